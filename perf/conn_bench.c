@@ -0,0 +1,195 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/clock.c"
+
+#if defined __linux__
+#include <unistd.h>
+#endif
+
+/*  Measures how fast connections can be set up and torn down against
+    a single listener, how long each one takes until the first message
+    gets through and how much memory an idle connection costs.
+
+    Each of the churn connections is a fresh socket that connects, sends
+    one message and closes. The time until the listener receives the
+    message covers the transport connect, the WebSocket handshake if any,
+    the protocol header exchange and the message itself. */
+
+static int cmp_sample (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*  Returns the resident set size of the process in bytes, or 0 if it can't
+    be determined on this platform. */
+static size_t rss (void)
+{
+#if defined __linux__
+    FILE *f;
+    unsigned long pages;
+    unsigned long resident;
+    int rc;
+
+    f = fopen ("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    rc = fscanf (f, "%lu %lu", &pages, &resident);
+    fclose (f);
+    if (rc != 2)
+        return 0;
+    return (size_t) resident * sysconf (_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+int main (int argc, char *argv [])
+{
+    const char *bind_to;
+    int conns;
+    int idle;
+    int s;
+    int c;
+    int rc;
+    int i;
+    int opt;
+    char buf [1];
+    uint64_t *samples;
+    uint64_t start;
+    uint64_t stop;
+    uint64_t t;
+    size_t before;
+    size_t after;
+    uint64_t allocated;
+
+    if (argc < 2 || argc > 4) {
+        printf ("usage: conn_bench <bind-to> [connections] "
+            "[idle-connections]\n");
+        return 1;
+    }
+    bind_to = argv [1];
+    conns = argc > 2 ? atoi (argv [2]) : 1000;
+    idle = argc > 3 ? atoi (argv [3]) : 100;
+    nn_assert (conns > 0 && idle >= 0);
+
+    samples = malloc (sizeof (uint64_t) * conns);
+    nn_assert (samples);
+
+    s = nn_socket (AF_SP, NN_PULL);
+    nn_assert (s != -1);
+    rc = nn_bind (s, bind_to);
+    nn_assert (rc >= 0);
+
+    /*  Connection churn. */
+    start = nn_clock_us ();
+    for (i = 0; i != conns; i++) {
+        t = nn_clock_us ();
+        c = nn_socket (AF_SP, NN_PUSH);
+        nn_assert (c != -1);
+        opt = 0;
+        rc = nn_setsockopt (c, NN_SOL_SOCKET, NN_LINGER, &opt, sizeof (opt));
+        nn_assert (rc == 0);
+        rc = nn_connect (c, bind_to);
+        nn_assert (rc >= 0);
+        rc = nn_send (c, "A", 1, 0);
+        nn_assert (rc == 1);
+        rc = nn_recv (s, buf, sizeof (buf), 0);
+        nn_assert (rc == 1);
+        samples [i] = nn_clock_us () - t;
+        rc = nn_close (c);
+        nn_assert (rc == 0);
+    }
+    stop = nn_clock_us ();
+    if (stop == start)
+        ++stop;
+
+    qsort (samples, conns, sizeof (uint64_t), cmp_sample);
+    printf ("connections: %d\n", conns);
+    printf ("connections per second: %d [1/s]\n",
+        (int) ((uint64_t) conns * 1000000 / (stop - start)));
+    printf ("p50 handshake: %d [us]\n", (int) samples [conns / 2]);
+    printf ("p99 handshake: %d [us]\n", (int) samples [conns * 99 / 100]);
+    printf ("max handshake: %d [us]\n", (int) samples [conns - 1]);
+
+    /*  Wait for the listener to dispose of the closed connections. */
+    for (i = 0; i != 1000; i++) {
+        if (nn_get_statistic (s, NN_STAT_CURRENT_CONNECTIONS) == 0)
+            break;
+        nn_sleep (10);
+    }
+    printf ("accepted connections: %d\n",
+        (int) nn_get_statistic (s, NN_STAT_ACCEPTED_CONNECTIONS));
+
+    /*  Idle connections. Both ends of each connection live in this process
+        so the memory figure covers the two of them. */
+    if (idle > 0) {
+        c = nn_socket (AF_SP, NN_PUSH);
+        nn_assert (c != -1);
+        before = rss ();
+        allocated = nn_get_statistic (s, NN_STAT_ALLOCATED_BYTES) +
+            nn_get_statistic (c, NN_STAT_ALLOCATED_BYTES);
+        for (i = 0; i != idle; i++) {
+            rc = nn_connect (c, bind_to);
+            nn_assert (rc >= 0);
+        }
+        for (i = 0; i != 1000; i++) {
+            if (nn_get_statistic (s, NN_STAT_CURRENT_CONNECTIONS) ==
+                  (uint64_t) idle)
+                break;
+            nn_sleep (10);
+        }
+        nn_assert (nn_get_statistic (s, NN_STAT_CURRENT_CONNECTIONS) ==
+            (uint64_t) idle);
+        after = rss ();
+        allocated = nn_get_statistic (s, NN_STAT_ALLOCATED_BYTES) +
+            nn_get_statistic (c, NN_STAT_ALLOCATED_BYTES) - allocated;
+        printf ("idle connections: %d\n", idle);
+        printf ("allocated per idle connection: %d [B]\n",
+            (int) (allocated / idle));
+        if (before && after > before)
+            printf ("memory per idle connection: %d [B]\n",
+                (int) ((after - before) / idle));
+        else
+            printf ("memory per idle connection: unknown\n");
+        rc = nn_close (c);
+        nn_assert (rc == 0);
+    }
+
+    free (samples);
+    rc = nn_close (s);
+    nn_assert (rc == 0);
+
+    return 0;
+}
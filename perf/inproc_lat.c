@@ -37,6 +37,7 @@
 
 static size_t message_size;
 static int roundtrip_count;
+static int rcvspin;
 
 void worker (NN_UNUSED void *arg)
 {
@@ -47,6 +48,9 @@ void worker (NN_UNUSED void *arg)
 
     s = nn_socket (AF_SP, NN_PAIR);
     assert (s != -1);
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &rcvspin,
+        sizeof (rcvspin));
+    assert (rc == 0);
     rc = nn_connect (s, "inproc://inproc_lat");
     assert (rc >= 0);
 
@@ -61,6 +65,10 @@ void worker (NN_UNUSED void *arg)
     }
 
     free (buf);
+
+    /*  Closing the socket drops the last reply if it's still in flight,
+        so stick around till it's received. */
+    nn_sleep (100);
     rc = nn_close (s);
     assert (rc == 0);
 }
@@ -76,16 +84,21 @@ int main (int argc, char *argv [])
     uint64_t elapsed;
     double latency;
 
-    if (argc != 3) {
-        printf ("usage: inproc_lat <message-size> <roundtrip-count>\n");
+    if (argc != 3 && argc != 4) {
+        printf ("usage: inproc_lat <message-size> <roundtrip-count> "
+            "[rcvspin-us]\n");
         return 1;
     }
 
     message_size = atoi (argv [1]);
     roundtrip_count = atoi (argv [2]);
+    rcvspin = argc == 4 ? atoi (argv [3]) : 0;
 
     s = nn_socket (AF_SP, NN_PAIR);
     assert (s != -1);
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &rcvspin,
+        sizeof (rcvspin));
+    assert (rc == 0);
     rc = nn_bind (s, "inproc://inproc_lat");
     assert (rc >= 0);
 
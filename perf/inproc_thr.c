@@ -61,6 +61,11 @@ void worker (NN_UNUSED void *arg)
         assert (rc == (int)message_size);
     }
 
+    /*  Messages still queued are dropped when the socket is closed, so wait
+        till the peer confirms it got all of them. */
+    rc = nn_recv (s, buf, message_size, 0);
+    assert (rc == 0);
+
     free (buf);
     rc = nn_close (s);
     assert (rc == 0);
@@ -109,6 +114,9 @@ int main (int argc, char *argv [])
 
     elapsed = nn_stopwatch_term (&stopwatch);
 
+    rc = nn_send (s, NULL, 0, 0);
+    assert (rc == 0);
+
     nn_thread_term (&thread);
     free (buf);
     rc = nn_close (s);
@@ -44,14 +44,19 @@ int main (int argc, char *argv [])
     int i;
     int opt;
 
-    if (argc != 4) {
-        printf ("usage: local_lat <bind-to> <msg-size> <roundtrips>\n");
+    if (argc < 4 || argc > 6) {
+        printf ("usage: local_lat <bind-to> <msg-size> <roundtrips> "
+            "[rcvspin-us] [warmup-roundtrips]\n");
         return 1;
     }
     bind_to = argv [1];
     sz = atoi (argv [2]);
     rts = atoi (argv [3]);
 
+    /*  The warm-up roundtrips have to be answered as well. */
+    if (argc > 5)
+        rts += atoi (argv [5]);
+
     s = nn_socket (AF_SP, NN_PAIR);
     nn_assert (s != -1);
     opt = 1;
@@ -60,6 +65,11 @@ int main (int argc, char *argv [])
     opt = -1;
     rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
     nn_assert (rc == 0);
+    if (argc > 4) {
+        opt = atoi (argv [4]);
+        rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &opt, sizeof (opt));
+        nn_assert (rc == 0);
+    }
     opt = 1000;
     rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_LINGER, &opt, sizeof (opt));
     nn_assert (rc == 0);
@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/utils/stopwatch.c"
+#include "../src/utils/err.c"
+
+/*  Receiving side of remote_mthr. Messages from all the senders are
+    fair-queued into a single PULL socket. */
+
+int main (int argc, char *argv [])
+{
+    const char *bind_to;
+    size_t sz;
+    int count;
+    int threads;
+    char *buf;
+    int nbytes;
+    int s;
+    int rc;
+    int i;
+    int opt;
+    struct nn_stopwatch sw;
+    uint64_t total;
+    uint64_t thr;
+    double mbs;
+
+    if (argc != 5) {
+        printf ("usage: local_mthr <bind-to> <msg-size> <msg-count> "
+            "<threads>\n");
+        return 1;
+    }
+    bind_to = argv [1];
+    sz = atoi (argv [2]);
+    count = atoi (argv [3]);
+    threads = atoi (argv [4]);
+    nn_assert (sz > 0 && threads > 0);
+
+    s = nn_socket (AF_SP, NN_PULL);
+    nn_assert (s != -1);
+    rc = nn_bind (s, bind_to);
+    nn_assert (rc >= 0);
+
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+
+    buf = malloc (sz);
+    nn_assert (buf);
+
+    /*  Each sender thread starts with an empty message. Measurement starts
+        with the first one to arrive; the rest are skipped. */
+    nbytes = nn_recv (s, buf, sz, 0);
+    nn_assert (nbytes == 0);
+
+    count *= threads;
+    nn_stopwatch_init (&sw);
+    for (i = 0; i != count; i++) {
+        nbytes = nn_recv (s, buf, sz, 0);
+        nn_assert (nbytes >= 0);
+        if (nbytes == 0) {
+            --i;
+            continue;
+        }
+        nn_assert (nbytes == (int)sz);
+    }
+    total = nn_stopwatch_term (&sw);
+    if (total == 0)
+        total = 1;
+
+    thr = (uint64_t) ((double) count / (double) total * 1000000);
+    mbs = (double) (thr * sz * 8) / 1000000;
+
+    printf ("message size: %d [B]\n", (int) sz);
+    printf ("message count: %d\n", (int) count);
+    printf ("sender threads: %d\n", (int) threads);
+    printf ("throughput: %d [msg/s]\n", (int) thr);
+    printf ("throughput: %.3f [Mb/s]\n", (double) mbs);
+
+    free (buf);
+
+    rc = nn_close (s);
+    nn_assert (rc == 0);
+
+    return 0;
+}
@@ -0,0 +1,583 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+#include "../src/pubsub.h"
+#include "../src/reqrep.h"
+#include "../src/survey.h"
+#include "../src/bus.h"
+
+#include "../src/utils/attr.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/clock.c"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Runs the messaging patterns over the transports with a range of message
+    sizes and peer counts, one thread per peer, and prints one line of
+    comma-separated results per run. Each message carries the time it was
+    sent in its first bytes; the receiving side records how long it took
+    to get there (for REQ/REP and SURVEY, the whole roundtrip). */
+
+#define PROTO_BENCH_MAXPEERS 64
+
+/*  Time to wait for the connections to be established before measuring. */
+#define PROTO_BENCH_SETTLE 200
+
+/*  Patterns that may drop messages stop waiting for more after this
+    long (in milliseconds). */
+#define PROTO_BENCH_LOSSY_TIMEO 1000
+
+/*  What a thread does with its socket. */
+#define PROTO_BENCH_SEND 1
+#define PROTO_BENCH_RECV 2
+#define PROTO_BENCH_REQ 3
+#define PROTO_BENCH_REP 4
+#define PROTO_BENCH_SURVEY 5
+#define PROTO_BENCH_RESPOND 6
+
+struct proto_bench_peer {
+    int s;
+    int role;
+
+    /*  Number of messages to send, to receive or roundtrips to do. */
+    int count;
+
+    /*  Number of responses expected per survey. */
+    int responses;
+
+    size_t size;
+    struct nn_thread thread;
+
+    /*  Results. Latencies are in microseconds. */
+    int received;
+    uint64_t first;
+    uint64_t last;
+    uint64_t *samples;
+};
+
+static const char *patterns [] = {"pipeline", "pubsub", "reqrep", "survey",
+    "bus", NULL};
+static const char *transports [] = {"inproc", "ipc", "tcp", "ws", NULL};
+static const size_t sizes [] = {64, 1024, 16384, 0};
+static const int peercounts [] = {1, 4, 0};
+
+/*  Every endpoint gets an address of its own so that runs don't step on
+    each other's toes. */
+static int addr_seq;
+
+static void proto_bench_addr (char *buf, size_t len, const char *transport)
+{
+    ++addr_seq;
+    if (strcmp (transport, "inproc") == 0)
+        snprintf (buf, len, "inproc://proto_bench_%d", addr_seq);
+    else if (strcmp (transport, "ipc") == 0)
+        snprintf (buf, len, "ipc://proto_bench_%d.ipc", addr_seq);
+    else
+        snprintf (buf, len, "%s://127.0.0.1:%d", transport,
+            15000 + addr_seq % 10000);
+}
+
+static void proto_bench_stamp (char *buf)
+{
+    uint64_t now;
+
+    now = nn_clock_us ();
+    memcpy (buf, &now, sizeof (now));
+}
+
+static void proto_bench_record (struct proto_bench_peer *self,
+    const char *buf)
+{
+    uint64_t now;
+    uint64_t sent;
+
+    now = nn_clock_us ();
+    memcpy (&sent, buf, sizeof (sent));
+    if (!self->received)
+        self->first = now;
+    self->last = now;
+    self->samples [self->received++] = now - sent;
+}
+
+static void proto_bench_worker (void *arg)
+{
+    struct proto_bench_peer *self;
+    char *buf;
+    int rc;
+    int i;
+    int j;
+
+    self = (struct proto_bench_peer*) arg;
+    buf = malloc (self->size);
+    assert (buf);
+    memset (buf, 111, self->size);
+
+    switch (self->role) {
+    case PROTO_BENCH_SEND:
+        for (i = 0; i != self->count; ++i) {
+            proto_bench_stamp (buf);
+            rc = nn_send (self->s, buf, self->size, 0);
+            assert (rc == (int) self->size);
+        }
+        break;
+    case PROTO_BENCH_RECV:
+        for (i = 0; i != self->count; ++i) {
+            rc = nn_recv (self->s, buf, self->size, 0);
+            if (rc < 0 && nn_errno () == ETIMEDOUT)
+                break;
+            assert (rc == (int) self->size);
+            proto_bench_record (self, buf);
+        }
+        break;
+    case PROTO_BENCH_REQ:
+        for (i = 0; i != self->count; ++i) {
+            proto_bench_stamp (buf);
+            rc = nn_send (self->s, buf, self->size, 0);
+            assert (rc == (int) self->size);
+            rc = nn_recv (self->s, buf, self->size, 0);
+            assert (rc == (int) self->size);
+            proto_bench_record (self, buf);
+        }
+        break;
+    case PROTO_BENCH_SURVEY:
+        for (i = 0; i != self->count; ++i) {
+            proto_bench_stamp (buf);
+            rc = nn_send (self->s, buf, self->size, 0);
+            assert (rc == (int) self->size);
+            for (j = 0; j != self->responses; ++j) {
+                rc = nn_recv (self->s, buf, self->size, 0);
+                if (rc < 0 && nn_errno () == ETIMEDOUT)
+                    break;
+                assert (rc == (int) self->size);
+                proto_bench_record (self, buf);
+            }
+        }
+        break;
+    case PROTO_BENCH_REP:
+    case PROTO_BENCH_RESPOND:
+
+        /*  Echo the messages till the socket is closed. */
+        while (1) {
+            rc = nn_recv (self->s, buf, self->size, 0);
+            if (rc < 0)
+                break;
+            rc = nn_send (self->s, buf, rc, 0);
+            if (rc < 0)
+                break;
+        }
+        break;
+    default:
+        assert (0);
+    }
+
+    free (buf);
+}
+
+static int proto_bench_cmp (const void *a, const void *b)
+{
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t*) a;
+    y = *(const uint64_t*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double proto_bench_pct (uint64_t *samples, size_t n, double pct)
+{
+    size_t i;
+
+    if (!n)
+        return 0;
+    i = (size_t) (pct / 100 * (double) n);
+    if (i >= n)
+        i = n - 1;
+    return (double) samples [i];
+}
+
+static int proto_bench_socket (int protocol)
+{
+    int s;
+
+    s = nn_socket (AF_SP, protocol);
+    assert (s >= 0);
+    return s;
+}
+
+static void proto_bench_bind (int s, const char *addr)
+{
+    int rc;
+
+    rc = nn_bind (s, addr);
+    assert (rc >= 0);
+}
+
+static void proto_bench_connect (int s, const char *addr)
+{
+    int rc;
+
+    rc = nn_connect (s, addr);
+    assert (rc >= 0);
+}
+
+static void proto_bench_timeo (int s)
+{
+    int rc;
+    int timeo;
+
+    timeo = PROTO_BENCH_LOSSY_TIMEO;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+        sizeof (timeo));
+    assert (rc == 0);
+}
+
+/*  Sets up the peers of the pattern, connected over the transport. Returns
+    the number of peers. */
+static int proto_bench_setup (struct proto_bench_peer *peers,
+    const char *pattern, const char *transport, int npeers, int count)
+{
+    char addr [128];
+    int server;
+    int n;
+    int i;
+    int j;
+    int rc;
+    int deadline;
+    int nodes [PROTO_BENCH_MAXPEERS];
+
+    n = 0;
+    proto_bench_addr (addr, sizeof (addr), transport);
+    memset (peers, 0, sizeof (struct proto_bench_peer) *
+        2 * PROTO_BENCH_MAXPEERS);
+
+    if (strcmp (pattern, "pipeline") == 0) {
+
+        /*  Fan-in: the producers share the messages evenly. */
+        server = proto_bench_socket (NN_PULL);
+        proto_bench_bind (server, addr);
+        peers [n].s = server;
+        peers [n].role = PROTO_BENCH_RECV;
+        peers [n].count = count / npeers * npeers;
+        ++n;
+        for (i = 0; i != npeers; ++i) {
+            peers [n].s = proto_bench_socket (NN_PUSH);
+            proto_bench_connect (peers [n].s, addr);
+            peers [n].role = PROTO_BENCH_SEND;
+            peers [n].count = count / npeers;
+            ++n;
+        }
+    }
+    else if (strcmp (pattern, "pubsub") == 0) {
+
+        /*  Fan-out: every subscriber gets every message, unless it's too
+            slow to keep up and the messages get dropped. */
+        server = proto_bench_socket (NN_PUB);
+        proto_bench_bind (server, addr);
+        peers [n].s = server;
+        peers [n].role = PROTO_BENCH_SEND;
+        peers [n].count = count;
+        ++n;
+        for (i = 0; i != npeers; ++i) {
+            peers [n].s = proto_bench_socket (NN_SUB);
+            rc = nn_setsockopt (peers [n].s, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+            assert (rc == 0);
+            proto_bench_timeo (peers [n].s);
+            proto_bench_connect (peers [n].s, addr);
+            peers [n].role = PROTO_BENCH_RECV;
+            peers [n].count = count;
+            ++n;
+        }
+    }
+    else if (strcmp (pattern, "reqrep") == 0) {
+        server = proto_bench_socket (NN_REP);
+        proto_bench_bind (server, addr);
+        peers [n].s = server;
+        peers [n].role = PROTO_BENCH_REP;
+        ++n;
+        for (i = 0; i != npeers; ++i) {
+            peers [n].s = proto_bench_socket (NN_REQ);
+            proto_bench_connect (peers [n].s, addr);
+            peers [n].role = PROTO_BENCH_REQ;
+            peers [n].count = count / npeers;
+            ++n;
+        }
+    }
+    else if (strcmp (pattern, "survey") == 0) {
+
+        /*  Each survey is answered by all the respondents. */
+        server = proto_bench_socket (NN_SURVEYOR);
+        deadline = PROTO_BENCH_LOSSY_TIMEO;
+        rc = nn_setsockopt (server, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+            &deadline, sizeof (deadline));
+        assert (rc == 0);
+        proto_bench_bind (server, addr);
+        peers [n].s = server;
+        peers [n].role = PROTO_BENCH_SURVEY;
+        peers [n].count = count / npeers;
+        peers [n].responses = npeers;
+        ++n;
+        for (i = 0; i != npeers; ++i) {
+            peers [n].s = proto_bench_socket (NN_RESPONDENT);
+            proto_bench_connect (peers [n].s, addr);
+            peers [n].role = PROTO_BENCH_RESPOND;
+            ++n;
+        }
+    }
+    else if (strcmp (pattern, "bus") == 0) {
+
+        /*  Full mesh of nodes, each sending its share of the messages to
+            all the others. Every node has a sending and a receiving
+            thread. */
+        if (npeers < 2)
+            npeers = 2;
+        for (i = 0; i != npeers; ++i) {
+            nodes [i] = proto_bench_socket (NN_BUS);
+            proto_bench_timeo (nodes [i]);
+            if (i)
+                proto_bench_addr (addr, sizeof (addr), transport);
+            proto_bench_bind (nodes [i], addr);
+            for (j = 0; j != i; ++j)
+                proto_bench_connect (nodes [j], addr);
+        }
+        for (i = 0; i != npeers; ++i) {
+            peers [n].s = nodes [i];
+            peers [n].role = PROTO_BENCH_SEND;
+            peers [n].count = count / npeers;
+            ++n;
+            peers [n].s = nodes [i];
+            peers [n].role = PROTO_BENCH_RECV;
+            peers [n].count = count / npeers * (npeers - 1);
+            ++n;
+        }
+    }
+    else {
+        return -1;
+    }
+
+    return n;
+}
+
+static void proto_bench_run (const char *pattern, const char *transport,
+    size_t size, int npeers, int count)
+{
+    static struct proto_bench_peer peers [2 * PROTO_BENCH_MAXPEERS];
+    int n;
+    int i;
+    int rc;
+    int received;
+    uint64_t first;
+    uint64_t last;
+    uint64_t *samples;
+    size_t nsamples;
+    double elapsed;
+    double msgs;
+
+    n = proto_bench_setup (peers, pattern, transport, npeers, count);
+    if (n < 0) {
+        fprintf (stderr, "unknown pattern: %s\n", pattern);
+        exit (1);
+    }
+    for (i = 0; i != n; ++i) {
+        peers [i].size = size;
+        if (peers [i].role == PROTO_BENCH_RECV ||
+              peers [i].role == PROTO_BENCH_REQ ||
+              peers [i].role == PROTO_BENCH_SURVEY) {
+            peers [i].samples = malloc (sizeof (uint64_t) *
+                (peers [i].count * (peers [i].responses ?
+                peers [i].responses : 1) + 1));
+            assert (peers [i].samples);
+        }
+    }
+
+    /*  Give the connections time to get established, then let go. */
+    nn_sleep (PROTO_BENCH_SETTLE);
+    for (i = 0; i != n; ++i)
+        nn_thread_init (&peers [i].thread, proto_bench_worker, &peers [i]);
+
+    /*  The echoing peers run till their sockets are closed. */
+    for (i = 0; i != n; ++i)
+        if (peers [i].role != PROTO_BENCH_REP &&
+              peers [i].role != PROTO_BENCH_RESPOND)
+            nn_thread_term (&peers [i].thread);
+    for (i = 0; i != n; ++i) {
+        if (i && peers [i].s == peers [i - 1].s)
+            continue;
+        rc = nn_close (peers [i].s);
+        assert (rc == 0);
+    }
+    for (i = 0; i != n; ++i)
+        if (peers [i].role == PROTO_BENCH_REP ||
+              peers [i].role == PROTO_BENCH_RESPOND)
+            nn_thread_term (&peers [i].thread);
+
+    /*  Merge the results of all the receiving peers. */
+    received = 0;
+    first = (uint64_t) -1;
+    last = 0;
+    nsamples = 0;
+    for (i = 0; i != n; ++i) {
+        if (!peers [i].samples || !peers [i].received)
+            continue;
+        received += peers [i].received;
+        if (peers [i].first < first)
+            first = peers [i].first;
+        if (peers [i].last > last)
+            last = peers [i].last;
+    }
+    samples = malloc (sizeof (uint64_t) * (received + 1));
+    assert (samples);
+    for (i = 0; i != n; ++i) {
+        if (!peers [i].samples)
+            continue;
+        memcpy (samples + nsamples, peers [i].samples,
+            sizeof (uint64_t) * peers [i].received);
+        nsamples += peers [i].received;
+        free (peers [i].samples);
+    }
+    qsort (samples, nsamples, sizeof (uint64_t), proto_bench_cmp);
+
+    elapsed = received > 1 ? (double) (last - first) / 1000000 : 0;
+    msgs = elapsed > 0 ? (double) received / elapsed : 0;
+    printf ("%s,%s,%d,%d,%d,%.0f,%.3f,%.0f,%.0f,%.0f\n", pattern, transport,
+        (int) size, npeers, received, msgs, msgs * (double) size / 1000000,
+        proto_bench_pct (samples, nsamples, 50),
+        proto_bench_pct (samples, nsamples, 99),
+        proto_bench_pct (samples, nsamples, 99.9));
+    fflush (stdout);
+    free (samples);
+}
+
+/*  Returns 1 if 'item' is in the comma-separated 'list', or if the list
+    is "all". */
+static int proto_bench_selected (const char *list, const char *item)
+{
+    size_t len;
+    const char *pos;
+
+    if (strcmp (list, "all") == 0)
+        return 1;
+    len = strlen (item);
+    pos = list;
+    while (1) {
+        if (strncmp (pos, item, len) == 0 &&
+              (pos [len] == ',' || pos [len] == 0))
+            return 1;
+        pos = strchr (pos, ',');
+        if (!pos)
+            return 0;
+        ++pos;
+    }
+}
+
+/*  Parses a comma-separated list of numbers, or returns the defaults if it
+    is "all". The list is terminated by zero. */
+static void proto_bench_numbers (const char *list, int *out, int max,
+    const int *defaults)
+{
+    int i;
+    const char *pos;
+
+    if (strcmp (list, "all") == 0) {
+        for (i = 0; defaults [i]; ++i)
+            out [i] = defaults [i];
+        out [i] = 0;
+        return;
+    }
+    pos = list;
+    for (i = 0; i != max - 1 && pos; ++i) {
+        out [i] = atoi (pos);
+        pos = strchr (pos, ',');
+        if (pos)
+            ++pos;
+    }
+    out [i] = 0;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *patternlist;
+    const char *transportlist;
+    int sizelist [16];
+    int peerlist [16];
+    int defsizes [16];
+    int count;
+    int p;
+    int t;
+    int s;
+    int n;
+
+    if (argc > 6) {
+        printf ("usage: proto_bench [patterns] [transports] [message-sizes] "
+            "[peers] [message-count]\n");
+        return 1;
+    }
+    patternlist = argc > 1 ? argv [1] : "all";
+    transportlist = argc > 2 ? argv [2] : "all";
+    for (s = 0; sizes [s]; ++s)
+        defsizes [s] = (int) sizes [s];
+    defsizes [s] = 0;
+    proto_bench_numbers (argc > 3 ? argv [3] : "all", sizelist, 16, defsizes);
+    proto_bench_numbers (argc > 4 ? argv [4] : "all", peerlist, 16,
+        peercounts);
+    count = argc > 5 ? atoi (argv [5]) : 10000;
+
+    for (s = 0; sizelist [s]; ++s) {
+        if (sizelist [s] < (int) sizeof (uint64_t)) {
+            fprintf (stderr, "message size must be at least %d bytes\n",
+                (int) sizeof (uint64_t));
+            return 1;
+        }
+    }
+    for (n = 0; peerlist [n]; ++n) {
+        if (peerlist [n] < 1 || peerlist [n] > PROTO_BENCH_MAXPEERS) {
+            fprintf (stderr, "number of peers must be between 1 and %d\n",
+                PROTO_BENCH_MAXPEERS);
+            return 1;
+        }
+    }
+
+    printf ("pattern,transport,size,peers,messages,msgs_per_sec,"
+        "mb_per_sec,p50_us,p99_us,p999_us\n");
+    for (p = 0; patterns [p]; ++p) {
+        if (!proto_bench_selected (patternlist, patterns [p]))
+            continue;
+        for (t = 0; transports [t]; ++t) {
+            if (!proto_bench_selected (transportlist, transports [t]))
+                continue;
+            for (s = 0; sizelist [s]; ++s)
+                for (n = 0; peerlist [n]; ++n)
+                    proto_bench_run (patterns [p], transports [t],
+                        (size_t) sizelist [s], peerlist [n], count);
+        }
+    }
+
+    return 0;
+}
@@ -29,32 +29,64 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "../src/utils/stopwatch.c"
+#include "../src/utils/clock.c"
 #include "../src/utils/err.c"
 
+static int cmp_rtt (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void print_pct (const char *name, uint64_t *rtts, int n, double pct)
+{
+    int i;
+
+    i = (int) (pct / 100 * n);
+    if (i >= n)
+        i = n - 1;
+    printf ("%s roundtrip: %d [us]\n", name, (int) rtts [i]);
+}
+
 int main (int argc, char *argv [])
 {
     const char *connect_to;
     size_t sz;
     int rts;
+    int warmup;
+    int rate;
     char *buf;
     int nbytes;
     int s;
     int rc;
     int i;
     int opt;
-    struct nn_stopwatch sw;
     uint64_t total;
     double lat;
-
-
-    if (argc != 4) {
-        printf ("usage: remote_lat <connect-to> <msg-size> <roundtrips>\n");
+    uint64_t *rtts;
+    uint64_t start;
+    uint64_t sent;
+    uint64_t now;
+
+    if (argc < 4 || argc > 7) {
+        printf ("usage: remote_lat <connect-to> <msg-size> <roundtrips> "
+            "[rcvspin-us] [warmup-roundtrips] [roundtrips-per-sec]\n");
         return 1;
     }
     connect_to = argv [1];
     sz = atoi (argv [2]);
     rts = atoi (argv [3]);
+    warmup = argc > 5 ? atoi (argv [5]) : 0;
+    rate = argc > 6 ? atoi (argv [6]) : 0;
+    if (rts < 1) {
+        printf ("roundtrips must be at least 1\n");
+        return 1;
+    }
+
+    rtts = malloc (sizeof (uint64_t) * rts);
+    nn_assert (rtts);
 
     s = nn_socket (AF_SP, NN_PAIR);
     nn_assert (s != -1);
@@ -64,6 +96,11 @@ int main (int argc, char *argv [])
     opt = -1;
     rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
     nn_assert (rc == 0);
+    if (argc > 4) {
+        opt = atoi (argv [4]);
+        rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &opt, sizeof (opt));
+        nn_assert (rc == 0);
+    }
     rc = nn_connect (s, connect_to);
     nn_assert (rc >= 0);
 
@@ -71,20 +108,54 @@ int main (int argc, char *argv [])
     nn_assert (buf);
     memset (buf, 111, sz);
 
-    nn_stopwatch_init (&sw);
+    /*  Let the connection, the caches and the allocator settle before
+        measuring anything. */
+    for (i = 0; i != warmup; i++) {
+        nbytes = nn_send (s, buf, sz, 0);
+        nn_assert (nbytes == (int)sz);
+        nbytes = nn_recv (s, buf, sz, 0);
+        nn_assert (nbytes == (int)sz);
+    }
+
+    /*  With a fixed rate, each roundtrip is due at a fixed point in time and
+        its latency is measured from there rather than from when it was
+        actually sent. That way a stall is accounted for in the roundtrips
+        that had to wait for it as well, not only in the stalled one. */
+    total = 0;
+    start = nn_clock_us ();
     for (i = 0; i != rts; i++) {
+        if (rate > 0) {
+            sent = start + (uint64_t) i * 1000000 / rate;
+            while (nn_clock_us () < sent)
+                ;
+        }
+        else
+            sent = nn_clock_us ();
         nbytes = nn_send (s, buf, sz, 0);
         nn_assert (nbytes == (int)sz);
         nbytes = nn_recv (s, buf, sz, 0);
         nn_assert (nbytes == (int)sz);
+        now = nn_clock_us ();
+        rtts [i] = now - sent;
+        total += rtts [i];
     }
-    total = nn_stopwatch_term (&sw);
 
     lat = (double) total / (rts * 2);
     printf ("message size: %d [B]\n", (int) sz);
     printf ("roundtrip count: %d\n", (int) rts);
+    if (rate > 0)
+        printf ("roundtrip rate: %d [1/s]\n", rate);
     printf ("average latency: %.3f [us]\n", (double) lat);
 
+    qsort (rtts, rts, sizeof (uint64_t), cmp_rtt);
+    printf ("min roundtrip: %d [us]\n", (int) rtts [0]);
+    print_pct ("p50", rtts, rts, 50);
+    print_pct ("p90", rtts, rts, 90);
+    print_pct ("p99", rtts, rts, 99);
+    print_pct ("p99.9", rtts, rts, 99.9);
+    printf ("max roundtrip: %d [us]\n", (int) rtts [rts - 1]);
+
+    free (rtts);
     free (buf);
 
     rc = nn_close (s);
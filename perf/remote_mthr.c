@@ -0,0 +1,139 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/thread.c"
+
+/*  Sends messages to local_mthr from several threads at once. By default
+    each thread has a socket and a connection of its own; in "shared" mode
+    all the threads send through the same socket. */
+
+struct remote_mthr_sender {
+    struct nn_thread thread;
+    int s;
+    size_t sz;
+    int count;
+};
+
+static void remote_mthr_worker (void *arg)
+{
+    struct remote_mthr_sender *self;
+    char *buf;
+    int nbytes;
+    int i;
+
+    self = (struct remote_mthr_sender*) arg;
+
+    buf = malloc (self->sz);
+    nn_assert (buf);
+    memset (buf, 111, self->sz);
+
+    nbytes = nn_send (self->s, buf, 0, 0);
+    nn_assert (nbytes == 0);
+
+    for (i = 0; i != self->count; i++) {
+        nbytes = nn_send (self->s, buf, self->sz, 0);
+        nn_assert (nbytes == (int)self->sz);
+    }
+
+    free (buf);
+}
+
+static int remote_mthr_socket (const char *connect_to)
+{
+    int s;
+    int rc;
+    int opt;
+
+    s = nn_socket (AF_SP, NN_PUSH);
+    nn_assert (s != -1);
+    rc = nn_connect (s, connect_to);
+    nn_assert (rc >= 0);
+
+    opt = 1000;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_LINGER, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+
+    return s;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *connect_to;
+    size_t sz;
+    int count;
+    int threads;
+    int shared;
+    struct remote_mthr_sender *senders;
+    int rc;
+    int i;
+
+    if (argc != 5 && argc != 6) {
+        printf ("usage: remote_mthr <connect-to> <msg-size> <msg-count> "
+            "<threads> [shared]\n");
+        return 1;
+    }
+    connect_to = argv [1];
+    sz = atoi (argv [2]);
+    count = atoi (argv [3]);
+    threads = atoi (argv [4]);
+    shared = argc == 6 && strcmp (argv [5], "shared") == 0;
+    nn_assert (sz > 0 && threads > 0);
+
+    senders = malloc (sizeof (struct remote_mthr_sender) * threads);
+    nn_assert (senders);
+    for (i = 0; i != threads; i++) {
+        senders [i].s = shared && i > 0 ? senders [0].s :
+            remote_mthr_socket (connect_to);
+        senders [i].sz = sz;
+        senders [i].count = count;
+    }
+
+    /*  Give all the connections a chance to get established so that
+        the load is spread evenly from the beginning. */
+    nn_sleep (100);
+
+    for (i = 0; i != threads; i++)
+        nn_thread_init (&senders [i].thread, remote_mthr_worker,
+            &senders [i]);
+    for (i = 0; i != threads; i++)
+        nn_thread_term (&senders [i].thread);
+
+    /*  Linger doesn't always do the trick, so sleep a bit to be sure. */
+    nn_sleep (1000);
+
+    for (i = 0; i != (shared ? 1 : threads); i++) {
+        rc = nn_close (senders [i].s);
+        nn_assert (rc == 0);
+    }
+    free (senders);
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/protocols/pubsub/trie.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/err.c"
+#include "../src/utils/clock.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Measures the speed of subscribing, matching and unsubscribing with the
+    trie used by SUB sockets, and the memory it takes. The topics are
+    produced by a fixed pseudo-random sequence, so that runs are repeatable
+    and can be compared across changes of the trie layout.
+
+    Half of the matched topics extend one of the subscriptions and thus
+    match, the others are fresh topics of the same kind, which mostly
+    don't. As the trie builds a flattened copy of itself once it has been
+    matched against often enough, the matching is timed after a warm-up. */
+
+static const char *topicsets [] = {"hier", "text", "binary", NULL};
+static const int subcounts [] = {1000, 10000, 100000, 1000000, 0};
+
+#define TRIE_BENCH_MAXTOPIC 48
+
+struct trie_bench_topics {
+    uint8_t *data;
+    size_t *offsets;
+    size_t *sizes;
+    int count;
+};
+
+static uint64_t trie_bench_state;
+
+static uint32_t trie_bench_random (void)
+{
+    /*  xorshift64*  */
+    trie_bench_state ^= trie_bench_state >> 12;
+    trie_bench_state ^= trie_bench_state << 25;
+    trie_bench_state ^= trie_bench_state >> 27;
+    return (uint32_t) ((trie_bench_state * 2685821657736338717ULL) >> 32);
+}
+
+/*  Generates a topic of the given kind into 'buf' and returns its size.
+    "hier" topics are dot-separated paths sharing long prefixes, "text"
+    are random lowercase strings and "binary" are random bytes, including
+    zeros. */
+static size_t trie_bench_topic (const char *set, uint8_t *buf)
+{
+    size_t size;
+    size_t i;
+
+    if (strcmp (set, "hier") == 0) {
+        return (size_t) sprintf ((char*) buf, "md.%u.%u.%u.%05u",
+            trie_bench_random () % 4, trie_bench_random () % 16,
+            trie_bench_random () % 64, trie_bench_random () % 100000);
+    }
+    if (strcmp (set, "text") == 0) {
+        size = 8 + trie_bench_random () % 17;
+        for (i = 0; i != size; ++i)
+            buf [i] = (uint8_t) ('a' + trie_bench_random () % 26);
+        return size;
+    }
+    size = 4 + trie_bench_random () % 9;
+    for (i = 0; i != size; ++i)
+        buf [i] = (uint8_t) trie_bench_random ();
+    return size;
+}
+
+static void trie_bench_topics_init (struct trie_bench_topics *self, int count)
+{
+    if (count < 1)
+        count = 1;
+    self->data = malloc ((size_t) count * TRIE_BENCH_MAXTOPIC);
+    alloc_assert (self->data);
+    self->offsets = malloc ((size_t) count * sizeof (size_t));
+    alloc_assert (self->offsets);
+    self->sizes = malloc ((size_t) count * sizeof (size_t));
+    alloc_assert (self->sizes);
+    self->count = count;
+}
+
+static void trie_bench_topics_term (struct trie_bench_topics *self)
+{
+    free (self->sizes);
+    free (self->offsets);
+    free (self->data);
+}
+
+static void trie_bench_run (const char *set, int nsubs, int nmatches)
+{
+    struct trie_bench_topics subs;
+    struct trie_bench_topics topics;
+    struct nn_trie trie;
+    struct nn_alloc_acct *acct;
+    struct nn_alloc_acct *prevacct;
+    uint8_t *pos;
+    size_t j;
+    size_t treebytes;
+    size_t totalbytes;
+    uint64_t start;
+    uint64_t subtime;
+    uint64_t matchtime;
+    uint64_t unsubtime;
+    uint64_t bulktime;
+    struct nn_trie_str *strs;
+    int warmup;
+    int matched;
+    int unique;
+    int i;
+
+    trie_bench_state = 0x9e3779b97f4a7c15ULL;
+
+    /*  Prepare the subscriptions and the topics to match in advance, so that
+        generating them doesn't count against the trie. */
+    trie_bench_topics_init (&subs, nsubs);
+    pos = subs.data;
+    for (i = 0; i != nsubs; ++i) {
+        subs.offsets [i] = pos - subs.data;
+        subs.sizes [i] = trie_bench_topic (set, pos);
+        pos += subs.sizes [i];
+    }
+    trie_bench_topics_init (&topics, nmatches);
+    pos = topics.data;
+    for (i = 0; i != nmatches; ++i) {
+        topics.offsets [i] = pos - topics.data;
+        if (trie_bench_random () & 1) {
+            j = trie_bench_random () % (uint32_t) nsubs;
+            memcpy (pos, subs.data + subs.offsets [j], subs.sizes [j]);
+            topics.sizes [i] = subs.sizes [j];
+            topics.sizes [i] += sprintf ((char*) pos + topics.sizes [i],
+                ".%u", trie_bench_random () % 1000);
+        }
+        else
+            topics.sizes [i] = trie_bench_topic (set, pos);
+        pos += topics.sizes [i];
+    }
+
+    /*  The memory taken by the trie is found out by charging it to
+        an account of its own. */
+    acct = nn_alloc_acct_create ();
+    alloc_assert (acct);
+    prevacct = nn_alloc_acct_select (acct);
+
+    nn_trie_init (&trie);
+    unique = 0;
+    start = nn_clock_us ();
+    for (i = 0; i != nsubs; ++i)
+        unique += nn_trie_subscribe (&trie, subs.data + subs.offsets [i],
+            subs.sizes [i]);
+    subtime = nn_clock_us () - start;
+    treebytes = nn_alloc_acct_bytes (acct);
+
+    warmup = nmatches / 10;
+    for (i = 0; i != warmup; ++i)
+        nn_trie_match (&trie, topics.data + topics.offsets [i],
+            topics.sizes [i]);
+    matched = 0;
+    start = nn_clock_us ();
+    for (i = warmup; i != nmatches; ++i)
+        matched += nn_trie_match (&trie, topics.data + topics.offsets [i],
+            topics.sizes [i]);
+    matchtime = nn_clock_us () - start;
+    totalbytes = nn_alloc_acct_bytes (acct);
+
+    start = nn_clock_us ();
+    for (i = 0; i != nsubs; ++i)
+        nn_trie_unsubscribe (&trie, subs.data + subs.offsets [i],
+            subs.sizes [i]);
+    unsubtime = nn_clock_us () - start;
+
+    nn_trie_term (&trie);
+    nn_alloc_acct_select (prevacct);
+    nn_alloc_acct_release (acct);
+
+    /*  Same subscriptions once again, added in a single batch. */
+    strs = malloc (nsubs * sizeof (struct nn_trie_str));
+    alloc_assert (strs);
+    for (i = 0; i != nsubs; ++i) {
+        strs [i].data = subs.data + subs.offsets [i];
+        strs [i].size = subs.sizes [i];
+    }
+    nn_trie_init (&trie);
+    start = nn_clock_us ();
+    nn_trie_subscribe_many (&trie, strs, nsubs);
+    bulktime = nn_clock_us () - start;
+    nn_trie_term (&trie);
+    free (strs);
+
+    printf ("%s,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", set, nsubs,
+        unique,
+        (double) subtime * 1000 / nsubs,
+        (double) treebytes / unique,
+        nmatches > warmup ?
+            (double) matchtime * 1000 / (nmatches - warmup) : 0.0,
+        nmatches > warmup ?
+            (double) matched * 100 / (nmatches - warmup) : 0.0,
+        (double) (totalbytes - treebytes) / unique,
+        (double) unsubtime * 1000 / nsubs,
+        (double) bulktime * 1000 / nsubs);
+    fflush (stdout);
+
+    trie_bench_topics_term (&topics);
+    trie_bench_topics_term (&subs);
+}
+
+/*  Returns 1 if 'item' is in the comma-separated 'list', or if the list
+    is "all". */
+static int trie_bench_selected (const char *list, const char *item)
+{
+    size_t len;
+    const char *pos;
+
+    if (strcmp (list, "all") == 0)
+        return 1;
+    len = strlen (item);
+    pos = list;
+    while (1) {
+        if (strncmp (pos, item, len) == 0 &&
+              (pos [len] == ',' || pos [len] == 0))
+            return 1;
+        pos = strchr (pos, ',');
+        if (!pos)
+            return 0;
+        ++pos;
+    }
+}
+
+int main (int argc, char *argv [])
+{
+    const char *setlist;
+    int countlist [16];
+    int nmatches;
+    const char *pos;
+    int s;
+    int n;
+
+    if (argc > 4) {
+        printf ("usage: trie_bench [topic-sets] [subscriptions] "
+            "[match-count]\n");
+        return 1;
+    }
+    setlist = argc > 1 ? argv [1] : "all";
+    if (argc > 2 && strcmp (argv [2], "all") != 0) {
+        pos = argv [2];
+        for (n = 0; n != 15 && pos; ++n) {
+            countlist [n] = atoi (pos);
+            if (countlist [n] < 1) {
+                fprintf (stderr, "number of subscriptions must be positive\n");
+                return 1;
+            }
+            pos = strchr (pos, ',');
+            if (pos)
+                ++pos;
+        }
+        countlist [n] = 0;
+    }
+    else {
+        for (n = 0; subcounts [n]; ++n)
+            countlist [n] = subcounts [n];
+        countlist [n] = 0;
+    }
+    nmatches = argc > 3 ? atoi (argv [3]) : 1000000;
+    if (nmatches < 0) {
+        fprintf (stderr, "number of matches must not be negative\n");
+        return 1;
+    }
+
+    printf ("set,subscriptions,unique,subscribe_ns,bytes_per_sub,match_ns,"
+        "matched_pct,flat_bytes_per_sub,unsubscribe_ns,bulk_subscribe_ns\n");
+    for (s = 0; topicsets [s]; ++s) {
+        if (!trie_bench_selected (setlist, topicsets [s]))
+            continue;
+        for (n = 0; countlist [n]; ++n)
+            trie_bench_run (topicsets [s], countlist [n], nmatches);
+    }
+
+    return 0;
+}
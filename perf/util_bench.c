@@ -0,0 +1,438 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/chunk.h"
+#include "../src/utils/msg.h"
+#include "../src/utils/hash.h"
+#include "../src/aio/timerset.h"
+#include "../src/transports/inproc/msgqueue.h"
+#include "../src/protocols/utils/lb.h"
+#include "../src/protocols/utils/fq.h"
+#include "../src/transports/ws/ws_mask.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/clock.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Measures the data structures and helpers the message paths of the library
+    are built on, each in isolation and in a single thread, so that a change
+    to one of them can be evaluated without the noise of the sockets and
+    the worker threads around it. Each benchmark prints a CSV line with
+    the time per operation.
+
+    The benchmarks use the internals of the library directly and thus need
+    them to be visible when linking against it. */
+
+#define UTIL_BENCH_MAXITEMS 1000000
+
+static uint64_t util_bench_state;
+
+static uint32_t util_bench_random (void)
+{
+    /*  xorshift64*  */
+    util_bench_state ^= util_bench_state >> 12;
+    util_bench_state ^= util_bench_state << 25;
+    util_bench_state ^= util_bench_state >> 27;
+    return (uint32_t) ((util_bench_state * 2685821657736338717ULL) >> 32);
+}
+
+static void util_bench_report (const char *name, size_t param, int ops,
+    uint64_t ns)
+{
+    printf ("%s,%d,%d,%.1f\n", name, (int) param, ops,
+        ops ? (double) ns / ops : 0.0);
+    fflush (stdout);
+}
+
+/*  Allocates and frees heap chunks of the given size. */
+static void util_bench_chunk (size_t size, int count)
+{
+    int rc;
+    int i;
+    void *chunk;
+    uint64_t start;
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        rc = nn_chunk_alloc (size, 0, &chunk);
+        errnum_assert (rc == 0, -rc);
+        nn_chunk_free (chunk);
+    }
+    util_bench_report ("chunk_alloc_free", size, count, nn_clock_ns () - start);
+}
+
+/*  Makes 'copies' copies of a message the way PUB and BUS sockets fan it
+    out and releases them. The time is per copy. */
+static void util_bench_bulkcopy (size_t size, int copies, int count)
+{
+    int i;
+    int j;
+    struct nn_msg src;
+    struct nn_msg *dst;
+    uint64_t start;
+
+    dst = malloc (copies * sizeof (struct nn_msg));
+    alloc_assert (dst);
+    count /= copies;
+    if (count < 1)
+        count = 1;
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        nn_msg_init (&src, size);
+        nn_msg_bulkcopy_start (&src, copies);
+        for (j = 0; j != copies; ++j)
+            nn_msg_bulkcopy_cp (&dst [j], &src);
+        nn_msg_term (&src);
+        for (j = 0; j != copies; ++j)
+            nn_msg_term (&dst [j]);
+    }
+    util_bench_report ("msg_bulkcopy", copies, count * copies,
+        nn_clock_ns () - start);
+
+    free (dst);
+}
+
+/*  Fills a hash table with 'nitems' random keys, looks each of them up
+    and erases them again. */
+static void util_bench_hash (int nitems)
+{
+    int i;
+    struct nn_hash hash;
+    struct nn_hash_item *items;
+    struct nn_hash_item *item;
+    uint64_t start;
+
+    items = malloc (nitems * sizeof (struct nn_hash_item));
+    alloc_assert (items);
+    util_bench_state = 0x9e3779b97f4a7c15ULL;
+
+    nn_hash_init (&hash);
+    for (i = 0; i != nitems; ++i)
+        nn_hash_item_init (&items [i]);
+    start = nn_clock_ns ();
+    for (i = 0; i != nitems; ++i) {
+
+        /*  Keys must be unique. */
+        do {
+            items [i].key = util_bench_random ();
+        } while (nn_hash_get (&hash, items [i].key));
+        nn_hash_insert (&hash, items [i].key, &items [i]);
+    }
+    util_bench_report ("hash_insert", nitems, nitems, nn_clock_ns () - start);
+
+    start = nn_clock_ns ();
+    for (i = 0; i != nitems; ++i) {
+        item = nn_hash_get (&hash, items [(i * 7919) % nitems].key);
+        nn_assert (item);
+    }
+    util_bench_report ("hash_get", nitems, nitems, nn_clock_ns () - start);
+
+    start = nn_clock_ns ();
+    for (i = 0; i != nitems; ++i)
+        nn_hash_erase (&hash, &items [i]);
+    util_bench_report ("hash_erase", nitems, nitems, nn_clock_ns () - start);
+
+    for (i = 0; i != nitems; ++i)
+        nn_hash_item_term (&items [i]);
+    nn_hash_term (&hash);
+    free (items);
+}
+
+/*  Keeps 'ntimers' timeouts of up to a minute pending and measures adding
+    and removing them, the way the per-connection timers are rearmed. */
+static void util_bench_timerset (int ntimers, int count)
+{
+    int i;
+    int rc;
+    struct nn_timerset timerset;
+    struct nn_timerset_hndl *hndls;
+    uint64_t start;
+
+    hndls = malloc (ntimers * sizeof (struct nn_timerset_hndl));
+    alloc_assert (hndls);
+    util_bench_state = 0x9e3779b97f4a7c15ULL;
+
+    nn_timerset_init (&timerset);
+    nn_timerset_settime (&timerset, 1000);
+    for (i = 0; i != ntimers; ++i) {
+        nn_timerset_hndl_init (&hndls [i]);
+        nn_timerset_add (&timerset, 1 + util_bench_random () % 60000,
+            &hndls [i]);
+    }
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        rc = nn_timerset_rm (&timerset, &hndls [i % ntimers]);
+        errnum_assert (rc >= 0, -rc);
+        nn_timerset_add (&timerset, 1 + util_bench_random () % 60000,
+            &hndls [i % ntimers]);
+    }
+    util_bench_report ("timerset_rm_add", ntimers, count,
+        nn_clock_ns () - start);
+
+    for (i = 0; i != ntimers; ++i) {
+        nn_timerset_rm (&timerset, &hndls [i]);
+        nn_timerset_hndl_term (&hndls [i]);
+    }
+    nn_timerset_term (&timerset);
+    free (hndls);
+}
+
+/*  Passes messages of the given size through the inproc message queue in
+    batches of 'batch', from the same thread. */
+static void util_bench_msgqueue (size_t size, int batch, int count)
+{
+    int i;
+    int j;
+    int rc;
+    struct nn_msgqueue *queue;
+    struct nn_msg msg;
+    uint64_t start;
+
+    queue = malloc (sizeof (struct nn_msgqueue));
+    alloc_assert (queue);
+    nn_msgqueue_init (queue, 1024 * 1024 * 1024);
+    count /= batch;
+    if (count < 1)
+        count = 1;
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        for (j = 0; j != batch; ++j) {
+            nn_msg_init (&msg, size);
+            rc = nn_msgqueue_send (queue, &msg);
+            errnum_assert (rc >= 0, -rc);
+        }
+        for (j = 0; j != batch; ++j) {
+            rc = nn_msgqueue_recv (queue, &msg);
+            errnum_assert (rc >= 0, -rc);
+            nn_msg_term (&msg);
+        }
+    }
+    util_bench_report ("msgqueue_send_recv", size, count * batch,
+        nn_clock_ns () - start);
+
+    nn_msgqueue_term (queue);
+    free (queue);
+}
+
+/*  Picks the pipe to send to (or to receive from) among 'npipes' pipes of
+    the same priority. Every 'release'-th pick, the pipe is reported as
+    having no more room (no more messages) and becomes available again right
+    away, which exercises the bookkeeping of the active pipes. The pipes
+    are never used, so they are mere placeholders. */
+static void util_bench_lb (int npipes, int release, int count)
+{
+    int i;
+    struct nn_lb lb;
+    struct nn_lb_data *data;
+    struct nn_pipe *pipe;
+    uint64_t start;
+
+    data = malloc (npipes * sizeof (struct nn_lb_data));
+    alloc_assert (data);
+    nn_lb_init (&lb);
+    for (i = 0; i != npipes; ++i) {
+        nn_lb_add (&lb, &data [i], (struct nn_pipe*) &data [i], 8);
+        nn_lb_out (&lb, &data [i]);
+    }
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        pipe = nn_priolist_getpipe (&lb.priolist);
+        nn_assert (pipe);
+        if (release && i % release == 0) {
+            nn_priolist_advance (&lb.priolist, 1);
+            nn_lb_out (&lb, (struct nn_lb_data*) pipe);
+        }
+        else
+            nn_priolist_advance (&lb.priolist, 0);
+    }
+    util_bench_report (release ? "lb_select_release" : "lb_select", npipes,
+        count, nn_clock_ns () - start);
+
+    for (i = 0; i != npipes; ++i)
+        nn_lb_rm (&lb, &data [i]);
+    nn_lb_term (&lb);
+    free (data);
+}
+
+/*  Same as above for the fair-queuer. The pipes are added to its list
+    directly, as nn_fq_add asks the pipe for its NN_RCVWEIGHT, which the
+    placeholders can't answer. */
+static void util_bench_fq (int npipes, int release, int count)
+{
+    int i;
+    struct nn_fq fq;
+    struct nn_fq_data *data;
+    struct nn_pipe *pipe;
+    uint64_t start;
+
+    data = malloc (npipes * sizeof (struct nn_fq_data));
+    alloc_assert (data);
+    nn_fq_init (&fq);
+    for (i = 0; i != npipes; ++i) {
+        nn_priolist_add (&fq.priolist, &data [i].priodata,
+            (struct nn_pipe*) &data [i], 8);
+        nn_fq_in (&fq, &data [i]);
+    }
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i) {
+        pipe = nn_priolist_getpipe (&fq.priolist);
+        nn_assert (pipe);
+        if (release && i % release == 0) {
+            nn_priolist_advance (&fq.priolist, 1);
+            nn_fq_in (&fq, (struct nn_fq_data*) pipe);
+        }
+        else
+            nn_priolist_advance (&fq.priolist, 0);
+    }
+    util_bench_report (release ? "fq_select_release" : "fq_select", npipes,
+        count, nn_clock_ns () - start);
+
+    for (i = 0; i != npipes; ++i)
+        nn_fq_rm (&fq, &data [i]);
+    nn_fq_term (&fq);
+    free (data);
+}
+
+/*  Masks a payload of the given size in place, as done for each frame sent
+    by a WebSocket client and received by a server. */
+static void util_bench_mask (size_t size, int count)
+{
+    int i;
+    uint8_t *buf;
+    uint8_t mask [NN_WS_MASK_SIZE] = {0x12, 0x34, 0x56, 0x78};
+    uint64_t start;
+    uint64_t ns;
+
+    buf = malloc (size);
+    alloc_assert (buf);
+    memset (buf, 'x', size);
+    count = (int) (count / (1 + size / 1024));
+
+    start = nn_clock_ns ();
+    for (i = 0; i != count; ++i)
+        nn_ws_mask_payload (buf, buf, size, mask, sizeof (mask), NULL);
+    ns = nn_clock_ns () - start;
+    util_bench_report ("ws_mask_payload", size, count, ns);
+
+    free (buf);
+}
+
+static const char *benchnames [] = {"chunk", "bulkcopy", "hash", "timerset",
+    "msgqueue", "lb", "fq", "mask", NULL};
+
+/*  Returns 1 if 'item' is in the comma-separated 'list', or if the list
+    is "all". */
+static int util_bench_selected (const char *list, const char *item)
+{
+    size_t len;
+    const char *pos;
+
+    if (strcmp (list, "all") == 0)
+        return 1;
+    len = strlen (item);
+    pos = list;
+    while (1) {
+        if (strncmp (pos, item, len) == 0 &&
+              (pos [len] == ',' || pos [len] == 0))
+            return 1;
+        pos = strchr (pos, ',');
+        if (!pos)
+            return 0;
+        ++pos;
+    }
+}
+
+int main (int argc, char *argv [])
+{
+    const char *list;
+    int count;
+    int i;
+
+    if (argc > 3) {
+        printf ("usage: util_bench [benchmarks] [operation-count]\n");
+        return 1;
+    }
+    list = argc > 1 ? argv [1] : "all";
+    for (i = 0; benchnames [i]; ++i)
+        if (util_bench_selected (list, benchnames [i]))
+            break;
+    if (!benchnames [i]) {
+        fprintf (stderr, "no such benchmark: %s\n", list);
+        return 1;
+    }
+    count = argc > 2 ? atoi (argv [2]) : 1000000;
+    if (count < 1) {
+        fprintf (stderr, "number of operations must be positive\n");
+        return 1;
+    }
+
+    printf ("benchmark,param,ops,ns_per_op\n");
+    if (util_bench_selected (list, "chunk")) {
+        util_bench_chunk (64, count);
+        util_bench_chunk (1024, count);
+        util_bench_chunk (65536, count);
+    }
+    if (util_bench_selected (list, "bulkcopy")) {
+        util_bench_bulkcopy (1024, 1, count);
+        util_bench_bulkcopy (1024, 16, count);
+        util_bench_bulkcopy (1024, 256, count);
+    }
+    if (util_bench_selected (list, "hash")) {
+        util_bench_hash (count < 1000 ? count : 1000);
+        util_bench_hash (count < UTIL_BENCH_MAXITEMS ?
+            count : UTIL_BENCH_MAXITEMS);
+    }
+    if (util_bench_selected (list, "timerset")) {
+        util_bench_timerset (16, count);
+        util_bench_timerset (10000, count);
+    }
+    if (util_bench_selected (list, "msgqueue")) {
+        util_bench_msgqueue (64, 1, count);
+        util_bench_msgqueue (64, 64, count);
+        util_bench_msgqueue (1024, 64, count);
+    }
+    if (util_bench_selected (list, "lb")) {
+        util_bench_lb (1, 0, count);
+        util_bench_lb (64, 0, count);
+        util_bench_lb (64, 4, count);
+    }
+    if (util_bench_selected (list, "fq")) {
+        util_bench_fq (1, 0, count);
+        util_bench_fq (64, 0, count);
+        util_bench_fq (64, 4, count);
+    }
+    if (util_bench_selected (list, "mask")) {
+        util_bench_mask (64, count);
+        util_bench_mask (1500, count);
+        util_bench_mask (65536, count);
+    }
+
+    return 0;
+}
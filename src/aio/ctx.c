@@ -29,11 +29,16 @@
 void nn_ctx_init (struct nn_ctx *self, struct nn_pool *pool,
     nn_ctx_onleave onleave)
 {
-    nn_mutex_init (&self->sync);
+    nn_mutex_init_adaptive (&self->sync);
     self->pool = pool;
     nn_queue_init (&self->events);
     nn_queue_init (&self->eventsto);
     self->onleave = onleave;
+    self->worker = NULL;
+    self->workers = 0;
+    self->home = NULL;
+    self->acct = NULL;
+    self->prevacct = NULL;
 }
 
 void nn_ctx_term (struct nn_ctx *self)
@@ -46,6 +51,21 @@ void nn_ctx_term (struct nn_ctx *self)
 void nn_ctx_enter (struct nn_ctx *self)
 {
     nn_mutex_lock (&self->sync);
+    self->prevacct = nn_alloc_acct_select (self->acct);
+}
+
+/*  Processes the events queued in the context so far, including those
+    raised while processing them. The context must be locked. */
+static void nn_ctx_process (struct nn_ctx *self)
+{
+    struct nn_queue_item *item;
+
+    while (1) {
+        item = nn_queue_pop (&self->events);
+        if (!item)
+            break;
+        nn_fsm_event_process (nn_cont (item, struct nn_fsm_event, item));
+    }
 }
 
 void nn_ctx_leave (struct nn_ctx *self)
@@ -53,19 +73,21 @@ void nn_ctx_leave (struct nn_ctx *self)
     struct nn_queue_item *item;
     struct nn_fsm_event *event;
     struct nn_queue eventsto;
+    struct nn_ctx *ctx;
 
-    /*  Process any queued events before leaving the context. */
+    /*  Process any queued events before leaving the context. Then notify
+        the owner that we are leaving it. The owner may do more work in
+        the context at that point, so the events it raises are processed
+        and the owner notified once again. */
     while (1) {
-        item = nn_queue_pop (&self->events);
-        event = nn_cont (item, struct nn_fsm_event, item);
-        if (!event)
+        nn_ctx_process (self);
+        if (nn_fast (self->onleave != NULL))
+            self->onleave (self);
+        if (nn_fast (nn_queue_empty (&self->events)))
             break;
-        nn_fsm_event_process (event);
     }
 
-    /*  Notify the owner that we are leaving the context. */
-    if (nn_fast (self->onleave != NULL))
-        self->onleave (self);
+    nn_alloc_acct_select (self->prevacct);
 
     /*  Shortcut in the case there are no external events. */
     if (nn_queue_empty (&self->eventsto)) {
@@ -81,15 +103,25 @@ void nn_ctx_leave (struct nn_ctx *self)
     nn_mutex_unlock (&self->sync);
 
     /*  Process any queued external events. Before processing each event
-        lock the context it belongs to. */
-    while (1) {
-        item = nn_queue_pop (&eventsto);
+        lock the context it belongs to. Consecutive events for the same
+        context are processed in a single visit to spare locking and
+        leaving the context for each of them. */
+    item = nn_queue_pop (&eventsto);
+    while (item) {
         event = nn_cont (item, struct nn_fsm_event, item);
-        if (!event)
-            break;
-        nn_ctx_enter (event->fsm->ctx);
-        nn_fsm_event_process (event);
-        nn_ctx_leave (event->fsm->ctx);
+        ctx = event->fsm->ctx;
+        nn_ctx_enter (ctx);
+        while (1) {
+            nn_fsm_event_process (event);
+            item = nn_queue_pop (&eventsto);
+            if (!item)
+                break;
+            event = nn_cont (item, struct nn_fsm_event, item);
+            if (event->fsm->ctx != ctx)
+                break;
+            nn_ctx_process (ctx);
+        }
+        nn_ctx_leave (ctx);
     }
 
     nn_queue_term (&eventsto);
@@ -97,7 +129,33 @@ void nn_ctx_leave (struct nn_ctx *self)
 
 struct nn_worker *nn_ctx_choose_worker (struct nn_ctx *self)
 {
-    return nn_pool_choose_worker (self->pool);
+    /*  Whatever worker is chosen, it's going to be used. */
+    nn_pool_start (self->pool);
+
+    if (self->worker)
+        return self->worker;
+    if (!self->workers && self->home)
+        return self->home;
+    return nn_pool_choose_worker (self->pool, self->workers);
+}
+
+void nn_ctx_choose_workers (struct nn_ctx *self, struct nn_worker **workers,
+    int count)
+{
+    int i;
+
+    nn_pool_start (self->pool);
+
+    if (self->worker) {
+        for (i = 0; i != count; ++i)
+            workers [i] = self->worker;
+        return;
+    }
+    if (count == 1) {
+        workers [0] = nn_ctx_choose_worker (self);
+        return;
+    }
+    nn_pool_choose_workers (self->pool, self->workers, workers, count);
 }
 
 void nn_ctx_raise (struct nn_ctx *self, struct nn_fsm_event *event)
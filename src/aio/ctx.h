@@ -23,6 +23,7 @@
 #ifndef NN_CTX_INCLUDED
 #define NN_CTX_INCLUDED
 
+#include "../utils/alloc.h"
 #include "../utils/mutex.h"
 #include "../utils/queue.h"
 
@@ -40,6 +41,24 @@ struct nn_ctx {
     struct nn_queue events;
     struct nn_queue eventsto;
     nn_ctx_onleave onleave;
+
+    /*  If set, all the AIO objects created within this context are handled
+        by this worker rather than by a worker picked from the pool. */
+    struct nn_worker *worker;
+
+    /*  Otherwise, if 'workers' is non-zero, the AIO objects are spread
+        over the workers whose indices have their bits set in it. If it's
+        zero and 'home' is set, they are handled by the 'home' worker,
+        except when several workers are asked for at once, in which case
+        they are spread over the whole pool. */
+    uint64_t workers;
+    struct nn_worker *home;
+
+    /*  If set, the memory allocated from within this context is charged to
+        this account. 'prevacct' is the account that was selected in
+        the thread before it entered the context. */
+    struct nn_alloc_acct *acct;
+    struct nn_alloc_acct *prevacct;
 };
 
 void nn_ctx_init (struct nn_ctx *self, struct nn_pool *pool,
@@ -50,6 +69,8 @@ void nn_ctx_enter (struct nn_ctx *self);
 void nn_ctx_leave (struct nn_ctx *self);
 
 struct nn_worker *nn_ctx_choose_worker (struct nn_ctx *self);
+void nn_ctx_choose_workers (struct nn_ctx *self, struct nn_worker **workers,
+    int count);
 
 void nn_ctx_raise (struct nn_ctx *self, struct nn_fsm_event *event);
 void nn_ctx_raiseto (struct nn_ctx *self, struct nn_fsm_event *event);
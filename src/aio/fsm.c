@@ -172,12 +172,28 @@ struct nn_worker *nn_fsm_choose_worker (struct nn_fsm *self)
     return nn_ctx_choose_worker (self->ctx);
 }
 
+void nn_fsm_choose_workers (struct nn_fsm *self, struct nn_worker **workers,
+    int count)
+{
+    nn_ctx_choose_workers (self->ctx, workers, count);
+}
+
 void nn_fsm_action (struct nn_fsm *self, int type)
 {
     nn_assert (type > 0);
     nn_fsm_feed (self, NN_FSM_ACTION, type, NULL);
 }
 
+void nn_fsm_post (struct nn_fsm *self, struct nn_fsm_event *event,
+    int src, int type)
+{
+    event->fsm = self;
+    event->src = src;
+    event->srcptr = NULL;
+    event->type = type;
+    nn_ctx_raise (self->ctx, event);
+}
+
 void nn_fsm_raise (struct nn_fsm *self, struct nn_fsm_event *event, int type)
 {
     event->fsm = self->owner;
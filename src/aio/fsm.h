@@ -93,9 +93,19 @@ void nn_fsm_swap_owner (struct nn_fsm *self, struct nn_fsm_owner *owner);
 
 struct nn_worker *nn_fsm_choose_worker (struct nn_fsm *self);
 
+/*  Chooses 'count' workers, distinct ones if possible, e.g. to spread
+    several objects across the threads. */
+void nn_fsm_choose_workers (struct nn_fsm *self, struct nn_worker **workers,
+    int count);
+
 /*  Using this function state machine can trigger an action on itself. */
 void nn_fsm_action (struct nn_fsm *self, int type);
 
+/*  Queue an event to the state machine itself. Unlike nn_fsm_action, the
+    event is processed only once the current context is being left. */
+void nn_fsm_post (struct nn_fsm *self, struct nn_fsm_event *event,
+    int src, int type);
+
 /*  Send event from the state machine to its owner. */
 void nn_fsm_raise (struct nn_fsm *self, struct nn_fsm_event *event, int type);
 
@@ -23,7 +23,9 @@
 
 #include "poller.h"
 
-#if defined NN_USE_EPOLL
+#if defined NN_USE_IO_URING
+    #include "poller_uring.inc"
+#elif defined NN_USE_EPOLL
     #include "poller_epoll.inc"
 #elif defined NN_USE_KQUEUE
     #include "poller_kqueue.inc"
@@ -28,7 +28,9 @@
 #define NN_POLLER_OUT 2
 #define NN_POLLER_ERR 3
 
-#if defined NN_USE_EPOLL
+#if defined NN_USE_IO_URING
+    #include "poller_uring.h"
+#elif defined NN_USE_EPOLL
     #include "poller_epoll.h"
 #elif defined NN_USE_KQUEUE
     #include "poller_kqueue.h"
@@ -48,6 +50,19 @@ void nn_poller_reset_in (struct nn_poller *self, struct nn_poller_hndl *hndl);
 void nn_poller_set_out (struct nn_poller *self, struct nn_poller_hndl *hndl);
 void nn_poller_reset_out (struct nn_poller *self, struct nn_poller_hndl *hndl);
 int nn_poller_wait (struct nn_poller *self, int timeout);
+
+/*  Has IN reported on the handle again after the next nn_poller_wait, even
+    though the file descriptor wasn't drained. A no-op with the level-triggered
+    pollers, which do so anyway. */
+void nn_poller_defer_in (struct nn_poller *self, struct nn_poller_hndl *hndl);
+
+/*  Returns a file descriptor that becomes readable once nn_poller_wait has
+    events to return, or -1 if the pollset can't be waited for that way. */
+int nn_poller_getfd (struct nn_poller *self);
+
+/*  Returns 1 if nn_poller_wait has events to return even though the file
+    descriptor may not be readable, 0 otherwise. */
+int nn_poller_pending (struct nn_poller *self);
 int nn_poller_event (struct nn_poller *self, int *event,
     struct nn_poller_hndl **hndl);
 
@@ -24,13 +24,38 @@
 #include <sys/types.h>
 #include <sys/epoll.h>
 
+#if defined NN_USE_EPOLLET
+#include "../utils/list.h"
+#endif
+
 #define NN_POLLER_HAVE_ASYNC_ADD 1
 
+/*  Maximum number of events retrieved by a single epoll_wait call. */
+#ifndef NN_POLLER_MAX_EVENTS
 #define NN_POLLER_MAX_EVENTS 32
+#endif
 
 struct nn_poller_hndl {
     int fd;
+
+    /*  Events the user is interested in. */
     uint32_t events;
+
+#if defined NN_USE_EPOLLET
+    /*  In edge-triggered mode the file descriptor is registered for both
+        IN and OUT once and for all. Edges that arrive while the user is not
+        interested in them are remembered here and delivered once the user
+        asks for them. */
+    uint32_t ready;
+
+    /*  The handle is in the list of pending handles if it has remembered
+        readiness the user has subsequently become interested in. */
+    struct nn_list_item pending;
+
+    /*  The handle is in the list of deferred handles if IN is to be
+        reported on it once more in the next iteration. */
+    struct nn_list_item deferred;
+#endif
 };
 
 struct nn_poller {
@@ -46,5 +71,15 @@ struct nn_poller {
 
     /*  Events being processed at the moment. */
     struct epoll_event events [NN_POLLER_MAX_EVENTS];
+
+#if defined NN_USE_EPOLLET
+    /*  Handles with readiness that wasn't reported by epoll_wait in this
+        iteration, but is to be delivered to the user. */
+    struct nn_list pending;
+
+    /*  Handles that weren't drained by the user. They become ready for IN
+        again at the beginning of the next iteration. */
+    struct nn_list deferred;
+#endif
 };
 
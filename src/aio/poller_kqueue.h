@@ -24,14 +24,42 @@
 #include <sys/types.h>
 #include <sys/event.h>
 
+#include "../utils/list.h"
+
+/*  Maximum number of events retrieved by a single kevent call. */
+#ifndef NN_POLLER_MAX_EVENTS
 #define NN_POLLER_MAX_EVENTS 32
+#endif
 
 #define NN_POLLER_EVENT_IN 1
 #define NN_POLLER_EVENT_OUT 2
 
 struct nn_poller_hndl {
     int fd;
+
+    /*  Events the user is interested in. */
     int events;
+
+    /*  Filters registered with the kqueue. They are brought in line with
+        'events' by the next nn_poller_wait, while the handle is in the list
+        of changed handles. */
+    int registered;
+    struct nn_list_item changed;
+
+#if defined NN_USE_EV_CLEAR
+    /*  In edge-triggered mode both filters are registered once and for all.
+        Edges that arrive while the user is not interested in them are
+        remembered here and delivered once the user asks for them. */
+    int ready;
+
+    /*  The handle is in the list of pending handles if it has remembered
+        readiness the user has subsequently become interested in. */
+    struct nn_list_item pending;
+
+    /*  The handle is in the list of deferred handles if IN is to be
+        reported on it once more in the next iteration. */
+    struct nn_list_item deferred;
+#endif
 };
 
 struct nn_poller {
@@ -47,5 +75,21 @@ struct nn_poller {
 
     /*  Cached events. */
     struct kevent events [NN_POLLER_MAX_EVENTS];
+
+    /*  Handles whose filters are to be changed, and the changes being
+        collected for submission along with the next wait. */
+    struct nn_list changed;
+    struct kevent changes [NN_POLLER_MAX_EVENTS];
+    int nchanges;
+
+#if defined NN_USE_EV_CLEAR
+    /*  Handles with readiness that wasn't reported by kevent in this
+        iteration, but is to be delivered to the user. */
+    struct nn_list pending;
+
+    /*  Handles that weren't drained by the user. They become ready for IN
+        again at the beginning of the next iteration. */
+    struct nn_list deferred;
+#endif
 };
 
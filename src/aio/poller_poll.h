@@ -25,7 +25,13 @@
 #define NN_POLLER_HAVE_ASYNC_ADD 0
 
 struct nn_poller_hndl {
+
+    /*  Position of the file descriptor in the pollset. */
     int index;
+
+    /*  Position of the handle in the list of ready handles, -1 if it's not
+        there. */
+    int ready;
 };
 
 struct nn_poller {
@@ -33,25 +39,22 @@ struct nn_poller {
     /*  Actual number of elements in the pollset. */
     int size;
 
-    /*  Index of the event being processed at the moment. */
-    int index;
-
     /*  Number of allocated elements in the pollset. */
     int capacity;
 
     /*  The pollset. */
     struct pollfd *pollset;
 
-    /*  List of handles associated with elements in the pollset. Either points
-        to the handle associated with the file descriptor (hndl) or is part
-        of the list of removed pollitems (removed). */
-    struct nn_hndls_item {
-        struct nn_poller_hndl *hndl;
-        int prev;
-        int next;
-    } *hndls;
-
-    /*  List of removed pollitems, linked by indices. -1 means empty list. */
-    int removed;
-};
+    /*  Handles associated with elements in the pollset. A removed element is
+        replaced by the one at the end of the pollset right away, so that
+        the pollset never has gaps in it. */
+    struct nn_poller_hndl **hndls;
+
+    /*  Handles with events reported by the last poll, in the order of
+        the pollset. Removed handles are replaced by NULL. */
+    struct nn_poller_hndl **ready;
+    int nready;
 
+    /*  Index of the ready handle being processed at the moment. */
+    int index;
+};
@@ -0,0 +1,121 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../utils/list.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#define NN_POLLER_HAVE_ASYNC_ADD 1
+
+/*  Maximum number of completions retrieved by a single nn_poller_wait. */
+#ifndef NN_POLLER_MAX_EVENTS
+#define NN_POLLER_MAX_EVENTS 32
+#endif
+
+/*  Number of submission queue entries. The completion queue is twice
+    as large. */
+#define NN_POLLER_URING_ENTRIES 256
+
+struct nn_poller_hndl {
+    int fd;
+
+    /*  Events the user is interested in. */
+    uint32_t events;
+
+    /*  Index of the slot tracking the poll request for this handle or -1
+        if the handle was never armed. */
+    int slot;
+
+    /*  The handle is in the list of handles to be (re)armed. */
+    struct nn_list_item arm;
+};
+
+/*  Poll requests can outlive the handle they were submitted for (removal
+    is asynchronous), so completions are matched to handles via slots owned
+    by the poller rather than via pointers to the handles themselves. */
+struct nn_poller_slot {
+
+    /*  The handle or NULL if it was already removed from the poller. */
+    struct nn_poller_hndl *hndl;
+
+    /*  Events the outstanding poll request waits for. */
+    uint32_t mask;
+
+    /*  Whether a poll request is outstanding and whether it's being
+        cancelled. */
+    int armed;
+    int cancelling;
+
+    /*  Next slot in the free list. */
+    int next;
+};
+
+struct nn_poller_event {
+    int slot;
+    uint32_t events;
+};
+
+struct nn_poller {
+
+    /*  The ring. */
+    int fd;
+    void *ring;
+    size_t ringsz;
+    struct io_uring_sqe *sqes;
+    size_t sqessz;
+
+    /*  Submission queue. */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+
+    /*  Completion queue. */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /*  Number of queued submissions not yet passed to the kernel. */
+    unsigned tosubmit;
+
+    /*  Slots, free slots are chained via their 'next' member. */
+    struct nn_poller_slot *slots;
+    int nslots;
+    int freeslot;
+
+    /*  Handles which need their poll request to be (re)submitted. */
+    struct nn_list arm;
+
+    /*  Number of events being processed at the moment. */
+    int nevents;
+
+    /*  Index of the event being processed at the moment. */
+    int index;
+
+    /*  Events being processed at the moment. */
+    struct nn_poller_event events [NN_POLLER_MAX_EVENTS];
+};
+
@@ -22,20 +22,313 @@
 
 #include "pool.h"
 
-/*  TODO: The dummy implementation of a thread pool. As for now there's only
-    one worker thread created. */
+#include "../utils/alloc.h"
+#include "../utils/err.h"
+#include "../utils/fast.h"
+#include "../utils/clock.h"
+#include "../utils/sleep.h"
 
-int nn_pool_init (struct nn_pool *self)
+#include <string.h>
+
+int nn_pool_init (struct nn_pool *self, int nworkers)
 {
-    return nn_worker_init (&self->worker);
+    int rc;
+
+    self->spread = 0;
+    self->ncpus = 0;
+    self->balance = 0;
+    self->spin = 0;
+
+    /*  A single worker driven by the application. It has no thread, so
+        there's nothing to be saved by setting it up later on. */
+    if (nworkers == 0) {
+        self->workers = nn_alloc (sizeof (struct nn_worker), "worker pool");
+        alloc_assert (self->workers);
+        rc = nn_worker_init_external (&self->workers [0]);
+        if (rc == 0) {
+            self->nworkers = 1;
+            self->external = 1;
+            nn_atomic_init (&self->next, 0);
+            nn_atomic_init (&self->started, 1);
+            nn_mutex_init (&self->startsync);
+            return 0;
+        }
+        nn_free (self->workers);
+        if (rc != -ENOTSUP) {
+            self->workers = NULL;
+            self->nworkers = 0;
+            return rc;
+        }
+    }
+
+    self->external = 0;
+    if (nworkers < 1)
+        nworkers = 1;
+    if (nworkers > NN_POOL_MAX_WORKERS)
+        nworkers = NN_POOL_MAX_WORKERS;
+
+    /*  The workers can be handed out before they are started. */
+    self->workers = nn_alloc (sizeof (struct nn_worker) * nworkers,
+        "worker pool");
+    alloc_assert (self->workers);
+    self->nworkers = nworkers;
+    nn_atomic_init (&self->next, 0);
+    nn_atomic_init (&self->started, 0);
+    nn_mutex_init (&self->startsync);
+
+    return 0;
 }
 
 void nn_pool_term (struct nn_pool *self)
 {
-    nn_worker_term (&self->worker);
+    int i;
+
+    if (!self->workers)
+        return;
+
+    if (nn_atomic_load (&self->started))
+        for (i = 0; i != self->nworkers; ++i)
+            nn_worker_term (&self->workers [i]);
+    nn_mutex_term (&self->startsync);
+    nn_atomic_term (&self->started);
+    nn_atomic_term (&self->next);
+    nn_free (self->workers);
+    self->workers = NULL;
+    self->nworkers = 0;
+}
+
+void nn_pool_start (struct nn_pool *self)
+{
+    int rc;
+    int i;
+    struct nn_alloc_acct *prevacct;
+
+    if (nn_fast (nn_atomic_load (&self->started)))
+        return;
+
+    /*  The workers are started on behalf of whichever socket needs one
+        first, but they are shared, so their memory is not charged to it. */
+    prevacct = nn_alloc_acct_select (NULL);
+    nn_mutex_lock (&self->startsync);
+    if (!nn_atomic_load (&self->started)) {
+
+        /*  There's no way to tell the AIO object asking for a worker that
+            there's none, the same as if it failed to allocate memory. */
+        for (i = 0; i != self->nworkers; ++i) {
+            rc = nn_worker_init (&self->workers [i]);
+            errnum_assert (rc == 0, -rc);
+            if (self->ncpus > 0)
+                (void) nn_worker_setaffinity (&self->workers [i],
+                    self->cpus [i % self->ncpus]);
+            if (self->balance && self->nworkers > 1)
+                nn_worker_setbalance (&self->workers [i], self->balance);
+            if (self->spin & ((uint64_t) 1 << i))
+                nn_worker_setspin (&self->workers [i]);
+        }
+        nn_atomic_store (&self->started, 1);
+    }
+    nn_mutex_unlock (&self->startsync);
+    nn_alloc_acct_select (prevacct);
+}
+
+/*  Returns the index of the n-th worker, modulo their number, among those
+    with the bits set in 'mask'. */
+static int nn_pool_pick (struct nn_pool *self, uint64_t mask, uint32_t n)
+{
+    int i;
+    int count;
+
+    if (self->nworkers < 64)
+        mask &= ((uint64_t) 1 << self->nworkers) - 1;
+    if (!mask)
+        return (int) (n % (uint32_t) self->nworkers);
+
+    count = 0;
+    for (i = 0; i != self->nworkers; ++i)
+        if (mask & ((uint64_t) 1 << i))
+            ++count;
+    n %= (uint32_t) count;
+    for (i = 0; ; ++i)
+        if ((mask & ((uint64_t) 1 << i)) && n-- == 0)
+            return i;
+}
+
+struct nn_worker *nn_pool_choose_worker (struct nn_pool *self, uint64_t mask)
+{
+    uint32_t n;
+
+    if (self->nworkers == 1)
+        return &self->workers [0];
+
+    n = nn_atomic_inc (&self->next, 1);
+    return &self->workers [nn_pool_pick (self, mask, n)];
+}
+
+void nn_pool_choose_workers (struct nn_pool *self, uint64_t mask,
+    struct nn_worker **workers, int count)
+{
+    uint32_t n;
+    int i;
+
+    n = nn_atomic_inc (&self->next, (uint32_t) count);
+    for (i = 0; i != count; ++i)
+        workers [i] = &self->workers [nn_pool_pick (self, mask, n + i)];
+}
+
+struct nn_worker *nn_pool_choose_home (struct nn_pool *self)
+{
+    /*  With a single worker there's nothing to choose from. */
+    if (self->spread || self->nworkers == 1)
+        return NULL;
+    return nn_pool_choose_worker (self, 0);
+}
+
+struct nn_worker *nn_pool_least_loaded (struct nn_pool *self, uint64_t mask)
+{
+    int i;
+    struct nn_worker *best;
+
+    best = NULL;
+    for (i = 0; i != self->nworkers; ++i) {
+        if (mask && !(mask & ((uint64_t) 1 << i)))
+            continue;
+        if (!best ||
+              nn_worker_load (&self->workers [i]) < nn_worker_load (best))
+            best = &self->workers [i];
+    }
+    return best;
+}
+
+void nn_pool_setbalance (struct nn_pool *self, int interval)
+{
+    int i;
+
+    if (self->nworkers == 1)
+        return;
+    nn_mutex_lock (&self->startsync);
+    self->balance = interval;
+    if (nn_atomic_load (&self->started))
+        for (i = 0; i != self->nworkers; ++i)
+            nn_worker_setbalance (&self->workers [i], interval);
+    nn_mutex_unlock (&self->startsync);
+}
+
+void nn_pool_setspin (struct nn_pool *self, uint64_t mask)
+{
+    int i;
+
+    if (self->external)
+        return;
+    nn_mutex_lock (&self->startsync);
+    self->spin |= mask;
+    if (nn_atomic_load (&self->started))
+        for (i = 0; i != self->nworkers; ++i)
+            if (mask & ((uint64_t) 1 << i))
+                nn_worker_setspin (&self->workers [i]);
+    nn_mutex_unlock (&self->startsync);
+}
+
+int nn_pool_size (struct nn_pool *self)
+{
+    return self->nworkers;
+}
+
+struct nn_worker *nn_pool_worker (struct nn_pool *self, int index)
+{
+    if (index < 0 || index >= self->nworkers)
+        return NULL;
+    return &self->workers [index];
+}
+
+void nn_pool_getstats (struct nn_pool *self, struct nn_worker_stats *stats)
+{
+    int i;
+
+    memset (stats, 0, sizeof (*stats));
+    if (!nn_atomic_load (&self->started))
+        return;
+    for (i = 0; i != self->nworkers; ++i)
+        nn_worker_getstats (&self->workers [i], stats);
+}
+
+void nn_pool_setaffinity (struct nn_pool *self, const int *cpus, int ncpus)
+{
+    int i;
+
+    if (ncpus <= 0 || self->external)
+        return;
+    if (ncpus > NN_POOL_MAX_WORKERS)
+        ncpus = NN_POOL_MAX_WORKERS;
+
+    /*  Failing to pin a thread is not fatal. The worker just continues
+        running wherever the OS schedules it. */
+    nn_mutex_lock (&self->startsync);
+    memcpy (self->cpus, cpus, ncpus * sizeof (int));
+    self->ncpus = ncpus;
+    if (nn_atomic_load (&self->started))
+        for (i = 0; i != self->nworkers; ++i)
+            (void) nn_worker_setaffinity (&self->workers [i],
+                cpus [i % ncpus]);
+    nn_mutex_unlock (&self->startsync);
+}
+
+struct nn_worker *nn_pool_external (struct nn_pool *self)
+{
+    return self->external ? &self->workers [0] : NULL;
+}
+
+int nn_pool_wait (struct nn_pool *self, struct nn_sem *sem)
+{
+    int rc;
+
+    if (!self->external)
+        return nn_sem_wait (sem);
+
+    while (1) {
+        rc = nn_sem_trywait (sem);
+        if (rc != -EAGAIN)
+            return rc;
+        rc = nn_worker_run (&self->workers [0], NN_POOL_WAIT_INTERVAL);
+        errnum_assert (rc == 0, -rc);
+    }
 }
 
-struct nn_worker *nn_pool_choose_worker (struct nn_pool *self)
+int nn_pool_wait_efd (struct nn_pool *self, struct nn_efd *efd, int timeout)
 {
-    return &self->worker;
+    int rc;
+    int interval;
+    uint64_t expire;
+    uint64_t now;
+
+    if (!self->external)
+        return nn_efd_wait (efd, timeout);
+
+    expire = timeout > 0 ? nn_clock_ms () + timeout : 0;
+    while (1) {
+        rc = nn_efd_wait (efd, 0);
+        if (rc != -ETIMEDOUT || timeout == 0)
+            return rc;
+        interval = NN_POOL_WAIT_INTERVAL;
+        if (timeout > 0) {
+            now = nn_clock_ms ();
+            if (now >= expire)
+                return -ETIMEDOUT;
+            if (expire - now < (uint64_t) interval)
+                interval = (int) (expire - now);
+        }
+        rc = nn_worker_run (&self->workers [0], interval);
+        errnum_assert (rc == 0, -rc);
+    }
+}
+
+void nn_pool_idle (struct nn_pool *self, int timeout)
+{
+    int rc;
+
+    if (!self->external) {
+        nn_sleep (timeout);
+        return;
+    }
+    rc = nn_worker_run (&self->workers [0], timeout);
+    errnum_assert (rc == 0, -rc);
 }
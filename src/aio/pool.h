@@ -25,15 +25,117 @@
 
 #include "worker.h"
 
+#include "../utils/atomic.h"
+#include "../utils/efd.h"
+#include "../utils/mutex.h"
+#include "../utils/sem.h"
+
+/*  Default and maximum number of worker threads in the pool. */
+#define NN_POOL_DEFAULT_WORKERS 1
+#define NN_POOL_MAX_WORKERS 64
+
+/*  Longest time, in milliseconds, a thread waiting for something to be
+    done by an external worker processes its events before checking
+    again. It matters only if it's another thread that does it. */
+#define NN_POOL_WAIT_INTERVAL 10
+
 /*  Worker thread pool. */
 
 struct nn_pool {
-    struct nn_worker worker;
+
+    /*  Array of worker threads. */
+    struct nn_worker *workers;
+    int nworkers;
+
+    /*  If set, the pool consists of a single worker without a thread,
+        driven by the application. */
+    int external;
+
+    /*  Index of the worker to hand out next. Workers are assigned to new
+        AIO objects in round-robin fashion. */
+    struct nn_atomic next;
+
+    /*  If set, the sockets don't get home workers and their AIO objects
+        are spread over the whole pool. */
+    int spread;
+
+    /*  Worker threads are started only when the first AIO object asks for
+        a worker, so that a process using inproc alone runs none. 'started'
+        is set once they are, 'startsync' guards starting them. */
+    struct nn_atomic started;
+    struct nn_mutex startsync;
+
+    /*  Settings to apply to the worker threads once they are started. */
+    int cpus [NN_POOL_MAX_WORKERS];
+    int ncpus;
+    int balance;
+    uint64_t spin;
 };
 
-int nn_pool_init (struct nn_pool *self);
+/*  Sets up a pool of 'nworkers' worker threads, to be started by
+    nn_pool_start. Zero means a single external worker to be driven by
+    the application, which is set up straight away, or a single worker
+    thread if the platform doesn't support that. Other values out of
+    the allowed range are clamped to [1, NN_POOL_MAX_WORKERS]. */
+int nn_pool_init (struct nn_pool *self, int nworkers);
 void nn_pool_term (struct nn_pool *self);
-struct nn_worker *nn_pool_choose_worker (struct nn_pool *self);
+
+/*  Starts the worker threads unless they are running already. Has to be
+    called before any of the workers handed out by the pool is used. */
+void nn_pool_start (struct nn_pool *self);
+
+/*  Hands out the workers in round-robin fashion. If 'mask' is non-zero, only
+    the workers whose indices have their bits set in it are handed out. */
+struct nn_worker *nn_pool_choose_worker (struct nn_pool *self, uint64_t mask);
+
+/*  Fills in 'workers' with 'count' workers handed out one after another.
+    They are all distinct unless there are fewer workers to choose from. */
+void nn_pool_choose_workers (struct nn_pool *self, uint64_t mask,
+    struct nn_worker **workers, int count);
+
+/*  Returns the worker a new socket is to do its I/O in by default, NULL if
+    its AIO objects are to be spread over the pool. */
+struct nn_worker *nn_pool_choose_home (struct nn_pool *self);
+
+/*  Returns the least loaded of the workers whose indices have their bits
+    set in 'mask', any worker if it's zero, NULL if there's no such worker. */
+struct nn_worker *nn_pool_least_loaded (struct nn_pool *self, uint64_t mask);
+
+/*  Makes the workers balance their load every 'interval' milliseconds,
+    zero meaning never. A single worker has nobody to balance it with. */
+void nn_pool_setbalance (struct nn_pool *self, int interval);
+
+/*  Makes the workers whose indices have their bits set in 'mask' busy-poll
+    for events (see nn_worker_setspin). */
+void nn_pool_setspin (struct nn_pool *self, uint64_t mask);
+
+/*  Returns the number of workers in the pool. */
+int nn_pool_size (struct nn_pool *self);
+
+/*  Returns the worker with the specfied index or NULL if there's no such
+    worker. */
+struct nn_worker *nn_pool_worker (struct nn_pool *self, int index);
+
+/*  Fills in 'stats' with the counters combined over all the workers, zeros
+    if they were not started yet. */
+void nn_pool_getstats (struct nn_pool *self, struct nn_worker_stats *stats);
+
+/*  Pins the workers to CPUs. Worker N is pinned to cpus [N % ncpus], at
+    latest when it's started. */
+void nn_pool_setaffinity (struct nn_pool *self, const int *cpus, int ncpus);
+
+/*  Returns the external worker, NULL if the pool has worker threads. */
+struct nn_worker *nn_pool_external (struct nn_pool *self);
+
+/*  Wait for a semaphore or an efd the same way nn_sem_wait and nn_efd_wait
+    do. If the pool is driven by the application, its events are processed
+    in the meantime, otherwise nobody might be there to signal the object. */
+int nn_pool_wait (struct nn_pool *self, struct nn_sem *sem);
+int nn_pool_wait_efd (struct nn_pool *self, struct nn_efd *efd, int timeout);
+
+/*  Lets 'timeout' milliseconds pass, processing the events in the meantime
+    if the pool is driven by the application. */
+void nn_pool_idle (struct nn_pool *self, int timeout);
 
 #endif
 
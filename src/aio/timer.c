@@ -53,7 +53,11 @@ void nn_timer_init (struct nn_timer *self, int src, struct nn_fsm *owner)
     nn_worker_task_init (&self->stop_task, NN_TIMER_SRC_STOP_TASK, &self->fsm);
     nn_worker_timer_init (&self->wtimer, &self->fsm);
     nn_fsm_event_init (&self->done);
-    self->worker = nn_fsm_choose_worker (&self->fsm);
+
+    /*  The worker is chosen when the timer is first started. Many timers
+        never are and there's no point in starting the worker threads for
+        them. */
+    self->worker = NULL;
     self->timeout = -1;
 }
 
@@ -131,6 +135,8 @@ static void nn_timer_handler (struct nn_fsm *self, int src, int type,
             case NN_FSM_START:
 
                 /*  Send start event to the worker thread. */
+                if (nn_slow (!timer->worker))
+                    timer->worker = nn_fsm_choose_worker (&timer->fsm);
                 timer->state = NN_TIMER_STATE_ACTIVE;
                 nn_worker_execute (timer->worker, &timer->start_task);
                 return;
@@ -27,45 +27,66 @@
 #include "../utils/clock.h"
 #include "../utils/err.h"
 
+/*  Private functions. */
+static int nn_timerset_ctz (uint64_t val);
+static void nn_timerset_insert (struct nn_timerset *self,
+    struct nn_timerset_hndl *hndl);
+static void nn_timerset_advance (struct nn_timerset *self, uint64_t now);
+static uint64_t nn_timerset_next (struct nn_timerset *self);
+
 void nn_timerset_init (struct nn_timerset *self)
 {
-    nn_list_init (&self->timeouts);
+    int i;
+    int j;
+
+    self->now = nn_clock_ms ();
+    self->clock = self->now;
+    nn_list_init (&self->expired);
+    for (i = 0; i != NN_TIMERSET_LEVELS; ++i) {
+        self->levels [i].pending = 0;
+        for (j = 0; j != NN_TIMERSET_SLOTS; ++j)
+            nn_list_init (&self->levels [i].slots [j]);
+    }
 }
 
 void nn_timerset_term (struct nn_timerset *self)
 {
-    nn_list_term (&self->timeouts);
+    int i;
+    int j;
+
+    for (i = 0; i != NN_TIMERSET_LEVELS; ++i)
+        for (j = 0; j != NN_TIMERSET_SLOTS; ++j)
+            nn_list_term (&self->levels [i].slots [j]);
+    nn_list_term (&self->expired);
 }
 
 int nn_timerset_add (struct nn_timerset *self, int timeout,
     struct nn_timerset_hndl *hndl)
 {
-    struct nn_list_item *it;
-    struct nn_timerset_hndl *ith;
-    int first;
+    uint64_t next;
 
     /*  Compute the instant when the timeout will be due. */
-    hndl->timeout = nn_clock_ms()  + timeout;
-
-    /*  Insert it into the ordered list of timeouts. */
-    for (it = nn_list_begin (&self->timeouts);
-          it != nn_list_end (&self->timeouts);
-          it = nn_list_next (&self->timeouts, it)) {
-        ith = nn_cont (it, struct nn_timerset_hndl, list);
-        if (hndl->timeout < ith->timeout)
-            break;
-    }
+    hndl->timeout = self->clock + timeout;
 
     /*  If the new timeout happens to be the first one to expire, let the user
         know that the current waiting interval has to be changed. */
-    first = nn_list_begin (&self->timeouts) == it ? 1 : 0;
-    nn_list_insert (&self->timeouts, &hndl->list, it);
-    return first;
+    next = nn_timerset_next (self);
+    nn_timerset_insert (self, hndl);
+    return hndl->timeout < next ? 1 : 0;
+}
+
+void nn_timerset_settime (struct nn_timerset *self, uint64_t now)
+{
+    /*  The clock is monotonic, but be defensive about the callers. */
+    if (nn_fast (now > self->clock))
+        self->clock = now;
 }
 
 int nn_timerset_rm (struct nn_timerset *self, struct nn_timerset_hndl *hndl)
 {
     int first;
+    int level;
+    int slot;
 
     /*  Ignore if handle is not in the timeouts list. */
     if (!nn_list_item_isinlist (&hndl->list))
@@ -73,40 +94,56 @@ int nn_timerset_rm (struct nn_timerset *self, struct nn_timerset_hndl *hndl)
 
     /*  If it was the first timeout that was removed, the actual waiting time
         may have changed. We'll thus return 1 to let the user know. */
-    first = nn_list_begin (&self->timeouts) == &hndl->list ? 1 : 0;
-    nn_list_erase (&self->timeouts, &hndl->list);
+    first = hndl->timeout <= nn_timerset_next (self) ? 1 : 0;
+    nn_list_erase (hndl->slot, &hndl->list);
+
+    /*  Keep the bitmap of non-empty slots up to date. */
+    if (hndl->slot != &self->expired && nn_list_empty (hndl->slot)) {
+        level = (int) (((char*) hndl->slot - (char*) self->levels) /
+            sizeof (struct nn_timerset_level));
+        slot = (int) (hndl->slot - self->levels [level].slots);
+        self->levels [level].pending &= ~(((uint64_t) 1) << slot);
+    }
     return first;
 }
 
 int nn_timerset_timeout (struct nn_timerset *self)
 {
-    int timeout;
+    uint64_t next;
+    uint64_t now;
 
-    if (nn_fast (nn_list_empty (&self->timeouts)))
+    next = nn_timerset_next (self);
+    if (nn_fast (next == UINT64_MAX))
         return -1;
 
-    timeout = (int) (nn_cont (nn_list_begin (&self->timeouts),
-        struct nn_timerset_hndl, list)->timeout - nn_clock_ms());
-    return timeout < 0 ? 0 : timeout;
+    /*  For timeouts stored at the higher levels of the wheel this is the
+        beginning of the slot rather than the exact due time. Waking up early
+        is harmless; the timeouts will be cascaded by nn_timerset_event. */
+    now = self->clock;
+    return next <= now ? 0 : (int) (next - now);
 }
 
 int nn_timerset_event (struct nn_timerset *self, struct nn_timerset_hndl **hndl)
 {
     struct nn_timerset_hndl *first;
+    uint64_t now;
 
-    /*  If there's no timeout, there's no event to report. */
-    if (nn_fast (nn_list_empty (&self->timeouts)))
-        return -EAGAIN;
+    /*  Move all the timeouts that are due to the list of expired timeouts. */
+    if (nn_list_empty (&self->expired)) {
+        now = self->clock;
+        if (now > self->now)
+            nn_timerset_advance (self, now);
+    }
 
     /*  If no timeout have expired yet, there's no event to return. */
-    first = nn_cont (nn_list_begin (&self->timeouts),
-        struct nn_timerset_hndl, list);
-    if (first->timeout > nn_clock_ms())
+    if (nn_fast (nn_list_empty (&self->expired)))
         return -EAGAIN;
 
     /*  Return the first timeout and remove it from the list of active
         timeouts. */
-    nn_list_erase (&self->timeouts, &first->list);
+    first = nn_cont (nn_list_begin (&self->expired),
+        struct nn_timerset_hndl, list);
+    nn_list_erase (&self->expired, &first->list);
     *hndl = first;
     return 0;
 }
@@ -114,6 +151,7 @@ int nn_timerset_event (struct nn_timerset *self, struct nn_timerset_hndl **hndl)
 void nn_timerset_hndl_init (struct nn_timerset_hndl *self)
 {
     nn_list_item_init (&self->list);
+    self->slot = NULL;
 }
 
 void nn_timerset_hndl_term (struct nn_timerset_hndl *self)
@@ -126,3 +164,127 @@ int nn_timerset_hndl_isactive (struct nn_timerset_hndl *self)
     return nn_list_item_isinlist (&self->list);
 }
 
+static int nn_timerset_ctz (uint64_t val)
+{
+#if defined __GNUC__ || defined __clang__
+    return __builtin_ctzll (val);
+#else
+    int res;
+
+    res = 0;
+    while (!(val & 1)) {
+        val >>= 1;
+        ++res;
+    }
+    return res;
+#endif
+}
+
+static void nn_timerset_insert (struct nn_timerset *self,
+    struct nn_timerset_hndl *hndl)
+{
+    uint64_t diff;
+    int level;
+    int slot;
+
+    if (hndl->timeout <= self->now) {
+        hndl->slot = &self->expired;
+        nn_list_insert (hndl->slot, &hndl->list, nn_list_end (hndl->slot));
+        return;
+    }
+
+    /*  Find the most significant group of bits where the due time differs
+        from the current time of the wheel. */
+    diff = hndl->timeout ^ self->now;
+    level = 0;
+    while (level + 1 != NN_TIMERSET_LEVELS &&
+          (diff >> (NN_TIMERSET_BITS * (level + 1))))
+        ++level;
+    slot = (int) ((hndl->timeout >> (NN_TIMERSET_BITS * level)) &
+        (NN_TIMERSET_SLOTS - 1));
+
+    hndl->slot = &self->levels [level].slots [slot];
+    nn_list_insert (hndl->slot, &hndl->list, nn_list_end (hndl->slot));
+    self->levels [level].pending |= ((uint64_t) 1) << slot;
+}
+
+static void nn_timerset_advance (struct nn_timerset *self, uint64_t now)
+{
+    struct nn_list due;
+    struct nn_list_item *it;
+    struct nn_timerset_hndl *hndl;
+    struct nn_timerset_level *level;
+    int i;
+    int shift;
+    int slot;
+    int last;
+
+    /*  Within a level, all the timeouts are stored in the slots following
+        the one that corresponds to the current time. Collect all the slots
+        the time has moved past. */
+    nn_list_init (&due);
+    for (i = 0; i != NN_TIMERSET_LEVELS; ++i) {
+        level = &self->levels [i];
+        if (!level->pending)
+            continue;
+        shift = NN_TIMERSET_BITS * i;
+        if (i + 1 != NN_TIMERSET_LEVELS &&
+              (now >> (shift + NN_TIMERSET_BITS)) ==
+              (self->now >> (shift + NN_TIMERSET_BITS)))
+            last = (int) ((now >> shift) & (NN_TIMERSET_SLOTS - 1));
+        else if (i + 1 == NN_TIMERSET_LEVELS)
+            last = (int) ((now >> shift) & (NN_TIMERSET_SLOTS - 1));
+        else
+            last = NN_TIMERSET_SLOTS - 1;
+        while (level->pending) {
+            slot = nn_timerset_ctz (level->pending);
+            if (slot > last)
+                break;
+            while (!nn_list_empty (&level->slots [slot])) {
+                it = nn_list_begin (&level->slots [slot]);
+                nn_list_erase (&level->slots [slot], it);
+                nn_list_insert (&due, it, nn_list_end (&due));
+            }
+            level->pending &= ~(((uint64_t) 1) << slot);
+        }
+    }
+
+    /*  Re-insert the collected timeouts. They'll end up either at a lower
+        level of the wheel or in the list of expired timeouts. */
+    self->now = now;
+    while (!nn_list_empty (&due)) {
+        it = nn_list_begin (&due);
+        nn_list_erase (&due, it);
+        hndl = nn_cont (it, struct nn_timerset_hndl, list);
+        nn_timerset_insert (self, hndl);
+    }
+    nn_list_term (&due);
+}
+
+static uint64_t nn_timerset_next (struct nn_timerset *self)
+{
+    int i;
+    int shift;
+    uint64_t base;
+
+    if (!nn_list_empty (&self->expired))
+        return self->now;
+
+    /*  Timeouts at lower levels are due before the ones at higher levels.
+        At level zero each slot corresponds to a single millisecond. At higher
+        levels, report the beginning of the first non-empty slot. */
+    for (i = 0; i != NN_TIMERSET_LEVELS; ++i) {
+        if (!self->levels [i].pending)
+            continue;
+        shift = NN_TIMERSET_BITS * i;
+        if (i + 1 == NN_TIMERSET_LEVELS)
+            base = 0;
+        else
+            base = (self->now >> (shift + NN_TIMERSET_BITS)) <<
+                (shift + NN_TIMERSET_BITS);
+        return base | (((uint64_t) nn_timerset_ctz (
+            self->levels [i].pending)) << shift);
+    }
+    return UINT64_MAX;
+}
+
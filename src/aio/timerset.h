@@ -28,15 +28,50 @@
 #include "../utils/list.h"
 
 /*  This class stores a list of timeouts and reports the next one to expire
-    along with the time till it happens. */
+    along with the time till it happens.
+
+    Timeouts are kept in a hierarchical timing wheel so that both adding and
+    removing a timeout is O(1) irrespective of the number of timeouts.
+    Each level of the wheel has NN_TIMERSET_SLOTS slots. A timeout is stored
+    at the level given by the most significant group of NN_TIMERSET_BITS bits
+    in which its due time differs from the current time of the wheel. As the
+    time advances, timeouts cascade to lower levels and finally to the list of
+    expired timeouts. */
+
+#define NN_TIMERSET_BITS 6
+#define NN_TIMERSET_SLOTS (1 << NN_TIMERSET_BITS)
+#define NN_TIMERSET_LEVELS ((64 + NN_TIMERSET_BITS - 1) / NN_TIMERSET_BITS)
 
 struct nn_timerset_hndl {
     struct nn_list_item list;
     uint64_t timeout;
+
+    /*  The slot (or the list of expired timeouts) the handle is stored in. */
+    struct nn_list *slot;
+};
+
+struct nn_timerset_level {
+
+    /*  Bitmap of the slots that contain at least one timeout. */
+    uint64_t pending;
+
+    struct nn_list slots [NN_TIMERSET_SLOTS];
 };
 
 struct nn_timerset {
-    struct nn_list timeouts;
+
+    /*  Current time of the wheel, in milliseconds. */
+    uint64_t now;
+
+    /*  Current time as last set by nn_timerset_settime, in milliseconds.
+        The timerset doesn't query the clock itself, so that the owner can
+        read it once per iteration of its loop. */
+    uint64_t clock;
+
+    /*  Timeouts that are already due and not yet reported to the user. */
+    struct nn_list expired;
+
+    struct nn_timerset_level levels [NN_TIMERSET_LEVELS];
 };
 
 void nn_timerset_init (struct nn_timerset *self);
@@ -44,6 +79,7 @@ void nn_timerset_term (struct nn_timerset *self);
 int nn_timerset_add (struct nn_timerset *self, int timeout,
     struct nn_timerset_hndl *hndl);
 int nn_timerset_rm (struct nn_timerset *self, struct nn_timerset_hndl *hndl);
+void nn_timerset_settime (struct nn_timerset *self, uint64_t now);
 int nn_timerset_timeout (struct nn_timerset *self);
 int nn_timerset_event (struct nn_timerset *self, struct nn_timerset_hndl **hndl);
 
@@ -26,6 +26,8 @@
 /*  Import the definition of nn_iovec. */
 #include "../nn.h"
 
+#include "../utils/msg.h"
+
 /*  OS-level sockets. */
 
 /*  Event types generated by nn_usock. */
@@ -37,14 +39,36 @@
 #define NN_USOCK_ACCEPT_ERROR 6
 #define NN_USOCK_STOPPED 7
 #define NN_USOCK_SHUTDOWN 8
+#define NN_USOCK_SECURED 9
 
-/*  Maximum number of iovecs that can be passed to nn_usock_send function. */
-#define NN_USOCK_MAX_IOVCNT 3
+/*  Maximum number of iovecs that can be passed to nn_usock_send function.
+    That's enough for buffers of coalesced urgent and ordinary messages
+    followed by transport header, SP header, body and all the parts of
+    a multi-part message. */
+#define NN_USOCK_MAX_IOVCNT (5 + NN_MSG_MAXPARTS)
 
 /*  Size of the buffer used for batch-reads of inbound data. To keep the
     performance optimal make sure that this value is larger than network MTU. */
 #define NN_USOCK_BATCH_SIZE 2048
 
+/*  Default upper limit the batch buffer is allowed to grow to when reads keep
+    filling it up completely. */
+#define NN_USOCK_BATCH_MAX 65536
+
+/*  Maximum number of bytes of a single large message read from the socket
+    in one go. The rest is read once the worker has served the other
+    connections that are ready, so that a peer sending huge messages doesn't
+    hold up the rest. */
+#define NN_USOCK_RECV_BUDGET 262144
+
+/*  Size of the records of a record-oriented socket that the receiving
+    side is always prepared for (see nn_usock_setrecords). */
+#define NN_USOCK_RECORD_MAX 65536
+
+/*  Maximum number of file descriptors passed along with a single write and
+    the number of received descriptors the socket keeps for the user. */
+#define NN_USOCK_MAXFDS 64
+
 #if defined NN_HAVE_WINDOWS
 #include "usock_win.h"
 #else
@@ -55,6 +79,11 @@ void nn_usock_init (struct nn_usock *self, int src, struct nn_fsm *owner);
 void nn_usock_term (struct nn_usock *self);
 
 int nn_usock_isidle (struct nn_usock *self);
+
+/*  Makes the socket use the specified worker thread instead of the one chosen
+    when it was initialised. Can be called only before the socket is started
+    or accepted. */
+void nn_usock_setworker (struct nn_usock *self, struct nn_worker *worker);
 int nn_usock_start (struct nn_usock *self,
     int domain, int type, int protocol);
 void nn_usock_start_fd (struct nn_usock *self, int fd);
@@ -87,8 +116,90 @@ void nn_usock_connect (struct nn_usock *self, const struct sockaddr *addr,
 
 void nn_usock_send (struct nn_usock *self, const struct nn_iovec *iov,
     int iovcnt);
+
+/*  Enable zero-copy sends on the socket. Returns -ENOTSUP if the platform
+    doesn't support them. */
+int nn_usock_setzerocopy (struct nn_usock *self);
+
+/*  Same as nn_usock_send, except that the buffers starting with the one at
+    index 'first' are passed to the kernel by reference. They must not be
+    modified or deallocated until nn_usock_zcdone reaches the value
+    nn_usock_zcsent had once NN_USOCK_SENT was raised. */
+void nn_usock_send_zerocopy (struct nn_usock *self, const struct nn_iovec *iov,
+    int iovcnt, int first);
+
+/*  Number of zero-copy sends issued so far and number of those completed
+    by the kernel, both modulo 2^32. */
+uint32_t nn_usock_zcsent (struct nn_usock *self);
+uint32_t nn_usock_zcdone (struct nn_usock *self);
+
+/*  Have the kernel timestamp the data it receives on the socket. Returns
+    -ENOTSUP if the platform doesn't support it. */
+int nn_usock_settimestamps (struct nn_usock *self);
+
+/*  Returns the time the kernel received the data read from the socket last,
+    in nanoseconds since the Epoch, or 0 if there's no timestamp. Data taken
+    from the batch buffer carry the timestamp of the read that filled it. */
+uint64_t nn_usock_rcvtimestamp (struct nn_usock *self);
 void nn_usock_recv (struct nn_usock *self, void *buf, size_t len, int *fd);
 
+#if !defined NN_HAVE_WINDOWS
+/*  Same as nn_usock_send, except that the file descriptors are passed to
+    the peer along with the data (SCM_RIGHTS). The descriptors must stay
+    open until NN_USOCK_SENT is raised. */
+void nn_usock_sendfds (struct nn_usock *self, const struct nn_iovec *iov,
+    int iovcnt, const int *fds, int nfds);
+
+/*  Returns the oldest file descriptor received from the peer that hasn't
+    been claimed yet, -1 if there's none. The descriptors arrive no later
+    than the data that were sent along with them and the caller becomes
+    responsible for closing them. Descriptors not claimed by the time the
+    socket is closed are closed along with it. */
+int nn_usock_recvfd (struct nn_usock *self);
+
+/*  Returns 1 if nn_usock_send_file can be used with the socket, i.e. if
+    sendfile is available and the data don't have to be encrypted in user
+    space nor split into records. */
+int nn_usock_cansendfile (struct nn_usock *self);
+
+/*  Same as nn_usock_send, except that 'length' bytes of the file starting at
+    'offset' are sent after the buffers, without being copied to the user
+    space. The file must stay open until NN_USOCK_SENT is raised. */
+void nn_usock_send_file (struct nn_usock *self, const struct nn_iovec *iov,
+    int iovcnt, int fd, uint64_t offset, uint64_t length);
+#endif
+
+/*  Receive data only if all of it is already available in the batch buffer.
+    Returns 1 if the data were copied to the buffer, 0 otherwise, in which
+    case nothing is consumed. No event is raised either way. */
+int nn_usock_tryrecv (struct nn_usock *self, void *buf, size_t len);
+
+/*  Set the size the batch buffer is allowed to grow to. Values smaller than
+    NN_USOCK_BATCH_SIZE prevent the buffer from growing at all. */
+void nn_usock_setbatch (struct nn_usock *self, size_t max);
+
+#if !defined NN_HAVE_WINDOWS
+/*  Makes the socket treat the underlying SOCK_SEQPACKET socket as a
+    stream. The data are sent in records of at most 'size' bytes, which
+    must not exceed NN_USOCK_RECORD_MAX, and each read leaves room for
+    a whole record of that size so that none is ever truncated. Must be
+    called when there are no data buffered. */
+void nn_usock_setrecords (struct nn_usock *self, size_t size);
+#endif
+
 int nn_usock_geterrno (struct nn_usock *self);
 
+#if defined NN_HAVE_TLS
+struct ssl_ctx_st;
+
+/*  Start a TLS handshake on an active socket. 'host' is the name or address
+    the server's certificate is checked against; NULL means that the socket
+    is the server side of the connection. Once the handshake is done,
+    NN_USOCK_SECURED is raised and all the data sent and received
+    afterwards are protected. If the handshake fails, NN_USOCK_ERROR is
+    raised. No data may be sent or received on the socket meanwhile. */
+void nn_usock_starttls (struct nn_usock *self, struct ssl_ctx_st *ctx,
+    const char *host);
+#endif
+
 #endif
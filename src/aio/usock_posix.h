@@ -27,6 +27,18 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 
+#if defined NN_HAVE_TLS
+struct ssl_st;
+#endif
+
+/*  Padding used to keep the receiving and the sending state on separate
+    cache lines. */
+#define NN_USOCK_CACHELINE 64
+
+/*  The receiving state is used by the worker as data arrive, while the
+    sending state is mostly used by the thread sending a message. Each is
+    kept on cache lines of its own so that the two don't pull each other's
+    data along. */
 struct nn_usock {
 
     /*  State machine base class. */
@@ -40,6 +52,8 @@ struct nn_usock {
     int s;
     struct nn_worker_fd wfd;
 
+    char pad1 [NN_USOCK_CACHELINE];
+
     /*  Members related to receiving data. */
     struct {
 
@@ -50,9 +64,13 @@ struct nn_usock {
         /*  Buffer for batch-reading inbound data. */
         uint8_t *batch;
 
-        /*  Size of the batch buffer. */
+        /*  Amount of data in the batch buffer. */
         size_t batch_len;
 
+        /*  Allocated size of the batch buffer and the size it may grow to. */
+        size_t batch_cap;
+        size_t batch_max;
+
         /*  Current position in the batch buffer. The data preceding this
             position were already received by the user. The data that follow
             will be received in the future. */
@@ -60,7 +78,21 @@ struct nn_usock {
 
         /*  File descriptor received via SCM_RIGHTS, if any. */
         int *pfd;
+
+        /*  Other received file descriptors, waiting to be claimed by
+            nn_usock_recvfd, in the order of arrival. */
+        int fds [NN_USOCK_MAXFDS];
+        int fds_pos;
+        int fds_len;
+
+        /*  Time the kernel received the data read last, in nanoseconds
+            since the Epoch, 0 if timestamps aren't enabled. */
+        uint64_t tstamp;
     } in;
+    struct nn_worker_task task_recv;
+    struct nn_fsm_event event_received;
+
+    char pad2 [NN_USOCK_CACHELINE];
 
     /*  Members related to sending data. */
     struct {
@@ -70,20 +102,81 @@ struct nn_usock {
 
         /*  List of buffers being sent at the moment. Referenced from 'hdr'. */
         struct iovec iov [NN_USOCK_MAX_IOVCNT];
+
+        /*  Control data with the file descriptors to pass along with the
+            first byte of the data being sent. Referenced from 'hdr' until
+            that byte is sent. */
+#if defined NN_HAVE_MSG_CONTROL
+        union {
+            struct cmsghdr align;
+            unsigned char buf [CMSG_SPACE (sizeof (int) * NN_USOCK_MAXFDS)];
+        } ctrl;
+#else
+        int ctrl [NN_USOCK_MAXFDS];
+#endif
+
+        /*  Index of the first buffer in 'iov' to be passed to the kernel
+            by reference, -1 if everything is to be copied. */
+        int zcfirst;
+
+        /*  Maximum size of a record passed to the kernel, 0 if the socket
+            is a stream. */
+        size_t maxrec;
+
+        /*  1 if zero-copy sends were enabled on the socket. */
+        int zerocopy;
+
+        /*  Number of zero-copy sends issued and number of those the kernel
+            has already reported as completed. Both wrap around. */
+        uint32_t zcsent;
+        uint32_t zcdone;
+
+        /*  Region of the file to send after the buffers, if 'filelen' is
+            non-zero. The offset and the length are updated as the data are
+            sent. */
+        int filefd;
+        uint64_t fileoff;
+        uint64_t filelen;
     } out;
+    struct nn_worker_task task_send;
+    struct nn_fsm_event event_sent;
+
+    char pad3 [NN_USOCK_CACHELINE];
 
-    /*  Asynchronous tasks for the worker. */
+    /*  1 if the listening socket is registered with the poller. It stays
+        registered after a connection is accepted so that the next one, that
+        usually follows right away, doesn't require another round trip to
+        the worker thread. */
+    int polling;
+
+#if defined NN_HAVE_TLS
+    /*  Members related to TLS. */
+    struct {
+
+        /*  The TLS connection layered on top of the socket, NULL if the
+            data are sent as they are. */
+        struct ssl_st *ssl;
+
+        /*  1 while the handshake is going on. */
+        int handshaking;
+
+        /*  1 if the kernel encrypts the outbound data itself (kTLS). The
+            data are then sent by the ordinary syscalls. */
+        int ktls;
+    } tls;
+#endif
+
+    /*  Asynchronous tasks for the worker. The ones for receiving and
+        sending are kept with the respective state. */
     struct nn_worker_task task_connecting;
     struct nn_worker_task task_connected;
     struct nn_worker_task task_accept;
-    struct nn_worker_task task_send;
-    struct nn_worker_task task_recv;
     struct nn_worker_task task_stop;
+    struct nn_worker_task task_migrated;
 
-    /*  Events raised by the usock. */
+    /*  Events raised by the usock, except for the ones kept with
+        the receiving and the sending state. */
     struct nn_fsm_event event_established;
-    struct nn_fsm_event event_sent;
-    struct nn_fsm_event event_received;
     struct nn_fsm_event event_error;
 
     /*  In ACCEPTING state points to the socket being accepted.
@@ -25,6 +25,33 @@
 
 #include "../utils/win.h"
 
+#include <stdint.h>
+
+/*  Number of receives kept outstanding on a TCP connection and the size of
+    the buffer each of them reads into. */
+#define NN_USOCK_RECVS 4
+#define NN_USOCK_RECV_SIZE 16384
+
+/*  Size of the registered buffer outbound data are copied to when
+    the connection uses Registered I/O. */
+#define NN_USOCK_RIO_SEND_SIZE 65536
+
+struct nn_usock_slot {
+
+    /*  The receive reading into the buffer. */
+    struct nn_worker_op op;
+    uint8_t *buf;
+
+    /*  Number of bytes received and number of them already handed over
+        to the user. Zero bytes received means the peer has closed
+        the connection. */
+    size_t len;
+    size_t pos;
+
+    /*  1 if the receive has completed and the data weren't consumed yet. */
+    int full;
+};
+
 struct nn_usock {
 
     /*  The state machine. */
@@ -48,6 +75,38 @@ struct nn_usock {
     struct nn_worker_op in;
     struct nn_worker_op out;
 
+    /*  The worker whose completion port the socket is associated with. */
+    struct nn_worker *worker;
+
+    /*  Inbound data of TCP connections. Once the connection is active,
+        a receive is outstanding on each slot that holds no data. The slots
+        are consumed in the order the receives were issued, starting with
+        'head'. 'buf' and 'len' describe what's left of the user's buffer
+        to be filled in. All the slot buffers are allocated as 'batch'. */
+    struct {
+        struct nn_usock_slot slots [NN_USOCK_RECVS];
+        uint8_t *batch;
+        int head;
+        int on;
+        uint8_t *buf;
+        size_t len;
+    } rx;
+
+#if defined NN_USE_RIO
+    /*  Registered I/O of TCP connections. 'rq' is RIO_INVALID_RQ if
+        the connection uses overlapped I/O. 'bufid' registers 'rx.batch',
+        which is followed by the send buffer in that case. Outbound data
+        are copied to the send buffer in chunks; 'iov' holds what's left
+        of them, starting with the element 'iovidx'. */
+    struct {
+        RIO_RQ rq;
+        RIO_BUFFERID bufid;
+        struct nn_iovec iov [NN_USOCK_MAX_IOVCNT];
+        int iovcnt;
+        int iovidx;
+    } rio;
+#endif
+
     /*  When accepting new socket, they have to be created with same
         type as the listening socket. Thus, in listening socket we
         have to store its exact type. */
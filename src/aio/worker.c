@@ -43,3 +43,24 @@ int nn_worker_timer_isactive (struct nn_worker_timer *self)
 {
     return nn_timerset_hndl_isactive (&self->hndl);
 }
+
+int nn_worker_setaffinity (struct nn_worker *self, int cpu)
+{
+    return nn_thread_setaffinity (&self->thread, cpu);
+}
+
+void nn_worker_getstats (struct nn_worker *self, struct nn_worker_stats *stats)
+{
+    stats->waits += self->stats.waits;
+    stats->events += self->stats.events;
+    stats->tasks += self->stats.tasks;
+    stats->timers += self->stats.timers;
+    stats->busy_time += self->stats.busy_time;
+    stats->wait_time += self->stats.wait_time;
+    if (self->stats.max_events > stats->max_events)
+        stats->max_events = self->stats.max_events;
+    if (self->stats.max_tasks > stats->max_tasks)
+        stats->max_tasks = self->stats.max_tasks;
+    stats->lock_contentions += nn_worker_lock_contentions (self);
+    stats->migrations += self->stats.migrations;
+}
@@ -27,6 +27,37 @@
 #include "fsm.h"
 #include "timerset.h"
 
+#include <stdint.h>
+
+/*  Counters maintained by the worker thread. They are updated without any
+    synchronisation, so a reader may see slightly stale values. */
+struct nn_worker_stats {
+
+    /*  Number of times the worker waited for events. */
+    uint64_t waits;
+
+    /*  Number of I/O events, tasks and timers processed. */
+    uint64_t events;
+    uint64_t tasks;
+    uint64_t timers;
+
+    /*  Time, in microseconds, spent processing and waiting for events. */
+    uint64_t busy_time;
+    uint64_t wait_time;
+
+    /*  The highest number of events and of queued tasks processed after
+        a single wait. */
+    uint64_t max_events;
+    uint64_t max_tasks;
+
+    /*  Number of times a thread found the worker's locks taken. */
+    uint64_t lock_contentions;
+
+    /*  Number of connections handed over to other workers to balance
+        the load. */
+    uint64_t migrations;
+};
+
 #if defined NN_HAVE_WINDOWS
 #include "worker_win.h"
 #else
@@ -57,9 +88,57 @@ struct nn_worker;
 
 int nn_worker_init (struct nn_worker *self);
 void nn_worker_term (struct nn_worker *self);
+
+/*  Initialises a worker without a thread of its own. Its events are
+    processed by whatever thread calls nn_worker_run, typically the one
+    running the application's event loop. Returns -ENOTSUP if the platform
+    provides no file descriptor the application could wait for. */
+int nn_worker_init_external (struct nn_worker *self);
+
+/*  Returns the file descriptor that becomes readable when an external
+    worker has events to process. */
+int nn_worker_getfd (struct nn_worker *self);
+
+/*  Waits at most 'timeout' milliseconds (negative meaning infinite) for
+    events of an external worker and processes them. Pending timers shorten
+    the wait. */
+int nn_worker_run (struct nn_worker *self, int timeout);
+
+/*  Returns the number of milliseconds an external worker may be left
+    alone while its file descriptor is not readable, -1 meaning infinite. */
+int nn_worker_timeout (struct nn_worker *self);
 void nn_worker_execute (struct nn_worker *self, struct nn_worker_task *task);
 void nn_worker_cancel (struct nn_worker *self, struct nn_worker_task *task);
 
+/*  Pins the worker thread to the specified CPU. */
+int nn_worker_setaffinity (struct nn_worker *self, int cpu);
+
+/*  Makes the worker balance its load with the other workers in the pool
+    every 'interval' milliseconds, zero meaning never. Has no effect on
+    the platforms that don't support moving connections between workers. */
+void nn_worker_setbalance (struct nn_worker *self, int interval);
+
+/*  Makes the worker busy-poll for events instead of sleeping till they
+    come. Tasks posted to a spinning worker don't signal its efd either,
+    the worker looks for them on every iteration. Once set, it stays on.
+    Has no effect on external workers and on the platforms that have no
+    poller to busy-poll. */
+void nn_worker_setspin (struct nn_worker *self);
+
+/*  Returns the per mille of the last balancing interval the worker was
+    busy. */
+uint64_t nn_worker_load (struct nn_worker *self);
+
+/*  Adds the counters of the worker to 'stats'. Maxima are combined by taking
+    the larger of the two values. */
+void nn_worker_getstats (struct nn_worker *self, struct nn_worker_stats *stats);
+
+/*  Makes sure that at least 'count' receive buffers, up to the number
+    the worker is able to cache, are allocated and faulted in ahead of
+    the first reads. Has no effect on the platforms where the sockets
+    don't share receive buffers. */
+void nn_worker_prefill (struct nn_worker *self, int count);
+
 void nn_worker_add_timer (struct nn_worker *self, int timeout,
     struct nn_worker_timer *timer);
 void nn_worker_rm_timer (struct nn_worker *self,
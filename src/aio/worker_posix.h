@@ -21,9 +21,12 @@
     IN THE SOFTWARE.
 */
 
+#include "../utils/list.h"
 #include "../utils/queue.h"
+#include "../utils/mpscq.h"
 #include "../utils/mutex.h"
 #include "../utils/thread.h"
+#include "../utils/sem.h"
 #include "../utils/efd.h"
 
 #include "poller.h"
@@ -32,16 +35,57 @@
 #define NN_WORKER_FD_OUT NN_POLLER_OUT
 #define NN_WORKER_FD_ERR NN_POLLER_ERR
 
+/*  Raised on a migratable fd when the worker wants to hand it over to
+    the worker in 'dest'. The owner may ignore it. Otherwise it removes the
+    fd from the current worker and has the new one adopt it (see
+    nn_worker_adopt_fd). */
+#define NN_WORKER_FD_MIGRATE 4
+
+/*  Maximum number of receive buffers cached by a worker. */
+#define NN_WORKER_MAX_BUFS 64
+
+/*  Load, in per mille of the time, below which a worker never hands its
+    connections over to other workers. */
+#define NN_WORKER_BALANCE_LOAD 250
+
+/*  Interval, in milliseconds, in which a worker with fds paused for lack of
+    memory checks whether they can resume. */
+#define NN_WORKER_PAUSE_IVL 10
+
 struct nn_worker_fd {
     int src;
     struct nn_fsm *owner;
     struct nn_poller_hndl hndl;
+
+    /*  NN_WORKER_FD_IN and NN_WORKER_FD_OUT bits the fd is polled for. */
+    int events;
+
+    /*  If set, the owner handles NN_WORKER_FD_MIGRATE events. */
+    int migratable;
+
+    /*  Number of events reported on the fd during the balancing interval
+        identified by 'epoch' and whether the fd was registered with
+        the worker before that interval began. */
+    uint64_t nevents;
+    uint64_t epoch;
+    int seen;
+
+    /*  The worker the fd is asked to move to. Valid only while
+        NN_WORKER_FD_MIGRATE is being processed. */
+    struct nn_worker *dest;
+
+    /*  The fd is in the worker's list of paused fds if it's not polled for
+        IN until the memory held by messages drops below the budget. */
+    struct nn_list_item paused;
 };
 
 void nn_worker_fd_init (struct nn_worker_fd *self, int src,
     struct nn_fsm *owner);
 void nn_worker_fd_term (struct nn_worker_fd *self);
 
+/*  Lets the worker move the fd to another worker when balancing the load. */
+void nn_worker_fd_setmigratable (struct nn_worker_fd *self);
+
 struct nn_worker_task {
     int src;
     struct nn_fsm *owner;
@@ -49,6 +93,11 @@ struct nn_worker_task {
 };
 
 struct nn_worker {
+
+    /*  Tasks posted by other threads are pushed to 'incoming' without
+        locking. The mutex guards moving them to 'tasks', which is done
+        by the worker thread and by nn_worker_cancel. */
+    struct nn_mpscq incoming;
     struct nn_mutex sync;
     struct nn_queue tasks;
     struct nn_queue_item stop;
@@ -57,11 +106,82 @@ struct nn_worker {
     struct nn_poller_hndl efd_hndl;
     struct nn_timerset timerset;
     struct nn_thread thread;
+    struct nn_worker_stats stats;
+
+    /*  The worker thread sets the worker up itself, then posts 'ready'
+        with the result in 'initrc'. */
+    struct nn_sem ready;
+    int initrc;
+
+    /*  Time, in microseconds, when the last wait for events finished. */
+    uint64_t start;
+
+    /*  If set, the worker has no thread of its own. Its events are
+        processed by nn_worker_run, with 'runsync' ensuring that only one
+        thread does so at a time. */
+    int external;
+    struct nn_mutex runsync;
+
+    /*  Receive buffers given back by idle sockets, to be reused when some
+        socket handled by the worker becomes readable. They are chained
+        through their first bytes. */
+    struct nn_mutex bufsync;
+    void *bufs;
+    int nbufs;
+
+    /*  Every 'balance' milliseconds, zero meaning never, the worker
+        computes its load, i.e. the per mille of the last interval it was
+        busy. If it's much higher than the load of another worker, the
+        'hot' fd, the one with the most events during the interval, is
+        handed over to that worker. 'epoch' counts the intervals, the other
+        members hold the time and the counters at the start of the
+        current one. */
+    int balance;
+    uint64_t epoch;
+    uint64_t load;
+    uint64_t since;
+    uint64_t busy;
+    uint64_t events;
+    struct nn_worker_fd *hot;
+
+    /*  Fds paused by nn_worker_pause_in. */
+    struct nn_list paused;
+
+    /*  If set, the worker busy-polls, see nn_worker_setspin. */
+    volatile int spin;
 };
 
+/*  Returns a buffer given back by nn_worker_putbuf, NULL if there's none.
+    All the cached buffers are NN_USOCK_BATCH_SIZE bytes long. */
+void *nn_worker_getbuf (struct nn_worker *self);
+
+/*  Gives a buffer back for reuse. If the cache is full, the buffer is
+    freed. */
+void nn_worker_putbuf (struct nn_worker *self, void *buf);
+
 void nn_worker_add_fd (struct nn_worker *self, int s, struct nn_worker_fd *fd);
 void nn_worker_rm_fd(struct nn_worker *self, struct nn_worker_fd *fd);
 void nn_worker_set_in (struct nn_worker *self, struct nn_worker_fd *fd);
 void nn_worker_reset_in (struct nn_worker *self, struct nn_worker_fd *fd);
+
+/*  Asks for IN to be delivered again in the next iteration of the worker,
+    once the other ready file descriptors were served. To be used when
+    the user stopped reading before the file descriptor was drained. */
+void nn_worker_defer_in (struct nn_worker *self, struct nn_worker_fd *fd);
+
+/*  Stops polling the fd for IN while the memory held by messages in
+    the process exceeds the budget set with NN_MEMBUDGET_RECV flag. Once
+    it doesn't, IN is polled for again, unless nn_worker_reset_in was
+    called in the meantime. */
+void nn_worker_pause_in (struct nn_worker *self, struct nn_worker_fd *fd);
 void nn_worker_set_out (struct nn_worker *self, struct nn_worker_fd *fd);
 void nn_worker_reset_out (struct nn_worker *self, struct nn_worker_fd *fd);
+
+/*  Adds an fd removed from another worker, polling it for the same events
+    it was polled for there. */
+void nn_worker_adopt_fd (struct nn_worker *self, int s,
+    struct nn_worker_fd *fd);
+
+/*  Returns 1 if the task was posted to the worker and wasn't processed yet,
+    0 otherwise. */
+int nn_worker_pending (struct nn_worker *self, struct nn_worker_task *task);
@@ -25,6 +25,7 @@
 
 #include "../utils/win.h"
 #include "../utils/thread.h"
+#include "../utils/atomic.h"
 
 struct nn_worker_task {
     int src;
@@ -39,6 +40,9 @@ struct nn_worker_op {
     struct nn_fsm *owner;
     int state;
 
+    /*  Number of bytes transferred by the operation that completed last. */
+    size_t nbytes;
+
     /*  This structure is to be used by the user, not nn_worker_op itself.
         Actual usage is specific to the asynchronous operation in question. */
     OVERLAPPED olpd;
@@ -59,6 +63,38 @@ struct nn_worker {
     HANDLE cp;
     struct nn_timerset timerset;
     struct nn_thread thread;
+    struct nn_worker_stats stats;
+
+#if defined NN_USE_RIO
+    /*  Completion queue shared by the Registered I/O request queues of
+        the connections handled by the worker, RIO_INVALID_CQ if the system
+        doesn't support Registered I/O. It signals new completions via
+        the completion port, using 'rioolpd'. 'rioused' is the number of
+        its entries reserved by the request queues. */
+    RIO_CQ riocq;
+    OVERLAPPED rioolpd;
+    struct nn_atomic rioused;
+#endif
 };
 
 HANDLE nn_worker_getcp (struct nn_worker *self);
+
+#if defined NN_USE_RIO
+
+/*  Number of entries in the completion queue of a worker. */
+#define NN_WORKER_RIO_CQ_SIZE 65536
+
+/*  Returns the Registered I/O functions, NULL if the system doesn't
+    support them. Valid once the first worker was initialised. */
+const RIO_EXTENSION_FUNCTION_TABLE *nn_worker_rio (void);
+
+/*  Reserves 'n' entries of the worker's completion queue for a request
+    queue and returns the completion queue. Returns RIO_INVALID_CQ if there
+    are not enough entries left, in which case the caller is expected to
+    fall back to overlapped I/O. The request context of the requests
+    issued to the request queue must point to the nn_worker_op to
+    complete. */
+RIO_CQ nn_worker_rio_reserve (struct nn_worker *self, int n);
+void nn_worker_rio_release (struct nn_worker *self, int n);
+
+#endif
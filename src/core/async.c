@@ -0,0 +1,511 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+
+#include "async.h"
+#include "global.h"
+#include "sock.h"
+
+#include "../aio/ctx.h"
+#include "../aio/fsm.h"
+#include "../aio/worker.h"
+
+#include "../utils/err.h"
+#include "../utils/alloc.h"
+#include "../utils/attr.h"
+#include "../utils/chunk.h"
+#include "../utils/chunkref.h"
+#include "../utils/cont.h"
+#include "../utils/fast.h"
+#include "../utils/msg.h"
+#include "../utils/mutex.h"
+#include "../utils/sem.h"
+
+/*  Maximum number of operations of either kind done at once. */
+#define NN_ASYNC_BATCH 32
+
+/*  Maximum number of batches done before the worker gets a chance to handle
+    other tasks. */
+#define NN_ASYNC_ROUNDS 8
+
+#define NN_ASYNC_SRC_TASK 1
+
+/*  Kinds of the operations. */
+#define NN_ASYNC_SEND 0
+#define NN_ASYNC_RECV 1
+#define NN_ASYNC_WAIT 2
+
+/*  Queue of operations, linked through their 'next' fields. */
+struct nn_async_queue {
+    struct nn_aio *head;
+    struct nn_aio **tail;
+};
+
+/*  Asynchronous operations on a socket. They are done by a worker task,
+    which is queued whenever an operation is submitted or the socket hook
+    reports the socket to be readable or writable, and calls the completion
+    callbacks from within its own context. Created by the first operation
+    submitted, the object lives as long as the socket does and its hook stays
+    installed till then. */
+struct nn_async {
+    struct nn_sock *sock;
+    struct nn_sock_hook hook;
+    struct nn_fsm fsm;
+    struct nn_ctx ctx;
+    struct nn_worker *worker;
+    struct nn_worker_task task;
+
+    /*  Guards the queues and the flags below. Only the task removes
+        operations from the queues. */
+    struct nn_mutex sync;
+    struct nn_async_queue sends;
+    struct nn_async_queue recvs;
+    struct nn_async_queue waits;
+
+    /*  'scheduled' is set while the task is queued to the worker and
+        'running' while it's executed. Once 'closing' is set, the task posts
+        'done' when it's neither. */
+    int scheduled;
+    int running;
+    int closing;
+    struct nn_sem done;
+};
+
+static int nn_async_get (struct nn_sock *sock, struct nn_async **result);
+static int nn_async_submit (int s, struct nn_aio *aio, int kind);
+static void nn_async_notify (struct nn_sock_hook *self);
+static void nn_async_schedule (struct nn_async *self);
+static void nn_async_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static int nn_async_send (struct nn_async *self);
+static int nn_async_recv (struct nn_async *self);
+static int nn_async_wait (struct nn_async *self);
+static struct nn_aio *nn_async_pop (struct nn_async *self,
+    struct nn_async_queue *queue);
+
+int nn_send_async (int s, struct nn_aio *aio)
+{
+    return nn_async_submit (s, aio, NN_ASYNC_SEND);
+}
+
+int nn_recv_async (int s, struct nn_aio *aio)
+{
+    return nn_async_submit (s, aio, NN_ASYNC_RECV);
+}
+
+int nn_wait_async (int s, struct nn_aio *aio)
+{
+    return nn_async_submit (s, aio, NN_ASYNC_WAIT);
+}
+
+static int nn_async_submit (int s, struct nn_aio *aio, int kind)
+{
+    int rc;
+    struct nn_sock *sock;
+    struct nn_async *self;
+    struct nn_async_queue *queue;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (!aio || !aio->fn)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    if (nn_slow (kind == NN_ASYNC_SEND && !aio->msg)) {
+        rc = -EFAULT;
+        goto fail;
+    }
+    if (nn_slow (kind == NN_ASYNC_WAIT && (!aio->events ||
+          (aio->events & ~(NN_POLLIN | NN_POLLOUT))))) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    rc = nn_async_get (sock, &self);
+    if (nn_slow (rc < 0))
+        goto fail;
+
+    /*  The operation is done by the task. The hold on the socket keeps
+        nn_async_term from running in the meantime. */
+    aio->next = NULL;
+    aio->err = 0;
+    queue = kind == NN_ASYNC_SEND ? &self->sends :
+        kind == NN_ASYNC_RECV ? &self->recvs : &self->waits;
+    nn_mutex_lock (&self->sync);
+    *queue->tail = aio;
+    queue->tail = &aio->next;
+    nn_mutex_unlock (&self->sync);
+    nn_async_schedule (self);
+
+    nn_global_rele_socket (s);
+
+    return 0;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+static int nn_async_get (struct nn_sock *sock, struct nn_async **result)
+{
+    struct nn_async *self;
+
+    /*  The object is created along with the hook, in the socket context, so
+        that the socket can still be spliced if it's never used this way. */
+    nn_ctx_enter (nn_sock_getctx (sock));
+    self = sock->async;
+    if (nn_slow (!self)) {
+        if (nn_slow (sock->hook != NULL)) {
+            nn_ctx_leave (nn_sock_getctx (sock));
+            return -EBUSY;
+        }
+        self = nn_alloc (sizeof (struct nn_async), "async");
+        alloc_assert (self);
+        self->sock = sock;
+        self->hook.fn = nn_async_notify;
+        self->hook.events = 0;
+        nn_ctx_init (&self->ctx, nn_global_getpool (), NULL);
+        nn_fsm_init_root (&self->fsm, nn_async_handler, nn_async_handler,
+            &self->ctx);
+        self->worker = nn_ctx_choose_worker (nn_sock_getctx (sock));
+        nn_worker_task_init (&self->task, NN_ASYNC_SRC_TASK, &self->fsm);
+        nn_mutex_init (&self->sync);
+        self->sends.head = NULL;
+        self->sends.tail = &self->sends.head;
+        self->recvs.head = NULL;
+        self->recvs.tail = &self->recvs.head;
+        self->waits.head = NULL;
+        self->waits.tail = &self->waits.head;
+        self->scheduled = 0;
+        self->running = 0;
+        self->closing = 0;
+        nn_sem_init (&self->done);
+        sock->async = self;
+        sock->hook = &self->hook;
+    }
+    nn_ctx_leave (nn_sock_getctx (sock));
+
+    *result = self;
+    return 0;
+}
+
+void nn_async_term (struct nn_async *self)
+{
+    int rc;
+    int wait;
+    struct nn_aio *aio;
+
+    /*  No operations can be submitted by now and the socket is stopped, so
+        the hook is not notified any more. Wait till the task is done with
+        the notification it got when the socket was being closed. */
+    rc = nn_sock_sethook (self->sock, NULL);
+    errnum_assert (rc == 0, -rc);
+    nn_mutex_lock (&self->sync);
+    self->closing = 1;
+    wait = self->scheduled || self->running;
+    nn_mutex_unlock (&self->sync);
+    while (wait) {
+        rc = nn_pool_wait (nn_global_getpool (), &self->done);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        wait = 0;
+    }
+    nn_ctx_enter (&self->ctx);
+    nn_ctx_leave (&self->ctx);
+
+    /*  The operations that are left fail. */
+    while ((aio = nn_async_pop (self, &self->sends)) != NULL) {
+        aio->err = EBADF;
+        aio->fn (aio);
+    }
+    while ((aio = nn_async_pop (self, &self->recvs)) != NULL) {
+        aio->msg = NULL;
+        aio->len = 0;
+        aio->err = EBADF;
+        aio->fn (aio);
+    }
+    while ((aio = nn_async_pop (self, &self->waits)) != NULL) {
+        aio->events = 0;
+        aio->err = EBADF;
+        aio->fn (aio);
+    }
+
+    nn_sem_term (&self->done);
+    nn_mutex_term (&self->sync);
+    nn_worker_task_term (&self->task);
+    nn_fsm_term (&self->fsm);
+    nn_ctx_term (&self->ctx);
+    nn_free (self);
+}
+
+static void nn_async_notify (struct nn_sock_hook *self)
+{
+    nn_async_schedule (nn_cont (self, struct nn_async, hook));
+}
+
+static void nn_async_schedule (struct nn_async *self)
+{
+    nn_mutex_lock (&self->sync);
+    if (!self->scheduled) {
+        self->scheduled = 1;
+        nn_worker_execute (self->worker, &self->task);
+    }
+    nn_mutex_unlock (&self->sync);
+}
+
+static struct nn_aio *nn_async_pop (struct nn_async *self,
+    struct nn_async_queue *queue)
+{
+    struct nn_aio *aio;
+
+    nn_mutex_lock (&self->sync);
+    aio = queue->head;
+    if (aio) {
+        queue->head = aio->next;
+        if (!queue->head)
+            queue->tail = &queue->head;
+        aio->next = NULL;
+    }
+    nn_mutex_unlock (&self->sync);
+
+    return aio;
+}
+
+static void nn_async_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_async *async;
+    int round;
+    int more;
+
+    async = nn_cont (self, struct nn_async, fsm);
+
+    nn_assert (src == NN_ASYNC_SRC_TASK && type == NN_WORKER_TASK_EXECUTE);
+
+    /*  From now on, any notification or submission queues the task anew. */
+    nn_mutex_lock (&async->sync);
+    nn_assert (async->scheduled);
+    async->scheduled = 0;
+    async->running = 1;
+    nn_mutex_unlock (&async->sync);
+
+    for (round = 0; round != NN_ASYNC_ROUNDS; ++round) {
+        more = nn_async_send (async);
+        more |= nn_async_recv (async);
+        more |= nn_async_wait (async);
+        if (!more)
+            break;
+    }
+
+    /*  If the operations were cut short, continue once the worker is done
+        with the tasks that are already queued. */
+    nn_mutex_lock (&async->sync);
+    async->running = 0;
+    if (round == NN_ASYNC_ROUNDS && !async->scheduled) {
+        async->scheduled = 1;
+        nn_worker_execute (async->worker, &async->task);
+    }
+    if (async->closing && !async->scheduled)
+        nn_sem_post (&async->done);
+    nn_mutex_unlock (&async->sync);
+}
+
+/*  Returns 1 if a full batch of the operations was done, 0 otherwise. */
+static int nn_async_send (struct nn_async *self)
+{
+    int rc;
+    int i;
+    int count;
+    size_t bytes;
+    struct nn_aio *aio;
+    struct nn_aio *aios [NN_ASYNC_BATCH];
+    struct nn_msg msgs [NN_ASYNC_BATCH];
+    size_t sizes [NN_ASYNC_BATCH];
+
+    /*  Only the task removes operations from the queue, so the ones at its
+        head stay there till the messages are sent. */
+    nn_mutex_lock (&self->sync);
+    count = 0;
+    for (aio = self->sends.head; aio && count != NN_ASYNC_BATCH;
+          aio = aio->next)
+        aios [count++] = aio;
+    nn_mutex_unlock (&self->sync);
+    if (!count)
+        return 0;
+
+    for (i = 0; i != count; ++i) {
+        sizes [i] = nn_chunk_size (aios [i]->msg);
+        nn_msg_init_chunk (&msgs [i], aios [i]->msg);
+    }
+    rc = nn_sock_sendmany (self->sock, msgs, count, NN_DONTWAIT);
+
+    /*  The messages that were not sent remain with the operations. If the
+        socket is not writable, they wait for the hook to be notified. */
+    for (i = rc > 0 ? rc : 0; i != count; ++i) {
+        nn_chunkref_init (&msgs [i].body, 0);
+        nn_msg_term (&msgs [i]);
+    }
+    if (rc == -EAGAIN)
+        return 0;
+
+    /*  Any other error fails the operation at the head of the queue, or
+        all of them if the socket is being closed. */
+    if (nn_slow (rc < 0)) {
+        for (i = 0; i != (rc == -EBADF ? count : 1); ++i) {
+            aio = nn_async_pop (self, &self->sends);
+            aio->err = -rc;
+            aio->fn (aio);
+        }
+        return rc != -EBADF;
+    }
+
+    /*  Complete the operations. */
+    bytes = 0;
+    for (i = 0; i != rc; ++i) {
+        aio = nn_async_pop (self, &self->sends);
+        nn_assert (aio == aios [i]);
+        aio->len = sizes [i];
+        bytes += aio->len;
+        aio->msg = NULL;
+    }
+    nn_sock_stat_increment (self->sock, NN_STAT_MESSAGES_SENT, rc);
+    nn_sock_stat_increment (self->sock, NN_STAT_BYTES_SENT, bytes);
+    for (i = 0; i != rc; ++i)
+        aios [i]->fn (aios [i]);
+
+    return rc == NN_ASYNC_BATCH;
+}
+
+/*  Returns 1 if a full batch of the operations was done, 0 otherwise. */
+static int nn_async_recv (struct nn_async *self)
+{
+    int rc;
+    int i;
+    int count;
+    size_t bytes;
+    struct nn_aio *aio;
+    struct nn_aio *aios [NN_ASYNC_BATCH];
+    struct nn_msg msgs [NN_ASYNC_BATCH];
+
+    nn_mutex_lock (&self->sync);
+    count = 0;
+    for (aio = self->recvs.head; aio && count != NN_ASYNC_BATCH;
+          aio = aio->next)
+        ++count;
+    nn_mutex_unlock (&self->sync);
+    if (!count)
+        return 0;
+
+    rc = nn_sock_recvmany (self->sock, msgs, count, NN_DONTWAIT);
+    if (rc == -EAGAIN)
+        return 0;
+
+    /*  An error fails all the operations waiting for messages, as none of
+        them would get one. */
+    if (nn_slow (rc < 0)) {
+        for (i = 0; i != count; ++i) {
+            aio = nn_async_pop (self, &self->recvs);
+            aio->msg = NULL;
+            aio->len = 0;
+            aio->err = -rc;
+            aio->fn (aio);
+        }
+        return 0;
+    }
+
+    /*  Hand the messages over to the operations. Properties of the messages
+        are not passed to the user, so any file descriptors they carry are
+        closed. */
+    bytes = 0;
+    for (i = 0; i != rc; ++i) {
+        aios [i] = nn_async_pop (self, &self->recvs);
+        aios [i]->msg = nn_chunkref_getchunk_type (&msgs [i].body,
+            self->sock->ep_template.rcvpool);
+        aios [i]->len = nn_chunk_size (aios [i]->msg);
+        bytes += aios [i]->len;
+        nn_msg_closefds (&msgs [i], 0);
+        nn_msg_term (&msgs [i]);
+    }
+    nn_sock_stat_increment (self->sock, NN_STAT_MESSAGES_RECEIVED, rc);
+    nn_sock_stat_increment (self->sock, NN_STAT_BYTES_RECEIVED, bytes);
+    for (i = 0; i != rc; ++i)
+        aios [i]->fn (aios [i]);
+
+    return rc == NN_ASYNC_BATCH;
+}
+
+/*  Returns 1 if a full batch of the operations was done, 0 otherwise. */
+static int nn_async_wait (struct nn_async *self)
+{
+    int events;
+    int count;
+    int i;
+    struct nn_aio *aio;
+    struct nn_aio **prev;
+    struct nn_aio *aios [NN_ASYNC_BATCH];
+
+    nn_mutex_lock (&self->sync);
+    events = 0;
+    for (aio = self->waits.head; aio; aio = aio->next)
+        events |= aio->events;
+    nn_mutex_unlock (&self->sync);
+    if (!events)
+        return 0;
+
+    /*  NN_POLLIN and NN_POLLOUT match the socket's events. If none of the
+        operations is done now, the hook gets notified once one can be. */
+    events = nn_sock_events (self->sock, events);
+
+    /*  Take the operations that are done out of the queue, wherever they
+        are in it. Those waiting for other events stay where they are. */
+    nn_mutex_lock (&self->sync);
+    count = 0;
+    prev = &self->waits.head;
+    while (*prev && count != NN_ASYNC_BATCH) {
+        aio = *prev;
+        if (events >= 0 && !(aio->events & events)) {
+            prev = &aio->next;
+            continue;
+        }
+        *prev = aio->next;
+        if (!*prev)
+            self->waits.tail = prev;
+        aio->next = NULL;
+        aios [count++] = aio;
+    }
+    nn_mutex_unlock (&self->sync);
+
+    for (i = 0; i != count; ++i) {
+        aios [i]->events = events < 0 ? 0 : aios [i]->events & events;
+        aios [i]->err = events < 0 ? -events : 0;
+        aios [i]->fn (aios [i]);
+    }
+
+    return count == NN_ASYNC_BATCH;
+}
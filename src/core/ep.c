@@ -58,8 +58,15 @@ int nn_ep_init (struct nn_ep *self, int src, struct nn_sock *sock, int eid,
     self->sock = sock;
     self->eid = eid;
     self->last_errno = 0;
+    memset (&self->statistics, 0, sizeof (self->statistics));
     nn_list_item_init (&self->item);
     memcpy (&self->options, &sock->ep_template, sizeof(struct nn_ep_options));
+    nn_list_init (&self->standby);
+    self->inuse = 0;
+    if (!bind)
+        self->options.idle = 0;
+    else
+        self->options.standby = 0;
 
     /*  Store the textual form of the address. */
     nn_assert (strlen (addr) <= NN_SOCKADDR_MAX);
@@ -73,6 +80,7 @@ int nn_ep_init (struct nn_ep *self, int src, struct nn_sock *sock, int eid,
 
     /*  Endpoint creation failed. */
     if (rc < 0) {
+        nn_list_term (&self->standby);
         nn_list_item_term (&self->item);
         nn_fsm_term (&self->fsm);
         return rc;
@@ -86,6 +94,7 @@ void nn_ep_term (struct nn_ep *self)
     nn_assert_state (self, NN_EP_STATE_IDLE);
 
     self->vfptr->destroy (self);
+    nn_list_term (&self->standby);
     nn_list_item_term (&self->item);
     nn_fsm_term (&self->fsm);
 }
@@ -110,6 +119,11 @@ void nn_ep_stopped (struct nn_ep *self)
     nn_ctx_raise (self->fsm.ctx, &self->fsm.stopped);
 }
 
+int nn_ep_isactive (struct nn_ep *self)
+{
+    return self->state == NN_EP_STATE_ACTIVE ? 1 : 0;
+}
+
 struct nn_ctx *nn_ep_getctx (struct nn_ep *self)
 {
     return nn_sock_getctx (self->sock);
@@ -209,7 +223,7 @@ void nn_ep_set_error(struct nn_ep *self, int errnum)
         /*  Error is still there, no need to report it again  */
         return;
     if (self->last_errno == 0)
-        nn_sock_stat_increment (self->sock, NN_STAT_CURRENT_EP_ERRORS, 1);
+        nn_ep_stat_increment (self, NN_STAT_CURRENT_EP_ERRORS, 1);
     self->last_errno = errnum;
     nn_sock_report_error (self->sock, self, errnum);
 }
@@ -219,16 +233,123 @@ void nn_ep_clear_error (struct nn_ep *self)
     if (self->last_errno == 0)
         /*  Error is already clear, no need to report it  */
         return;
-    nn_sock_stat_increment (self->sock, NN_STAT_CURRENT_EP_ERRORS, -1);
+    nn_ep_stat_increment (self, NN_STAT_CURRENT_EP_ERRORS, -1);
     self->last_errno = 0;
     nn_sock_report_error (self->sock, self, 0);
 }
 
 void nn_ep_stat_increment (struct nn_ep *self, int name, int increment)
 {
+    switch (name) {
+    case NN_STAT_ESTABLISHED_CONNECTIONS:
+        self->statistics.established_connections += increment;
+        break;
+    case NN_STAT_ACCEPTED_CONNECTIONS:
+        self->statistics.accepted_connections += increment;
+        break;
+    case NN_STAT_DROPPED_CONNECTIONS:
+        self->statistics.dropped_connections += increment;
+        break;
+    case NN_STAT_BROKEN_CONNECTIONS:
+        self->statistics.broken_connections += increment;
+        break;
+    case NN_STAT_CONNECT_ERRORS:
+        self->statistics.connect_errors += increment;
+        break;
+    case NN_STAT_BIND_ERRORS:
+        self->statistics.bind_errors += increment;
+        break;
+    case NN_STAT_ACCEPT_ERRORS:
+        self->statistics.accept_errors += increment;
+        break;
+    case NN_STAT_DROPPED_MESSAGES:
+        self->statistics.dropped_messages += increment;
+        break;
+    case NN_STAT_MESSAGES_SENT:
+        self->statistics.messages_sent += increment;
+        break;
+    case NN_STAT_MESSAGES_RECEIVED:
+        self->statistics.messages_received += increment;
+        break;
+    case NN_STAT_BYTES_SENT:
+        self->statistics.bytes_sent += increment;
+        break;
+    case NN_STAT_BYTES_RECEIVED:
+        self->statistics.bytes_received += increment;
+        break;
+    case NN_STAT_CURRENT_CONNECTIONS:
+        self->statistics.current_connections += increment;
+        break;
+    case NN_STAT_INPROGRESS_CONNECTIONS:
+        self->statistics.inprogress_connections += increment;
+        break;
+    }
+
+    /*  The socket's message and byte counters are updated by nn_send and
+        nn_recv rather than by the pipes. */
+    switch (name) {
+    case NN_STAT_MESSAGES_SENT:
+    case NN_STAT_MESSAGES_RECEIVED:
+    case NN_STAT_BYTES_SENT:
+    case NN_STAT_BYTES_RECEIVED:
+        return;
+    }
     nn_sock_stat_increment (self->sock, name, increment);
 }
 
+int nn_ep_stat_get (struct nn_ep *self, int name, uint64_t *value)
+{
+    switch (name) {
+    case NN_STAT_ESTABLISHED_CONNECTIONS:
+        *value = self->statistics.established_connections;
+        return 0;
+    case NN_STAT_ACCEPTED_CONNECTIONS:
+        *value = self->statistics.accepted_connections;
+        return 0;
+    case NN_STAT_DROPPED_CONNECTIONS:
+        *value = self->statistics.dropped_connections;
+        return 0;
+    case NN_STAT_BROKEN_CONNECTIONS:
+        *value = self->statistics.broken_connections;
+        return 0;
+    case NN_STAT_CONNECT_ERRORS:
+        *value = self->statistics.connect_errors;
+        return 0;
+    case NN_STAT_BIND_ERRORS:
+        *value = self->statistics.bind_errors;
+        return 0;
+    case NN_STAT_ACCEPT_ERRORS:
+        *value = self->statistics.accept_errors;
+        return 0;
+    case NN_STAT_DROPPED_MESSAGES:
+        *value = self->statistics.dropped_messages;
+        return 0;
+    case NN_STAT_MESSAGES_SENT:
+        *value = self->statistics.messages_sent;
+        return 0;
+    case NN_STAT_MESSAGES_RECEIVED:
+        *value = self->statistics.messages_received;
+        return 0;
+    case NN_STAT_BYTES_SENT:
+        *value = self->statistics.bytes_sent;
+        return 0;
+    case NN_STAT_BYTES_RECEIVED:
+        *value = self->statistics.bytes_received;
+        return 0;
+    case NN_STAT_CURRENT_CONNECTIONS:
+        *value = self->statistics.current_connections;
+        return 0;
+    case NN_STAT_INPROGRESS_CONNECTIONS:
+        *value = self->statistics.inprogress_connections;
+        return 0;
+    case NN_STAT_CURRENT_EP_ERRORS:
+        *value = self->last_errno ? 1 : 0;
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
 /*  Get transport private state object. */
 void *nn_ep_tran_private (struct nn_ep *self)
 {
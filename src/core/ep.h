@@ -42,9 +42,34 @@ struct nn_ep {
     char addr [NN_SOCKADDR_MAX + 1];
     int protocol;
 
+    /*  Connections held in reserve (see NN_STANDBY) and the number of those
+        passed to the protocol. */
+    struct nn_list standby;
+    int inuse;
+
     /*  Error state for endpoint */
     int last_errno;
 
+    /*  Counterparts of the socket statistics, restricted to the endpoint.
+        The message and byte counters cover all of its connections, past
+        and present. */
+    struct {
+        uint64_t established_connections;
+        uint64_t accepted_connections;
+        uint64_t dropped_connections;
+        uint64_t broken_connections;
+        uint64_t connect_errors;
+        uint64_t bind_errors;
+        uint64_t accept_errors;
+        uint64_t dropped_messages;
+        uint64_t messages_sent;
+        uint64_t messages_received;
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        int current_connections;
+        int inprogress_connections;
+    } statistics;
+
     /*  Transport private state structure */
     void *tran_private;
 
@@ -61,6 +86,9 @@ void nn_ep_stop (struct nn_ep *self);
 
 void nn_ep_stopped (struct nn_ep *self);
 
+/*  Returns 1 if the endpoint is running, i.e. it wasn't asked to stop. */
+int nn_ep_isactive (struct nn_ep *self);
+
 struct nn_ctx *nn_ep_getctx (struct nn_ep *self);
 const char *nn_ep_getaddr (struct nn_ep *self);
 void nn_ep_getopt (struct nn_ep *self, int level, int option,
@@ -70,4 +98,8 @@ void nn_ep_set_error(struct nn_ep *self, int errnum);
 void nn_ep_clear_error(struct nn_ep *self);
 void nn_ep_stat_increment(struct nn_ep *self, int name, int increment);
 
+/*  Retrieves the value of the endpoint's statistic. Returns -EINVAL if
+    there's no such statistic for an endpoint. */
+int nn_ep_stat_get (struct nn_ep *self, int name, uint64_t *value);
+
 #endif
@@ -30,30 +30,47 @@
 #include "sock.h"
 #include "ep.h"
 
+#include "../aio/ctx.h"
 #include "../aio/pool.h"
 #include "../aio/timer.h"
 
 #include "../utils/err.h"
 #include "../utils/alloc.h"
 #include "../utils/mutex.h"
+#include "../utils/atomic.h"
 #include "../utils/condvar.h"
+#include "../utils/sem.h"
 #include "../utils/once.h"
 #include "../utils/list.h"
 #include "../utils/cont.h"
 #include "../utils/random.h"
 #include "../utils/chunk.h"
+#include "../utils/clock.h"
 #include "../utils/msg.h"
+#include "../utils/wire.h"
 #include "../utils/attr.h"
+#include "../utils/trace.h"
+#include "../utils/statshm.h"
+#include "../utils/copy.h"
 
 #include "../transports/inproc/inproc.h"
+#include "../transports/sim/sim.h"
 #include "../transports/ipc/ipc.h"
+#include "../transports/shm/shm.h"
 #include "../transports/tcp/tcp.h"
+#include "../transports/tcpmux/tcpmux.h"
 #include "../transports/ws/ws.h"
+#include "../transports/udp/udp.h"
+#include "../transports/tls/tls.h"
+#include "../transports/rdma/rdma.h"
 
 #include "../pubsub.h"
 #include "../pipeline.h"
+#include "../ipc.h"
 
+#include <limits.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -62,15 +79,44 @@
 #include "../utils/win.h"
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #endif
 
 /*  Max number of concurrent SP sockets. */
-#define NN_MAX_SOCKETS 512
+#ifndef NN_MAX_SOCKETS
+#define NN_MAX_SOCKETS 65536
+#endif
+
+/*  The socket table grows in chunks of this many slots. Chunks are never
+    moved or deallocated, so a slot can be accessed without the global lock
+    even while the table grows. */
+#define NN_GLOBAL_CHUNK_SLOTS 256
+#define NN_GLOBAL_MAX_CHUNKS (NN_MAX_SOCKETS / NN_GLOBAL_CHUNK_SLOTS)
+CT_ASSERT (NN_MAX_SOCKETS % NN_GLOBAL_CHUNK_SLOTS == 0);
+
+/*  Default number of slots allocated when the library is initialised. */
+#define NN_GLOBAL_DEFAULT_SLOTS NN_GLOBAL_CHUNK_SLOTS
+
+/*  How often, in milliseconds, nn_term checks whether the sockets are
+    done closing. */
+#define NN_GLOBAL_TERM_INTERVAL 1
 
-/*  To save some space, list of unused socket slots uses uint16_t integers to
-    refer to individual sockets. If there's a need to more that 0x10000 sockets,
-    the type should be changed to uint32_t or int. */
-CT_ASSERT (NN_MAX_SOCKETS <= 0x10000);
+/*  Maximum number of deallocated socket objects kept for reuse. */
+#define NN_GLOBAL_MAX_FREE_SOCKS 64
+
+/*  Layout of the state word of a socket table slot. The low bits count the
+    holds on the socket, NN_GLOBAL_SLOT_LIVE is set while the descriptor
+    refers to an open socket and the remaining bits are a generation counter
+    bumped each time the slot is vacated, so that a compare-and-swap based on
+    a stale value can never succeed. */
+#define NN_GLOBAL_SLOT_HOLDS 0x7fffu
+#define NN_GLOBAL_SLOT_LIVE 0x8000u
+#define NN_GLOBAL_SLOT_GEN 0x10000u
+
+/*  Number of messages nn_sendmmsg and nn_recvmmsg pass down to the socket
+    in a single locked operation. */
+#define NN_GLOBAL_MMSG_BATCH 16
 
 #define NN_CTX_FLAG_TERMED 1
 #define NN_CTX_FLAG_TERMING 2
@@ -78,72 +124,139 @@ CT_ASSERT (NN_MAX_SOCKETS <= 0x10000);
 
 #define NN_GLOBAL_SRC_STAT_TIMER 1
 
+/*  Default interval between two statistics reports, in milliseconds. */
+#define NN_GLOBAL_STAT_INTERVAL 10000
+
+/*  Size of the buffer a statistics report for a single socket is formatted
+    into, and the most a single field of the report can take. */
+#define NN_GLOBAL_STAT_BUFSIZE 2048
+#define NN_GLOBAL_STAT_FIELDSIZE 96
+
+/*  Most allocation sites reported by the allocation monitor report. */
+#define NN_GLOBAL_ALLOC_STATS 128
+
 #define NN_GLOBAL_STATE_IDLE           1
 #define NN_GLOBAL_STATE_ACTIVE         2
 #define NN_GLOBAL_STATE_STOPPING_TIMER 3
 
 /*  We could put these in an external header file, but there really is
     need to.  We are the only thing that needs them. */
+#if defined NN_HAVE_PAIR
 extern struct nn_socktype nn_pair_socktype;
 extern struct nn_socktype nn_xpair_socktype;
+#endif
+#if defined NN_HAVE_PUBSUB
 extern struct nn_socktype nn_pub_socktype;
 extern struct nn_socktype nn_sub_socktype;
 extern struct nn_socktype nn_xpub_socktype;
 extern struct nn_socktype nn_xsub_socktype;
+#endif
+#if defined NN_HAVE_REQREP
 extern struct nn_socktype nn_rep_socktype;
 extern struct nn_socktype nn_req_socktype;
 extern struct nn_socktype nn_xrep_socktype;
 extern struct nn_socktype nn_xreq_socktype;
+#endif
+#if defined NN_HAVE_PIPELINE
 extern struct nn_socktype nn_push_socktype;
 extern struct nn_socktype nn_xpush_socktype;
 extern struct nn_socktype nn_pull_socktype;
 extern struct nn_socktype nn_xpull_socktype;
+#endif
+#if defined NN_HAVE_SURVEY
 extern struct nn_socktype nn_respondent_socktype;
 extern struct nn_socktype nn_surveyor_socktype;
 extern struct nn_socktype nn_xrespondent_socktype;
 extern struct nn_socktype nn_xsurveyor_socktype;
+#endif
+#if defined NN_HAVE_BUS
 extern struct nn_socktype nn_bus_socktype;
 extern struct nn_socktype nn_xbus_socktype;
+#endif
 
 /*  Array of known socket types. */
 const struct nn_socktype *nn_socktypes[] = {
+#if defined NN_HAVE_PAIR
     &nn_pair_socktype,
     &nn_xpair_socktype,
+#endif
+#if defined NN_HAVE_PUBSUB
     &nn_pub_socktype,
     &nn_sub_socktype,
     &nn_xpub_socktype,
     &nn_xsub_socktype,
+#endif
+#if defined NN_HAVE_REQREP
     &nn_rep_socktype,
     &nn_req_socktype,
     &nn_xrep_socktype,
     &nn_xreq_socktype,
+#endif
+#if defined NN_HAVE_PIPELINE
     &nn_push_socktype,
     &nn_xpush_socktype,
     &nn_pull_socktype,
     &nn_xpull_socktype,
+#endif
+#if defined NN_HAVE_SURVEY
     &nn_respondent_socktype,
     &nn_surveyor_socktype,
     &nn_xrespondent_socktype,
     &nn_xsurveyor_socktype,
+#endif
+#if defined NN_HAVE_BUS
     &nn_bus_socktype,
     &nn_xbus_socktype,
+#endif
     NULL,
 };
 
+struct nn_global_slot {
+
+    /*  Holds, liveness and generation of the slot, as described above. */
+    struct nn_atomic state;
+
+    /*  The socket itself. Valid while the slot is live or held. */
+    struct nn_sock *sock;
+
+    /*  Next unused slot while the slot is on the unused list, next closing
+        one while it's on the closing list. */
+    int next;
+};
+
 struct nn_global {
 
-    /*  The global table of existing sockets. The descriptor representing
-        the socket is the index to this table. This pointer is also used to
-        find out whether context is initialised. If it is NULL, context is
-        uninitialised. */
-    struct nn_sock **socks;
+    /*  The global table of existing sockets, split into chunks. The
+        descriptor representing the socket is the index to this table.
+        Holds are taken and released without the global lock, which is why
+        the chunks are never deallocated. */
+    struct nn_global_slot *volatile chunks [NN_GLOBAL_MAX_CHUNKS];
+    int nchunks;
+
+    /*  Stack of unused file descriptors, linked through the slots. -1 if
+        all the allocated slots are in use. */
+    int unused;
 
-    /*  Stack of unused file descriptors. */
-    uint16_t *unused;
+    /*  Sockets closed by nn_close_async that are not deallocated yet,
+        linked through the slots. -1 if there are none. The slots are not
+        reused till then. */
+    int closing;
+
+    /*  Deallocated socket objects kept for reuse, chained through their
+        first bytes. */
+    void *freesocks;
+    int nfreesocks;
+
+    /*  Non-zero if the context is initialised. */
+    int initialised;
 
     /*  Number of actual open sockets in the socket table. */
     size_t nsocks;
 
+    /*  Number of threads using the external worker at the moment. The
+        global context isn't uninitialised until they are done. */
+    int nloops;
+
     /*  Combination of the flags listed above. */
     int flags;
 
@@ -156,7 +269,27 @@ struct nn_global {
     struct nn_pool pool;
 
     /*  Timer and other machinery for submitting statistics  */
+    struct nn_ctx ctx;
+    struct nn_fsm fsm;
     int state;
+    struct nn_timer stat_timer;
+    struct nn_sem stat_stopped;
+
+    /*  Socket the statistics are published on, NULL if reporting is
+        disabled. It is private to the library and doesn't occupy a slot
+        in the socket table. */
+    struct nn_sock *stat_sock;
+
+    /*  Interval between two statistics reports, in milliseconds. */
+    int stat_interval;
+
+    /*  Shared memory segment the statistics are exported into, if
+        'stat_shm' is set. 'stat_ids' lists the statistics in the order
+        they have in the segment. */
+    int stat_shm;
+    struct nn_statshm statshm;
+    int *stat_ids;
+    int nstat_ids;
 
     int print_errors;
 
@@ -172,6 +305,9 @@ static nn_once_t once = NN_ONCE_INITIALIZER;
 /*  Context creation- and termination-related private functions. */
 static void nn_global_init (void);
 static void nn_global_term (void);
+static int nn_global_close (int s, int async);
+static void nn_global_release (int s);
+static void nn_global_reap (void);
 
 /*  Transport-related private functions. */
 static void nn_global_add_transport (struct nn_transport *transport);
@@ -179,15 +315,44 @@ static void nn_global_add_transport (struct nn_transport *transport);
 /*  Private function that unifies nn_bind and nn_connect functionality.
     It returns the ID of the newly created endpoint. */
 static int nn_global_create_ep (struct nn_sock *, const char *addr, int bind);
+static int nn_global_parse_addr (const char *addr,
+    struct nn_transport **tpp, const char **addrp);
 
 /*  Private socket creator which doesn't initialize global state and
     does no locking by itself */
 static int nn_global_create_socket (int domain, int protocol);
 
-/*  Socket holds. */
-static int nn_global_hold_socket (struct nn_sock **sockp, int s);
-static int nn_global_hold_socket_locked (struct nn_sock **sockp, int s);
-static void nn_global_rele_socket(struct nn_sock *);
+/*  Conversion between the message headers supplied by the user and the
+    message objects passed down the stack. nn_global_msg_drop releases a
+    message that was built but not sent; user-supplied chunks stay owned by
+    the user. nn_global_msg_deliver terminates the message and returns the
+    size of its body. Bodies handed over to the user as NN_MSG chunks are
+    allocated from the 'pool' if they have to be. */
+static int nn_global_msg_build (const struct nn_msghdr *msghdr,
+    struct nn_msg *msg, size_t *szp, int *nnmsgp);
+static void nn_global_msg_drop (struct nn_msg *msg, int nnmsg);
+static int nn_global_msghdr_check (const struct nn_msghdr *msghdr);
+static int nn_global_check_cmsgs (const struct nn_msghdr *msghdr);
+static size_t nn_global_msg_deliver (struct nn_msg *msg,
+    struct nn_msghdr *msghdr, int pool);
+static size_t nn_global_msg_pack (struct nn_msg *msg, uint8_t *pos);
+
+/*  Socket table management. */
+static struct nn_global_slot *nn_global_slot (int s);
+static int nn_global_grow (void);
+
+/*  Periodic reporting of socket statistics. */
+static void nn_global_stat_start (void);
+static void nn_global_stat_stop (void);
+static void nn_global_stat_close (void);
+static void nn_global_stat_sock_start (const char *addr);
+static void nn_global_statshm_start (const char *name);
+static void nn_global_statshm_update (unsigned long now);
+static void nn_global_submit_statistics (void);
+static void nn_global_handler (struct nn_fsm *myfsm,
+    int src, int type, void *srcptr);
+static void nn_global_shutdown (struct nn_fsm *myfsm,
+    int src, int type, void *srcptr);
 
 int nn_errno (void)
 {
@@ -201,8 +366,13 @@ const char *nn_strerror (int errnum)
 
 static void nn_global_init (void)
 {
-    int i;
     char *envvar;
+    int nslots;
+    int nworkers;
+    int cpus [NN_POOL_MAX_WORKERS];
+    int ncpus;
+    int i;
+    uint64_t spin;
 
 #if defined NN_HAVE_WINDOWS
     int rc;
@@ -210,7 +380,7 @@ static void nn_global_init (void)
 #endif
 
     /*  Check whether the library was already initialised. If so, do nothing. */
-    if (self.socks)
+    if (self.initialised)
         return;
 
     /*  On Windows, initialise the socket library. */
@@ -227,13 +397,12 @@ static void nn_global_init (void)
     /*  Seed the pseudo-random number generator. */
     nn_random_seed ();
 
-    /*  Allocate the global table of SP sockets. */
-    self.socks = nn_alloc ((sizeof (struct nn_sock*) * NN_MAX_SOCKETS) +
-        (sizeof (uint16_t) * NN_MAX_SOCKETS), "socket table");
-    alloc_assert (self.socks);
-    for (i = 0; i != NN_MAX_SOCKETS; ++i)
-        self.socks [i] = NULL;
+    self.initialised = 1;
     self.nsocks = 0;
+    self.nloops = 0;
+    self.closing = -1;
+    self.freesocks = NULL;
+    self.nfreesocks = 0;
     self.flags = 0;
 
     /*  Print connection and accepting errors to the stderr  */
@@ -241,23 +410,85 @@ static void nn_global_init (void)
     /*  any non-empty string is true */
     self.print_errors = envvar && *envvar;
 
-    /*  Allocate the stack of unused file descriptors. */
-    self.unused = (uint16_t*) (self.socks + NN_MAX_SOCKETS);
-    alloc_assert (self.unused);
-    for (i = 0; i != NN_MAX_SOCKETS; ++i)
-        self.unused [i] = NN_MAX_SOCKETS - i - 1;
+    /*  Payloads this large are copied around the cache. */
+    nn_copy_init ();
+
+    /*  Preallocate the socket table. The table never shrinks, so this is
+        only effective before the first socket is created. */
+    envvar = getenv("NN_SOCKET_TABLE_SIZE");
+    nslots = envvar ? atoi (envvar) : NN_GLOBAL_DEFAULT_SLOTS;
+    while (self.nchunks * NN_GLOBAL_CHUNK_SLOTS < nslots)
+        if (nn_global_grow () < 0)
+            break;
 
     /*  Initialise other parts of the global state. */
     nn_list_init (&self.transports);
 
     /*  Plug in individual transports. */
     nn_global_add_transport (nn_inproc);
+    nn_global_add_transport (nn_sim);
+#if defined NN_HAVE_IPC
     nn_global_add_transport (nn_ipc);
+#endif
+#if defined NN_HAVE_TCP
     nn_global_add_transport (nn_tcp);
+    nn_global_add_transport (nn_tcpmux);
+#endif
+#if defined NN_HAVE_WS
     nn_global_add_transport (nn_ws);
+#endif
+#if defined NN_HAVE_SHM
+    nn_global_add_transport (nn_shm);
+#endif
+#if defined NN_HAVE_UDP
+    nn_global_add_transport (nn_udp);
+#endif
+#if defined NN_HAVE_TLS
+    nn_global_add_transport (nn_tls);
+#endif
+#if defined NN_HAVE_RDMA
+    nn_global_add_transport (nn_rdma);
+#endif
+
+    /*  Number of AIO worker threads, 0 meaning that the AIO is done by
+        the application's event loop. */
+    envvar = getenv("NN_WORKER_THREADS");
+    nworkers = envvar ? atoi (envvar) : NN_POOL_DEFAULT_WORKERS;
+
+    /*  Set up the worker pool. The threads are started once the first AIO
+        object, such as a TCP connection or a running timer, needs them. */
+    nn_pool_init (&self.pool, nworkers);
+
+    /*  Pin the worker threads to CPUs, if requested. */
+    envvar = getenv("NN_WORKER_AFFINITY");
+    if (envvar) {
+        ncpus = nn_global_parse_cpus (envvar, cpus, NN_POOL_MAX_WORKERS);
+        nn_pool_setaffinity (&self.pool, cpus, ncpus);
+    }
+
+    /*  Unless asked otherwise, each socket does its I/O in a single worker,
+        chosen when the socket is created. */
+    envvar = getenv("NN_WORKER_SPREAD");
+    self.pool.spread = envvar ? atoi (envvar) : 0;
+
+    /*  Moving busy connections between the workers is off by default. */
+    envvar = getenv("NN_WORKER_BALANCE");
+    if (envvar)
+        nn_pool_setbalance (&self.pool, atoi (envvar));
+
+    /*  Workers with dedicated cores may busy-poll for events. */
+    envvar = getenv("NN_WORKER_SPIN");
+    if (envvar) {
+        ncpus = nn_global_parse_cpus (envvar, cpus, NN_POOL_MAX_WORKERS);
+        spin = 0;
+        for (i = 0; i != ncpus; ++i)
+            if (cpus [i] < NN_POOL_MAX_WORKERS)
+                spin |= (uint64_t) 1 << cpus [i];
+        nn_pool_setspin (&self.pool, spin);
+    }
 
-    /*  Start the worker threads. */
-    nn_pool_init (&self.pool);
+    /*  Start publishing the statistics, if requested. */
+    nn_global_stat_start ();
 }
 
 static void nn_global_term (void)
@@ -267,15 +498,26 @@ static void nn_global_term (void)
 #endif
     struct nn_list_item *it;
     struct nn_transport *tp;
+    void *sock;
 
     /*  If there are no sockets remaining, uninitialise the global context. */
-    nn_assert (self.socks);
-    if (self.nsocks > 0)
+    nn_assert (self.initialised);
+    if (self.nsocks > 0 || self.nloops > 0)
         return;
 
+    /*  Stop publishing the statistics. This needs the worker threads. */
+    nn_global_stat_stop ();
+
     /*  Shut down the worker threads. */
     nn_pool_term (&self.pool);
 
+    while (self.freesocks) {
+        sock = self.freesocks;
+        self.freesocks = *(void**) sock;
+        nn_free (sock);
+    }
+    self.nfreesocks = 0;
+
     /*  Ask all the transport to deallocate their global resources. */
     while (!nn_list_empty (&self.transports)) {
         it = nn_list_begin (&self.transports);
@@ -287,12 +529,13 @@ static void nn_global_term (void)
 
     /*  Final deallocation of the nn_global object itself. */
     nn_list_term (&self.transports);
-    nn_free (self.socks);
 
     /*  This marks the global state as uninitialised. */
-    self.socks = NULL;
+    self.initialised = 0;
 
-    /*  Shut down the memory allocation subsystem. */
+    /*  Free the chunks kept for reuse, then shut down the memory
+        allocation subsystem. */
+    nn_chunk_term ();
     nn_alloc_term ();
 
     /*  On Windows, uninitialise the socket library. */
@@ -305,18 +548,42 @@ static void nn_global_term (void)
 void nn_term (void)
 {
     int i;
+    int nslots;
+    int timeout;
+    char *envvar;
+    uint64_t deadline;
 
     nn_mutex_lock (&self.lock);
     self.flags |= NN_CTX_FLAG_TERMING;
+    nslots = self.nchunks * NN_GLOBAL_CHUNK_SLOTS;
     nn_mutex_unlock (&self.lock);
 
-    /* Make sure we really close resources, this will cause global
-       resources to be freed too when the last socket is closed. */
-    for (i = 0; i < NN_MAX_SOCKETS; i++) {
-        (void) nn_close (i);
+    /*  Make sure we really close resources, this will cause global
+        resources to be freed too when the last socket is closed. All the
+        sockets are shutting down at the same time rather than one after
+        another. */
+    for (i = 0; i < nslots; i++) {
+        (void) nn_global_close (i, 1);
     }
 
+    /*  Wait till they are done, but no longer than NN_TERM_TIMEOUT
+        milliseconds. The remaining ones will be deallocated later on. */
+    envvar = getenv ("NN_TERM_TIMEOUT");
+    timeout = envvar && *envvar ? atoi (envvar) : -1;
+    deadline = nn_clock_ms () + (timeout > 0 ? timeout : 0);
     nn_mutex_lock (&self.lock);
+    while (1) {
+        nn_global_reap ();
+        if (self.closing < 0 ||
+              (timeout >= 0 && nn_clock_ms () >= deadline))
+            break;
+        nn_mutex_unlock (&self.lock);
+        nn_pool_idle (&self.pool, NN_GLOBAL_TERM_INTERVAL);
+        nn_mutex_lock (&self.lock);
+    }
+    if (self.initialised)
+        nn_global_term ();
+
     self.flags |= NN_CTX_FLAG_TERMED;
     self.flags &= ~NN_CTX_FLAG_TERMING;
     nn_condvar_broadcast(&self.cond);
@@ -346,6 +613,31 @@ void *nn_allocmsg (size_t size, int type)
     return NULL;
 }
 
+void *nn_allocmsg_reserve (size_t size, size_t headroom, size_t tailroom,
+    int type)
+{
+    int rc;
+    void *result;
+
+    rc = nn_chunk_alloc_room (size, headroom, tailroom, type, &result);
+    if (rc == 0)
+        return result;
+    errno = -rc;
+    return NULL;
+}
+
+int nn_set_allocator (int type, const struct nn_allocator *allocator)
+{
+    int rc;
+
+    rc = nn_alloc_setclass (type, allocator);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
 void *nn_reallocmsg (void *msg, size_t size)
 {
     int rc;
@@ -363,6 +655,30 @@ int nn_freemsg (void *msg)
     return 0;
 }
 
+int nn_msgpool (size_t size, int count)
+{
+    int rc;
+
+    rc = nn_chunk_msgpool_create (size, count);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return rc;
+}
+
+int nn_membudget (size_t bytes, int flags)
+{
+    int rc;
+
+    rc = nn_chunk_setbudget (bytes, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
 struct nn_cmsghdr *nn_cmsg_nxthdr_ (const struct nn_msghdr *mhdr,
     const struct nn_cmsghdr *cmsg)
 {
@@ -393,6 +709,8 @@ struct nn_cmsghdr *nn_cmsg_nxthdr_ (const struct nn_msghdr *mhdr,
         Otherwise move to the next property. */
     if (!cmsg)
         next = (struct nn_cmsghdr*) data;
+    else if (nn_slow (cmsg->cmsg_len < NN_CMSG_LEN (0)))
+        return NULL;
     else
         next = (struct nn_cmsghdr*)
             (((char*) cmsg) + NN_CMSG_ALIGN_ (cmsg->cmsg_len));
@@ -416,6 +734,7 @@ int nn_global_create_socket (int domain, int protocol)
     struct nn_list_item *it;
     const struct nn_socktype *socktype;
     struct nn_sock *sock;
+    struct nn_global_slot *slot;
 
     /* The function is called with lock held */
 
@@ -424,27 +743,44 @@ int nn_global_create_socket (int domain, int protocol)
         return -EAFNOSUPPORT;
     }
 
-    /*  If socket limit was reached, report error. */
-    if (self.nsocks >= NN_MAX_SOCKETS) {
-        return -EMFILE;
+    /*  Find an empty socket slot, growing the table if needed. If socket
+        limit was reached, this reports an error. */
+    if (self.unused < 0) {
+        rc = nn_global_grow ();
+        if (rc < 0)
+            return rc;
     }
-
-    /*  Find an empty socket slot. */
-    s = self.unused [NN_MAX_SOCKETS - self.nsocks - 1];
+    s = self.unused;
+    slot = nn_global_slot (s);
 
     /*  Find the appropriate socket type. */
     for (i = 0; (socktype = nn_socktypes[i]) != NULL; i++) {
         if (socktype->domain == domain && socktype->protocol == protocol) {
 
-            /*  Instantiate the socket. */
-            if ((sock = nn_alloc (sizeof (struct nn_sock), "sock")) == NULL)
+            /*  Instantiate the socket, reusing a deallocated one if
+                possible. */
+            if (self.freesocks) {
+                sock = self.freesocks;
+                self.freesocks = *(void**) sock;
+                --self.nfreesocks;
+            }
+            else if ((sock = nn_alloc (sizeof (struct nn_sock),
+                  "sock")) == NULL)
                 return -ENOMEM;
             rc = nn_sock_init (sock, socktype, s);
-            if (rc < 0)
+            if (rc < 0) {
+                nn_free (sock);
                 return rc;
+            }
 
-            /*  Adjust the global socket table. */
-            self.socks [s] = sock;
+            /*  Adjust the global socket table. Setting the live bit also
+                acts as a memory barrier, so the socket is fully visible
+                to anyone who manages to hold it. */
+            self.unused = slot->next;
+            slot->sock = sock;
+            nn_assert (!(nn_atomic_load_relaxed (&slot->state) &
+                (NN_GLOBAL_SLOT_LIVE | NN_GLOBAL_SLOT_HOLDS)));
+            nn_atomic_inc (&slot->state, NN_GLOBAL_SLOT_LIVE);
             ++self.nsocks;
             return s;
         }
@@ -458,6 +794,9 @@ static void nn_lib_init(void)
     /*  This function is executed once to initialize global locks. */
     nn_mutex_init (&self.lock);
     nn_condvar_init (&self.cond);
+    self.nchunks = 0;
+    self.unused = -1;
+    self.closing = -1;
 }
 
 int nn_socket (int domain, int protocol)
@@ -478,6 +817,10 @@ int nn_socket (int domain, int protocol)
     /*  Make sure that global state is initialised. */
     nn_global_init ();
 
+    /*  Deallocate the sockets that are done closing, so that their slots
+        can be reused. */
+    nn_global_reap ();
+
     rc = nn_global_create_socket (domain, protocol);
 
     if (rc < 0) {
@@ -495,45 +838,90 @@ int nn_socket (int domain, int protocol)
 int nn_close (int s)
 {
     int rc;
-    struct nn_sock *sock;
 
-    nn_mutex_lock (&self.lock);
-    rc = nn_global_hold_socket_locked (&sock, s);
+    rc = nn_global_close (s, 0);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
+int nn_close_async (int s)
+{
+    int rc;
+
+    rc = nn_global_close (s, 1);
     if (nn_slow (rc < 0)) {
-        nn_mutex_unlock (&self.lock);
         errno = -rc;
         return -1;
     }
 
+    /*  The socket itself is unlikely to be done yet, but others may. */
+    nn_mutex_lock (&self.lock);
+    nn_global_reap ();
+    nn_global_term ();
+    nn_mutex_unlock (&self.lock);
+
+    return 0;
+}
+
+static int nn_global_close (int s, int async)
+{
+    int rc;
+    struct nn_sock *sock;
+    struct nn_global_slot *slot;
+    uint32_t state;
+    uint32_t old;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Mark the descriptor as closed. No new holds can be acquired from now
+        on, which also ensures that two instances of nn_close can't access
+        the same socket. */
+    slot = nn_global_slot (s);
+    state = nn_atomic_load_relaxed (&slot->state);
+    while (1) {
+        if (nn_slow (!(state & NN_GLOBAL_SLOT_LIVE))) {
+            nn_global_rele_socket (s);
+            return -EBADF;
+        }
+        old = nn_atomic_cas (&slot->state, state,
+            state & ~NN_GLOBAL_SLOT_LIVE);
+        if (nn_fast (old == state))
+            break;
+        state = old;
+    }
+
     /*  Start the shutdown process on the socket.  This will cause
-        all other socket users, as well as endpoints, to begin cleaning up.
-        This is done with the lock held to ensure that two instances
-        of nn_close can't access the same socket. */
+        all other socket users, as well as endpoints, to begin cleaning up. */
     nn_sock_stop (sock);
 
-    /*  We have to drop both the hold we just acquired, as well as
-        the original hold, in order for nn_sock_term to complete. */
-    nn_sock_rele (sock);
-    nn_sock_rele (sock);
-    nn_mutex_unlock (&self.lock);
+    /*  Drop the hold we just acquired in order for nn_sock_term to
+        complete. */
+    nn_global_rele_socket (s);
+
+    /*  The socket keeps its slot while it winds down in the background. It
+        is deallocated by whoever finds it done later on. */
+    if (async) {
+        nn_mutex_lock (&self.lock);
+        slot->next = self.closing;
+        self.closing = s;
+        nn_mutex_unlock (&self.lock);
+        return 0;
+    }
 
     /*  Now clean up.  The termination routine below will block until
         all other consumers of the socket have dropped their holds, and
         all endpoints have cleanly exited. */
     rc = nn_sock_term (sock);
-    if (nn_slow (rc == -EINTR)) {
-        nn_global_rele_socket (sock);
-        errno = EINTR;
-        return -1;
-    }
+    errnum_assert (rc == 0, -rc);
 
-    /*  Remove the socket from the socket table, add it to unused socket
-        table. */
     nn_mutex_lock (&self.lock);
-    self.socks [s] = NULL;
-    self.unused [NN_MAX_SOCKETS - self.nsocks] = s;
-    --self.nsocks;
-    nn_free (sock);
+    nn_global_release (s);
+    nn_global_reap ();
 
     /*  Destroy the global context if there's no socket remaining. */
     nn_global_term ();
@@ -543,6 +931,123 @@ int nn_close (int s)
     return 0;
 }
 
+/*  Removes a terminated socket from the socket table and deallocates it.
+    Called with the lock held. */
+static void nn_global_release (int s)
+{
+    struct nn_global_slot *slot;
+
+    slot = nn_global_slot (s);
+    if (self.nfreesocks < NN_GLOBAL_MAX_FREE_SOCKS) {
+        *(void**) slot->sock = self.freesocks;
+        self.freesocks = slot->sock;
+        ++self.nfreesocks;
+    }
+    else
+        nn_free (slot->sock);
+    slot->sock = NULL;
+    nn_atomic_inc (&slot->state, NN_GLOBAL_SLOT_GEN);
+    slot->next = self.unused;
+    self.unused = s;
+    --self.nsocks;
+}
+
+/*  Deallocates the asynchronously closed sockets that are done closing.
+    It doesn't uninitialise the global context even if there are no
+    sockets left. Called with the lock held. */
+static void nn_global_reap (void)
+{
+    int s;
+    int *prev;
+
+    prev = &self.closing;
+    while (*prev >= 0) {
+        s = *prev;
+        if (nn_sock_tryterm (nn_global_slot (s)->sock) < 0) {
+            prev = &nn_global_slot (s)->next;
+            continue;
+        }
+        *prev = nn_global_slot (s)->next;
+        nn_global_release (s);
+    }
+}
+
+static int nn_global_hold_loop (struct nn_worker **worker)
+{
+    nn_do_once (&once, nn_lib_init);
+
+    nn_mutex_lock (&self.lock);
+    if (nn_slow (!self.initialised)) {
+        nn_mutex_unlock (&self.lock);
+        return -EBADF;
+    }
+    *worker = nn_pool_external (&self.pool);
+    if (nn_slow (!*worker)) {
+        nn_mutex_unlock (&self.lock);
+        return -ENOTSUP;
+    }
+    ++self.nloops;
+    nn_mutex_unlock (&self.lock);
+
+    return 0;
+}
+
+static void nn_global_rele_loop (void)
+{
+    nn_mutex_lock (&self.lock);
+    --self.nloops;
+    nn_global_term ();
+    nn_mutex_unlock (&self.lock);
+}
+
+int nn_loop_fd (void)
+{
+    int rc;
+    struct nn_worker *worker;
+
+    rc = nn_global_hold_loop (&worker);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    rc = nn_worker_getfd (worker);
+    nn_global_rele_loop ();
+
+    return rc;
+}
+
+int nn_loop_timeout (void)
+{
+    int rc;
+    struct nn_worker *worker;
+
+    /*  There's nothing to wait for. */
+    rc = nn_global_hold_loop (&worker);
+    if (nn_slow (rc < 0))
+        return -1;
+    rc = nn_worker_timeout (worker);
+    nn_global_rele_loop ();
+
+    return rc;
+}
+
+int nn_loop_run (int timeout)
+{
+    int rc;
+    struct nn_worker *worker;
+
+    rc = nn_global_hold_loop (&worker);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    rc = nn_worker_run (worker, timeout);
+    errnum_assert (rc == 0, -rc);
+    nn_global_rele_loop ();
+
+    return 0;
+}
+
 int nn_setsockopt (int s, int level, int option, const void *optval,
     size_t optvallen)
 {
@@ -564,11 +1069,11 @@ int nn_setsockopt (int s, int level, int option, const void *optval,
     if (nn_slow (rc < 0))
         goto fail;
     errnum_assert (rc == 0, -rc);
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     return 0;
 
 fail:
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     errno = -rc;
     return -1;
 }
@@ -590,15 +1095,23 @@ int nn_getsockopt (int s, int level, int option, void *optval,
         goto fail;
     }
 
+    /*  The options queried the most, e.g. by nn_poll, are retrieved without
+        entering the socket context if possible. */
+    rc = nn_sock_getopt_fast (sock, level, option, optval, optvallen);
+    if (nn_fast (rc == 0)) {
+        nn_global_rele_socket (s);
+        return 0;
+    }
+
     rc = nn_sock_getopt (sock, level, option, optval, optvallen);
     if (nn_slow (rc < 0))
         goto fail;
     errnum_assert (rc == 0, -rc);
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     return 0;
 
 fail:
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     errno = -rc;
     return -1;
 }
@@ -616,12 +1129,12 @@ int nn_bind (int s, const char *addr)
 
     rc = nn_global_create_ep (sock, addr, 1);
     if (nn_slow (rc < 0)) {
-        nn_global_rele_socket (sock);
+        nn_global_rele_socket (s);
         errno = -rc;
         return -1;
     }
 
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     return rc;
 }
 
@@ -638,15 +1151,62 @@ int nn_connect (int s, const char *addr)
 
     rc = nn_global_create_ep (sock, addr, 0);
     if (rc < 0) {
-        nn_global_rele_socket (sock);
+        nn_global_rele_socket (s);
         errno = -rc;
         return -1;
     }
 
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     return rc;
 }
 
+int nn_connectv (int s, const char **addrs, int naddrs, int *eids)
+{
+    int rc;
+    int i;
+    struct nn_sock *sock;
+    struct nn_transport **tps;
+    const char **tpaddrs;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (naddrs < 0 || (naddrs > 0 && !addrs))) {
+        nn_global_rele_socket (s);
+        errno = naddrs < 0 ? EINVAL : EFAULT;
+        return -1;
+    }
+    if (naddrs == 0) {
+        nn_global_rele_socket (s);
+        return 0;
+    }
+
+    /*  Parse all the addresses before any endpoint is created. */
+    tps = nn_alloc (naddrs * sizeof (struct nn_transport*), "transports");
+    alloc_assert (tps);
+    tpaddrs = nn_alloc (naddrs * sizeof (const char*), "addresses");
+    alloc_assert (tpaddrs);
+    for (i = 0; i != naddrs; ++i) {
+        rc = nn_global_parse_addr (addrs [i], &tps [i], &tpaddrs [i]);
+        if (nn_slow (rc < 0))
+            break;
+    }
+    if (nn_fast (rc == 0))
+        rc = nn_sock_add_eps (sock, tps, tpaddrs, naddrs, 0, eids);
+    nn_free (tpaddrs);
+    nn_free (tps);
+
+    nn_global_rele_socket (s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
 int nn_shutdown (int s, int how)
 {
     int rc;
@@ -660,13 +1220,13 @@ int nn_shutdown (int s, int how)
 
     rc = nn_sock_rm_ep (sock, how);
     if (nn_slow (rc < 0)) {
-        nn_global_rele_socket (sock);
+        nn_global_rele_socket (s);
         errno = -rc;
         return -1;
     }
     nn_assert (rc == 0);
 
-    nn_global_rele_socket (sock);
+    nn_global_rele_socket (s);
     return 0;
 }
 
@@ -702,17 +1262,11 @@ int nn_recv (int s, void *buf, size_t len, int flags)
     return nn_recvmsg (s, &hdr, flags);
 }
 
-int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
+int nn_recvborrow (int s, const void **buf, int flags)
 {
     int rc;
-    size_t sz;
-    size_t spsz;
-    int i;
-    struct nn_iovec *iov;
     struct nn_msg msg;
-    void *chunk;
-    int nnmsg;
-    struct nn_cmsghdr *cmsg;
+    size_t sz;
     struct nn_sock *sock;
 
     rc = nn_global_hold_socket (&sock, s);
@@ -721,58 +1275,481 @@ int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
         return -1;
     }
 
-    if (nn_slow (!msghdr)) {
+    if (nn_slow (!buf)) {
         rc = -EINVAL;
         goto fail;
     }
 
-    if (nn_slow (msghdr->msg_iovlen < 0)) {
-        rc = -EMSGSIZE;
+    /*  The previously borrowed message is given up even if no new message
+        is available. */
+    nn_chunkref_term (&sock->borrowed);
+    nn_chunkref_init (&sock->borrowed, 0);
+
+    rc = nn_sock_recv (sock, &msg, flags);
+    if (nn_slow (rc < 0))
         goto fail;
-    }
 
-    if (msghdr->msg_iovlen == 1 && msghdr->msg_iov [0].iov_len == NN_MSG) {
-        chunk = *(void**) msghdr->msg_iov [0].iov_base;
-        if (nn_slow (chunk == NULL)) {
-            rc = -EFAULT;
-            goto fail;
-        }
-        sz = nn_chunk_size (chunk);
-        nn_msg_init_chunk (&msg, chunk);
-        nnmsg = 1;
-    }
-    else {
+    /*  Keep the body with the socket and lend it to the user. */
+    nn_msg_flatten (&msg);
+    nn_chunkref_mv (&sock->borrowed, &msg.body);
+    nn_chunkref_init (&msg.body, 0);
+    nn_msg_term (&msg);
+    *buf = nn_chunkref_data (&sock->borrowed);
+    sz = nn_chunkref_size (&sock->borrowed);
+    NN_TRACE (NN_TRACE_RECV_EXIT, sock, sz);
+
+    /*  Adjust the statistics. */
+    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, 1);
+    nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED, sz);
+
+    nn_global_rele_socket (s);
+
+    return (int) sz;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_recvpacked (int s, void *buf, size_t len, int flags)
+{
+    int rc;
+    int i;
+    int nrecvd;
+    size_t done;
+    size_t sz;
+    struct nn_msg msgs [NN_GLOBAL_MMSG_BATCH];
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow ((!buf && len) || len == NN_MSG)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    if (len > INT_MAX)
+        len = INT_MAX;
+
+    /*  The messages are taken in batches, only the first of which may
+        block. The message that doesn't fit is left with the socket for
+        the next receive. */
+    done = 0;
+    while (1) {
+        nrecvd = nn_sock_recvbudget (sock, msgs, NN_GLOBAL_MMSG_BATCH,
+            len - done, sizeof (uint32_t), done ? flags | NN_DONTWAIT : flags);
+        if (nn_slow (nrecvd < 0)) {
+            if (done)
+                break;
+            rc = nrecvd;
+            goto fail;
+        }
+
+        for (i = 0; i != nrecvd; ++i) {
+            sz = nn_global_msg_pack (&msgs [i], (uint8_t*) buf + done);
+            done += sizeof (uint32_t) + sz;
+            NN_TRACE (NN_TRACE_RECV_EXIT, sock, sz);
+            nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED, sz);
+        }
+        nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, nrecvd);
+
+        if (nrecvd != NN_GLOBAL_MMSG_BATCH)
+            break;
+    }
+
+    nn_global_rele_socket (s);
+
+    return (int) done;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
+{
+    int rc;
+    size_t sz;
+    struct nn_msg msg;
+    int nnmsg;
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    rc = nn_global_msg_build (msghdr, &msg, &sz, &nnmsg);
+    if (nn_slow (rc < 0))
+        goto fail;
+    NN_TRACE (NN_TRACE_SEND_ENTER, sock, sz);
+
+    /*  Send it further down the stack. */
+    rc = nn_sock_send (sock, &msg, flags);
+    if (nn_slow (rc < 0)) {
+        nn_global_msg_drop (&msg, nnmsg);
+        goto fail;
+    }
+
+    /*  Adjust the statistics. */
+    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_SENT, 1);
+    nn_sock_stat_increment (sock, NN_STAT_BYTES_SENT, sz);
+
+    nn_global_rele_socket (s);
+
+    return (int) sz;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
+{
+    int rc;
+    struct nn_msg msg;
+    size_t sz;
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    rc = nn_global_msghdr_check (msghdr);
+    if (nn_slow (rc < 0))
+        goto fail;
+
+    /*  Get a message. */
+    rc = nn_sock_recv (sock, &msg, flags);
+    if (nn_slow (rc < 0)) {
+        goto fail;
+    }
+
+    sz = nn_global_msg_deliver (&msg, msghdr, sock->ep_template.rcvpool);
+    NN_TRACE (NN_TRACE_RECV_EXIT, sock, sz);
+
+    /*  Adjust the statistics. */
+    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, 1);
+    nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED, sz);
+
+    nn_global_rele_socket (s);
+
+    return (int) sz;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_sendmmsg (int s, struct nn_mmsghdr *msgvec, int vlen, int flags)
+{
+    int rc;
+    int i;
+    int count;
+    int nbuilt;
+    int nsent;
+    int done;
+    struct nn_msg msgs [NN_GLOBAL_MMSG_BATCH];
+    size_t sizes [NN_GLOBAL_MMSG_BATCH];
+    int nnmsgs [NN_GLOBAL_MMSG_BATCH];
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (!msgvec || vlen < 0)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    done = 0;
+    while (done < vlen) {
+
+        /*  Convert the next batch of headers into message objects. An invalid
+            header terminates the batch; the error is reported only if no
+            message was sent before it. */
+        count = vlen - done;
+        if (count > NN_GLOBAL_MMSG_BATCH)
+            count = NN_GLOBAL_MMSG_BATCH;
+        for (nbuilt = 0; nbuilt != count; ++nbuilt) {
+            rc = nn_global_msg_build (&msgvec [done + nbuilt].msg_hdr,
+                &msgs [nbuilt], &sizes [nbuilt], &nnmsgs [nbuilt]);
+            if (nn_slow (rc < 0))
+                break;
+            NN_TRACE (NN_TRACE_SEND_ENTER, sock, sizes [nbuilt]);
+        }
+        if (nn_slow (nbuilt == 0))
+            break;
+
+        nsent = nn_sock_sendmany (sock, msgs, nbuilt, flags);
+        if (nn_slow (nsent < 0)) {
+            rc = nsent;
+            nsent = 0;
+        }
+
+        for (i = 0; i != nsent; ++i) {
+            msgvec [done + i].msg_len = sizes [i];
+            nn_sock_stat_increment (sock, NN_STAT_BYTES_SENT, sizes [i]);
+        }
+        if (nsent > 0)
+            nn_sock_stat_increment (sock, NN_STAT_MESSAGES_SENT, nsent);
+        for (i = nsent; i != nbuilt; ++i)
+            nn_global_msg_drop (&msgs [i], nnmsgs [i]);
+
+        done += nsent;
+        if (nsent != count)
+            break;
+    }
+
+    if (nn_slow (done == 0 && vlen != 0))
+        goto fail;
+
+    nn_global_rele_socket (s);
+
+    return done;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_recvmmsg (int s, struct nn_mmsghdr *msgvec, int vlen, int flags)
+{
+    int rc;
+    int i;
+    int count;
+    int nrecvd;
+    int done;
+    struct nn_msg msgs [NN_GLOBAL_MMSG_BATCH];
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (!msgvec || vlen < 0)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    /*  Validate all the headers in advance so that no message has to be
+        dropped once it has been taken from the socket. */
+    for (i = 0; i != vlen; ++i) {
+        rc = nn_global_msghdr_check (&msgvec [i].msg_hdr);
+        if (nn_slow (rc < 0))
+            goto fail;
+    }
+
+    done = 0;
+    while (done < vlen) {
+        count = vlen - done;
+        if (count > NN_GLOBAL_MMSG_BATCH)
+            count = NN_GLOBAL_MMSG_BATCH;
+
+        /*  Only the very first message of the call may block. */
+        nrecvd = nn_sock_recvmany (sock, msgs, count,
+            done ? flags | NN_DONTWAIT : flags);
+        if (nn_slow (nrecvd < 0)) {
+            rc = nrecvd;
+            break;
+        }
+
+        for (i = 0; i != nrecvd; ++i) {
+            msgvec [done + i].msg_len = nn_global_msg_deliver (&msgs [i],
+                &msgvec [done + i].msg_hdr, sock->ep_template.rcvpool);
+            NN_TRACE (NN_TRACE_RECV_EXIT, sock, msgvec [done + i].msg_len);
+            nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED,
+                msgvec [done + i].msg_len);
+        }
+        nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, nrecvd);
+
+        done += nrecvd;
+        if (nrecvd != count)
+            break;
+    }
+
+    if (nn_slow (done == 0 && vlen != 0))
+        goto fail;
+
+    nn_global_rele_socket (s);
+
+    return done;
+
+fail:
+    nn_global_rele_socket (s);
+
+    errno = -rc;
+    return -1;
+}
+
+uint64_t nn_get_statistic (int s, int statistic)
+{
+    int rc;
+    struct nn_sock *sock;
+    uint64_t val;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return (uint64_t)-1;
+    }
+
+    rc = nn_sock_stat_get (sock, statistic, &val);
+    if (nn_slow (rc < 0)) {
+        val = (uint64_t)-1;
+        errno = -rc;
+    }
+
+    nn_global_rele_socket (s);
+    return val;
+}
+
+uint64_t nn_get_ep_statistic (int s, int eid, int statistic)
+{
+    int rc;
+    struct nn_sock *sock;
+    uint64_t val;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return (uint64_t)-1;
+    }
+
+    rc = nn_sock_ep_stat_get (sock, eid, statistic, &val);
+    if (nn_slow (rc < 0)) {
+        val = (uint64_t)-1;
+        errno = -rc;
+    }
+
+    nn_global_rele_socket (s);
+    return val;
+}
+
+int nn_get_pipe_stat (int s, int prev, struct nn_pipe_stat *stat)
+{
+    int rc;
+    struct nn_sock *sock;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (!stat)) {
+        nn_global_rele_socket (s);
+        errno = EFAULT;
+        return -1;
+    }
+
+    rc = nn_sock_pipe_stat_get (sock, prev, stat);
+    nn_global_rele_socket (s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
+static int nn_global_msg_build (const struct nn_msghdr *msghdr,
+    struct nn_msg *msg, size_t *szp, int *nnmsgp)
+{
+    int rc;
+    size_t sz;
+    size_t spsz;
+    int ttl;
+    int urgent;
+    int i;
+    struct nn_iovec *iov;
+    void *chunk;
+    struct nn_cmsghdr *cmsg;
+
+    if (nn_slow (!msghdr))
+        return -EINVAL;
+
+    if (nn_slow (msghdr->msg_iovlen < 0))
+        return -EMSGSIZE;
+
+    rc = nn_global_check_cmsgs (msghdr);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  While the messages in the process exceed the budget, the user is
+        asked to try again later instead of queueing up even more. */
+    if (nn_slow (nn_chunk_overbudget (NN_MEMBUDGET_SEND)))
+        return -EAGAIN;
+
+    if (msghdr->msg_iovlen >= 1 && msghdr->msg_iov [0].iov_len == NN_MSG) {
+
+        /*  Zero-copy message, possibly consisting of multiple chunks. Each
+            of them is passed down to the transport as it is. */
+        if (nn_slow (msghdr->msg_iovlen > NN_MSG_MAXPARTS + 1))
+            return -EINVAL;
+        for (i = 0; i != msghdr->msg_iovlen; ++i) {
+            iov = &msghdr->msg_iov [i];
+            if (nn_slow (iov->iov_len != NN_MSG))
+                return -EINVAL;
+            if (nn_slow (*(void**) iov->iov_base == NULL))
+                return -EFAULT;
+        }
+        chunk = *(void**) msghdr->msg_iov [0].iov_base;
+        nn_msg_init_chunk (msg, chunk);
+        for (i = 1; i != msghdr->msg_iovlen; ++i) {
+            rc = nn_msg_addpart (msg,
+                *(void**) msghdr->msg_iov [i].iov_base);
+            errnum_assert (rc == 0, -rc);
+        }
+        sz = nn_msg_bodysize (msg);
+        *nnmsgp = 1;
+    }
+    else {
 
         /*  Compute the total size of the message. */
         sz = 0;
         for (i = 0; i != msghdr->msg_iovlen; ++i) {
             iov = &msghdr->msg_iov [i];
-            if (nn_slow (iov->iov_len == NN_MSG)) {
-               rc = -EINVAL;
-               goto fail;
-            }
-            if (nn_slow (!iov->iov_base && iov->iov_len)) {
-                rc = -EFAULT;
-                goto fail;
-            }
-            if (nn_slow (sz + iov->iov_len < sz)) {
-                rc = -EINVAL;
-                goto fail;
-            }
+            if (nn_slow (iov->iov_len == NN_MSG))
+               return -EINVAL;
+            if (nn_slow (!iov->iov_base && iov->iov_len))
+                return -EFAULT;
+            if (nn_slow (sz + iov->iov_len < sz))
+                return -EINVAL;
             sz += iov->iov_len;
         }
 
         /*  Create a message object from the supplied scatter array. */
-        nn_msg_init (&msg, sz);
+        nn_msg_init (msg, sz);
         sz = 0;
         for (i = 0; i != msghdr->msg_iovlen; ++i) {
             iov = &msghdr->msg_iov [i];
-            memcpy (((uint8_t*) nn_chunkref_data (&msg.body)) + sz,
+            nn_copy (((uint8_t*) nn_chunkref_data (&msg->body)) + sz,
                 iov->iov_base, iov->iov_len);
             sz += iov->iov_len;
         }
 
-        nnmsg = 0;
+        *nnmsgp = 0;
     }
 
     /*  Add ancillary data to the message. */
@@ -782,70 +1759,158 @@ int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
         /*  TODO: SP_HDR should not be copied here! */
         if (msghdr->msg_controllen == NN_MSG) {
             chunk = *((void**) msghdr->msg_control);
-            nn_chunkref_term (&msg.hdrs);
-            nn_chunkref_init_chunk (&msg.hdrs, chunk);
+            nn_chunkref_term (&msg->hdrs);
+            nn_chunkref_init_chunk (&msg->hdrs, chunk);
         }
         else {
-            nn_chunkref_term (&msg.hdrs);
-            nn_chunkref_init (&msg.hdrs, msghdr->msg_controllen);
-            memcpy (nn_chunkref_data (&msg.hdrs),
+            nn_chunkref_term (&msg->hdrs);
+            nn_chunkref_init (&msg->hdrs, msghdr->msg_controllen);
+            memcpy (nn_chunkref_data (&msg->hdrs),
                 msghdr->msg_control, msghdr->msg_controllen);
         }
 
-        /* Search for SP_HDR property. */
+        /* Search for SP_HDR, NN_MSG_TTL and NN_MSG_URGENT properties. */
         cmsg = NN_CMSG_FIRSTHDR (msghdr);
         while (cmsg) {
-            if (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR) {
+            if (cmsg->cmsg_level == PROTO_SP &&
+                  cmsg->cmsg_type == NN_MSG_TTL &&
+                  cmsg->cmsg_len >= NN_CMSG_LEN (sizeof (int))) {
+                memcpy (&ttl, NN_CMSG_DATA (cmsg), sizeof (ttl));
+                if (ttl > 0)
+                    msg->expiry = nn_clock_us () + (uint64_t) ttl * 1000;
+            }
+            else if (cmsg->cmsg_level == PROTO_SP &&
+                  cmsg->cmsg_type == NN_MSG_URGENT &&
+                  cmsg->cmsg_len >= NN_CMSG_LEN (sizeof (int))) {
+                memcpy (&urgent, NN_CMSG_DATA (cmsg), sizeof (urgent));
+                msg->urgent = urgent != 0;
+            }
+            else if (cmsg->cmsg_level == PROTO_SP &&
+                  cmsg->cmsg_type == SP_HDR) {
                 unsigned char *ptr = NN_CMSG_DATA (cmsg);
                 size_t clen = cmsg->cmsg_len - NN_CMSG_SPACE (0);
                 if (clen > sizeof (size_t)) {
                     spsz = *(size_t *)(void *)ptr;
                     if (spsz <= (clen - sizeof (size_t))) {
                         /*  Copy body of SP_HDR property into 'sphdr'. */
-                        nn_chunkref_term (&msg.sphdr);
-                        nn_chunkref_init (&msg.sphdr, spsz);
-                         memcpy (nn_chunkref_data (&msg.sphdr),
+                        nn_chunkref_term (&msg->sphdr);
+                        nn_chunkref_init (&msg->sphdr, spsz);
+                         memcpy (nn_chunkref_data (&msg->sphdr),
                              ptr + sizeof (size_t), spsz);
                     }
                 }
-                break;
             }
-            cmsg = NN_CMSG_NXTHDR (msghdr, cmsg);
+            cmsg = NN_CMSG_NXTHDR (msghdr, cmsg);
+        }
+    }
+
+    *szp = sz;
+    return 0;
+}
+
+static int nn_global_check_cmsgs (const struct nn_msghdr *msghdr)
+{
+    struct nn_cmsghdr *cmsg;
+    size_t len;
+    int nregions;
+#if !defined NN_HAVE_WINDOWS
+    size_t i;
+    int fd;
+    struct nn_file_region region;
+    struct stat st;
+#endif
+
+    if (!msghdr->msg_control)
+        return 0;
+
+    /*  File descriptors to pass via ipc (see nn_ipc(7)), file regions and
+        message pieces (see nn_sendmsg(3)) are checked beforehand. The transport has no way
+        to report the error. */
+    nregions = 0;
+    cmsg = NN_CMSG_FIRSTHDR (msghdr);
+    while (cmsg) {
+        if (cmsg->cmsg_level == NN_SOL_SOCKET &&
+              cmsg->cmsg_type == NN_FILE_REGION) {
+            if (nn_slow (cmsg->cmsg_len !=
+                  NN_CMSG_LEN (sizeof (struct nn_file_region)) ||
+                  ++nregions > 1))
+                return -EINVAL;
+#if defined NN_HAVE_WINDOWS
+            return -ENOTSUP;
+#else
+            memcpy (&region, NN_CMSG_DATA (cmsg), sizeof (region));
+            if (nn_slow (region.fd < 0 || fstat (region.fd, &st) < 0))
+                return -EBADF;
+            if (nn_slow (!S_ISREG (st.st_mode) ||
+                  region.length > (size_t) -1 ||
+                  region.offset + region.length < region.offset ||
+                  region.offset + region.length > (uint64_t) st.st_size))
+                return -EINVAL;
+#endif
+        }
+        if (cmsg->cmsg_level == NN_SOL_SOCKET &&
+              cmsg->cmsg_type == NN_MSG_PIECE &&
+              nn_slow (cmsg->cmsg_len !=
+                  NN_CMSG_LEN (sizeof (struct nn_msg_piece))))
+            return -EINVAL;
+        if (cmsg->cmsg_level == NN_IPC && cmsg->cmsg_type == NN_IPC_FDS) {
+            len = cmsg->cmsg_len - NN_CMSG_LEN (0);
+            if (nn_slow (len % sizeof (int) != 0 ||
+                  len > NN_IPC_MAXFDS * sizeof (int)))
+                return -EINVAL;
+#if defined NN_HAVE_WINDOWS
+            if (len)
+                return -ENOTSUP;
+#else
+            for (i = 0; i != len / sizeof (int); ++i) {
+                memcpy (&fd, NN_CMSG_DATA (cmsg) + i * sizeof (int),
+                    sizeof (fd));
+                if (nn_slow (fd < 0 || fcntl (fd, F_GETFD) < 0))
+                    return -EBADF;
+            }
+#endif
         }
+        cmsg = NN_CMSG_NXTHDR (msghdr, cmsg);
     }
 
-    /*  Send it further down the stack. */
-    rc = nn_sock_send (sock, &msg, flags);
-    if (nn_slow (rc < 0)) {
-
-        /*  If we are dealing with user-supplied buffer, detach it from
-            the message object. */
-        if (nnmsg)
-            nn_chunkref_init (&msg.body, 0);
+    return 0;
+}
 
-        nn_msg_term (&msg);
-        goto fail;
+static void nn_global_msg_drop (struct nn_msg *msg, int nnmsg)
+{
+    /*  If we are dealing with user-supplied buffer, detach it from
+        the message object. */
+    if (nnmsg) {
+        nn_chunkref_init (&msg->body, 0);
+        msg->nparts = 0;
     }
 
-    /*  Adjust the statistics. */
-    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_SENT, 1);
-    nn_sock_stat_increment (sock, NN_STAT_BYTES_SENT, sz);
+    nn_msg_term (msg);
+}
 
-    nn_global_rele_socket (sock);
+static int nn_global_msghdr_check (const struct nn_msghdr *msghdr)
+{
+    int i;
 
-    return (int) sz;
+    if (nn_slow (!msghdr))
+        return -EINVAL;
 
-fail:
-    nn_global_rele_socket (sock);
+    if (nn_slow (msghdr->msg_iovlen < 0))
+        return -EMSGSIZE;
 
-    errno = -rc;
-    return -1;
+    /*  Zero-copy receive is possible only into a single buffer. */
+    if (msghdr->msg_iovlen != 1)
+        for (i = 0; i != msghdr->msg_iovlen; ++i)
+            if (nn_slow (msghdr->msg_iov [i].iov_len == NN_MSG))
+                return -EINVAL;
+
+    return 0;
 }
 
-int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
+static size_t nn_global_msg_deliver (struct nn_msg *msg,
+    struct nn_msghdr *msghdr, int pool)
 {
     int rc;
-    struct nn_msg msg;
     uint8_t *data;
     size_t sz;
     int i;
@@ -857,64 +1922,36 @@ int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
     size_t spsz;
     size_t sptotalsz;
     struct nn_cmsghdr *chdr;
-    struct nn_sock *sock;
-
-    rc = nn_global_hold_socket (&sock, s);
-    if (nn_slow (rc < 0)) {
-        errno = -rc;
-        return -1;
-    }
-
-    if (nn_slow (!msghdr)) {
-        rc = -EINVAL;
-        goto fail;
-    }
-
-    if (nn_slow (msghdr->msg_iovlen < 0)) {
-        rc = -EMSGSIZE;
-        goto fail;
-    }
-
-    /*  Get a message. */
-    rc = nn_sock_recv (sock, &msg, flags);
-    if (nn_slow (rc < 0)) {
-        goto fail;
-    }
 
     if (msghdr->msg_iovlen == 1 && msghdr->msg_iov [0].iov_len == NN_MSG) {
-        chunk = nn_chunkref_getchunk (&msg.body);
+        chunk = nn_chunkref_getchunk_type (&msg->body, pool);
         *(void**) (msghdr->msg_iov [0].iov_base) = chunk;
         sz = nn_chunk_size (chunk);
     }
     else {
 
         /*  Copy the message content into the supplied gather array. */
-        data = nn_chunkref_data (&msg.body);
-        sz = nn_chunkref_size (&msg.body);
+        data = nn_chunkref_data (&msg->body);
+        sz = nn_chunkref_size (&msg->body);
         for (i = 0; i != msghdr->msg_iovlen; ++i) {
             iov = &msghdr->msg_iov [i];
-            if (nn_slow (iov->iov_len == NN_MSG)) {
-                nn_msg_term (&msg);
-                rc = -EINVAL;
-                goto fail;
-            }
             if (iov->iov_len > sz) {
-                memcpy (iov->iov_base, data, sz);
+                nn_copy (iov->iov_base, data, sz);
                 break;
             }
-            memcpy (iov->iov_base, data, iov->iov_len);
+            nn_copy (iov->iov_base, data, iov->iov_len);
             data += iov->iov_len;
             sz -= iov->iov_len;
         }
-        sz = nn_chunkref_size (&msg.body);
+        sz = nn_chunkref_size (&msg->body);
     }
 
     /*  Retrieve the ancillary data from the message. */
     if (msghdr->msg_control) {
 
-        spsz = nn_chunkref_size (&msg.sphdr);
+        spsz = nn_chunkref_size (&msg->sphdr);
         sptotalsz = NN_CMSG_SPACE (spsz+sizeof (size_t));
-        ctrlsz = sptotalsz + nn_chunkref_size (&msg.hdrs);
+        ctrlsz = sptotalsz + nn_chunkref_size (&msg->hdrs);
 
         if (msghdr->msg_controllen == NN_MSG) {
 
@@ -946,101 +1983,74 @@ int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
             ptr += sizeof (*chdr);
             *(size_t *)(void *)ptr = spsz;
             ptr += sizeof (size_t);
-            memcpy (ptr, nn_chunkref_data (&msg.sphdr), spsz);
+            memcpy (ptr, nn_chunkref_data (&msg->sphdr), spsz);
 
             /*  Fill in as many remaining properties as possible.
                 Truncate the trailing properties if necessary. */
-            hdrssz = nn_chunkref_size (&msg.hdrs);
+            hdrssz = nn_chunkref_size (&msg->hdrs);
             if (hdrssz > ctrlsz - sptotalsz)
                 hdrssz = ctrlsz - sptotalsz;
             memcpy (((char*) ctrl) + sptotalsz,
-                nn_chunkref_data (&msg.hdrs), hdrssz);
+                nn_chunkref_data (&msg->hdrs), hdrssz);
+
+            /*  The descriptors that were passed to the user are theirs
+                now, those truncated away are closed. */
+            nn_msg_closefds (msg, hdrssz);
         }
+        else
+            nn_msg_closefds (msg, 0);
     }
+    else
+        nn_msg_closefds (msg, 0);
 
-    nn_msg_term (&msg);
-
-    /*  Adjust the statistics. */
-    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, 1);
-    nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED, sz);
+    nn_msg_term (msg);
 
-    nn_global_rele_socket (sock);
+    return sz;
+}
 
-    return (int) sz;
+static size_t nn_global_msg_pack (struct nn_msg *msg, uint8_t *pos)
+{
+    size_t sz;
 
-fail:
-    nn_global_rele_socket (sock);
+    /*  Store the length of the body followed by the body itself. Control
+        data are not passed to the user. */
+    nn_msg_flatten (msg);
+    sz = nn_chunkref_size (&msg->body);
+    nn_putl (pos, (uint32_t) sz);
+    nn_copy (pos + sizeof (uint32_t), nn_chunkref_data (&msg->body), sz);
+    nn_msg_closefds (msg, 0);
+    nn_msg_term (msg);
 
-    errno = -rc;
-    return -1;
+    return sz;
 }
 
-uint64_t nn_get_statistic (int s, int statistic)
+int nn_global_parse_cpus (const char *str, int *cpus, int maxcpus)
 {
-    int rc;
-    struct nn_sock *sock;
-    uint64_t val;
-
-    rc = nn_global_hold_socket (&sock, s);
-    if (nn_slow (rc < 0)) {
-        errno = -rc;
-        return (uint64_t)-1;
-    }
-
-    switch (statistic) {
-    case NN_STAT_ESTABLISHED_CONNECTIONS:
-        val = sock->statistics.established_connections;
-        break;
-    case NN_STAT_ACCEPTED_CONNECTIONS:
-        val = sock->statistics.accepted_connections;
-        break;
-    case NN_STAT_DROPPED_CONNECTIONS:
-        val = sock->statistics.dropped_connections;
-        break;
-    case NN_STAT_BROKEN_CONNECTIONS:
-        val = sock->statistics.broken_connections;
-        break;
-    case NN_STAT_CONNECT_ERRORS:
-        val = sock->statistics.connect_errors;
-        break;
-    case NN_STAT_BIND_ERRORS:
-        val = sock->statistics.bind_errors;
-        break;
-    case NN_STAT_ACCEPT_ERRORS:
-        val = sock->statistics.bind_errors;
-        break;
-    case NN_STAT_MESSAGES_SENT:
-        val = sock->statistics.messages_sent;
-        break;
-    case NN_STAT_MESSAGES_RECEIVED:
-        val = sock->statistics.messages_received;
-        break;
-    case NN_STAT_BYTES_SENT:
-        val = sock->statistics.bytes_sent;
-        break;
-    case NN_STAT_BYTES_RECEIVED:
-        val = sock->statistics.bytes_received;
-        break;
-    case NN_STAT_CURRENT_CONNECTIONS:
-        val = sock->statistics.current_connections;
-        break;
-    case NN_STAT_INPROGRESS_CONNECTIONS:
-        val = sock->statistics.inprogress_connections;
-        break;
-    case NN_STAT_CURRENT_SND_PRIORITY:
-        val = sock->statistics.current_snd_priority;
-        break;
-    case NN_STAT_CURRENT_EP_ERRORS:
-        val = sock->statistics.current_ep_errors;
-        break;
-    default:
-        val = (uint64_t)-1;
-        errno = EINVAL;
-        break;
+    int ncpus;
+    char *end;
+    long first;
+    long last;
+
+    ncpus = 0;
+    while (*str && ncpus < maxcpus) {
+        first = strtol (str, &end, 10);
+        if (end == str || first < 0)
+            return ncpus;
+        last = first;
+        str = end;
+        if (*str == '-') {
+            last = strtol (str + 1, &end, 10);
+            if (end == str + 1 || last < first)
+                return ncpus;
+            str = end;
+        }
+        while (first <= last && ncpus < maxcpus)
+            cpus [ncpus++] = (int) first++;
+        if (*str != ',')
+            break;
+        ++str;
     }
-
-    nn_global_rele_socket (sock);
-    return val;
+    return ncpus;
 }
 
 static void nn_global_add_transport (struct nn_transport *transport)
@@ -1051,10 +2061,9 @@ static void nn_global_add_transport (struct nn_transport *transport)
         nn_list_end (&self.transports));
 }
 
-static int nn_global_create_ep (struct nn_sock *sock, const char *addr,
-    int bind)
+static int nn_global_parse_addr (const char *addr,
+    struct nn_transport **tpp, const char **addrp)
 {
-    int rc;
     const char *proto;
     const char *delim;
     size_t protosz;
@@ -1094,6 +2103,21 @@ static int nn_global_create_ep (struct nn_sock *sock, const char *addr,
         return -EPROTONOSUPPORT;
     }
 
+    *tpp = tp;
+    *addrp = addr;
+    return 0;
+}
+
+static int nn_global_create_ep (struct nn_sock *sock, const char *addr,
+    int bind)
+{
+    int rc;
+    struct nn_transport *tp;
+
+    rc = nn_global_parse_addr (addr, &tp, &addr);
+    if (nn_slow (rc < 0))
+        return rc;
+
     /*  Ask the socket to create the endpoint. */
     rc = nn_sock_add_ep (sock, tp, bind, addr);
     return rc;
@@ -1128,40 +2152,468 @@ int nn_global_print_errors ()
     return self.print_errors;
 }
 
-/*  Get the socket structure for a socket id.  This must be called under
-    the global lock (self.lock.)  The socket itself will not be freed
-    while the hold is active. */
-int nn_global_hold_socket_locked(struct nn_sock **sockp, int s)
+/*  Returns the slot for the specified descriptor, or NULL if the descriptor
+    is outside of the table. Can be called without the global lock. */
+static struct nn_global_slot *nn_global_slot (int s)
 {
-    struct nn_sock *sock;
+    struct nn_global_slot *chunk;
 
-    if (nn_slow (s < 0 || s >= NN_MAX_SOCKETS || self.socks == NULL))
-        return -EBADF;
+    if (nn_slow (s < 0 || s >= NN_MAX_SOCKETS))
+        return NULL;
+    chunk = self.chunks [s / NN_GLOBAL_CHUNK_SLOTS];
+    if (nn_slow (!chunk))
+        return NULL;
+    return &chunk [s % NN_GLOBAL_CHUNK_SLOTS];
+}
 
-    sock = self.socks[s];
-    if (nn_slow (sock == NULL)) {
-        return -EBADF;
+/*  Adds one chunk of slots to the socket table and pushes them onto the
+    stack of unused descriptors, lowest one on the top. This must be called
+    under the global lock. */
+static int nn_global_grow (void)
+{
+    int i;
+    int base;
+    struct nn_global_slot *chunk;
+
+    if (nn_slow (self.nchunks >= NN_GLOBAL_MAX_CHUNKS))
+        return -EMFILE;
+
+    chunk = nn_alloc (sizeof (struct nn_global_slot) * NN_GLOBAL_CHUNK_SLOTS,
+        "socket table");
+    if (nn_slow (!chunk))
+        return -ENOMEM;
+
+    base = self.nchunks * NN_GLOBAL_CHUNK_SLOTS;
+    for (i = NN_GLOBAL_CHUNK_SLOTS - 1; i >= 0; --i) {
+        nn_atomic_init (&chunk [i].state, 0);
+        chunk [i].sock = NULL;
+        chunk [i].next = self.unused;
+        self.unused = base + i;
     }
 
-    if (nn_slow (nn_sock_hold (sock) != 0)) {
+    /*  The atomic operation acts as a memory barrier, ensuring that the
+        chunk is initialised before it becomes visible to other threads. */
+    nn_atomic_inc (&chunk [0].state, 0);
+    self.chunks [self.nchunks] = chunk;
+    ++self.nchunks;
+
+    return 0;
+}
+
+/*  Get the socket structure for a socket id.  The socket itself will not
+    be freed while the hold is active. */
+int nn_global_hold_socket (struct nn_sock **sockp, int s)
+{
+    struct nn_global_slot *slot;
+    uint32_t state;
+    uint32_t old;
+
+    slot = nn_global_slot (s);
+    if (nn_slow (!slot))
         return -EBADF;
+
+    state = nn_atomic_load_relaxed (&slot->state);
+    while (1) {
+        if (nn_slow (!(state & NN_GLOBAL_SLOT_LIVE)))
+            return -EBADF;
+        nn_assert ((state & NN_GLOBAL_SLOT_HOLDS) != NN_GLOBAL_SLOT_HOLDS);
+        old = nn_atomic_cas (&slot->state, state, state + 1);
+        if (nn_fast (old == state))
+            break;
+        state = old;
     }
-    *sockp = sock;
+
+    *sockp = slot->sock;
     return 0;
 }
 
-int nn_global_hold_socket(struct nn_sock **sockp, int s)
+void nn_global_rele_socket (int s)
+{
+    struct nn_global_slot *slot;
+    struct nn_sock *sock;
+    uint32_t old;
+
+    /*  If the socket is being closed and this is the last hold, let
+        nn_sock_term proceed. The socket can't go away before that. */
+    slot = nn_global_slot (s);
+    sock = slot->sock;
+    old = nn_atomic_dec (&slot->state, 1);
+    if (nn_slow ((old & (NN_GLOBAL_SLOT_LIVE | NN_GLOBAL_SLOT_HOLDS)) == 1))
+        nn_sock_rele (sock);
+}
+
+static void nn_global_stat_start (void)
+{
+    char *addr;
+    char *shm;
+    char *envvar;
+
+    self.stat_sock = NULL;
+    self.stat_shm = 0;
+
+    /*  Statistics are only published if the address of the collector or
+        the name of the shared memory segment is specified. */
+    addr = getenv ("NN_STATISTICS_SOCKET");
+    shm = getenv ("NN_STATISTICS_SHM");
+    if ((!addr || !*addr) && (!shm || !*shm))
+        return;
+    envvar = getenv ("NN_STATISTICS_INTERVAL");
+    self.stat_interval = envvar ? atoi (envvar) : NN_GLOBAL_STAT_INTERVAL;
+    if (self.stat_interval <= 0)
+        return;
+
+    if (shm && *shm)
+        nn_global_statshm_start (shm);
+    if (addr && *addr)
+        nn_global_stat_sock_start (addr);
+    if (!self.stat_sock && !self.stat_shm)
+        return;
+
+    /*  Launch the timer. */
+    nn_ctx_init (&self.ctx, &self.pool, NULL);
+    nn_fsm_init_root (&self.fsm, nn_global_handler, nn_global_shutdown,
+        &self.ctx);
+    self.state = NN_GLOBAL_STATE_IDLE;
+    nn_timer_init (&self.stat_timer, NN_GLOBAL_SRC_STAT_TIMER, &self.fsm);
+    nn_sem_init (&self.stat_stopped);
+    nn_ctx_enter (&self.ctx);
+    nn_fsm_start (&self.fsm);
+    nn_ctx_leave (&self.ctx);
+}
+
+static void nn_global_stat_sock_start (const char *addr)
 {
     int rc;
-    nn_mutex_lock(&self.lock);
-    rc = nn_global_hold_socket_locked(sockp, s);
-    nn_mutex_unlock(&self.lock);
-    return rc;
+    int i;
+    const struct nn_socktype *socktype;
+
+    /*  The publisher may have been left out of the library. */
+    for (i = 0; (socktype = nn_socktypes [i]) != NULL; i++)
+        if (socktype->domain == AF_SP && socktype->protocol == NN_PUB)
+            break;
+    if (nn_slow (!socktype)) {
+        if (self.print_errors)
+            fprintf (stderr, "nanomsg: statistics[%s]: Error: %s\n",
+                addr, nn_strerror (EPROTONOSUPPORT));
+        return;
+    }
+
+    /*  Create the publisher and connect it to the collector. */
+    self.stat_sock = nn_alloc (sizeof (struct nn_sock), "statistics socket");
+    alloc_assert (self.stat_sock);
+    rc = nn_sock_init (self.stat_sock, socktype, -1);
+    errnum_assert (rc == 0, -rc);
+    rc = nn_global_create_ep (self.stat_sock, addr, 0);
+    if (nn_slow (rc < 0)) {
+        if (self.print_errors)
+            fprintf (stderr, "nanomsg: statistics[%s]: Error: %s\n",
+                addr, nn_strerror (-rc));
+        nn_global_stat_close ();
+        return;
+    }
+}
+
+static void nn_global_statshm_start (const char *name)
+{
+    int rc;
+    int i;
+    int n;
+    struct nn_symbol_properties sym;
+
+    /*  The segment has a slot for each descriptor the socket table has
+        room for when the library is initialised. */
+    for (n = 0, i = 0; nn_symbol_info (i, &sym, sizeof (sym)); ++i)
+        if (sym.ns == NN_NS_STATISTIC)
+            ++n;
+    rc = nn_statshm_init (&self.statshm, name,
+        self.nchunks * NN_GLOBAL_CHUNK_SLOTS, n, self.stat_interval);
+    if (nn_slow (rc < 0)) {
+        if (self.print_errors)
+            fprintf (stderr, "nanomsg: statistics[%s]: Error: %s\n",
+                name, nn_strerror (-rc));
+        return;
+    }
+
+    self.stat_ids = nn_alloc (sizeof (int) * n, "statistics ids");
+    alloc_assert (self.stat_ids);
+    self.nstat_ids = n;
+    for (n = 0, i = 0; nn_symbol_info (i, &sym, sizeof (sym)); ++i) {
+        if (sym.ns != NN_NS_STATISTIC)
+            continue;
+
+        /*  Skip the "NN_STAT_" prefix of the name. */
+        nn_statshm_setname (&self.statshm, n, sym.name + 8);
+        self.stat_ids [n++] = sym.value;
+    }
+    nn_statshm_publish (&self.statshm);
+    self.stat_shm = 1;
+}
+
+static void nn_global_stat_stop (void)
+{
+    int rc;
+
+    if (!self.stat_sock && !self.stat_shm)
+        return;
+
+    /*  Stop the timer and wait till no report is in progress. */
+    nn_ctx_enter (&self.ctx);
+    nn_fsm_stop (&self.fsm);
+    nn_ctx_leave (&self.ctx);
+    for (;;) {
+        rc = nn_pool_wait (&self.pool, &self.stat_stopped);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        break;
+    }
+
+    /*  The worker that posted the semaphore may still be in the context. */
+    nn_ctx_enter (&self.ctx);
+    nn_ctx_leave (&self.ctx);
+
+    nn_sem_term (&self.stat_stopped);
+    nn_timer_term (&self.stat_timer);
+    nn_fsm_term (&self.fsm);
+    nn_ctx_term (&self.ctx);
+
+    if (self.stat_sock)
+        nn_global_stat_close ();
+    if (self.stat_shm) {
+        nn_statshm_term (&self.statshm);
+        nn_free (self.stat_ids);
+        self.stat_shm = 0;
+    }
+}
+
+static void nn_global_stat_close (void)
+{
+    int rc;
+
+    /*  There's no socket table slot to clear, so release the implicit
+        hold by hand to let nn_sock_term complete. */
+    nn_sock_stop (self.stat_sock);
+    nn_sock_rele (self.stat_sock);
+    rc = nn_sock_term (self.stat_sock);
+    errnum_assert (rc == 0, -rc);
+    nn_free (self.stat_sock);
+    self.stat_sock = NULL;
+}
+
+static void nn_global_submit_report (const char *buf, size_t len)
+{
+    int rc;
+    struct nn_msg msg;
+
+    /*  If the collector can't keep up, the report is dropped. */
+    nn_msg_init (&msg, len);
+    memcpy (nn_chunkref_data (&msg.body), buf, len);
+    rc = nn_sock_send (self.stat_sock, &msg, NN_DONTWAIT);
+    if (nn_slow (rc < 0))
+        nn_msg_term (&msg);
+}
+
+/*  The allocation monitor is reported under the name "alloc", e.g.
+    "alloc 1500000000 message_chunk.live_bytes=1024
+    message_chunk.allocations=16", with the spaces in the names of the
+    allocation sites replaced by underscores. Sites that don't fit into
+    a single message are reported in further messages. */
+static void nn_global_submit_alloc_statistics (unsigned long now)
+{
+    int i;
+    size_t j;
+    int nstats;
+    size_t len;
+    size_t hdrlen;
+    char name [41];
+    struct nn_alloc_stat stats [NN_GLOBAL_ALLOC_STATS];
+    char buf [NN_GLOBAL_STAT_BUFSIZE];
+
+    nstats = nn_alloc_stats (stats, NN_GLOBAL_ALLOC_STATS);
+    if (!nstats)
+        return;
+
+    hdrlen = sprintf (buf, "alloc %lu", now);
+    len = hdrlen;
+    for (i = 0; i != nstats; ++i) {
+        if (len + 2 * NN_GLOBAL_STAT_FIELDSIZE > sizeof (buf)) {
+            nn_global_submit_report (buf, len);
+            len = hdrlen;
+        }
+        for (j = 0; j != sizeof (name) - 1 && stats [i].name [j]; ++j)
+            name [j] = stats [i].name [j] == ' ' ? '_' : stats [i].name [j];
+        name [j] = 0;
+        len += sprintf (buf + len, " %s.live_bytes=%llu %s.allocations=%llu",
+            name, (unsigned long long) stats [i].live_bytes,
+            name, (unsigned long long) stats [i].allocations);
+    }
+    nn_global_submit_report (buf, len);
+}
+
+/*  The slot of each open socket is filled in with all its statistics, zero
+    or not; slots of sockets closed since the last update are marked as
+    such. As with the reports, the sockets are held rather than locked. */
+static void nn_global_statshm_update (unsigned long now)
+{
+    int s;
+    int i;
+    int rc;
+    struct nn_sock *sock;
+    struct nn_statshm_slot *slot;
+    uint64_t value;
+
+    for (s = 0; (slot = nn_statshm_slot (&self.statshm, s)) != NULL; ++s) {
+        if (nn_global_hold_socket (&sock, s) < 0) {
+            if (slot->live) {
+                nn_statshm_lock (slot);
+                slot->live = 0;
+                slot->time = now;
+                nn_statshm_unlock (slot);
+            }
+            continue;
+        }
+
+        nn_statshm_lock (slot);
+        slot->live = 1;
+        slot->time = now;
+        memcpy (slot->name, sock->socket_name, sizeof (slot->name));
+        slot->name [sizeof (slot->name) - 1] = 0;
+        for (i = 0; i != self.nstat_ids; ++i) {
+            rc = nn_sock_stat_get (sock, self.stat_ids [i], &value);
+            slot->values [i] = rc < 0 ? 0 : value;
+        }
+        nn_statshm_unlock (slot);
+
+        nn_global_rele_socket (s);
+    }
+}
+
+static void nn_global_submit_statistics (void)
+{
+    int rc;
+    int s;
+    int i;
+    int nslots;
+    size_t len;
+    struct nn_sock *sock;
+    struct nn_symbol_properties sym;
+    uint64_t value;
+    unsigned long now;
+    char buf [NN_GLOBAL_STAT_BUFSIZE];
+
+    now = (unsigned long) time (NULL);
+    if (self.stat_shm)
+        nn_global_statshm_update (now);
+    if (!self.stat_sock)
+        return;
+
+    /*  Each socket is reported in a single message consisting of its name,
+        the wall clock time in seconds and the space separated list of its
+        non-zero statistics, e.g. "1 1500000000 MESSAGES_SENT=12". Sockets
+        are held rather than locked, so reporting doesn't contend with
+        the application using them. */
+    nslots = self.nchunks * NN_GLOBAL_CHUNK_SLOTS;
+    for (s = 0; s != nslots; ++s) {
+        if (nn_global_hold_socket (&sock, s) < 0)
+            continue;
+
+        len = sprintf (buf, "%.63s %lu", sock->socket_name, now);
+        for (i = 0; nn_symbol_info (i, &sym, sizeof (sym)); ++i) {
+            if (sym.ns != NN_NS_STATISTIC)
+                continue;
+            rc = nn_sock_stat_get (sock, sym.value, &value);
+            if (rc < 0 || !value)
+                continue;
+            if (len + NN_GLOBAL_STAT_FIELDSIZE > sizeof (buf))
+                break;
+
+            /*  Skip the "NN_STAT_" prefix of the name. */
+            len += sprintf (buf + len, " %.60s=%llu",
+                sym.name + 8, (unsigned long long) value);
+        }
+
+        nn_global_rele_socket (s);
+
+        nn_global_submit_report (buf, len);
+    }
+
+    nn_global_submit_alloc_statistics (now);
+}
+
+static void nn_global_handler (NN_UNUSED struct nn_fsm *myfsm,
+    int src, int type, NN_UNUSED void *srcptr)
+{
+    switch (self.state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/*  The state machine wasn't yet started.                                     */
+/******************************************************************************/
+    case NN_GLOBAL_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                self.state = NN_GLOBAL_STATE_ACTIVE;
+                nn_timer_start (&self.stat_timer, self.stat_interval);
+                return;
+            default:
+                nn_fsm_bad_action (self.state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (self.state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/*  Statistics are submitted each time the timer fires.                       */
+/******************************************************************************/
+    case NN_GLOBAL_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_GLOBAL_SRC_STAT_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+                nn_global_submit_statistics ();
+                nn_timer_stop (&self.stat_timer);
+                return;
+            case NN_TIMER_STOPPED:
+                nn_timer_start (&self.stat_timer, self.stat_interval);
+                return;
+            default:
+                nn_fsm_bad_action (self.state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (self.state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (self.state, src, type);
+    }
 }
 
-void nn_global_rele_socket(struct nn_sock *sock)
+static void nn_global_shutdown (NN_UNUSED struct nn_fsm *myfsm,
+    int src, int type, NN_UNUSED void *srcptr)
 {
-    nn_mutex_lock(&self.lock);
-    nn_sock_rele(sock);
-    nn_mutex_unlock(&self.lock);
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        nn_timer_stop (&self.stat_timer);
+        self.state = NN_GLOBAL_STATE_STOPPING_TIMER;
+        return;
+    }
+    if (nn_slow (self.state == NN_GLOBAL_STATE_STOPPING_TIMER)) {
+        if (!nn_timer_isidle (&self.stat_timer))
+            return;
+        self.state = NN_GLOBAL_STATE_IDLE;
+        nn_fsm_stopped_noevent (&self.fsm);
+        nn_sem_post (&self.stat_stopped);
+        return;
+    }
+
+    nn_fsm_bad_state (self.state, src, type);
 }
@@ -23,6 +23,8 @@
 #ifndef NN_GLOBAL_INCLUDED
 #define NN_GLOBAL_INCLUDED
 
+struct nn_sock;
+
 /*  Provides access to the list of available transports. */
 struct nn_transport *nn_global_transport (int id);
 
@@ -30,4 +32,14 @@ struct nn_transport *nn_global_transport (int id);
 struct nn_pool *nn_global_getpool ();
 int nn_global_print_errors();
 
+/*  Parses a list of CPUs or worker indices such as "0,2,4-7" into 'cpus'.
+    Returns the number of entries, parsing stops at the first invalid one. */
+int nn_global_parse_cpus (const char *str, int *cpus, int maxcpus);
+
+/*  Get the socket structure for a socket descriptor. The socket won't be
+    deallocated until the hold is released, even if it's closed meanwhile.
+    Neither function takes the global lock. */
+int nn_global_hold_socket (struct nn_sock **sockp, int s);
+void nn_global_rele_socket (int s);
+
 #endif
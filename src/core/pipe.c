@@ -27,8 +27,17 @@
 #include "sock.h"
 #include "ep.h"
 
+#include "../aio/ctx.h"
+
 #include "../utils/err.h"
+#include "../utils/clock.h"
 #include "../utils/fast.h"
+#include "../utils/trace.h"
+#include "../utils/alloc.h"
+#include "../utils/cont.h"
+#include "../utils/wire.h"
+
+#include <string.h>
 
 /*  Internal pipe states. */
 #define NN_PIPEBASE_STATE_IDLE 1
@@ -47,26 +56,144 @@
 #define NN_PIPEBASE_OUTSTATE_SENT 3
 #define NN_PIPEBASE_OUTSTATE_ASYNC 4
 
-void nn_pipebase_init (struct nn_pipebase *self,
-    const struct nn_pipebase_vfptr *vfptr, struct nn_ep *ep)
+/*  Pipe striped over several connections. It's the pipe seen by
+    the protocol while the connections, its members, are not added to
+    the socket at all. Every message sent through the group is preceded by
+    an 8-byte sequence number, stripped off by the receiving group, which
+    uses it to pass the messages to the protocol in the order they were
+    sent if asked to. A group may also be split between the members carrying
+    the small messages and those carrying the large ones, in which case
+    the messages are passed to the protocol as they arrive. */
+struct nn_pipegroup {
+
+    /*  The pipe passed to the protocol. */
+    struct nn_pipebase base;
+
+    /*  State machine the notifications of the members are delivered to.
+        It's never started, all the events are handled by the handler. */
+    struct nn_fsm fsm;
+
+    /*  Item in the list of groups of the socket. */
+    struct nn_list_item item;
+
+    /*  Identifier of the group, number of members it's expected to consist
+        of and whether the messages are to be received in order. */
+    uint64_t id;
+    int size;
+    int ordered;
+
+    /*  Messages larger than this are sent over the bulk members, 0 if
+        the group is not split. */
+    size_t threshold;
+
+    /*  The members, the one sent to the longest time ago being the first
+        one. */
+    struct nn_list members;
+
+    /*  Sequence number of the next message to send and of the one expected
+        to be received next. */
+    uint64_t sndseq;
+    uint64_t rcvseq;
+
+    /*  Set once a member leaves the group. The messages it had on the way
+        are lost and not waited for any more. */
+    int degraded;
+
+    /*  Message accepted from the protocol while none of the members was
+        writable, if 'hasout' is set. */
+    struct nn_msg outmsg;
+    int hasout;
+};
+
+struct nn_pipegroup_member {
+    struct nn_pipebase *pipe;
+    struct nn_pipegroup *group;
+    struct nn_list_item item;
+
+    /*  The message received from the member, if 'hasmsg' is set, along with
+        its sequence number. */
+    struct nn_msg msg;
+    int hasmsg;
+    uint64_t seq;
+
+    /*  Set if the member was disconnected and is about to leave. */
+    int broken;
+
+    /*  Set if the member carries the large messages of a split group. */
+    int bulk;
+};
+
+static int nn_pipegroup_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_pipegroup_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_pipegroup_queued (struct nn_pipebase *self);
+static size_t nn_pipegroup_unsent (struct nn_pipebase *self);
+static void nn_pipegroup_disconnect (struct nn_pipebase *self);
+static const struct nn_pipebase_vfptr nn_pipegroup_vfptr = {
+    nn_pipegroup_send,
+    nn_pipegroup_recv,
+    nn_pipegroup_queued,
+    nn_pipegroup_unsent,
+    nn_pipegroup_disconnect
+};
+
+static void nn_pipegroup_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static int nn_pipegroup_join (struct nn_pipebase *pipe);
+static void nn_pipegroup_leave (struct nn_pipebase *pipe);
+static void nn_pipegroup_pull (struct nn_pipegroup *self);
+static void nn_pipegroup_notify (struct nn_pipegroup *self);
+static struct nn_pipegroup_member *nn_pipegroup_eligible (
+    struct nn_pipegroup *self);
+static struct nn_pipegroup_member *nn_pipegroup_writable (
+    struct nn_pipegroup *self, int bulk);
+static int nn_pipegroup_class (struct nn_pipegroup *self, struct nn_msg *msg);
+static void nn_pipegroup_push (struct nn_pipegroup *self,
+    struct nn_pipegroup_member *member, struct nn_msg *msg);
+
+static void nn_pipebase_init_inner (struct nn_pipebase *self,
+    const struct nn_pipebase_vfptr *vfptr, struct nn_sock *sock,
+    const struct nn_ep_options *options, struct nn_ep *ep, int eid)
 {
-    nn_assert (ep->sock);
-
-    nn_fsm_init (&self->fsm, NULL, NULL, 0, self, &ep->sock->fsm);
+    nn_fsm_init (&self->fsm, NULL, NULL, 0, self, &sock->fsm);
     self->vfptr = vfptr;
     self->state = NN_PIPEBASE_STATE_IDLE;
     self->instate = NN_PIPEBASE_INSTATE_DEACTIVATED;
     self->outstate = NN_PIPEBASE_OUTSTATE_DEACTIVATED;
-    self->sock = ep->sock;
-    memcpy (&self->options, &ep->options, sizeof (struct nn_ep_options));
+    self->sock = sock;
+    memcpy (&self->options, options, sizeof (struct nn_ep_options));
     nn_fsm_event_init (&self->in);
     nn_fsm_event_init (&self->out);
+    self->groupid = 0;
+    self->groupsize = 0;
+    self->grouporder = 0;
+    self->groupbulk = 0;
+    self->groupthreshold = 0;
+    self->member = NULL;
+    nn_list_item_init (&self->item);
+    self->standby = 0;
+    self->sendfile = 0;
+    self->pieces = 0;
+    self->frame = NULL;
+    self->ep = ep;
+    self->eid = eid;
+    self->id = 0;
+    memset (&self->statistics, 0, sizeof (self->statistics));
+}
+
+void nn_pipebase_init (struct nn_pipebase *self,
+    const struct nn_pipebase_vfptr *vfptr, struct nn_ep *ep)
+{
+    nn_assert (ep->sock);
+
+    nn_pipebase_init_inner (self, vfptr, ep->sock, &ep->options,
+        ep, ep->eid);
 }
 
 void nn_pipebase_term (struct nn_pipebase *self)
 {
     nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
 
+    nn_list_item_term (&self->item);
     nn_fsm_event_term (&self->out);
     nn_fsm_event_term (&self->in);
     nn_fsm_term (&self->fsm);
@@ -81,21 +208,125 @@ int nn_pipebase_start (struct nn_pipebase *self)
     self->state = NN_PIPEBASE_STATE_ACTIVE;
     self->instate = NN_PIPEBASE_INSTATE_ASYNC;
     self->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
-    rc = nn_sock_add (self->sock, (struct nn_pipe*) self);
+
+    /*  Members of a group are not passed to the protocol. Their
+        notifications, including the one below, go to the group instead.
+        Neither are the connections the endpoint holds in reserve. They are
+        passed to the protocol once they replace the one in use. */
+    if (self->groupid)
+        rc = nn_pipegroup_join (self);
+    else if (nn_slow (self->ep && self->options.standby &&
+          self->ep->inuse)) {
+        self->standby = 1;
+        nn_list_insert (&self->ep->standby, &self->item,
+            nn_list_end (&self->ep->standby));
+        ++self->ep->statistics.current_connections;
+        return 0;
+    }
+    else {
+        rc = nn_sock_add (self->sock, (struct nn_pipe*) self);
+        if (rc >= 0 && self->ep)
+            ++self->ep->inuse;
+    }
     if (nn_slow (rc < 0)) {
         self->state = NN_PIPEBASE_STATE_FAILED;
         return rc;
     }
+    if (self->ep)
+        ++self->ep->statistics.current_connections;
     nn_fsm_raise (&self->fsm, &self->out, NN_PIPE_OUT);
 
     return 0;
 }
 
+/*  Passes the first of the connections the endpoint holds in reserve to
+    the protocol, along with the notifications it missed. */
+static void nn_pipebase_promote (struct nn_ep *ep)
+{
+    int rc;
+    struct nn_pipebase *self;
+
+    self = nn_cont (nn_list_begin (&ep->standby), struct nn_pipebase, item);
+    nn_list_erase (&ep->standby, &self->item);
+    rc = nn_sock_add (self->sock, (struct nn_pipe*) self);
+    if (nn_slow (rc < 0)) {
+        nn_list_insert (&ep->standby, &self->item,
+            nn_list_begin (&ep->standby));
+        return;
+    }
+    self->standby = 0;
+    ++ep->inuse;
+    nn_fsm_raise (&self->fsm, &self->out, NN_PIPE_OUT);
+    if (self->instate == NN_PIPEBASE_INSTATE_IDLE)
+        nn_fsm_raise (&self->fsm, &self->in, NN_PIPE_IN);
+}
+
+void nn_pipebase_setgroup (struct nn_pipebase *self, uint64_t id,
+    int size, int ordered)
+{
+    nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
+
+    self->groupid = id;
+    self->groupsize = size;
+    self->grouporder = ordered;
+}
+
+void nn_pipebase_setbulk (struct nn_pipebase *self, int bulk,
+    size_t threshold)
+{
+    nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
+    nn_assert (self->groupid && threshold > 0);
+
+    self->groupbulk = bulk;
+    self->groupthreshold = threshold;
+}
+
+void nn_pipebase_setsendfile (struct nn_pipebase *self, int sendfile)
+{
+    nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
+
+    self->sendfile = sendfile;
+}
+
+void nn_pipebase_setpieces (struct nn_pipebase *self, int pieces)
+{
+    nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
+
+    self->pieces = pieces;
+}
+
 void nn_pipebase_stop (struct nn_pipebase *self)
 {
-    if (self->state == NN_PIPEBASE_STATE_ACTIVE)
-        nn_sock_rm (self->sock, (struct nn_pipe*) self);
+    if (self->state == NN_PIPEBASE_STATE_ACTIVE) {
+        if (self->ep)
+            --self->ep->statistics.current_connections;
+        if (self->member)
+            nn_pipegroup_leave (self);
+        else if (nn_slow (self->standby)) {
+            nn_list_erase (&self->ep->standby, &self->item);
+            self->standby = 0;
+        }
+        else {
+            nn_sock_rm (self->sock, (struct nn_pipe*) self);
+
+            /*  A connection held in reserve takes over straight away,
+                unless the endpoint is being shut down. */
+            if (self->ep) {
+                --self->ep->inuse;
+                if (!nn_list_empty (&self->ep->standby) &&
+                      nn_ep_isactive (self->ep))
+                    nn_pipebase_promote (self->ep);
+            }
+        }
+    }
     self->state = NN_PIPEBASE_STATE_IDLE;
+
+    /*  The socket has forgotten about the pipe, so the notifications raised
+        but not yet delivered must not reach it. This happens when the
+        connection breaks within the same context as the pipe got readable
+        or writable. */
+    nn_queue_remove (&self->fsm.ctx->events, &self->in.item);
+    nn_queue_remove (&self->fsm.ctx->events, &self->out.item);
 }
 
 void nn_pipebase_received (struct nn_pipebase *self)
@@ -106,6 +337,10 @@ void nn_pipebase_received (struct nn_pipebase *self)
     }
     nn_assert (self->instate == NN_PIPEBASE_INSTATE_ASYNC);
     self->instate = NN_PIPEBASE_INSTATE_IDLE;
+
+    /*  A pipe held in reserve is notified once it's promoted. */
+    if (nn_slow (self->standby))
+        return;
     nn_fsm_raise (&self->fsm, &self->in, NN_PIPE_IN);
 }
 
@@ -117,9 +352,37 @@ void nn_pipebase_sent (struct nn_pipebase *self)
     }
     nn_assert (self->outstate == NN_PIPEBASE_OUTSTATE_ASYNC);
     self->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
+    self->statistics.blocked_time +=
+        nn_clock_us () - self->statistics.blocked_since;
     nn_fsm_raise (&self->fsm, &self->out, NN_PIPE_OUT);
 }
 
+void nn_pipebase_drained (struct nn_pipebase *self)
+{
+    nn_sock_drained (self->sock);
+}
+
+int nn_pipebase_flushed (struct nn_pipebase *self)
+{
+    /*  The transport hasn't got rid of the last message yet. */
+    if (self->outstate == NN_PIPEBASE_OUTSTATE_ASYNC)
+        return 0;
+
+    if (self->vfptr->unsent)
+        return self->vfptr->unsent (self) == 0 ? 1 : 0;
+    return self->vfptr->queued (self) == 0 ? 1 : 0;
+}
+
+int nn_pipebase_blocked (struct nn_pipebase *self)
+{
+    return self->outstate == NN_PIPEBASE_OUTSTATE_ASYNC ? 1 : 0;
+}
+
+struct nn_msg_frame *nn_pipebase_frame (struct nn_pipebase *self)
+{
+    return self->frame;
+}
+
 void nn_pipebase_getopt (struct nn_pipebase *self, int level, int option,
     void *optval, size_t *optvallen)
 {
@@ -136,9 +399,18 @@ void nn_pipebase_getopt (struct nn_pipebase *self, int level, int option,
         case NN_RCVPRIO:
             intval = self->options.rcvprio;
             break;
+        case NN_RCVWEIGHT:
+            intval = self->options.rcvweight;
+            break;
         case NN_IPV4ONLY:
             intval = self->options.ipv4only;
             break;
+        case NN_RCVPOOL:
+            intval = self->options.rcvpool;
+            break;
+        case NN_IDLE_TIMEOUT:
+            intval = self->options.idle;
+            break;
 
         /*  Fallback to socket options  */
         default:
@@ -174,15 +446,99 @@ void *nn_pipe_getdata (struct nn_pipe *self)
     return ((struct nn_pipebase*) self)->data;
 }
 
+#if defined NN_STATIC_DISPATCH
+
+/*  Pipes of the transports most of the traffic goes through. Their
+    functions are called directly rather than through the pointer held by
+    the pipe. Once the library is built with link-time optimisation, these
+    calls can be inlined. */
+extern const struct nn_pipebase_vfptr nn_sinproc_pipebase_vfptr;
+#if defined NN_HAVE_IPC
+extern const struct nn_pipebase_vfptr nn_sipc_pipebase_vfptr;
+#endif
+#if defined NN_HAVE_TCP
+extern const struct nn_pipebase_vfptr nn_stcp_pipebase_vfptr;
+#endif
+
+#endif
+
+static int nn_pipebase_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+#if defined NN_STATIC_DISPATCH
+    if (self->vfptr == &nn_sinproc_pipebase_vfptr)
+        return nn_sinproc_pipebase_vfptr.send (self, msg);
+#if defined NN_HAVE_TCP
+    if (self->vfptr == &nn_stcp_pipebase_vfptr)
+        return nn_stcp_pipebase_vfptr.send (self, msg);
+#endif
+#if defined NN_HAVE_IPC
+    if (self->vfptr == &nn_sipc_pipebase_vfptr)
+        return nn_sipc_pipebase_vfptr.send (self, msg);
+#endif
+#endif
+    return self->vfptr->send (self, msg);
+}
+
+static int nn_pipebase_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+#if defined NN_STATIC_DISPATCH
+    if (self->vfptr == &nn_sinproc_pipebase_vfptr)
+        return nn_sinproc_pipebase_vfptr.recv (self, msg);
+#if defined NN_HAVE_TCP
+    if (self->vfptr == &nn_stcp_pipebase_vfptr)
+        return nn_stcp_pipebase_vfptr.recv (self, msg);
+#endif
+#if defined NN_HAVE_IPC
+    if (self->vfptr == &nn_sipc_pipebase_vfptr)
+        return nn_sipc_pipebase_vfptr.recv (self, msg);
+#endif
+#endif
+    return self->vfptr->recv (self, msg);
+}
+
 int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
 {
     int rc;
+    size_t sz;
     struct nn_pipebase *pipebase;
 
     pipebase = (struct nn_pipebase*) self;
     nn_assert (pipebase->outstate == NN_PIPEBASE_OUTSTATE_IDLE);
     pipebase->outstate = NN_PIPEBASE_OUTSTATE_SENDING;
-    rc = pipebase->vfptr->send (pipebase, msg);
+    sz = nn_chunkref_size (&msg->body);
+    NN_TRACE (NN_TRACE_PIPE_SEND, self, sz);
+    ++pipebase->statistics.messages_sent;
+    pipebase->statistics.bytes_sent += sz;
+    if (pipebase->ep) {
+        ++pipebase->ep->statistics.messages_sent;
+        pipebase->ep->statistics.bytes_sent += sz;
+    }
+
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0)) {
+
+        /*  The transport can't send the file region attached to the
+            message, so it's read into memory instead. If that fails,
+            there's no way to report the error and the message is
+            dropped. */
+        if (!pipebase->sendfile && nn_msg_file (msg, NULL)) {
+            rc = nn_msg_loadfile (msg);
+            if (nn_slow (rc < 0)) {
+                nn_msg_term (msg);
+                pipebase->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
+                return 0;
+            }
+        }
+
+        /*  Neither is there a way to deliver a piece of a message if
+            the transport can't keep the pieces together. */
+        if (!pipebase->pieces && nn_msg_piece (msg, NULL)) {
+            nn_msg_term (msg);
+            pipebase->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
+            return 0;
+        }
+    }
+
+    rc = nn_pipebase_send (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
     if (nn_fast (pipebase->outstate == NN_PIPEBASE_OUTSTATE_SENT)) {
         pipebase->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
@@ -190,19 +546,45 @@ int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
     }
     nn_assert (pipebase->outstate == NN_PIPEBASE_OUTSTATE_SENDING);
     pipebase->outstate = NN_PIPEBASE_OUTSTATE_ASYNC;
+    pipebase->statistics.blocked_since = nn_clock_us ();
     return rc | NN_PIPEBASE_RELEASE;
 }
 
+int nn_pipe_sendframe (struct nn_pipe *self, struct nn_msg *msg,
+    struct nn_msg_frame *frame)
+{
+    int rc;
+    struct nn_pipebase *pipebase;
+
+    /*  Transport headers may change the framing of the message from one
+        pipe to another, so such messages share nothing. */
+    pipebase = (struct nn_pipebase*) self;
+    if (nn_fast (nn_chunkref_size (&msg->hdrs) == 0))
+        pipebase->frame = frame;
+    rc = nn_pipe_send (self, msg);
+    pipebase->frame = NULL;
+    return rc;
+}
+
 int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
 {
     int rc;
+    size_t sz;
     struct nn_pipebase *pipebase;
 
     pipebase = (struct nn_pipebase*) self;
     nn_assert (pipebase->instate == NN_PIPEBASE_INSTATE_IDLE);
     pipebase->instate = NN_PIPEBASE_INSTATE_RECEIVING;
-    rc = pipebase->vfptr->recv (pipebase, msg);
+    rc = nn_pipebase_recv (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
+    sz = nn_chunkref_size (&msg->body);
+    NN_TRACE (NN_TRACE_PIPE_RECV, self, sz);
+    ++pipebase->statistics.messages_received;
+    pipebase->statistics.bytes_received += sz;
+    if (pipebase->ep) {
+        ++pipebase->ep->statistics.messages_received;
+        pipebase->ep->statistics.bytes_received += sz;
+    }
 
     if (nn_fast (pipebase->instate == NN_PIPEBASE_INSTATE_RECEIVED)) {
         pipebase->instate = NN_PIPEBASE_INSTATE_IDLE;
@@ -213,6 +595,25 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
     return rc | NN_PIPEBASE_RELEASE;
 }
 
+size_t nn_pipe_queued (struct nn_pipe *self)
+{
+    struct nn_pipebase *pipebase;
+
+    pipebase = (struct nn_pipebase*) self;
+    return pipebase->vfptr->queued (pipebase);
+}
+
+int nn_pipe_disconnect (struct nn_pipe *self)
+{
+    struct nn_pipebase *pipebase;
+
+    pipebase = (struct nn_pipebase*) self;
+    if (!pipebase->vfptr->disconnect)
+        return -ENOTSUP;
+    pipebase->vfptr->disconnect (pipebase);
+    return 0;
+}
+
 void nn_pipe_getopt (struct nn_pipe *self, int level, int option,
     void *optval, size_t *optvallen)
 {
@@ -222,3 +623,400 @@ void nn_pipe_getopt (struct nn_pipe *self, int level, int option,
     pipebase = (struct nn_pipebase*) self;
     nn_pipebase_getopt (pipebase, level, option, optval, optvallen);
 }
+
+static int nn_pipegroup_join (struct nn_pipebase *pipe)
+{
+    int rc;
+    struct nn_list_item *it;
+    struct nn_pipegroup *group;
+    struct nn_pipegroup_member *member;
+
+    /*  Look for the group among those of the socket. */
+    group = NULL;
+    for (it = nn_list_begin (&pipe->sock->pipegroups);
+          it != nn_list_end (&pipe->sock->pipegroups);
+          it = nn_list_next (&pipe->sock->pipegroups, it)) {
+        group = nn_cont (it, struct nn_pipegroup, item);
+        if (group->id == pipe->groupid)
+            break;
+        group = NULL;
+    }
+
+    /*  The first member creates the group, which is then passed to the
+        protocol the same way as any other pipe. */
+    if (!group) {
+        group = nn_alloc (sizeof (struct nn_pipegroup), "pipe group");
+        alloc_assert (group);
+        nn_pipebase_init_inner (&group->base, &nn_pipegroup_vfptr,
+            pipe->sock, &pipe->options, NULL, pipe->eid);
+
+        /*  The region is passed to the member the message is sent to, which
+            decides on its own. */
+        group->base.sendfile = 1;
+        nn_fsm_init (&group->fsm, nn_pipegroup_handler, nn_pipegroup_handler,
+            0, group, &pipe->sock->fsm);
+        nn_list_item_init (&group->item);
+        group->id = pipe->groupid;
+        group->size = pipe->groupsize;
+        group->ordered = pipe->grouporder;
+        group->threshold = pipe->groupthreshold;
+        nn_list_init (&group->members);
+        group->sndseq = 0;
+        group->rcvseq = 0;
+        group->degraded = 0;
+        group->hasout = 0;
+        rc = nn_pipebase_start (&group->base);
+        if (nn_slow (rc < 0)) {
+            nn_pipebase_stop (&group->base);
+            nn_list_term (&group->members);
+            nn_list_item_term (&group->item);
+            nn_fsm_term (&group->fsm);
+            nn_pipebase_term (&group->base);
+            nn_free (group);
+            return rc;
+        }
+        nn_list_insert (&pipe->sock->pipegroups, &group->item,
+            nn_list_end (&pipe->sock->pipegroups));
+    }
+
+    member = nn_alloc (sizeof (struct nn_pipegroup_member),
+        "pipe group member");
+    alloc_assert (member);
+    member->pipe = pipe;
+    member->group = group;
+    nn_list_item_init (&member->item);
+    member->hasmsg = 0;
+    member->seq = 0;
+    member->broken = 0;
+    member->bulk = pipe->groupbulk;
+    nn_list_insert (&group->members, &member->item,
+        nn_list_end (&group->members));
+    pipe->member = member;
+    pipe->fsm.owner = &group->fsm;
+
+    return 0;
+}
+
+static void nn_pipegroup_leave (struct nn_pipebase *pipe)
+{
+    struct nn_pipegroup_member *member;
+    struct nn_pipegroup *group;
+
+    member = pipe->member;
+    group = member->group;
+
+    nn_list_erase (&group->members, &member->item);
+    nn_list_item_term (&member->item);
+    if (member->hasmsg)
+        nn_msg_term (&member->msg);
+    nn_free (member);
+    pipe->member = NULL;
+    pipe->fsm.owner = &pipe->sock->fsm;
+
+    /*  Messages received from the remaining members may have been waiting
+        for those lost along with the member. */
+    if (!nn_list_empty (&group->members)) {
+        group->degraded = 1;
+        nn_pipegroup_notify (group);
+        return;
+    }
+
+    /*  The last member is gone. Remove the group from the socket. */
+    nn_pipebase_stop (&group->base);
+    nn_list_erase (&pipe->sock->pipegroups, &group->item);
+    if (group->hasout)
+        nn_msg_term (&group->outmsg);
+    nn_list_term (&group->members);
+    nn_list_item_term (&group->item);
+    nn_fsm_term (&group->fsm);
+    nn_pipebase_term (&group->base);
+    nn_free (group);
+}
+
+static void nn_pipegroup_handler (struct nn_fsm *self, int src,
+    int type, void *srcptr)
+{
+    struct nn_pipegroup *group;
+    struct nn_pipegroup_member *member;
+
+    group = nn_cont (self, struct nn_pipegroup, fsm);
+    nn_assert (((struct nn_pipebase*) srcptr)->member);
+
+    switch (type) {
+    case NN_PIPE_IN:
+        nn_pipegroup_pull (group);
+        nn_pipegroup_notify (group);
+        return;
+    case NN_PIPE_OUT:
+        if (group->hasout) {
+            member = nn_pipegroup_writable (group,
+                nn_pipegroup_class (group, &group->outmsg));
+            if (!member)
+                return;
+            group->hasout = 0;
+            nn_pipegroup_push (group, member, &group->outmsg);
+        }
+        if (group->base.outstate == NN_PIPEBASE_OUTSTATE_ASYNC &&
+              nn_pipegroup_writable (group, -1))
+            nn_pipebase_sent (&group->base);
+        return;
+    default:
+        nn_fsm_bad_action (-1, src, type);
+    }
+}
+
+static void nn_pipegroup_pull (struct nn_pipegroup *self)
+{
+    int rc;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+
+    for (it = nn_list_begin (&self->members);
+          it != nn_list_end (&self->members);
+          it = nn_list_next (&self->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        if (member->hasmsg || member->broken ||
+              member->pipe->instate != NN_PIPEBASE_INSTATE_IDLE)
+            continue;
+        rc = nn_pipe_recv ((struct nn_pipe*) member->pipe, &member->msg);
+        nn_assert (!(rc & NN_PIPEBASE_PARSED));
+
+        /*  Message without the sequence number is a protocol error. */
+        if (nn_slow (nn_chunkref_size (&member->msg.body) < 8)) {
+            nn_msg_term (&member->msg);
+            member->broken = 1;
+            nn_pipe_disconnect ((struct nn_pipe*) member->pipe);
+            continue;
+        }
+        member->seq = nn_getll (nn_chunkref_data (&member->msg.body));
+        nn_chunkref_trim (&member->msg.body, 8);
+        member->hasmsg = 1;
+    }
+}
+
+static void nn_pipegroup_notify (struct nn_pipegroup *self)
+{
+    if (self->base.instate == NN_PIPEBASE_INSTATE_ASYNC &&
+          nn_pipegroup_eligible (self))
+        nn_pipebase_received (&self->base);
+}
+
+static struct nn_pipegroup_member *nn_pipegroup_eligible (
+    struct nn_pipegroup *self)
+{
+    int all;
+    int count;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+    struct nn_pipegroup_member *best;
+
+    /*  Each of the connections is ordered, so the message sent first is
+        the one with the lowest sequence number. */
+    all = 1;
+    count = 0;
+    best = NULL;
+    for (it = nn_list_begin (&self->members);
+          it != nn_list_end (&self->members);
+          it = nn_list_next (&self->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        ++count;
+        if (!member->hasmsg) {
+            all = 0;
+            continue;
+        }
+        if (!best || member->seq < best->seq)
+            best = member;
+    }
+    if (!best || !self->ordered || best->seq <= self->rcvseq)
+        return best;
+
+    /*  The message expected is not going to arrive if all the members have
+        later ones at hand, unless some of them haven't joined yet. */
+    if (all && (self->degraded || count >= self->size))
+        return best;
+    return NULL;
+}
+
+static struct nn_pipegroup_member *nn_pipegroup_writable (
+    struct nn_pipegroup *self, int bulk)
+{
+    size_t queued;
+    size_t minqueued;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+    struct nn_pipegroup_member *best;
+
+    /*  The member with the fewest messages waiting is chosen. Among those
+        with the same number the one sent to the longest time ago is. If
+        'bulk' is not -1, only the members of that class are considered. */
+    best = NULL;
+    minqueued = 0;
+    for (it = nn_list_begin (&self->members);
+          it != nn_list_end (&self->members);
+          it = nn_list_next (&self->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        if (member->broken ||
+              member->pipe->outstate != NN_PIPEBASE_OUTSTATE_IDLE ||
+              (bulk >= 0 && member->bulk != bulk))
+            continue;
+        queued = nn_pipe_queued ((struct nn_pipe*) member->pipe);
+        if (!best || queued < minqueued) {
+            best = member;
+            minqueued = queued;
+        }
+    }
+    return best;
+}
+
+static int nn_pipegroup_class (struct nn_pipegroup *self, struct nn_msg *msg)
+{
+    int bulk;
+    size_t sz;
+    struct nn_file_region region;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+
+    if (!self->threshold)
+        return -1;
+
+    /*  The sequence number in front of the header doesn't count. */
+    sz = nn_chunkref_size (&msg->sphdr) - 8 + nn_msg_bodysize (msg);
+    if (nn_msg_file (msg, &region))
+        sz += region.length;
+    bulk = sz > self->threshold ? 1 : 0;
+
+    /*  Each class is carried by a single connection, which keeps the
+        messages of the class in order. While it's not there, the other
+        class takes over. */
+    for (it = nn_list_begin (&self->members);
+          it != nn_list_end (&self->members);
+          it = nn_list_next (&self->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        if (!member->broken && member->bulk == bulk)
+            return bulk;
+    }
+    return !bulk;
+}
+
+static void nn_pipegroup_push (struct nn_pipegroup *self,
+    struct nn_pipegroup_member *member, struct nn_msg *msg)
+{
+    nn_pipe_send ((struct nn_pipe*) member->pipe, msg);
+
+    /*  Move the member to the end of the list for the others to take
+        their turns. */
+    nn_list_erase (&self->members, &member->item);
+    nn_list_insert (&self->members, &member->item,
+        nn_list_end (&self->members));
+}
+
+static int nn_pipegroup_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_pipegroup *group;
+    struct nn_pipegroup_member *member;
+    uint8_t seq [8];
+
+    group = nn_cont (self, struct nn_pipegroup, base);
+
+    /*  Put the sequence number in front of the SP header. */
+    nn_putll (seq, group->sndseq++);
+    nn_chunkref_push (&msg->sphdr, seq, sizeof (seq));
+
+    /*  If none of the members can accept the message, it's kept till one
+        of them can. */
+    member = nn_pipegroup_writable (group, nn_pipegroup_class (group, msg));
+    if (nn_slow (!member)) {
+        nn_msg_mv (&group->outmsg, msg);
+        group->hasout = 1;
+        return 0;
+    }
+    nn_pipegroup_push (group, member, msg);
+
+    /*  The group remains writable as long as any of the members is. */
+    if (nn_pipegroup_writable (group, -1))
+        nn_pipebase_sent (&group->base);
+
+    return 0;
+}
+
+static int nn_pipegroup_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_pipegroup *group;
+    struct nn_pipegroup_member *member;
+
+    group = nn_cont (self, struct nn_pipegroup, base);
+
+    member = nn_pipegroup_eligible (group);
+    nn_assert (member);
+    nn_msg_mv (msg, &member->msg);
+    member->hasmsg = 0;
+    if (member->seq >= group->rcvseq)
+        group->rcvseq = member->seq + 1;
+
+    /*  Get the next message from the member and check whether the group
+        remains readable. */
+    nn_pipegroup_pull (group);
+    if (nn_pipegroup_eligible (group))
+        nn_pipebase_received (&group->base);
+
+    return 0;
+}
+
+static size_t nn_pipegroup_queued (struct nn_pipebase *self)
+{
+    struct nn_pipegroup *group;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+    size_t queued;
+
+    group = nn_cont (self, struct nn_pipegroup, base);
+
+    queued = group->hasout ? 1 : 0;
+    for (it = nn_list_begin (&group->members);
+          it != nn_list_end (&group->members);
+          it = nn_list_next (&group->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        queued += nn_pipe_queued ((struct nn_pipe*) member->pipe);
+    }
+    return queued;
+}
+
+static size_t nn_pipegroup_unsent (struct nn_pipebase *self)
+{
+    struct nn_pipegroup *group;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+    size_t unsent;
+
+    group = nn_cont (self, struct nn_pipegroup, base);
+
+    unsent = group->hasout ? 1 : 0;
+    for (it = nn_list_begin (&group->members);
+          it != nn_list_end (&group->members);
+          it = nn_list_next (&group->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        if (!nn_pipebase_flushed (member->pipe))
+            ++unsent;
+    }
+    return unsent;
+}
+
+static void nn_pipegroup_disconnect (struct nn_pipebase *self)
+{
+    struct nn_pipegroup *group;
+    struct nn_list_item *it;
+    struct nn_pipegroup_member *member;
+
+    group = nn_cont (self, struct nn_pipegroup, base);
+
+    /*  The group goes away once the last of the members does. */
+    for (it = nn_list_begin (&group->members);
+          it != nn_list_end (&group->members);
+          it = nn_list_next (&group->members, it)) {
+        member = nn_cont (it, struct nn_pipegroup_member, item);
+        if (member->broken)
+            continue;
+        member->broken = 1;
+        nn_pipe_disconnect ((struct nn_pipe*) member->pipe);
+    }
+}
@@ -147,7 +147,6 @@ int nn_poll (struct nn_pollfd *fds, int nfds, int timeout)
             rc = nn_getsockopt (fds [i].fd, NN_SOL_SOCKET, NN_RCVFD, &fd, &sz);
             if (nn_slow (rc < 0)) {
                 nn_free (pfd);
-                errno = -rc;
                 return -1;
             }
             nn_assert (sz == sizeof (fd));
@@ -160,7 +159,6 @@ int nn_poll (struct nn_pollfd *fds, int nfds, int timeout)
             rc = nn_getsockopt (fds [i].fd, NN_SOL_SOCKET, NN_SNDFD, &fd, &sz);
             if (nn_slow (rc < 0)) {
                 nn_free (pfd);
-                errno = -rc;
                 return -1;
             }
             nn_assert (sz == sizeof (fd));
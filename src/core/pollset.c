@@ -0,0 +1,529 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+
+#include "../utils/alloc.h"
+#include "../utils/fast.h"
+#include "../utils/err.h"
+#include "../utils/hash.h"
+#include "../utils/list.h"
+#include "../utils/cont.h"
+#include "../utils/attr.h"
+
+#include <stddef.h>
+
+#if defined NN_HAVE_EPOLL
+#define NN_POLLSET_EPOLL
+#elif defined NN_HAVE_KQUEUE
+#define NN_POLLSET_KQUEUE
+#endif
+
+#if defined NN_POLLSET_EPOLL
+#include "../utils/closefd.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+#elif defined NN_POLLSET_KQUEUE
+#include "../utils/closefd.h"
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+/*  NetBSD has different definition of udata. */
+#if defined NN_HAVE_NETBSD
+#define nn_pollset_udata intptr_t
+#else
+#define nn_pollset_udata void*
+#endif
+#endif
+
+#if defined NN_POLLSET_EPOLL || defined NN_POLLSET_KQUEUE
+#define NN_POLLSET_KERNEL
+#endif
+
+/*  A pollset is a persistent set of SP sockets to poll. Where epoll or kqueue
+    is available, the NN_RCVFD and NN_SNDFD file descriptors of a socket are
+    looked up and registered with the kernel once, when the socket is added
+    to the set, and waiting for the set costs only as much as the number of
+    sockets that are ready. Elsewhere the set falls back to nn_poll. */
+
+#if defined NN_POLLSET_KERNEL
+
+/*  One of the two file descriptors of a socket in the set. */
+struct nn_pollset_fd {
+    struct nn_pollset_entry *entry;
+    int fd;
+
+    /*  NN_POLLIN or NN_POLLOUT. Zero if the descriptor is not polled. */
+    short event;
+};
+
+#endif
+
+struct nn_pollset_entry {
+
+    /*  The socket is used as the key in the hash of the pollset. */
+    struct nn_hash_item hashitem;
+    struct nn_list_item item;
+    int s;
+    short events;
+
+#if defined NN_POLLSET_KERNEL
+    struct nn_pollset_fd fds [2];
+
+    /*  Position of the socket in the array of results while a wait is
+        being processed, -1 otherwise. */
+    int pos;
+#endif
+};
+
+struct nn_pollset {
+
+    /*  All the sockets in the set. The hash is used to look them up, the
+        list to iterate over them. */
+    struct nn_hash entries;
+    struct nn_list items;
+    int count;
+
+#if defined NN_POLLSET_KERNEL
+
+    /*  epoll or kqueue file descriptor. */
+    int kfd;
+
+    /*  Buffer for the ready file descriptors reported by the kernel. */
+    int nevents;
+#if defined NN_POLLSET_EPOLL
+    struct epoll_event *events;
+#else
+    struct kevent *events;
+#endif
+
+#else
+
+    /*  Buffer for the pollset passed to nn_poll. */
+    int npollfds;
+    struct nn_pollfd *pollfds;
+#endif
+};
+
+#if defined NN_POLLSET_KERNEL
+
+static int nn_pollset_init_kfd (struct nn_pollset *self)
+{
+#if defined NN_POLLSET_EPOLL
+#ifdef EPOLL_CLOEXEC
+    self->kfd = epoll_create1 (EPOLL_CLOEXEC);
+#else
+    int rc;
+
+    /*  Size parameter is unused, we can safely set it to 1. */
+    self->kfd = epoll_create (1);
+    if (self->kfd != -1) {
+        rc = fcntl (self->kfd, F_SETFD, FD_CLOEXEC);
+        errno_assert (rc != -1);
+    }
+#endif
+#else
+    self->kfd = kqueue ();
+#endif
+    if (nn_slow (self->kfd == -1)) {
+        if (errno == ENFILE || errno == EMFILE)
+            return -EMFILE;
+        errno_assert (0);
+    }
+    self->nevents = 0;
+    self->events = NULL;
+
+    return 0;
+}
+
+/*  Starts polling the file descriptor for readability. */
+static int nn_pollset_register (struct nn_pollset *self,
+    struct nn_pollset_fd *fd)
+{
+    int rc;
+#if defined NN_POLLSET_EPOLL
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void*) fd;
+    rc = epoll_ctl (self->kfd, EPOLL_CTL_ADD, fd->fd, &ev);
+#else
+    struct kevent ev;
+
+    EV_SET (&ev, fd->fd, EVFILT_READ, EV_ADD, 0, 0, (nn_pollset_udata) fd);
+    rc = kevent (self->kfd, &ev, 1, NULL, 0, NULL);
+#endif
+    if (nn_slow (rc < 0)) {
+        if (errno == ENOMEM || errno == ENOSPC)
+            return -ENOMEM;
+        errno_assert (errno == EBADF || errno == EEXIST || errno == ENOENT);
+        return -EBADF;
+    }
+
+    return 0;
+}
+
+static void nn_pollset_unregister (struct nn_pollset *self,
+    struct nn_pollset_fd *fd)
+{
+#if defined NN_POLLSET_EPOLL
+    struct epoll_event ev;
+
+    /*  If the socket was already closed, so was the file descriptor and
+        the kernel has forgotten about it. Hence the error is ignored. */
+    epoll_ctl (self->kfd, EPOLL_CTL_DEL, fd->fd, &ev);
+#else
+    struct kevent ev;
+
+    EV_SET (&ev, fd->fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+    kevent (self->kfd, &ev, 1, NULL, 0, NULL);
+#endif
+    fd->event = 0;
+}
+
+#endif
+
+/*  Looks up the file descriptors of the socket and starts polling them. */
+static int nn_pollset_start (NN_UNUSED struct nn_pollset *self,
+    struct nn_pollset_entry *entry)
+{
+    int rc;
+    int i;
+    int fd;
+    int event;
+    size_t sz;
+
+    for (i = 0; i != 2; ++i) {
+        event = i == 0 ? NN_POLLIN : NN_POLLOUT;
+#if defined NN_POLLSET_KERNEL
+        entry->fds [i].entry = entry;
+        entry->fds [i].event = 0;
+#endif
+        if (!(entry->events & event))
+            continue;
+        sz = sizeof (fd);
+        rc = nn_getsockopt (entry->s, NN_SOL_SOCKET,
+            event == NN_POLLIN ? NN_RCVFD : NN_SNDFD, &fd, &sz);
+        if (nn_slow (rc < 0)) {
+            rc = -nn_errno ();
+            goto fail;
+        }
+#if defined NN_POLLSET_KERNEL
+        entry->fds [i].fd = fd;
+        entry->fds [i].event = (short) event;
+        rc = nn_pollset_register (self, &entry->fds [i]);
+        if (nn_slow (rc < 0)) {
+            entry->fds [i].event = 0;
+            goto fail;
+        }
+#endif
+    }
+
+    return 0;
+
+fail:
+#if defined NN_POLLSET_KERNEL
+    if (entry->fds [0].event)
+        nn_pollset_unregister (self, &entry->fds [0]);
+#endif
+    return rc;
+}
+
+static void nn_pollset_stop (NN_UNUSED struct nn_pollset *self,
+    NN_UNUSED struct nn_pollset_entry *entry)
+{
+#if defined NN_POLLSET_KERNEL
+    int i;
+
+    for (i = 0; i != 2; ++i)
+        if (entry->fds [i].event)
+            nn_pollset_unregister (self, &entry->fds [i]);
+#endif
+}
+
+struct nn_pollset *nn_pollset_create (void)
+{
+    struct nn_pollset *self;
+#if defined NN_POLLSET_KERNEL
+    int rc;
+#endif
+
+    self = nn_alloc (sizeof (struct nn_pollset), "pollset");
+    if (nn_slow (!self)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+#if defined NN_POLLSET_KERNEL
+    rc = nn_pollset_init_kfd (self);
+    if (nn_slow (rc < 0)) {
+        nn_free (self);
+        errno = -rc;
+        return NULL;
+    }
+#else
+    self->npollfds = 0;
+    self->pollfds = NULL;
+#endif
+    nn_hash_init (&self->entries);
+    nn_list_init (&self->items);
+    self->count = 0;
+
+    return self;
+}
+
+int nn_pollset_add (struct nn_pollset *self, int s, int events)
+{
+    int rc;
+    struct nn_pollset_entry *entry;
+
+    if (nn_slow (!self)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (s < 0)) {
+        errno = EBADF;
+        return -1;
+    }
+    if (nn_slow (!events || (events & ~(NN_POLLIN | NN_POLLOUT)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*  If the socket is already in the set, change the events polled for. */
+    if (nn_slow (nn_hash_get (&self->entries, (uint32_t) s) != NULL)) {
+        rc = nn_pollset_remove (self, s);
+        errnum_assert (rc == 0, nn_errno ());
+    }
+
+    entry = nn_alloc (sizeof (struct nn_pollset_entry), "pollset entry");
+    if (nn_slow (!entry)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    entry->s = s;
+    entry->events = (short) events;
+#if defined NN_POLLSET_KERNEL
+    entry->pos = -1;
+#endif
+    rc = nn_pollset_start (self, entry);
+    if (nn_slow (rc < 0)) {
+        nn_free (entry);
+        errno = -rc;
+        return -1;
+    }
+
+    nn_hash_item_init (&entry->hashitem);
+    nn_hash_insert (&self->entries, (uint32_t) s, &entry->hashitem);
+    nn_list_item_init (&entry->item);
+    nn_list_insert (&self->items, &entry->item, nn_list_end (&self->items));
+    ++self->count;
+
+    return 0;
+}
+
+int nn_pollset_remove (struct nn_pollset *self, int s)
+{
+    struct nn_hash_item *item;
+    struct nn_pollset_entry *entry;
+
+    if (nn_slow (!self)) {
+        errno = EFAULT;
+        return -1;
+    }
+    item = s >= 0 ? nn_hash_get (&self->entries, (uint32_t) s) : NULL;
+    if (nn_slow (!item)) {
+        errno = EINVAL;
+        return -1;
+    }
+    entry = nn_cont (item, struct nn_pollset_entry, hashitem);
+
+    nn_pollset_stop (self, entry);
+    nn_hash_erase (&self->entries, &entry->hashitem);
+    nn_hash_item_term (&entry->hashitem);
+    nn_list_erase (&self->items, &entry->item);
+    nn_list_item_term (&entry->item);
+    --self->count;
+    nn_free (entry);
+
+    return 0;
+}
+
+int nn_pollset_destroy (struct nn_pollset *self)
+{
+    struct nn_pollset_entry *entry;
+
+    if (nn_slow (!self)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    while (!nn_list_empty (&self->items)) {
+        entry = nn_cont (nn_list_begin (&self->items),
+            struct nn_pollset_entry, item);
+        nn_pollset_remove (self, entry->s);
+    }
+
+    nn_list_term (&self->items);
+    nn_hash_term (&self->entries);
+#if defined NN_POLLSET_KERNEL
+    nn_free (self->events);
+    nn_closefd (self->kfd);
+#else
+    nn_free (self->pollfds);
+#endif
+    nn_free (self);
+
+    return 0;
+}
+
+#if defined NN_POLLSET_KERNEL
+
+int nn_pollset_wait (struct nn_pollset *self, struct nn_pollfd *fds,
+    int nfds, int timeout)
+{
+    int rc;
+    int i;
+    int res;
+    void *events;
+    struct nn_pollset_fd *fd;
+#if defined NN_POLLSET_KQUEUE
+    struct timespec ts;
+#endif
+
+    if (nn_slow (!self || !fds)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (nfds <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*  No more file descriptors than there are result slots are asked for,
+        so that each of them fits even if they belong to distinct sockets. */
+    if (nn_slow (nfds > self->nevents)) {
+        events = nn_realloc (self->events, sizeof (*self->events) * nfds);
+        if (nn_slow (!events)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        self->events = events;
+        self->nevents = nfds;
+    }
+
+#if defined NN_POLLSET_EPOLL
+    rc = epoll_wait (self->kfd, self->events, nfds, timeout);
+#else
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+    }
+    rc = kevent (self->kfd, NULL, 0, self->events, nfds,
+        timeout >= 0 ? &ts : NULL);
+#endif
+    if (nn_slow (rc <= 0))
+        return rc;
+
+    /*  The readable file descriptors are merged into one result entry per
+        socket. */
+    res = 0;
+    for (i = 0; i != rc; ++i) {
+#if defined NN_POLLSET_EPOLL
+        fd = (struct nn_pollset_fd*) self->events [i].data.ptr;
+#else
+        fd = (struct nn_pollset_fd*) self->events [i].udata;
+#endif
+        if (fd->entry->pos < 0) {
+            fd->entry->pos = res;
+            fds [res].fd = fd->entry->s;
+            fds [res].events = fd->entry->events;
+            fds [res].revents = 0;
+            ++res;
+        }
+        fds [fd->entry->pos].revents |= fd->event;
+    }
+    for (i = 0; i != rc; ++i) {
+#if defined NN_POLLSET_EPOLL
+        fd = (struct nn_pollset_fd*) self->events [i].data.ptr;
+#else
+        fd = (struct nn_pollset_fd*) self->events [i].udata;
+#endif
+        fd->entry->pos = -1;
+    }
+
+    return res;
+}
+
+#else
+
+int nn_pollset_wait (struct nn_pollset *self, struct nn_pollfd *fds,
+    int nfds, int timeout)
+{
+    int rc;
+    int i;
+    int res;
+    void *pollfds;
+    struct nn_list_item *it;
+    struct nn_pollset_entry *entry;
+
+    if (nn_slow (!self || !fds)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (nfds <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nn_slow (self->count > self->npollfds)) {
+        pollfds = nn_realloc (self->pollfds,
+            sizeof (struct nn_pollfd) * self->count);
+        if (nn_slow (!pollfds)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        self->pollfds = pollfds;
+        self->npollfds = self->count;
+    }
+    i = 0;
+    for (it = nn_list_begin (&self->items); it != nn_list_end (&self->items);
+          it = nn_list_next (&self->items, it)) {
+        entry = nn_cont (it, struct nn_pollset_entry, item);
+        self->pollfds [i].fd = entry->s;
+        self->pollfds [i].events = entry->events;
+        ++i;
+    }
+
+    rc = nn_poll (self->pollfds, self->count, timeout);
+    if (nn_slow (rc <= 0))
+        return rc;
+
+    res = 0;
+    for (i = 0; i != self->count && res != nfds; ++i)
+        if (self->pollfds [i].revents)
+            fds [res++] = self->pollfds [i];
+
+    return res;
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../nn.h"
+
+#include "rcvring.h"
+#include "sock.h"
+#include "global.h"
+
+#include "../transports/inproc/msgqueue.h"
+
+#include "../utils/err.h"
+#include "../utils/fast.h"
+#include "../utils/msg.h"
+#include "../utils/chunk.h"
+#include "../utils/chunkref.h"
+#include "../utils/trace.h"
+
+/*  Number of messages taken from the queue at a time. */
+#define NN_RCVRING_BATCH 64
+
+int nn_rcvring_init (struct nn_rcvring *self, struct nn_sock *sock)
+{
+    int rc;
+
+    rc = nn_efd_init (&self->doorbell);
+    if (nn_slow (rc < 0))
+        return rc;
+    self->sock = sock;
+    self->armed = 1;
+    return 0;
+}
+
+void nn_rcvring_term (struct nn_rcvring *self)
+{
+    nn_efd_term (&self->doorbell);
+}
+
+void nn_rcvring_stop (struct nn_rcvring *self)
+{
+    nn_efd_stop (&self->doorbell);
+}
+
+void nn_rcvring_notify (struct nn_rcvring *self)
+{
+    if (nn_msgqueue_rcvnotify (self->sock->rcvqueue))
+        nn_efd_signal (&self->doorbell);
+}
+
+struct nn_rcvring *nn_rcvring_open (int s)
+{
+    int rc;
+    struct nn_sock *sock;
+    struct nn_rcvring *ring;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return NULL;
+    }
+    rc = nn_sock_openring (sock, &ring);
+    nn_global_rele_socket (s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return NULL;
+    }
+    return ring;
+}
+
+int nn_rcvring_fd (struct nn_rcvring *ring)
+{
+    if (nn_slow (!ring)) {
+        errno = EFAULT;
+        return -1;
+    }
+    return (int) nn_efd_getfd (&ring->doorbell);
+}
+
+int nn_rcvring_recv (struct nn_rcvring *ring, void **bufs, size_t *lens,
+    int count)
+{
+    int i;
+    int n;
+    int done;
+    size_t bytes;
+    struct nn_sock *sock;
+    struct nn_msgqueue *queue;
+    struct nn_msg msgs [NN_RCVRING_BATCH];
+
+    if (nn_slow (!ring || !bufs || !lens)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (count <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    sock = ring->sock;
+    queue = sock->rcvqueue;
+
+    /*  Once the application is back for more messages, the pending
+        notification, if any, has done its job. If it was already sent,
+        the doorbell is silenced. */
+    if (ring->armed) {
+        if (!nn_msgqueue_rcvcancel (queue)) {
+            nn_efd_unsignal (&ring->doorbell);
+            nn_msgqueue_rcvwoken (queue);
+        }
+        ring->armed = 0;
+    }
+
+    done = 0;
+    bytes = 0;
+    while (done != count) {
+        n = nn_sock_recvqueued (sock, msgs, count - done < NN_RCVRING_BATCH ?
+            count - done : NN_RCVRING_BATCH);
+        if (n == 0) {
+
+            /*  The queue is empty. Ask for the notification and check
+                once again, as a message may have arrived in the meantime.
+                If it did, the request is withdrawn, unless it's too late,
+                in which case the doorbell rings for nothing. */
+            if (done)
+                break;
+            nn_msgqueue_rcvwait (queue);
+            ring->armed = 1;
+            if (nn_msgqueue_empty (queue)) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if (!nn_msgqueue_rcvcancel (queue)) {
+                nn_efd_unsignal (&ring->doorbell);
+                nn_msgqueue_rcvwoken (queue);
+            }
+            ring->armed = 0;
+            continue;
+        }
+
+        /*  Hand the bodies of the messages over to the application the same
+            way nn_recv does with NN_MSG. */
+        for (i = 0; i != n; ++i) {
+            nn_msg_flatten (&msgs [i]);
+            bufs [done] = nn_chunkref_getchunk_type (&msgs [i].body,
+                sock->ep_template.rcvpool);
+            lens [done] = nn_chunk_size (bufs [done]);
+            bytes += lens [done];
+            NN_TRACE (NN_TRACE_RECV_EXIT, sock, lens [done]);
+            nn_msg_term (&msgs [i]);
+            ++done;
+        }
+    }
+
+    nn_sock_stat_increment (sock, NN_STAT_MESSAGES_RECEIVED, done);
+    nn_sock_stat_increment (sock, NN_STAT_BYTES_RECEIVED, bytes);
+
+    return done;
+}
@@ -0,0 +1,54 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_RCVRING_INCLUDED
+#define NN_RCVRING_INCLUDED
+
+#include "../utils/efd.h"
+
+struct nn_sock;
+
+/*  Receive ring of a socket (see nn_rcvring_open). The ring itself is the
+    socket's receive queue, which the context fills as the messages arrive.
+    The application takes them from there without locking the socket. Once
+    it finds the queue empty, it asks to be notified about the next message
+    through the doorbell. */
+struct nn_rcvring {
+    struct nn_sock *sock;
+    struct nn_efd doorbell;
+
+    /*  1 if the notification was asked for, which it initially is. */
+    int armed;
+};
+
+int nn_rcvring_init (struct nn_rcvring *self, struct nn_sock *sock);
+void nn_rcvring_term (struct nn_rcvring *self);
+
+/*  Closes the doorbell, so that whoever waits for it wakes up. */
+void nn_rcvring_stop (struct nn_rcvring *self);
+
+/*  Rings the doorbell if the notification is due. Called from within
+    the socket context once the messages are put into the queue. */
+void nn_rcvring_notify (struct nn_rcvring *self);
+
+#endif
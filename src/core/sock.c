@@ -24,10 +24,19 @@
 
 #include "../protocol.h"
 #include "../transport.h"
+#include "../pair.h"
 
 #include "sock.h"
 #include "global.h"
 #include "ep.h"
+#include "async.h"
+#include "rcvring.h"
+
+#include "../aio/pool.h"
+
+#include "../protocols/utils/priolist.h"
+
+#include "../transports/inproc/msgqueue.h"
 
 #include "../utils/err.h"
 #include "../utils/cont.h"
@@ -35,8 +44,13 @@
 #include "../utils/fast.h"
 #include "../utils/alloc.h"
 #include "../utils/msg.h"
+#include "../utils/attr.h"
+#include "../utils/trace.h"
 
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 /*  These bits specify whether individual efds are signalled or not at
     the moment. Storing this information allows us to avoid redundant signalling
@@ -44,24 +58,84 @@
 #define NN_SOCK_FLAG_IN 1
 #define NN_SOCK_FLAG_OUT 2
 
+/*  These bits specify whether NN_RCVFD and NN_SNDFD file descriptors were
+    handed out to the user. Until then, and unless there's a thread blocked
+    in recv or send, nobody looks at the efds and their state is not updated,
+    saving two syscalls on most state changes. */
+#define NN_SOCK_FLAG_RCVFD 4
+#define NN_SOCK_FLAG_SNDFD 8
+
+/*  These bits specify whether the efds were created. Sockets that are
+    only used in non-blocking way never need them. */
+#define NN_SOCK_FLAG_RCVEFD 16
+#define NN_SOCK_FLAG_SNDEFD 32
+
+/*  Set while a message waits for the send rate limit. */
+#define NN_SOCK_FLAG_THROTTLED 64
+
+/*  Set while 'held' contains a message that was taken from the protocol
+    but didn't fit the receive budget (see nn_sock_recvbudget). */
+#define NN_SOCK_FLAG_HELD 128
+
+/*  The tokens of the send rate buckets are kept in millionths. */
+#define NN_SOCK_SNDRATE_UNIT 1000000
+
+/*  The groups of members of the socket don't share cache lines, i.e. there
+    is at least a cache line between the last member of one and the first
+    member of the next one. */
+#define NN_SOCK_GAP(last, first) (offsetof (struct nn_sock, first) - \
+    offsetof (struct nn_sock, last) - sizeof (((struct nn_sock*) 0)->last))
+CT_ASSERT (NN_SOCK_GAP (rcvfd, ctx) >= NN_SOCK_CACHELINE);
+CT_ASSERT (NN_SOCK_GAP (stat_shards_mem, fsm) >= NN_SOCK_CACHELINE);
+
+/*  Hint to the CPU that the thread is busy-waiting. */
+#if defined __GNUC__ && (defined __i386__ || defined __x86_64__)
+#define nn_sock_pause() __builtin_ia32_pause ()
+#elif defined __GNUC__ && defined __aarch64__
+#define nn_sock_pause() __asm__ __volatile__ ("yield")
+#else
+#define nn_sock_pause() ((void) 0)
+#endif
+
 /*  Possible states of the socket. */
 #define NN_SOCK_STATE_INIT 1
 #define NN_SOCK_STATE_ACTIVE 2
-#define NN_SOCK_STATE_STOPPING_EPS 3
-#define NN_SOCK_STATE_STOPPING 4
-#define NN_SOCK_STATE_FINI 5
+#define NN_SOCK_STATE_LINGERING 3
+#define NN_SOCK_STATE_STOPPING_TIMER 4
+#define NN_SOCK_STATE_STOPPING_EPS 5
+#define NN_SOCK_STATE_STOPPING 6
+#define NN_SOCK_STATE_FINI 7
 
 /*  Events sent to the state machine. */
 #define NN_SOCK_ACTION_STOPPED 1
+#define NN_SOCK_ACTION_DRAINED 2
 
 /*  Subordinated source objects. */
 #define NN_SOCK_SRC_EP 1
+#define NN_SOCK_SRC_LINGER_TIMER 2
+#define NN_SOCK_SRC_SNDRATE_TIMER 3
 
 /*  Private functions. */
 static struct nn_optset *nn_sock_optset (struct nn_sock *self, int id);
 static int nn_sock_setopt_inner (struct nn_sock *self, int level,
     int option, const void *optval, size_t optvallen);
+static int nn_sock_setworkers (struct nn_sock *self, const void *optval,
+    size_t optvallen);
+static int nn_sock_setsingle (struct nn_sock *self, int val);
 static void nn_sock_onleave (struct nn_ctx *self);
+static void nn_sock_prefetch (struct nn_sock *self);
+static int nn_sock_expired (struct nn_sock *self, struct nn_msg *msg);
+static int nn_sock_openfd (struct nn_sock *self, int flag);
+static int nn_sock_piece (struct nn_sock *self, struct nn_msg *msg,
+    struct nn_msg_piece *piece);
+static int nn_sock_flushed (struct nn_sock *self);
+static void nn_sock_sndrate_reset (struct nn_sock *self);
+static uint64_t nn_sock_sndrate_wait (struct nn_sock *self, size_t size);
+static int nn_sock_sndrate_throttle (struct nn_sock *self, size_t size);
+static void nn_sock_sndrate_take (struct nn_sock *self, size_t size);
+static int nn_sock_warmup (struct nn_sock *self);
+static void nn_sock_stop_eps (struct nn_sock *self);
+static void nn_sock_finish (struct nn_sock *self);
 static void nn_sock_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_sock_shutdown (struct nn_fsm *self, int src, int type,
@@ -74,6 +148,7 @@ int nn_sock_init (struct nn_sock *self, const struct nn_socktype *socktype,
 {
     int rc;
     int i;
+    struct nn_alloc_acct *prevacct;
 
     /* Make sure that at least one message direction is supported. */
     nn_assert (!(socktype->flags & NN_SOCKTYPE_FLAG_NOSEND) ||
@@ -81,62 +156,98 @@ int nn_sock_init (struct nn_sock *self, const struct nn_socktype *socktype,
 
     /*  Create the AIO context for the SP socket. */
     nn_ctx_init (&self->ctx, nn_global_getpool (), nn_sock_onleave);
+    self->ctx.home = nn_pool_choose_home (nn_global_getpool ());
+
+    /*  Everything allocated on behalf of the socket, its endpoints and its
+        pipes is charged to the socket's account. Messages are not; they are
+        passed on to the user or to other sockets. */
+    self->ctx.acct = nn_alloc_acct_create ();
+    alloc_assert (self->ctx.acct);
+    prevacct = nn_alloc_acct_select (self->ctx.acct);
 
     /*  Initialise the state machine. */
     nn_fsm_init_root (&self->fsm, nn_sock_handler,
         nn_sock_shutdown, &self->ctx);
     self->state = NN_SOCK_STATE_INIT;
 
-    /*  Open the NN_SNDFD and NN_RCVFD efds. Do so, only if the socket type
-        supports send/recv, as appropriate. */
-    if (socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)
-        memset (&self->sndfd, 0xcd, sizeof (self->sndfd));
-    else {
-        rc = nn_efd_init (&self->sndfd);
-        if (nn_slow (rc < 0))
-            return rc;
-    }
-    if (socktype->flags & NN_SOCKTYPE_FLAG_NORECV)
-        memset (&self->rcvfd, 0xcd, sizeof (self->rcvfd));
-    else {
-        rc = nn_efd_init (&self->rcvfd);
-        if (nn_slow (rc < 0)) {
-            if (!(socktype->flags & NN_SOCKTYPE_FLAG_NOSEND))
-                nn_efd_term (&self->sndfd);
-            return rc;
-        }
-    }
+    /*  The NN_SNDFD and NN_RCVFD efds are created once they are needed,
+        see nn_sock_openfd. */
     nn_sem_init (&self->termsem);
     nn_sem_init (&self->relesem);
-    if (nn_slow (rc < 0)) {
-        if (!(socktype->flags & NN_SOCKTYPE_FLAG_NORECV))
-            nn_efd_term (&self->rcvfd);
-        if (!(socktype->flags & NN_SOCKTYPE_FLAG_NOSEND))
-            nn_efd_term (&self->sndfd);
-        return rc;
-    }
+    self->termed = 0;
+    self->hook = NULL;
+    self->async = NULL;
+    self->single = 0;
+    self->rcvqueue = NULL;
+    self->rcvring = NULL;
 
-    self->holds = 1;   /*  Callers hold. */
     self->flags = 0;
+    nn_atomic_init (&self->fdflags, 0);
+    self->rcvwaiters = 0;
+    self->sndwaiters = 0;
+    self->events = -1;
     nn_list_init (&self->eps);
     nn_list_init (&self->sdeps);
+    nn_list_init (&self->pipegroups);
+    nn_list_init (&self->pipes);
+    nn_timer_init (&self->linger_timer, NN_SOCK_SRC_LINGER_TIMER, &self->fsm);
+    nn_timer_init (&self->sndrate_timer, NN_SOCK_SRC_SNDRATE_TIMER,
+        &self->fsm);
+    nn_fsm_event_init (&self->drained);
     self->eid = 1;
+    self->pipeid = 1;
 
     /*  Default values for NN_SOL_SOCKET options. */
     self->sndbuf = 128 * 1024;
     self->rcvbuf = 128 * 1024;
     self->rcvmaxsize = 1024 * 1024;
+    self->rcvpiece = 0;
+    self->sndpiece.size = 0;
+    self->sndpiece.offset = 0;
+    self->sndqueue_msgs = 0;
+    self->sndqueue_bytes = 0;
     self->sndtimeo = -1;
     self->rcvtimeo = -1;
+    self->msgttl = -1;
+    self->rcvspin = 0;
     self->reconnect_ivl = 100;
     self->reconnect_ivl_max = 0;
     self->maxttl = 8;
+    self->worker = -1;
+    self->linger = 0;
+    self->sndrate_msgs = 0;
+    self->sndrate_bytes = 0;
+    self->sndrate_burst = 100;
+    self->heartbeat_ivl = 0;
+    self->warmup_size = 0;
+    self->warmup_msgs = 0;
+    self->rcvtimestamp = 0;
+    self->sndrate_pending = 0;
+    nn_sock_sndrate_reset (self);
+    self->workers [0] = 0;
     self->ep_template.sndprio = 8;
     self->ep_template.rcvprio = 8;
+    self->ep_template.rcvweight = 1;
     self->ep_template.ipv4only = 1;
+    self->ep_template.rcvpool = 0;
+    self->ep_template.idle = 0;
+    self->ep_template.maxconn = 0;
+    self->ep_template.standby = 0;
+    nn_chunkref_init (&self->borrowed, 0);
 
     /* Clear statistic entries */
     memset(&self->statistics, 0, sizeof (self->statistics));
+    self->stat_shards_mem = nn_alloc (NN_SOCK_STAT_SHARDS *
+        sizeof (struct nn_sock_stat_shard) + NN_SOCK_CACHELINE - 1,
+        "socket statistics");
+    alloc_assert (self->stat_shards_mem);
+    self->stat_shards = (struct nn_sock_stat_shard*)
+        (((uintptr_t) self->stat_shards_mem + NN_SOCK_CACHELINE - 1) &
+        ~((uintptr_t) NN_SOCK_CACHELINE - 1));
+    memset (self->stat_shards, 0,
+        NN_SOCK_STAT_SHARDS * sizeof (struct nn_sock_stat_shard));
+    for (i = 0; i != NN_SOCKBASE_LATENCIES; ++i)
+        self->latencies [i] = NULL;
 
     /*  Should be pretty much enough space for just the number  */
     sprintf(self->socket_name, "%d", fd);
@@ -162,6 +273,8 @@ int nn_sock_init (struct nn_sock *self, const struct nn_socktype *socktype,
     nn_fsm_start (&self->fsm);
     nn_ctx_leave (&self->ctx);
 
+    nn_alloc_acct_select (prevacct);
+
     return 0;
 }
 
@@ -188,7 +301,6 @@ void nn_sock_stop (struct nn_sock *self)
 int nn_sock_term (struct nn_sock *self)
 {
     int rc;
-    int i;
 
     /*  NOTE: nn_sock_stop must have already been called. */
 
@@ -196,23 +308,56 @@ int nn_sock_term (struct nn_sock *self)
         till they are all closed.  This loop is not interruptible, because
         making it so would leave a partially cleaned up socket, and we don't
         have a way to defer resource deallocation. */
-    for (;;) {
-        rc = nn_sem_wait (&self->termsem);
+    while (!self->termed) {
+        rc = nn_pool_wait (self->ctx.pool, &self->termsem);
         if (nn_slow (rc == -EINTR))
             continue;
         errnum_assert (rc == 0, -rc);
-        break;
+        self->termed = 1;
     }
 
     /*  Also, wait for all holds on the socket to be released.  */
     for (;;) {
-        rc = nn_sem_wait (&self->relesem);
+        rc = nn_pool_wait (self->ctx.pool, &self->relesem);
         if (nn_slow (rc == -EINTR))
             continue;
         errnum_assert (rc == 0, -rc);
         break;
     }
 
+    nn_sock_finish (self);
+
+    return 0;
+}
+
+int nn_sock_tryterm (struct nn_sock *self)
+{
+    int rc;
+
+    if (!self->termed) {
+        rc = nn_sem_trywait (&self->termsem);
+        if (rc < 0)
+            return rc;
+        self->termed = 1;
+    }
+    rc = nn_sem_trywait (&self->relesem);
+    if (rc < 0)
+        return rc;
+
+    nn_sock_finish (self);
+
+    return 0;
+}
+
+/*  Deallocates the socket once it's stopped and there are no holds. */
+static void nn_sock_finish (struct nn_sock *self)
+{
+    int i;
+
+    /*  The pending asynchronous operations fail. */
+    if (self->async)
+        nn_async_term (self->async);
+
     /*  Threads that posted the semaphore(s) can still have the ctx locked
         for a short while. By simply entering the context and exiting it
         immediately we can be sure that any such threads have already
@@ -226,6 +371,12 @@ int nn_sock_term (struct nn_sock *self)
     nn_fsm_stopped_noevent (&self->fsm);
     nn_fsm_term (&self->fsm);
     nn_sem_term (&self->termsem);
+    nn_fsm_event_term (&self->drained);
+    nn_atomic_term (&self->fdflags);
+    nn_timer_term (&self->sndrate_timer);
+    nn_timer_term (&self->linger_timer);
+    nn_list_term (&self->pipes);
+    nn_list_term (&self->pipegroups);
     nn_list_term (&self->sdeps);
     nn_list_term (&self->eps);
     nn_ctx_term (&self->ctx);
@@ -235,7 +386,21 @@ int nn_sock_term (struct nn_sock *self)
         if (self->optsets [i])
             self->optsets [i]->vfptr->destroy (self->optsets [i]);
 
-    return 0;
+    nn_chunkref_term (&self->borrowed);
+    if (self->flags & NN_SOCK_FLAG_HELD)
+        nn_msg_term (&self->held);
+    if (self->rcvqueue) {
+        nn_msgqueue_term (self->rcvqueue);
+        nn_free (self->rcvqueue);
+    }
+    nn_free (self->stat_shards_mem);
+    for (i = 0; i != NN_SOCKBASE_LATENCIES; ++i) {
+        if (self->latencies [i]) {
+            nn_hist_term (self->latencies [i]);
+            nn_free (self->latencies [i]);
+        }
+    }
+    nn_alloc_acct_release (self->ctx.acct);
 }
 
 struct nn_ctx *nn_sock_getctx (struct nn_sock *self)
@@ -257,6 +422,51 @@ int nn_sock_ispeer (struct nn_sock *self, int socktype)
     return self->socktype->ispeer (socktype);
 }
 
+int nn_sock_sethook (struct nn_sock *self, struct nn_sock_hook *hook)
+{
+    nn_ctx_enter (&self->ctx);
+    if (hook) {
+        if (nn_slow (self->state != NN_SOCK_STATE_ACTIVE)) {
+            nn_ctx_leave (&self->ctx);
+            return -EBADF;
+        }
+        if (nn_slow (self->hook != NULL)) {
+            nn_ctx_leave (&self->ctx);
+            return -EBUSY;
+        }
+        hook->events = 0;
+    }
+    self->hook = hook;
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
+}
+
+int nn_sock_events (struct nn_sock *self, int events)
+{
+    int rc;
+
+    nn_ctx_enter (&self->ctx);
+    if (nn_slow (self->state != NN_SOCK_STATE_ACTIVE)) {
+        nn_ctx_leave (&self->ctx);
+        return -EBADF;
+    }
+    rc = self->sockbase->vfptr->events (self->sockbase);
+    errnum_assert (rc >= 0, -rc);
+    if (nn_slow (self->flags & NN_SOCK_FLAG_HELD))
+        rc |= NN_SOCKBASE_EVENT_IN;
+    if (self->rcvqueue && !nn_msgqueue_empty (self->rcvqueue))
+        rc |= NN_SOCKBASE_EVENT_IN;
+
+    /*  The hook is notified once the missing events show up, the same way
+        it is after a non-blocking operation fails with EAGAIN. */
+    if (self->hook)
+        self->hook->events &= rc | ~events;
+    nn_ctx_leave (&self->ctx);
+
+    return rc;
+}
+
 int nn_sock_setopt (struct nn_sock *self, int level, int option,
     const void *optval, size_t optvallen)
 {
@@ -269,11 +479,97 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
     return rc;
 }
 
+static int nn_sock_warmup (struct nn_sock *self)
+{
+    int rc;
+    int i;
+    struct nn_pool *pool;
+
+    /*  Messages sent by the user are allocated on the heap, those received
+        come from the receive pool if there's one. */
+    rc = nn_chunk_warmup (self->warmup_size, self->warmup_msgs, 0);
+    if (rc == 0 && self->ep_template.rcvpool != 0)
+        rc = nn_chunk_warmup (self->warmup_size, self->warmup_msgs,
+            self->ep_template.rcvpool);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Start the workers rather than waiting for the first connection and
+        give them receive buffers. Without a worker of its own, any worker
+        of the pool may end up handling the socket's connections. */
+    pool = nn_global_getpool ();
+    nn_pool_start (pool);
+    if (self->ctx.worker) {
+        nn_worker_prefill (self->ctx.worker, self->warmup_msgs);
+        return 0;
+    }
+    for (i = 0; i != nn_pool_size (pool); ++i)
+        nn_worker_prefill (nn_pool_worker (pool, i), self->warmup_msgs);
+    return 0;
+}
+
+static int nn_sock_setworkers (struct nn_sock *self, const void *optval,
+    size_t optvallen)
+{
+    char str [64];
+    int indices [NN_POOL_MAX_WORKERS];
+    int count;
+    int i;
+    uint64_t mask;
+
+    if (optvallen >= sizeof (str))
+        return -EINVAL;
+    memcpy (str, optval, optvallen);
+    str [optvallen] = 0;
+
+    /*  An empty list restores the default. */
+    mask = 0;
+    if (str [0]) {
+        count = nn_global_parse_cpus (str, indices, NN_POOL_MAX_WORKERS);
+        if (count == 0)
+            return -EINVAL;
+        for (i = 0; i != count; ++i) {
+            if (indices [i] >= nn_pool_size (nn_global_getpool ()))
+                return -EINVAL;
+            mask |= (uint64_t) 1 << indices [i];
+        }
+    }
+
+    self->ctx.workers = mask;
+    memcpy (self->workers, str, optvallen + 1);
+    return 0;
+}
+
+static int nn_sock_setsingle (struct nn_sock *self, int val)
+{
+    if (val != 0 && val != 1)
+        return -EINVAL;
+
+    /*  Messages are taken from the protocol before the user asks for them,
+        which only the protocols that keep no state between the messages
+        can afford. */
+    if (nn_slow (val && !(self->socktype->flags & NN_SOCKTYPE_FLAG_STATELESS)))
+        return -ENOTSUP;
+
+    /*  Once allocated, the queue stays till the socket is closed. If the
+        option is switched off, the messages in it are received first. */
+    if (val && !self->rcvqueue &&
+          !(self->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
+        self->rcvqueue = nn_alloc (sizeof (struct nn_msgqueue),
+            "socket receive queue");
+        alloc_assert (self->rcvqueue);
+        nn_msgqueue_init (self->rcvqueue, SIZE_MAX);
+    }
+    self->single = val;
+    return 0;
+}
+
 static int nn_sock_setopt_inner (struct nn_sock *self, int level,
     int option, const void *optval, size_t optvallen)
 {
     struct nn_optset *optset;
     int val;
+    struct nn_worker *worker;
 
     /*  Protocol-specific socket options. */
     if (level > NN_SOL_SOCKET)
@@ -298,6 +594,8 @@ static int nn_sock_setopt_inner (struct nn_sock *self, int level,
         self->socket_name [optvallen] = 0;
         return 0;
     }
+    if (option == NN_WORKERS)
+        return nn_sock_setworkers (self, optval, optvallen);
 
     /*  At this point we assume that all options are of type int. */
     if (optvallen != sizeof (int))
@@ -321,12 +619,39 @@ static int nn_sock_setopt_inner (struct nn_sock *self, int level,
             return -EINVAL;
         self->rcvmaxsize = val;
         return 0;
+    case NN_RCVPIECE:
+        if (nn_slow (self->socktype->protocol != NN_PAIR))
+            return -ENOTSUP;
+        if (val < 0)
+            return -EINVAL;
+        self->rcvpiece = val;
+        return 0;
+    case NN_SNDQUEUE_MSGS:
+        if (val < 0)
+            return -EINVAL;
+        self->sndqueue_msgs = val;
+        return 0;
+    case NN_SNDQUEUE_BYTES:
+        if (val < 0)
+            return -EINVAL;
+        self->sndqueue_bytes = val;
+        return 0;
     case NN_SNDTIMEO:
         self->sndtimeo = val;
         return 0;
     case NN_RCVTIMEO:
         self->rcvtimeo = val;
         return 0;
+    case NN_MSGTTL:
+        if (val <= 0 && val != -1)
+            return -EINVAL;
+        self->msgttl = val;
+        return 0;
+    case NN_RCVSPIN:
+        if (val < 0)
+            return -EINVAL;
+        self->rcvspin = val;
+        return 0;
     case NN_RECONNECT_IVL:
         if (val < 0)
             return -EINVAL;
@@ -338,28 +663,105 @@ static int nn_sock_setopt_inner (struct nn_sock *self, int level,
         self->reconnect_ivl_max = val;
         return 0;
     case NN_SNDPRIO:
-        if (val < 1 || val > 16)
+        if (val < 1 || val > NN_PRIOLIST_SLOTS)
             return -EINVAL;
         self->ep_template.sndprio = val;
         return 0;
     case NN_RCVPRIO:
-        if (val < 1 || val > 16)
+        if (val < 1 || val > NN_PRIOLIST_SLOTS)
             return -EINVAL;
         self->ep_template.rcvprio = val;
         return 0;
+    case NN_RCVWEIGHT:
+        if (val < 1 || val > 100)
+            return -EINVAL;
+        self->ep_template.rcvweight = val;
+        return 0;
     case NN_IPV4ONLY:
         if (val != 0 && val != 1)
             return -EINVAL;
         self->ep_template.ipv4only = val;
         return 0;
+    case NN_RCVPOOL:
+        if (val != 0 && !nn_chunk_msgpool_valid (val))
+            return -EINVAL;
+        self->ep_template.rcvpool = val;
+        return 0;
+    case NN_IDLE_TIMEOUT:
+        if (val < 0 || val > 86400000)
+            return -EINVAL;
+        self->ep_template.idle = val;
+        return 0;
+    case NN_MAXCONN:
+        if (val < 0)
+            return -EINVAL;
+        self->ep_template.maxconn = val;
+        return 0;
+    case NN_STANDBY:
+        if (val < 0 || val > NN_MAX_STANDBY)
+            return -EINVAL;
+        self->ep_template.standby = val;
+        return 0;
     case NN_MAXTTL:
         if (val < 1 || val > 255)
             return -EINVAL;
         self->maxttl = val;
         return 0;
+    case NN_WORKER:
+        if (val == -1) {
+            self->ctx.worker = NULL;
+            self->worker = -1;
+            return 0;
+        }
+        worker = nn_pool_worker (nn_global_getpool (), val);
+        if (!worker)
+            return -EINVAL;
+        self->ctx.worker = worker;
+        self->worker = val;
+        return 0;
     case NN_LINGER:
-	/*  Ignored, retained for compatibility. */
+        self->linger = val;
         return 0;
+    case NN_SNDRATE_MSGS:
+        if (val < 0)
+            return -EINVAL;
+        self->sndrate_msgs = val;
+        nn_sock_sndrate_reset (self);
+        return 0;
+    case NN_SNDRATE_BYTES:
+        if (val < 0)
+            return -EINVAL;
+        self->sndrate_bytes = val;
+        nn_sock_sndrate_reset (self);
+        return 0;
+    case NN_SNDRATE_BURST:
+        if (val < 1 || val > 3600000)
+            return -EINVAL;
+        self->sndrate_burst = val;
+        nn_sock_sndrate_reset (self);
+        return 0;
+    case NN_HEARTBEAT_IVL:
+        if (val < 0 || val > 3600000)
+            return -EINVAL;
+        self->heartbeat_ivl = val;
+        return 0;
+    case NN_WARMUP_SIZE:
+        if (val < 0)
+            return -EINVAL;
+        self->warmup_size = val;
+        return 0;
+    case NN_WARMUP_MSGS:
+        if (val < 0)
+            return -EINVAL;
+        self->warmup_msgs = val;
+        return nn_sock_warmup (self);
+    case NN_RCVTIMESTAMP:
+        if (val != 0 && val != 1)
+            return -EINVAL;
+        self->rcvtimestamp = val;
+        return 0;
+    case NN_SINGLE_THREAD:
+        return nn_sock_setsingle (self, val);
     }
 
     return -ENOPROTOOPT;
@@ -377,6 +779,55 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
     return rc;
 }
 
+int nn_sock_getopt_fast (struct nn_sock *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    int intval;
+    nn_fd fd;
+
+    if (nn_slow (level != NN_SOL_SOCKET))
+        return -EAGAIN;
+
+    switch (option) {
+
+    /*  Never change. */
+    case NN_DOMAIN:
+        intval = self->socktype->domain;
+        break;
+    case NN_PROTOCOL:
+        intval = self->socktype->protocol;
+        break;
+
+    /*  Don't change once created. The acquire load makes sure the efd
+        is seen initialised. */
+    case NN_SNDFD:
+        if (!(nn_atomic_load (&self->fdflags) & NN_SOCK_FLAG_SNDFD))
+            return -EAGAIN;
+        fd = nn_efd_getfd (&self->sndfd);
+        memcpy (optval, &fd,
+            *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
+        *optvallen = sizeof (nn_fd);
+        return 0;
+    case NN_RCVFD:
+        if (!(nn_atomic_load (&self->fdflags) & NN_SOCK_FLAG_RCVFD))
+            return -EAGAIN;
+        fd = nn_efd_getfd (&self->rcvfd);
+        memcpy (optval, &fd,
+            *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
+        *optvallen = sizeof (nn_fd);
+        return 0;
+
+    default:
+        return -EAGAIN;
+    }
+
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+
+    return 0;
+}
+
 int nn_sock_getopt_inner (struct nn_sock *self, int level,
     int option, void *optval, size_t *optvallen)
 {
@@ -409,7 +860,7 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
         intval = self->socktype->protocol;
         break;
     case NN_LINGER:
-        intval = 0;
+        intval = self->linger;
         break;
     case NN_SNDBUF:
         intval = self->sndbuf;
@@ -420,12 +871,51 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
     case NN_RCVMAXSIZE:
         intval = self->rcvmaxsize;
         break;
+    case NN_RCVPIECE:
+        intval = self->rcvpiece;
+        break;
+    case NN_SNDQUEUE_MSGS:
+        intval = self->sndqueue_msgs;
+        break;
+    case NN_SNDQUEUE_BYTES:
+        intval = self->sndqueue_bytes;
+        break;
+    case NN_SNDRATE_MSGS:
+        intval = self->sndrate_msgs;
+        break;
+    case NN_SNDRATE_BYTES:
+        intval = self->sndrate_bytes;
+        break;
+    case NN_SNDRATE_BURST:
+        intval = self->sndrate_burst;
+        break;
+    case NN_HEARTBEAT_IVL:
+        intval = self->heartbeat_ivl;
+        break;
+    case NN_WARMUP_SIZE:
+        intval = self->warmup_size;
+        break;
+    case NN_WARMUP_MSGS:
+        intval = self->warmup_msgs;
+        break;
+    case NN_RCVTIMESTAMP:
+        intval = self->rcvtimestamp;
+        break;
+    case NN_SINGLE_THREAD:
+        intval = self->single;
+        break;
     case NN_SNDTIMEO:
         intval = self->sndtimeo;
         break;
     case NN_RCVTIMEO:
         intval = self->rcvtimeo;
         break;
+    case NN_MSGTTL:
+        intval = self->msgttl;
+        break;
+    case NN_RCVSPIN:
+        intval = self->rcvspin;
+        break;
     case NN_RECONNECT_IVL:
         intval = self->reconnect_ivl;
         break;
@@ -438,16 +928,40 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
     case NN_RCVPRIO:
         intval = self->ep_template.rcvprio;
         break;
+    case NN_RCVWEIGHT:
+        intval = self->ep_template.rcvweight;
+        break;
     case NN_IPV4ONLY:
         intval = self->ep_template.ipv4only;
         break;
+    case NN_RCVPOOL:
+        intval = self->ep_template.rcvpool;
+        break;
+    case NN_IDLE_TIMEOUT:
+        intval = self->ep_template.idle;
+        break;
+    case NN_MAXCONN:
+        intval = self->ep_template.maxconn;
+        break;
+    case NN_STANDBY:
+        intval = self->ep_template.standby;
+        break;
     case NN_MAXTTL:
         intval = self->maxttl;
         break;
+    case NN_WORKER:
+        intval = self->worker;
+        break;
     case NN_SNDFD:
         if (self->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)
             return -ENOPROTOOPT;
+        rc = nn_sock_openfd (self, NN_SOCK_FLAG_SNDEFD);
+        if (nn_slow (rc < 0))
+            return rc;
         fd = nn_efd_getfd (&self->sndfd);
+        self->flags |= NN_SOCK_FLAG_SNDFD;
+        nn_atomic_store (&self->fdflags, self->flags &
+            (NN_SOCK_FLAG_RCVFD | NN_SOCK_FLAG_SNDFD));
         memcpy (optval, &fd,
             *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
         *optvallen = sizeof (nn_fd);
@@ -455,7 +969,13 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
     case NN_RCVFD:
         if (self->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)
             return -ENOPROTOOPT;
+        rc = nn_sock_openfd (self, NN_SOCK_FLAG_RCVEFD);
+        if (nn_slow (rc < 0))
+            return rc;
         fd = nn_efd_getfd (&self->rcvfd);
+        self->flags |= NN_SOCK_FLAG_RCVFD;
+        nn_atomic_store (&self->fdflags, self->flags &
+            (NN_SOCK_FLAG_RCVFD | NN_SOCK_FLAG_SNDFD));
         memcpy (optval, &fd,
             *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
         *optvallen = sizeof (nn_fd);
@@ -464,6 +984,10 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
         strncpy (optval, self->socket_name, *optvallen);
         *optvallen = strlen(self->socket_name);
         return 0;
+    case NN_WORKERS:
+        strncpy (optval, self->workers, *optvallen);
+        *optvallen = strlen (self->workers);
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -475,22 +999,19 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
     return 0;
 }
 
-int nn_sock_add_ep (struct nn_sock *self, struct nn_transport *transport,
-    int bind, const char *addr)
+static int nn_sock_add_ep_inner (struct nn_sock *self,
+    struct nn_transport *transport, int bind, const char *addr)
 {
     int rc;
     struct nn_ep *ep;
     int eid;
 
-    nn_ctx_enter (&self->ctx);
-
     /*  Instantiate the endpoint. */
     ep = nn_alloc (sizeof (struct nn_ep), "endpoint");
     rc = nn_ep_init (ep, NN_SOCK_SRC_EP, self, self->eid, transport,
         bind, addr);
     if (nn_slow (rc < 0)) {
         nn_free (ep);
-        nn_ctx_leave (&self->ctx);
         return rc;
     }
     nn_ep_start (ep);
@@ -502,9 +1023,63 @@ int nn_sock_add_ep (struct nn_sock *self, struct nn_transport *transport,
     /*  Add it to the list of active endpoints. */
     nn_list_insert (&self->eps, &ep->item, nn_list_end (&self->eps));
 
+    return eid;
+}
+
+static void nn_sock_rm_ep_inner (struct nn_sock *self, struct nn_ep *ep)
+{
+    /*  Move the endpoint from the list of active endpoints to the list
+        of shutting down endpoints. */
+    nn_list_erase (&self->eps, &ep->item);
+    nn_list_insert (&self->sdeps, &ep->item, nn_list_end (&self->sdeps));
+
+    /*  Ask the endpoint to stop. Actual terminatation may be delayed
+        by the transport. */
+    nn_ep_stop (ep);
+}
+
+int nn_sock_add_ep (struct nn_sock *self, struct nn_transport *transport,
+    int bind, const char *addr)
+{
+    int rc;
+
+    nn_ctx_enter (&self->ctx);
+    rc = nn_sock_add_ep_inner (self, transport, bind, addr);
     nn_ctx_leave (&self->ctx);
 
-    return eid;
+    return rc;
+}
+
+int nn_sock_add_eps (struct nn_sock *self, struct nn_transport **transports,
+    const char **addrs, int naddrs, int bind, int *eids)
+{
+    int rc;
+    int i;
+
+    /*  All the endpoints are created within a single critical section so
+        that their connection attempts are started back to back. */
+    nn_ctx_enter (&self->ctx);
+    rc = 0;
+    for (i = 0; i != naddrs; ++i) {
+        rc = nn_sock_add_ep_inner (self, transports [i], bind, addrs [i]);
+        if (nn_slow (rc < 0))
+            break;
+        if (eids)
+            eids [i] = rc;
+    }
+
+    /*  Either all the endpoints are created or none of them. Those created
+        so far are at the end of the list; remove them. */
+    if (nn_slow (rc < 0)) {
+        while (i--)
+            nn_sock_rm_ep_inner (self, nn_cont (nn_list_prev (&self->eps,
+                nn_list_end (&self->eps)), struct nn_ep, item));
+        nn_ctx_leave (&self->ctx);
+        return rc;
+    }
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
 }
 
 int nn_sock_rm_ep (struct nn_sock *self, int eid)
@@ -531,14 +1106,7 @@ int nn_sock_rm_ep (struct nn_sock *self, int eid)
         return -EINVAL;
     }
 
-    /*  Move the endpoint from the list of active endpoints to the list
-        of shutting down endpoints. */
-    nn_list_erase (&self->eps, &ep->item);
-    nn_list_insert (&self->sdeps, &ep->item, nn_list_end (&self->sdeps));
-
-    /*  Ask the endpoint to stop. Actual terminatation may be delayed
-        by the transport. */
-    nn_ep_stop (ep);
+    nn_sock_rm_ep_inner (self, ep);
 
     nn_ctx_leave (&self->ctx);
 
@@ -548,14 +1116,39 @@ int nn_sock_rm_ep (struct nn_sock *self, int eid)
 int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
 {
     int rc;
+
+    rc = nn_sock_sendmany (self, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+int nn_sock_sendmany (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags)
+{
+    int rc;
+    int i;
     uint64_t deadline;
     uint64_t now;
     int timeout;
+    int wait;
+    uint64_t waitstart;
+    int ispiece;
+    struct nn_msg_piece piece;
+    size_t size;
 
     /*  Some sockets types cannot be used for sending messages. */
     if (nn_slow (self->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND))
         return -ENOTSUP;
 
+    /*  Turn a non-blocking send away without locking the socket if it is
+        known not to be writable. This is the only part of sending that
+        doesn't contend with receiving: both run in the socket's context,
+        as do all the state machines of the socket, so blocking sends and
+        receives are still serialised. */
+    if ((flags & NN_DONTWAIT) &&
+          (self->socktype->flags & NN_SOCKTYPE_FLAG_STATELESS) &&
+          !self->hook && !(self->events & NN_SOCKBASE_EVENT_OUT))
+        return -EAGAIN;
+
     nn_ctx_enter (&self->ctx);
 
     /*  Compute the deadline for SNDTIMEO timer. */
@@ -568,6 +1161,8 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
         timeout = self->sndtimeo;
     }
 
+    i = 0;
+    waitstart = 0;
     while (1) {
 
         switch (self->state) {
@@ -575,6 +1170,8 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
         case NN_SOCK_STATE_INIT:
              break;
 
+        case NN_SOCK_STATE_LINGERING:
+        case NN_SOCK_STATE_STOPPING_TIMER:
         case NN_SOCK_STATE_STOPPING_EPS:
         case NN_SOCK_STATE_STOPPING:
         case NN_SOCK_STATE_FINI:
@@ -585,42 +1182,112 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
                 leading to situations where technically the outstanding
                 operation should refer to some other socket entirely.  */
             nn_ctx_leave (&self->ctx);
-            return -EBADF;
+            return i ? i : -EBADF;
+        }
+
+        /*  Messages without an explicit deadline get the default one. */
+        if (nn_slow (self->msgttl > 0) && !msgs [i].expiry)
+            msgs [i].expiry = nn_clock_us () +
+                (uint64_t) self->msgttl * 1000;
+
+        /*  While a message is being sent in pieces, each message is
+            the next piece of it. */
+        ispiece = 0;
+        if (nn_slow (self->sndpiece.size ||
+              nn_chunkref_size (&msgs [i].hdrs) != 0)) {
+            ispiece = nn_sock_piece (self, &msgs [i], &piece);
+            if (nn_slow (ispiece < 0)) {
+                nn_ctx_leave (&self->ctx);
+                return i ? i : ispiece;
+            }
         }
 
-        /*  Try to send the message in a non-blocking way. */
-        rc = self->sockbase->vfptr->send (self->sockbase, msg);
+        /*  Try to send the message in a non-blocking way, unless it has
+            to wait for the send rate limit. */
+        size = nn_chunkref_size (&msgs [i].body);
+        if (nn_slow (self->sndrate_msgs || self->sndrate_bytes) &&
+              nn_sock_sndrate_throttle (self, size))
+            rc = -EAGAIN;
+        else
+            rc = self->sockbase->vfptr->send (self->sockbase, &msgs [i]);
         if (nn_fast (rc == 0)) {
-            nn_ctx_leave (&self->ctx);
-            return 0;
+            NN_TRACE (NN_TRACE_SEND_PROTO, self, 0);
+            if (nn_slow (self->sndrate_msgs || self->sndrate_bytes))
+                nn_sock_sndrate_take (self, size);
+            if (nn_slow (ispiece)) {
+                self->sndpiece = piece;
+                if (piece.offset == piece.size) {
+                    self->sndpiece.size = 0;
+                    self->sndpiece.offset = 0;
+                }
+            }
+            nn_sock_stat_record (self, NN_SOCKBASE_LATENCY_SNDWAIT,
+                waitstart ? nn_clock_us () - waitstart : 0);
+            waitstart = 0;
+
+            /*  Each message of the batch is subject to blocking, but they
+                share a single deadline. */
+            if (++i == count) {
+                nn_ctx_leave (&self->ctx);
+                return i;
+            }
+            continue;
         }
         nn_assert (rc < 0);
 
         /*  Any unexpected error is forwarded to the caller. */
         if (nn_slow (rc != -EAGAIN)) {
             nn_ctx_leave (&self->ctx);
-            return rc;
+            return i ? i : rc;
         }
 
         /*  If the message cannot be sent at the moment and the send call
             is non-blocking, return immediately. */
         if (nn_fast (flags & NN_DONTWAIT)) {
+            if (self->hook)
+                self->hook->events &= ~NN_SOCKBASE_EVENT_OUT;
             nn_ctx_leave (&self->ctx);
-            return -EAGAIN;
+            return i ? i : -EAGAIN;
         }
 
         /*  With blocking send, wait while there are new pipes available
-            for sending. */
+            for sending. Leaving the context brings the efd up to date
+            now that there's a waiter. */
+        if (!waitstart)
+            waitstart = nn_clock_us ();
+
+        /*  There's no point in waiting past the message's deadline. */
+        wait = timeout;
+        if (nn_slow (msgs [i].expiry)) {
+            now = nn_clock_us ();
+            if (now >= msgs [i].expiry) {
+                nn_sock_stat_increment (self, NN_STAT_EXPIRED_MESSAGES, 1);
+                nn_ctx_leave (&self->ctx);
+                return i ? i : -ETIMEDOUT;
+            }
+            now = (msgs [i].expiry - now + 999) / 1000;
+            if (wait < 0 || now < (uint64_t) wait)
+                wait = (int) now;
+        }
+
+        rc = nn_sock_openfd (self, NN_SOCK_FLAG_SNDEFD);
+        if (nn_slow (rc < 0)) {
+            nn_ctx_leave (&self->ctx);
+            return i ? i : rc;
+        }
+        ++self->sndwaiters;
         nn_ctx_leave (&self->ctx);
-        rc = nn_efd_wait (&self->sndfd, timeout);
-        if (nn_slow (rc == -ETIMEDOUT))
-            return -ETIMEDOUT;
-        if (nn_slow (rc == -EINTR))
-            return -EINTR;
-        if (nn_slow (rc == -EBADF))
-            return -EBADF;
-        errnum_assert (rc == 0, rc);
+        rc = nn_pool_wait_efd (self->ctx.pool, &self->sndfd, wait);
         nn_ctx_enter (&self->ctx);
+        --self->sndwaiters;
+        if (nn_slow (rc == -ETIMEDOUT || rc == -EINTR || rc == -EBADF)) {
+            if (rc == -ETIMEDOUT && msgs [i].expiry &&
+                  nn_clock_us () >= msgs [i].expiry)
+                nn_sock_stat_increment (self, NN_STAT_EXPIRED_MESSAGES, 1);
+            nn_ctx_leave (&self->ctx);
+            return i ? i : rc;
+        }
+        errnum_assert (rc == 0, rc);
         /*
          *  Double check if pipes are still available for sending
          */
@@ -637,17 +1304,163 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
     }
 }
 
+/*  Fills the send rate buckets up and lets the next message through. */
+static void nn_sock_sndrate_reset (struct nn_sock *self)
+{
+    self->sndrate_mtokens = (int64_t) self->sndrate_msgs *
+        self->sndrate_burst * (NN_SOCK_SNDRATE_UNIT / 1000);
+    self->sndrate_btokens = (int64_t) self->sndrate_bytes *
+        self->sndrate_burst * (NN_SOCK_SNDRATE_UNIT / 1000);
+    self->sndrate_stamp = nn_clock_us ();
+    self->flags &= ~NN_SOCK_FLAG_THROTTLED;
+}
+
+/*  Refills one bucket for the time elapsed and returns the number of
+    microseconds till it has 'cost' tokens, or as many as it can hold. */
+static uint64_t nn_sock_sndrate_bucket (struct nn_sock *self,
+    int64_t *tokens, int rate, uint64_t elapsed, int64_t cost)
+{
+    int64_t size;
+
+    if (!rate)
+        return 0;
+
+    size = (int64_t) rate * self->sndrate_burst *
+        (NN_SOCK_SNDRATE_UNIT / 1000);
+    if (elapsed >= (uint64_t) (size - *tokens) / rate + 1)
+        *tokens = size;
+    else
+        *tokens += (int64_t) elapsed * rate;
+    if (*tokens > size)
+        *tokens = size;
+
+    /*  A message that doesn't fit into the bucket is let through once
+        the bucket is full and the debt is paid off afterwards. */
+    if (cost > size)
+        cost = size;
+    if (*tokens >= cost)
+        return 0;
+    return (uint64_t) (cost - *tokens + rate - 1) / rate;
+}
+
+/*  Returns the number of microseconds the message of the given size has
+    to wait for the send rate limit. */
+static uint64_t nn_sock_sndrate_wait (struct nn_sock *self, size_t size)
+{
+    uint64_t now;
+    uint64_t elapsed;
+    uint64_t mwait;
+    uint64_t bwait;
+
+    now = nn_clock_us ();
+    elapsed = now - self->sndrate_stamp;
+    self->sndrate_stamp = now;
+
+    mwait = nn_sock_sndrate_bucket (self, &self->sndrate_mtokens,
+        self->sndrate_msgs, elapsed, NN_SOCK_SNDRATE_UNIT);
+    bwait = nn_sock_sndrate_bucket (self, &self->sndrate_btokens,
+        self->sndrate_bytes, elapsed, (int64_t) size * NN_SOCK_SNDRATE_UNIT);
+    return mwait > bwait ? mwait : bwait;
+}
+
+/*  Returns 1 if the message of the given size has to wait for the send rate
+    limit. The socket then stays non-writable till the timer finds out that
+    the tokens are there. */
+static int nn_sock_sndrate_throttle (struct nn_sock *self, size_t size)
+{
+    uint64_t wait;
+
+    wait = nn_sock_sndrate_wait (self, size);
+    if (nn_fast (!wait))
+        return 0;
+
+    self->flags |= NN_SOCK_FLAG_THROTTLED;
+    self->sndrate_pending = size;
+    if (nn_timer_isidle (&self->sndrate_timer))
+        nn_timer_start (&self->sndrate_timer,
+            wait >= (uint64_t) INT_MAX * 1000 ?
+            INT_MAX : (int) ((wait + 999) / 1000));
+    return 1;
+}
+
+/*  Takes the tokens for a message that was sent. If there are not enough
+    left for another one, the socket stops being writable straight away. */
+static void nn_sock_sndrate_take (struct nn_sock *self, size_t size)
+{
+    if (self->sndrate_msgs)
+        self->sndrate_mtokens -= NN_SOCK_SNDRATE_UNIT;
+    if (self->sndrate_bytes)
+        self->sndrate_btokens -= (int64_t) size * NN_SOCK_SNDRATE_UNIT;
+    nn_sock_sndrate_throttle (self, 0);
+}
+
 int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
 {
     int rc;
+
+    rc = nn_sock_recvmany (self, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+/*  Busy-waits till the socket gets the event or till the deadline
+    (in microseconds) expires. Returns 1 in the former case, 0 in the latter.
+    Called from outside of the socket's context. */
+static int nn_sock_spin (struct nn_sock *self, int event, uint64_t deadline)
+{
+    int i;
+
+    while (1) {
+        for (i = 0; i != 64; ++i) {
+            if (self->events & event)
+                return 1;
+            nn_sock_pause ();
+        }
+        if (nn_clock_us () >= deadline)
+            return 0;
+    }
+}
+
+int nn_sock_recvmany (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags)
+{
+    return nn_sock_recvbudget (self, msgs, count, NN_MSG, 0, flags);
+}
+
+int nn_sock_recvbudget (struct nn_sock *self, struct nn_msg *msgs, int count,
+    size_t budget, size_t overhead, int flags)
+{
+    int rc;
+    int i;
+    int held;
+    int prefetched;
+    size_t sz;
     uint64_t deadline;
     uint64_t now;
     int timeout;
+    uint64_t spindeadline;
 
     /*  Some sockets types cannot be used for receiving messages. */
     if (nn_slow (self->socktype->flags & NN_SOCKTYPE_FLAG_NORECV))
         return -ENOTSUP;
 
+    /*  The owning thread of a NN_SINGLE_THREAD socket takes the messages
+        from the receive queue without entering the context. The context
+        is only entered if the queue is empty. The held message is
+        the owning thread's as well. */
+    if (self->single && budget == NN_MSG &&
+          !(self->flags & NN_SOCK_FLAG_HELD)) {
+        i = nn_sock_recvqueued (self, msgs, count);
+        if (i)
+            return i;
+    }
+
+    /*  Same as with send, turn a non-blocking recv away without locking
+        the socket if it is known not to be readable. */
+    if ((flags & NN_DONTWAIT) &&
+          (self->socktype->flags & NN_SOCKTYPE_FLAG_STATELESS) &&
+          !self->hook && !(self->events & NN_SOCKBASE_EVENT_IN))
+        return -EAGAIN;
+
     nn_ctx_enter (&self->ctx);
 
     /*  Compute the deadline for RCVTIMEO timer. */
@@ -660,6 +1473,8 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
         timeout = self->rcvtimeo;
     }
 
+    i = 0;
+    spindeadline = 0;
     while (1) {
 
         switch (self->state) {
@@ -667,6 +1482,8 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
         case NN_SOCK_STATE_INIT:
              break;
 
+        case NN_SOCK_STATE_LINGERING:
+        case NN_SOCK_STATE_STOPPING_TIMER:
         case NN_SOCK_STATE_STOPPING_EPS:
         case NN_SOCK_STATE_STOPPING:
         case NN_SOCK_STATE_FINI:
@@ -677,42 +1494,119 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
                 leading to situations where technically the outstanding
                 operation should refer to some other socket entirely.  */
             nn_ctx_leave (&self->ctx);
-            return -EBADF;
+            return i ? i : -EBADF;
         }
 
-        /*  Try to receive the message in a non-blocking way. */
-        rc = self->sockbase->vfptr->recv (self->sockbase, msg);
+        /*  Try to receive the message in a non-blocking way. The message
+            held back by the previous call goes first, followed by those
+            already moved to the receive queue. */
+        held = self->flags & NN_SOCK_FLAG_HELD;
+        prefetched = 0;
+        if (nn_slow (held)) {
+            nn_msg_mv (&msgs [i], &self->held);
+            self->flags &= ~NN_SOCK_FLAG_HELD;
+            rc = 0;
+        }
+        else if (self->rcvqueue &&
+              nn_msgqueue_recv (self->rcvqueue, &msgs [i]) == 0) {
+            prefetched = 1;
+            rc = 0;
+        }
+        else
+            rc = self->sockbase->vfptr->recv (self->sockbase, &msgs [i]);
         if (nn_fast (rc == 0)) {
-            nn_ctx_leave (&self->ctx);
-            return 0;
+
+            /*  Drop the messages that have outlived their deadline while
+                waiting to be received. A held message was checked
+                already, a prefetched one was traced when it was taken
+                from the protocol. */
+            if (nn_fast (!held)) {
+                if (nn_slow (nn_sock_expired (self, &msgs [i])))
+                    continue;
+                if (nn_fast (!prefetched)) {
+                    NN_TRACE (NN_TRACE_RECV_PROTO, self,
+                        nn_chunkref_size (&msgs [i].body));
+                    if (msgs [i].rcvtime)
+                        nn_sock_stat_record (self,
+                            NN_SOCKBASE_LATENCY_RCVDELAY,
+                            nn_clock_us () - msgs [i].rcvtime);
+                }
+            }
+
+            /*  A message that doesn't fit is put aside till the next call. */
+            if (nn_slow (budget != NN_MSG)) {
+                sz = nn_msg_bodysize (&msgs [i]) + overhead;
+                if (sz > budget) {
+                    nn_msg_mv (&self->held, &msgs [i]);
+                    self->flags |= NN_SOCK_FLAG_HELD;
+                    nn_ctx_leave (&self->ctx);
+                    return i ? i : -EMSGSIZE;
+                }
+                budget -= sz;
+            }
+            if (++i == count) {
+                nn_ctx_leave (&self->ctx);
+                return i;
+            }
+            continue;
         }
         nn_assert (rc < 0);
 
         /*  Any unexpected error is forwarded to the caller. */
         if (nn_slow (rc != -EAGAIN)) {
             nn_ctx_leave (&self->ctx);
-            return rc;
+            return i ? i : rc;
         }
 
         /*  If the message cannot be received at the moment and the recv call
-            is non-blocking, return immediately. */
-        if (nn_fast (flags & NN_DONTWAIT)) {
+            is non-blocking, return immediately. Only the first message
+            of a batch is waited for. */
+        if (nn_fast ((flags & NN_DONTWAIT) || i)) {
+            if (self->hook)
+                self->hook->events &= ~NN_SOCKBASE_EVENT_IN;
             nn_ctx_leave (&self->ctx);
-            return -EAGAIN;
+            return i ? i : -EAGAIN;
+        }
+
+        /*  If asked to, poll for a message for a while before going to
+            sleep. The spinning is limited by RCVTIMEO as well. */
+        if (nn_slow (self->rcvspin > 0)) {
+            if (!spindeadline) {
+                spindeadline = nn_clock_us () + self->rcvspin;
+                if (self->rcvtimeo >= 0 && spindeadline > deadline * 1000)
+                    spindeadline = deadline * 1000;
+            }
+            if (nn_clock_us () < spindeadline) {
+                nn_ctx_leave (&self->ctx);
+                rc = nn_sock_spin (self, NN_SOCKBASE_EVENT_IN, spindeadline);
+                nn_ctx_enter (&self->ctx);
+                if (rc)
+                    continue;
+                if (self->rcvtimeo >= 0) {
+                    now = nn_clock_ms();
+                    timeout = (int) (now > deadline ? 0 : deadline - now);
+                }
+            }
         }
 
         /*  With blocking recv, wait while there are new pipes available
-            for receiving. */
+            for receiving. Leaving the context brings the efd up to date
+            now that there's a waiter. */
+        rc = nn_sock_openfd (self, NN_SOCK_FLAG_RCVEFD);
+        if (nn_slow (rc < 0)) {
+            nn_ctx_leave (&self->ctx);
+            return i ? i : rc;
+        }
+        ++self->rcvwaiters;
         nn_ctx_leave (&self->ctx);
-        rc = nn_efd_wait (&self->rcvfd, timeout);
-        if (nn_slow (rc == -ETIMEDOUT))
-            return -ETIMEDOUT;
-        if (nn_slow (rc == -EINTR))
-            return -EINTR;
-        if (nn_slow (rc == -EBADF))
-            return -EBADF;
-        errnum_assert (rc == 0, rc);
+        rc = nn_pool_wait_efd (self->ctx.pool, &self->rcvfd, timeout);
         nn_ctx_enter (&self->ctx);
+        --self->rcvwaiters;
+        if (nn_slow (rc == -ETIMEDOUT || rc == -EINTR || rc == -EBADF)) {
+            nn_ctx_leave (&self->ctx);
+            return i ? i : rc;
+        }
+        errnum_assert (rc == 0, rc);
         /*
          *  Double check if pipes are still available for receiving
          */
@@ -729,12 +1623,68 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
     }
 }
 
+int nn_sock_recvqueued (struct nn_sock *self, struct nn_msg *msgs, int count)
+{
+    int i;
+
+    i = 0;
+    while (i != count && nn_msgqueue_recv (self->rcvqueue, &msgs [i]) == 0) {
+        if (nn_slow (msgs [i].expiry) && nn_clock_us () >= msgs [i].expiry) {
+            nn_ctx_enter (&self->ctx);
+            nn_sock_expired (self, &msgs [i]);
+            nn_ctx_leave (&self->ctx);
+            continue;
+        }
+        ++i;
+    }
+    return i;
+}
+
+int nn_sock_openring (struct nn_sock *self, struct nn_rcvring **ring)
+{
+    int rc;
+
+    nn_ctx_enter (&self->ctx);
+    if (nn_slow (self->state != NN_SOCK_STATE_INIT &&
+          self->state != NN_SOCK_STATE_ACTIVE)) {
+        nn_ctx_leave (&self->ctx);
+        return -EBADF;
+    }
+    if (nn_slow (self->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
+        nn_ctx_leave (&self->ctx);
+        return -ENOTSUP;
+    }
+    rc = nn_sock_setsingle (self, 1);
+    if (nn_slow (rc < 0)) {
+        nn_ctx_leave (&self->ctx);
+        return rc;
+    }
+    if (!self->rcvring) {
+        self->rcvring = nn_alloc (sizeof (struct nn_rcvring), "receive ring");
+        alloc_assert (self->rcvring);
+        rc = nn_rcvring_init (self->rcvring, self);
+        if (nn_slow (rc < 0)) {
+            nn_free (self->rcvring);
+            self->rcvring = NULL;
+            nn_ctx_leave (&self->ctx);
+            return rc;
+        }
+    }
+    *ring = self->rcvring;
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
+}
+
 int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe)
 {
     int rc;
 
     rc = self->sockbase->vfptr->add (self->sockbase, pipe);
     if (nn_slow (rc >= 0)) {
+        ((struct nn_pipebase*) pipe)->id = self->pipeid++;
+        nn_list_insert (&self->pipes, &((struct nn_pipebase*) pipe)->item,
+            nn_list_end (&self->pipes));
         nn_sock_stat_increment (self, NN_STAT_CURRENT_CONNECTIONS, 1);
     }
     return rc;
@@ -743,7 +1693,102 @@ int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe)
 void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe)
 {
     self->sockbase->vfptr->rm (self->sockbase, pipe);
+    nn_list_erase (&self->pipes, &((struct nn_pipebase*) pipe)->item);
     nn_sock_stat_increment (self, NN_STAT_CURRENT_CONNECTIONS, -1);
+
+    /*  The messages of a broken connection are lost, there's no point
+        in waiting for them. */
+    nn_sock_drained (self);
+}
+
+void nn_sock_drained (struct nn_sock *self)
+{
+    if (nn_fast (self->state != NN_SOCK_STATE_LINGERING))
+        return;
+    if (!nn_fsm_event_active (&self->drained))
+        nn_fsm_post (&self->fsm, &self->drained, NN_FSM_ACTION,
+            NN_SOCK_ACTION_DRAINED);
+}
+
+/*  Returns 1 if none of the pipes has outbound messages left. */
+/*  Checks the piece of a message passed in pieces and attaches
+    the NN_MSG_PIECE property to it, if it's not there already. Returns 1
+    if the message is a piece, with 'piece' describing the message as it's
+    going to be once the piece is sent, and 0 if it's an ordinary one. */
+static int nn_sock_piece (struct nn_sock *self, struct nn_msg *msg,
+    struct nn_msg_piece *piece)
+{
+    int haspiece;
+    int *fds;
+    uint64_t len;
+
+    haspiece = nn_msg_piece (msg, piece);
+    if (!haspiece && !self->sndpiece.size)
+        return 0;
+
+    /*  Pieces are sent one after another over a single pipe, which is
+        what NN_PAIR sockets have. The headers are replaced by the property,
+        so no other ones can be attached. */
+    if (nn_slow (self->socktype->protocol != NN_PAIR))
+        return -ENOTSUP;
+    if (nn_slow (nn_msg_file (msg, NULL) || nn_msg_fds (msg, &fds)))
+        return -EINVAL;
+
+    len = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    if (!self->sndpiece.size) {
+        if (nn_slow (piece->offset != 0 || piece->size < len))
+            return -EINVAL;
+    }
+    else {
+        if (nn_slow (haspiece && (piece->size != self->sndpiece.size ||
+              piece->offset != self->sndpiece.offset)))
+            return -EINVAL;
+        if (nn_slow (len > self->sndpiece.size - self->sndpiece.offset))
+            return -EINVAL;
+        *piece = self->sndpiece;
+    }
+    if (!haspiece)
+        nn_msg_setpiece (msg, piece);
+    piece->offset += len;
+    return 1;
+}
+
+static int nn_sock_flushed (struct nn_sock *self)
+{
+    struct nn_list_item *it;
+
+    for (it = nn_list_begin (&self->pipes);
+          it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it))
+        if (!nn_pipebase_flushed (nn_cont (it, struct nn_pipebase, item)))
+            return 0;
+    return 1;
+}
+
+/*  Creates the efd specified by 'flag' unless it already exists. Called
+    from within the socket's context. The efd is created unsignalled, which
+    matches the state it would be in if it existed, as nobody could have
+    looked at it. */
+static int nn_sock_openfd (struct nn_sock *self, int flag)
+{
+    int rc;
+
+    if (nn_fast (self->flags & flag))
+        return 0;
+
+    /*  The efds of a closed socket are stopped, so a new one would never
+        wake anybody up. */
+    if (nn_slow (self->state != NN_SOCK_STATE_INIT &&
+          self->state != NN_SOCK_STATE_ACTIVE))
+        return -EBADF;
+
+    rc = nn_efd_init (flag == NN_SOCK_FLAG_RCVEFD ?
+        &self->rcvfd : &self->sndfd);
+    if (nn_slow (rc < 0))
+        return rc;
+    self->flags |= flag;
+
+    return 0;
 }
 
 static void nn_sock_onleave (struct nn_ctx *self)
@@ -754,18 +1799,49 @@ static void nn_sock_onleave (struct nn_ctx *self)
     sock = nn_cont (self, struct nn_sock, ctx);
 
     /*  If nn_close() was already called there's no point in adjusting the
-        snd/rcv file descriptors. */
-    if (nn_slow (sock->state != NN_SOCK_STATE_ACTIVE))
+        snd/rcv file descriptors. All the events are reported so that
+        nobody skips entering the context and finding out the socket is
+        being closed. */
+    if (nn_slow (sock->state != NN_SOCK_STATE_ACTIVE)) {
+        sock->events = -1;
         return;
+    }
+
+    /*  Hand the inbound messages over to the owning thread. */
+    if (nn_slow (sock->rcvqueue && (sock->single || sock->rcvring)))
+        nn_sock_prefetch (sock);
 
     /*  Check whether socket is readable and/or writable at the moment. */
     events = sock->sockbase->vfptr->events (sock->sockbase);
     errnum_assert (events >= 0, -events);
+    if (nn_slow (sock->flags & NN_SOCK_FLAG_THROTTLED))
+        events &= ~NN_SOCKBASE_EVENT_OUT;
+    if (nn_slow (sock->flags & NN_SOCK_FLAG_HELD))
+        events |= NN_SOCKBASE_EVENT_IN;
+    if (nn_slow (sock->rcvqueue && nn_msgqueue_size (sock->rcvqueue)))
+        events |= NN_SOCKBASE_EVENT_IN;
+
+    /*  Threads spinning on the events keep their cache line shared. It's
+        written only when the events change, so that leaving the context
+        doesn't take it from them each time. */
+    if (sock->events != events)
+        sock->events = events;
+
+    /*  Notify the hook about the events it doesn't know about yet. */
+    if (nn_slow (sock->hook != NULL)) {
+        if (events & ~sock->hook->events) {
+            sock->hook->events |= events;
+            sock->hook->fn (sock->hook);
+        }
+    }
 
-    /*  Signal/unsignal IN as needed. */
+    /*  Signal/unsignal IN as needed. The efd is signalled only if someone
+        may be looking at it; if it's not signalled, it needs no
+        unsignalling either. */
     if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
         if (events & NN_SOCKBASE_EVENT_IN) {
-            if (!(sock->flags & NN_SOCK_FLAG_IN)) {
+            if (!(sock->flags & NN_SOCK_FLAG_IN) &&
+                  (sock->rcvwaiters || (sock->flags & NN_SOCK_FLAG_RCVFD))) {
                 sock->flags |= NN_SOCK_FLAG_IN;
                 nn_efd_signal (&sock->rcvfd);
             }
@@ -781,7 +1857,8 @@ static void nn_sock_onleave (struct nn_ctx *self)
     /*  Signal/unsignal OUT as needed. */
     if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)) {
         if (events & NN_SOCKBASE_EVENT_OUT) {
-            if (!(sock->flags & NN_SOCK_FLAG_OUT)) {
+            if (!(sock->flags & NN_SOCK_FLAG_OUT) &&
+                  (sock->sndwaiters || (sock->flags & NN_SOCK_FLAG_SNDFD))) {
                 sock->flags |= NN_SOCK_FLAG_OUT;
                 nn_efd_signal (&sock->sndfd);
             }
@@ -795,6 +1872,54 @@ static void nn_sock_onleave (struct nn_ctx *self)
     }
 }
 
+/*  Moves the messages from the protocol to the receive queue till either
+    runs out, the queue being limited by NN_RCVBUF the same way the pipes
+    are. The queue is filled only in the context, so there's a single
+    producer, and it's emptied by the owning thread. */
+static void nn_sock_prefetch (struct nn_sock *self)
+{
+    int rc;
+    size_t count;
+    struct nn_msg msg;
+
+    /*  The held message must be received before any that follows it. */
+    if (nn_slow (self->flags & NN_SOCK_FLAG_HELD))
+        return;
+
+    while (1) {
+        count = nn_msgqueue_size (self->rcvqueue);
+        if (count == NN_MSGQUEUE_SLOTS || (count > 0 &&
+              nn_msgqueue_bytes (self->rcvqueue) >= (size_t) self->rcvbuf))
+            break;
+        rc = self->sockbase->vfptr->recv (self->sockbase, &msg);
+        if (rc < 0)
+            break;
+        if (nn_slow (nn_sock_expired (self, &msg)))
+            continue;
+        NN_TRACE (NN_TRACE_RECV_PROTO, self, nn_chunkref_size (&msg.body));
+        if (msg.rcvtime)
+            nn_sock_stat_record (self, NN_SOCKBASE_LATENCY_RCVDELAY,
+                nn_clock_us () - msg.rcvtime);
+        rc = nn_msgqueue_send (self->rcvqueue, &msg);
+        errnum_assert (rc == 0, -rc);
+    }
+
+    /*  Let the receive ring know if it is waiting for the messages. */
+    if (self->rcvring && nn_msgqueue_size (self->rcvqueue))
+        nn_rcvring_notify (self->rcvring);
+}
+
+/*  Drops the message if it has outlived its deadline while waiting to be
+    received. Returns 1 if it was dropped, 0 otherwise. */
+static int nn_sock_expired (struct nn_sock *self, struct nn_msg *msg)
+{
+    if (nn_fast (!msg->expiry || nn_clock_us () < msg->expiry))
+        return 0;
+    nn_msg_term (msg);
+    nn_sock_stat_increment (self, NN_STAT_EXPIRED_MESSAGES, 1);
+    return 1;
+}
+
 static struct nn_optset *nn_sock_optset (struct nn_sock *self, int id)
 {
     int index;
@@ -822,11 +1947,28 @@ static struct nn_optset *nn_sock_optset (struct nn_sock *self, int id)
     return self->optsets [index];
 }
 
+/*  Asks all the endpoints to stop. */
+static void nn_sock_stop_eps (struct nn_sock *self)
+{
+    struct nn_list_item *it;
+    struct nn_ep *ep;
+
+    it = nn_list_begin (&self->eps);
+    while (it != nn_list_end (&self->eps)) {
+        ep = nn_cont (it, struct nn_ep, item);
+        it = nn_list_next (&self->eps, it);
+        nn_list_erase (&self->eps, &ep->item);
+        nn_list_insert (&self->sdeps, &ep->item,
+            nn_list_end (&self->sdeps));
+        nn_ep_stop (ep);
+    }
+    self->state = NN_SOCK_STATE_STOPPING_EPS;
+}
+
 static void nn_sock_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr)
 {
     struct nn_sock *sock;
-    struct nn_list_item *it;
     struct nn_ep *ep;
 
     sock = nn_cont (self, struct nn_sock, fsm);
@@ -836,25 +1978,104 @@ static void nn_sock_shutdown (struct nn_fsm *self, int src, int type,
 
         /*  Close sndfd and rcvfd. This should make any current
             select/poll using SNDFD and/or RCVFD exit. */
-        if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
+        if (sock->flags & NN_SOCK_FLAG_RCVEFD)
             nn_efd_stop (&sock->rcvfd);
-        }
-        if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)) {
+        if (sock->flags & NN_SOCK_FLAG_SNDEFD)
             nn_efd_stop (&sock->sndfd);
+        if (sock->rcvring)
+            nn_rcvring_stop (sock->rcvring);
+
+        /*  Let the hook find out that the socket is being closed. */
+        if (sock->hook)
+            sock->hook->fn (sock->hook);
+
+        /*  Nobody is going to send any more. */
+        nn_timer_stop (&sock->sndrate_timer);
+
+        /*  If asked to, give the pipes a chance to send what they've got
+            before the endpoints, and the connections along with them, are
+            stopped. */
+        if (sock->linger != 0 && !nn_sock_flushed (sock)) {
+            sock->state = NN_SOCK_STATE_LINGERING;
+            if (sock->linger > 0)
+                nn_timer_start (&sock->linger_timer, sock->linger);
+            return;
         }
 
-        /*  Ask all the associated endpoints to stop. */
-        it = nn_list_begin (&sock->eps);
-        while (it != nn_list_end (&sock->eps)) {
-            ep = nn_cont (it, struct nn_ep, item);
-            it = nn_list_next (&sock->eps, it);
-            nn_list_erase (&sock->eps, &ep->item);
-            nn_list_insert (&sock->sdeps, &ep->item,
-                nn_list_end (&sock->sdeps));
-            nn_ep_stop (ep);
+        nn_sock_stop_eps (sock);
+        goto finish2;
+    }
+    if (nn_slow (src == NN_SOCK_SRC_SNDRATE_TIMER)) {
 
+        /*  The protocol can't be stopped before the timer is. */
+        if (type != NN_TIMER_STOPPED ||
+              sock->state != NN_SOCK_STATE_STOPPING_EPS)
+            return;
+        goto finish2;
+    }
+    if (nn_slow (sock->state == NN_SOCK_STATE_LINGERING ||
+          sock->state == NN_SOCK_STATE_STOPPING_TIMER)) {
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            nn_assert (type == NN_SOCK_ACTION_DRAINED);
+            break;
+
+        case NN_SOCK_SRC_LINGER_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+
+                /*  Out of time. The messages left are dropped. */
+                if (sock->state == NN_SOCK_STATE_STOPPING_TIMER)
+                    return;
+                nn_timer_stop (&sock->linger_timer);
+                sock->state = NN_SOCK_STATE_STOPPING_TIMER;
+                return;
+            case NN_TIMER_STOPPED:
+                nn_assert (sock->state == NN_SOCK_STATE_STOPPING_TIMER);
+                nn_sock_stop_eps (sock);
+                goto finish2;
+            default:
+                nn_fsm_bad_action (sock->state, src, type);
+            }
+
+        case NN_SOCK_SRC_EP:
+
+            /*  Endpoint closed by nn_shutdown() before nn_close(). */
+            nn_assert (type == NN_EP_STOPPED);
+            ep = (struct nn_ep*) srcptr;
+            nn_list_erase (&sock->sdeps, &ep->item);
+            nn_ep_term (ep);
+            nn_free (ep);
+            return;
+
+        default:
+
+            /*  The protocol keeps getting the pipe events, so that it can
+                pass the messages it has queued itself to the pipes. */
+            switch (type) {
+            case NN_PIPE_IN:
+                sock->sockbase->vfptr->in (sock->sockbase,
+                    (struct nn_pipe*) srcptr);
+                break;
+            case NN_PIPE_OUT:
+                sock->sockbase->vfptr->out (sock->sockbase,
+                    (struct nn_pipe*) srcptr);
+                break;
+            default:
+                nn_fsm_bad_action (sock->state, src, type);
+            }
         }
-        sock->state = NN_SOCK_STATE_STOPPING_EPS;
+
+        /*  Once everything is sent, stop lingering. */
+        if (sock->state != NN_SOCK_STATE_LINGERING || !nn_sock_flushed (sock))
+            return;
+        if (sock->linger > 0) {
+            nn_timer_stop (&sock->linger_timer);
+            sock->state = NN_SOCK_STATE_STOPPING_TIMER;
+            return;
+        }
+        nn_sock_stop_eps (sock);
         goto finish2;
     }
     if (nn_slow (sock->state == NN_SOCK_STATE_STOPPING_EPS)) {
@@ -876,7 +2097,8 @@ finish2:
         /*  If all the endpoints are deallocated, we can start stopping
             protocol-specific part of the socket. If there' no stop function
             we can consider it stopped straight away. */
-        if (!nn_list_empty (&sock->sdeps))
+        if (!nn_list_empty (&sock->sdeps) ||
+              !nn_timer_isidle (&sock->sndrate_timer))
             return;
         nn_assert (nn_list_empty (&sock->eps));
         sock->state = NN_SOCK_STATE_STOPPING;
@@ -898,11 +2120,14 @@ finish1:
         sock->state = NN_SOCK_STATE_FINI;
 
         /*  Close the event FDs entirely. */
-        if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
+        if (sock->flags & NN_SOCK_FLAG_RCVEFD)
             nn_efd_term (&sock->rcvfd);
-        }
-        if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)) {
+        if (sock->flags & NN_SOCK_FLAG_SNDEFD)
             nn_efd_term (&sock->sndfd);
+        if (sock->rcvring) {
+            nn_rcvring_term (sock->rcvring);
+            nn_free (sock->rcvring);
+            sock->rcvring = NULL;
         }
 
         /*  Now we can unblock the application thread blocked in
@@ -972,6 +2197,30 @@ static void nn_sock_handler (struct nn_fsm *self, int src, int type,
                 nn_fsm_bad_action (sock->state, src, type);
             }
 
+        case NN_SOCK_SRC_SNDRATE_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+
+                /*  The tokens are there. Leaving the context makes the
+                    socket writable again. */
+                sock->flags &= ~NN_SOCK_FLAG_THROTTLED;
+                nn_timer_stop (&sock->sndrate_timer);
+                return;
+
+            case NN_TIMER_STOPPED:
+
+                /*  Another message may have run out of tokens while the
+                    timer was being stopped. */
+                if (!(sock->flags & NN_SOCK_FLAG_THROTTLED))
+                    return;
+                if (!nn_sock_sndrate_throttle (sock, sock->sndrate_pending))
+                    sock->flags &= ~NN_SOCK_FLAG_THROTTLED;
+                return;
+
+            default:
+                nn_fsm_bad_action (sock->state, src, type);
+            }
+
         default:
 
             /*  The assumption is that all the other events come from pipes. */
@@ -1018,8 +2267,26 @@ void nn_sock_report_error (struct nn_sock *self, struct nn_ep *ep, int errnum)
     }
 }
 
+/*  Returns the statistics shard of the calling thread. */
+static struct nn_sock_stat_shard *nn_sock_stat_shard (struct nn_sock *self)
+{
+    static NN_THREAD_LOCAL int index = -1;
+    uint64_t hash;
+
+    /*  The address of a thread-local variable differs in every thread. Hash
+        it to spread the threads evenly over the shards. Threads that end up
+        sharing a shard merely share a cache line. */
+    if (nn_slow (index < 0)) {
+        hash = (uint64_t) (uintptr_t) &index * 0x9e3779b97f4a7c15ULL;
+        index = (int) (hash >> (64 - NN_SOCK_STAT_SHARD_BITS));
+    }
+    return &self->stat_shards [index];
+}
+
 void nn_sock_stat_increment (struct nn_sock *self, int name, int64_t increment)
 {
+    struct nn_sock_stat_shard *shard;
+
     switch (name) {
         case NN_STAT_ESTABLISHED_CONNECTIONS:
             nn_assert (increment > 0);
@@ -1049,21 +2316,33 @@ void nn_sock_stat_increment (struct nn_sock *self, int name, int64_t increment)
             nn_assert (increment > 0);
             self->statistics.accept_errors += increment;
             break;
+        case NN_STAT_DROPPED_MESSAGES:
+            nn_assert (increment > 0);
+            self->statistics.dropped_messages += increment;
+            break;
+        case NN_STAT_EXPIRED_MESSAGES:
+            nn_assert (increment > 0);
+            self->statistics.expired_messages += increment;
+            break;
         case NN_STAT_MESSAGES_SENT:
             nn_assert (increment > 0);
-            self->statistics.messages_sent += increment;
+            shard = nn_sock_stat_shard (self);
+            shard->messages_sent += increment;
             break;
         case NN_STAT_MESSAGES_RECEIVED:
             nn_assert (increment > 0);
-            self->statistics.messages_received += increment;
+            shard = nn_sock_stat_shard (self);
+            shard->messages_received += increment;
             break;
         case NN_STAT_BYTES_SENT:
             nn_assert (increment >= 0);
-            self->statistics.bytes_sent += increment;
+            shard = nn_sock_stat_shard (self);
+            shard->bytes_sent += increment;
             break;
         case NN_STAT_BYTES_RECEIVED:
             nn_assert (increment >= 0);
-            self->statistics.bytes_received += increment;
+            shard = nn_sock_stat_shard (self);
+            shard->bytes_received += increment;
             break;
 
         case NN_STAT_CURRENT_CONNECTIONS:
@@ -1080,7 +2359,8 @@ void nn_sock_stat_increment (struct nn_sock *self, int name, int64_t increment)
             break;
         case NN_STAT_CURRENT_SND_PRIORITY:
             /*  This is an exception, we don't want to increment priority  */
-            nn_assert((increment > 0 && increment <= 16) || increment == -1);
+            nn_assert ((increment > 0 && increment <= NN_PRIOLIST_SLOTS) ||
+                increment == -1);
             self->statistics.current_snd_priority = (int) increment;
             break;
         case NN_STAT_CURRENT_EP_ERRORS:
@@ -1092,25 +2372,267 @@ void nn_sock_stat_increment (struct nn_sock *self, int name, int64_t increment)
     }
 }
 
-int nn_sock_hold (struct nn_sock *self)
+void nn_sock_stat_record (struct nn_sock *self, int latency, uint64_t value)
 {
-    switch (self->state) {
-    case NN_SOCK_STATE_ACTIVE:
-    case NN_SOCK_STATE_INIT:
-        self->holds++;
+    struct nn_hist *hist;
+
+    nn_assert (latency >= 0 && latency < NN_SOCKBASE_LATENCIES);
+    hist = self->latencies [latency];
+    if (nn_slow (!hist)) {
+        hist = nn_alloc (sizeof (struct nn_hist), "latency histogram");
+        alloc_assert (hist);
+        nn_hist_init (hist);
+        self->latencies [latency] = hist;
+    }
+    nn_hist_record (hist, value);
+}
+
+uint64_t nn_sock_stat_latency (struct nn_sock *self, int latency,
+    int permille)
+{
+    struct nn_hist *hist;
+
+    hist = self->latencies [latency];
+    return hist ? nn_hist_percentile (hist, permille) : 0;
+}
+
+static void nn_sock_stat_worker (struct nn_sock *self,
+    struct nn_worker_stats *stats)
+{
+    /*  A socket bound to a worker does all its I/O there. Otherwise its
+        endpoints may be spread over the whole pool. */
+    if (self->ctx.worker) {
+        memset (stats, 0, sizeof (*stats));
+        nn_worker_getstats (self->ctx.worker, stats);
+        return;
+    }
+    nn_pool_getstats (nn_global_getpool (), stats);
+}
+
+int nn_sock_stat_get (struct nn_sock *self, int name, uint64_t *value)
+{
+    int i;
+    uint64_t val;
+    struct nn_worker_stats wstats;
+    struct nn_mutex_stats mstats;
+
+    switch (name) {
+    case NN_STAT_ESTABLISHED_CONNECTIONS:
+        *value = self->statistics.established_connections;
+        return 0;
+    case NN_STAT_ACCEPTED_CONNECTIONS:
+        *value = self->statistics.accepted_connections;
+        return 0;
+    case NN_STAT_DROPPED_CONNECTIONS:
+        *value = self->statistics.dropped_connections;
+        return 0;
+    case NN_STAT_BROKEN_CONNECTIONS:
+        *value = self->statistics.broken_connections;
+        return 0;
+    case NN_STAT_CONNECT_ERRORS:
+        *value = self->statistics.connect_errors;
+        return 0;
+    case NN_STAT_BIND_ERRORS:
+        *value = self->statistics.bind_errors;
+        return 0;
+    case NN_STAT_ACCEPT_ERRORS:
+        *value = self->statistics.accept_errors;
+        return 0;
+    case NN_STAT_DROPPED_MESSAGES:
+        *value = self->statistics.dropped_messages;
+        return 0;
+    case NN_STAT_EXPIRED_MESSAGES:
+        *value = self->statistics.expired_messages;
+        return 0;
+    case NN_STAT_MESSAGES_SENT:
+        for (val = 0, i = 0; i != NN_SOCK_STAT_SHARDS; ++i)
+            val += self->stat_shards [i].messages_sent;
+        *value = val;
+        return 0;
+    case NN_STAT_MESSAGES_RECEIVED:
+        for (val = 0, i = 0; i != NN_SOCK_STAT_SHARDS; ++i)
+            val += self->stat_shards [i].messages_received;
+        *value = val;
+        return 0;
+    case NN_STAT_BYTES_SENT:
+        for (val = 0, i = 0; i != NN_SOCK_STAT_SHARDS; ++i)
+            val += self->stat_shards [i].bytes_sent;
+        *value = val;
+        return 0;
+    case NN_STAT_BYTES_RECEIVED:
+        for (val = 0, i = 0; i != NN_SOCK_STAT_SHARDS; ++i)
+            val += self->stat_shards [i].bytes_received;
+        *value = val;
+        return 0;
+    case NN_STAT_CURRENT_CONNECTIONS:
+        *value = self->statistics.current_connections;
+        return 0;
+    case NN_STAT_INPROGRESS_CONNECTIONS:
+        *value = self->statistics.inprogress_connections;
+        return 0;
+    case NN_STAT_CURRENT_SND_PRIORITY:
+        *value = self->statistics.current_snd_priority;
+        return 0;
+    case NN_STAT_CURRENT_EP_ERRORS:
+        *value = self->statistics.current_ep_errors;
+        return 0;
+    case NN_STAT_ALLOCATED_BYTES:
+        *value = sizeof (struct nn_sock) +
+            nn_alloc_acct_bytes (self->ctx.acct);
+        return 0;
+    case NN_STAT_SEND_WAIT_P50:
+    case NN_STAT_SEND_WAIT_P99:
+    case NN_STAT_SEND_WAIT_P999:
+    case NN_STAT_SEND_WAIT_MAX:
+        i = NN_SOCKBASE_LATENCY_SNDWAIT;
+        break;
+    case NN_STAT_RECV_DELAY_P50:
+    case NN_STAT_RECV_DELAY_P99:
+    case NN_STAT_RECV_DELAY_P999:
+    case NN_STAT_RECV_DELAY_MAX:
+        i = NN_SOCKBASE_LATENCY_RCVDELAY;
+        break;
+    case NN_STAT_RTT_P50:
+    case NN_STAT_RTT_P99:
+    case NN_STAT_RTT_P999:
+    case NN_STAT_RTT_MAX:
+        i = NN_SOCKBASE_LATENCY_RTT;
+        break;
+    case NN_STAT_WORKER_WAITS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.waits;
+        return 0;
+    case NN_STAT_WORKER_EVENTS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.events;
+        return 0;
+    case NN_STAT_WORKER_TASKS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.tasks;
+        return 0;
+    case NN_STAT_WORKER_TIMERS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.timers;
+        return 0;
+    case NN_STAT_WORKER_BUSY_TIME:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.busy_time;
+        return 0;
+    case NN_STAT_WORKER_WAIT_TIME:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.wait_time;
+        return 0;
+    case NN_STAT_WORKER_MAX_EVENTS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.max_events;
+        return 0;
+    case NN_STAT_WORKER_MAX_TASKS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.max_tasks;
+        return 0;
+    case NN_STAT_WORKER_LOCK_CONTENTIONS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.lock_contentions;
+        return 0;
+    case NN_STAT_WORKER_MIGRATIONS:
+        nn_sock_stat_worker (self, &wstats);
+        *value = wstats.migrations;
+        return 0;
+    case NN_STAT_LOCK_CONTENTIONS:
+    case NN_STAT_LOCK_PARKS:
+        mstats.contentions = 0;
+        mstats.parks = 0;
+        nn_mutex_getstats (&self->ctx.sync, &mstats);
+        *value = name == NN_STAT_LOCK_CONTENTIONS ?
+            mstats.contentions : mstats.parks;
         return 0;
-    case NN_SOCK_STATE_STOPPING:
-    case NN_SOCK_STATE_STOPPING_EPS:
-    case NN_SOCK_STATE_FINI:
     default:
-        return -EBADF;
+        return -EINVAL;
+    }
+
+    /*  Statistics derived from a latency histogram. They are numbered
+        P50, P99, P999 and MAX within each group. */
+    switch (name % 10) {
+    case 1:
+        *value = nn_sock_stat_latency (self, i, 500);
+        break;
+    case 2:
+        *value = nn_sock_stat_latency (self, i, 990);
+        break;
+    case 3:
+        *value = nn_sock_stat_latency (self, i, 999);
+        break;
+    default:
+        *value = nn_sock_stat_latency (self, i, 1000);
+        break;
     }
+    return 0;
 }
 
-void nn_sock_rele (struct nn_sock *self)
+int nn_sock_ep_stat_get (struct nn_sock *self, int eid, int name,
+    uint64_t *value)
 {
-    self->holds--;
-    if (self->holds == 0) {
-        nn_sem_post (&self->relesem);
+    int rc;
+    struct nn_list_item *it;
+    struct nn_ep *ep;
+
+    nn_ctx_enter (&self->ctx);
+    rc = -EINVAL;
+    for (it = nn_list_begin (&self->eps);
+          it != nn_list_end (&self->eps);
+          it = nn_list_next (&self->eps, it)) {
+        ep = nn_cont (it, struct nn_ep, item);
+        if (ep->eid == eid) {
+            rc = nn_ep_stat_get (ep, name, value);
+            break;
+        }
     }
+    nn_ctx_leave (&self->ctx);
+
+    return rc;
+}
+
+int nn_sock_pipe_stat_get (struct nn_sock *self, int prev,
+    struct nn_pipe_stat *stat)
+{
+    struct nn_list_item *it;
+    struct nn_pipebase *pipe;
+    struct nn_pipebase *next;
+
+    nn_ctx_enter (&self->ctx);
+
+    /*  The pipes come and go, hence the lookup by ID rather than by
+        position in the list. */
+    next = NULL;
+    for (it = nn_list_begin (&self->pipes);
+          it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        pipe = nn_cont (it, struct nn_pipebase, item);
+        if (pipe->id > prev && (!next || pipe->id < next->id))
+            next = pipe;
+    }
+    if (!next) {
+        nn_ctx_leave (&self->ctx);
+        return -ENOENT;
+    }
+
+    stat->id = next->id;
+    stat->eid = next->eid;
+    stat->messages_sent = next->statistics.messages_sent;
+    stat->messages_received = next->statistics.messages_received;
+    stat->bytes_sent = next->statistics.bytes_sent;
+    stat->bytes_received = next->statistics.bytes_received;
+    stat->queued = next->vfptr->queued (next);
+    stat->blocked_time = next->statistics.blocked_time;
+    if (nn_pipebase_blocked (next))
+        stat->blocked_time += nn_clock_us () - next->statistics.blocked_since;
+
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
+}
+
+void nn_sock_rele (struct nn_sock *self)
+{
+    nn_sem_post (&self->relesem);
 }
@@ -29,57 +29,218 @@
 
 #include "../aio/ctx.h"
 #include "../aio/fsm.h"
+#include "../aio/timer.h"
 
+#include "../utils/atomic.h"
 #include "../utils/efd.h"
 #include "../utils/sem.h"
 #include "../utils/list.h"
+#include "../utils/hist.h"
 
 struct nn_pipe;
+struct nn_async;
+struct nn_msgqueue;
+struct nn_rcvring;
+
+/*  Receiver of socket readiness notifications. It allows in-library code,
+    such as devices, to use the socket without a thread blocked in it. */
+struct nn_sock_hook {
+
+    /*  Invoked from within the socket context when the socket becomes
+        readable or writable, and when the socket is being closed. It must
+        not enter any other context. */
+    void (*fn) (struct nn_sock_hook *self);
+
+    /*  Events the hook was already notified about. Once notified about
+        an event, the hook is not notified again until a non-blocking recv
+        or send on the socket fails with EAGAIN. */
+    int events;
+};
 
 /*  The maximum implemented transport ID. */
-#define NN_MAX_TRANSPORT 4
+#define NN_MAX_TRANSPORT 10
+
+/*  The maximum number of standby connections of an endpoint. */
+#define NN_MAX_STANDBY 16
+
+/*  Number of cache lines the per-message statistics are spread over. */
+#define NN_SOCK_STAT_SHARD_BITS 3
+#define NN_SOCK_STAT_SHARDS (1 << NN_SOCK_STAT_SHARD_BITS)
+#define NN_SOCK_CACHELINE 64
+
+struct nn_sock_stat_shard {
+    /*  Messages sent  */
+    uint64_t messages_sent;
+    /*  Messages received  */
+    uint64_t messages_received;
+    /*  Bytes sent (sum length of data in messages sent)  */
+    uint64_t bytes_sent;
+    /*  Bytes recevied (sum length of data in messages received)  */
+    uint64_t bytes_received;
+
+    uint8_t padding [NN_SOCK_CACHELINE - 4 * sizeof (uint64_t)];
+};
 
+/*  The members of the socket are laid out in three groups separated by
+    a cache line of padding, so that no cache line is shared by two of
+    them:
+
+      - members read by threads that haven't entered the socket's context,
+        such as the ones spinning on 'events', written rarely;
+      - the context along with the state send and receive use while in it,
+        written by every thread entering the context;
+      - the rest, used when creating, configuring or closing the socket. */
 struct nn_sock
 {
-    /*  Socket state machine. */
-    struct nn_fsm fsm;
-    int state;
-
-    /*  Pointer to the instance of the specific socket type. */
-    struct nn_sockbase *sockbase;
+    /*****  Read without entering the context  *****/
 
     /*  Pointer to the socket type metadata. */
     const struct nn_socktype *socktype;
 
-    int flags;
+    /*  Copy of the NN_SOCK_FLAG_RCVFD and NN_SOCK_FLAG_SNDFD bits of 'flags'.
+        Once set, the efds are there till the socket is deallocated, so the
+        options can be retrieved without entering the context. */
+    struct nn_atomic fdflags;
 
-    struct nn_ctx ctx;
+    /*  Events the socket had when its context was last left, or -1 if not
+        known. Used by threads that look at the socket without entering
+        its context. */
+    volatile int events;
+
+    /*  Hook notified about readiness changes, if any. */
+    struct nn_sock_hook *hook;
+
+    /*  Set by NN_SINGLE_THREAD. The inbound messages are then moved from
+        the protocol to 'rcvqueue' whenever the context is left, so that
+        the owning thread can pick them up without entering the context.
+        The queue is allocated once the option is first set. */
+    int single;
+    struct nn_msgqueue *rcvqueue;
+
+    /*  Created by nn_rcvring_open, if ever. */
+    struct nn_rcvring *rcvring;
+
+    /*  Created on the first blocking send/recv or NN_SNDFD/NN_RCVFD query. */
     struct nn_efd sndfd;
     struct nn_efd rcvfd;
+
+    char pad1 [NN_SOCK_CACHELINE];
+
+    /*****  Used by send and recv within the context  *****/
+
+    struct nn_ctx ctx;
+
+    /*  Pointer to the instance of the specific socket type. */
+    struct nn_sockbase *sockbase;
+
+    int flags;
+
+    /*  Number of threads blocked in send and recv, respectively. */
+    int sndwaiters;
+    int rcvwaiters;
+
+    /*  Socket-level socket options used by every send or recv. */
+    int sndtimeo;
+    int rcvtimeo;
+    int rcvspin;
+    int msgttl;
+    int sndrate_msgs;
+    int sndrate_bytes;
+
+    /*  Token buckets of NN_SNDRATE_MSGS and NN_SNDRATE_BYTES, in millionths
+        of a message and of a byte respectively, as last refilled at
+        'sndrate_stamp' (in microseconds). They go negative when a message
+        larger than the bucket is let through. While a message waits for
+        the tokens, the socket is not writable and 'sndrate_timer' runs
+        till the tokens for a message of 'sndrate_pending' bytes are there. */
+    int64_t sndrate_mtokens;
+    int64_t sndrate_btokens;
+    uint64_t sndrate_stamp;
+    size_t sndrate_pending;
+
+    /*  Size of the message being sent in pieces (NN_MSG_PIECE) and
+        the number of bytes of it sent so far, both 0 if there's none. */
+    struct nn_msg_piece sndpiece;
+
+    /*  Body of the message last returned by nn_recvborrow. It is kept till
+        the next call or till the socket is closed. */
+    struct nn_chunkref borrowed;
+
+    /*  Message held back by nn_sock_recvbudget because it didn't fit. It's
+        the first one to be received next. */
+    struct nn_msg held;
+
+    /*  The message and byte counters are updated by every nn_send and
+        nn_recv. They are spread over NN_SOCK_STAT_SHARDS cache lines, each
+        thread updating the one its shard index maps to, and summed up when
+        they are read. 'stat_shards_mem' is the unaligned allocation. */
+    struct nn_sock_stat_shard *stat_shards;
+    void *stat_shards_mem;
+
+    char pad2 [NN_SOCK_CACHELINE];
+
+    /*****  Used when the socket is set up or torn down  *****/
+
+    /*  Socket state machine. */
+    struct nn_fsm fsm;
+    int state;
+
     struct nn_sem termsem;
     struct nn_sem relesem;
 
+    /*  Set once 'termsem' was found posted by nn_sock_tryterm. */
+    int termed;
+
+    /*  Asynchronous operations on the socket, created along with their
+        hook when the first one is submitted. */
+    struct nn_async *async;
+
     /*  List of all endpoints associated with the socket. */
     struct nn_list eps;
 
     /*  List of all endpoint being in the process of shutting down. */
     struct nn_list sdeps;
 
+    /*  Groups of pipes that are presented to the protocol as single pipes. */
+    struct nn_list pipegroups;
+
+    /*  All the pipes passed to the protocol. Once nn_close() is called,
+        they are waited for to get rid of their outbound messages for up to
+        NN_LINGER milliseconds, measured by 'linger_timer'. 'drained' is
+        posted to find out whether they're done. */
+    struct nn_list pipes;
+    struct nn_timer linger_timer;
+    struct nn_fsm_event drained;
+
     /*  Next endpoint ID to assign to a new endpoint. */
     int eid;
 
-    /*  Count of active holds against the socket. */
-    int holds;
+    /*  Next ID to assign to a pipe passed to the protocol. */
+    int pipeid;
 
-    /*  Socket-level socket options. */
+    /*  The rest of the socket-level socket options. */
     int sndbuf;
     int rcvbuf;
     int rcvmaxsize;
-    int sndtimeo;
-    int rcvtimeo;
+    int rcvpiece;
+    int sndqueue_msgs;
+    int sndqueue_bytes;
     int reconnect_ivl;
     int reconnect_ivl_max;
     int maxttl;
+    int worker;
+    int linger;
+    int sndrate_burst;
+    int heartbeat_ivl;
+    int warmup_size;
+    int warmup_msgs;
+    int rcvtimestamp;
+
+    /*  Timer waiting for the tokens of the send rate limit. */
+    struct nn_timer sndrate_timer;
+
+    /*  The set of workers given by NN_WORKERS, in its textual form. */
+    char workers [64];
 
     /*  Endpoint-specific options.  */
     struct nn_ep_options ep_template;
@@ -105,15 +266,12 @@ struct nn_sock
         uint64_t bind_errors;
         /*  Errors accepting connections at nn_bind()'ed endpoint  */
         uint64_t accept_errors;
+        /*  Messages discarded by the protocol, e.g. for slow peers  */
+        uint64_t dropped_messages;
+        /*  Messages discarded because their time to live elapsed  */
+        uint64_t expired_messages;
 
-        /*  Messages sent  */
-        uint64_t messages_sent;
-        /*  Messages received  */
-        uint64_t messages_received;
-        /*  Bytes sent (sum length of data in messages sent)  */
-        uint64_t bytes_sent;
-        /*  Bytes recevied (sum length of data in messages received)  */
-        uint64_t bytes_received;
+        /*  Message and byte counters are kept in 'stat_shards'.  */
 
         /*****  Level-style values *****/
 
@@ -128,6 +286,11 @@ struct nn_sock
 
     } statistics;
 
+    /*  Latency histograms, indexed by NN_SOCKBASE_LATENCY_* constants. They
+        are allocated when the first sample is recorded and updated from
+        within the socket context. */
+    struct nn_hist *latencies [NN_SOCKBASE_LATENCIES];
+
     /*  The socket name for statistics  */
     char socket_name[64];
 
@@ -150,6 +313,11 @@ void nn_sock_stop (struct nn_sock *self);
     and can return -EINTR. */
 int nn_sock_term (struct nn_sock *self);
 
+/*  Same as nn_sock_term, except that it returns -EAGAIN instead of blocking
+    if the socket is not done stopping yet. It can be called repeatedly and
+    finished by nn_sock_term. */
+int nn_sock_tryterm (struct nn_sock *self);
+
 /*  Called by sockbase when stopping is done. */
 void nn_sock_stopped (struct nn_sock *self);
 
@@ -164,6 +332,11 @@ int nn_sock_ispeer (struct nn_sock *self, int socktype);
 int nn_sock_add_ep (struct nn_sock *self, struct nn_transport *transport,
     int bind, const char *addr);
 
+/*  Add naddrs endpoints to the socket at once. Either all of them are
+    created, their IDs stored in eids unless it's NULL, or none is. */
+int nn_sock_add_eps (struct nn_sock *self, struct nn_transport **transports,
+    const char **addrs, int naddrs, int bind, int *eids);
+
 /*  Remove the endpoint with the specified ID from the socket. */
 int nn_sock_rm_ep (struct nn_sock *self, int eid);
 
@@ -173,6 +346,51 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags);
 /*  Receive a message from the socket. */
 int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags);
 
+/*  Send up to 'count' messages to the socket while holding the socket lock
+    except when waiting. Unless NN_DONTWAIT is set, each message is waited
+    for in turn, with a single SNDTIMEO deadline for the whole batch. Returns
+    the number of messages sent, or a negative error if the first one could
+    not be sent. Messages that were sent are moved out of the array. */
+int nn_sock_sendmany (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags);
+
+/*  Receive up to 'count' messages from the socket. Only the first message
+    is waited for; the rest are received as long as that is possible without
+    blocking. Returns the number of messages received or a negative error
+    if there was none. */
+int nn_sock_recvmany (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags);
+
+/*  Same as nn_sock_recvmany, except that messages are received only while
+    their payloads, each counted 'overhead' bytes larger, add up to no more
+    than 'budget' bytes. The message that would exceed the budget is kept
+    by the socket and is the first one to be received by the next call.
+    If it's the first message of the call, -EMSGSIZE is returned. A budget
+    of NN_MSG means there's no limit. */
+int nn_sock_recvbudget (struct nn_sock *self, struct nn_msg *msgs, int count,
+    size_t budget, size_t overhead, int flags);
+
+/*  Takes up to 'count' messages from the receive queue of a NN_SINGLE_THREAD
+    socket without entering the context, unless a message has expired.
+    Only to be called by the owning thread. Returns the number of messages
+    taken, 0 if the queue is empty. */
+int nn_sock_recvqueued (struct nn_sock *self, struct nn_msg *msgs, int count);
+
+/*  Returns the receive ring of the socket, creating it if needed. It makes
+    the socket NN_SINGLE_THREAD. */
+int nn_sock_openring (struct nn_sock *self, struct nn_rcvring **ring);
+
+/*  Sets the hook of the socket, or clears it if 'hook' is NULL. The hook is
+    notified straight away about the events the socket already has. Returns
+    -EBUSY if the socket already has a hook, or -EBADF if it's being closed.
+    A hook can be cleared even from a socket that is being closed. */
+int nn_sock_sethook (struct nn_sock *self, struct nn_sock_hook *hook);
+
+/*  Returns the events the socket has at the moment, or -EBADF if it's
+    being closed. If the hook lacks some of 'events', it's notified once
+    they show up. */
+int nn_sock_events (struct nn_sock *self, int events);
+
 /*  Set a socket option. */
 int nn_sock_setopt (struct nn_sock *self, int level, int option,
     const void *optval, size_t optvallen);
@@ -181,6 +399,12 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
 int nn_sock_getopt (struct nn_sock *self, int level, int option,
     void *optval, size_t *optvallen);
 
+/*  Retrieve one of the options that don't require entering the socket
+    context. Returns -EAGAIN if the option is not one of them, in which case
+    nn_sock_getopt is to be used instead. */
+int nn_sock_getopt_fast (struct nn_sock *self, int level, int option,
+    void *optval, size_t *optvallen);
+
 /*  Retrieve a socket option. This function is to be called from within
     the socket. */
 int nn_sock_getopt_inner (struct nn_sock *self, int level, int option,
@@ -190,12 +414,39 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level, int option,
 int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe);
 void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe);
 
+/*  Called when some of the pipe's outbound messages were written to the
+    network. Does nothing unless the socket is lingering. */
+void nn_sock_drained (struct nn_sock *self);
+
 /*  Monitoring callbacks  */
 void nn_sock_report_error(struct nn_sock *self, struct nn_ep *ep,  int errnum);
 void nn_sock_stat_increment(struct nn_sock *self, int name, int64_t increment);
 
-/*  Holds and releases. */
-int nn_sock_hold (struct nn_sock *self);
+/*  Add a sample to a latency histogram. Must be called from within
+    the socket context. */
+void nn_sock_stat_record (struct nn_sock *self, int latency, uint64_t value);
+
+/*  Returns a percentile, in thousandths, of a latency histogram, 0 if there
+    are no samples. Must be called from within the socket context. */
+uint64_t nn_sock_stat_latency (struct nn_sock *self, int latency,
+    int permille);
+
+/*  Retrieve the current value of a statistic. Returns -EINVAL if there's no
+    such statistic. */
+int nn_sock_stat_get (struct nn_sock *self, int name, uint64_t *value);
+
+/*  Retrieve the value of a statistic of the endpoint with the specified ID.
+    Returns -EINVAL if there's no such endpoint or statistic. */
+int nn_sock_ep_stat_get (struct nn_sock *self, int eid, int name,
+    uint64_t *value);
+
+/*  Fill in the statistics of the pipe with the lowest ID greater than
+    'prev'. Returns -ENOENT if there's none. */
+int nn_sock_pipe_stat_get (struct nn_sock *self, int prev,
+    struct nn_pipe_stat *stat);
+
+/*  Called once the socket is stopped and the last hold on it is released.
+    Holds themselves are maintained by the global socket table. */
 void nn_sock_rele (struct nn_sock *self);
 
 #endif
@@ -60,3 +60,15 @@ void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
 {
     nn_sock_stat_increment (self->sock, name, increment);
 }
+
+void nn_sockbase_stat_record (struct nn_sockbase *self, int latency,
+    uint64_t value)
+{
+    nn_sock_stat_record (self->sock, latency, value);
+}
+
+uint64_t nn_sockbase_stat_latency (struct nn_sockbase *self, int latency,
+    int permille)
+{
+    return nn_sock_stat_latency (self->sock, latency, permille);
+}
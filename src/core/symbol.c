@@ -27,6 +27,7 @@
 
 #include "../inproc.h"
 #include "../ipc.h"
+#include "../shm.h"
 #include "../tcp.h"
 
 #include "../pair.h"
@@ -36,6 +37,11 @@
 #include "../survey.h"
 #include "../bus.h"
 #include "../ws.h"
+#include "../udp.h"
+#include "../tls.h"
+#include "../rdma.h"
+#include "../tcpmux.h"
+#include "../sim.h"
 
 #include <string.h>
 
@@ -70,6 +76,7 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_UNIT_BOOLEAN, OPTION_UNIT, NONE, NONE),
     NN_SYM(NN_UNIT_COUNTER, OPTION_UNIT, NONE, NONE),
     NN_SYM(NN_UNIT_MESSAGES, OPTION_UNIT, NONE, NONE),
+    NN_SYM(NN_UNIT_MICROSECONDS, OPTION_UNIT, NONE, NONE),
 
     NN_SYM(NN_VERSION_CURRENT, VERSION, NONE, NONE),
     NN_SYM(NN_VERSION_REVISION, VERSION, NONE, NONE),
@@ -79,20 +86,52 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(AF_SP_RAW, DOMAIN, NONE, NONE),
 
     NN_SYM(NN_INPROC, TRANSPORT, NONE, NONE),
+    NN_SYM(NN_SIM, TRANSPORT, NONE, NONE),
+#if defined NN_HAVE_IPC
     NN_SYM(NN_IPC, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_TCP
     NN_SYM(NN_TCP, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_WS
     NN_SYM(NN_WS, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_SHM
+    NN_SYM(NN_SHM, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_UDP
+    NN_SYM(NN_UDP, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_TLS
+    NN_SYM(NN_TLS, TRANSPORT, NONE, NONE),
+#endif
+#if defined NN_HAVE_RDMA
+    NN_SYM(NN_RDMA, TRANSPORT, NONE, NONE),
+    NN_SYM(NN_TCPMUX, TRANSPORT, NONE, NONE),
+#endif
 
+#if defined NN_HAVE_PAIR
     NN_SYM(NN_PAIR, PROTOCOL, NONE, NONE),
+#endif
+#if defined NN_HAVE_PUBSUB
     NN_SYM(NN_PUB, PROTOCOL, NONE, NONE),
     NN_SYM(NN_SUB, PROTOCOL, NONE, NONE),
+#endif
+#if defined NN_HAVE_REQREP
     NN_SYM(NN_REP, PROTOCOL, NONE, NONE),
     NN_SYM(NN_REQ, PROTOCOL, NONE, NONE),
+#endif
+#if defined NN_HAVE_PIPELINE
     NN_SYM(NN_PUSH, PROTOCOL, NONE, NONE),
     NN_SYM(NN_PULL, PROTOCOL, NONE, NONE),
+#endif
+#if defined NN_HAVE_SURVEY
     NN_SYM(NN_SURVEYOR, PROTOCOL, NONE, NONE),
     NN_SYM(NN_RESPONDENT, PROTOCOL, NONE, NONE),
+#endif
+#if defined NN_HAVE_BUS
     NN_SYM(NN_BUS, PROTOCOL, NONE, NONE),
+#endif
 
     NN_SYM(NN_SOCKADDR_MAX, LIMIT, NONE, NONE),
 
@@ -115,17 +154,139 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_IPV4ONLY, SOCKET_OPTION, INT, BOOLEAN),
     NN_SYM(NN_SOCKET_NAME, SOCKET_OPTION, STR, NONE),
     NN_SYM(NN_MAXTTL, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_WORKER, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_RCVSPIN, SOCKET_OPTION, INT, MICROSECONDS),
+    NN_SYM(NN_SNDQUEUE_MSGS, SOCKET_OPTION, INT, MESSAGES),
+    NN_SYM(NN_SNDQUEUE_BYTES, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_MSGTTL, SOCKET_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_RCVWEIGHT, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_RCVPOOL, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_WORKERS, SOCKET_OPTION, STR, NONE),
+    NN_SYM(NN_RCVPIECE, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_SNDRATE_MSGS, SOCKET_OPTION, INT, MESSAGES),
+    NN_SYM(NN_SNDRATE_BYTES, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_SNDRATE_BURST, SOCKET_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_HEARTBEAT_IVL, SOCKET_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_WARMUP_SIZE, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_WARMUP_MSGS, SOCKET_OPTION, INT, MESSAGES),
+    NN_SYM(NN_RCVTIMESTAMP, SOCKET_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_IDLE_TIMEOUT, SOCKET_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_MAXCONN, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_STANDBY, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_SINGLE_THREAD, SOCKET_OPTION, INT, BOOLEAN),
 
+#if defined NN_HAVE_PUBSUB
     NN_SYM(NN_SUB_SUBSCRIBE, TRANSPORT_OPTION, STR, NONE),
     NN_SYM(NN_SUB_UNSUBSCRIBE, TRANSPORT_OPTION, STR, NONE),
+#endif
+#if defined NN_HAVE_REQREP
     NN_SYM(NN_REQ_RESEND_IVL, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_REQ_MAXINFLIGHT, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_ID, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_LB, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_STICKY, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_HEDGE_IVL, TRANSPORT_OPTION, INT, MILLISECONDS),
+#endif
+#if defined NN_HAVE_PIPELINE
+    NN_SYM(NN_PUSH_LB, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_PUSH_SPOOL, TRANSPORT_OPTION, STR, NONE),
+    NN_SYM(NN_PUSH_SPOOL_SIZE, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_PUSH_SEQUENCE, TRANSPORT_OPTION, INT, BOOLEAN),
+#endif
+#if defined NN_HAVE_REQREP
+    NN_SYM(NN_REP_FQ, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REP_CACHE, TRANSPORT_OPTION, INT, MESSAGES),
+    NN_SYM(NN_REP_MAXOUTSTANDING, TRANSPORT_OPTION, INT, MESSAGES),
+#endif
+#if defined NN_HAVE_PIPELINE
+    NN_SYM(NN_PULL_FQ, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_PULL_SEQUENCE, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_PULL_REORDER, TRANSPORT_OPTION, INT, MESSAGES),
+#endif
+#if defined NN_HAVE_BUS
+    NN_SYM(NN_BUS_DEDUP, TRANSPORT_OPTION, INT, MESSAGES),
+#endif
+#if defined NN_HAVE_SURVEY
     NN_SYM(NN_SURVEYOR_DEADLINE, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_SURVEYOR_MAXSURVEYS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_SURVEYOR_ID, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_RESPONDENT_MAXOUTSTANDING, TRANSPORT_OPTION, INT, MESSAGES),
+#endif
+#if defined NN_HAVE_TCP
     NN_SYM(NN_TCP_NODELAY, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_RCVBATCH, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_TCP_ZEROCOPY, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_TCP_LISTENERS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_BUSY_POLL, TRANSPORT_OPTION, INT, MICROSECONDS),
+    NN_SYM(NN_TCP_QUICKACK, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_PRIORITY, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_TOS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_NOTSENT_LOWAT, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_TCP_INCOMING_CPU, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_CORK, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_STRIPES, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_STRIPE_ORDERED, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_COMPRESS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_COMPRESS_THRESHOLD, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_TCP_BATCH, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_TCP_FASTOPEN, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_CHECKSUM, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_BULK_THRESHOLD, TRANSPORT_OPTION, INT, BYTES),
+#endif
+#if defined NN_HAVE_IPC
+    NN_SYM(NN_IPC_RCVBATCH, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_IPC_SEQPACKET, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_IPC_COMPRESS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_IPC_COMPRESS_THRESHOLD, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_IPC_BATCH, TRANSPORT_OPTION, INT, BYTES),
+#endif
+#if defined NN_HAVE_SHM
+    NN_SYM(NN_SHM_BUFSZ, TRANSPORT_OPTION, INT, BYTES),
+#endif
+#if defined NN_HAVE_UDP
+    NN_SYM(NN_UDP_TTL, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_UDP_LOOPBACK, TRANSPORT_OPTION, INT, BOOLEAN),
+#endif
+#if defined NN_HAVE_TLS
+    NN_SYM(NN_TLS_CERT_FILE, TRANSPORT_OPTION, STR, NONE),
+    NN_SYM(NN_TLS_KEY_FILE, TRANSPORT_OPTION, STR, NONE),
+    NN_SYM(NN_TLS_CA_FILE, TRANSPORT_OPTION, STR, NONE),
+    NN_SYM(NN_TLS_VERIFY, TRANSPORT_OPTION, INT, BOOLEAN),
+#endif
+#if defined NN_HAVE_RDMA
+    NN_SYM(NN_RDMA_BUFSZ, TRANSPORT_OPTION, INT, BYTES),
+    NN_SYM(NN_RDMA_BUFS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_RDMA_GID_INDEX, TRANSPORT_OPTION, INT, NONE),
+#endif
+#if defined NN_HAVE_WS
     NN_SYM(NN_WS_MSG_TYPE, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_WS_DEFLATE, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_WS_DEFLATE_WINDOW_BITS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER, TRANSPORT_OPTION, INT, NONE),
+#endif
+    NN_SYM(NN_SIM_DELAY, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_SIM_JITTER, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_SIM_BANDWIDTH, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_SIM_LOSS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_SIM_SEED, TRANSPORT_OPTION, INT, NONE),
 
     NN_SYM(NN_DONTWAIT, FLAG, NONE, NONE),
+#if defined NN_HAVE_WS
     NN_SYM(NN_WS_MSG_TYPE_TEXT, FLAG, NONE, NONE),
     NN_SYM(NN_WS_MSG_TYPE_BINARY, FLAG, NONE, NONE),
+#endif
+#if defined NN_HAVE_TCP
+    NN_SYM(NN_TCP_COMPRESS_LZ4, FLAG, NONE, NONE),
+    NN_SYM(NN_TCP_COMPRESS_ZSTD, FLAG, NONE, NONE),
+#endif
+#if defined NN_HAVE_IPC
+    NN_SYM(NN_IPC_COMPRESS_LZ4, FLAG, NONE, NONE),
+    NN_SYM(NN_IPC_COMPRESS_ZSTD, FLAG, NONE, NONE),
+#endif
+    NN_SYM(NN_LB_ROUNDROBIN, FLAG, NONE, NONE),
+    NN_SYM(NN_LB_LEASTLOADED, FLAG, NONE, NONE),
+    NN_SYM(NN_FQ_ROUNDROBIN, FLAG, NONE, NONE),
+    NN_SYM(NN_FQ_DEFICIT, FLAG, NONE, NONE),
 
     NN_SYM(NN_POLLIN, EVENT, NONE, NONE),
     NN_SYM(NN_POLLOUT, EVENT, NONE, NONE),
@@ -177,7 +338,34 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_STAT_CURRENT_CONNECTIONS, STATISTIC, INT, NONE),
     NN_SYM(NN_STAT_INPROGRESS_CONNECTIONS, STATISTIC, INT, NONE),
     NN_SYM(NN_STAT_CURRENT_SND_PRIORITY, STATISTIC, INT, PRIORITY),
-    NN_SYM(NN_STAT_CURRENT_EP_ERRORS, STATISTIC, INT, NONE)
+    NN_SYM(NN_STAT_DROPPED_MESSAGES, STATISTIC, INT, MESSAGES),
+    NN_SYM(NN_STAT_EXPIRED_MESSAGES, STATISTIC, INT, MESSAGES),
+    NN_SYM(NN_STAT_CURRENT_EP_ERRORS, STATISTIC, INT, NONE),
+    NN_SYM(NN_STAT_ALLOCATED_BYTES, STATISTIC, INT, BYTES),
+    NN_SYM(NN_STAT_SEND_WAIT_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_WAIT_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_WAIT_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_WAIT_MAX, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_DELAY_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_DELAY_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_DELAY_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_DELAY_MAX, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RTT_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RTT_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RTT_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RTT_MAX, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_WORKER_WAITS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_WORKER_EVENTS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_WORKER_TASKS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_WORKER_TIMERS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_WORKER_BUSY_TIME, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_WORKER_WAIT_TIME, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_WORKER_MAX_EVENTS, STATISTIC, INT, NONE),
+    NN_SYM(NN_STAT_WORKER_MAX_TASKS, STATISTIC, INT, NONE),
+    NN_SYM(NN_STAT_WORKER_LOCK_CONTENTIONS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_WORKER_MIGRATIONS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_LOCK_CONTENTIONS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_LOCK_PARKS, STATISTIC, INT, COUNTER)
 };
 
 const int SYM_VALUE_NAMES_LEN = (sizeof (sym_value_names) /
@@ -22,16 +22,170 @@
 */
 
 #include "../nn.h"
+#include "../pubsub.h"
 
 #include "../utils/err.h"
 #include "../utils/fast.h"
 #include "../utils/fd.h"
 #include "../utils/attr.h"
+#include "../utils/cont.h"
+#include "../utils/alloc.h"
+#include "../utils/clock.h"
 #include "../utils/thread.h"
 #include "device.h"
+#include "splice.h"
 
 #include <string.h>
 
+/*  Maximum number of messages moved by a single nn_device_mvmsg call. */
+#define NN_DEVICE_BATCH 32
+
+/*  How often, in milliseconds, the thread-based one-way device relays
+    the subscriptions. */
+#define NN_DEVICE_SUBSCRIBE_IVL 100
+
+/*  Initial size of the buffer the subscriptions are copied to. */
+#define NN_DEVICE_SUBS_BUFSZ 1024
+
+/*  Returns 1 if messages are forwarded from a SUB socket to a PUB one,
+    0 if not, -1 on error. */
+static int nn_device_ispubsub (int from, int to)
+{
+    int rc;
+    int op1;
+    int op2;
+    size_t opsz;
+
+    opsz = sizeof (op1);
+    rc = nn_getsockopt (from, NN_SOL_SOCKET, NN_PROTOCOL, &op1, &opsz);
+    if (nn_slow (rc != 0))
+        return -1;
+    nn_assert (opsz == sizeof (op1));
+    opsz = sizeof (op2);
+    rc = nn_getsockopt (to, NN_SOL_SOCKET, NN_PROTOCOL, &op2, &opsz);
+    if (nn_slow (rc != 0))
+        return -1;
+    nn_assert (opsz == sizeof (op2));
+    return op1 == NN_SUB && op2 == NN_PUB ? 1 : 0;
+}
+
+/*  Whether the splice is to relay the subscriptions itself. It does so as
+    the default relay function would, only without polling. */
+static int nn_device_splice_subscribe (struct nn_device_recipe *device,
+    int s1, int s2, int twoway)
+{
+    if (twoway || s1 == s2 || device->nn_device_subscribe == NULL)
+        return 0;
+    return nn_device_ispubsub (s1, s2);
+}
+
+/*  Devices that forward the messages unchanged are spliced within the library
+    rather than by threads moving each message through the socket API.
+    Returns 0 if splicing is not possible and the device should fall back
+    to the thread-based forwarding. */
+static int nn_device_splice (struct nn_device_recipe *device,
+    int s1, int s2, int twoway)
+{
+    int rc;
+    int subscribe;
+
+    if (device->nn_device_mvmsg != nn_device_mvmsg ||
+          device->nn_device_rewritemsg != nn_device_rewritemsg ||
+          (device->nn_device_subscribe != nn_device_subscribe &&
+          device->nn_device_subscribe != NULL))
+        return 0;
+    subscribe = nn_device_splice_subscribe (device, s1, s2, twoway);
+    if (nn_slow (subscribe < 0))
+        return -1;
+
+    /*  A socket can be spliced only once. If it's already spliced elsewhere,
+        the messages are moved by threads as before. */
+    rc = nn_splice (s1, s2, twoway, 1, subscribe);
+    if (rc == -EBUSY)
+        return 0;
+    errno = -rc;
+    return -1;
+}
+
+/*  Ordinary device forwarding the messages by several workers. */
+struct nn_device_sharded {
+    struct nn_device_recipe recipe;
+    int nshards;
+};
+
+/*  If the sockets can't be spliced, the sharded device falls back to
+    the ordinary forwarding. */
+static int nn_device_sharded_splice (struct nn_device_recipe *device,
+    int s1, int s2, int twoway)
+{
+    int rc;
+    int subscribe;
+    struct nn_device_sharded *sharded;
+
+    sharded = nn_cont (device, struct nn_device_sharded, recipe);
+    subscribe = nn_device_splice_subscribe (device, s1, s2, twoway);
+    if (nn_slow (subscribe < 0))
+        return -1;
+    rc = nn_splice (s1, s2, twoway, sharded->nshards, subscribe);
+    if (rc == -EBUSY) {
+        if (s1 == s2)
+            return nn_device_loopback (device, s1);
+        return twoway ? nn_device_twoway (device, s1, s2) :
+            nn_device_oneway (device, s1, s2);
+    }
+    errno = -rc;
+    return -1;
+}
+
+static int nn_device_sharded_loopback (struct nn_device_recipe *device, int s)
+{
+    int rc;
+    int op;
+    size_t opsz;
+
+    /*  Check whether the socket is a "raw" socket. */
+    opsz = sizeof (op);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_DOMAIN, &op, &opsz);
+    if (nn_slow (rc != 0))
+        return -1;
+    nn_assert (opsz == sizeof (op));
+    if (op != AF_SP_RAW) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return nn_device_sharded_splice (device, s, s, 0);
+}
+
+static int nn_device_sharded_twoway (struct nn_device_recipe *device,
+    int s1, int s2)
+{
+    return nn_device_sharded_splice (device, s1, s2, 1);
+}
+
+static int nn_device_sharded_oneway (struct nn_device_recipe *device,
+    int s1, int s2)
+{
+    return nn_device_sharded_splice (device, s1, s2, 0);
+}
+
+int nn_device_sharded (int s1, int s2, int nshards)
+{
+    struct nn_device_sharded sharded;
+
+    if (nn_slow (nshards < 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sharded.recipe = nn_ordinary_device;
+    sharded.recipe.nn_device_loopback = nn_device_sharded_loopback;
+    sharded.recipe.nn_device_twoway = nn_device_sharded_twoway;
+    sharded.recipe.nn_device_oneway = nn_device_sharded_oneway;
+    sharded.nshards = nshards;
+    return nn_custom_device (&sharded.recipe, s1, s2, 0);
+}
+
 int nn_custom_device(struct nn_device_recipe *device, int s1, int s2,
     int flags)
 {
@@ -66,9 +220,9 @@ int nn_device_entry (struct nn_device_recipe *device, int s1, int s2,
     /*  Handle the case when there's only one socket in the device. */
     if (device->required_checks & NN_CHECK_ALLOW_LOOPBACK) {
         if (s2 < 0)
-            return nn_device_loopback (device, s1);
+            return device->nn_device_loopback (device, s1);
         if (s1 < 0)
-            return nn_device_loopback (device, s2);
+            return device->nn_device_loopback (device, s2);
     }
 
     /*  Check whether both sockets are "raw" sockets. */
@@ -175,17 +329,17 @@ int nn_device_entry (struct nn_device_recipe *device, int s1, int s2,
     /*  Two-directional device. */
     if (device->required_checks & NN_CHECK_ALLOW_BIDIRECTIONAL) {
         if (s1rcv != -1 && s1snd != -1 && s2rcv != -1 && s2snd != -1)
-            return nn_device_twoway (device, s1, s2);
+            return device->nn_device_twoway (device, s1, s2);
     }
 
     if (device->required_checks & NN_CHECK_ALLOW_UNIDIRECTIONAL) {
         /*  Single-directional device passing messages from s1 to s2. */
         if (s1rcv != -1 && s1snd == -1 && s2rcv == -1 && s2snd != -1)
-            return nn_device_oneway (device, s1, s2);
+            return device->nn_device_oneway (device, s1, s2);
 
         /*  Single-directional device passing messages from s2 to s1. */
         if (s1rcv == -1 && s1snd != -1 && s2rcv != -1 && s2snd == -1)
-            return nn_device_oneway (device, s2, s1);
+            return device->nn_device_oneway (device, s2, s1);
     }
 
     /*  This should never happen. */
@@ -209,6 +363,9 @@ int nn_device_loopback (struct nn_device_recipe *device, int s)
         return -1;
     }
 
+    if (nn_device_splice (device, s, s, 0) < 0)
+        return -1;
+
     for (;;) {
         rc = nn_device_mvmsg (device, s, s, 0);
         if (nn_slow (rc < 0))
@@ -243,6 +400,9 @@ int nn_device_twoway (struct nn_device_recipe *device, int s1, int s2)
     struct nn_device_forwarder_args a1;
     struct nn_device_forwarder_args a2;
 
+    if (nn_device_splice (device, s1, s2, 1) < 0)
+        return -1;
+
     a1.device = device;
     a1.s1 = s1;
     a1.s2 = s2;
@@ -268,49 +428,139 @@ int nn_device_twoway (struct nn_device_recipe *device, int s1, int s2)
 int nn_device_oneway (struct nn_device_recipe *device, int s1, int s2)
 {
     int rc;
+    uint64_t now;
+    uint64_t next;
+    struct nn_pollfd pfd;
+
+    if (nn_device_splice (device, s1, s2, 0) < 0)
+        return -1;
+
+    rc = device->nn_device_subscribe ?
+        device->nn_device_subscribe (device, s1, s2) : 0;
+    if (nn_slow (rc < 0))
+        return -1;
+    if (!rc) {
+        while (1) {
+            rc = nn_device_mvmsg (device, s1, s2, 0);
+            if (nn_slow (rc < 0))
+                return -1;
+        }
+    }
 
+    /*  Downstream subscriptions come and go. Wait for the messages only for
+        so long, so that they can be relayed upstream in the meantime. */
+    next = nn_clock_ms () + NN_DEVICE_SUBSCRIBE_IVL;
     while (1) {
-        rc = nn_device_mvmsg (device, s1, s2, 0);
-        if (nn_slow (rc < 0))
+        pfd.fd = s1;
+        pfd.events = NN_POLLIN;
+        pfd.revents = 0;
+        rc = nn_poll (&pfd, 1, NN_DEVICE_SUBSCRIBE_IVL);
+        if (nn_slow (rc < 0 && nn_errno () != EINTR))
             return -1;
+        if (rc > 0 && (pfd.revents & NN_POLLIN)) {
+            rc = nn_device_mvmsg (device, s1, s2, 0);
+            if (nn_slow (rc < 0))
+                return -1;
+        }
+        now = nn_clock_ms ();
+        if (now >= next) {
+            rc = device->nn_device_subscribe (device, s1, s2);
+            if (nn_slow (rc < 0))
+                return -1;
+            next = now + NN_DEVICE_SUBSCRIBE_IVL;
+        }
     }
 }
 
+/*  Drops a message that was received but won't be sent. */
+static void nn_device_freemsg (struct nn_msghdr *hdr)
+{
+    if (hdr->msg_iovlen == 1 && hdr->msg_iov->iov_len == NN_MSG)
+        nn_freemsg (*(void**) hdr->msg_iov->iov_base);
+    if (hdr->msg_controllen == NN_MSG)
+        nn_freemsg (*(void**) hdr->msg_control);
+}
+
 int nn_device_mvmsg (struct nn_device_recipe *device,
     int from, int to, int flags)
 {
     int rc;
-    void *body;
-    void *control;
-    struct nn_iovec iov;
-    struct nn_msghdr hdr;
-
-    iov.iov_base = &body;
-    iov.iov_len = NN_MSG;
-    memset (&hdr, 0, sizeof (hdr));
-    hdr.msg_iov = &iov;
-    hdr.msg_iovlen = 1;
-    hdr.msg_control = &control;
-    hdr.msg_controllen = NN_MSG;
-    rc = nn_recvmsg (from, &hdr, flags);
-    if (nn_slow (rc < 0 && (nn_errno () == ETERM || nn_errno () == EBADF))) {
-        return -1;
+    int i;
+    int count;
+    int nfwd;
+    int nsent;
+    int err;
+    void *bodies [NN_DEVICE_BATCH];
+    void *controls [NN_DEVICE_BATCH];
+    struct nn_iovec iovs [NN_DEVICE_BATCH];
+    struct nn_mmsghdr hdrs [NN_DEVICE_BATCH];
+
+    /*  Wait for a message, then take all the messages that are immediately
+        available, up to the size of the batch. */
+    memset (hdrs, 0, sizeof (hdrs));
+    for (i = 0; i != NN_DEVICE_BATCH; ++i) {
+        iovs [i].iov_base = &bodies [i];
+        iovs [i].iov_len = NN_MSG;
+        hdrs [i].msg_hdr.msg_iov = &iovs [i];
+        hdrs [i].msg_hdr.msg_iovlen = 1;
+        hdrs [i].msg_hdr.msg_control = &controls [i];
+        hdrs [i].msg_hdr.msg_controllen = NN_MSG;
     }
-    errno_assert (rc >= 0);
-
-    rc = device->nn_device_rewritemsg (device, from, to, flags, &hdr, rc);
-    if (nn_slow (rc == -1))
+    count = nn_recvmmsg (from, hdrs, NN_DEVICE_BATCH, flags);
+    if (nn_slow (count < 0 && (nn_errno () == ETERM || nn_errno () == EBADF))) {
         return -1;
-    else if (rc == 0)
-        return 0;
-    nn_assert(rc == 1);
+    }
+    errno_assert (count >= 0);
+
+    /*  Let the recipe rewrite or drop each of the messages. The ones to be
+        forwarded are moved to the beginning of the batch. If the recipe
+        fails, the rest of the batch is dropped. */
+    err = 0;
+    nfwd = 0;
+    for (i = 0; i != count; ++i) {
+        if (nn_slow (err)) {
+            nn_device_freemsg (&hdrs [i].msg_hdr);
+            continue;
+        }
+        rc = device->nn_device_rewritemsg (device, from, to, flags,
+            &hdrs [i].msg_hdr, (int) hdrs [i].msg_len);
+        if (nn_slow (rc == -1)) {
+            err = 1;
+            continue;
+        }
+        else if (rc == 0)
+            continue;
+        nn_assert (rc == 1);
+        if (nfwd != i) {
+            bodies [nfwd] = bodies [i];
+            controls [nfwd] = controls [i];
+            iovs [nfwd] = iovs [i];
+            if (iovs [i].iov_base == &bodies [i])
+                iovs [nfwd].iov_base = &bodies [nfwd];
+            hdrs [nfwd].msg_hdr = hdrs [i].msg_hdr;
+            if (hdrs [i].msg_hdr.msg_iov == &iovs [i])
+                hdrs [nfwd].msg_hdr.msg_iov = &iovs [nfwd];
+            if (hdrs [i].msg_hdr.msg_control == &controls [i])
+                hdrs [nfwd].msg_hdr.msg_control = &controls [nfwd];
+        }
+        ++nfwd;
+    }
 
-    rc = nn_sendmsg (to, &hdr, flags);
-    if (nn_slow (rc < 0 && (nn_errno () == ETERM || nn_errno () == EBADF))) {
-        return -1;
+    /*  Send the messages to be forwarded in one go. */
+    nsent = 0;
+    while (nsent != nfwd) {
+        rc = nn_sendmmsg (to, hdrs + nsent, nfwd - nsent, flags);
+        if (nn_slow (rc < 0 && (nn_errno () == ETERM || nn_errno () == EBADF))) {
+            err = 1;
+            break;
+        }
+        errno_assert (rc >= 0);
+        nsent += rc;
     }
-    errno_assert (rc >= 0);
-    return 0;
+    for (i = nsent; i != nfwd; ++i)
+        nn_device_freemsg (&hdrs [i].msg_hdr);
+
+    return err ? -1 : 0;
 }
 
 int nn_device_rewritemsg (NN_UNUSED struct nn_device_recipe *device,
@@ -319,3 +569,46 @@ int nn_device_rewritemsg (NN_UNUSED struct nn_device_recipe *device,
 {
     return 1; /* always forward */
 }
+
+int nn_device_subscribe (NN_UNUSED struct nn_device_recipe *device,
+    int from, int to)
+{
+    int rc;
+    int one;
+    void *buf;
+    size_t bufsz;
+    size_t sz;
+
+    rc = nn_device_ispubsub (from, to);
+    if (rc <= 0)
+        return rc;
+
+    one = 1;
+    rc = nn_setsockopt (from, NN_SUB, NN_SUB_FORWARD, &one, sizeof (one));
+    if (nn_slow (rc != 0))
+        return -1;
+
+    /*  The list may grow between the calls. */
+    bufsz = NN_DEVICE_SUBS_BUFSZ;
+    while (1) {
+        buf = nn_alloc (bufsz, "subscriptions (device)");
+        alloc_assert (buf);
+        sz = bufsz;
+        rc = nn_getsockopt (to, NN_PUB, NN_PUB_SUBSCRIPTIONS, buf, &sz);
+        if (nn_slow (rc != 0)) {
+            nn_free (buf);
+            return -1;
+        }
+        if (sz <= bufsz)
+            break;
+        nn_free (buf);
+        bufsz = sz;
+    }
+
+    /*  Setting the same list again doesn't disturb the upstream peers. */
+    rc = nn_setsockopt (from, NN_SUB, NN_SUB_SUBSCRIPTIONS, buf, sz);
+    nn_free (buf);
+    if (nn_slow (rc != 0))
+        return -1;
+    return 1;
+}
@@ -66,6 +66,19 @@ struct nn_device_recipe {
     */
     int (*nn_device_rewritemsg) (struct nn_device_recipe *device,
         int from, int to, int flags, struct nn_msghdr *msghdr, int bytes);
+
+    /*  The subscription relay function.  Subscribes the 'from' socket to
+        the topics the peers of the 'to' socket are interested in, so that
+        the messages nobody downstream wants are not forwarded.  It is
+        called when a one-way device starts and then periodically.
+        NULL if the device should forward everything it gets.
+        return values:
+        1  indicates that the subscriptions were relayed.
+        0  indicates that the sockets don't deal with subscriptions.
+        -1 indicates an error.  Set errno.
+    */
+    int (*nn_device_subscribe) (struct nn_device_recipe *device,
+        int from, int to);
 };
 
 /*  Default implementations of the functions. */
@@ -78,6 +91,7 @@ int nn_device_entry(struct nn_device_recipe *device,
     int s1, int s2, int flags);
 int nn_device_rewritemsg(struct nn_device_recipe *device,
     int from, int to, int flags, struct nn_msghdr *msghdr, int bytes);
+int nn_device_subscribe (struct nn_device_recipe *device, int from, int to);
 
 
 /*  At least one socket must be passed to the device. */
@@ -106,6 +120,7 @@ static struct nn_device_recipe nn_ordinary_device = {
     nn_device_oneway,
     nn_device_loopback,
     nn_device_mvmsg,
-    nn_device_rewritemsg
+    nn_device_rewritemsg,
+    nn_device_subscribe
 };
 
@@ -0,0 +1,491 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+#include "../pubsub.h"
+
+#include "splice.h"
+
+#include "../core/global.h"
+#include "../core/sock.h"
+
+#include "../aio/ctx.h"
+#include "../aio/fsm.h"
+#include "../aio/worker.h"
+
+#include "../utils/err.h"
+#include "../utils/alloc.h"
+#include "../utils/atomic.h"
+#include "../utils/attr.h"
+#include "../utils/cont.h"
+#include "../utils/fast.h"
+#include "../utils/msg.h"
+#include "../utils/sem.h"
+
+/*  Maximum number of messages moved between the sockets at once. */
+#define NN_SPLICE_BATCH 32
+
+/*  Maximum number of batches forwarded in either direction before the worker
+    gets a chance to handle other tasks. */
+#define NN_SPLICE_ROUNDS 8
+
+/*  Initial size of the buffer the downstream subscriptions are copied to. */
+#define NN_SPLICE_SUBS_BUFSZ 1024
+
+#define NN_SPLICE_SRC_TASK 1
+
+/*  States of the splice as a whole. Nothing is forwarded before all the hooks
+    are in place, so the splice can be undone if a hook can't be set. */
+#define NN_SPLICE_STARTING 0
+#define NN_SPLICE_RUNNING 1
+#define NN_SPLICE_STOPPING 2
+
+/*  Whether the forwarding task of a shard is queued to its worker. Once
+    the shard is done, the task is never queued again. */
+#define NN_SPLICE_IDLE 0
+#define NN_SPLICE_SCHEDULED 1
+#define NN_SPLICE_DONE 2
+
+struct nn_splice;
+
+/*  One of the spliced sockets. */
+struct nn_splice_end {
+    struct nn_sock *sock;
+    struct nn_sock_hook hook;
+    struct nn_splice *splice;
+    int hooked;
+};
+
+/*  One direction of forwarding. Messages that were received from 'from' but
+    not yet sent to 'to' are kept in 'msgs', along with their sizes for
+    the statistics. */
+struct nn_splice_dir {
+    struct nn_sock *from;
+    struct nn_sock *to;
+    struct nn_msg msgs [NN_SPLICE_BATCH];
+    size_t sizes [NN_SPLICE_BATCH];
+    int first;
+    int count;
+};
+
+/*  Forwarding task. Each shard is run by a worker of its own and handles
+    both forwarding directions. */
+struct nn_splice_shard {
+    struct nn_fsm fsm;
+    struct nn_ctx ctx;
+    struct nn_worker *worker;
+    struct nn_worker_task task;
+    struct nn_atomic scheduled;
+    struct nn_splice *splice;
+    struct nn_splice_dir dirs [2];
+};
+
+struct nn_splice {
+    struct nn_atomic state;
+    int nends;
+    struct nn_splice_end ends [2];
+    int ndirs;
+    int nshards;
+    struct nn_splice_shard *shards;
+
+    /*  If set, the first shard keeps the upstream subscriptions in sync with
+        the downstream ones. */
+    int subscribe;
+
+    /*  Number of shards that are not done yet. */
+    struct nn_atomic active;
+
+    /*  Error the splice has ended with. Set when it starts stopping. */
+    int err;
+
+    /*  Posted once all the shards are done with the splice. */
+    struct nn_sem done;
+};
+
+static void nn_splice_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_splice_notify (struct nn_sock_hook *self);
+static void nn_splice_schedule (struct nn_splice_shard *self);
+static void nn_splice_schedule_all (struct nn_splice *self);
+static void nn_splice_stop (struct nn_splice *self, int err);
+static int nn_splice_forward (struct nn_splice_shard *self,
+    struct nn_splice_dir *dir);
+static int nn_splice_subscribe (struct nn_splice_dir *dir);
+
+int nn_splice (int s1, int s2, int twoway, int nshards, int subscribe)
+{
+    int rc;
+    int i;
+    int j;
+    struct nn_sock *sock1;
+    struct nn_sock *sock2;
+    struct nn_splice *self;
+    struct nn_splice_shard *shard;
+    struct nn_worker **workers;
+
+    nn_assert (nshards >= 1);
+    nn_assert (!subscribe || (!twoway && s2 != s1));
+
+    rc = nn_global_hold_socket (&sock1, s1);
+    if (nn_slow (rc < 0))
+        return rc;
+    sock2 = sock1;
+    if (s2 != s1) {
+        rc = nn_global_hold_socket (&sock2, s2);
+        if (nn_slow (rc < 0)) {
+            nn_global_rele_socket (s1);
+            return rc;
+        }
+    }
+
+    self = nn_alloc (sizeof (struct nn_splice), "splice");
+    alloc_assert (self);
+    nn_atomic_init (&self->state, NN_SPLICE_STARTING);
+    self->nends = s2 != s1 ? 2 : 1;
+    self->ends [0].sock = sock1;
+    self->ends [1].sock = sock2;
+    for (i = 0; i != 2; ++i) {
+        self->ends [i].hook.fn = nn_splice_notify;
+        self->ends [i].splice = self;
+        self->ends [i].hooked = 0;
+    }
+    self->ndirs = twoway ? 2 : 1;
+    self->subscribe = subscribe;
+    self->err = 0;
+    nn_sem_init (&self->done);
+
+    /*  The shards are spread over the workers, starting with the one the
+        first socket is handled by. */
+    self->nshards = nshards;
+    self->shards = nn_alloc (sizeof (struct nn_splice_shard) * nshards,
+        "splice shards");
+    alloc_assert (self->shards);
+    workers = nn_alloc (sizeof (struct nn_worker*) * nshards,
+        "splice workers");
+    alloc_assert (workers);
+    nn_ctx_choose_workers (nn_sock_getctx (sock1), workers, nshards);
+    nn_atomic_init (&self->active, nshards);
+    for (i = 0; i != nshards; ++i) {
+        shard = &self->shards [i];
+        nn_ctx_init (&shard->ctx, nn_global_getpool (), NULL);
+        nn_fsm_init_root (&shard->fsm, nn_splice_handler, nn_splice_handler,
+            &shard->ctx);
+        shard->worker = workers [i];
+        nn_worker_task_init (&shard->task, NN_SPLICE_SRC_TASK, &shard->fsm);
+        nn_atomic_init (&shard->scheduled, NN_SPLICE_IDLE);
+        shard->splice = self;
+        shard->dirs [0].from = sock1;
+        shard->dirs [0].to = sock2;
+        shard->dirs [1].from = sock2;
+        shard->dirs [1].to = sock1;
+        for (j = 0; j != 2; ++j) {
+            shard->dirs [j].first = 0;
+            shard->dirs [j].count = 0;
+        }
+    }
+    nn_free (workers);
+
+    /*  Install the hooks. The shards may start running in the meantime,
+        but they do nothing until the splice is running. */
+    rc = 0;
+    for (i = 0; i != self->nends; ++i) {
+        rc = nn_sock_sethook (self->ends [i].sock, &self->ends [i].hook);
+        if (nn_slow (rc < 0))
+            break;
+        self->ends [i].hooked = 1;
+    }
+    if (nn_fast (rc == 0)) {
+        nn_atomic_cas (&self->state, NN_SPLICE_STARTING, NN_SPLICE_RUNNING);
+        nn_splice_schedule_all (self);
+    }
+    else
+        nn_splice_stop (self, rc);
+
+    /*  Wait till the splice ends. It's done by the workers, so this loop is
+        not interruptible. */
+    for (;;) {
+        rc = nn_pool_wait (nn_global_getpool (), &self->done);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        break;
+    }
+
+    for (i = 0; i != nshards; ++i) {
+        shard = &self->shards [i];
+
+        /*  The worker can still be in the context for a short while after
+            the shard is done. */
+        nn_ctx_enter (&shard->ctx);
+        nn_ctx_leave (&shard->ctx);
+
+        nn_atomic_term (&shard->scheduled);
+        nn_worker_task_term (&shard->task);
+        nn_fsm_term (&shard->fsm);
+        nn_ctx_term (&shard->ctx);
+    }
+    rc = self->err;
+    nn_free (self->shards);
+    nn_sem_term (&self->done);
+    nn_atomic_term (&self->active);
+    nn_atomic_term (&self->state);
+    nn_free (self);
+
+    if (s2 != s1)
+        nn_global_rele_socket (s2);
+    nn_global_rele_socket (s1);
+
+    return rc;
+}
+
+static void nn_splice_notify (struct nn_sock_hook *self)
+{
+    struct nn_splice_end *end;
+
+    /*  Any of the shards may be waiting for the socket. */
+    end = nn_cont (self, struct nn_splice_end, hook);
+    nn_splice_schedule_all (end->splice);
+}
+
+static void nn_splice_schedule (struct nn_splice_shard *self)
+{
+    if (nn_atomic_cas (&self->scheduled, NN_SPLICE_IDLE,
+          NN_SPLICE_SCHEDULED) == NN_SPLICE_IDLE)
+        nn_worker_execute (self->worker, &self->task);
+}
+
+static void nn_splice_schedule_all (struct nn_splice *self)
+{
+    int i;
+
+    for (i = 0; i != self->nshards; ++i)
+        nn_splice_schedule (&self->shards [i]);
+}
+
+static void nn_splice_stop (struct nn_splice *self, int err)
+{
+    uint32_t old;
+
+    /*  Only the first error is reported. Every shard has to find out that
+        the splice is stopping. */
+    old = nn_atomic_load (&self->state);
+    while (old != NN_SPLICE_STOPPING) {
+        if (nn_atomic_cas (&self->state, old, NN_SPLICE_STOPPING) == old) {
+            self->err = err;
+            nn_splice_schedule_all (self);
+            return;
+        }
+        old = nn_atomic_load (&self->state);
+    }
+}
+
+static void nn_splice_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_splice_shard *shard;
+    struct nn_splice *splice;
+    struct nn_splice_dir *dir;
+    int rc;
+    int i;
+    int more;
+    uint32_t old;
+
+    shard = nn_cont (self, struct nn_splice_shard, fsm);
+    splice = shard->splice;
+
+    nn_assert (src == NN_SPLICE_SRC_TASK && type == NN_WORKER_TASK_EXECUTE);
+
+    /*  From now on, any notification queues the task anew. */
+    old = nn_atomic_cas (&shard->scheduled, NN_SPLICE_SCHEDULED,
+        NN_SPLICE_IDLE);
+    nn_assert (old == NN_SPLICE_SCHEDULED);
+
+    switch (nn_atomic_load (&splice->state)) {
+    case NN_SPLICE_STARTING:
+        return;
+    case NN_SPLICE_RUNNING:
+        if (splice->subscribe && shard == splice->shards) {
+            rc = nn_splice_subscribe (&shard->dirs [0]);
+            if (nn_slow (rc < 0)) {
+                nn_splice_stop (splice, rc);
+                break;
+            }
+        }
+        more = 0;
+        for (i = 0; i != splice->ndirs; ++i) {
+            rc = nn_splice_forward (shard, &shard->dirs [i]);
+            if (nn_slow (rc < 0)) {
+                nn_splice_stop (splice, rc);
+                break;
+            }
+            more |= rc;
+        }
+
+        /*  If forwarding was cut short, continue once the worker is done
+            with the tasks that are already queued. */
+        if (nn_fast (i == splice->ndirs)) {
+            if (more)
+                nn_splice_schedule (shard);
+            return;
+        }
+        break;
+    }
+
+    /*  The splice is stopping. A notification that has already queued
+        the task will get here again. */
+    for (i = 0; i != splice->ndirs; ++i) {
+        dir = &shard->dirs [i];
+        while (dir->count) {
+            nn_msg_term (&dir->msgs [dir->first]);
+            ++dir->first;
+            --dir->count;
+        }
+    }
+    if (nn_atomic_cas (&shard->scheduled, NN_SPLICE_IDLE,
+          NN_SPLICE_DONE) != NN_SPLICE_IDLE)
+        return;
+
+    /*  The last shard removes the hooks. Notifications can still come till
+        then, but they are ignored by the shards that are done. */
+    if (nn_atomic_dec (&splice->active, 1) != 1)
+        return;
+    for (i = 0; i != splice->nends; ++i) {
+        if (splice->ends [i].hooked) {
+            rc = nn_sock_sethook (splice->ends [i].sock, NULL);
+            errnum_assert (rc == 0, -rc);
+            splice->ends [i].hooked = 0;
+        }
+    }
+    nn_sem_post (&splice->done);
+}
+
+/*  Returns 1 if the direction was left with messages to forward, 0 if it
+    has to wait for one of the sockets, or a negative error. */
+static int nn_splice_forward (struct nn_splice_shard *self,
+    struct nn_splice_dir *dir)
+{
+    int rc;
+    int i;
+    int round;
+    size_t bytes;
+    struct nn_splice *splice;
+
+    splice = self->splice;
+
+    for (round = 0; round != NN_SPLICE_ROUNDS; ++round) {
+
+        /*  Receive a new batch once the previous one is sent, so that
+            the messages handled by the shard are forwarded in order. */
+        if (!dir->count) {
+            rc = nn_sock_recvmany (dir->from, dir->msgs, NN_SPLICE_BATCH,
+                NN_DONTWAIT);
+            if (rc == -EAGAIN)
+                return 0;
+            if (nn_slow (rc < 0))
+                return rc;
+            dir->first = 0;
+            dir->count = rc;
+            bytes = 0;
+            for (i = 0; i != rc; ++i) {
+                dir->sizes [i] = nn_msg_bodysize (&dir->msgs [i]);
+                bytes += dir->sizes [i];
+            }
+            nn_sock_stat_increment (dir->from, NN_STAT_MESSAGES_RECEIVED, rc);
+            nn_sock_stat_increment (dir->from, NN_STAT_BYTES_RECEIVED, bytes);
+
+            /*  A full batch suggests there are more messages. Let the next
+                shard take them while this one is sending. */
+            if (rc == NN_SPLICE_BATCH && splice->nshards > 1)
+                nn_splice_schedule (&splice->shards [
+                    (self - splice->shards + 1) % splice->nshards]);
+        }
+
+        /*  A failed send leaves the messages in place. They are sent once
+            the socket becomes writable. */
+        rc = nn_sock_sendmany (dir->to, dir->msgs + dir->first,
+            dir->count, NN_DONTWAIT);
+        if (rc == -EAGAIN)
+            return 0;
+        if (nn_slow (rc < 0))
+            return rc;
+        bytes = 0;
+        for (i = 0; i != rc; ++i)
+            bytes += dir->sizes [dir->first + i];
+        nn_sock_stat_increment (dir->to, NN_STAT_MESSAGES_SENT, rc);
+        nn_sock_stat_increment (dir->to, NN_STAT_BYTES_SENT, bytes);
+        dir->first += rc;
+        dir->count -= rc;
+        if (dir->count)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*  Subscribes 'from' to the union of the subscriptions of the peers of 'to'
+    each time the latter changes. The hook is notified about the next change
+    once the socket doesn't report it any more. */
+static int nn_splice_subscribe (struct nn_splice_dir *dir)
+{
+    int rc;
+    int one;
+    void *buf;
+    size_t bufsz;
+    size_t sz;
+
+    while (1) {
+        rc = nn_sock_events (dir->to, NN_SOCKBASE_EVENT_SUBS);
+        if (nn_slow (rc < 0))
+            return rc;
+        if (!(rc & NN_SOCKBASE_EVENT_SUBS))
+            return 0;
+
+        one = 1;
+        rc = nn_sock_setopt (dir->from, NN_SUB, NN_SUB_FORWARD,
+            &one, sizeof (one));
+        if (nn_slow (rc < 0))
+            return rc;
+
+        /*  The list may grow between the calls. */
+        bufsz = NN_SPLICE_SUBS_BUFSZ;
+        while (1) {
+            buf = nn_alloc (bufsz, "subscriptions (splice)");
+            alloc_assert (buf);
+            sz = bufsz;
+            rc = nn_sock_getopt (dir->to, NN_PUB, NN_PUB_SUBSCRIPTIONS,
+                buf, &sz);
+            if (nn_slow (rc < 0)) {
+                nn_free (buf);
+                return rc;
+            }
+            if (sz <= bufsz)
+                break;
+            nn_free (buf);
+            bufsz = sz;
+        }
+        rc = nn_sock_setopt (dir->from, NN_SUB, NN_SUB_SUBSCRIPTIONS,
+            buf, sz);
+        nn_free (buf);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+}
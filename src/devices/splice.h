@@ -0,0 +1,41 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SPLICE_INCLUDED
+#define NN_SPLICE_INCLUDED
+
+/*  Forwards messages between two raw sockets within the library until either
+    of them is closed. Messages received from s1 are sent to s2 and, if
+    'twoway' is set, the other way round too. s1 and s2 may be the same
+    socket. Messages are moved between the sockets from within the AIO
+    workers, without copying them and without waking up any user thread.
+    With 'nshards' greater than 1, that many workers forward the messages
+    in parallel, in which case the messages may get reordered. The calling
+    thread is blocked meanwhile. Returns -EBADF once one of the sockets is
+    closed, or -EBUSY straight away if one of them is already spliced.
+    If 'subscribe' is set, s1 must be a raw SUB socket and s2 a raw PUB one
+    forwarding one way; s1 is then subscribed to exactly the topics that
+    the subscribers connected to s2 are subscribed to. */
+int nn_splice (int s1, int s2, int twoway, int nshards, int subscribe);
+
+#endif
+
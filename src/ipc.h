@@ -33,6 +33,23 @@ extern "C" {
 #define NN_IPC_SEC_ATTR 1
 #define NN_IPC_OUTBUFSZ 2
 #define NN_IPC_INBUFSZ 3
+#define NN_IPC_RCVBATCH 4
+#define NN_IPC_SEQPACKET 5
+#define NN_IPC_COMPRESS 6
+#define NN_IPC_COMPRESS_THRESHOLD 7
+#define NN_IPC_BATCH 8
+
+/*  Values of NN_IPC_COMPRESS option. */
+#define NN_IPC_COMPRESS_NONE 0
+#define NN_IPC_COMPRESS_LZ4 1
+#define NN_IPC_COMPRESS_ZSTD 2
+
+/*  Ancillary property of level NN_IPC carrying an array of file descriptors
+    along with the message (see nn_ipc(7)). */
+#define NN_IPC_FDS 1
+
+/*  Maximum number of file descriptors attached to a single message. */
+#define NN_IPC_MAXFDS 16
 
 #ifdef __cplusplus
 }
@@ -216,6 +216,7 @@ NN_EXPORT const char *nn_symbol (int i, int *value);
 #define NN_UNIT_BOOLEAN 4
 #define NN_UNIT_MESSAGES 5
 #define NN_UNIT_COUNTER 6
+#define NN_UNIT_MICROSECONDS 7
 
 /*  Structure that is returned from nn_symbol  */
 struct nn_symbol_properties {
@@ -255,9 +256,48 @@ NN_EXPORT void nn_term (void);
 #define NN_MSG ((size_t) -1)
 
 NN_EXPORT void *nn_allocmsg (size_t size, int type);
+
+/*  Same as nn_allocmsg, except that room is reserved in front of the message
+    for protocol headers and behind it for nn_reallocmsg to grow it into. */
+NN_EXPORT void *nn_allocmsg_reserve (size_t size, size_t headroom,
+    size_t tailroom, int type);
+
 NN_EXPORT void *nn_reallocmsg (void *msg, size_t size);
 NN_EXPORT int nn_freemsg (void *msg);
 
+/*  Creates a pool of up to 'count' message buffers, 'size' bytes each. The
+    returned number can be passed as 'type' to nn_allocmsg and set as
+    NN_RCVPOOL socket option. Buffers go back to the pool once freed. */
+NN_EXPORT int nn_msgpool (size_t size, int count);
+
+/*  Limits the memory held by the messages in the process to 'bytes', zero
+    meaning no limit. While the limit is exceeded, sends fail with EAGAIN
+    if NN_MEMBUDGET_SEND is set and the connections stop reading from
+    the network if NN_MEMBUDGET_RECV is set. */
+#define NN_MEMBUDGET_SEND 1
+#define NN_MEMBUDGET_RECV 2
+NN_EXPORT int nn_membudget (size_t bytes, int flags);
+
+/******************************************************************************/
+/*  Pluggable memory allocators.                                              */
+/******************************************************************************/
+
+/*  Classes of memory the library allocates. Each can be served by
+    an allocator of its own.                                                  */
+#define NN_ALLOC_OBJECT 0   /*  Sockets, endpoints, state machines etc.  */
+#define NN_ALLOC_MSG 1      /*  Message chunks.  */
+#define NN_ALLOC_QUEUE 2    /*  Queues of messages waiting to be passed on.  */
+#define NN_ALLOC_IOBUF 3    /*  Buffers used to batch network I/O.  */
+
+struct nn_allocator {
+    void *(*alloc) (size_t size, void *arg);
+    void *(*realloc) (void *ptr, size_t size, void *arg);
+    void (*free) (void *ptr, void *arg);
+    void *arg;
+};
+
+NN_EXPORT int nn_set_allocator (int type, const struct nn_allocator *allocator);
+
 /******************************************************************************/
 /*  Socket definition.                                                        */
 /******************************************************************************/
@@ -274,6 +314,11 @@ struct nn_msghdr {
     size_t msg_controllen;
 };
 
+struct nn_mmsghdr {
+    struct nn_msghdr msg_hdr;
+    size_t msg_len;
+};
+
 struct nn_cmsghdr {
     size_t cmsg_len;
     int cmsg_level;
@@ -306,6 +351,33 @@ NN_EXPORT  struct nn_cmsghdr *nn_cmsg_nxthdr_ (
 #define NN_CMSG_LEN(len) \
     (NN_CMSG_ALIGN_ (sizeof (struct nn_cmsghdr)) + (len))
 
+/*  Ancillary property of level NN_SOL_SOCKET passed to nn_sendmsg. The region
+    of the file it describes follows the data of the message body. Transports
+    able to do so send it without reading it into memory (see nn_sendmsg(3)).
+    At most one such property per message. */
+#define NN_FILE_REGION 1
+
+struct nn_file_region {
+    int fd;
+    uint64_t offset;
+    uint64_t length;
+};
+
+/*  Ancillary property of level NN_SOL_SOCKET marking a piece of a message
+    too large to be passed at once, with the size of the whole message and
+    the offset of the piece within it (see nn_sendmsg(3) and NN_RCVPIECE). */
+#define NN_MSG_PIECE 2
+
+struct nn_msg_piece {
+    uint64_t size;
+    uint64_t offset;
+};
+
+/*  Ancillary property of level NN_SOL_SOCKET returned by nn_recvmsg with
+    NN_RCVTIMESTAMP set. Holds the time the kernel received the message as
+    a uint64_t, in nanoseconds since the Epoch. */
+#define NN_MSG_TIMESTAMP 3
+
 /*  SP address families.                                                      */
 #define AF_SP 1
 #define AF_SP_RAW 2
@@ -335,6 +407,35 @@ NN_EXPORT  struct nn_cmsghdr *nn_cmsg_nxthdr_ (
 #define NN_SOCKET_NAME 15
 #define NN_RCVMAXSIZE 16
 #define NN_MAXTTL 17
+#define NN_WORKER 18
+#define NN_RCVSPIN 19
+#define NN_SNDQUEUE_MSGS 20
+#define NN_SNDQUEUE_BYTES 21
+#define NN_MSGTTL 22
+#define NN_RCVWEIGHT 23
+#define NN_RCVPOOL 24
+#define NN_WORKERS 25
+#define NN_RCVPIECE 26
+#define NN_SNDRATE_MSGS 27
+#define NN_SNDRATE_BYTES 28
+#define NN_SNDRATE_BURST 29
+#define NN_HEARTBEAT_IVL 30
+#define NN_WARMUP_SIZE 31
+#define NN_WARMUP_MSGS 32
+#define NN_RCVTIMESTAMP 33
+#define NN_IDLE_TIMEOUT 34
+#define NN_MAXCONN 35
+#define NN_STANDBY 36
+#define NN_SINGLE_THREAD 37
+
+/*  Load-balancing strategies of NN_PUSH_LB and NN_REQ_LB options.            */
+#define NN_LB_ROUNDROBIN 1
+#define NN_LB_LEASTLOADED 2
+#define NN_LB_KEYED 3
+
+/*  Scheduling strategies of NN_PULL_FQ and NN_REP_FQ options.                */
+#define NN_FQ_ROUNDROBIN 1
+#define NN_FQ_DEFICIT 2
 
 /*  Send/recv options.                                                        */
 #define NN_DONTWAIT 1
@@ -343,19 +444,85 @@ NN_EXPORT  struct nn_cmsghdr *nn_cmsg_nxthdr_ (
 #define PROTO_SP 1
 #define SP_HDR 1
 
+/*  Key used to pick the peer with NN_LB_KEYED strategy. Passed to nn_sendmsg
+    as a PROTO_SP level property. */
+#define NN_ROUTING_KEY 2
+
+/*  Time to live of the message in milliseconds, as an int. Passed to
+    nn_sendmsg as a PROTO_SP level property, it overrides NN_MSGTTL. */
+#define NN_MSG_TTL 3
+
+/*  Marks the message as urgent if the int passed along is non-zero. Passed
+    to nn_sendmsg as a PROTO_SP level property. Stream transports write urgent
+    messages ahead of the ordinary ones queued on the same connection. */
+#define NN_MSG_URGENT 4
+
 NN_EXPORT int nn_socket (int domain, int protocol);
 NN_EXPORT int nn_close (int s);
+NN_EXPORT int nn_close_async (int s);
 NN_EXPORT int nn_setsockopt (int s, int level, int option, const void *optval,
     size_t optvallen);
 NN_EXPORT int nn_getsockopt (int s, int level, int option, void *optval,
     size_t *optvallen);
 NN_EXPORT int nn_bind (int s, const char *addr);
 NN_EXPORT int nn_connect (int s, const char *addr);
+NN_EXPORT int nn_connectv (int s, const char **addrs, int naddrs, int *eids);
 NN_EXPORT int nn_shutdown (int s, int how);
 NN_EXPORT int nn_send (int s, const void *buf, size_t len, int flags);
 NN_EXPORT int nn_recv (int s, void *buf, size_t len, int flags);
 NN_EXPORT int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags);
 NN_EXPORT int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags);
+NN_EXPORT int nn_sendmmsg (int s, struct nn_mmsghdr *msgvec, int vlen,
+    int flags);
+NN_EXPORT int nn_recvmmsg (int s, struct nn_mmsghdr *msgvec, int vlen,
+    int flags);
+
+/*  Receives a message without copying it. Fills in a pointer to the body
+    of the message, which stays owned by the socket and remains valid until
+    the next call to nn_recvborrow on the socket or until it's closed. */
+NN_EXPORT int nn_recvborrow (int s, const void **buf, int flags);
+
+/*  Receives as many of the pending messages as fit into the buffer, each
+    preceded by its length as a 4-byte integer in network byte order.
+    Returns the number of bytes stored in the buffer. */
+NN_EXPORT int nn_recvpacked (int s, void *buf, size_t len, int flags);
+
+/*  Asynchronous send, receive or wait operation. The caller fills in 'fn',
+    'arg' and, for a send, 'msg', a message allocated by nn_allocmsg, or for
+    a wait, 'events'. The library invokes 'fn' from one of its worker
+    threads once the operation is done, having set 'err' to 0 or to the
+    error the operation failed with. A received message is then stored in
+    'msg' and its size in 'len'. */
+struct nn_aio {
+    void (*fn) (struct nn_aio *aio);
+    void *arg;
+    void *msg;
+    size_t len;
+    int err;
+
+    /*  For nn_wait_async, NN_POLLIN and/or NN_POLLOUT to wait for. Once
+        done, the ones the socket has. */
+    int events;
+
+    /*  Used by the library while the operation is in progress. */
+    struct nn_aio *next;
+};
+
+NN_EXPORT int nn_send_async (int s, struct nn_aio *aio);
+NN_EXPORT int nn_recv_async (int s, struct nn_aio *aio);
+NN_EXPORT int nn_wait_async (int s, struct nn_aio *aio);
+
+/*  Receive ring of a socket used by a single thread. The messages are
+    taken from it without locking the socket and without system calls.
+    Each one is returned as a buffer to be freed by nn_freemsg, along with
+    its length. The file descriptor becomes readable once a message arrives
+    after nn_rcvring_recv found the ring empty. */
+struct nn_rcvring;
+
+NN_EXPORT struct nn_rcvring *nn_rcvring_open (int s);
+NN_EXPORT int nn_rcvring_recv (struct nn_rcvring *ring, void **bufs,
+    size_t *lens, int count);
+NN_EXPORT int nn_rcvring_fd (struct nn_rcvring *ring);
 
 /******************************************************************************/
 /*  Socket mutliplexing support.                                              */
@@ -372,11 +539,32 @@ struct nn_pollfd {
 
 NN_EXPORT int nn_poll (struct nn_pollfd *fds, int nfds, int timeout);
 
+/*  Persistent set of sockets to poll. Unlike with nn_poll, the sockets'
+    file descriptors are looked up only when they are added to the set and
+    waiting returns just the sockets that are ready. */
+struct nn_pollset;
+
+NN_EXPORT struct nn_pollset *nn_pollset_create (void);
+NN_EXPORT int nn_pollset_destroy (struct nn_pollset *ps);
+NN_EXPORT int nn_pollset_add (struct nn_pollset *ps, int s, int events);
+NN_EXPORT int nn_pollset_remove (struct nn_pollset *ps, int s);
+NN_EXPORT int nn_pollset_wait (struct nn_pollset *ps, struct nn_pollfd *fds,
+    int nfds, int timeout);
+
+/*  If the library is started with NN_WORKER_THREADS set to 0, there are no
+    worker threads and the I/O is done by the application's own event loop.
+    It waits for the descriptor to become readable or for the timeout to
+    expire and lets the library process the events. */
+NN_EXPORT int nn_loop_fd (void);
+NN_EXPORT int nn_loop_timeout (void);
+NN_EXPORT int nn_loop_run (int timeout);
+
 /******************************************************************************/
 /*  Built-in support for devices.                                             */
 /******************************************************************************/
 
 NN_EXPORT int nn_device (int s1, int s2);
+NN_EXPORT int nn_device_sharded (int s1, int s2, int nshards);
 
 /******************************************************************************/
 /*  Statistics.                                                               */
@@ -394,6 +582,7 @@ NN_EXPORT int nn_device (int s1, int s2);
 #define NN_STAT_CURRENT_CONNECTIONS     201
 #define NN_STAT_INPROGRESS_CONNECTIONS  202
 #define NN_STAT_CURRENT_EP_ERRORS       203
+#define NN_STAT_ALLOCATED_BYTES         204
 
 /*  The socket-internal statistics  */
 #define NN_STAT_MESSAGES_SENT           301
@@ -402,9 +591,94 @@ NN_EXPORT int nn_device (int s1, int s2);
 #define NN_STAT_BYTES_RECEIVED          304
 /*  Protocol statistics  */
 #define	NN_STAT_CURRENT_SND_PRIORITY    401
+#define NN_STAT_DROPPED_MESSAGES        402
+#define NN_STAT_EXPIRED_MESSAGES        403
+
+/*  Latency statistics, in microseconds. Time spent waiting in nn_send
+    for the message to be accepted by the socket.  */
+#define NN_STAT_SEND_WAIT_P50           501
+#define NN_STAT_SEND_WAIT_P99           502
+#define NN_STAT_SEND_WAIT_P999          503
+#define NN_STAT_SEND_WAIT_MAX           504
+/*  Time between a message arriving from the network and it being handed
+    over to nn_recv  */
+#define NN_STAT_RECV_DELAY_P50          511
+#define NN_STAT_RECV_DELAY_P99          512
+#define NN_STAT_RECV_DELAY_P999         513
+#define NN_STAT_RECV_DELAY_MAX          514
+/*  Round-trip time of requests (REQ sockets only)  */
+#define NN_STAT_RTT_P50                 521
+#define NN_STAT_RTT_P99                 522
+#define NN_STAT_RTT_P999                523
+#define NN_STAT_RTT_MAX                 524
+/*  Worker thread statistics. For a socket bound to a worker by NN_WORKER
+    they describe that worker, otherwise all the workers combined.  */
+#define NN_STAT_WORKER_WAITS            601
+#define NN_STAT_WORKER_EVENTS           602
+#define NN_STAT_WORKER_TASKS            603
+#define NN_STAT_WORKER_TIMERS           604
+#define NN_STAT_WORKER_BUSY_TIME        605
+#define NN_STAT_WORKER_WAIT_TIME        606
+#define NN_STAT_WORKER_MAX_EVENTS       607
+#define NN_STAT_WORKER_MAX_TASKS        608
+#define NN_STAT_WORKER_LOCK_CONTENTIONS 609
+#define NN_STAT_WORKER_MIGRATIONS       610
+/*  Contention on the lock protecting the socket's state  */
+#define NN_STAT_LOCK_CONTENTIONS        701
+#define NN_STAT_LOCK_PARKS              702
 
 NN_EXPORT uint64_t nn_get_statistic (int s, int stat);
 
+/*  Statistics of a single endpoint. Those of the transport and the message
+    and byte counters are available, restricted to the endpoint. */
+NN_EXPORT uint64_t nn_get_ep_statistic (int s, int eid, int stat);
+
+/*  Statistics of a single connection (pipe) of the socket. 'queued' is
+    the number of messages waiting to be sent, 'blocked_time' the number
+    of microseconds the pipe has spent not writable. */
+struct nn_pipe_stat {
+    int id;
+    int eid;
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t queued;
+    uint64_t blocked_time;
+};
+
+/*  Iterates over the pipes of the socket. Retrieves the statistics of
+    the pipe following the one with ID 'prev', 0 to start with. */
+NN_EXPORT int nn_get_pipe_stat (int s, int prev, struct nn_pipe_stat *stat);
+
+/******************************************************************************/
+/*  Message tracing. Available only if the library was built with             */
+/*  NN_ENABLE_TRACE.                                                          */
+/******************************************************************************/
+
+/*  nn_send/nn_sendmsg was entered with a message of the given size.  */
+#define NN_TRACE_SEND_ENTER             1
+/*  The message was accepted by the protocol of the socket.  */
+#define NN_TRACE_SEND_PROTO             2
+/*  The protocol handed the message over to a pipe.  */
+#define NN_TRACE_PIPE_SEND              3
+/*  Bytes were written to the underlying OS socket.  */
+#define NN_TRACE_USOCK_SENT             4
+/*  Bytes were read from the underlying OS socket.  */
+#define NN_TRACE_USOCK_RECV             5
+/*  A complete message was reassembled by the transport.  */
+#define NN_TRACE_TRANSPORT_RECV         6
+/*  The protocol took the message from a pipe.  */
+#define NN_TRACE_PIPE_RECV              7
+/*  The protocol of the socket handed the message to the user.  */
+#define NN_TRACE_RECV_PROTO             8
+/*  nn_recv/nn_recvmsg is about to return a message of the given size.  */
+#define NN_TRACE_RECV_EXIT              9
+
+typedef void (*nn_trace_fn) (int point, const void *obj, size_t len);
+
+NN_EXPORT int nn_trace (nn_trace_fn fn);
+
 #ifdef __cplusplus
 }
 #endif
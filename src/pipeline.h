@@ -33,6 +33,16 @@ extern "C" {
 #define NN_PUSH (NN_PROTO_PIPELINE * 16 + 0)
 #define NN_PULL (NN_PROTO_PIPELINE * 16 + 1)
 
+#define NN_PUSH_LB 1
+#define NN_PUSH_SPOOL 2
+#define NN_PUSH_SPOOL_SIZE 3
+#define NN_PUSH_SEQUENCE 4
+
+#define NN_PULL_CREDITS 1
+#define NN_PULL_FQ 2
+#define NN_PULL_SEQUENCE 3
+#define NN_PULL_REORDER 4
+
 #ifdef __cplusplus
 }
 #endif
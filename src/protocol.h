@@ -66,10 +66,27 @@ void *nn_pipe_getdata (struct nn_pipe *self);
     messages. */
 int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg);
 
+/*  Same as nn_pipe_send, except that the transport may reuse the parts of
+    the wire framing of the message that were already worked out when it
+    was sent to other pipes, and store those it works out itself, in
+    'frame'. All the messages sharing the frame have to have the same
+    content. */
+int nn_pipe_sendframe (struct nn_pipe *self, struct nn_msg *msg,
+    struct nn_msg_frame *frame);
+
 /*  Receive a message from a pipe. 'msg' should not be initialised prior to
     the call. It will be initialised when the call succeeds. */
 int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg);
 
+/*  Returns the number of messages sent to the pipe that haven't been written
+    to the network yet. */
+size_t nn_pipe_queued (struct nn_pipe *self);
+
+/*  Closes the underlying connection. The pipe is removed from the socket
+    later on, via the usual 'rm' notification. Returns -ENOTSUP if the
+    transport doesn't support closing connections on demand. */
+int nn_pipe_disconnect (struct nn_pipe *self);
+
 /*  Get option for pipe. Mostly useful for endpoint-specific options  */
 void nn_pipe_getopt (struct nn_pipe *self, int level, int option,
     void *optval, size_t *optvallen);
@@ -86,6 +103,11 @@ struct nn_sockbase;
 #define NN_SOCKBASE_EVENT_IN 1
 #define NN_SOCKBASE_EVENT_OUT 2
 
+/*  The set of subscriptions the socket's peers are interested in has changed
+    since it was last retrieved. Reported only by the socket types that
+    collect their peers' subscriptions. */
+#define NN_SOCKBASE_EVENT_SUBS 4
+
 /*  To be implemented by individual socket types. */
 struct nn_sockbase_vfptr {
 
@@ -155,6 +177,21 @@ int nn_sockbase_getopt (struct nn_sockbase *self, int option,
 void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
     int increment);
 
+/*  Latency histograms maintained for each socket. */
+#define NN_SOCKBASE_LATENCY_SNDWAIT 0
+#define NN_SOCKBASE_LATENCY_RCVDELAY 1
+#define NN_SOCKBASE_LATENCY_RTT 2
+#define NN_SOCKBASE_LATENCIES 3
+
+/*  Add a sample, in microseconds, to one of the latency histograms. */
+void nn_sockbase_stat_record (struct nn_sockbase *self, int latency,
+    uint64_t value);
+
+/*  Returns a percentile of one of the latency histograms, in thousandths;
+    e.g. 990 gives the 99th percentile. Returns 0 if there are no samples. */
+uint64_t nn_sockbase_stat_latency (struct nn_sockbase *self, int latency,
+    int permille);
+
 /******************************************************************************/
 /*  The socktype class.                                                       */
 /******************************************************************************/
@@ -167,6 +204,13 @@ void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
 /*  Specifies that the socket type can be never used to send messages. */
 #define NN_SOCKTYPE_FLAG_NOSEND 2
 
+/*  Specifies that the socket type keeps no state between individual send
+    and recv operations, i.e. send fails with EAGAIN (and nothing else) when
+    the socket lacks NN_SOCKBASE_EVENT_OUT, and so does recv when it lacks
+    NN_SOCKBASE_EVENT_IN. Non-blocking operations on such sockets can be
+    turned away without locking the socket. */
+#define NN_SOCKTYPE_FLAG_STATELESS 4
+
 struct nn_socktype {
 
     /*  Domain and protocol IDs as specified in nn_socket() function. */
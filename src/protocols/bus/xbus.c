@@ -31,6 +31,7 @@
 #include "../../utils/alloc.h"
 #include "../../utils/list.h"
 #include "../../utils/attr.h"
+#include "../../utils/chunk.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -40,6 +41,15 @@
     neccessary for the pointer to fit in 64-bit ID. */
 CT_ASSERT (sizeof (uint64_t) >= sizeof (struct nn_pipe*));
 
+/*  Upper limit for NN_BUS_DEDUP. The cache uses 32 bytes per ID. */
+#define NN_XBUS_DEDUP_MAX (1024 * 1024)
+
+/*  Private functions. */
+static void nn_xbus_dedup_init (struct nn_xbus_dedup *self, size_t size);
+static void nn_xbus_dedup_term (struct nn_xbus_dedup *self);
+static int nn_xbus_dedup_seen (struct nn_xbus_dedup *self,
+    struct nn_msg *msg);
+
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xbus_destroy (struct nn_sockbase *self);
 static const struct nn_sockbase_vfptr nn_xbus_sockbase_vfptr = {
@@ -62,10 +72,12 @@ void nn_xbus_init (struct nn_xbus *self,
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_dist_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    nn_xbus_dedup_init (&self->dedup, 0);
 }
 
 void nn_xbus_term (struct nn_xbus *self)
 {
+    nn_xbus_dedup_term (&self->dedup);
     nn_fq_term (&self->inpipes);
     nn_dist_term (&self->outpipes);
     nn_sockbase_term (&self->sockbase);
@@ -93,7 +105,7 @@ int nn_xbus_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xbus_data), "pipe data (xbus)");
     alloc_assert (data);
@@ -148,6 +160,7 @@ int nn_xbus_events (struct nn_sockbase *self)
 
 int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
+    struct nn_xbus *xbus;
     size_t hdrsz;
     struct nn_pipe *exclude;
 
@@ -162,8 +175,15 @@ int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg)
     else
         return -EINVAL;
 
-    return nn_dist_send (&nn_cont (self, struct nn_xbus, sockbase)->outpipes,
-        msg, exclude);
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    /*  Remember the message so that the copies coming back through
+        the mesh are dropped. */
+    if (xbus->dedup.size)
+        nn_xbus_dedup_seen (&xbus->dedup, msg);
+
+    /*  All the peers share a single copy of the message body. */
+    return nn_dist_send (&xbus->outpipes, msg, exclude);
 }
 
 int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
@@ -182,9 +202,19 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
             return rc;
 
         /*  The message should have no header. Drop malformed messages. */
-        if (nn_chunkref_size (&msg->sphdr) == 0)
-            break;
-        nn_msg_term (msg);
+        if (nn_slow (nn_chunkref_size (&msg->sphdr) != 0)) {
+            nn_msg_term (msg);
+            continue;
+        }
+
+        /*  Drop the messages that were already seen. */
+        if (xbus->dedup.size && nn_xbus_dedup_seen (&xbus->dedup, msg)) {
+            nn_sockbase_stat_increment (self, NN_STAT_DROPPED_MESSAGES, 1);
+            nn_msg_term (msg);
+            continue;
+        }
+
+        break;
     }
 
     /*  Add pipe ID to the message header. */
@@ -196,20 +226,156 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
     return 0;
 }
 
-int nn_xbus_setopt (NN_UNUSED struct nn_sockbase *self, NN_UNUSED int level,
-    NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+int nn_xbus_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xbus *xbus;
+    int val;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level != NN_BUS)
+        return -ENOPROTOOPT;
+
+    if (option == NN_BUS_DEDUP) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0 || val > NN_XBUS_DEDUP_MAX))
+            return -EINVAL;
+
+        /*  Changing the size starts with an empty cache. */
+        nn_xbus_dedup_term (&xbus->dedup);
+        nn_xbus_dedup_init (&xbus->dedup, val);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-int nn_xbus_getopt (NN_UNUSED struct nn_sockbase *self, NN_UNUSED int level,
-    NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+int nn_xbus_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    struct nn_xbus *xbus;
+    int intval;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level != NN_BUS)
+        return -ENOPROTOOPT;
+
+    if (option == NN_BUS_DEDUP) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        intval = (int) xbus->dedup.size;
+        memcpy (optval, &intval, sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
+static void nn_xbus_dedup_init (struct nn_xbus_dedup *self, size_t size)
+{
+    size_t slots;
+
+    self->size = size;
+    self->count = 0;
+    self->mask = 0;
+    self->cur = NULL;
+    self->prev = NULL;
+    if (!size)
+        return;
+
+    /*  Keep the tables at most half full so that the probe sequences stay
+        short. Zero marks an empty slot. */
+    slots = 1;
+    while (slots < size * 2)
+        slots <<= 1;
+    self->mask = slots - 1;
+    self->cur = nn_alloc (slots * sizeof (uint64_t), "bus dedup table");
+    alloc_assert (self->cur);
+    memset (self->cur, 0, slots * sizeof (uint64_t));
+    self->prev = nn_alloc (slots * sizeof (uint64_t), "bus dedup table");
+    alloc_assert (self->prev);
+    memset (self->prev, 0, slots * sizeof (uint64_t));
+}
+
+static void nn_xbus_dedup_term (struct nn_xbus_dedup *self)
+{
+    if (self->cur)
+        nn_free (self->cur);
+    if (self->prev)
+        nn_free (self->prev);
+}
+
+static int nn_xbus_dedup_find (struct nn_xbus_dedup *self,
+    const uint64_t *table, uint64_t id, size_t *slot)
+{
+    size_t i;
+
+    i = (size_t) id & self->mask;
+    while (table [i]) {
+        if (table [i] == id)
+            return 1;
+        i = (i + 1) & self->mask;
+    }
+    if (slot)
+        *slot = i;
+    return 0;
+}
+
+static uint64_t nn_xbus_dedup_hash (uint64_t id, const uint8_t *data,
+    size_t size)
+{
+    while (size--) {
+        id ^= *data++;
+        id *= 1099511628211ull;
+    }
+    return id;
+}
+
+static int nn_xbus_dedup_seen (struct nn_xbus_dedup *self,
+    struct nn_msg *msg)
+{
+    int i;
+    uint64_t id;
+    size_t slot;
+    uint64_t *tmp;
+
+    /*  BUS messages carry no ID on the wire, so the ID is the FNV-1a hash
+        of the payload. Identical payloads are thus treated as the same
+        message. A message sent in several parts is received flattened,
+        so the parts are hashed as if they were contiguous. */
+    id = nn_xbus_dedup_hash (14695981039346656037ull,
+        nn_chunkref_data (&msg->body), nn_chunkref_size (&msg->body));
+    for (i = 0; i != msg->nparts; ++i)
+        id = nn_xbus_dedup_hash (id, msg->parts [i],
+            nn_chunk_size (msg->parts [i]));
+    if (nn_slow (id == 0))
+        id = 1;
+
+    if (nn_xbus_dedup_find (self, self->prev, id, NULL))
+        return 1;
+    if (nn_xbus_dedup_find (self, self->cur, id, &slot))
+        return 1;
+
+    /*  The current generation is full. Retire it. */
+    if (self->count == self->size) {
+        tmp = self->prev;
+        self->prev = self->cur;
+        self->cur = tmp;
+        memset (self->cur, 0, (self->mask + 1) * sizeof (uint64_t));
+        self->count = 0;
+        nn_xbus_dedup_find (self, self->cur, id, &slot);
+    }
+
+    self->cur [slot] = id;
+    ++self->count;
+    return 0;
+}
+
 static int nn_xbus_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xbus *self;
@@ -230,7 +396,7 @@ int nn_xbus_ispeer (int socktype)
 struct nn_socktype nn_xbus_socktype = {
     AF_SP_RAW,
     NN_BUS,
-    0,
+    NN_SOCKTYPE_FLAG_STATELESS,
     nn_xbus_create,
     nn_xbus_ispeer,
 };
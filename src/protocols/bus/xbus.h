@@ -33,10 +33,26 @@ struct nn_xbus_data {
     struct nn_fq_data initem;
 };
 
+/*  Cache of the IDs of recently seen messages, used to drop the copies
+    that come back around the loops of a mesh. The IDs are kept in two
+    open-addressing tables; once the current one holds 'size' IDs it
+    replaces the previous one, which is forgotten. That way the memory
+    used stays bounded and no IDs have to be removed one by one. */
+struct nn_xbus_dedup {
+    size_t size;
+    size_t mask;
+    size_t count;
+    uint64_t *cur;
+    uint64_t *prev;
+};
+
 struct nn_xbus {
     struct nn_sockbase sockbase;
     struct nn_dist outpipes;
     struct nn_fq inpipes;
+
+    /*  Duplicate suppression. Disabled when dedup.size is zero. */
+    struct nn_xbus_dedup dedup;
 };
 
 void nn_xbus_init (struct nn_xbus *self,
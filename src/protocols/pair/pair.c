@@ -28,7 +28,7 @@
 struct nn_socktype nn_pair_socktype = {
     AF_SP,
     NN_PAIR,
-    0,
+    NN_SOCKTYPE_FLAG_STATELESS,
     nn_xpair_create,
     nn_xpair_ispeer,
 };
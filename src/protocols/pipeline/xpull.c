@@ -22,6 +22,7 @@
 */
 
 #include "xpull.h"
+#include "xpush.h"
 
 #include "../../nn.h"
 #include "../../pipeline.h"
@@ -32,21 +33,70 @@
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
+#include "../../utils/wire.h"
 #include "../../utils/attr.h"
 
+#include <string.h>
+
+/*  Per-pipe flags used for granting credits. */
+
+/*  The pipe can accept a message. */
+#define NN_XPULL_FLAG_WRITABLE 1
+
+/*  The peer should be sent a new credit limit. */
+#define NN_XPULL_FLAG_DIRTY 2
+
+/*  Maximum value of NN_PULL_REORDER option. */
+#define NN_XPULL_REORDER_MAX 65536
+
 struct nn_xpull_data {
     struct nn_fq_data fq;
+    struct nn_pipe *pipe;
+    int flags;
+
+    /*  Number of messages the peer may have in flight, zero if credits are
+        not used on this pipe. */
+    uint32_t window;
+
+    /*  Messages received from the pipe by the user and the limit last
+        granted to the peer, both since the pipe was established. */
+    uint32_t consumed;
+    uint32_t granted;
 };
 
 struct nn_xpull {
     struct nn_sockbase sockbase;
     struct nn_fq fq;
+
+    /*  NN_PULL_CREDITS option. */
+    int credits;
+
+    /*  NN_PULL_SEQUENCE option. */
+    int sequence;
+
+    /*  Reorder buffer, if NN_PULL_REORDER is set. The message with sequence
+        number 'next' is delivered next. The messages that arrived ahead of
+        it are held in 'slots', indexed by their sequence number modulo
+        'window', till it's their turn. A message that doesn't fit in the
+        window is held as 'stray' while the gap that keeps it out is
+        skipped. */
+    int window;
+    uint32_t next;
+    struct nn_msg *slots;
+    uint8_t *full;
+    int held;
+    int hasstray;
+    struct nn_msg stray;
 };
 
 /*  Private functions. */
 static void nn_xpull_init (struct nn_xpull *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xpull_term (struct nn_xpull *self);
+static void nn_xpull_flush (struct nn_xpull_data *data);
+static int nn_xpull_recvpipe (struct nn_xpull *self, struct nn_msg *msg);
+static int nn_xpull_pop (struct nn_xpull *self, struct nn_msg *msg);
+static void nn_xpull_setwindow (struct nn_xpull *self, int window);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xpull_destroy (struct nn_sockbase *self);
@@ -79,10 +129,19 @@ static void nn_xpull_init (struct nn_xpull *self,
 {
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_fq_init (&self->fq);
+    self->credits = 0;
+    self->sequence = 0;
+    self->window = 0;
+    self->next = 0;
+    self->slots = NULL;
+    self->full = NULL;
+    self->held = 0;
+    self->hasstray = 0;
 }
 
 static void nn_xpull_term (struct nn_xpull *self)
 {
+    nn_xpull_setwindow (self, 0);
     nn_fq_term (&self->fq);
     nn_sockbase_term (&self->sockbase);
 }
@@ -109,10 +168,15 @@ static int nn_xpull_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xpull_data), "pipe data (pull)");
     alloc_assert (data);
+    data->pipe = pipe;
+    data->window = (uint32_t) xpull->credits;
+    data->flags = data->window ? NN_XPULL_FLAG_DIRTY : 0;
+    data->consumed = 0;
+    data->granted = 0;
     nn_pipe_setdata (pipe, data);
     nn_fq_add (&xpull->fq, &data->fq, pipe, rcvprio);
 
@@ -142,40 +206,295 @@ static void nn_xpull_in (NN_UNUSED struct nn_sockbase *self,
 }
 
 static void nn_xpull_out (NN_UNUSED struct nn_sockbase *self,
-                          NN_UNUSED struct nn_pipe *pipe)
+                          struct nn_pipe *pipe)
 {
-    /*  We are not going to send any messages, so there's no point is
-        maintaining a list of pipes ready for sending. */
+    struct nn_xpull_data *data;
+
+    /*  The only messages ever sent are credit grants. If one was held back
+        because the pipe was busy, send it now. */
+    data = nn_pipe_getdata (pipe);
+    data->flags |= NN_XPULL_FLAG_WRITABLE;
+    nn_xpull_flush (data);
+}
+
+static void nn_xpull_flush (struct nn_xpull_data *data)
+{
+    int rc;
+    uint8_t *pos;
+    struct nn_msg msg;
+
+    if ((data->flags & (NN_XPULL_FLAG_WRITABLE | NN_XPULL_FLAG_DIRTY)) !=
+          (NN_XPULL_FLAG_WRITABLE | NN_XPULL_FLAG_DIRTY))
+        return;
+
+    data->granted = data->consumed + data->window;
+    nn_msg_init (&msg, 5);
+    pos = nn_chunkref_data (&msg.body);
+    pos [0] = NN_XPUSH_CMD_CREDIT;
+    nn_putl (pos + 1, data->granted);
+
+    data->flags &= ~NN_XPULL_FLAG_DIRTY;
+    rc = nn_pipe_send (data->pipe, &msg);
+    errnum_assert (rc >= 0, -rc);
+    if (rc & NN_PIPE_RELEASE)
+        data->flags &= ~NN_XPULL_FLAG_WRITABLE;
 }
 
 static int nn_xpull_events (struct nn_sockbase *self)
 {
-    return nn_fq_can_recv (&nn_cont (self, struct nn_xpull, sockbase)->fq) ?
-        NN_SOCKBASE_EVENT_IN : 0;
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    /*  Held messages can be delivered if the next one in sequence is there,
+        or if there's a gap to skip. */
+    if (nn_slow (xpull->window && (xpull->hasstray ||
+          xpull->full [xpull->next % xpull->window])))
+        return NN_SOCKBASE_EVENT_IN;
+    return nn_fq_can_recv (&xpull->fq) ? NN_SOCKBASE_EVENT_IN : 0;
 }
 
 static int nn_xpull_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xpull *xpull;
+    uint32_t seq;
+    uint32_t pos;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
 
-    rc = nn_fq_recv (&nn_cont (self, struct nn_xpull, sockbase)->fq,
-         msg, NULL);
+    if (nn_fast (!xpull->window))
+        return nn_xpull_recvpipe (xpull, msg);
+
+    while (1) {
+
+        /*  Deliver the next message in sequence if it's been held. */
+        if (nn_xpull_pop (xpull, msg))
+            return 0;
+
+        rc = nn_xpull_recvpipe (xpull, msg);
+        if (nn_slow (rc < 0))
+            return rc;
+
+        /*  The next message in sequence, and the late ones that arrive after
+            their turn was skipped, are delivered straight away. */
+        seq = nn_getl (nn_chunkref_data (&msg->sphdr));
+        if (seq == xpull->next) {
+            ++xpull->next;
+            return 0;
+        }
+        if ((int32_t) (seq - xpull->next) < 0)
+            return 0;
+
+        /*  The others are held, without copying them, till it's their turn.
+            So is a duplicate of a held message delivered straight away. */
+        if (seq - xpull->next < (uint32_t) xpull->window) {
+            pos = seq % xpull->window;
+            if (nn_slow (xpull->full [pos]))
+                return 0;
+            nn_msg_mv (&xpull->slots [pos], msg);
+            xpull->full [pos] = 1;
+            ++xpull->held;
+            continue;
+        }
+        nn_msg_mv (&xpull->stray, msg);
+        xpull->hasstray = 1;
+    }
+}
+
+static int nn_xpull_pop (struct nn_xpull *self, struct nn_msg *msg)
+{
+    uint32_t pos;
+    uint32_t seq;
+
+    while (1) {
+        pos = self->next % self->window;
+        if (self->full [pos]) {
+            nn_msg_mv (msg, &self->slots [pos]);
+            self->full [pos] = 0;
+            --self->held;
+            ++self->next;
+            return 1;
+        }
+        if (!self->hasstray)
+            return 0;
+
+        /*  The next message is missing while the window is exceeded. Give up
+            on it, e.g. the worker it was sent to may have died. Once there's
+            nothing held, move the window so that the stray message is at its
+            end in one go. */
+        seq = nn_getl (nn_chunkref_data (&self->stray.sphdr));
+        if (self->held)
+            ++self->next;
+        else
+            self->next = seq - (uint32_t) self->window + 1;
+        if (seq - self->next < (uint32_t) self->window) {
+            pos = seq % self->window;
+            self->hasstray = 0;
+            if (nn_slow (self->full [pos])) {
+                nn_msg_mv (msg, &self->stray);
+                return 1;
+            }
+            nn_msg_mv (&self->slots [pos], &self->stray);
+            self->full [pos] = 1;
+            ++self->held;
+        }
+    }
+}
+
+static int nn_xpull_recvpipe (struct nn_xpull *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_pipe *pipe;
+    struct nn_xpull_data *data;
+
+    rc = nn_fq_recv (&self->fq, msg, &pipe);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Once the user has consumed half of the window, top the peer's credit
+        up. Granting in batches keeps the upstream traffic low. */
+    data = nn_pipe_getdata (pipe);
+    if (data->window) {
+        ++data->consumed;
+        if (data->consumed - (data->granted - data->window) >=
+              (data->window + 1) / 2) {
+            data->flags |= NN_XPULL_FLAG_DIRTY;
+            nn_xpull_flush (data);
+        }
+    }
+
+    /*  Split the sequence number from the body. Messages without one are
+        ignored. */
+    if (nn_slow (self->sequence || self->window)) {
+        if (!(rc & NN_PIPE_PARSED)) {
+            if (nn_slow (nn_chunkref_size (&msg->body) < sizeof (uint32_t)))
+                nn_msg_flatten (msg);
+            if (nn_slow (nn_chunkref_size (&msg->body) < sizeof (uint32_t))) {
+                nn_msg_term (msg);
+                return -EAGAIN;
+            }
+            nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+            nn_chunkref_term (&msg->sphdr);
+            nn_chunkref_init (&msg->sphdr, sizeof (uint32_t));
+            memcpy (nn_chunkref_data (&msg->sphdr),
+                nn_chunkref_data (&msg->body), sizeof (uint32_t));
+            nn_chunkref_trim (&msg->body, sizeof (uint32_t));
+        }
+        else if (nn_slow (nn_chunkref_size (&msg->sphdr) !=
+              sizeof (uint32_t))) {
+            nn_msg_term (msg);
+            return -EAGAIN;
+        }
+    }
 
     /*  Discard NN_PIPEBASE_PARSED flag. */
-    return rc < 0 ? rc : 0;
+    return 0;
+}
+
+static void nn_xpull_setwindow (struct nn_xpull *self, int window)
+{
+    int i;
+
+    /*  The messages held in the old buffer are dropped. */
+    for (i = 0; i != self->window; ++i)
+        if (self->full [i])
+            nn_msg_term (&self->slots [i]);
+    if (self->hasstray)
+        nn_msg_term (&self->stray);
+    if (self->slots) {
+        nn_free (self->slots);
+        nn_free (self->full);
+    }
+    self->slots = NULL;
+    self->full = NULL;
+    self->held = 0;
+    self->hasstray = 0;
+    self->window = window;
+    if (!window)
+        return;
+
+    self->slots = nn_alloc (window * sizeof (struct nn_msg),
+        "reorder buffer (pull)");
+    alloc_assert (self->slots);
+    self->full = nn_alloc (window, "reorder buffer (pull)");
+    alloc_assert (self->full);
+    memset (self->full, 0, window);
 }
 
-static int nn_xpull_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+static int nn_xpull_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level == NN_PULL && option == NN_PULL_CREDITS) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        xpull->credits = *(int*) optval;
+        return 0;
+    }
+
+    if (level == NN_PULL && option == NN_PULL_FQ)
+        return nn_fq_setopt (&xpull->fq, optval, optvallen);
+
+    if (level == NN_PULL && option == NN_PULL_SEQUENCE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        xpull->sequence = *(int*) optval ? 1 : 0;
+        return 0;
+    }
+
+    if (level == NN_PULL && option == NN_PULL_REORDER) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0 ||
+              *(int*) optval > NN_XPULL_REORDER_MAX))
+            return -EINVAL;
+        nn_xpull_setwindow (xpull, *(int*) optval);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-static int nn_xpull_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+static int nn_xpull_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level == NN_PULL && option == NN_PULL_CREDITS) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpull->credits;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (level == NN_PULL && option == NN_PULL_FQ)
+        return nn_fq_getopt (&xpull->fq, optval, optvallen);
+
+    if (level == NN_PULL && option == NN_PULL_SEQUENCE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpull->sequence;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (level == NN_PULL && option == NN_PULL_REORDER) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpull->window;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -199,7 +518,7 @@ int nn_xpull_ispeer (int socktype)
 struct nn_socktype nn_xpull_socktype = {
     AF_SP_RAW,
     NN_PULL,
-    NN_SOCKTYPE_FLAG_NOSEND,
+    NN_SOCKTYPE_FLAG_NOSEND | NN_SOCKTYPE_FLAG_STATELESS,
     nn_xpull_create,
     nn_xpull_ispeer,
 };
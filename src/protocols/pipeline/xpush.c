@@ -26,26 +26,64 @@
 #include "../../pipeline.h"
 
 #include "../utils/lb.h"
+#include "../utils/spool.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
+#include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
+
+#include <string.h>
+
+/*  The pipe can accept a message. */
+#define NN_XPUSH_FLAG_WRITABLE 1
+
+/*  The peer grants credits, so only 'limit' messages can be sent. */
+#define NN_XPUSH_FLAG_CREDITED 2
+
+/*  Default value of NN_PUSH_SPOOL_SIZE option. */
+#define NN_XPUSH_SPOOL_SIZE (64 * 1024 * 1024)
 
 struct nn_xpush_data {
     struct nn_lb_data lb;
+    int flags;
+
+    /*  Number of messages sent to the pipe and the number of messages the
+        peer allows to be sent, both since the pipe was established. They
+        wrap around and are compared by their difference only. */
+    uint32_t sent;
+    uint32_t limit;
 };
 
 struct nn_xpush {
     struct nn_sockbase sockbase;
     struct nn_lb lb;
+
+    /*  Messages sent while there's no pipe to send them to, if NN_PUSH_SPOOL
+        is set. They are sent in order once there is one. 'spoolfull' is set
+        if the last message didn't fit in, till room is made. */
+    struct nn_spool spool;
+    char spoolpath [NN_SPOOL_PATH_MAX];
+    int spoolsize;
+    int spoolfull;
+
+    /*  NN_PUSH_SEQUENCE option and the sequence number of the next message
+        to be stamped. */
+    int sequence;
+    uint32_t seq;
 };
 
 /*  Private functions. */
 static void nn_xpush_init (struct nn_xpush *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xpush_term (struct nn_xpush *self);
+static int nn_xpush_hascredit (struct nn_xpush_data *data);
+static int nn_xpush_sendlb (struct nn_xpush *self, struct nn_msg *msg);
+static int nn_xpush_spill (struct nn_xpush *self, struct nn_msg *msg);
+static void nn_xpush_replay (struct nn_xpush *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xpush_destroy (struct nn_sockbase *self);
@@ -78,10 +116,18 @@ static void nn_xpush_init (struct nn_xpush *self,
 {
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_lb_init (&self->lb);
+    nn_spool_init (&self->spool);
+    self->spoolpath [0] = 0;
+    self->spoolsize = NN_XPUSH_SPOOL_SIZE;
+    self->spoolfull = 0;
+    self->sequence = 0;
+    self->seq = 0;
 }
 
 static void nn_xpush_term (struct nn_xpush *self)
 {
+    nn_spool_close (&self->spool);
+    nn_spool_term (&self->spool);
     nn_lb_term (&self->lb);
     nn_sockbase_term (&self->sockbase);
 }
@@ -108,10 +154,13 @@ static int nn_xpush_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (sndprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_SNDPRIO, &sndprio, &sz);
     nn_assert (sz == sizeof (sndprio));
-    nn_assert (sndprio >= 1 && sndprio <= 16);
+    nn_assert (sndprio >= 1 && sndprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xpush_data), "pipe data (push)");
     alloc_assert (data);
+    data->flags = 0;
+    data->sent = 0;
+    data->limit = 0;
     nn_pipe_setdata (pipe, data);
     nn_lb_add (&xpush->lb, &data->lb, pipe, sndprio);
 
@@ -132,11 +181,44 @@ static void nn_xpush_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
         nn_lb_get_priority (&xpush->lb));
 }
 
-static void nn_xpush_in (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED struct nn_pipe *pipe)
+static void nn_xpush_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    /*  We are not going to receive any messages, so there's no need to store
-        the list of inbound pipes. */
+    int rc;
+    struct nn_xpush *xpush;
+    struct nn_xpush_data *data;
+    struct nn_msg msg;
+    uint8_t *pos;
+
+    /*  The only messages pullers send are credit grants. */
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+    data = nn_pipe_getdata (pipe);
+    while (1) {
+        rc = nn_pipe_recv (pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        pos = nn_chunkref_data (&msg.body);
+        if (nn_chunkref_size (&msg.body) == 5 &&
+              pos [0] == NN_XPUSH_CMD_CREDIT) {
+            data->limit = nn_getl (pos + 1);
+            data->flags |= NN_XPUSH_FLAG_CREDITED;
+        }
+        nn_msg_term (&msg);
+        if (rc & NN_PIPE_RELEASE)
+            break;
+    }
+
+    /*  The new limit may make the pipe available or, if more messages were
+        sent before the first grant arrived than it allows, hold it back. */
+    if (!(data->flags & NN_XPUSH_FLAG_WRITABLE))
+        return;
+    if (nn_xpush_hascredit (data)) {
+        if (!nn_lb_isactive (&data->lb))
+            nn_lb_out (&xpush->lb, &data->lb);
+    }
+    else if (nn_lb_isactive (&data->lb))
+        nn_lb_hold (&xpush->lb, &data->lb);
+    nn_xpush_replay (xpush);
+    nn_sockbase_stat_increment (self, NN_STAT_CURRENT_SND_PRIORITY,
+        nn_lb_get_priority (&xpush->lb));
 }
 
 static void nn_xpush_out (struct nn_sockbase *self, struct nn_pipe *pipe)
@@ -146,34 +228,221 @@ static void nn_xpush_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 
     xpush = nn_cont (self, struct nn_xpush, sockbase);
     data = nn_pipe_getdata (pipe);
+    data->flags |= NN_XPUSH_FLAG_WRITABLE;
+    if (!nn_xpush_hascredit (data))
+        return;
     nn_lb_out (&xpush->lb, &data->lb);
+    nn_xpush_replay (xpush);
     nn_sockbase_stat_increment (self, NN_STAT_CURRENT_SND_PRIORITY,
         nn_lb_get_priority (&xpush->lb));
 }
 
 static int nn_xpush_events (struct nn_sockbase *self)
 {
-    return nn_lb_can_send (&nn_cont (self, struct nn_xpush, sockbase)->lb) ?
-        NN_SOCKBASE_EVENT_OUT : 0;
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    /*  With the spool, the socket is writable until the spool is full. */
+    if (nn_slow (nn_spool_isopen (&xpush->spool) && !xpush->spoolfull))
+        return NN_SOCKBASE_EVENT_OUT;
+    return nn_lb_can_send (&xpush->lb) ? NN_SOCKBASE_EVENT_OUT : 0;
 }
 
 static int nn_xpush_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_lb_send (&nn_cont (self, struct nn_xpush, sockbase)->lb,
-        msg, NULL);
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    /*  Stamp the message with its sequence number. A message that already
+        carries a header, e.g. a result passed on by a worker along with
+        the number of the task it belongs to, keeps it. */
+    if (nn_slow (xpush->sequence && !nn_chunkref_size (&msg->sphdr))) {
+        nn_chunkref_term (&msg->sphdr);
+        nn_chunkref_init (&msg->sphdr, sizeof (uint32_t));
+        nn_putl (nn_chunkref_data (&msg->sphdr), xpush->seq++);
+    }
+
+    /*  The messages spooled earlier go first, so that the order is kept.
+        If they can't be all sent, so can't the new one. */
+    if (nn_slow (nn_spool_isopen (&xpush->spool))) {
+        nn_xpush_replay (xpush);
+        if (!nn_spool_empty (&xpush->spool) || !nn_lb_can_send (&xpush->lb))
+            return nn_xpush_spill (xpush, msg);
+        xpush->spoolfull = 0;
+    }
+
+    return nn_xpush_sendlb (xpush, msg);
 }
 
-static int nn_xpush_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+static int nn_xpush_sendlb (struct nn_xpush *self, struct nn_msg *msg)
 {
+    int rc;
+    struct nn_xpush_data *data;
+    struct nn_pipe *to;
+
+    rc = nn_lb_send (&self->lb, msg, &to);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  If the pipe is still writable but the peer's credit was used up,
+        stop sending to it until more credit is granted. */
+    data = nn_pipe_getdata (to);
+    ++data->sent;
+    if (!nn_lb_isactive (&data->lb))
+        data->flags &= ~NN_XPUSH_FLAG_WRITABLE;
+    else if (nn_slow (!nn_xpush_hascredit (data)))
+        nn_lb_hold (&self->lb, &data->lb);
+
+    return rc;
+}
+
+static int nn_xpush_spill (struct nn_xpush *self, struct nn_msg *msg)
+{
+    int rc;
+
+    /*  The file region is stored along with the rest of the message, as
+        the descriptor won't be around by the time it's sent. */
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 &&
+          nn_msg_file (msg, NULL))) {
+        rc = nn_msg_loadfile (msg);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+
+    rc = nn_spool_push (&self->spool, msg);
+    if (nn_slow (rc < 0)) {
+        self->spoolfull = 1;
+        return rc;
+    }
+    nn_msg_term (msg);
+
+    return 0;
+}
+
+static void nn_xpush_replay (struct nn_xpush *self)
+{
+    int rc;
+    struct nn_msg msg;
+
+    if (nn_fast (!nn_spool_isopen (&self->spool)))
+        return;
+
+    while (nn_lb_can_send (&self->lb) && nn_spool_pop (&self->spool, &msg)) {
+        self->spoolfull = 0;
+
+        /*  Don't bother sending messages that went stale in the spool. */
+        if (nn_slow (msg.expiry && nn_clock_us () >= msg.expiry)) {
+            nn_msg_term (&msg);
+            nn_sockbase_stat_increment (&self->sockbase,
+                NN_STAT_EXPIRED_MESSAGES, 1);
+            continue;
+        }
+
+        rc = nn_xpush_sendlb (self, &msg);
+        errnum_assert (rc >= 0, -rc);
+    }
+}
+
+static int nn_xpush_hascredit (struct nn_xpush_data *data)
+{
+    if (!(data->flags & NN_XPUSH_FLAG_CREDITED))
+        return 1;
+    return (int32_t) (data->limit - data->sent) > 0 ? 1 : 0;
+}
+
+static int nn_xpush_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    int rc;
+    int val;
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level != NN_PUSH)
+        return -ENOPROTOOPT;
+
+    switch (option) {
+    case NN_PUSH_LB:
+        return nn_lb_setopt (&xpush->lb, optval, optvallen);
+
+    case NN_PUSH_SPOOL:
+
+        /*  The messages in the old spool stay there. An empty file name
+            disables the spool. */
+        if (nn_slow (optvallen >= NN_SPOOL_PATH_MAX ||
+              memchr (optval, 0, optvallen)))
+            return -EINVAL;
+        nn_spool_close (&xpush->spool);
+        xpush->spoolfull = 0;
+        memcpy (xpush->spoolpath, optval, optvallen);
+        xpush->spoolpath [optvallen] = 0;
+        if (!optvallen)
+            return 0;
+        rc = nn_spool_open (&xpush->spool, xpush->spoolpath,
+            (size_t) xpush->spoolsize);
+        if (nn_slow (rc < 0)) {
+            xpush->spoolpath [0] = 0;
+            return rc;
+        }
+        nn_xpush_replay (xpush);
+        return 0;
+
+    case NN_PUSH_SPOOL_SIZE:
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < NN_SPOOL_MINSIZE || val > NN_SPOOL_MAXSIZE))
+            return -EINVAL;
+        xpush->spoolsize = val;
+        return 0;
+
+    case NN_PUSH_SEQUENCE:
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        xpush->sequence = *(int*) optval ? 1 : 0;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-static int nn_xpush_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+static int nn_xpush_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    size_t sz;
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level != NN_PUSH)
+        return -ENOPROTOOPT;
+
+    switch (option) {
+    case NN_PUSH_LB:
+        return nn_lb_getopt (&xpush->lb, optval, optvallen);
+
+    case NN_PUSH_SPOOL:
+        sz = strlen (xpush->spoolpath);
+        memcpy (optval, xpush->spoolpath, *optvallen < sz ? *optvallen : sz);
+        *optvallen = sz;
+        return 0;
+
+    case NN_PUSH_SPOOL_SIZE:
+        memcpy (optval, &xpush->spoolsize,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+
+    case NN_PUSH_SEQUENCE:
+        memcpy (optval, &xpush->sequence,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -197,7 +466,7 @@ int nn_xpush_ispeer (int socktype)
 struct nn_socktype nn_xpush_socktype = {
     AF_SP_RAW,
     NN_PUSH,
-    NN_SOCKTYPE_FLAG_NORECV,
+    NN_SOCKTYPE_FLAG_NORECV | NN_SOCKTYPE_FLAG_STATELESS,
     nn_xpush_create,
     nn_xpush_ispeer,
 };
@@ -25,6 +25,13 @@
 
 #include "../../protocol.h"
 
+/*  Command sent upstream by pullers with NN_PULL_CREDITS enabled. The first
+    byte of the message is the command. CREDIT is followed by a 32-bit
+    network-order count of messages the pusher may have sent to the pipe
+    since it was established; it replaces any limit received earlier.
+    Unknown commands are ignored. */
+#define NN_XPUSH_CMD_CREDIT 1
+
 int nn_xpush_create (void *hint, struct nn_sockbase **sockbase);
 int nn_xpush_ispeer (int socktype);
 
@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "subgroup.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/alloc.h"
+#include "../../utils/list.h"
+#include "../../utils/cont.h"
+#include "../../utils/mutex.h"
+#include "../../utils/once.h"
+#include "../../utils/atomic.h"
+
+/*  Read-only copy of the subscriptions. 'flat' is NULL if there are none. */
+struct nn_subgroup_snap {
+    struct nn_atomic refcount;
+    uint8_t *flat;
+};
+
+struct nn_subgroup {
+    struct nn_list_item item;
+    int key;
+
+    /*  Number of sockets in the group. Guarded by the registry lock. */
+    int members;
+
+    /*  Guards the rest of the fields, except for 'gen', which is only ever
+        changed under it, but can be read without it. */
+    nn_mutex_t sync;
+    struct nn_trie trie;
+
+    /*  Bumped on every change of the subscriptions. */
+    struct nn_atomic gen;
+
+    /*  Snapshot of the current subscriptions, NULL if not built yet.
+        The group holds a reference to it. If the trie is too big to be
+        copied, 'giant' is set and the members match against the master
+        copy under the lock instead. */
+    struct nn_subgroup_snap *snap;
+    int giant;
+};
+
+/*  All the groups in the process. */
+static struct nn_list nn_subgroup_list;
+static nn_mutex_t nn_subgroup_sync;
+static nn_once_t nn_subgroup_once = NN_ONCE_INITIALIZER;
+
+/*  Private functions. */
+static void nn_subgroup_init (void);
+static void nn_subgroup_release (struct nn_subgroup_snap *snap);
+static void nn_subgroup_refresh (struct nn_subgroup_ref *self);
+
+static void nn_subgroup_init (void)
+{
+    nn_list_init (&nn_subgroup_list);
+    nn_mutex_init (&nn_subgroup_sync);
+}
+
+void nn_subgroup_join (struct nn_subgroup_ref *self, int key)
+{
+    struct nn_list_item *it;
+    struct nn_subgroup *group;
+
+    nn_do_once (&nn_subgroup_once, nn_subgroup_init);
+
+    nn_mutex_lock (&nn_subgroup_sync);
+    group = NULL;
+    for (it = nn_list_begin (&nn_subgroup_list);
+          it != nn_list_end (&nn_subgroup_list);
+          it = nn_list_next (&nn_subgroup_list, it)) {
+        group = nn_cont (it, struct nn_subgroup, item);
+        if (group->key == key)
+            break;
+        group = NULL;
+    }
+    if (!group) {
+        group = nn_alloc (sizeof (struct nn_subgroup), "subscription group");
+        alloc_assert (group);
+        nn_list_item_init (&group->item);
+        group->key = key;
+        group->members = 0;
+        nn_mutex_init (&group->sync);
+        nn_trie_init (&group->trie);
+        nn_atomic_init (&group->gen, 1);
+        group->snap = NULL;
+        group->giant = 0;
+        nn_list_insert (&nn_subgroup_list, &group->item,
+            nn_list_end (&nn_subgroup_list));
+    }
+    ++group->members;
+    nn_mutex_unlock (&nn_subgroup_sync);
+
+    self->group = group;
+    self->snap = NULL;
+    self->gen = 0;
+}
+
+void nn_subgroup_leave (struct nn_subgroup_ref *self)
+{
+    struct nn_subgroup *group;
+
+    group = self->group;
+    if (self->snap)
+        nn_subgroup_release (self->snap);
+    self->group = NULL;
+    self->snap = NULL;
+
+    nn_mutex_lock (&nn_subgroup_sync);
+    if (--group->members) {
+        nn_mutex_unlock (&nn_subgroup_sync);
+        return;
+    }
+    nn_list_erase (&nn_subgroup_list, &group->item);
+    nn_mutex_unlock (&nn_subgroup_sync);
+
+    if (group->snap)
+        nn_subgroup_release (group->snap);
+    nn_atomic_term (&group->gen);
+    nn_trie_term (&group->trie);
+    nn_mutex_term (&group->sync);
+    nn_list_item_term (&group->item);
+    nn_free (group);
+}
+
+struct nn_trie *nn_subgroup_lock (struct nn_subgroup_ref *self)
+{
+    nn_mutex_lock (&self->group->sync);
+    return &self->group->trie;
+}
+
+void nn_subgroup_unlock (struct nn_subgroup_ref *self, int changed)
+{
+    struct nn_subgroup *group;
+
+    /*  The snapshot is not rebuilt till someone needs it, so that adding
+        subscriptions one by one doesn't copy the trie over and over. */
+    group = self->group;
+    if (changed) {
+        if (group->snap) {
+            nn_subgroup_release (group->snap);
+            group->snap = NULL;
+        }
+        group->giant = 0;
+        nn_atomic_inc (&group->gen, 1);
+    }
+    nn_mutex_unlock (&group->sync);
+}
+
+int nn_subgroup_match (struct nn_subgroup_ref *self, const uint8_t *data,
+    size_t size, size_t *len)
+{
+    int rc;
+    struct nn_subgroup *group;
+
+    group = self->group;
+    if (nn_slow (nn_atomic_load (&group->gen) != self->gen))
+        nn_subgroup_refresh (self);
+
+    if (nn_fast (self->snap != NULL)) {
+        if (!self->snap->flat)
+            return 0;
+        return nn_trie_match_flat (self->snap->flat, data, size, len);
+    }
+
+    nn_mutex_lock (&group->sync);
+    rc = nn_trie_match_prefix (&group->trie, data, size, len);
+    nn_mutex_unlock (&group->sync);
+    return rc;
+}
+
+static void nn_subgroup_refresh (struct nn_subgroup_ref *self)
+{
+    int rc;
+    struct nn_subgroup *group;
+    struct nn_subgroup_snap *old;
+
+    group = self->group;
+    old = self->snap;
+
+    nn_mutex_lock (&group->sync);
+    if (!group->snap && !group->giant) {
+        group->snap = nn_alloc (sizeof (struct nn_subgroup_snap),
+            "subscription snapshot");
+        alloc_assert (group->snap);
+        rc = nn_trie_flatten (&group->trie, &group->snap->flat);
+        if (nn_fast (rc == 0))
+            nn_atomic_init (&group->snap->refcount, 1);
+        else {
+            errnum_assert (rc == -E2BIG, -rc);
+            nn_free (group->snap);
+            group->snap = NULL;
+            group->giant = 1;
+        }
+    }
+    self->snap = group->snap;
+    if (self->snap)
+        nn_atomic_inc (&self->snap->refcount, 1);
+    self->gen = nn_atomic_load (&group->gen);
+    nn_mutex_unlock (&group->sync);
+
+    if (old)
+        nn_subgroup_release (old);
+}
+
+static void nn_subgroup_release (struct nn_subgroup_snap *snap)
+{
+    if (nn_atomic_dec (&snap->refcount, 1) != 1)
+        return;
+    if (snap->flat)
+        nn_free (snap->flat);
+    nn_atomic_term (&snap->refcount);
+    nn_free (snap);
+}
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_SUBGROUP_INCLUDED
+#define NN_SUBGROUP_INCLUDED
+
+#include "trie.h"
+
+#include <stdint.h>
+
+/*  A set of subscriptions shared by several SUB sockets within the process.
+    The sockets join the group by its key. The master copy of the
+    subscriptions is changed under the group's lock; the sockets match
+    the messages against read-only snapshots of it, which are built lazily
+    after each change and shared by all the members till the next one. */
+
+struct nn_subgroup;
+struct nn_subgroup_snap;
+
+/*  A socket's membership of a group. */
+struct nn_subgroup_ref {
+    struct nn_subgroup *group;
+
+    /*  The snapshot the socket matches against and the generation of
+        the subscriptions it was built from. */
+    struct nn_subgroup_snap *snap;
+    uint32_t gen;
+};
+
+/*  Joins the group with the given key, creating it if needed. */
+void nn_subgroup_join (struct nn_subgroup_ref *self, int key);
+
+/*  Leaves the group. Once the last member leaves, the subscriptions are
+    gone. */
+void nn_subgroup_leave (struct nn_subgroup_ref *self);
+
+/*  Gives access to the master copy of the subscriptions. It has to be
+    released by nn_subgroup_unlock, with 'changed' set if the subscriptions
+    were modified. */
+struct nn_trie *nn_subgroup_lock (struct nn_subgroup_ref *self);
+void nn_subgroup_unlock (struct nn_subgroup_ref *self, int changed);
+
+/*  Same as nn_trie_match_prefix, for the group's subscriptions. */
+int nn_subgroup_match (struct nn_subgroup_ref *self, const uint8_t *data,
+    size_t size, size_t *len);
+
+#endif
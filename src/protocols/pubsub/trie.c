@@ -33,6 +33,40 @@
     we believe it to be. */
 CT_ASSERT (sizeof (struct nn_trie_node) == 24);
 
+/*  Sparse child lookup compares all the characters in a single 64-bit
+    word. */
+CT_ASSERT (NN_TRIE_SPARSE_MAX == 8);
+#define NN_TRIE_ONES 0x0101010101010101ULL
+
+/*  The flat copy of the trie is built after this many matches at least,
+    or after one match per 16 bytes of its last known size, whichever is
+    more. */
+#define NN_TRIE_COMPILE_MIN 1024
+
+/*  nn_trie_lanes [n] has the first n bytes set, in memory order, so it
+    can be loaded as a mask of used slots in a sparse node of type n. */
+static const uint8_t nn_trie_lanes [NN_TRIE_SPARSE_MAX + 1]
+      [NN_TRIE_SPARSE_MAX] = {
+    {0, 0, 0, 0, 0, 0, 0, 0},
+    {0xff, 0, 0, 0, 0, 0, 0, 0},
+    {0xff, 0xff, 0, 0, 0, 0, 0, 0},
+    {0xff, 0xff, 0xff, 0, 0, 0, 0, 0},
+    {0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0, 0, 0},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0, 0},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+};
+
+/*  State of the walk performed by nn_trie_foreach. 'buf' holds the string
+    represented by the node being visited. */
+struct nn_trie_walk {
+    nn_trie_fn fn;
+    void *arg;
+    uint8_t *buf;
+    size_t capacity;
+};
+
 /*  Forward declarations. */
 static struct nn_trie_node *nn_node_compact (struct nn_trie_node *self);
 static int nn_node_check_prefix (struct nn_trie_node *self,
@@ -41,10 +75,21 @@ static struct nn_trie_node **nn_node_child (struct nn_trie_node *self,
     int index);
 static struct nn_trie_node **nn_node_next (struct nn_trie_node *self,
     uint8_t c);
+static int nn_node_index (const struct nn_trie_node *self, uint8_t c);
+static int nn_node_children (const struct nn_trie_node *self);
+static size_t nn_node_flatsz (struct nn_trie_node *self);
+static uint32_t nn_node_flatten (struct nn_trie_node *self, uint8_t *buf,
+    size_t *pos);
+static void nn_trie_compile (struct nn_trie *self);
+static void nn_trie_invalidate (struct nn_trie *self);
+static struct nn_trie_node *nn_node_build (struct nn_trie_str *strs,
+    size_t count, size_t depth, struct nn_trie_str *tmp, size_t *fresh);
 static int nn_node_unsubscribe (struct nn_trie_node **self,
     const uint8_t *data, size_t size);
 static void nn_node_term (struct nn_trie_node *self);
 static int nn_node_has_subscribers (struct nn_trie_node *self);
+static void nn_node_foreach (struct nn_trie_node *self,
+    struct nn_trie_walk *walk, size_t len);
 static void nn_node_dump (struct nn_trie_node *self, int indent);
 static void nn_node_indent (int indent);
 static void nn_node_putchar (uint8_t c);
@@ -52,13 +97,63 @@ static void nn_node_putchar (uint8_t c);
 void nn_trie_init (struct nn_trie *self)
 {
     self->root = NULL;
+    self->flat = NULL;
+    self->flatsz = 0;
+    self->misses = 0;
 }
 
 void nn_trie_term (struct nn_trie *self)
 {
+    nn_trie_invalidate (self);
     nn_node_term (self->root);
 }
 
+void nn_trie_foreach (struct nn_trie *self, nn_trie_fn fn, void *arg)
+{
+    struct nn_trie_walk walk;
+
+    if (!self->root)
+        return;
+
+    walk.fn = fn;
+    walk.arg = arg;
+    walk.capacity = 64;
+    walk.buf = nn_alloc (walk.capacity, "trie walk");
+    alloc_assert (walk.buf);
+    nn_node_foreach (self->root, &walk, 0);
+    nn_free (walk.buf);
+}
+
+void nn_node_foreach (struct nn_trie_node *self, struct nn_trie_walk *walk,
+    size_t len)
+{
+    int i;
+    int children;
+    struct nn_trie_node *child;
+
+    /*  Make sure there's space for the prefix and one child character. */
+    if (len + self->prefix_len + 1 > walk->capacity) {
+        walk->capacity = (len + self->prefix_len + 1) * 2;
+        walk->buf = nn_realloc (walk->buf, walk->capacity);
+        alloc_assert (walk->buf);
+    }
+
+    memcpy (walk->buf + len, self->prefix, self->prefix_len);
+    len += self->prefix_len;
+    if (nn_node_has_subscribers (self))
+        walk->fn (walk->arg, walk->buf, len);
+
+    children = nn_node_children (self);
+    for (i = 0; i != children; ++i) {
+        child = *nn_node_child (self, i);
+        if (!child)
+            continue;
+        walk->buf [len] = self->type <= NN_TRIE_SPARSE_MAX ?
+            self->u.sparse.children [i] : (uint8_t) (self->u.dense.min + i);
+        nn_node_foreach (child, walk, len + 1);
+    }
+}
+
 void nn_trie_dump (struct nn_trie *self)
 {
     nn_node_dump (self->root, 0);
@@ -183,21 +278,51 @@ struct nn_trie_node **nn_node_next (struct nn_trie_node *self, uint8_t c)
 
     int i;
 
+    i = nn_node_index (self, c);
+    return i < 0 ? NULL : nn_node_child (self, i);
+}
+
+int nn_node_index (const struct nn_trie_node *self, uint8_t c)
+{
+    /*  Finds the index of the child corresponding to the supplied character.
+        Returns -1 if there's no such child. In dense mode the slot may still
+        be empty. */
+
+    int i;
+    uint64_t chars;
+    uint64_t lanes;
+
     if (self->type == 0)
-        return NULL;
+        return -1;
 
     /*  Sparse mode. */
     if (self->type <= 8) {
+
+        /*  Compare all eight characters at once. Unused slots are forced
+            to non-zero so that only a real match yields a zero byte. If
+            there's no zero byte there's no match and we are done. */
+        memcpy (&chars, self->u.sparse.children, sizeof (chars));
+        memcpy (&lanes, nn_trie_lanes [self->type], sizeof (lanes));
+        chars = (chars ^ (NN_TRIE_ONES * c)) | ~lanes;
+        if (!((chars - NN_TRIE_ONES) & ~chars & (NN_TRIE_ONES << 7)))
+            return -1;
+
         for (i = 0; i != self->type; ++i)
             if (self->u.sparse.children [i] == c)
-                return nn_node_child (self, i);
-        return NULL;
+                return i;
+        return -1;
     }
 
     /*  Dense mode. */
     if (c < self->u.dense.min || c > self->u.dense.max)
-        return NULL;
-    return nn_node_child (self, c - self->u.dense.min);
+        return -1;
+    return c - self->u.dense.min;
+}
+
+int nn_node_children (const struct nn_trie_node *self)
+{
+    return self->type <= NN_TRIE_SPARSE_MAX ?
+        self->type : (self->u.dense.max - self->u.dense.min + 1);
 }
 
 struct nn_trie_node *nn_node_compact (struct nn_trie_node *self)
@@ -250,6 +375,8 @@ int nn_trie_subscribe (struct nn_trie *self, const uint8_t *data, size_t size)
     int inserted;
     int more_nodes;
 
+    nn_trie_invalidate (self);
+
     /*  Step 1 -- Traverse the trie. */
 
     node = &self->root;
@@ -379,7 +506,7 @@ step3:
         assert (*node);
 
         /*  Fill in the new node. */
-        (*node)->refcount = 0;
+        (*node)->refcount = old_node->refcount;
         (*node)->prefix_len = old_node->prefix_len;
         (*node)->type = NN_TRIE_DENSE_TYPE;
         memcpy ((*node)->prefix, old_node->prefix, old_node->prefix_len);
@@ -436,11 +563,182 @@ step5:
     return (*node)->refcount == 1 ? 1 : 0;
 }
 
+size_t nn_trie_subscribe_many (struct nn_trie *self, struct nn_trie_str *strs,
+    size_t count)
+{
+    size_t fresh;
+    size_t i;
+    struct nn_trie_str *tmp;
+
+    if (!count)
+        return 0;
+
+    nn_trie_invalidate (self);
+    fresh = 0;
+    if (self->root) {
+        for (i = 0; i != count; ++i)
+            fresh += nn_trie_subscribe (self, strs [i].data, strs [i].size);
+        return fresh;
+    }
+
+    tmp = nn_alloc (count * sizeof (struct nn_trie_str), "trie strings");
+    alloc_assert (tmp);
+    self->root = nn_node_build (strs, count, 0, tmp, &fresh);
+    nn_free (tmp);
+    return fresh;
+}
+
+struct nn_trie_node *nn_node_build (struct nn_trie_str *strs, size_t count,
+    size_t depth, struct nn_trie_str *tmp, size_t *fresh)
+{
+    /*  Builds the node for a run of strings having the first 'depth'
+        characters in common, the part represented by the ancestors. On the
+        way, the run is sorted by the character following the node's prefix,
+        the strings ending at the node coming first. That makes the strings
+        of each subtree adjacent, like in MSD radix sort. */
+
+    struct nn_trie_node *self;
+    struct nn_trie_str str;
+    size_t counts [256];
+    size_t common;
+    size_t limit;
+    size_t pos;
+    size_t i;
+    size_t j;
+    int children;
+    int nbr;
+    int c;
+
+    /*  Find the prefix shared by all the strings of the run. */
+    limit = strs [0].size;
+    if (limit > depth + NN_TRIE_PREFIX_MAX)
+        limit = depth + NN_TRIE_PREFIX_MAX;
+    for (i = 1; i != count && limit > depth; ++i) {
+        if (limit > strs [i].size)
+            limit = strs [i].size;
+        for (j = depth; j != limit && strs [i].data [j] == strs [0].data [j];
+              ++j)
+            ;
+        limit = j;
+    }
+    common = limit;
+
+    /*  Move the strings ending here to the front and sort the rest by the
+        next character. Short runs are done by insertion sort, the long ones
+        by counting sort. */
+    pos = 0;
+    for (i = 0; i != count; ++i) {
+        if (strs [i].size == common) {
+            str = strs [i];
+            strs [i] = strs [pos];
+            strs [pos++] = str;
+        }
+    }
+    if (count - pos <= 32) {
+        for (i = pos + 1; i < count; ++i) {
+            str = strs [i];
+            for (j = i; j > pos &&
+                  strs [j - 1].data [common] > str.data [common]; --j)
+                strs [j] = strs [j - 1];
+            strs [j] = str;
+        }
+    }
+    else {
+        memset (counts, 0, sizeof (counts));
+        for (i = pos; i != count; ++i)
+            ++counts [strs [i].data [common]];
+        j = pos;
+        for (c = 0; c != 256; ++c) {
+            i = counts [c];
+            counts [c] = j;
+            j += i;
+        }
+        for (i = pos; i != count; ++i)
+            tmp [counts [strs [i].data [common]]++] = strs [i];
+        memcpy (strs + pos, tmp + pos,
+            (count - pos) * sizeof (struct nn_trie_str));
+    }
+
+    /*  Count the children. */
+    nbr = 0;
+    for (i = pos; i != count; i = j) {
+        c = strs [i].data [common];
+        for (j = i + 1; j != count && strs [j].data [common] == c; ++j)
+            ;
+        ++nbr;
+    }
+    if (nbr <= NN_TRIE_SPARSE_MAX)
+        children = nbr;
+    else
+        children = strs [count - 1].data [common] -
+            strs [pos].data [common] + 1;
+
+    self = nn_alloc (sizeof (struct nn_trie_node) +
+        children * sizeof (struct nn_trie_node*), "trie node");
+    alloc_assert (self);
+    self->refcount = (uint32_t) pos;
+    if (pos)
+        ++*fresh;
+    self->prefix_len = (uint8_t) (common - depth);
+    memcpy (self->prefix, strs [0].data + depth, self->prefix_len);
+    if (nbr <= NN_TRIE_SPARSE_MAX) {
+        self->type = (uint8_t) nbr;
+    }
+    else {
+        self->type = NN_TRIE_DENSE_TYPE;
+        self->u.dense.min = strs [pos].data [common];
+        self->u.dense.max = strs [count - 1].data [common];
+        self->u.dense.nbr = (uint16_t) nbr;
+        memset (self + 1, 0, children * sizeof (struct nn_trie_node*));
+    }
+
+    /*  Build the subtrees, one per distinct next character. */
+    nbr = 0;
+    for (i = pos; i != count; i = j) {
+        c = strs [i].data [common];
+        for (j = i + 1; j != count && strs [j].data [common] == c; ++j)
+            ;
+        if (self->type == NN_TRIE_DENSE_TYPE) {
+            *nn_node_child (self, c - self->u.dense.min) =
+                nn_node_build (strs + i, j - i, common + 1, tmp + i, fresh);
+        }
+        else {
+            self->u.sparse.children [nbr] = (uint8_t) c;
+            *nn_node_child (self, nbr) =
+                nn_node_build (strs + i, j - i, common + 1, tmp + i, fresh);
+        }
+        ++nbr;
+    }
+
+    return self;
+}
+
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
+{
+    size_t len;
+
+    return nn_trie_match_prefix (self, data, size, &len);
+}
+
+int nn_trie_match_prefix (struct nn_trie *self, const uint8_t *data,
+    size_t size, size_t *len)
 {
     struct nn_trie_node *node;
     struct nn_trie_node **tmp;
+    const uint8_t *start;
+
+    /*  Use the flat copy if available. Build it if the trie has been stable
+        for long enough. */
+    if (nn_fast (self->flat != NULL))
+        return nn_trie_match_flat (self->flat, data, size, len);
+    if (self->root && ++self->misses >= NN_TRIE_COMPILE_MIN &&
+          self->misses >= self->flatsz / 16) {
+        nn_trie_compile (self);
+        if (self->flat)
+            return nn_trie_match_flat (self->flat, data, size, len);
+    }
 
+    start = data;
     node = self->root;
     while (1) {
 
@@ -450,16 +748,25 @@ int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
 
         /*  Check whether whole prefix matches the data. If not so,
             the whole string won't match. */
-        if (nn_node_check_prefix (node, data, size) != node->prefix_len)
-            return 0;
-
-        /*  Skip the prefix. */
-        data += node->prefix_len;
-        size -= node->prefix_len;
+        if (node->prefix_len) {
+            if (size < node->prefix_len ||
+                  memcmp (node->prefix, data, node->prefix_len) != 0)
+                return 0;
+
+            /*  Skip the prefix. */
+            data += node->prefix_len;
+            size -= node->prefix_len;
+        }
 
         /*  If all the data are matched, return. */
-        if (nn_node_has_subscribers (node))
+        if (nn_node_has_subscribers (node)) {
+            *len = data - start;
             return 1;
+        }
+
+        /*  If the data are exhausted there's nothing more to match. */
+        if (!size)
+            return 0;
 
         /*  Move to the next node. */
         tmp = nn_node_next (node, *data);
@@ -469,8 +776,135 @@ int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
     }
 }
 
+int nn_trie_match_flat (const uint8_t *flat, const uint8_t *data, size_t size,
+    size_t *len)
+{
+    const struct nn_trie_node *node;
+    const uint8_t *start;
+    uint32_t offset;
+    int i;
+
+    /*  Same algorithm as above, only the children are found by offsets
+        into the flat copy. Offset 0 is the root, so it can't be a child
+        and is used to denote a missing one. */
+    start = data;
+    node = (const struct nn_trie_node*) flat;
+    while (1) {
+        if (node->prefix_len) {
+            if (size < node->prefix_len ||
+                  memcmp (node->prefix, data, node->prefix_len) != 0)
+                return 0;
+            data += node->prefix_len;
+            size -= node->prefix_len;
+        }
+        if (node->refcount) {
+            *len = data - start;
+            return 1;
+        }
+        if (!size)
+            return 0;
+        i = nn_node_index (node, *data);
+        if (i < 0)
+            return 0;
+        offset = ((const uint32_t*) (node + 1)) [i];
+        if (!offset)
+            return 0;
+        node = (const struct nn_trie_node*) (flat + offset);
+        ++data;
+        --size;
+    }
+}
+
+void nn_trie_compile (struct nn_trie *self)
+{
+    size_t sz;
+    size_t pos;
+
+    /*  Offsets are 32-bit. Giant tries are matched the slow way. */
+    sz = nn_node_flatsz (self->root);
+    self->flatsz = sz;
+    if (nn_slow (sz > UINT32_MAX))
+        return;
+
+    self->flat = nn_alloc (sz, "trie flat copy");
+    alloc_assert (self->flat);
+    pos = 0;
+    nn_node_flatten (self->root, self->flat, &pos);
+    nn_assert (pos == sz);
+}
+
+int nn_trie_flatten (struct nn_trie *self, uint8_t **flat)
+{
+    size_t sz;
+    size_t pos;
+
+    *flat = NULL;
+    if (!self->root)
+        return 0;
+    sz = nn_node_flatsz (self->root);
+    if (nn_slow (sz > UINT32_MAX))
+        return -E2BIG;
+    *flat = nn_alloc (sz, "trie flat copy");
+    alloc_assert (*flat);
+    pos = 0;
+    nn_node_flatten (self->root, *flat, &pos);
+    nn_assert (pos == sz);
+    return 0;
+}
+
+void nn_trie_invalidate (struct nn_trie *self)
+{
+    if (self->flat) {
+        nn_free (self->flat);
+        self->flat = NULL;
+    }
+    self->misses = 0;
+}
+
+size_t nn_node_flatsz (struct nn_trie_node *self)
+{
+    int i;
+    int children;
+    size_t sz;
+
+    if (!self)
+        return 0;
+
+    children = nn_node_children (self);
+    sz = sizeof (struct nn_trie_node) + children * sizeof (uint32_t);
+    for (i = 0; i != children; ++i)
+        sz += nn_node_flatsz (*nn_node_child (self, i));
+    return sz;
+}
+
+uint32_t nn_node_flatten (struct nn_trie_node *self, uint8_t *buf,
+    size_t *pos)
+{
+    int i;
+    int children;
+    uint32_t offset;
+    uint32_t child;
+    struct nn_trie_node *ch;
+
+    /*  The node header is copied verbatim, followed by the offsets of
+        the children. The children themselves follow in depth-first
+        order. */
+    offset = (uint32_t) *pos;
+    children = nn_node_children (self);
+    memcpy (buf + offset, self, sizeof (struct nn_trie_node));
+    *pos += sizeof (struct nn_trie_node) + children * sizeof (uint32_t);
+    for (i = 0; i != children; ++i) {
+        ch = *nn_node_child (self, i);
+        child = ch ? nn_node_flatten (ch, buf, pos) : 0;
+        memcpy (buf + offset + sizeof (struct nn_trie_node) +
+            i * sizeof (uint32_t), &child, sizeof (child));
+    }
+    return offset;
+}
+
 int nn_trie_unsubscribe (struct nn_trie *self, const uint8_t *data, size_t size)
 {
+    nn_trie_invalidate (self);
     return nn_node_unsubscribe (&self->root, data, size);
 }
 
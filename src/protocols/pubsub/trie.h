@@ -89,6 +89,19 @@ struct nn_trie {
     /*  The root node of the trie (representing the empty subscription). */
     struct nn_trie_node *root;
 
+    /*  Read-only copy of the trie used for matching. All the nodes are
+        stored in a single block, in depth-first order, and refer to their
+        children by 32-bit offsets. It is dropped whenever the trie changes
+        and rebuilt once enough matches were done to pay for the copying.
+        NULL if not built. */
+    uint8_t *flat;
+
+    /*  Size of the last built copy. */
+    size_t flatsz;
+
+    /*  Number of matches done since the trie was last changed. */
+    size_t misses;
+
 };
 
 /*  Initialise an empty trie. */
@@ -102,6 +115,20 @@ void nn_trie_term (struct nn_trie *self);
     0 is returned. */
 int nn_trie_subscribe (struct nn_trie *self, const uint8_t *data, size_t size);
 
+/*  A string to be added to the trie in bulk. */
+struct nn_trie_str {
+    const uint8_t *data;
+    size_t size;
+};
+
+/*  Adds all the strings in the array to the trie, same as calling
+    nn_trie_subscribe for each of them. If the trie is empty, it's built in
+    a single pass, each node being allocated with its final size, and the
+    array is sorted in the process. Returns the number of strings that
+    weren't in the trie before. */
+size_t nn_trie_subscribe_many (struct nn_trie *self, struct nn_trie_str *strs,
+    size_t count);
+
 /*  Remove the string from the trie. If the string was actually removed,
     1 is returned. If reference count was decremented without falling to zero,
     0 is returned. */
@@ -112,6 +139,29 @@ int nn_trie_unsubscribe (struct nn_trie *self, const uint8_t *data,
     it returns 0. */
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size);
 
+/*  Same as nn_trie_match, but if the string matches, the length of the
+    shortest subscription it matches is stored in 'len'. */
+int nn_trie_match_prefix (struct nn_trie *self, const uint8_t *data,
+    size_t size, size_t *len);
+
+/*  Invokes 'fn' once for every string stored in the trie, in no particular
+    order. Strings are passed without a terminating zero and the buffer is
+    valid only for the duration of the call. */
+typedef void (*nn_trie_fn) (void *arg, const uint8_t *data, size_t size);
+void nn_trie_foreach (struct nn_trie *self, nn_trie_fn fn, void *arg);
+
+/*  Builds a read-only copy of the trie in a single block and stores it in
+    'flat', or NULL if the trie is empty. The copy is not affected by later
+    changes to the trie, doesn't change when matched against and thus can be
+    matched by nn_trie_match_flat from several threads at once. It has to be
+    deallocated by nn_free. Returns -E2BIG if the trie is too big to be
+    copied. */
+int nn_trie_flatten (struct nn_trie *self, uint8_t **flat);
+
+/*  Same as nn_trie_match_prefix, for a copy made by nn_trie_flatten. */
+int nn_trie_match_flat (const uint8_t *flat, const uint8_t *data,
+    size_t size, size_t *len);
+
 /*  Debugging interface. */
 void nn_trie_dump (struct nn_trie *self);
 
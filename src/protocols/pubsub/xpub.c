@@ -21,23 +21,99 @@
 */
 
 #include "xpub.h"
+#include "trie.h"
 
 #include "../../nn.h"
 #include "../../pubsub.h"
 
 #include "../utils/dist.h"
 
+#include "../../aio/ctx.h"
+#include "../../aio/fsm.h"
+#include "../../aio/worker.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
 
 #include <stddef.h>
+#include <string.h>
+
+/*  Maximum value of NN_PUB_FANOUT. */
+#define NN_XPUB_FANOUT_MAX 64
+
+/*  Maximum number of messages waiting to be distributed by a partition's
+    worker. Messages beyond that are dropped for the partition. */
+#define NN_XPUB_FANOUT_BACKLOG 1024
+
+/*  Maximum number of messages distributed by a worker before it lets others
+    into the socket. */
+#define NN_XPUB_FANOUT_BATCH 16
+
+#define NN_XPUB_STATE_ACTIVE 1
+#define NN_XPUB_STATE_STOPPING 2
+
+/*  Message waiting for a slow subscriber to become writable again. */
+struct nn_xpub_queued {
+    struct nn_list_item item;
+    struct nn_msg msg;
+};
+
+struct nn_xpub_part;
 
 struct nn_xpub_data {
     struct nn_dist_data item;
+
+    /*  The partition the pipe belongs to. */
+    struct nn_xpub_part *part;
+
+    /*  Subscriptions forwarded by the peer. NULL if the peer doesn't forward
+        its subscriptions and thus gets every message. */
+    struct nn_trie *filter;
+
+    /*  Member of the partition's list of pipes, writable or not. */
+    struct nn_list_item pipe;
+
+    /*  Messages waiting for the pipe to become writable. The pipe is handed
+        back to the distributor only once this queue is drained. */
+    struct nn_list queue;
+    size_t queued_msgs;
+    size_t queued_bytes;
+
+    /*  Set once the connection was closed because of the pipe being too
+        slow. Nothing is sent to the pipe from then on. */
+    int disconnected;
+};
+
+/*  Pipes the messages are distributed to together. Unless NN_PUB_FANOUT
+    is set, there's a single partition and the messages are distributed to
+    it by the sending thread. Otherwise the pipes are spread over
+    the partitions and each partition is handed the messages to distribute
+    by a worker of its own. */
+struct nn_xpub_part {
+    struct nn_xpub *xpub;
+
+    /*  Distributor. */
+    struct nn_dist outpipes;
+
+    /*  All the pipes of the partition. Pipes that are not writable are
+        missing from the distributor, so this is where their queues are
+        looked for. */
+    struct nn_list pipes;
+    uint32_t npipes;
+
+    /*  Messages waiting to be distributed by the worker, and the task doing
+        it. Used only with NN_PUB_FANOUT. */
+    struct nn_list backlog;
+    size_t nbacklog;
+    struct nn_worker *worker;
+    struct nn_worker_task task;
+    int scheduled;
 };
 
 struct nn_xpub {
@@ -45,16 +121,67 @@ struct nn_xpub {
     /*  The generic socket base class. */
     struct nn_sockbase sockbase;
 
-    /*  Distributor. */
-    struct nn_dist outpipes;
+    /*  State machine receiving the partitions' tasks. */
+    struct nn_fsm fsm;
+    int state;
+
+    /*  Partitions of the pipes and the NN_PUB_FANOUT option. */
+    struct nn_xpub_part *parts;
+    int nparts;
+    int fanout;
+
+    /*  Number of pipes that have forwarded their subscriptions. While it is
+        zero, messages are distributed without per-pipe matching. */
+    int filtered;
+
+    /*  Number of all the attached pipes. */
+    uint32_t npipes;
+
+    /*  Limits of the per-pipe queues and what to do when they are hit. While
+        both limits are zero, messages for unwritable pipes are dropped. */
+    int hwm_msgs;
+    int hwm_bytes;
+    int drop_policy;
+
+    /*  Bumped whenever the subscriptions of the peers may have changed.
+        'subs_seen' is the generation last retrieved by the user via
+        NN_PUB_SUBSCRIPTIONS. */
+    uint32_t subs_gen;
+    uint32_t subs_seen;
+};
+
+/*  Union of the peers' subscriptions being packed into an option value. */
+struct nn_xpub_pack {
+    uint8_t *pos;
+    size_t left;
+    size_t size;
 };
 
 /*  Private functions. */
 static void nn_xpub_init (struct nn_xpub *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xpub_term (struct nn_xpub *self);
+static void nn_xpub_command (struct nn_xpub *self, struct nn_xpub_data *data,
+    struct nn_msg *msg);
+static int nn_xpub_match (struct nn_dist_data *item, struct nn_msg *msg);
+static void nn_xpub_enqueue (struct nn_xpub *self, struct nn_xpub_data *data,
+    struct nn_msg *msg);
+static int nn_xpub_flush (struct nn_xpub *self, struct nn_xpub_data *data);
+static int nn_xpub_purge (struct nn_xpub_data *data);
+static void nn_xpub_collect (void *arg, const uint8_t *data, size_t size);
+static void nn_xpub_pack (void *arg, const uint8_t *data, size_t size);
+static int nn_xpub_subscriptions (struct nn_xpub *self, void *optval,
+    size_t *optvallen);
+static void nn_xpub_partition (struct nn_xpub *self, int fanout);
+static void nn_xpub_unpartition (struct nn_xpub *self);
+static int nn_xpub_distribute (struct nn_xpub_part *part, struct nn_msg *msg);
+static void nn_xpub_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_xpub_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
 
 /*  Implementation of nn_sockbase's virtual functions. */
+static void nn_xpub_stop (struct nn_sockbase *self);
 static void nn_xpub_destroy (struct nn_sockbase *self);
 static int nn_xpub_add (struct nn_sockbase *self, struct nn_pipe *pipe);
 static void nn_xpub_rm (struct nn_sockbase *self, struct nn_pipe *pipe);
@@ -67,7 +194,7 @@ static int nn_xpub_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_xpub_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpub_sockbase_vfptr = {
-    NULL,
+    nn_xpub_stop,
     nn_xpub_destroy,
     nn_xpub_add,
     nn_xpub_rm,
@@ -84,15 +211,93 @@ static void nn_xpub_init (struct nn_xpub *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint)
 {
     nn_sockbase_init (&self->sockbase, vfptr, hint);
-    nn_dist_init (&self->outpipes);
+    nn_fsm_init_root (&self->fsm, nn_xpub_handler, nn_xpub_shutdown,
+        nn_sockbase_getctx (&self->sockbase));
+    self->state = NN_XPUB_STATE_ACTIVE;
+    nn_xpub_partition (self, 0);
+    self->filtered = 0;
+    self->npipes = 0;
+    self->hwm_msgs = 0;
+    self->hwm_bytes = 0;
+    self->drop_policy = NN_PUB_DROP_NEWEST;
+    self->subs_gen = 1;
+    self->subs_seen = 0;
+    nn_fsm_start (&self->fsm);
 }
 
 static void nn_xpub_term (struct nn_xpub *self)
 {
-    nn_dist_term (&self->outpipes);
+    nn_assert (self->npipes == 0);
+    nn_xpub_unpartition (self);
+    nn_fsm_term (&self->fsm);
     nn_sockbase_term (&self->sockbase);
 }
 
+static void nn_xpub_stop (struct nn_sockbase *self)
+{
+    struct nn_xpub *xpub;
+
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+    nn_fsm_stop (&xpub->fsm);
+}
+
+/*  Creates the partitions. With no fanout, there's a single partition
+    the messages are distributed to directly. */
+static void nn_xpub_partition (struct nn_xpub *self, int fanout)
+{
+    int i;
+    struct nn_xpub_part *part;
+    struct nn_worker *workers [NN_XPUB_FANOUT_MAX];
+
+    self->fanout = fanout;
+    self->nparts = fanout ? fanout : 1;
+    self->parts = nn_alloc (sizeof (struct nn_xpub_part) * self->nparts,
+        "partitions (pub)");
+    alloc_assert (self->parts);
+    if (fanout)
+        nn_ctx_choose_workers (nn_sockbase_getctx (&self->sockbase),
+            workers, fanout);
+    for (i = 0; i != self->nparts; ++i) {
+        part = &self->parts [i];
+        part->xpub = self;
+        nn_dist_init (&part->outpipes);
+        nn_list_init (&part->pipes);
+        part->npipes = 0;
+        nn_list_init (&part->backlog);
+        part->nbacklog = 0;
+        part->worker = fanout ? workers [i] : NULL;
+        nn_worker_task_init (&part->task, i, &self->fsm);
+        part->scheduled = 0;
+    }
+}
+
+static void nn_xpub_unpartition (struct nn_xpub *self)
+{
+    int i;
+    struct nn_xpub_part *part;
+    struct nn_xpub_queued *queued;
+
+    for (i = 0; i != self->nparts; ++i) {
+        part = &self->parts [i];
+        nn_assert (part->npipes == 0 && !part->scheduled);
+        while (!nn_list_empty (&part->backlog)) {
+            queued = nn_cont (nn_list_begin (&part->backlog),
+                struct nn_xpub_queued, item);
+            nn_list_erase (&part->backlog, &queued->item);
+            nn_list_item_term (&queued->item);
+            nn_msg_term (&queued->msg);
+            nn_free (queued);
+        }
+        nn_list_term (&part->backlog);
+        nn_worker_task_term (&part->task);
+        nn_list_term (&part->pipes);
+        nn_dist_term (&part->outpipes);
+    }
+    nn_free (self->parts);
+    self->parts = NULL;
+    self->nparts = 0;
+}
+
 void nn_xpub_destroy (struct nn_sockbase *self)
 {
     struct nn_xpub *xpub;
@@ -105,16 +310,37 @@ void nn_xpub_destroy (struct nn_sockbase *self)
 
 static int nn_xpub_add (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
+    int i;
     struct nn_xpub *xpub;
     struct nn_xpub_data *data;
+    struct nn_xpub_part *part;
 
     xpub = nn_cont (self, struct nn_xpub, sockbase);
 
+    /*  The pipe goes to the partition with the fewest pipes. */
+    part = &xpub->parts [0];
+    for (i = 1; i < xpub->nparts; ++i)
+        if (xpub->parts [i].npipes < part->npipes)
+            part = &xpub->parts [i];
+
     data = nn_alloc (sizeof (struct nn_xpub_data), "pipe data (pub)");
     alloc_assert (data);
-    nn_dist_add (&xpub->outpipes, &data->item, pipe);
+    data->part = part;
+    data->filter = NULL;
+    nn_list_item_init (&data->pipe);
+    nn_list_insert (&part->pipes, &data->pipe, nn_list_end (&part->pipes));
+    ++part->npipes;
+    ++xpub->npipes;
+    nn_list_init (&data->queue);
+    data->queued_msgs = 0;
+    data->queued_bytes = 0;
+    data->disconnected = 0;
+    nn_dist_add (&part->outpipes, &data->item, pipe);
     nn_pipe_setdata (pipe, data);
 
+    /*  Until it forwards its subscriptions, the peer gets every message. */
+    ++xpub->subs_gen;
+
     return 0;
 }
 
@@ -126,16 +352,109 @@ static void nn_xpub_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     xpub = nn_cont (self, struct nn_xpub, sockbase);
     data = nn_pipe_getdata (pipe);
 
-    nn_dist_rm (&xpub->outpipes, &data->item);
-
+    nn_dist_rm (&data->part->outpipes, &data->item);
+    nn_list_erase (&data->part->pipes, &data->pipe);
+    nn_list_item_term (&data->pipe);
+    --data->part->npipes;
+    --xpub->npipes;
+    nn_xpub_purge (data);
+    nn_list_term (&data->queue);
+
+    if (data->filter) {
+        nn_trie_term (data->filter);
+        nn_free (data->filter);
+        --xpub->filtered;
+    }
     nn_free (data);
+    ++xpub->subs_gen;
 }
 
-static void nn_xpub_in (NN_UNUSED struct nn_sockbase *self,
-                       NN_UNUSED struct nn_pipe *pipe)
+static void nn_xpub_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    /*  We shouldn't get any messages from subscribers. */
-    nn_assert (0);
+    int rc;
+    struct nn_xpub *xpub;
+    struct nn_xpub_data *data;
+    struct nn_msg msg;
+
+    /*  The only messages subscribers send are subscription updates. */
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+    data = nn_pipe_getdata (pipe);
+    if (nn_slow (data->disconnected))
+        return;
+    while (1) {
+        rc = nn_pipe_recv (pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        nn_xpub_command (xpub, data, &msg);
+        nn_msg_term (&msg);
+        if (rc & NN_PIPE_RELEASE)
+            break;
+    }
+}
+
+static void nn_xpub_command (struct nn_xpub *self, struct nn_xpub_data *data,
+    struct nn_msg *msg)
+{
+    uint8_t *pos;
+    size_t size;
+    size_t len;
+    struct nn_trie *filter;
+
+    pos = nn_chunkref_data (&msg->body);
+    size = nn_chunkref_size (&msg->body);
+    if (size < 1)
+        return;
+
+    switch (pos [0]) {
+    case NN_XPUB_CMD_SUBSCRIPTIONS:
+
+        /*  Parse the list into a fresh trie so that a malformed message
+            leaves the current filter intact. */
+        filter = nn_alloc (sizeof (struct nn_trie), "subscription filter");
+        alloc_assert (filter);
+        nn_trie_init (filter);
+        ++pos;
+        --size;
+        while (size) {
+            if (size < 4 || nn_getl (pos) > size - 4) {
+                nn_trie_term (filter);
+                nn_free (filter);
+                return;
+            }
+            len = nn_getl (pos);
+            nn_trie_subscribe (filter, pos + 4, len);
+            pos += 4 + len;
+            size -= 4 + len;
+        }
+        break;
+
+    case NN_XPUB_CMD_UNFILTERED:
+        filter = NULL;
+        break;
+
+    default:
+        return;
+    }
+
+    if (data->filter) {
+        nn_trie_term (data->filter);
+        nn_free (data->filter);
+        --self->filtered;
+    }
+    data->filter = filter;
+    if (filter)
+        ++self->filtered;
+    ++self->subs_gen;
+}
+
+static int nn_xpub_match (struct nn_dist_data *item, struct nn_msg *msg)
+{
+    struct nn_xpub_data *data;
+
+    data = nn_cont (item, struct nn_xpub_data, item);
+    if (!data->filter)
+        return 1;
+    return nn_trie_match (data->filter, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body));
 }
 
 static void nn_xpub_out (struct nn_sockbase *self, struct nn_pipe *pipe)
@@ -145,35 +464,430 @@ static void nn_xpub_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 
     xpub = nn_cont (self, struct nn_xpub, sockbase);
     data = nn_pipe_getdata (pipe);
+    if (nn_slow (data->disconnected))
+        return;
+
+    /*  Send the backlog first. If the pipe fills up again, it stays out of
+        the distributor and new messages keep being queued behind. */
+    if (nn_slow (data->queued_msgs) && !nn_xpub_flush (xpub, data))
+        return;
+    nn_dist_out (&data->part->outpipes, &data->item);
+}
 
-    nn_dist_out (&xpub->outpipes, &data->item);
+static void nn_xpub_enqueue (struct nn_xpub *self, struct nn_xpub_data *data,
+    struct nn_msg *msg)
+{
+    int rc;
+    int dropped;
+    size_t size;
+    struct nn_xpub_queued *queued;
+
+    /*  Make room for the message. An empty queue always accepts a message,
+        however large it is. */
+    size = nn_msg_bodysize (msg);
+    dropped = 0;
+    while (data->queued_msgs &&
+          ((self->hwm_msgs && data->queued_msgs >= (size_t) self->hwm_msgs) ||
+          (self->hwm_bytes &&
+          data->queued_bytes + size > (size_t) self->hwm_bytes))) {
+        if (self->drop_policy == NN_PUB_DROP_NEWEST) {
+            nn_sockbase_stat_increment (&self->sockbase,
+                NN_STAT_DROPPED_MESSAGES, 1);
+            return;
+        }
+        if (self->drop_policy == NN_PUB_DROP_OLDEST) {
+            queued = nn_cont (nn_list_begin (&data->queue),
+                struct nn_xpub_queued, item);
+            nn_list_erase (&data->queue, &queued->item);
+            nn_list_item_term (&queued->item);
+            --data->queued_msgs;
+            data->queued_bytes -= nn_msg_bodysize (&queued->msg);
+            nn_msg_term (&queued->msg);
+            nn_free (queued);
+            ++dropped;
+            continue;
+        }
+
+        /*  NN_PUB_DISCONNECT. If the transport can't close the connection
+            the backlog is thrown away instead and the subscriber carries on
+            from the current message. */
+        nn_assert (self->drop_policy == NN_PUB_DISCONNECT);
+        dropped += nn_xpub_purge (data);
+        rc = nn_pipe_disconnect (data->item.pipe);
+        if (rc == 0) {
+            data->disconnected = 1;
+            nn_sockbase_stat_increment (&self->sockbase,
+                NN_STAT_DROPPED_MESSAGES, dropped + 1);
+            return;
+        }
+        nn_assert (rc == -ENOTSUP);
+    }
+    if (dropped)
+        nn_sockbase_stat_increment (&self->sockbase,
+            NN_STAT_DROPPED_MESSAGES, dropped);
+
+    queued = nn_alloc (sizeof (struct nn_xpub_queued), "queued message (pub)");
+    alloc_assert (queued);
+    nn_list_item_init (&queued->item);
+    nn_msg_cp (&queued->msg, msg);
+    nn_list_insert (&data->queue, &queued->item, nn_list_end (&data->queue));
+    ++data->queued_msgs;
+    data->queued_bytes += size;
+}
+
+static int nn_xpub_flush (struct nn_xpub *self, struct nn_xpub_data *data)
+{
+    int rc;
+    uint64_t now;
+    struct nn_xpub_queued *queued;
+    struct nn_msg msg;
+
+    /*  Returns 1 if the whole queue was sent and the pipe is still writable,
+        0 otherwise. */
+    while (!nn_list_empty (&data->queue)) {
+        queued = nn_cont (nn_list_begin (&data->queue),
+            struct nn_xpub_queued, item);
+        nn_list_erase (&data->queue, &queued->item);
+        nn_list_item_term (&queued->item);
+        --data->queued_msgs;
+        data->queued_bytes -= nn_msg_bodysize (&queued->msg);
+        nn_msg_mv (&msg, &queued->msg);
+        nn_free (queued);
+
+        /*  Don't bother sending messages that went stale in the queue. */
+        if (nn_slow (msg.expiry)) {
+            now = nn_clock_us ();
+            if (now >= msg.expiry) {
+                nn_msg_term (&msg);
+                nn_sockbase_stat_increment (&self->sockbase,
+                    NN_STAT_EXPIRED_MESSAGES, 1);
+                continue;
+            }
+        }
+
+        rc = nn_pipe_send (data->item.pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        if (rc & NN_PIPE_RELEASE)
+            return 0;
+    }
+    return 1;
+}
+
+static int nn_xpub_purge (struct nn_xpub_data *data)
+{
+    int count;
+    struct nn_xpub_queued *queued;
+
+    count = 0;
+    while (!nn_list_empty (&data->queue)) {
+        queued = nn_cont (nn_list_begin (&data->queue),
+            struct nn_xpub_queued, item);
+        nn_list_erase (&data->queue, &queued->item);
+        nn_list_item_term (&queued->item);
+        nn_msg_term (&queued->msg);
+        nn_free (queued);
+        ++count;
+    }
+    data->queued_msgs = 0;
+    data->queued_bytes = 0;
+    return count;
 }
 
-static int nn_xpub_events (NN_UNUSED struct nn_sockbase *self)
+static int nn_xpub_events (struct nn_sockbase *self)
 {
+    struct nn_xpub *xpub;
+
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+    if (nn_slow (xpub->subs_gen != xpub->subs_seen))
+        return NN_SOCKBASE_EVENT_OUT | NN_SOCKBASE_EVENT_SUBS;
     return NN_SOCKBASE_EVENT_OUT;
 }
 
 static int nn_xpub_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_dist_send (&nn_cont (self, struct nn_xpub, sockbase)->outpipes,
-        msg, NULL);
+    int i;
+    struct nn_xpub *xpub;
+    struct nn_xpub_part *part;
+    struct nn_xpub_queued *queued;
+
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+
+    if (nn_fast (!xpub->fanout))
+        return nn_xpub_distribute (&xpub->parts [0], msg);
+
+    /*  Hand a copy of the message to each partition's worker. The body is
+        shared by all the copies. */
+    for (i = 0; i != xpub->nparts; ++i) {
+        part = &xpub->parts [i];
+        if (!part->npipes)
+            continue;
+        if (nn_slow (part->nbacklog >= NN_XPUB_FANOUT_BACKLOG)) {
+            nn_sockbase_stat_increment (&xpub->sockbase,
+                NN_STAT_DROPPED_MESSAGES, 1);
+            continue;
+        }
+        queued = nn_alloc (sizeof (struct nn_xpub_queued),
+            "queued message (pub)");
+        alloc_assert (queued);
+        nn_list_item_init (&queued->item);
+        nn_msg_cp (&queued->msg, msg);
+        nn_list_insert (&part->backlog, &queued->item,
+            nn_list_end (&part->backlog));
+        ++part->nbacklog;
+        if (!part->scheduled) {
+            part->scheduled = 1;
+            nn_worker_execute (part->worker, &part->task);
+        }
+    }
+    nn_msg_term (msg);
+    return 0;
 }
 
-static int nn_xpub_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+static int nn_xpub_distribute (struct nn_xpub_part *part, struct nn_msg *msg)
 {
-    return -ENOPROTOOPT;
+    struct nn_xpub *xpub;
+    struct nn_list_item *it;
+    struct nn_xpub_data *data;
+
+    xpub = part->xpub;
+
+    /*  The filters match the beginning of the payload, which may span
+        several of its parts. */
+    if (nn_slow (xpub->filtered && msg->nparts))
+        nn_msg_flatten (msg);
+
+    /*  Pipes that are not in the distributor, i.e. those that are not
+        writable or still have a backlog, get a copy of the message queued.
+        This has to be done first, as the distributor consumes the message. */
+    if (nn_slow ((xpub->hwm_msgs || xpub->hwm_bytes) &&
+          part->npipes != part->outpipes.count)) {
+        for (it = nn_list_begin (&part->pipes);
+              it != nn_list_end (&part->pipes);
+              it = nn_list_next (&part->pipes, it)) {
+            data = nn_cont (it, struct nn_xpub_data, pipe);
+            if (nn_dist_isout (&data->item) || data->disconnected)
+                continue;
+            if (xpub->filtered && !nn_xpub_match (&data->item, msg))
+                continue;
+            nn_xpub_enqueue (xpub, data, msg);
+        }
+    }
+
+    if (nn_fast (xpub->filtered == 0))
+        return nn_dist_send (&part->outpipes, msg, NULL);
+    return nn_dist_send_filtered (&part->outpipes, msg, nn_xpub_match);
+}
+
+static void nn_xpub_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    int rc;
+    int count;
+    struct nn_xpub *xpub;
+    struct nn_xpub_part *part;
+    struct nn_xpub_queued *queued;
+    struct nn_msg msg;
+
+    xpub = nn_cont (self, struct nn_xpub, fsm);
+
+    if (src == NN_FSM_ACTION && type == NN_FSM_START)
+        return;
+    nn_assert (type == NN_WORKER_TASK_EXECUTE);
+    nn_assert (src >= 0 && src < xpub->nparts);
+    part = nn_cont (srcptr, struct nn_xpub_part, task);
+
+    /*  Distribute a batch of messages. If there are more, queue the task
+        anew, so that the senders get a chance to enter the socket. */
+    for (count = 0; count != NN_XPUB_FANOUT_BATCH; ++count) {
+        if (nn_list_empty (&part->backlog)) {
+            part->scheduled = 0;
+            return;
+        }
+        queued = nn_cont (nn_list_begin (&part->backlog),
+            struct nn_xpub_queued, item);
+        nn_list_erase (&part->backlog, &queued->item);
+        nn_list_item_term (&queued->item);
+        --part->nbacklog;
+        nn_msg_mv (&msg, &queued->msg);
+        nn_free (queued);
+        rc = nn_xpub_distribute (part, &msg);
+        errnum_assert (rc == 0, -rc);
+    }
+    nn_worker_execute (part->worker, &part->task);
+}
+
+static void nn_xpub_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    int i;
+    struct nn_xpub *xpub;
+    struct nn_xpub_part *part;
+
+    xpub = nn_cont (self, struct nn_xpub, fsm);
+
+    /*  All the pipes are gone by now, but the tasks already queued have to
+        be executed before the socket can go away. */
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP))
+        xpub->state = NN_XPUB_STATE_STOPPING;
+    else {
+        nn_assert (xpub->state == NN_XPUB_STATE_STOPPING &&
+            type == NN_WORKER_TASK_EXECUTE);
+        part = nn_cont (srcptr, struct nn_xpub_part, task);
+        part->scheduled = 0;
+    }
+    for (i = 0; i != xpub->nparts; ++i)
+        if (xpub->parts [i].scheduled)
+            return;
+    xpub->state = NN_XPUB_STATE_ACTIVE;
+    nn_fsm_stopped_noevent (&xpub->fsm);
+    nn_sockbase_stopped (&xpub->sockbase);
 }
 
-static int nn_xpub_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+static int nn_xpub_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xpub *xpub;
+    int val;
+    int i;
+
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+
+    if (level != NN_PUB)
+        return -ENOPROTOOPT;
+    if (nn_slow (optvallen != sizeof (int)))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_PUB_FANOUT:
+
+        /*  The pipes can't be moved between the partitions. */
+        if (nn_slow (val < 0 || val > NN_XPUB_FANOUT_MAX))
+            return -EINVAL;
+        if (val == xpub->fanout)
+            return 0;
+        for (i = 0; i != xpub->nparts; ++i)
+            if (nn_slow (xpub->parts [i].npipes || xpub->parts [i].scheduled))
+                return -EINVAL;
+        nn_xpub_unpartition (xpub);
+        nn_xpub_partition (xpub, val);
+        return 0;
+    case NN_PUB_HWM_MSGS:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xpub->hwm_msgs = val;
+        return 0;
+    case NN_PUB_HWM_BYTES:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xpub->hwm_bytes = val;
+        return 0;
+    case NN_PUB_DROP_POLICY:
+        if (nn_slow (val != NN_PUB_DROP_NEWEST && val != NN_PUB_DROP_OLDEST &&
+              val != NN_PUB_DISCONNECT))
+            return -EINVAL;
+        xpub->drop_policy = val;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
+static int nn_xpub_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xpub *xpub;
+
+    xpub = nn_cont (self, struct nn_xpub, sockbase);
+
+    if (level != NN_PUB)
+        return -ENOPROTOOPT;
+    if (option == NN_PUB_SUBSCRIPTIONS)
+        return nn_xpub_subscriptions (xpub, optval, optvallen);
+    if (nn_slow (*optvallen < sizeof (int)))
+        return -EINVAL;
+
+    switch (option) {
+    case NN_PUB_HWM_MSGS:
+        *(int*) optval = xpub->hwm_msgs;
+        break;
+    case NN_PUB_HWM_BYTES:
+        *(int*) optval = xpub->hwm_bytes;
+        break;
+    case NN_PUB_DROP_POLICY:
+        *(int*) optval = xpub->drop_policy;
+        break;
+    case NN_PUB_FANOUT:
+        *(int*) optval = xpub->fanout;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    *optvallen = sizeof (int);
+
+    return 0;
+}
+
+static void nn_xpub_collect (void *arg, const uint8_t *data, size_t size)
+{
+    nn_trie_subscribe ((struct nn_trie*) arg, data, size);
+}
+
+static void nn_xpub_pack (void *arg, const uint8_t *data, size_t size)
+{
+    struct nn_xpub_pack *pack;
+
+    /*  Subscriptions that don't fit into the buffer are only measured. */
+    pack = (struct nn_xpub_pack*) arg;
+    pack->size += 4 + size;
+    if (pack->left < 4 + size) {
+        pack->left = 0;
+        return;
+    }
+    nn_putl (pack->pos, (uint32_t) size);
+    memcpy (pack->pos + 4, data, size);
+    pack->pos += 4 + size;
+    pack->left -= 4 + size;
+}
+
+/*  Packs the union of the peers' subscriptions in the same format as
+    NN_SUB_SUBSCRIBE_MANY expects. If any of the peers doesn't forward its
+    subscriptions, the union is the empty subscription matching everything. */
+static int nn_xpub_subscriptions (struct nn_xpub *self, void *optval,
+    size_t *optvallen)
+{
+    int i;
+    struct nn_trie all;
+    struct nn_list_item *it;
+    struct nn_xpub_part *part;
+    struct nn_xpub_data *data;
+    struct nn_xpub_pack pack;
+
+    nn_trie_init (&all);
+    if (self->filtered != (int) self->npipes)
+        nn_trie_subscribe (&all, (const uint8_t*) "", 0);
+    else {
+        for (i = 0; i != self->nparts; ++i) {
+            part = &self->parts [i];
+            for (it = nn_list_begin (&part->pipes);
+                  it != nn_list_end (&part->pipes);
+                  it = nn_list_next (&part->pipes, it)) {
+                data = nn_cont (it, struct nn_xpub_data, pipe);
+                nn_trie_foreach (data->filter, nn_xpub_collect, &all);
+            }
+        }
+    }
+    pack.pos = optval;
+    pack.left = *optvallen;
+    pack.size = 0;
+    nn_trie_foreach (&all, nn_xpub_pack, &pack);
+    nn_trie_term (&all);
+
+    *optvallen = pack.size;
+    self->subs_seen = self->subs_gen;
+    return 0;
+}
+
 int nn_xpub_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xpub *self;
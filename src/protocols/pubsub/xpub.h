@@ -25,6 +25,15 @@
 
 #include "../../protocol.h"
 
+/*  Commands sent upstream by subscribers with NN_SUB_FORWARD enabled.
+    The first byte of the message is the command. SUBSCRIPTIONS is followed
+    by the complete list of the subscriber's topics, each encoded as a 32-bit
+    network-order length and the topic itself; it replaces any list received
+    earlier on the same pipe. UNFILTERED reverts the pipe to receiving all
+    the messages. Unknown commands are ignored. */
+#define NN_XPUB_CMD_SUBSCRIPTIONS 1
+#define NN_XPUB_CMD_UNFILTERED 2
+
 int nn_xpub_create (void *hint, struct nn_sockbase **sockbase);
 int nn_xpub_ispeer (int socktype);
 
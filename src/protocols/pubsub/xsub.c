@@ -22,7 +22,9 @@
 */
 
 #include "xsub.h"
+#include "xpub.h"
 #include "trie.h"
+#include "subgroup.h"
 
 #include "../../nn.h"
 #include "../../pubsub.h"
@@ -33,22 +35,129 @@
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
+#include "../../utils/list.h"
+#include "../../utils/hash.h"
+#include "../../utils/wire.h"
 #include "../../utils/attr.h"
 
+#include <string.h>
+
+/*  Per-pipe flags used for subscription forwarding. */
+
+/*  The pipe can accept a message. */
+#define NN_XSUB_FLAG_WRITABLE 1
+
+/*  The subscription list known to the peer is out of date. */
+#define NN_XSUB_FLAG_DIRTY 2
+
+/*  The peer was sent a subscription list and filters messages for us. */
+#define NN_XSUB_FLAG_FORWARDED 4
+
+/*  A message waiting to be received by a conflating socket. */
+struct nn_xsub_pending {
+    struct nn_list_item item;
+    struct nn_hash_item hndl;
+    struct nn_msg msg;
+
+    /*  Length of the subscription the message matched. */
+    size_t keylen;
+
+    /*  Set if the message can be looked up by its subscription. */
+    int hashed;
+};
+
+/*  A topic subscribed to by NN_SUB_SUBSCRIBE_EXACT. The topic itself
+    follows the structure. Topics whose hashes collide are chained from
+    the one that is in the hash table. */
+struct nn_xsub_topic {
+    struct nn_hash_item hndl;
+    struct nn_list_item item;
+    struct nn_xsub_topic *next;
+    uint32_t refcount;
+    size_t size;
+};
+
 struct nn_xsub_data {
     struct nn_fq_data fq;
+    struct nn_list_item item;
+    struct nn_pipe *pipe;
+    int flags;
 };
 
 struct nn_xsub {
     struct nn_sockbase sockbase;
     struct nn_fq fq;
     struct nn_trie trie;
+
+    /*  All the pipes attached to the socket. */
+    struct nn_list pipes;
+
+    /*  NN_SUB_FORWARD option. */
+    int forward;
+
+    /*  NN_SUB_CONFLATE option. */
+    int conflate;
+
+    /*  NN_SUB_SHARE option. If non-zero, the subscriptions are those of
+        the group and 'trie' is not used. */
+    int share;
+    struct nn_subgroup_ref group;
+
+    /*  Messages taken from the pipes but not yet received, oldest first,
+        and the same messages hashed by the subscription they matched.
+        Used only if conflating. */
+    struct nn_list pending;
+    struct nn_hash index;
+
+    /*  Encoded subscription list, built lazily and shared by all the pipes.
+        Valid only if 'snapshot_valid' is set. */
+    struct nn_msg snapshot;
+    int snapshot_valid;
+
+    /*  The list the subscriptions were last replaced with by
+        NN_SUB_SUBSCRIPTIONS, as passed in. Valid only if 'replaced_valid' is
+        set, i.e. if the subscriptions haven't been changed since. */
+    uint8_t *replaced;
+    size_t replacedsz;
+    int replaced_valid;
+
+    /*  Exact topics subscribed to, in the order of subscription and hashed
+        by the topic. Matched before the prefixes in 'trie'. */
+    struct nn_list topics;
+    struct nn_hash topicindex;
+
+    /*  NN_SUB_TOPIC_DELIMITER option. -1 if the whole body of the message
+        is its topic. */
+    int delimiter;
 };
 
 /*  Private functions. */
 static void nn_xsub_init (struct nn_xsub *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xsub_term (struct nn_xsub *self);
+static void nn_xsub_invalidate (struct nn_xsub *self);
+static void nn_xsub_flush (struct nn_xsub *self, struct nn_xsub_data *data);
+static void nn_xsub_measure (void *arg, const uint8_t *data, size_t size);
+static void nn_xsub_encode (void *arg, const uint8_t *data, size_t size);
+static uint32_t nn_xsub_hashkey (const uint8_t *data, size_t size);
+static void nn_xsub_conflate (struct nn_xsub *self);
+static int nn_xsub_unpack (const void *optval, size_t optvallen,
+    struct nn_trie_str **strs, size_t *count);
+static void nn_xsub_forget (struct nn_xsub *self);
+static struct nn_trie *nn_xsub_lock (struct nn_xsub *self);
+static void nn_xsub_unlock (struct nn_xsub *self, int changed);
+static int nn_xsub_match (struct nn_xsub *self, const uint8_t *data,
+    size_t size, size_t *len);
+static int nn_xsub_share (struct nn_xsub *self, int key);
+static int nn_xsub_replace (struct nn_xsub *self, const void *optval,
+    size_t optvallen);
+static struct nn_xsub_topic *nn_xsub_topic_find (struct nn_xsub *self,
+    const uint8_t *data, size_t size);
+static int nn_xsub_subscribe_exact (struct nn_xsub *self,
+    const uint8_t *data, size_t size);
+static int nn_xsub_unsubscribe_exact (struct nn_xsub *self,
+    const uint8_t *data, size_t size);
+static void nn_xsub_clear_topics (struct nn_xsub *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xsub_destroy (struct nn_sockbase *self);
@@ -82,10 +191,47 @@ static void nn_xsub_init (struct nn_xsub *self,
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_fq_init (&self->fq);
     nn_trie_init (&self->trie);
+    nn_list_init (&self->pipes);
+    self->forward = 0;
+    self->conflate = 0;
+    self->share = 0;
+    nn_list_init (&self->pending);
+    nn_hash_init (&self->index);
+    self->snapshot_valid = 0;
+    self->replaced = NULL;
+    self->replacedsz = 0;
+    self->replaced_valid = 0;
+    nn_list_init (&self->topics);
+    nn_hash_init (&self->topicindex);
+    self->delimiter = -1;
 }
 
 static void nn_xsub_term (struct nn_xsub *self)
 {
+    struct nn_xsub_pending *pending;
+
+    while (!nn_list_empty (&self->pending)) {
+        pending = nn_cont (nn_list_begin (&self->pending),
+            struct nn_xsub_pending, item);
+        nn_list_erase (&self->pending, &pending->item);
+        nn_list_item_term (&pending->item);
+        if (pending->hashed)
+            nn_hash_erase (&self->index, &pending->hndl);
+        nn_hash_item_term (&pending->hndl);
+        nn_msg_term (&pending->msg);
+        nn_free (pending);
+    }
+    nn_hash_term (&self->index);
+    nn_list_term (&self->pending);
+    if (self->snapshot_valid)
+        nn_msg_term (&self->snapshot);
+    nn_xsub_forget (self);
+    if (self->share)
+        nn_subgroup_leave (&self->group);
+    nn_xsub_clear_topics (self);
+    nn_hash_term (&self->topicindex);
+    nn_list_term (&self->topics);
+    nn_list_term (&self->pipes);
     nn_trie_term (&self->trie);
     nn_fq_term (&self->fq);
     nn_sockbase_term (&self->sockbase);
@@ -113,10 +259,14 @@ static int nn_xsub_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xsub_data), "pipe data (sub)");
     alloc_assert (data);
+    data->pipe = pipe;
+    data->flags = xsub->forward ? NN_XSUB_FLAG_DIRTY : 0;
+    nn_list_item_init (&data->item);
+    nn_list_insert (&xsub->pipes, &data->item, nn_list_end (&xsub->pipes));
     nn_pipe_setdata (pipe, data);
     nn_fq_add (&xsub->fq, &data->fq, pipe, rcvprio);
 
@@ -131,6 +281,8 @@ static void nn_xsub_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     xsub = nn_cont (self, struct nn_xsub, sockbase);
     data = nn_pipe_getdata (pipe);
     nn_fq_rm (&xsub->fq, &data->fq);
+    nn_list_erase (&xsub->pipes, &data->item);
+    nn_list_item_term (&data->item);
     nn_free (data);
 }
 
@@ -144,27 +296,214 @@ static void nn_xsub_in (struct nn_sockbase *self, struct nn_pipe *pipe)
     nn_fq_in (&xsub->fq, &data->fq);
 }
 
-static void nn_xsub_out (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED struct nn_pipe *pipe)
+static void nn_xsub_out (struct nn_sockbase *self, struct nn_pipe *pipe)
+{
+    struct nn_xsub *xsub;
+    struct nn_xsub_data *data;
+
+    /*  The only messages ever sent are subscription updates. If one was
+        held back because the pipe was busy, send it now. */
+    xsub = nn_cont (self, struct nn_xsub, sockbase);
+    data = nn_pipe_getdata (pipe);
+    data->flags |= NN_XSUB_FLAG_WRITABLE;
+    nn_xsub_flush (xsub, data);
+}
+
+static void nn_xsub_invalidate (struct nn_xsub *self)
+{
+    struct nn_list_item *it;
+    struct nn_xsub_data *data;
+
+    /*  Subscriptions have changed. Let all the affected peers know. */
+    if (self->snapshot_valid) {
+        nn_msg_term (&self->snapshot);
+        self->snapshot_valid = 0;
+    }
+    for (it = nn_list_begin (&self->pipes);
+          it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        data = nn_cont (it, struct nn_xsub_data, item);
+        if (self->forward || (data->flags & NN_XSUB_FLAG_FORWARDED)) {
+            data->flags |= NN_XSUB_FLAG_DIRTY;
+            nn_xsub_flush (self, data);
+        }
+    }
+}
+
+static void nn_xsub_measure (void *arg, NN_UNUSED const uint8_t *data,
+    size_t size)
+{
+    *(size_t*) arg += 4 + size;
+}
+
+static void nn_xsub_encode (void *arg, const uint8_t *data, size_t size)
 {
-    /*  We are not going to send any messages until subscription forwarding
-        is implemented, so there's no point is maintaining a list of pipes
-        ready for sending. */
+    uint8_t **pos;
+
+    pos = (uint8_t**) arg;
+    nn_putl (*pos, (uint32_t) size);
+    memcpy (*pos + 4, data, size);
+    *pos += 4 + size;
+}
+
+static void nn_xsub_flush (struct nn_xsub *self, struct nn_xsub_data *data)
+{
+    int rc;
+    size_t size;
+    uint8_t *pos;
+    struct nn_msg msg;
+    struct nn_list_item *it;
+    struct nn_xsub_topic *topic;
+
+    if ((data->flags & (NN_XSUB_FLAG_WRITABLE | NN_XSUB_FLAG_DIRTY)) !=
+          (NN_XSUB_FLAG_WRITABLE | NN_XSUB_FLAG_DIRTY))
+        return;
+
+    /*  Exact topics are forwarded as prefixes. The publishers send
+        a superset of the matching messages then, which is filtered
+        here. */
+    if (self->forward) {
+        if (!self->snapshot_valid) {
+            size = 1;
+            nn_trie_foreach (&self->trie, nn_xsub_measure, &size);
+            for (it = nn_list_begin (&self->topics);
+                  it != nn_list_end (&self->topics);
+                  it = nn_list_next (&self->topics, it)) {
+                topic = nn_cont (it, struct nn_xsub_topic, item);
+                nn_xsub_measure (&size, (uint8_t*) (topic + 1), topic->size);
+            }
+            nn_msg_init (&self->snapshot, size);
+            pos = nn_chunkref_data (&self->snapshot.body);
+            *pos = NN_XPUB_CMD_SUBSCRIPTIONS;
+            ++pos;
+            nn_trie_foreach (&self->trie, nn_xsub_encode, &pos);
+            for (it = nn_list_begin (&self->topics);
+                  it != nn_list_end (&self->topics);
+                  it = nn_list_next (&self->topics, it)) {
+                topic = nn_cont (it, struct nn_xsub_topic, item);
+                nn_xsub_encode (&pos, (uint8_t*) (topic + 1), topic->size);
+            }
+            self->snapshot_valid = 1;
+        }
+        nn_msg_cp (&msg, &self->snapshot);
+        data->flags |= NN_XSUB_FLAG_FORWARDED;
+    }
+    else {
+        nn_msg_init (&msg, 1);
+        *(uint8_t*) nn_chunkref_data (&msg.body) = NN_XPUB_CMD_UNFILTERED;
+        data->flags &= ~NN_XSUB_FLAG_FORWARDED;
+    }
+
+    data->flags &= ~NN_XSUB_FLAG_DIRTY;
+    rc = nn_pipe_send (data->pipe, &msg);
+    errnum_assert (rc >= 0, -rc);
+    if (rc & NN_PIPE_RELEASE)
+        data->flags &= ~NN_XSUB_FLAG_WRITABLE;
 }
 
 static int nn_xsub_events (struct nn_sockbase *self)
 {
-    return nn_fq_can_recv (&nn_cont (self, struct nn_xsub, sockbase)->fq) ?
+    struct nn_xsub *xsub;
+
+    xsub = nn_cont (self, struct nn_xsub, sockbase);
+    return nn_fq_can_recv (&xsub->fq) || !nn_list_empty (&xsub->pending) ?
         NN_SOCKBASE_EVENT_IN : 0;
 }
 
+static uint32_t nn_xsub_hashkey (const uint8_t *data, size_t size)
+{
+    uint32_t key;
+
+    /*  FNV-1a. */
+    key = 2166136261u;
+    while (size--) {
+        key ^= *data++;
+        key *= 16777619u;
+    }
+    return key;
+}
+
+static void nn_xsub_conflate (struct nn_xsub *self)
+{
+    int rc;
+    size_t len;
+    uint32_t key;
+    uint8_t *data;
+    struct nn_msg msg;
+    struct nn_hash_item *hndl;
+    struct nn_xsub_pending *pending;
+
+    /*  Take all the messages that have arrived so far. A message replaces
+        the pending one that matched the same subscription, keeping its
+        place in the queue. */
+    while (1) {
+        rc = nn_fq_recv (&self->fq, &msg, NULL);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc >= 0, -rc);
+        data = nn_chunkref_data (&msg.body);
+        if (!nn_xsub_match (self, data, nn_chunkref_size (&msg.body),
+              &len)) {
+            nn_msg_term (&msg);
+            continue;
+        }
+
+        key = nn_xsub_hashkey (data, len);
+        hndl = nn_hash_get (&self->index, key);
+        if (hndl) {
+            pending = nn_cont (hndl, struct nn_xsub_pending, hndl);
+            if (pending->keylen == len &&
+                  memcmp (nn_chunkref_data (&pending->msg.body),
+                  data, len) == 0) {
+                nn_msg_term (&pending->msg);
+                nn_msg_mv (&pending->msg, &msg);
+                continue;
+            }
+        }
+
+        /*  On the unlikely collision of two subscriptions' hashes, the
+            message is queued without being conflated. */
+        pending = nn_alloc (sizeof (struct nn_xsub_pending),
+            "pending message (sub)");
+        alloc_assert (pending);
+        nn_msg_mv (&pending->msg, &msg);
+        pending->keylen = len;
+        nn_hash_item_init (&pending->hndl);
+        pending->hashed = hndl ? 0 : 1;
+        if (pending->hashed)
+            nn_hash_insert (&self->index, key, &pending->hndl);
+        nn_list_item_init (&pending->item);
+        nn_list_insert (&self->pending, &pending->item,
+            nn_list_end (&self->pending));
+    }
+}
+
 static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    size_t len;
     struct nn_xsub *xsub;
+    struct nn_xsub_pending *pending;
 
     xsub = nn_cont (self, struct nn_xsub, sockbase);
 
+    /*  Messages held back by conflation go first, even if the option was
+        switched off since. */
+    if (xsub->conflate)
+        nn_xsub_conflate (xsub);
+    if (!nn_list_empty (&xsub->pending)) {
+        pending = nn_cont (nn_list_begin (&xsub->pending),
+            struct nn_xsub_pending, item);
+        nn_list_erase (&xsub->pending, &pending->item);
+        nn_list_item_term (&pending->item);
+        if (pending->hashed)
+            nn_hash_erase (&xsub->index, &pending->hndl);
+        nn_hash_item_term (&pending->hndl);
+        nn_msg_mv (msg, &pending->msg);
+        nn_free (pending);
+        return 0;
+    }
+
     /*  Loop while a matching message is found or when there are no more
         messages to receive. */
     while (1) {
@@ -172,8 +511,8 @@ static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg)
         if (nn_slow (rc == -EAGAIN))
             return -EAGAIN;
         errnum_assert (rc >= 0, -rc);
-        rc = nn_trie_match (&xsub->trie, nn_chunkref_data (&msg->body),
-            nn_chunkref_size (&msg->body));
+        rc = nn_xsub_match (xsub, nn_chunkref_data (&msg->body),
+            nn_chunkref_size (&msg->body), &len);
         if (rc == 0) {
             nn_msg_term (msg);
             continue;
@@ -189,33 +528,443 @@ static int nn_xsub_setopt (struct nn_sockbase *self, int level, int option,
 {
     int rc;
     struct nn_xsub *xsub;
+    struct nn_trie *trie;
+    struct nn_trie_str *strs;
+    size_t count;
+    size_t i;
+    int removed;
 
     xsub = nn_cont (self, struct nn_xsub, sockbase);
 
     if (level != NN_SUB)
         return -ENOPROTOOPT;
 
+    if (option == NN_SUB_SUBSCRIPTIONS)
+        return nn_xsub_replace (xsub, optval, optvallen);
+
     if (option == NN_SUB_SUBSCRIBE) {
-        rc = nn_trie_subscribe (&xsub->trie, optval, optvallen);
+        nn_xsub_forget (xsub);
+        trie = nn_xsub_lock (xsub);
+        rc = nn_trie_subscribe (trie, optval, optvallen);
+        nn_xsub_unlock (xsub, rc == 1);
+        if (rc == 1 && xsub->forward)
+            nn_xsub_invalidate (xsub);
         if (rc >= 0)
             return 0;
         return rc;
     }
 
     if (option == NN_SUB_UNSUBSCRIBE) {
-        rc = nn_trie_unsubscribe (&xsub->trie, optval, optvallen);
+        nn_xsub_forget (xsub);
+        trie = nn_xsub_lock (xsub);
+        rc = nn_trie_unsubscribe (trie, optval, optvallen);
+        nn_xsub_unlock (xsub, rc == 1);
+        if (rc == 1 && xsub->forward)
+            nn_xsub_invalidate (xsub);
         if (rc >= 0)
             return 0;
         return rc;
     }
 
+    if (option == NN_SUB_SUBSCRIBE_MANY) {
+        rc = nn_xsub_unpack (optval, optvallen, &strs, &count);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_xsub_forget (xsub);
+        trie = nn_xsub_lock (xsub);
+        rc = nn_trie_subscribe_many (trie, strs, count) ? 1 : 0;
+        nn_xsub_unlock (xsub, rc);
+        if (rc && xsub->forward)
+            nn_xsub_invalidate (xsub);
+        nn_free (strs);
+        return 0;
+    }
+
+    if (option == NN_SUB_UNSUBSCRIBE_MANY) {
+        rc = nn_xsub_unpack (optval, optvallen, &strs, &count);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_xsub_forget (xsub);
+        trie = nn_xsub_lock (xsub);
+        removed = 0;
+        for (i = 0; i != count; ++i) {
+            rc = nn_trie_unsubscribe (trie, strs [i].data, strs [i].size);
+            if (rc == 1)
+                removed = 1;
+        }
+        nn_xsub_unlock (xsub, removed);
+        if (removed && xsub->forward)
+            nn_xsub_invalidate (xsub);
+        nn_free (strs);
+        return 0;
+    }
+
+    if (option == NN_SUB_SUBSCRIBE_EXACT) {
+        if (nn_slow (xsub->share))
+            return -EINVAL;
+        nn_xsub_forget (xsub);
+        rc = nn_xsub_subscribe_exact (xsub, optval, optvallen);
+        if (rc == 1 && xsub->forward)
+            nn_xsub_invalidate (xsub);
+        return 0;
+    }
+
+    if (option == NN_SUB_UNSUBSCRIBE_EXACT) {
+        if (nn_slow (xsub->share))
+            return -EINVAL;
+        nn_xsub_forget (xsub);
+        rc = nn_xsub_unsubscribe_exact (xsub, optval, optvallen);
+        if (rc == 1 && xsub->forward)
+            nn_xsub_invalidate (xsub);
+        if (rc >= 0)
+            return 0;
+        return rc;
+    }
+
+    if (option == NN_SUB_TOPIC_DELIMITER) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < -1 || *(int*) optval > 255))
+            return -EINVAL;
+        xsub->delimiter = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_SUB_FORWARD) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+
+        /*  Other members of the group could change the subscriptions
+            without the peers of this socket finding out. */
+        if (nn_slow (*(int*) optval && xsub->share))
+            return -EINVAL;
+        if (!!*(int*) optval != xsub->forward) {
+            xsub->forward = !!*(int*) optval;
+            nn_xsub_invalidate (xsub);
+        }
+        return 0;
+    }
+
+    if (option == NN_SUB_CONFLATE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        xsub->conflate = !!*(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_SUB_SHARE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        return nn_xsub_share (xsub, *(int*) optval);
+    }
+
     return -ENOPROTOOPT;
 }
 
-static int nn_xsub_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+/*  Splits the packed list of subscriptions, each preceded by its length
+    as a 32-bit number in network byte order. The strings aren't copied,
+    they point into the option value. */
+static int nn_xsub_unpack (const void *optval, size_t optvallen,
+    struct nn_trie_str **strs, size_t *count)
+{
+    const uint8_t *pos;
+    size_t left;
+    size_t size;
+    size_t i;
+
+    /*  Validate the whole list first, so that it's applied entirely or
+        not at all. */
+    pos = optval;
+    left = optvallen;
+    *count = 0;
+    while (left) {
+        if (nn_slow (left < 4))
+            return -EINVAL;
+        size = nn_getl (pos);
+        if (nn_slow (size > left - 4))
+            return -EINVAL;
+        pos += 4 + size;
+        left -= 4 + size;
+        ++*count;
+    }
+
+    *strs = nn_alloc ((*count ? *count : 1) * sizeof (struct nn_trie_str),
+        "subscriptions");
+    alloc_assert (*strs);
+    pos = optval;
+    for (i = 0; i != *count; ++i) {
+        (*strs) [i].size = nn_getl (pos);
+        (*strs) [i].data = pos + 4;
+        pos += 4 + (*strs) [i].size;
+    }
+    return 0;
+}
+
+static void nn_xsub_forget (struct nn_xsub *self)
+{
+    if (self->replaced_valid) {
+        nn_free (self->replaced);
+        self->replaced = NULL;
+        self->replaced_valid = 0;
+    }
+}
+
+/*  Replaces all the subscriptions by the packed list at once. Devices set
+    the same list over and over again, so if it hasn't changed since the last
+    time, the peers are not bothered with an update. */
+static int nn_xsub_replace (struct nn_xsub *self, const void *optval,
+    size_t optvallen)
+{
+    int rc;
+    struct nn_trie_str *strs;
+    size_t count;
+    struct nn_trie trie;
+    struct nn_trie *old;
+
+    if (self->replaced_valid && self->replacedsz == optvallen &&
+          memcmp (self->replaced, optval, optvallen) == 0)
+        return 0;
+
+    rc = nn_xsub_unpack (optval, optvallen, &strs, &count);
+    if (nn_slow (rc < 0))
+        return rc;
+    nn_trie_init (&trie);
+    nn_trie_subscribe_many (&trie, strs, count);
+    nn_free (strs);
+    old = nn_xsub_lock (self);
+    nn_trie_term (old);
+    *old = trie;
+    nn_xsub_unlock (self, 1);
+
+    /*  Other members of the group may change the subscriptions, so the list
+        is not remembered for them. */
+    nn_xsub_forget (self);
+    if (self->share)
+        return 0;
+    self->replaced = nn_alloc (optvallen ? optvallen : 1,
+        "subscriptions (sub)");
+    alloc_assert (self->replaced);
+    memcpy (self->replaced, optval, optvallen);
+    self->replacedsz = optvallen;
+    self->replaced_valid = 1;
+
+    if (self->forward)
+        nn_xsub_invalidate (self);
+    return 0;
+}
+
+static struct nn_trie *nn_xsub_lock (struct nn_xsub *self)
+{
+    if (self->share)
+        return nn_subgroup_lock (&self->group);
+    return &self->trie;
+}
+
+static void nn_xsub_unlock (struct nn_xsub *self, int changed)
+{
+    if (self->share)
+        nn_subgroup_unlock (&self->group, changed);
+}
+
+static int nn_xsub_match (struct nn_xsub *self, const uint8_t *data,
+    size_t size, size_t *len)
+{
+    size_t topiclen;
+    const uint8_t *end;
+
+    /*  The topic of the message is looked up among the exact subscriptions
+        first, which takes a single hash whatever their number. */
+    if (!nn_list_empty (&self->topics)) {
+        topiclen = size;
+        if (self->delimiter >= 0) {
+            end = memchr (data, self->delimiter, size);
+            if (end)
+                topiclen = end - data;
+        }
+        if (nn_xsub_topic_find (self, data, topiclen)) {
+            *len = topiclen;
+            return 1;
+        }
+    }
+
+    if (nn_slow (self->share))
+        return nn_subgroup_match (&self->group, data, size, len);
+    return nn_trie_match_prefix (&self->trie, data, size, len);
+}
+
+/*  A socket joining a group takes over the group's subscriptions. One that
+    leaves it starts with no subscriptions. */
+static int nn_xsub_share (struct nn_xsub *self, int key)
 {
+    if (key == self->share)
+        return 0;
+    if (nn_slow (key && self->forward))
+        return -EINVAL;
+
+    nn_xsub_forget (self);
+    if (self->share)
+        nn_subgroup_leave (&self->group);
+    nn_trie_term (&self->trie);
+    nn_trie_init (&self->trie);
+    nn_xsub_clear_topics (self);
+    self->share = key;
+    if (key)
+        nn_subgroup_join (&self->group, key);
+    return 0;
+}
+
+static struct nn_xsub_topic *nn_xsub_topic_find (struct nn_xsub *self,
+    const uint8_t *data, size_t size)
+{
+    struct nn_hash_item *hndl;
+    struct nn_xsub_topic *topic;
+
+    hndl = nn_hash_get (&self->topicindex, nn_xsub_hashkey (data, size));
+    if (!hndl)
+        return NULL;
+    for (topic = nn_cont (hndl, struct nn_xsub_topic, hndl); topic;
+          topic = topic->next)
+        if (topic->size == size &&
+              memcmp (topic + 1, data, size) == 0)
+            return topic;
+    return NULL;
+}
+
+/*  Same as nn_trie_subscribe, for an exact topic. */
+static int nn_xsub_subscribe_exact (struct nn_xsub *self,
+    const uint8_t *data, size_t size)
+{
+    uint32_t key;
+    struct nn_hash_item *hndl;
+    struct nn_xsub_topic *topic;
+
+    topic = nn_xsub_topic_find (self, data, size);
+    if (topic) {
+        ++topic->refcount;
+        return 0;
+    }
+
+    topic = nn_alloc (sizeof (struct nn_xsub_topic) + size,
+        "subscription (sub)");
+    alloc_assert (topic);
+    memcpy (topic + 1, data, size);
+    topic->size = size;
+    topic->refcount = 1;
+    topic->next = NULL;
+    nn_hash_item_init (&topic->hndl);
+    nn_list_item_init (&topic->item);
+    nn_list_insert (&self->topics, &topic->item, nn_list_end (&self->topics));
+
+    /*  On collision, the topic is chained after the one in the table. */
+    key = nn_xsub_hashkey (data, size);
+    hndl = nn_hash_get (&self->topicindex, key);
+    if (hndl) {
+        topic->next = nn_cont (hndl, struct nn_xsub_topic, hndl)->next;
+        nn_cont (hndl, struct nn_xsub_topic, hndl)->next = topic;
+    }
+    else
+        nn_hash_insert (&self->topicindex, key, &topic->hndl);
+    return 1;
+}
+
+/*  Same as nn_trie_unsubscribe, for an exact topic. */
+static int nn_xsub_unsubscribe_exact (struct nn_xsub *self,
+    const uint8_t *data, size_t size)
+{
+    uint32_t key;
+    struct nn_hash_item *hndl;
+    struct nn_xsub_topic *head;
+    struct nn_xsub_topic *topic;
+    struct nn_xsub_topic **prev;
+
+    topic = nn_xsub_topic_find (self, data, size);
+    if (nn_slow (!topic))
+        return -EINVAL;
+    if (--topic->refcount)
+        return 0;
+
+    /*  If the topic heads its chain, the next one takes its place in
+        the table. */
+    key = nn_xsub_hashkey (data, size);
+    hndl = nn_hash_get (&self->topicindex, key);
+    head = nn_cont (hndl, struct nn_xsub_topic, hndl);
+    if (head == topic) {
+        nn_hash_erase (&self->topicindex, &topic->hndl);
+        if (topic->next)
+            nn_hash_insert (&self->topicindex, key, &topic->next->hndl);
+    }
+    else {
+        for (prev = &head->next; *prev != topic; prev = &(*prev)->next)
+            ;
+        *prev = topic->next;
+    }
+    nn_list_erase (&self->topics, &topic->item);
+    nn_list_item_term (&topic->item);
+    nn_hash_item_term (&topic->hndl);
+    nn_free (topic);
+    return 1;
+}
+
+static void nn_xsub_clear_topics (struct nn_xsub *self)
+{
+    struct nn_xsub_topic *topic;
+
+    while (!nn_list_empty (&self->topics)) {
+        topic = nn_cont (nn_list_begin (&self->topics),
+            struct nn_xsub_topic, item);
+        nn_list_erase (&self->topics, &topic->item);
+        nn_list_item_term (&topic->item);
+        if (nn_hash_get (&self->topicindex,
+              nn_xsub_hashkey ((uint8_t*) (topic + 1), topic->size)) ==
+              &topic->hndl)
+            nn_hash_erase (&self->topicindex, &topic->hndl);
+        nn_hash_item_term (&topic->hndl);
+        nn_free (topic);
+    }
+}
+
+static int nn_xsub_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xsub *xsub;
+
+    xsub = nn_cont (self, struct nn_xsub, sockbase);
+
+    if (level != NN_SUB)
+        return -ENOPROTOOPT;
+
+    if (option == NN_SUB_FORWARD) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsub->forward;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_CONFLATE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsub->conflate;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_SHARE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsub->share;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_TOPIC_DELIMITER) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsub->delimiter;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -239,7 +988,7 @@ int nn_xsub_ispeer (int socktype)
 struct nn_socktype nn_xsub_socktype = {
     AF_SP_RAW,
     NN_SUB,
-    NN_SOCKTYPE_FLAG_NOSEND,
+    NN_SOCKTYPE_FLAG_NOSEND | NN_SOCKTYPE_FLAG_STATELESS,
     nn_xsub_create,
     nn_xsub_ispeer,
 };
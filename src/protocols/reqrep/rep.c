@@ -37,6 +37,19 @@
 
 #define NN_REP_INPROGRESS 1
 
+/*  Upper limit for NN_REP_CACHE. */
+#define NN_REP_CACHE_MAX (1024 * 1024)
+
+/*  Private functions. */
+static void nn_rep_cache_init (struct nn_rep_cache *self, size_t size);
+static void nn_rep_cache_term (struct nn_rep_cache *self);
+static struct nn_rep_entry *nn_rep_cache_find (struct nn_rep_cache *self,
+    struct nn_chunkref *backtrace, uint64_t hash);
+static void nn_rep_cache_add (struct nn_rep_cache *self,
+    struct nn_chunkref *backtrace, struct nn_msg *reply);
+static void nn_rep_cache_evict (struct nn_rep_cache *self);
+static uint64_t nn_rep_cache_hash (struct nn_chunkref *backtrace);
+
 static const struct nn_sockbase_vfptr nn_rep_sockbase_vfptr = {
     NULL,
     nn_rep_destroy,
@@ -47,8 +60,8 @@ static const struct nn_sockbase_vfptr nn_rep_sockbase_vfptr = {
     nn_rep_events,
     nn_rep_send,
     nn_rep_recv,
-    nn_xrep_setopt,
-    nn_xrep_getopt
+    nn_rep_setopt,
+    nn_rep_getopt
 };
 
 void nn_rep_init (struct nn_rep *self,
@@ -56,12 +69,14 @@ void nn_rep_init (struct nn_rep *self,
 {
     nn_xrep_init (&self->xrep, vfptr, hint);
     self->flags = 0;
+    nn_rep_cache_init (&self->cache, 0);
 }
 
 void nn_rep_term (struct nn_rep *self)
 {
     if (self->flags & NN_REP_INPROGRESS)
         nn_chunkref_term (&self->backtrace);
+    nn_rep_cache_term (&self->cache);
     nn_xrep_term (&self->xrep);
 }
 
@@ -98,6 +113,12 @@ int nn_rep_send (struct nn_sockbase *self, struct nn_msg *msg)
     if (nn_slow (!(rep->flags & NN_REP_INPROGRESS)))
         return -EFSM;
 
+    /*  Remember the reply so that a resent copy of the request can be
+        answered straight away. Replies carrying properties, such as file
+        descriptors, can't be sent twice and are not cached. */
+    if (rep->cache.size && nn_chunkref_size (&msg->hdrs) == 0)
+        nn_rep_cache_add (&rep->cache, &rep->backtrace, msg);
+
     /*  Move the stored backtrace into the message header. */
     nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
     nn_chunkref_term (&msg->sphdr);
@@ -116,20 +137,43 @@ int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_rep *rep;
+    struct nn_rep_entry *entry;
+    struct nn_msg reply;
 
     rep = nn_cont (self, struct nn_rep, xrep.sockbase);
 
     /*  If a request is already being processed, cancel it. */
     if (nn_slow (rep->flags & NN_REP_INPROGRESS)) {
+        nn_xrep_cancel (&rep->xrep.sockbase, &rep->backtrace);
         nn_chunkref_term (&rep->backtrace);
         rep->flags &= ~NN_REP_INPROGRESS;
     }
 
-    /*  Receive the request. */
-    rc = nn_xrep_recv (&rep->xrep.sockbase, msg);
-    if (nn_slow (rc == -EAGAIN))
-        return -EAGAIN;
-    errnum_assert (rc == 0, -rc);
+    while (1) {
+
+        /*  Receive the request. */
+        rc = nn_xrep_recv (&rep->xrep.sockbase, msg);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc == 0, -rc);
+
+        if (!rep->cache.size)
+            break;
+        entry = nn_rep_cache_find (&rep->cache, &msg->sphdr,
+            nn_rep_cache_hash (&msg->sphdr));
+        if (!entry)
+            break;
+
+        /*  The request was answered already. Send the cached reply back
+            instead of handing the request to the user. */
+        nn_msg_cp (&reply, &entry->reply);
+        nn_chunkref_term (&reply.sphdr);
+        nn_chunkref_mv (&reply.sphdr, &msg->sphdr);
+        nn_chunkref_init (&msg->sphdr, 0);
+        nn_msg_term (msg);
+        rc = nn_xrep_send (&rep->xrep.sockbase, &reply);
+        errnum_assert (rc == 0, -rc);
+    }
 
     /*  Store the backtrace. */
     nn_chunkref_mv (&rep->backtrace, &msg->sphdr);
@@ -139,6 +183,168 @@ int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg)
     return 0;
 }
 
+int nn_rep_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_rep *rep;
+    int val;
+
+    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+
+    if (level == NN_REP && option == NN_REP_CACHE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0 || val > NN_REP_CACHE_MAX))
+            return -EINVAL;
+
+        /*  Changing the size starts with an empty cache. */
+        nn_rep_cache_term (&rep->cache);
+        nn_rep_cache_init (&rep->cache, val);
+        return 0;
+    }
+
+    return nn_xrep_setopt (self, level, option, optval, optvallen);
+}
+
+int nn_rep_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_rep *rep;
+    int intval;
+
+    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+
+    if (level == NN_REP && option == NN_REP_CACHE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        intval = (int) rep->cache.size;
+        memcpy (optval, &intval, sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return nn_xrep_getopt (self, level, option, optval, optvallen);
+}
+
+static void nn_rep_cache_init (struct nn_rep_cache *self, size_t size)
+{
+    size_t buckets;
+
+    self->size = size;
+    self->count = 0;
+    self->mask = 0;
+    self->buckets = NULL;
+    nn_list_init (&self->entries);
+    if (!size)
+        return;
+
+    buckets = 1;
+    while (buckets < size)
+        buckets <<= 1;
+    self->mask = buckets - 1;
+    self->buckets = nn_alloc (buckets * sizeof (struct nn_rep_entry*),
+        "rep cache buckets");
+    alloc_assert (self->buckets);
+    memset (self->buckets, 0, buckets * sizeof (struct nn_rep_entry*));
+}
+
+static void nn_rep_cache_term (struct nn_rep_cache *self)
+{
+    while (self->count)
+        nn_rep_cache_evict (self);
+    nn_list_term (&self->entries);
+    if (self->buckets)
+        nn_free (self->buckets);
+}
+
+static struct nn_rep_entry *nn_rep_cache_find (struct nn_rep_cache *self,
+    struct nn_chunkref *backtrace, uint64_t hash)
+{
+    struct nn_rep_entry *entry;
+    size_t size;
+
+    size = nn_chunkref_size (backtrace);
+    for (entry = self->buckets [hash & self->mask]; entry;
+          entry = entry->next) {
+        if (entry->hash == hash &&
+              nn_chunkref_size (&entry->backtrace) == size &&
+              memcmp (nn_chunkref_data (&entry->backtrace),
+              nn_chunkref_data (backtrace), size) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void nn_rep_cache_add (struct nn_rep_cache *self,
+    struct nn_chunkref *backtrace, struct nn_msg *reply)
+{
+    uint64_t hash;
+    struct nn_rep_entry *entry;
+    struct nn_rep_entry **bucket;
+
+    /*  The same request may have been handed to the user twice if it was
+        resent before it was answered. Keep the first reply. */
+    hash = nn_rep_cache_hash (backtrace);
+    if (nn_rep_cache_find (self, backtrace, hash))
+        return;
+
+    if (self->count == self->size)
+        nn_rep_cache_evict (self);
+
+    entry = nn_alloc (sizeof (struct nn_rep_entry), "rep cache entry");
+    alloc_assert (entry);
+    entry->hash = hash;
+    nn_chunkref_cp (&entry->backtrace, backtrace);
+    nn_msg_cp (&entry->reply, reply);
+    entry->reply.expiry = 0;
+    bucket = &self->buckets [hash & self->mask];
+    entry->next = *bucket;
+    *bucket = entry;
+    nn_list_item_init (&entry->item);
+    nn_list_insert (&self->entries, &entry->item,
+        nn_list_end (&self->entries));
+    ++self->count;
+}
+
+static void nn_rep_cache_evict (struct nn_rep_cache *self)
+{
+    struct nn_rep_entry *entry;
+    struct nn_rep_entry **it;
+
+    /*  Forget the oldest reply. */
+    entry = nn_cont (nn_list_begin (&self->entries), struct nn_rep_entry,
+        item);
+    nn_assert (entry);
+    for (it = &self->buckets [entry->hash & self->mask]; *it != entry;
+          it = &(*it)->next)
+        ;
+    *it = entry->next;
+    nn_list_erase (&self->entries, &entry->item);
+    nn_list_item_term (&entry->item);
+    nn_chunkref_term (&entry->backtrace);
+    nn_msg_term (&entry->reply);
+    nn_free (entry);
+    --self->count;
+}
+
+static uint64_t nn_rep_cache_hash (struct nn_chunkref *backtrace)
+{
+    uint64_t hash;
+    size_t size;
+    const uint8_t *data;
+
+    /*  FNV-1a. */
+    hash = 14695981039346656037ull;
+    data = nn_chunkref_data (backtrace);
+    size = nn_chunkref_size (backtrace);
+    while (size--) {
+        hash ^= *data++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 static int nn_rep_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_rep *self;
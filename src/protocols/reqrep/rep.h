@@ -26,10 +26,38 @@
 #include "../../protocol.h"
 #include "xrep.h"
 
+#include "../../utils/list.h"
+#include "../../utils/msg.h"
+
+/*  A cached reply along with the backtrace of the request it answers. */
+struct nn_rep_entry {
+    struct nn_list_item item;
+    struct nn_rep_entry *next;
+    uint64_t hash;
+    struct nn_chunkref backtrace;
+    struct nn_msg reply;
+};
+
+/*  Cache of the replies recently sent, used to answer the resent copies of
+    the requests without handing them to the application again. Entries
+    are kept in the order they were added in 'entries' and hashed by the
+    backtrace into 'buckets'. Once 'size' replies are cached, the oldest
+    one is forgotten. */
+struct nn_rep_cache {
+    size_t size;
+    size_t count;
+    size_t mask;
+    struct nn_rep_entry **buckets;
+    struct nn_list entries;
+};
+
 struct nn_rep {
     struct nn_xrep xrep;
     uint32_t flags;
     struct nn_chunkref backtrace;
+
+    /*  Reply cache. Disabled when cache.size is zero. */
+    struct nn_rep_cache cache;
 };
 
 /*  Some users may want to extend the REP protocol similar to how REP extends XREP.
@@ -43,5 +71,9 @@ void nn_rep_destroy (struct nn_sockbase *self);
 int nn_rep_events (struct nn_sockbase *self);
 int nn_rep_send (struct nn_sockbase *self, struct nn_msg *msg);
 int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg);
+int nn_rep_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+int nn_rep_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
 
 #endif
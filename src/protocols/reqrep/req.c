@@ -36,6 +36,7 @@
 #include "../../utils/random.h"
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -52,6 +53,7 @@
 #define NN_REQ_STATE_STOPPING_TIMER 7
 #define NN_REQ_STATE_DONE 8
 #define NN_REQ_STATE_STOPPING 9
+#define NN_REQ_STATE_HEDGING 10
 
 #define NN_REQ_ACTION_START 1
 #define NN_REQ_ACTION_IN 2
@@ -61,6 +63,29 @@
 #define NN_REQ_ACTION_PIPE_RM 6
 
 #define NN_REQ_SRC_RESEND_TIMER 1
+#define NN_REQ_SRC_TASK_TIMER 2
+
+/*  States of the individual requests when multiple requests are allowed
+    to be in flight. */
+#define NN_REQ_TASK_DELAYED 1
+#define NN_REQ_TASK_ACTIVE 2
+#define NN_REQ_TASK_TIMED_OUT 3
+#define NN_REQ_TASK_STOPPING 4
+#define NN_REQ_TASK_DONE 5
+#define NN_REQ_TASK_HEDGING 6
+
+/*  Private functions. */
+static void nn_req_timer_start (struct nn_req *self, struct nn_task *task);
+static void nn_req_hedge (struct nn_req *self, struct nn_task *task);
+static void nn_req_unload (struct nn_req *self, struct nn_task *task);
+static void nn_req_task_send (struct nn_req *self, struct nn_task *task);
+static void nn_req_task_done (struct nn_req *self, struct nn_task *task);
+static void nn_req_task_handler (struct nn_req *self, int type,
+    struct nn_task *task);
+static void nn_req_task_destroy (struct nn_task *task);
+static void nn_req_task_in (struct nn_req *self);
+static int nn_req_task_csend (struct nn_req *self, struct nn_msg *msg);
+static int nn_req_task_crecv (struct nn_req *self, struct nn_msg *msg);
 
 static const struct nn_sockbase_vfptr nn_req_sockbase_vfptr = {
     nn_req_stop,
@@ -94,15 +119,45 @@ void nn_req_init (struct nn_req *self,
     nn_msg_init (&self->task.reply, 0);
     nn_timer_init (&self->task.timer, NN_REQ_SRC_RESEND_TIMER, &self->fsm);
     self->resend_ivl = NN_REQ_DEFAULT_RESEND_IVL;
+    self->maxinflight = 1;
+    self->hedge_ivl = 0;
 
     nn_task_init (&self->task, self->lastid);
 
+    nn_list_init (&self->tasks);
+    nn_hash_init (&self->inflight);
+    nn_list_init (&self->replies);
+    self->ntasks = 0;
+
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
 }
 
 void nn_req_term (struct nn_req *self)
 {
+    struct nn_list_item *it;
+    struct nn_task *task;
+
+    /*  Deallocate the requests that are still in flight and the replies
+        that were not retrieved. */
+    while (!nn_list_empty (&self->tasks)) {
+        it = nn_list_begin (&self->tasks);
+        task = nn_cont (it, struct nn_task, item);
+        nn_list_erase (&self->tasks, it);
+        if (task->state != NN_REQ_TASK_STOPPING)
+            nn_hash_erase (&self->inflight, &task->hashitem);
+        nn_req_task_destroy (task);
+    }
+    while (!nn_list_empty (&self->replies)) {
+        it = nn_list_begin (&self->replies);
+        task = nn_cont (it, struct nn_task, item);
+        nn_list_erase (&self->replies, it);
+        nn_req_task_destroy (task);
+    }
+    nn_list_term (&self->replies);
+    nn_hash_term (&self->inflight);
+    nn_list_term (&self->tasks);
+
     nn_timer_term (&self->task.timer);
     nn_task_term (&self->task);
     nn_msg_term (&self->task.reply);
@@ -149,6 +204,11 @@ void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
     /*  Pass the pipe to the raw REQ socket. */
     nn_xreq_in (&req->xreq.sockbase, pipe);
 
+    if (req->maxinflight > 1) {
+        nn_req_task_in (req);
+        return;
+    }
+
     while (1) {
 
         /*  Get new reply. */
@@ -188,8 +248,13 @@ void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
         /*  TODO: Deallocate the request here? */
 
         /*  Notify the state machine. */
-        if (req->state == NN_REQ_STATE_ACTIVE)
+        if (req->state == NN_REQ_STATE_ACTIVE ||
+              req->state == NN_REQ_STATE_HEDGING) {
+            nn_sockbase_stat_record (&req->xreq.sockbase,
+                NN_SOCKBASE_LATENCY_RTT, (req->task.reply.rcvtime ?
+                req->task.reply.rcvtime : nn_clock_us ()) - req->task.sent_at);
             nn_fsm_action (&req->fsm, NN_REQ_ACTION_IN);
+        }
 
         return;
     }
@@ -198,12 +263,26 @@ void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 void nn_req_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
     struct nn_req *req;
+    struct nn_list_item *it;
+    struct nn_task *task;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
     /*  Add the pipe to the underlying raw socket. */
     nn_xreq_out (&req->xreq.sockbase, pipe);
 
+    /*  Send the delayed requests, in the order they were submitted, until
+        there's no peer to send them to. */
+    for (it = nn_list_begin (&req->tasks); it != nn_list_end (&req->tasks);
+          it = nn_list_next (&req->tasks, it)) {
+        task = nn_cont (it, struct nn_task, item);
+        if (task->state != NN_REQ_TASK_DELAYED)
+            continue;
+        nn_req_task_send (req, task);
+        if (task->state == NN_REQ_TASK_DELAYED)
+            break;
+    }
+
     /*  Notify the state machine. */
     if (req->state == NN_REQ_STATE_DELAYED)
         nn_fsm_action (&req->fsm, NN_REQ_ACTION_OUT);
@@ -216,6 +295,12 @@ int nn_req_events (struct nn_sockbase *self)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    /*  With multiple requests in flight, new request can be sent only
+        while the limit is not reached. */
+    if (req->maxinflight > 1)
+        return (req->ntasks < req->maxinflight ? NN_SOCKBASE_EVENT_OUT : 0) |
+            (nn_list_empty (&req->replies) ? 0 : NN_SOCKBASE_EVENT_IN);
+
     /*  OUT is signalled all the time because sending a request while
         another one is being processed cancels the old one. */
     rc = NN_SOCKBASE_EVENT_OUT;
@@ -233,6 +318,9 @@ int nn_req_csend (struct nn_sockbase *self, struct nn_msg *msg)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    if (req->maxinflight > 1)
+        return nn_req_task_csend (req, msg);
+
     /*  Generate new request ID for the new request and put it into message
         header. The most important bit is set to 1 to indicate that this is
         the bottom of the backtrace stack. */
@@ -258,6 +346,9 @@ int nn_req_crecv (struct nn_sockbase *self, struct nn_msg *msg)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    if (req->maxinflight > 1)
+        return nn_req_task_crecv (req, msg);
+
     /*  No request was sent. Waiting for a reply doesn't make sense. */
     if (nn_slow (!nn_req_inprogress (req)))
         return -EFSM;
@@ -293,7 +384,30 @@ int nn_req_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_MAXINFLIGHT) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 1))
+            return -EINVAL;
+
+        /*  Requests of one mode can't be carried over to the other. */
+        if (nn_slow ((*(int*) optval > 1) != (req->maxinflight > 1) &&
+              (nn_req_inprogress (req) || req->ntasks)))
+            return -EFSM;
+        req->maxinflight = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_REQ_HEDGE_IVL) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < -1))
+            return -EINVAL;
+        req->hedge_ivl = *(int*) optval;
+        return 0;
+    }
+
+    return nn_xreq_setopt (self, level, option, optval, optvallen);
 }
 
 int nn_req_getopt (struct nn_sockbase *self, int level, int option,
@@ -314,23 +428,60 @@ int nn_req_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_MAXINFLIGHT) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->maxinflight;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_HEDGE_IVL) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->hedge_ivl;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_ID) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = (int) (req->task.id & 0x7fffffff);
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return nn_xreq_getopt (self, level, option, optval, optvallen);
 }
 
 void nn_req_shutdown (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
     struct nn_req *req;
+    struct nn_list_item *it;
+    struct nn_task *task;
 
     req = nn_cont (self, struct nn_req, fsm);
 
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
         nn_timer_stop (&req->task.timer);
+        for (it = nn_list_begin (&req->tasks);
+              it != nn_list_end (&req->tasks);
+              it = nn_list_next (&req->tasks, it))
+            nn_timer_stop (&nn_cont (it, struct nn_task, item)->timer);
         req->state = NN_REQ_STATE_STOPPING;
     }
     if (nn_slow (req->state == NN_REQ_STATE_STOPPING)) {
         if (!nn_timer_isidle (&req->task.timer))
             return;
+        for (it = nn_list_begin (&req->tasks);
+              it != nn_list_end (&req->tasks);
+              it = nn_list_next (&req->tasks, it)) {
+            task = nn_cont (it, struct nn_task, item);
+            if (!nn_timer_isidle (&task->timer))
+                return;
+        }
         req->state = NN_REQ_STATE_IDLE;
         nn_fsm_stopped_noevent (&req->fsm);
         nn_sockbase_stopped (&req->xreq.sockbase);
@@ -341,12 +492,20 @@ void nn_req_shutdown (struct nn_fsm *self, int src, int type,
 }
 
 void nn_req_handler (struct nn_fsm *self, int src, int type,
-    NN_UNUSED void *srcptr)
+    void *srcptr)
 {
     struct nn_req *req;
 
     req = nn_cont (self, struct nn_req, fsm);
 
+    /*  Timers of the individual requests are handled irrespective of
+        the state of the socket. */
+    if (src == NN_REQ_SRC_TASK_TIMER) {
+        nn_req_task_handler (req, type,
+            nn_cont (srcptr, struct nn_task, timer));
+        return;
+    }
+
     switch (req->state) {
 
 /******************************************************************************/
@@ -427,7 +586,7 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
 
                 /*  Reply arrived. */
                 nn_timer_stop (&req->task.timer);
-                req->task.sent_to = NULL;
+                nn_req_unload (req, &req->task);
                 req->state = NN_REQ_STATE_STOPPING_TIMER;
                 return;
 
@@ -436,7 +595,7 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
                 /*  New request was sent while the old one was still being
                     processed. Cancel the old request first. */
                 nn_timer_stop (&req->task.timer);
-                req->task.sent_to = NULL;
+                nn_req_unload (req, &req->task);
                 req->state = NN_REQ_STATE_CANCELLING;
                 return;
 
@@ -444,6 +603,7 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
                 /*  Pipe that we sent request to is removed  */
                 nn_timer_stop (&req->task.timer);
                 req->task.sent_to = NULL;
+                nn_req_unload (req, &req->task);
                 /*  Pretend we timed out so request resent immediately  */
                 req->state = NN_REQ_STATE_TIMED_OUT;
                 return;
@@ -456,7 +616,55 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_TIMER_TIMEOUT:
                 nn_timer_stop (&req->task.timer);
+
+                /*  It's time to send the duplicate of the request. */
+                if (req->task.hedge_rest >= 0) {
+                    req->state = NN_REQ_STATE_HEDGING;
+                    return;
+                }
+
+                nn_req_unload (req, &req->task);
+                req->state = NN_REQ_STATE_TIMED_OUT;
+                return;
+            default:
+                nn_fsm_bad_action (req->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (req->state, src, type);
+        }
+
+/******************************************************************************/
+/*  HEDGING state.                                                            */
+/*  The reply is late. Stopping the timer. Afterwards, a duplicate of the     */
+/*  request is sent to another peer and the first reply to arrive is taken.   */
+/******************************************************************************/
+    case NN_REQ_STATE_HEDGING:
+        switch (src) {
+
+        case NN_REQ_SRC_RESEND_TIMER:
+            switch (type) {
+            case NN_TIMER_STOPPED:
+                nn_req_hedge (req, &req->task);
+                req->state = NN_REQ_STATE_ACTIVE;
+                return;
+            default:
+                nn_fsm_bad_action (req->state, src, type);
+            }
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_REQ_ACTION_IN:
+                nn_req_unload (req, &req->task);
+                req->state = NN_REQ_STATE_STOPPING_TIMER;
+                return;
+            case NN_REQ_ACTION_SENT:
+                nn_req_unload (req, &req->task);
+                req->state = NN_REQ_STATE_CANCELLING;
+                return;
+            case NN_REQ_ACTION_PIPE_RM:
                 req->task.sent_to = NULL;
+                nn_req_unload (req, &req->task);
                 req->state = NN_REQ_STATE_TIMED_OUT;
                 return;
             default:
@@ -623,9 +831,11 @@ void nn_req_action_send (struct nn_req *self, int allow_delay)
         in case the request gets lost somewhere further out
         in the topology. */
     if (nn_fast (rc == 0)) {
-        nn_timer_start (&self->task.timer, self->resend_ivl);
+        nn_req_timer_start (self, &self->task);
         nn_assert (to);
         self->task.sent_to = to;
+        nn_xreq_load (&self->xreq.sockbase, to, 1);
+        self->task.sent_at = nn_clock_us ();
         self->state = NN_REQ_STATE_ACTIVE;
         return;
     }
@@ -634,6 +844,316 @@ void nn_req_action_send (struct nn_req *self, int allow_delay)
     errnum_assert (0, -rc);
 }
 
+/*  Sets the timer of a request that was just sent. If hedging is enabled
+    and the reply is expected well before the re-send interval, the timer
+    first fires when it's time to send the duplicate. With NN_REQ_HEDGE_IVL
+    of -1 that's the 99th percentile of the round-trip times seen so far. */
+static void nn_req_timer_start (struct nn_req *self, struct nn_task *task)
+{
+    uint64_t p99;
+    int delay;
+
+    delay = self->hedge_ivl;
+    if (delay < 0) {
+        p99 = nn_sockbase_stat_latency (&self->xreq.sockbase,
+            NN_SOCKBASE_LATENCY_RTT, 990);
+        delay = p99 ? (int) ((p99 + 999) / 1000) : 0;
+    }
+
+    if (delay > 0 && delay < self->resend_ivl) {
+        task->hedge_rest = self->resend_ivl - delay;
+        nn_timer_start (&task->timer, delay);
+        return;
+    }
+    task->hedge_rest = -1;
+    nn_timer_start (&task->timer, self->resend_ivl);
+}
+
+/*  Sends the duplicate of the request and waits for the rest of the re-send
+    interval. The load balancer picks the peer, which is a different one
+    unless there's no other peer to pick. */
+static void nn_req_hedge (struct nn_req *self, struct nn_task *task)
+{
+    int rc;
+    struct nn_msg msg;
+    struct nn_pipe *to;
+
+    nn_msg_cp (&msg, &task->request);
+    rc = nn_xreq_send_to (&self->xreq.sockbase, &msg, &to);
+    if (nn_slow (rc == -EAGAIN))
+        nn_msg_term (&msg);
+    else {
+        errnum_assert (rc == 0, -rc);
+        task->hedged_to = to;
+        nn_xreq_load (&self->xreq.sockbase, to, 1);
+    }
+
+    nn_timer_start (&task->timer, task->hedge_rest);
+    task->hedge_rest = -1;
+}
+
+/*  The request is no longer waiting for a reply from the pipes it was sent
+    to. */
+static void nn_req_unload (struct nn_req *self, struct nn_task *task)
+{
+    if (task->sent_to)
+        nn_xreq_load (&self->xreq.sockbase, task->sent_to, -1);
+    if (task->hedged_to)
+        nn_xreq_load (&self->xreq.sockbase, task->hedged_to, -1);
+    task->sent_to = NULL;
+    task->hedged_to = NULL;
+}
+
+/******************************************************************************/
+/*  Multiple requests in flight.                                              */
+/******************************************************************************/
+
+static int nn_req_task_csend (struct nn_req *self, struct nn_msg *msg)
+{
+    struct nn_task *task;
+
+    if (nn_slow (self->ntasks >= self->maxinflight))
+        return -EAGAIN;
+
+    /*  Generate new request ID skipping the ones still in use, which may
+        happen only if the IDs have wrapped around. */
+    do {
+        ++self->task.id;
+    } while (nn_slow (nn_hash_get (&self->inflight,
+        self->task.id & 0x7fffffff) != NULL));
+
+    task = nn_alloc (sizeof (struct nn_task), "request");
+    alloc_assert (task);
+    nn_task_init (task, self->task.id & 0x7fffffff);
+    nn_msg_init (&task->reply, 0);
+    nn_timer_init (&task->timer, NN_REQ_SRC_TASK_TIMER, &self->fsm);
+    task->sent_to = NULL;
+
+    nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, 4);
+    nn_putl (nn_chunkref_data (&msg->sphdr), task->id | 0x80000000);
+    nn_msg_mv (&task->request, msg);
+
+    nn_hash_insert (&self->inflight, task->id, &task->hashitem);
+    nn_list_insert (&self->tasks, &task->item, nn_list_end (&self->tasks));
+    ++self->ntasks;
+
+    /*  If there are older requests waiting for a peer, the new one has to
+        wait as well so that the requests are sent in order. */
+    task->state = NN_REQ_TASK_DELAYED;
+    if (nn_list_prev (&self->tasks, &task->item) == NULL ||
+          nn_cont (nn_list_prev (&self->tasks, &task->item), struct nn_task,
+          item)->state != NN_REQ_TASK_DELAYED)
+        nn_req_task_send (self, task);
+
+    return 0;
+}
+
+static int nn_req_task_crecv (struct nn_req *self, struct nn_msg *msg)
+{
+    struct nn_list_item *it;
+    struct nn_task *task;
+
+    if (nn_slow (nn_list_empty (&self->replies)))
+        return self->ntasks ? -EAGAIN : -EFSM;
+
+    it = nn_list_begin (&self->replies);
+    task = nn_cont (it, struct nn_task, item);
+    nn_list_erase (&self->replies, it);
+    --self->ntasks;
+
+    nn_msg_mv (msg, &task->reply);
+    nn_msg_init (&task->reply, 0);
+    nn_req_task_destroy (task);
+
+    return 0;
+}
+
+static void nn_req_task_in (struct nn_req *self)
+{
+    int rc;
+    struct nn_msg msg;
+    uint32_t reqid;
+    struct nn_hash_item *item;
+    struct nn_task *task;
+    struct nn_chunkref hdrs;
+    struct nn_cmsghdr *cmsg;
+    size_t hdrssz;
+    int id;
+
+    while (1) {
+
+        rc = nn_xreq_recv (&self->xreq.sockbase, &msg);
+        if (nn_slow (rc == -EAGAIN))
+            return;
+        errnum_assert (rc == 0, -rc);
+
+        /*  Ignore malformed replies and replies to the requests that are
+            not in flight. */
+        if (nn_slow (nn_chunkref_size (&msg.sphdr) != sizeof (uint32_t))) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        reqid = nn_getl (nn_chunkref_data (&msg.sphdr));
+        if (nn_slow (!(reqid & 0x80000000))) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        item = nn_hash_get (&self->inflight, reqid & 0x7fffffff);
+        if (nn_slow (!item)) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        task = nn_cont (item, struct nn_task, hashitem);
+        nn_hash_erase (&self->inflight, &task->hashitem);
+
+        if (task->sent_at)
+            nn_sockbase_stat_record (&self->xreq.sockbase,
+                NN_SOCKBASE_LATENCY_RTT, (msg.rcvtime ? msg.rcvtime :
+                nn_clock_us ()) - task->sent_at);
+
+        /*  Trim the request ID and pass it to the user as a control
+            message instead, along with any the transport has attached. */
+        nn_chunkref_term (&msg.sphdr);
+        nn_chunkref_init (&msg.sphdr, 0);
+        hdrssz = nn_chunkref_size (&msg.hdrs);
+        nn_chunkref_init (&hdrs, hdrssz + NN_CMSG_SPACE (sizeof (id)));
+        memcpy (nn_chunkref_data (&hdrs), nn_chunkref_data (&msg.hdrs),
+            hdrssz);
+        cmsg = (struct nn_cmsghdr*)
+            ((uint8_t*) nn_chunkref_data (&hdrs) + hdrssz);
+        cmsg->cmsg_level = NN_REQ;
+        cmsg->cmsg_type = NN_REQ_ID;
+        cmsg->cmsg_len = NN_CMSG_SPACE (sizeof (id));
+        id = (int) task->id;
+        memcpy (NN_CMSG_DATA (cmsg), &id, sizeof (id));
+        nn_chunkref_term (&msg.hdrs);
+        nn_chunkref_mv (&msg.hdrs, &hdrs);
+
+        nn_msg_mv (&task->reply, &msg);
+        nn_req_unload (self, task);
+
+        /*  The reply can be passed to the user once the resend timer is
+            stopped. */
+        switch (task->state) {
+        case NN_REQ_TASK_ACTIVE:
+            nn_timer_stop (&task->timer);
+            task->state = NN_REQ_TASK_STOPPING;
+            break;
+        case NN_REQ_TASK_TIMED_OUT:
+        case NN_REQ_TASK_HEDGING:
+            task->state = NN_REQ_TASK_STOPPING;
+            break;
+        case NN_REQ_TASK_DELAYED:
+            nn_req_task_done (self, task);
+            break;
+        default:
+            nn_assert (0);
+        }
+    }
+}
+
+static void nn_req_task_handler (struct nn_req *self, int type,
+    struct nn_task *task)
+{
+    switch (task->state) {
+
+    /*  Waiting for reply. If it doesn't arrive in time, stop the timer
+        and re-send the request afterwards. */
+    case NN_REQ_TASK_ACTIVE:
+        switch (type) {
+        case NN_TIMER_TIMEOUT:
+            nn_timer_stop (&task->timer);
+            if (task->hedge_rest >= 0) {
+                task->state = NN_REQ_TASK_HEDGING;
+                return;
+            }
+            nn_req_unload (self, task);
+            task->state = NN_REQ_TASK_TIMED_OUT;
+            return;
+        default:
+            nn_fsm_bad_action (task->state, NN_REQ_SRC_TASK_TIMER, type);
+        }
+
+    /*  The reply is late. Send a duplicate of the request once the timer
+        is stopped. */
+    case NN_REQ_TASK_HEDGING:
+        switch (type) {
+        case NN_TIMER_STOPPED:
+            nn_req_hedge (self, task);
+            task->state = NN_REQ_TASK_ACTIVE;
+            return;
+        default:
+            nn_fsm_bad_action (task->state, NN_REQ_SRC_TASK_TIMER, type);
+        }
+
+    case NN_REQ_TASK_TIMED_OUT:
+        switch (type) {
+        case NN_TIMER_STOPPED:
+            nn_req_task_send (self, task);
+            return;
+        default:
+            nn_fsm_bad_action (task->state, NN_REQ_SRC_TASK_TIMER, type);
+        }
+
+    /*  Reply arrived. Waiting till the timer is stopped. */
+    case NN_REQ_TASK_STOPPING:
+        switch (type) {
+        case NN_TIMER_STOPPED:
+            nn_req_task_done (self, task);
+            return;
+        default:
+            nn_fsm_bad_action (task->state, NN_REQ_SRC_TASK_TIMER, type);
+        }
+
+    default:
+        nn_fsm_bad_state (task->state, NN_REQ_SRC_TASK_TIMER, type);
+    }
+}
+
+static void nn_req_task_send (struct nn_req *self, struct nn_task *task)
+{
+    int rc;
+    struct nn_msg msg;
+    struct nn_pipe *to;
+
+    nn_msg_cp (&msg, &task->request);
+    rc = nn_xreq_send_to (&self->xreq.sockbase, &msg, &to);
+
+    /*  If the request cannot be sent at the moment wait till
+        new outbound pipe arrives. */
+    if (nn_slow (rc == -EAGAIN)) {
+        nn_msg_term (&msg);
+        task->state = NN_REQ_TASK_DELAYED;
+        return;
+    }
+    errnum_assert (rc == 0, -rc);
+
+    nn_req_timer_start (self, task);
+    nn_assert (to);
+    task->sent_to = to;
+    nn_xreq_load (&self->xreq.sockbase, to, 1);
+    task->sent_at = nn_clock_us ();
+    task->state = NN_REQ_TASK_ACTIVE;
+}
+
+static void nn_req_task_done (struct nn_req *self, struct nn_task *task)
+{
+    nn_list_erase (&self->tasks, &task->item);
+    nn_list_insert (&self->replies, &task->item, nn_list_end (&self->replies));
+    task->state = NN_REQ_TASK_DONE;
+}
+
+static void nn_req_task_destroy (struct nn_task *task)
+{
+    nn_timer_term (&task->timer);
+    nn_msg_term (&task->reply);
+    nn_msg_term (&task->request);
+    nn_task_term (task);
+    nn_free (task);
+}
+
 static int nn_req_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_req *self;
@@ -648,10 +1168,33 @@ static int nn_req_create (void *hint, struct nn_sockbase **sockbase)
 
 void nn_req_rm (struct nn_sockbase *self, struct nn_pipe *pipe) {
     struct nn_req *req;
+    struct nn_list_item *it;
+    struct nn_task *task;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
     nn_xreq_rm (self, pipe);
+
+    /*  Requests sent to the removed pipe are re-sent straight away, as if
+        they've timed out. */
+    for (it = nn_list_begin (&req->tasks); it != nn_list_end (&req->tasks);
+          it = nn_list_next (&req->tasks, it)) {
+        task = nn_cont (it, struct nn_task, item);
+        if (task->hedged_to == pipe)
+            task->hedged_to = NULL;
+        if (task->sent_to != pipe)
+            continue;
+        if (task->state == NN_REQ_TASK_ACTIVE)
+            nn_timer_stop (&task->timer);
+        else if (task->state != NN_REQ_TASK_HEDGING)
+            continue;
+        task->sent_to = NULL;
+        nn_req_unload (req, task);
+        task->state = NN_REQ_TASK_TIMED_OUT;
+    }
+
+    if (req->task.hedged_to == pipe)
+        req->task.hedged_to = NULL;
     if (nn_slow (pipe == req->task.sent_to)) {
         nn_fsm_action (&req->fsm, NN_REQ_ACTION_PIPE_RM);
     }
@@ -43,9 +43,22 @@ struct nn_req {
 
     /*  Protocol-specific socket options. */
     int resend_ivl;
+    int maxinflight;
+    int hedge_ivl;
 
     /*  The request being processed. */
     struct nn_task task;
+
+    /*  If more than one request is allowed to be in flight, each of them
+        gets a task of its own and 'task' above is not used. 'tasks' are
+        the requests waiting for a reply, 'inflight' is the same set keyed
+        by request ID and 'replies' are the tasks whose reply is yet to be
+        retrieved by the user, in the order the replies have arrived.
+        'ntasks' counts the tasks on both lists. */
+    struct nn_list tasks;
+    struct nn_hash inflight;
+    struct nn_list replies;
+    int ntasks;
 };
 
 /*  Some users may want to extend the REQ protocol similar to how REQ extends XREQ.
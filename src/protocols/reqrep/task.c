@@ -22,14 +22,21 @@
 */
 
 #include "task.h"
-#include "../../utils/attr.h"
 
 void nn_task_init (struct nn_task *self, uint32_t id)
 {
     self->id = id;
+    self->sent_at = 0;
+    self->hedged_to = NULL;
+    self->hedge_rest = -1;
+    self->state = 0;
+    nn_hash_item_init (&self->hashitem);
+    nn_list_item_init (&self->item);
 }
 
-void nn_task_term (NN_UNUSED struct nn_task *self)
+void nn_task_term (struct nn_task *self)
 {
+    nn_list_item_term (&self->item);
+    nn_hash_item_term (&self->hashitem);
 }
 
@@ -29,6 +29,8 @@
 #include "../../aio/fsm.h"
 #include "../../aio/timer.h"
 #include "../../utils/msg.h"
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
 
 struct nn_task {
 
@@ -48,6 +50,28 @@ struct nn_task {
     /*  Pipe the current request has been sent to. This is an optimisation so
         that request can be re-sent immediately if the pipe disappears.  */
     struct nn_pipe *sent_to;
+
+    /*  Pipe a duplicate of the current request has been sent to, if any,
+        and, while the timer is set to send the duplicate, the time left
+        until the request is re-sent afterwards. Otherwise it is -1. */
+    struct nn_pipe *hedged_to;
+    int hedge_rest;
+
+    /*  Time the current request was last sent at, in microseconds. */
+    uint64_t sent_at;
+
+    /*  The following fields are used only when multiple requests are allowed
+        to be in flight. In that case each request has a task of its own.
+        'state' is one of the NN_REQ_TASK_* states defined in req.c. */
+    int state;
+
+    /*  The task in the table of requests waiting for a reply, keyed by
+        request ID. */
+    struct nn_hash_item hashitem;
+
+    /*  The task in the list of requests in flight or in the list of replies
+        not yet retrieved by the user. */
+    struct nn_list_item item;
 };
 
 void nn_task_init (struct nn_task *self, uint32_t id);
@@ -38,6 +38,8 @@
 
 /*  Private functions. */
 static void nn_xrep_destroy (struct nn_sockbase *self);
+static struct nn_xrep_data *nn_xrep_answered (struct nn_xrep *self,
+    uint32_t key);
 
 static const struct nn_sockbase_vfptr nn_xrep_sockbase_vfptr = {
     NULL,
@@ -64,6 +66,8 @@ void nn_xrep_init (struct nn_xrep *self, const struct nn_sockbase_vfptr *vfptr,
 
     nn_hash_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    self->maxoutstanding = 0;
+    self->outstanding = 0;
 }
 
 void nn_xrep_term (struct nn_xrep *self)
@@ -95,13 +99,14 @@ int nn_xrep_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xrep_data), "pipe data (xrep)");
     alloc_assert (data);
     data->pipe = pipe;
     nn_hash_item_init (&data->outitem);
     data->flags = 0;
+    data->outstanding = 0;
     nn_hash_insert (&xrep->outpipes, xrep->next_key & 0x7fffffff,
         &data->outitem);
     ++xrep->next_key;
@@ -119,6 +124,9 @@ void nn_xrep_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     xrep = nn_cont (self, struct nn_xrep, sockbase);
     data = nn_pipe_getdata (pipe);
 
+    /*  The requests of the peer will never be answered. */
+    xrep->outstanding -= data->outstanding;
+
     nn_fq_rm (&xrep->inpipes, &data->initem);
     nn_hash_erase (&xrep->outpipes, &data->outitem);
     nn_hash_item_term (&data->outitem);
@@ -147,8 +155,14 @@ void nn_xrep_out (NN_UNUSED struct nn_sockbase *self, struct nn_pipe *pipe)
 
 int nn_xrep_events (struct nn_sockbase *self)
 {
-    return (nn_fq_can_recv (&nn_cont (self, struct nn_xrep,
-        sockbase)->inpipes) ? NN_SOCKBASE_EVENT_IN : 0) | NN_SOCKBASE_EVENT_OUT;
+    struct nn_xrep *xrep;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (xrep->maxoutstanding && xrep->outstanding >= xrep->maxoutstanding)
+        return NN_SOCKBASE_EVENT_OUT;
+    return (nn_fq_can_recv (&xrep->inpipes) ? NN_SOCKBASE_EVENT_IN : 0) |
+        NN_SOCKBASE_EVENT_OUT;
 }
 
 int nn_xrep_send (struct nn_sockbase *self, struct nn_msg *msg)
@@ -172,8 +186,7 @@ int nn_xrep_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     /*  Find the appropriate pipe to send the message to. If there's none,
         or if it's not ready for sending, silently drop the message. */
-    data = nn_cont (nn_hash_get (&xrep->outpipes, key), struct nn_xrep_data,
-        outitem);
+    data = nn_xrep_answered (xrep, key);
     if (!data || !(data->flags & NN_XREP_OUT)) {
         nn_msg_term (msg);
         return 0;
@@ -197,11 +210,17 @@ int nn_xrep_recv (struct nn_sockbase *self, struct nn_msg *msg)
     int maxttl;
     void *data;
     size_t sz;
-    struct nn_chunkref ref;
+    uint8_t key [sizeof (uint32_t)];
     struct nn_xrep_data *pipedata;
 
     xrep = nn_cont (self, struct nn_xrep, sockbase);
 
+    /*  Don't read more requests until some of the ones being processed are
+        answered. The peers are pushed back by the transports meanwhile. */
+    if (nn_slow (xrep->maxoutstanding &&
+          xrep->outstanding >= xrep->maxoutstanding))
+        return -EAGAIN;
+
     rc = nn_fq_recv (&xrep->inpipes, msg, &pipe);
     if (nn_slow (rc < 0))
         return rc;
@@ -238,38 +257,94 @@ int nn_xrep_recv (struct nn_sockbase *self, struct nn_msg *msg)
             return -EAGAIN;
         }
 
-        /*  Split the header and the body. */
+        /*  Split the header and the body. If the header is too long to be
+            stored inline, room is left for the keys of further hops. */
         nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
         nn_chunkref_term (&msg->sphdr);
-        nn_chunkref_init (&msg->sphdr, i * sizeof (uint32_t));
+        nn_chunkref_init_room (&msg->sphdr, i * sizeof (uint32_t),
+            NN_CHUNKREF_HEADROOM);
         memcpy (nn_chunkref_data (&msg->sphdr), data, i * sizeof (uint32_t));
         nn_chunkref_trim (&msg->body, i * sizeof (uint32_t));
     }
 
-    /*  Prepend the header by the pipe key. */
+    /*  Push the pipe key onto the backtrace stack. It's popped off again
+        by nn_xrep_send. */
     pipedata = nn_pipe_getdata (pipe);
-    nn_chunkref_init (&ref,
-        nn_chunkref_size (&msg->sphdr) + sizeof (uint32_t));
-    nn_putl (nn_chunkref_data (&ref), pipedata->outitem.key);
-    memcpy (((uint8_t*) nn_chunkref_data (&ref)) + sizeof (uint32_t),
-        nn_chunkref_data (&msg->sphdr), nn_chunkref_size (&msg->sphdr));
-    nn_chunkref_term (&msg->sphdr);
-    nn_chunkref_mv (&msg->sphdr, &ref);
+    nn_putl (key, pipedata->outitem.key);
+    nn_chunkref_push (&msg->sphdr, key, sizeof (key));
+
+    ++pipedata->outstanding;
+    ++xrep->outstanding;
 
     return 0;
 }
 
-int nn_xrep_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+void nn_xrep_cancel (struct nn_sockbase *self, struct nn_chunkref *backtrace)
+{
+    struct nn_xrep *xrep;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (nn_chunkref_size (backtrace) >= sizeof (uint32_t))
+        nn_xrep_answered (xrep, nn_getl (nn_chunkref_data (backtrace)));
+}
+
+static struct nn_xrep_data *nn_xrep_answered (struct nn_xrep *self,
+    uint32_t key)
+{
+    struct nn_xrep_data *data;
+
+    data = nn_cont (nn_hash_get (&self->outpipes, key), struct nn_xrep_data,
+        outitem);
+    if (data && data->outstanding) {
+        --data->outstanding;
+        --self->outstanding;
+    }
+    return data;
+}
+
+int nn_xrep_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xrep *xrep;
+    int val;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (level == NN_REP && option == NN_REP_FQ)
+        return nn_fq_setopt (&xrep->inpipes, optval, optvallen);
+
+    if (level == NN_REP && option == NN_REP_MAXOUTSTANDING) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xrep->maxoutstanding = val;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-int nn_xrep_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+int nn_xrep_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    struct nn_xrep *xrep;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (level == NN_REP && option == NN_REP_FQ)
+        return nn_fq_getopt (&xrep->inpipes, optval, optvallen);
+
+    if (level == NN_REP && option == NN_REP_MAXOUTSTANDING) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        memcpy (optval, &xrep->maxoutstanding, sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
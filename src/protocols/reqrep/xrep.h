@@ -38,6 +38,9 @@ struct nn_xrep_data {
     struct nn_hash_item outitem;
     struct nn_fq_data initem;
     uint32_t flags;
+
+    /*  Number of requests received from the pipe and not answered yet. */
+    int outstanding;
 };
 
 struct nn_xrep {
@@ -52,6 +55,11 @@ struct nn_xrep {
 
     /*  Fair-queuer to get messages from. */
     struct nn_fq inpipes;
+
+    /*  Once 'maxoutstanding' requests are waiting for the reply, no more
+        requests are read from the pipes. Zero means no limit. */
+    int maxoutstanding;
+    int outstanding;
 };
 
 void nn_xrep_init (struct nn_xrep *self, const struct nn_sockbase_vfptr *vfptr,
@@ -72,4 +80,9 @@ int nn_xrep_getopt (struct nn_sockbase *self, int level, int option,
 
 int nn_xrep_ispeer (int socktype);
 
+/*  Tells the socket that the request with the given backtrace is not going
+    to be answered, so that it doesn't count towards NN_REP_MAXOUTSTANDING
+    any more. */
+void nn_xrep_cancel (struct nn_sockbase *self, struct nn_chunkref *backtrace);
+
 #endif
@@ -34,10 +34,26 @@
 struct nn_xreq_data {
     struct nn_lb_data lb;
     struct nn_fq_data fq;
+
+    /*  Clients routed to this pipe in sticky mode. */
+    struct nn_list sticky;
+};
+
+/*  The peer the requests of a particular client are routed to. */
+struct nn_xreq_sticky {
+    struct nn_hash_item hitem;
+    struct nn_list_item lru;
+    struct nn_list_item item;
+    struct nn_xreq_data *data;
 };
 
 /*  Private functions. */
 static void nn_xreq_destroy (struct nn_sockbase *self);
+static int nn_xreq_sticky_key (struct nn_msg *msg, uint32_t *key);
+static void nn_xreq_sticky_bind (struct nn_xreq *self, uint32_t key,
+    struct nn_xreq_sticky *sticky, struct nn_xreq_data *data);
+static void nn_xreq_sticky_rm (struct nn_xreq *self,
+    struct nn_xreq_sticky *sticky);
 
 static const struct nn_sockbase_vfptr nn_xreq_sockbase_vfptr = {
     NULL,
@@ -59,10 +75,17 @@ void nn_xreq_init (struct nn_xreq *self, const struct nn_sockbase_vfptr *vfptr,
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_lb_init (&self->lb);
     nn_fq_init (&self->fq);
+    self->sticky = 0;
+    self->nsticky = 0;
+    nn_hash_init (&self->stickymap);
+    nn_list_init (&self->stickylru);
 }
 
 void nn_xreq_term (struct nn_xreq *self)
 {
+    nn_assert (self->nsticky == 0);
+    nn_list_term (&self->stickylru);
+    nn_hash_term (&self->stickymap);
     nn_fq_term (&self->fq);
     nn_lb_term (&self->lb);
     nn_sockbase_term (&self->sockbase);
@@ -91,15 +114,16 @@ int nn_xreq_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (sndprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_SNDPRIO, &sndprio, &sz);
     nn_assert (sz == sizeof (sndprio));
-    nn_assert (sndprio >= 1 && sndprio <= 16);
+    nn_assert (sndprio >= 1 && sndprio <= NN_PRIOLIST_SLOTS);
 
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xreq_data), "pipe data (req)");
     alloc_assert (data);
+    nn_list_init (&data->sticky);
     nn_pipe_setdata (pipe, data);
     nn_lb_add (&xreq->lb, &data->lb, pipe, sndprio);
     nn_fq_add (&xreq->fq, &data->fq, pipe, rcvprio);
@@ -114,6 +138,14 @@ void nn_xreq_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
 
     xreq = nn_cont (self, struct nn_xreq, sockbase);
     data = nn_pipe_getdata (pipe);
+
+    /*  Forget the clients routed to the pipe. Their next requests will be
+        load-balanced anew. */
+    while (!nn_list_empty (&data->sticky))
+        nn_xreq_sticky_rm (xreq, nn_cont (nn_list_begin (&data->sticky),
+            struct nn_xreq_sticky, item));
+    nn_list_term (&data->sticky);
+
     nn_lb_rm (&xreq->lb, &data->lb);
     nn_fq_rm (&xreq->fq, &data->fq);
     nn_free (data);
@@ -164,16 +196,122 @@ int nn_xreq_send_to (struct nn_sockbase *self, struct nn_msg *msg,
     struct nn_pipe **to)
 {
     int rc;
+    struct nn_xreq *xreq;
+    uint32_t key;
+    struct nn_hash_item *hitem;
+    struct nn_xreq_sticky *sticky;
+    struct nn_pipe *pipe;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
 
-    /*  If request cannot be sent due to the pushback, drop it silenly. */
-    rc = nn_lb_send (&nn_cont (self, struct nn_xreq, sockbase)->lb, msg, to);
+    if (!xreq->sticky || !nn_xreq_sticky_key (msg, &key)) {
+
+        /*  If request cannot be sent due to the pushback, drop it silenly. */
+        rc = nn_lb_send (&xreq->lb, msg, to);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc >= 0, -rc);
+        return 0;
+    }
+
+    /*  If the client was seen before and its peer is still writable, send
+        the request to the same peer again. */
+    hitem = nn_hash_get (&xreq->stickymap, key);
+    sticky = hitem ? nn_cont (hitem, struct nn_xreq_sticky, hitem) : NULL;
+    if (sticky && nn_lb_isactive (&sticky->data->lb)) {
+        nn_list_erase (&xreq->stickylru, &sticky->lru);
+        nn_list_insert (&xreq->stickylru, &sticky->lru,
+            nn_list_end (&xreq->stickylru));
+        pipe = sticky->data->lb.priodata.pipe;
+        rc = nn_pipe_send (pipe, msg);
+        errnum_assert (rc >= 0, -rc);
+        if (rc & NN_PIPE_RELEASE)
+            nn_lb_hold (&xreq->lb, &sticky->data->lb);
+        if (to != NULL)
+            *to = pipe;
+        return 0;
+    }
+
+    /*  Otherwise pick a peer in the usual way and remember it. */
+    rc = nn_lb_send (&xreq->lb, msg, &pipe);
     if (nn_slow (rc == -EAGAIN))
         return -EAGAIN;
     errnum_assert (rc >= 0, -rc);
+    nn_xreq_sticky_bind (xreq, key, sticky, nn_pipe_getdata (pipe));
+    if (to != NULL)
+        *to = pipe;
 
     return 0;
 }
 
+/*  The client is identified by the backtrace of the request, i.e. the keys
+    of the pipes it has passed through, without the request ID that ends
+    it. Requests sent by a REQ socket itself have no backtrace and are
+    load-balanced as usual. Clients whose backtraces hash to the same key
+    share the peer, which is harmless. */
+static int nn_xreq_sticky_key (struct nn_msg *msg, uint32_t *key)
+{
+    size_t size;
+    const uint8_t *data;
+    uint32_t hash;
+
+    size = nn_chunkref_size (&msg->sphdr);
+    if (size <= sizeof (uint32_t) || size % sizeof (uint32_t))
+        return 0;
+    size -= sizeof (uint32_t);
+    data = nn_chunkref_data (&msg->sphdr);
+
+    /*  FNV-1a. */
+    hash = 2166136261u;
+    while (size--) {
+        hash ^= *data++;
+        hash *= 16777619u;
+    }
+    *key = hash;
+    return 1;
+}
+
+/*  Routes the client to the pipe. 'sticky' is the client's existing entry,
+    if any. When the table is full, the least recently used client is
+    forgotten. */
+static void nn_xreq_sticky_bind (struct nn_xreq *self, uint32_t key,
+    struct nn_xreq_sticky *sticky, struct nn_xreq_data *data)
+{
+    if (sticky) {
+        nn_list_erase (&sticky->data->sticky, &sticky->item);
+        nn_list_erase (&self->stickylru, &sticky->lru);
+    }
+    else {
+        if (self->nsticky == (size_t) self->sticky)
+            nn_xreq_sticky_rm (self, nn_cont (nn_list_begin (
+                &self->stickylru), struct nn_xreq_sticky, lru));
+        sticky = nn_alloc (sizeof (struct nn_xreq_sticky), "sticky client");
+        alloc_assert (sticky);
+        nn_hash_item_init (&sticky->hitem);
+        nn_list_item_init (&sticky->lru);
+        nn_list_item_init (&sticky->item);
+        nn_hash_insert (&self->stickymap, key, &sticky->hitem);
+        ++self->nsticky;
+    }
+    sticky->data = data;
+    nn_list_insert (&data->sticky, &sticky->item, nn_list_end (&data->sticky));
+    nn_list_insert (&self->stickylru, &sticky->lru,
+        nn_list_end (&self->stickylru));
+}
+
+static void nn_xreq_sticky_rm (struct nn_xreq *self,
+    struct nn_xreq_sticky *sticky)
+{
+    nn_hash_erase (&self->stickymap, &sticky->hitem);
+    nn_list_erase (&self->stickylru, &sticky->lru);
+    nn_list_erase (&sticky->data->sticky, &sticky->item);
+    nn_hash_item_term (&sticky->hitem);
+    nn_list_item_term (&sticky->lru);
+    nn_list_item_term (&sticky->item);
+    nn_free (sticky);
+    --self->nsticky;
+}
+
 int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
@@ -203,17 +341,63 @@ int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
     return 0;
 }
 
-int nn_xreq_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+void nn_xreq_load (NN_UNUSED struct nn_sockbase *self, struct nn_pipe *pipe,
+    int delta)
+{
+    struct nn_xreq_data *data;
+
+    data = nn_pipe_getdata (pipe);
+    data->lb.load += delta;
+    nn_assert (data->lb.load >= 0);
+}
+
+int nn_xreq_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xreq *xreq;
+    int val;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level == NN_REQ && option == NN_REQ_LB)
+        return nn_lb_setopt (&xreq->lb, optval, optvallen);
+
+    if (level == NN_REQ && option == NN_REQ_STICKY) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0))
+            return -EINVAL;
+
+        /*  Forget the least recently used clients that don't fit. */
+        while (xreq->nsticky > (size_t) val)
+            nn_xreq_sticky_rm (xreq, nn_cont (nn_list_begin (
+                &xreq->stickylru), struct nn_xreq_sticky, lru));
+        xreq->sticky = val;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-int nn_xreq_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+int nn_xreq_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    struct nn_xreq *xreq;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level == NN_REQ && option == NN_REQ_LB)
+        return nn_lb_getopt (&xreq->lb, optval, optvallen);
+
+    if (level == NN_REQ && option == NN_REQ_STICKY) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xreq->sticky;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
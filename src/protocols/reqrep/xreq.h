@@ -28,10 +28,23 @@
 #include "../utils/lb.h"
 #include "../utils/fq.h"
 
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
+
 struct nn_xreq {
     struct nn_sockbase sockbase;
     struct nn_lb lb;
     struct nn_fq fq;
+
+    /*  Maximum number of clients whose peer is remembered, zero if sticky
+        routing is disabled. */
+    int sticky;
+
+    /*  Remembered clients, keyed by the hash of their backtrace and ordered
+        from the least to the most recently used. */
+    size_t nsticky;
+    struct nn_hash stickymap;
+    struct nn_list stickylru;
 };
 
 void nn_xreq_init (struct nn_xreq *self, const struct nn_sockbase_vfptr *vfptr,
@@ -47,6 +60,10 @@ int nn_xreq_send (struct nn_sockbase *self, struct nn_msg *msg);
 int nn_xreq_send_to (struct nn_sockbase *self, struct nn_msg *msg,
     struct nn_pipe **to);
 int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg);
+
+/*  Adjusts the number of requests sent to the pipe that are waiting for
+    a reply. It's used to pick the least loaded pipe. */
+void nn_xreq_load (struct nn_sockbase *self, struct nn_pipe *pipe, int delta);
 int nn_xreq_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen);
 int nn_xreq_getopt (struct nn_sockbase *self, int level, int option,
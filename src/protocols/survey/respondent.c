@@ -139,6 +139,8 @@ static int nn_respondent_recv (struct nn_sockbase *self, struct nn_msg *msg)
 
     /*  Cancel current survey and clean up backtrace, if it exists. */
     if (nn_slow (respondent->flags & NN_RESPONDENT_INPROGRESS)) {
+        nn_xrespondent_cancel (&respondent->xrespondent.sockbase,
+            &respondent->backtrace);
         nn_chunkref_term (&respondent->backtrace);
         respondent->flags &= ~NN_RESPONDENT_INPROGRESS;
     }
@@ -36,6 +36,8 @@
 #include "../../utils/alloc.h"
 #include "../../utils/random.h"
 #include "../../utils/attr.h"
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
 
 #include <string.h>
 
@@ -52,9 +54,29 @@
 #define NN_SURVEYOR_ACTION_CANCEL 2
 
 #define NN_SURVEYOR_SRC_DEADLINE_TIMER 1
+#define NN_SURVEYOR_SRC_SURVEY_TIMER 2
 
 #define NN_SURVEYOR_TIMEDOUT 1
 
+/*  States of the individual surveys when multiple surveys are allowed to be
+    in progress. */
+#define NN_SURVEYOR_SURVEY_ACTIVE 1
+#define NN_SURVEYOR_SURVEY_STOPPING 2
+
+/*  A survey in progress when multiple surveys are allowed at the same time.
+    Each one has a deadline timer of its own. */
+struct nn_surveyor_survey {
+    uint32_t id;
+    int state;
+    struct nn_timer timer;
+
+    /*  The survey in the table of surveys accepting responses, keyed by
+        survey ID. Once the deadline expires, it's removed from the table
+        and kept on the list only until the timer is stopped. */
+    struct nn_hash_item hashitem;
+    struct nn_list_item item;
+};
+
 struct nn_surveyor {
 
     /*  The underlying raw SP socket. */
@@ -78,6 +100,14 @@ struct nn_surveyor {
 
     /*  Flag if surveyor has timed out */
     int timedout;
+
+    /*  Maximum number of surveys in progress. If larger than 1, each survey
+        is tracked in 'surveys' and 'active' rather than by the state machine
+        above. */
+    int maxsurveys;
+    int nsurveys;
+    struct nn_list surveys;
+    struct nn_hash active;
 };
 
 /*  Private functions. */
@@ -90,6 +120,13 @@ static void nn_surveyor_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_surveyor_inprogress (struct nn_surveyor *self);
 static void nn_surveyor_resend (struct nn_surveyor *self);
+static int nn_surveyor_send_survey (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static int nn_surveyor_recv_survey (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static void nn_surveyor_survey_handler (struct nn_surveyor *self, int type,
+    struct nn_surveyor_survey *survey);
+static int nn_surveyor_filter (struct nn_xsurveyor *self, uint32_t surveyid);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_surveyor_stop (struct nn_sockbase *self);
@@ -119,6 +156,7 @@ static void nn_surveyor_init (struct nn_surveyor *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint)
 {
     nn_xsurveyor_init (&self->xsurveyor, vfptr, hint);
+    self->xsurveyor.filter = nn_surveyor_filter;
     nn_fsm_init_root (&self->fsm, nn_surveyor_handler, nn_surveyor_shutdown,
         nn_sockbase_getctx (&self->xsurveyor.sockbase));
     self->state = NN_SURVEYOR_STATE_IDLE;
@@ -131,6 +169,10 @@ static void nn_surveyor_init (struct nn_surveyor *self,
     nn_msg_init (&self->tosend, 0);
     self->deadline = NN_SURVEYOR_DEFAULT_DEADLINE;
     self->timedout = 0;
+    self->maxsurveys = 1;
+    self->nsurveys = 0;
+    nn_list_init (&self->surveys);
+    nn_hash_init (&self->active);
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
@@ -138,6 +180,23 @@ static void nn_surveyor_init (struct nn_surveyor *self,
 
 static void nn_surveyor_term (struct nn_surveyor *self)
 {
+    struct nn_list_item *it;
+    struct nn_surveyor_survey *survey;
+
+    while (!nn_list_empty (&self->surveys)) {
+        it = nn_list_begin (&self->surveys);
+        survey = nn_cont (it, struct nn_surveyor_survey, item);
+        nn_list_erase (&self->surveys, it);
+        if (survey->state == NN_SURVEYOR_SURVEY_ACTIVE)
+            nn_hash_erase (&self->active, &survey->hashitem);
+        nn_timer_term (&survey->timer);
+        nn_hash_item_term (&survey->hashitem);
+        nn_list_item_term (&survey->item);
+        nn_free (survey);
+    }
+    nn_hash_term (&self->active);
+    nn_list_term (&self->surveys);
+
     nn_msg_term (&self->tosend);
     nn_timer_term (&self->timer);
     nn_fsm_term (&self->fsm);
@@ -181,6 +240,16 @@ static int nn_surveyor_events (struct nn_sockbase *self)
     /*  Determine the actual readability/writability of the socket. */
     rc = nn_xsurveyor_events (&surveyor->xsurveyor.sockbase);
 
+    /*  With multiple surveys, new one can be started only while the limit
+        is not reached. IN is signalled once all of them have expired. */
+    if (surveyor->maxsurveys > 1) {
+        if (surveyor->nsurveys >= surveyor->maxsurveys)
+            rc &= ~NN_SOCKBASE_EVENT_OUT;
+        if (!surveyor->nsurveys)
+            rc |= NN_SOCKBASE_EVENT_IN;
+        return rc;
+    }
+
     /*  If there's no survey going on we'll signal IN to interrupt polling
         when the survey expires. nn_recv() will return -EFSM afterwards. */
     if (!nn_surveyor_inprogress (surveyor))
@@ -195,6 +264,9 @@ static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    if (surveyor->maxsurveys > 1)
+        return nn_surveyor_send_survey (surveyor, msg);
+
     /*  Generate new survey ID. */
     ++surveyor->surveyid;
     surveyor->surveyid |= 0x80000000;
@@ -234,10 +306,12 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_surveyor *surveyor;
-    uint32_t surveyid;
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    if (surveyor->maxsurveys > 1)
+        return nn_surveyor_recv_survey (surveyor, msg);
+
     /*  If no survey is going on return EFSM error. */
     if (nn_slow (!nn_surveyor_inprogress (surveyor))) {
         if (surveyor->timedout == NN_SURVEYOR_TIMEDOUT) {
@@ -247,27 +321,15 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
             return -EFSM;
     }
 
-    while (1) {
+    /*  Get next response. The stale ones were dropped by the filter. */
+    rc = nn_xsurveyor_recv (&surveyor->xsurveyor.sockbase, msg);
+    if (nn_slow (rc == -EAGAIN))
+        return -EAGAIN;
+    errnum_assert (rc == 0, -rc);
 
-        /*  Get next response. */
-        rc = nn_xsurveyor_recv (&surveyor->xsurveyor.sockbase, msg);
-        if (nn_slow (rc == -EAGAIN))
-            return -EAGAIN;
-        errnum_assert (rc == 0, -rc);
-
-        /*  Get the survey ID. Ignore any stale responses. */
-        /*  TODO: This should be done asynchronously! */
-        if (nn_slow (nn_chunkref_size (&msg->sphdr) != sizeof (uint32_t)))
-            continue;
-        surveyid = nn_getl (nn_chunkref_data (&msg->sphdr));
-        if (nn_slow (surveyid != surveyor->surveyid))
-            continue;
-
-        /*  Discard the header and return the message to the user. */
-        nn_chunkref_term (&msg->sphdr);
-        nn_chunkref_init (&msg->sphdr, 0);
-        break;
-    }
+    /*  Discard the header and return the message to the user. */
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, 0);
 
     return 0;
 }
@@ -289,6 +351,20 @@ static int nn_surveyor_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_MAXSURVEYS) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 1))
+            return -EINVAL;
+
+        /*  Surveys of one mode can't be carried over to the other. */
+        if (nn_slow ((*(int*) optval > 1) != (surveyor->maxsurveys > 1) &&
+              (nn_surveyor_inprogress (surveyor) || surveyor->nsurveys)))
+            return -EFSM;
+        surveyor->maxsurveys = *(int*) optval;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -310,6 +386,22 @@ static int nn_surveyor_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_MAXSURVEYS) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->maxsurveys;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_ID) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = (int) (surveyor->surveyid & 0x7fffffff);
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -317,16 +409,28 @@ static void nn_surveyor_shutdown (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
     struct nn_surveyor *surveyor;
+    struct nn_list_item *it;
 
     surveyor = nn_cont (self, struct nn_surveyor, fsm);
 
     if (nn_slow (src== NN_FSM_ACTION && type == NN_FSM_STOP)) {
         nn_timer_stop (&surveyor->timer);
+        for (it = nn_list_begin (&surveyor->surveys);
+              it != nn_list_end (&surveyor->surveys);
+              it = nn_list_next (&surveyor->surveys, it))
+            nn_timer_stop (&nn_cont (it, struct nn_surveyor_survey,
+                item)->timer);
         surveyor->state = NN_SURVEYOR_STATE_STOPPING;
     }
     if (nn_slow (surveyor->state == NN_SURVEYOR_STATE_STOPPING)) {
         if (!nn_timer_isidle (&surveyor->timer))
             return;
+        for (it = nn_list_begin (&surveyor->surveys);
+              it != nn_list_end (&surveyor->surveys);
+              it = nn_list_next (&surveyor->surveys, it))
+            if (!nn_timer_isidle (&nn_cont (it, struct nn_surveyor_survey,
+                  item)->timer))
+                return;
         surveyor->state = NN_SURVEYOR_STATE_IDLE;
         nn_fsm_stopped_noevent (&surveyor->fsm);
         nn_sockbase_stopped (&surveyor->xsurveyor.sockbase);
@@ -337,12 +441,20 @@ static void nn_surveyor_shutdown (struct nn_fsm *self, int src, int type,
 }
 
 static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
-    NN_UNUSED void *srcptr)
+    void *srcptr)
 {
     struct nn_surveyor *surveyor;
 
     surveyor = nn_cont (self, struct nn_surveyor, fsm);
 
+    /*  Timers of the individual surveys are handled irrespective of
+        the state of the socket. */
+    if (src == NN_SURVEYOR_SRC_SURVEY_TIMER) {
+        nn_surveyor_survey_handler (surveyor, type,
+            nn_cont (srcptr, struct nn_surveyor_survey, timer));
+        return;
+    }
+
     switch (surveyor->state) {
 
 /******************************************************************************/
@@ -498,6 +610,154 @@ static void nn_surveyor_resend (struct nn_surveyor *self)
     errnum_assert (rc == 0, -rc);
 }
 
+/******************************************************************************/
+/*  Multiple surveys in progress.                                             */
+/******************************************************************************/
+
+static int nn_surveyor_send_survey (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    struct nn_surveyor_survey *survey;
+
+    if (nn_slow (self->nsurveys >= self->maxsurveys))
+        return -EAGAIN;
+
+    /*  Generate new survey ID skipping the ones still in use, which may
+        happen only if the IDs have wrapped around. */
+    do {
+        ++self->surveyid;
+        self->surveyid |= 0x80000000;
+    } while (nn_slow (nn_hash_get (&self->active,
+        self->surveyid & 0x7fffffff) != NULL));
+
+    nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, 4);
+    nn_putl (nn_chunkref_data (&msg->sphdr), self->surveyid);
+    rc = nn_xsurveyor_send (&self->xsurveyor.sockbase, msg);
+    errnum_assert (rc == 0, -rc);
+
+    survey = nn_alloc (sizeof (struct nn_surveyor_survey), "survey");
+    alloc_assert (survey);
+    survey->id = self->surveyid & 0x7fffffff;
+    survey->state = NN_SURVEYOR_SURVEY_ACTIVE;
+    nn_timer_init (&survey->timer, NN_SURVEYOR_SRC_SURVEY_TIMER, &self->fsm);
+    nn_hash_item_init (&survey->hashitem);
+    nn_list_item_init (&survey->item);
+    nn_hash_insert (&self->active, survey->id, &survey->hashitem);
+    nn_list_insert (&self->surveys, &survey->item,
+        nn_list_end (&self->surveys));
+    ++self->nsurveys;
+    self->timedout = 0;
+
+    nn_timer_start (&survey->timer, self->deadline);
+
+    return 0;
+}
+
+static int nn_surveyor_recv_survey (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    uint32_t surveyid;
+    struct nn_chunkref hdrs;
+    struct nn_cmsghdr *cmsg;
+    size_t hdrssz;
+    int id;
+
+    /*  Once all the surveys have expired, the first receive reports
+        the deadline. */
+    if (nn_slow (!self->nsurveys)) {
+        if (self->timedout == NN_SURVEYOR_TIMEDOUT) {
+            self->timedout = 0;
+            return -ETIMEDOUT;
+        }
+        return -EFSM;
+    }
+
+    /*  Responses to the surveys that have expired were dropped by
+        the filter. */
+    rc = nn_xsurveyor_recv (&self->xsurveyor.sockbase, msg);
+    if (nn_slow (rc == -EAGAIN))
+        return -EAGAIN;
+    errnum_assert (rc == 0, -rc);
+    surveyid = nn_getl (nn_chunkref_data (&msg->sphdr));
+
+    /*  Replace the header with a control message telling the user which
+        survey is the response for. */
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, 0);
+    hdrssz = nn_chunkref_size (&msg->hdrs);
+    nn_chunkref_init (&hdrs, hdrssz + NN_CMSG_SPACE (sizeof (id)));
+    memcpy (nn_chunkref_data (&hdrs), nn_chunkref_data (&msg->hdrs), hdrssz);
+    cmsg = (struct nn_cmsghdr*) ((uint8_t*) nn_chunkref_data (&hdrs) + hdrssz);
+    cmsg->cmsg_level = NN_SURVEYOR;
+    cmsg->cmsg_type = NN_SURVEYOR_ID;
+    cmsg->cmsg_len = NN_CMSG_SPACE (sizeof (id));
+    id = (int) (surveyid & 0x7fffffff);
+    memcpy (NN_CMSG_DATA (cmsg), &id, sizeof (id));
+    nn_chunkref_term (&msg->hdrs);
+    nn_chunkref_mv (&msg->hdrs, &hdrs);
+
+    return 0;
+}
+
+static int nn_surveyor_filter (struct nn_xsurveyor *self, uint32_t surveyid)
+{
+    struct nn_surveyor *surveyor;
+
+    surveyor = nn_cont (self, struct nn_surveyor, xsurveyor);
+
+    /*  Only the responses to the current survey, or to the surveys whose
+        deadline hasn't expired yet, are accepted. */
+    if (surveyor->maxsurveys > 1)
+        return (surveyid & 0x80000000) && nn_hash_get (&surveyor->active,
+            surveyid & 0x7fffffff) ? 1 : 0;
+    return surveyid == surveyor->surveyid ? 1 : 0;
+}
+
+static void nn_surveyor_survey_handler (struct nn_surveyor *self, int type,
+    struct nn_surveyor_survey *survey)
+{
+    switch (survey->state) {
+
+    /*  Deadline expired. Responses are not accepted any more. */
+    case NN_SURVEYOR_SURVEY_ACTIVE:
+        switch (type) {
+        case NN_TIMER_TIMEOUT:
+            nn_timer_stop (&survey->timer);
+            nn_hash_erase (&self->active, &survey->hashitem);
+            survey->state = NN_SURVEYOR_SURVEY_STOPPING;
+            return;
+        default:
+            nn_fsm_bad_action (survey->state, NN_SURVEYOR_SRC_SURVEY_TIMER,
+                type);
+        }
+
+    /*  The timer is stopped. The survey can be deallocated. */
+    case NN_SURVEYOR_SURVEY_STOPPING:
+        switch (type) {
+        case NN_TIMER_STOPPED:
+            nn_list_erase (&self->surveys, &survey->item);
+            nn_timer_term (&survey->timer);
+            nn_hash_item_term (&survey->hashitem);
+            nn_list_item_term (&survey->item);
+            nn_free (survey);
+            --self->nsurveys;
+            if (!self->nsurveys)
+                self->timedout = NN_SURVEYOR_TIMEDOUT;
+            return;
+        default:
+            nn_fsm_bad_action (survey->state, NN_SURVEYOR_SRC_SURVEY_TIMER,
+                type);
+        }
+
+    default:
+        nn_fsm_bad_state (survey->state, NN_SURVEYOR_SRC_SURVEY_TIMER, type);
+    }
+}
+
 static int nn_surveyor_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_surveyor *self;
@@ -36,6 +36,8 @@
 
 /*  Private functions. */
 static void nn_xrespondent_destroy (struct nn_sockbase *self);
+static struct nn_xrespondent_data *nn_xrespondent_answered (
+    struct nn_xrespondent *self, uint32_t key);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static const struct nn_sockbase_vfptr nn_xrespondent_sockbase_vfptr = {
@@ -61,6 +63,8 @@ void nn_xrespondent_init (struct nn_xrespondent *self,
     nn_random_generate (&self->next_key, sizeof (self->next_key));
     nn_hash_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    self->maxoutstanding = 0;
+    self->outstanding = 0;
 }
 
 void nn_xrespondent_term (struct nn_xrespondent *self)
@@ -92,7 +96,7 @@ int nn_xrespondent_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (*data), "pipe data (xrespondent)");
     alloc_assert (data);
@@ -100,6 +104,7 @@ int nn_xrespondent_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data->pipe = pipe;
     nn_hash_item_init (&data->outitem);
     data->flags = 0;
+    data->outstanding = 0;
     nn_hash_insert (&xrespondent->outpipes, xrespondent->next_key & 0x7fffffff,
         &data->outitem);
     xrespondent->next_key++;
@@ -117,6 +122,9 @@ void nn_xrespondent_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
     data = nn_pipe_getdata (pipe);
 
+    /*  The surveys of the peer will never be answered. */
+    xrespondent->outstanding -= data->outstanding;
+
     nn_fq_rm (&xrespondent->inpipes, &data->initem);
     nn_hash_erase (&xrespondent->outpipes, &data->outitem);
     nn_hash_item_term (&data->outitem);
@@ -146,8 +154,15 @@ void nn_xrespondent_out (NN_UNUSED struct nn_sockbase *self,
 
 int nn_xrespondent_events (struct nn_sockbase *self)
 {
-    return (nn_fq_can_recv (&nn_cont (self, struct nn_xrespondent,
-        sockbase)->inpipes) ? NN_SOCKBASE_EVENT_IN : 0) | NN_SOCKBASE_EVENT_OUT;
+    struct nn_xrespondent *xrespondent;
+
+    xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
+
+    if (xrespondent->maxoutstanding &&
+          xrespondent->outstanding >= xrespondent->maxoutstanding)
+        return NN_SOCKBASE_EVENT_OUT;
+    return (nn_fq_can_recv (&xrespondent->inpipes) ?
+        NN_SOCKBASE_EVENT_IN : 0) | NN_SOCKBASE_EVENT_OUT;
 }
 
 int nn_xrespondent_send (struct nn_sockbase *self, struct nn_msg *msg)
@@ -171,8 +186,7 @@ int nn_xrespondent_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     /*  Find the appropriate pipe to send the message to. If there's none,
         or if it's not ready for sending, silently drop the message. */
-    data = nn_cont (nn_hash_get (&xrespondent->outpipes, key),
-        struct nn_xrespondent_data, outitem);
+    data = nn_xrespondent_answered (xrespondent, key);
     if (!data || !(data->flags & NN_XRESPONDENT_OUT)) {
         nn_msg_term (msg);
         return 0;
@@ -201,6 +215,12 @@ int nn_xrespondent_recv (struct nn_sockbase *self, struct nn_msg *msg)
 
     xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
 
+    /*  Don't read more surveys until some of the ones being processed are
+        answered. The peers are pushed back by the transports meanwhile. */
+    if (nn_slow (xrespondent->maxoutstanding &&
+          xrespondent->outstanding >= xrespondent->maxoutstanding))
+        return -EAGAIN;
+
     rc = nn_fq_recv (&xrespondent->inpipes, msg, &pipe);
     if (nn_slow (rc < 0))
         return rc;
@@ -254,20 +274,74 @@ int nn_xrespondent_recv (struct nn_sockbase *self, struct nn_msg *msg)
     nn_chunkref_term (&msg->sphdr);
     nn_chunkref_mv (&msg->sphdr, &ref);
 
+    ++pipedata->outstanding;
+    ++xrespondent->outstanding;
+
     return 0;
 }
 
-int nn_xrespondent_setopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED const void *optval, NN_UNUSED size_t optvallen)
+void nn_xrespondent_cancel (struct nn_sockbase *self,
+    struct nn_chunkref *backtrace)
+{
+    struct nn_xrespondent *xrespondent;
+
+    xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
+
+    if (nn_chunkref_size (backtrace) >= sizeof (uint32_t))
+        nn_xrespondent_answered (xrespondent,
+            nn_getl (nn_chunkref_data (backtrace)));
+}
+
+static struct nn_xrespondent_data *nn_xrespondent_answered (
+    struct nn_xrespondent *self, uint32_t key)
+{
+    struct nn_xrespondent_data *data;
+
+    data = nn_cont (nn_hash_get (&self->outpipes, key),
+        struct nn_xrespondent_data, outitem);
+    if (data && data->outstanding) {
+        --data->outstanding;
+        --self->outstanding;
+    }
+    return data;
+}
+
+int nn_xrespondent_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
 {
+    struct nn_xrespondent *xrespondent;
+    int val;
+
+    xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
+
+    if (level == NN_RESPONDENT && option == NN_RESPONDENT_MAXOUTSTANDING) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xrespondent->maxoutstanding = val;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
-int nn_xrespondent_getopt (NN_UNUSED struct nn_sockbase *self,
-    NN_UNUSED int level, NN_UNUSED int option,
-    NN_UNUSED void *optval, NN_UNUSED size_t *optvallen)
+int nn_xrespondent_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
 {
+    struct nn_xrespondent *xrespondent;
+
+    xrespondent = nn_cont (self, struct nn_xrespondent, sockbase);
+
+    if (level == NN_RESPONDENT && option == NN_RESPONDENT_MAXOUTSTANDING) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        memcpy (optval, &xrespondent->maxoutstanding, sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
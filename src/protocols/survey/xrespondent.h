@@ -36,6 +36,9 @@ struct nn_xrespondent_data {
     struct nn_hash_item outitem;
     struct nn_fq_data initem;
     uint32_t flags;
+
+    /*  Number of surveys received from the pipe and not answered yet. */
+    int outstanding;
 };
 
 struct nn_xrespondent {
@@ -49,6 +52,11 @@ struct nn_xrespondent {
 
     /*  Fair-queuer to get surveys from. */
     struct nn_fq inpipes;
+
+    /*  Once 'maxoutstanding' surveys are waiting for the response, no more
+        surveys are read from the pipes. Zero means no limit. */
+    int maxoutstanding;
+    int outstanding;
 };
 
 void nn_xrespondent_init (struct nn_xrespondent *self,
@@ -69,4 +77,10 @@ int nn_xrespondent_getopt (struct nn_sockbase *self, int level, int option,
 
 int nn_xrespondent_ispeer (int socktype);
 
+/*  Tells the socket that the survey with the given backtrace is not going
+    to be answered, so that it doesn't count towards
+    NN_RESPONDENT_MAXOUTSTANDING any more. */
+void nn_xrespondent_cancel (struct nn_sockbase *self,
+    struct nn_chunkref *backtrace);
+
 #endif
@@ -28,6 +28,7 @@
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
+#include "../../utils/wire.h"
 #include "../../utils/alloc.h"
 #include "../../utils/attr.h"
 
@@ -57,6 +58,7 @@ void nn_xsurveyor_init (struct nn_xsurveyor *self,
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_dist_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    self->filter = NULL;
 }
 
 void nn_xsurveyor_term (struct nn_xsurveyor *self)
@@ -88,7 +90,7 @@ int nn_xsurveyor_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     sz = sizeof (rcvprio);
     nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVPRIO, &rcvprio, &sz);
     nn_assert (sz == sizeof (rcvprio));
-    nn_assert (rcvprio >= 1 && rcvprio <= 16);
+    nn_assert (rcvprio >= 1 && rcvprio <= NN_PRIOLIST_SLOTS);
 
     data = nn_alloc (sizeof (struct nn_xsurveyor_data),
         "pipe data (xsurveyor)");
@@ -160,28 +162,53 @@ int nn_xsurveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_xsurveyor *xsurveyor;
+    struct nn_chunkref *hdr;
 
     xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
 
-    rc = nn_fq_recv (&xsurveyor->inpipes, msg, NULL);
-    if (nn_slow (rc < 0))
-        return rc;
+    while (1) {
+        rc = nn_fq_recv (&xsurveyor->inpipes, msg, NULL);
+        if (nn_slow (rc < 0))
+            return rc;
+
+        /*  The survey ID is either in the header already or at the beginning
+            of the body. */
+        if (rc & NN_PIPE_PARSED)
+            hdr = &msg->sphdr;
+        else {
+            hdr = &msg->body;
+            if (nn_slow (nn_chunkref_size (hdr) < sizeof (uint32_t))) {
+                nn_msg_term (msg);
+                continue;
+            }
+        }
 
-    /*  Split the header from the body, if needed. */
-    if (!(rc & NN_PIPE_PARSED)) {
-        if (nn_slow (nn_chunkref_size (&msg->body) < sizeof (uint32_t))) {
-            nn_msg_term (msg);
-            return -EAGAIN;
+        /*  Drop the responses the surveyor isn't interested in right away,
+            so that stale ones don't cost more than being received. */
+        if (xsurveyor->filter) {
+            if (nn_slow ((rc & NN_PIPE_PARSED) &&
+                  nn_chunkref_size (hdr) != sizeof (uint32_t)) ||
+                  !xsurveyor->filter (xsurveyor,
+                  nn_getl (nn_chunkref_data (hdr)))) {
+                nn_msg_term (msg);
+                nn_sockbase_stat_increment (self,
+                    NN_STAT_DROPPED_MESSAGES, 1);
+                continue;
+            }
         }
-        nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
-        nn_chunkref_term (&msg->sphdr);
-        nn_chunkref_init (&msg->sphdr, sizeof (uint32_t));
-        memcpy (nn_chunkref_data (&msg->sphdr), nn_chunkref_data (&msg->body),
-           sizeof (uint32_t));
-        nn_chunkref_trim (&msg->body, sizeof (uint32_t));
-    }
 
-    return 0;
+        /*  Split the header from the body, if needed. */
+        if (!(rc & NN_PIPE_PARSED)) {
+            nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+            nn_chunkref_term (&msg->sphdr);
+            nn_chunkref_init (&msg->sphdr, sizeof (uint32_t));
+            memcpy (nn_chunkref_data (&msg->sphdr),
+                nn_chunkref_data (&msg->body), sizeof (uint32_t));
+            nn_chunkref_trim (&msg->body, sizeof (uint32_t));
+        }
+
+        return 0;
+    }
 }
 
 int nn_xsurveyor_setopt (NN_UNUSED struct nn_sockbase *self,
@@ -44,6 +44,11 @@ struct nn_xsurveyor {
 
     /*  Fair-queuer to receive messages. */
     struct nn_fq inpipes;
+
+    /*  If set, the survey ID of each response is passed to it as soon as
+        the response is taken from the pipe. The responses it returns 0 for
+        are dropped before their header is split off. */
+    int (*filter) (struct nn_xsurveyor *self, uint32_t surveyid);
 };
 
 void nn_xsurveyor_init (struct nn_xsurveyor *self,
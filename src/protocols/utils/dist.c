@@ -23,56 +23,98 @@
 #include "dist.h"
 
 #include "../../utils/err.h"
-#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
 #include "../../utils/fast.h"
 #include "../../utils/attr.h"
 
 #include <stddef.h>
 
+/*  Initial size of the array of pipes. */
+#define NN_DIST_MIN_CAPACITY 8
+
 void nn_dist_init (struct nn_dist *self)
 {
     self->count = 0;
-    nn_list_init (&self->pipes);
+    self->capacity = 0;
+    self->pipes = NULL;
 }
 
 void nn_dist_term (struct nn_dist *self)
 {
     nn_assert (self->count == 0);
-    nn_list_term (&self->pipes);
+    if (self->pipes)
+        nn_free (self->pipes);
 }
 
 void nn_dist_add (NN_UNUSED struct nn_dist *self,
     struct nn_dist_data *data, struct nn_pipe *pipe)
 {
     data->pipe = pipe;
-    nn_list_item_init (&data->item);
+    data->index = -1;
 }
 
-void nn_dist_rm (struct nn_dist *self, struct nn_dist_data *data)
+/*  Removes the pipe at position 'index' from the array. The last pipe
+    takes its place. */
+static void nn_dist_erase (struct nn_dist *self, uint32_t index)
 {
-    if (nn_list_item_isinlist (&data->item)) {
-        --self->count;
-        nn_list_erase (&self->pipes, &data->item);
+    struct nn_dist_entry *entry;
+
+    entry = &self->pipes [index];
+    entry->data->index = -1;
+    --self->count;
+    if (index != self->count) {
+        *entry = self->pipes [self->count];
+        entry->data->index = (int) index;
     }
-    nn_list_item_term (&data->item);
+}
+
+void nn_dist_rm (struct nn_dist *self, struct nn_dist_data *data)
+{
+    if (data->index >= 0)
+        nn_dist_erase (self, (uint32_t) data->index);
 }
 
 void nn_dist_out (struct nn_dist *self, struct nn_dist_data *data)
 {
+    struct nn_dist_entry *entry;
+
+    nn_assert (data->index < 0);
+
+    if (nn_slow (self->count == self->capacity)) {
+        self->capacity = self->capacity ?
+            self->capacity * 2 : NN_DIST_MIN_CAPACITY;
+        if (self->pipes)
+            self->pipes = nn_realloc (self->pipes,
+                self->capacity * sizeof (struct nn_dist_entry));
+        else
+            self->pipes = nn_alloc (
+                self->capacity * sizeof (struct nn_dist_entry), "dist pipes");
+        alloc_assert (self->pipes);
+    }
+
+    entry = &self->pipes [self->count];
+    entry->pipe = data->pipe;
+    entry->data = data;
+    entry->selected = 0;
+    data->index = (int) self->count;
     ++self->count;
-    nn_list_insert (&self->pipes, &data->item, nn_list_end (&self->pipes));
+}
+
+int nn_dist_isout (struct nn_dist_data *data)
+{
+    return data->index >= 0 ? 1 : 0;
 }
 
 int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
     struct nn_pipe *exclude)
 {
     int rc;
-    struct nn_list_item *it;
-    struct nn_dist_data *data;
+    uint32_t remaining;
+    uint32_t i;
+    struct nn_pipe *pipe;
     struct nn_msg copy;
-
-    /*  TODO: We can optimise for the case when there's only one outbound
-        pipe here. No message copying is needed in such case. */
+    struct nn_msg_frame frame;
+    struct nn_msg_frame *shared;
 
     /*  In the specific case when there are no outbound pipes. There's nowhere
         to send the message to. Deallocate it. */
@@ -81,28 +123,111 @@ int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
         return 0;
     }
 
-    /*  Send the message to all the subscribers. */
-    nn_msg_bulkcopy_start (msg, self->count);
-    it = nn_list_begin (&self->pipes);
-    while (it != nn_list_end (&self->pipes)) {
-       data = nn_cont (it, struct nn_dist_data, item);
-       nn_msg_bulkcopy_cp (&copy, msg);
-       if (nn_fast (data->pipe == exclude)) {
-           nn_msg_term (&copy);
+    /*  Work out how many copies are needed up front. The excluded pipe
+        doesn't get one, provided it is writable in the first place. */
+    remaining = self->count;
+    if (exclude) {
+        for (i = 0; i != self->count; ++i) {
+            if (self->pipes [i].pipe == exclude) {
+                --remaining;
+                break;
+            }
+        }
+        if (remaining == 0) {
+            nn_msg_term (msg);
+            return 0;
+        }
+    }
+
+    /*  The references for all the copies but the last one are added at once
+        and the last pipe gets the original message. With a single pipe no
+        copying happens at all. A released pipe is replaced by one that
+        wasn't visited yet, so the same position is looked at again. The
+        copies share their framing, so that the work common to all the
+        pipes, such as compressing the message, is done only once. */
+    nn_msg_frame_init (&frame);
+    shared = NULL;
+    if (remaining > 1) {
+        nn_msg_bulkcopy_start (msg, remaining - 1);
+        shared = &frame;
+    }
+    i = 0;
+    while (remaining) {
+       pipe = self->pipes [i].pipe;
+       if (nn_slow (pipe == exclude)) {
+           ++i;
+           continue;
        }
-       else {
-           rc = nn_pipe_send (data->pipe, &copy);
-           errnum_assert (rc >= 0, -rc);
-           if (rc & NN_PIPE_RELEASE) {
-               --self->count;
-               it = nn_list_erase (&self->pipes, it);
-               continue;
-           }
+       if (--remaining)
+           nn_msg_bulkcopy_cp (&copy, msg);
+       else
+           nn_msg_mv (&copy, msg);
+       rc = nn_pipe_sendframe (pipe, &copy, shared);
+       errnum_assert (rc >= 0, -rc);
+       if (rc & NN_PIPE_RELEASE) {
+           nn_dist_erase (self, i);
+           continue;
        }
-       it = nn_list_next (&self->pipes, it);
+       ++i;
     }
-    nn_msg_term (msg);
+    nn_msg_frame_term (&frame);
 
     return 0;
 }
 
+int nn_dist_send_filtered (struct nn_dist *self, struct nn_msg *msg,
+    nn_dist_filter filter)
+{
+    int rc;
+    uint32_t remaining;
+    uint32_t i;
+    struct nn_dist_entry *entry;
+    struct nn_msg copy;
+    struct nn_msg_frame frame;
+    struct nn_msg_frame *shared;
+
+    /*  First pass: find out which pipes are interested in the message. */
+    remaining = 0;
+    for (i = 0; i != self->count; ++i) {
+        entry = &self->pipes [i];
+        entry->selected = filter (entry->data, msg) ? 1 : 0;
+        remaining += entry->selected;
+    }
+
+    if (remaining == 0) {
+        nn_msg_term (msg);
+        return 0;
+    }
+
+    /*  Second pass: send the message to the matching pipes only. As in
+        nn_dist_send, the last matching pipe gets the original message and
+        the copies share their framing. */
+    nn_msg_frame_init (&frame);
+    shared = NULL;
+    if (remaining > 1) {
+        nn_msg_bulkcopy_start (msg, remaining - 1);
+        shared = &frame;
+    }
+    i = 0;
+    while (remaining) {
+       entry = &self->pipes [i];
+       if (!entry->selected) {
+           ++i;
+           continue;
+       }
+       if (--remaining)
+           nn_msg_bulkcopy_cp (&copy, msg);
+       else
+           nn_msg_mv (&copy, msg);
+       rc = nn_pipe_sendframe (entry->pipe, &copy, shared);
+       errnum_assert (rc >= 0, -rc);
+       if (rc & NN_PIPE_RELEASE) {
+           nn_dist_erase (self, i);
+           continue;
+       }
+       ++i;
+    }
+    nn_msg_frame_term (&frame);
+
+    return 0;
+}
@@ -25,18 +25,33 @@
 
 #include "../../protocol.h"
 
-#include "../../utils/list.h"
-
-/*  Distributor. Sends messages to all the pipes. */
+/*  Distributor. Sends messages to all the pipes. The writable pipes are
+    kept in a dense array so that sending a message is a linear scan over
+    contiguous memory. */
 
 struct nn_dist_data {
-    struct nn_list_item item;
     struct nn_pipe *pipe;
+
+    /*  Position of the pipe in the array of writable pipes, -1 if the pipe
+        isn't writable at the moment. */
+    int index;
+};
+
+struct nn_dist_entry {
+    struct nn_pipe *pipe;
+    struct nn_dist_data *data;
+
+    /*  Scratch flag used by nn_dist_send_filtered. */
+    int selected;
 };
 
 struct nn_dist {
+
+    /*  Writable pipes. Pipes are removed by moving the last one in their
+        place, so the order of the pipes is arbitrary. */
     uint32_t count;
-    struct nn_list pipes;
+    uint32_t capacity;
+    struct nn_dist_entry *pipes;
 };
 
 void nn_dist_init (struct nn_dist *self);
@@ -46,10 +61,20 @@ void nn_dist_add (struct nn_dist *self,
 void nn_dist_rm (struct nn_dist *self, struct nn_dist_data *data);
 void nn_dist_out (struct nn_dist *self, struct nn_dist_data *data);
 
+/*  Returns 1 if the pipe is among the writable pipes, 0 otherwise. */
+int nn_dist_isout (struct nn_dist_data *data);
+
 /*  Sends the message to all the attached pipes except the one specified
     by 'exclude' parameter. If 'exclude' is NULL, message is sent to all
     attached pipes. */
 int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
     struct nn_pipe *exclude);
 
+/*  Sends the message only to the attached pipes for which 'filter' returns
+    a non-zero value. The filter is evaluated once per pipe and the message
+    is copied only as many times as there are matching pipes. */
+typedef int (*nn_dist_filter) (struct nn_dist_data *data, struct nn_msg *msg);
+int nn_dist_send_filtered (struct nn_dist *self, struct nn_msg *msg,
+    nn_dist_filter filter);
+
 #endif
@@ -22,14 +22,21 @@
 
 #include "fq.h"
 
+#include "../../nn.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
+#include "../../utils/fast.h"
 
 #include <stddef.h>
 
+static int nn_fq_recv_deficit (struct nn_fq *self, struct nn_msg *msg,
+    struct nn_pipe **pipe);
+
 void nn_fq_init (struct nn_fq *self)
 {
     nn_priolist_init (&self->priolist);
+    self->strategy = NN_FQ_ROUNDROBIN;
 }
 
 void nn_fq_term (struct nn_fq *self)
@@ -40,7 +47,14 @@ void nn_fq_term (struct nn_fq *self)
 void nn_fq_add (struct nn_fq *self, struct nn_fq_data *data,
     struct nn_pipe *pipe, int priority)
 {
+    size_t sz;
+
     nn_priolist_add (&self->priolist, &data->priodata, pipe, priority);
+    data->deficit = 0;
+    sz = sizeof (data->weight);
+    nn_pipe_getopt (pipe, NN_SOL_SOCKET, NN_RCVWEIGHT, &data->weight, &sz);
+    nn_assert (sz == sizeof (data->weight));
+    nn_assert (data->weight >= 1 && data->weight <= 100);
 }
 
 void nn_fq_rm (struct nn_fq *self, struct nn_fq_data *data)
@@ -63,6 +77,9 @@ int nn_fq_recv (struct nn_fq *self, struct nn_msg *msg, struct nn_pipe **pipe)
     int rc;
     struct nn_pipe *p;
 
+    if (nn_slow (self->strategy == NN_FQ_DEFICIT))
+        return nn_fq_recv_deficit (self, msg, pipe);
+
     /*  Pipe is NULL only when there are no avialable pipes. */
     p = nn_priolist_getpipe (&self->priolist);
     if (nn_slow (!p))
@@ -82,3 +99,67 @@ int nn_fq_recv (struct nn_fq *self, struct nn_msg *msg, struct nn_pipe **pipe)
     return rc & ~NN_PIPE_RELEASE;
 }
 
+int nn_fq_setopt (struct nn_fq *self, const void *optval, size_t optvallen)
+{
+    int val;
+
+    if (nn_slow (optvallen != sizeof (int)))
+        return -EINVAL;
+    val = *(int*) optval;
+    if (nn_slow (val != NN_FQ_ROUNDROBIN && val != NN_FQ_DEFICIT))
+        return -EINVAL;
+    self->strategy = val;
+    return 0;
+}
+
+int nn_fq_getopt (struct nn_fq *self, void *optval, size_t *optvallen)
+{
+    if (nn_slow (*optvallen < sizeof (int)))
+        return -EINVAL;
+    *(int*) optval = self->strategy;
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+static int nn_fq_recv_deficit (struct nn_fq *self, struct nn_msg *msg,
+    struct nn_pipe **pipe)
+{
+    int rc;
+    struct nn_priolist_slot *slot;
+    struct nn_fq_data *data;
+
+    if (nn_slow (self->priolist.current == -1))
+        return -EAGAIN;
+
+    /*  A pipe that has used up its quantum gets a new one when it's its turn
+        again. Pipes still paying off an overdraft are skipped meanwhile. */
+    while (1) {
+        slot = &self->priolist.slots [self->priolist.current - 1];
+        data = nn_cont (slot->current, struct nn_fq_data, priodata);
+        if (data->deficit > 0)
+            break;
+        data->deficit += (int64_t) NN_FQ_QUANTUM * data->weight;
+        if (data->deficit > 0)
+            break;
+        nn_priolist_advance (&self->priolist, 0);
+    }
+
+    rc = nn_pipe_recv (data->priodata.pipe, msg);
+    errnum_assert (rc >= 0, -rc);
+    data->deficit -= nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+
+    if (pipe)
+        *pipe = data->priodata.pipe;
+
+    /*  Stay with the pipe till the quantum is used up. A pipe that has
+        nothing more to read doesn't keep the rest of its quantum. */
+    if (rc & NN_PIPE_RELEASE) {
+        if (data->deficit > 0)
+            data->deficit = 0;
+        nn_priolist_advance (&self->priolist, 1);
+    }
+    else if (data->deficit <= 0)
+        nn_priolist_advance (&self->priolist, 0);
+
+    return rc & ~NN_PIPE_RELEASE;
+}
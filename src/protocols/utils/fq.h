@@ -28,14 +28,31 @@
 #include "priolist.h"
 
 /*  Fair-queuer. Retrieves messages from a set of pipes in round-robin
-    manner. */
+    manner. With NN_FQ_DEFICIT strategy, the pipes of the same priority are
+    served using deficit round-robin instead: on its turn, a pipe receives
+    a quantum of bytes proportional to its NN_RCVWEIGHT and it is read from
+    until the quantum is used up. A message exceeding the remaining quantum
+    is received anyway and the overdraft is deducted from the following
+    turns. That way the peers get their share of bandwidth irrespective of
+    the size of their messages. */
+
+/*  The number of bytes a pipe of weight 1 gets on its turn. */
+#define NN_FQ_QUANTUM 1024
 
 struct nn_fq_data {
     struct nn_priolist_data priodata;
+
+    /*  Bytes the pipe can still receive on its turn. Goes negative when
+        a message larger than the remaining quantum is received. */
+    int64_t deficit;
+    int weight;
 };
 
 struct nn_fq {
     struct nn_priolist priolist;
+
+    /*  NN_FQ_ROUNDROBIN or NN_FQ_DEFICIT. */
+    int strategy;
 };
 
 void nn_fq_init (struct nn_fq *self);
@@ -46,5 +63,7 @@ void nn_fq_rm (struct nn_fq *self, struct nn_fq_data *data);
 void nn_fq_in (struct nn_fq *self, struct nn_fq_data *data);
 int nn_fq_can_recv (struct nn_fq *self);
 int nn_fq_recv (struct nn_fq *self, struct nn_msg *msg, struct nn_pipe **pipe);
+int nn_fq_setopt (struct nn_fq *self, const void *optval, size_t optvallen);
+int nn_fq_getopt (struct nn_fq *self, void *optval, size_t *optvallen);
 
 #endif
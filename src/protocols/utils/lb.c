@@ -22,14 +22,24 @@
 
 #include "lb.h"
 
+#include "../../nn.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
+#include "../../utils/fast.h"
 
 #include <stddef.h>
+#include <stdint.h>
+
+static void nn_lb_select (struct nn_lb *self);
+static int nn_lb_key (struct nn_msg *msg, uint64_t *key);
+static void nn_lb_select_keyed (struct nn_lb *self, uint64_t key);
+static uint64_t nn_lb_mix (uint64_t val);
 
 void nn_lb_init (struct nn_lb *self)
 {
     nn_priolist_init (&self->priolist);
+    self->strategy = NN_LB_ROUNDROBIN;
 }
 
 void nn_lb_term (struct nn_lb *self)
@@ -41,6 +51,8 @@ void nn_lb_add (struct nn_lb *self, struct nn_lb_data *data,
     struct nn_pipe *pipe, int priority)
 {
     nn_priolist_add (&self->priolist, &data->priodata, pipe, priority);
+    data->load = 0;
+    data->seed = nn_lb_mix ((uint64_t) (uintptr_t) pipe);
 }
 
 void nn_lb_rm (struct nn_lb *self, struct nn_lb_data *data)
@@ -53,6 +65,18 @@ void nn_lb_out (struct nn_lb *self, struct nn_lb_data *data)
     nn_priolist_activate (&self->priolist, &data->priodata);
 }
 
+void nn_lb_hold (struct nn_lb *self, struct nn_lb_data *data)
+{
+    nn_priolist_rm (&self->priolist, &data->priodata);
+    nn_priolist_add (&self->priolist, &data->priodata, data->priodata.pipe,
+        data->priodata.priority);
+}
+
+int nn_lb_isactive (struct nn_lb_data *data)
+{
+    return nn_list_item_isinlist (&data->priodata.item);
+}
+
 int nn_lb_can_send (struct nn_lb *self)
 {
     return nn_priolist_is_active (&self->priolist);
@@ -67,6 +91,12 @@ int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to)
 {
     int rc;
     struct nn_pipe *pipe;
+    uint64_t key;
+
+    if (self->strategy == NN_LB_LEASTLOADED)
+        nn_lb_select (self);
+    else if (self->strategy == NN_LB_KEYED && nn_lb_key (msg, &key))
+        nn_lb_select_keyed (self, key);
 
     /*  Pipe is NULL only when there are no avialable pipes. */
     pipe = nn_priolist_getpipe (&self->priolist);
@@ -86,3 +116,149 @@ int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to)
     return rc & ~NN_PIPE_RELEASE;
 }
 
+int nn_lb_setopt (struct nn_lb *self, const void *optval, size_t optvallen)
+{
+    int val;
+
+    if (nn_slow (optvallen != sizeof (int)))
+        return -EINVAL;
+    val = *(int*) optval;
+    if (nn_slow (val != NN_LB_ROUNDROBIN && val != NN_LB_LEASTLOADED &&
+          val != NN_LB_KEYED))
+        return -EINVAL;
+    self->strategy = val;
+    return 0;
+}
+
+int nn_lb_getopt (struct nn_lb *self, void *optval, size_t *optvallen)
+{
+    if (nn_slow (*optvallen < sizeof (int)))
+        return -EINVAL;
+    *(int*) optval = self->strategy;
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+/*  Makes the least loaded pipe of the current priority level the current
+    one. The search starts at the current pipe, so that the pipes with
+    the same load are still used in round-robin fashion. */
+static void nn_lb_select (struct nn_lb *self)
+{
+    struct nn_priolist_slot *slot;
+    struct nn_priolist_data *best;
+    struct nn_priolist_data *data;
+    struct nn_list_item *it;
+    size_t bestload;
+    size_t load;
+
+    if (nn_slow (self->priolist.current == -1))
+        return;
+    slot = &self->priolist.slots [self->priolist.current - 1];
+
+    best = slot->current;
+    bestload = nn_cont (best, struct nn_lb_data, priodata)->load +
+        nn_pipe_queued (best->pipe);
+    it = &best->item;
+    while (bestload) {
+        it = nn_list_next (&slot->pipes, it);
+        if (!it)
+            it = nn_list_begin (&slot->pipes);
+        data = nn_cont (it, struct nn_priolist_data, item);
+        if (data == slot->current)
+            break;
+        load = nn_cont (data, struct nn_lb_data, priodata)->load +
+            nn_pipe_queued (data->pipe);
+        if (load < bestload) {
+            best = data;
+            bestload = load;
+        }
+    }
+    slot->current = best;
+}
+
+
+/*  Looks for the routing key among the message properties passed to
+    nn_sendmsg. If found, stores its hash in 'key' and returns 1. Messages
+    without the key are round-robined. */
+static int nn_lb_key (struct nn_msg *msg, uint64_t *key)
+{
+    uint8_t *pos;
+    size_t size;
+    size_t len;
+    struct nn_cmsghdr *cmsg;
+    uint64_t hash;
+    size_t i;
+
+    pos = nn_chunkref_data (&msg->hdrs);
+    size = nn_chunkref_size (&msg->hdrs);
+    while (size >= NN_CMSG_SPACE (0)) {
+        cmsg = (struct nn_cmsghdr*) pos;
+        if (nn_slow (cmsg->cmsg_len < NN_CMSG_LEN (0) ||
+              cmsg->cmsg_len > size))
+            return 0;
+        if (cmsg->cmsg_level == PROTO_SP &&
+              cmsg->cmsg_type == NN_ROUTING_KEY) {
+
+            /*  FNV-1a. */
+            len = cmsg->cmsg_len - NN_CMSG_LEN (0);
+            hash = 14695981039346656037ULL;
+            for (i = 0; i != len; ++i) {
+                hash ^= NN_CMSG_DATA (cmsg) [i];
+                hash *= 1099511628211ULL;
+            }
+            *key = hash;
+            return 1;
+        }
+        len = NN_CMSG_ALIGN_ (cmsg->cmsg_len);
+        if (len >= size)
+            return 0;
+        pos += len;
+        size -= len;
+    }
+    return 0;
+}
+
+/*  Makes the pipe with the highest weight for the key the current one.
+    Each pipe's weight depends only on the key and the pipe itself, so the
+    choice between any two pipes is not affected by the other pipes. */
+static void nn_lb_select_keyed (struct nn_lb *self, uint64_t key)
+{
+    struct nn_priolist_slot *slot;
+    struct nn_priolist_data *best;
+    struct nn_priolist_data *data;
+    struct nn_list_item *it;
+    uint64_t bestweight;
+    uint64_t weight;
+
+    if (nn_slow (self->priolist.current == -1))
+        return;
+    slot = &self->priolist.slots [self->priolist.current - 1];
+
+    best = NULL;
+    bestweight = 0;
+    for (it = nn_list_begin (&slot->pipes);
+          it != nn_list_end (&slot->pipes);
+          it = nn_list_next (&slot->pipes, it)) {
+        data = nn_cont (it, struct nn_priolist_data, item);
+        weight = nn_lb_mix (key ^
+            nn_cont (data, struct nn_lb_data, priodata)->seed);
+        if (!best || weight > bestweight) {
+            best = data;
+            bestweight = weight;
+        }
+    }
+    nn_assert (best);
+    slot->current = best;
+}
+
+/*  Finalizer of the SplitMix64 generator. Spreads every bit of the input
+    over the whole output. */
+static uint64_t nn_lb_mix (uint64_t val)
+{
+    val ^= val >> 30;
+    val *= 0xbf58476d1ce4e5b9ULL;
+    val ^= val >> 27;
+    val *= 0x94d049bb133111ebULL;
+    val ^= val >> 31;
+    return val;
+}
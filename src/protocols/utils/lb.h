@@ -27,14 +27,31 @@
 
 #include "priolist.h"
 
-/*  A load balancer. Round-robins messages to a set of pipes. */
+/*  A load balancer. Round-robins messages to a set of pipes. Alternatively,
+    messages can be sent to the pipe with the least outstanding messages
+    within the highest priority, i.e. the messages still waiting to be
+    written to the network plus, if tracked by the owner, the messages
+    waiting for an answer. With NN_LB_KEYED strategy, messages carrying
+    a routing key are sent to the pipe chosen by rendezvous hashing of the key
+    over the writable pipes of the highest priority. A pipe joining or leaving
+    thus only moves the keys that hash to it. */
 
 struct nn_lb_data {
     struct nn_priolist_data priodata;
+
+    /*  Number of messages sent to the pipe that are still waiting for
+        an answer. Maintained by the owner of the load balancer. */
+    int load;
+
+    /*  Identity of the pipe for the purposes of rendezvous hashing. */
+    uint64_t seed;
 };
 
 struct nn_lb {
     struct nn_priolist priolist;
+
+    /*  NN_LB_ROUNDROBIN, NN_LB_LEASTLOADED or NN_LB_KEYED. */
+    int strategy;
 };
 
 void nn_lb_init (struct nn_lb *self);
@@ -43,8 +60,18 @@ void nn_lb_add (struct nn_lb *self, struct nn_lb_data *data,
     struct nn_pipe *pipe, int priority);
 void nn_lb_rm (struct nn_lb *self, struct nn_lb_data *data);
 void nn_lb_out (struct nn_lb *self, struct nn_lb_data *data);
+
+/*  Stops sending messages to the pipe although it is writable. Calling
+    nn_lb_out makes it available again. */
+void nn_lb_hold (struct nn_lb *self, struct nn_lb_data *data);
+
+/*  Returns 1 if messages can be sent to the pipe at the moment. */
+int nn_lb_isactive (struct nn_lb_data *data);
+
 int nn_lb_can_send (struct nn_lb *self);
 int nn_lb_get_priority (struct nn_lb *self);
 int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to);
+int nn_lb_setopt (struct nn_lb *self, const void *optval, size_t optvallen);
+int nn_lb_getopt (struct nn_lb *self, void *optval, size_t *optvallen);
 
 #endif
@@ -30,6 +30,12 @@
 
 #include <stddef.h>
 
+/*  Private functions. */
+static int nn_priolist_ctz (uint64_t val);
+static void nn_priolist_set (struct nn_priolist *self, int priority);
+static void nn_priolist_clear (struct nn_priolist *self, int priority);
+static int nn_priolist_first (struct nn_priolist *self);
+
 void nn_priolist_init (struct nn_priolist *self)
 {
     int i;
@@ -38,6 +44,8 @@ void nn_priolist_init (struct nn_priolist *self)
         nn_list_init (&self->slots [i].pipes);
         self->slots [i].current = NULL;
     }
+    for (i = 0; i != NN_PRIOLIST_WORDS; ++i)
+        self->active [i] = 0;
     self->current = -1;
 }
 
@@ -86,19 +94,15 @@ void nn_priolist_rm (struct nn_priolist *self, struct nn_priolist_data *data)
         slot->current = nn_cont (it, struct nn_priolist_data, item);
     }
 
-    /*  If we are not messing with the current slot, we are done. */
-    if (self->current != data->priority)
+    /*  If the slot is still non-empty, we are done. */
+    if (!nn_list_empty (&slot->pipes))
         return;
 
-    /*  Otherwise, the current slot may have become empty and we have switch
-        to lower priority slots. */
-    while (nn_list_empty (&self->slots [self->current - 1].pipes)) {
-        ++self->current;
-        if (self->current > NN_PRIOLIST_SLOTS) {
-            self->current = -1;
-            return;
-        }
-    }
+    /*  Otherwise, if it was the current slot, we have to switch to the
+        highest-priority slot still having some pipes. */
+    nn_priolist_clear (self, data->priority);
+    if (self->current == data->priority)
+        self->current = nn_priolist_first (self);
 }
 
 void nn_priolist_activate (struct nn_priolist *self,
@@ -119,6 +123,7 @@ void nn_priolist_activate (struct nn_priolist *self,
         this slot becomes current. */
     nn_list_insert (&slot->pipes, &data->item, nn_list_end (&slot->pipes));
     slot->current = data;
+    nn_priolist_set (self, data->priority);
     if (self->current == -1) {
         self->current = data->priority;
         return;
@@ -163,18 +168,52 @@ void nn_priolist_advance (struct nn_priolist *self, int release)
         it = nn_list_begin (&slot->pipes);
     slot->current = nn_cont (it, struct nn_priolist_data, item);
 
-    /* If there are no more pipes in this slot, find a non-empty slot with
-       lower priority. */
-    while (nn_list_empty (&slot->pipes)) {
-        ++self->current;
-        if (self->current > NN_PRIOLIST_SLOTS) {
-            self->current = -1;
-            return;
-        }
-        slot = &self->slots [self->current - 1];
+    /* If there are no more pipes in this slot, switch to the non-empty slot
+       with the next lower priority. */
+    if (nn_list_empty (&slot->pipes)) {
+        nn_priolist_clear (self, self->current);
+        self->current = nn_priolist_first (self);
     }
 }
 
 int nn_priolist_get_priority (struct nn_priolist *self) {
     return self->current;
 }
+
+static int nn_priolist_ctz (uint64_t val)
+{
+#if defined __GNUC__ || defined __clang__
+    return __builtin_ctzll (val);
+#else
+    int res;
+
+    res = 0;
+    while (!(val & 1)) {
+        val >>= 1;
+        ++res;
+    }
+    return res;
+#endif
+}
+
+static void nn_priolist_set (struct nn_priolist *self, int priority)
+{
+    self->active [(priority - 1) / 64] |=
+        ((uint64_t) 1) << ((priority - 1) % 64);
+}
+
+static void nn_priolist_clear (struct nn_priolist *self, int priority)
+{
+    self->active [(priority - 1) / 64] &=
+        ~(((uint64_t) 1) << ((priority - 1) % 64));
+}
+
+static int nn_priolist_first (struct nn_priolist *self)
+{
+    int i;
+
+    for (i = 0; i != NN_PRIOLIST_WORDS; ++i)
+        if (self->active [i])
+            return i * 64 + nn_priolist_ctz (self->active [i]) + 1;
+    return -1;
+}
@@ -27,9 +27,15 @@
 
 #include "../../utils/list.h"
 
-/*  Prioritised list of pipes. */
+#include <stdint.h>
 
-#define NN_PRIOLIST_SLOTS 16
+/*  Prioritised list of pipes. Priorities range from 1 (highest) to
+    NN_PRIOLIST_SLOTS (lowest). */
+
+#define NN_PRIOLIST_SLOTS 64
+
+/*  Number of 64-bit words in the bitmap of non-empty slots. */
+#define NN_PRIOLIST_WORDS ((NN_PRIOLIST_SLOTS + 63) / 64)
 
 struct nn_priolist_data {
 
@@ -59,6 +65,11 @@ struct nn_priolist {
     /*  Each slot holds pipes for a particular priority level. */
     struct nn_priolist_slot slots [NN_PRIOLIST_SLOTS];
 
+    /*  Bit N is set if slot N has at least one active pipe. The next
+        non-empty slot is found with a find-first-set instead of walking
+        the slots one by one. */
+    uint64_t active [NN_PRIOLIST_WORDS];
+
     /*  The index of the slot holding the current pipe. It should be the
         highest-priority non-empty slot available. If there's no available
         pipe, this field is set to -1. */
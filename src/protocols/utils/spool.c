@@ -0,0 +1,296 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "spool.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/chunk.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*  Identifies the file and the layout of the data in it. */
+#define NN_SPOOL_TAG 0x6e6e73706f6f6c01ULL
+
+/*  Record marking the rest of the ring as unused. The next record starts
+    at the beginning of the ring. */
+#define NN_SPOOL_WRAP 0xffffffffU
+
+/*  Layout of the beginning of the file. The ring follows. */
+struct nn_spool_hdr {
+    uint64_t tag;
+
+    /*  Size of the ring. */
+    uint64_t size;
+
+    /*  Number of bytes written into the ring and consumed from it so far.
+        The records between them are the messages waiting in the queue. */
+    volatile uint64_t head;
+    volatile uint64_t tail;
+
+    uint8_t pad [32];
+};
+
+/*  Each message is preceded by its size and deadline, the whole record
+    being rounded up to a multiple of 8 bytes. */
+struct nn_spool_rec {
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t expiry;
+};
+
+#define NN_SPOOL_ALIGN(sz) (((sz) + 7) & ~(uint64_t) 7)
+
+void nn_spool_init (struct nn_spool *self)
+{
+    self->hdr = NULL;
+    self->data = NULL;
+    self->size = 0;
+    self->maplen = 0;
+    self->fd = -1;
+    self->opened = 0;
+}
+
+void nn_spool_term (struct nn_spool *self)
+{
+    nn_assert (self->hdr == NULL);
+}
+
+#if defined NN_HAVE_WINDOWS
+
+int nn_spool_open (NN_UNUSED struct nn_spool *self,
+    NN_UNUSED const char *path, NN_UNUSED size_t size)
+{
+    return -ENOTSUP;
+}
+
+void nn_spool_close (NN_UNUSED struct nn_spool *self)
+{
+}
+
+#else
+
+int nn_spool_open (struct nn_spool *self, const char *path, size_t size)
+{
+    int rc;
+    int fd;
+    struct stat st;
+    void *addr;
+    struct nn_spool_hdr *hdr;
+    int valid;
+
+    nn_assert (self->hdr == NULL);
+
+    if (nn_slow (size < NN_SPOOL_MINSIZE || size > NN_SPOOL_MAXSIZE))
+        return -EINVAL;
+    size = (size_t) NN_SPOOL_ALIGN (size);
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (nn_slow (fd < 0))
+        return -errno;
+    rc = flock (fd, LOCK_EX | LOCK_NB);
+    if (nn_slow (rc != 0)) {
+        rc = errno == EWOULDBLOCK ? -EADDRINUSE : -errno;
+        close (fd);
+        return rc;
+    }
+
+    /*  A file left over by a previous process keeps its size. Anything else
+        is started afresh. */
+    rc = fstat (fd, &st);
+    if (nn_slow (rc != 0))
+        goto fail;
+    valid = 0;
+    if ((size_t) st.st_size >= sizeof (struct nn_spool_hdr)) {
+        addr = mmap (NULL, sizeof (struct nn_spool_hdr), PROT_READ,
+            MAP_SHARED, fd, 0);
+        if (nn_slow (addr == MAP_FAILED))
+            goto fail;
+        hdr = (struct nn_spool_hdr*) addr;
+        if (hdr->tag == NN_SPOOL_TAG && hdr->size >= NN_SPOOL_MINSIZE &&
+              hdr->size <= NN_SPOOL_MAXSIZE && hdr->size % 8 == 0 &&
+              (uint64_t) st.st_size == sizeof (*hdr) + hdr->size &&
+              hdr->head - hdr->tail <= hdr->size &&
+              hdr->head % 8 == 0 && hdr->tail % 8 == 0) {
+            size = (size_t) hdr->size;
+            valid = 1;
+        }
+        munmap (addr, sizeof (struct nn_spool_hdr));
+    }
+    if (!valid) {
+        rc = ftruncate (fd, 0);
+        if (nn_slow (rc != 0))
+            goto fail;
+        rc = ftruncate (fd, sizeof (struct nn_spool_hdr) + size);
+        if (nn_slow (rc != 0))
+            goto fail;
+    }
+
+    self->maplen = sizeof (struct nn_spool_hdr) + size;
+    addr = mmap (NULL, self->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (nn_slow (addr == MAP_FAILED))
+        goto fail;
+
+    /*  The messages are written and read in order. */
+    madvise (addr, self->maplen, MADV_SEQUENTIAL);
+
+    self->hdr = (struct nn_spool_hdr*) addr;
+    self->data = (uint8_t*) (self->hdr + 1);
+    self->size = size;
+    self->fd = fd;
+
+    /*  The new file is zero-filled, only the size and the tag have to be
+        filled in. */
+    if (!valid) {
+        self->hdr->size = size;
+        self->hdr->tag = NN_SPOOL_TAG;
+    }
+    self->opened = self->hdr->head;
+
+    return 0;
+
+fail:
+    rc = -errno;
+    close (fd);
+    return rc;
+}
+
+void nn_spool_close (struct nn_spool *self)
+{
+    int rc;
+
+    if (!self->hdr)
+        return;
+
+    rc = munmap (self->hdr, self->maplen);
+    errno_assert (rc == 0);
+    rc = close (self->fd);
+    errno_assert (rc == 0);
+    self->hdr = NULL;
+    self->data = NULL;
+    self->size = 0;
+    self->maplen = 0;
+    self->fd = -1;
+}
+
+#endif
+
+int nn_spool_isopen (struct nn_spool *self)
+{
+    return self->hdr != NULL;
+}
+
+int nn_spool_empty (struct nn_spool *self)
+{
+    return self->hdr->head == self->hdr->tail;
+}
+
+int nn_spool_push (struct nn_spool *self, struct nn_msg *msg)
+{
+    uint64_t size;
+    uint64_t recsize;
+    uint64_t pos;
+    uint64_t gap;
+    uint8_t *dst;
+    struct nn_spool_rec *rec;
+    int i;
+
+    /*  If the record doesn't fit in before the end of the ring, the rest of
+        it is skipped. */
+    size = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    recsize = NN_SPOOL_ALIGN (sizeof (struct nn_spool_rec) + size);
+    pos = self->hdr->head % self->size;
+    gap = self->size - pos < recsize ? self->size - pos : 0;
+    if (nn_slow (size >= NN_SPOOL_WRAP || gap + recsize >
+          self->size - (self->hdr->head - self->hdr->tail)))
+        return -EAGAIN;
+    if (gap) {
+        rec = (struct nn_spool_rec*) (self->data + pos);
+        rec->size = NN_SPOOL_WRAP;
+        pos = 0;
+    }
+
+    rec = (struct nn_spool_rec*) (self->data + pos);
+    rec->size = (uint32_t) size;
+    rec->reserved = 0;
+    rec->expiry = msg->expiry;
+    dst = (uint8_t*) (rec + 1);
+    memcpy (dst, nn_chunkref_data (&msg->sphdr),
+        nn_chunkref_size (&msg->sphdr));
+    dst += nn_chunkref_size (&msg->sphdr);
+    memcpy (dst, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body));
+    dst += nn_chunkref_size (&msg->body);
+    for (i = 0; i != msg->nparts; ++i) {
+        memcpy (dst, msg->parts [i], nn_chunk_size (msg->parts [i]));
+        dst += nn_chunk_size (msg->parts [i]);
+    }
+
+    self->hdr->head += gap + recsize;
+
+    return 0;
+}
+
+int nn_spool_pop (struct nn_spool *self, struct nn_msg *msg)
+{
+    uint64_t pos;
+    uint64_t recsize;
+    struct nn_spool_rec *rec;
+
+    if (self->hdr->head == self->hdr->tail)
+        return 0;
+
+    pos = self->hdr->tail % self->size;
+    rec = (struct nn_spool_rec*) (self->data + pos);
+    if (rec->size == NN_SPOOL_WRAP) {
+        self->hdr->tail += self->size - pos;
+        pos = 0;
+        rec = (struct nn_spool_rec*) self->data;
+    }
+
+    /*  The file may have been damaged, e.g. by a crash in the middle of
+        a write. The rest of it is dropped then. */
+    recsize = NN_SPOOL_ALIGN (sizeof (struct nn_spool_rec) + rec->size);
+    if (nn_slow (self->hdr->head - self->hdr->tail > self->size ||
+          recsize > self->size - pos ||
+          recsize > self->hdr->head - self->hdr->tail)) {
+        self->hdr->tail = self->hdr->head;
+        return 0;
+    }
+
+    nn_msg_init (msg, rec->size);
+    memcpy (nn_chunkref_data (&msg->body), rec + 1, rec->size);
+    msg->expiry = self->hdr->tail < self->opened ? 0 : rec->expiry;
+    self->hdr->tail += recsize;
+
+    return 1;
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SPOOL_INCLUDED
+#define NN_SPOOL_INCLUDED
+
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Queue of messages kept in a memory-mapped file. The file holds a header
+    followed by a ring the messages are appended to and consumed from in
+    order, so that both the writes and the reads are sequential and the file
+    never grows past the size of the ring. The positions of both ends are
+    kept in the header, so the messages left over by a previous process
+    are picked up once the file is opened again. Only a single queue can
+    have the file open at a time. The mapping is shared, so the messages
+    survive the process exiting or crashing, but the file is never synced
+    to the disk and a crash of the system may lose or damage them. Not
+    supported on Windows. */
+
+/*  Limits for the size of the ring. */
+#define NN_SPOOL_MINSIZE 4096
+#define NN_SPOOL_MAXSIZE (1 << 30)
+
+/*  Maximum length of the file name, including the terminating zero. */
+#define NN_SPOOL_PATH_MAX 1024
+
+struct nn_spool_hdr;
+
+struct nn_spool {
+
+    /*  Mapped file. NULL if the queue is not open. */
+    struct nn_spool_hdr *hdr;
+    uint8_t *data;
+    size_t size;
+    size_t maplen;
+
+    /*  The file, locked for as long as it's open. */
+    int fd;
+
+    /*  Position the ring was at when the file was opened. The deadlines of
+        the messages found in it are meaningless to this process. */
+    uint64_t opened;
+};
+
+void nn_spool_init (struct nn_spool *self);
+void nn_spool_term (struct nn_spool *self);
+
+/*  Opens the file, creating it if it doesn't exist yet with the ring of
+    'size' bytes, rounded up to a multiple of 8. An existing file keeps its
+    own size along with the messages in it. Returns -EADDRINUSE if another
+    queue has it open. */
+int nn_spool_open (struct nn_spool *self, const char *path, size_t size);
+
+/*  Unmaps the file. The messages stay in it. */
+void nn_spool_close (struct nn_spool *self);
+
+/*  Returns 1 if the file is open. */
+int nn_spool_isopen (struct nn_spool *self);
+
+/*  Returns 1 if there are no messages in the queue. */
+int nn_spool_empty (struct nn_spool *self);
+
+/*  Appends a copy of the message to the queue. Only the header, the body
+    and the deadline of the message are kept, not its properties. Returns
+    -EAGAIN if there's not enough room for it. */
+int nn_spool_push (struct nn_spool *self, struct nn_msg *msg);
+
+/*  Moves the oldest message of the queue into 'msg', which must be
+    uninitialised, with the header stored as a part of the body. Messages
+    left over by a previous process have no deadline. Returns 0 if the queue
+    is empty. */
+int nn_spool_pop (struct nn_spool *self, struct nn_msg *msg);
+
+#endif
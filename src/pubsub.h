@@ -34,6 +34,26 @@ extern "C" {
 
 #define NN_SUB_SUBSCRIBE 1
 #define NN_SUB_UNSUBSCRIBE 2
+#define NN_SUB_FORWARD 3
+#define NN_SUB_CONFLATE 4
+#define NN_SUB_SUBSCRIBE_MANY 5
+#define NN_SUB_UNSUBSCRIBE_MANY 6
+#define NN_SUB_SUBSCRIPTIONS 7
+#define NN_SUB_SHARE 8
+#define NN_SUB_SUBSCRIBE_EXACT 9
+#define NN_SUB_UNSUBSCRIBE_EXACT 10
+#define NN_SUB_TOPIC_DELIMITER 11
+
+#define NN_PUB_HWM_MSGS 1
+#define NN_PUB_HWM_BYTES 2
+#define NN_PUB_DROP_POLICY 3
+#define NN_PUB_SUBSCRIPTIONS 4
+#define NN_PUB_FANOUT 5
+
+/*  Values of NN_PUB_DROP_POLICY option. */
+#define NN_PUB_DROP_NEWEST 1
+#define NN_PUB_DROP_OLDEST 2
+#define NN_PUB_DISCONNECT 3
 
 #ifdef __cplusplus
 }
@@ -36,6 +36,15 @@ extern "C" {
 #define NN_REP (NN_PROTO_REQREP * 16 + 1)
 
 #define NN_REQ_RESEND_IVL 1
+#define NN_REQ_MAXINFLIGHT 2
+#define NN_REQ_ID 3
+#define NN_REQ_LB 4
+#define NN_REQ_STICKY 5
+#define NN_REQ_HEDGE_IVL 6
+
+#define NN_REP_FQ 1
+#define NN_REP_CACHE 2
+#define NN_REP_MAXOUTSTANDING 3
 
 typedef union nn_req_handle {
     int i;
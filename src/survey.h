@@ -37,6 +37,10 @@ extern "C" {
 #define NN_RESPONDENT (NN_PROTO_SURVEY * 16 + 3)
 
 #define NN_SURVEYOR_DEADLINE 1
+#define NN_SURVEYOR_MAXSURVEYS 2
+#define NN_SURVEYOR_ID 3
+
+#define NN_RESPONDENT_MAXOUTSTANDING 4
 
 #ifdef __cplusplus
 }
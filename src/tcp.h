@@ -30,6 +30,29 @@ extern "C" {
 #define NN_TCP -3
 
 #define NN_TCP_NODELAY 1
+#define NN_TCP_RCVBATCH 2
+#define NN_TCP_ZEROCOPY 3
+#define NN_TCP_LISTENERS 4
+#define NN_TCP_BUSY_POLL 5
+#define NN_TCP_QUICKACK 6
+#define NN_TCP_PRIORITY 7
+#define NN_TCP_TOS 8
+#define NN_TCP_NOTSENT_LOWAT 9
+#define NN_TCP_INCOMING_CPU 10
+#define NN_TCP_CORK 11
+#define NN_TCP_STRIPES 12
+#define NN_TCP_STRIPE_ORDERED 13
+#define NN_TCP_COMPRESS 14
+#define NN_TCP_COMPRESS_THRESHOLD 15
+#define NN_TCP_BATCH 16
+#define NN_TCP_FASTOPEN 17
+#define NN_TCP_CHECKSUM 18
+#define NN_TCP_BULK_THRESHOLD 19
+
+/*  Values of NN_TCP_COMPRESS option. */
+#define NN_TCP_COMPRESS_NONE 0
+#define NN_TCP_COMPRESS_LZ4 1
+#define NN_TCP_COMPRESS_ZSTD 2
 
 #ifdef __cplusplus
 }
@@ -125,6 +125,7 @@ void nn_ep_stat_increment(struct nn_ep *, int name, int increment);
     connections are represented by pipes. */
 
 struct nn_pipebase;
+struct nn_pipegroup_member;
 
 /*  This value is returned by pipe's send and recv functions to signalise that
     more sends/recvs are not possible at the moment. From that moment on,
@@ -147,6 +148,20 @@ struct nn_pipebase_vfptr {
     /*  Receive a message from the network. The function can return either error
         (negative number) or any combination of the flags defined above. */
     int (*recv) (struct nn_pipebase *self, struct nn_msg *msg);
+
+    /*  Returns the number of messages passed to the pipe that are still
+        waiting to be written to the network. */
+    size_t (*queued) (struct nn_pipebase *self);
+
+    /*  Returns the number of those messages that would be lost if the pipe
+        was closed now, i.e. that the peer hasn't got hold of yet. NULL if
+        it's the same as 'queued'. */
+    size_t (*unsent) (struct nn_pipebase *self);
+
+    /*  Close the connection on behalf of the protocol. The pipe has to be
+        stopped asynchronously, after the function returns. Transports that
+        can't do that leave the pointer NULL. */
+    void (*disconnect) (struct nn_pipebase *self);
 };
 
 /*  Endpoint specific options. Same restrictions as for nn_pipebase apply  */
@@ -154,7 +169,23 @@ struct nn_ep_options
 {
     int sndprio;
     int rcvprio;
+    int rcvweight;
     int ipv4only;
+    int rcvpool;
+
+    /*  Time after which connections of bound endpoints that carry no
+        messages are closed, 0 meaning never. Always 0 for connecting
+        endpoints. */
+    int idle;
+
+    /*  Most connections a bound endpoint keeps at a time, 0 meaning no
+        limit. The endpoint stops accepting once it's reached. */
+    int maxconn;
+
+    /*  Number of connections a connecting endpoint keeps established in
+        addition to the one in use, to replace it once it fails. Always 0
+        for bound endpoints. */
+    int standby;
 };
 
 /*  The member of this structure are used internally by the core. Never use
@@ -170,6 +201,49 @@ struct nn_pipebase {
     struct nn_fsm_event in;
     struct nn_fsm_event out;
     struct nn_ep_options options;
+    uint64_t groupid;
+    int groupsize;
+    int grouporder;
+    int groupbulk;
+    size_t groupthreshold;
+    struct nn_pipegroup_member *member;
+    struct nn_list_item item;
+
+    /*  Set while the pipe is held in reserve by its endpoint (see
+        NN_STANDBY). The protocol doesn't know about such a pipe till it
+        replaces the one in use. */
+    int standby;
+
+    /*  Set if the transport sends the NN_FILE_REGION property of the
+        messages itself. Otherwise the region is read into the message
+        before it's passed to the transport. */
+    int sendfile;
+
+    /*  Set if the transport passes the messages sent in pieces
+        (NN_MSG_PIECE property) on. Otherwise the pieces are dropped. */
+    int pieces;
+
+    /*  Framing shared with the other pipes the message being sent goes to,
+        NULL if there are none. Only set during the send. */
+    struct nn_msg_frame *frame;
+
+    /*  The endpoint the connection belongs to, NULL for a group of them.
+        'id' is assigned once the pipe is passed to the protocol. */
+    struct nn_ep *ep;
+    int eid;
+    int id;
+
+    /*  Per-pipe statistics, updated within the socket's context.
+        'blocked_time' is the number of microseconds spent not writable,
+        the current period having started at 'blocked_since'. */
+    struct {
+        uint64_t messages_sent;
+        uint64_t messages_received;
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        uint64_t blocked_time;
+        uint64_t blocked_since;
+    } statistics;
 };
 
 /*  Initialise the pipe.  */
@@ -179,6 +253,36 @@ void nn_pipebase_init (struct nn_pipebase *self,
 /*  Terminate the pipe. */
 void nn_pipebase_term (struct nn_pipebase *self);
 
+/*  Makes the pipe one of the connections a logical pipe is striped over.
+    Pipes of the socket with the same non-zero 'id' are presented to the
+    protocol as a single pipe, expected to consist of 'size' of them. If
+    'ordered' is set, the messages received from them are passed to
+    the protocol in the order they were sent. Must be called before
+    nn_pipebase_start. */
+void nn_pipebase_setgroup (struct nn_pipebase *self, uint64_t id,
+    int size, int ordered);
+
+/*  Splits the messages sent through the group the pipe belongs to by size.
+    Those larger than 'threshold' bytes are sent over the members with 'bulk'
+    set, the others over the rest of them, so that the large messages don't
+    hold up the small ones. If none of the members of the class is there,
+    the other class is used. Must be called after nn_pipebase_setgroup and
+    before nn_pipebase_start. */
+void nn_pipebase_setbulk (struct nn_pipebase *self, int bulk,
+    size_t threshold);
+
+/*  Tells the core whether the transport is able to send the file region
+    attached to the message (NN_FILE_REGION property) on its own, in which
+    case it's responsible for closing the descriptor it refers to. It's not
+    by default. Must be called before nn_pipebase_start. */
+void nn_pipebase_setsendfile (struct nn_pipebase *self, int sendfile);
+
+/*  Tells the core whether the transport is able to pass a message on in
+    pieces (NN_MSG_PIECE property) so that the peer gets it the same way it
+    would if it was sent as a whole. It's not by default, in which case
+    the pieces are dropped. Must be called before nn_pipebase_start. */
+void nn_pipebase_setpieces (struct nn_pipebase *self, int pieces);
+
 /*  Call this function once the connection is established. */
 int nn_pipebase_start (struct nn_pipebase *self);
 
@@ -191,6 +295,23 @@ void nn_pipebase_received (struct nn_pipebase *self);
 /*  Call this function when current outgoing message was fully sent. */
 void nn_pipebase_sent (struct nn_pipebase *self);
 
+/*  Call this function when the last of the queued messages was written to
+    the network, so that a lingering socket can find out it's done. */
+void nn_pipebase_drained (struct nn_pipebase *self);
+
+/*  Returns 1 if none of the messages passed to the pipe would be lost if it
+    was closed now, 0 otherwise. */
+int nn_pipebase_flushed (struct nn_pipebase *self);
+
+/*  Returns 1 if the pipe is waiting for the transport to get rid of
+    the last message sent, i.e. it's not writable, 0 otherwise. */
+int nn_pipebase_blocked (struct nn_pipebase *self);
+
+/*  Returns the framing the message being sent shares with those sent to
+    other pipes, or NULL if there's none. Only valid within the send
+    function of the pipe. */
+struct nn_msg_frame *nn_pipebase_frame (struct nn_pipebase *self);
+
 /*  Retrieve value of a socket option. */
 void nn_pipebase_getopt (struct nn_pipebase *self, int level, int option,
     void *optval, size_t *optvallen);
@@ -55,15 +55,15 @@ static void nn_binproc_connect (struct nn_ins_item *self,
     struct nn_ins_item *peer);
 
 
-int nn_binproc_create (struct nn_ep *ep)
+int nn_binproc_create (struct nn_ep *ep, int sim)
 {
     int rc;
     struct nn_binproc *self;
 
-    self = nn_alloc (sizeof (struct nn_binproc), "binproc");
-    alloc_assert (self);
+    self = nn_ins_alloc (NN_INS_BINPROC, sizeof (struct nn_binproc),
+        "binproc");
 
-    nn_ins_item_init (&self->item, ep);
+    nn_ins_item_init (&self->item, ep, sim);
     nn_fsm_init_root (&self->fsm, nn_binproc_handler, nn_binproc_shutdown,
         nn_ep_getctx (ep));
     self->state = NN_BINPROC_STATE_IDLE;
@@ -83,7 +83,7 @@ int nn_binproc_create (struct nn_ep *ep)
         nn_fsm_term (&self->fsm);
 
         nn_ins_item_term (&self->item);
-        nn_free (self);
+        nn_ins_free (NN_INS_BINPROC, self);
         return rc;
     }
 
@@ -110,7 +110,7 @@ static void nn_binproc_destroy (struct nn_ep *ep)
     nn_fsm_term (&binproc->fsm);
     nn_ins_item_term (&binproc->item);
 
-    nn_free (binproc);
+    nn_ins_free (NN_INS_BINPROC, binproc);
 }
 
 static void nn_binproc_connect (struct nn_ins_item *self,
@@ -125,10 +125,10 @@ static void nn_binproc_connect (struct nn_ins_item *self,
 
     nn_assert_state (binproc, NN_BINPROC_STATE_ACTIVE);
 
-    sinproc = nn_alloc (sizeof (struct nn_sinproc), "sinproc");
-    alloc_assert (sinproc);
+    sinproc = nn_ins_alloc (NN_INS_SINPROC, sizeof (struct nn_sinproc),
+        "sinproc");
     nn_sinproc_init (sinproc, NN_BINPROC_SRC_SINPROC,
-        binproc->item.ep, &binproc->fsm);
+        binproc->item.ep, binproc->item.sim, &binproc->fsm);
     nn_list_insert (&binproc->sinprocs, &sinproc->item,
         nn_list_end (&binproc->sinprocs));
     nn_sinproc_connect (sinproc, &cinproc->fsm);
@@ -167,7 +167,7 @@ static void nn_binproc_shutdown (struct nn_fsm *self, int src, int type,
         sinproc = (struct nn_sinproc*) srcptr;
         nn_list_erase (&binproc->sinprocs, &sinproc->item);
         nn_sinproc_term (sinproc);
-        nn_free (sinproc);
+        nn_ins_free (NN_INS_SINPROC, sinproc);
 finish:
         if (!nn_list_empty (&binproc->sinprocs))
             return;
@@ -220,10 +220,10 @@ static void nn_binproc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_SINPROC_CONNECT:
                 peer = (struct nn_sinproc*) srcptr;
-                sinproc = nn_alloc (sizeof (struct nn_sinproc), "sinproc");
-                alloc_assert (sinproc);
+                sinproc = nn_ins_alloc (NN_INS_SINPROC,
+                    sizeof (struct nn_sinproc), "sinproc");
                 nn_sinproc_init (sinproc, NN_BINPROC_SRC_SINPROC,
-                    binproc->item.ep, &binproc->fsm);
+                    binproc->item.ep, binproc->item.sim, &binproc->fsm);
                 nn_list_insert (&binproc->sinprocs, &sinproc->item,
                     nn_list_end (&binproc->sinprocs));
                 nn_sinproc_accept (sinproc, peer);
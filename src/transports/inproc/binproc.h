@@ -47,6 +47,7 @@ struct nn_binproc {
     struct nn_list sinprocs;
 };
 
-int nn_binproc_create (struct nn_ep *);
+/*  'sim' is 1 if the endpoint belongs to the sim transport. */
+int nn_binproc_create (struct nn_ep *ep, int sim);
 
 #endif
@@ -57,16 +57,16 @@ static void nn_cinproc_shutdown (struct nn_fsm *self, int src, int type,
 static void nn_cinproc_connect (struct nn_ins_item *self,
     struct nn_ins_item *peer);
 
-int nn_cinproc_create (struct nn_ep *ep)
+int nn_cinproc_create (struct nn_ep *ep, int sim)
 {
     struct nn_cinproc *self;
 
-    self = nn_alloc (sizeof (struct nn_cinproc), "cinproc");
-    alloc_assert (self);
+    self = nn_ins_alloc (NN_INS_CINPROC, sizeof (struct nn_cinproc),
+        "cinproc");
 
     nn_ep_tran_setup (ep, &nn_cinproc_vfptr, self);
 
-    nn_ins_item_init (&self->item, ep);
+    nn_ins_item_init (&self->item, ep, sim);
     nn_fsm_init_root (&self->fsm, nn_cinproc_handler, nn_cinproc_shutdown,
         nn_ep_getctx (ep));
     self->state = NN_CINPROC_STATE_IDLE;
@@ -102,7 +102,7 @@ static void nn_cinproc_destroy (struct nn_ep *ep)
     nn_fsm_term (&cinproc->fsm);
     nn_ins_item_term (&cinproc->item);
 
-    nn_free (cinproc);
+    nn_ins_free (NN_INS_CINPROC, cinproc);
 }
 
 static void nn_cinproc_connect (struct nn_ins_item *self,
@@ -117,10 +117,10 @@ static void nn_cinproc_connect (struct nn_ins_item *self,
 
     nn_assert_state (cinproc, NN_CINPROC_STATE_ACTIVE);
 
-    sinproc = nn_alloc (sizeof (struct nn_sinproc), "sinproc");
-    alloc_assert (sinproc);
+    sinproc = nn_ins_alloc (NN_INS_SINPROC, sizeof (struct nn_sinproc),
+        "sinproc");
     nn_sinproc_init (sinproc, NN_CINPROC_SRC_SINPROC,
-        cinproc->item.ep, &cinproc->fsm);
+        cinproc->item.ep, cinproc->item.sim, &cinproc->fsm);
 
     nn_list_insert (&cinproc->sinprocs, &sinproc->item,
         nn_list_end (&cinproc->sinprocs));
@@ -160,7 +160,7 @@ static void nn_cinproc_shutdown (struct nn_fsm *self, int src, int type,
         sinproc = (struct nn_sinproc *) srcptr;
         nn_list_erase (&cinproc->sinprocs, &sinproc->item);
         nn_sinproc_term (sinproc);
-        nn_free (sinproc);
+        nn_ins_free (NN_INS_SINPROC, sinproc);
 
 finish:
         if (!nn_list_empty (&cinproc->sinprocs))
@@ -215,10 +215,10 @@ static void nn_cinproc_handler (struct nn_fsm *self, int src, int type,
 
             switch (type) {
             case NN_SINPROC_CONNECT:
-                sinproc = nn_alloc (sizeof (struct nn_sinproc), "sinproc");
-                alloc_assert (sinproc);
+                sinproc = nn_ins_alloc (NN_INS_SINPROC,
+                    sizeof (struct nn_sinproc), "sinproc");
                 nn_sinproc_init (sinproc, NN_CINPROC_SRC_SINPROC,
-                    cinproc->item.ep, &cinproc->fsm);
+                    cinproc->item.ep, cinproc->item.sim, &cinproc->fsm);
                 nn_list_insert (&cinproc->sinprocs, &sinproc->item,
                     nn_list_end (&cinproc->sinprocs));
                 nn_sinproc_accept (sinproc, peer);
@@ -46,7 +46,8 @@ struct nn_cinproc {
     struct nn_list sinprocs;
 };
 
-int nn_cinproc_create (struct nn_ep *);
+/*  'sim' is 1 if the endpoint belongs to the sim transport. */
+int nn_cinproc_create (struct nn_ep *ep, int sim);
 
 #endif
 
@@ -61,11 +61,11 @@ static void nn_inproc_term (void)
 
 static int nn_inproc_bind (struct nn_ep *ep)
 {
-    return nn_binproc_create (ep);
+    return nn_binproc_create (ep, 0);
 }
 
 static int nn_inproc_connect (struct nn_ep *ep)
 {
-    return nn_cinproc_create (ep);
+    return nn_cinproc_create (ep, 0);
 }
 
@@ -25,86 +25,122 @@
 
 #include "../../utils/mutex.h"
 #include "../../utils/alloc.h"
-#include "../../utils/list.h"
+#include "../../utils/hash.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/err.h"
 
+#include <string.h>
+
 struct nn_ins {
 
     /*  Synchronises access to this object. */
     struct nn_mutex sync;
 
-    /*  List of all bound inproc endpoints. */
-    /*  TODO: O(n) lookup, shouldn't we do better? Hash? */
-    struct nn_list bound;
+    /*  All bound inproc endpoints, indexed by address. */
+    struct nn_hash bound;
+
+    /*  All connected inproc endpoints, indexed by address. */
+    struct nn_hash connected;
 
-    /*  List of all connected inproc endpoints. */
-    /*  TODO: O(n) lookup, shouldn't we do better? Hash? */
-    struct nn_list connected;
+    /*  Objects kept for reuse, of each kind. The free objects are chained
+        through their first bytes. Guarded by a mutex of its own, as objects
+        are allocated while 'sync' is held. */
+    struct nn_mutex cachesync;
+    void *cache [NN_INS_KINDS];
+    int ncached [NN_INS_KINDS];
 };
 
-/*  Global instance of the nn_ins object. It contains the lists of all
+/*  Maximum number of free objects of each kind kept for reuse. */
+#define NN_INS_CACHE_MAX 16
+
+/*  Global instance of the nn_ins object. It contains the indices of all
     inproc endpoints in the current process. */
 static struct nn_ins self;
 
-void nn_ins_item_init (struct nn_ins_item *self, struct nn_ep *ep)
+/*  Private functions. */
+static uint32_t nn_ins_hashkey (const char *addr);
+static int nn_ins_match (struct nn_ins_item *item, const char *addr,
+    int sim);
+static void nn_ins_insert (struct nn_hash *index, struct nn_ins_item *item);
+static void nn_ins_erase (struct nn_hash *index, struct nn_ins_item *item);
+
+void nn_ins_item_init (struct nn_ins_item *self, struct nn_ep *ep, int sim)
 {
     self->ep = ep;
-    nn_list_item_init (&self->item);
+    self->sim = sim;
+    self->next = NULL;
+    nn_hash_item_init (&self->hndl);
 }
 
 void nn_ins_item_term (struct nn_ins_item *self)
 {
-    nn_list_item_term (&self->item);
+    nn_hash_item_term (&self->hndl);
 }
 
 void nn_ins_init (void)
 {
     nn_mutex_init (&self.sync);
-    nn_list_init (&self.bound);
-    nn_list_init (&self.connected);
+    nn_hash_init (&self.bound);
+    nn_hash_init (&self.connected);
+    nn_mutex_init (&self.cachesync);
+    memset (self.cache, 0, sizeof (self.cache));
+    memset (self.ncached, 0, sizeof (self.ncached));
 }
+
 void nn_ins_term (void)
 {
-    nn_list_term (&self.connected);
-    nn_list_term (&self.bound);
+    int kind;
+    void *p;
+
+    for (kind = 0; kind != NN_INS_KINDS; ++kind) {
+        while (self.cache [kind]) {
+            p = self.cache [kind];
+            self.cache [kind] = *(void**) p;
+            nn_free (p);
+        }
+    }
+    nn_mutex_term (&self.cachesync);
+    nn_hash_term (&self.connected);
+    nn_hash_term (&self.bound);
     nn_mutex_term (&self.sync);
 }
 
 int nn_ins_bind (struct nn_ins_item *item, nn_ins_fn fn)
 {
-    struct nn_list_item *it;
+    const char *addr;
+    uint32_t key;
+    struct nn_hash_item *hndl;
     struct nn_ins_item *bitem;
     struct nn_ins_item *citem;
 
+    addr = nn_ep_getaddr (item->ep);
+    key = nn_ins_hashkey (addr);
+
     nn_mutex_lock (&self.sync);
 
     /*  Check whether the endpoint isn't already bound. */
-    /*  TODO:  This is an O(n) algorithm! */
-    for (it = nn_list_begin (&self.bound); it != nn_list_end (&self.bound);
-          it = nn_list_next (&self.bound, it)) {
-        bitem = nn_cont (it, struct nn_ins_item, item);
-
-        if (strncmp (nn_ep_getaddr(bitem->ep), nn_ep_getaddr(item->ep),
-            NN_SOCKADDR_MAX) == 0) {
-
-            nn_mutex_unlock (&self.sync);
-            return -EADDRINUSE;
+    hndl = nn_hash_get (&self.bound, key);
+    if (hndl) {
+        for (bitem = nn_cont (hndl, struct nn_ins_item, hndl); bitem;
+              bitem = bitem->next) {
+            if (nn_ins_match (bitem, addr, item->sim)) {
+                nn_mutex_unlock (&self.sync);
+                return -EADDRINUSE;
+            }
         }
     }
 
     /*  Insert the entry into the endpoint repository. */
-    nn_list_insert (&self.bound, &item->item,
-        nn_list_end (&self.bound));
+    nn_ins_insert (&self.bound, item);
 
     /*  During this process new pipes may be created. */
-    for (it = nn_list_begin (&self.connected);
-          it != nn_list_end (&self.connected);
-          it = nn_list_next (&self.connected, it)) {
-        citem = nn_cont (it, struct nn_ins_item, item);
-        if (strncmp (nn_ep_getaddr(item->ep), nn_ep_getaddr(citem->ep),
-            NN_SOCKADDR_MAX) == 0) {
+    hndl = nn_hash_get (&self.connected, key);
+    if (hndl) {
+        for (citem = nn_cont (hndl, struct nn_ins_item, hndl); citem;
+              citem = citem->next) {
+            if (!nn_ins_match (citem, addr, item->sim))
+                continue;
 
             /*  Check whether the two sockets are compatible. */
             if (!nn_ep_ispeer_ep (item->ep, citem->ep))
@@ -121,23 +157,26 @@ int nn_ins_bind (struct nn_ins_item *item, nn_ins_fn fn)
 
 void nn_ins_connect (struct nn_ins_item *item, nn_ins_fn fn)
 {
-    struct nn_list_item *it;
+    const char *addr;
+    uint32_t key;
+    struct nn_hash_item *hndl;
     struct nn_ins_item *bitem;
 
+    addr = nn_ep_getaddr (item->ep);
+    key = nn_ins_hashkey (addr);
+
     nn_mutex_lock (&self.sync);
 
     /*  Insert the entry into the endpoint repository. */
-    nn_list_insert (&self.connected, &item->item,
-        nn_list_end (&self.connected));
+    nn_ins_insert (&self.connected, item);
 
     /*  During this process a pipe may be created. */
-    for (it = nn_list_begin (&self.bound);
-          it != nn_list_end (&self.bound);
-          it = nn_list_next (&self.bound, it)) {
-        bitem = nn_cont (it, struct nn_ins_item, item);
-
-        if (strncmp (nn_ep_getaddr(item->ep), nn_ep_getaddr(bitem->ep),
-            NN_SOCKADDR_MAX) == 0) {
+    hndl = nn_hash_get (&self.bound, key);
+    if (hndl) {
+        for (bitem = nn_cont (hndl, struct nn_ins_item, hndl); bitem;
+              bitem = bitem->next) {
+            if (!nn_ins_match (bitem, addr, item->sim))
+                continue;
 
             /*  Check whether the two sockets are compatible. */
             if (!nn_ep_ispeer_ep (item->ep, bitem->ep))
@@ -156,14 +195,125 @@ void nn_ins_connect (struct nn_ins_item *item, nn_ins_fn fn)
 void nn_ins_disconnect (struct nn_ins_item *item)
 {
     nn_mutex_lock (&self.sync);
-    nn_list_erase (&self.connected, &item->item);
+    nn_ins_erase (&self.connected, item);
     nn_mutex_unlock (&self.sync);
 }
 
 void nn_ins_unbind (struct nn_ins_item *item)
 {
     nn_mutex_lock (&self.sync);
-    nn_list_erase (&self.bound, &item->item);
+    nn_ins_erase (&self.bound, item);
     nn_mutex_unlock (&self.sync);
 }
 
+static uint32_t nn_ins_hashkey (const char *addr)
+{
+    uint32_t key;
+    size_t len;
+
+    /*  FNV-1a. */
+    key = 2166136261u;
+    for (len = 0; len != NN_SOCKADDR_MAX && addr [len]; ++len) {
+        key ^= (uint8_t) addr [len];
+        key *= 16777619u;
+    }
+    return key;
+}
+
+static int nn_ins_match (struct nn_ins_item *item, const char *addr,
+    int sim)
+{
+    return item->sim == sim &&
+        strncmp (nn_ep_getaddr (item->ep), addr, NN_SOCKADDR_MAX) == 0;
+}
+
+static void nn_ins_insert (struct nn_hash *index, struct nn_ins_item *item)
+{
+    uint32_t key;
+    struct nn_hash_item *hndl;
+    struct nn_ins_item *head;
+
+    /*  Items whose addresses hash to the same key go into the chain of
+        the one already in the index. */
+    key = nn_ins_hashkey (nn_ep_getaddr (item->ep));
+    hndl = nn_hash_get (index, key);
+    if (hndl) {
+        head = nn_cont (hndl, struct nn_ins_item, hndl);
+        item->next = head->next;
+        head->next = item;
+    }
+    else {
+        item->next = NULL;
+        nn_hash_insert (index, key, &item->hndl);
+    }
+}
+
+static void nn_ins_erase (struct nn_hash *index, struct nn_ins_item *item)
+{
+    uint32_t key;
+    struct nn_hash_item *hndl;
+    struct nn_ins_item *head;
+    struct nn_ins_item **prev;
+
+    key = nn_ins_hashkey (nn_ep_getaddr (item->ep));
+    hndl = nn_hash_get (index, key);
+    nn_assert (hndl);
+    head = nn_cont (hndl, struct nn_ins_item, hndl);
+
+    /*  If the item heading the chain goes away, the next one takes its
+        place in the index. */
+    if (head == item) {
+        nn_hash_erase (index, &item->hndl);
+        if (item->next)
+            nn_hash_insert (index, key, &item->next->hndl);
+    }
+    else {
+        for (prev = &head->next; *prev != item; prev = &(*prev)->next)
+            nn_assert (*prev);
+        *prev = item->next;
+    }
+    item->next = NULL;
+}
+
+void *nn_ins_alloc (int kind, size_t size, const char *name)
+{
+    void *p;
+    struct nn_alloc_acct *prevacct;
+
+    nn_assert (size >= sizeof (void*));
+
+    nn_mutex_lock (&self.cachesync);
+    p = self.cache [kind];
+    if (nn_fast (p != NULL)) {
+        self.cache [kind] = *(void**) p;
+        --self.ncached [kind];
+        nn_mutex_unlock (&self.cachesync);
+        return p;
+    }
+    nn_mutex_unlock (&self.cachesync);
+
+    /*  Cached objects get reused by other sockets, so they are not charged
+        to the socket that allocated them in the first place. Sessions are
+        mostly made of their message queues. */
+    prevacct = nn_alloc_acct_select (NULL);
+    p = nn_alloc_class (size, kind == NN_INS_SINPROC ? NN_ALLOC_QUEUE :
+        NN_ALLOC_OBJECT, name);
+    nn_alloc_acct_select (prevacct);
+    alloc_assert (p);
+    return p;
+}
+
+void nn_ins_free (int kind, void *p)
+{
+    nn_mutex_lock (&self.cachesync);
+    if (nn_fast (self.ncached [kind] < NN_INS_CACHE_MAX)) {
+        *(void**) p = self.cache [kind];
+        self.cache [kind] = p;
+        ++self.ncached [kind];
+        nn_mutex_unlock (&self.cachesync);
+        return;
+    }
+    nn_mutex_unlock (&self.cachesync);
+
+    nn_free (p);
+}
@@ -25,23 +25,30 @@
 
 #include "../../transport.h"
 
-#include "../../utils/list.h"
+#include "../../utils/hash.h"
 
 /*  Inproc naming system. A global repository of inproc endpoints. */
 
 struct nn_ins_item {
 
-    /*  Every ins_item is either in the list of bound or connected endpoints. */
-    struct nn_list_item item;
+    /*  Every ins_item is either in the index of bound or connected endpoints,
+        keyed by the hash of its address. Items with the same key are chained
+        behind the one that is in the index. */
+    struct nn_hash_item hndl;
+    struct nn_ins_item *next;
 
     struct nn_ep *ep;
 
     /*  This is the local cache of the endpoint's protocol ID. This way we can
         check the value without actually locking the object. */
     int protocol;
+
+    /*  1 if the endpoint belongs to the sim transport. Its addresses are
+        a namespace of their own. */
+    int sim;
 };
 
-void nn_ins_item_init (struct nn_ins_item *self, struct nn_ep *ep);
+void nn_ins_item_init (struct nn_ins_item *self, struct nn_ep *ep, int sim);
 void nn_ins_item_term (struct nn_ins_item *self);
 
 void nn_ins_init (void);
@@ -54,5 +61,17 @@ void nn_ins_connect (struct nn_ins_item *item, nn_ins_fn fn);
 void nn_ins_disconnect (struct nn_ins_item *item);
 void nn_ins_unbind (struct nn_ins_item *item);
 
+/*  Kinds of objects the inproc transport recycles rather than returning them
+    to the heap, so that connecting and disconnecting over and over again
+    doesn't thrash the allocator. Objects of a kind must be of the same
+    size. */
+#define NN_INS_BINPROC 0
+#define NN_INS_CINPROC 1
+#define NN_INS_SINPROC 2
+#define NN_INS_KINDS 3
+
+void *nn_ins_alloc (int kind, size_t size, const char *name);
+void nn_ins_free (int kind, void *p);
+
 #endif
 
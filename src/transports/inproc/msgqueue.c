@@ -20,32 +20,44 @@
     IN THE SOFTWARE.
 */
 
+
 #include "msgqueue.h"
 
-#include "../../utils/alloc.h"
 #include "../../utils/fast.h"
 #include "../../utils/err.h"
 
 #include <string.h>
 
-void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
-{
-    struct nn_msgqueue_chunk *chunk;
+#define NN_MSGQUEUE_MASK (NN_MSGQUEUE_SLOTS - 1)
+CT_ASSERT ((NN_MSGQUEUE_SLOTS & NN_MSGQUEUE_MASK) == 0);
 
-    self->count = 0;
-    self->mem = 0;
-    self->maxmem = maxmem;
+/*  States of a notification request. */
+#define NN_MSGQUEUE_WAIT_NONE 0
+#define NN_MSGQUEUE_WAIT_ARMED 1
+#define NN_MSGQUEUE_WAIT_FIRED 2
 
-    chunk = nn_alloc (sizeof (struct nn_msgqueue_chunk), "msgqueue chunk");
-    alloc_assert (chunk);
-    chunk->next = NULL;
+static size_t nn_msgqueue_msgsz (struct nn_msg *msg)
+{
+    return nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body);
+}
 
-    self->out.chunk = chunk;
-    self->out.pos = 0;
-    self->in.chunk = chunk;
-    self->in.pos = 0;
+void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
+{
+    nn_atomic_init (&self->tail, 0);
+    self->bytes_in = 0;
+    self->head_cache = 0;
+    self->bytes_out_cache = 0;
+    nn_atomic_init (&self->head, 0);
+    self->bytes_out = 0;
+    self->tail_cache = 0;
+
+    /*  Nothing was received yet, so the consumer is waiting for the first
+        message right from the start. */
+    nn_atomic_init (&self->sndwait, NN_MSGQUEUE_WAIT_NONE);
+    nn_atomic_init (&self->rcvwait, NN_MSGQUEUE_WAIT_ARMED);
+    self->sndbatch = 0;
 
-    self->cache = NULL;
+    self->maxmem = maxmem;
 }
 
 void nn_msgqueue_term (struct nn_msgqueue *self)
@@ -62,86 +74,178 @@ void nn_msgqueue_term (struct nn_msgqueue *self)
         nn_msg_term (&msg);
     }
 
-    /*  There are no more messages in the pipe so there's at most one chunk
-        in the queue. Deallocate it. */
-    nn_assert (self->in.chunk == self->out.chunk);
-    nn_free (self->in.chunk);
-
-    /*  Deallocate the cached chunk, if any. */
-    if (self->cache)
-        nn_free (self->cache);
+    nn_atomic_term (&self->rcvwait);
+    nn_atomic_term (&self->sndwait);
+    nn_atomic_term (&self->head);
+    nn_atomic_term (&self->tail);
 }
 
 int nn_msgqueue_empty (struct nn_msgqueue *self)
 {
-    return self->count == 0 ? 1 : 0;
+    uint32_t head;
+
+    head = nn_atomic_load_relaxed (&self->head);
+    if (nn_fast (head != self->tail_cache))
+        return 0;
+    self->tail_cache = nn_atomic_load (&self->tail);
+    return head == self->tail_cache ? 1 : 0;
+}
+
+size_t nn_msgqueue_size (struct nn_msgqueue *self)
+{
+    return nn_atomic_load_relaxed (&self->tail) -
+        nn_atomic_load (&self->head);
+}
+
+size_t nn_msgqueue_bytes (struct nn_msgqueue *self)
+{
+    /*  The consumer updates the byte count before it frees the slot, so
+        the count may be a little too low, never too high. */
+    return self->bytes_in - self->bytes_out;
+}
+
+void nn_msgqueue_consumed (struct nn_msgqueue *self, uint32_t *msgs,
+    size_t *bytes)
+{
+    /*  The consumer updates the byte count before it frees the slot, so
+        the bytes may be ahead of the messages, never behind. */
+    *msgs = nn_atomic_load (&self->head);
+    *bytes = self->bytes_out;
 }
 
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg)
 {
+    uint32_t tail;
+    uint32_t count;
     size_t msgsz;
 
+    tail = nn_atomic_load_relaxed (&self->tail);
+    msgsz = nn_msgqueue_msgsz (msg);
+
     /*  By allowing one message of arbitrary size to be written to the queue,
         we allow even messages that exceed max buffer size to pass through.
-        Beyond that we'll apply the buffer limit as specified by the user. */
-    msgsz = nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body);
-    if (nn_slow (self->count > 0 && self->mem + msgsz >= self->maxmem))
-        return -EAGAIN;
-
-    /*  Adjust the statistics. */
-    ++self->count;
-    self->mem += msgsz;
-
-    /*  Move the content of the message to the pipe. */
-    nn_msg_mv (&self->out.chunk->msgs [self->out.pos], msg);
-    ++self->out.pos;
-
-    /*  If there's no space for a new message in the pipe, either re-use
-        the cache chunk or allocate a new chunk if it does not exist. */
-    if (nn_slow (self->out.pos == NN_MSGQUEUE_GRANULARITY)) {
-        if (nn_slow (!self->cache)) {
-            self->cache = nn_alloc (sizeof (struct nn_msgqueue_chunk),
-                "msgqueue chunk");
-            alloc_assert (self->cache);
-            self->cache->next = NULL;
-        }
-        self->out.chunk->next = self->cache;
-        self->out.chunk = self->cache;
-        self->cache = NULL;
-        self->out.pos = 0;
+        Beyond that we'll apply the buffer limit as specified by the user.
+        The consumer's counters are only re-read if the queue looks full. */
+    count = tail - self->head_cache;
+    if (nn_slow (count == NN_MSGQUEUE_SLOTS || (count > 0 &&
+          self->bytes_in - self->bytes_out_cache + msgsz >= self->maxmem))) {
+        self->head_cache = nn_atomic_load (&self->head);
+        self->bytes_out_cache = self->bytes_out;
+        count = tail - self->head_cache;
+        if (count == NN_MSGQUEUE_SLOTS || (count > 0 &&
+              self->bytes_in - self->bytes_out_cache + msgsz >= self->maxmem))
+            return -EAGAIN;
     }
 
+    /*  Move the content of the message to the pipe and publish it. Being
+        a full barrier, the increment also orders the write before
+        the check for the consumer's notification request. */
+    nn_msg_mv (&self->slots [tail & NN_MSGQUEUE_MASK], msg);
+    self->bytes_in += msgsz;
+    nn_atomic_inc (&self->tail, 1);
+
     return 0;
 }
 
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg)
 {
-    struct nn_msgqueue_chunk *o;
+    uint32_t head;
 
     /*  If there is no message in the queue. */
-    if (nn_slow (!self->count))
+    if (nn_slow (nn_msgqueue_empty (self)))
         return -EAGAIN;
 
-    /*  Move the message from the pipe to the user. */
-    nn_msg_mv (msg, &self->in.chunk->msgs [self->in.pos]);
-
-    /*  Move to the next position. */
-    ++self->in.pos;
-    if (nn_slow (self->in.pos == NN_MSGQUEUE_GRANULARITY)) {
-        o = self->in.chunk;
-        self->in.chunk = self->in.chunk->next;
-        self->in.pos = 0;
-        if (nn_fast (!self->cache))
-            self->cache = o;
-        else
-            nn_free (o);
+    /*  Move the message from the pipe to the user and free the slot. The
+        byte count must be visible to the producer by the time it sees
+        the slot freed. */
+    head = nn_atomic_load_relaxed (&self->head);
+    nn_msg_mv (msg, &self->slots [head & NN_MSGQUEUE_MASK]);
+    self->bytes_out += nn_msgqueue_msgsz (msg);
+    nn_atomic_inc (&self->head, 1);
+
+    return 0;
+}
+
+void nn_msgqueue_sndwait (struct nn_msgqueue *self)
+{
+    uint32_t old;
+
+    /*  The failed send has just refreshed our view of the consumer. The flag
+        is published by the barrier below. */
+    self->sndbatch = nn_atomic_load_relaxed (&self->tail) -
+        self->head_cache == NN_MSGQUEUE_SLOTS ? 1 : 0;
+
+    /*  If the previous notification is still in flight, it will do. */
+    old = nn_atomic_cas (&self->sndwait, NN_MSGQUEUE_WAIT_NONE,
+        NN_MSGQUEUE_WAIT_ARMED);
+    nn_assert (old != NN_MSGQUEUE_WAIT_ARMED);
+}
+
+int nn_msgqueue_sndcancel (struct nn_msgqueue *self)
+{
+    return nn_atomic_cas (&self->sndwait, NN_MSGQUEUE_WAIT_ARMED,
+        NN_MSGQUEUE_WAIT_NONE) == NN_MSGQUEUE_WAIT_ARMED ? 1 : 0;
+}
+
+int nn_msgqueue_sndnotify (struct nn_msgqueue *self)
+{
+    uint32_t count;
+
+    if (nn_fast (nn_atomic_load_relaxed (&self->sndwait) !=
+          NN_MSGQUEUE_WAIT_ARMED))
+        return 0;
+
+    /*  The byte limit is set by the user, so room made under it is reported
+        straight away. The slot limit is ours and can be more lax. */
+    if (self->sndbatch) {
+        count = nn_atomic_load (&self->tail) -
+            nn_atomic_load_relaxed (&self->head);
+        if (count > NN_MSGQUEUE_SLOTS / 2)
+            return 0;
     }
 
-    /*  Adjust the statistics. */
-    --self->count;
-    self->mem -= (nn_chunkref_size (&msg->sphdr) +
-        nn_chunkref_size (&msg->body));
+    return nn_atomic_cas (&self->sndwait, NN_MSGQUEUE_WAIT_ARMED,
+        NN_MSGQUEUE_WAIT_FIRED) == NN_MSGQUEUE_WAIT_ARMED ? 1 : 0;
+}
 
-    return 0;
+void nn_msgqueue_sndwoken (struct nn_msgqueue *self)
+{
+    uint32_t old;
+
+    old = nn_atomic_cas (&self->sndwait, NN_MSGQUEUE_WAIT_FIRED,
+        NN_MSGQUEUE_WAIT_NONE);
+    nn_assert (old == NN_MSGQUEUE_WAIT_FIRED);
 }
 
+void nn_msgqueue_rcvwait (struct nn_msgqueue *self)
+{
+    uint32_t old;
+
+    old = nn_atomic_cas (&self->rcvwait, NN_MSGQUEUE_WAIT_NONE,
+        NN_MSGQUEUE_WAIT_ARMED);
+    nn_assert (old != NN_MSGQUEUE_WAIT_ARMED);
+}
+
+int nn_msgqueue_rcvcancel (struct nn_msgqueue *self)
+{
+    return nn_atomic_cas (&self->rcvwait, NN_MSGQUEUE_WAIT_ARMED,
+        NN_MSGQUEUE_WAIT_NONE) == NN_MSGQUEUE_WAIT_ARMED ? 1 : 0;
+}
+
+int nn_msgqueue_rcvnotify (struct nn_msgqueue *self)
+{
+    if (nn_fast (nn_atomic_load_relaxed (&self->rcvwait) !=
+          NN_MSGQUEUE_WAIT_ARMED))
+        return 0;
+    return nn_atomic_cas (&self->rcvwait, NN_MSGQUEUE_WAIT_ARMED,
+        NN_MSGQUEUE_WAIT_FIRED) == NN_MSGQUEUE_WAIT_ARMED ? 1 : 0;
+}
+
+void nn_msgqueue_rcvwoken (struct nn_msgqueue *self)
+{
+    uint32_t old;
+
+    old = nn_atomic_cas (&self->rcvwait, NN_MSGQUEUE_WAIT_FIRED,
+        NN_MSGQUEUE_WAIT_NONE);
+    nn_assert (old == NN_MSGQUEUE_WAIT_FIRED);
+}
@@ -20,61 +20,90 @@
     IN THE SOFTWARE.
 */
 
+
 #ifndef NN_MSGQUEUE_INCLUDED
 #define NN_MSGQUEUE_INCLUDED
 
 #include "../../utils/msg.h"
+#include "../../utils/atomic.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
-/*  This class is a simple uni-directional message queue. */
+/*  This class is a bounded uni-directional message queue. It is lock-free,
+    but it can have only a single producer, calling the _send functions, and
+    a single consumer, calling the _recv functions. */
 
-/*  It's not 128 so that chunk including its footer fits into a memory page. */
-#define NN_MSGQUEUE_GRANULARITY 126
+/*  Number of messages the queue can hold. Must be a power of two. */
+#define NN_MSGQUEUE_SLOTS 128
 
-struct nn_msgqueue_chunk {
-    struct nn_msg msgs [NN_MSGQUEUE_GRANULARITY];
-    struct nn_msgqueue_chunk *next;
-};
+/*  Padding used to keep the producer's and the consumer's state on separate
+    cache lines. */
+#define NN_MSGQUEUE_CACHELINE 64
 
 struct nn_msgqueue {
 
-    /*  Pointer to the position where next message should be written into
-        the message queue. */
-    struct {
-        struct nn_msgqueue_chunk *chunk;
-        int pos;
-    } out;
-
-    /*  Pointer to the first unread message in the message queue. */
-    struct {
-        struct nn_msgqueue_chunk *chunk;
-        int pos;
-    } in;
-
-    /*  Number of messages in the queue. */
-    size_t count;
-
-    /*  Amount of memory used by messages in the queue. */
-    size_t mem;
+    /*  Producer side. Number of messages ever written to the queue, number
+        of bytes ever written, and the consumer's counters as seen by the
+        producer the last time it looked. */
+    struct nn_atomic tail;
+    size_t bytes_in;
+    uint32_t head_cache;
+    size_t bytes_out_cache;
+    char pad1 [NN_MSGQUEUE_CACHELINE];
+
+    /*  Consumer side. Number of messages ever read from the queue, number
+        of bytes ever read, and the producer's counter as seen by the
+        consumer the last time it looked. */
+    struct nn_atomic head;
+    volatile size_t bytes_out;
+    uint32_t tail_cache;
+    char pad2 [NN_MSGQUEUE_CACHELINE];
+
+    /*  Requests for notification by the other side. The producer asks to be
+        told when the full queue gets some room, the consumer asks to be told
+        when the empty queue gets a message. */
+    struct nn_atomic sndwait;
+    struct nn_atomic rcvwait;
+
+    /*  Set if the producer waits because all the slots are taken, rather
+        than because of the byte limit. In that case it is only notified
+        once half of the slots are free, so that it can hand over a whole
+        batch of messages per notification. */
+    int sndbatch;
 
     /*   Maximal queue size (in bytes). */
     size_t maxmem;
 
-    /*  One empty chunk is always cached so that in case of steady stream
-        of messages through the pipe there are no memory allocations. */
-    struct nn_msgqueue_chunk *cache;
+    /*  The messages themselves. They are stored inline so that the queue,
+        along with the pipe that embeds it, is a single allocation. */
+    struct nn_msg slots [NN_MSGQUEUE_SLOTS];
 };
 
 /*  Initialise the message pipe. maxmem is the maximal queue size in bytes. */
 void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem);
 
-/*  Terminate the message pipe. */
+/*  Terminate the message pipe. Neither side may be using it any more. */
 void nn_msgqueue_term (struct nn_msgqueue *self);
 
-/*  Returns 1 if there are no messages in the queue, 0 otherwise. */
+/*  Returns 1 if there are no messages in the queue, 0 otherwise. Only to be
+    called by the consumer. */
 int nn_msgqueue_empty (struct nn_msgqueue *self);
 
+/*  Returns the number of messages in the queue. Only to be called by
+    the producer. */
+size_t nn_msgqueue_size (struct nn_msgqueue *self);
+
+/*  Returns the number of bytes in the queue. Only to be called by
+    the producer. */
+size_t nn_msgqueue_bytes (struct nn_msgqueue *self);
+
+/*  Retrieves the number of messages and bytes the consumer has read from
+    the queue so far. Both counters wrap around. Only to be called by the
+    producer. */
+void nn_msgqueue_consumed (struct nn_msgqueue *self, uint32_t *msgs,
+    size_t *bytes);
+
 /*  Writes a message to the pipe. -EAGAIN is returned if the message cannot
     be sent because the queue is full. */
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg);
@@ -83,4 +112,27 @@ int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg);
     to receive. */
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg);
 
+/*  Notification protocol. A side that finds the queue full (empty) asks to
+    be notified using _sndwait (_rcvwait) and then checks the queue once
+    again, because the other side may have made progress in the meantime.
+    If it did, the request can be withdrawn using _sndcancel (_rcvcancel),
+    which fails if the notification is already on its way.
+
+    After each successful send (recv) the other side checks using
+    _rcvnotify (_sndnotify) whether the notification is due. If so, it is
+    expected to deliver it and the notified side calls _sndwoken (_rcvwoken)
+    once it gets it. There's never more than one notification of each kind
+    in flight. As the check follows the send (recv) rather than being atomic
+    with it, the notification may be stale by the time it arrives, i.e. the
+    notified side may have dealt with the message (room) and asked for
+    another notification in the meantime. */
+void nn_msgqueue_sndwait (struct nn_msgqueue *self);
+int nn_msgqueue_sndcancel (struct nn_msgqueue *self);
+int nn_msgqueue_sndnotify (struct nn_msgqueue *self);
+void nn_msgqueue_sndwoken (struct nn_msgqueue *self);
+void nn_msgqueue_rcvwait (struct nn_msgqueue *self);
+int nn_msgqueue_rcvcancel (struct nn_msgqueue *self);
+int nn_msgqueue_rcvnotify (struct nn_msgqueue *self);
+void nn_msgqueue_rcvwoken (struct nn_msgqueue *self);
+
 #endif
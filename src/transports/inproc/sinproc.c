@@ -23,9 +23,13 @@
 
 #include "sinproc.h"
 
+#include "../../sim.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
+#include "../../utils/fast.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
 
 #include <stddef.h>
 
@@ -40,14 +44,17 @@
 #define NN_SINPROC_ACTION_READY 1
 #define NN_SINPROC_ACTION_ACCEPTED 2
 
-/*  Set when SENT event was sent to the peer but RECEIVED haven't been
-    passed back yet. */
+#define NN_SINPROC_SRC_TIMER 1
+
+/*  Set when the outgoing message couldn't be written to the peer's queue
+    because it was full. The peer will pass RECEIVED back once there's
+    room. */
 #define NN_SINPROC_FLAG_SENDING 1
 
-/*  Set when SENT event was received, but the new message cannot be written
-    to the queue yet, i.e. RECEIVED event haven't been returned
-    to the peer yet. */
-#define NN_SINPROC_FLAG_RECEIVING 2
+/*  Set when a message was put into the emulated link of a sim session, but
+    the link is not done transmitting it yet, or the messages coming out of
+    it are held up by the peer's full queue. */
+#define NN_SINPROC_FLAG_LINKBUSY 2
 
 /*  Private functions. */
 static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
@@ -55,17 +62,31 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
 static void nn_sinproc_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 
+static int nn_sinproc_push (struct nn_sinproc *self);
+static void nn_sinproc_rcvwait (struct nn_sinproc *self);
+static void nn_sinproc_flush (struct nn_sinproc *self);
+
 static int nn_sinproc_send (struct nn_pipebase *self, struct nn_msg *msg);
 static int nn_sinproc_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_sinproc_queued (struct nn_pipebase *self);
+static size_t nn_sinproc_unsent (struct nn_pipebase *self);
 const struct nn_pipebase_vfptr nn_sinproc_pipebase_vfptr = {
     nn_sinproc_send,
-    nn_sinproc_recv
+    nn_sinproc_recv,
+    nn_sinproc_queued,
+    nn_sinproc_unsent,
+    NULL
 };
 
 void nn_sinproc_init (struct nn_sinproc *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner)
+    struct nn_ep *ep, int sim, struct nn_fsm *owner)
 {
     int rcvbuf;
+    int delay;
+    int jitter;
+    int bandwidth;
+    int loss;
+    int seed;
     size_t sz;
 
     nn_fsm_init (&self->fsm, nn_sinproc_handler, nn_sinproc_shutdown,
@@ -74,6 +95,7 @@ void nn_sinproc_init (struct nn_sinproc *self, int src,
     self->flags = 0;
     self->peer = NULL;
     nn_pipebase_init (&self->pipebase, &nn_sinproc_pipebase_vfptr, ep);
+    nn_pipebase_setpieces (&self->pipebase, 1);
     sz = sizeof (rcvbuf);
     nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
     nn_assert (sz == sizeof (rcvbuf));
@@ -84,10 +106,30 @@ void nn_sinproc_init (struct nn_sinproc *self, int src,
     nn_fsm_event_init (&self->event_received);
     nn_fsm_event_init (&self->event_disconnect);
     nn_list_item_init (&self->item);
+
+    /*  Each side emulates the link in the direction of its own messages,
+        as set by its own socket's options. */
+    self->sim = sim;
+    self->wakeup = 0;
+    if (sim) {
+        sz = sizeof (int);
+        nn_ep_getopt (ep, NN_SIM, NN_SIM_DELAY, &delay, &sz);
+        nn_ep_getopt (ep, NN_SIM, NN_SIM_JITTER, &jitter, &sz);
+        nn_ep_getopt (ep, NN_SIM, NN_SIM_BANDWIDTH, &bandwidth, &sz);
+        nn_ep_getopt (ep, NN_SIM, NN_SIM_LOSS, &loss, &sz);
+        nn_ep_getopt (ep, NN_SIM, NN_SIM_SEED, &seed, &sz);
+        nn_assert (sz == sizeof (int));
+        nn_simlink_init (&self->link, delay, jitter, bandwidth, loss, seed);
+        nn_timer_init (&self->timer, NN_SINPROC_SRC_TIMER, &self->fsm);
+    }
 }
 
 void nn_sinproc_term (struct nn_sinproc *self)
 {
+    if (self->sim) {
+        nn_timer_term (&self->timer);
+        nn_simlink_term (&self->link);
+    }
     nn_list_item_term (&self->item);
     nn_fsm_event_term (&self->event_disconnect);
     nn_fsm_event_term (&self->event_received);
@@ -138,6 +180,7 @@ static int nn_sinproc_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_sinproc *sinproc;
     struct nn_msg nmsg;
+    struct nn_msg_piece piece;
 
     sinproc = nn_cont (self, struct nn_sinproc, pipebase);
 
@@ -146,35 +189,130 @@ static int nn_sinproc_send (struct nn_pipebase *self, struct nn_msg *msg)
     if (sinproc->state == NN_SINPROC_STATE_DISCONNECTED)
         return -ECONNRESET;
 
-    /*  Sanity checks. */
+    /*  Sanity checks. In a sim session, the message held up by the peer's
+        queue is one that has crossed the link, not the one being sent. */
     nn_assert_state (sinproc, NN_SINPROC_STATE_ACTIVE);
-    nn_assert (!(sinproc->flags & NN_SINPROC_FLAG_SENDING));
-
-    nn_msg_init (&nmsg,
-        nn_chunkref_size (&msg->sphdr) +
-        nn_chunkref_size (&msg->body));
-    memcpy (nn_chunkref_data (&nmsg.body),
-        nn_chunkref_data (&msg->sphdr),
-        nn_chunkref_size (&msg->sphdr));
-    memcpy ((char *)nn_chunkref_data (&nmsg.body) +
-        nn_chunkref_size (&msg->sphdr),
-        nn_chunkref_data (&msg->body),
-        nn_chunkref_size (&msg->body));
+    nn_assert (!(sinproc->flags & (sinproc->sim ?
+        NN_SINPROC_FLAG_LINKBUSY : NN_SINPROC_FLAG_SENDING)));
+
+    /*  The peer expects the protocol header at the beginning of the body.
+        If there's none, or if the body chunk has room for it in front, the
+        body is handed over as it is, so that a chunk sent by the user ends
+        up with the receiver without being copied. */
+    nn_msg_flatten (msg);
+    if (!nn_chunkref_size (&msg->sphdr) ||
+          nn_chunkref_prepend (&msg->body, nn_chunkref_data (&msg->sphdr),
+          nn_chunkref_size (&msg->sphdr))) {
+        nn_msg_init (&nmsg, 0);
+        nn_chunkref_term (&nmsg.body);
+        nn_chunkref_mv (&nmsg.body, &msg->body);
+        nn_chunkref_init (&msg->body, 0);
+    }
+    else {
+        nn_msg_init (&nmsg,
+            nn_chunkref_size (&msg->sphdr) +
+            nn_chunkref_size (&msg->body));
+        memcpy (nn_chunkref_data (&nmsg.body),
+            nn_chunkref_data (&msg->sphdr),
+            nn_chunkref_size (&msg->sphdr));
+        memcpy ((char *)nn_chunkref_data (&nmsg.body) +
+            nn_chunkref_size (&msg->sphdr),
+            nn_chunkref_data (&msg->body),
+            nn_chunkref_size (&msg->body));
+    }
+    nmsg.expiry = msg->expiry;
+
+    /*  Pieces of a message are delivered as they are. Other properties
+        are of no use to the peer. */
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 &&
+          nn_msg_piece (msg, &piece)))
+        nn_msg_setpiece (&nmsg, &piece);
     nn_msg_term (msg);
 
-    /*  Expose the message to the peer. */
+    /*  In a sim session, the message is put into the link. The socket may
+        send the next one once the link is done transmitting this one. */
+    if (nn_slow (sinproc->sim)) {
+        nn_simlink_put (&sinproc->link, &nmsg, nn_clock_us ());
+        sinproc->flags |= NN_SINPROC_FLAG_LINKBUSY;
+        nn_sinproc_flush (sinproc);
+        return 0;
+    }
+
+    /*  Write the message to the peer's queue. If it is full, keep the
+        message till the peer makes room for it. */
     nn_msg_term (&sinproc->msg);
     nn_msg_mv (&sinproc->msg, &nmsg);
-
-    /*  Notify the peer that there's a message to get. */
-    sinproc->flags |= NN_SINPROC_FLAG_SENDING;
-    nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-        &sinproc->peer->event_sent, NN_SINPROC_SRC_PEER,
-        NN_SINPROC_SENT, sinproc);
+    if (nn_fast (nn_sinproc_push (sinproc)))
+        nn_pipebase_sent (&sinproc->pipebase);
+    else
+        sinproc->flags |= NN_SINPROC_FLAG_SENDING;
 
     return 0;
 }
 
+/*  Moves the pending outgoing message to the peer's queue. Returns 1 on
+    success, 0 if the queue is full and the peer was asked to pass RECEIVED
+    back once there's room. */
+static int nn_sinproc_push (struct nn_sinproc *self)
+{
+    struct nn_msgqueue *msgqueue;
+
+    msgqueue = &self->peer->msgqueue;
+    if (nn_slow (nn_msgqueue_send (msgqueue, &self->msg) < 0)) {
+
+        /*  The peer may have made room just before it was asked to tell us
+            about it, so check once again. */
+        nn_msgqueue_sndwait (msgqueue);
+        if (nn_msgqueue_send (msgqueue, &self->msg) < 0)
+            return 0;
+
+        /*  If the notification was already sent, it will simply be
+            ignored. */
+        nn_msgqueue_sndcancel (msgqueue);
+    }
+    nn_msg_init (&self->msg, 0);
+
+    /*  Notify the peer that there's a message to get, unless it was
+        already aware of that. */
+    if (nn_msgqueue_rcvnotify (msgqueue))
+        nn_fsm_raiseto (&self->fsm, &self->peer->fsm,
+            &self->peer->event_sent, NN_SINPROC_SRC_PEER,
+            NN_SINPROC_SENT, self);
+
+    return 1;
+}
+
+static size_t nn_sinproc_queued (struct nn_pipebase *self)
+{
+    struct nn_sinproc *sinproc;
+    size_t queued;
+
+    sinproc = nn_cont (self, struct nn_sinproc, pipebase);
+
+    if (sinproc->state != NN_SINPROC_STATE_ACTIVE)
+        return 0;
+
+    /*  Messages in the peer's queue plus the one waiting for room in it. */
+    queued = nn_msgqueue_size (&sinproc->peer->msgqueue);
+    if (sinproc->flags & NN_SINPROC_FLAG_SENDING)
+        ++queued;
+    if (sinproc->sim)
+        queued += nn_simlink_size (&sinproc->link);
+    return queued;
+}
+
+static size_t nn_sinproc_unsent (struct nn_pipebase *self)
+{
+    struct nn_sinproc *sinproc;
+
+    sinproc = nn_cont (self, struct nn_sinproc, pipebase);
+
+    /*  Once in the peer's queue, the messages are out of the socket's hands,
+        the same way the data in the kernel's buffers are for the other
+        transports. */
+    return (sinproc->flags & NN_SINPROC_FLAG_SENDING) ? 1 : 0;
+}
+
 static int nn_sinproc_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
     int rc;
@@ -190,32 +328,89 @@ static int nn_sinproc_recv (struct nn_pipebase *self, struct nn_msg *msg)
     rc = nn_msgqueue_recv (&sinproc->msgqueue, msg);
     errnum_assert (rc == 0, -rc);
 
-    /*  If there was a message from peer lingering because of the exceeded
-        buffer limit, try to enqueue it once again. */
-    if (sinproc->state != NN_SINPROC_STATE_DISCONNECTED) {
-        if (nn_slow (sinproc->flags & NN_SINPROC_FLAG_RECEIVING)) {
-            rc = nn_msgqueue_send (&sinproc->msgqueue, &sinproc->peer->msg);
-            nn_assert (rc == 0 || rc == -EAGAIN);
-            if (rc == 0) {
-                errnum_assert (rc == 0, -rc);
-                nn_msg_init (&sinproc->peer->msg, 0);
-                nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-                    &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
-                    NN_SINPROC_RECEIVED, sinproc);
-                sinproc->flags &= ~NN_SINPROC_FLAG_RECEIVING;
-            }
-        }
+    /*  If the peer has a message lingering because of the exceeded buffer
+        limit, let it know there's room now. */
+    if (sinproc->state != NN_SINPROC_STATE_DISCONNECTED &&
+          nn_slow (nn_msgqueue_sndnotify (&sinproc->msgqueue)))
+        nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
+            &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
+            NN_SINPROC_RECEIVED, sinproc);
+
+    if (nn_fast (!nn_msgqueue_empty (&sinproc->msgqueue))) {
+        nn_pipebase_received (&sinproc->pipebase);
+        return 0;
     }
+    if (sinproc->state == NN_SINPROC_STATE_DISCONNECTED)
+        return 0;
 
-    if (!nn_msgqueue_empty (&sinproc->msgqueue))
-       nn_pipebase_received (&sinproc->pipebase);
+    nn_sinproc_rcvwait (sinproc);
 
     return 0;
 }
 
+/*  The queue is empty. Asks the peer to tell us about the next message,
+    unless it has written one in the meantime. */
+static void nn_sinproc_rcvwait (struct nn_sinproc *self)
+{
+    nn_msgqueue_rcvwait (&self->msgqueue);
+    if (!nn_msgqueue_empty (&self->msgqueue) &&
+          nn_msgqueue_rcvcancel (&self->msgqueue))
+        nn_pipebase_received (&self->pipebase);
+}
+
+/*  Moves the messages that have come out of the link to the peer's queue
+    and lets the socket send the next message once the link is free, then
+    sets the timer for whichever of the two is to happen next. */
+static void nn_sinproc_flush (struct nn_sinproc *self)
+{
+    uint64_t now;
+    uint64_t wakeup;
+
+    now = nn_clock_us ();
+
+    /*  A message the peer has no room for holds up the ones behind it. */
+    while (!(self->flags & NN_SINPROC_FLAG_SENDING)) {
+        if (nn_simlink_get (&self->link, &self->msg, now) < 0)
+            break;
+        if (!nn_sinproc_push (self))
+            self->flags |= NN_SINPROC_FLAG_SENDING;
+    }
+
+    /*  Once the peer stops picking up the messages, so does the sender
+        stop sending them, as it would over a real connection. */
+    if (self->flags & NN_SINPROC_FLAG_SENDING)
+        return;
+    if ((self->flags & NN_SINPROC_FLAG_LINKBUSY) &&
+          nn_simlink_free (&self->link) <= now) {
+        self->flags &= ~NN_SINPROC_FLAG_LINKBUSY;
+        nn_pipebase_sent (&self->pipebase);
+    }
+
+    wakeup = nn_simlink_next (&self->link);
+    if ((self->flags & NN_SINPROC_FLAG_LINKBUSY) &&
+          (!wakeup || nn_simlink_free (&self->link) < wakeup))
+        wakeup = nn_simlink_free (&self->link);
+    if (!wakeup)
+        return;
+
+    /*  The timer can't be reset while it's running. If it's set for too
+        late, it's stopped and set anew once it has stopped. */
+    if (!nn_timer_isidle (&self->timer)) {
+        if (self->wakeup > wakeup)
+            nn_timer_stop (&self->timer);
+        return;
+    }
+    self->wakeup = wakeup;
+    nn_timer_start (&self->timer, (int) ((wakeup - now + 999) / 1000));
+}
+
 static void nn_sinproc_shutdown_events (struct nn_sinproc *self, int src,
     int type, NN_UNUSED void *srcptr)
 {
+    /*  The timer is stopped along with the session. */
+    if (src == NN_SINPROC_SRC_TIMER)
+        return;
+
     /*  *******************************  */
     /*  Any-state events                 */
     /*  *******************************  */
@@ -223,6 +418,8 @@ static void nn_sinproc_shutdown_events (struct nn_sinproc *self, int src,
     case NN_FSM_ACTION:
         switch (type) {
         case NN_FSM_STOP:
+            if (self->sim)
+                nn_timer_stop (&self->timer);
             if (self->state != NN_SINPROC_STATE_IDLE &&
                   self->state != NN_SINPROC_STATE_DISCONNECTED) {
                 nn_pipebase_stop (&self->pipebase);
@@ -239,6 +436,7 @@ static void nn_sinproc_shutdown_events (struct nn_sinproc *self, int src,
         }
     case NN_SINPROC_SRC_PEER:
         switch (type) {
+        case NN_SINPROC_SENT:
         case NN_SINPROC_RECEIVED:
             return;
         }
@@ -288,14 +486,17 @@ static void nn_sinproc_shutdown (struct nn_fsm *self, int src, int type,
     }
 
     /*  Are all events processed? We can't cancel them unfortunately  */
-    if (nn_fsm_event_active (&sinproc->event_received)
+    if (nn_fsm_event_active (&sinproc->event_sent)
+        || nn_fsm_event_active (&sinproc->event_received)
         || nn_fsm_event_active (&sinproc->event_disconnect))
     {
         return;
     }
+    if (sinproc->sim && !nn_timer_isidle (&sinproc->timer))
+        return;
+
     /*  These events are deemed to be impossible here  */
     nn_assert (!nn_fsm_event_active (&sinproc->event_connect));
-    nn_assert (!nn_fsm_event_active (&sinproc->event_sent));
 
     /*  **********************************************  */
     /*  All checks are successful. Just stop right now  */
@@ -310,10 +511,22 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
 {
     int rc;
     struct nn_sinproc *sinproc;
-    int empty;
 
     sinproc = nn_cont (self, struct nn_sinproc, fsm);
 
+    /*  The timer of a sim session, in any state. */
+    if (nn_slow (src == NN_SINPROC_SRC_TIMER)) {
+        if (type == NN_TIMER_TIMEOUT) {
+            nn_timer_stop (&sinproc->timer);
+            return;
+        }
+        nn_assert (type == NN_TIMER_STOPPED);
+        sinproc->wakeup = 0;
+        if (sinproc->state == NN_SINPROC_STATE_ACTIVE)
+            nn_sinproc_flush (sinproc);
+        return;
+    }
+
     switch (sinproc->state) {
 
 /******************************************************************************/
@@ -420,33 +633,33 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_SINPROC_SENT:
 
-                empty = nn_msgqueue_empty (&sinproc->msgqueue);
-
-                /*  Push the message to the inbound message queue. */
-                rc = nn_msgqueue_send (&sinproc->msgqueue,
-                    &sinproc->peer->msg);
-                if (rc == -EAGAIN) {
-                    sinproc->flags |= NN_SINPROC_FLAG_RECEIVING;
+                /*  The peer wrote a message into our empty queue. Notify
+                    the user that there's a message to receive. The peer
+                    checks for our request only after writing the message,
+                    so the notification may be stale: we may have already
+                    read the message and asked for the next one. */
+                nn_msgqueue_rcvwoken (&sinproc->msgqueue);
+                if (nn_fast (!nn_msgqueue_empty (&sinproc->msgqueue))) {
+                    nn_pipebase_received (&sinproc->pipebase);
                     return;
                 }
-                errnum_assert (rc == 0, -rc);
-                nn_msg_init (&sinproc->peer->msg, 0);
-
-                /*  Notify the user that there's a message to receive. */
-                if (empty)
-                    nn_pipebase_received (&sinproc->pipebase);
-
-                /*  Notify the peer that the message was received. */
-                nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-                    &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
-                    NN_SINPROC_RECEIVED, sinproc);
-
+                nn_sinproc_rcvwait (sinproc);
                 return;
 
             case NN_SINPROC_RECEIVED:
-                nn_assert (sinproc->flags & NN_SINPROC_FLAG_SENDING);
-                nn_pipebase_sent (&sinproc->pipebase);
-                sinproc->flags &= ~NN_SINPROC_FLAG_SENDING;
+
+                /*  There's room in the peer's queue. The notification may
+                    be stale if we've managed to write the message anyway. */
+                nn_msgqueue_sndwoken (&sinproc->peer->msgqueue);
+                if (!(sinproc->flags & NN_SINPROC_FLAG_SENDING))
+                    return;
+                if (nn_sinproc_push (sinproc)) {
+                    sinproc->flags &= ~NN_SINPROC_FLAG_SENDING;
+                    if (sinproc->sim)
+                        nn_sinproc_flush (sinproc);
+                    else
+                        nn_pipebase_sent (&sinproc->pipebase);
+                }
                 return;
 
             case NN_SINPROC_DISCONNECT:
@@ -477,6 +690,7 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
         switch (src) {
         case NN_SINPROC_SRC_PEER:
             switch (type) {
+            case NN_SINPROC_SENT:
             case NN_SINPROC_RECEIVED:
                 /*  This case can safely be ignored. It may happen when
                     nn_close() comes before the already enqueued
@@ -28,7 +28,10 @@
 
 #include "../../transport.h"
 
+#include "../utils/simlink.h"
+
 #include "../../aio/fsm.h"
+#include "../../aio/timer.h"
 
 #include "../../utils/msg.h"
 #include "../../utils/list.h"
@@ -61,12 +64,14 @@ struct nn_sinproc {
     struct nn_pipebase pipebase;
 
     /*  Inbound message queue. The messages contained are meant to be received
-        by the user later on. */
+        by the user later on. The peer writes into it directly, without
+        entering our context; SENT and RECEIVED events are only exchanged
+        when one side has to wait for the other. */
     struct nn_msgqueue msgqueue;
 
     /*  This message is the one being sent from this session to the peer
-        session. It holds the data only temporarily, until the peer moves
-        it to its msgqueue. */
+        session. It holds the data only temporarily, while the peer's
+        msgqueue is full. */
     struct nn_msg msg;
 
     /*  Outbound events. I.e. event sent by this sinproc to the peer sinproc. */
@@ -80,10 +85,20 @@ struct nn_sinproc {
     /*  This member is used only if we are on the bound side. binproc object
         has a list of sinprocs it handles. */
     struct nn_list_item item;
+
+    /*  1 if the session belongs to the sim transport. The outgoing messages
+        then cross the emulated link before they get to the peer's queue,
+        the timer waking us up when the next one comes out of it or when
+        the link is done transmitting. 'wakeup' is the time the timer is
+        set for, 0 if it isn't running. */
+    int sim;
+    struct nn_simlink link;
+    struct nn_timer timer;
+    uint64_t wakeup;
 };
 
 void nn_sinproc_init (struct nn_sinproc *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner);
+    struct nn_ep *ep, int sim, struct nn_fsm *owner);
 void nn_sinproc_term (struct nn_sinproc *self);
 int nn_sinproc_isidle (struct nn_sinproc *self);
 
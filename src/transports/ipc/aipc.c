@@ -47,7 +47,7 @@ static void nn_aipc_shutdown (struct nn_fsm *self, int src, int type,
    void *srcptr);
 
 void nn_aipc_init (struct nn_aipc *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner)
+    struct nn_ep *ep, int shm, struct nn_fsm *owner)
 {
     nn_fsm_init (&self->fsm, nn_aipc_handler, nn_aipc_shutdown,
         src, self, owner);
@@ -57,7 +57,7 @@ void nn_aipc_init (struct nn_aipc *self, int src,
     self->listener = NULL;
     self->listener_owner.src = -1;
     self->listener_owner.fsm = NULL;
-    nn_sipc_init (&self->sipc, NN_AIPC_SRC_SIPC, ep, &self->fsm);
+    nn_sipc_init (&self->sipc, NN_AIPC_SRC_SIPC, ep, shm, &self->fsm);
     nn_fsm_event_init (&self->accepted);
     nn_fsm_event_init (&self->done);
     nn_list_item_init (&self->item);
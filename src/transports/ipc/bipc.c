@@ -24,6 +24,7 @@
 
 #include "bipc.h"
 #include "aipc.h"
+#include "ipc.h"
 
 #include "../../aio/fsm.h"
 #include "../../aio/usock.h"
@@ -70,6 +71,14 @@ struct nn_bipc {
 
     /*  List of accepted connections. */
     struct nn_list aipcs;
+
+    /*  1 if the accepted connections use shared memory. */
+    int shm;
+
+    /*  Number of accepted connections and the limit thereof, as set by
+        NN_MAXCONN. Zero means no limit. */
+    int nconns;
+    int maxconn;
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -87,11 +96,13 @@ static void nn_bipc_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_bipc_listen (struct nn_bipc *self);
 static void nn_bipc_start_accepting (struct nn_bipc *self);
+static void nn_bipc_resume_accepting (struct nn_bipc *self);
 
-int nn_bipc_create (struct nn_ep *ep)
+int nn_bipc_create (struct nn_ep *ep, int shm)
 {
     struct nn_bipc *self;
     int rc;
+    size_t maxconnsz;
 
     /*  Allocate the new endpoint object. */
     self = nn_alloc (sizeof (struct nn_bipc), "bipc");
@@ -106,6 +117,11 @@ int nn_bipc_create (struct nn_ep *ep)
     self->state = NN_BIPC_STATE_IDLE;
     self->aipc = NULL;
     nn_list_init (&self->aipcs);
+    self->shm = shm;
+    self->nconns = 0;
+    maxconnsz = sizeof (self->maxconn);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_MAXCONN, &self->maxconn, &maxconnsz);
+    nn_assert (maxconnsz == sizeof (self->maxconn));
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
@@ -159,26 +175,29 @@ static void nn_bipc_shutdown (struct nn_fsm *self, int src, int type,
     bipc = nn_cont (self, struct nn_bipc, fsm);
 
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
-        if (bipc->aipc) {
+
+        /*  There's no connection being accepted if accepting is paused,
+            but the listening socket has to be stopped all the same. */
+        if (bipc->aipc)
             nn_aipc_stop (bipc->aipc);
-            bipc->state = NN_BIPC_STATE_STOPPING_AIPC;
-        }
-        else {
-            bipc->state = NN_BIPC_STATE_STOPPING_USOCK;
-        }
+        bipc->state = NN_BIPC_STATE_STOPPING_AIPC;
     }
     if (nn_slow (bipc->state == NN_BIPC_STATE_STOPPING_AIPC)) {
-        if (!nn_aipc_isidle (bipc->aipc))
-            return;
-        nn_aipc_term (bipc->aipc);
-        nn_free (bipc->aipc);
-        bipc->aipc = NULL;
+        if (bipc->aipc) {
+            if (!nn_aipc_isidle (bipc->aipc))
+                return;
+            nn_aipc_term (bipc->aipc);
+            nn_free (bipc->aipc);
+            bipc->aipc = NULL;
+        }
 
         /* On *nixes, unlink the domain socket file */
 #if defined NN_HAVE_UNIX_SOCKETS
         addr = nn_ep_getaddr (bipc->ep);
-        rc = unlink(addr);
-        errno_assert (rc == 0 || errno == ENOENT);
+        if (nn_ipc_hasfile (addr)) {
+            rc = unlink(addr);
+            errno_assert (rc == 0 || errno == ENOENT);
+        }
 #endif
 
         nn_usock_stop (&bipc->usock);
@@ -256,8 +275,9 @@ static void nn_bipc_handler (struct nn_fsm *self, int src, int type,
 
             nn_list_insert (&bipc->aipcs, &aipc->item,
                 nn_list_end (&bipc->aipcs));
+            ++bipc->nconns;
             bipc->aipc = NULL;
-            nn_bipc_start_accepting (bipc);
+            nn_bipc_resume_accepting (bipc);
             return;
         case NN_AIPC_ERROR:
             nn_aipc_stop (aipc);
@@ -266,6 +286,8 @@ static void nn_bipc_handler (struct nn_fsm *self, int src, int type,
             nn_list_erase (&bipc->aipcs, &aipc->item);
             nn_aipc_term (aipc);
             nn_free (aipc);
+            --bipc->nconns;
+            nn_bipc_resume_accepting (bipc);
             return;
         default:
             nn_fsm_bad_action (bipc->state, src, type);
@@ -283,48 +305,47 @@ static int nn_bipc_listen (struct nn_bipc *self)
 {
     int rc;
     struct sockaddr_storage ss;
-    struct sockaddr_un *un;
+    size_t sslen;
     const char *addr;
+    int type;
 #if defined NN_HAVE_UNIX_SOCKETS
     int fd;
 #endif
 
     /*  First, create the AF_UNIX address. */
     addr = nn_ep_getaddr (self->ep);
-    memset (&ss, 0, sizeof (ss));
-    un = (struct sockaddr_un*) &ss;
-    nn_assert (strlen (addr) < sizeof (un->sun_path));
-    ss.ss_family = AF_UNIX;
-    strncpy (un->sun_path, addr, sizeof (un->sun_path));
+    sslen = nn_ipc_sockaddr (addr, &ss);
+    type = nn_ipc_socktype (self->ep, self->shm);
 
     /*  Delete the IPC file left over by eventual previous runs of
         the application. We'll check whether the file is still in use by
         connecting to the endpoint. On Windows plaform, NamedPipe is used
-        which does not have an underlying file. */
+        which does not have an underlying file. Neither is there one for
+        an abstract address. */
 #if defined NN_HAVE_UNIX_SOCKETS
-    fd = socket (AF_UNIX, SOCK_STREAM, 0);
-    if (fd >= 0) {
-        rc = fcntl (fd, F_SETFL, O_NONBLOCK);
-        errno_assert (rc != -1 || errno == EINVAL);
-        rc = connect (fd, (struct sockaddr*) &ss,
-            sizeof (struct sockaddr_un));
-        if (rc == -1 && errno == ECONNREFUSED) {
-            rc = unlink (addr);
-            errno_assert (rc == 0 || errno == ENOENT);
+    if (nn_ipc_hasfile (addr)) {
+        fd = socket (AF_UNIX, type, 0);
+        if (fd >= 0) {
+            rc = fcntl (fd, F_SETFL, O_NONBLOCK);
+            errno_assert (rc != -1 || errno == EINVAL);
+            rc = connect (fd, (struct sockaddr*) &ss, (socklen_t) sslen);
+            if (rc == -1 && errno == ECONNREFUSED) {
+                rc = unlink (addr);
+                errno_assert (rc == 0 || errno == ENOENT);
+            }
+            rc = close (fd);
+            errno_assert (rc == 0);
         }
-        rc = close (fd);
-        errno_assert (rc == 0);
     }
 #endif
 
     /*  Start listening for incoming connections. */
-    rc = nn_usock_start (&self->usock, AF_UNIX, SOCK_STREAM, 0);
+    rc = nn_usock_start (&self->usock, AF_UNIX, type, 0);
     if (rc < 0) {
         return rc;
     }
 
-    rc = nn_usock_bind (&self->usock,
-        (struct sockaddr*) &ss, sizeof (struct sockaddr_un));
+    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &ss, sslen);
     if (rc < 0) {
         nn_usock_stop (&self->usock);
         return rc;
@@ -351,8 +372,20 @@ static void nn_bipc_start_accepting (struct nn_bipc *self)
     /*  Allocate new aipc state machine. */
     self->aipc = nn_alloc (sizeof (struct nn_aipc), "aipc");
     alloc_assert (self->aipc);
-    nn_aipc_init (self->aipc, NN_BIPC_SRC_AIPC, self->ep, &self->fsm);
+    nn_aipc_init (self->aipc, NN_BIPC_SRC_AIPC, self->ep, self->shm,
+        &self->fsm);
 
     /*  Start waiting for a new incoming connection. */
     nn_aipc_start (self->aipc, &self->usock);
 }
+
+static void nn_bipc_resume_accepting (struct nn_bipc *self)
+{
+    /*  Once the limit is reached, new connections wait in the listen
+        backlog till some of the existing ones are closed. */
+    if (self->aipc)
+        return;
+    if (self->maxconn > 0 && self->nconns >= self->maxconn)
+        return;
+    nn_bipc_start_accepting (self);
+}
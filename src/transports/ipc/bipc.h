@@ -26,8 +26,9 @@
 
 #include "../../transport.h"
 
-/*  State machine managing bound IPC socket. */
+/*  State machine managing bound IPC socket. If 'shm' is set, the accepted
+    connections pass messages through shared memory (see sipc.h). */
 
-int nn_bipc_create (struct nn_ep *);
+int nn_bipc_create (struct nn_ep *, int shm);
 
 #endif
@@ -23,11 +23,13 @@
 
 #include "cipc.h"
 #include "sipc.h"
+#include "ipc.h"
 
 #include "../../aio/fsm.h"
 #include "../../aio/usock.h"
 
 #include "../utils/backoff.h"
+#include "../utils/pathwatch.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
@@ -56,6 +58,16 @@
 #define NN_CIPC_SRC_USOCK 1
 #define NN_CIPC_SRC_RECONNECT_TIMER 2
 #define NN_CIPC_SRC_SIPC 3
+#define NN_CIPC_SRC_WATCH 4
+#define NN_CIPC_SRC_TASK_WATCH 5
+#define NN_CIPC_SRC_TASK_UNWATCH 6
+
+/*  The peer creates the socket file a moment before it starts listening,
+    so the attempts made once the file shows up may be refused. They are
+    retried this many times, this many milliseconds apart, before the
+    endpoint falls back to the backoff. */
+#define NN_CIPC_LISTEN_RETRIES 20
+#define NN_CIPC_LISTEN_IVL 1
 
 struct nn_cipc {
 
@@ -74,6 +86,29 @@ struct nn_cipc {
     /*  State machine that handles the active part of the connection
         lifetime. */
     struct nn_sipc sipc;
+
+#if defined NN_HAVE_PATHWATCH
+    /*  Watch for the socket file to be created, so that the endpoint
+        doesn't have to wait for the backoff to expire once the peer binds
+        it. The watch is registered with the worker by task_watch and
+        removed by task_unwatch, 'added' being set in between. */
+    struct nn_pathwatch watch;
+    struct nn_worker *worker;
+    struct nn_worker_fd wfd;
+    struct nn_worker_task task_watch;
+    struct nn_worker_task task_unwatch;
+    int added;
+
+    /*  1 while task_unwatch is pending. */
+    int unwatching;
+
+    /*  1 if the file was created since the last connection attempt began,
+        i.e. the attempt may have failed only because it came too early. */
+    int created;
+
+    /*  Number of quick retries left since the file was created. */
+    int retries;
+#endif
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -90,8 +125,12 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
 static void nn_cipc_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_cipc_start_connecting (struct nn_cipc *self);
+static void nn_cipc_wait (struct nn_cipc *self);
+#if defined NN_HAVE_PATHWATCH
+static void nn_cipc_watch (struct nn_cipc *self, int src, int type);
+#endif
 
-int nn_cipc_create (struct nn_ep *ep)
+int nn_cipc_create (struct nn_ep *ep, int shm)
 {
     struct nn_cipc *self;
     int reconnect_ivl;
@@ -120,7 +159,24 @@ int nn_cipc_create (struct nn_ep *ep)
         reconnect_ivl_max = reconnect_ivl;
     nn_backoff_init (&self->retry, NN_CIPC_SRC_RECONNECT_TIMER,
         reconnect_ivl, reconnect_ivl_max, &self->fsm);
-    nn_sipc_init (&self->sipc, NN_CIPC_SRC_SIPC, ep, &self->fsm);
+    nn_sipc_init (&self->sipc, NN_CIPC_SRC_SIPC, ep, shm, &self->fsm);
+#if defined NN_HAVE_PATHWATCH
+    self->worker = nn_fsm_choose_worker (&self->fsm);
+    nn_worker_fd_init (&self->wfd, NN_CIPC_SRC_WATCH, &self->fsm);
+    nn_worker_task_init (&self->task_watch, NN_CIPC_SRC_TASK_WATCH,
+        &self->fsm);
+    nn_worker_task_init (&self->task_unwatch, NN_CIPC_SRC_TASK_UNWATCH,
+        &self->fsm);
+    self->added = 0;
+    self->unwatching = 0;
+    self->created = 0;
+    self->retries = 0;
+
+    /*  If the file can't be watched, e.g. because its directory doesn't
+        exist yet, the endpoint relies on the backoff alone. */
+    nn_pathwatch_init (&self->watch, nn_ipc_hasfile (nn_ep_getaddr (ep)) ?
+        nn_ep_getaddr (ep) : NULL);
+#endif
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
@@ -143,6 +199,12 @@ static void nn_cipc_destroy (struct nn_ep *ep)
 
     cipc = nn_ep_tran_private (ep);
 
+#if defined NN_HAVE_PATHWATCH
+    nn_pathwatch_term (&cipc->watch);
+    nn_worker_task_term (&cipc->task_unwatch);
+    nn_worker_task_term (&cipc->task_watch);
+    nn_worker_fd_term (&cipc->wfd);
+#endif
     nn_sipc_term (&cipc->sipc);
     nn_backoff_term (&cipc->retry);
     nn_usock_term (&cipc->usock);
@@ -158,11 +220,30 @@ static void nn_cipc_shutdown (struct nn_fsm *self, int src, int type,
 
     cipc = nn_cont (self, struct nn_cipc, fsm);
 
+#if defined NN_HAVE_PATHWATCH
+    /*  The watch is removed by the worker. The tasks are executed in order,
+        so by the time it gets to task_unwatch, task_watch is done. */
+    if (src == NN_CIPC_SRC_WATCH || src == NN_CIPC_SRC_TASK_WATCH)
+        return;
+    if (src == NN_CIPC_SRC_TASK_UNWATCH) {
+        if (cipc->added)
+            nn_worker_rm_fd (cipc->worker, &cipc->wfd);
+        cipc->added = 0;
+        cipc->unwatching = 0;
+    }
+#endif
+
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
         if (!nn_sipc_isidle (&cipc->sipc)) {
             nn_ep_stat_increment (cipc->ep, NN_STAT_DROPPED_CONNECTIONS, 1);
             nn_sipc_stop (&cipc->sipc);
         }
+#if defined NN_HAVE_PATHWATCH
+        if (nn_pathwatch_getfd (&cipc->watch) >= 0) {
+            nn_worker_execute (cipc->worker, &cipc->task_unwatch);
+            cipc->unwatching = 1;
+        }
+#endif
         cipc->state = NN_CIPC_STATE_STOPPING_SIPC_FINAL;
     }
     if (nn_slow (cipc->state == NN_CIPC_STATE_STOPPING_SIPC_FINAL)) {
@@ -176,6 +257,10 @@ static void nn_cipc_shutdown (struct nn_fsm *self, int src, int type,
         if (!nn_backoff_isidle (&cipc->retry) ||
               !nn_usock_isidle (&cipc->usock))
             return;
+#if defined NN_HAVE_PATHWATCH
+        if (cipc->unwatching)
+            return;
+#endif
         cipc->state = NN_CIPC_STATE_IDLE;
         nn_fsm_stopped_noevent (&cipc->fsm);
         nn_ep_stopped (cipc->ep);
@@ -192,6 +277,13 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
 
     cipc = nn_cont (self, struct nn_cipc, fsm);
 
+#if defined NN_HAVE_PATHWATCH
+    if (src == NN_CIPC_SRC_WATCH || src == NN_CIPC_SRC_TASK_WATCH) {
+        nn_cipc_watch (cipc, src, type);
+        return;
+    }
+#endif
+
     switch (cipc->state) {
 
 /******************************************************************************/
@@ -204,6 +296,10 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
         case NN_FSM_ACTION:
             switch (type) {
             case NN_FSM_START:
+#if defined NN_HAVE_PATHWATCH
+                if (nn_pathwatch_getfd (&cipc->watch) >= 0)
+                    nn_worker_execute (cipc->worker, &cipc->task_watch);
+#endif
                 nn_cipc_start_connecting (cipc);
                 return;
             default:
@@ -224,6 +320,10 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
         case NN_CIPC_SRC_USOCK:
             switch (type) {
             case NN_USOCK_CONNECTED:
+                nn_backoff_reset (&cipc->retry);
+#if defined NN_HAVE_PATHWATCH
+                cipc->retries = 0;
+#endif
                 nn_sipc_start (&cipc->sipc, &cipc->usock);
                 cipc->state = NN_CIPC_STATE_ACTIVE;
                 nn_ep_stat_increment (cipc->ep,
@@ -305,8 +405,7 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
             case NN_USOCK_SHUTDOWN:
                 return;
             case NN_USOCK_STOPPED:
-                nn_backoff_start (&cipc->retry);
-                cipc->state = NN_CIPC_STATE_WAITING;
+                nn_cipc_wait (cipc);
                 return;
             default:
                 nn_fsm_bad_action (cipc->state, src, type);
@@ -319,7 +418,8 @@ static void nn_cipc_handler (struct nn_fsm *self, int src, int type,
 /******************************************************************************/
 /*  WAITING state.                                                            */
 /*  Waiting before re-connection is attempted. This way we won't overload     */
-/*  the system by continuous re-connection attemps.                           */
+/*  the system by continuous re-connection attemps. The wait is cut short     */
+/*  if the socket file is created in the meantime.                            */
 /******************************************************************************/
     case NN_CIPC_STATE_WAITING:
         switch (src) {
@@ -374,16 +474,19 @@ static void nn_cipc_start_connecting (struct nn_cipc *self)
 {
     int rc;
     struct sockaddr_storage ss;
-    struct sockaddr_un *un;
-    const char *addr;
+    size_t sslen;
     int val;
     size_t sz;
 
+#if defined NN_HAVE_PATHWATCH
+    self->created = 0;
+#endif
+
     /*  Try to start the underlying socket. */
-    rc = nn_usock_start (&self->usock, AF_UNIX, SOCK_STREAM, 0);
+    rc = nn_usock_start (&self->usock, AF_UNIX,
+        nn_ipc_socktype (self->ep, self->sipc.shm), 0);
     if (nn_slow (rc < 0)) {
-        nn_backoff_start (&self->retry);
-        self->state = NN_CIPC_STATE_WAITING;
+        nn_cipc_wait (self);
         return;
     }
 
@@ -400,12 +503,7 @@ static void nn_cipc_start_connecting (struct nn_cipc *self)
         &val, sizeof (val));
 
     /*  Create the IPC address from the address string. */
-    addr = nn_ep_getaddr (self->ep);
-    memset (&ss, 0, sizeof (ss));
-    un = (struct sockaddr_un*) &ss;
-    nn_assert (strlen (addr) < sizeof (un->sun_path));
-    ss.ss_family = AF_UNIX;
-    strncpy (un->sun_path, addr, sizeof (un->sun_path));
+    sslen = nn_ipc_sockaddr (nn_ep_getaddr (self->ep), &ss);
 
 #if defined NN_HAVE_WINDOWS
     /* Get/Set security attribute pointer*/
@@ -416,9 +514,61 @@ static void nn_cipc_start_connecting (struct nn_cipc *self)
 #endif
 
     /*  Start connecting. */
-    nn_usock_connect (&self->usock, (struct sockaddr*) &ss,
-        sizeof (struct sockaddr_un));
+    nn_usock_connect (&self->usock, (struct sockaddr*) &ss, sslen);
     self->state  = NN_CIPC_STATE_CONNECTING;
 
     nn_ep_stat_increment (self->ep, NN_STAT_INPROGRESS_CONNECTIONS, 1);
 }
+
+static void nn_cipc_wait (struct nn_cipc *self)
+{
+    self->state = NN_CIPC_STATE_WAITING;
+
+#if defined NN_HAVE_PATHWATCH
+    /*  The file was created while the failed attempt was under way. */
+    if (self->created) {
+        nn_backoff_wait (&self->retry, 0);
+        return;
+    }
+
+    /*  The file was created recently, the peer may not be listening yet. */
+    if (self->retries > 0) {
+        --self->retries;
+        nn_backoff_wait (&self->retry, NN_CIPC_LISTEN_IVL);
+        return;
+    }
+#endif
+
+    nn_backoff_start (&self->retry);
+}
+
+#if defined NN_HAVE_PATHWATCH
+
+static void nn_cipc_watch (struct nn_cipc *self, int src, int type)
+{
+    if (src == NN_CIPC_SRC_TASK_WATCH) {
+        nn_assert (type == NN_WORKER_TASK_EXECUTE);
+        nn_worker_add_fd (self->worker, nn_pathwatch_getfd (&self->watch),
+            &self->wfd);
+        nn_worker_set_in (self->worker, &self->wfd);
+        self->added = 1;
+        return;
+    }
+
+    nn_assert (type == NN_WORKER_FD_IN);
+    if (!nn_pathwatch_check (&self->watch))
+        return;
+
+    /*  The peer has just bound the address, so the backoff starts over. */
+    nn_backoff_reset (&self->retry);
+    self->retries = NN_CIPC_LISTEN_RETRIES;
+    if (self->state == NN_CIPC_STATE_WAITING) {
+        nn_backoff_stop (&self->retry);
+        self->state = NN_CIPC_STATE_STOPPING_BACKOFF;
+        return;
+    }
+    if (self->state != NN_CIPC_STATE_ACTIVE)
+        self->created = 1;
+}
+
+#endif
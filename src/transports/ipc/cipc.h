@@ -26,8 +26,9 @@
 #include "../../transport.h"
 #include "../../ipc.h"
 
-/*  State machine managing connected IPC socket. */
+/*  State machine managing connected IPC socket. If 'shm' is set, the
+    connection passes messages through shared memory (see sipc.h). */
 
-int nn_cipc_create (struct nn_ep *ep);
+int nn_cipc_create (struct nn_ep *ep, int shm);
 
 #endif
@@ -28,6 +28,9 @@
 
 #include "../../ipc.h"
 
+#include "../utils/compress.h"
+#include "../utils/batch.h"
+
 #include "../../utils/err.h"
 #include "../../utils/alloc.h"
 #include "../../utils/fast.h"
@@ -42,6 +45,7 @@
 #include <sys/un.h>
 #include <unistd.h>
 #endif
+#include <stddef.h>
 
 /*  IPC-specific socket options. */
 struct nn_ipc_optset {
@@ -52,6 +56,11 @@ struct nn_ipc_optset {
 
     int outbuffersz;
     int inbuffersz;
+    int rcvbatch;
+    int seqpacket;
+    int compress;
+    int compressthreshold;
+    int batch;
 };
 
 static void nn_ipc_optset_destroy (struct nn_optset *self);
@@ -85,12 +94,64 @@ struct nn_transport *nn_ipc = &nn_ipc_vfptr;
 
 static int nn_ipc_bind (struct nn_ep *ep)
 {
-    return nn_bipc_create (ep);
+    return nn_bipc_create (ep, 0);
 }
 
 static int nn_ipc_connect (struct nn_ep *ep)
 {
-    return nn_cipc_create (ep);
+    return nn_cipc_create (ep, 0);
+}
+
+size_t nn_ipc_sockaddr (const char *addr, struct sockaddr_storage *ss)
+{
+    struct sockaddr_un *un;
+
+    memset (ss, 0, sizeof (*ss));
+    un = (struct sockaddr_un*) ss;
+    nn_assert (strlen (addr) < sizeof (un->sun_path));
+    ss->ss_family = AF_UNIX;
+    strncpy (un->sun_path, addr, sizeof (un->sun_path));
+
+#if defined NN_HAVE_LINUX
+    /*  The name of an abstract socket starts with a zero byte and spans
+        the rest of the address, so the length must be exact. */
+    if (addr [0] == '@') {
+        un->sun_path [0] = 0;
+        return offsetof (struct sockaddr_un, sun_path) + strlen (addr);
+    }
+#endif
+
+    return sizeof (struct sockaddr_un);
+}
+
+int nn_ipc_socktype (struct nn_ep *ep, int shm)
+{
+#if defined NN_HAVE_UNIX_SOCKETS
+    int val;
+    size_t sz;
+
+    if (!shm) {
+        sz = sizeof (val);
+        nn_ep_getopt (ep, NN_IPC, NN_IPC_SEQPACKET, &val, &sz);
+        nn_assert (sz == sizeof (val));
+        if (val)
+            return SOCK_SEQPACKET;
+    }
+#endif
+    return SOCK_STREAM;
+}
+
+int nn_ipc_hasfile (const char *addr)
+{
+#if defined NN_HAVE_LINUX
+    if (addr [0] == '@')
+        return 0;
+#endif
+#if defined NN_HAVE_UNIX_SOCKETS
+    return 1;
+#else
+    return 0;
+#endif
 }
 
 static struct nn_optset *nn_ipc_optset ()
@@ -105,6 +166,11 @@ static struct nn_optset *nn_ipc_optset ()
     optset->sec_attr = NULL;
     optset->outbuffersz = 4096;
     optset->inbuffersz = 4096;
+    optset->rcvbatch = 65536;
+    optset->seqpacket = 0;
+    optset->compress = NN_IPC_COMPRESS_NONE;
+    optset->compressthreshold = 1024;
+    optset->batch = 0;
 
     return &optset->base;   
 }
@@ -137,6 +203,35 @@ static int nn_ipc_optset_setopt (struct nn_optset *self, int option,
     case NN_IPC_INBUFSZ:
         optset->inbuffersz = *(int *)optval;
         return 0;
+    case NN_IPC_RCVBATCH:
+        if (*(int *)optval <= 0)
+            return -EINVAL;
+        optset->rcvbatch = *(int *)optval;
+        return 0;
+    case NN_IPC_SEQPACKET:
+        if (*(int *)optval != 0 && *(int *)optval != 1)
+            return -EINVAL;
+        optset->seqpacket = *(int *)optval;
+        return 0;
+    case NN_IPC_COMPRESS:
+        if (*(int *)optval != NN_IPC_COMPRESS_NONE &&
+              *(int *)optval != NN_IPC_COMPRESS_LZ4 &&
+              *(int *)optval != NN_IPC_COMPRESS_ZSTD)
+            return -EINVAL;
+        if ((*(int *)optval & ~nn_compress_supported ()) != 0)
+            return -ENOTSUP;
+        optset->compress = *(int *)optval;
+        return 0;
+    case NN_IPC_COMPRESS_THRESHOLD:
+        if (*(int *)optval < 0)
+            return -EINVAL;
+        optset->compressthreshold = *(int *)optval;
+        return 0;
+    case NN_IPC_BATCH:
+        if (*(int *)optval < 0 || *(int *)optval > NN_BATCH_MSGMAX)
+            return -EINVAL;
+        optset->batch = *(int *)optval;
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -162,6 +257,26 @@ static int nn_ipc_optset_getopt (struct nn_optset *self, int option,
         *(int *)optval = optset->inbuffersz;
         *optvallen = sizeof (int);
         return 0;
+    case NN_IPC_RCVBATCH:
+        *(int *)optval = optset->rcvbatch;
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_IPC_SEQPACKET:
+        *(int *)optval = optset->seqpacket;
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_IPC_COMPRESS:
+        *(int *)optval = optset->compress;
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_IPC_COMPRESS_THRESHOLD:
+        *(int *)optval = optset->compressthreshold;
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_IPC_BATCH:
+        *(int *)optval = optset->batch;
+        *optvallen = sizeof (int);
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -25,6 +25,23 @@
 
 #include "../../transport.h"
 
+#include <stddef.h>
+
 extern struct nn_transport *nn_ipc;
 
+struct sockaddr_storage;
+
+/*  Fills in the AF_UNIX address for the IPC address string and returns its
+    length. On Linux, addresses starting with '@' are in the abstract
+    namespace, i.e. there's no file associated with them. */
+size_t nn_ipc_sockaddr (const char *addr, struct sockaddr_storage *ss);
+
+/*  Returns the type of the AF_UNIX sockets the endpoint uses, depending on
+    the NN_IPC_SEQPACKET option. Shared memory connections always use
+    SOCK_STREAM. */
+int nn_ipc_socktype (struct nn_ep *ep, int shm);
+
+/*  Returns 1 if there's a file associated with the IPC address. */
+int nn_ipc_hasfile (const char *addr);
+
 #endif
@@ -23,15 +23,49 @@
 
 #include "sipc.h"
 
+#include "../../ipc.h"
+#include "../../shm.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
+#include "../../utils/chunk.h"
+#include "../../utils/closefd.h"
+
+#include <string.h>
+#if !defined NN_HAVE_WINDOWS
+#include <fcntl.h>
+#endif
 
 /*  Types of messages passed via IPC transport. */
 #define NN_SIPC_MSG_NORMAL 1
 #define NN_SIPC_MSG_SHMEM 2
+#define NN_SIPC_MSG_SHMCHUNK 3
+
+/*  Message accompanied by file descriptors. The first byte of the size
+    field holds the number of the descriptors, the remaining 7 bytes the
+    size of the message. */
+#define NN_SIPC_MSG_FDS 4
+
+/*  Compressed message. The first byte of the size field holds the algorithm
+    it's compressed with. */
+#define NN_SIPC_MSG_COMPRESSED 5
+
+/*  Batch frame carrying several small messages. */
+#define NN_SIPC_MSG_BATCH 6
+
+/*  Heartbeat frame, see heartbeat.h. */
+#define NN_SIPC_MSG_HEARTBEAT 7
+
+/*  Records of a SOCK_SEQPACKET connection are never smaller than this, even
+    if the send buffer is. The kernel doesn't make it smaller than 4608. */
+#define NN_SIPC_RECORD_MIN 2048
+
+/*  Maximum size of the SP header of a message passed by reference. */
+#define NN_SIPC_SPHDR_MAX 1024
 
 /*  States of the object as a whole. */
 #define NN_SIPC_STATE_IDLE 1
@@ -41,26 +75,38 @@
 #define NN_SIPC_STATE_SHUTTING_DOWN 5
 #define NN_SIPC_STATE_DONE 6
 #define NN_SIPC_STATE_STOPPING 7
+#define NN_SIPC_STATE_SHMSETUP 8
 
 /*  Subordinated srcptr objects. */
 #define NN_SIPC_SRC_USOCK 1
 #define NN_SIPC_SRC_STREAMHDR 2
+#define NN_SIPC_SRC_HEARTBEAT 3
 
 /*  Possible states of the inbound part of the object. */
 #define NN_SIPC_INSTATE_HDR 1
 #define NN_SIPC_INSTATE_BODY 2
 #define NN_SIPC_INSTATE_HASMSG 3
 
-/*  Possible states of the outbound part of the object. */
+/*  Possible states of the outbound part of the object. The pipe is either
+    accepting messages or waiting for the outbound queue to drain. */
 #define NN_SIPC_OUTSTATE_IDLE 1
 #define NN_SIPC_OUTSTATE_SENDING 2
 
+/*  Steps of the shared memory setup that are done. */
+#define NN_SIPC_SHMSETUP_SENT 1
+#define NN_SIPC_SHMSETUP_RECEIVED 2
+
 /*  Stream is a special type of pipe. Implementation of the virtual pipe API. */
 static int nn_sipc_send (struct nn_pipebase *self, struct nn_msg *msg);
 static int nn_sipc_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_sipc_queued (struct nn_pipebase *self);
+static void nn_sipc_disconnect (struct nn_pipebase *self);
 const struct nn_pipebase_vfptr nn_sipc_pipebase_vfptr = {
     nn_sipc_send,
-    nn_sipc_recv
+    nn_sipc_recv,
+    nn_sipc_queued,
+    NULL,
+    nn_sipc_disconnect
 };
 
 /*  Private functions. */
@@ -68,9 +114,35 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_sipc_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
+static int nn_sipc_activate (struct nn_sipc *self);
+static void nn_sipc_flush (struct nn_sipc *self);
+static void nn_sipc_pushbatch (struct nn_sipc *self);
+static void nn_sipc_heartbeat (struct nn_sipc *self);
+static int nn_sipc_recv_hdr (struct nn_sipc *self);
+static int nn_sipc_recv_body (struct nn_sipc *self);
+static int nn_sipc_recv_msg (struct nn_sipc *self);
+static void nn_sipc_recv_next (struct nn_sipc *self);
+static int nn_sipc_recv_done (struct nn_sipc *self);
+#if !defined NN_HAVE_WINDOWS
+static int nn_sipc_dupfds (struct nn_msg *msg);
+static int nn_sipc_recvfds (struct nn_sipc *self, int nfds);
+static void nn_sipc_msgterm (struct nn_msg *msg);
+#endif
+#if defined NN_HAVE_SHM
+static int nn_sipc_shm_setup (struct nn_sipc *self);
+static int nn_sipc_shm_open (struct nn_sipc *self);
+static void nn_sipc_shm_close (struct nn_sipc *self);
+static int nn_sipc_shm_send (struct nn_sipc *self, struct nn_msg *msg);
+static int nn_sipc_shm_recv (struct nn_sipc *self, struct nn_msg *msg);
+static int nn_sipc_shm_write (struct nn_sipc *self);
+static int nn_sipc_shm_read (struct nn_sipc *self);
+static int nn_sipc_shm_readmsg (struct nn_sipc *self, int *progress);
+static int nn_sipc_shm_chunk (struct nn_sipc *self);
+static void nn_sipc_shm_ring (struct nn_sipc *self);
+#endif
 
 void nn_sipc_init (struct nn_sipc *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner)
+    struct nn_ep *ep, int shm, struct nn_fsm *owner)
 {
     nn_fsm_init (&self->fsm, nn_sipc_handler, nn_sipc_shutdown,
         src, self, owner);
@@ -82,8 +154,30 @@ void nn_sipc_init (struct nn_sipc *self, int src,
     nn_pipebase_init (&self->pipebase, &nn_sipc_pipebase_vfptr, ep);
     self->instate = -1;
     nn_msg_init (&self->inmsg, 0);
+    nn_compress_init (&self->compress);
+    self->inalg = 0;
+    nn_batch_init (&self->batch);
+    self->inbatch = 0;
+    nn_pieces_init (&self->pieces);
+    nn_heartbeat_init (&self->heartbeat, NN_SIPC_SRC_HEARTBEAT, &self->fsm);
+    self->inheartbeat = 0;
+    self->rcvtstamp = 0;
+    self->intstamp = 0;
     self->outstate = -1;
+    nn_outq_init (&self->outq);
+#if !defined NN_HAVE_WINDOWS
+    nn_outq_setdtor (&self->outq, nn_sipc_msgterm);
+#endif
+    self->shm = shm;
+#if defined NN_HAVE_SHM
+    nn_shmring_init (&self->txring);
+    nn_shmring_init (&self->rxring);
     nn_msg_init (&self->outmsg, 0);
+    self->outchunk = 0;
+    self->inchunk = 0;
+#else
+    nn_assert (!shm);
+#endif
     nn_fsm_event_init (&self->done);
 }
 
@@ -92,7 +186,17 @@ void nn_sipc_term (struct nn_sipc *self)
     nn_assert_state (self, NN_SIPC_STATE_IDLE);
 
     nn_fsm_event_term (&self->done);
+#if defined NN_HAVE_SHM
     nn_msg_term (&self->outmsg);
+    nn_shmring_term (&self->rxring);
+    nn_shmring_term (&self->txring);
+#endif
+    nn_outq_term (&self->outq);
+    nn_heartbeat_term (&self->heartbeat);
+    nn_pieces_term (&self->pieces);
+    nn_batch_term (&self->batch);
+    nn_compress_term (&self->compress);
+    nn_msg_closefds (&self->inmsg, 0);
     nn_msg_term (&self->inmsg);
     nn_pipebase_term (&self->pipebase);
     nn_streamhdr_term (&self->streamhdr);
@@ -125,52 +229,712 @@ void nn_sipc_stop (struct nn_sipc *self)
 static int nn_sipc_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_sipc *sipc;
-    struct nn_iovec iov [3];
+    uint8_t hdr [9];
+    uint64_t size;
+    int rc;
+#if !defined NN_HAVE_WINDOWS
+    int nfds;
+    int *fds;
+    struct nn_file_region region;
+#endif
 
     sipc = nn_cont (self, struct nn_sipc, pipebase);
 
     nn_assert_state (sipc, NN_SIPC_STATE_ACTIVE);
     nn_assert (sipc->outstate == NN_SIPC_OUTSTATE_IDLE);
+    nn_heartbeat_traffic (&sipc->heartbeat);
 
-    /*  Move the message to the local storage. */
-    nn_msg_term (&sipc->outmsg);
-    nn_msg_mv (&sipc->outmsg, msg);
+#if defined NN_HAVE_SHM
+    if (sipc->shm)
+        return nn_sipc_shm_send (sipc, msg);
+#endif
 
     /*  Serialise the message header. */
-    sipc->outhdr [0] = NN_SIPC_MSG_NORMAL;
-    nn_putll (sipc->outhdr + 1, nn_chunkref_size (&sipc->outmsg.sphdr) +
-        nn_chunkref_size (&sipc->outmsg.body));
+    hdr [0] = NN_SIPC_MSG_NORMAL;
+    nn_putll (hdr + 1, nn_chunkref_size (&msg->sphdr) +
+        nn_msg_bodysize (msg));
+
+    /*  The first piece of a message is sent as an ordinary message of
+        the size of all of it, the others with no header at all. */
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 ||
+          sipc->pieces.outsize)) {
+        rc = nn_pieces_send (&sipc->pieces, msg, &size);
+        if (nn_slow (rc < 0)) {
+            nn_msg_term (msg);
+            sipc->state = NN_SIPC_STATE_DONE;
+            nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+            return 0;
+        }
+        if (rc == NN_PIECES_DROP) {
+            nn_msg_term (msg);
+            goto queued;
+        }
+        if (rc != NN_PIECES_NONE) {
+            nn_putll (hdr + 1, size);
+            nn_sipc_pushbatch (sipc);
+            nn_outq_push (&sipc->outq, hdr,
+                rc == NN_PIECES_FIRST ? sizeof (hdr) : 0, msg);
+            if (!nn_outq_busy (&sipc->outq))
+                nn_sipc_flush (sipc);
+            goto queued;
+        }
+    }
 
-    /*  Start async sending. */
-    iov [0].iov_base = sipc->outhdr;
-    iov [0].iov_len = sizeof (sipc->outhdr);
-    iov [1].iov_base = nn_chunkref_data (&sipc->outmsg.sphdr);
-    iov [1].iov_len = nn_chunkref_size (&sipc->outmsg.sphdr);
-    iov [2].iov_base = nn_chunkref_data (&sipc->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&sipc->outmsg.body);
-    nn_usock_send (sipc->usock, iov, 3);
+#if !defined NN_HAVE_WINDOWS
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 &&
+          nn_msg_file (msg, &region))) {
+
+        /*  The file region follows the body. As with the descriptors below,
+            the queue gets a duplicate of the one it refers to. A message
+            carrying both is sent with the region read into it instead. If
+            neither can be done, the connection is dropped. */
+        if (nn_msg_fds (msg, &fds) != 0)
+            rc = nn_msg_loadfile (msg);
+        else
+            rc = nn_msg_dupfile (msg);
+        if (nn_slow (rc < 0)) {
+            nn_msg_term (msg);
+            sipc->state = NN_SIPC_STATE_DONE;
+            nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+            return 0;
+        }
+        if (nn_msg_file (msg, NULL)) {
+            nn_putll (hdr + 1, nn_chunkref_size (&msg->sphdr) +
+                nn_msg_bodysize (msg) + region.length);
+            nn_sipc_pushbatch (sipc);
+            nn_outq_pushref (&sipc->outq, hdr, sizeof (hdr), msg);
+            if (!nn_outq_busy (&sipc->outq))
+                nn_sipc_flush (sipc);
+            goto queued;
+        }
+        nn_putll (hdr + 1, nn_chunkref_size (&msg->sphdr) +
+            nn_msg_bodysize (msg));
+    }
 
-    sipc->outstate = NN_SIPC_OUTSTATE_SENDING;
+    /*  The message carries file descriptors. They must stay valid till
+        the message is sent, so the queue gets duplicates of them. */
+    nfds = nn_sipc_dupfds (msg);
+    if (nn_slow (nfds != 0)) {
+        if (nn_slow (nfds < 0)) {
+
+            /*  Out of descriptors. There's no way to deliver the message
+                as it is, so the connection is dropped instead. */
+            nn_msg_term (msg);
+            sipc->state = NN_SIPC_STATE_DONE;
+            nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+            return 0;
+        }
+        hdr [0] = NN_SIPC_MSG_FDS;
+        hdr [1] = (uint8_t) nfds;
+        nn_sipc_pushbatch (sipc);
+        nn_outq_pushref (&sipc->outq, hdr, sizeof (hdr), msg);
+        if (!nn_outq_busy (&sipc->outq))
+            nn_sipc_flush (sipc);
+        goto queued;
+    }
+#endif
+
+    /*  While a write is in progress, a small message is packed into
+        the batch frame along with the others sent in the meantime. The frame
+        is queued once it's full, or the write is done. Urgent messages are
+        not held back that way. */
+    if (!msg->urgent && nn_batch_fits (&sipc->batch, msg) &&
+          nn_outq_busy (&sipc->outq)) {
+        if (nn_batch_add (&sipc->batch, msg))
+            nn_sipc_pushbatch (sipc);
+        goto queued;
+    }
+
+    /*  The frame goes first so that the order of messages is kept. An urgent
+        message overtakes it anyway. */
+    if (nn_fast (!msg->urgent))
+        nn_sipc_pushbatch (sipc);
+
+    /*  Compress the message if it's worth it. */
+    if (nn_slow (nn_compress_msg (&sipc->compress, msg,
+          nn_pipebase_frame (&sipc->pipebase)))) {
+        hdr [0] = NN_SIPC_MSG_COMPRESSED;
+        nn_putll (hdr + 1, nn_chunkref_size (&msg->body));
+        hdr [1] = (uint8_t) nn_compress_alg (&sipc->compress);
+    }
+
+    /*  Queue the message. If nothing is being sent at the moment, start
+        sending straight away. Otherwise the message will be sent along with
+        the others queued in the meantime once the current write is done. */
+    if (nn_slow (msg->urgent))
+        nn_outq_pushurgent (&sipc->outq, hdr, sizeof (hdr), msg);
+    else
+        nn_outq_push (&sipc->outq, hdr, sizeof (hdr), msg);
+    if (!nn_outq_busy (&sipc->outq))
+        nn_sipc_flush (sipc);
+
+queued:
+    /*  Unless the queue is full, the pipe remains writable. */
+    if (nn_slow (nn_outq_full (&sipc->outq))) {
+        sipc->outstate = NN_SIPC_OUTSTATE_SENDING;
+        return 0;
+    }
+    nn_pipebase_sent (&sipc->pipebase);
 
     return 0;
 }
 
+static void nn_sipc_flush (struct nn_sipc *self)
+{
+    struct nn_iovec iov [NN_OUTQ_MAXIOV];
+    int iovcnt;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_msg *msg;
+    int *fds;
+    int nfds;
+    struct nn_file_region region;
+#endif
+
+    iovcnt = nn_outq_start (&self->outq, iov);
+    nn_heartbeat_sent (&self->heartbeat);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Only the referenced message of the batch may carry descriptors or
+        a file region. */
+    msg = nn_outq_msg (&self->outq);
+    if (msg) {
+        if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 &&
+              nn_msg_file (msg, &region))) {
+            nn_usock_send_file (self->usock, iov, iovcnt, region.fd,
+                region.offset, region.length);
+            return;
+        }
+        nfds = nn_msg_fds (msg, &fds);
+        if (nfds) {
+            nn_usock_sendfds (self->usock, iov, iovcnt, fds, nfds);
+            return;
+        }
+    }
+#endif
+
+    nn_usock_send (self->usock, iov, iovcnt);
+}
+
+static void nn_sipc_pushbatch (struct nn_sipc *self)
+{
+    int rc;
+    struct nn_msg msg;
+    uint8_t hdr [9];
+
+    rc = nn_batch_close (&self->batch, &msg);
+    if (nn_fast (rc == 0))
+        return;
+    hdr [0] = rc == NN_BATCH_FRAME ? NN_SIPC_MSG_BATCH : NN_SIPC_MSG_NORMAL;
+    nn_putll (hdr + 1, nn_chunkref_size (&msg.sphdr) +
+        nn_chunkref_size (&msg.body));
+    nn_outq_push (&self->outq, hdr, sizeof (hdr), &msg);
+}
+
+static void nn_sipc_heartbeat (struct nn_sipc *self)
+{
+    struct nn_msg msg;
+    uint8_t hdr [9];
+
+    /*  A heartbeat can't be squeezed in between the pieces of a message.
+        Nor is there any point in queueing one if the peer isn't reading
+        what's queued already. */
+    if (nn_slow (self->pieces.outsize || nn_outq_full (&self->outq)))
+        return;
+
+    /*  The frame overtakes the messages not being written yet so that
+        the peer hears from us as soon as possible. */
+    nn_msg_init (&msg, NN_HEARTBEAT_SIZE);
+    nn_heartbeat_put (&self->heartbeat, nn_chunkref_data (&msg.body));
+    hdr [0] = NN_SIPC_MSG_HEARTBEAT;
+    nn_putll (hdr + 1, NN_HEARTBEAT_SIZE);
+    nn_outq_pushurgent (&self->outq, hdr, sizeof (hdr), &msg);
+    if (!nn_outq_busy (&self->outq))
+        nn_sipc_flush (self);
+}
+
+static size_t nn_sipc_queued (struct nn_pipebase *self)
+{
+    struct nn_sipc *sipc;
+
+    sipc = nn_cont (self, struct nn_sipc, pipebase);
+
+#if defined NN_HAVE_SHM
+    /*  The message waiting for space in the ring. */
+    if (sipc->shm)
+        return sipc->outstate == NN_SIPC_OUTSTATE_SENDING ? 1 : 0;
+#endif
+
+    return nn_outq_count (&sipc->outq) + nn_batch_count (&sipc->batch);
+}
+
+static void nn_sipc_disconnect (struct nn_pipebase *self)
+{
+    struct nn_sipc *sipc;
+
+    sipc = nn_cont (self, struct nn_sipc, pipebase);
+
+    /*  Handled the same way as a protocol error. The owner stops the object
+        once the error is delivered, which also removes the pipe from the
+        socket. */
+    if (sipc->state != NN_SIPC_STATE_ACTIVE)
+        return;
+    sipc->state = NN_SIPC_STATE_DONE;
+    nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+}
+
 static int nn_sipc_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
     struct nn_sipc *sipc;
 
     sipc = nn_cont (self, struct nn_sipc, pipebase);
 
     nn_assert_state (sipc, NN_SIPC_STATE_ACTIVE);
     nn_assert (sipc->instate == NN_SIPC_INSTATE_HASMSG);
+    nn_heartbeat_traffic (&sipc->heartbeat);
+
+#if defined NN_HAVE_SHM
+    if (sipc->shm)
+        return nn_sipc_shm_recv (sipc, msg);
+#endif
 
     /*  Move received message to the user. */
     nn_msg_mv (msg, &sipc->inmsg);
     nn_msg_init (&sipc->inmsg, 0);
 
-    /*  Start receiving new message. */
+    /*  The rest of a batch frame is handed over first. */
+    if (nn_batch_next (&sipc->batch, &sipc->inmsg)) {
+        sipc->inmsg.rcvtime = nn_clock_us ();
+        if (nn_slow (sipc->intstamp))
+            nn_msg_addtimestamp (&sipc->inmsg, sipc->intstamp);
+        nn_pipebase_received (&sipc->pipebase);
+        return 0;
+    }
+
+    /*  The next piece of the message follows straight away. */
+    if (nn_slow (nn_pieces_receiving (&sipc->pieces))) {
+        nn_sipc_recv_next (sipc);
+        return 0;
+    }
+
+    /*  Start receiving new message. If all of it is already in the batch
+        buffer, parse it straight away so that the pipe stays readable and
+        the messages in a batch don't have to travel through the state
+        machine one by one. */
     sipc->instate = NN_SIPC_INSTATE_HDR;
-    nn_usock_recv (sipc->usock, sipc->inhdr, sizeof (sipc->inhdr), NULL);
+    if (!nn_usock_tryrecv (sipc->usock, sipc->inhdr, sizeof (sipc->inhdr))) {
+        nn_usock_recv (sipc->usock, sipc->inhdr, sizeof (sipc->inhdr), NULL);
+        return 0;
+    }
+    rc = nn_sipc_recv_body (sipc);
+    if (nn_slow (rc < 0)) {
+        sipc->state = NN_SIPC_STATE_DONE;
+        nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+    }
+
+    return 0;
+}
+
+static int nn_sipc_recv_hdr (struct nn_sipc *self)
+{
+    uint64_t size;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+    int nfds;
+
+    /*  Message header was received. Check that message size is acceptable
+        by comparing with NN_RCVMAXSIZE; if it's too large, the caller is
+        expected to drop the connection. The same goes for a message of
+        unknown type, e.g. a shm peer connected to an ipc endpoint. */
+    size = nn_getll (self->inhdr + 1);
+    nfds = 0;
+    self->inalg = 0;
+    self->inbatch = 0;
+    if (nn_slow (self->rcvtstamp))
+        self->intstamp = nn_usock_rcvtimestamp (self->usock);
+    nn_heartbeat_received (&self->heartbeat);
+    if (nn_slow (self->inhdr [0] == NN_SIPC_MSG_HEARTBEAT)) {
+        if (nn_slow (self->shm || size != NN_HEARTBEAT_SIZE))
+            return -EPROTO;
+        self->inheartbeat = 1;
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, NN_HEARTBEAT_SIZE);
+        return 0;
+    }
+    if (nn_slow (self->inhdr [0] == NN_SIPC_MSG_BATCH)) {
+
+        /*  The messages of the frame are checked once it's received. */
+        if (nn_slow (self->shm || size > NN_BATCH_FRAMEMAX))
+            return -EPROTO;
+        self->inbatch = 1;
+    }
+    else if (nn_slow (self->inhdr [0] == NN_SIPC_MSG_COMPRESSED)) {
+        self->inalg = self->inhdr [1];
+        size &= 0x00ffffffffffffffULL;
+        if (nn_slow (self->shm || !self->inalg ||
+              (self->inalg & ~nn_compress_supported ()) != 0))
+            return -EPROTO;
+    }
+    else if (nn_slow (self->inhdr [0] != NN_SIPC_MSG_NORMAL)) {
+#if !defined NN_HAVE_WINDOWS
+        if (self->inhdr [0] != NN_SIPC_MSG_FDS)
+            return -EPROTO;
+        nfds = self->inhdr [1];
+        size &= 0x00ffffffffffffffULL;
+        if (nn_slow (nfds == 0 || nfds > NN_IPC_MAXFDS))
+            return -EPROTO;
+#else
+        return -EPROTO;
+#endif
+    }
+
+    /*  Message larger than NN_RCVPIECE is handed over in pieces, none of
+        which is subject to NN_RCVMAXSIZE. */
+    if (nn_slow (!self->inalg && !self->inbatch && !nfds && !self->shm)) {
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPIECE, &opt, &opt_sz);
+        if (nn_slow (nn_pieces_recvstart (&self->pieces, size,
+              (size_t) opt))) {
+            opt_sz = sizeof (opt);
+            nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+                NN_RCVPOOL, &opt, &opt_sz);
+            nn_pieces_recvnext (&self->pieces, &self->inmsg, opt);
+            return 0;
+        }
+    }
+
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVMAXSIZE, &opt, &opt_sz);
+
+    if (!self->inbatch && opt >= 0 && size > (unsigned)opt)
+        return -EMSGSIZE;
+
+    /*  Allocate memory for the message, from the message pool set by
+        NN_RCVPOOL option if any. Compressed message is decompressed into
+        memory from the pool once it's received, and so are the messages of
+        a batch frame copied. */
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVPOOL, &opt, &opt_sz);
+    nn_msg_term (&self->inmsg);
+    nn_msg_init_type (&self->inmsg, (size_t) size,
+        self->inalg || self->inbatch ? 0 : opt);
+
+#if !defined NN_HAVE_WINDOWS
+    if (nfds)
+        return nn_sipc_recvfds (self, nfds);
+#endif
+
+    return 0;
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+static int nn_sipc_dupfds (struct nn_msg *msg)
+{
+    int *fds;
+    int nfds;
+    int i;
+    struct nn_chunkref hdrs;
+    struct nn_cmsghdr *cmsg;
+    int *dups;
+
+    nfds = nn_msg_fds (msg, &fds);
+    if (nn_fast (nfds == 0))
+        return 0;
+
+    /*  The number of descriptors was checked by nn_sendmsg. The other
+        properties are of no use to the peer, so the headers are replaced
+        by the duplicates alone. */
+    nn_assert (nfds <= NN_IPC_MAXFDS);
+    nn_chunkref_init (&hdrs, NN_CMSG_SPACE (sizeof (int) * nfds));
+    cmsg = nn_chunkref_data (&hdrs);
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int) * nfds);
+    cmsg->cmsg_level = NN_IPC;
+    cmsg->cmsg_type = NN_IPC_FDS;
+    dups = (int*) NN_CMSG_DATA (cmsg);
+    for (i = 0; i != nfds; ++i) {
+        dups [i] = fcntl (fds [i], F_DUPFD_CLOEXEC, 0);
+        if (nn_slow (dups [i] < 0)) {
+            while (i--)
+                nn_closefd (dups [i]);
+            nn_chunkref_term (&hdrs);
+            return -errno;
+        }
+    }
+    nn_chunkref_term (&msg->hdrs);
+    nn_chunkref_mv (&msg->hdrs, &hdrs);
+
+    return nfds;
+}
+
+static int nn_sipc_recvfds (struct nn_sipc *self, int nfds)
+{
+    int i;
+    struct nn_cmsghdr *cmsg;
+    int *fds;
+
+    /*  The descriptors precede the message they arrived with, so all of
+        them should be there by now. */
+    nn_chunkref_term (&self->inmsg.hdrs);
+    nn_chunkref_init (&self->inmsg.hdrs,
+        NN_CMSG_SPACE (sizeof (int) * nfds));
+    cmsg = nn_chunkref_data (&self->inmsg.hdrs);
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int) * nfds);
+    cmsg->cmsg_level = NN_IPC;
+    cmsg->cmsg_type = NN_IPC_FDS;
+    fds = (int*) NN_CMSG_DATA (cmsg);
+    for (i = 0; i != nfds; ++i) {
+        fds [i] = nn_usock_recvfd (self->usock);
+        if (nn_slow (fds [i] < 0)) {
+            while (i--)
+                nn_closefd (fds [i]);
+            nn_chunkref_term (&self->inmsg.hdrs);
+            nn_chunkref_init (&self->inmsg.hdrs, 0);
+            return -EPROTO;
+        }
+    }
+
+    return 0;
+}
+
+static void nn_sipc_msgterm (struct nn_msg *msg)
+{
+    /*  Close the duplicates of the descriptors and of the file once
+        the message is sent or dropped. Other messages don't carry any. */
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0)) {
+        nn_msg_closefds (msg, 0);
+        nn_msg_closefile (msg);
+    }
+    nn_msg_term (msg);
+}
+
+#endif
+
+static int nn_sipc_recv_body (struct nn_sipc *self)
+{
+    int rc;
+
+    rc = nn_sipc_recv_hdr (self);
+    if (nn_slow (rc < 0))
+        return rc;
+    return nn_sipc_recv_msg (self);
+}
+
+static void nn_sipc_recv_next (struct nn_sipc *self)
+{
+    int rc;
+    int type;
+    size_t opt_sz;
+
+    opt_sz = sizeof (type);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVPOOL, &type, &opt_sz);
+    nn_pieces_recvnext (&self->pieces, &self->inmsg, type);
+    rc = nn_sipc_recv_msg (self);
+    errnum_assert (rc == 0, -rc);
+}
+
+static int nn_sipc_recv_msg (struct nn_sipc *self)
+{
+    size_t size;
+
+    size = nn_chunkref_size (&self->inmsg.body);
+
+    /*  If the body is empty or already fully buffered, the message is
+        complete. */
+    if (!size || nn_usock_tryrecv (self->usock,
+          nn_chunkref_data (&self->inmsg.body), size))
+        return nn_sipc_recv_done (self);
+
+    /*  Start receiving the message body. */
+    self->instate = NN_SIPC_INSTATE_BODY;
+    nn_usock_recv (self->usock, nn_chunkref_data (&self->inmsg.body),
+        size, NULL);
+
+    return 0;
+}
+
+static int nn_sipc_recv_done (struct nn_sipc *self)
+{
+    int rc;
+    int maxsize;
+    int type;
+    size_t opt_sz;
+
+    /*  Heartbeat only tells how often the peer sends them. It's not passed
+        to the user and the next message is received straight away. */
+    if (nn_slow (self->inheartbeat)) {
+        self->inheartbeat = 0;
+        rc = nn_heartbeat_get (&self->heartbeat,
+            nn_chunkref_data (&self->inmsg.body));
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, 0);
+        self->instate = NN_SIPC_INSTATE_HDR;
+        nn_usock_recv (self->usock, self->inhdr, sizeof (self->inhdr), NULL);
+        return 0;
+    }
+
+    /*  Decompress the message. If the original one is larger than allowed,
+        the caller is expected to drop the connection as well. */
+    if (nn_slow (self->inalg)) {
+        opt_sz = sizeof (maxsize);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVMAXSIZE, &maxsize, &opt_sz);
+        opt_sz = sizeof (type);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPOOL, &type, &opt_sz);
+        rc = nn_compress_decompress (&self->compress, self->inalg,
+            &self->inmsg.body, maxsize, type);
+        if (nn_slow (rc < 0))
+            return rc;
+        self->inalg = 0;
+    }
+
+    /*  Unpack the batch frame. Its first message is received straight
+        away, the others once the previous one is picked up. */
+    if (nn_slow (self->inbatch)) {
+        opt_sz = sizeof (maxsize);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVMAXSIZE, &maxsize, &opt_sz);
+        opt_sz = sizeof (type);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPOOL, &type, &opt_sz);
+        rc = nn_batch_open (&self->batch, &self->inmsg, maxsize, type);
+        if (nn_slow (rc < 0))
+            return rc;
+        self->inbatch = 0;
+        nn_batch_next (&self->batch, &self->inmsg);
+    }
+
+    /*  Notify the owner that it can receive the message. */
+    self->instate = NN_SIPC_INSTATE_HASMSG;
+    self->inmsg.rcvtime = nn_clock_us ();
+    if (nn_slow (self->intstamp))
+        nn_msg_addtimestamp (&self->inmsg, self->intstamp);
+    nn_pipebase_received (&self->pipebase);
+
+    return 0;
+}
+
+static int nn_sipc_activate (struct nn_sipc *self)
+{
+    int rc;
+    int opt;
+    int idle;
+    size_t opt_sz = sizeof (opt);
+    size_t maxmsgs;
+    int alg;
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Let the kernel send the file regions attached to the messages if
+        it's able to. Otherwise, they are read into the messages beforehand,
+        as is the case with the SOCK_SEQPACKET sockets, the records of which
+        are set up below. */
+    if (!self->shm) {
+        nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_SEQPACKET,
+            &opt, &opt_sz);
+        nn_pipebase_setsendfile (&self->pipebase,
+            !opt && nn_usock_cansendfile (self->usock));
+    }
+#endif
+
+    /*  Messages can be passed in pieces, except through the shared
+        memory. */
+    nn_pipebase_setpieces (&self->pipebase, !self->shm);
+
+    /*  Start the pipe. */
+    rc = nn_pipebase_start (&self->pipebase);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Mark the pipe as available for sending. */
+    self->outstate = NN_SIPC_OUTSTATE_IDLE;
+
+    self->instate = NN_SIPC_INSTATE_HDR;
+    self->state = NN_SIPC_STATE_ACTIVE;
+
+#if defined NN_HAVE_SHM
+    if (self->shm) {
+
+        /*  Wait for wake-ups from the peer and pick up whatever it may have
+            written into the ring already. */
+        nn_usock_recv (self->usock, &self->bellin, 1, NULL);
+        self->inpos = 0;
+        return nn_sipc_shm_read (self);
+    }
+#endif
+
+    /*  Let the batch buffer grow as configured. */
+    nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_RCVBATCH,
+        &opt, &opt_sz);
+    nn_usock_setbatch (self->usock, (size_t) opt);
+
+    /*  Have the messages carry the time the kernel received them, if asked
+        to and supported. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_RCVTIMESTAMP,
+        &opt, &opt_sz);
+    self->rcvtstamp = opt && nn_usock_settimestamps (self->usock) == 0;
+
+#if !defined NN_HAVE_WINDOWS
+    /*  On a SOCK_SEQPACKET socket the writes are split into records. The
+        kernel refuses a record that doesn't fit into the send buffer. */
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_SEQPACKET,
+        &opt, &opt_sz);
+    if (opt) {
+        opt_sz = sizeof (opt);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_SNDBUF,
+            &opt, &opt_sz);
+        if (opt > NN_USOCK_RECORD_MAX)
+            opt = NN_USOCK_RECORD_MAX;
+        if (opt < NN_SIPC_RECORD_MIN)
+            opt = NN_SIPC_RECORD_MIN;
+        nn_usock_setrecords (self->usock, (size_t) opt);
+    }
+#endif
+
+    /*  Let the messages that don't fit into the batch wait in the backlog,
+        if asked to. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_SNDQUEUE_MSGS,
+        &opt, &opt_sz);
+    maxmsgs = (size_t) opt;
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_SNDQUEUE_BYTES,
+        &opt, &opt_sz);
+    nn_outq_setlimits (&self->outq, maxmsgs, (size_t) opt);
+
+    /*  Compress the messages if asked to and the peer is able to
+        decompress them. */
+    nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_COMPRESS,
+        &alg, &opt_sz);
+    nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_COMPRESS_THRESHOLD,
+        &opt, &opt_sz);
+    nn_compress_start (&self->compress, alg, (size_t) opt,
+        self->streamhdr.peeralgs);
+
+    /*  Pack small messages into batch frames if asked to and the peer is
+        able to unpack them. */
+    nn_pipebase_getopt (&self->pipebase, NN_IPC, NN_IPC_BATCH,
+        &opt, &opt_sz);
+    nn_batch_start (&self->batch, (size_t) opt, self->streamhdr.peerflags);
+
+    /*  Start receiving a message in asynchronous manner. */
+    nn_usock_recv (self->usock, &self->inhdr, sizeof (self->inhdr), NULL);
+
+    /*  Start sending heartbeats if asked to, letting the peer know how
+        often to expect them, and watch for the connection going idle.
+        Peers sharing memory are not watched that way. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_IDLE_TIMEOUT,
+        &idle, &opt_sz);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_HEARTBEAT_IVL,
+        &opt, &opt_sz);
+    if (nn_heartbeat_start (&self->heartbeat, opt,
+          self->streamhdr.peerflags & NN_STREAMHDR_CANHEARTBEAT ? 1 : 0,
+          idle) == NN_HEARTBEAT_SEND)
+        nn_sipc_heartbeat (self);
 
     return 0;
 }
@@ -185,14 +949,40 @@ static void nn_sipc_shutdown (struct nn_fsm *self, int src, int type,
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
         nn_pipebase_stop (&sipc->pipebase);
         nn_streamhdr_stop (&sipc->streamhdr);
+        nn_heartbeat_stop (&sipc->heartbeat);
         sipc->state = NN_SIPC_STATE_STOPPING;
     }
     if (nn_slow (sipc->state == NN_SIPC_STATE_STOPPING)) {
-        if (nn_streamhdr_isidle (&sipc->streamhdr)) {
+        if (nn_streamhdr_isidle (&sipc->streamhdr) &&
+              nn_heartbeat_isidle (&sipc->heartbeat)) {
             nn_usock_swap_owner (sipc->usock, &sipc->usock_owner);
             sipc->usock = NULL;
             sipc->usock_owner.src = -1;
             sipc->usock_owner.fsm = NULL;
+
+            /*  The connection may have broken in the middle of a write.
+                Drop whatever is left so that the queue starts afresh if
+                the state machine is started again. */
+            nn_outq_term (&sipc->outq);
+            nn_outq_init (&sipc->outq);
+#if !defined NN_HAVE_WINDOWS
+            nn_outq_setdtor (&sipc->outq, nn_sipc_msgterm);
+#endif
+            nn_batch_reset (&sipc->batch);
+            sipc->inbatch = 0;
+            nn_pieces_reset (&sipc->pieces);
+            sipc->inheartbeat = 0;
+
+            /*  So does a message received only in part, or not picked up
+                by the pipe, along with its descriptors. */
+            nn_msg_closefds (&sipc->inmsg, 0);
+            nn_msg_term (&sipc->inmsg);
+            nn_msg_init (&sipc->inmsg, 0);
+#if defined NN_HAVE_SHM
+            if (sipc->shm)
+                nn_sipc_shm_close (sipc);
+#endif
+
             sipc->state = NN_SIPC_STATE_IDLE;
             nn_fsm_stopped (&sipc->fsm, NN_SIPC_STOPPED);
             return;
@@ -208,12 +998,27 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
 {
     int rc;
     struct nn_sipc *sipc;
-    uint64_t size;
-    int opt;
-    size_t opt_sz = sizeof (opt);
 
     sipc = nn_cont (self, struct nn_sipc, fsm);
 
+    /*  Send a heartbeat if the connection was quiet, or drop it if the peer
+        is gone or if no messages were passed for too long. Once the
+        connection is broken, the timer is just left to wind down. */
+    if (src == NN_SIPC_SRC_HEARTBEAT) {
+        rc = nn_heartbeat_event (&sipc->heartbeat, type,
+            sipc->state == NN_SIPC_STATE_ACTIVE &&
+            sipc->instate == NN_SIPC_INSTATE_HDR);
+        if (sipc->state != NN_SIPC_STATE_ACTIVE)
+            return;
+        if (rc == NN_HEARTBEAT_SEND)
+            nn_sipc_heartbeat (sipc);
+        else if (rc == NN_HEARTBEAT_DEAD || rc == NN_HEARTBEAT_IDLE) {
+            nn_pipebase_stop (&sipc->pipebase);
+            sipc->state = NN_SIPC_STATE_DONE;
+            nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+        }
+        return;
+    }
 
     switch (sipc->state) {
 
@@ -227,7 +1032,9 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_FSM_START:
                 nn_streamhdr_start (&sipc->streamhdr, sipc->usock,
-                    &sipc->pipebase);
+                    &sipc->pipebase, sipc->shm ? 0 :
+                    NN_STREAMHDR_CANBATCH | NN_STREAMHDR_CANHEARTBEAT,
+                    sipc->shm ? 0 : nn_compress_supported ());
                 sipc->state = NN_SIPC_STATE_PROTOHDR;
                 return;
             default:
@@ -280,32 +1087,90 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_STREAMHDR_STOPPED:
 
-                 /*  Start the pipe. */
-                 rc = nn_pipebase_start (&sipc->pipebase);
+#if defined NN_HAVE_SHM
+                 /*  In shared memory mode, the rings have to be set up
+                     before the pipe can be started. */
+                 if (sipc->shm) {
+                     rc = nn_sipc_shm_setup (sipc);
+                     if (nn_slow (rc < 0)) {
+                         sipc->state = NN_SIPC_STATE_DONE;
+                         nn_fsm_raise (&sipc->fsm, &sipc->done,
+                             NN_SIPC_ERROR);
+                         return;
+                     }
+                     sipc->state = NN_SIPC_STATE_SHMSETUP;
+                     return;
+                 }
+#endif
+
+                 rc = nn_sipc_activate (sipc);
                  if (nn_slow (rc < 0)) {
                     sipc->state = NN_SIPC_STATE_DONE;
                     nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
-                    return;
                  }
+                 return;
 
-                 /*  Start receiving a message in asynchronous manner. */
-                 sipc->instate = NN_SIPC_INSTATE_HDR;
-                 nn_usock_recv (sipc->usock, &sipc->inhdr,
-                     sizeof (sipc->inhdr), NULL);
+            default:
+                nn_fsm_bad_action (sipc->state, src, type);
+            }
 
-                 /*  Mark the pipe as available for sending. */
-                 sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
+        default:
+            nn_fsm_bad_source (sipc->state, src, type);
+        }
 
-                 sipc->state = NN_SIPC_STATE_ACTIVE;
-                 return;
+#if defined NN_HAVE_SHM
+/******************************************************************************/
+/*  SHMSETUP state.                                                           */
+/*  Description of the local ring is being sent to the peer and that of the   */
+/*  peer's ring is being received.                                            */
+/******************************************************************************/
+    case NN_SIPC_STATE_SHMSETUP:
+        switch (src) {
+
+        case NN_SIPC_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SENT:
+                sipc->shmsetup |= NN_SIPC_SHMSETUP_SENT;
+                break;
+
+            case NN_USOCK_RECEIVED:
+                rc = nn_sipc_shm_open (sipc);
+                if (nn_slow (rc < 0)) {
+                    sipc->state = NN_SIPC_STATE_DONE;
+                    nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+                    return;
+                }
+                sipc->shmsetup |= NN_SIPC_SHMSETUP_RECEIVED;
+                break;
+
+            case NN_USOCK_SHUTDOWN:
+                sipc->state = NN_SIPC_STATE_SHUTTING_DOWN;
+                return;
+
+            case NN_USOCK_ERROR:
+                sipc->state = NN_SIPC_STATE_DONE;
+                nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+                return;
 
             default:
                 nn_fsm_bad_action (sipc->state, src, type);
             }
 
+            /*  Once both rings are mapped, start passing messages. */
+            if (sipc->shmsetup ==
+                  (NN_SIPC_SHMSETUP_SENT | NN_SIPC_SHMSETUP_RECEIVED)) {
+                rc = nn_sipc_activate (sipc);
+                if (nn_slow (rc < 0)) {
+                    sipc->state = NN_SIPC_STATE_DONE;
+                    nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+                }
+            }
+            return;
+
         default:
             nn_fsm_bad_source (sipc->state, src, type);
         }
+#endif
 
 /******************************************************************************/
 /*  ACTIVE state.                                                             */
@@ -317,60 +1182,80 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
 
-                /*  The message is now fully sent. */
-                nn_assert (sipc->outstate == NN_SIPC_OUTSTATE_SENDING);
-                sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
-                nn_msg_term (&sipc->outmsg);
-                nn_msg_init (&sipc->outmsg, 0);
-                nn_pipebase_sent (&sipc->pipebase);
+#if defined NN_HAVE_SHM
+                /*  Wake-up byte was sent. Send the next one, if needed. */
+                if (sipc->shm) {
+                    sipc->bellbusy = 0;
+                    if (sipc->bellpending) {
+                        sipc->bellpending = 0;
+                        nn_sipc_shm_ring (sipc);
+                    }
+                    return;
+                }
+#endif
+
+                /*  The batch is now fully sent. Send the messages queued in
+                    the meantime, if any, in a single write. */
+                nn_outq_done (&sipc->outq);
+                nn_sipc_pushbatch (sipc);
+                if (nn_outq_haspending (&sipc->outq))
+                    nn_sipc_flush (sipc);
+                else
+                    nn_pipebase_drained (&sipc->pipebase);
+
+                /*  If the pipe was waiting for space in the queue, it can
+                    accept messages again. */
+                if (sipc->outstate == NN_SIPC_OUTSTATE_SENDING &&
+                      !nn_outq_full (&sipc->outq)) {
+                    sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
+                    nn_pipebase_sent (&sipc->pipebase);
+                }
                 return;
 
             case NN_USOCK_RECEIVED:
 
+#if defined NN_HAVE_SHM
+                /*  The peer has made progress. Several wake-ups may have
+                    been received at once; one is enough to check both rings
+                    for data and space. */
+                if (sipc->shm) {
+                    while (nn_usock_tryrecv (sipc->usock, &sipc->bellin, 1))
+                        ;
+                    nn_usock_recv (sipc->usock, &sipc->bellin, 1, NULL);
+                    if (sipc->outstate == NN_SIPC_OUTSTATE_SENDING &&
+                          nn_sipc_shm_write (sipc)) {
+                        sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
+                        nn_pipebase_sent (&sipc->pipebase);
+                    }
+                    if (sipc->instate != NN_SIPC_INSTATE_HASMSG) {
+                        rc = nn_sipc_shm_read (sipc);
+                        if (nn_slow (rc < 0)) {
+                            sipc->state = NN_SIPC_STATE_DONE;
+                            nn_fsm_raise (&sipc->fsm, &sipc->done,
+                                NN_SIPC_ERROR);
+                        }
+                    }
+                    return;
+                }
+#endif
+
                 switch (sipc->instate) {
                 case NN_SIPC_INSTATE_HDR:
-
-                    /*  Message header was received. Check that message size
-                        is acceptable by comparing with NN_RCVMAXSIZE;
-                        if it's too large, drop the connection. */
-                    nn_assert (sipc->inhdr [0] == NN_SIPC_MSG_NORMAL);
-                    size = nn_getll (sipc->inhdr + 1);
-
-                    nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
-                        NN_RCVMAXSIZE, &opt, &opt_sz);
-
-                    if (opt >= 0 && size > (unsigned)opt) {
+                    rc = nn_sipc_recv_body (sipc);
+                    if (nn_slow (rc < 0)) {
                         sipc->state = NN_SIPC_STATE_DONE;
                         nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
-                        return;
                     }
-
-                    /*  Allocate memory for the message. */
-                    nn_msg_term (&sipc->inmsg);
-                    nn_msg_init (&sipc->inmsg, (size_t) size);
-
-                    /*  Special case when size of the message body is 0. */
-                    if (!size) {
-                        sipc->instate = NN_SIPC_INSTATE_HASMSG;
-                        nn_pipebase_received (&sipc->pipebase);
-                        return;
-                    }
-
-                    /*  Start receiving the message body. */
-                    sipc->instate = NN_SIPC_INSTATE_BODY;
-                    nn_usock_recv (sipc->usock,
-                        nn_chunkref_data (&sipc->inmsg.body),
-                        (size_t) size, NULL);
-
                     return;
 
                 case NN_SIPC_INSTATE_BODY:
 
-                    /*  Message body was received. Notify the owner that it
-                        can receive it. */
-                    sipc->instate = NN_SIPC_INSTATE_HASMSG;
-                    nn_pipebase_received (&sipc->pipebase);
-
+                    /*  Message body was received. */
+                    rc = nn_sipc_recv_done (sipc);
+                    if (nn_slow (rc < 0)) {
+                        sipc->state = NN_SIPC_STATE_DONE;
+                        nn_fsm_raise (&sipc->fsm, &sipc->done, NN_SIPC_ERROR);
+                    }
                     return;
 
                 default:
@@ -435,3 +1320,396 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
         nn_fsm_bad_state (sipc->state, src, type);
     }
 }
+
+#if defined NN_HAVE_SHM
+
+static int nn_sipc_shm_setup (struct nn_sipc *self)
+{
+    int rc;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+    struct nn_iovec iov;
+
+    /*  Create the ring for outbound messages. */
+    nn_pipebase_getopt (&self->pipebase, NN_SHM, NN_SHM_BUFSZ,
+        &opt, &opt_sz);
+    rc = nn_shmring_create (&self->txring, (size_t) opt);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Tell the peer where to find it. */
+    memset (self->shmout, 0, sizeof (self->shmout));
+    self->shmout [0] = NN_SIPC_MSG_SHMEM;
+    nn_putll (self->shmout + 1, self->txring.size);
+    memcpy (self->shmout + 9, self->txring.name, strlen (self->txring.name));
+    iov.iov_base = self->shmout;
+    iov.iov_len = sizeof (self->shmout);
+    nn_usock_send (self->usock, &iov, 1);
+
+    /*  Start receiving the description of the peer's ring. */
+    nn_usock_recv (self->usock, self->shmin, sizeof (self->shmin), NULL);
+
+    self->shmsetup = 0;
+    self->bellbusy = 0;
+    self->bellpending = 0;
+
+    return 0;
+}
+
+static int nn_sipc_shm_open (struct nn_sipc *self)
+{
+    int rc;
+    uint64_t size;
+    char name [NN_SHMRING_NAMELEN];
+
+    if (nn_slow (self->shmin [0] != NN_SIPC_MSG_SHMEM))
+        return -EPROTO;
+    size = nn_getll (self->shmin + 1);
+    if (nn_slow (size > NN_SHMRING_MAXSIZE))
+        return -EPROTO;
+    memcpy (name, self->shmin + 9, sizeof (name));
+    name [sizeof (name) - 1] = 0;
+
+    rc = nn_shmring_open (&self->rxring, name, (size_t) size);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Both sides have the segment mapped now. Remove the name, so that the
+        memory is released by the system once the connection is closed,
+        whatever way the processes terminate. */
+    nn_shmring_unlink (&self->rxring);
+
+    self->instate = NN_SIPC_INSTATE_HDR;
+    self->inpos = 0;
+
+    return 0;
+}
+
+static void nn_sipc_shm_close (struct nn_sipc *self)
+{
+    int progress;
+
+    /*  Messages left in the inbound ring may carry references to chunks
+        handed over by the peer. Release them, so that they don't stay
+        allocated in the peer's arena forever. */
+    if (self->rxring.hdr) {
+        if (self->instate == NN_SIPC_INSTATE_HASMSG) {
+            self->instate = NN_SIPC_INSTATE_HDR;
+            self->inpos = 0;
+        }
+        while (nn_sipc_shm_readmsg (self, &progress) == 1) {
+            self->instate = NN_SIPC_INSTATE_HDR;
+            self->inpos = 0;
+        }
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, 0);
+    }
+
+    nn_shmring_close (&self->txring);
+    nn_shmring_close (&self->rxring);
+
+    /*  Drop the message that may have been written only partially. */
+    nn_msg_term (&self->outmsg);
+    nn_msg_init (&self->outmsg, 0);
+}
+
+static int nn_sipc_shm_send (struct nn_sipc *self, struct nn_msg *msg)
+{
+    const char *name;
+    uint64_t offset;
+    size_t sphdrsz;
+
+    nn_msg_mv (&self->outmsg, msg);
+    self->outpos = 0;
+
+    /*  If the body is a chunk in shared memory owned solely by this message,
+        pass just the reference to it, along with the SP header. */
+    sphdrsz = nn_chunkref_size (&self->outmsg.sphdr);
+    self->outchunk = self->outmsg.nparts == 0 &&
+        sphdrsz <= NN_SIPC_SPHDR_MAX &&
+        nn_chunkref_ischunk (&self->outmsg.body) &&
+        nn_chunk_shmhandle (nn_chunkref_data (&self->outmsg.body),
+        &name, &offset) == 0;
+    if (self->outchunk) {
+        self->outhdr [0] = NN_SIPC_MSG_SHMCHUNK;
+        nn_putll (self->outhdr + 1, sizeof (self->outrec) + sphdrsz);
+        memset (self->outrec, 0, sizeof (self->outrec));
+        nn_putll (self->outrec, offset);
+        nn_putll (self->outrec + 8, nn_chunkref_size (&self->outmsg.body));
+        memcpy (self->outrec + 16, name, strlen (name));
+    }
+    else {
+        self->outhdr [0] = NN_SIPC_MSG_NORMAL;
+        nn_putll (self->outhdr + 1, sphdrsz + nn_msg_bodysize (&self->outmsg));
+    }
+
+    /*  If the whole message fits into the ring, the pipe remains writable.
+        Otherwise the rest of it will be written once the peer makes some
+        space. */
+    if (nn_fast (nn_sipc_shm_write (self))) {
+        nn_pipebase_sent (&self->pipebase);
+        return 0;
+    }
+    self->outstate = NN_SIPC_OUTSTATE_SENDING;
+
+    return 0;
+}
+
+static int nn_sipc_shm_recv (struct nn_sipc *self, struct nn_msg *msg)
+{
+    int rc;
+    int parsed;
+
+    /*  Messages passed by reference have the SP header already split from
+        the body. */
+    parsed = self->inchunk ? NN_PIPEBASE_PARSED : 0;
+    nn_msg_mv (msg, &self->inmsg);
+    nn_msg_init (&self->inmsg, 0);
+
+    /*  Read the next message straight away if it's already in the ring. */
+    self->instate = NN_SIPC_INSTATE_HDR;
+    self->inpos = 0;
+    rc = nn_sipc_shm_read (self);
+    if (nn_slow (rc < 0)) {
+        self->state = NN_SIPC_STATE_DONE;
+        nn_fsm_raise (&self->fsm, &self->done, NN_SIPC_ERROR);
+    }
+
+    return parsed;
+}
+
+/*  Writes as much of the outbound message into the ring as possible.
+    Returns 1 if the message was written completely, 0 otherwise. */
+static int nn_sipc_shm_write (struct nn_sipc *self)
+{
+    struct nn_iovec iov [3 + NN_MSG_MAXPARTS];
+    int iovcnt;
+    int i;
+    int waiting;
+    size_t pos;
+    size_t len;
+    size_t nbytes;
+    size_t written;
+
+    iov [0].iov_base = self->outhdr;
+    iov [0].iov_len = sizeof (self->outhdr);
+    if (self->outchunk) {
+        iov [1].iov_base = self->outrec;
+        iov [1].iov_len = sizeof (self->outrec);
+        iov [2].iov_base = nn_chunkref_data (&self->outmsg.sphdr);
+        iov [2].iov_len = nn_chunkref_size (&self->outmsg.sphdr);
+        iovcnt = 3;
+    }
+    else {
+        iov [1].iov_base = nn_chunkref_data (&self->outmsg.sphdr);
+        iov [1].iov_len = nn_chunkref_size (&self->outmsg.sphdr);
+        iov [2].iov_base = nn_chunkref_data (&self->outmsg.body);
+        iov [2].iov_len = nn_chunkref_size (&self->outmsg.body);
+        iovcnt = 3;
+        for (i = 0; i != self->outmsg.nparts; ++i) {
+            iov [iovcnt].iov_base = self->outmsg.parts [i];
+            iov [iovcnt].iov_len = nn_chunk_size (self->outmsg.parts [i]);
+            ++iovcnt;
+        }
+    }
+
+    waiting = 0;
+    while (1) {
+
+        /*  Skip the part of the message written so far and copy as much
+            of the rest as fits. */
+        pos = self->outpos;
+        written = 0;
+        for (i = 0; i != iovcnt; ++i) {
+            if (pos >= iov [i].iov_len) {
+                pos -= iov [i].iov_len;
+                continue;
+            }
+            len = iov [i].iov_len - pos;
+            nbytes = nn_shmring_write (&self->txring,
+                ((uint8_t*) iov [i].iov_base) + pos, len);
+            written += nbytes;
+            if (nbytes < len)
+                break;
+            pos = 0;
+        }
+        self->outpos += written;
+
+        if (written && nn_shmring_rxwake (&self->txring))
+            nn_sipc_shm_ring (self);
+
+        if (i == iovcnt) {
+            if (waiting)
+                nn_shmring_txdone (&self->txring);
+
+            /*  The reference to the chunk now belongs to the peer. */
+            if (self->outchunk)
+                nn_chunkref_getchunk (&self->outmsg.body);
+            nn_msg_term (&self->outmsg);
+            nn_msg_init (&self->outmsg, 0);
+            return 1;
+        }
+
+        /*  The ring is full. Ask the peer to wake us up once it makes some
+            space and check once more in case it did so in the meantime. */
+        if (waiting && !written)
+            return 0;
+        if (!waiting) {
+            nn_shmring_txwait (&self->txring);
+            waiting = 1;
+        }
+    }
+}
+
+/*  Reads the inbound message from the ring. When it is complete, the owner
+    is notified that it can receive it. */
+static int nn_sipc_shm_read (struct nn_sipc *self)
+{
+    int rc;
+    int waiting;
+    int progress;
+
+    waiting = 0;
+    while (1) {
+        rc = nn_sipc_shm_readmsg (self, &progress);
+        if (nn_slow (rc < 0))
+            return rc;
+
+        if (progress && nn_shmring_txwake (&self->rxring))
+            nn_sipc_shm_ring (self);
+
+        if (rc == 1) {
+            if (waiting)
+                nn_shmring_rxdone (&self->rxring);
+            self->instate = NN_SIPC_INSTATE_HASMSG;
+            self->inmsg.rcvtime = nn_clock_us ();
+            nn_pipebase_received (&self->pipebase);
+            return 0;
+        }
+
+        /*  The ring is empty. Ask the peer to wake us up once it writes
+            more data and check once more in case it did so already. */
+        if (waiting && !progress)
+            return 0;
+        if (!waiting) {
+            nn_shmring_rxwait (&self->rxring);
+            waiting = 1;
+        }
+    }
+}
+
+/*  Reads whatever is available of the inbound message. Returns 1 if the
+    message is complete, 0 if the ring ran out of data. 'progress' is set
+    if anything was read. */
+static int nn_sipc_shm_readmsg (struct nn_sipc *self, int *progress)
+{
+    int rc;
+    uint8_t *buf;
+    size_t len;
+    size_t nbytes;
+    uint64_t size;
+
+    *progress = 0;
+    while (1) {
+        if (self->instate == NN_SIPC_INSTATE_HDR) {
+            buf = self->inhdr;
+            len = sizeof (self->inhdr);
+        }
+        else {
+            buf = nn_chunkref_data (&self->inmsg.body);
+            len = nn_chunkref_size (&self->inmsg.body);
+        }
+
+        nbytes = nn_shmring_read (&self->rxring, buf + self->inpos,
+            len - self->inpos);
+        self->inpos += nbytes;
+        if (nbytes)
+            *progress = 1;
+        if (self->inpos < len)
+            return 0;
+
+        if (self->instate == NN_SIPC_INSTATE_BODY)
+            return self->inchunk ? nn_sipc_shm_chunk (self) : 1;
+
+        /*  Header is complete. Continue with the body, which in case of
+            a message passed by reference is the record describing it. */
+        self->inchunk = self->inhdr [0] == NN_SIPC_MSG_SHMCHUNK;
+        if (self->inchunk) {
+            size = nn_getll (self->inhdr + 1);
+            if (nn_slow (size < NN_SIPC_SHMCHUNK_LEN ||
+                  size > NN_SIPC_SHMCHUNK_LEN + NN_SIPC_SPHDR_MAX))
+                return -EPROTO;
+            nn_msg_term (&self->inmsg);
+            nn_msg_init (&self->inmsg, (size_t) size);
+        }
+        else {
+            rc = nn_sipc_recv_hdr (self);
+            if (nn_slow (rc < 0))
+                return rc;
+        }
+        self->instate = NN_SIPC_INSTATE_BODY;
+        self->inpos = 0;
+    }
+}
+
+/*  Replaces the record describing a message passed by reference with the
+    message itself. */
+static int nn_sipc_shm_chunk (struct nn_sipc *self)
+{
+    int rc;
+    uint8_t *rec;
+    uint64_t offset;
+    uint64_t size;
+    size_t sphdrsz;
+    char name [NN_SHMARENA_NAMELEN];
+    void *chunk;
+    struct nn_msg msg;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+
+    rec = nn_chunkref_data (&self->inmsg.body);
+    offset = nn_getll (rec);
+    size = nn_getll (rec + 8);
+    memcpy (name, rec + 16, sizeof (name));
+    name [sizeof (name) - 1] = 0;
+    rc = nn_chunk_shmopen (name, offset, (size_t) size, &chunk);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    nn_msg_init_chunk (&msg, chunk);
+    sphdrsz = nn_chunkref_size (&self->inmsg.body) - NN_SIPC_SHMCHUNK_LEN;
+    nn_chunkref_term (&msg.sphdr);
+    nn_chunkref_init (&msg.sphdr, sphdrsz);
+    memcpy (nn_chunkref_data (&msg.sphdr), rec + NN_SIPC_SHMCHUNK_LEN,
+        sphdrsz);
+    nn_msg_term (&self->inmsg);
+    nn_msg_mv (&self->inmsg, &msg);
+
+    /*  The chunk is owned by this side now and is released along with the
+        message if it can't be accepted. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVMAXSIZE, &opt, &opt_sz);
+    if (opt >= 0 && size + sphdrsz > (unsigned) opt)
+        return -EMSGSIZE;
+
+    return 1;
+}
+
+static void nn_sipc_shm_ring (struct nn_sipc *self)
+{
+    struct nn_iovec iov;
+
+    /*  Only one byte is sent at a time. It's enough to send one more once
+        it's done, however many wake-ups were requested in the meantime. */
+    if (self->bellbusy) {
+        self->bellpending = 1;
+        return;
+    }
+    self->bellout = 0;
+    iov.iov_base = &self->bellout;
+    iov.iov_len = 1;
+    nn_usock_send (self->usock, &iov, 1);
+    self->bellbusy = 1;
+}
+
+#endif
@@ -30,11 +30,47 @@
 #include "../../aio/usock.h"
 
 #include "../utils/streamhdr.h"
+#include "../utils/outq.h"
+#include "../utils/compress.h"
+#include "../utils/batch.h"
+#include "../utils/pieces.h"
+#include "../utils/heartbeat.h"
+#if defined NN_HAVE_SHM
+#include "../utils/shmring.h"
+#include "../../utils/shmarena.h"
+#endif
 
 #include "../../utils/msg.h"
 
 /*  This state machine handles IPC connection from the point where it is
-    established to the point when it is broken. */
+    established to the point when it is broken.
+
+    In shared memory mode, used by the shm transport, each side creates
+    a ring for the messages it sends and passes its name to the peer once
+    the protocol header is exchanged. From then on, messages are copied
+    through the rings and the socket only carries single-byte wake-ups for
+    the side that waits for data or space in a ring.
+
+    A message whose body was allocated as NN_SHM and is not shared with any
+    other message isn't copied at all. Only its offset in the sender's arena
+    is passed and the ownership of the chunk moves to the receiver.
+
+    File descriptors attached to a message by an NN_IPC_FDS property are
+    duplicated when the message is queued and passed to the peer along
+    with the write carrying the message, which is never coalesced with
+    another message carrying descriptors. The receiver picks them up from
+    the socket in the order of arrival once it parses the message header
+    that announces them. Neither those messages nor the ones passed through
+    shared memory are compressed or packed into batch frames. */
+
+/*  Size of the record describing a ring: message header followed by the
+    name of the segment. */
+#define NN_SIPC_SHMREC_LEN (9 + NN_SHMRING_NAMELEN)
+
+/*  Size of the record describing a message passed by reference: offset of
+    the chunk data, size of the body and the name of the arena. The SP
+    header of the message follows the record. */
+#define NN_SIPC_SHMCHUNK_LEN (16 + NN_SHMARENA_NAMELEN)
 
 #define NN_SIPC_ERROR 1
 #define NN_SIPC_STOPPED 2
@@ -66,21 +102,81 @@ struct nn_sipc {
     /*  Message being received at the moment. */
     struct nn_msg inmsg;
 
+    /*  Compression of the messages and the algorithm the message being
+        received is compressed with, 0 if it's not. */
+    struct nn_compress compress;
+    int inalg;
+
+    /*  Small messages packed into batch frames and the frames received,
+        along with a flag set if the message being received is one. */
+    struct nn_batch batch;
+    int inbatch;
+
+    /*  Messages sent and received in pieces. */
+    struct nn_pieces pieces;
+
+    /*  Heartbeats exchanged with the peer, along with a flag set if
+        the frame being received is one. */
+    struct nn_heartbeat heartbeat;
+    int inheartbeat;
+
+    /*  1 if the messages are to carry the time the kernel received them,
+        along with that time for the frame being received. */
+    int rcvtstamp;
+    uint64_t intstamp;
+
     /*  State of the outbound state machine. */
     int outstate;
 
-    /*  Buffer used to store the header of outgoing message. */
-    uint8_t outhdr [9];
+    /*  Messages being sent at the moment and those waiting to be sent. */
+    struct nn_outq outq;
+
+    /*  1 if the messages are passed through shared memory. */
+    int shm;
+
+#if defined NN_HAVE_SHM
 
-    /*  Message being sent at the moment. */
+    /*  Ring for outbound messages, created by this side, and the one for
+        inbound messages, created by the peer. */
+    struct nn_shmring txring;
+    struct nn_shmring rxring;
+
+    /*  Records describing the rings, exchanged during the setup. */
+    uint8_t shmout [NN_SIPC_SHMREC_LEN];
+    uint8_t shmin [NN_SIPC_SHMREC_LEN];
+    int shmsetup;
+
+    /*  Message being written into the ring, its header and the number of
+        bytes written so far. */
     struct nn_msg outmsg;
+    uint8_t outhdr [9];
+    size_t outpos;
+
+    /*  Set if the outbound message is passed by reference, in which case
+        the record describing it is stored in 'outrec'. */
+    int outchunk;
+    uint8_t outrec [NN_SIPC_SHMCHUNK_LEN];
+
+    /*  Set if the inbound message is passed by reference. */
+    int inchunk;
+
+    /*  Number of bytes of the inbound message header or body read so far. */
+    size_t inpos;
+
+    /*  Wake-up bytes. 'bellbusy' is set while one is being sent and
+        'bellpending' if another one has to be sent after it. */
+    uint8_t bellout;
+    uint8_t bellin;
+    int bellbusy;
+    int bellpending;
+#endif
 
     /*  Event raised when the state machine ends. */
     struct nn_fsm_event done;
 };
 
 void nn_sipc_init (struct nn_sipc *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner);
+    struct nn_ep *ep, int shm, struct nn_fsm *owner);
 void nn_sipc_term (struct nn_sipc *self);
 
 int nn_sipc_isidle (struct nn_sipc *self);
@@ -0,0 +1,192 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_HAVE_RDMA
+
+#include "rdma.h"
+
+#include "../../rdma.h"
+
+#include "../tcp/btcp.h"
+#include "../tcp/ctcp.h"
+#include "../utils/verbs.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/list.h"
+#include "../../utils/cont.h"
+
+#include <string.h>
+
+/*  The rdma transport uses the TCP state machines to establish connections.
+    Once the protocol header is exchanged, each side creates a reliable
+    connected queue pair and passes the description of it to the peer over
+    the TCP connection. From then on, messages are passed through the queue
+    pairs and the TCP connection is only used to detect that the peer has
+    gone away. */
+
+/*  rdma-specific socket options. */
+struct nn_rdma_optset {
+    struct nn_optset base;
+    int bufsz;
+    int bufs;
+    int gididx;
+};
+
+static void nn_rdma_optset_destroy (struct nn_optset *self);
+static int nn_rdma_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_rdma_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_rdma_optset_vfptr = {
+    nn_rdma_optset_destroy,
+    nn_rdma_optset_setopt,
+    nn_rdma_optset_getopt
+};
+
+/*  nn_transport interface. */
+static int nn_rdma_bind (struct nn_ep *ep);
+static int nn_rdma_connect (struct nn_ep *ep);
+static struct nn_optset *nn_rdma_optset (void);
+
+static struct nn_transport nn_rdma_vfptr = {
+    "rdma",
+    NN_RDMA,
+    NULL,
+    NULL,
+    nn_rdma_bind,
+    nn_rdma_connect,
+    nn_rdma_optset,
+    NN_LIST_ITEM_INITIALIZER
+};
+
+struct nn_transport *nn_rdma = &nn_rdma_vfptr;
+
+static int nn_rdma_bind (struct nn_ep *ep)
+{
+    int rc;
+
+    /*  Rather than failing every single connection later on, refuse to
+        create the endpoint if there's no device to pass the messages. */
+    rc = nn_verbs_available ();
+    if (nn_slow (rc < 0))
+        return rc;
+    return nn_btcp_create (ep, NULL, 1);
+}
+
+static int nn_rdma_connect (struct nn_ep *ep)
+{
+    int rc;
+
+    rc = nn_verbs_available ();
+    if (nn_slow (rc < 0))
+        return rc;
+    return nn_ctcp_create (ep, NULL, 1);
+}
+
+static struct nn_optset *nn_rdma_optset ()
+{
+    struct nn_rdma_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_rdma_optset), "optset (rdma)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_rdma_optset_vfptr;
+
+    /*  Default values for rdma socket options. */
+    optset->bufsz = 64 * 1024;
+    optset->bufs = 16;
+    optset->gididx = 0;
+
+    return &optset->base;
+}
+
+static void nn_rdma_optset_destroy (struct nn_optset *self)
+{
+    struct nn_rdma_optset *optset;
+
+    optset = nn_cont (self, struct nn_rdma_optset, base);
+    nn_free (optset);
+}
+
+static int nn_rdma_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_rdma_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_rdma_optset, base);
+
+    /*  At this point we assume that all options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_RDMA_BUFSZ:
+        if (nn_slow (val < NN_VERBS_MINBUFSZ || val > NN_VERBS_MAXBUFSZ))
+            return -EINVAL;
+        optset->bufsz = val;
+        return 0;
+    case NN_RDMA_BUFS:
+        if (nn_slow (val <= 0 || val > NN_VERBS_MAXBUFS))
+            return -EINVAL;
+        optset->bufs = val;
+        return 0;
+    case NN_RDMA_GID_INDEX:
+        if (nn_slow (val < -1 || val > 255))
+            return -EINVAL;
+        optset->gididx = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_rdma_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_rdma_optset *optset;
+    int intval;
+
+    optset = nn_cont (self, struct nn_rdma_optset, base);
+
+    switch (option) {
+    case NN_RDMA_BUFSZ:
+        intval = optset->bufsz;
+        break;
+    case NN_RDMA_BUFS:
+        intval = optset->bufs;
+        break;
+    case NN_RDMA_GID_INDEX:
+        intval = optset->gididx;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+#endif
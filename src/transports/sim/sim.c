@@ -0,0 +1,194 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "sim.h"
+
+#include "../inproc/binproc.h"
+#include "../inproc/cinproc.h"
+
+#include "../../sim.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/list.h"
+#include "../../utils/cont.h"
+
+#include <string.h>
+
+/*  The sim transport uses the inproc state machines to connect the sockets
+    and has the messages cross an emulated network link on their way to the
+    peer (see simlink.h). It's meant for testing and benchmarking the
+    protocols in the presence of latency, limited bandwidth and loss. Its
+    addresses are in a namespace of their own, i.e. sim://a doesn't connect
+    to inproc://a. */
+
+/*  sim-specific socket options. */
+struct nn_sim_optset {
+    struct nn_optset base;
+    int delay;
+    int jitter;
+    int bandwidth;
+    int loss;
+    int seed;
+};
+
+static void nn_sim_optset_destroy (struct nn_optset *self);
+static int nn_sim_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_sim_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_sim_optset_vfptr = {
+    nn_sim_optset_destroy,
+    nn_sim_optset_setopt,
+    nn_sim_optset_getopt
+};
+
+/*  nn_transport interface. */
+static int nn_sim_bind (struct nn_ep *ep);
+static int nn_sim_connect (struct nn_ep *ep);
+static struct nn_optset *nn_sim_optset (void);
+
+static struct nn_transport nn_sim_vfptr = {
+    "sim",
+    NN_SIM,
+    NULL,
+    NULL,
+    nn_sim_bind,
+    nn_sim_connect,
+    nn_sim_optset,
+    NN_LIST_ITEM_INITIALIZER
+};
+
+struct nn_transport *nn_sim = &nn_sim_vfptr;
+
+static int nn_sim_bind (struct nn_ep *ep)
+{
+    return nn_binproc_create (ep, 1);
+}
+
+static int nn_sim_connect (struct nn_ep *ep)
+{
+    return nn_cinproc_create (ep, 1);
+}
+
+static struct nn_optset *nn_sim_optset ()
+{
+    struct nn_sim_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_sim_optset), "optset (sim)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_sim_optset_vfptr;
+
+    /*  By default, the link is a perfect one. */
+    optset->delay = 0;
+    optset->jitter = 0;
+    optset->bandwidth = 0;
+    optset->loss = 0;
+    optset->seed = 0;
+
+    return &optset->base;
+}
+
+static void nn_sim_optset_destroy (struct nn_optset *self)
+{
+    struct nn_sim_optset *optset;
+
+    optset = nn_cont (self, struct nn_sim_optset, base);
+    nn_free (optset);
+}
+
+static int nn_sim_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_sim_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_sim_optset, base);
+
+    /*  At this point we assume that all options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_SIM_DELAY:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->delay = val;
+        return 0;
+    case NN_SIM_JITTER:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->jitter = val;
+        return 0;
+    case NN_SIM_BANDWIDTH:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->bandwidth = val;
+        return 0;
+    case NN_SIM_LOSS:
+        if (nn_slow (val < 0 || val > 1000000))
+            return -EINVAL;
+        optset->loss = val;
+        return 0;
+    case NN_SIM_SEED:
+        optset->seed = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_sim_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_sim_optset *optset;
+    int intval;
+
+    optset = nn_cont (self, struct nn_sim_optset, base);
+
+    switch (option) {
+    case NN_SIM_DELAY:
+        intval = optset->delay;
+        break;
+    case NN_SIM_JITTER:
+        intval = optset->jitter;
+        break;
+    case NN_SIM_BANDWIDTH:
+        intval = optset->bandwidth;
+        break;
+    case NN_SIM_LOSS:
+        intval = optset->loss;
+        break;
+    case NN_SIM_SEED:
+        intval = optset->seed;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
@@ -22,6 +22,7 @@
 */
 
 #include "atcp.h"
+#include "tcp.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
@@ -46,8 +47,8 @@ static void nn_atcp_handler (struct nn_fsm *self, int src, int type,
 static void nn_atcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 
-void nn_atcp_init (struct nn_atcp *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner)
+void nn_atcp_init (struct nn_atcp *self, int src, struct nn_ep *ep,
+    struct ssl_ctx_st *tls, int rdma, struct nn_fsm *owner)
 {
     nn_fsm_init (&self->fsm, nn_atcp_handler, nn_atcp_shutdown,
         src, self, owner);
@@ -57,7 +58,8 @@ void nn_atcp_init (struct nn_atcp *self, int src,
     self->listener = NULL;
     self->listener_owner.src = -1;
     self->listener_owner.fsm = NULL;
-    nn_stcp_init (&self->stcp, NN_ATCP_SRC_STCP, ep, &self->fsm);
+    nn_stcp_init (&self->stcp, NN_ATCP_SRC_STCP, ep, tls, NULL, rdma,
+        0, 0, 0, &self->fsm);
     nn_fsm_event_init (&self->accepted);
     nn_fsm_event_init (&self->done);
     nn_list_item_init (&self->item);
@@ -141,8 +143,6 @@ static void nn_atcp_handler (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
     struct nn_atcp *atcp;
-    int val;
-    size_t sz;
 
     atcp = nn_cont (self, struct nn_atcp, fsm);
 
@@ -182,16 +182,7 @@ static void nn_atcp_handler (struct nn_fsm *self, int src, int type,
                 nn_ep_clear_error (atcp->ep);
 
                 /*  Set the relevant socket options. */
-                sz = sizeof (val);
-                nn_ep_getopt (atcp->ep, NN_SOL_SOCKET, NN_SNDBUF, &val, &sz);
-                nn_assert (sz == sizeof (val));
-                nn_usock_setsockopt (&atcp->usock, SOL_SOCKET, SO_SNDBUF,
-                    &val, sizeof (val));
-                sz = sizeof (val);
-                nn_ep_getopt (atcp->ep, NN_SOL_SOCKET, NN_RCVBUF, &val, &sz);
-                nn_assert (sz == sizeof (val));
-                nn_usock_setsockopt (&atcp->usock, SOL_SOCKET, SO_RCVBUF,
-                    &val, sizeof (val));
+                nn_tcp_setsockopts (&atcp->usock, atcp->ep);
 
                 /*  Return ownership of the listening socket to the parent. */
                 nn_usock_swap_owner (atcp->listener, &atcp->listener_owner);
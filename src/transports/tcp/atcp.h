@@ -69,8 +69,8 @@ struct nn_atcp {
     struct nn_list_item item;
 };
 
-void nn_atcp_init (struct nn_atcp *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner);
+void nn_atcp_init (struct nn_atcp *self, int src, struct nn_ep *ep,
+    struct ssl_ctx_st *tls, int rdma, struct nn_fsm *owner);
 void nn_atcp_term (struct nn_atcp *self);
 
 int nn_atcp_isidle (struct nn_atcp *self);
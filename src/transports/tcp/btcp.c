@@ -23,6 +23,9 @@
 
 #include "btcp.h"
 #include "atcp.h"
+#include "tcp.h"
+
+#include "../../tcp.h"
 
 #include "../utils/port.h"
 #include "../utils/iface.h"
@@ -40,11 +43,16 @@
 
 #include <string.h>
 
+#if defined NN_HAVE_TLS
+#include <openssl/ssl.h>
+#endif
+
 #if defined NN_HAVE_WINDOWS
 #include "../../utils/win.h"
 #else
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
 /*  The backlog is set relatively high so that there are not too many failed
@@ -60,6 +68,18 @@
 #define NN_BTCP_SRC_USOCK 1
 #define NN_BTCP_SRC_ATCP 2
 
+struct nn_btcp_listener {
+
+    /*  The underlying listening TCP socket. */
+    struct nn_usock usock;
+
+    /*  The worker thread handling the socket. */
+    struct nn_worker *worker;
+
+    /*  The connection being accepted at the moment. */
+    struct nn_atcp *atcp;
+};
+
 struct nn_btcp {
 
     /*  The state machine. */
@@ -68,14 +88,24 @@ struct nn_btcp {
 
     struct nn_ep *ep;
 
-    /*  The underlying listening TCP socket. */
-    struct nn_usock usock;
-
-    /*  The connection being accepted at the moment. */
-    struct nn_atcp *atcp;
+    /*  Listening sockets. If there's more than one, they share the port
+        using SO_REUSEPORT and each is handled by a different worker. */
+    struct nn_btcp_listener *listeners;
+    int nlisteners;
 
     /*  List of accepted connections. */
     struct nn_list atcps;
+
+    /*  Number of accepted connections and the limit thereof, as set by
+        NN_MAXCONN. Zero means no limit. */
+    int nconns;
+    int maxconn;
+
+    /*  TLS context for the accepted connections, NULL if there's no TLS. */
+    struct ssl_ctx_st *tls;
+
+    /*  1 if the messages are passed through verbs queue pairs. */
+    int rdma;
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -92,9 +122,14 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
 static void nn_btcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_btcp_listen (struct nn_btcp *self);
-static void nn_btcp_start_accepting (struct nn_btcp *self);
-
-int nn_btcp_create (struct nn_ep *ep)
+static int nn_btcp_listen_one (struct nn_btcp *self,
+    struct nn_btcp_listener *listener, struct sockaddr_storage *ss,
+    size_t sslen);
+static void nn_btcp_start_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener);
+static void nn_btcp_resume_accepting (struct nn_btcp *self);
+
+int nn_btcp_create (struct nn_ep *ep, struct ssl_ctx_st *tls, int rdma)
 {
     int rc;
     struct nn_btcp *self;
@@ -105,6 +140,11 @@ int nn_btcp_create (struct nn_ep *ep)
     size_t sslen;
     int ipv4only;
     size_t ipv4onlylen;
+    int nlisteners;
+    size_t nlistenerssz;
+    size_t maxconnsz;
+    struct nn_worker *workers [NN_BTCP_MAX_LISTENERS];
+    int i;
 
     /*  Allocate the new endpoint object. */
     self = nn_alloc (sizeof (struct nn_btcp), "btcp");
@@ -137,17 +177,45 @@ int nn_btcp_create (struct nn_ep *ep)
         return -ENODEV;
     }
 
+    /*  Find out how many listening sockets to open. */
+    nlistenerssz = sizeof (nlisteners);
+    nn_ep_getopt (ep, NN_TCP, NN_TCP_LISTENERS, &nlisteners, &nlistenerssz);
+    nn_assert (nlistenerssz == sizeof (nlisteners));
+#if !defined SO_REUSEPORT
+    nlisteners = 1;
+#endif
+
     /*  Initialise the structure. */
     nn_fsm_init_root (&self->fsm, nn_btcp_handler, nn_btcp_shutdown,
         nn_ep_getctx (ep));
     self->state = NN_BTCP_STATE_IDLE;
-    self->atcp = NULL;
+    self->listeners = nn_alloc (sizeof (struct nn_btcp_listener) * nlisteners,
+        "btcp listeners");
+    alloc_assert (self->listeners);
+    self->nlisteners = nlisteners;
     nn_list_init (&self->atcps);
+    self->nconns = 0;
+    maxconnsz = sizeof (self->maxconn);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_MAXCONN, &self->maxconn, &maxconnsz);
+    nn_assert (maxconnsz == sizeof (self->maxconn));
+    self->tls = tls;
+    self->rdma = rdma;
+#if defined NN_HAVE_TLS
+    if (tls)
+        SSL_CTX_up_ref (tls);
+#endif
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
 
-    nn_usock_init (&self->usock, NN_BTCP_SRC_USOCK, &self->fsm);
+    nn_fsm_choose_workers (&self->fsm, workers, nlisteners);
+    for (i = 0; i != nlisteners; ++i) {
+        nn_usock_init (&self->listeners [i].usock, NN_BTCP_SRC_USOCK,
+            &self->fsm);
+        nn_usock_setworker (&self->listeners [i].usock, workers [i]);
+        self->listeners [i].worker = workers [i];
+        self->listeners [i].atcp = NULL;
+    }
 
     rc = nn_btcp_listen (self);
     if (rc != 0) {
@@ -169,13 +237,21 @@ static void nn_btcp_stop (struct nn_ep *ep)
 static void nn_btcp_destroy (struct nn_ep *ep)
 {
     struct nn_btcp *btcp;
+    int i;
 
     btcp = nn_ep_tran_private (ep);
 
     nn_assert_state (btcp, NN_BTCP_STATE_IDLE);
     nn_list_term (&btcp->atcps);
-    nn_assert (btcp->atcp == NULL);
-    nn_usock_term (&btcp->usock);
+    for (i = 0; i != btcp->nlisteners; ++i) {
+        nn_assert (btcp->listeners [i].atcp == NULL);
+        nn_usock_term (&btcp->listeners [i].usock);
+    }
+    nn_free (btcp->listeners);
+#if defined NN_HAVE_TLS
+    if (btcp->tls)
+        SSL_CTX_free (btcp->tls);
+#endif
     nn_fsm_term (&btcp->fsm);
 
     nn_free (btcp);
@@ -187,30 +263,40 @@ static void nn_btcp_shutdown (struct nn_fsm *self, int src, int type,
     struct nn_btcp *btcp;
     struct nn_list_item *it;
     struct nn_atcp *atcp;
+    struct nn_btcp_listener *listener;
+    int i;
 
     btcp = nn_cont (self, struct nn_btcp, fsm);
 
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
-        if (btcp->atcp) {
-            nn_atcp_stop (btcp->atcp);
-            btcp->state = NN_BTCP_STATE_STOPPING_ATCP;
-        }
-        else {
-            btcp->state = NN_BTCP_STATE_STOPPING_USOCK;
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            if (btcp->listeners [i].atcp)
+                nn_atcp_stop (btcp->listeners [i].atcp);
         }
+        btcp->state = NN_BTCP_STATE_STOPPING_ATCP;
     }
     if (nn_slow (btcp->state == NN_BTCP_STATE_STOPPING_ATCP)) {
-        if (!nn_atcp_isidle (btcp->atcp))
-            return;
-        nn_atcp_term (btcp->atcp);
-        nn_free (btcp->atcp);
-        btcp->atcp = NULL;
-        nn_usock_stop (&btcp->usock);
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            listener = &btcp->listeners [i];
+            if (listener->atcp && !nn_atcp_isidle (listener->atcp))
+                return;
+        }
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            listener = &btcp->listeners [i];
+            if (listener->atcp) {
+                nn_atcp_term (listener->atcp);
+                nn_free (listener->atcp);
+                listener->atcp = NULL;
+            }
+            nn_usock_stop (&listener->usock);
+        }
         btcp->state = NN_BTCP_STATE_STOPPING_USOCK;
     }
     if (nn_slow (btcp->state == NN_BTCP_STATE_STOPPING_USOCK)) {
-       if (!nn_usock_isidle (&btcp->usock))
-            return;
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            if (!nn_usock_isidle (&btcp->listeners [i].usock))
+                return;
+        }
         for (it = nn_list_begin (&btcp->atcps);
               it != nn_list_end (&btcp->atcps);
               it = nn_list_next (&btcp->atcps, it)) {
@@ -248,6 +334,7 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
 {
     struct nn_btcp *btcp;
     struct nn_atcp *atcp;
+    int i;
 
     btcp = nn_cont (self, struct nn_btcp, fsm);
 
@@ -278,11 +365,15 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
         atcp = (struct nn_atcp*) srcptr;
         switch (type) {
         case NN_ATCP_ACCEPTED:
-            nn_assert (btcp->atcp == atcp) ;
+            for (i = 0; i != btcp->nlisteners; ++i)
+                if (btcp->listeners [i].atcp == atcp)
+                    break;
+            nn_assert (i < btcp->nlisteners);
             nn_list_insert (&btcp->atcps, &atcp->item,
                 nn_list_end (&btcp->atcps));
-            btcp->atcp = NULL;
-            nn_btcp_start_accepting (btcp);
+            ++btcp->nconns;
+            btcp->listeners [i].atcp = NULL;
+            nn_btcp_resume_accepting (btcp);
             return;
         case NN_ATCP_ERROR:
             nn_atcp_stop (atcp);
@@ -291,6 +382,8 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
             nn_list_erase (&btcp->atcps, &atcp->item);
             nn_atcp_term (atcp);
             nn_free (atcp);
+            --btcp->nconns;
+            nn_btcp_resume_accepting (btcp);
             return;
         default:
             nn_fsm_bad_action (btcp->state, src, type);
@@ -315,6 +408,7 @@ static int nn_btcp_listen (struct nn_btcp *self)
     const char *end;
     const char *pos;
     uint16_t port;
+    int i;
 
     /*  First, resolve the IP address. */
     addr = nn_ep_getaddr (self->ep);
@@ -357,23 +451,77 @@ static int nn_btcp_listen (struct nn_btcp *self)
     }
 
     /*  Start listening for incoming connections. */
-    rc = nn_usock_start (&self->usock, ss.ss_family, SOCK_STREAM, 0);
+    for (i = 0; i != self->nlisteners; ++i) {
+        rc = nn_btcp_listen_one (self, &self->listeners [i], &ss, sslen);
+        if (rc < 0) {
+            while (i > 0)
+                nn_usock_stop (&self->listeners [--i].usock);
+            return rc;
+        }
+    }
+    nn_btcp_resume_accepting (self);
+
+    return 0;
+}
+
+static int nn_btcp_listen_one (struct nn_btcp *self,
+    struct nn_btcp_listener *listener, struct sockaddr_storage *ss,
+    size_t sslen)
+{
+    int rc;
+#if defined SO_REUSEPORT || defined SO_INCOMING_CPU
+    int opt;
+#endif
+#if defined SO_INCOMING_CPU
+    size_t optsz;
+#endif
+
+    rc = nn_usock_start (&listener->usock, ss->ss_family, SOCK_STREAM, 0);
     if (rc < 0) {
         return rc;
     }
 
-    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &ss, (size_t) sslen);
+    /*  Ask for the connections whose packets are processed by a specific
+        CPU. Each listener is given its own CPU, the failures are ignored. */
+#if defined SO_INCOMING_CPU
+    optsz = sizeof (opt);
+    nn_ep_getopt (self->ep, NN_TCP, NN_TCP_INCOMING_CPU, &opt, &optsz);
+    nn_assert (optsz == sizeof (opt));
+    if (opt >= 0) {
+        opt += (int) (listener - self->listeners);
+        nn_usock_setsockopt (&listener->usock, SOL_SOCKET, SO_INCOMING_CPU,
+            &opt, sizeof (opt));
+    }
+#endif
+
+    /*  Let the kernel distribute the incoming connections among several
+        sockets bound to the same address. */
+#if defined SO_REUSEPORT
+    if (self->nlisteners > 1) {
+        opt = 1;
+        rc = nn_usock_setsockopt (&listener->usock, SOL_SOCKET, SO_REUSEPORT,
+            &opt, sizeof (opt));
+        if (rc < 0) {
+            nn_usock_stop (&listener->usock);
+            return rc;
+        }
+    }
+#endif
+
+    rc = nn_usock_bind (&listener->usock, (struct sockaddr*) ss,
+        (size_t) sslen);
     if (rc < 0) {
-       nn_usock_stop (&self->usock);
+       nn_usock_stop (&listener->usock);
        return rc;
     }
 
-    rc = nn_usock_listen (&self->usock, NN_BTCP_BACKLOG);
+    nn_tcp_setfastopen (&listener->usock, self->ep, NN_BTCP_BACKLOG);
+
+    rc = nn_usock_listen (&listener->usock, NN_BTCP_BACKLOG);
     if (rc < 0) {
-        nn_usock_stop (&self->usock);
+        nn_usock_stop (&listener->usock);
         return rc;
     }
-    nn_btcp_start_accepting(self);
 
     return 0;
 }
@@ -382,15 +530,44 @@ static int nn_btcp_listen (struct nn_btcp *self)
 /*  State machine actions.                                                    */
 /******************************************************************************/
 
-static void nn_btcp_start_accepting (struct nn_btcp *self)
+static void nn_btcp_start_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener)
 {
-    nn_assert (self->atcp == NULL);
-
-    /*  Allocate new atcp state machine. */
-    self->atcp = nn_alloc (sizeof (struct nn_atcp), "atcp");
-    alloc_assert (self->atcp);
-    nn_atcp_init (self->atcp, NN_BTCP_SRC_ATCP, self->ep, &self->fsm);
+    nn_assert (listener->atcp == NULL);
+
+    /*  Allocate new atcp state machine. If there are several listeners,
+        the accepted connection stays with the worker of the one that
+        accepted it. */
+    listener->atcp = nn_alloc (sizeof (struct nn_atcp), "atcp");
+    alloc_assert (listener->atcp);
+    nn_atcp_init (listener->atcp, NN_BTCP_SRC_ATCP, self->ep, self->tls,
+        self->rdma, &self->fsm);
+    if (self->nlisteners > 1)
+        nn_usock_setworker (&listener->atcp->usock, listener->worker);
 
     /*  Start waiting for a new incoming connection. */
-    nn_atcp_start (self->atcp, &self->usock);
+    nn_atcp_start (listener->atcp, &listener->usock);
+}
+
+static void nn_btcp_resume_accepting (struct nn_btcp *self)
+{
+    int i;
+    int naccepting;
+
+    /*  Each listener waiting for a connection may get one, so they count
+        against the limit as well. Once it's reached, new connections wait
+        in the listen backlog, without costing anything to the existing
+        ones, till some of those are closed. */
+    naccepting = 0;
+    for (i = 0; i != self->nlisteners; ++i)
+        if (self->listeners [i].atcp)
+            ++naccepting;
+    for (i = 0; i != self->nlisteners; ++i) {
+        if (self->maxconn > 0 && self->nconns + naccepting >= self->maxconn)
+            break;
+        if (self->listeners [i].atcp)
+            continue;
+        nn_btcp_start_accepting (self, &self->listeners [i]);
+        ++naccepting;
+    }
 }
@@ -26,9 +26,18 @@
 
 #include "../../transport.h"
 
-/*  State machine managing bound TCP socket. */
+/*  State machine managing bound TCP socket. If 'tls' is not NULL, the
+    accepted connections are secured using the TLS context. The endpoint
+    holds a reference to the context of its own. If 'rdma' is set, the
+    connections are only used to set up verbs queue pairs that carry the
+    messages. */
 
-int nn_btcp_create (struct nn_ep *);
+/*  Maximum number of listening sockets per endpoint. */
+#define NN_BTCP_MAX_LISTENERS 64
+
+struct ssl_ctx_st;
+
+int nn_btcp_create (struct nn_ep *, struct ssl_ctx_st *tls, int rdma);
 
 #endif
 
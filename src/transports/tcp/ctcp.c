@@ -23,6 +23,7 @@
 
 #include "ctcp.h"
 #include "stcp.h"
+#include "tcp.h"
 
 #include "../../tcp.h"
 
@@ -34,15 +35,21 @@
 
 #include "../../aio/fsm.h"
 #include "../../aio/usock.h"
+#include "../../aio/timer.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/alloc.h"
 #include "../../utils/fast.h"
 #include "../../utils/attr.h"
+#include "../../utils/random.h"
 
 #include <string.h>
 
+#if defined NN_HAVE_TLS
+#include <openssl/ssl.h>
+#endif
+
 #if defined NN_HAVE_WINDOWS
 #include "../../utils/win.h"
 #else
@@ -67,6 +74,27 @@
 #define NN_CTCP_SRC_RECONNECT_TIMER 2
 #define NN_CTCP_SRC_DNS 3
 #define NN_CTCP_SRC_STCP 4
+#define NN_CTCP_SRC_DELAY_TIMER 5
+
+/*  Maximum number of hosts in the address and maximum number of IP addresses
+    connected to. */
+#define NN_CTCP_MAXHOSTS 8
+#define NN_CTCP_MAXADDRS 16
+
+/*  Maximum number of connection attempts under way at the same time and the
+    time to wait before the next one is started, in milliseconds, unless the
+    previous one failed in the meantime. The delay is the one recommended by
+    RFC 8305. */
+#define NN_CTCP_ATTEMPTS 4
+#define NN_CTCP_ATTEMPT_DELAY 250
+
+/*  One of the alternative hosts listed in the address. The name points into
+    the address string of the endpoint. */
+struct nn_ctcp_host {
+    const char *name;
+    size_t namelen;
+    uint16_t port;
+};
 
 struct nn_ctcp {
 
@@ -76,8 +104,38 @@ struct nn_ctcp {
 
     struct nn_ep *ep;
 
-    /*  The underlying TCP socket. */
-    struct nn_usock usock;
+    /*  The underlying TCP sockets, one for each connection attempt that may
+        be under way, and the one the connection was established on. */
+    struct nn_usock usocks [NN_CTCP_ATTEMPTS];
+    struct nn_usock *usock;
+
+    /*  Hosts listed in the address. They are resolved one after another,
+        'host' being the index of the one currently being resolved. */
+    struct nn_ctcp_host hosts [NN_CTCP_MAXHOSTS];
+    int nhosts;
+    int host;
+
+    /*  Addresses to connect to along with the index of the host each of them
+        belongs to and the address each of the sockets is connecting to. */
+    struct sockaddr_storage addrs [NN_CTCP_MAXADDRS];
+    size_t addrlens [NN_CTCP_MAXADDRS];
+    int addrhosts [NN_CTCP_MAXADDRS];
+    int naddrs;
+    int attempts [NN_CTCP_ATTEMPTS];
+
+    /*  Index of the next address to try and the number of attempts under
+        way. 'overdue' is set if the next attempt should have been started
+        already but all the sockets were busy and 'errnum' is the error the
+        last attempt failed with. */
+    int next;
+    int pending;
+    int overdue;
+    int errnum;
+
+    /*  Timer to start the next attempt with. 'expired' is set if it is being
+        stopped after it has expired, as opposed to being restarted. */
+    struct nn_timer delay;
+    int expired;
 
     /*  Used to wait before retrying to connect. */
     struct nn_backoff retry;
@@ -90,6 +148,19 @@ struct nn_ctcp {
         along with the variable to hold the result. */
     struct nn_dns dns;
     struct nn_dns_result dns_result;
+
+    /*  TLS context for the connection, NULL if there's no TLS, and the host
+        part of the address the server's certificate is checked against.
+        The latter is filled in with the host the connection was established
+        to. */
+    struct ssl_ctx_st *tls;
+    char *tlshost;
+
+    /*  If the pipe is striped over several connections, or there are
+        connections held in reserve (see NN_STANDBY), each of them is
+        handled by an object of its own. The first one is the private data
+        of the endpoint and the others are linked to it. */
+    struct nn_ctcp *nextstripe;
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -105,79 +176,148 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_ctcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
+static int nn_ctcp_parse (const char *addr, int ipv4only,
+    struct nn_ctcp_host *hosts);
 static void nn_ctcp_start_resolving (struct nn_ctcp *self);
-static void nn_ctcp_start_connecting (struct nn_ctcp *self,
-    struct sockaddr_storage *ss, size_t sslen);
-
-int nn_ctcp_create (struct nn_ep *ep)
+static void nn_ctcp_resolve (struct nn_ctcp *self);
+static void nn_ctcp_resolved (struct nn_ctcp *self);
+static void nn_ctcp_interleave (struct nn_ctcp *self);
+static void nn_ctcp_start_connecting (struct nn_ctcp *self);
+static void nn_ctcp_next_attempt (struct nn_ctcp *self);
+static int nn_ctcp_connect (struct nn_ctcp *self, int i);
+static void nn_ctcp_connected (struct nn_ctcp *self, struct nn_usock *usock);
+static int nn_ctcp_isquiet (struct nn_ctcp *self);
+static void nn_ctcp_quiesced (struct nn_ctcp *self);
+static void nn_ctcp_settlshost (struct nn_ctcp *self, int host);
+static struct nn_ctcp *nn_ctcp_alloc (struct nn_ep *ep,
+    struct nn_ctcp_host *hosts, int nhosts, struct ssl_ctx_st *tls, int rdma,
+    uint64_t group, int stripes, int bulk);
+
+int nn_ctcp_create (struct nn_ep *ep, struct ssl_ctx_st *tls, int rdma)
 {
     int rc;
-    const char *addr;
-    size_t addrlen;
-    const char *semicolon;
-    const char *hostname;
-    const char *colon;
-    const char *end;
-    struct sockaddr_storage ss;
-    size_t sslen;
+    int i;
+    struct nn_ctcp_host hosts [NN_CTCP_MAXHOSTS];
+    int nhosts;
     int ipv4only;
     size_t ipv4onlylen;
-    struct nn_ctcp *self;
-    int reconnect_ivl;
-    int reconnect_ivl_max;
+    int stripes;
+    int threshold;
+    int standby;
     size_t sz;
-
-    /*  Allocate the new endpoint object. */
-    self = nn_alloc (sizeof (struct nn_ctcp), "ctcp");
-    alloc_assert (self);
-
-    /*  Initalise the endpoint. */
-    self->ep = ep;
-    nn_ep_tran_setup (ep, &nn_ctcp_ep_vfptr, self);
+    uint64_t group;
+    struct nn_ctcp *self;
+    struct nn_ctcp *stripe;
 
     /*  Check whether IPv6 is to be used. */
     ipv4onlylen = sizeof (ipv4only);
     nn_ep_getopt (ep, NN_SOL_SOCKET, NN_IPV4ONLY, &ipv4only, &ipv4onlylen);
     nn_assert (ipv4onlylen == sizeof (ipv4only));
 
-    /*  Start parsing the address. */
-    addr = nn_ep_getaddr (ep);
-    addrlen = strlen (addr);
-    semicolon = strchr (addr, ';');
-    hostname = semicolon ? semicolon + 1 : addr;
-    colon = strrchr (addr, ':');
-    end = addr + addrlen;
-
-    /*  Parse the port. */
-    if (!colon) {
-        return -EINVAL;
-    }
-    rc = nn_port_resolve (colon + 1, end - colon - 1);
-    if (rc < 0) {
-        return -EINVAL;
+    /*  Check whether the address is valid. */
+    rc = nn_ctcp_parse (nn_ep_getaddr (ep), ipv4only, hosts);
+    if (rc < 0)
+        return rc;
+    nhosts = rc;
+
+    /*  Messages passed through queue pairs are never striped. The identifier
+        of a striped pipe has to be unique among the pipes of the peer,
+        which may be connected to by any number of processes. */
+    stripes = 1;
+    threshold = 0;
+    if (!rdma) {
+        sz = sizeof (stripes);
+        nn_ep_getopt (ep, NN_TCP, NN_TCP_STRIPES, &stripes, &sz);
+        nn_assert (sz == sizeof (stripes));
+        sz = sizeof (threshold);
+        nn_ep_getopt (ep, NN_TCP, NN_TCP_BULK_THRESHOLD, &threshold, &sz);
+        nn_assert (sz == sizeof (threshold));
     }
 
-    /*  Check whether the host portion of the address is either a literal
-        or a valid hostname. */
-    if (nn_dns_check_hostname (hostname, colon - hostname) < 0 &&
-          nn_literal_resolve (hostname, colon - hostname, ipv4only,
-          &ss, &sslen) < 0) {
-        return -EINVAL;
+    /*  A pipe split by the size of the messages consists of the main
+        connection and the bulk one, which follows it. */
+    if (threshold > 0)
+        stripes = 2;
+    group = 0;
+    while (stripes > 1 && group == 0)
+        nn_random_secure (&group, sizeof (group));
+
+    /*  Connections in reserve are established the same way as the one in
+        use. There's no way to replace a single stripe of a pipe though. */
+    sz = sizeof (standby);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_STANDBY, &standby, &sz);
+    nn_assert (sz == sizeof (standby));
+    if (stripes > 1)
+        standby = 0;
+
+    /*  Allocate the objects handling the connections. */
+    self = nn_ctcp_alloc (ep, hosts, nhosts, tls, rdma, group, stripes,
+        threshold > 0 ? NN_STCP_MAIN : 0);
+    stripe = self;
+    for (i = 1; i < stripes + standby; ++i) {
+        stripe->nextstripe = nn_ctcp_alloc (ep, hosts, nhosts, tls, rdma,
+            group, stripes, threshold > 0 ? NN_STCP_BULK : 0);
+        stripe = stripe->nextstripe;
     }
+    nn_ep_tran_setup (ep, &nn_ctcp_ep_vfptr, self);
 
-    /*  If local address is specified, check whether it is valid. */
-    if (semicolon) {
-        rc = nn_iface_resolve (addr, semicolon - addr, ipv4only, &ss, &sslen);
-        if (rc < 0) {
-            return -ENODEV;
-        }
+    /*  Start the state machines. */
+    for (stripe = self; stripe; stripe = stripe->nextstripe)
+        nn_fsm_start (&stripe->fsm);
+
+    return 0;
+}
+
+static struct nn_ctcp *nn_ctcp_alloc (struct nn_ep *ep,
+    struct nn_ctcp_host *hosts, int nhosts, struct ssl_ctx_st *tls, int rdma,
+    uint64_t group, int stripes, int bulk)
+{
+    int i;
+    struct nn_ctcp *self;
+    int reconnect_ivl;
+    int reconnect_ivl_max;
+    size_t sz;
+
+    /*  Allocate the new endpoint object. */
+    self = nn_alloc (sizeof (struct nn_ctcp), "ctcp");
+    alloc_assert (self);
+    memcpy (self->hosts, hosts, nhosts * sizeof (struct nn_ctcp_host));
+    self->nhosts = nhosts;
+    self->ep = ep;
+    self->nextstripe = NULL;
+
+    /*  Remember what the server's certificate is to be checked against.
+        The buffer is large enough for any of the hosts. */
+    self->tls = tls;
+    self->tlshost = NULL;
+    if (tls) {
+#if defined NN_HAVE_TLS
+        SSL_CTX_up_ref (tls);
+#endif
+        sz = 0;
+        for (i = 0; i != self->nhosts; ++i)
+            if (self->hosts [i].namelen > sz)
+                sz = self->hosts [i].namelen;
+        self->tlshost = nn_alloc (sz + 1, "tls host");
+        alloc_assert (self->tlshost);
+        nn_ctcp_settlshost (self, 0);
     }
 
     /*  Initialise the structure. */
     nn_fsm_init_root (&self->fsm, nn_ctcp_handler, nn_ctcp_shutdown,
         nn_ep_getctx (ep));
     self->state = NN_CTCP_STATE_IDLE;
-    nn_usock_init (&self->usock, NN_CTCP_SRC_USOCK, &self->fsm);
+    for (i = 0; i != NN_CTCP_ATTEMPTS; ++i)
+        nn_usock_init (&self->usocks [i], NN_CTCP_SRC_USOCK, &self->fsm);
+    self->usock = NULL;
+    self->host = 0;
+    self->naddrs = 0;
+    self->next = 0;
+    self->pending = 0;
+    self->overdue = 0;
+    self->errnum = 0;
+    nn_timer_init (&self->delay, NN_CTCP_SRC_DELAY_TIMER, &self->fsm);
+    self->expired = 0;
     sz = sizeof (reconnect_ivl);
     nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL, &reconnect_ivl, &sz);
     nn_assert (sz == sizeof (reconnect_ivl));
@@ -189,43 +329,52 @@ int nn_ctcp_create (struct nn_ep *ep)
         reconnect_ivl_max = reconnect_ivl;
     nn_backoff_init (&self->retry, NN_CTCP_SRC_RECONNECT_TIMER,
         reconnect_ivl, reconnect_ivl_max, &self->fsm);
-    nn_stcp_init (&self->stcp, NN_CTCP_SRC_STCP, ep, &self->fsm);
+    nn_stcp_init (&self->stcp, NN_CTCP_SRC_STCP, ep, self->tls,
+        self->tlshost, rdma, group, stripes, bulk, &self->fsm);
     nn_dns_init (&self->dns, NN_CTCP_SRC_DNS, &self->fsm);
 
-    /*  Start the state machine. */
-    nn_fsm_start (&self->fsm);
-
-    return 0;
+    return self;
 }
 
 static void nn_ctcp_stop (struct nn_ep *ep)
 {
     struct nn_ctcp *ctcp;
 
-    ctcp = nn_ep_tran_private (ep);
-
-    nn_fsm_stop (&ctcp->fsm);
+    for (ctcp = nn_ep_tran_private (ep); ctcp; ctcp = ctcp->nextstripe)
+        nn_fsm_stop (&ctcp->fsm);
 }
 
 static void nn_ctcp_destroy (struct nn_ep *ep)
 {
     struct nn_ctcp *ctcp;
-
-    ctcp = nn_ep_tran_private (ep);
-
-    nn_dns_term (&ctcp->dns);
-    nn_stcp_term (&ctcp->stcp);
-    nn_backoff_term (&ctcp->retry);
-    nn_usock_term (&ctcp->usock);
-    nn_fsm_term (&ctcp->fsm);
-
-    nn_free (ctcp);
+    struct nn_ctcp *next;
+    int i;
+
+    for (ctcp = nn_ep_tran_private (ep); ctcp; ctcp = next) {
+        next = ctcp->nextstripe;
+        nn_dns_term (&ctcp->dns);
+        nn_stcp_term (&ctcp->stcp);
+        nn_backoff_term (&ctcp->retry);
+        nn_timer_term (&ctcp->delay);
+        for (i = 0; i != NN_CTCP_ATTEMPTS; ++i)
+            nn_usock_term (&ctcp->usocks [i]);
+        nn_fsm_term (&ctcp->fsm);
+#if defined NN_HAVE_TLS
+        if (ctcp->tls)
+            SSL_CTX_free (ctcp->tls);
+#endif
+        if (ctcp->tlshost)
+            nn_free (ctcp->tlshost);
+        nn_free (ctcp);
+    }
 }
 
 static void nn_ctcp_shutdown (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
     struct nn_ctcp *ctcp;
+    struct nn_ctcp *stripe;
+    int i;
 
     ctcp = nn_cont (self, struct nn_ctcp, fsm);
 
@@ -240,17 +389,26 @@ static void nn_ctcp_shutdown (struct nn_fsm *self, int src, int type,
         if (!nn_stcp_isidle (&ctcp->stcp))
             return;
         nn_backoff_stop (&ctcp->retry);
-        nn_usock_stop (&ctcp->usock);
+        nn_backoff_release (&ctcp->retry);
+        nn_timer_stop (&ctcp->delay);
+        for (i = 0; i != NN_CTCP_ATTEMPTS; ++i)
+            nn_usock_stop (&ctcp->usocks [i]);
         nn_dns_stop (&ctcp->dns);
         ctcp->state = NN_CTCP_STATE_STOPPING;
     }
     if (nn_slow (ctcp->state == NN_CTCP_STATE_STOPPING)) {
         if (!nn_backoff_isidle (&ctcp->retry) ||
-              !nn_usock_isidle (&ctcp->usock) ||
+              !nn_ctcp_isquiet (ctcp) ||
               !nn_dns_isidle (&ctcp->dns))
             return;
         ctcp->state = NN_CTCP_STATE_IDLE;
         nn_fsm_stopped_noevent (&ctcp->fsm);
+
+        /*  The endpoint is stopped once all the stripes are. */
+        for (stripe = nn_ep_tran_private (ctcp->ep); stripe;
+              stripe = stripe->nextstripe)
+            if (!nn_fsm_isidle (&stripe->fsm))
+                return;
         nn_ep_stopped (ctcp->ep);
         return;
     }
@@ -259,9 +417,10 @@ static void nn_ctcp_shutdown (struct nn_fsm *self, int src, int type,
 }
 
 static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
-    NN_UNUSED void *srcptr)
+    void *srcptr)
 {
     struct nn_ctcp *ctcp;
+    struct nn_usock *usock;
 
     ctcp = nn_cont (self, struct nn_ctcp, fsm);
 
@@ -318,13 +477,7 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
         case NN_CTCP_SRC_DNS:
             switch (type) {
             case NN_DNS_STOPPED:
-                if (ctcp->dns_result.error == 0) {
-                    nn_ctcp_start_connecting (ctcp, &ctcp->dns_result.addr,
-                        ctcp->dns_result.addrlen);
-                    return;
-                }
-                nn_backoff_start (&ctcp->retry);
-                ctcp->state = NN_CTCP_STATE_WAITING;
+                nn_ctcp_resolved (ctcp);
                 return;
             default:
                 nn_fsm_bad_action (ctcp->state, src, type);
@@ -336,29 +489,44 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
 
 /******************************************************************************/
 /*  CONNECTING state.                                                         */
-/*  Non-blocking connect is under way.                                        */
+/*  Non-blocking connects to one or more of the addresses are under way.      */
 /******************************************************************************/
     case NN_CTCP_STATE_CONNECTING:
         switch (src) {
 
         case NN_CTCP_SRC_USOCK:
+            usock = (struct nn_usock*) srcptr;
             switch (type) {
             case NN_USOCK_CONNECTED:
-                nn_stcp_start (&ctcp->stcp, &ctcp->usock);
-                ctcp->state = NN_CTCP_STATE_ACTIVE;
-                nn_ep_stat_increment (ctcp->ep,
-                    NN_STAT_INPROGRESS_CONNECTIONS, -1);
-                nn_ep_stat_increment (ctcp->ep,
-                    NN_STAT_ESTABLISHED_CONNECTIONS, 1);
-                nn_ep_clear_error (ctcp->ep);
+                nn_ctcp_connected (ctcp, usock);
                 return;
             case NN_USOCK_ERROR:
-                nn_ep_set_error (ctcp->ep, nn_usock_geterrno (&ctcp->usock));
-                nn_usock_stop (&ctcp->usock);
-                ctcp->state = NN_CTCP_STATE_STOPPING_USOCK;
-                nn_ep_stat_increment (ctcp->ep,
-                    NN_STAT_INPROGRESS_CONNECTIONS, -1);
-                nn_ep_stat_increment (ctcp->ep, NN_STAT_CONNECT_ERRORS, 1);
+                ctcp->errnum = nn_usock_geterrno (usock);
+                nn_usock_stop (usock);
+                --ctcp->pending;
+                nn_ctcp_next_attempt (ctcp);
+                return;
+            case NN_USOCK_SHUTDOWN:
+                return;
+            case NN_USOCK_STOPPED:
+                if (ctcp->overdue)
+                    nn_ctcp_next_attempt (ctcp);
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
+        case NN_CTCP_SRC_DELAY_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+                ctcp->expired = 1;
+                nn_timer_stop (&ctcp->delay);
+                return;
+            case NN_TIMER_STOPPED:
+                if (ctcp->expired)
+                    nn_ctcp_next_attempt (ctcp);
+                else if (ctcp->next < ctcp->naddrs)
+                    nn_timer_start (&ctcp->delay, NN_CTCP_ATTEMPT_DELAY);
                 return;
             default:
                 nn_fsm_bad_action (ctcp->state, src, type);
@@ -371,6 +539,7 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
 /******************************************************************************/
 /*  ACTIVE state.                                                             */
 /*  Connection is established and handled by the stcp state machine.          */
+/*  The remaining connection attempts may still be being stopped.             */
 /******************************************************************************/
     case NN_CTCP_STATE_ACTIVE:
         switch (src) {
@@ -386,6 +555,23 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
                 nn_fsm_bad_action (ctcp->state, src, type);
             }
 
+        case NN_CTCP_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SHUTDOWN:
+            case NN_USOCK_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
+        case NN_CTCP_SRC_DELAY_TIMER:
+            switch (type) {
+            case NN_TIMER_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
         default:
             nn_fsm_bad_source (ctcp->state, src, type);
         }
@@ -402,20 +588,38 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
             case NN_USOCK_SHUTDOWN:
                 return;
             case NN_STCP_STOPPED:
-                nn_usock_stop (&ctcp->usock);
+                nn_usock_stop (ctcp->usock);
+                ctcp->usock = NULL;
                 ctcp->state = NN_CTCP_STATE_STOPPING_USOCK;
                 return;
             default:
                 nn_fsm_bad_action (ctcp->state, src, type);
             }
 
+        case NN_CTCP_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SHUTDOWN:
+            case NN_USOCK_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
+        case NN_CTCP_SRC_DELAY_TIMER:
+            switch (type) {
+            case NN_TIMER_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
         default:
             nn_fsm_bad_source (ctcp->state, src, type);
         }
 
 /******************************************************************************/
 /*  STOPPING_USOCK state.                                                     */
-/*  usock object was asked to stop but it haven't stopped yet.                */
+/*  usock objects were asked to stop but some of them haven't stopped yet.    */
 /******************************************************************************/
     case NN_CTCP_STATE_STOPPING_USOCK:
         switch (src) {
@@ -425,8 +629,16 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
             case NN_USOCK_SHUTDOWN:
                 return;
             case NN_USOCK_STOPPED:
-                nn_backoff_start (&ctcp->retry);
-                ctcp->state = NN_CTCP_STATE_WAITING;
+                nn_ctcp_quiesced (ctcp);
+                return;
+            default:
+                nn_fsm_bad_action (ctcp->state, src, type);
+            }
+
+        case NN_CTCP_SRC_DELAY_TIMER:
+            switch (type) {
+            case NN_TIMER_STOPPED:
+                nn_ctcp_quiesced (ctcp);
                 return;
             default:
                 nn_fsm_bad_action (ctcp->state, src, type);
@@ -490,23 +702,80 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
 /*  State machine actions.                                                    */
 /******************************************************************************/
 
-static void nn_ctcp_start_resolving (struct nn_ctcp *self)
+/*  The address has the form of [interface;]host:port[,host:port...].
+    Stores the hosts into the array and returns their number or a negative
+    error code if the address is invalid. */
+static int nn_ctcp_parse (const char *addr, int ipv4only,
+    struct nn_ctcp_host *hosts)
 {
-    const char *addr;
+    int rc;
+    int nhosts;
+    const char *semicolon;
     const char *begin;
     const char *end;
+    const char *colon;
+    struct sockaddr_storage ss;
+    size_t sslen;
+
+    /*  If local address is specified, check whether it is valid. */
+    semicolon = strchr (addr, ';');
+    if (semicolon) {
+        rc = nn_iface_resolve (addr, semicolon - addr, ipv4only, &ss, &sslen);
+        if (rc < 0)
+            return -ENODEV;
+    }
+
+    nhosts = 0;
+    begin = semicolon ? semicolon + 1 : addr;
+    while (1) {
+        end = strchr (begin, ',');
+        if (!end)
+            end = begin + strlen (begin);
+        if (nhosts == NN_CTCP_MAXHOSTS)
+            return -EINVAL;
+
+        /*  Parse the port. */
+        for (colon = end; colon != begin && colon [-1] != ':'; --colon)
+            ;
+        if (colon == begin)
+            return -EINVAL;
+        --colon;
+        rc = nn_port_resolve (colon + 1, end - colon - 1);
+        if (rc < 0)
+            return -EINVAL;
+        hosts [nhosts].port = (uint16_t) rc;
+
+        /*  Check whether the host portion of the address is either a literal
+            or a valid hostname. */
+        if (nn_dns_check_hostname (begin, colon - begin) < 0 &&
+              nn_literal_resolve (begin, colon - begin, ipv4only,
+              &ss, &sslen) < 0)
+            return -EINVAL;
+        hosts [nhosts].name = begin;
+        hosts [nhosts].namelen = colon - begin;
+        ++nhosts;
+
+        if (!*end)
+            return nhosts;
+        begin = end + 1;
+    }
+}
+
+static void nn_ctcp_start_resolving (struct nn_ctcp *self)
+{
+    /*  Start with the first host in the address. */
+    self->host = 0;
+    self->naddrs = 0;
+    nn_ctcp_resolve (self);
+}
+
+static void nn_ctcp_resolve (struct nn_ctcp *self)
+{
     int ipv4only;
     size_t ipv4onlylen;
+    struct nn_ctcp_host *host;
 
-    /*  Extract the hostname part from address string. */
-    addr = nn_ep_getaddr (self->ep);
-    begin = strchr (addr, ';');
-    if (!begin)
-        begin = addr;
-    else
-        ++begin;
-    end = strrchr (addr, ':');
-    nn_assert (end);
+    host = &self->hosts [self->host];
 
     /*  Check whether IPv6 is to be used. */
     ipv4onlylen = sizeof (ipv4only);
@@ -514,40 +783,187 @@ static void nn_ctcp_start_resolving (struct nn_ctcp *self)
         &ipv4only, &ipv4onlylen);
     nn_assert (ipv4onlylen == sizeof (ipv4only));
 
-    /*  TODO: Get the actual value of IPV4ONLY option. */
-    nn_dns_start (&self->dns, begin, end - begin, ipv4only, &self->dns_result);
+    nn_dns_start (&self->dns, host->name, host->namelen, ipv4only,
+        &self->dns_result);
 
     self->state = NN_CTCP_STATE_RESOLVING;
 }
 
-static void nn_ctcp_start_connecting (struct nn_ctcp *self,
-    struct sockaddr_storage *ss, size_t sslen)
+/*  Adds the addresses the host resolved to to the list of those to connect
+    to and resolves the next host, if any. Each host gets its share of the
+    list. */
+static void nn_ctcp_resolved (struct nn_ctcp *self)
+{
+    int i;
+    int n;
+    uint16_t port;
+    struct sockaddr_storage *ss;
+
+    if (self->dns_result.error == 0) {
+        n = self->dns_result.naddrs;
+        if (n > NN_CTCP_MAXADDRS / self->nhosts)
+            n = NN_CTCP_MAXADDRS / self->nhosts;
+        port = htons (self->hosts [self->host].port);
+        for (i = 0; i != n; ++i) {
+            ss = &self->addrs [self->naddrs];
+            memcpy (ss, &self->dns_result.addrs [i],
+                self->dns_result.addrlens [i]);
+            if (ss->ss_family == AF_INET)
+                ((struct sockaddr_in*) ss)->sin_port = port;
+            else if (ss->ss_family == AF_INET6)
+                ((struct sockaddr_in6*) ss)->sin6_port = port;
+            else
+                nn_assert (0);
+            self->addrlens [self->naddrs] = self->dns_result.addrlens [i];
+            self->addrhosts [self->naddrs] = self->host;
+            ++self->naddrs;
+        }
+    }
+
+    ++self->host;
+    if (self->host < self->nhosts) {
+        nn_ctcp_resolve (self);
+        return;
+    }
+
+    if (self->naddrs == 0) {
+        nn_backoff_start (&self->retry);
+        self->state = NN_CTCP_STATE_WAITING;
+        return;
+    }
+    nn_ctcp_start_connecting (self);
+}
+
+/*  Reorders the addresses so that the hosts take turns, the first address of
+    each host coming first, followed by the second ones etc. */
+static void nn_ctcp_interleave (struct nn_ctcp *self)
+{
+    struct sockaddr_storage addrs [NN_CTCP_MAXADDRS];
+    size_t addrlens [NN_CTCP_MAXADDRS];
+    int addrhosts [NN_CTCP_MAXADDRS];
+    int ranks [NN_CTCP_MAXADDRS];
+    int rank;
+    int i;
+    int n;
+
+    if (self->nhosts == 1)
+        return;
+
+    memcpy (addrs, self->addrs, sizeof (addrs));
+    memcpy (addrlens, self->addrlens, sizeof (addrlens));
+    memcpy (addrhosts, self->addrhosts, sizeof (addrhosts));
+    for (i = 0; i != self->naddrs; ++i)
+        ranks [i] = i > 0 && addrhosts [i] == addrhosts [i - 1] ?
+            ranks [i - 1] + 1 : 0;
+
+    n = 0;
+    for (rank = 0; n != self->naddrs; ++rank) {
+        for (i = 0; i != self->naddrs; ++i) {
+            if (ranks [i] != rank)
+                continue;
+            memcpy (&self->addrs [n], &addrs [i], addrlens [i]);
+            self->addrlens [n] = addrlens [i];
+            self->addrhosts [n] = addrhosts [i];
+            ++n;
+        }
+    }
+}
+
+static void nn_ctcp_start_connecting (struct nn_ctcp *self)
+{
+    int rc;
+
+    /*  Wait for a while if there are too many connection attempts under way
+        in the process already. */
+    rc = nn_backoff_acquire (&self->retry);
+    if (nn_slow (rc < 0)) {
+        nn_backoff_throttle (&self->retry);
+        self->state = NN_CTCP_STATE_WAITING;
+        return;
+    }
+
+    nn_ctcp_interleave (self);
+    self->next = 0;
+    self->pending = 0;
+    self->overdue = 0;
+    self->errnum = 0;
+    self->state = NN_CTCP_STATE_CONNECTING;
+    nn_ep_stat_increment (self->ep, NN_STAT_INPROGRESS_CONNECTIONS, 1);
+
+    nn_ctcp_next_attempt (self);
+}
+
+/*  Starts connecting to the next address and restarts the attempt delay
+    timer if there are more addresses left. Once all the attempts have
+    failed, waits for the sockets to stop before trying again. */
+static void nn_ctcp_next_attempt (struct nn_ctcp *self)
 {
     int rc;
-    struct sockaddr_storage remote;
+    int i;
+
+    self->expired = 0;
+    self->overdue = 0;
+    while (self->next < self->naddrs) {
+
+        /*  Find a socket that's not in use. If there's none, the attempt is
+            started once one of them is stopped. */
+        for (i = 0; i != NN_CTCP_ATTEMPTS; ++i)
+            if (nn_usock_isidle (&self->usocks [i]))
+                break;
+        if (i == NN_CTCP_ATTEMPTS) {
+            self->overdue = 1;
+            return;
+        }
+
+        self->attempts [i] = self->next;
+        ++self->next;
+        rc = nn_ctcp_connect (self, i);
+        if (nn_fast (rc == 0)) {
+            ++self->pending;
+            break;
+        }
+        self->errnum = -rc;
+    }
+
+    /*  Restart the timer. If it's running, it's started anew once it is
+        stopped. */
+    if (self->next < self->naddrs) {
+        if (nn_timer_isidle (&self->delay))
+            nn_timer_start (&self->delay, NN_CTCP_ATTEMPT_DELAY);
+        else
+            nn_timer_stop (&self->delay);
+        return;
+    }
+    nn_timer_stop (&self->delay);
+    if (self->pending > 0)
+        return;
+
+    /*  All the attempts have failed. */
+    nn_backoff_release (&self->retry);
+    nn_ep_set_error (self->ep, self->errnum);
+    nn_ep_stat_increment (self->ep, NN_STAT_INPROGRESS_CONNECTIONS, -1);
+    nn_ep_stat_increment (self->ep, NN_STAT_CONNECT_ERRORS, 1);
+    self->state = NN_CTCP_STATE_STOPPING_USOCK;
+    nn_ctcp_quiesced (self);
+}
+
+/*  Starts connecting the i-th socket to the address assigned to it. */
+static int nn_ctcp_connect (struct nn_ctcp *self, int i)
+{
+    int rc;
+    struct nn_usock *usock;
+    struct sockaddr_storage *remote;
     size_t remotelen;
     struct sockaddr_storage local;
     size_t locallen;
     const char *addr;
-    const char *end;
-    const char *colon;
     const char *semicolon;
-    uint16_t port;
     int ipv4only;
     size_t ipv4onlylen;
-    int val;
-    size_t sz;
-
-    /*  Create IP address from the address string. */
-    addr = nn_ep_getaddr (self->ep);
-    memset (&remote, 0, sizeof (remote));
 
-    /*  Parse the port. */
-    end = addr + strlen (addr);
-    colon = strrchr (addr, ':');
-    rc = nn_port_resolve (colon + 1, end - colon - 1);
-    errnum_assert (rc > 0, -rc);
-    port = rc;
+    usock = &self->usocks [i];
+    remote = &self->addrs [self->attempts [i]];
+    remotelen = self->addrlens [self->attempts [i]];
 
     /*  Check whether IPv6 is to be used. */
     ipv4onlylen = sizeof (ipv4only);
@@ -555,60 +971,105 @@ static void nn_ctcp_start_connecting (struct nn_ctcp *self,
         &ipv4only, &ipv4onlylen);
     nn_assert (ipv4onlylen == sizeof (ipv4only));
 
-    /*  Parse the local address, if any. */
+    /*  Parse the local address, if any. If there's none, any local address
+        of the same family as the remote one is used. */
+    addr = nn_ep_getaddr (self->ep);
     semicolon = strchr (addr, ';');
     memset (&local, 0, sizeof (local));
     if (semicolon)
         rc = nn_iface_resolve (addr, semicolon - addr, ipv4only,
             &local, &locallen);
     else
-        rc = nn_iface_resolve ("*", 1, ipv4only, &local, &locallen);
-    if (nn_slow (rc < 0)) {
-        nn_backoff_start (&self->retry);
-        self->state = NN_CTCP_STATE_WAITING;
-        return;
-    }
-
-    /*  Combine the remote address and the port. */
-    remote = *ss;
-    remotelen = sslen;
-    if (remote.ss_family == AF_INET)
-        ((struct sockaddr_in*) &remote)->sin_port = htons (port);
-    else if (remote.ss_family == AF_INET6)
-        ((struct sockaddr_in6*) &remote)->sin6_port = htons (port);
-    else
-        nn_assert (0);
+        rc = nn_iface_resolve ("*", 1, remote->ss_family == AF_INET,
+            &local, &locallen);
+    if (nn_slow (rc < 0))
+        return rc;
 
     /*  Try to start the underlying socket. */
-    rc = nn_usock_start (&self->usock, remote.ss_family, SOCK_STREAM, 0);
-    if (nn_slow (rc < 0)) {
-        nn_backoff_start (&self->retry);
-        self->state = NN_CTCP_STATE_WAITING;
-        return;
-    }
+    rc = nn_usock_start (usock, remote->ss_family, SOCK_STREAM, 0);
+    if (nn_slow (rc < 0))
+        return rc;
 
     /*  Set the relevant socket options. */
-    sz = sizeof (val);
-    nn_ep_getopt (self->ep, NN_SOL_SOCKET, NN_SNDBUF, &val, &sz);
-    nn_assert (sz == sizeof (val));
-    nn_usock_setsockopt (&self->usock, SOL_SOCKET, SO_SNDBUF,
-        &val, sizeof (val));
-    sz = sizeof (val);
-    nn_ep_getopt (self->ep, NN_SOL_SOCKET, NN_RCVBUF, &val, &sz);
-    nn_assert (sz == sizeof (val));
-    nn_usock_setsockopt (&self->usock, SOL_SOCKET, SO_RCVBUF,
-        &val, sizeof (val));
+    nn_tcp_setsockopts (usock, self->ep);
 
     /*  Bind the socket to the local network interface. */
-    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &local, locallen);
+    rc = nn_usock_bind (usock, (struct sockaddr*) &local, locallen);
     if (nn_slow (rc != 0)) {
-        nn_backoff_start (&self->retry);
-        self->state = NN_CTCP_STATE_WAITING;
-        return;
+        nn_usock_stop (usock);
+        return rc;
     }
 
+    nn_tcp_setfastopen (usock, self->ep, 0);
+
     /*  Start connecting. */
-    nn_usock_connect (&self->usock, (struct sockaddr*) &remote, remotelen);
-    self->state = NN_CTCP_STATE_CONNECTING;
-    nn_ep_stat_increment (self->ep, NN_STAT_INPROGRESS_CONNECTIONS, 1);
+    nn_usock_connect (usock, (struct sockaddr*) remote, remotelen);
+    return 0;
+}
+
+/*  The connection was established using the socket. Stop the remaining
+    attempts and hand the socket over to the stcp state machine. */
+static void nn_ctcp_connected (struct nn_ctcp *self, struct nn_usock *usock)
+{
+    int i;
+
+    nn_timer_stop (&self->delay);
+    for (i = 0; i != NN_CTCP_ATTEMPTS; ++i) {
+        if (&self->usocks [i] == usock) {
+            if (self->tlshost)
+                nn_ctcp_settlshost (self,
+                    self->addrhosts [self->attempts [i]]);
+            continue;
+        }
+        nn_usock_stop (&self->usocks [i]);
+    }
+
+    nn_backoff_release (&self->retry);
+    nn_backoff_reset (&self->retry);
+    self->usock = usock;
+    nn_stcp_start (&self->stcp, usock);
+    self->state = NN_CTCP_STATE_ACTIVE;
+    nn_ep_stat_increment (self->ep, NN_STAT_INPROGRESS_CONNECTIONS, -1);
+    nn_ep_stat_increment (self->ep, NN_STAT_ESTABLISHED_CONNECTIONS, 1);
+    nn_ep_clear_error (self->ep);
+}
+
+/*  Returns 1 if none of the sockets and neither the attempt delay timer are
+    in use. */
+static int nn_ctcp_isquiet (struct nn_ctcp *self)
+{
+    int i;
+
+    if (!nn_timer_isidle (&self->delay))
+        return 0;
+    for (i = 0; i != NN_CTCP_ATTEMPTS; ++i)
+        if (!nn_usock_isidle (&self->usocks [i]))
+            return 0;
+    return 1;
+}
+
+/*  Waits before reconnecting once all the sockets have stopped. */
+static void nn_ctcp_quiesced (struct nn_ctcp *self)
+{
+    if (!nn_ctcp_isquiet (self))
+        return;
+    nn_backoff_start (&self->retry);
+    self->state = NN_CTCP_STATE_WAITING;
+}
+
+/*  Stores the name of the host into the buffer for the TLS handshake.
+    The brackets around an IPv6 literal are not part of the address. */
+static void nn_ctcp_settlshost (struct nn_ctcp *self, int host)
+{
+    const char *name;
+    size_t namelen;
+
+    name = self->hosts [host].name;
+    namelen = self->hosts [host].namelen;
+    if (*name == '[' && namelen >= 2 && name [namelen - 1] == ']') {
+        ++name;
+        namelen -= 2;
+    }
+    memcpy (self->tlshost, name, namelen);
+    self->tlshost [namelen] = 0;
 }
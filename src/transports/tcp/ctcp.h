@@ -26,9 +26,17 @@
 
 #include "../../transport.h"
 
-/*  State machine managing connected TCP socket. */
+/*  Maximum number of connections a single logical pipe can be striped over. */
+#define NN_CTCP_MAX_STRIPES 16
 
-int nn_ctcp_create (struct nn_ep *);
+/*  State machine managing connected TCP socket. If 'tls' is not NULL, the
+    connection is secured using the TLS context. The endpoint holds
+    a reference to the context of its own. If 'rdma' is set, the connection
+    is only used to set up a verbs queue pair that carries the messages. */
+
+struct ssl_ctx_st;
+
+int nn_ctcp_create (struct nn_ep *, struct ssl_ctx_st *tls, int rdma);
 
 #endif
 
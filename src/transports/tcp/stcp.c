@@ -22,12 +22,24 @@
 */
 
 #include "stcp.h"
+#include "ctcp.h"
+
+#include "../utils/crc32c.h"
+
+#include "../../tcp.h"
+#include "../../rdma.h"
 
 #include "../../utils/err.h"
+#include "../../utils/alloc.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
+#include "../../utils/trace.h"
+#include "../../utils/chunk.h"
+
+#include <string.h>
 
 /*  States of the object as a whole. */
 #define NN_STCP_STATE_IDLE 1
@@ -37,26 +49,61 @@
 #define NN_STCP_STATE_SHUTTING_DOWN 5
 #define NN_STCP_STATE_DONE 6
 #define NN_STCP_STATE_STOPPING 7
+#define NN_STCP_STATE_HANDSHAKE 8
+#define NN_STCP_STATE_RDMASETUP 9
+#define NN_STCP_STATE_GROUPHDR 10
 
 /*  Possible states of the inbound part of the object. */
 #define NN_STCP_INSTATE_HDR 1
 #define NN_STCP_INSTATE_BODY 2
 #define NN_STCP_INSTATE_HASMSG 3
 
-/*  Possible states of the outbound part of the object. */
+/*  Possible states of the outbound part of the object. The pipe is either
+    accepting messages or waiting for the outbound queue to drain. */
 #define NN_STCP_OUTSTATE_IDLE 1
 #define NN_STCP_OUTSTATE_SENDING 2
 
 /*  Subordinate srcptr objects. */
 #define NN_STCP_SRC_USOCK 1
 #define NN_STCP_SRC_STREAMHDR 2
+#define NN_STCP_SRC_FLUSH 3
+#define NN_STCP_SRC_RDMAFD 4
+#define NN_STCP_SRC_RDMASTART 5
+#define NN_STCP_SRC_RDMASTOP 6
+#define NN_STCP_SRC_HEARTBEAT 7
+
+/*  Markers in the top byte of the size of a batch frame and of a heartbeat
+    frame. With checksums, a message sent in pieces is marked as one that
+    is not checked, as its checksum is not known when its header is sent. */
+#define NN_STCP_BATCH 0x80
+#define NN_STCP_HEARTBEAT 0x81
+#define NN_STCP_UNCHECKED 0x82
+
+/*  Steps of the queue pair setup that are done. */
+#define NN_STCP_RDMASETUP_SENT 1
+#define NN_STCP_RDMASETUP_RECEIVED 2
 
 /*  Stream is a special type of pipe. Implementation of the virtual pipe API. */
 static int nn_stcp_send (struct nn_pipebase *self, struct nn_msg *msg);
 static int nn_stcp_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_stcp_queued (struct nn_pipebase *self);
+static void nn_stcp_disconnect (struct nn_pipebase *self);
 const struct nn_pipebase_vfptr nn_stcp_pipebase_vfptr = {
     nn_stcp_send,
-    nn_stcp_recv
+    nn_stcp_recv,
+    nn_stcp_queued,
+    NULL,
+    nn_stcp_disconnect
+};
+
+/*  Message sent by reference, waiting for the kernel to release its data. */
+struct nn_stcp_zcmsg {
+    struct nn_list_item item;
+
+    /*  The message is released once nn_usock_zcdone reaches this value. */
+    uint32_t seq;
+
+    struct nn_msg msg;
 };
 
 /*  Private functions. */
@@ -64,9 +111,37 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_stcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
-
-void nn_stcp_init (struct nn_stcp *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner)
+static void nn_stcp_flush (struct nn_stcp *self);
+static size_t nn_stcp_puthdr (struct nn_stcp *self, uint8_t *hdr,
+    uint64_t size, struct nn_msg *msg, struct nn_msg_frame *frame);
+static uint32_t nn_stcp_checksum (struct nn_msg *msg,
+    struct nn_msg_frame *frame, int alg);
+static void nn_stcp_pushbatch (struct nn_stcp *self);
+static void nn_stcp_heartbeat (struct nn_stcp *self);
+static int nn_stcp_hdrflags (struct nn_stcp *self);
+static int nn_stcp_hdralgs (struct nn_stcp *self);
+static int nn_stcp_grouphdr (struct nn_stcp *self);
+static int nn_stcp_activate (struct nn_stcp *self);
+static int nn_stcp_recv_body (struct nn_stcp *self);
+static int nn_stcp_recv_msg (struct nn_stcp *self);
+static void nn_stcp_recv_next (struct nn_stcp *self);
+static int nn_stcp_recv_done (struct nn_stcp *self);
+static void nn_stcp_zcrelease (struct nn_stcp *self, int all);
+static void nn_stcp_msgterm (struct nn_msg *msg);
+#if defined NN_HAVE_RDMA
+static int nn_stcp_rdma_setup (struct nn_stcp *self);
+static int nn_stcp_rdma_activate (struct nn_stcp *self);
+static void nn_stcp_rdma_close (struct nn_stcp *self);
+static void nn_stcp_rdma_event (struct nn_stcp *self, int src);
+static int nn_stcp_rdma_send (struct nn_stcp *self, struct nn_msg *msg);
+static int nn_stcp_rdma_recv (struct nn_stcp *self, struct nn_msg *msg);
+static int nn_stcp_rdma_write (struct nn_stcp *self);
+static int nn_stcp_rdma_read (struct nn_stcp *self);
+#endif
+
+void nn_stcp_init (struct nn_stcp *self, int src, struct nn_ep *ep,
+    struct ssl_ctx_st *tls, const char *tlshost, int rdma,
+    uint64_t group, int stripes, int bulk, struct nn_fsm *owner)
 {
     nn_fsm_init (&self->fsm, nn_stcp_handler, nn_stcp_shutdown,
         src, self, owner);
@@ -77,9 +152,49 @@ void nn_stcp_init (struct nn_stcp *self, int src,
     self->usock_owner.fsm = NULL;
     nn_pipebase_init (&self->pipebase, &nn_stcp_pipebase_vfptr, ep);
     self->instate = -1;
+    self->inhdrlen = 8;
     nn_msg_init (&self->inmsg, 0);
+    self->checksum = 0;
+    self->incheck = 0;
+    self->incrc = 0;
+    self->insum = 0;
+    nn_compress_init (&self->compress);
+    self->inalg = 0;
+    nn_batch_init (&self->batch);
+    self->inbatch = 0;
+    nn_pieces_init (&self->pieces);
+    nn_heartbeat_init (&self->heartbeat, NN_STCP_SRC_HEARTBEAT, &self->fsm);
+    self->inheartbeat = 0;
+    self->rcvtstamp = 0;
+    self->intstamp = 0;
     self->outstate = -1;
+    nn_outq_init (&self->outq);
+    nn_outq_setdtor (&self->outq, nn_stcp_msgterm);
+    self->zcthreshold = 0;
+    self->zcbusy = 0;
+    nn_list_init (&self->zcmsgs);
+    self->cork = 0;
+    nn_fsm_event_init (&self->flush);
+    self->tls = tls;
+    self->tlshost = tlshost;
+    self->rdma = rdma;
+    self->group = group;
+    self->stripes = stripes;
+    self->bulk = bulk;
+#if defined NN_HAVE_RDMA
+    nn_verbs_init (&self->verbs);
+    self->worker = NULL;
+    nn_worker_fd_init (&self->rdmafd, NN_STCP_SRC_RDMAFD, &self->fsm);
+    nn_worker_task_init (&self->rdmastart, NN_STCP_SRC_RDMASTART, &self->fsm);
+    nn_worker_task_init (&self->rdmastop, NN_STCP_SRC_RDMASTOP, &self->fsm);
+    self->rdmawatch = 0;
+    self->rdmaadded = 0;
     nn_msg_init (&self->outmsg, 0);
+    self->outpos = 0;
+    self->inpos = 0;
+#else
+    nn_assert (!rdma);
+#endif
     nn_fsm_event_init (&self->done);
 }
 
@@ -88,7 +203,21 @@ void nn_stcp_term (struct nn_stcp *self)
     nn_assert_state (self, NN_STCP_STATE_IDLE);
 
     nn_fsm_event_term (&self->done);
+#if defined NN_HAVE_RDMA
     nn_msg_term (&self->outmsg);
+    nn_worker_task_term (&self->rdmastop);
+    nn_worker_task_term (&self->rdmastart);
+    nn_worker_fd_term (&self->rdmafd);
+    nn_verbs_term (&self->verbs);
+#endif
+    nn_fsm_event_term (&self->flush);
+    nn_stcp_zcrelease (self, 1);
+    nn_list_term (&self->zcmsgs);
+    nn_outq_term (&self->outq);
+    nn_heartbeat_term (&self->heartbeat);
+    nn_pieces_term (&self->pieces);
+    nn_batch_term (&self->batch);
+    nn_compress_term (&self->compress);
     nn_msg_term (&self->inmsg);
     nn_pipebase_term (&self->pipebase);
     nn_streamhdr_term (&self->streamhdr);
@@ -121,51 +250,758 @@ void nn_stcp_stop (struct nn_stcp *self)
 static int nn_stcp_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_stcp *stcp;
-    struct nn_iovec iov [3];
+    uint8_t hdr [12];
+    size_t hdrlen;
+    uint64_t alg;
+    uint64_t size;
+    struct nn_file_region region;
+    struct nn_msg_frame *frame;
+    int rc;
 
     stcp = nn_cont (self, struct nn_stcp, pipebase);
 
     nn_assert_state (stcp, NN_STCP_STATE_ACTIVE);
     nn_assert (stcp->outstate == NN_STCP_OUTSTATE_IDLE);
+    nn_heartbeat_traffic (&stcp->heartbeat);
+
+#if defined NN_HAVE_RDMA
+    if (stcp->rdma)
+        return nn_stcp_rdma_send (stcp, msg);
+#endif
+
+    /*  The first piece of a message is preceded by the size of all of it,
+        the others by nothing at all. None of them is compressed or packed
+        into a frame. */
+    rc = NN_PIECES_NONE;
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 ||
+          stcp->pieces.outsize)) {
+        rc = nn_pieces_send (&stcp->pieces, msg, &size);
+        if (nn_slow (rc < 0)) {
+            nn_msg_term (msg);
+            stcp->state = NN_STCP_STATE_DONE;
+            nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+            return 0;
+        }
+        if (rc == NN_PIECES_DROP) {
+            nn_msg_term (msg);
+            nn_pipebase_sent (&stcp->pipebase);
+            return 0;
+        }
+    }
 
-    /*  Move the message to the local storage. */
-    nn_msg_term (&stcp->outmsg);
-    nn_msg_mv (&stcp->outmsg, msg);
+    if (nn_slow (rc == NN_PIECES_FIRST)) {
+        nn_stcp_pushbatch (stcp);
+        hdrlen = nn_stcp_puthdr (stcp, hdr, size, NULL, NULL);
+        nn_outq_push (&stcp->outq, hdr, hdrlen, msg);
+    }
+    else if (nn_slow (rc == NN_PIECES_NEXT))
+        nn_outq_push (&stcp->outq, hdr, 0, msg);
+    else if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0 &&
+          nn_msg_file (msg, &region))) {
+
+        /*  The file region follows the body. Checksums are not used in
+            this case (see nn_stcp_activate). The descriptor must stay
+            valid till the message is sent, so the queue gets a duplicate of
+            it. If there are no descriptors left, there's no way to deliver
+            the message as it is and the connection is dropped instead. */
+        rc = nn_msg_dupfile (msg);
+        if (nn_slow (rc < 0)) {
+            nn_msg_term (msg);
+            stcp->state = NN_STCP_STATE_DONE;
+            nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+            return 0;
+        }
+        nn_stcp_pushbatch (stcp);
+        nn_putll (hdr, nn_chunkref_size (&msg->sphdr) +
+            nn_msg_bodysize (msg) + region.length);
+        nn_outq_pushref (&stcp->outq, hdr, 8, msg);
+    }
 
-    /*  Serialise the message header. */
-    nn_putll (stcp->outhdr, nn_chunkref_size (&stcp->outmsg.sphdr) +
-        nn_chunkref_size (&stcp->outmsg.body));
+    /*  While a write is in progress, or the messages are corked, a small
+        message is packed into the batch frame along with the others sent
+        in the meantime. The frame is queued once it's full. Urgent messages
+        are not held back that way. */
+    else if (!msg->urgent && nn_batch_fits (&stcp->batch, msg) &&
+          (nn_outq_busy (&stcp->outq) || stcp->cork)) {
+        if (nn_batch_add (&stcp->batch, msg))
+            nn_stcp_pushbatch (stcp);
+    }
+    else {
+
+        /*  The frame goes first so that the order of messages is kept.
+            An urgent message overtakes it anyway. */
+        if (nn_fast (!msg->urgent))
+            nn_stcp_pushbatch (stcp);
+
+        /*  Compress the message if it's worth it. The algorithm is passed
+            in the top byte of the size. */
+        alg = 0;
+        frame = nn_pipebase_frame (&stcp->pipebase);
+        if (nn_slow (nn_compress_msg (&stcp->compress, msg, frame)))
+            alg = (uint64_t) nn_compress_alg (&stcp->compress) << 56;
+
+        /*  Serialise the message header and queue the message. */
+        hdrlen = nn_stcp_puthdr (stcp, hdr, (nn_chunkref_size (&msg->sphdr) +
+            nn_msg_bodysize (msg)) | alg, msg, frame);
+        if (nn_slow (msg->urgent))
+            nn_outq_pushurgent (&stcp->outq, hdr, hdrlen, msg);
+        else
+            nn_outq_push (&stcp->outq, hdr, hdrlen, msg);
+    }
 
-    /*  Start async sending. */
-    iov [0].iov_base = stcp->outhdr;
-    iov [0].iov_len = sizeof (stcp->outhdr);
-    iov [1].iov_base = nn_chunkref_data (&stcp->outmsg.sphdr);
-    iov [1].iov_len = nn_chunkref_size (&stcp->outmsg.sphdr);
-    iov [2].iov_base = nn_chunkref_data (&stcp->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&stcp->outmsg.body);
-    nn_usock_send (stcp->usock, iov, 3);
+    /*  If nothing is being sent at the moment, start sending straight
+        away. Otherwise the message will be sent along with the others
+        queued in the meantime once the current write is done. When corked,
+        the write is postponed till the context is left so that it carries
+        all the messages sent in the meantime. */
+    if (!nn_outq_busy (&stcp->outq)) {
+        if (!stcp->cork)
+            nn_stcp_flush (stcp);
+        else if (!nn_fsm_event_active (&stcp->flush))
+            nn_fsm_post (&stcp->fsm, &stcp->flush, NN_STCP_SRC_FLUSH, 0);
+    }
 
-    stcp->outstate = NN_STCP_OUTSTATE_SENDING;
+    /*  Unless the queue is full, the pipe remains writable. */
+    if (nn_slow (nn_outq_full (&stcp->outq))) {
+        stcp->outstate = NN_STCP_OUTSTATE_SENDING;
+        return 0;
+    }
+    nn_pipebase_sent (&stcp->pipebase);
 
     return 0;
 }
 
+/*  Serialises the header of a frame of 'size' bytes, followed by
+    the checksum of the frame if checksums are used, and returns its length.
+    'msg' is NULL for the first piece of a message. 'frame' is the framing
+    the message shares with other connections, if any. */
+static size_t nn_stcp_puthdr (struct nn_stcp *self, uint8_t *hdr,
+    uint64_t size, struct nn_msg *msg, struct nn_msg_frame *frame)
+{
+    if (nn_fast (!self->checksum)) {
+        nn_putll (hdr, size);
+        return 8;
+    }
+    if (nn_slow (!msg)) {
+        nn_putll (hdr, size | (uint64_t) NN_STCP_UNCHECKED << 56);
+        nn_putl (hdr + 8, 0);
+        return 12;
+    }
+    nn_putll (hdr, size);
+    nn_putl (hdr + 8, nn_stcp_checksum (msg, frame, (int) (size >> 56)));
+    return 12;
+}
+
+/*  Returns the checksum of the payload of the frame, i.e. of the SP header,
+    the body and the parts that follow it. 'alg' is the top byte of the size
+    of the frame. If 'frame' isn't NULL, the checksum is shared with the
+    other connections the message is sent to. */
+static uint32_t nn_stcp_checksum (struct nn_msg *msg,
+    struct nn_msg_frame *frame, int alg)
+{
+    uint32_t crc;
+    int i;
+
+    if (frame && frame->crcalg == alg)
+        return frame->crc;
+
+    crc = nn_crc32c (0, nn_chunkref_data (&msg->sphdr),
+        nn_chunkref_size (&msg->sphdr));
+    crc = nn_crc32c (crc, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body));
+    for (i = 0; i != msg->nparts; ++i)
+        crc = nn_crc32c (crc, msg->parts [i], nn_chunk_size (msg->parts [i]));
+    if (frame && frame->crcalg < 0) {
+        frame->crcalg = alg;
+        frame->crc = crc;
+    }
+    return crc;
+}
+
+static void nn_stcp_pushbatch (struct nn_stcp *self)
+{
+    int rc;
+    struct nn_msg msg;
+    uint8_t hdr [12];
+    size_t hdrlen;
+
+    rc = nn_batch_close (&self->batch, &msg);
+    if (nn_fast (rc == 0))
+        return;
+    hdrlen = nn_stcp_puthdr (self, hdr, (nn_chunkref_size (&msg.sphdr) +
+        nn_chunkref_size (&msg.body)) |
+        (rc == NN_BATCH_FRAME ? (uint64_t) NN_STCP_BATCH << 56 : 0), &msg,
+        NULL);
+    nn_outq_push (&self->outq, hdr, hdrlen, &msg);
+}
+
+static void nn_stcp_heartbeat (struct nn_stcp *self)
+{
+    struct nn_msg msg;
+    uint8_t hdr [12];
+    size_t hdrlen;
+
+    /*  A heartbeat can't be squeezed in between the pieces of a message.
+        Nor is there any point in queueing one if the peer isn't reading
+        what's queued already. */
+    if (nn_slow (self->pieces.outsize || nn_outq_full (&self->outq)))
+        return;
+
+    /*  The frame overtakes the messages not being written yet so that
+        the peer hears from us as soon as possible. */
+    nn_msg_init (&msg, NN_HEARTBEAT_SIZE);
+    nn_heartbeat_put (&self->heartbeat, nn_chunkref_data (&msg.body));
+    hdrlen = nn_stcp_puthdr (self, hdr, NN_HEARTBEAT_SIZE |
+        (uint64_t) NN_STCP_HEARTBEAT << 56, &msg, NULL);
+    nn_outq_pushurgent (&self->outq, hdr, hdrlen, &msg);
+    if (!nn_outq_busy (&self->outq))
+        nn_stcp_flush (self);
+}
+
+static int nn_stcp_hdrflags (struct nn_stcp *self)
+{
+    int opt;
+    size_t opt_sz;
+
+    /*  Messages passed through queue pairs can't be striped, nor packed
+        into batch frames. Nothing but the messages is passed that way,
+        so there are no heartbeats or checksums either. */
+    if (self->rdma)
+        return 0;
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_CHECKSUM,
+        &opt, &opt_sz);
+    return NN_STREAMHDR_CANGROUP | NN_STREAMHDR_CANBATCH |
+        NN_STREAMHDR_CANHEARTBEAT | NN_STREAMHDR_CANCHECKSUM |
+        (opt ? NN_STREAMHDR_CHECKSUM : 0) |
+        (self->group ? NN_STREAMHDR_GROUP : 0) |
+        (self->bulk ? NN_STREAMHDR_SPLIT : 0) |
+        (self->bulk == NN_STCP_BULK ? NN_STREAMHDR_BULK : 0);
+}
+
+static int nn_stcp_hdralgs (struct nn_stcp *self)
+{
+    /*  Nor are they compressed. */
+    if (self->rdma)
+        return 0;
+    return nn_compress_supported ();
+}
+
+static int nn_stcp_grouphdr (struct nn_stcp *self)
+{
+    struct nn_iovec iov;
+
+    if (self->rdma)
+        return 0;
+
+    /*  The connecting side asks for the connection to be striped by setting
+        the flag in the protocol header. If the peer is unable to do so,
+        the connection is used as a pipe of its own. */
+    if (self->group) {
+        if (!(self->streamhdr.peerflags & NN_STREAMHDR_CANGROUP))
+            return 0;
+        nn_putll (self->grouphdr, self->group);
+        nn_putl (self->grouphdr + 8, (uint32_t) self->stripes);
+        iov.iov_base = self->grouphdr;
+        iov.iov_len = sizeof (self->grouphdr);
+        nn_usock_send (self->usock, &iov, 1);
+        return 1;
+    }
+    if (self->streamhdr.peerflags & NN_STREAMHDR_GROUP) {
+        nn_usock_recv (self->usock, self->grouphdr,
+            sizeof (self->grouphdr), NULL);
+        return 1;
+    }
+    return 0;
+}
+
+static int nn_stcp_activate (struct nn_stcp *self)
+{
+    int rc;
+    int opt;
+    int idle;
+    size_t opt_sz = sizeof (opt);
+    size_t maxmsgs;
+    uint64_t group;
+    int stripes;
+    int bulk;
+    int alg;
+
+    /*  Join the other stripes of the pipe, if there are any. */
+    group = 0;
+    stripes = 0;
+    bulk = 0;
+    if (self->group ? (self->streamhdr.peerflags & NN_STREAMHDR_CANGROUP) :
+          (self->streamhdr.peerflags & NN_STREAMHDR_GROUP)) {
+        group = nn_getll (self->grouphdr);
+        stripes = (int) nn_getl (self->grouphdr + 8);
+        if (self->group)
+            bulk = self->bulk;
+        else if (self->streamhdr.peerflags & NN_STREAMHDR_SPLIT)
+            bulk = (self->streamhdr.peerflags & NN_STREAMHDR_BULK) ?
+                NN_STCP_BULK : NN_STCP_MAIN;
+    }
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_STRIPE_ORDERED,
+        &opt, &opt_sz);
+    nn_pipebase_setgroup (&self->pipebase, group, stripes, bulk ? 0 : opt);
+
+    /*  If the pipe is split, the messages of each class keep their order
+        as each class is carried by a connection of its own. Either side
+        sends over the bulk connection according to its own threshold.
+        A bound endpoint without one sends everything over the main one. */
+    if (bulk) {
+        nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_BULK_THRESHOLD,
+            &opt, &opt_sz);
+        nn_pipebase_setbulk (&self->pipebase, bulk == NN_STCP_BULK,
+            opt > 0 ? (size_t) opt : SIZE_MAX);
+    }
+
+    /*  Checksums are used in both directions if either side asks for them
+        and both are able to check them. The header of each frame is then
+        followed by the checksum. */
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_CHECKSUM,
+        &opt, &opt_sz);
+    self->checksum = !self->rdma &&
+        (self->streamhdr.peerflags & NN_STREAMHDR_CANCHECKSUM) &&
+        (opt || (self->streamhdr.peerflags & NN_STREAMHDR_CHECKSUM));
+    self->inhdrlen = self->checksum ? 12 : 8;
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Let the kernel send the file regions attached to the messages if
+        it's able to. Otherwise, they are read into the messages
+        beforehand, as they are when the checksums are used, which need
+        the data to be read anyway. */
+    if (!self->rdma)
+        nn_pipebase_setsendfile (&self->pipebase, !self->checksum &&
+            nn_usock_cansendfile (self->usock));
+#endif
+
+    /*  Messages can be passed in pieces, except through queue pairs. */
+    nn_pipebase_setpieces (&self->pipebase, !self->rdma);
+
+    /*  Start the pipe. */
+    rc = nn_pipebase_start (&self->pipebase);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Let the batch buffer grow as configured. */
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_RCVBATCH,
+        &opt, &opt_sz);
+    nn_usock_setbatch (self->usock, (size_t) opt);
+
+    /*  Enable zero-copy sends if asked to and supported. */
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_ZEROCOPY,
+        &opt, &opt_sz);
+    self->zcthreshold = 0;
+    if (opt > 0 && nn_usock_setzerocopy (self->usock) == 0)
+        self->zcthreshold = (size_t) opt;
+
+    /*  Have the messages carry the time the kernel received them, if asked
+        to and supported. A message gets the time of the read that completed
+        the header of its frame. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_RCVTIMESTAMP,
+        &opt, &opt_sz);
+    self->rcvtstamp = !self->rdma && opt &&
+        nn_usock_settimestamps (self->usock) == 0;
+
+    /*  Let the messages that don't fit into the batch wait in the backlog,
+        if asked to. */
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_SNDQUEUE_MSGS, &opt, &opt_sz);
+    maxmsgs = (size_t) opt;
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_SNDQUEUE_BYTES, &opt, &opt_sz);
+    nn_outq_setlimits (&self->outq, maxmsgs, (size_t) opt);
+
+    nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_CORK,
+        &opt, &opt_sz);
+    self->cork = opt;
+
+    /*  Compress the messages if asked to and the peer is able to
+        decompress them. */
+    if (!self->rdma) {
+        nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_COMPRESS,
+            &alg, &opt_sz);
+        nn_pipebase_getopt (&self->pipebase, NN_TCP,
+            NN_TCP_COMPRESS_THRESHOLD, &opt, &opt_sz);
+        nn_compress_start (&self->compress, alg, (size_t) opt,
+            self->streamhdr.peeralgs);
+
+        /*  Pack small messages into batch frames if asked to and the peer
+            is able to unpack them. */
+        nn_pipebase_getopt (&self->pipebase, NN_TCP, NN_TCP_BATCH,
+            &opt, &opt_sz);
+        nn_batch_start (&self->batch, (size_t) opt,
+            self->streamhdr.peerflags);
+    }
+
+    /*  Start receiving a message in asynchronous manner. */
+    self->instate = NN_STCP_INSTATE_HDR;
+    nn_usock_recv (self->usock, &self->inhdr, self->inhdrlen, NULL);
+
+    /*  Mark the pipe as available for sending. */
+    self->outstate = NN_STCP_OUTSTATE_IDLE;
+
+    self->state = NN_STCP_STATE_ACTIVE;
+
+    /*  Start sending heartbeats if asked to, letting the peer know how
+        often to expect them, and watch for the connection going idle. */
+    if (!self->rdma) {
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_IDLE_TIMEOUT, &idle, &opt_sz);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_HEARTBEAT_IVL, &opt, &opt_sz);
+        if (nn_heartbeat_start (&self->heartbeat, opt,
+              self->streamhdr.peerflags & NN_STREAMHDR_CANHEARTBEAT ?
+              1 : 0, idle) == NN_HEARTBEAT_SEND)
+            nn_stcp_heartbeat (self);
+    }
+
+    return 0;
+}
+
+static void nn_stcp_flush (struct nn_stcp *self)
+{
+    struct nn_iovec iov [NN_OUTQ_MAXIOV];
+    int iovcnt;
+    struct nn_msg *msg;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_file_region region;
+#endif
+
+    iovcnt = nn_outq_start (&self->outq, iov);
+    msg = nn_outq_msg (&self->outq);
+    nn_heartbeat_sent (&self->heartbeat);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Only the referenced message of the batch may carry a file region. */
+    if (nn_slow (msg && nn_chunkref_size (&msg->hdrs) != 0 &&
+          nn_msg_file (msg, &region))) {
+        nn_usock_send_file (self->usock, iov, iovcnt, region.fd,
+            region.offset, region.length);
+        return;
+    }
+#endif
+
+    /*  Large body is passed to the kernel by reference. The body has to be
+        a chunk of its own rather than data stored inside the message,
+        as the message gets moved once the write is done. */
+    if (nn_slow (self->zcthreshold && msg &&
+          nn_chunkref_size (&msg->body) >= self->zcthreshold &&
+          nn_chunkref_size (&msg->body) >= NN_CHUNKREF_MAX)) {
+        self->zcbusy = 1;
+        nn_usock_send_zerocopy (self->usock, iov, iovcnt,
+            iovcnt - msg->nparts - 1);
+        return;
+    }
+
+    nn_usock_send (self->usock, iov, iovcnt);
+}
+
+static void nn_stcp_zcrelease (struct nn_stcp *self, int all)
+{
+    uint32_t done;
+    struct nn_list_item *it;
+    struct nn_stcp_zcmsg *zcmsg;
+
+    /*  When shutting down, there's no point in waiting for the kernel. */
+    done = all ? 0 : nn_usock_zcdone (self->usock);
+    while (!nn_list_empty (&self->zcmsgs)) {
+        it = nn_list_begin (&self->zcmsgs);
+        zcmsg = nn_cont (it, struct nn_stcp_zcmsg, item);
+        if (!all && (int32_t) (done - zcmsg->seq) < 0)
+            return;
+        nn_list_erase (&self->zcmsgs, it);
+        nn_list_item_term (&zcmsg->item);
+        nn_msg_term (&zcmsg->msg);
+        nn_free (zcmsg);
+    }
+}
+
+static void nn_stcp_msgterm (struct nn_msg *msg)
+{
+    /*  Close the duplicate of the file descriptor once the message is sent
+        or dropped. Other messages don't carry any. */
+    if (nn_slow (nn_chunkref_size (&msg->hdrs) != 0))
+        nn_msg_closefile (msg);
+    nn_msg_term (msg);
+}
+
+static size_t nn_stcp_queued (struct nn_pipebase *self)
+{
+    struct nn_stcp *stcp;
+
+    stcp = nn_cont (self, struct nn_stcp, pipebase);
+
+#if defined NN_HAVE_RDMA
+    /*  The message waiting for free slots. */
+    if (stcp->rdma)
+        return stcp->outstate == NN_STCP_OUTSTATE_SENDING ? 1 : 0;
+#endif
+
+    return nn_outq_count (&stcp->outq) + nn_batch_count (&stcp->batch);
+}
+
+static void nn_stcp_disconnect (struct nn_pipebase *self)
+{
+    struct nn_stcp *stcp;
+
+    stcp = nn_cont (self, struct nn_stcp, pipebase);
+
+    /*  Handled the same way as a protocol error. The owner stops the object
+        once the error is delivered, which also removes the pipe from the
+        socket. */
+    if (stcp->state != NN_STCP_STATE_ACTIVE)
+        return;
+    stcp->state = NN_STCP_STATE_DONE;
+    nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+}
+
 static int nn_stcp_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
     struct nn_stcp *stcp;
 
     stcp = nn_cont (self, struct nn_stcp, pipebase);
 
     nn_assert_state (stcp, NN_STCP_STATE_ACTIVE);
     nn_assert (stcp->instate == NN_STCP_INSTATE_HASMSG);
+    nn_heartbeat_traffic (&stcp->heartbeat);
+
+#if defined NN_HAVE_RDMA
+    if (stcp->rdma)
+        return nn_stcp_rdma_recv (stcp, msg);
+#endif
 
     /*  Move received message to the user. */
     nn_msg_mv (msg, &stcp->inmsg);
     nn_msg_init (&stcp->inmsg, 0);
 
-    /*  Start receiving new message. */
+    /*  The rest of a batch frame is handed over first. */
+    if (nn_batch_next (&stcp->batch, &stcp->inmsg)) {
+        stcp->inmsg.rcvtime = nn_clock_us ();
+        if (nn_slow (stcp->intstamp))
+            nn_msg_addtimestamp (&stcp->inmsg, stcp->intstamp);
+        NN_TRACE (NN_TRACE_TRANSPORT_RECV, &stcp->pipebase,
+            nn_chunkref_size (&stcp->inmsg.body));
+        nn_pipebase_received (&stcp->pipebase);
+        return 0;
+    }
+
+    /*  The next piece of the message follows straight away. */
+    if (nn_slow (nn_pieces_receiving (&stcp->pieces))) {
+        nn_stcp_recv_next (stcp);
+        return 0;
+    }
+
+    /*  Start receiving new message. If all of it is already in the batch
+        buffer, parse it straight away so that the pipe stays readable and
+        the messages in a batch don't have to travel through the state
+        machine one by one. */
     stcp->instate = NN_STCP_INSTATE_HDR;
-    nn_usock_recv (stcp->usock, stcp->inhdr, sizeof (stcp->inhdr), NULL);
+    if (!nn_usock_tryrecv (stcp->usock, stcp->inhdr, stcp->inhdrlen)) {
+        nn_usock_recv (stcp->usock, stcp->inhdr, stcp->inhdrlen, NULL);
+        return 0;
+    }
+    rc = nn_stcp_recv_body (stcp);
+    if (nn_slow (rc < 0)) {
+        stcp->state = NN_STCP_STATE_DONE;
+        nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+    }
+
+    return 0;
+}
+
+static int nn_stcp_recv_body (struct nn_stcp *self)
+{
+    uint64_t size;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+
+    /*  Message header was received. Check that message size is acceptable
+        by comparing with NN_RCVMAXSIZE; if it's too large, the caller is
+        expected to drop the connection. The top byte holds the algorithm
+        the message is compressed with, if any, or marks a batch frame,
+        the messages of which are checked once it's received. */
+    size = nn_getll (self->inhdr);
+    self->inalg = (int) (size >> 56);
+    size &= 0x00ffffffffffffffULL;
+    self->inbatch = 0;
+
+    /*  The payload is checked against the checksum as it arrives, unless
+        the message was sent in pieces. */
+    if (nn_slow (self->checksum)) {
+        self->incheck = 1;
+        self->incrc = nn_getl (self->inhdr + 8);
+        self->insum = 0;
+        if (self->inalg == NN_STCP_UNCHECKED) {
+            self->inalg = 0;
+            self->incheck = 0;
+        }
+    }
+    if (nn_slow (self->rcvtstamp))
+        self->intstamp = nn_usock_rcvtimestamp (self->usock);
+    nn_heartbeat_received (&self->heartbeat);
+    if (nn_slow (self->inalg == NN_STCP_HEARTBEAT)) {
+        if (nn_slow (size != NN_HEARTBEAT_SIZE))
+            return -EPROTO;
+        self->inalg = 0;
+        self->inheartbeat = 1;
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, NN_HEARTBEAT_SIZE);
+        return nn_stcp_recv_msg (self);
+    }
+    if (nn_slow (self->inalg == NN_STCP_BATCH)) {
+        if (nn_slow (size > NN_BATCH_FRAMEMAX))
+            return -EPROTO;
+        self->inalg = 0;
+        self->inbatch = 1;
+    }
+    else if (nn_slow (self->inalg &&
+          (self->inalg & ~nn_compress_supported ()) != 0))
+        return -EPROTO;
+
+    /*  Message larger than NN_RCVPIECE is handed over in pieces, none of
+        which is subject to NN_RCVMAXSIZE. */
+    if (nn_slow (!self->inalg && !self->inbatch)) {
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPIECE, &opt, &opt_sz);
+        if (nn_slow (nn_pieces_recvstart (&self->pieces, size,
+              (size_t) opt))) {
+            nn_stcp_recv_next (self);
+            return 0;
+        }
+    }
+
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVMAXSIZE, &opt, &opt_sz);
+
+    if (!self->inbatch && opt >= 0 && size > (unsigned)opt)
+        return -EMSGSIZE;
+
+    /*  Allocate memory for the message, from the message pool set by
+        NN_RCVPOOL option if any. Compressed message is decompressed into
+        memory from the pool once it's received. */
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVPOOL, &opt, &opt_sz);
+    nn_msg_term (&self->inmsg);
+    nn_msg_init_type (&self->inmsg, (size_t) size,
+        self->inalg || self->inbatch ? 0 : opt);
+
+    return nn_stcp_recv_msg (self);
+}
+
+static void nn_stcp_recv_next (struct nn_stcp *self)
+{
+    int rc;
+    int type;
+    size_t opt_sz;
+
+    opt_sz = sizeof (type);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+        NN_RCVPOOL, &type, &opt_sz);
+    nn_pieces_recvnext (&self->pieces, &self->inmsg, type);
+    rc = nn_stcp_recv_msg (self);
+    errnum_assert (rc == 0, -rc);
+}
+
+static int nn_stcp_recv_msg (struct nn_stcp *self)
+{
+    size_t size;
+
+    /*  If the body is empty or already fully buffered, the message is
+        complete. */
+    size = nn_chunkref_size (&self->inmsg.body);
+    if (!size || nn_usock_tryrecv (self->usock,
+          nn_chunkref_data (&self->inmsg.body), size))
+        return nn_stcp_recv_done (self);
+
+    /*  Start receiving the message body. */
+    self->instate = NN_STCP_INSTATE_BODY;
+    nn_usock_recv (self->usock, nn_chunkref_data (&self->inmsg.body),
+        size, NULL);
+
+    return 0;
+}
+
+static int nn_stcp_recv_done (struct nn_stcp *self)
+{
+    int rc;
+    int maxsize;
+    int type;
+    size_t opt_sz;
+
+    /*  A message handed over in pieces is checked once its last piece
+        arrives. The pieces passed to the user already can't be taken back,
+        but the connection is dropped all the same. */
+    if (nn_slow (self->incheck)) {
+        self->insum = nn_crc32c (self->insum,
+            nn_chunkref_data (&self->inmsg.body),
+            nn_chunkref_size (&self->inmsg.body));
+        if (!nn_pieces_receiving (&self->pieces)) {
+            if (nn_slow (self->insum != self->incrc))
+                return -EPROTO;
+            self->incheck = 0;
+        }
+    }
+
+    /*  Heartbeat only tells how often the peer sends them. It's not passed
+        to the user and the next message is received straight away. */
+    if (nn_slow (self->inheartbeat)) {
+        self->inheartbeat = 0;
+        rc = nn_heartbeat_get (&self->heartbeat,
+            nn_chunkref_data (&self->inmsg.body));
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, 0);
+        self->instate = NN_STCP_INSTATE_HDR;
+        nn_usock_recv (self->usock, self->inhdr, self->inhdrlen, NULL);
+        return 0;
+    }
+
+    /*  Decompress the message. If the original one is larger than allowed,
+        the caller is expected to drop the connection as well. */
+    if (nn_slow (self->inalg)) {
+        opt_sz = sizeof (maxsize);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVMAXSIZE, &maxsize, &opt_sz);
+        opt_sz = sizeof (type);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPOOL, &type, &opt_sz);
+        rc = nn_compress_decompress (&self->compress, self->inalg,
+            &self->inmsg.body, maxsize, type);
+        if (nn_slow (rc < 0))
+            return rc;
+        self->inalg = 0;
+    }
+
+    /*  Unpack the batch frame. Its first message is received straight
+        away, the others once the previous one is picked up. */
+    if (nn_slow (self->inbatch)) {
+        opt_sz = sizeof (maxsize);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVMAXSIZE, &maxsize, &opt_sz);
+        opt_sz = sizeof (type);
+        nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+            NN_RCVPOOL, &type, &opt_sz);
+        rc = nn_batch_open (&self->batch, &self->inmsg, maxsize, type);
+        if (nn_slow (rc < 0))
+            return rc;
+        self->inbatch = 0;
+        nn_batch_next (&self->batch, &self->inmsg);
+    }
+
+    /*  Notify the owner that it can receive the message. */
+    self->instate = NN_STCP_INSTATE_HASMSG;
+    self->inmsg.rcvtime = nn_clock_us ();
+    if (nn_slow (self->intstamp))
+        nn_msg_addtimestamp (&self->inmsg, self->intstamp);
+    NN_TRACE (NN_TRACE_TRANSPORT_RECV, &self->pipebase,
+        nn_chunkref_size (&self->inmsg.body));
+    nn_pipebase_received (&self->pipebase);
 
     return 0;
 }
@@ -177,17 +1013,69 @@ static void nn_stcp_shutdown (struct nn_fsm *self, int src, int type,
 
     stcp = nn_cont (self, struct nn_stcp, fsm);
 
+    /*  Corked messages are dropped along with the rest of the queue. */
+    if (nn_slow (src == NN_STCP_SRC_FLUSH))
+        return;
+
+#if defined NN_HAVE_RDMA
+    /*  Completions are of no interest any more. The channel is not added
+        to the poller if the object is being stopped already, and it's
+        removed from it otherwise. */
+    if (src == NN_STCP_SRC_RDMAFD) {
+        nn_verbs_arm (&stcp->verbs);
+        return;
+    }
+    if (src == NN_STCP_SRC_RDMASTART)
+        return;
+    if (src == NN_STCP_SRC_RDMASTOP) {
+        if (stcp->rdmaadded) {
+            nn_worker_rm_fd (stcp->worker, &stcp->rdmafd);
+            stcp->rdmaadded = 0;
+        }
+        stcp->rdmawatch = 0;
+    }
+#endif
+
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
         nn_pipebase_stop (&stcp->pipebase);
         nn_streamhdr_stop (&stcp->streamhdr);
+        nn_heartbeat_stop (&stcp->heartbeat);
+#if defined NN_HAVE_RDMA
+        if (stcp->rdmawatch)
+            nn_worker_execute (stcp->worker, &stcp->rdmastop);
+#endif
         stcp->state = NN_STCP_STATE_STOPPING;
     }
     if (nn_slow (stcp->state == NN_STCP_STATE_STOPPING)) {
-        if (nn_streamhdr_isidle (&stcp->streamhdr)) {
+#if defined NN_HAVE_RDMA
+        if (stcp->rdmawatch)
+            return;
+#endif
+        if (nn_streamhdr_isidle (&stcp->streamhdr) &&
+              nn_heartbeat_isidle (&stcp->heartbeat)) {
             nn_usock_swap_owner (stcp->usock, &stcp->usock_owner);
             stcp->usock = NULL;
             stcp->usock_owner.src = -1;
             stcp->usock_owner.fsm = NULL;
+
+            /*  The connection may have broken in the middle of a write.
+                Drop whatever is left so that the queue starts afresh if
+                the state machine is started again. */
+            nn_outq_term (&stcp->outq);
+            nn_outq_init (&stcp->outq);
+            nn_outq_setdtor (&stcp->outq, nn_stcp_msgterm);
+            nn_batch_reset (&stcp->batch);
+            stcp->inbatch = 0;
+            stcp->incheck = 0;
+            nn_pieces_reset (&stcp->pieces);
+            stcp->inheartbeat = 0;
+            stcp->zcbusy = 0;
+            nn_stcp_zcrelease (stcp, 1);
+#if defined NN_HAVE_RDMA
+            if (stcp->rdma)
+                nn_stcp_rdma_close (stcp);
+#endif
+
             stcp->state = NN_STCP_STATE_IDLE;
             nn_fsm_stopped (&stcp->fsm, NN_STCP_STOPPED);
             return;
@@ -203,12 +1091,48 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
 {
     int rc;
     struct nn_stcp *stcp;
-    uint64_t size;
-    int opt;
-    size_t opt_sz = sizeof (opt);
+    struct nn_stcp_zcmsg *zcmsg;
 
     stcp = nn_cont (self, struct nn_stcp, fsm);
 
+    /*  Write out the corked messages, unless a write was started or the
+        connection broke in the meantime. */
+    if (src == NN_STCP_SRC_FLUSH) {
+        if (stcp->state == NN_STCP_STATE_ACTIVE &&
+              !nn_outq_busy (&stcp->outq)) {
+            nn_stcp_pushbatch (stcp);
+            if (nn_outq_haspending (&stcp->outq))
+                nn_stcp_flush (stcp);
+        }
+        return;
+    }
+
+    /*  Send a heartbeat if the connection was quiet, or drop it if the peer
+        is gone or if no messages were passed for too long. Once the
+        connection is broken, the timer is just left to wind down. */
+    if (src == NN_STCP_SRC_HEARTBEAT) {
+        rc = nn_heartbeat_event (&stcp->heartbeat, type,
+            stcp->state == NN_STCP_STATE_ACTIVE &&
+            stcp->instate == NN_STCP_INSTATE_HDR);
+        if (stcp->state != NN_STCP_STATE_ACTIVE)
+            return;
+        if (rc == NN_HEARTBEAT_SEND)
+            nn_stcp_heartbeat (stcp);
+        else if (rc == NN_HEARTBEAT_DEAD || rc == NN_HEARTBEAT_IDLE) {
+            nn_pipebase_stop (&stcp->pipebase);
+            stcp->state = NN_STCP_STATE_DONE;
+            nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+        }
+        return;
+    }
+
+#if defined NN_HAVE_RDMA
+    if (src == NN_STCP_SRC_RDMAFD || src == NN_STCP_SRC_RDMASTART) {
+        nn_stcp_rdma_event (stcp, src);
+        return;
+    }
+#endif
+
     switch (stcp->state) {
 
 /******************************************************************************/
@@ -220,10 +1144,50 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
         case NN_FSM_ACTION:
             switch (type) {
             case NN_FSM_START:
+#if defined NN_HAVE_TLS
+                if (stcp->tls) {
+                    nn_usock_starttls (stcp->usock, stcp->tls, stcp->tlshost);
+                    stcp->state = NN_STCP_STATE_HANDSHAKE;
+                    return;
+                }
+#endif
+                nn_streamhdr_start (&stcp->streamhdr, stcp->usock,
+                    &stcp->pipebase, nn_stcp_hdrflags (stcp),
+                    nn_stcp_hdralgs (stcp));
+                stcp->state = NN_STCP_STATE_PROTOHDR;
+                return;
+            default:
+                nn_fsm_bad_action (stcp->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (stcp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  HANDSHAKE state.                                                          */
+/*  TLS handshake is going on. The protocol header is exchanged once it's     */
+/*  done.                                                                     */
+/******************************************************************************/
+    case NN_STCP_STATE_HANDSHAKE:
+        switch (src) {
+
+        case NN_STCP_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SECURED:
                 nn_streamhdr_start (&stcp->streamhdr, stcp->usock,
-                    &stcp->pipebase);
+                    &stcp->pipebase, nn_stcp_hdrflags (stcp),
+                    nn_stcp_hdralgs (stcp));
                 stcp->state = NN_STCP_STATE_PROTOHDR;
                 return;
+            case NN_USOCK_SHUTDOWN:
+
+                /*  Wait for the ERROR event. */
+                return;
+            case NN_USOCK_ERROR:
+                stcp->state = NN_STCP_STATE_DONE;
+                nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                return;
             default:
                 nn_fsm_bad_action (stcp->state, src, type);
             }
@@ -274,33 +1238,144 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_STREAMHDR_STOPPED:
 
+#if defined NN_HAVE_RDMA
+                 /*  In RDMA mode, the queue pairs have to be set up before
+                     the pipe can be started. */
+                 if (stcp->rdma) {
+                     rc = nn_stcp_rdma_setup (stcp);
+                     if (nn_slow (rc < 0)) {
+                         stcp->state = NN_STCP_STATE_DONE;
+                         nn_fsm_raise (&stcp->fsm, &stcp->done,
+                             NN_STCP_ERROR);
+                         return;
+                     }
+                     stcp->state = NN_STCP_STATE_RDMASETUP;
+                     return;
+                 }
+#endif
+
+                 /*  If the connection is one of several a pipe is striped
+                     over, the identifier of the pipe is exchanged first. */
+                 if (nn_stcp_grouphdr (stcp)) {
+                     stcp->state = NN_STCP_STATE_GROUPHDR;
+                     return;
+                 }
+
                  /*  Start the pipe. */
-                 rc = nn_pipebase_start (&stcp->pipebase);
+                 rc = nn_stcp_activate (stcp);
                  if (nn_slow (rc < 0)) {
                     stcp->state = NN_STCP_STATE_DONE;
                     nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
                     return;
                  }
+                 return;
+
+            default:
+                nn_fsm_bad_action (stcp->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (stcp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  GROUPHDR state.                                                           */
+/*  Identifier of the striped pipe is being sent to the peer or received      */
+/*  from it.                                                                  */
+/******************************************************************************/
+    case NN_STCP_STATE_GROUPHDR:
+        switch (src) {
 
-                 /*  Start receiving a message in asynchronous manner. */
-                 stcp->instate = NN_STCP_INSTATE_HDR;
-                 nn_usock_recv (stcp->usock, &stcp->inhdr,
-                     sizeof (stcp->inhdr), NULL);
+        case NN_STCP_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SENT:
+                break;
 
-                 /*  Mark the pipe as available for sending. */
-                 stcp->outstate = NN_STCP_OUTSTATE_IDLE;
+            case NN_USOCK_RECEIVED:
 
-                 stcp->state = NN_STCP_STATE_ACTIVE;
-                 return;
+                /*  Check that the peer's idea of the pipe makes sense. */
+                if (nn_slow (nn_getll (stcp->grouphdr) == 0 ||
+                      nn_getl (stcp->grouphdr + 8) < 1 ||
+                      nn_getl (stcp->grouphdr + 8) > NN_CTCP_MAX_STRIPES)) {
+                    stcp->state = NN_STCP_STATE_DONE;
+                    nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                    return;
+                }
+                break;
+
+            case NN_USOCK_SHUTDOWN:
+                stcp->state = NN_STCP_STATE_SHUTTING_DOWN;
+                return;
+
+            case NN_USOCK_ERROR:
+                stcp->state = NN_STCP_STATE_DONE;
+                nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                return;
 
             default:
                 nn_fsm_bad_action (stcp->state, src, type);
             }
 
+            rc = nn_stcp_activate (stcp);
+            if (nn_slow (rc < 0)) {
+                stcp->state = NN_STCP_STATE_DONE;
+                nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+            }
+            return;
+
         default:
             nn_fsm_bad_source (stcp->state, src, type);
         }
 
+#if defined NN_HAVE_RDMA
+/******************************************************************************/
+/*  RDMASETUP state.                                                          */
+/*  Description of the local queue pair is being sent to the peer and that    */
+/*  of the peer's one is being received.                                      */
+/******************************************************************************/
+    case NN_STCP_STATE_RDMASETUP:
+        switch (src) {
+
+        case NN_STCP_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SENT:
+                stcp->rdmasetup |= NN_STCP_RDMASETUP_SENT;
+                break;
+
+            case NN_USOCK_RECEIVED:
+                stcp->rdmasetup |= NN_STCP_RDMASETUP_RECEIVED;
+                break;
+
+            case NN_USOCK_SHUTDOWN:
+                stcp->state = NN_STCP_STATE_SHUTTING_DOWN;
+                return;
+
+            case NN_USOCK_ERROR:
+                stcp->state = NN_STCP_STATE_DONE;
+                nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                return;
+
+            default:
+                nn_fsm_bad_action (stcp->state, src, type);
+            }
+
+            /*  Once both sides know about each other, connect the queue
+                pairs and start passing messages. */
+            if (stcp->rdmasetup ==
+                  (NN_STCP_RDMASETUP_SENT | NN_STCP_RDMASETUP_RECEIVED)) {
+                rc = nn_stcp_rdma_activate (stcp);
+                if (nn_slow (rc < 0)) {
+                    stcp->state = NN_STCP_STATE_DONE;
+                    nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                }
+            }
+            return;
+
+        default:
+            nn_fsm_bad_source (stcp->state, src, type);
+        }
+#endif
+
 /******************************************************************************/
 /*  ACTIVE state.                                                             */
 /******************************************************************************/
@@ -311,59 +1386,70 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
 
-                /*  The message is now fully sent. */
-                nn_assert (stcp->outstate == NN_STCP_OUTSTATE_SENDING);
-                stcp->outstate = NN_STCP_OUTSTATE_IDLE;
-                nn_msg_term (&stcp->outmsg);
-                nn_msg_init (&stcp->outmsg, 0);
-                nn_pipebase_sent (&stcp->pipebase);
+                /*  The kernel may still be using the data of a message sent
+                    by reference. Hold the message till it's done with it. */
+                if (stcp->zcbusy) {
+                    zcmsg = nn_alloc (sizeof (struct nn_stcp_zcmsg),
+                        "zero-copy message");
+                    alloc_assert (zcmsg);
+                    nn_list_item_init (&zcmsg->item);
+                    zcmsg->seq = nn_usock_zcsent (stcp->usock);
+                    nn_outq_detach (&stcp->outq, &zcmsg->msg);
+                    nn_list_insert (&stcp->zcmsgs, &zcmsg->item,
+                        nn_list_end (&stcp->zcmsgs));
+                    stcp->zcbusy = 0;
+                }
+                if (!nn_list_empty (&stcp->zcmsgs))
+                    nn_stcp_zcrelease (stcp, 0);
+
+                /*  The batch is now fully sent. Send the messages queued in
+                    the meantime, if any, in a single write. */
+                nn_outq_done (&stcp->outq);
+                nn_stcp_pushbatch (stcp);
+                if (nn_outq_haspending (&stcp->outq))
+                    nn_stcp_flush (stcp);
+                else
+                    nn_pipebase_drained (&stcp->pipebase);
+
+                /*  If the pipe was waiting for space in the queue, it can
+                    accept messages again. */
+                if (stcp->outstate == NN_STCP_OUTSTATE_SENDING &&
+                      !nn_outq_full (&stcp->outq)) {
+                    stcp->outstate = NN_STCP_OUTSTATE_IDLE;
+                    nn_pipebase_sent (&stcp->pipebase);
+                }
                 return;
 
             case NN_USOCK_RECEIVED:
 
+#if defined NN_HAVE_RDMA
+                /*  Once the queue pairs are connected, nothing is supposed
+                    to arrive on the connection. */
+                if (stcp->rdma) {
+                    nn_pipebase_stop (&stcp->pipebase);
+                    stcp->state = NN_STCP_STATE_DONE;
+                    nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                    return;
+                }
+#endif
+
                 switch (stcp->instate) {
                 case NN_STCP_INSTATE_HDR:
-
-                    /*  Message header was received. Check that message size
-                        is acceptable by comparing with NN_RCVMAXSIZE;
-                        if it's too large, drop the connection. */
-                    size = nn_getll (stcp->inhdr);
-
-                    nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
-                        NN_RCVMAXSIZE, &opt, &opt_sz);
-
-                    if (opt >= 0 && size > (unsigned)opt) {
+                    rc = nn_stcp_recv_body (stcp);
+                    if (nn_slow (rc < 0)) {
                         stcp->state = NN_STCP_STATE_DONE;
                         nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
-                        return;
-                    }
-
-                    /*  Allocate memory for the message. */
-                    nn_msg_term (&stcp->inmsg);
-                    nn_msg_init (&stcp->inmsg, (size_t) size);
-
-                    /*  Special case when size of the message body is 0. */
-                    if (!size) {
-                        stcp->instate = NN_STCP_INSTATE_HASMSG;
-                        nn_pipebase_received (&stcp->pipebase);
-                        return;
                     }
-
-                    /*  Start receiving the message body. */
-                    stcp->instate = NN_STCP_INSTATE_BODY;
-                    nn_usock_recv (stcp->usock,
-                        nn_chunkref_data (&stcp->inmsg.body),
-                       (size_t) size, NULL);
-
                     return;
 
                 case NN_STCP_INSTATE_BODY:
 
-                    /*  Message body was received. Notify the owner that it
-                        can receive it. */
-                    stcp->instate = NN_STCP_INSTATE_HASMSG;
-                    nn_pipebase_received (&stcp->pipebase);
-
+                    /*  Message body was received. */
+                    rc = nn_stcp_recv_done (stcp);
+                    if (nn_slow (rc < 0)) {
+                        stcp->state = NN_STCP_STATE_DONE;
+                        nn_fsm_raise (&stcp->fsm, &stcp->done, NN_STCP_ERROR);
+                    }
                     return;
 
                 default:
@@ -429,3 +1515,311 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
     }
 }
 
+
+#if defined NN_HAVE_RDMA
+
+static int nn_stcp_rdma_setup (struct nn_stcp *self)
+{
+    int rc;
+    int bufsz;
+    int bufs;
+    int gididx;
+    size_t opt_sz;
+    struct nn_iovec iov;
+
+    /*  Create the local queue pair. */
+    opt_sz = sizeof (bufsz);
+    nn_pipebase_getopt (&self->pipebase, NN_RDMA, NN_RDMA_BUFSZ,
+        &bufsz, &opt_sz);
+    opt_sz = sizeof (bufs);
+    nn_pipebase_getopt (&self->pipebase, NN_RDMA, NN_RDMA_BUFS,
+        &bufs, &opt_sz);
+    opt_sz = sizeof (gididx);
+    nn_pipebase_getopt (&self->pipebase, NN_RDMA, NN_RDMA_GID_INDEX,
+        &gididx, &opt_sz);
+    rc = nn_verbs_open (&self->verbs, (size_t) bufsz, bufs, gididx,
+        self->rdmaout);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Tell the peer how to reach it. */
+    iov.iov_base = self->rdmaout;
+    iov.iov_len = sizeof (self->rdmaout);
+    nn_usock_send (self->usock, &iov, 1);
+
+    /*  Start receiving the description of the peer's queue pair. */
+    nn_usock_recv (self->usock, self->rdmain, sizeof (self->rdmain), NULL);
+
+    self->rdmasetup = 0;
+
+    return 0;
+}
+
+static int nn_stcp_rdma_activate (struct nn_stcp *self)
+{
+    int rc;
+
+    rc = nn_verbs_connect (&self->verbs, self->rdmain);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Start the pipe. */
+    rc = nn_pipebase_start (&self->pipebase);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    self->outstate = NN_STCP_OUTSTATE_IDLE;
+    self->instate = NN_STCP_INSTATE_HDR;
+    self->inpos = 0;
+    self->state = NN_STCP_STATE_ACTIVE;
+
+    /*  Nothing more is expected on the connection. Reading from it tells
+        when the peer goes away. */
+    nn_usock_recv (self->usock, &self->rdmaeof, 1, NULL);
+
+    /*  Completions are waited for by the worker of the connection. Messages
+        that arrived before the channel is in its poller are picked up once
+        it is. */
+    self->worker = self->usock->worker;
+    self->rdmawatch = 1;
+    nn_worker_execute (self->worker, &self->rdmastart);
+
+    return 0;
+}
+
+static void nn_stcp_rdma_close (struct nn_stcp *self)
+{
+    nn_assert (!self->rdmawatch && !self->rdmaadded);
+
+    nn_verbs_close (&self->verbs);
+
+    /*  Drop the message that may have been sent only partially. */
+    nn_msg_term (&self->outmsg);
+    nn_msg_init (&self->outmsg, 0);
+}
+
+static void nn_stcp_rdma_event (struct nn_stcp *self, int src)
+{
+    int rc;
+
+    if (src == NN_STCP_SRC_RDMASTART) {
+        nn_worker_add_fd (self->worker, nn_verbs_fd (&self->verbs),
+            &self->rdmafd);
+        nn_worker_set_in (self->worker, &self->rdmafd);
+        self->rdmaadded = 1;
+    }
+
+    /*  Ask to be notified about the next completion before processing those
+        that are there already, so that none of them is missed. Once the
+        connection is broken, they are of no interest though. */
+    rc = nn_verbs_arm (&self->verbs);
+    if (self->state != NN_STCP_STATE_ACTIVE)
+        return;
+    if (nn_fast (rc == 0))
+        rc = nn_verbs_poll (&self->verbs);
+
+    /*  Free slots may allow the rest of the outbound message to be sent. */
+    if (nn_fast (rc == 0) && self->outstate == NN_STCP_OUTSTATE_SENDING) {
+        rc = nn_stcp_rdma_write (self);
+        if (rc == 1) {
+            self->outstate = NN_STCP_OUTSTATE_IDLE;
+            nn_pipebase_sent (&self->pipebase);
+        }
+    }
+    if (rc >= 0 && self->instate != NN_STCP_INSTATE_HASMSG)
+        rc = nn_stcp_rdma_read (self);
+
+    if (nn_slow (rc < 0)) {
+        nn_pipebase_stop (&self->pipebase);
+        self->state = NN_STCP_STATE_DONE;
+        nn_fsm_raise (&self->fsm, &self->done, NN_STCP_ERROR);
+    }
+}
+
+static int nn_stcp_rdma_send (struct nn_stcp *self, struct nn_msg *msg)
+{
+    int rc;
+
+    nn_msg_mv (&self->outmsg, msg);
+    self->outpos = 0;
+
+    /*  If there are enough free slots for the whole message, the pipe
+        remains writable. Otherwise the rest of it will be sent once some
+        of the sends in progress complete. */
+    rc = nn_stcp_rdma_write (self);
+    if (nn_fast (rc == 1)) {
+        nn_pipebase_sent (&self->pipebase);
+        return 0;
+    }
+    if (nn_slow (rc < 0)) {
+        self->state = NN_STCP_STATE_DONE;
+        nn_fsm_raise (&self->fsm, &self->done, NN_STCP_ERROR);
+        return 0;
+    }
+    self->outstate = NN_STCP_OUTSTATE_SENDING;
+
+    return 0;
+}
+
+static int nn_stcp_rdma_recv (struct nn_stcp *self, struct nn_msg *msg)
+{
+    int rc;
+
+    nn_msg_mv (msg, &self->inmsg);
+    nn_msg_init (&self->inmsg, 0);
+
+    /*  Pick up the next message straight away if it has arrived already. */
+    self->instate = NN_STCP_INSTATE_HDR;
+    rc = nn_stcp_rdma_read (self);
+    if (nn_slow (rc < 0)) {
+        self->state = NN_STCP_STATE_DONE;
+        nn_fsm_raise (&self->fsm, &self->done, NN_STCP_ERROR);
+    }
+
+    return 0;
+}
+
+/*  Copies as much of the outbound message into free slots as possible and
+    posts the sends. Returns 1 if the message was sent completely,
+    0 otherwise. */
+static int nn_stcp_rdma_write (struct nn_stcp *self)
+{
+    int rc;
+    int i;
+    int iovcnt;
+    struct nn_iovec iov [2 + NN_MSG_MAXPARTS];
+    uint64_t size;
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+    size_t nbytes;
+
+    iov [0].iov_base = nn_chunkref_data (&self->outmsg.sphdr);
+    iov [0].iov_len = nn_chunkref_size (&self->outmsg.sphdr);
+    iov [1].iov_base = nn_chunkref_data (&self->outmsg.body);
+    iov [1].iov_len = nn_chunkref_size (&self->outmsg.body);
+    iovcnt = 2;
+    for (i = 0; i != self->outmsg.nparts; ++i) {
+        iov [iovcnt].iov_base = self->outmsg.parts [i];
+        iov [iovcnt].iov_len = nn_chunk_size (self->outmsg.parts [i]);
+        ++iovcnt;
+    }
+
+    /*  The size of the message is passed as 32-bit immediate data. */
+    size = iov [0].iov_len + nn_msg_bodysize (&self->outmsg);
+    if (nn_slow (size > 0xffffffff))
+        return -EMSGSIZE;
+
+    /*  Even an empty message takes one send. */
+    do {
+        buf = nn_verbs_txbuf (&self->verbs);
+        if (!buf) {
+
+            /*  The sends may have completed in the meantime. */
+            rc = nn_verbs_poll (&self->verbs);
+            if (nn_slow (rc < 0))
+                return rc;
+            buf = nn_verbs_txbuf (&self->verbs);
+            if (!buf)
+                return 0;
+        }
+
+        /*  Fill the slot with the next fragment of the message. */
+        len = size - self->outpos;
+        if (len > self->verbs.fragsz)
+            len = self->verbs.fragsz;
+        pos = self->outpos;
+        nbytes = 0;
+        for (i = 0; i != iovcnt && nbytes < len; ++i) {
+            if (pos >= iov [i].iov_len) {
+                pos -= iov [i].iov_len;
+                continue;
+            }
+            if (iov [i].iov_len - pos < len - nbytes) {
+                memcpy (buf + nbytes, ((uint8_t*) iov [i].iov_base) + pos,
+                    iov [i].iov_len - pos);
+                nbytes += iov [i].iov_len - pos;
+            }
+            else {
+                memcpy (buf + nbytes, ((uint8_t*) iov [i].iov_base) + pos,
+                    len - nbytes);
+                nbytes = len;
+            }
+            pos = 0;
+        }
+
+        rc = nn_verbs_send (&self->verbs, len, self->outpos == 0,
+            (uint32_t) size);
+        if (nn_slow (rc < 0))
+            return rc;
+        self->outpos += len;
+    } while (self->outpos < size);
+
+    nn_msg_term (&self->outmsg);
+    nn_msg_init (&self->outmsg, 0);
+    return 1;
+}
+
+/*  Copies the received fragments into the inbound message and posts the
+    slots anew. When the message is complete, the owner is notified that it
+    can receive it. */
+static int nn_stcp_rdma_read (struct nn_stcp *self)
+{
+    int rc;
+    uint8_t *buf;
+    size_t len;
+    int first;
+    uint32_t size;
+    int opt;
+    size_t opt_sz;
+
+    while (1) {
+        buf = nn_verbs_rxbuf (&self->verbs, &len, &first, &size);
+        if (!buf)
+            return 0;
+
+        if (self->instate == NN_STCP_INSTATE_HDR) {
+            if (nn_slow (!first))
+                return -EPROTO;
+
+            /*  Check that message size is acceptable by comparing with
+                NN_RCVMAXSIZE and allocate memory for it, from the message
+                pool set by NN_RCVPOOL option if any. */
+            opt_sz = sizeof (opt);
+            nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+                NN_RCVMAXSIZE, &opt, &opt_sz);
+            if (opt >= 0 && size > (unsigned) opt)
+                return -EMSGSIZE;
+            opt_sz = sizeof (opt);
+            nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET,
+                NN_RCVPOOL, &opt, &opt_sz);
+            nn_msg_term (&self->inmsg);
+            nn_msg_init_type (&self->inmsg, (size_t) size, opt);
+            self->inpos = 0;
+            self->instate = NN_STCP_INSTATE_BODY;
+        }
+        else if (nn_slow (first))
+            return -EPROTO;
+
+        if (nn_slow (len > nn_chunkref_size (&self->inmsg.body) -
+              self->inpos))
+            return -EPROTO;
+        memcpy (((uint8_t*) nn_chunkref_data (&self->inmsg.body)) +
+            self->inpos, buf, len);
+        self->inpos += len;
+        rc = nn_verbs_recvdone (&self->verbs);
+        if (nn_slow (rc < 0))
+            return rc;
+
+        if (self->inpos == nn_chunkref_size (&self->inmsg.body)) {
+            self->instate = NN_STCP_INSTATE_HASMSG;
+            self->inmsg.rcvtime = nn_clock_us ();
+            NN_TRACE (NN_TRACE_TRANSPORT_RECV, &self->pipebase,
+                self->inpos);
+            nn_pipebase_received (&self->pipebase);
+            return 0;
+        }
+    }
+}
+
+#endif
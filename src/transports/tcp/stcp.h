@@ -28,17 +28,46 @@
 
 #include "../../aio/fsm.h"
 #include "../../aio/usock.h"
+#include "../../aio/worker.h"
 
 #include "../utils/streamhdr.h"
+#include "../utils/outq.h"
+#include "../utils/compress.h"
+#include "../utils/batch.h"
+#include "../utils/pieces.h"
+#include "../utils/heartbeat.h"
+#if defined NN_HAVE_RDMA
+#include "../utils/verbs.h"
+#endif
 
 #include "../../utils/msg.h"
+#include "../../utils/list.h"
 
 /*  This state machine handles TCP connection from the point where it is
-    established to the point when it is broken. */
+    established to the point when it is broken.
+
+    If both sides support it, the connecting side can ask for the connection
+    to be one of several a pipe is striped over. The identifier of the pipe
+    is then passed to the accepting side after the protocol header. Such
+    a pipe may also be split between a connection carrying the small
+    messages and one carrying the large ones (see NN_TCP_BULK_THRESHOLD).
+
+    In RDMA mode, used by the rdma transport, each side creates a verbs
+    queue pair once the protocol header is exchanged and passes its
+    description to the peer. From then on, messages are copied through the
+    memory registered for the queue pairs and the connection itself is only
+    watched for the peer going away. Completions are waited for by the worker
+    thread, using the file descriptor of the completion channel. */
 
 #define NN_STCP_ERROR 1
 #define NN_STCP_STOPPED 2
 
+/*  Roles of the connections of a pipe split by the size of the messages. */
+#define NN_STCP_MAIN 1
+#define NN_STCP_BULK 2
+
+struct ssl_ctx_st;
+
 struct nn_stcp {
 
     /*  The state machine. */
@@ -60,27 +89,133 @@ struct nn_stcp {
     /*  State of inbound state machine. */
     int instate;
 
-    /*  Buffer used to store the header of incoming message. */
-    uint8_t inhdr [8];
+    /*  Buffer used to store the header of incoming message, followed by
+        the checksum of the message if checksums are used, and the length
+        of the header. */
+    uint8_t inhdr [12];
+    size_t inhdrlen;
+
+    /*  1 if the frames carry CRC-32C checksums of their payload. For
+        the frame being received, 'incheck' is set if it's to be checked
+        against 'incrc', 'insum' being the checksum of the part of it
+        received so far. */
+    int checksum;
+    int incheck;
+    uint32_t incrc;
+    uint32_t insum;
 
     /*  Message being received at the moment. */
     struct nn_msg inmsg;
 
+    /*  Compression of the messages and the algorithm the message being
+        received is compressed with, 0 if it's not. */
+    struct nn_compress compress;
+    int inalg;
+
+    /*  Small messages packed into batch frames and the frames received,
+        along with a flag set if the message being received is one. */
+    struct nn_batch batch;
+    int inbatch;
+
+    /*  Messages sent and received in pieces. */
+    struct nn_pieces pieces;
+
+    /*  Heartbeats exchanged with the peer, along with a flag set if
+        the frame being received is one. */
+    struct nn_heartbeat heartbeat;
+    int inheartbeat;
+
+    /*  1 if the messages are to carry the time the kernel received them,
+        along with that time for the frame being received. */
+    int rcvtstamp;
+    uint64_t intstamp;
+
     /*  State of the outbound state machine. */
     int outstate;
 
-    /*  Buffer used to store the header of outgoing message. */
-    uint8_t outhdr [8];
-
-    /*  Message being sent at the moment. */
+    /*  Messages being sent at the moment and those waiting to be sent. */
+    struct nn_outq outq;
+
+    /*  Messages with bodies at least this large are sent without copying
+        them to the kernel, 0 if zero-copy sends are disabled. */
+    size_t zcthreshold;
+
+    /*  1 if the write in progress is a zero-copy one. */
+    int zcbusy;
+
+    /*  Messages already sent by reference, held until the kernel is done
+        with their data. Checked whenever a write completes. */
+    struct nn_list zcmsgs;
+
+    /*  If 1, the messages sent while the context is held are written out
+        together once it's left, rather than each on its own. */
+    int cork;
+
+    /*  Event used to write out the corked messages. */
+    struct nn_fsm_event flush;
+
+    /*  If not NULL, the connection is secured using this TLS context before
+        the protocol header is exchanged. 'tlshost' is the name the server
+        is verified against, NULL on the accepting side. */
+    struct ssl_ctx_st *tls;
+    const char *tlshost;
+
+    /*  1 if the messages are passed through a verbs queue pair. */
+    int rdma;
+
+    /*  Identifier of the striped pipe the connection belongs to and
+        the number of connections the pipe is striped over, as chosen by
+        the connecting side. The former is 0 if the connection is a pipe
+        of its own. Both are passed to the accepting side in 'grouphdr'
+        once the protocol header is exchanged. */
+    uint64_t group;
+    int stripes;
+    uint8_t grouphdr [12];
+
+    /*  Role of the connection if the pipe is split by the size of
+        the messages, NN_STCP_MAIN or NN_STCP_BULK, as chosen by
+        the connecting side. 0 otherwise. */
+    int bulk;
+
+#if defined NN_HAVE_RDMA
+
+    /*  The queue pair along with the records describing it and the peer's
+        one, exchanged during the setup. */
+    struct nn_verbs verbs;
+    uint8_t rdmaout [NN_VERBS_RECLEN];
+    uint8_t rdmain [NN_VERBS_RECLEN];
+    int rdmasetup;
+
+    /*  The completion channel is added to the poller of the connection's
+        worker, and removed from it, by these tasks. 'rdmawatch' is set from
+        the moment the former is posted till the latter is done, 'rdmaadded'
+        while the channel is in the poller. */
+    struct nn_worker *worker;
+    struct nn_worker_fd rdmafd;
+    struct nn_worker_task rdmastart;
+    struct nn_worker_task rdmastop;
+    int rdmawatch;
+    int rdmaadded;
+
+    /*  Message being sent and the number of bytes of it sent so far. */
     struct nn_msg outmsg;
+    size_t outpos;
+
+    /*  Number of bytes of the inbound message received so far. */
+    size_t inpos;
+
+    /*  Buffer for data arriving on the connection, which the peer is not
+        supposed to send once the queue pairs are set up. */
+    uint8_t rdmaeof;
+#endif
 
     /*  Event raised when the state machine ends. */
     struct nn_fsm_event done;
 };
 
-void nn_stcp_init (struct nn_stcp *self, int src,
-    struct nn_ep *ep, struct nn_fsm *owner);
+void nn_stcp_init (struct nn_stcp *self, int src, struct nn_ep *ep,
+    struct ssl_ctx_st *tls, const char *tlshost, int rdma,
+    uint64_t group, int stripes, int bulk, struct nn_fsm *owner);
 void nn_stcp_term (struct nn_stcp *self);
 
 int nn_stcp_isidle (struct nn_stcp *self);
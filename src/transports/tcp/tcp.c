@@ -30,6 +30,10 @@
 
 #include "../utils/port.h"
 #include "../utils/iface.h"
+#include "../utils/dns.h"
+#include "../utils/compress.h"
+#include "../utils/batch.h"
+#include "../utils/crc32c.h"
 
 #include "../../utils/err.h"
 #include "../../utils/alloc.h"
@@ -43,6 +47,9 @@
 #include "../../utils/win.h"
 #else
 #include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #endif
 
 /*  TCP-specific socket options. */
@@ -50,6 +57,24 @@
 struct nn_tcp_optset {
     struct nn_optset base;
     int nodelay;
+    int rcvbatch;
+    int zerocopy;
+    int listeners;
+    int busypoll;
+    int quickack;
+    int priority;
+    int tos;
+    int notsentlowat;
+    int incomingcpu;
+    int cork;
+    int stripes;
+    int stripeordered;
+    int compress;
+    int compressthreshold;
+    int batch;
+    int fastopen;
+    int checksum;
+    int bulkthreshold;
 };
 
 static void nn_tcp_optset_destroy (struct nn_optset *self);
@@ -64,6 +89,8 @@ static const struct nn_optset_vfptr nn_tcp_optset_vfptr = {
 };
 
 /*  nn_transport interface. */
+static void nn_tcp_init (void);
+static void nn_tcp_term (void);
 static int nn_tcp_bind (struct nn_ep *ep);
 static int nn_tcp_connect (struct nn_ep *ep);
 static struct nn_optset *nn_tcp_optset (void);
@@ -71,8 +98,8 @@ static struct nn_optset *nn_tcp_optset (void);
 static struct nn_transport nn_tcp_vfptr = {
     "tcp",
     NN_TCP,
-    NULL,
-    NULL,
+    nn_tcp_init,
+    nn_tcp_term,
     nn_tcp_bind,
     nn_tcp_connect,
     nn_tcp_optset,
@@ -81,14 +108,116 @@ static struct nn_transport nn_tcp_vfptr = {
 
 struct nn_transport *nn_tcp = &nn_tcp_vfptr;
 
+/*  Returns the value of an integer option of the endpoint. */
+static int nn_tcp_getint (struct nn_ep *ep, int level, int option)
+{
+    int val;
+    size_t sz;
+
+    sz = sizeof (val);
+    nn_ep_getopt (ep, level, option, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    return val;
+}
+
+void nn_tcp_setsockopts (struct nn_usock *usock, struct nn_ep *ep)
+{
+    int val;
+
+    /*  Failures are ignored. The options are hints and a connection that
+        can't apply them is still usable. */
+    val = nn_tcp_getint (ep, NN_SOL_SOCKET, NN_SNDBUF);
+    nn_usock_setsockopt (usock, SOL_SOCKET, SO_SNDBUF, &val, sizeof (val));
+    val = nn_tcp_getint (ep, NN_SOL_SOCKET, NN_RCVBUF);
+    nn_usock_setsockopt (usock, SOL_SOCKET, SO_RCVBUF, &val, sizeof (val));
+
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_NODELAY);
+    if (val)
+        nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_NODELAY,
+            &val, sizeof (val));
+
+    /*  The rest of the options are platform-specific. */
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_BUSY_POLL);
+#if defined SO_BUSY_POLL
+    if (val)
+        nn_usock_setsockopt (usock, SOL_SOCKET, SO_BUSY_POLL,
+            &val, sizeof (val));
+#endif
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_QUICKACK);
+#if defined TCP_QUICKACK
+    if (val)
+        nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_QUICKACK,
+            &val, sizeof (val));
+#endif
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_PRIORITY);
+#if defined SO_PRIORITY
+    if (val >= 0)
+        nn_usock_setsockopt (usock, SOL_SOCKET, SO_PRIORITY,
+            &val, sizeof (val));
+#endif
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_TOS);
+    if (val >= 0) {
+        /*  Only one of them applies, depending on the address family. */
+        nn_usock_setsockopt (usock, IPPROTO_IP, IP_TOS, &val, sizeof (val));
+#if defined IPV6_TCLASS
+        nn_usock_setsockopt (usock, IPPROTO_IPV6, IPV6_TCLASS,
+            &val, sizeof (val));
+#endif
+    }
+    val = nn_tcp_getint (ep, NN_TCP, NN_TCP_NOTSENT_LOWAT);
+#if defined TCP_NOTSENT_LOWAT
+    if (val)
+        nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            &val, sizeof (val));
+#endif
+    (void) val;
+}
+
+void nn_tcp_setfastopen (struct nn_usock *usock, struct nn_ep *ep, int qlen)
+{
+    int val;
+
+    if (!nn_tcp_getint (ep, NN_TCP, NN_TCP_FASTOPEN))
+        return;
+
+    /*  A connecting socket holds the SYN back until the first write, which
+        is the protocol header, and sends the two together if it has
+        a cookie from the peer. Otherwise the connection is established as
+        usual and the cookie is asked for on the way. */
+    if (qlen == 0) {
+#if defined TCP_FASTOPEN_CONNECT
+        val = 1;
+        nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+            &val, sizeof (val));
+#endif
+        return;
+    }
+
+#if defined TCP_FASTOPEN
+    val = qlen;
+    nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_FASTOPEN, &val, sizeof (val));
+#endif
+    (void) val;
+}
+
+static void nn_tcp_init (void)
+{
+    nn_crc32c_init ();
+}
+
+static void nn_tcp_term (void)
+{
+    nn_dns_shutdown ();
+}
+
 static int nn_tcp_bind (struct nn_ep *ep)
 {
-    return nn_btcp_create (ep);
+    return nn_btcp_create (ep, NULL, 0);
 }
 
 static int nn_tcp_connect (struct nn_ep *ep)
 {
-    return nn_ctcp_create (ep);
+    return nn_ctcp_create (ep, NULL, 0);
 }
 
 static struct nn_optset *nn_tcp_optset ()
@@ -101,6 +230,24 @@ static struct nn_optset *nn_tcp_optset ()
 
     /*  Default values for TCP socket options. */
     optset->nodelay = 0;
+    optset->rcvbatch = 65536;
+    optset->zerocopy = 0;
+    optset->listeners = 1;
+    optset->busypoll = 0;
+    optset->quickack = 0;
+    optset->priority = -1;
+    optset->tos = -1;
+    optset->notsentlowat = 0;
+    optset->incomingcpu = -1;
+    optset->cork = 0;
+    optset->stripes = 1;
+    optset->stripeordered = 1;
+    optset->compress = NN_TCP_COMPRESS_NONE;
+    optset->compressthreshold = 1024;
+    optset->batch = 0;
+    optset->fastopen = 0;
+    optset->checksum = 0;
+    optset->bulkthreshold = 0;
 
     return &optset->base;   
 }
@@ -132,6 +279,99 @@ static int nn_tcp_optset_setopt (struct nn_optset *self, int option,
             return -EINVAL;
         optset->nodelay = val;
         return 0;
+    case NN_TCP_RCVBATCH:
+        if (nn_slow (val <= 0))
+            return -EINVAL;
+        optset->rcvbatch = val;
+        return 0;
+    case NN_TCP_ZEROCOPY:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->zerocopy = val;
+        return 0;
+    case NN_TCP_LISTENERS:
+        if (nn_slow (val < 1 || val > NN_BTCP_MAX_LISTENERS))
+            return -EINVAL;
+        optset->listeners = val;
+        return 0;
+    case NN_TCP_BUSY_POLL:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->busypoll = val;
+        return 0;
+    case NN_TCP_QUICKACK:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->quickack = val;
+        return 0;
+    case NN_TCP_PRIORITY:
+        if (nn_slow (val < -1))
+            return -EINVAL;
+        optset->priority = val;
+        return 0;
+    case NN_TCP_TOS:
+        if (nn_slow (val < -1 || val > 255))
+            return -EINVAL;
+        optset->tos = val;
+        return 0;
+    case NN_TCP_NOTSENT_LOWAT:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->notsentlowat = val;
+        return 0;
+    case NN_TCP_INCOMING_CPU:
+        if (nn_slow (val < -1))
+            return -EINVAL;
+        optset->incomingcpu = val;
+        return 0;
+    case NN_TCP_CORK:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->cork = val;
+        return 0;
+    case NN_TCP_STRIPES:
+        if (nn_slow (val < 1 || val > NN_CTCP_MAX_STRIPES))
+            return -EINVAL;
+        optset->stripes = val;
+        return 0;
+    case NN_TCP_STRIPE_ORDERED:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->stripeordered = val;
+        return 0;
+    case NN_TCP_COMPRESS:
+        if (nn_slow (val != NN_TCP_COMPRESS_NONE &&
+              val != NN_TCP_COMPRESS_LZ4 && val != NN_TCP_COMPRESS_ZSTD))
+            return -EINVAL;
+        if (nn_slow ((val & ~nn_compress_supported ()) != 0))
+            return -ENOTSUP;
+        optset->compress = val;
+        return 0;
+    case NN_TCP_COMPRESS_THRESHOLD:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->compressthreshold = val;
+        return 0;
+    case NN_TCP_BATCH:
+        if (nn_slow (val < 0 || val > NN_BATCH_MSGMAX))
+            return -EINVAL;
+        optset->batch = val;
+        return 0;
+    case NN_TCP_FASTOPEN:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->fastopen = val;
+        return 0;
+    case NN_TCP_CHECKSUM:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->checksum = val;
+        return 0;
+    case NN_TCP_BULK_THRESHOLD:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->bulkthreshold = val;
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -149,6 +389,60 @@ static int nn_tcp_optset_getopt (struct nn_optset *self, int option,
     case NN_TCP_NODELAY:
         intval = optset->nodelay;
         break;
+    case NN_TCP_RCVBATCH:
+        intval = optset->rcvbatch;
+        break;
+    case NN_TCP_ZEROCOPY:
+        intval = optset->zerocopy;
+        break;
+    case NN_TCP_LISTENERS:
+        intval = optset->listeners;
+        break;
+    case NN_TCP_BUSY_POLL:
+        intval = optset->busypoll;
+        break;
+    case NN_TCP_QUICKACK:
+        intval = optset->quickack;
+        break;
+    case NN_TCP_PRIORITY:
+        intval = optset->priority;
+        break;
+    case NN_TCP_TOS:
+        intval = optset->tos;
+        break;
+    case NN_TCP_NOTSENT_LOWAT:
+        intval = optset->notsentlowat;
+        break;
+    case NN_TCP_INCOMING_CPU:
+        intval = optset->incomingcpu;
+        break;
+    case NN_TCP_CORK:
+        intval = optset->cork;
+        break;
+    case NN_TCP_STRIPES:
+        intval = optset->stripes;
+        break;
+    case NN_TCP_STRIPE_ORDERED:
+        intval = optset->stripeordered;
+        break;
+    case NN_TCP_COMPRESS:
+        intval = optset->compress;
+        break;
+    case NN_TCP_COMPRESS_THRESHOLD:
+        intval = optset->compressthreshold;
+        break;
+    case NN_TCP_BATCH:
+        intval = optset->batch;
+        break;
+    case NN_TCP_FASTOPEN:
+        intval = optset->fastopen;
+        break;
+    case NN_TCP_CHECKSUM:
+        intval = optset->checksum;
+        break;
+    case NN_TCP_BULK_THRESHOLD:
+        intval = optset->bulkthreshold;
+        break;
     default:
         return -ENOPROTOOPT;
     }
@@ -24,7 +24,18 @@
 #define NN_TCP_INCLUDED
 
 #include "../../transport.h"
+#include "../../aio/usock.h"
 
 extern struct nn_transport *nn_tcp;
 
+/*  Applies the socket options of the endpoint to a newly created TCP
+    connection. Must be called before the underlying socket is activated. */
+void nn_tcp_setsockopts (struct nn_usock *usock, struct nn_ep *ep);
+
+/*  Enables TCP Fast Open on the socket if the endpoint asks for it.
+    'qlen' is zero for a socket about to connect, otherwise it's the number
+    of pending Fast Open requests a listening socket accepts. Must be called
+    before connecting or listening, failures are ignored. */
+void nn_tcp_setfastopen (struct nn_usock *usock, struct nn_ep *ep, int qlen);
+
 #endif
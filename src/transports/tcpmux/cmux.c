@@ -0,0 +1,449 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "cmux.h"
+
+#include "../utils/port.h"
+
+#include "../../core/global.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
+#else
+#include <netinet/in.h>
+#endif
+
+#define NN_CMUX_STATE_IDLE 1
+#define NN_CMUX_STATE_RESOLVING 2
+#define NN_CMUX_STATE_STOPPING_DNS 3
+#define NN_CMUX_STATE_CONNECTING 4
+#define NN_CMUX_STATE_ACTIVE 5
+#define NN_CMUX_STATE_STOPPING_SMUX 6
+#define NN_CMUX_STATE_WAITING 7
+#define NN_CMUX_STATE_STOPPING_BACKOFF 8
+#define NN_CMUX_STATE_STOPPING 9
+
+#define NN_CMUX_SRC_DNS 1
+#define NN_CMUX_SRC_SMUX 2
+#define NN_CMUX_SRC_RECONNECT_TIMER 3
+#define NN_CMUX_SRC_MAILBOX 4
+
+/*  Private functions. */
+static void nn_cmux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_cmux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_cmux_mail (struct nn_cmux *self);
+static void nn_cmux_resolve (struct nn_cmux *self);
+static void nn_cmux_connect (struct nn_cmux *self);
+
+void nn_cmux_init (struct nn_cmux *self, const char *addr, size_t addrlen,
+    struct nn_ep *ep)
+{
+    int rc;
+    int reconnect_ivl;
+    int reconnect_ivl_max;
+    size_t sz;
+    const char *colon;
+
+    nn_ctx_init (&self->ctx, nn_global_getpool (), NULL);
+    nn_fsm_init_root (&self->fsm, nn_cmux_handler, nn_cmux_shutdown,
+        &self->ctx);
+    self->state = NN_CMUX_STATE_IDLE;
+    nn_tcpmux_host_init (&self->host, 0, addr, addrlen, &self->fsm);
+    nn_pmux_mailbox_init (&self->mailbox, NN_CMUX_SRC_MAILBOX, &self->fsm);
+    nn_smux_init (&self->smux, NN_CMUX_SRC_SMUX, NULL, &self->fsm);
+
+    for (colon = addr + addrlen; colon [-1] != ':'; --colon)
+        ;
+    --colon;
+    self->namelen = colon - addr;
+    rc = nn_port_resolve (colon + 1, addr + addrlen - colon - 1);
+    nn_assert (rc >= 0);
+    self->port = (uint16_t) rc;
+
+    sz = sizeof (self->ipv4only);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_IPV4ONLY, &self->ipv4only, &sz);
+    nn_assert (sz == sizeof (self->ipv4only));
+    sz = sizeof (reconnect_ivl);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL, &reconnect_ivl, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl));
+    sz = sizeof (reconnect_ivl_max);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL_MAX,
+        &reconnect_ivl_max, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl_max));
+    if (reconnect_ivl_max == 0)
+        reconnect_ivl_max = reconnect_ivl;
+    nn_dns_init (&self->dns, NN_CMUX_SRC_DNS, &self->fsm);
+    nn_backoff_init (&self->retry, NN_CMUX_SRC_RECONNECT_TIMER,
+        reconnect_ivl, reconnect_ivl_max, &self->fsm);
+    nn_list_init (&self->pmuxes);
+
+    /*  Start connecting. */
+    nn_ctx_enter (&self->ctx);
+    nn_fsm_start (&self->fsm);
+    nn_ctx_leave (&self->ctx);
+}
+
+void nn_cmux_term (struct nn_cmux *self)
+{
+    /*  The worker thread that has raised the last event may still be
+        leaving the context. */
+    nn_ctx_enter (&self->ctx);
+    nn_ctx_leave (&self->ctx);
+
+    nn_assert_state (self, NN_CMUX_STATE_IDLE);
+    nn_list_term (&self->pmuxes);
+    nn_backoff_term (&self->retry);
+    nn_dns_term (&self->dns);
+    nn_smux_term (&self->smux);
+    nn_pmux_mailbox_term (&self->mailbox);
+    nn_tcpmux_host_term (&self->host);
+    nn_fsm_term (&self->fsm);
+    nn_ctx_term (&self->ctx);
+}
+
+/*  Processes the notifications from the pmuxes. */
+static void nn_cmux_mail (struct nn_cmux *self)
+{
+    struct nn_queue queue;
+    struct nn_queue_item *item;
+    struct nn_pmux *pmux;
+    uint32_t what;
+
+    nn_queue_init (&queue);
+    nn_pmux_mailbox_drain (&self->mailbox, &queue);
+    while (1) {
+        item = nn_queue_pop (&queue);
+        if (!item)
+            break;
+        pmux = nn_cont (item, struct nn_pmux, mailitem);
+        what = nn_pmux_mail (pmux);
+
+        /*  If there's no connection at the moment, the channel is opened
+            once there's one. */
+        if (what & NN_PMUX_ATTACH) {
+            if (self->state == NN_CMUX_STATE_ACTIVE)
+                nn_smux_open (&self->smux, pmux);
+            else
+                nn_list_insert (&self->pmuxes, &pmux->item,
+                    nn_list_end (&self->pmuxes));
+        }
+        if (what & (NN_PMUX_SENT | NN_PMUX_RECEIVED))
+            nn_smux_mail (pmux, what);
+        if (what & NN_PMUX_DETACH) {
+            if (pmux->smux)
+                nn_smux_detach (pmux->smux, pmux);
+            else if (nn_list_item_isinlist (&pmux->item))
+                nn_list_erase (&self->pmuxes, &pmux->item);
+            nn_pmux_notify (pmux, &self->fsm, NN_PMUX_DETACHED);
+        }
+    }
+    nn_queue_term (&queue);
+}
+
+static void nn_cmux_resolve (struct nn_cmux *self)
+{
+    nn_dns_start (&self->dns, self->host.addr, self->namelen,
+        self->ipv4only, &self->dns_result);
+    self->state = NN_CMUX_STATE_RESOLVING;
+}
+
+/*  The name was resolved. Connect to the first of the addresses. */
+static void nn_cmux_connect (struct nn_cmux *self)
+{
+    int rc;
+    struct sockaddr_storage ss;
+
+    rc = -EHOSTUNREACH;
+    if (self->dns_result.error == 0 && self->dns_result.naddrs > 0) {
+        memcpy (&ss, &self->dns_result.addrs [0],
+            self->dns_result.addrlens [0]);
+        if (ss.ss_family == AF_INET)
+            ((struct sockaddr_in*) &ss)->sin_port = htons (self->port);
+        else if (ss.ss_family == AF_INET6)
+            ((struct sockaddr_in6*) &ss)->sin6_port = htons (self->port);
+        else
+            nn_assert (0);
+        rc = nn_smux_connect (&self->smux, (struct sockaddr*) &ss,
+            self->dns_result.addrlens [0]);
+    }
+    if (nn_slow (rc < 0)) {
+        nn_backoff_start (&self->retry);
+        self->state = NN_CMUX_STATE_WAITING;
+        return;
+    }
+    self->state = NN_CMUX_STATE_CONNECTING;
+}
+
+static void nn_cmux_shutdown (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_cmux *cmux;
+
+    cmux = nn_cont (self, struct nn_cmux, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        nn_smux_stop (&cmux->smux);
+        nn_dns_stop (&cmux->dns);
+        nn_backoff_stop (&cmux->retry);
+        cmux->state = NN_CMUX_STATE_STOPPING;
+    }
+    else if (src == NN_CMUX_SRC_MAILBOX && type == NN_PMUX_MAIL) {
+        nn_cmux_mail (cmux);
+    }
+
+    /*  Whatever else is reported meanwhile is ignored. There are no pmuxes
+        left, yet a notification from the last of them may still be on its
+        way. */
+    if (!nn_smux_isidle (&cmux->smux) || !nn_dns_isidle (&cmux->dns) ||
+          !nn_backoff_isidle (&cmux->retry) ||
+          !nn_pmux_mailbox_isidle (&cmux->mailbox))
+        return;
+    nn_assert (nn_list_empty (&cmux->pmuxes));
+    cmux->state = NN_CMUX_STATE_IDLE;
+    nn_fsm_stopped_noevent (&cmux->fsm);
+    nn_tcpmux_host_released (&cmux->host);
+}
+
+static void nn_cmux_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_cmux *cmux;
+    struct nn_pmux *pmux;
+
+    cmux = nn_cont (self, struct nn_cmux, fsm);
+
+    /*  Any-state events. */
+    switch (src) {
+    case NN_CMUX_SRC_MAILBOX:
+        nn_assert (type == NN_PMUX_MAIL);
+        nn_cmux_mail (cmux);
+        return;
+    case NN_TCPMUX_SRC_PEER:
+        nn_assert (type == NN_TCPMUX_STOP);
+        nn_fsm_stop (&cmux->fsm);
+        return;
+    }
+
+    switch (cmux->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_CMUX_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                nn_cmux_resolve (cmux);
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  RESOLVING state.                                                          */
+/******************************************************************************/
+    case NN_CMUX_STATE_RESOLVING:
+        switch (src) {
+
+        case NN_CMUX_SRC_DNS:
+            switch (type) {
+            case NN_DNS_DONE:
+                nn_dns_stop (&cmux->dns);
+                cmux->state = NN_CMUX_STATE_STOPPING_DNS;
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  STOPPING_DNS state.                                                       */
+/******************************************************************************/
+    case NN_CMUX_STATE_STOPPING_DNS:
+        switch (src) {
+
+        case NN_CMUX_SRC_DNS:
+            switch (type) {
+            case NN_DNS_STOPPED:
+                nn_cmux_connect (cmux);
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  CONNECTING state.                                                         */
+/*  The connection is being established.                                      */
+/******************************************************************************/
+    case NN_CMUX_STATE_CONNECTING:
+        switch (src) {
+
+        case NN_CMUX_SRC_SMUX:
+            switch (type) {
+            case NN_SMUX_ACTIVE:
+                nn_backoff_reset (&cmux->retry);
+                cmux->state = NN_CMUX_STATE_ACTIVE;
+                while (!nn_list_empty (&cmux->pmuxes)) {
+                    pmux = nn_cont (nn_list_begin (&cmux->pmuxes),
+                        struct nn_pmux, item);
+                    nn_list_erase (&cmux->pmuxes, &pmux->item);
+                    nn_smux_open (&cmux->smux, pmux);
+                }
+                return;
+            case NN_SMUX_ERROR:
+                nn_smux_stop (&cmux->smux);
+                cmux->state = NN_CMUX_STATE_STOPPING_SMUX;
+                return;
+            case NN_SMUX_STOPPED:
+
+                /*  The socket couldn't be bound. */
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/******************************************************************************/
+    case NN_CMUX_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_CMUX_SRC_SMUX:
+            switch (type) {
+            case NN_SMUX_ERROR:
+                nn_smux_stop (&cmux->smux);
+                cmux->state = NN_CMUX_STATE_STOPPING_SMUX;
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  STOPPING_SMUX state.                                                      */
+/*  The connection has failed and all its channels were closed.               */
+/******************************************************************************/
+    case NN_CMUX_STATE_STOPPING_SMUX:
+        switch (src) {
+
+        case NN_CMUX_SRC_SMUX:
+            switch (type) {
+            case NN_SMUX_ERROR:
+                return;
+            case NN_SMUX_STOPPED:
+                nn_backoff_start (&cmux->retry);
+                cmux->state = NN_CMUX_STATE_WAITING;
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  WAITING state.                                                            */
+/*  Waiting before reconnecting.                                              */
+/******************************************************************************/
+    case NN_CMUX_STATE_WAITING:
+        switch (src) {
+
+        case NN_CMUX_SRC_SMUX:
+            switch (type) {
+            case NN_SMUX_STOPPED:
+
+                /*  The socket couldn't be bound. */
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        case NN_CMUX_SRC_RECONNECT_TIMER:
+            switch (type) {
+            case NN_BACKOFF_TIMEOUT:
+                nn_backoff_stop (&cmux->retry);
+                cmux->state = NN_CMUX_STATE_STOPPING_BACKOFF;
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  STOPPING_BACKOFF state.                                                   */
+/******************************************************************************/
+    case NN_CMUX_STATE_STOPPING_BACKOFF:
+        switch (src) {
+
+        case NN_CMUX_SRC_RECONNECT_TIMER:
+            switch (type) {
+            case NN_BACKOFF_STOPPED:
+                nn_cmux_resolve (cmux);
+                return;
+            default:
+                nn_fsm_bad_action (cmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (cmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (cmux->state, src, type);
+    }
+}
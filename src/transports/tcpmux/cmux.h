@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CMUX_INCLUDED
+#define NN_CMUX_INCLUDED
+
+#include "tcpmux.h"
+#include "smux.h"
+#include "pmux.h"
+
+#include "../utils/dns.h"
+#include "../utils/backoff.h"
+
+#include "../../aio/ctx.h"
+#include "../../aio/fsm.h"
+
+#include "../../utils/list.h"
+
+/*  Host of the connecting endpoints with the same address. It keeps
+    a connection to the address, reconnecting whenever it's broken, and
+    opens a channel for each of the pmuxes of the endpoints. */
+
+struct nn_cmux {
+
+    /*  The state machine and the context it lives in. */
+    struct nn_fsm fsm;
+    int state;
+    struct nn_ctx ctx;
+
+    /*  Entry in the registry. */
+    struct nn_tcpmux_host host;
+
+    /*  Notifications from the pmuxes. */
+    struct nn_pmux_mailbox mailbox;
+
+    /*  The connection. */
+    struct nn_smux smux;
+
+    /*  Name to connect to and the port. The options are those of the
+        endpoint the host was created for. */
+    size_t namelen;
+    uint16_t port;
+    int ipv4only;
+    struct nn_dns dns;
+    struct nn_dns_result dns_result;
+    struct nn_backoff retry;
+
+    /*  The pmuxes waiting for the connection to be established. */
+    struct nn_list pmuxes;
+};
+
+/*  'addr' is in the "host:port" form and it was validated by the caller.
+    The host starts connecting straight away. */
+void nn_cmux_init (struct nn_cmux *self, const char *addr, size_t addrlen,
+    struct nn_ep *ep);
+void nn_cmux_term (struct nn_cmux *self);
+
+#endif
@@ -0,0 +1,529 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "emux.h"
+#include "cmux.h"
+
+#include "../utils/dns.h"
+#include "../utils/port.h"
+#include "../utils/literal.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
+#else
+#include <sys/socket.h>
+#endif
+
+#define NN_EMUX_STATE_IDLE 1
+#define NN_EMUX_STATE_ACTIVE 2
+#define NN_EMUX_STATE_WAITING 3
+#define NN_EMUX_STATE_STOPPING_BACKOFF 4
+#define NN_EMUX_STATE_STOPPING 5
+#define NN_EMUX_STATE_RELEASING 6
+
+#define NN_EMUX_SRC_PMUX 1
+#define NN_EMUX_SRC_RECONNECT_TIMER 2
+
+/*  nn_ep virtual interface implementation. */
+static void nn_emux_stop (struct nn_ep *ep);
+static void nn_emux_destroy (struct nn_ep *ep);
+const struct nn_ep_vfptr nn_emux_ep_vfptr = {
+    nn_emux_stop,
+    nn_emux_destroy
+};
+
+/*  Private functions. */
+static void nn_emux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_emux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static int nn_emux_parse (const char *addr, int bind, int ipv4only,
+    size_t *hostlen);
+static int nn_emux_gethost (struct nn_emux *self, const char *addr,
+    size_t addrlen);
+static void nn_emux_open (struct nn_emux *self);
+static void nn_emux_incoming (struct nn_emux *self, struct nn_lmux_req *req);
+static void nn_emux_term (struct nn_emux *self);
+static void nn_emux_free_pmux (struct nn_pmux *pmux);
+static void nn_emux_release (struct nn_emux *self);
+
+int nn_emux_create (struct nn_ep *ep, int bind)
+{
+    int rc;
+    const char *addr;
+    size_t hostlen;
+    int ipv4only;
+    int reconnect_ivl;
+    int reconnect_ivl_max;
+    size_t sz;
+    struct nn_emux *self;
+
+    sz = sizeof (ipv4only);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_IPV4ONLY, &ipv4only, &sz);
+    nn_assert (sz == sizeof (ipv4only));
+
+    /*  Check whether the address is valid. */
+    addr = nn_ep_getaddr (ep);
+    rc = nn_emux_parse (addr, bind, ipv4only, &hostlen);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Allocate the new endpoint object. */
+    self = nn_alloc (sizeof (struct nn_emux), "emux");
+    alloc_assert (self);
+    nn_fsm_init_root (&self->fsm, nn_emux_handler, nn_emux_shutdown,
+        nn_ep_getctx (ep));
+    self->state = NN_EMUX_STATE_IDLE;
+    self->ep = ep;
+    self->bind = bind;
+    self->host = NULL;
+    strcpy (self->service, addr + hostlen + 1);
+    nn_list_item_init (&self->svc.item);
+    self->svc.name = self->service;
+    self->svc.namelen = strlen (self->service);
+    self->svc.fsm = &self->fsm;
+    self->svc.nincoming = 0;
+    self->pmux = NULL;
+    sz = sizeof (reconnect_ivl);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL, &reconnect_ivl, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl));
+    sz = sizeof (reconnect_ivl_max);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL_MAX,
+        &reconnect_ivl_max, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl_max));
+    if (reconnect_ivl_max == 0)
+        reconnect_ivl_max = reconnect_ivl;
+    nn_backoff_init (&self->retry, NN_EMUX_SRC_RECONNECT_TIMER,
+        reconnect_ivl, reconnect_ivl_max, &self->fsm);
+    nn_list_init (&self->pmuxes);
+    nn_fsm_event_init (&self->stop);
+    nn_fsm_event_init (&self->released);
+
+    /*  Join the host, creating it if needed. */
+    rc = nn_emux_gethost (self, addr, hostlen);
+    if (nn_slow (rc < 0)) {
+        nn_emux_term (self);
+        return rc;
+    }
+    nn_ep_tran_setup (ep, &nn_emux_ep_vfptr, self);
+
+    /*  Start the state machine. */
+    nn_fsm_start (&self->fsm);
+
+    return 0;
+}
+
+static void nn_emux_stop (struct nn_ep *ep)
+{
+    struct nn_emux *emux;
+
+    emux = nn_ep_tran_private (ep);
+    nn_fsm_stop (&emux->fsm);
+}
+
+static void nn_emux_destroy (struct nn_ep *ep)
+{
+    nn_emux_term (nn_ep_tran_private (ep));
+}
+
+static void nn_emux_term (struct nn_emux *self)
+{
+    nn_assert_state (self, NN_EMUX_STATE_IDLE);
+    nn_assert (!self->host);
+    nn_assert (!self->pmux);
+
+    nn_fsm_event_term (&self->released);
+    nn_fsm_event_term (&self->stop);
+    nn_list_term (&self->pmuxes);
+    nn_backoff_term (&self->retry);
+    nn_list_item_term (&self->svc.item);
+    nn_fsm_term (&self->fsm);
+
+    nn_free (self);
+}
+
+static int nn_emux_parse (const char *addr, int bind, int ipv4only,
+    size_t *hostlen)
+{
+    int rc;
+    const char *slash;
+    const char *colon;
+    struct sockaddr_storage ss;
+    size_t sslen;
+
+    /*  The address has the "host:port/service" form. */
+    slash = strchr (addr, '/');
+    if (!slash || !slash [1] || strlen (slash + 1) > NN_SMUX_SERVICEMAX)
+        return -EINVAL;
+
+    /*  Parse the port. */
+    for (colon = slash; colon != addr && colon [-1] != ':'; --colon)
+        ;
+    if (colon == addr)
+        return -EINVAL;
+    --colon;
+    rc = nn_port_resolve (colon + 1, slash - colon - 1);
+    if (rc < 0)
+        return -EINVAL;
+
+    /*  The interface to bind to is resolved when the host is created. When
+        connecting, check whether the host portion of the address is either
+        a literal or a valid hostname. */
+    if (!bind && nn_dns_check_hostname (addr, colon - addr) < 0 &&
+          nn_literal_resolve (addr, colon - addr, ipv4only, &ss, &sslen) < 0)
+        return -EINVAL;
+
+    *hostlen = slash - addr;
+    return 0;
+}
+
+/*  Looks up the host with the address, creating it if there's none yet. The
+    options of the endpoint the host is created for apply to all of its
+    endpoints. */
+static int nn_emux_gethost (struct nn_emux *self, const char *addr,
+    size_t addrlen)
+{
+    int rc;
+    struct nn_tcpmux_host *host;
+    struct nn_cmux *cmux;
+    struct nn_lmux *lmux;
+
+    nn_tcpmux_lock ();
+    host = nn_tcpmux_find (self->bind, addr, addrlen);
+    if (!host) {
+        if (self->bind) {
+            lmux = nn_alloc (sizeof (struct nn_lmux), "lmux");
+            alloc_assert (lmux);
+            rc = nn_lmux_init (lmux, addr, addrlen, self->ep);
+            if (nn_slow (rc < 0)) {
+                nn_lmux_term (lmux);
+                nn_free (lmux);
+                nn_tcpmux_unlock ();
+                return rc;
+            }
+            host = &lmux->host;
+        }
+        else {
+            cmux = nn_alloc (sizeof (struct nn_cmux), "cmux");
+            alloc_assert (cmux);
+            nn_cmux_init (cmux, addr, addrlen, self->ep);
+            host = &cmux->host;
+        }
+        nn_tcpmux_insert (host);
+    }
+
+    /*  Each service can be bound to only once. A new host has none. */
+    if (self->bind) {
+        rc = nn_lmux_register (nn_cont (host, struct nn_lmux, host),
+            &self->svc);
+        if (nn_slow (rc < 0)) {
+            nn_assert (host->refs > 0);
+            nn_tcpmux_unlock ();
+            return rc;
+        }
+    }
+    ++host->refs;
+    self->host = host;
+    nn_tcpmux_unlock ();
+
+    return 0;
+}
+
+/*  Destroys the host once it has stopped. */
+static void nn_emux_release (struct nn_emux *self)
+{
+    struct nn_cmux *cmux;
+    struct nn_lmux *lmux;
+
+    if (self->bind) {
+        lmux = nn_cont (self->host, struct nn_lmux, host);
+        nn_lmux_term (lmux);
+        nn_free (lmux);
+    }
+    else {
+        cmux = nn_cont (self->host, struct nn_cmux, host);
+        nn_cmux_term (cmux);
+        nn_free (cmux);
+    }
+    self->host = NULL;
+}
+
+static void nn_emux_free_pmux (struct nn_pmux *pmux)
+{
+    nn_pmux_term (pmux);
+    nn_free (pmux);
+}
+
+/*  Opens the channel of the connecting endpoint. */
+static void nn_emux_open (struct nn_emux *self)
+{
+    nn_assert (!self->pmux);
+
+    self->pmux = nn_alloc (sizeof (struct nn_pmux), "pmux");
+    alloc_assert (self->pmux);
+    nn_pmux_init (self->pmux, NN_EMUX_SRC_PMUX, self->ep,
+        &nn_cont (self->host, struct nn_cmux, host)->mailbox, self->service,
+        &self->fsm);
+    nn_pmux_start (self->pmux);
+    self->state = NN_EMUX_STATE_ACTIVE;
+}
+
+/*  A peer has asked to open a channel to the bound endpoint. */
+static void nn_emux_incoming (struct nn_emux *self, struct nn_lmux_req *req)
+{
+    struct nn_pmux *pmux;
+
+    nn_tcpmux_lock ();
+    --self->svc.nincoming;
+    nn_tcpmux_unlock ();
+
+    if (nn_slow (self->state != NN_EMUX_STATE_ACTIVE ||
+          !nn_ep_ispeer (self->ep, req->protocol))) {
+        nn_lmux_reject (&self->fsm, req);
+        return;
+    }
+
+    pmux = nn_alloc (sizeof (struct nn_pmux), "pmux");
+    alloc_assert (pmux);
+    nn_pmux_init (pmux, NN_EMUX_SRC_PMUX, self->ep, &req->lmux->mailbox,
+        NULL, &self->fsm);
+    nn_pmux_setchannel (pmux, req->smux, req->chan, req->protocol);
+    nn_list_insert (&self->pmuxes, &pmux->epitem,
+        nn_list_end (&self->pmuxes));
+    nn_pmux_start (pmux);
+
+    nn_fsm_event_term (&req->event);
+    nn_free (req);
+}
+
+static void nn_emux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    int last;
+    struct nn_emux *emux;
+    struct nn_list_item *it;
+    struct nn_pmux *pmux;
+
+    emux = nn_cont (self, struct nn_emux, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+
+        /*  No new channels are passed to the endpoint from now on. */
+        if (emux->bind) {
+            nn_tcpmux_lock ();
+            nn_lmux_unregister (nn_cont (emux->host, struct nn_lmux, host),
+                &emux->svc);
+            nn_tcpmux_unlock ();
+        }
+        if (emux->pmux)
+            nn_pmux_stop (emux->pmux);
+        for (it = nn_list_begin (&emux->pmuxes);
+              it != nn_list_end (&emux->pmuxes);
+              it = nn_list_next (&emux->pmuxes, it))
+            nn_pmux_stop (nn_cont (it, struct nn_pmux, epitem));
+        nn_backoff_stop (&emux->retry);
+        emux->state = NN_EMUX_STATE_STOPPING;
+    }
+    else if (src == NN_EMUX_SRC_PMUX && type == NN_PMUX_STOPPED) {
+        pmux = (struct nn_pmux*) srcptr;
+        if (emux->bind)
+            nn_list_erase (&emux->pmuxes, &pmux->epitem);
+        else
+            emux->pmux = NULL;
+        nn_emux_free_pmux (pmux);
+    }
+    else if (src == NN_TCPMUX_SRC_PEER && type == NN_TCPMUX_INCOMING) {
+        nn_emux_incoming (emux, (struct nn_lmux_req*) srcptr);
+    }
+    else if (src == NN_TCPMUX_SRC_PEER && type == NN_TCPMUX_RELEASED) {
+        nn_assert_state (emux, NN_EMUX_STATE_RELEASING);
+        nn_emux_release (emux);
+    }
+
+    /*  Whatever else is reported meanwhile is ignored. */
+    if (emux->state == NN_EMUX_STATE_STOPPING) {
+        if (emux->pmux || !nn_list_empty (&emux->pmuxes) ||
+              !nn_backoff_isidle (&emux->retry))
+            return;
+
+        /*  Wait for the channels already passed to the endpoint, they are
+            rejected. The last endpoint to stop using the host stops it. */
+        nn_tcpmux_lock ();
+        if (emux->svc.nincoming > 0) {
+            nn_tcpmux_unlock ();
+            return;
+        }
+        last = --emux->host->refs == 0;
+        if (last)
+            nn_tcpmux_erase (emux->host);
+        nn_tcpmux_unlock ();
+        if (last) {
+            emux->host->releaser = &emux->fsm;
+            emux->host->released = &emux->released;
+            nn_fsm_raiseto (&emux->fsm, emux->host->fsm, &emux->stop,
+                NN_TCPMUX_SRC_PEER, NN_TCPMUX_STOP, NULL);
+            emux->state = NN_EMUX_STATE_RELEASING;
+            return;
+        }
+        emux->host = NULL;
+    }
+    else if (emux->state == NN_EMUX_STATE_RELEASING) {
+        if (emux->host)
+            return;
+    }
+    emux->state = NN_EMUX_STATE_IDLE;
+    nn_fsm_stopped_noevent (&emux->fsm);
+    nn_ep_stopped (emux->ep);
+}
+
+static void nn_emux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    struct nn_emux *emux;
+    struct nn_pmux *pmux;
+
+    emux = nn_cont (self, struct nn_emux, fsm);
+
+    /*  Requests to open a channel can come at any time. */
+    if (src == NN_TCPMUX_SRC_PEER) {
+        nn_assert (type == NN_TCPMUX_INCOMING);
+        nn_emux_incoming (emux, (struct nn_lmux_req*) srcptr);
+        return;
+    }
+
+    switch (emux->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_EMUX_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                if (emux->bind)
+                    emux->state = NN_EMUX_STATE_ACTIVE;
+                else
+                    nn_emux_open (emux);
+                return;
+            default:
+                nn_fsm_bad_action (emux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (emux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/*  The connecting endpoint has its channel open or being opened, the bound   */
+/*  one takes over the channels opened by the peers.                          */
+/******************************************************************************/
+    case NN_EMUX_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_EMUX_SRC_PMUX:
+            pmux = (struct nn_pmux*) srcptr;
+            switch (type) {
+            case NN_PMUX_ERROR:
+
+                /*  If the channel was open, the next one is opened without
+                    delay. */
+                if (!emux->bind && pmux->started)
+                    nn_backoff_reset (&emux->retry);
+                nn_pmux_stop (pmux);
+                return;
+            case NN_PMUX_STOPPED:
+                if (emux->bind) {
+                    nn_list_erase (&emux->pmuxes, &pmux->epitem);
+                    nn_emux_free_pmux (pmux);
+                    return;
+                }
+                emux->pmux = NULL;
+                nn_emux_free_pmux (pmux);
+                nn_backoff_start (&emux->retry);
+                emux->state = NN_EMUX_STATE_WAITING;
+                return;
+            default:
+                nn_fsm_bad_action (emux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (emux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  WAITING state.                                                            */
+/*  Waiting before opening a new channel.                                     */
+/******************************************************************************/
+    case NN_EMUX_STATE_WAITING:
+        switch (src) {
+
+        case NN_EMUX_SRC_RECONNECT_TIMER:
+            switch (type) {
+            case NN_BACKOFF_TIMEOUT:
+                nn_backoff_stop (&emux->retry);
+                emux->state = NN_EMUX_STATE_STOPPING_BACKOFF;
+                return;
+            default:
+                nn_fsm_bad_action (emux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (emux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  STOPPING_BACKOFF state.                                                   */
+/******************************************************************************/
+    case NN_EMUX_STATE_STOPPING_BACKOFF:
+        switch (src) {
+
+        case NN_EMUX_SRC_RECONNECT_TIMER:
+            switch (type) {
+            case NN_BACKOFF_STOPPED:
+                nn_emux_open (emux);
+                return;
+            default:
+                nn_fsm_bad_action (emux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (emux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (emux->state, src, type);
+    }
+}
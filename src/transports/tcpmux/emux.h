@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_EMUX_INCLUDED
+#define NN_EMUX_INCLUDED
+
+#include "tcpmux.h"
+#include "lmux.h"
+#include "pmux.h"
+#include "smux.h"
+
+#include "../utils/backoff.h"
+
+#include "../../transport.h"
+
+#include "../../aio/fsm.h"
+
+#include "../../utils/list.h"
+
+/*  Endpoint of the tcpmux transport. It uses the host shared by all the
+    endpoints with the same address and has a channel to the service
+    opened for each of its pipes. The connecting endpoint keeps a single
+    channel open, the bound one takes over the channels the peers open. */
+
+struct nn_emux {
+
+    /*  The state machine. */
+    struct nn_fsm fsm;
+    int state;
+
+    /*  The endpoint. */
+    struct nn_ep *ep;
+    int bind;
+
+    /*  The host the endpoint uses. */
+    struct nn_tcpmux_host *host;
+
+    /*  Name of the service, i.e. the part of the address after the slash. */
+    char service [NN_SMUX_SERVICEMAX + 1];
+
+    /*  The service as registered with the listening host. */
+    struct nn_lmux_service svc;
+
+    /*  The channel of the connecting endpoint and the timer used to wait
+        before opening a new one. */
+    struct nn_pmux *pmux;
+    struct nn_backoff retry;
+
+    /*  The channels of the bound endpoint. */
+    struct nn_list pmuxes;
+
+    /*  Events exchanged with the host when the endpoint is the last one to
+        stop using it. */
+    struct nn_fsm_event stop;
+    struct nn_fsm_event released;
+};
+
+int nn_emux_create (struct nn_ep *ep, int bind);
+
+#endif
@@ -0,0 +1,450 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "lmux.h"
+
+#include "../utils/port.h"
+#include "../utils/iface.h"
+
+#include "../../core/global.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+/*  Same as for the tcp transport. */
+#define NN_LMUX_BACKLOG 100
+
+#define NN_LMUX_STATE_IDLE 1
+#define NN_LMUX_STATE_ACTIVE 2
+#define NN_LMUX_STATE_STOPPING_SMUXES 3
+#define NN_LMUX_STATE_STOPPING_LISTENER 4
+#define NN_LMUX_STATE_STOPPING_MAILBOX 5
+
+#define NN_LMUX_SRC_LISTENER 1
+#define NN_LMUX_SRC_SMUX 2
+#define NN_LMUX_SRC_MAILBOX 3
+
+/*  Private functions. */
+static void nn_lmux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_lmux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static int nn_lmux_listen (struct nn_lmux *self, const char *addr,
+    size_t addrlen, struct nn_ep *ep);
+static int nn_lmux_open (struct nn_smux *smux, struct nn_smux_chan *chan,
+    int protocol, const char *service, size_t servicelen);
+static void nn_lmux_start_accepting (struct nn_lmux *self);
+static void nn_lmux_mail (struct nn_lmux *self);
+static void nn_lmux_rejected (struct nn_lmux_req *req);
+
+int nn_lmux_init (struct nn_lmux *self, const char *addr, size_t addrlen,
+    struct nn_ep *ep)
+{
+    int rc;
+
+    nn_ctx_init (&self->ctx, nn_global_getpool (), NULL);
+    nn_fsm_init_root (&self->fsm, nn_lmux_handler, nn_lmux_shutdown,
+        &self->ctx);
+    self->state = NN_LMUX_STATE_IDLE;
+    nn_tcpmux_host_init (&self->host, 1, addr, addrlen, &self->fsm);
+    nn_pmux_mailbox_init (&self->mailbox, NN_LMUX_SRC_MAILBOX, &self->fsm);
+    nn_usock_init (&self->listener, NN_LMUX_SRC_LISTENER, &self->fsm);
+    self->accepting = NULL;
+    nn_list_init (&self->smuxes);
+    nn_list_init (&self->services);
+
+    /*  If the socket can't be bound, it is stopped straight away and the
+        host remains idle. */
+    nn_ctx_enter (&self->ctx);
+    rc = nn_lmux_listen (self, addr, addrlen, ep);
+    if (nn_fast (rc == 0))
+        nn_fsm_start (&self->fsm);
+    nn_ctx_leave (&self->ctx);
+
+    return rc;
+}
+
+void nn_lmux_term (struct nn_lmux *self)
+{
+    /*  The worker thread that has raised the last event may still be
+        leaving the context. */
+    nn_ctx_enter (&self->ctx);
+    nn_ctx_leave (&self->ctx);
+
+    nn_assert_state (self, NN_LMUX_STATE_IDLE);
+    nn_assert (nn_list_empty (&self->services));
+    nn_list_term (&self->services);
+    nn_list_term (&self->smuxes);
+    nn_usock_term (&self->listener);
+    nn_pmux_mailbox_term (&self->mailbox);
+    nn_tcpmux_host_term (&self->host);
+    nn_fsm_term (&self->fsm);
+    nn_ctx_term (&self->ctx);
+}
+
+int nn_lmux_register (struct nn_lmux *self, struct nn_lmux_service *service)
+{
+    struct nn_list_item *it;
+    struct nn_lmux_service *other;
+
+    for (it = nn_list_begin (&self->services);
+          it != nn_list_end (&self->services);
+          it = nn_list_next (&self->services, it)) {
+        other = nn_cont (it, struct nn_lmux_service, item);
+        if (other->namelen == service->namelen &&
+              memcmp (other->name, service->name, service->namelen) == 0)
+            return -EADDRINUSE;
+    }
+    nn_list_insert (&self->services, &service->item,
+        nn_list_end (&self->services));
+    return 0;
+}
+
+void nn_lmux_unregister (struct nn_lmux *self,
+    struct nn_lmux_service *service)
+{
+    nn_list_erase (&self->services, &service->item);
+}
+
+void nn_lmux_reject (struct nn_fsm *fsm, struct nn_lmux_req *req)
+{
+    nn_fsm_raiseto (fsm, &req->lmux->fsm, &req->event, NN_TCPMUX_SRC_PEER,
+        NN_TCPMUX_REJECT, req);
+}
+
+static int nn_lmux_listen (struct nn_lmux *self, const char *addr,
+    size_t addrlen, struct nn_ep *ep)
+{
+    int rc;
+    int ipv4only;
+    size_t sz;
+    const char *colon;
+    uint16_t port;
+    struct sockaddr_storage ss;
+    size_t sslen;
+
+    for (colon = addr + addrlen; colon [-1] != ':'; --colon)
+        ;
+    --colon;
+    rc = nn_port_resolve (colon + 1, addr + addrlen - colon - 1);
+    nn_assert (rc >= 0);
+    port = (uint16_t) rc;
+
+    sz = sizeof (ipv4only);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_IPV4ONLY, &ipv4only, &sz);
+    nn_assert (sz == sizeof (ipv4only));
+    rc = nn_iface_resolve (addr, colon - addr, ipv4only, &ss, &sslen);
+    if (nn_slow (rc < 0))
+        return rc;
+    switch (ss.ss_family) {
+    case AF_INET:
+        ((struct sockaddr_in*) &ss)->sin_port = htons (port);
+        sslen = sizeof (struct sockaddr_in);
+        break;
+    case AF_INET6:
+        ((struct sockaddr_in6*) &ss)->sin6_port = htons (port);
+        sslen = sizeof (struct sockaddr_in6);
+        break;
+    default:
+        nn_assert (0);
+    }
+
+    rc = nn_usock_start (&self->listener, ss.ss_family, SOCK_STREAM, 0);
+    if (nn_slow (rc < 0))
+        return rc;
+    rc = nn_usock_bind (&self->listener, (struct sockaddr*) &ss, sslen);
+    if (nn_fast (rc == 0))
+        rc = nn_usock_listen (&self->listener, NN_LMUX_BACKLOG);
+    if (nn_slow (rc < 0)) {
+        nn_usock_stop (&self->listener);
+        return rc;
+    }
+
+    return 0;
+}
+
+/*  Called by a session when the peer asks to open a channel. */
+static int nn_lmux_open (struct nn_smux *smux, struct nn_smux_chan *chan,
+    int protocol, const char *service, size_t servicelen)
+{
+    struct nn_lmux *self;
+    struct nn_list_item *it;
+    struct nn_lmux_service *svc;
+    struct nn_lmux_req *req;
+
+    self = nn_cont (smux->fsm.owner, struct nn_lmux, fsm);
+
+    nn_tcpmux_lock ();
+    for (it = nn_list_begin (&self->services);
+          it != nn_list_end (&self->services);
+          it = nn_list_next (&self->services, it)) {
+        svc = nn_cont (it, struct nn_lmux_service, item);
+        if (svc->namelen == servicelen &&
+              memcmp (svc->name, service, servicelen) == 0)
+            break;
+    }
+    if (nn_slow (it == nn_list_end (&self->services))) {
+        nn_tcpmux_unlock ();
+        return -ECONNREFUSED;
+    }
+
+    /*  The endpoint can't go away before it processes the request. */
+    req = nn_alloc (sizeof (struct nn_lmux_req), "tcpmux request");
+    alloc_assert (req);
+    nn_fsm_event_init (&req->event);
+    req->lmux = self;
+    req->smux = smux;
+    req->chan = chan;
+    req->protocol = protocol;
+    ++svc->nincoming;
+    nn_fsm_raiseto (&self->fsm, svc->fsm, &req->event, NN_TCPMUX_SRC_PEER,
+        NN_TCPMUX_INCOMING, req);
+    nn_tcpmux_unlock ();
+
+    return 0;
+}
+
+static void nn_lmux_rejected (struct nn_lmux_req *req)
+{
+    nn_smux_reject (req->smux, req->chan);
+    nn_fsm_event_term (&req->event);
+    nn_free (req);
+}
+
+static void nn_lmux_start_accepting (struct nn_lmux *self)
+{
+    nn_assert (self->accepting == NULL);
+
+    self->accepting = nn_alloc (sizeof (struct nn_smux), "smux");
+    alloc_assert (self->accepting);
+    nn_smux_init (self->accepting, NN_LMUX_SRC_SMUX, nn_lmux_open,
+        &self->fsm);
+    nn_smux_accept (self->accepting, &self->listener);
+}
+
+/*  Processes the notifications from the pmuxes. */
+static void nn_lmux_mail (struct nn_lmux *self)
+{
+    struct nn_queue queue;
+    struct nn_queue_item *item;
+    struct nn_pmux *pmux;
+    uint32_t what;
+
+    nn_queue_init (&queue);
+    nn_pmux_mailbox_drain (&self->mailbox, &queue);
+    while (1) {
+        item = nn_queue_pop (&queue);
+        if (!item)
+            break;
+        pmux = nn_cont (item, struct nn_pmux, mailitem);
+        what = nn_pmux_mail (pmux);
+
+        /*  The pmuxes on this side are given the channel when created. */
+        if (what & NN_PMUX_ATTACH)
+            nn_smux_attach (pmux->smux, pmux->chan, pmux);
+        if (what & (NN_PMUX_SENT | NN_PMUX_RECEIVED))
+            nn_smux_mail (pmux, what);
+        if (what & NN_PMUX_DETACH) {
+            if (pmux->smux)
+                nn_smux_detach (pmux->smux, pmux);
+            nn_pmux_notify (pmux, &self->fsm, NN_PMUX_DETACHED);
+        }
+    }
+    nn_queue_term (&queue);
+}
+
+static void nn_lmux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    struct nn_lmux *lmux;
+    struct nn_list_item *it;
+    struct nn_smux *smux;
+
+    lmux = nn_cont (self, struct nn_lmux, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        if (lmux->accepting)
+            nn_smux_stop (lmux->accepting);
+        for (it = nn_list_begin (&lmux->smuxes);
+              it != nn_list_end (&lmux->smuxes);
+              it = nn_list_next (&lmux->smuxes, it)) {
+            smux = nn_cont (it, struct nn_smux, item);
+            nn_smux_stop (smux);
+        }
+        lmux->state = NN_LMUX_STATE_STOPPING_SMUXES;
+    }
+    else if (src == NN_LMUX_SRC_MAILBOX && type == NN_PMUX_MAIL) {
+        nn_lmux_mail (lmux);
+    }
+    else if (src == NN_TCPMUX_SRC_PEER && type == NN_TCPMUX_REJECT) {
+        nn_lmux_rejected ((struct nn_lmux_req*) srcptr);
+    }
+    else if (src == NN_LMUX_SRC_SMUX && type == NN_SMUX_STOPPED) {
+        smux = (struct nn_smux*) srcptr;
+        if (smux == lmux->accepting)
+            lmux->accepting = NULL;
+        else
+            nn_list_erase (&lmux->smuxes, &smux->item);
+        nn_smux_term (smux);
+        nn_free (smux);
+    }
+
+    /*  Whatever else is reported meanwhile is ignored. */
+    if (lmux->state == NN_LMUX_STATE_STOPPING_SMUXES) {
+        if (lmux->accepting || !nn_list_empty (&lmux->smuxes))
+            return;
+        nn_usock_stop (&lmux->listener);
+        lmux->state = NN_LMUX_STATE_STOPPING_LISTENER;
+    }
+    if (lmux->state == NN_LMUX_STATE_STOPPING_LISTENER) {
+        if (!nn_usock_isidle (&lmux->listener))
+            return;
+        lmux->state = NN_LMUX_STATE_STOPPING_MAILBOX;
+    }
+
+    /*  There are no pmuxes left, yet a notification from the last of them
+        may still be on its way. */
+    if (!nn_pmux_mailbox_isidle (&lmux->mailbox))
+        return;
+    lmux->state = NN_LMUX_STATE_IDLE;
+    nn_fsm_stopped_noevent (&lmux->fsm);
+    nn_tcpmux_host_released (&lmux->host);
+}
+
+static void nn_lmux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr)
+{
+    struct nn_lmux *lmux;
+    struct nn_smux *smux;
+
+    lmux = nn_cont (self, struct nn_lmux, fsm);
+
+    /*  Any-state events. */
+    switch (src) {
+    case NN_LMUX_SRC_MAILBOX:
+        nn_assert (type == NN_PMUX_MAIL);
+        nn_lmux_mail (lmux);
+        return;
+    case NN_TCPMUX_SRC_PEER:
+        switch (type) {
+        case NN_TCPMUX_STOP:
+            nn_fsm_stop (&lmux->fsm);
+            return;
+        case NN_TCPMUX_REJECT:
+            nn_lmux_rejected ((struct nn_lmux_req*) srcptr);
+            return;
+        default:
+            nn_fsm_bad_action (lmux->state, src, type);
+        }
+    }
+
+    switch (lmux->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_LMUX_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                nn_lmux_start_accepting (lmux);
+                lmux->state = NN_LMUX_STATE_ACTIVE;
+                return;
+            default:
+                nn_fsm_bad_action (lmux->state, src, type);
+            }
+
+        /*  The socket was stopped because it couldn't be bound. */
+        case NN_LMUX_SRC_LISTENER:
+            switch (type) {
+            case NN_USOCK_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (lmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (lmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/******************************************************************************/
+    case NN_LMUX_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_LMUX_SRC_LISTENER:
+            switch (type) {
+            case NN_USOCK_ACCEPT_ERROR:
+                nn_usock_accept (&lmux->accepting->usock, &lmux->listener);
+                return;
+            default:
+                nn_fsm_bad_action (lmux->state, src, type);
+            }
+
+        case NN_LMUX_SRC_SMUX:
+            smux = (struct nn_smux*) srcptr;
+            switch (type) {
+            case NN_SMUX_ACCEPTED:
+                nn_assert (smux == lmux->accepting);
+                nn_list_insert (&lmux->smuxes, &smux->item,
+                    nn_list_end (&lmux->smuxes));
+                lmux->accepting = NULL;
+                nn_lmux_start_accepting (lmux);
+                return;
+            case NN_SMUX_ERROR:
+                nn_smux_stop (smux);
+                return;
+            case NN_SMUX_STOPPED:
+                nn_list_erase (&lmux->smuxes, &smux->item);
+                nn_smux_term (smux);
+                nn_free (smux);
+                return;
+            default:
+                nn_fsm_bad_action (lmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (lmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (lmux->state, src, type);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_LMUX_INCLUDED
+#define NN_LMUX_INCLUDED
+
+#include "tcpmux.h"
+#include "smux.h"
+#include "pmux.h"
+
+#include "../../aio/ctx.h"
+#include "../../aio/fsm.h"
+#include "../../aio/usock.h"
+
+#include "../../utils/list.h"
+
+/*  Host of the endpoints bound to the same address. It owns the listening
+    socket and the sessions accepted through it, and passes the requests to
+    open a channel to the endpoints bound to the requested service. */
+
+struct nn_lmux {
+
+    /*  The state machine and the context it lives in. */
+    struct nn_fsm fsm;
+    int state;
+    struct nn_ctx ctx;
+
+    /*  Entry in the registry. */
+    struct nn_tcpmux_host host;
+
+    /*  Notifications from the pmuxes. */
+    struct nn_pmux_mailbox mailbox;
+
+    /*  The listening socket, the session that is accepting the next
+        connection and the established sessions. */
+    struct nn_usock listener;
+    struct nn_smux *accepting;
+    struct nn_list smuxes;
+
+    /*  The services of the endpoints. Guarded by the registry lock. */
+    struct nn_list services;
+};
+
+/*  A service, i.e. an endpoint bound to the host. */
+struct nn_lmux_service {
+    struct nn_list_item item;
+    const char *name;
+    size_t namelen;
+    struct nn_fsm *fsm;
+
+    /*  Number of requests to open a channel sent to the endpoint and not
+        yet processed by it. Guarded by the registry lock. */
+    int nincoming;
+};
+
+/*  Request to open a channel. Sent to the endpoint as the argument of
+    NN_TCPMUX_INCOMING; if the endpoint doesn't attach a pmux to the channel,
+    it returns the request with NN_TCPMUX_REJECT. */
+struct nn_lmux_req {
+    struct nn_fsm_event event;
+    struct nn_lmux *lmux;
+    struct nn_smux *smux;
+    struct nn_smux_chan *chan;
+    int protocol;
+};
+
+/*  'addr' is in the "iface:port" form and it was validated by the caller.
+    The host starts listening straight away; if it fails to, an error is
+    returned and the host has to be terminated. */
+int nn_lmux_init (struct nn_lmux *self, const char *addr, size_t addrlen,
+    struct nn_ep *ep);
+void nn_lmux_term (struct nn_lmux *self);
+
+/*  Adds a service to the host and removes it. Fails with -EADDRINUSE if
+    there's already a service with the same name. The registry lock must be
+    held. */
+int nn_lmux_register (struct nn_lmux *self, struct nn_lmux_service *service);
+void nn_lmux_unregister (struct nn_lmux *self,
+    struct nn_lmux_service *service);
+
+/*  To be called by the endpoint for the requests it doesn't accept. */
+void nn_lmux_reject (struct nn_fsm *fsm, struct nn_lmux_req *req);
+
+#endif
@@ -0,0 +1,546 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "pmux.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#define NN_PMUX_STATE_IDLE 1
+#define NN_PMUX_STATE_ATTACHING 2
+#define NN_PMUX_STATE_ACTIVE 3
+#define NN_PMUX_STATE_DONE 4
+#define NN_PMUX_STATE_DETACHING 5
+
+/*  Private functions. */
+static void nn_pmux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_pmux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_pmux_post (struct nn_pmux *self, uint32_t what);
+static void nn_pmux_opened (struct nn_pmux *self);
+static void nn_pmux_in (struct nn_pmux *self);
+static void nn_pmux_out (struct nn_pmux *self);
+static void nn_pmux_closed (struct nn_pmux *self);
+static int nn_pmux_push (struct nn_pmux *self);
+static void nn_pmux_rcvwait (struct nn_pmux *self);
+
+static int nn_pmux_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_pmux_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_pmux_queued (struct nn_pipebase *self);
+static void nn_pmux_disconnect (struct nn_pipebase *self);
+const struct nn_pipebase_vfptr nn_pmux_pipebase_vfptr = {
+    nn_pmux_send,
+    nn_pmux_recv,
+    nn_pmux_queued,
+    NULL,
+    nn_pmux_disconnect
+};
+
+void nn_pmux_mailbox_init (struct nn_pmux_mailbox *self, int src,
+    struct nn_fsm *host)
+{
+    self->host = host;
+    self->src = src;
+    nn_mpscq_init (&self->queue);
+    nn_atomic_init (&self->pending, 0);
+    nn_fsm_event_init (&self->event);
+}
+
+void nn_pmux_mailbox_term (struct nn_pmux_mailbox *self)
+{
+    nn_fsm_event_term (&self->event);
+    nn_atomic_term (&self->pending);
+    nn_mpscq_term (&self->queue);
+}
+
+int nn_pmux_mailbox_isidle (struct nn_pmux_mailbox *self)
+{
+    return nn_atomic_load (&self->pending) ? 0 : 1;
+}
+
+void nn_pmux_mailbox_drain (struct nn_pmux_mailbox *self,
+    struct nn_queue *queue)
+{
+    /*  From now on, the pmuxes have to raise the event again. Those that
+        got into the mailbox before this point are taken below. */
+    nn_atomic_store (&self->pending, 0);
+    nn_mpscq_drain (&self->queue, queue);
+}
+
+void nn_pmux_init (struct nn_pmux *self, int src, struct nn_ep *ep,
+    struct nn_pmux_mailbox *mailbox, const char *service,
+    struct nn_fsm *owner)
+{
+    int sndbuf;
+    size_t sz;
+
+    nn_fsm_init (&self->fsm, nn_pmux_handler, nn_pmux_shutdown,
+        src, self, owner);
+    self->state = NN_PMUX_STATE_IDLE;
+    nn_pipebase_init (&self->pipebase, &nn_pmux_pipebase_vfptr, ep);
+    self->ep = ep;
+    self->mailbox = mailbox;
+    sz = sizeof (self->rcvbuf);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RCVBUF, &self->rcvbuf, &sz);
+    nn_assert (sz == sizeof (self->rcvbuf));
+    sz = sizeof (sndbuf);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
+    nn_assert (sz == sizeof (sndbuf));
+    sz = sizeof (self->rcvmaxsize);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RCVMAXSIZE, &self->rcvmaxsize, &sz);
+    nn_assert (sz == sizeof (self->rcvmaxsize));
+    sz = sizeof (self->protocol);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_PROTOCOL, &self->protocol, &sz);
+    nn_assert (sz == sizeof (self->protocol));
+    nn_msgqueue_init (&self->inq, self->rcvbuf);
+    nn_msgqueue_init (&self->outq, sndbuf);
+    nn_msg_init (&self->msg, 0);
+    self->sending = 0;
+    self->attached = 0;
+    self->started = 0;
+    nn_atomic_init (&self->tohost, 0);
+    nn_queue_item_init (&self->mailitem);
+    nn_atomic_init (&self->fromhost, 0);
+    nn_fsm_event_init (&self->fromhostev);
+    nn_fsm_event_init (&self->done);
+    self->service = service;
+    self->peer = -1;
+    self->smux = NULL;
+    self->chan = NULL;
+    nn_list_item_init (&self->item);
+    nn_list_item_init (&self->epitem);
+}
+
+void nn_pmux_term (struct nn_pmux *self)
+{
+    nn_assert_state (self, NN_PMUX_STATE_IDLE);
+
+    nn_list_item_term (&self->epitem);
+    nn_list_item_term (&self->item);
+    nn_fsm_event_term (&self->done);
+    nn_fsm_event_term (&self->fromhostev);
+    nn_atomic_term (&self->fromhost);
+    nn_queue_item_term (&self->mailitem);
+    nn_atomic_term (&self->tohost);
+    nn_msg_term (&self->msg);
+    nn_msgqueue_term (&self->outq);
+    nn_msgqueue_term (&self->inq);
+    nn_pipebase_term (&self->pipebase);
+    nn_fsm_term (&self->fsm);
+}
+
+int nn_pmux_isidle (struct nn_pmux *self)
+{
+    return nn_fsm_isidle (&self->fsm);
+}
+
+void nn_pmux_setchannel (struct nn_pmux *self, struct nn_smux *smux,
+    struct nn_smux_chan *chan, int peer)
+{
+    nn_assert_state (self, NN_PMUX_STATE_IDLE);
+    self->smux = smux;
+    self->chan = chan;
+    self->peer = peer;
+}
+
+void nn_pmux_start (struct nn_pmux *self)
+{
+    nn_fsm_start (&self->fsm);
+}
+
+void nn_pmux_stop (struct nn_pmux *self)
+{
+    nn_fsm_stop (&self->fsm);
+}
+
+void nn_pmux_notify (struct nn_pmux *self, struct nn_fsm *host,
+    uint32_t what)
+{
+    uint32_t old;
+    uint32_t cur;
+
+    old = nn_atomic_load (&self->fromhost);
+    while (1) {
+        cur = nn_atomic_cas (&self->fromhost, old,
+            old | what | NN_PMUX_QUEUED);
+        if (nn_fast (cur == old))
+            break;
+        old = cur;
+    }
+
+    /*  If the event is on its way already, the pmux will find the new
+        notifications along with the old ones. */
+    if (!(old & NN_PMUX_QUEUED))
+        nn_fsm_raiseto (host, &self->fsm, &self->fromhostev,
+            NN_PMUX_SRC_HOST, NN_PMUX_HOST, self);
+}
+
+uint32_t nn_pmux_mail (struct nn_pmux *self)
+{
+    return nn_atomic_swap (&self->tohost, 0) & ~NN_PMUX_QUEUED;
+}
+
+/*  Tells the host about the pmux. The pmux gets into the mailbox only if it
+    isn't there yet and the host is raised the event only if it isn't going
+    to look into the mailbox anyway. */
+static void nn_pmux_post (struct nn_pmux *self, uint32_t what)
+{
+    uint32_t old;
+    uint32_t cur;
+    struct nn_pmux_mailbox *mailbox;
+
+    old = nn_atomic_load (&self->tohost);
+    while (1) {
+        cur = nn_atomic_cas (&self->tohost, old,
+            old | what | NN_PMUX_QUEUED);
+        if (nn_fast (cur == old))
+            break;
+        old = cur;
+    }
+    if (old & NN_PMUX_QUEUED)
+        return;
+
+    mailbox = self->mailbox;
+    nn_mpscq_push (&mailbox->queue, &self->mailitem);
+    if (nn_atomic_cas (&mailbox->pending, 0, 1) == 0)
+        nn_fsm_raiseto (&self->fsm, mailbox->host, &mailbox->event,
+            mailbox->src, NN_PMUX_MAIL, NULL);
+}
+
+static int nn_pmux_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_pmux *pmux;
+    struct nn_msg nmsg;
+
+    pmux = nn_cont (self, struct nn_pmux, pipebase);
+
+    /*  The channel may have been closed in the meantime. */
+    if (nn_slow (pmux->state != NN_PMUX_STATE_ACTIVE))
+        return -ECONNRESET;
+    nn_assert (!pmux->sending);
+
+    /*  The peer expects the protocol header at the beginning of the body,
+        the same way the inproc peers do. Prepend it to the body without
+        copying the latter if there's room for it in front. */
+    nn_msg_flatten (msg);
+    if (!nn_chunkref_size (&msg->sphdr) ||
+          nn_chunkref_prepend (&msg->body, nn_chunkref_data (&msg->sphdr),
+          nn_chunkref_size (&msg->sphdr))) {
+        nn_msg_init (&nmsg, 0);
+        nn_chunkref_term (&nmsg.body);
+        nn_chunkref_mv (&nmsg.body, &msg->body);
+        nn_chunkref_init (&msg->body, 0);
+    }
+    else {
+        nn_msg_init (&nmsg,
+            nn_chunkref_size (&msg->sphdr) +
+            nn_chunkref_size (&msg->body));
+        memcpy (nn_chunkref_data (&nmsg.body),
+            nn_chunkref_data (&msg->sphdr),
+            nn_chunkref_size (&msg->sphdr));
+        memcpy ((char *)nn_chunkref_data (&nmsg.body) +
+            nn_chunkref_size (&msg->sphdr),
+            nn_chunkref_data (&msg->body),
+            nn_chunkref_size (&msg->body));
+    }
+    nn_msg_term (msg);
+
+    /*  Write the message to the outbound queue. If it is full, keep the
+        message till the host makes room for it. */
+    nn_msg_term (&pmux->msg);
+    nn_msg_mv (&pmux->msg, &nmsg);
+    if (nn_fast (nn_pmux_push (pmux)))
+        nn_pipebase_sent (&pmux->pipebase);
+    else
+        pmux->sending = 1;
+
+    return 0;
+}
+
+/*  Moves the pending outgoing message to the outbound queue. Returns 1 on
+    success, 0 if the queue is full and the host was asked to tell us once
+    there's room. */
+static int nn_pmux_push (struct nn_pmux *self)
+{
+    if (nn_slow (nn_msgqueue_send (&self->outq, &self->msg) < 0)) {
+        nn_msgqueue_sndwait (&self->outq);
+        if (nn_msgqueue_send (&self->outq, &self->msg) < 0)
+            return 0;
+        nn_msgqueue_sndcancel (&self->outq);
+    }
+    nn_msg_init (&self->msg, 0);
+
+    /*  Wake the host up, unless it's already aware there's something to
+        send. */
+    if (nn_msgqueue_rcvnotify (&self->outq))
+        nn_pmux_post (self, NN_PMUX_SENT);
+
+    return 1;
+}
+
+static size_t nn_pmux_queued (struct nn_pipebase *self)
+{
+    struct nn_pmux *pmux;
+
+    pmux = nn_cont (self, struct nn_pmux, pipebase);
+
+    return nn_msgqueue_size (&pmux->outq) + (pmux->sending ? 1 : 0);
+}
+
+static int nn_pmux_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_pmux *pmux;
+
+    pmux = nn_cont (self, struct nn_pmux, pipebase);
+    nn_assert (pmux->started);
+
+    rc = nn_msgqueue_recv (&pmux->inq, msg);
+    errnum_assert (rc == 0, -rc);
+
+    /*  Let the host know it can grant the peer more credit. */
+    if (nn_slow (nn_msgqueue_sndnotify (&pmux->inq)))
+        nn_pmux_post (pmux, NN_PMUX_RECEIVED);
+
+    if (nn_fast (!nn_msgqueue_empty (&pmux->inq))) {
+        nn_pipebase_received (&pmux->pipebase);
+        return 0;
+    }
+    nn_pmux_rcvwait (pmux);
+
+    return 0;
+}
+
+/*  The inbound queue is empty. Asks the host to tell us about the next
+    message, unless it has written one in the meantime. */
+static void nn_pmux_rcvwait (struct nn_pmux *self)
+{
+    nn_msgqueue_rcvwait (&self->inq);
+    if (!nn_msgqueue_empty (&self->inq) &&
+          nn_msgqueue_rcvcancel (&self->inq))
+        nn_pipebase_received (&self->pipebase);
+}
+
+static void nn_pmux_disconnect (struct nn_pipebase *self)
+{
+    struct nn_pmux *pmux;
+
+    pmux = nn_cont (self, struct nn_pmux, pipebase);
+
+    if (pmux->state == NN_PMUX_STATE_ACTIVE) {
+        pmux->state = NN_PMUX_STATE_DONE;
+        nn_fsm_raise (&pmux->fsm, &pmux->done, NN_PMUX_ERROR);
+    }
+}
+
+/*  Processes the notifications from the host. */
+static void nn_pmux_host (struct nn_pmux *self)
+{
+    uint32_t what;
+
+    what = nn_atomic_swap (&self->fromhost, 0) & ~NN_PMUX_QUEUED;
+    if (what & NN_PMUX_OPENED)
+        nn_pmux_opened (self);
+    if (what & NN_PMUX_IN)
+        nn_pmux_in (self);
+    if (what & NN_PMUX_OUT)
+        nn_pmux_out (self);
+    if (what & NN_PMUX_CLOSED)
+        nn_pmux_closed (self);
+    if (what & NN_PMUX_DETACHED) {
+        nn_assert_state (self, NN_PMUX_STATE_DETACHING);
+        self->attached = 0;
+    }
+}
+
+static void nn_pmux_opened (struct nn_pmux *self)
+{
+    int rc;
+
+    if (self->state != NN_PMUX_STATE_ATTACHING)
+        return;
+
+    rc = nn_pipebase_ispeer (&self->pipebase, self->peer) ? 0 : -EPROTO;
+    if (nn_fast (rc == 0))
+        rc = nn_pipebase_start (&self->pipebase);
+    if (nn_slow (rc < 0)) {
+        self->state = NN_PMUX_STATE_DONE;
+        nn_fsm_raise (&self->fsm, &self->done, NN_PMUX_ERROR);
+        return;
+    }
+    self->started = 1;
+    self->state = NN_PMUX_STATE_ACTIVE;
+    nn_ep_clear_error (self->ep);
+    nn_ep_stat_increment (self->ep, self->service ?
+        NN_STAT_ESTABLISHED_CONNECTIONS : NN_STAT_ACCEPTED_CONNECTIONS, 1);
+}
+
+static void nn_pmux_in (struct nn_pmux *self)
+{
+    /*  The host wrote a message into the empty inbound queue. The
+        notification may be stale: we may have already read the message and
+        asked for the next one. */
+    nn_msgqueue_rcvwoken (&self->inq);
+    if (!self->started)
+        return;
+    if (nn_fast (!nn_msgqueue_empty (&self->inq))) {
+        nn_pipebase_received (&self->pipebase);
+        return;
+    }
+    nn_pmux_rcvwait (self);
+}
+
+static void nn_pmux_out (struct nn_pmux *self)
+{
+    /*  There's room in the outbound queue. The notification may be stale if
+        we've managed to write the message anyway. */
+    nn_msgqueue_sndwoken (&self->outq);
+    if (!self->sending || self->state != NN_PMUX_STATE_ACTIVE)
+        return;
+    if (nn_pmux_push (self)) {
+        self->sending = 0;
+        nn_pipebase_sent (&self->pipebase);
+    }
+}
+
+static void nn_pmux_closed (struct nn_pmux *self)
+{
+    switch (self->state) {
+    case NN_PMUX_STATE_ATTACHING:
+        if (self->service) {
+            nn_ep_set_error (self->ep, ECONNREFUSED);
+            nn_ep_stat_increment (self->ep, NN_STAT_CONNECT_ERRORS, 1);
+        }
+        break;
+    case NN_PMUX_STATE_ACTIVE:
+        nn_ep_stat_increment (self->ep, NN_STAT_BROKEN_CONNECTIONS, 1);
+        break;
+    default:
+        return;
+    }
+    self->state = NN_PMUX_STATE_DONE;
+    nn_fsm_raise (&self->fsm, &self->done, NN_PMUX_ERROR);
+}
+
+static void nn_pmux_shutdown (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_pmux *pmux;
+
+    pmux = nn_cont (self, struct nn_pmux, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        if (pmux->started) {
+            if (pmux->state == NN_PMUX_STATE_ACTIVE)
+                nn_ep_stat_increment (pmux->ep,
+                    NN_STAT_DROPPED_CONNECTIONS, 1);
+            nn_pipebase_stop (&pmux->pipebase);
+            pmux->started = 0;
+        }
+
+        /*  Ask the host to forget about us. We can go only once it has
+            confirmed that it did. */
+        pmux->state = NN_PMUX_STATE_DETACHING;
+        if (pmux->attached)
+            nn_pmux_post (pmux, NN_PMUX_DETACH);
+    }
+    else if (src == NN_PMUX_SRC_HOST && type == NN_PMUX_HOST) {
+        nn_pmux_host (pmux);
+    }
+    else {
+        nn_fsm_bad_source (pmux->state, src, type);
+    }
+
+    if (pmux->attached)
+        return;
+    pmux->state = NN_PMUX_STATE_IDLE;
+    nn_fsm_stopped (&pmux->fsm, NN_PMUX_STOPPED);
+}
+
+static void nn_pmux_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_pmux *pmux;
+
+    pmux = nn_cont (self, struct nn_pmux, fsm);
+
+    switch (pmux->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/*  The host is asked to attach the pmux to a session, either to open         */
+/*  a channel or to take over the one the peer has opened.                    */
+/******************************************************************************/
+    case NN_PMUX_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                pmux->attached = 1;
+                pmux->state = NN_PMUX_STATE_ATTACHING;
+                nn_pmux_post (pmux, NN_PMUX_ATTACH);
+                return;
+            default:
+                nn_fsm_bad_action (pmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (pmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ATTACHING, ACTIVE and DONE states.                                        */
+/*  Whatever the state, the notifications from the host are processed the    */
+/*  same way. DONE means that the channel was closed and the owner was        */
+/*  asked to stop the pmux.                                                   */
+/******************************************************************************/
+    case NN_PMUX_STATE_ATTACHING:
+    case NN_PMUX_STATE_ACTIVE:
+    case NN_PMUX_STATE_DONE:
+        switch (src) {
+
+        case NN_PMUX_SRC_HOST:
+            switch (type) {
+            case NN_PMUX_HOST:
+                nn_pmux_host (pmux);
+                return;
+            default:
+                nn_fsm_bad_action (pmux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (pmux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (pmux->state, src, type);
+    }
+}
@@ -0,0 +1,190 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_PMUX_INCLUDED
+#define NN_PMUX_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../aio/fsm.h"
+
+#include "../inproc/msgqueue.h"
+
+#include "../../utils/msg.h"
+#include "../../utils/list.h"
+#include "../../utils/queue.h"
+#include "../../utils/mpscq.h"
+#include "../../utils/atomic.h"
+
+#include <stdint.h>
+
+/*  The pipe of a tcpmux endpoint, i.e. one logical channel of a TCP
+    connection shared by several sockets. It lives in the context of its
+    socket, while the connection lives in the context of the host that owns
+    it. The two exchange the messages using a pair of lock-free queues, the
+    same way the two ends of an inproc connection do, and notify each other
+    using the mailboxes described below. */
+
+/*  Events the pmux raises to its owner. */
+#define NN_PMUX_ERROR 1
+#define NN_PMUX_STOPPED 2
+
+/*  Sources and types of the events passed between the pmuxes and the
+    hosts. */
+#define NN_PMUX_SRC_HOST 27715
+#define NN_PMUX_HOST 1
+#define NN_PMUX_MAIL 2
+
+/*  What the pmux tells the host. ATTACH asks it to open the channel, SENT
+    says there's a message in the outbound queue, RECEIVED says there's room
+    in the inbound one and DETACH asks the host to forget the pmux. */
+#define NN_PMUX_ATTACH 1
+#define NN_PMUX_SENT 2
+#define NN_PMUX_RECEIVED 4
+#define NN_PMUX_DETACH 8
+
+/*  What the host tells the pmux. OPENED says the channel is open, IN that
+    there's a message in the inbound queue, OUT that there's room in the
+    outbound one and CLOSED that the channel was closed. DETACHED is the last
+    notification the pmux ever gets. */
+#define NN_PMUX_OPENED 1
+#define NN_PMUX_IN 2
+#define NN_PMUX_OUT 4
+#define NN_PMUX_CLOSED 8
+#define NN_PMUX_DETACHED 16
+
+/*  Set in a set of pending notifications while it is on its way. */
+#define NN_PMUX_QUEUED 0x80000000
+
+/*  Notifications from any number of pmuxes to a host are collected in its
+    mailbox. Each pmux accumulates its notifications and puts itself into
+    the queue only if it's not there yet; the host is raised an event only if
+    it isn't going to look into the mailbox anyway. */
+struct nn_pmux_mailbox {
+    struct nn_fsm *host;
+    int src;
+    struct nn_mpscq queue;
+    struct nn_atomic pending;
+    struct nn_fsm_event event;
+};
+
+void nn_pmux_mailbox_init (struct nn_pmux_mailbox *self, int src,
+    struct nn_fsm *host);
+void nn_pmux_mailbox_term (struct nn_pmux_mailbox *self);
+
+/*  Returns 1 if there are no notifications on their way to the host. */
+int nn_pmux_mailbox_isidle (struct nn_pmux_mailbox *self);
+
+/*  To be called by the host when it gets NN_PMUX_MAIL. Moves the pmuxes
+    that have something to tell to 'queue'. */
+void nn_pmux_mailbox_drain (struct nn_pmux_mailbox *self,
+    struct nn_queue *queue);
+
+struct nn_smux;
+struct nn_smux_chan;
+
+struct nn_pmux {
+
+    /*  The state machine. */
+    struct nn_fsm fsm;
+    int state;
+
+    /*  Pipe connecting the channel to the nanomsg core. */
+    struct nn_pipebase pipebase;
+    struct nn_ep *ep;
+
+    /*  The host the channel belongs to. */
+    struct nn_pmux_mailbox *mailbox;
+
+    /*  Messages received from the peer, written by the host. */
+    struct nn_msgqueue inq;
+
+    /*  Messages to send to the peer, read by the host. */
+    struct nn_msgqueue outq;
+
+    /*  The message waiting for room in the outbound queue, if any. */
+    struct nn_msg msg;
+    int sending;
+
+    /*  1 once the host was told about the pmux, 1 while the pipe is
+        started. */
+    int attached;
+    int started;
+
+    /*  Notifications for the host that weren't picked up yet and the item
+        the pmux is queued in the mailbox with. */
+    struct nn_atomic tohost;
+    struct nn_queue_item mailitem;
+
+    /*  Notifications from the host that weren't processed yet and the event
+        they are delivered with. */
+    struct nn_atomic fromhost;
+    struct nn_fsm_event fromhostev;
+
+    struct nn_fsm_event done;
+
+    /*  Set up when the pmux is created. The service to open is NULL on the
+        bound side, where the channel is already opened by the peer. */
+    const char *service;
+    int protocol;
+    int rcvbuf;
+    int rcvmaxsize;
+
+    /*  Socket type of the peer. Written by the host before OPENED. */
+    int peer;
+
+    /*  Fields owned by the host. The session and the channel the pmux is
+        attached to, and the item in the list of pmuxes waiting for
+        a session. */
+    struct nn_smux *smux;
+    struct nn_smux_chan *chan;
+    struct nn_list_item item;
+
+    /*  The item in the endpoint's list of pmuxes. */
+    struct nn_list_item epitem;
+};
+
+void nn_pmux_init (struct nn_pmux *self, int src, struct nn_ep *ep,
+    struct nn_pmux_mailbox *mailbox, const char *service,
+    struct nn_fsm *owner);
+void nn_pmux_term (struct nn_pmux *self);
+
+int nn_pmux_isidle (struct nn_pmux *self);
+
+/*  Hands the pmux a channel its peer has opened. Must be called before
+    nn_pmux_start on the bound side. */
+void nn_pmux_setchannel (struct nn_pmux *self, struct nn_smux *smux,
+    struct nn_smux_chan *chan, int peer);
+
+void nn_pmux_start (struct nn_pmux *self);
+void nn_pmux_stop (struct nn_pmux *self);
+
+/*  To be called by the host, in its own context. Delivers the notifications
+    to the pmux. */
+void nn_pmux_notify (struct nn_pmux *self, struct nn_fsm *host,
+    uint32_t what);
+
+/*  To be called by the host for each pmux taken from the mailbox. Returns
+    the notifications the pmux has for it. */
+uint32_t nn_pmux_mail (struct nn_pmux *self);
+
+#endif
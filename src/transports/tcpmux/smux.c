@@ -0,0 +1,1193 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "smux.h"
+
+#include "../utils/iface.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+#include "../../utils/alloc.h"
+#include "../../utils/wire.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#define NN_SMUX_STATE_IDLE 1
+#define NN_SMUX_STATE_CONNECTING 2
+#define NN_SMUX_STATE_ACCEPTING 3
+#define NN_SMUX_STATE_HANDSHAKE 4
+#define NN_SMUX_STATE_ACTIVE 5
+#define NN_SMUX_STATE_FAILED 6
+#define NN_SMUX_STATE_STOPPING_USOCK 7
+#define NN_SMUX_STATE_STOPPING 8
+
+#define NN_SMUX_SRC_USOCK 1
+
+/*  What is being read from the connection. */
+#define NN_SMUX_INSTATE_HANDSHAKE 1
+#define NN_SMUX_INSTATE_HDR 2
+#define NN_SMUX_INSTATE_BODY 3
+#define NN_SMUX_INSTATE_CTRL 4
+#define NN_SMUX_INSTATE_SKIP 5
+
+/*  Types of the frames. */
+#define NN_SMUX_OPEN 1
+#define NN_SMUX_ACCEPT 2
+#define NN_SMUX_CLOSE 3
+#define NN_SMUX_DATA 4
+#define NN_SMUX_CREDIT 5
+
+/*  Bits of nn_smux_chan.ctrls, i.e. control frames to send. */
+#define NN_SMUX_CTRL_OPEN 1
+#define NN_SMUX_CTRL_ACCEPT 2
+#define NN_SMUX_CTRL_CREDIT 4
+#define NN_SMUX_CTRL_CLOSE 8
+
+/*  The peer has opened the channel and the owner hasn't decided yet whether
+    to accept it. */
+#define NN_SMUX_FLAG_INCOMING 1
+
+/*  The channel is open, i.e. messages can be sent and received. */
+#define NN_SMUX_FLAG_OPEN 2
+
+/*  OPEN was sent to the peer. */
+#define NN_SMUX_FLAG_OPENSENT 4
+
+/*  CLOSE was sent to the peer and received from it, respectively. */
+#define NN_SMUX_FLAG_CLOSESENT 8
+#define NN_SMUX_FLAG_CLOSERCVD 16
+
+/*  The messages received are dropped. */
+#define NN_SMUX_FLAG_DROP 32
+
+/*  The next message to send waits for credit. */
+#define NN_SMUX_FLAG_BLOCKED 64
+
+#define NN_SMUX_HDRLEN 16
+
+/*  Longest body of a control frame. */
+#define NN_SMUX_CTRLMAX (10 + NN_SMUX_SERVICEMAX)
+
+/*  Room in the output buffer needed by the control frames of a channel. */
+#define NN_SMUX_CTRLSPACE (4 * NN_SMUX_HDRLEN + NN_SMUX_CTRLMAX + 16)
+
+/*  Messages up to this size are copied to the output buffer rather than
+    being sent from their own chunks. */
+#define NN_SMUX_COPYMAX 256
+
+static const uint8_t nn_smux_header [8] = {0, 'M', 'U', 'X', 0, 1, 0, 0};
+
+/*  Private functions. */
+static void nn_smux_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_smux_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_smux_handshake (struct nn_smux *self);
+static void nn_smux_fail (struct nn_smux *self);
+static void nn_smux_error (struct nn_smux *self);
+static void nn_smux_check_stopped (struct nn_smux *self);
+static void nn_smux_flush (struct nn_smux *self);
+static int nn_smux_fetch (struct nn_smux *self, struct nn_smux_chan *chan,
+    struct nn_msg *msg);
+static size_t nn_smux_putctrls (struct nn_smux *self,
+    struct nn_smux_chan *chan, uint8_t *buf);
+static void nn_smux_recvhdr (struct nn_smux *self);
+static void nn_smux_skip (struct nn_smux *self);
+static int nn_smux_input (struct nn_smux *self);
+static int nn_smux_frame (struct nn_smux *self);
+static int nn_smux_ctrlframe (struct nn_smux *self);
+static int nn_smux_deliver (struct nn_smux *self);
+static void nn_smux_credit (struct nn_smux *self, struct nn_smux_chan *chan);
+static struct nn_smux_chan *nn_smux_chan_new (struct nn_smux *self,
+    uint32_t id);
+static void nn_smux_chan_free (struct nn_smux *self,
+    struct nn_smux_chan *chan);
+static void nn_smux_chan_check (struct nn_smux *self,
+    struct nn_smux_chan *chan);
+static void nn_smux_chan_ctrl (struct nn_smux *self,
+    struct nn_smux_chan *chan, int ctrl);
+static void nn_smux_chan_ready (struct nn_smux *self,
+    struct nn_smux_chan *chan);
+
+void nn_smux_init (struct nn_smux *self, int src, nn_smux_openfn openfn,
+    struct nn_fsm *owner)
+{
+    int i;
+
+    nn_fsm_init (&self->fsm, nn_smux_handler, nn_smux_shutdown,
+        src, self, owner);
+    self->state = NN_SMUX_STATE_IDLE;
+    nn_usock_init (&self->usock, NN_SMUX_SRC_USOCK, &self->fsm);
+    self->openfn = openfn;
+    nn_hash_init (&self->chans);
+    nn_list_init (&self->chanlist);
+    self->nextid = 1;
+    self->nincoming = 0;
+    nn_list_init (&self->ctrls);
+    nn_list_init (&self->ready);
+    self->sending = 0;
+    self->hsdone = 0;
+    for (i = 0; i != NN_SMUX_BATCH; ++i)
+        nn_msg_init (&self->outmsgs [i], 0);
+    self->noutmsgs = 0;
+    self->instate = -1;
+    nn_msg_init (&self->inmsg, 0);
+    nn_fsm_event_init (&self->event);
+    nn_fsm_event_init (&self->done);
+    nn_list_item_init (&self->item);
+}
+
+void nn_smux_term (struct nn_smux *self)
+{
+    int i;
+
+    nn_assert_state (self, NN_SMUX_STATE_IDLE);
+    nn_assert (nn_list_empty (&self->chanlist));
+
+    nn_list_item_term (&self->item);
+    nn_fsm_event_term (&self->done);
+    nn_fsm_event_term (&self->event);
+    nn_msg_term (&self->inmsg);
+    for (i = 0; i != NN_SMUX_BATCH; ++i)
+        nn_msg_term (&self->outmsgs [i]);
+    nn_list_term (&self->ready);
+    nn_list_term (&self->ctrls);
+    nn_list_term (&self->chanlist);
+    nn_hash_term (&self->chans);
+    nn_usock_term (&self->usock);
+    nn_fsm_term (&self->fsm);
+}
+
+int nn_smux_isidle (struct nn_smux *self)
+{
+    return nn_fsm_isidle (&self->fsm);
+}
+
+int nn_smux_connect (struct nn_smux *self, const struct sockaddr *addr,
+    size_t addrlen)
+{
+    int rc;
+    int val;
+    struct sockaddr_storage local;
+    size_t locallen;
+
+    nn_assert_state (self, NN_SMUX_STATE_IDLE);
+
+    /*  Connect from any local address of the same family. */
+    memset (&local, 0, sizeof (local));
+    rc = nn_iface_resolve ("*", 1, addr->sa_family == AF_INET,
+        &local, &locallen);
+    if (nn_slow (rc < 0))
+        return rc;
+    rc = nn_usock_start (&self->usock, addr->sa_family, SOCK_STREAM, 0);
+    if (nn_slow (rc < 0))
+        return rc;
+    val = 1;
+    nn_usock_setsockopt (&self->usock, IPPROTO_TCP, TCP_NODELAY,
+        &val, sizeof (val));
+    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &local, locallen);
+    if (nn_slow (rc < 0)) {
+        nn_usock_stop (&self->usock);
+        return rc;
+    }
+
+    nn_fsm_start (&self->fsm);
+    self->state = NN_SMUX_STATE_CONNECTING;
+    nn_usock_connect (&self->usock, addr, addrlen);
+    return 0;
+}
+
+void nn_smux_accept (struct nn_smux *self, struct nn_usock *listener)
+{
+    nn_assert_state (self, NN_SMUX_STATE_IDLE);
+
+    nn_fsm_start (&self->fsm);
+    self->state = NN_SMUX_STATE_ACCEPTING;
+    nn_usock_accept (&self->usock, listener);
+}
+
+void nn_smux_stop (struct nn_smux *self)
+{
+    nn_fsm_stop (&self->fsm);
+}
+
+void nn_smux_open (struct nn_smux *self, struct nn_pmux *pmux)
+{
+    uint32_t id;
+    struct nn_smux_chan *chan;
+
+    nn_assert_state (self, NN_SMUX_STATE_ACTIVE);
+    nn_assert (!self->openfn);
+
+    /*  IDs of the channels that are still being closed can't be reused. */
+    while (1) {
+        id = self->nextid++;
+        if (id != 0 && !nn_hash_get (&self->chans, id))
+            break;
+    }
+
+    chan = nn_smux_chan_new (self, id);
+    chan->pmux = pmux;
+    pmux->smux = self;
+    pmux->chan = chan;
+    nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_OPEN);
+    nn_smux_flush (self);
+}
+
+void nn_smux_attach (struct nn_smux *self, struct nn_smux_chan *chan,
+    struct nn_pmux *pmux)
+{
+    nn_assert (chan->flags & NN_SMUX_FLAG_INCOMING);
+    chan->flags &= ~NN_SMUX_FLAG_INCOMING;
+    --self->nincoming;
+
+    /*  The connection has failed in the meantime. */
+    if (nn_slow (self->state != NN_SMUX_STATE_ACTIVE)) {
+        pmux->smux = NULL;
+        pmux->chan = NULL;
+        nn_pmux_notify (pmux, &self->fsm, NN_PMUX_CLOSED);
+        nn_smux_chan_check (self, chan);
+        nn_smux_check_stopped (self);
+        return;
+    }
+
+    chan->pmux = pmux;
+    pmux->smux = self;
+    pmux->chan = chan;
+
+    /*  The peer may have given up on the channel in the meantime. The pmux
+        is going to be detached, which closes the channel on our side. */
+    if (nn_slow (chan->flags & NN_SMUX_FLAG_CLOSERCVD)) {
+        nn_pmux_notify (pmux, &self->fsm, NN_PMUX_CLOSED);
+        return;
+    }
+
+    chan->flags |= NN_SMUX_FLAG_OPEN;
+    nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_ACCEPT);
+    nn_pmux_notify (pmux, &self->fsm, NN_PMUX_OPENED);
+    nn_smux_flush (self);
+}
+
+void nn_smux_reject (struct nn_smux *self, struct nn_smux_chan *chan)
+{
+    nn_assert (chan->flags & NN_SMUX_FLAG_INCOMING);
+    chan->flags &= ~NN_SMUX_FLAG_INCOMING;
+    --self->nincoming;
+
+    if (nn_slow (self->state != NN_SMUX_STATE_ACTIVE)) {
+        nn_smux_chan_check (self, chan);
+        nn_smux_check_stopped (self);
+        return;
+    }
+
+    nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_CLOSE);
+    nn_smux_flush (self);
+}
+
+void nn_smux_detach (struct nn_smux *self, struct nn_pmux *pmux)
+{
+    struct nn_smux_chan *chan;
+
+    chan = pmux->chan;
+    nn_assert (chan && chan->pmux == pmux);
+    chan->pmux = NULL;
+    pmux->smux = NULL;
+    pmux->chan = NULL;
+
+    /*  Messages that weren't sent yet are dropped. */
+    if (chan->held) {
+        nn_msg_term (&chan->msg);
+        nn_msg_init (&chan->msg, 0);
+        chan->held = 0;
+    }
+    chan->flags &= ~NN_SMUX_FLAG_BLOCKED;
+    if (nn_list_item_isinlist (&chan->readyitem))
+        nn_list_erase (&self->ready, &chan->readyitem);
+
+    /*  If the peer doesn't know about the channel yet, it can be forgotten
+        straight away. */
+    if (chan->ctrls & NN_SMUX_CTRL_OPEN) {
+        nn_smux_chan_free (self, chan);
+        return;
+    }
+
+    chan->ctrls &= ~(NN_SMUX_CTRL_ACCEPT | NN_SMUX_CTRL_CREDIT);
+    if (!chan->ctrls && nn_list_item_isinlist (&chan->ctrlitem))
+        nn_list_erase (&self->ctrls, &chan->ctrlitem);
+    if (!(chan->flags & NN_SMUX_FLAG_CLOSESENT))
+        nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_CLOSE);
+    nn_smux_chan_check (self, chan);
+    nn_smux_flush (self);
+}
+
+void nn_smux_mail (struct nn_pmux *pmux, uint32_t what)
+{
+    struct nn_smux *self;
+    struct nn_smux_chan *chan;
+
+    self = pmux->smux;
+    chan = pmux->chan;
+
+    /*  The notifications have to be acknowledged even if the pmux was
+        detached in the meantime. */
+    if (what & NN_PMUX_SENT) {
+        nn_msgqueue_rcvwoken (&pmux->outq);
+        if (self && (chan->flags & NN_SMUX_FLAG_OPEN) &&
+              !(chan->flags & (NN_SMUX_FLAG_BLOCKED |
+              NN_SMUX_FLAG_CLOSERCVD)))
+            nn_smux_chan_ready (self, chan);
+    }
+    if (what & NN_PMUX_RECEIVED) {
+        nn_msgqueue_sndwoken (&pmux->inq);
+        if (self) {
+
+            /*  Keep asking for notifications as long as there are messages
+                the socket hasn't consumed yet. */
+            chan->creditwait = 0;
+            nn_smux_credit (self, chan);
+            if (chan->consmsgs != chan->rcvmsgs) {
+                nn_msgqueue_sndwait (&pmux->inq);
+                chan->creditwait = 1;
+                nn_smux_credit (self, chan);
+            }
+        }
+    }
+
+    if (self)
+        nn_smux_flush (self);
+}
+
+static struct nn_smux_chan *nn_smux_chan_new (struct nn_smux *self,
+    uint32_t id)
+{
+    struct nn_smux_chan *chan;
+
+    chan = nn_alloc (sizeof (struct nn_smux_chan), "tcpmux channel");
+    alloc_assert (chan);
+    nn_hash_item_init (&chan->hitem);
+    nn_list_item_init (&chan->item);
+    chan->id = id;
+    chan->flags = 0;
+    chan->pmux = NULL;
+    chan->ctrls = 0;
+    nn_list_item_init (&chan->ctrlitem);
+    nn_list_item_init (&chan->readyitem);
+    nn_msg_init (&chan->msg, 0);
+    chan->held = 0;
+    chan->window = 0;
+    chan->sentmsgs = 0;
+    chan->sentbytes = 0;
+    chan->ackmsgs = 0;
+    chan->ackbytes = 0;
+    chan->consmsgs32 = 0;
+    chan->consbytes32 = 0;
+    chan->consmsgs = 0;
+    chan->consbytes = 0;
+    chan->rcvmsgs = 0;
+    chan->creditmsgs = 0;
+    chan->creditbytes = 0;
+    chan->creditwait = 0;
+
+    nn_hash_insert (&self->chans, id, &chan->hitem);
+    nn_list_insert (&self->chanlist, &chan->item,
+        nn_list_end (&self->chanlist));
+
+    return chan;
+}
+
+static void nn_smux_chan_free (struct nn_smux *self,
+    struct nn_smux_chan *chan)
+{
+    nn_assert (!chan->pmux);
+
+    if (nn_list_item_isinlist (&chan->readyitem))
+        nn_list_erase (&self->ready, &chan->readyitem);
+    if (nn_list_item_isinlist (&chan->ctrlitem))
+        nn_list_erase (&self->ctrls, &chan->ctrlitem);
+    nn_list_erase (&self->chanlist, &chan->item);
+    nn_hash_erase (&self->chans, &chan->hitem);
+
+    nn_msg_term (&chan->msg);
+    nn_list_item_term (&chan->readyitem);
+    nn_list_item_term (&chan->ctrlitem);
+    nn_list_item_term (&chan->item);
+    nn_hash_item_term (&chan->hitem);
+    nn_free (chan);
+}
+
+/*  Frees the channel if it's of no use any more, i.e. if nobody is using
+    it and its ID can be reused. */
+static void nn_smux_chan_check (struct nn_smux *self,
+    struct nn_smux_chan *chan)
+{
+    if (chan->pmux || (chan->flags & NN_SMUX_FLAG_INCOMING))
+        return;
+    if ((chan->flags & (NN_SMUX_FLAG_CLOSESENT | NN_SMUX_FLAG_CLOSERCVD)) !=
+          (NN_SMUX_FLAG_CLOSESENT | NN_SMUX_FLAG_CLOSERCVD))
+        return;
+    nn_smux_chan_free (self, chan);
+}
+
+static void nn_smux_chan_ctrl (struct nn_smux *self,
+    struct nn_smux_chan *chan, int ctrl)
+{
+    chan->ctrls |= ctrl;
+    if (!nn_list_item_isinlist (&chan->ctrlitem))
+        nn_list_insert (&self->ctrls, &chan->ctrlitem,
+            nn_list_end (&self->ctrls));
+}
+
+static void nn_smux_chan_ready (struct nn_smux *self,
+    struct nn_smux_chan *chan)
+{
+    if (!nn_list_item_isinlist (&chan->readyitem))
+        nn_list_insert (&self->ready, &chan->readyitem,
+            nn_list_end (&self->ready));
+}
+
+/*  Writes whatever control frames the channel has to send into the buffer
+    and returns their size. */
+static size_t nn_smux_putctrls (struct nn_smux *self,
+    struct nn_smux_chan *chan, uint8_t *buf)
+{
+    uint8_t *pos;
+    size_t len;
+    struct nn_pmux *pmux;
+
+    pos = buf;
+    pmux = chan->pmux;
+
+    if (chan->ctrls & NN_SMUX_CTRL_OPEN) {
+        len = strlen (pmux->service);
+        nn_putl (pos, NN_SMUX_OPEN);
+        nn_putl (pos + 4, chan->id);
+        nn_putll (pos + 8, 10 + len);
+        nn_puts (pos + 16, (uint16_t) pmux->protocol);
+        nn_putll (pos + 18, (uint64_t) pmux->rcvbuf);
+        memcpy (pos + 26, pmux->service, len);
+        pos += 26 + len;
+        chan->flags |= NN_SMUX_FLAG_OPENSENT;
+    }
+    if (chan->ctrls & NN_SMUX_CTRL_ACCEPT) {
+        nn_putl (pos, NN_SMUX_ACCEPT);
+        nn_putl (pos + 4, chan->id);
+        nn_putll (pos + 8, 10);
+        nn_puts (pos + 16, (uint16_t) pmux->protocol);
+        nn_putll (pos + 18, (uint64_t) pmux->rcvbuf);
+        pos += 26;
+    }
+    if (chan->ctrls & NN_SMUX_CTRL_CREDIT) {
+        nn_putl (pos, NN_SMUX_CREDIT);
+        nn_putl (pos + 4, chan->id);
+        nn_putll (pos + 8, 16);
+        nn_putll (pos + 16, chan->consmsgs);
+        nn_putll (pos + 24, chan->consbytes);
+        pos += 32;
+        chan->creditmsgs = chan->consmsgs;
+        chan->creditbytes = chan->consbytes;
+    }
+    if (chan->ctrls & NN_SMUX_CTRL_CLOSE) {
+        nn_putl (pos, NN_SMUX_CLOSE);
+        nn_putl (pos + 4, chan->id);
+        nn_putll (pos + 8, 0);
+        pos += 16;
+        chan->flags |= NN_SMUX_FLAG_CLOSESENT;
+    }
+    chan->ctrls = 0;
+
+    return pos - buf;
+}
+
+/*  Sends whatever there's to send, unless a send is already under way.
+    Control frames go first. The messages are taken from the channels in
+    round-robin fashion, one at a time. */
+static void nn_smux_flush (struct nn_smux *self)
+{
+    struct nn_iovec iov [NN_USOCK_MAX_IOVCNT];
+    int iovcnt;
+    size_t outlen;
+    size_t start;
+    size_t sz;
+    struct nn_smux_chan *chan;
+    struct nn_msg msg;
+
+    if (self->state != NN_SMUX_STATE_ACTIVE || self->sending)
+        return;
+
+    outlen = 0;
+    while (!nn_list_empty (&self->ctrls)) {
+        if (outlen + NN_SMUX_CTRLSPACE > NN_SMUX_BUFSIZE)
+            break;
+        chan = nn_cont (nn_list_begin (&self->ctrls), struct nn_smux_chan,
+            ctrlitem);
+        nn_list_erase (&self->ctrls, &chan->ctrlitem);
+        outlen += nn_smux_putctrls (self, chan, self->outbuf + outlen);
+        nn_smux_chan_check (self, chan);
+    }
+
+    iovcnt = 0;
+    start = 0;
+    nn_assert (self->noutmsgs == 0);
+    while (nn_list_empty (&self->ctrls) && !nn_list_empty (&self->ready) &&
+          self->noutmsgs < NN_SMUX_BATCH &&
+          outlen + NN_SMUX_HDRLEN <= NN_SMUX_BUFSIZE) {
+        chan = nn_cont (nn_list_begin (&self->ready), struct nn_smux_chan,
+            readyitem);
+        nn_list_erase (&self->ready, &chan->readyitem);
+        if (!nn_smux_fetch (self, chan, &msg))
+            continue;
+
+        sz = nn_chunkref_size (&msg.body);
+        nn_putl (self->outbuf + outlen, NN_SMUX_DATA);
+        nn_putl (self->outbuf + outlen + 4, chan->id);
+        nn_putll (self->outbuf + outlen + 8, sz);
+        outlen += NN_SMUX_HDRLEN;
+        if (sz <= NN_SMUX_COPYMAX && outlen + sz <= NN_SMUX_BUFSIZE) {
+            memcpy (self->outbuf + outlen, nn_chunkref_data (&msg.body), sz);
+            outlen += sz;
+            nn_msg_term (&msg);
+        }
+        else {
+            iov [iovcnt].iov_base = self->outbuf + start;
+            iov [iovcnt].iov_len = outlen - start;
+            ++iovcnt;
+            iov [iovcnt].iov_base = nn_chunkref_data (&msg.body);
+            iov [iovcnt].iov_len = sz;
+            ++iovcnt;
+            start = outlen;
+            nn_msg_mv (&self->outmsgs [self->noutmsgs], &msg);
+            ++self->noutmsgs;
+        }
+
+        /*  The channel goes to the back of the queue. If it has nothing
+            more to send, it is dropped from it next time round. */
+        nn_smux_chan_ready (self, chan);
+    }
+    if (outlen > start) {
+        iov [iovcnt].iov_base = self->outbuf + start;
+        iov [iovcnt].iov_len = outlen - start;
+        ++iovcnt;
+    }
+    if (!iovcnt)
+        return;
+
+    nn_usock_send (&self->usock, iov, iovcnt);
+    self->sending = 1;
+}
+
+/*  Takes the next message to send from the channel. Returns 0 if there's
+    none or if the peer has no room for it. */
+static int nn_smux_fetch (struct nn_smux *self, struct nn_smux_chan *chan,
+    struct nn_msg *msg)
+{
+    struct nn_pmux *pmux;
+    uint64_t sz;
+    uint64_t out;
+    uint64_t outbytes;
+
+    pmux = chan->pmux;
+    if (!chan->held) {
+        if (nn_msgqueue_recv (&pmux->outq, &chan->msg) < 0) {
+
+            /*  Ask the pmux to tell us about the next message and check
+                once again, as it may have written one in the meantime. If
+                the notification is on its way already, it is ignored. */
+            nn_msgqueue_rcvwait (&pmux->outq);
+            if (nn_msgqueue_recv (&pmux->outq, &chan->msg) < 0)
+                return 0;
+            nn_msgqueue_rcvcancel (&pmux->outq);
+        }
+        chan->held = 1;
+
+        /*  Let the pmux know if it waits for room in the queue. */
+        if (nn_slow (nn_msgqueue_sndnotify (&pmux->outq)))
+            nn_pmux_notify (pmux, &self->fsm, NN_PMUX_OUT);
+    }
+
+    /*  The peer has to have room for the message, unless it has consumed
+        all the messages sent to it. */
+    sz = nn_chunkref_size (&chan->msg.body);
+    out = chan->sentmsgs - chan->ackmsgs;
+    outbytes = chan->sentbytes - chan->ackbytes;
+    if (out != 0 && (out >= NN_MSGQUEUE_SLOTS ||
+          outbytes + sz >= chan->window)) {
+        chan->flags |= NN_SMUX_FLAG_BLOCKED;
+        return 0;
+    }
+
+    nn_msg_mv (msg, &chan->msg);
+    nn_msg_init (&chan->msg, 0);
+    chan->held = 0;
+    ++chan->sentmsgs;
+    chan->sentbytes += sz;
+    return 1;
+}
+
+/*  Checks how much the socket has consumed and schedules a CREDIT frame if
+    it's more than the peer was told about. */
+static void nn_smux_credit (struct nn_smux *self, struct nn_smux_chan *chan)
+{
+    uint32_t msgs;
+    size_t bytes;
+
+    nn_msgqueue_consumed (&chan->pmux->inq, &msgs, &bytes);
+    chan->consmsgs += (uint32_t) (msgs - chan->consmsgs32);
+    chan->consmsgs32 = msgs;
+    chan->consbytes += (size_t) (bytes - chan->consbytes32);
+    chan->consbytes32 = bytes;
+    if (chan->consmsgs != chan->creditmsgs ||
+          chan->consbytes != chan->creditbytes)
+        nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_CREDIT);
+}
+
+static void nn_smux_handshake (struct nn_smux *self)
+{
+    struct nn_iovec iov;
+
+    memcpy (self->outbuf, nn_smux_header, sizeof (nn_smux_header));
+    iov.iov_base = self->outbuf;
+    iov.iov_len = sizeof (nn_smux_header);
+    nn_usock_send (&self->usock, &iov, 1);
+    self->sending = 1;
+    self->hsdone = 0;
+    self->instate = NN_SMUX_INSTATE_HANDSHAKE;
+    nn_usock_recv (&self->usock, self->inbuf, sizeof (nn_smux_header), NULL);
+    self->state = NN_SMUX_STATE_HANDSHAKE;
+}
+
+static void nn_smux_recvhdr (struct nn_smux *self)
+{
+    self->instate = NN_SMUX_INSTATE_HDR;
+    nn_usock_recv (&self->usock, self->inhdr, NN_SMUX_HDRLEN, NULL);
+}
+
+/*  Reads and throws away the rest of the frame. */
+static void nn_smux_skip (struct nn_smux *self)
+{
+    if (self->insize == 0) {
+        nn_smux_recvhdr (self);
+        return;
+    }
+    self->inskip = self->insize < NN_SMUX_BUFSIZE ?
+        (size_t) self->insize : NN_SMUX_BUFSIZE;
+    self->instate = NN_SMUX_INSTATE_SKIP;
+    nn_usock_recv (&self->usock, self->inbuf, self->inskip, NULL);
+}
+
+/*  Processes the data just read. Returns -EPROTO if the peer has violated
+    the protocol. */
+static int nn_smux_input (struct nn_smux *self)
+{
+    int rc;
+
+    switch (self->instate) {
+    case NN_SMUX_INSTATE_HDR:
+        self->intype = nn_getl (self->inhdr);
+        self->inid = nn_getl (self->inhdr + 4);
+        self->insize = nn_getll (self->inhdr + 8);
+        return nn_smux_frame (self);
+    case NN_SMUX_INSTATE_BODY:
+        rc = nn_smux_deliver (self);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_smux_recvhdr (self);
+        return 0;
+    case NN_SMUX_INSTATE_CTRL:
+        rc = nn_smux_ctrlframe (self);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_smux_recvhdr (self);
+        return 0;
+    case NN_SMUX_INSTATE_SKIP:
+        self->insize -= self->inskip;
+        nn_smux_skip (self);
+        return 0;
+    default:
+        nn_assert (0);
+        return -EPROTO;
+    }
+}
+
+/*  The header of a frame was read. */
+static int nn_smux_frame (struct nn_smux *self)
+{
+    int rc;
+    struct nn_hash_item *hitem;
+    struct nn_smux_chan *chan;
+    struct nn_pmux *pmux;
+
+    if (self->intype != NN_SMUX_DATA) {
+        if (nn_slow (self->intype < NN_SMUX_OPEN ||
+              self->intype > NN_SMUX_CREDIT ||
+              self->insize > NN_SMUX_CTRLMAX))
+            return -EPROTO;
+        if (self->insize == 0) {
+            rc = nn_smux_ctrlframe (self);
+            if (nn_slow (rc < 0))
+                return rc;
+            nn_smux_recvhdr (self);
+            return 0;
+        }
+        self->instate = NN_SMUX_INSTATE_CTRL;
+        nn_usock_recv (&self->usock, self->inbuf, (size_t) self->insize,
+            NULL);
+        return 0;
+    }
+
+    hitem = nn_hash_get (&self->chans, self->inid);
+    if (nn_slow (!hitem))
+        return -EPROTO;
+    chan = nn_cont (hitem, struct nn_smux_chan, hitem);
+
+    /*  Messages for channels being closed are dropped. */
+    pmux = chan->pmux;
+    if (!pmux || !(chan->flags & NN_SMUX_FLAG_OPEN) ||
+          (chan->flags & (NN_SMUX_FLAG_DROP | NN_SMUX_FLAG_CLOSERCVD))) {
+        nn_smux_skip (self);
+        return 0;
+    }
+
+    /*  A message that's too big closes the channel. */
+    if (nn_slow (pmux->rcvmaxsize >= 0 &&
+          self->insize > (uint64_t) pmux->rcvmaxsize)) {
+        chan->flags |= NN_SMUX_FLAG_DROP;
+        nn_pmux_notify (pmux, &self->fsm, NN_PMUX_CLOSED);
+        nn_smux_skip (self);
+        return 0;
+    }
+
+    nn_msg_term (&self->inmsg);
+    nn_msg_init (&self->inmsg, (size_t) self->insize);
+    if (self->insize == 0) {
+        rc = nn_smux_deliver (self);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_smux_recvhdr (self);
+        return 0;
+    }
+    self->instate = NN_SMUX_INSTATE_BODY;
+    nn_usock_recv (&self->usock, nn_chunkref_data (&self->inmsg.body),
+        (size_t) self->insize, NULL);
+    return 0;
+}
+
+/*  Passes the message just read to the pmux. */
+static int nn_smux_deliver (struct nn_smux *self)
+{
+    int rc;
+    struct nn_hash_item *hitem;
+    struct nn_smux_chan *chan;
+    struct nn_pmux *pmux;
+
+    /*  The channel may have been closed while the message was being read. */
+    hitem = nn_hash_get (&self->chans, self->inid);
+    chan = hitem ? nn_cont (hitem, struct nn_smux_chan, hitem) : NULL;
+    if (!chan || !chan->pmux ||
+          (chan->flags & (NN_SMUX_FLAG_DROP | NN_SMUX_FLAG_CLOSERCVD))) {
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, 0);
+        return 0;
+    }
+    pmux = chan->pmux;
+
+    /*  The peer is not allowed to send more than the queue can hold. */
+    rc = nn_msgqueue_send (&pmux->inq, &self->inmsg);
+    if (nn_slow (rc < 0))
+        return -EPROTO;
+    nn_msg_init (&self->inmsg, 0);
+    ++chan->rcvmsgs;
+
+    if (nn_msgqueue_rcvnotify (&pmux->inq))
+        nn_pmux_notify (pmux, &self->fsm, NN_PMUX_IN);
+
+    /*  Ask the pmux to tell us once the socket consumes some messages so
+        that the peer can be granted more credit. */
+    if (!chan->creditwait) {
+        nn_msgqueue_sndwait (&pmux->inq);
+        chan->creditwait = 1;
+        nn_smux_credit (self, chan);
+        nn_smux_flush (self);
+    }
+
+    return 0;
+}
+
+/*  The body of a control frame was read. */
+static int nn_smux_ctrlframe (struct nn_smux *self)
+{
+    int rc;
+    int protocol;
+    uint64_t window;
+    uint64_t msgs;
+    uint64_t bytes;
+    struct nn_hash_item *hitem;
+    struct nn_smux_chan *chan;
+
+    hitem = nn_hash_get (&self->chans, self->inid);
+    chan = hitem ? nn_cont (hitem, struct nn_smux_chan, hitem) : NULL;
+
+    switch (self->intype) {
+
+    case NN_SMUX_OPEN:
+        if (nn_slow (!self->openfn || chan || self->inid == 0 ||
+              self->insize <= 10))
+            return -EPROTO;
+        protocol = nn_gets (self->inbuf);
+        window = nn_getll (self->inbuf + 2);
+        chan = nn_smux_chan_new (self, self->inid);
+        chan->window = window;
+        chan->flags = NN_SMUX_FLAG_INCOMING;
+        rc = self->openfn (self, chan, protocol, (char*) self->inbuf + 10,
+            (size_t) self->insize - 10);
+        if (nn_fast (rc == 0)) {
+            ++self->nincoming;
+            return 0;
+        }
+
+        /*  There's no such service. */
+        chan->flags = 0;
+        nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_CLOSE);
+        break;
+
+    case NN_SMUX_ACCEPT:
+        if (nn_slow (!chan || self->openfn || self->insize != 10 ||
+              !(chan->flags & NN_SMUX_FLAG_OPENSENT) ||
+              (chan->flags & (NN_SMUX_FLAG_OPEN | NN_SMUX_FLAG_CLOSERCVD))))
+            return -EPROTO;
+
+        /*  The pmux has gone in the meantime. */
+        if (!chan->pmux)
+            return 0;
+        chan->window = nn_getll (self->inbuf + 2);
+        chan->flags |= NN_SMUX_FLAG_OPEN;
+        chan->pmux->peer = nn_gets (self->inbuf);
+        nn_pmux_notify (chan->pmux, &self->fsm, NN_PMUX_OPENED);
+        return 0;
+
+    case NN_SMUX_CLOSE:
+        if (nn_slow (!chan || self->insize != 0 ||
+              (chan->flags & NN_SMUX_FLAG_CLOSERCVD)))
+            return -EPROTO;
+        chan->flags |= NN_SMUX_FLAG_CLOSERCVD;
+
+        /*  The pmux is going to be detached, which closes the channel on
+            our side as well. */
+        if (chan->pmux) {
+            nn_pmux_notify (chan->pmux, &self->fsm, NN_PMUX_CLOSED);
+            return 0;
+        }
+        if (chan->flags & NN_SMUX_FLAG_INCOMING)
+            return 0;
+        if (!(chan->flags & NN_SMUX_FLAG_CLOSESENT) &&
+              !(chan->ctrls & NN_SMUX_CTRL_CLOSE))
+            nn_smux_chan_ctrl (self, chan, NN_SMUX_CTRL_CLOSE);
+        nn_smux_chan_check (self, chan);
+        break;
+
+    case NN_SMUX_CREDIT:
+        if (nn_slow (!chan || self->insize != 16))
+            return -EPROTO;
+        msgs = nn_getll (self->inbuf);
+        bytes = nn_getll (self->inbuf + 8);
+        if (nn_slow (msgs < chan->ackmsgs || msgs > chan->sentmsgs ||
+              bytes < chan->ackbytes || bytes > chan->sentbytes))
+            return -EPROTO;
+        chan->ackmsgs = msgs;
+        chan->ackbytes = bytes;
+        if (chan->flags & NN_SMUX_FLAG_BLOCKED) {
+            chan->flags &= ~NN_SMUX_FLAG_BLOCKED;
+            nn_smux_chan_ready (self, chan);
+        }
+        break;
+
+    default:
+        nn_assert (0);
+    }
+
+    nn_smux_flush (self);
+    return 0;
+}
+
+/*  Closes all the channels. Those waiting for the owner's decision are kept
+    until it's made. */
+static void nn_smux_fail (struct nn_smux *self)
+{
+    struct nn_list_item *it;
+    struct nn_smux_chan *chan;
+    struct nn_pmux *pmux;
+
+    it = nn_list_begin (&self->chanlist);
+    while (it != nn_list_end (&self->chanlist)) {
+        chan = nn_cont (it, struct nn_smux_chan, item);
+        it = nn_list_next (&self->chanlist, it);
+        pmux = chan->pmux;
+        if (pmux) {
+            chan->pmux = NULL;
+            pmux->smux = NULL;
+            pmux->chan = NULL;
+            nn_pmux_notify (pmux, &self->fsm, NN_PMUX_CLOSED);
+        }
+        chan->flags |= NN_SMUX_FLAG_CLOSESENT | NN_SMUX_FLAG_CLOSERCVD;
+        chan->ctrls = 0;
+        if (nn_list_item_isinlist (&chan->ctrlitem))
+            nn_list_erase (&self->ctrls, &chan->ctrlitem);
+        if (nn_list_item_isinlist (&chan->readyitem))
+            nn_list_erase (&self->ready, &chan->readyitem);
+        nn_smux_chan_check (self, chan);
+    }
+}
+
+static void nn_smux_error (struct nn_smux *self)
+{
+    nn_smux_fail (self);
+    self->state = NN_SMUX_STATE_FAILED;
+    nn_fsm_raise (&self->fsm, &self->done, NN_SMUX_ERROR);
+}
+
+static void nn_smux_check_stopped (struct nn_smux *self)
+{
+    int i;
+
+    if (self->state != NN_SMUX_STATE_STOPPING || self->nincoming > 0)
+        return;
+    for (i = 0; i != self->noutmsgs; ++i) {
+        nn_msg_term (&self->outmsgs [i]);
+        nn_msg_init (&self->outmsgs [i], 0);
+    }
+    self->noutmsgs = 0;
+    self->sending = 0;
+    self->state = NN_SMUX_STATE_IDLE;
+    nn_fsm_stopped (&self->fsm, NN_SMUX_STOPPED);
+}
+
+static void nn_smux_shutdown (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_smux *smux;
+
+    smux = nn_cont (self, struct nn_smux, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        if (smux->state != NN_SMUX_STATE_FAILED)
+            nn_smux_fail (smux);
+        nn_usock_stop (&smux->usock);
+        smux->state = NN_SMUX_STATE_STOPPING_USOCK;
+    }
+    if (nn_slow (smux->state == NN_SMUX_STATE_STOPPING_USOCK)) {
+       if (!nn_usock_isidle (&smux->usock))
+            return;
+       smux->state = NN_SMUX_STATE_STOPPING;
+    }
+    nn_smux_check_stopped (smux);
+}
+
+static void nn_smux_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    int rc;
+    int val;
+    struct nn_smux *smux;
+
+    smux = nn_cont (self, struct nn_smux, fsm);
+
+    switch (smux->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_SMUX_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+
+        /*  The socket was stopped because it couldn't be bound. */
+        case NN_SMUX_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_STOPPED:
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  CONNECTING state.                                                         */
+/******************************************************************************/
+    case NN_SMUX_STATE_CONNECTING:
+        switch (src) {
+
+        case NN_SMUX_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_CONNECTED:
+                nn_smux_handshake (smux);
+                return;
+            case NN_USOCK_ERROR:
+                nn_smux_error (smux);
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACCEPTING state.                                                          */
+/******************************************************************************/
+    case NN_SMUX_STATE_ACCEPTING:
+        switch (src) {
+
+        case NN_SMUX_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_ACCEPTED:
+                val = 1;
+                nn_usock_setsockopt (&smux->usock, IPPROTO_TCP, TCP_NODELAY,
+                    &val, sizeof (val));
+                nn_usock_activate (&smux->usock);
+                nn_fsm_raise (&smux->fsm, &smux->event, NN_SMUX_ACCEPTED);
+                nn_smux_handshake (smux);
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  HANDSHAKE state.                                                          */
+/*  The headers are being exchanged.                                          */
+/******************************************************************************/
+    case NN_SMUX_STATE_HANDSHAKE:
+        switch (src) {
+
+        case NN_SMUX_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SENT:
+                smux->sending = 0;
+                smux->hsdone |= 1;
+                break;
+            case NN_USOCK_RECEIVED:
+                if (memcmp (smux->inbuf, nn_smux_header,
+                      sizeof (nn_smux_header)) != 0) {
+                    nn_smux_error (smux);
+                    return;
+                }
+                smux->hsdone |= 2;
+                break;
+            case NN_USOCK_ERROR:
+            case NN_USOCK_SHUTDOWN:
+                nn_smux_error (smux);
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+            if (smux->hsdone != 3)
+                return;
+            smux->state = NN_SMUX_STATE_ACTIVE;
+            if (!smux->openfn)
+                nn_fsm_raise (&smux->fsm, &smux->event, NN_SMUX_ACTIVE);
+            nn_smux_recvhdr (smux);
+            nn_smux_flush (smux);
+            return;
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/******************************************************************************/
+    case NN_SMUX_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_SMUX_SRC_USOCK:
+            switch (type) {
+            case NN_USOCK_SENT:
+                while (smux->noutmsgs > 0) {
+                    --smux->noutmsgs;
+                    nn_msg_term (&smux->outmsgs [smux->noutmsgs]);
+                    nn_msg_init (&smux->outmsgs [smux->noutmsgs], 0);
+                }
+                smux->sending = 0;
+                nn_smux_flush (smux);
+                return;
+            case NN_USOCK_RECEIVED:
+                rc = nn_smux_input (smux);
+                if (nn_slow (rc < 0))
+                    nn_smux_error (smux);
+                return;
+            case NN_USOCK_ERROR:
+            case NN_USOCK_SHUTDOWN:
+                nn_smux_error (smux);
+                return;
+            default:
+                nn_fsm_bad_action (smux->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  FAILED state.                                                             */
+/*  The owner was asked to stop the session. Whatever the socket reports in   */
+/*  the meantime is ignored.                                                  */
+/******************************************************************************/
+    case NN_SMUX_STATE_FAILED:
+        switch (src) {
+
+        case NN_SMUX_SRC_USOCK:
+            return;
+
+        default:
+            nn_fsm_bad_source (smux->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (smux->state, src, type);
+    }
+}
@@ -0,0 +1,225 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SMUX_INCLUDED
+#define NN_SMUX_INCLUDED
+
+#include "pmux.h"
+
+#include "../../aio/fsm.h"
+#include "../../aio/usock.h"
+
+#include "../../utils/msg.h"
+#include "../../utils/list.h"
+#include "../../utils/hash.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Session of the tcpmux transport, i.e. a TCP connection carrying any
+    number of logical channels. The channels are opened by the connecting
+    side, each of them for one pipe of one socket. The bound side passes
+    the request to open a channel to the owner, which either attaches
+    a pmux to the channel or rejects it.
+
+    Both sides start by sending an 8-byte header: "\0MUX\0\1\0\0". It is
+    followed by frames, each of which starts with a 16-byte header: type of
+    the frame (32 bits), ID of the channel (32 bits) and size of the frame
+    body (64 bits), all in network byte order. The frames are:
+
+    OPEN     Protocol of the socket (16 bits), size of its receive buffer
+             (64 bits) and name of the service to connect to.
+    ACCEPT   Protocol of the socket (16 bits) and size of its receive
+             buffer (64 bits).
+    CLOSE    Empty. Each side sends it once; the ID can be reused once it
+             was both sent and received.
+    DATA     A message, starting with the protocol header.
+    CREDIT   Total number of messages (64 bits) and of bytes (64 bits) of
+             the channel consumed by the socket so far.
+
+    A side may have data sent to the peer but not yet consumed by the socket
+    as long as their size doesn't exceed the receive buffer of the peer's
+    socket, and there may be at most NN_MSGQUEUE_SLOTS such messages. One
+    message is always allowed, however big it is. That way, a socket that
+    doesn't read its messages stops the sender of the channel without
+    affecting the other channels of the connection. */
+
+/*  Longest name of a service. */
+#define NN_SMUX_SERVICEMAX 128
+
+/*  Events raised to the owner. ACCEPTED is raised by the bound side once
+    the connection is accepted, ACTIVE by the connecting side once it is
+    ready for channels to be opened. */
+#define NN_SMUX_ACCEPTED 1
+#define NN_SMUX_ACTIVE 2
+#define NN_SMUX_ERROR 3
+#define NN_SMUX_STOPPED 4
+
+/*  Size of the buffers for the control frames and for the headers. */
+#define NN_SMUX_BUFSIZE 4096
+
+/*  Most messages sent in one go. */
+#define NN_SMUX_BATCH ((NN_USOCK_MAX_IOVCNT - 1) / 2)
+
+struct nn_smux;
+struct nn_smux_chan;
+
+/*  Called on the bound side when the peer asks to open a channel. Returns
+    0 if the request was passed to the owner of the service, which must then
+    call either nn_smux_attach or nn_smux_reject on the channel. */
+typedef int (*nn_smux_openfn) (struct nn_smux *self, struct nn_smux_chan *chan,
+    int protocol, const char *service, size_t servicelen);
+
+struct nn_smux_chan {
+
+    /*  Items in the hash table and in the list of channels. */
+    struct nn_hash_item hitem;
+    struct nn_list_item item;
+    uint32_t id;
+
+    /*  Any combination of the flags defined in the .c file. */
+    int flags;
+
+    /*  The pmux the channel is attached to, if any. */
+    struct nn_pmux *pmux;
+
+    /*  Control frames to send and the item in the list of channels that
+        have some. */
+    int ctrls;
+    struct nn_list_item ctrlitem;
+
+    /*  Item in the list of channels that have a message to send. */
+    struct nn_list_item readyitem;
+
+    /*  The next message to send, taken from the pmux, if it has to wait
+        for credit. */
+    struct nn_msg msg;
+    int held;
+
+    /*  Outbound flow control: receive buffer of the peer and the messages
+        and bytes sent and consumed by the peer so far. */
+    uint64_t window;
+    uint64_t sentmsgs;
+    uint64_t sentbytes;
+    uint64_t ackmsgs;
+    uint64_t ackbytes;
+
+    /*  Inbound flow control: messages and bytes consumed by the socket so
+        far, as seen the last time, and the amounts reported to the peer.
+        'creditwait' is set while the pmux is asked to tell us once it
+        consumes a message. */
+    uint32_t consmsgs32;
+    size_t consbytes32;
+    uint64_t consmsgs;
+    uint64_t consbytes;
+    uint64_t rcvmsgs;
+    uint64_t creditmsgs;
+    uint64_t creditbytes;
+    int creditwait;
+};
+
+struct nn_smux {
+
+    /*  The state machine. */
+    struct nn_fsm fsm;
+    int state;
+
+    /*  The underlying TCP connection. */
+    struct nn_usock usock;
+
+    /*  NULL on the connecting side. */
+    nn_smux_openfn openfn;
+
+    /*  The channels, by ID and all of them. */
+    struct nn_hash chans;
+    struct nn_list chanlist;
+    uint32_t nextid;
+
+    /*  Number of channels opened by the peer that wait for the owner's
+        decision. The session can't be stopped till there are none. */
+    int nincoming;
+
+    /*  Channels that have control frames to send and those that have
+        messages to send. */
+    struct nn_list ctrls;
+    struct nn_list ready;
+
+    /*  Outbound data. The buffer holds the control frames, the headers of
+        the messages and the small messages. The bigger messages are sent
+        directly from their chunks. */
+    int sending;
+    int hsdone;
+    uint8_t outbuf [NN_SMUX_BUFSIZE];
+    struct nn_msg outmsgs [NN_SMUX_BATCH];
+    int noutmsgs;
+
+    /*  Inbound data. */
+    int instate;
+    uint8_t inhdr [16];
+    uint8_t inbuf [NN_SMUX_BUFSIZE];
+    uint32_t intype;
+    uint32_t inid;
+    uint64_t insize;
+    size_t inskip;
+    struct nn_msg inmsg;
+
+    /*  Events raised to the owner. */
+    struct nn_fsm_event event;
+    struct nn_fsm_event done;
+
+    /*  Item in the owner's list of sessions. */
+    struct nn_list_item item;
+};
+
+void nn_smux_init (struct nn_smux *self, int src, nn_smux_openfn openfn,
+    struct nn_fsm *owner);
+void nn_smux_term (struct nn_smux *self);
+
+int nn_smux_isidle (struct nn_smux *self);
+
+/*  Start the session on the connecting side. */
+int nn_smux_connect (struct nn_smux *self, const struct sockaddr *addr,
+    size_t addrlen);
+
+/*  Start the session on the bound side by accepting a connection. */
+void nn_smux_accept (struct nn_smux *self, struct nn_usock *listener);
+
+/*  Once stopped, all the channels are closed. */
+void nn_smux_stop (struct nn_smux *self);
+
+/*  Opens a new channel for the pmux. Only on the connecting side, once
+    ACTIVE was raised. */
+void nn_smux_open (struct nn_smux *self, struct nn_pmux *pmux);
+
+/*  Attaches a pmux to a channel opened by the peer, or refuses to do so. */
+void nn_smux_attach (struct nn_smux *self, struct nn_smux_chan *chan,
+    struct nn_pmux *pmux);
+void nn_smux_reject (struct nn_smux *self, struct nn_smux_chan *chan);
+
+/*  Closes the channel of the pmux. */
+void nn_smux_detach (struct nn_smux *self, struct nn_pmux *pmux);
+
+/*  Processes the SENT and RECEIVED notifications of the pmux. It may not be
+    attached to a session any more. */
+void nn_smux_mail (struct nn_pmux *pmux, uint32_t what);
+
+#endif
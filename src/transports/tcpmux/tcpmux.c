@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "tcpmux.h"
+#include "emux.h"
+
+#include "../../tcpmux.h"
+
+#include "../utils/dns.h"
+
+#include "../../utils/err.h"
+#include "../../utils/mutex.h"
+#include "../../utils/cont.h"
+
+#include <string.h>
+
+/*  nn_transport interface. */
+static void nn_tcpmux_init (void);
+static void nn_tcpmux_term (void);
+static int nn_tcpmux_bind (struct nn_ep *ep);
+static int nn_tcpmux_connect (struct nn_ep *ep);
+
+static struct nn_transport nn_tcpmux_vfptr = {
+    "tcpmux",
+    NN_TCPMUX,
+    nn_tcpmux_init,
+    nn_tcpmux_term,
+    nn_tcpmux_bind,
+    nn_tcpmux_connect,
+    NULL,
+    NN_LIST_ITEM_INITIALIZER
+};
+
+struct nn_transport *nn_tcpmux = &nn_tcpmux_vfptr;
+
+/*  The registry of the hosts. */
+static nn_mutex_t nn_tcpmux_sync;
+static struct nn_list nn_tcpmux_hosts;
+
+static void nn_tcpmux_init (void)
+{
+    nn_mutex_init (&nn_tcpmux_sync);
+    nn_list_init (&nn_tcpmux_hosts);
+}
+
+static void nn_tcpmux_term (void)
+{
+    /*  The last endpoint of each host has stopped it. */
+    nn_assert (nn_list_empty (&nn_tcpmux_hosts));
+    nn_list_term (&nn_tcpmux_hosts);
+    nn_mutex_term (&nn_tcpmux_sync);
+    nn_dns_shutdown ();
+}
+
+static int nn_tcpmux_bind (struct nn_ep *ep)
+{
+    return nn_emux_create (ep, 1);
+}
+
+static int nn_tcpmux_connect (struct nn_ep *ep)
+{
+    return nn_emux_create (ep, 0);
+}
+
+void nn_tcpmux_host_init (struct nn_tcpmux_host *self, int bind,
+    const char *addr, size_t addrlen, struct nn_fsm *fsm)
+{
+    nn_assert (addrlen <= NN_SOCKADDR_MAX);
+
+    nn_list_item_init (&self->item);
+    self->bind = bind;
+    memcpy (self->addr, addr, addrlen);
+    self->addr [addrlen] = 0;
+    self->refs = 0;
+    self->fsm = fsm;
+    self->releaser = NULL;
+    self->released = NULL;
+}
+
+void nn_tcpmux_host_term (struct nn_tcpmux_host *self)
+{
+    nn_assert (self->refs == 0);
+    nn_list_item_term (&self->item);
+}
+
+void nn_tcpmux_host_released (struct nn_tcpmux_host *self)
+{
+    nn_assert (self->releaser);
+    nn_fsm_raiseto (self->fsm, self->releaser, self->released,
+        NN_TCPMUX_SRC_PEER, NN_TCPMUX_RELEASED, NULL);
+}
+
+void nn_tcpmux_lock (void)
+{
+    nn_mutex_lock (&nn_tcpmux_sync);
+}
+
+void nn_tcpmux_unlock (void)
+{
+    nn_mutex_unlock (&nn_tcpmux_sync);
+}
+
+struct nn_tcpmux_host *nn_tcpmux_find (int bind, const char *addr,
+    size_t addrlen)
+{
+    struct nn_list_item *it;
+    struct nn_tcpmux_host *host;
+
+    for (it = nn_list_begin (&nn_tcpmux_hosts);
+          it != nn_list_end (&nn_tcpmux_hosts);
+          it = nn_list_next (&nn_tcpmux_hosts, it)) {
+        host = nn_cont (it, struct nn_tcpmux_host, item);
+        if (host->bind == bind && strlen (host->addr) == addrlen &&
+              memcmp (host->addr, addr, addrlen) == 0)
+            return host;
+    }
+    return NULL;
+}
+
+void nn_tcpmux_insert (struct nn_tcpmux_host *host)
+{
+    nn_list_insert (&nn_tcpmux_hosts, &host->item,
+        nn_list_end (&nn_tcpmux_hosts));
+}
+
+void nn_tcpmux_erase (struct nn_tcpmux_host *host)
+{
+    nn_list_erase (&nn_tcpmux_hosts, &host->item);
+}
@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TCPMUX_INCLUDED
+#define NN_TCPMUX_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../aio/fsm.h"
+
+#include "../../utils/list.h"
+
+extern struct nn_transport *nn_tcpmux;
+
+/*  The endpoints connecting to the same address share a host that owns the
+    connection to it, the endpoints bound to the same address share a host
+    that owns the listening socket. The hosts live in contexts of their own
+    and are kept in a process-wide registry. */
+
+/*  Events the endpoints and the hosts pass to each other. */
+#define NN_TCPMUX_SRC_PEER 27716
+#define NN_TCPMUX_STOP 1
+#define NN_TCPMUX_RELEASED 2
+#define NN_TCPMUX_INCOMING 3
+#define NN_TCPMUX_REJECT 4
+
+struct nn_tcpmux_host {
+
+    /*  Item in the registry. */
+    struct nn_list_item item;
+
+    /*  1 for a listening host, 0 for a connecting one. */
+    int bind;
+
+    /*  Address without the service name, e.g. "127.0.0.1:5555". */
+    char addr [NN_SOCKADDR_MAX + 1];
+
+    /*  Number of endpoints using the host. Guarded by the registry lock. */
+    int refs;
+
+    /*  The state machine of the host. Once the last endpoint is done with
+        the host, it sends it NN_TCPMUX_STOP and the host replies with
+        NN_TCPMUX_RELEASED once it's stopped. */
+    struct nn_fsm *fsm;
+    struct nn_fsm *releaser;
+    struct nn_fsm_event *released;
+};
+
+void nn_tcpmux_host_init (struct nn_tcpmux_host *self, int bind,
+    const char *addr, size_t addrlen, struct nn_fsm *fsm);
+void nn_tcpmux_host_term (struct nn_tcpmux_host *self);
+
+/*  To be called by the host once it's stopped. */
+void nn_tcpmux_host_released (struct nn_tcpmux_host *self);
+
+/*  The registry lock. */
+void nn_tcpmux_lock (void);
+void nn_tcpmux_unlock (void);
+
+/*  Looks up the host with the specified address. The lock must be held. */
+struct nn_tcpmux_host *nn_tcpmux_find (int bind, const char *addr,
+    size_t addrlen);
+
+/*  Adds the host to the registry and removes it from there. The lock must
+    be held. */
+void nn_tcpmux_insert (struct nn_tcpmux_host *host);
+void nn_tcpmux_erase (struct nn_tcpmux_host *host);
+
+#endif
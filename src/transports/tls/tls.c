@@ -0,0 +1,301 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_HAVE_TLS
+
+#include "tls.h"
+
+#include "../../tls.h"
+
+#include "../tcp/btcp.h"
+#include "../tcp/ctcp.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/list.h"
+#include "../../utils/cont.h"
+
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/*  The tls+tcp transport uses the TCP state machines to establish the
+    connections, which are then secured by a TLS handshake before the SP
+    protocol header is exchanged. The options of the tcp transport apply to
+    these connections as well. */
+
+/*  Maximum length of a file name passed in an option. */
+#define NN_TLS_PATH_MAX 1024
+
+/*  TLS-specific socket options. */
+struct nn_tls_optset {
+    struct nn_optset base;
+    char cert [NN_TLS_PATH_MAX];
+    char key [NN_TLS_PATH_MAX];
+    char ca [NN_TLS_PATH_MAX];
+    int verify;
+};
+
+static void nn_tls_optset_destroy (struct nn_optset *self);
+static int nn_tls_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_tls_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_tls_optset_vfptr = {
+    nn_tls_optset_destroy,
+    nn_tls_optset_setopt,
+    nn_tls_optset_getopt
+};
+
+/*  nn_transport interface. */
+static int nn_tls_bind (struct nn_ep *ep);
+static int nn_tls_connect (struct nn_ep *ep);
+static struct nn_optset *nn_tls_optset (void);
+
+static struct nn_transport nn_tls_vfptr = {
+    "tls+tcp",
+    NN_TLS,
+    NULL,
+    NULL,
+    nn_tls_bind,
+    nn_tls_connect,
+    nn_tls_optset,
+    NN_LIST_ITEM_INITIALIZER
+};
+
+struct nn_transport *nn_tls = &nn_tls_vfptr;
+
+/*  Retrieves a file name option of the endpoint. Returns 0 if it's not set. */
+static int nn_tls_getpath (struct nn_ep *ep, int option,
+    char path [NN_TLS_PATH_MAX])
+{
+    size_t sz;
+
+    sz = NN_TLS_PATH_MAX - 1;
+    nn_ep_getopt (ep, NN_TLS, option, path, &sz);
+    nn_assert (sz < NN_TLS_PATH_MAX);
+    path [sz] = 0;
+    return sz > 0;
+}
+
+/*  Creates the TLS context for the endpoint out of its options. Returns NULL
+    if the certificates or the key can't be loaded. */
+static SSL_CTX *nn_tls_context (struct nn_ep *ep, int server)
+{
+    SSL_CTX *ctx;
+    char cert [NN_TLS_PATH_MAX];
+    char key [NN_TLS_PATH_MAX];
+    char ca [NN_TLS_PATH_MAX];
+    int hascert;
+    int haskey;
+    int hasca;
+    int verify;
+    size_t sz;
+
+    hascert = nn_tls_getpath (ep, NN_TLS_CERT_FILE, cert);
+    haskey = nn_tls_getpath (ep, NN_TLS_KEY_FILE, key);
+    hasca = nn_tls_getpath (ep, NN_TLS_CA_FILE, ca);
+    sz = sizeof (verify);
+    nn_ep_getopt (ep, NN_TLS, NN_TLS_VERIFY, &verify, &sz);
+    nn_assert (sz == sizeof (verify));
+
+    /*  The server can't do without a certificate. */
+    if (server && !(hascert && haskey))
+        return NULL;
+
+    ctx = SSL_CTX_new (server ? TLS_server_method () : TLS_client_method ());
+    alloc_assert (ctx);
+    SSL_CTX_set_min_proto_version (ctx, TLS1_2_VERSION);
+
+    /*  Let the kernel encrypt the data once the handshake is done, if it
+        can. Renegotiation and session tickets would require the library to
+        take part in the data transfer later on, so they are disabled. */
+#if defined SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options (ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    SSL_CTX_set_options (ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets (ctx, 0);
+    SSL_CTX_set_mode (ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+        SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (hascert || haskey) {
+        if (!(hascert && haskey) ||
+              SSL_CTX_use_certificate_chain_file (ctx, cert) != 1 ||
+              SSL_CTX_use_PrivateKey_file (ctx, key, SSL_FILETYPE_PEM) != 1 ||
+              SSL_CTX_check_private_key (ctx) != 1)
+            goto error;
+    }
+
+    /*  The server asks the clients for their certificates only if it was
+        told whom to trust. The client always checks the server's one,
+        unless asked not to. */
+    if (verify && hasca) {
+        if (SSL_CTX_load_verify_locations (ctx, ca, NULL) != 1)
+            goto error;
+    }
+    if (verify && !server && !hasca) {
+        if (SSL_CTX_set_default_verify_paths (ctx) != 1)
+            goto error;
+    }
+    if (verify && (!server || hasca))
+        SSL_CTX_set_verify (ctx, SSL_VERIFY_PEER |
+            SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    else
+        SSL_CTX_set_verify (ctx, SSL_VERIFY_NONE, NULL);
+
+    return ctx;
+
+error:
+    ERR_clear_error ();
+    SSL_CTX_free (ctx);
+    return NULL;
+}
+
+static int nn_tls_bind (struct nn_ep *ep)
+{
+    int rc;
+    SSL_CTX *ctx;
+
+    ctx = nn_tls_context (ep, 1);
+    if (nn_slow (!ctx))
+        return -EINVAL;
+    rc = nn_btcp_create (ep, ctx, 0);
+    SSL_CTX_free (ctx);
+    return rc;
+}
+
+static int nn_tls_connect (struct nn_ep *ep)
+{
+    int rc;
+    SSL_CTX *ctx;
+
+    ctx = nn_tls_context (ep, 0);
+    if (nn_slow (!ctx))
+        return -EINVAL;
+    rc = nn_ctcp_create (ep, ctx, 0);
+    SSL_CTX_free (ctx);
+    return rc;
+}
+
+static struct nn_optset *nn_tls_optset ()
+{
+    struct nn_tls_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_tls_optset), "optset (tls)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_tls_optset_vfptr;
+
+    /*  Default values for TLS socket options. */
+    optset->cert [0] = 0;
+    optset->key [0] = 0;
+    optset->ca [0] = 0;
+    optset->verify = 1;
+
+    return &optset->base;
+}
+
+static void nn_tls_optset_destroy (struct nn_optset *self)
+{
+    struct nn_tls_optset *optset;
+
+    optset = nn_cont (self, struct nn_tls_optset, base);
+    nn_free (optset);
+}
+
+static int nn_tls_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_tls_optset *optset;
+    char *path;
+    int val;
+
+    optset = nn_cont (self, struct nn_tls_optset, base);
+
+    switch (option) {
+    case NN_TLS_CERT_FILE:
+        path = optset->cert;
+        break;
+    case NN_TLS_KEY_FILE:
+        path = optset->key;
+        break;
+    case NN_TLS_CA_FILE:
+        path = optset->ca;
+        break;
+    case NN_TLS_VERIFY:
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->verify = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+
+    /*  File names. An empty one unsets the option. */
+    if (nn_slow (optvallen >= NN_TLS_PATH_MAX ||
+          memchr (optval, 0, optvallen)))
+        return -EINVAL;
+    memcpy (path, optval, optvallen);
+    path [optvallen] = 0;
+    return 0;
+}
+
+static int nn_tls_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_tls_optset *optset;
+    const char *path;
+    size_t sz;
+    int intval;
+
+    optset = nn_cont (self, struct nn_tls_optset, base);
+
+    switch (option) {
+    case NN_TLS_CERT_FILE:
+        path = optset->cert;
+        break;
+    case NN_TLS_KEY_FILE:
+        path = optset->key;
+        break;
+    case NN_TLS_CA_FILE:
+        path = optset->ca;
+        break;
+    case NN_TLS_VERIFY:
+        intval = optset->verify;
+        memcpy (optval, &intval,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+    sz = strlen (path);
+    memcpy (optval, path, *optvallen < sz ? *optvallen : sz);
+    *optvallen = sz;
+    return 0;
+}
+
+#endif
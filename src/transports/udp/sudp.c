@@ -0,0 +1,782 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_HAVE_UDP
+
+#include "sudp.h"
+
+#include "../../udp.h"
+
+#include "../utils/port.h"
+#include "../utils/iface.h"
+#include "../utils/literal.h"
+
+#include "../../aio/fsm.h"
+#include "../../aio/worker.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+#include "../../utils/clock.h"
+#include "../../utils/closefd.h"
+#include "../../utils/trace.h"
+#include "../../utils/chunk.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+/*  Each message travels in a datagram of its own, preceded by the same
+    header that stream transports exchange when the connection is set up.
+    It lets the receiver drop datagrams sent by sockets that aren't its
+    peers. Datagrams can't get any larger than this. */
+#define NN_SUDP_MAXDGRAM 65536
+
+#define NN_SUDP_STATE_IDLE 1
+#define NN_SUDP_STATE_STARTING 2
+#define NN_SUDP_STATE_ACTIVE 3
+#define NN_SUDP_STATE_FAILED 4
+#define NN_SUDP_STATE_STOPPING 5
+
+#define NN_SUDP_INSTATE_IDLE 1
+#define NN_SUDP_INSTATE_HASMSG 2
+
+#define NN_SUDP_OUTSTATE_IDLE 1
+#define NN_SUDP_OUTSTATE_SENDING 2
+
+#define NN_SUDP_SRC_FD 1
+#define NN_SUDP_SRC_TASK_START 2
+#define NN_SUDP_SRC_TASK_SEND 3
+#define NN_SUDP_SRC_TASK_RECV 4
+#define NN_SUDP_SRC_TASK_STOP 5
+
+struct nn_sudp {
+
+    /*  The state machine. */
+    struct nn_fsm fsm;
+    int state;
+
+    /*  This object is a specific type of endpoint.
+        Thus it is derived from epbase. */
+    struct nn_ep *ep;
+
+    /*  The underlying OS socket and the worker thread polling it. */
+    int s;
+    struct nn_worker *worker;
+    struct nn_worker_fd wfd;
+
+    /*  Asynchronous tasks for the worker. */
+    struct nn_worker_task task_start;
+    struct nn_worker_task task_send;
+    struct nn_worker_task task_recv;
+    struct nn_worker_task task_stop;
+
+    /*  The only pipe of the endpoint. */
+    struct nn_pipebase pipebase;
+
+    /*  Where the datagrams are sent to. Zero length for bound endpoints,
+        which don't send anything. */
+    struct sockaddr_storage addr;
+    size_t addrlen;
+
+    /*  Header of the outbound datagrams. */
+    uint8_t protohdr [8];
+
+    /*  Message received and not yet passed to the socket, and the buffer
+        a datagram is read into before that. */
+    int instate;
+    struct nn_msg inmsg;
+    uint8_t *buf;
+
+    /*  Message waiting for space in the send buffer of the OS socket. */
+    int outstate;
+    struct nn_msg outmsg;
+};
+
+/*  nn_ep virtual interface implementation. */
+static void nn_sudp_stop (struct nn_ep *);
+static void nn_sudp_destroy (struct nn_ep *);
+const struct nn_ep_vfptr nn_sudp_ep_vfptr = {
+    nn_sudp_stop,
+    nn_sudp_destroy
+};
+
+/*  Implementation of the virtual pipe API. */
+static int nn_sudp_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_sudp_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_sudp_queued (struct nn_pipebase *self);
+const struct nn_pipebase_vfptr nn_sudp_pipebase_vfptr = {
+    nn_sudp_send,
+    nn_sudp_recv,
+    nn_sudp_queued,
+    NULL,
+    NULL
+};
+
+/*  Private functions. */
+static void nn_sudp_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_sudp_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static int nn_sudp_ismulticast (const struct sockaddr_storage *ss);
+static int nn_sudp_open (struct nn_sudp *self, int bound,
+    struct sockaddr_storage *ss, size_t sslen,
+    struct sockaddr_storage *ifss, size_t ifsslen);
+static int nn_sudp_sendmsg (struct nn_sudp *self);
+static int nn_sudp_recvmsg (struct nn_sudp *self);
+static void nn_sudp_clearerr (struct nn_sudp *self);
+
+int nn_sudp_create (struct nn_ep *ep, int bound)
+{
+    int rc;
+    struct nn_sudp *self;
+    const char *addr;
+    const char *end;
+    const char *semicolon;
+    const char *host;
+    const char *colon;
+    int port;
+    struct sockaddr_storage ss;
+    size_t sslen;
+    struct sockaddr_storage ifss;
+    size_t ifsslen;
+    int ipv4only;
+    size_t ipv4onlylen;
+    int protocol;
+    size_t sz;
+
+    /*  Address has the form of [interface;]address:port. */
+    addr = nn_ep_getaddr (ep);
+    end = addr + strlen (addr);
+    semicolon = strchr (addr, ';');
+    host = semicolon ? semicolon + 1 : addr;
+    colon = strrchr (addr, ':');
+    if (nn_slow (colon == NULL || colon < host))
+        return -EINVAL;
+    rc = nn_port_resolve (colon + 1, end - colon - 1);
+    if (nn_slow (rc < 0))
+        return -EINVAL;
+    port = rc;
+
+    /*  Check whether IPv6 is to be used. */
+    ipv4onlylen = sizeof (ipv4only);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_IPV4ONLY, &ipv4only, &ipv4onlylen);
+    nn_assert (ipv4onlylen == sizeof (ipv4only));
+
+    /*  Bound endpoint may listen on all the interfaces. The address to send
+        the datagrams to has to be a literal one. There's no point in
+        resolving names as multicast groups don't have any. */
+    if (bound) {
+        rc = nn_iface_resolve (host, colon - host, ipv4only, &ss, &sslen);
+        if (nn_slow (rc < 0))
+            return -ENODEV;
+    }
+    else {
+        rc = nn_literal_resolve (host, colon - host, ipv4only, &ss, &sslen);
+        if (nn_slow (rc < 0))
+            return -EINVAL;
+    }
+    if (ss.ss_family == AF_INET)
+        ((struct sockaddr_in*) &ss)->sin_port = htons (port);
+    else
+        ((struct sockaddr_in6*) &ss)->sin6_port = htons (port);
+
+    /*  Interface to send the datagrams from or to join the group on. */
+    ifsslen = 0;
+    if (semicolon) {
+        rc = nn_iface_resolve (addr, semicolon - addr, ipv4only,
+            &ifss, &ifsslen);
+        if (nn_slow (rc < 0))
+            return -ENODEV;
+        if (nn_slow (ifss.ss_family != ss.ss_family))
+            return -EINVAL;
+    }
+
+    /*  Allocate the new endpoint object. */
+    self = nn_alloc (sizeof (struct nn_sudp), "sudp");
+    alloc_assert (self);
+    self->ep = ep;
+    self->s = -1;
+    self->addrlen = 0;
+    self->buf = NULL;
+    rc = nn_sudp_open (self, bound, &ss, sslen, &ifss, ifsslen);
+    if (nn_slow (rc < 0)) {
+        if (self->s >= 0)
+            nn_closefd (self->s);
+        nn_free (self);
+        return rc;
+    }
+    if (bound) {
+        self->buf = nn_alloc (NN_SUDP_MAXDGRAM, "udp datagram");
+        alloc_assert (self->buf);
+    }
+
+    nn_ep_tran_setup (ep, &nn_sudp_ep_vfptr, self);
+
+    /*  Initialise the structure. */
+    nn_fsm_init_root (&self->fsm, nn_sudp_handler, nn_sudp_shutdown,
+        nn_ep_getctx (ep));
+    self->state = NN_SUDP_STATE_IDLE;
+    self->worker = nn_fsm_choose_worker (&self->fsm);
+    nn_worker_fd_init (&self->wfd, NN_SUDP_SRC_FD, &self->fsm);
+    nn_worker_task_init (&self->task_start, NN_SUDP_SRC_TASK_START,
+        &self->fsm);
+    nn_worker_task_init (&self->task_send, NN_SUDP_SRC_TASK_SEND,
+        &self->fsm);
+    nn_worker_task_init (&self->task_recv, NN_SUDP_SRC_TASK_RECV,
+        &self->fsm);
+    nn_worker_task_init (&self->task_stop, NN_SUDP_SRC_TASK_STOP,
+        &self->fsm);
+    nn_pipebase_init (&self->pipebase, &nn_sudp_pipebase_vfptr, ep);
+    self->instate = NN_SUDP_INSTATE_IDLE;
+    self->outstate = NN_SUDP_OUTSTATE_IDLE;
+
+    sz = sizeof (protocol);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &protocol, &sz);
+    nn_assert (sz == sizeof (protocol));
+    memcpy (self->protohdr, "\0SP\0\0\0\0\0", 8);
+    nn_puts (self->protohdr + 4, (uint16_t) protocol);
+
+    /*  Start the state machine. */
+    nn_fsm_start (&self->fsm);
+
+    return 0;
+}
+
+static void nn_sudp_stop (struct nn_ep *ep)
+{
+    struct nn_sudp *sudp;
+
+    sudp = nn_ep_tran_private (ep);
+
+    nn_fsm_stop (&sudp->fsm);
+}
+
+static void nn_sudp_destroy (struct nn_ep *ep)
+{
+    struct nn_sudp *sudp;
+
+    sudp = nn_ep_tran_private (ep);
+
+    nn_assert_state (sudp, NN_SUDP_STATE_IDLE);
+    nn_pipebase_term (&sudp->pipebase);
+    nn_worker_task_term (&sudp->task_stop);
+    nn_worker_task_term (&sudp->task_recv);
+    nn_worker_task_term (&sudp->task_send);
+    nn_worker_task_term (&sudp->task_start);
+    nn_worker_fd_term (&sudp->wfd);
+    nn_fsm_term (&sudp->fsm);
+    if (sudp->buf)
+        nn_free (sudp->buf);
+
+    nn_free (sudp);
+}
+
+static int nn_sudp_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_sudp *sudp;
+
+    sudp = nn_cont (self, struct nn_sudp, pipebase);
+
+    nn_assert_state (sudp, NN_SUDP_STATE_ACTIVE);
+    nn_assert (sudp->outstate == NN_SUDP_OUTSTATE_IDLE);
+
+    /*  Messages sent through a bound endpoint, such as subscription
+        updates, have nowhere to go. */
+    if (nn_slow (sudp->addrlen == 0)) {
+        nn_msg_term (msg);
+        nn_pipebase_sent (&sudp->pipebase);
+        return 0;
+    }
+
+    /*  If the send buffer of the OS socket is full, wait till there's space
+        in it. The pipe doesn't accept any more messages in the meantime. */
+    nn_msg_mv (&sudp->outmsg, msg);
+    rc = nn_sudp_sendmsg (sudp);
+    if (nn_slow (rc == -EAGAIN)) {
+        sudp->outstate = NN_SUDP_OUTSTATE_SENDING;
+        nn_worker_execute (sudp->worker, &sudp->task_send);
+        return 0;
+    }
+    nn_pipebase_sent (&sudp->pipebase);
+
+    return 0;
+}
+
+static int nn_sudp_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_sudp *sudp;
+
+    sudp = nn_cont (self, struct nn_sudp, pipebase);
+
+    nn_assert_state (sudp, NN_SUDP_STATE_ACTIVE);
+    nn_assert (sudp->instate == NN_SUDP_INSTATE_HASMSG);
+
+    nn_msg_mv (msg, &sudp->inmsg);
+
+    /*  If there's another datagram already, there's no need to ask
+        the worker thread to wait for it. */
+    if (nn_sudp_recvmsg (sudp) == 0) {
+        nn_pipebase_received (&sudp->pipebase);
+        return 0;
+    }
+    sudp->instate = NN_SUDP_INSTATE_IDLE;
+    nn_worker_execute (sudp->worker, &sudp->task_recv);
+
+    return 0;
+}
+
+static size_t nn_sudp_queued (struct nn_pipebase *self)
+{
+    struct nn_sudp *sudp;
+
+    sudp = nn_cont (self, struct nn_sudp, pipebase);
+    return sudp->outstate == NN_SUDP_OUTSTATE_SENDING ? 1 : 0;
+}
+
+static void nn_sudp_shutdown (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_sudp *sudp;
+
+    sudp = nn_cont (self, struct nn_sudp, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        if (sudp->state == NN_SUDP_STATE_ACTIVE)
+            nn_pipebase_stop (&sudp->pipebase);
+
+        /*  The tasks are executed in order, so once the worker gets to this
+            one, it's done with all the others, including the start. */
+        nn_worker_execute (sudp->worker, &sudp->task_stop);
+        sudp->state = NN_SUDP_STATE_STOPPING;
+        return;
+    }
+    if (nn_slow (sudp->state == NN_SUDP_STATE_STOPPING)) {
+        switch (src) {
+        case NN_SUDP_SRC_TASK_START:
+            nn_worker_add_fd (sudp->worker, sudp->s, &sudp->wfd);
+            return;
+        case NN_SUDP_SRC_FD:
+            if (type == NN_WORKER_FD_IN)
+                nn_worker_reset_in (sudp->worker, &sudp->wfd);
+            else if (type == NN_WORKER_FD_OUT)
+                nn_worker_reset_out (sudp->worker, &sudp->wfd);
+            else
+                nn_sudp_clearerr (sudp);
+            return;
+        case NN_SUDP_SRC_TASK_STOP:
+            nn_worker_rm_fd (sudp->worker, &sudp->wfd);
+            nn_closefd (sudp->s);
+            sudp->s = -1;
+            if (sudp->instate == NN_SUDP_INSTATE_HASMSG)
+                nn_msg_term (&sudp->inmsg);
+            sudp->instate = NN_SUDP_INSTATE_IDLE;
+            if (sudp->outstate == NN_SUDP_OUTSTATE_SENDING)
+                nn_msg_term (&sudp->outmsg);
+            sudp->outstate = NN_SUDP_OUTSTATE_IDLE;
+            sudp->state = NN_SUDP_STATE_IDLE;
+            nn_fsm_stopped_noevent (&sudp->fsm);
+            nn_ep_stopped (sudp->ep);
+            return;
+        default:
+            return;
+        }
+    }
+
+    nn_fsm_bad_state(sudp->state, src, type);
+}
+
+static void nn_sudp_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    int rc;
+    struct nn_sudp *sudp;
+
+    sudp = nn_cont (self, struct nn_sudp, fsm);
+
+    switch (sudp->state) {
+
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_SUDP_STATE_IDLE:
+        switch (src) {
+
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                nn_worker_execute (sudp->worker, &sudp->task_start);
+                sudp->state = NN_SUDP_STATE_STARTING;
+                return;
+            default:
+                nn_fsm_bad_action (sudp->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (sudp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  STARTING state.                                                           */
+/*  Waiting for the worker thread to start polling the socket.                */
+/******************************************************************************/
+    case NN_SUDP_STATE_STARTING:
+        switch (src) {
+
+        case NN_SUDP_SRC_TASK_START:
+            nn_assert (type == NN_WORKER_TASK_EXECUTE);
+            nn_worker_add_fd (sudp->worker, sudp->s, &sudp->wfd);
+
+            /*  The socket may refuse the pipe, e.g. if it's a pair socket
+                that's already got one. There's no one to tell about it. */
+            rc = nn_pipebase_start (&sudp->pipebase);
+            if (nn_slow (rc < 0)) {
+                sudp->state = NN_SUDP_STATE_FAILED;
+                return;
+            }
+            sudp->state = NN_SUDP_STATE_ACTIVE;
+            if (sudp->buf)
+                nn_worker_set_in (sudp->worker, &sudp->wfd);
+            return;
+
+        default:
+            nn_fsm_bad_source (sudp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  ACTIVE state.                                                             */
+/******************************************************************************/
+    case NN_SUDP_STATE_ACTIVE:
+        switch (src) {
+
+        case NN_SUDP_SRC_TASK_SEND:
+            nn_assert (type == NN_WORKER_TASK_EXECUTE);
+            nn_worker_set_out (sudp->worker, &sudp->wfd);
+            return;
+
+        case NN_SUDP_SRC_TASK_RECV:
+            nn_assert (type == NN_WORKER_TASK_EXECUTE);
+            nn_worker_set_in (sudp->worker, &sudp->wfd);
+            return;
+
+        case NN_SUDP_SRC_FD:
+            switch (type) {
+            case NN_WORKER_FD_IN:
+                nn_assert (sudp->instate == NN_SUDP_INSTATE_IDLE);
+                if (nn_sudp_recvmsg (sudp) < 0)
+                    return;
+                nn_worker_reset_in (sudp->worker, &sudp->wfd);
+                sudp->instate = NN_SUDP_INSTATE_HASMSG;
+                nn_pipebase_received (&sudp->pipebase);
+                return;
+
+            case NN_WORKER_FD_OUT:
+                nn_assert (sudp->outstate == NN_SUDP_OUTSTATE_SENDING);
+                if (nn_sudp_sendmsg (sudp) < 0)
+                    return;
+                nn_worker_reset_out (sudp->worker, &sudp->wfd);
+                sudp->outstate = NN_SUDP_OUTSTATE_IDLE;
+                nn_pipebase_sent (&sudp->pipebase);
+                return;
+
+            case NN_WORKER_FD_ERR:
+                nn_sudp_clearerr (sudp);
+                return;
+
+            default:
+                nn_fsm_bad_action (sudp->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (sudp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  FAILED state.                                                             */
+/*  The pipe couldn't be started. Nothing is sent or received till the       */
+/*  endpoint is stopped.                                                      */
+/******************************************************************************/
+    case NN_SUDP_STATE_FAILED:
+        switch (src) {
+
+        case NN_SUDP_SRC_FD:
+            nn_sudp_clearerr (sudp);
+            return;
+
+        default:
+            nn_fsm_bad_source (sudp->state, src, type);
+        }
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (sudp->state, src, type);
+    }
+}
+
+static int nn_sudp_ismulticast (const struct sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET)
+        return IN_MULTICAST (ntohl (
+            ((const struct sockaddr_in*) ss)->sin_addr.s_addr));
+    return IN6_IS_ADDR_MULTICAST (&((const struct sockaddr_in6*) ss)->sin6_addr);
+}
+
+static int nn_sudp_open (struct nn_sudp *self, int bound,
+    struct sockaddr_storage *ss, size_t sslen,
+    struct sockaddr_storage *ifss, size_t ifsslen)
+{
+    int rc;
+    int type;
+    int opt;
+    size_t sz;
+    int multicast;
+    unsigned char val;
+    struct ip_mreq mreq;
+    struct ipv6_mreq mreq6;
+
+    type = SOCK_DGRAM;
+#ifdef SOCK_CLOEXEC
+    type |= SOCK_CLOEXEC;
+#endif
+    self->s = socket (ss->ss_family, type, 0);
+    if (nn_slow (self->s < 0))
+        return -errno;
+#if defined FD_CLOEXEC
+    rc = fcntl (self->s, F_SETFD, FD_CLOEXEC);
+    errno_assert (rc != -1);
+#endif
+    opt = fcntl (self->s, F_GETFL, 0);
+    if (opt == -1)
+        opt = 0;
+    rc = fcntl (self->s, F_SETFL, opt | O_NONBLOCK);
+    errno_assert (rc != -1);
+
+    multicast = nn_sudp_ismulticast (ss);
+
+    if (bound) {
+
+        /*  Several subscribers on the same box may join the same group. */
+        if (multicast) {
+            opt = 1;
+            rc = setsockopt (self->s, SOL_SOCKET, SO_REUSEADDR,
+                &opt, sizeof (opt));
+            errno_assert (rc == 0);
+#if defined SO_REUSEPORT && !defined NN_HAVE_LINUX
+            rc = setsockopt (self->s, SOL_SOCKET, SO_REUSEPORT,
+                &opt, sizeof (opt));
+            errno_assert (rc == 0);
+#endif
+        }
+
+        sz = sizeof (opt);
+        nn_ep_getopt (self->ep, NN_SOL_SOCKET, NN_RCVBUF, &opt, &sz);
+        nn_assert (sz == sizeof (opt));
+        if (opt >= 0) {
+            rc = setsockopt (self->s, SOL_SOCKET, SO_RCVBUF,
+                &opt, sizeof (opt));
+            errno_assert (rc == 0);
+        }
+
+        /*  Binding to the group rather than to all the interfaces keeps
+            the datagrams sent to other groups on the same port away. */
+        rc = bind (self->s, (struct sockaddr*) ss, (socklen_t) sslen);
+        if (nn_slow (rc < 0))
+            return -errno;
+
+        if (!multicast)
+            return 0;
+        if (ss->ss_family == AF_INET) {
+            mreq.imr_multiaddr = ((struct sockaddr_in*) ss)->sin_addr;
+            mreq.imr_interface.s_addr = ifsslen ?
+                ((struct sockaddr_in*) ifss)->sin_addr.s_addr :
+                htonl (INADDR_ANY);
+            rc = setsockopt (self->s, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                &mreq, sizeof (mreq));
+        }
+        else {
+            mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6*) ss)->sin6_addr;
+            mreq6.ipv6mr_interface = 0;
+            rc = setsockopt (self->s, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                &mreq6, sizeof (mreq6));
+        }
+        if (nn_slow (rc < 0))
+            return -errno;
+        return 0;
+    }
+
+    sz = sizeof (opt);
+    nn_ep_getopt (self->ep, NN_SOL_SOCKET, NN_SNDBUF, &opt, &sz);
+    nn_assert (sz == sizeof (opt));
+    if (opt >= 0) {
+        rc = setsockopt (self->s, SOL_SOCKET, SO_SNDBUF, &opt, sizeof (opt));
+        errno_assert (rc == 0);
+    }
+
+    /*  Datagrams are sent from the specified interface, if any. */
+    if (ifsslen) {
+        rc = bind (self->s, (struct sockaddr*) ifss, (socklen_t) ifsslen);
+        if (nn_slow (rc < 0))
+            return -errno;
+        if (multicast && ss->ss_family == AF_INET) {
+            rc = setsockopt (self->s, IPPROTO_IP, IP_MULTICAST_IF,
+                &((struct sockaddr_in*) ifss)->sin_addr,
+                sizeof (struct in_addr));
+            if (nn_slow (rc < 0))
+                return -errno;
+        }
+    }
+
+    if (multicast) {
+        sz = sizeof (opt);
+        nn_ep_getopt (self->ep, NN_UDP, NN_UDP_TTL, &opt, &sz);
+        nn_assert (sz == sizeof (opt));
+        if (ss->ss_family == AF_INET) {
+            val = (unsigned char) opt;
+            rc = setsockopt (self->s, IPPROTO_IP, IP_MULTICAST_TTL,
+                &val, sizeof (val));
+            errno_assert (rc == 0);
+        }
+        else {
+            rc = setsockopt (self->s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+                &opt, sizeof (opt));
+            errno_assert (rc == 0);
+        }
+
+        /*  Subscribers on the same box get the datagrams only if they are
+            looped back. */
+        sz = sizeof (opt);
+        nn_ep_getopt (self->ep, NN_UDP, NN_UDP_LOOPBACK, &opt, &sz);
+        nn_assert (sz == sizeof (opt));
+        if (ss->ss_family == AF_INET) {
+            val = (unsigned char) opt;
+            rc = setsockopt (self->s, IPPROTO_IP, IP_MULTICAST_LOOP,
+                &val, sizeof (val));
+            errno_assert (rc == 0);
+        }
+        else {
+            rc = setsockopt (self->s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
+                &opt, sizeof (opt));
+            errno_assert (rc == 0);
+        }
+    }
+
+    memcpy (&self->addr, ss, sslen);
+    self->addrlen = sslen;
+
+    return 0;
+}
+
+/*  Sends the pending message. Returns -EAGAIN if there's no space for it in
+    the send buffer, 0 otherwise, including when the message is dropped. */
+static int nn_sudp_sendmsg (struct nn_sudp *self)
+{
+    struct nn_msg *msg;
+    struct iovec iov [3 + NN_MSG_MAXPARTS];
+    struct msghdr hdr;
+    ssize_t nbytes;
+    int i;
+
+    msg = &self->outmsg;
+    iov [0].iov_base = self->protohdr;
+    iov [0].iov_len = sizeof (self->protohdr);
+    iov [1].iov_base = nn_chunkref_data (&msg->sphdr);
+    iov [1].iov_len = nn_chunkref_size (&msg->sphdr);
+    iov [2].iov_base = nn_chunkref_data (&msg->body);
+    iov [2].iov_len = nn_chunkref_size (&msg->body);
+    for (i = 0; i != msg->nparts; ++i) {
+        iov [3 + i].iov_base = msg->parts [i];
+        iov [3 + i].iov_len = nn_chunk_size (msg->parts [i]);
+    }
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_name = &self->addr;
+    hdr.msg_namelen = (socklen_t) self->addrlen;
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 3 + msg->nparts;
+
+    nbytes = sendmsg (self->s, &hdr, 0);
+    if (nn_slow (nbytes < 0)) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -EAGAIN;
+
+        /*  Datagrams may get lost anyway. A message that doesn't fit into
+            one or can't be routed is dropped rather than retried. */
+        nn_ep_stat_increment (self->ep, NN_STAT_DROPPED_MESSAGES, 1);
+    }
+    else
+        NN_TRACE (NN_TRACE_USOCK_SENT, self, (size_t) nbytes);
+    nn_msg_term (msg);
+
+    return 0;
+}
+
+/*  Reads datagrams till there's one sent by a peer. Returns 0 once
+    the message is stored in 'inmsg', -EAGAIN if there are no more
+    datagrams. */
+static int nn_sudp_recvmsg (struct nn_sudp *self)
+{
+    ssize_t nbytes;
+
+    while (1) {
+        nbytes = recv (self->s, self->buf, NN_SUDP_MAXDGRAM, 0);
+        if (nn_slow (nbytes < 0)) {
+            if (errno == EINTR)
+                continue;
+            return -EAGAIN;
+        }
+        NN_TRACE (NN_TRACE_USOCK_RECV, self, (size_t) nbytes);
+        if (nn_slow (nbytes < (ssize_t) sizeof (self->protohdr) ||
+              memcmp (self->buf, "\0SP\0", 4) != 0 ||
+              !nn_pipebase_ispeer (&self->pipebase, nn_gets (self->buf + 4))))
+            continue;
+        nbytes -= sizeof (self->protohdr);
+        nn_msg_init (&self->inmsg, (size_t) nbytes);
+        memcpy (nn_chunkref_data (&self->inmsg.body),
+            self->buf + sizeof (self->protohdr), (size_t) nbytes);
+        self->inmsg.rcvtime = nn_clock_us ();
+        NN_TRACE (NN_TRACE_TRANSPORT_RECV, &self->pipebase, (size_t) nbytes);
+        return 0;
+    }
+}
+
+/*  Errors reported asynchronously, e.g. by ICMP, are of no interest.
+    They are picked up so that the poller doesn't report them again. */
+static void nn_sudp_clearerr (struct nn_sudp *self)
+{
+    int err;
+    socklen_t errlen;
+
+    errlen = sizeof (err);
+    (void) getsockopt (self->s, SOL_SOCKET, SO_ERROR, &err, &errlen);
+}
+
+#endif
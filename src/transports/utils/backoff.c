@@ -22,6 +22,48 @@
 
 #include "backoff.h"
 
+#include "../../utils/mutex.h"
+#include "../../utils/once.h"
+#include "../../utils/random.h"
+#include "../../utils/err.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*  Default maximum number of connection attempts under way in the process. */
+#define NN_BACKOFF_DEFAULT_CONNECT_MAX 64
+
+/*  Process-wide count of connection attempts under way. Zero limit means
+    there's no limit. */
+static struct {
+    struct nn_mutex sync;
+    int limit;
+    int count;
+} nn_backoff_slots;
+static nn_once_t nn_backoff_once = NN_ONCE_INITIALIZER;
+
+static void nn_backoff_slots_init (void)
+{
+    char *envvar;
+
+    nn_mutex_init (&nn_backoff_slots.sync);
+    nn_backoff_slots.count = 0;
+    nn_backoff_slots.limit = NN_BACKOFF_DEFAULT_CONNECT_MAX;
+    envvar = getenv ("NN_CONNECT_MAX");
+    if (envvar && atoi (envvar) >= 0)
+        nn_backoff_slots.limit = atoi (envvar);
+}
+
+/*  Returns random number from the interval [0, range]. Low-order bits
+    of the generator are of poor quality, so the high-order ones are used. */
+static int nn_backoff_random (int range)
+{
+    uint64_t rnd;
+
+    nn_random_generate (&rnd, sizeof (rnd));
+    return (int) ((rnd >> 32) % ((uint64_t) range + 1));
+}
+
 void nn_backoff_init (struct nn_backoff *self, int src, int minivl, int maxivl,
     struct nn_fsm *owner)
 {
@@ -29,10 +71,12 @@ void nn_backoff_init (struct nn_backoff *self, int src, int minivl, int maxivl,
     self->minivl = minivl;
     self->maxivl = maxivl;
     self->n = 1;
+    self->slot = 0;
 }
 
 void nn_backoff_term (struct nn_backoff *self)
 {
+    nn_backoff_release (self);
     nn_timer_term (&self->timer);
 }
 
@@ -52,6 +96,9 @@ void nn_backoff_start (struct nn_backoff *self)
          timeout = self->maxivl;
      else
          self->n *= 2;
+
+     /*  Randomise the timeout to spread the reconnection attempts. */
+     timeout -= nn_backoff_random (timeout / 2);
      nn_timer_start (&self->timer, timeout);
 }
 
@@ -65,3 +112,48 @@ void nn_backoff_reset (struct nn_backoff *self)
     self->n = 1;
 }
 
+void nn_backoff_wait (struct nn_backoff *self, int timeout)
+{
+    nn_timer_start (&self->timer, timeout);
+}
+
+
+int nn_backoff_acquire (struct nn_backoff *self)
+{
+    int rc;
+
+    nn_assert (!self->slot);
+    nn_do_once (&nn_backoff_once, nn_backoff_slots_init);
+
+    nn_mutex_lock (&nn_backoff_slots.sync);
+    if (nn_backoff_slots.limit > 0 &&
+          nn_backoff_slots.count >= nn_backoff_slots.limit) {
+        rc = -EAGAIN;
+    }
+    else {
+        ++nn_backoff_slots.count;
+        self->slot = 1;
+        rc = 0;
+    }
+    nn_mutex_unlock (&nn_backoff_slots.sync);
+
+    return rc;
+}
+
+void nn_backoff_throttle (struct nn_backoff *self)
+{
+    /*  Wait at least a millisecond so that throttled endpoints don't spin. */
+    nn_timer_start (&self->timer, 1 + nn_backoff_random (self->minivl));
+}
+
+void nn_backoff_release (struct nn_backoff *self)
+{
+    if (!self->slot)
+        return;
+
+    nn_mutex_lock (&nn_backoff_slots.sync);
+    nn_assert (nn_backoff_slots.count > 0);
+    --nn_backoff_slots.count;
+    nn_mutex_unlock (&nn_backoff_slots.sync);
+    self->slot = 0;
+}
@@ -25,8 +25,11 @@
 
 #include "../../aio/timer.h"
 
-/*  Timer with exponential backoff. Actual wating time is (2^n-1)*minivl,
-    meaning that first wait is 0 ms long, second one is minivl ms long etc. */
+/*  Timer with exponential backoff. Nominal wating time is (2^n-1)*minivl,
+    meaning that first wait is 0 ms long, second one is minivl ms long etc.
+    Actual waiting time is chosen randomly between half of the nominal
+    time and the nominal time so that peers that lost their connections
+    at the same moment don't try to reconnect at the same moment. */
 
 #define NN_BACKOFF_TIMEOUT NN_TIMER_TIMEOUT
 #define NN_BACKOFF_STOPPED NN_TIMER_STOPPED
@@ -36,6 +39,9 @@ struct nn_backoff {
     int minivl;
     int maxivl;
     int n;
+
+    /*  1 if the object holds one of the process-wide connection slots. */
+    int slot;
 };
 
 void nn_backoff_init (struct nn_backoff *self, int src, int minivl, int maxivl,
@@ -48,5 +54,21 @@ void nn_backoff_stop (struct nn_backoff *self);
 
 void nn_backoff_reset (struct nn_backoff *self);
 
+/*  Waits for 'timeout' ms instead of the next interval of the backoff,
+    without advancing it. */
+void nn_backoff_wait (struct nn_backoff *self, int timeout);
+
+/*  Number of connection attempts that may be under way in the process at any
+    given time can be limited using NN_CONNECT_MAX environment variable.
+    nn_backoff_acquire claims one of the slots before the connection attempt
+    is started. If there's no free slot it returns -EAGAIN and the caller
+    should retry later using nn_backoff_throttle. It doesn't advance the
+    backoff and waits for a random time of at most minivl ms. The slot is
+    returned by nn_backoff_release once the attempt succeeds or fails.
+    Releasing an object that holds no slot is a no-op. */
+int nn_backoff_acquire (struct nn_backoff *self);
+void nn_backoff_throttle (struct nn_backoff *self);
+void nn_backoff_release (struct nn_backoff *self);
+
 #endif
 
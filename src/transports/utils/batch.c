@@ -0,0 +1,266 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "batch.h"
+#include "streamhdr.h"
+
+#include "../../utils/err.h"
+#include "../../utils/chunk.h"
+#include "../../utils/fast.h"
+
+#include <string.h>
+
+/*  Maximum length of an encoded message size. Sizes of the messages in
+    a frame never need more than this. */
+#define NN_BATCH_VARINTMAX 3
+
+static void nn_batch_append (struct nn_batch *self, struct nn_msg *msg);
+static size_t nn_batch_putvarint (uint8_t *buf, size_t val);
+static int nn_batch_getvarint (const uint8_t *buf, size_t len, size_t *val);
+
+void nn_batch_init (struct nn_batch *self)
+{
+    self->maxsize = 0;
+    nn_msg_init (&self->first, 0);
+    self->out = NULL;
+    self->outlen = 0;
+    self->outmsgs = 0;
+    nn_chunkref_init (&self->in, 0);
+    self->inpos = 0;
+    self->inmsgs = 0;
+    self->intype = 0;
+}
+
+void nn_batch_term (struct nn_batch *self)
+{
+    nn_batch_reset (self);
+    nn_chunkref_term (&self->in);
+    nn_msg_term (&self->first);
+}
+
+void nn_batch_start (struct nn_batch *self, size_t maxsize, int peerflags)
+{
+    if (maxsize > NN_BATCH_MSGMAX)
+        maxsize = NN_BATCH_MSGMAX;
+    self->maxsize = (peerflags & NN_STREAMHDR_CANBATCH) ? maxsize : 0;
+}
+
+void nn_batch_reset (struct nn_batch *self)
+{
+    if (self->out) {
+        nn_chunk_free (self->out);
+        self->out = NULL;
+    }
+    if (self->outmsgs) {
+        nn_msg_term (&self->first);
+        nn_msg_init (&self->first, 0);
+    }
+    self->outlen = 0;
+    self->outmsgs = 0;
+    nn_chunkref_term (&self->in);
+    nn_chunkref_init (&self->in, 0);
+    self->inpos = 0;
+    self->inmsgs = 0;
+}
+
+int nn_batch_fits (struct nn_batch *self, struct nn_msg *msg)
+{
+    return self->maxsize && msg->nparts == 0 &&
+        nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body) <=
+        self->maxsize;
+}
+
+int nn_batch_add (struct nn_batch *self, struct nn_msg *msg)
+{
+    int rc;
+
+    nn_assert (nn_batch_fits (self, msg));
+
+    /*  There's no point in a frame till there's another message. */
+    if (self->outmsgs == 0) {
+        nn_msg_term (&self->first);
+        nn_msg_mv (&self->first, msg);
+        self->outmsgs = 1;
+        return 0;
+    }
+
+    /*  The frame is allocated at its full size and shrunk once it's
+        closed. */
+    if (!self->out) {
+        rc = nn_chunk_alloc (NN_BATCH_FRAMEMAX, 0, &self->out);
+        errnum_assert (rc == 0, -rc);
+        nn_batch_append (self, &self->first);
+        nn_msg_init (&self->first, 0);
+    }
+    nn_batch_append (self, msg);
+    ++self->outmsgs;
+
+    return self->outlen + NN_BATCH_VARINTMAX + self->maxsize >
+        NN_BATCH_FRAMEMAX;
+}
+
+size_t nn_batch_count (struct nn_batch *self)
+{
+    return self->outmsgs;
+}
+
+int nn_batch_close (struct nn_batch *self, struct nn_msg *frame)
+{
+    int rc;
+
+    if (nn_fast (self->outmsgs == 0))
+        return 0;
+
+    if (self->outmsgs == 1) {
+        nn_msg_mv (frame, &self->first);
+        nn_msg_init (&self->first, 0);
+        self->outmsgs = 0;
+        return NN_BATCH_SINGLE;
+    }
+
+    /*  Shrinking the chunk is done in place. */
+    rc = nn_chunk_realloc (self->outlen, &self->out);
+    errnum_assert (rc == 0, -rc);
+    nn_msg_init_chunk (frame, self->out);
+    self->out = NULL;
+    self->outlen = 0;
+    self->outmsgs = 0;
+
+    return NN_BATCH_FRAME;
+}
+
+int nn_batch_open (struct nn_batch *self, struct nn_msg *frame,
+    int maxsize, int type)
+{
+    int rc;
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    size_t size;
+    size_t msgs;
+
+    nn_assert (self->inmsgs == 0);
+    nn_chunkref_term (&self->in);
+    nn_chunkref_mv (&self->in, &frame->body);
+    nn_chunkref_init (&frame->body, 0);
+
+    /*  Walk the whole frame before any message is handed over, so that
+        a malformed one is refused as a whole. */
+    data = nn_chunkref_data (&self->in);
+    len = nn_chunkref_size (&self->in);
+    pos = 0;
+    msgs = 0;
+    while (pos != len) {
+        rc = nn_batch_getvarint (data + pos, len - pos, &size);
+        if (nn_slow (rc <= 0 || size > len - pos - rc))
+            goto error;
+        if (nn_slow (maxsize >= 0 && size > (unsigned) maxsize)) {
+            nn_batch_reset (self);
+            return -EMSGSIZE;
+        }
+        pos += rc + size;
+        ++msgs;
+    }
+    if (nn_slow (msgs == 0))
+        goto error;
+
+    self->inpos = 0;
+    self->inmsgs = msgs;
+    self->intype = type;
+
+    return 0;
+
+error:
+    nn_batch_reset (self);
+    return -EPROTO;
+}
+
+int nn_batch_next (struct nn_batch *self, struct nn_msg *msg)
+{
+    const uint8_t *data;
+    size_t size;
+
+    if (nn_fast (self->inmsgs == 0))
+        return 0;
+
+    /*  The frame was checked once it arrived. */
+    data = (const uint8_t*) nn_chunkref_data (&self->in) + self->inpos;
+    self->inpos += nn_batch_getvarint (data, NN_BATCH_VARINTMAX, &size);
+    nn_msg_term (msg);
+    nn_msg_init_type (msg, size, self->intype);
+    memcpy (nn_chunkref_data (&msg->body),
+        (const uint8_t*) nn_chunkref_data (&self->in) + self->inpos, size);
+    self->inpos += size;
+
+    /*  Release the frame once it's done with. */
+    if (--self->inmsgs == 0) {
+        nn_chunkref_term (&self->in);
+        nn_chunkref_init (&self->in, 0);
+        self->inpos = 0;
+    }
+
+    return 1;
+}
+
+static void nn_batch_append (struct nn_batch *self, struct nn_msg *msg)
+{
+    uint8_t *pos;
+    size_t sphdrlen;
+    size_t bodylen;
+
+    sphdrlen = nn_chunkref_size (&msg->sphdr);
+    bodylen = nn_chunkref_size (&msg->body);
+    pos = (uint8_t*) self->out + self->outlen;
+    pos += nn_batch_putvarint (pos, sphdrlen + bodylen);
+    memcpy (pos, nn_chunkref_data (&msg->sphdr), sphdrlen);
+    pos += sphdrlen;
+    memcpy (pos, nn_chunkref_data (&msg->body), bodylen);
+    pos += bodylen;
+    self->outlen = pos - (uint8_t*) self->out;
+    nn_msg_term (msg);
+}
+
+static size_t nn_batch_putvarint (uint8_t *buf, size_t val)
+{
+    size_t len;
+
+    len = 0;
+    while (val >= 0x80) {
+        buf [len++] = (uint8_t) (val | 0x80);
+        val >>= 7;
+    }
+    buf [len++] = (uint8_t) val;
+    return len;
+}
+
+static int nn_batch_getvarint (const uint8_t *buf, size_t len, size_t *val)
+{
+    int i;
+
+    *val = 0;
+    for (i = 0; i != NN_BATCH_VARINTMAX && (size_t) i != len; ++i) {
+        *val |= (size_t) (buf [i] & 0x7f) << (7 * i);
+        if (!(buf [i] & 0x80))
+            return i + 1;
+    }
+    return i == NN_BATCH_VARINTMAX ? -1 : 0;
+}
@@ -0,0 +1,117 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_BATCH_INCLUDED
+#define NN_BATCH_INCLUDED
+
+#include "../../utils/msg.h"
+#include "../../utils/chunkref.h"
+
+#include <stddef.h>
+
+/*  Packing of small messages into batch frames on stream connections. Each
+    side able to unpack the frames announces it by NN_STREAMHDR_CANBATCH
+    when the protocol header is exchanged. While a write is in progress, or
+    the messages are corked, the small messages sent in the meantime are
+    appended to a frame rather than queued one by one, each of them preceded
+    by its size encoded as a varint. The frame is queued as a single message
+    once it's full, a message that can't be packed is sent, or the write
+    in progress is done. A lone message is sent as it is. The receiver checks the whole frame in one pass
+    once it arrives and then hands the messages over to the pipe one by one
+    without parsing any further headers. */
+
+/*  Maximum size of a frame. Larger ones are refused by the receiver. */
+#define NN_BATCH_FRAMEMAX 16384
+
+/*  Largest message that can be packed into a frame. */
+#define NN_BATCH_MSGMAX 1024
+
+/*  Values returned by nn_batch_close. */
+#define NN_BATCH_FRAME 1
+#define NN_BATCH_SINGLE 2
+
+struct nn_batch {
+
+    /*  Largest message packed into outbound frames, 0 if they're not
+        used on the connection. */
+    size_t maxsize;
+
+    /*  The first message sent since the last frame was closed. It's packed
+        into a frame once another one follows. */
+    struct nn_msg first;
+
+    /*  Chunk the outbound frame is being filled in, NULL if there's none,
+        the number of bytes used and the number of messages in it,
+        including 'first'. */
+    void *out;
+    size_t outlen;
+    size_t outmsgs;
+
+    /*  Inbound frame, the position of the next message in it and the number
+        of messages left. The messages are allocated from the message
+        pool 'intype'. */
+    struct nn_chunkref in;
+    size_t inpos;
+    size_t inmsgs;
+    int intype;
+};
+
+void nn_batch_init (struct nn_batch *self);
+void nn_batch_term (struct nn_batch *self);
+
+/*  Starts packing the outbound messages of a new connection up to 'maxsize'
+    bytes into frames, provided the peer announced it's able to unpack them
+    in 'peerflags'. Zero 'maxsize' disables the packing. */
+void nn_batch_start (struct nn_batch *self, size_t maxsize, int peerflags);
+
+/*  Drops both the outbound and the inbound frame, if any. */
+void nn_batch_reset (struct nn_batch *self);
+
+/*  Returns 1 if the message can be packed into a frame. */
+int nn_batch_fits (struct nn_batch *self, struct nn_msg *msg);
+
+/*  Appends the message to the outbound frame. The message is terminated.
+    Returns 1 if the frame is now unable to take another message, in which
+    case it should be closed. */
+int nn_batch_add (struct nn_batch *self, struct nn_msg *msg);
+
+/*  Returns the number of messages in the outbound frame. */
+size_t nn_batch_count (struct nn_batch *self);
+
+/*  Moves the outbound frame into 'frame', which must be uninitialised.
+    Returns NN_BATCH_FRAME if it's a batch frame, NN_BATCH_SINGLE if there
+    was only one message, which is then moved into 'frame' as it is, and
+    0 if there were none. */
+int nn_batch_close (struct nn_batch *self, struct nn_msg *frame);
+
+/*  Takes the body of the received frame over, leaving it empty, and checks
+    it. Returns -EPROTO if the frame is malformed and -EMSGSIZE if any of
+    the messages exceeds 'maxsize' bytes (negative 'maxsize' means no limit).
+    The messages are allocated from the message pool 'type'. */
+int nn_batch_open (struct nn_batch *self, struct nn_msg *frame,
+    int maxsize, int type);
+
+/*  Moves the next message of the inbound frame into 'msg', which is
+    terminated first. Returns 0 if the frame has no more messages. */
+int nn_batch_next (struct nn_batch *self, struct nn_msg *msg);
+
+#endif
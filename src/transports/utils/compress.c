@@ -0,0 +1,271 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "compress.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/chunk.h"
+#include "../../utils/chunkref.h"
+#include "../../utils/wire.h"
+#include "../../utils/fast.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+/*  Zstandard level favouring speed over ratio, as the messages are
+    compressed on the fly. */
+#define NN_COMPRESS_ZSTD_LEVEL 1
+
+int nn_compress_supported (void)
+{
+    int algs;
+
+    algs = 0;
+#if defined NN_HAVE_LZ4
+    algs |= NN_COMPRESS_LZ4;
+#endif
+#if defined NN_HAVE_ZSTD
+    algs |= NN_COMPRESS_ZSTD;
+#endif
+    return algs;
+}
+
+void nn_compress_init (struct nn_compress *self)
+{
+    self->alg = 0;
+    self->threshold = 0;
+#if defined NN_HAVE_ZSTD
+    self->cctx = NULL;
+    self->dctx = NULL;
+#endif
+}
+
+void nn_compress_term (struct nn_compress *self)
+{
+#if defined NN_HAVE_ZSTD
+    if (self->cctx)
+        ZSTD_freeCCtx (self->cctx);
+    if (self->dctx)
+        ZSTD_freeDCtx (self->dctx);
+#else
+    nn_assert (self);
+#endif
+}
+
+void nn_compress_start (struct nn_compress *self, int alg, size_t threshold,
+    int peeralgs)
+{
+    nn_assert ((alg & ~nn_compress_supported ()) == 0);
+
+    self->alg = alg & peeralgs;
+    self->threshold = threshold;
+}
+
+int nn_compress_alg (struct nn_compress *self)
+{
+    return self->alg;
+}
+
+int nn_compress_msg (struct nn_compress *self, struct nn_msg *msg,
+    struct nn_msg_frame *frame)
+{
+    int rc;
+    int i;
+    size_t size;
+    size_t sz;
+#if defined NN_HAVE_LZ4 || defined NN_HAVE_ZSTD
+    size_t bound;
+#endif
+    size_t len;
+    uint8_t *src;
+    uint8_t *pos;
+    void *chunk;
+    int urgent;
+
+    size = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    if (nn_fast (!self->alg || size < self->threshold ||
+          size <= NN_COMPRESS_HDRLEN))
+        return 0;
+
+    /*  Another connection has compressed the message with the same
+        algorithm already. */
+    if (frame && frame->alg == self->alg) {
+        if (!frame->compressed)
+            return 0;
+        nn_chunk_addref (frame->compressed, 1);
+        chunk = frame->compressed;
+        goto replace;
+    }
+
+    /*  Only the messages consisting of the body alone are compressed
+        without copying them first. */
+    if (nn_fast (!nn_chunkref_size (&msg->sphdr) && !msg->nparts))
+        src = nn_chunkref_data (&msg->body);
+    else {
+        src = nn_alloc (size, "message to compress");
+        alloc_assert (src);
+        pos = src;
+        sz = nn_chunkref_size (&msg->sphdr);
+        memcpy (pos, nn_chunkref_data (&msg->sphdr), sz);
+        pos += sz;
+        sz = nn_chunkref_size (&msg->body);
+        memcpy (pos, nn_chunkref_data (&msg->body), sz);
+        pos += sz;
+        for (i = 0; i != msg->nparts; ++i) {
+            sz = nn_chunk_size (msg->parts [i]);
+            memcpy (pos, msg->parts [i], sz);
+            pos += sz;
+        }
+    }
+
+    /*  Compress the message right after the header of the new body. */
+    len = 0;
+    chunk = NULL;
+    switch (self->alg) {
+#if defined NN_HAVE_LZ4
+    case NN_COMPRESS_LZ4:
+        if (size > LZ4_MAX_INPUT_SIZE)
+            break;
+        bound = (size_t) LZ4_compressBound ((int) size);
+        rc = nn_chunk_alloc (NN_COMPRESS_HDRLEN + bound, 0, &chunk);
+        errnum_assert (rc == 0, -rc);
+        rc = LZ4_compress_default ((const char*) src,
+            ((char*) chunk) + NN_COMPRESS_HDRLEN, (int) size, (int) bound);
+        if (rc > 0)
+            len = (size_t) rc;
+        break;
+#endif
+#if defined NN_HAVE_ZSTD
+    case NN_COMPRESS_ZSTD:
+        if (!self->cctx) {
+            self->cctx = ZSTD_createCCtx ();
+            alloc_assert (self->cctx);
+        }
+        bound = ZSTD_compressBound (size);
+        rc = nn_chunk_alloc (NN_COMPRESS_HDRLEN + bound, 0, &chunk);
+        errnum_assert (rc == 0, -rc);
+        len = ZSTD_compressCCtx (self->cctx,
+            ((uint8_t*) chunk) + NN_COMPRESS_HDRLEN, bound, src, size,
+            NN_COMPRESS_ZSTD_LEVEL);
+        if (ZSTD_isError (len))
+            len = 0;
+        break;
+#endif
+    default:
+        nn_assert (0);
+    }
+    if (src != nn_chunkref_data (&msg->body))
+        nn_free (src);
+
+    /*  Incompressible data is sent as it is. */
+    if (!len || NN_COMPRESS_HDRLEN + len >= size) {
+        if (chunk)
+            nn_chunk_free (chunk);
+        if (frame && !frame->alg)
+            frame->alg = self->alg;
+        return 0;
+    }
+    nn_putll (chunk, size);
+    rc = nn_chunk_realloc (NN_COMPRESS_HDRLEN + len, &chunk);
+    errnum_assert (rc == 0, -rc);
+    if (frame && !frame->alg) {
+        frame->alg = self->alg;
+        frame->compressed = chunk;
+        nn_chunk_addref (chunk, 1);
+    }
+
+replace:
+    urgent = msg->urgent;
+    nn_msg_term (msg);
+    nn_msg_init_chunk (msg, chunk);
+    msg->urgent = urgent;
+
+    return 1;
+}
+
+int nn_compress_decompress (struct nn_compress *self, int alg,
+    struct nn_chunkref *body, int maxsize, int type)
+{
+    int rc;
+    uint64_t size;
+    size_t len;
+    uint8_t *src;
+    void *chunk;
+
+    /*  Check the size of the original message before allocating memory
+        for it, so that the peer can't make us allocate more than it's
+        allowed to send. */
+    len = nn_chunkref_size (body);
+    if (nn_slow (len <= NN_COMPRESS_HDRLEN ||
+          (alg & nn_compress_supported ()) != alg))
+        return -EPROTO;
+    src = nn_chunkref_data (body);
+    size = nn_getll (src);
+    if (nn_slow (maxsize >= 0 && size > (uint64_t) maxsize))
+        return -EMSGSIZE;
+    if (nn_slow (size < len || size > (size_t) -1))
+        return -EPROTO;
+    src += NN_COMPRESS_HDRLEN;
+    len -= NN_COMPRESS_HDRLEN;
+
+    rc = nn_chunk_alloc ((size_t) size, type, &chunk);
+    errnum_assert (rc == 0, -rc);
+
+    switch (alg) {
+#if defined NN_HAVE_LZ4
+    case NN_COMPRESS_LZ4:
+        if (size > LZ4_MAX_INPUT_SIZE)
+            goto fail;
+        rc = LZ4_decompress_safe ((const char*) src, (char*) chunk,
+            (int) len, (int) size);
+        if (nn_slow (rc < 0 || (uint64_t) rc != size))
+            goto fail;
+        break;
+#endif
+#if defined NN_HAVE_ZSTD
+    case NN_COMPRESS_ZSTD:
+        if (!self->dctx) {
+            self->dctx = ZSTD_createDCtx ();
+            alloc_assert (self->dctx);
+        }
+        len = ZSTD_decompressDCtx (self->dctx, chunk, (size_t) size,
+            src, len);
+        if (nn_slow (ZSTD_isError (len) || len != size))
+            goto fail;
+        break;
+#endif
+    default:
+        goto fail;
+    }
+
+    nn_chunkref_term (body);
+    nn_chunkref_init_chunk (body, chunk);
+    return 0;
+
+fail:
+    nn_chunk_free (chunk);
+    return -EPROTO;
+}
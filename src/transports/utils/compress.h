@@ -0,0 +1,95 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_COMPRESS_INCLUDED
+#define NN_COMPRESS_INCLUDED
+
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+
+#if defined NN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*  Compression of the messages passed over stream connections. Each side
+    announces the algorithms it's able to decompress when the protocol
+    header is exchanged and compresses the messages it sends with the
+    algorithm it's configured to use, provided the peer announced it.
+    Messages are compressed one by one, so that they can be decompressed
+    independently of each other, and only if they are large enough and
+    actually get smaller. */
+
+/*  The algorithms, used as bits of the mask of those supported. The values
+    match those of the NN_TCP_COMPRESS and NN_IPC_COMPRESS options. */
+#define NN_COMPRESS_LZ4 1
+#define NN_COMPRESS_ZSTD 2
+
+/*  Compressed message starts with the size of the original one. */
+#define NN_COMPRESS_HDRLEN 8
+
+struct nn_compress {
+
+    /*  Algorithm outbound messages are compressed with, 0 if they are not,
+        and the size of the smallest message that is. */
+    int alg;
+    size_t threshold;
+
+#if defined NN_HAVE_ZSTD
+    /*  Contexts reused for all the messages of the connection. Created
+        once they are needed. */
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+};
+
+/*  Returns the mask of the algorithms the library was built with. */
+int nn_compress_supported (void);
+
+void nn_compress_init (struct nn_compress *self);
+void nn_compress_term (struct nn_compress *self);
+
+/*  Starts compressing outbound messages of a new connection with 'alg'
+    once the peer announced the algorithms in 'peeralgs'. If the peer is
+    not able to decompress them, the messages are sent as they are. */
+void nn_compress_start (struct nn_compress *self, int alg, size_t threshold,
+    int peeralgs);
+
+/*  Returns the algorithm the outbound messages are compressed with. */
+int nn_compress_alg (struct nn_compress *self);
+
+/*  Compresses the message, header and all, into a new message body if it's
+    worth it. Returns 1 if it was compressed, 0 otherwise, in which case
+    the message is left as it is. If 'frame' isn't NULL, the outcome is
+    reused from, or stored into, the framing shared with other connections
+    the same message is sent to. */
+int nn_compress_msg (struct nn_compress *self, struct nn_msg *msg,
+    struct nn_msg_frame *frame);
+
+/*  Decompresses the message body in place using 'alg'. The new body is
+    allocated from the message pool 'type'. Returns -EMSGSIZE if the
+    original message exceeds 'maxsize' bytes (negative 'maxsize' means no
+    limit) and -EPROTO if the body is not a valid compressed message. */
+int nn_compress_decompress (struct nn_compress *self, int alg,
+    struct nn_chunkref *body, int maxsize, int type);
+
+#endif
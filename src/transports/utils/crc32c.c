@@ -0,0 +1,157 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined __SSE4_2__ || defined __AVX__
+#include <nmmintrin.h>
+#define NN_CRC32C_SSE42
+#elif defined __ARM_FEATURE_CRC32 && !defined __ARM_BIG_ENDIAN
+#include <arm_acle.h>
+#define NN_CRC32C_ARMV8
+#endif
+
+#if defined NN_CRC32C_SSE42
+
+void nn_crc32c_init (void)
+{
+}
+
+uint32_t nn_crc32c (uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *pos;
+#if defined __x86_64__ || defined _M_X64
+    uint64_t crc64;
+    uint64_t word;
+#else
+    uint32_t word;
+#endif
+
+    pos = (const uint8_t*) data;
+    crc = ~crc;
+
+    /*  Data are not necessarily aligned, so the words are accessed via
+        memcpy, which compilers turn into plain loads. */
+#if defined __x86_64__ || defined _M_X64
+    crc64 = crc;
+    for (; len >= sizeof (word); len -= sizeof (word), pos += sizeof (word)) {
+        memcpy (&word, pos, sizeof (word));
+        crc64 = _mm_crc32_u64 (crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#else
+    for (; len >= sizeof (word); len -= sizeof (word), pos += sizeof (word)) {
+        memcpy (&word, pos, sizeof (word));
+        crc = _mm_crc32_u32 (crc, word);
+    }
+#endif
+    for (; len; --len, ++pos)
+        crc = _mm_crc32_u8 (crc, *pos);
+
+    return ~crc;
+}
+
+#elif defined NN_CRC32C_ARMV8
+
+void nn_crc32c_init (void)
+{
+}
+
+uint32_t nn_crc32c (uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *pos;
+    uint64_t word;
+
+    pos = (const uint8_t*) data;
+    crc = ~crc;
+    for (; len >= sizeof (word); len -= sizeof (word), pos += sizeof (word)) {
+        memcpy (&word, pos, sizeof (word));
+        crc = __crc32cd (crc, word);
+    }
+    for (; len; --len, ++pos)
+        crc = __crc32cb (crc, *pos);
+
+    return ~crc;
+}
+
+#else
+
+/*  Reversed CRC-32C polynomial. */
+#define NN_CRC32C_POLY 0x82f63b78
+
+/*  The first table is the usual one, processing a single byte. The k-th one
+    gives the effect of a byte followed by k zero bytes, so that eight bytes
+    are processed by eight independent lookups. */
+static uint32_t nn_crc32c_tables [8] [256];
+
+void nn_crc32c_init (void)
+{
+    int i;
+    int j;
+    uint32_t crc;
+
+    for (i = 0; i != 256; ++i) {
+        crc = (uint32_t) i;
+        for (j = 0; j != 8; ++j)
+            crc = crc & 1 ? (crc >> 1) ^ NN_CRC32C_POLY : crc >> 1;
+        nn_crc32c_tables [0] [i] = crc;
+    }
+    for (i = 0; i != 256; ++i) {
+        crc = nn_crc32c_tables [0] [i];
+        for (j = 1; j != 8; ++j) {
+            crc = (crc >> 8) ^ nn_crc32c_tables [0] [crc & 0xff];
+            nn_crc32c_tables [j] [i] = crc;
+        }
+    }
+}
+
+uint32_t nn_crc32c (uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *pos;
+    uint32_t lo;
+    uint32_t hi;
+
+    pos = (const uint8_t*) data;
+    crc = ~crc;
+    for (; len >= 8; len -= 8, pos += 8) {
+        lo = crc ^ ((uint32_t) pos [0] | ((uint32_t) pos [1] << 8) |
+            ((uint32_t) pos [2] << 16) | ((uint32_t) pos [3] << 24));
+        hi = (uint32_t) pos [4] | ((uint32_t) pos [5] << 8) |
+            ((uint32_t) pos [6] << 16) | ((uint32_t) pos [7] << 24);
+        crc = nn_crc32c_tables [7] [lo & 0xff] ^
+            nn_crc32c_tables [6] [(lo >> 8) & 0xff] ^
+            nn_crc32c_tables [5] [(lo >> 16) & 0xff] ^
+            nn_crc32c_tables [4] [lo >> 24] ^
+            nn_crc32c_tables [3] [hi & 0xff] ^
+            nn_crc32c_tables [2] [(hi >> 8) & 0xff] ^
+            nn_crc32c_tables [1] [(hi >> 16) & 0xff] ^
+            nn_crc32c_tables [0] [hi >> 24];
+    }
+    for (; len; --len, ++pos)
+        crc = (crc >> 8) ^ nn_crc32c_tables [0] [(crc ^ *pos) & 0xff];
+
+    return ~crc;
+}
+
+#endif
@@ -21,10 +21,102 @@
 */
 
 #include "dns.h"
+#include "literal.h"
+
+#include "../../aio/ctx.h"
 
 #include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/attr.h"
+#include "../../utils/alloc.h"
+#include "../../utils/clock.h"
+#include "../../utils/mutex.h"
+#include "../../utils/once.h"
+#include "../../utils/fast.h"
 
 #include <string.h>
+#include <stdlib.h>
+
+#ifndef NN_HAVE_WINDOWS
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+
+#if defined NN_HAVE_GETADDRINFO_A && !defined NN_DISABLE_GETADDRINFO_A
+#include "dns_getaddrinfo_a.h"
+#else
+#include "dns_getaddrinfo.h"
+#endif
+
+#define NN_DNS_STATE_IDLE 1
+#define NN_DNS_STATE_RESOLVING 2
+#define NN_DNS_STATE_DONE 3
+#define NN_DNS_STATE_STOPPING 4
+
+#define NN_DNS_ACTION_DONE 1
+
+/*  Default time to keep the successful and failed lookups, in milliseconds. */
+#define NN_DNS_DEFAULT_TTL 10000
+#define NN_DNS_DEFAULT_NEGATIVE_TTL 1000
+
+/*  Number of cache entries above which the unused ones are recycled. */
+#define NN_DNS_CACHE_SIZE 256
+
+struct nn_dns_entry {
+
+    /*  The name looked up. */
+    char hostname [NN_SOCKADDR_MAX];
+    int ipv4only;
+
+    /*  1 while the lookup is in progress. The objects waiting for it are
+        stored in 'waiters'. */
+    int pending;
+    struct nn_list waiters;
+
+    /*  Result of the last lookup and the time it expires at. */
+    struct nn_dns_result result;
+    uint64_t expires;
+
+    /*  Data used by the resolver while the lookup is in progress. */
+    struct nn_dns_lookup lookup;
+
+    struct nn_list_item item;
+};
+
+/*  Process-wide cache of the lookups. */
+static struct {
+    nn_mutex_t sync;
+    struct nn_list entries;
+    int nentries;
+    int ttl;
+    int negative_ttl;
+} nn_dns_cache;
+
+static nn_once_t nn_dns_once = NN_ONCE_INITIALIZER;
+
+/*  Private functions. */
+static void nn_dns_cache_init (void);
+static struct nn_dns_entry *nn_dns_cache_find (const char *hostname,
+    int ipv4only);
+static void nn_dns_complete (struct nn_dns_entry *entry, int error,
+    const struct addrinfo *reply);
+static void nn_dns_order (struct nn_dns_result *result,
+    const struct addrinfo *reply);
+static int nn_dns_family (const struct addrinfo *ai);
+static const struct addrinfo *nn_dns_next (const struct addrinfo *ai,
+    int family);
+static void nn_dns_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_dns_shutdown_fsm (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+
+/*  Functions provided by the resolver. nn_dns_lookup_start starts looking up
+    the name stored in the entry. Once done, the resolver calls
+    nn_dns_complete from a thread that holds no locks. */
+static void nn_dns_lookup_init (void);
+static void nn_dns_lookup_start (struct nn_dns_entry *entry);
+static void nn_dns_lookup_shutdown (void);
 
 int nn_dns_check_hostname (const char *name, size_t namelen)
 {
@@ -88,6 +180,363 @@ int nn_dns_check_hostname (const char *name, size_t namelen)
     }
 }
 
+static void nn_dns_cache_init (void)
+{
+    char *envvar;
+
+    nn_mutex_init (&nn_dns_cache.sync);
+    nn_list_init (&nn_dns_cache.entries);
+    nn_dns_cache.nentries = 0;
+
+    nn_dns_cache.ttl = NN_DNS_DEFAULT_TTL;
+    envvar = getenv ("NN_DNS_TTL");
+    if (envvar && atoi (envvar) >= 0)
+        nn_dns_cache.ttl = atoi (envvar);
+    nn_dns_cache.negative_ttl = NN_DNS_DEFAULT_NEGATIVE_TTL;
+    envvar = getenv ("NN_DNS_NEGATIVE_TTL");
+    if (envvar && atoi (envvar) >= 0)
+        nn_dns_cache.negative_ttl = atoi (envvar);
+
+    nn_dns_lookup_init ();
+}
+
+/*  Returns the entry for the name, creating one if needed. Must be called
+    with the cache locked. */
+static struct nn_dns_entry *nn_dns_cache_find (const char *hostname,
+    int ipv4only)
+{
+    struct nn_list_item *it;
+    struct nn_dns_entry *entry;
+    struct nn_dns_entry *spare;
+
+    spare = NULL;
+    for (it = nn_list_begin (&nn_dns_cache.entries);
+          it != nn_list_end (&nn_dns_cache.entries);
+          it = nn_list_next (&nn_dns_cache.entries, it)) {
+        entry = nn_cont (it, struct nn_dns_entry, item);
+        if (entry->ipv4only == ipv4only &&
+              strcmp (entry->hostname, hostname) == 0)
+            return entry;
+        if (!spare && !entry->pending)
+            spare = entry;
+    }
+
+    /*  Recycle the least recently added entry unless the cache is small.
+        Entries being looked up can't be recycled, so the cache may grow
+        beyond the limit if there are many lookups in progress. */
+    if (spare && nn_dns_cache.nentries >= NN_DNS_CACHE_SIZE) {
+        entry = spare;
+        nn_list_erase (&nn_dns_cache.entries, &entry->item);
+    }
+    else {
+        entry = nn_alloc (sizeof (struct nn_dns_entry), "dns entry");
+        alloc_assert (entry);
+        nn_list_init (&entry->waiters);
+        nn_list_item_init (&entry->item);
+        ++nn_dns_cache.nentries;
+    }
+    strcpy (entry->hostname, hostname);
+    entry->ipv4only = ipv4only;
+    entry->pending = 0;
+    entry->expires = 0;
+    nn_list_insert (&nn_dns_cache.entries, &entry->item,
+        nn_list_end (&nn_dns_cache.entries));
+
+    return entry;
+}
+
+static void nn_dns_complete (struct nn_dns_entry *entry, int error,
+    const struct addrinfo *reply)
+{
+    struct nn_list waiters;
+    struct nn_list_item *it;
+    struct nn_dns *dns;
+
+    nn_mutex_lock (&nn_dns_cache.sync);
+
+    /*  Store the result. */
+    entry->result.error = error;
+    if (!error)
+        nn_dns_order (&entry->result, reply);
+    entry->expires = nn_clock_ms () + (error ? nn_dns_cache.negative_ttl :
+        nn_dns_cache.ttl);
+    entry->pending = 0;
+
+    /*  Pass the result to the waiting objects and detach them from the
+        entry. From now on each of them stays around until it is notified,
+        even if it is asked to stop in the meantime. */
+    nn_list_init (&waiters);
+    while (!nn_list_empty (&entry->waiters)) {
+        it = nn_list_begin (&entry->waiters);
+        dns = nn_cont (it, struct nn_dns, item);
+        nn_list_erase (&entry->waiters, it);
+        memcpy (dns->result, &entry->result, sizeof (struct nn_dns_result));
+        dns->entry = NULL;
+        nn_list_insert (&waiters, it, nn_list_end (&waiters));
+    }
+
+    nn_mutex_unlock (&nn_dns_cache.sync);
+
+    /*  Notify them, each within its own context. */
+    while (!nn_list_empty (&waiters)) {
+        it = nn_list_begin (&waiters);
+        dns = nn_cont (it, struct nn_dns, item);
+        nn_list_erase (&waiters, it);
+        nn_ctx_enter (dns->fsm.ctx);
+        nn_fsm_action (&dns->fsm, NN_DNS_ACTION_DONE);
+        nn_ctx_leave (dns->fsm.ctx);
+    }
+}
+
+/*  Copies the addresses from the reply to the result, alternating between
+    IPv6 and IPv4 ones (RFC 8305, section 4) so that if one of the families
+    doesn't work, the connection attempts fall back to the other one early. */
+static void nn_dns_order (struct nn_dns_result *result,
+    const struct addrinfo *reply)
+{
+    const struct addrinfo *next [2];
+    const struct addrinfo *ai;
+    int family;
+
+    next [0] = nn_dns_next (reply, 0);
+    next [1] = nn_dns_next (reply, 1);
+    family = nn_dns_family (reply);
+    result->naddrs = 0;
+    while (result->naddrs < NN_DNS_MAXADDRS) {
+        if (!next [family])
+            family = !family;
+        ai = next [family];
+        if (!ai)
+            break;
+        next [family] = nn_dns_next (ai->ai_next, family);
+        family = !family;
+
+        nn_assert (ai->ai_addrlen <= sizeof (struct sockaddr_storage));
+        memcpy (&result->addrs [result->naddrs], ai->ai_addr, ai->ai_addrlen);
+        result->addrlens [result->naddrs] = (size_t) ai->ai_addrlen;
+        ++result->naddrs;
+    }
+    nn_assert (result->naddrs > 0);
+}
+
+/*  Returns 1 for native IPv6 addresses, 0 for IPv4 and IPv4-mapped ones. */
+static int nn_dns_family (const struct addrinfo *ai)
+{
+    const struct sockaddr_in6 *in6;
+
+    if (ai->ai_family != AF_INET6)
+        return 0;
+    in6 = (const struct sockaddr_in6*) ai->ai_addr;
+    return IN6_IS_ADDR_V4MAPPED (&in6->sin6_addr) ? 0 : 1;
+}
+
+/*  Returns the first address of the family in the list, if any. */
+static const struct addrinfo *nn_dns_next (const struct addrinfo *ai,
+    int family)
+{
+    while (ai && nn_dns_family (ai) != family)
+        ai = ai->ai_next;
+    return ai;
+}
+
+void nn_dns_init (struct nn_dns *self, int src, struct nn_fsm *owner)
+{
+    nn_fsm_init (&self->fsm, nn_dns_handler, nn_dns_shutdown_fsm,
+        src, self, owner);
+    self->state = NN_DNS_STATE_IDLE;
+    self->result = NULL;
+    self->entry = NULL;
+    nn_list_item_init (&self->item);
+    self->waiting = 0;
+    nn_fsm_event_init (&self->done);
+}
+
+void nn_dns_term (struct nn_dns *self)
+{
+    nn_assert_state (self, NN_DNS_STATE_IDLE);
+
+    nn_fsm_event_term (&self->done);
+    nn_list_item_term (&self->item);
+    nn_fsm_term (&self->fsm);
+}
+
+int nn_dns_isidle (struct nn_dns *self)
+{
+    return nn_fsm_isidle (&self->fsm);
+}
+
+void nn_dns_start (struct nn_dns *self, const char *addr, size_t addrlen,
+    int ipv4only, struct nn_dns_result *result)
+{
+    int rc;
+    char hostname [NN_SOCKADDR_MAX];
+    struct nn_dns_entry *entry;
+    int lookup;
+
+    nn_assert_state (self, NN_DNS_STATE_IDLE);
+
+    self->result = result;
+    self->waiting = 0;
+
+    /*  Try to resolve the supplied string as a literal address. In this case,
+        there's no DNS lookup involved. */
+    rc = nn_literal_resolve (addr, addrlen, ipv4only, &self->result->addrs [0],
+        &self->result->addrlens [0]);
+    if (rc == 0) {
+        self->result->error = 0;
+        self->result->naddrs = 1;
+        nn_fsm_start (&self->fsm);
+        return;
+    }
+    errnum_assert (rc == -EINVAL, -rc);
+
+    /*  Make a zero-terminated copy of the address string. */
+    nn_assert (sizeof (hostname) > addrlen);
+    memcpy (hostname, addr, addrlen);
+    hostname [addrlen] = 0;
+
+    nn_do_once (&nn_dns_once, nn_dns_cache_init);
+    nn_mutex_lock (&nn_dns_cache.sync);
+    entry = nn_dns_cache_find (hostname, ipv4only);
+
+    /*  Use the cached result if it's still valid. */
+    if (!entry->pending && entry->expires > nn_clock_ms ()) {
+        memcpy (self->result, &entry->result, sizeof (struct nn_dns_result));
+        nn_mutex_unlock (&nn_dns_cache.sync);
+        nn_fsm_start (&self->fsm);
+        return;
+    }
+
+    /*  Wait for the lookup, starting it unless it's already under way. */
+    lookup = !entry->pending;
+    entry->pending = 1;
+    self->entry = entry;
+    self->waiting = 1;
+    nn_list_insert (&entry->waiters, &self->item,
+        nn_list_end (&entry->waiters));
+    self->result->error = EINPROGRESS;
+    nn_mutex_unlock (&nn_dns_cache.sync);
+
+    if (lookup)
+        nn_dns_lookup_start (entry);
+    nn_fsm_start (&self->fsm);
+}
+
+void nn_dns_stop (struct nn_dns *self)
+{
+    nn_fsm_stop (&self->fsm);
+}
+
+void nn_dns_shutdown (void)
+{
+    nn_do_once (&nn_dns_once, nn_dns_cache_init);
+    nn_dns_lookup_shutdown ();
+}
+
+static void nn_dns_shutdown_fsm (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_dns *dns;
+    int waiting;
+
+    dns = nn_cont (self, struct nn_dns, fsm);
+
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        if (dns->state == NN_DNS_STATE_RESOLVING) {
+
+            /*  Stop waiting for the lookup. If the result is already on its
+                way, wait for it to arrive. The lookup itself goes on and its
+                result is cached. */
+            nn_mutex_lock (&nn_dns_cache.sync);
+            waiting = dns->entry != NULL;
+            if (waiting) {
+                nn_list_erase (&dns->entry->waiters, &dns->item);
+                dns->entry = NULL;
+            }
+            nn_mutex_unlock (&nn_dns_cache.sync);
+            if (!waiting) {
+                dns->state = NN_DNS_STATE_STOPPING;
+                return;
+            }
+        }
+        nn_fsm_stopped (&dns->fsm, NN_DNS_STOPPED);
+        dns->state = NN_DNS_STATE_IDLE;
+        return;
+    }
+    if (nn_slow (dns->state == NN_DNS_STATE_STOPPING)) {
+        if (src == NN_FSM_ACTION && type == NN_DNS_ACTION_DONE) {
+            nn_fsm_stopped (&dns->fsm, NN_DNS_STOPPED);
+            dns->state = NN_DNS_STATE_IDLE;
+            return;
+        }
+        return;
+    }
+
+    nn_fsm_bad_state (dns->state, src, type);
+}
+
+static void nn_dns_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_dns *dns;
+
+    dns = nn_cont (self, struct nn_dns, fsm);
+
+    switch (dns->state) {
+/******************************************************************************/
+/*  IDLE state.                                                               */
+/******************************************************************************/
+    case NN_DNS_STATE_IDLE:
+        switch (src) {
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_FSM_START:
+                if (dns->waiting) {
+                    dns->state = NN_DNS_STATE_RESOLVING;
+                    return;
+                }
+                nn_fsm_raise (&dns->fsm, &dns->done, NN_DNS_DONE);
+                dns->state = NN_DNS_STATE_DONE;
+                return;
+            default:
+                nn_fsm_bad_action (dns->state, src, type);
+            }
+        default:
+            nn_fsm_bad_source (dns->state, src, type);
+        }
+
+/******************************************************************************/
+/*  RESOLVING state.                                                          */
+/******************************************************************************/
+    case NN_DNS_STATE_RESOLVING:
+        switch (src) {
+        case NN_FSM_ACTION:
+            switch (type) {
+            case NN_DNS_ACTION_DONE:
+                nn_fsm_raise (&dns->fsm, &dns->done, NN_DNS_DONE);
+                dns->state = NN_DNS_STATE_DONE;
+                return;
+            default:
+                nn_fsm_bad_action (dns->state, src, type);
+            }
+        default:
+            nn_fsm_bad_source (dns->state, src, type);
+        }
+
+/******************************************************************************/
+/*  DONE state.                                                               */
+/******************************************************************************/
+    case NN_DNS_STATE_DONE:
+        nn_fsm_bad_source (dns->state, src, type);
+
+/******************************************************************************/
+/*  Invalid state.                                                            */
+/******************************************************************************/
+    default:
+        nn_fsm_bad_state (dns->state, src, type);
+    }
+}
+
 #if defined NN_HAVE_GETADDRINFO_A && !defined NN_DISABLE_GETADDRINFO_A
 #include "dns_getaddrinfo_a.inc"
 #else
@@ -35,16 +35,51 @@ int nn_dns_check_hostname (const char *name, size_t namelen);
 #define NN_DNS_DONE 1
 #define NN_DNS_STOPPED 2
 
-#if defined NN_HAVE_GETADDRINFO_A && !defined NN_DISABLE_GETADDRINFO_A
-#include "dns_getaddrinfo_a.h"
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
 #else
-#include "dns_getaddrinfo.h"
+#include <sys/socket.h>
 #endif
 
+#include "../../utils/list.h"
+
+/*  Results of the lookups are cached process-wide, both successful and
+    failed ones, for the time given by NN_DNS_TTL and NN_DNS_NEGATIVE_TTL
+    environment variables respectively. Concurrent lookups of the same name
+    are merged into one. The lookup itself never blocks the calling thread.
+
+    Up to NN_DNS_MAXADDRS addresses are kept per name. They are ordered as
+    recommended by RFC 8305, i.e. the address families alternate, starting
+    with the family of the first address returned by the resolver. Unless
+    only IPv4 is used, IPv4 addresses are returned as IPv4-mapped IPv6 ones. */
+
+#define NN_DNS_MAXADDRS 8
+
 struct nn_dns_result {
     int error;
-    struct sockaddr_storage addr;
-    size_t addrlen;
+    int naddrs;
+    struct sockaddr_storage addrs [NN_DNS_MAXADDRS];
+    size_t addrlens [NN_DNS_MAXADDRS];
+};
+
+struct nn_dns_entry;
+
+struct nn_dns {
+    struct nn_fsm fsm;
+    int state;
+    struct nn_dns_result *result;
+
+    /*  Cache entry whose lookup the object waits for, if any, and the item
+        in its list of waiters. Both are guarded by the cache lock. */
+    struct nn_dns_entry *entry;
+    struct nn_list_item item;
+
+    /*  1 if the result is to be delivered by the resolver. The resolver may
+        store it before the state machine is even started, so the result
+        itself can't tell. */
+    int waiting;
+
+    struct nn_fsm_event done;
 };
 
 void nn_dns_init (struct nn_dns *self, int src, struct nn_fsm *owner);
@@ -55,4 +90,8 @@ void nn_dns_start (struct nn_dns *self, const char *addr, size_t addrlen,
     int ipv4only, struct nn_dns_result *result);
 void nn_dns_stop (struct nn_dns *self);
 
+/*  Stops the background resolver, if any. Meant to be called when the
+    library is terminated. */
+void nn_dns_shutdown (void);
+
 #endif
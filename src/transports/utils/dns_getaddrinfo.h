@@ -20,16 +20,10 @@
     IN THE SOFTWARE.
 */
 
-#if defined NN_HAVE_WINDOWS
-#include "../../utils/win.h"
-#else
-#include <sys/socket.h>
-#endif
+#include "../../utils/queue.h"
 
-struct nn_dns {
-    struct nn_fsm fsm;
-    int state;
-    struct nn_dns_result *result;
-    struct nn_fsm_event done;
-};
+/*  Lookups are queued for a background thread that calls getaddrinfo. */
 
+struct nn_dns_lookup {
+    struct nn_queue_item item;
+};
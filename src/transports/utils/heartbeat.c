@@ -0,0 +1,176 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "heartbeat.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+
+/*  Longest interval the peer may announce, in milliseconds. */
+#define NN_HEARTBEAT_MAXIVL 3600000
+
+void nn_heartbeat_init (struct nn_heartbeat *self, int src,
+    struct nn_fsm *owner)
+{
+    nn_timer_init (&self->timer, src, owner);
+    self->ivl = 0;
+    self->peerivl = 0;
+    self->idle = 0;
+    self->tick = 0;
+    self->peercan = 0;
+    self->active = 0;
+    self->sent = 0;
+    self->received = 0;
+    self->traffic = 0;
+    self->silence = 0;
+    self->quiet = 0;
+}
+
+void nn_heartbeat_term (struct nn_heartbeat *self)
+{
+    nn_timer_term (&self->timer);
+}
+
+int nn_heartbeat_isidle (struct nn_heartbeat *self)
+{
+    return nn_timer_isidle (&self->timer);
+}
+
+int nn_heartbeat_start (struct nn_heartbeat *self, int ivl, int peercan,
+    int idle)
+{
+    nn_assert (ivl >= 0 && idle >= 0);
+
+    self->ivl = ivl;
+    self->peerivl = 0;
+    self->idle = idle;
+    self->peercan = peercan;
+    self->sent = 0;
+    self->received = 0;
+    self->traffic = 0;
+    self->silence = 0;
+    self->quiet = 0;
+    if (!ivl && !idle)
+        return 0;
+
+    /*  Without heartbeats, the timer fires often enough for the connection
+        to be closed soon after the idle timeout. */
+    self->tick = ivl;
+    if (idle && (!self->tick || idle < self->tick))
+        self->tick = ivl ? idle :
+            (idle + NN_HEARTBEAT_IDLE_TICKS - 1) / NN_HEARTBEAT_IDLE_TICKS;
+
+    /*  The timer may still be winding down if the connection was broken
+        shortly before. It's started once it's done. */
+    self->active = 1;
+    if (nn_timer_isidle (&self->timer))
+        nn_timer_start (&self->timer, self->tick);
+
+    return ivl && peercan ? NN_HEARTBEAT_SEND : 0;
+}
+
+void nn_heartbeat_stop (struct nn_heartbeat *self)
+{
+    self->active = 0;
+    nn_timer_stop (&self->timer);
+}
+
+int nn_heartbeat_event (struct nn_heartbeat *self, int type, int listening)
+{
+    int rc;
+
+    /*  The timer is restarted once it's stopped. */
+    if (type == NN_TIMER_TIMEOUT) {
+        nn_timer_stop (&self->timer);
+        return 0;
+    }
+    nn_assert (type == NN_TIMER_STOPPED);
+    if (!self->active)
+        return 0;
+
+    /*  Silence is only measured when there's something to hear. */
+    if (self->received || !listening || !self->peerivl)
+        self->silence = 0;
+    else {
+        self->silence += self->tick;
+        if (self->silence >= NN_HEARTBEAT_MISSED * self->peerivl) {
+            self->active = 0;
+            return NN_HEARTBEAT_DEAD;
+        }
+    }
+    self->received = 0;
+
+    /*  Likewise, a connection isn't idle while a received message waits
+        for the user to pick it up. */
+    if (self->traffic || !listening || !self->idle)
+        self->quiet = 0;
+    else {
+        self->quiet += self->tick;
+        if (self->quiet >= self->idle) {
+            self->active = 0;
+            return NN_HEARTBEAT_IDLE;
+        }
+    }
+    self->traffic = 0;
+    nn_timer_start (&self->timer, self->tick);
+
+    /*  The peer hears from us anyway if anything was written since
+        the timer last fired. */
+    rc = self->ivl && !self->sent && self->peercan ? NN_HEARTBEAT_SEND : 0;
+    self->sent = 0;
+
+    return rc;
+}
+
+void nn_heartbeat_sent (struct nn_heartbeat *self)
+{
+    self->sent = 1;
+}
+
+void nn_heartbeat_received (struct nn_heartbeat *self)
+{
+    self->received = 1;
+}
+
+void nn_heartbeat_traffic (struct nn_heartbeat *self)
+{
+    self->traffic = 1;
+}
+
+void nn_heartbeat_put (struct nn_heartbeat *self, uint8_t *buf)
+{
+    nn_putl (buf, (uint32_t) self->ivl);
+}
+
+int nn_heartbeat_get (struct nn_heartbeat *self, const uint8_t *buf)
+{
+    uint32_t ivl;
+
+    ivl = nn_getl (buf);
+    if (nn_slow (ivl > NN_HEARTBEAT_MAXIVL))
+        return -EPROTO;
+    self->peerivl = (int) ivl;
+    self->received = 1;
+
+    return 0;
+}
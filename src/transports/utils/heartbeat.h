@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_HEARTBEAT_INCLUDED
+#define NN_HEARTBEAT_INCLUDED
+
+#include "../../aio/timer.h"
+
+#include <stdint.h>
+
+/*  Keeps track of whether the peer is still there, as set by NN_HEARTBEAT_IVL
+    option. Once a connection is established, each side that has the option
+    set tells the peer how often it's going to send heartbeats. It then sends
+    one every interval in which nothing else was written to the connection.
+    If a peer that announced its interval is silent for NN_HEARTBEAT_MISSED
+    of them while the connection is waiting for a message to arrive, it's
+    considered gone and the connection is dropped, so that the messages are
+    routed elsewhere rather than waiting for TCP keepalives.
+
+    The same timer closes connections of bound endpoints that have carried
+    no messages in either direction for NN_IDLE_TIMEOUT, so that idle peers
+    don't hold on to the resources of the connections.
+
+    The timer is driven by the owner: the events it raises are passed to
+    nn_heartbeat_event, which restarts it and tells the owner what to do. */
+
+#define NN_HEARTBEAT_SEND 1
+#define NN_HEARTBEAT_DEAD 2
+#define NN_HEARTBEAT_IDLE 3
+
+/*  Number of the peer's intervals it may be silent for. */
+#define NN_HEARTBEAT_MISSED 3
+
+/*  Number of times the timer fires during the idle timeout if there are no
+    heartbeats to send. */
+#define NN_HEARTBEAT_IDLE_TICKS 4
+
+/*  Size of the body of a heartbeat frame, which carries the interval of
+    the sender in milliseconds. */
+#define NN_HEARTBEAT_SIZE 4
+
+struct nn_heartbeat {
+    struct nn_timer timer;
+
+    /*  Interval of our heartbeats and of the peer's ones, 0 if they are not
+        sent. */
+    int ivl;
+    int peerivl;
+
+    /*  Idle timeout, 0 if there's none, and the period of the timer. */
+    int idle;
+    int tick;
+
+    /*  1 if the peer recognises heartbeat frames. */
+    int peercan;
+
+    /*  1 while the timer is restarted each time it fires. */
+    int active;
+
+    /*  Set when something is written to the connection or received from it
+        and cleared each time the timer fires. */
+    int sent;
+    int received;
+
+    /*  Set when a message is sent or received and cleared each time the
+        timer fires. */
+    int traffic;
+
+    /*  For how long, in milliseconds, nothing was received from the peer,
+        and for how long no messages were passed at all. */
+    int silence;
+    int quiet;
+};
+
+void nn_heartbeat_init (struct nn_heartbeat *self, int src,
+    struct nn_fsm *owner);
+void nn_heartbeat_term (struct nn_heartbeat *self);
+
+int nn_heartbeat_isidle (struct nn_heartbeat *self);
+
+/*  Starts watching the connection. 'idle' is the idle timeout, 0 if the
+    connection is not to be closed for being idle. Returns NN_HEARTBEAT_SEND
+    if our interval is to be announced to the peer straight away, 0
+    otherwise. */
+int nn_heartbeat_start (struct nn_heartbeat *self, int ivl, int peercan,
+    int idle);
+void nn_heartbeat_stop (struct nn_heartbeat *self);
+
+/*  Handles an event raised by the timer. 'listening' is 1 if the owner is
+    waiting for the next message to arrive; the time spent otherwise, e.g.
+    while the user is not picking up the messages, doesn't count as silence.
+    Returns NN_HEARTBEAT_SEND if a heartbeat is to be sent, NN_HEARTBEAT_DEAD
+    if the connection is to be dropped, NN_HEARTBEAT_IDLE if it is to be
+    closed for being idle, 0 otherwise. */
+int nn_heartbeat_event (struct nn_heartbeat *self, int type, int listening);
+
+/*  Records that data was written to the connection or received from it. */
+void nn_heartbeat_sent (struct nn_heartbeat *self);
+void nn_heartbeat_received (struct nn_heartbeat *self);
+
+/*  Records that a message was handed over to the connection or picked up
+    from it. */
+void nn_heartbeat_traffic (struct nn_heartbeat *self);
+
+/*  Fills in the body of a heartbeat frame, or parses the one received from
+    the peer. Returns -EPROTO if the latter makes no sense. */
+void nn_heartbeat_put (struct nn_heartbeat *self, uint8_t *buf);
+int nn_heartbeat_get (struct nn_heartbeat *self, const uint8_t *buf);
+
+#endif
@@ -0,0 +1,410 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "outq.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+
+#include <string.h>
+
+/*  Message waiting in the backlog, along with its transport header. */
+struct nn_outq_item {
+    struct nn_queue_item item;
+    uint8_t hdr [NN_OUTQ_HDRMAX];
+    size_t hdrlen;
+    size_t size;
+    int ref;
+    struct nn_msg msg;
+};
+
+static void nn_outq_batch_init (struct nn_outq_batch *self);
+static void nn_outq_batch_term (struct nn_outq_batch *self,
+    void (*dtor) (struct nn_msg*));
+static void nn_outq_batch_reset (struct nn_outq_batch *self,
+    void (*dtor) (struct nn_msg*));
+static int nn_outq_batch_full (struct nn_outq_batch *self);
+static uint8_t *nn_outq_batch_add (struct nn_outq_batch *self,
+    const uint8_t *hdr, size_t hdrlen, struct nn_msg *msg, int copy);
+static uint8_t *nn_outq_copy (uint8_t *pos, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg);
+static void nn_outq_backlog (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg, int ref);
+static void nn_outq_refill (struct nn_outq *self);
+
+void nn_outq_init (struct nn_outq *self)
+{
+    nn_outq_batch_init (&self->batches [0]);
+    nn_outq_batch_init (&self->batches [1]);
+    self->pending = 0;
+    self->busy = 0;
+    nn_queue_init (&self->backlog);
+    self->backlog_msgs = 0;
+    self->backlog_bytes = 0;
+    self->maxmsgs = 0;
+    self->maxbytes = 0;
+    self->dtor = nn_msg_term;
+}
+
+void nn_outq_term (struct nn_outq *self)
+{
+    struct nn_queue_item *it;
+    struct nn_outq_item *item;
+
+    while ((it = nn_queue_pop (&self->backlog)) != NULL) {
+        item = nn_cont (it, struct nn_outq_item, item);
+        nn_queue_item_term (&item->item);
+        self->dtor (&item->msg);
+        nn_free (item);
+    }
+    nn_queue_term (&self->backlog);
+    nn_outq_batch_term (&self->batches [1], self->dtor);
+    nn_outq_batch_term (&self->batches [0], self->dtor);
+}
+
+void nn_outq_setlimits (struct nn_outq *self, size_t maxmsgs,
+    size_t maxbytes)
+{
+    self->maxmsgs = maxmsgs;
+    self->maxbytes = maxbytes;
+}
+
+void nn_outq_setdtor (struct nn_outq *self, void (*dtor) (struct nn_msg *msg))
+{
+    self->dtor = dtor;
+}
+
+uint8_t *nn_outq_push (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg)
+{
+    struct nn_outq_batch *batch;
+
+    nn_assert (hdrlen <= NN_OUTQ_HDRMAX);
+    batch = &self->batches [self->pending];
+
+    /*  If the pending batch is closed, or there are older messages waiting,
+        the message goes to the backlog. */
+    if (nn_slow (batch->hasmsg || !nn_queue_empty (&self->backlog))) {
+        nn_outq_backlog (self, hdr, hdrlen, msg, 0);
+        return NULL;
+    }
+
+    /*  If there's no write in progress, the message is going to be sent
+        straight away. There's no point in copying it. */
+    return nn_outq_batch_add (batch, hdr, hdrlen, msg, self->busy);
+}
+
+void nn_outq_pushref (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg)
+{
+    struct nn_outq_batch *batch;
+
+    nn_assert (hdrlen <= NN_OUTQ_HDRMAX);
+    batch = &self->batches [self->pending];
+
+    if (nn_slow (batch->hasmsg || !nn_queue_empty (&self->backlog))) {
+        nn_outq_backlog (self, hdr, hdrlen, msg, 1);
+        return;
+    }
+    nn_outq_batch_add (batch, hdr, hdrlen, msg, 0);
+}
+
+uint8_t *nn_outq_pushurgent (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg)
+{
+    struct nn_outq_batch *batch;
+    size_t size;
+    uint8_t *payload;
+
+    nn_assert (hdrlen <= NN_OUTQ_HDRMAX);
+    batch = &self->batches [self->pending];
+
+    /*  If there's nothing to overtake, the message is queued as usual.
+        The same applies if overtaking would split a message in two, or if
+        the message is too large to be copied. */
+    size = hdrlen + nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    if (!nn_outq_haspending (self) || batch->cont ||
+          size > NN_OUTQ_COPYMAX || batch->urglen + size > NN_OUTQ_BUFSZ)
+        return nn_outq_push (self, hdr, hdrlen, msg);
+
+    if (!batch->urgbuf) {
+        batch->urgbuf = nn_alloc_class (NN_OUTQ_BUFSZ, NN_ALLOC_IOBUF,
+            "outbound urgent batch");
+        alloc_assert (batch->urgbuf);
+    }
+    payload = nn_outq_copy (batch->urgbuf + batch->urglen, hdr, hdrlen, msg);
+    batch->urglen += size;
+    ++batch->nmsgs;
+
+    return payload;
+}
+
+int nn_outq_full (struct nn_outq *self)
+{
+    if (!nn_outq_batch_full (&self->batches [self->pending]))
+        return 0;
+    return self->backlog_msgs >= self->maxmsgs ||
+        (self->maxbytes && self->backlog_bytes >= self->maxbytes);
+}
+
+int nn_outq_busy (struct nn_outq *self)
+{
+    return self->busy;
+}
+
+int nn_outq_haspending (struct nn_outq *self)
+{
+    struct nn_outq_batch *batch;
+
+    batch = &self->batches [self->pending];
+    return batch->hasmsg || batch->len || batch->urglen;
+}
+
+size_t nn_outq_count (struct nn_outq *self)
+{
+    return self->batches [0].nmsgs + self->batches [1].nmsgs +
+        self->backlog_msgs;
+}
+
+int nn_outq_start (struct nn_outq *self, struct nn_iovec *iov)
+{
+    struct nn_outq_batch *batch;
+    int iovcnt;
+    int i;
+
+    nn_assert (!self->busy);
+    batch = &self->batches [self->pending];
+    self->pending = !self->pending;
+    self->busy = 1;
+    nn_outq_refill (self);
+
+    iovcnt = 0;
+    if (batch->urglen) {
+        iov [iovcnt].iov_base = batch->urgbuf;
+        iov [iovcnt].iov_len = batch->urglen;
+        ++iovcnt;
+    }
+    if (batch->len) {
+        iov [iovcnt].iov_base = batch->buf;
+        iov [iovcnt].iov_len = batch->len;
+        ++iovcnt;
+    }
+    if (batch->hasmsg) {
+        iov [iovcnt].iov_base = batch->hdr;
+        iov [iovcnt].iov_len = batch->hdrlen;
+        ++iovcnt;
+        iov [iovcnt].iov_base = nn_chunkref_data (&batch->msg.sphdr);
+        iov [iovcnt].iov_len = nn_chunkref_size (&batch->msg.sphdr);
+        ++iovcnt;
+        iov [iovcnt].iov_base = nn_chunkref_data (&batch->msg.body);
+        iov [iovcnt].iov_len = nn_chunkref_size (&batch->msg.body);
+        ++iovcnt;
+        for (i = 0; i != batch->msg.nparts; ++i) {
+            iov [iovcnt].iov_base = batch->msg.parts [i];
+            iov [iovcnt].iov_len = nn_chunk_size (batch->msg.parts [i]);
+            ++iovcnt;
+        }
+    }
+    nn_assert (iovcnt <= NN_OUTQ_MAXIOV);
+
+    return iovcnt;
+}
+
+struct nn_msg *nn_outq_msg (struct nn_outq *self)
+{
+    struct nn_outq_batch *batch;
+
+    nn_assert (self->busy);
+    batch = &self->batches [!self->pending];
+    return batch->hasmsg ? &batch->msg : NULL;
+}
+
+void nn_outq_detach (struct nn_outq *self, struct nn_msg *msg)
+{
+    struct nn_outq_batch *batch;
+
+    nn_assert (self->busy);
+    batch = &self->batches [!self->pending];
+    nn_assert (batch->hasmsg);
+    nn_msg_mv (msg, &batch->msg);
+    nn_msg_init (&batch->msg, 0);
+    batch->hasmsg = 0;
+}
+
+void nn_outq_done (struct nn_outq *self)
+{
+    nn_assert (self->busy);
+    nn_outq_batch_reset (&self->batches [!self->pending], self->dtor);
+    self->busy = 0;
+}
+
+static void nn_outq_batch_init (struct nn_outq_batch *self)
+{
+    self->urgbuf = NULL;
+    self->urglen = 0;
+    self->buf = NULL;
+    self->len = 0;
+    self->hasmsg = 0;
+    self->hdrlen = 0;
+    nn_msg_init (&self->msg, 0);
+    self->nmsgs = 0;
+    self->cont = 0;
+}
+
+static void nn_outq_batch_term (struct nn_outq_batch *self,
+    void (*dtor) (struct nn_msg*))
+{
+    if (self->hasmsg)
+        dtor (&self->msg);
+    else
+        nn_msg_term (&self->msg);
+    if (self->buf)
+        nn_free (self->buf);
+    if (self->urgbuf)
+        nn_free (self->urgbuf);
+}
+
+static void nn_outq_batch_reset (struct nn_outq_batch *self,
+    void (*dtor) (struct nn_msg*))
+{
+    self->urglen = 0;
+    self->len = 0;
+    self->nmsgs = 0;
+    self->cont = 0;
+    if (self->hasmsg) {
+        dtor (&self->msg);
+        nn_msg_init (&self->msg, 0);
+        self->hasmsg = 0;
+    }
+}
+
+static void nn_outq_backlog (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg, int ref)
+{
+    struct nn_outq_item *item;
+
+    nn_assert (self->busy);
+    nn_assert (self->backlog_msgs <= self->maxmsgs);
+    item = nn_alloc_class (sizeof (struct nn_outq_item),
+        NN_ALLOC_QUEUE, "outbound message");
+    alloc_assert (item);
+    nn_queue_item_init (&item->item);
+    memcpy (item->hdr, hdr, hdrlen);
+    item->hdrlen = hdrlen;
+    item->size = hdrlen + nn_chunkref_size (&msg->sphdr) +
+        nn_msg_bodysize (msg);
+    item->ref = ref;
+    nn_msg_mv (&item->msg, msg);
+    nn_queue_push (&self->backlog, &item->item);
+    ++self->backlog_msgs;
+    self->backlog_bytes += item->size;
+}
+
+static void nn_outq_refill (struct nn_outq *self)
+{
+    struct nn_outq_batch *batch;
+    struct nn_queue_item *it;
+    struct nn_outq_item *item;
+
+    batch = &self->batches [self->pending];
+    while (!batch->hasmsg) {
+        it = nn_queue_pop (&self->backlog);
+        if (!it)
+            return;
+        item = nn_cont (it, struct nn_outq_item, item);
+        --self->backlog_msgs;
+        self->backlog_bytes -= item->size;
+        nn_outq_batch_add (batch, item->hdr, item->hdrlen, &item->msg,
+            !item->ref);
+        nn_queue_item_term (&item->item);
+        nn_free (item);
+    }
+}
+
+static int nn_outq_batch_full (struct nn_outq_batch *self)
+{
+    return self->hasmsg || self->len + NN_OUTQ_COPYMAX > NN_OUTQ_BUFSZ;
+}
+
+static uint8_t *nn_outq_batch_add (struct nn_outq_batch *self,
+    const uint8_t *hdr, size_t hdrlen, struct nn_msg *msg, int copy)
+{
+    size_t size;
+    uint8_t *payload;
+
+    nn_assert (!self->hasmsg);
+
+    /*  Remember whether the batch starts in the middle of a message, so
+        that urgent messages don't overtake the rest of it. */
+    if (!self->len)
+        self->cont = hdrlen == 0;
+    ++self->nmsgs;
+
+    /*  Large messages are referenced rather than copied. */
+    size = hdrlen + nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    if (!copy || size > NN_OUTQ_COPYMAX ||
+          self->len + size > NN_OUTQ_BUFSZ) {
+        memcpy (self->hdr, hdr, hdrlen);
+        self->hdrlen = hdrlen;
+        nn_msg_term (&self->msg);
+        nn_msg_mv (&self->msg, msg);
+        self->hasmsg = 1;
+        return NULL;
+    }
+
+    if (!self->buf) {
+        self->buf = nn_alloc_class (NN_OUTQ_BUFSZ, NN_ALLOC_IOBUF,
+            "outbound batch");
+        alloc_assert (self->buf);
+    }
+    payload = nn_outq_copy (self->buf + self->len, hdr, hdrlen, msg);
+    self->len += size;
+
+    return payload;
+}
+
+static uint8_t *nn_outq_copy (uint8_t *pos, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg)
+{
+    uint8_t *payload;
+    int i;
+
+    memcpy (pos, hdr, hdrlen);
+    pos += hdrlen;
+    payload = pos;
+    memcpy (pos, nn_chunkref_data (&msg->sphdr),
+        nn_chunkref_size (&msg->sphdr));
+    pos += nn_chunkref_size (&msg->sphdr);
+    memcpy (pos, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body));
+    pos += nn_chunkref_size (&msg->body);
+    for (i = 0; i != msg->nparts; ++i) {
+        memcpy (pos, msg->parts [i], nn_chunk_size (msg->parts [i]));
+        pos += nn_chunk_size (msg->parts [i]);
+    }
+    nn_msg_term (msg);
+
+    return payload;
+}
@@ -0,0 +1,189 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_OUTQ_INCLUDED
+#define NN_OUTQ_INCLUDED
+
+#include "../../nn.h"
+
+#include "../../utils/msg.h"
+#include "../../utils/queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Outbound queue of a stream-based connection. While a write is in progress
+    the messages being sent are coalesced into a single batch so that they
+    can be passed to the kernel using a single gathered write once the
+    previous one is done. Small messages are copied into the batch buffer,
+    a larger one is referenced directly and closes the batch. Optionally,
+    messages that don't fit into the batch are kept in a backlog, up to
+    the configured limits, and moved into the next batch once the write
+    in progress is done. Messages are copied into the buffer when moved
+    from the backlog, so the transport must not rely on modifying them in
+    place if the backlog is enabled.
+
+    Urgent messages are copied into a separate buffer of the pending batch
+    which is written ahead of the rest of it, so that they overtake the
+    ordinary messages waiting for the write in progress to be done. Messages
+    are never interleaved though. The write in progress is not interrupted
+    and a batch that starts with the remainder of a message passed in pieces
+    is not overtaken. */
+
+/*  Maximum size of the transport header. */
+#define NN_OUTQ_HDRMAX 16
+
+/*  Messages up to this size, including the transport header, are copied
+    into the batch buffer. */
+#define NN_OUTQ_COPYMAX 1024
+
+/*  Size of the batch buffer. */
+#define NN_OUTQ_BUFSZ 16384
+
+/*  Maximum number of iovecs filled in by nn_outq_start. */
+#define NN_OUTQ_MAXIOV (5 + NN_MSG_MAXPARTS)
+
+struct nn_outq_batch {
+
+    /*  Copied urgent messages, including their transport headers. They are
+        written first. Allocated when first needed. */
+    uint8_t *urgbuf;
+    size_t urglen;
+
+    /*  Copied messages, including their transport headers. Allocated when
+        first needed. */
+    uint8_t *buf;
+    size_t len;
+
+    /*  Message referenced without copying, along with its transport header.
+        It follows the data in 'buf'. */
+    int hasmsg;
+    uint8_t hdr [NN_OUTQ_HDRMAX];
+    size_t hdrlen;
+    struct nn_msg msg;
+
+    /*  Number of messages in the batch. */
+    size_t nmsgs;
+
+    /*  1 if the batch starts with a message pushed without a transport
+        header, i.e. with the continuation of the previous one. */
+    int cont;
+};
+
+struct nn_outq {
+
+    /*  One batch is being written while the other one accumulates messages. */
+    struct nn_outq_batch batches [2];
+
+    /*  Index of the batch accumulating messages. */
+    int pending;
+
+    /*  1 if a write is in progress. */
+    int busy;
+
+    /*  Messages that didn't fit into the pending batch, in order. */
+    struct nn_queue backlog;
+    size_t backlog_msgs;
+    size_t backlog_bytes;
+
+    /*  Limits of the backlog. If maxmsgs is 0, the backlog is not used.
+        If maxbytes is 0, its size in bytes is not limited. */
+    size_t maxmsgs;
+    size_t maxbytes;
+
+    /*  Disposes of the messages the queue is done with. */
+    void (*dtor) (struct nn_msg *msg);
+};
+
+void nn_outq_init (struct nn_outq *self);
+void nn_outq_term (struct nn_outq *self);
+
+/*  Sets the limits of the backlog. Messages already in the backlog are not
+    affected. */
+void nn_outq_setlimits (struct nn_outq *self, size_t maxmsgs,
+    size_t maxbytes);
+
+/*  Sets the function used to dispose of the messages once they are sent
+    or dropped, instead of nn_msg_term. It allows the transport to release
+    the resources it has attached to the messages. */
+void nn_outq_setdtor (struct nn_outq *self, void (*dtor) (struct nn_msg *msg));
+
+/*  Adds the message, preceded by the supplied transport header, to the
+    pending batch. The queue takes ownership of the message. If the message
+    was copied into the batch buffer, returns the location of the copy of
+    its payload, so that the transport can modify it before it's sent.
+    Otherwise, returns NULL. The queue must not be full, except that
+    a second message may follow one pushed into a queue that wasn't, e.g.
+    a batch frame closed by the message after it. The backlog then exceeds
+    its limit on the number of messages by one. */
+uint8_t *nn_outq_push (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg);
+
+/*  Same as nn_outq_push, except that the message is always referenced
+    rather than copied and thus closes the batch. That way there is at most
+    one such message in each write, e.g. to match the file descriptors
+    passed along with the write to the message they belong to. */
+void nn_outq_pushref (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg);
+
+/*  Same as nn_outq_push, except that the message is written ahead of the
+    ordinary messages that are not being written yet, if it's small enough
+    to be copied. Otherwise, or if it can't overtake them without breaking
+    up a message, it's queued as an ordinary one. */
+uint8_t *nn_outq_pushurgent (struct nn_outq *self, const uint8_t *hdr,
+    size_t hdrlen, struct nn_msg *msg);
+
+/*  Returns 1 if neither the pending batch nor the backlog can accept more
+    messages. */
+int nn_outq_full (struct nn_outq *self);
+
+/*  Returns 1 if a write is in progress. */
+int nn_outq_busy (struct nn_outq *self);
+
+/*  Returns 1 if there are messages waiting to be written. */
+int nn_outq_haspending (struct nn_outq *self);
+
+/*  Returns the number of messages in the queue, including the ones being
+    written and the backlogged ones. */
+size_t nn_outq_count (struct nn_outq *self);
+
+/*  Starts writing the pending batch. Fills in the iovecs to pass to
+    the socket and returns their number. The data stay valid till
+    nn_outq_done is called. There must be no write in progress. Urgent
+    messages come first, the body and the parts of the referenced message,
+    if any, come last. Backlogged
+    messages are moved into the new pending batch. */
+int nn_outq_start (struct nn_outq *self, struct nn_iovec *iov);
+
+/*  Returns the message referenced by the batch being written, NULL if
+    there is none. */
+struct nn_msg *nn_outq_msg (struct nn_outq *self);
+
+/*  Takes the referenced message out of the batch being written. The message
+    must not be initialised beforehand. */
+void nn_outq_detach (struct nn_outq *self, struct nn_msg *msg);
+
+/*  The write in progress has completed. */
+void nn_outq_done (struct nn_outq *self);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "pathwatch.h"
+
+#include "../../utils/err.h"
+#include "../../utils/attr.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_PATHWATCH
+
+#include "../../utils/closefd.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined NN_HAVE_INOTIFY
+#include <sys/inotify.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+/*  Longest directory name that is watched. IPC addresses are limited to
+    the size of sun_path, so this is more than enough. */
+#define NN_PATHWATCH_DIRLEN 256
+
+/*  Returns the name of the file within its directory. */
+static const char *nn_pathwatch_basename (const char *path)
+{
+    const char *slash;
+
+    slash = strrchr (path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int nn_pathwatch_init (struct nn_pathwatch *self, const char *path)
+{
+    int rc;
+    size_t len;
+    char dir [NN_PATHWATCH_DIRLEN];
+#if !defined NN_HAVE_INOTIFY
+    struct kevent ev;
+#endif
+
+    self->fd = -1;
+    self->dirfd = -1;
+    self->path = path;
+    if (!path)
+        return -EINVAL;
+
+    /*  The directory is the part of the path up to the last slash, the
+        current directory if there's none and the root if it's the first
+        character. */
+    len = nn_pathwatch_basename (path) - path;
+    if (len == 0)
+        strcpy (dir, ".");
+    else {
+        if (nn_slow (len >= sizeof (dir)))
+            return -ENAMETOOLONG;
+        memcpy (dir, path, len > 1 ? len - 1 : len);
+        dir [len > 1 ? len - 1 : len] = 0;
+    }
+
+#if defined NN_HAVE_INOTIFY
+    self->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (nn_slow (self->fd < 0))
+        return -errno;
+
+    /*  A file created by bind() or renamed into place. */
+    rc = inotify_add_watch (self->fd, dir, IN_CREATE | IN_MOVED_TO);
+    if (nn_slow (rc < 0)) {
+        rc = -errno;
+        nn_closefd (self->fd);
+        self->fd = -1;
+        return rc;
+    }
+#else
+    self->dirfd = open (dir, O_RDONLY | O_CLOEXEC);
+    if (nn_slow (self->dirfd < 0))
+        return -errno;
+    self->fd = kqueue ();
+    if (nn_slow (self->fd < 0)) {
+        rc = -errno;
+        nn_closefd (self->dirfd);
+        self->dirfd = -1;
+        return rc;
+    }
+    fcntl (self->fd, F_SETFD, FD_CLOEXEC);
+
+    /*  Adding an entry to a directory is a write to it. */
+    EV_SET (&ev, self->dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE,
+        0, NULL);
+    rc = kevent (self->fd, &ev, 1, NULL, 0, NULL);
+    if (nn_slow (rc < 0)) {
+        rc = -errno;
+        nn_pathwatch_term (self);
+        return rc;
+    }
+#endif
+
+    return 0;
+}
+
+void nn_pathwatch_term (struct nn_pathwatch *self)
+{
+    if (self->fd >= 0)
+        nn_closefd (self->fd);
+    if (self->dirfd >= 0)
+        nn_closefd (self->dirfd);
+    self->fd = -1;
+    self->dirfd = -1;
+}
+
+int nn_pathwatch_getfd (struct nn_pathwatch *self)
+{
+    return self->fd;
+}
+
+int nn_pathwatch_check (struct nn_pathwatch *self)
+{
+    int created;
+#if defined NN_HAVE_INOTIFY
+    ssize_t nbytes;
+    size_t pos;
+    const char *name;
+    const struct inotify_event *ev;
+    union {
+        struct inotify_event align;
+        char buf [4096];
+    } u;
+#else
+    int rc;
+    struct kevent evs [4];
+    struct timespec ts;
+#endif
+
+    created = 0;
+    if (nn_slow (self->fd < 0))
+        return 0;
+
+#if defined NN_HAVE_INOTIFY
+    /*  The fd may be polled in edge-triggered mode, so it's drained. */
+    name = nn_pathwatch_basename (self->path);
+    while (1) {
+        nbytes = read (self->fd, u.buf, sizeof (u.buf));
+        if (nbytes <= 0)
+            break;
+        for (pos = 0; pos < (size_t) nbytes;
+              pos += sizeof (struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event*) (u.buf + pos);
+            if (ev->mask & IN_Q_OVERFLOW)
+                created = 1;
+            else if (ev->len && strcmp (ev->name, name) == 0)
+                created = 1;
+        }
+    }
+#else
+    /*  The kqueue doesn't say which entry was added, so the file is looked
+        for once the directory changed. */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 0;
+    while (1) {
+        rc = kevent (self->fd, NULL, 0, evs, 4, &ts);
+        if (rc <= 0)
+            break;
+        created = 1;
+    }
+    if (created)
+        created = access (self->path, F_OK) == 0;
+#endif
+
+    return created;
+}
+
+#else
+
+int nn_pathwatch_init (struct nn_pathwatch *self, const char *path)
+{
+    self->fd = -1;
+    self->dirfd = -1;
+    self->path = path;
+    return -ENOTSUP;
+}
+
+void nn_pathwatch_term (NN_UNUSED struct nn_pathwatch *self)
+{
+}
+
+int nn_pathwatch_getfd (struct nn_pathwatch *self)
+{
+    return self->fd;
+}
+
+int nn_pathwatch_check (NN_UNUSED struct nn_pathwatch *self)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_PATHWATCH_INCLUDED
+#define NN_PATHWATCH_INCLUDED
+
+/*  Watches the directory a file is to be created in, so that a connecting
+    IPC endpoint learns about its peer binding the socket file without
+    polling for it. The watch is a file descriptor that becomes readable
+    whenever the directory changes; nn_pathwatch_check then tells whether
+    the file showed up. Only the directory's own entries are watched, i.e.
+    the directory itself must exist. */
+
+#if !defined NN_HAVE_WINDOWS && (defined NN_HAVE_INOTIFY || \
+    defined NN_HAVE_KQUEUE)
+#define NN_HAVE_PATHWATCH
+#endif
+
+struct nn_pathwatch {
+
+    /*  inotify instance or kqueue, -1 if the file is not watched. */
+    int fd;
+
+    /*  The directory opened for the kqueue to watch, -1 otherwise. */
+    int dirfd;
+
+    /*  The watched file. Points into the caller's string. */
+    const char *path;
+};
+
+/*  Starts watching for the file at 'path' to be created. The string must
+    outlive the watch. If 'path' is NULL, nothing is watched. Returns
+    -ENOTSUP if the platform can't watch files, or a negative errno if the
+    directory can't be watched, e.g. because it doesn't exist. The object
+    can be terminated in either case. */
+int nn_pathwatch_init (struct nn_pathwatch *self, const char *path);
+void nn_pathwatch_term (struct nn_pathwatch *self);
+
+/*  Returns the file descriptor that becomes readable when the directory
+    changes, -1 if the file is not watched. */
+int nn_pathwatch_getfd (struct nn_pathwatch *self);
+
+/*  Consumes the pending changes of the directory. Returns 1 if the file
+    may have been created since the last call, 0 otherwise. */
+int nn_pathwatch_check (struct nn_pathwatch *self);
+
+#endif
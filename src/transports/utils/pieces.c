@@ -0,0 +1,126 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "pieces.h"
+
+#include "../../nn.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+void nn_pieces_init (struct nn_pieces *self)
+{
+    self->inmax = 0;
+    nn_pieces_reset (self);
+}
+
+void nn_pieces_term (NN_UNUSED struct nn_pieces *self)
+{
+}
+
+void nn_pieces_reset (struct nn_pieces *self)
+{
+    self->outsize = 0;
+    self->outpos = 0;
+    self->insize = 0;
+    self->inpos = 0;
+}
+
+int nn_pieces_send (struct nn_pieces *self, struct nn_msg *msg,
+    uint64_t *size)
+{
+    struct nn_msg_piece piece;
+    uint64_t len;
+
+    if (!nn_msg_piece (msg, &piece)) {
+        if (nn_slow (self->outsize))
+            return -EPROTO;
+        return NN_PIECES_NONE;
+    }
+
+    len = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+    if (piece.offset == 0) {
+        if (nn_slow (self->outsize || len > piece.size))
+            return -EPROTO;
+        *size = piece.size;
+        self->outsize = piece.size;
+        self->outpos = 0;
+    }
+    else if (!self->outsize) {
+
+        /*  The peer has never seen the beginning of the message. */
+        return NN_PIECES_DROP;
+    }
+    else if (nn_slow (piece.size != self->outsize ||
+          piece.offset != self->outpos ||
+          len > self->outsize - self->outpos))
+        return -EPROTO;
+
+    self->outpos += len;
+    if (self->outpos == self->outsize) {
+        self->outsize = 0;
+        self->outpos = 0;
+    }
+    return piece.offset == 0 ? NN_PIECES_FIRST : NN_PIECES_NEXT;
+}
+
+int nn_pieces_recvstart (struct nn_pieces *self, uint64_t size, size_t max)
+{
+    nn_assert (!self->insize);
+
+    if (!max || size <= max)
+        return 0;
+    self->insize = size;
+    self->inpos = 0;
+    self->inmax = max;
+    return 1;
+}
+
+int nn_pieces_receiving (struct nn_pieces *self)
+{
+    return self->insize != 0;
+}
+
+void nn_pieces_recvnext (struct nn_pieces *self, struct nn_msg *msg,
+    int type)
+{
+    struct nn_msg_piece piece;
+    uint64_t len;
+
+    nn_assert (self->insize);
+
+    len = self->insize - self->inpos;
+    if (len > self->inmax)
+        len = self->inmax;
+    nn_msg_term (msg);
+    nn_msg_init_type (msg, (size_t) len, type);
+    piece.size = self->insize;
+    piece.offset = self->inpos;
+    nn_msg_setpiece (msg, &piece);
+
+    self->inpos += len;
+    if (self->inpos == self->insize) {
+        self->insize = 0;
+        self->inpos = 0;
+    }
+}
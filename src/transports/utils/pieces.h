@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_PIECES_INCLUDED
+#define NN_PIECES_INCLUDED
+
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Messages passed in pieces on stream connections (see NN_MSG_PIECE in
+    nn_sendmsg(3)). The first piece is sent with the size of the whole
+    message in its header, the others follow it without any header at all,
+    so the peer sees the message as it would be if it was sent in one go.
+    Conversely, a message larger than NN_RCVPIECE is handed over to the
+    user in pieces of that size as its body arrives, rather than once all
+    of it is received. */
+
+/*  Values returned by nn_pieces_send. */
+#define NN_PIECES_NONE 0
+#define NN_PIECES_FIRST 1
+#define NN_PIECES_NEXT 2
+#define NN_PIECES_DROP 3
+
+struct nn_pieces {
+
+    /*  Size of the outbound message and the number of bytes of it sent so
+        far, 0 if there's none. */
+    uint64_t outsize;
+    uint64_t outpos;
+
+    /*  Same for the inbound message, which is handed over in pieces of
+        'inmax' bytes. */
+    uint64_t insize;
+    uint64_t inpos;
+    size_t inmax;
+};
+
+void nn_pieces_init (struct nn_pieces *self);
+void nn_pieces_term (struct nn_pieces *self);
+
+/*  Forgets the messages in progress, e.g. once the connection is
+    re-established. */
+void nn_pieces_reset (struct nn_pieces *self);
+
+/*  Checks the message to be sent. Returns NN_PIECES_NONE if it's an
+    ordinary message, NN_PIECES_FIRST if it's the first piece of one, in which
+    case 'size' is set to the size of the whole message, and NN_PIECES_NEXT
+    if it's one of the others. NN_PIECES_DROP is returned for the remaining
+    pieces of a message the first piece of which was sent over an earlier
+    connection, and -EPROTO if the piece doesn't follow the previous one. */
+int nn_pieces_send (struct nn_pieces *self, struct nn_msg *msg,
+    uint64_t *size);
+
+/*  Starts receiving a message of 'size' bytes in pieces of 'max' bytes,
+    provided it's larger than that. Returns 1 if started, 0 if the message
+    should be received as a whole. Zero 'max' means no pieces. */
+int nn_pieces_recvstart (struct nn_pieces *self, uint64_t size, size_t max);
+
+/*  Returns 1 if there are more pieces of the inbound message to come. */
+int nn_pieces_receiving (struct nn_pieces *self);
+
+/*  Re-initialises 'msg' as the next inbound piece, allocated from
+    the message pool 'type', for the body to be received into. */
+void nn_pieces_recvnext (struct nn_pieces *self, struct nn_msg *msg,
+    int type);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#if defined NN_HAVE_SHM
+
+#include "shmring.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  Layout of the beginning of the segment. Positions owned by the writer
+    and by the reader live in separate cache lines. The data area follows. */
+struct nn_shmring_hdr {
+
+    /*  Number of bytes written into the ring so far. */
+    volatile uint64_t head;
+    uint8_t pad1 [56];
+
+    /*  Number of bytes read from the ring so far. */
+    volatile uint64_t tail;
+    uint8_t pad2 [56];
+
+    /*  Wait flags. 1 if reader (writer) is waiting for data (space). */
+    volatile uint32_t rxwait;
+    volatile uint32_t txwait;
+
+    /*  Size of the data area. */
+    uint64_t size;
+    uint8_t pad3 [48];
+};
+
+/*  Used to generate unique segment names within the process. */
+static volatile uint32_t nn_shmring_seq = 0;
+
+static int nn_shmring_map (struct nn_shmring *self, int fd, size_t size);
+
+void nn_shmring_init (struct nn_shmring *self)
+{
+    self->hdr = NULL;
+    self->data = NULL;
+    self->size = 0;
+    self->maplen = 0;
+    self->name [0] = 0;
+    self->owner = 0;
+}
+
+void nn_shmring_term (struct nn_shmring *self)
+{
+    nn_assert (self->hdr == NULL);
+}
+
+int nn_shmring_create (struct nn_shmring *self, size_t size)
+{
+    int rc;
+    int fd;
+    int i;
+    size_t sz;
+
+    nn_assert (self->hdr == NULL);
+
+    /*  Round the size up to a power of two so that positions can be wrapped
+        around by masking. */
+    if (size > NN_SHMRING_MAXSIZE)
+        size = NN_SHMRING_MAXSIZE;
+    sz = NN_SHMRING_MINSIZE;
+    while (sz < size)
+        sz <<= 1;
+
+    /*  Try a few names in case there's a stale segment left over by
+        a process that used to have the same pid. */
+    for (i = 0; ; ++i) {
+        snprintf (self->name, sizeof (self->name), "/nn-%d-%u",
+            (int) getpid (), (unsigned) __sync_fetch_and_add (&nn_shmring_seq, 1));
+        fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (nn_fast (fd >= 0))
+            break;
+        if (errno != EEXIST || i == 16) {
+            rc = -errno;
+            self->name [0] = 0;
+            return rc;
+        }
+    }
+
+    rc = ftruncate (fd, sizeof (struct nn_shmring_hdr) + sz);
+    if (nn_slow (rc != 0)) {
+        rc = -errno;
+        close (fd);
+        shm_unlink (self->name);
+        self->name [0] = 0;
+        return rc;
+    }
+
+    rc = nn_shmring_map (self, fd, sz);
+    close (fd);
+    if (nn_slow (rc < 0)) {
+        shm_unlink (self->name);
+        self->name [0] = 0;
+        return rc;
+    }
+
+    /*  The segment is zero-filled, only the size has to be filled in. */
+    self->hdr->size = sz;
+    self->owner = 1;
+
+    return 0;
+}
+
+int nn_shmring_open (struct nn_shmring *self, const char *name, size_t size)
+{
+    int rc;
+    int fd;
+    struct stat st;
+
+    nn_assert (self->hdr == NULL);
+
+    if (strlen (name) >= sizeof (self->name) ||
+          size < NN_SHMRING_MINSIZE || size > NN_SHMRING_MAXSIZE ||
+          (size & (size - 1)) != 0)
+        return -EINVAL;
+
+    fd = shm_open (name, O_RDWR, 0);
+    if (nn_slow (fd < 0))
+        return -errno;
+
+    /*  Make sure the segment is as large as advertised by the peer. */
+    rc = fstat (fd, &st);
+    if (nn_slow (rc != 0)) {
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    if (nn_slow ((size_t) st.st_size < sizeof (struct nn_shmring_hdr) + size)) {
+        close (fd);
+        return -EPROTO;
+    }
+
+    rc = nn_shmring_map (self, fd, size);
+    close (fd);
+    if (nn_slow (rc < 0))
+        return rc;
+    if (nn_slow (self->hdr->size != size)) {
+        nn_shmring_close (self);
+        return -EPROTO;
+    }
+
+    strcpy (self->name, name);
+    self->owner = 0;
+
+    return 0;
+}
+
+void nn_shmring_unlink (struct nn_shmring *self)
+{
+    int rc;
+
+    if (!self->name [0])
+        return;
+
+    /*  The peer may have removed the name already. */
+    rc = shm_unlink (self->name);
+    errno_assert (rc == 0 || errno == ENOENT);
+    self->name [0] = 0;
+}
+
+void nn_shmring_close (struct nn_shmring *self)
+{
+    int rc;
+
+    if (!self->hdr)
+        return;
+
+    if (self->owner)
+        nn_shmring_unlink (self);
+
+    rc = munmap (self->hdr, self->maplen);
+    errno_assert (rc == 0);
+    nn_shmring_init (self);
+}
+
+size_t nn_shmring_write (struct nn_shmring *self, const void *buf, size_t len)
+{
+    uint64_t head;
+    size_t space;
+    size_t pos;
+    size_t first;
+
+    head = self->hdr->head;
+    space = self->size - (size_t) (head - self->hdr->tail);
+    if (len > space)
+        len = space;
+    if (!len)
+        return 0;
+
+    /*  Order the write of the data after the read of the reader's position,
+        so that the bytes are not overwritten before being read. */
+    __sync_synchronize ();
+
+    pos = (size_t) head & (self->size - 1);
+    first = len < self->size - pos ? len : self->size - pos;
+    memcpy (self->data + pos, buf, first);
+    memcpy (self->data, ((const uint8_t*) buf) + first, len - first);
+
+    /*  Publish the data. */
+    __sync_synchronize ();
+    self->hdr->head = head + len;
+
+    return len;
+}
+
+size_t nn_shmring_read (struct nn_shmring *self, void *buf, size_t len)
+{
+    uint64_t tail;
+    size_t avail;
+    size_t pos;
+    size_t first;
+
+    tail = self->hdr->tail;
+    avail = (size_t) (self->hdr->head - tail);
+    if (len > avail)
+        len = avail;
+    if (!len)
+        return 0;
+
+    /*  Don't read the data before the writer's position it was published
+        with. */
+    __sync_synchronize ();
+
+    pos = (size_t) tail & (self->size - 1);
+    first = len < self->size - pos ? len : self->size - pos;
+    memcpy (buf, self->data + pos, first);
+    memcpy (((uint8_t*) buf) + first, self->data, len - first);
+
+    /*  Give the space back to the writer once the data is copied out. */
+    __sync_synchronize ();
+    self->hdr->tail = tail + len;
+
+    return len;
+}
+
+void nn_shmring_rxwait (struct nn_shmring *self)
+{
+    self->hdr->rxwait = 1;
+    __sync_synchronize ();
+}
+
+void nn_shmring_rxdone (struct nn_shmring *self)
+{
+    self->hdr->rxwait = 0;
+}
+
+void nn_shmring_txwait (struct nn_shmring *self)
+{
+    self->hdr->txwait = 1;
+    __sync_synchronize ();
+}
+
+void nn_shmring_txdone (struct nn_shmring *self)
+{
+    self->hdr->txwait = 0;
+}
+
+int nn_shmring_rxwake (struct nn_shmring *self)
+{
+    /*  The compare-and-swap is a full barrier and thus orders the check
+        after the update of the position. */
+    return __sync_bool_compare_and_swap (&self->hdr->rxwait, 1, 0);
+}
+
+int nn_shmring_txwake (struct nn_shmring *self)
+{
+    return __sync_bool_compare_and_swap (&self->hdr->txwait, 1, 0);
+}
+
+static int nn_shmring_map (struct nn_shmring *self, int fd, size_t size)
+{
+    void *addr;
+
+    self->maplen = sizeof (struct nn_shmring_hdr) + size;
+    addr = mmap (NULL, self->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (nn_slow (addr == MAP_FAILED)) {
+        self->maplen = 0;
+        return -errno;
+    }
+
+    self->hdr = (struct nn_shmring_hdr*) addr;
+    self->data = ((uint8_t*) addr) + sizeof (struct nn_shmring_hdr);
+    self->size = size;
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_SHMRING_INCLUDED
+#define NN_SHMRING_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Single-producer single-consumer byte ring living in a POSIX shared memory
+    segment. One process creates the segment and writes into it, the peer
+    opens it by name and reads from it. Besides the data, the segment holds
+    a pair of flags that either side sets before it goes to sleep waiting
+    for the other one. The side making progress checks the flag afterwards
+    and, if it was set, is responsible for waking the peer up by other
+    means. */
+
+/*  Maximum length of the segment name, including the terminating zero. */
+#define NN_SHMRING_NAMELEN 64
+
+/*  Limits for the size of the data area. */
+#define NN_SHMRING_MINSIZE 4096
+#define NN_SHMRING_MAXSIZE (1 << 30)
+
+struct nn_shmring_hdr;
+
+struct nn_shmring {
+
+    /*  Mapped segment. NULL if the ring is not open. */
+    struct nn_shmring_hdr *hdr;
+    uint8_t *data;
+    size_t size;
+    size_t maplen;
+
+    /*  Name of the segment. */
+    char name [NN_SHMRING_NAMELEN];
+
+    /*  1 if the segment was created by this object and is to be unlinked
+        when it is closed. */
+    int owner;
+};
+
+void nn_shmring_init (struct nn_shmring *self);
+void nn_shmring_term (struct nn_shmring *self);
+
+/*  Creates a new uniquely named segment with data area of at least 'size'
+    bytes. The size is rounded up to a power of two. */
+int nn_shmring_create (struct nn_shmring *self, size_t size);
+
+/*  Maps segment created by the peer. 'size' is the size of its data area. */
+int nn_shmring_open (struct nn_shmring *self, const char *name, size_t size);
+
+/*  Removes the name of the segment from the system. The mapping stays valid
+    until the ring is closed. */
+void nn_shmring_unlink (struct nn_shmring *self);
+
+/*  Unmaps the segment. If it was created by this object, the name is
+    unlinked as well. */
+void nn_shmring_close (struct nn_shmring *self);
+
+/*  Copy up to 'len' bytes into/out of the ring. These return the number of
+    bytes actually transferred. */
+size_t nn_shmring_write (struct nn_shmring *self, const void *buf, size_t len);
+size_t nn_shmring_read (struct nn_shmring *self, void *buf, size_t len);
+
+/*  Reader and writer announce they are going to wait for data or space,
+    respectively. After setting the flag the caller must try to read or write
+    once more to avoid missing the wake-up. nn_shmring_rxdone and
+    nn_shmring_txdone withdraw the announcement once it is not needed. */
+void nn_shmring_rxwait (struct nn_shmring *self);
+void nn_shmring_rxdone (struct nn_shmring *self);
+void nn_shmring_txwait (struct nn_shmring *self);
+void nn_shmring_txdone (struct nn_shmring *self);
+
+/*  Called after writing or reading data, respectively. Returns 1 if the peer
+    was waiting and has to be woken up, 0 otherwise. */
+int nn_shmring_rxwake (struct nn_shmring *self);
+int nn_shmring_txwake (struct nn_shmring *self);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "simlink.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/random.h"
+
+struct nn_simlink_msg {
+    struct nn_list_item item;
+
+    /*  Time the message comes out of the link. */
+    uint64_t due;
+
+    struct nn_msg msg;
+};
+
+/*  xorshift64*, good enough for emulating a network. */
+static uint64_t nn_simlink_random (struct nn_simlink *self)
+{
+    self->rnd ^= self->rnd >> 12;
+    self->rnd ^= self->rnd << 25;
+    self->rnd ^= self->rnd >> 27;
+    return self->rnd * 2685821657736338717ULL;
+}
+
+void nn_simlink_init (struct nn_simlink *self, int delay, int jitter,
+    int bandwidth, int loss, int seed)
+{
+    self->delay = (uint64_t) delay * 1000;
+    self->jitter = (uint64_t) jitter * 1000;
+    self->bandwidth = (uint64_t) bandwidth;
+    self->loss = (uint32_t) loss;
+
+    /*  The generator gets stuck at zero. */
+    if (seed)
+        self->rnd = (uint64_t) (uint32_t) seed;
+    else
+        nn_random_generate (&self->rnd, sizeof (self->rnd));
+    if (!self->rnd)
+        self->rnd = 1;
+
+    self->free = 0;
+    self->last = 0;
+    nn_list_init (&self->line);
+    self->size = 0;
+}
+
+void nn_simlink_term (struct nn_simlink *self)
+{
+    struct nn_simlink_msg *lmsg;
+
+    while (!nn_list_empty (&self->line)) {
+        lmsg = nn_cont (nn_list_begin (&self->line), struct nn_simlink_msg,
+            item);
+        nn_list_erase (&self->line, &lmsg->item);
+        nn_list_item_term (&lmsg->item);
+        nn_msg_term (&lmsg->msg);
+        nn_free (lmsg);
+    }
+    nn_list_term (&self->line);
+}
+
+void nn_simlink_put (struct nn_simlink *self, struct nn_msg *msg,
+    uint64_t now)
+{
+    size_t size;
+    uint64_t due;
+    struct nn_simlink_msg *lmsg;
+
+    /*  The message is transmitted once the link is done with the previous
+        ones. Lost messages take their time to transmit all the same. */
+    if (self->free < now)
+        self->free = now;
+    if (self->bandwidth) {
+        size = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
+        self->free += (uint64_t) size * 1000000 / self->bandwidth;
+    }
+    if (self->loss && nn_simlink_random (self) % 1000000 < self->loss) {
+        nn_msg_term (msg);
+        return;
+    }
+
+    /*  The jitter doesn't reorder the messages, the same way it doesn't
+        within a TCP connection. */
+    due = self->free + self->delay;
+    if (self->jitter)
+        due += nn_simlink_random (self) % (self->jitter + 1);
+    if (due < self->last)
+        due = self->last;
+    self->last = due;
+
+    lmsg = nn_alloc (sizeof (struct nn_simlink_msg), "simlink message");
+    alloc_assert (lmsg);
+    nn_list_item_init (&lmsg->item);
+    lmsg->due = due;
+    nn_msg_mv (&lmsg->msg, msg);
+    nn_list_insert (&self->line, &lmsg->item, nn_list_end (&self->line));
+    ++self->size;
+}
+
+int nn_simlink_get (struct nn_simlink *self, struct nn_msg *msg,
+    uint64_t now)
+{
+    struct nn_simlink_msg *lmsg;
+
+    if (nn_list_empty (&self->line))
+        return -EAGAIN;
+    lmsg = nn_cont (nn_list_begin (&self->line), struct nn_simlink_msg, item);
+    if (lmsg->due > now)
+        return -EAGAIN;
+
+    nn_list_erase (&self->line, &lmsg->item);
+    nn_list_item_term (&lmsg->item);
+    nn_msg_term (msg);
+    nn_msg_mv (msg, &lmsg->msg);
+    nn_free (lmsg);
+    --self->size;
+
+    return 0;
+}
+
+uint64_t nn_simlink_next (struct nn_simlink *self)
+{
+    if (nn_list_empty (&self->line))
+        return 0;
+    return nn_cont (nn_list_begin (&self->line), struct nn_simlink_msg,
+        item)->due;
+}
+
+uint64_t nn_simlink_free (struct nn_simlink *self)
+{
+    return self->free;
+}
+
+size_t nn_simlink_size (struct nn_simlink *self)
+{
+    return self->size;
+}
@@ -0,0 +1,91 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_SIMLINK_INCLUDED
+#define NN_SIMLINK_INCLUDED
+
+#include "../../utils/msg.h"
+#include "../../utils/list.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Emulation of a network link used by the sim transport. Messages put into
+    the link are transmitted one after another at the configured bandwidth,
+    then take the configured delay plus a random jitter to cross it. They
+    come out in the order they were put in, except for the ones that are
+    lost on the way. All the times are in microseconds of nn_clock_us. The
+    random numbers come from a generator of the link's own, so that a link
+    with a given seed behaves the same way every time. */
+
+struct nn_simlink {
+
+    /*  Delay and jitter in microseconds, bandwidth in bytes per second,
+        0 meaning unlimited, and the loss rate in parts per million. */
+    uint64_t delay;
+    uint64_t jitter;
+    uint64_t bandwidth;
+    uint32_t loss;
+
+    /*  State of the random number generator. */
+    uint64_t rnd;
+
+    /*  Time the link is done transmitting the messages put into it and
+        time the last of them comes out of it. */
+    uint64_t free;
+    uint64_t last;
+
+    /*  Messages crossing the link, oldest first. */
+    struct nn_list line;
+    size_t size;
+};
+
+/*  'delay' and 'jitter' are in milliseconds. A zero seed is replaced by
+    a random one. */
+void nn_simlink_init (struct nn_simlink *self, int delay, int jitter,
+    int bandwidth, int loss, int seed);
+
+/*  Drops the messages still crossing the link. */
+void nn_simlink_term (struct nn_simlink *self);
+
+/*  Puts the message into the link at time 'now'. The link takes ownership
+    of it. */
+void nn_simlink_put (struct nn_simlink *self, struct nn_msg *msg,
+    uint64_t now);
+
+/*  Moves the oldest message into 'msg', dropping its previous content, if
+    it has come out of the link by 'now'. Returns -EAGAIN otherwise. */
+int nn_simlink_get (struct nn_simlink *self, struct nn_msg *msg,
+    uint64_t now);
+
+/*  Returns the time the oldest message comes out of the link, 0 if there
+    is none. */
+uint64_t nn_simlink_next (struct nn_simlink *self);
+
+/*  Returns the time the link is done transmitting. */
+uint64_t nn_simlink_free (struct nn_simlink *self);
+
+/*  Returns the number of messages crossing the link. */
+size_t nn_simlink_size (struct nn_simlink *self);
+
+#endif
@@ -80,7 +80,7 @@ int nn_streamhdr_isidle (struct nn_streamhdr *self)
 }
 
 void nn_streamhdr_start (struct nn_streamhdr *self, struct nn_usock *usock,
-    struct nn_pipebase *pipebase)
+    struct nn_pipebase *pipebase, int flags, int algs)
 {
     size_t sz;
     int protocol;
@@ -101,6 +101,10 @@ void nn_streamhdr_start (struct nn_streamhdr *self, struct nn_usock *usock,
     /*  Compose the protocol header. */
     memcpy (self->protohdr, "\0SP\0\0\0\0\0", 8);
     nn_puts (self->protohdr + 4, (uint16_t) protocol);
+    self->protohdr [6] = (uint8_t) flags;
+    self->protohdr [7] = (uint8_t) algs;
+    self->peerflags = 0;
+    self->peeralgs = 0;
 
     /*  Launch the state machine. */
     nn_fsm_start (&self->fsm);
@@ -223,6 +227,8 @@ static void nn_streamhdr_handler (struct nn_fsm *self, int src, int type,
                 protocol = nn_gets (streamhdr->protohdr + 4);
                 if (!nn_pipebase_ispeer (streamhdr->pipebase, protocol))
                     goto invalidhdr;
+                streamhdr->peerflags = streamhdr->protohdr [6];
+                streamhdr->peeralgs = streamhdr->protohdr [7];
                 nn_timer_stop (&streamhdr->timer);
                 streamhdr->state = NN_STREAMHDR_STATE_STOPPING_TIMER_DONE;
                 return;
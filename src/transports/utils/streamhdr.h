@@ -36,6 +36,32 @@
 #define NN_STREAMHDR_ERROR 2
 #define NN_STREAMHDR_STOPPED 3
 
+/*  Flags passed in the first of the reserved bytes of the header. Peers
+    not aware of them send zero and ignore them. */
+
+/*  The connection is one of several a pipe is striped over. */
+#define NN_STREAMHDR_GROUP 0x01
+
+/*  The sender is able to join connections into striped pipes. */
+#define NN_STREAMHDR_CANGROUP 0x02
+
+/*  The sender is able to unpack batch frames (see batch.h). */
+#define NN_STREAMHDR_CANBATCH 0x04
+
+/*  The sender is able to recognise heartbeat frames (see heartbeat.h). */
+#define NN_STREAMHDR_CANHEARTBEAT 0x08
+
+/*  The sender is able to check the frames against their checksums and,
+    if NN_STREAMHDR_CHECKSUM is set as well, asks for them to be used. */
+#define NN_STREAMHDR_CANCHECKSUM 0x10
+#define NN_STREAMHDR_CHECKSUM 0x20
+
+/*  The connection is one of the two a pipe is split between by the size of
+    the messages and, if NN_STREAMHDR_BULK is set as well, the one carrying
+    the large ones. Peers not aware of it treat the pipe as striped. */
+#define NN_STREAMHDR_SPLIT 0x40
+#define NN_STREAMHDR_BULK 0x80
+
 struct nn_streamhdr {
 
     /*  The state machine. */
@@ -57,6 +83,11 @@ struct nn_streamhdr {
     /*  Protocol header. */
     uint8_t protohdr [8];
 
+    /*  Flags and the mask of compression algorithms the peer is able to
+        decompress, valid once the exchange is done. */
+    int peerflags;
+    int peeralgs;
+
     /*  Event fired when the state machine ends. */
     struct nn_fsm_event done;
 };
@@ -67,7 +98,7 @@ void nn_streamhdr_term (struct nn_streamhdr *self);
 
 int nn_streamhdr_isidle (struct nn_streamhdr *self);
 void nn_streamhdr_start (struct nn_streamhdr *self, struct nn_usock *usock,
-    struct nn_pipebase *pipebase);
+    struct nn_pipebase *pipebase, int flags, int algs);
 void nn_streamhdr_stop (struct nn_streamhdr *self);
 
 #endif
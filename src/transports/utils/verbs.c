@@ -0,0 +1,453 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_HAVE_RDMA
+
+#include "verbs.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+#include "../../utils/random.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <infiniband/verbs.h>
+
+/*  Sends up to this many bytes long are copied into the work request. */
+#define NN_VERBS_MAXINLINE 128
+
+/*  Number of completions retrieved at once. */
+#define NN_VERBS_BATCH 16
+
+/*  Receiver not ready timer (0.64ms) and the acknowledgement timeout
+    (4.096us * 2^14, i.e. about 67ms), as encoded by the verbs interface. */
+#define NN_VERBS_RNR_TIMER 12
+#define NN_VERBS_TIMEOUT 14
+
+static int nn_verbs_postrecv (struct nn_verbs *self, uint32_t slot);
+
+void nn_verbs_init (struct nn_verbs *self)
+{
+    memset (self, 0, sizeof (struct nn_verbs));
+}
+
+void nn_verbs_term (struct nn_verbs *self)
+{
+    nn_assert (self->ctx == NULL);
+}
+
+int nn_verbs_available (void)
+{
+    struct ibv_device **devs;
+    int num;
+
+    devs = ibv_get_device_list (&num);
+    if (!devs)
+        return -ENODEV;
+    ibv_free_device_list (devs);
+    return num > 0 ? 0 : -ENODEV;
+}
+
+int nn_verbs_open (struct nn_verbs *self, size_t bufsz, int nbufs,
+    int gididx, uint8_t *rec)
+{
+    int rc;
+    int i;
+    int num;
+    int port;
+    int flags;
+    size_t memsz;
+    struct ibv_device **devs;
+    struct ibv_device_attr devattr;
+    struct ibv_port_attr portattr;
+    struct ibv_qp_init_attr qpinit;
+    struct ibv_qp_attr qpattr;
+    union ibv_gid gid;
+
+    nn_assert (self->ctx == NULL);
+    nn_assert (bufsz >= NN_VERBS_MINBUFSZ && bufsz <= NN_VERBS_MAXBUFSZ);
+    nn_assert (nbufs > 0 && nbufs <= NN_VERBS_MAXBUFS);
+
+    /*  Find the first device that has an active port. */
+    devs = ibv_get_device_list (&num);
+    if (!devs)
+        return -ENODEV;
+    port = 0;
+    for (i = 0; i != num; ++i) {
+        self->ctx = ibv_open_device (devs [i]);
+        if (!self->ctx)
+            continue;
+        if (ibv_query_device (self->ctx, &devattr) == 0) {
+            for (port = 1; port <= devattr.phys_port_cnt; ++port) {
+                if (ibv_query_port (self->ctx, (uint8_t) port,
+                      &portattr) == 0 && portattr.state == IBV_PORT_ACTIVE)
+                    break;
+            }
+            if (port <= devattr.phys_port_cnt)
+                break;
+        }
+        ibv_close_device (self->ctx);
+        self->ctx = NULL;
+    }
+    ibv_free_device_list (devs);
+    if (!self->ctx)
+        return -ENODEV;
+    self->port = (uint8_t) port;
+    self->gididx = gididx;
+    self->mtu = portattr.active_mtu;
+
+    memset (&gid, 0, sizeof (gid));
+    if (gididx >= 0 &&
+          ibv_query_gid (self->ctx, self->port, gididx, &gid) != 0) {
+        nn_verbs_close (self);
+        return -ENODEV;
+    }
+
+    /*  Completions of both the sends and the receives are reported via
+        a single queue, whose notifications are polled by the worker. */
+    self->pd = ibv_alloc_pd (self->ctx);
+    if (!self->pd)
+        goto fail;
+    self->channel = ibv_create_comp_channel (self->ctx);
+    if (!self->channel)
+        goto fail;
+    flags = fcntl (self->channel->fd, F_GETFL, 0);
+    if (flags < 0 ||
+          fcntl (self->channel->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        goto fail;
+    self->cq = ibv_create_cq (self->ctx, nbufs * 2, NULL, self->channel, 0);
+    if (!self->cq)
+        goto fail;
+
+    /*  Register memory for the slots. */
+    self->bufsz = bufsz;
+    self->nbufs = nbufs;
+    memsz = bufsz * nbufs * 2;
+    self->mem = nn_alloc (memsz, "rdma buffers");
+    if (!self->mem)
+        goto fail;
+    self->rx = nn_alloc (sizeof (struct nn_verbs_rx) * nbufs, "rdma slots");
+    if (!self->rx)
+        goto fail;
+    self->mr = ibv_reg_mr (self->pd, self->mem, memsz, IBV_ACCESS_LOCAL_WRITE);
+    if (!self->mr)
+        goto fail;
+
+    memset (&qpinit, 0, sizeof (qpinit));
+    qpinit.send_cq = self->cq;
+    qpinit.recv_cq = self->cq;
+    qpinit.qp_type = IBV_QPT_RC;
+    qpinit.cap.max_send_wr = nbufs;
+    qpinit.cap.max_recv_wr = nbufs;
+    qpinit.cap.max_send_sge = 1;
+    qpinit.cap.max_recv_sge = 1;
+    qpinit.cap.max_inline_data = NN_VERBS_MAXINLINE;
+    self->qp = ibv_create_qp (self->pd, &qpinit);
+    if (!self->qp) {
+
+        /*  Some devices don't support inline data at all. */
+        qpinit.cap.max_inline_data = 0;
+        self->qp = ibv_create_qp (self->pd, &qpinit);
+        if (!self->qp)
+            goto fail;
+    }
+    self->maxinline = qpinit.cap.max_inline_data;
+
+    memset (&qpattr, 0, sizeof (qpattr));
+    qpattr.qp_state = IBV_QPS_INIT;
+    qpattr.pkey_index = 0;
+    qpattr.port_num = self->port;
+    qpattr.qp_access_flags = 0;
+    rc = ibv_modify_qp (self->qp, &qpattr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+        IBV_QP_PORT | IBV_QP_ACCESS_FLAGS);
+    if (rc != 0)
+        goto fail;
+
+    /*  Receives can be posted before the queue pair is connected. */
+    self->txhead = self->txtail = 0;
+    self->rxhead = self->rxtail = 0;
+    for (i = 0; i != nbufs; ++i) {
+        if (nn_verbs_postrecv (self, (uint32_t) i) < 0)
+            goto fail;
+    }
+    if (ibv_req_notify_cq (self->cq, 0) != 0)
+        goto fail;
+
+    /*  Describe the queue pair to the peer. */
+    nn_random_generate (&self->psn, sizeof (self->psn));
+    self->psn &= 0xffffff;
+    memset (rec, 0, NN_VERBS_RECLEN);
+    nn_putl (rec, self->qp->qp_num);
+    nn_putl (rec + 4, self->psn);
+    nn_putl (rec + 8, (uint32_t) bufsz);
+    nn_puts (rec + 12, portattr.lid);
+    rec [14] = (uint8_t) self->mtu;
+    memcpy (rec + 16, gid.raw, 16);
+
+    return 0;
+
+fail:
+    nn_verbs_close (self);
+    return -ENOMEM;
+}
+
+int nn_verbs_connect (struct nn_verbs *self, const uint8_t *rec)
+{
+    int rc;
+    size_t bufsz;
+    struct ibv_qp_attr qpattr;
+    union ibv_gid gid;
+    static const uint8_t nogid [16] = {0};
+
+    bufsz = nn_getl (rec + 8);
+    if (nn_slow (bufsz < NN_VERBS_MINBUFSZ || rec [14] < IBV_MTU_256 ||
+          rec [14] > IBV_MTU_4096))
+        return -EPROTO;
+    self->fragsz = bufsz < self->bufsz ? bufsz : self->bufsz;
+    memcpy (gid.raw, rec + 16, 16);
+
+    memset (&qpattr, 0, sizeof (qpattr));
+    qpattr.qp_state = IBV_QPS_RTR;
+    qpattr.path_mtu = rec [14] < self->mtu ? rec [14] : self->mtu;
+    qpattr.dest_qp_num = nn_getl (rec);
+    qpattr.rq_psn = nn_getl (rec + 4) & 0xffffff;
+    qpattr.max_dest_rd_atomic = 1;
+    qpattr.min_rnr_timer = NN_VERBS_RNR_TIMER;
+    qpattr.ah_attr.dlid = nn_gets (rec + 12);
+    qpattr.ah_attr.sl = 0;
+    qpattr.ah_attr.src_path_bits = 0;
+    qpattr.ah_attr.port_num = self->port;
+
+    /*  RoCE has no local identifiers. The peers are addressed by GIDs. */
+    if (memcmp (gid.raw, nogid, 16) != 0 && self->gididx >= 0) {
+        qpattr.ah_attr.is_global = 1;
+        qpattr.ah_attr.grh.dgid = gid;
+        qpattr.ah_attr.grh.sgid_index = (uint8_t) self->gididx;
+        qpattr.ah_attr.grh.hop_limit = 64;
+    }
+    rc = ibv_modify_qp (self->qp, &qpattr, IBV_QP_STATE | IBV_QP_AV |
+        IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+        IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER);
+    if (rc != 0)
+        return -ECONNREFUSED;
+
+    /*  A receiver that runs out of posted slots makes the sender retry,
+        with no limit, until it consumes some of the messages. This is what
+        provides the back-pressure. */
+    memset (&qpattr, 0, sizeof (qpattr));
+    qpattr.qp_state = IBV_QPS_RTS;
+    qpattr.timeout = NN_VERBS_TIMEOUT;
+    qpattr.retry_cnt = 7;
+    qpattr.rnr_retry = 7;
+    qpattr.sq_psn = self->psn;
+    qpattr.max_rd_atomic = 1;
+    rc = ibv_modify_qp (self->qp, &qpattr, IBV_QP_STATE | IBV_QP_TIMEOUT |
+        IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
+        IBV_QP_MAX_QP_RD_ATOMIC);
+    if (rc != 0)
+        return -ECONNREFUSED;
+
+    return 0;
+}
+
+void nn_verbs_close (struct nn_verbs *self)
+{
+    int rc;
+
+    if (!self->ctx)
+        return;
+
+    /*  The notifications are acknowledged as soon as they are received,
+        so the completion queue can be destroyed straight away. */
+    if (self->qp) {
+        rc = ibv_destroy_qp (self->qp);
+        errnum_assert (rc == 0, rc);
+    }
+    if (self->cq) {
+        rc = ibv_destroy_cq (self->cq);
+        errnum_assert (rc == 0, rc);
+    }
+    if (self->channel) {
+        rc = ibv_destroy_comp_channel (self->channel);
+        errnum_assert (rc == 0, rc);
+    }
+    if (self->mr) {
+        rc = ibv_dereg_mr (self->mr);
+        errnum_assert (rc == 0, rc);
+    }
+    if (self->mem)
+        nn_free (self->mem);
+    if (self->rx)
+        nn_free (self->rx);
+    if (self->pd) {
+        rc = ibv_dealloc_pd (self->pd);
+        errnum_assert (rc == 0, rc);
+    }
+    rc = ibv_close_device (self->ctx);
+    errnum_assert (rc == 0, rc);
+
+    nn_verbs_init (self);
+}
+
+int nn_verbs_fd (struct nn_verbs *self)
+{
+    return self->channel->fd;
+}
+
+int nn_verbs_arm (struct nn_verbs *self)
+{
+    struct ibv_cq *cq;
+    void *ctx;
+
+    while (ibv_get_cq_event (self->channel, &cq, &ctx) == 0)
+        ibv_ack_cq_events (cq, 1);
+    if (nn_slow (ibv_req_notify_cq (self->cq, 0) != 0))
+        return -ECONNRESET;
+    return 0;
+}
+
+int nn_verbs_poll (struct nn_verbs *self)
+{
+    int rc;
+    int i;
+    struct ibv_wc wc [NN_VERBS_BATCH];
+    struct nn_verbs_rx *rx;
+
+    while (1) {
+        rc = ibv_poll_cq (self->cq, NN_VERBS_BATCH, wc);
+        if (nn_slow (rc < 0))
+            return -ECONNRESET;
+        for (i = 0; i != rc; ++i) {
+
+            /*  Once the connection breaks, all the outstanding work requests
+                are flushed with an error. */
+            if (nn_slow (wc [i].status != IBV_WC_SUCCESS))
+                return -ECONNRESET;
+
+            if (wc [i].opcode == IBV_WC_RECV) {
+                nn_assert (wc [i].wr_id == self->rxhead % self->nbufs);
+                rx = &self->rx [wc [i].wr_id];
+                rx->len = wc [i].byte_len;
+                rx->first = (wc [i].wc_flags & IBV_WC_WITH_IMM) ? 1 : 0;
+                rx->size = rx->first ? ntohl (wc [i].imm_data) : 0;
+                ++self->rxhead;
+                continue;
+            }
+
+            nn_assert (self->txtail != self->txhead);
+            ++self->txtail;
+        }
+        if (rc < NN_VERBS_BATCH)
+            return 0;
+    }
+}
+
+void *nn_verbs_txbuf (struct nn_verbs *self)
+{
+    if (self->txhead - self->txtail >= (uint32_t) self->nbufs)
+        return NULL;
+    return self->mem + (self->txhead % self->nbufs) * self->bufsz;
+}
+
+int nn_verbs_send (struct nn_verbs *self, size_t len, int first,
+    uint32_t size)
+{
+    int rc;
+    uint32_t slot;
+    struct ibv_sge sge;
+    struct ibv_send_wr wr;
+    struct ibv_send_wr *bad;
+
+    nn_assert (self->txhead - self->txtail < (uint32_t) self->nbufs);
+    nn_assert (len <= self->fragsz);
+
+    slot = self->txhead % self->nbufs;
+    sge.addr = (uintptr_t) (self->mem + slot * self->bufsz);
+    sge.length = (uint32_t) len;
+    sge.lkey = self->mr->lkey;
+    memset (&wr, 0, sizeof (wr));
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = len ? 1 : 0;
+    wr.opcode = first ? IBV_WR_SEND_WITH_IMM : IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    if (len <= self->maxinline)
+        wr.send_flags |= IBV_SEND_INLINE;
+    if (first)
+        wr.imm_data = htonl (size);
+    rc = ibv_post_send (self->qp, &wr, &bad);
+    if (nn_slow (rc != 0))
+        return -ECONNRESET;
+    ++self->txhead;
+
+    return 0;
+}
+
+void *nn_verbs_rxbuf (struct nn_verbs *self, size_t *len, int *first,
+    uint32_t *size)
+{
+    uint32_t slot;
+
+    if (self->rxtail == self->rxhead)
+        return NULL;
+    slot = self->rxtail % self->nbufs;
+    *len = self->rx [slot].len;
+    *first = self->rx [slot].first;
+    *size = self->rx [slot].size;
+    return self->mem + (self->nbufs + slot) * self->bufsz;
+}
+
+int nn_verbs_recvdone (struct nn_verbs *self)
+{
+    int rc;
+
+    nn_assert (self->rxtail != self->rxhead);
+    rc = nn_verbs_postrecv (self, self->rxtail % self->nbufs);
+    if (nn_slow (rc < 0))
+        return rc;
+    ++self->rxtail;
+    return 0;
+}
+
+static int nn_verbs_postrecv (struct nn_verbs *self, uint32_t slot)
+{
+    struct ibv_sge sge;
+    struct ibv_recv_wr wr;
+    struct ibv_recv_wr *bad;
+
+    sge.addr = (uintptr_t) (self->mem + (self->nbufs + slot) * self->bufsz);
+    sge.length = (uint32_t) self->bufsz;
+    sge.lkey = self->mr->lkey;
+    memset (&wr, 0, sizeof (wr));
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    if (nn_slow (ibv_post_recv (self->qp, &wr, &bad) != 0))
+        return -ECONNRESET;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_VERBS_INCLUDED
+#define NN_VERBS_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Reliable connected queue pair driven through the verbs interface, along
+    with the memory registered for it. The memory is split into fixed-size
+    slots, half of them used for outbound messages and half of them posted
+    to the receive queue. Messages larger than a slot are split into several
+    sends. The first send of a message carries its total size as immediate
+    data so that the receiver can allocate the message up front.
+
+    Queue pairs are set up by exchanging records describing them via some
+    other channel. Completions are signalled via a file descriptor, which
+    becomes readable once nn_verbs_arm was called and a completion arrived. */
+
+/*  Length of the record describing the local queue pair. */
+#define NN_VERBS_RECLEN 32
+
+/*  Limits for the size and number of the slots. */
+#define NN_VERBS_MINBUFSZ 256
+#define NN_VERBS_MAXBUFSZ (1 << 30)
+#define NN_VERBS_MAXBUFS 1024
+
+struct ibv_context;
+struct ibv_pd;
+struct ibv_comp_channel;
+struct ibv_cq;
+struct ibv_qp;
+struct ibv_mr;
+
+/*  Completed receive. */
+struct nn_verbs_rx {
+    uint32_t len;
+    uint32_t size;
+    int first;
+};
+
+struct nn_verbs {
+
+    /*  Verbs objects. 'ctx' is NULL if the queue pair is not open. */
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+    struct ibv_comp_channel *channel;
+    struct ibv_cq *cq;
+    struct ibv_qp *qp;
+    struct ibv_mr *mr;
+
+    /*  Local port and the parameters of the connection announced in the
+        record. */
+    uint8_t port;
+    int gididx;
+    int mtu;
+    uint32_t psn;
+
+    /*  Registered memory. Outbound slots are followed by the inbound ones. */
+    uint8_t *mem;
+    size_t bufsz;
+    int nbufs;
+
+    /*  Largest send that can be posted inline. */
+    size_t maxinline;
+
+    /*  Size of the fragments the messages are split into: the smaller of
+        the slot sizes of the two sides. */
+    size_t fragsz;
+
+    /*  Outbound slots are used in order. 'txhead' is the number of sends
+        posted so far and 'txtail' is the number of those completed. */
+    uint32_t txhead;
+    uint32_t txtail;
+
+    /*  Inbound slots complete in the order they were posted in. 'rxhead' is
+        the number of receives completed so far and 'rxtail' is the number
+        of those consumed and posted anew. */
+    uint32_t rxhead;
+    uint32_t rxtail;
+    struct nn_verbs_rx *rx;
+};
+
+void nn_verbs_init (struct nn_verbs *self);
+void nn_verbs_term (struct nn_verbs *self);
+
+/*  Returns 0 if there is at least one RDMA device in the system, -ENODEV
+    otherwise. */
+int nn_verbs_available (void);
+
+/*  Opens the first device with an active port, creates the queue pair and
+    registers 'nbufs' slots of 'bufsz' bytes for either direction. The record
+    to pass to the peer is stored in 'rec'. 'gididx' is the index of the
+    local GID to use, which matters for RoCE. */
+int nn_verbs_open (struct nn_verbs *self, size_t bufsz, int nbufs,
+    int gididx, uint8_t *rec);
+
+/*  Connects the queue pair to the one described by the peer's record. */
+int nn_verbs_connect (struct nn_verbs *self, const uint8_t *rec);
+
+/*  Destroys the queue pair and releases the registered memory. */
+void nn_verbs_close (struct nn_verbs *self);
+
+/*  Returns the file descriptor signalling the completions. */
+int nn_verbs_fd (struct nn_verbs *self);
+
+/*  Consumes the pending notifications and asks for a new one. Completions
+    have to be polled for afterwards so that none of them is missed. */
+int nn_verbs_arm (struct nn_verbs *self);
+
+/*  Processes the completions. Returns -ECONNRESET if any of the operations
+    failed, which is how a broken connection is reported. */
+int nn_verbs_poll (struct nn_verbs *self);
+
+/*  Returns the next free outbound slot, NULL if there's none. Its data is
+    sent by nn_verbs_send. 'first' is set for the first fragment of
+    a message, in which case 'size' is the size of the whole message. */
+void *nn_verbs_txbuf (struct nn_verbs *self);
+int nn_verbs_send (struct nn_verbs *self, size_t len, int first,
+    uint32_t size);
+
+/*  Returns the data of the next received fragment, NULL if there's none.
+    The slot is posted anew by nn_verbs_recvdone. */
+void *nn_verbs_rxbuf (struct nn_verbs *self, size_t *len, int *first,
+    uint32_t *size);
+int nn_verbs_recvdone (struct nn_verbs *self);
+
+#endif
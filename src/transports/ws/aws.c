@@ -60,7 +60,9 @@ void nn_aws_init (struct nn_aws *self, int src,
     self->listener_owner.src = -1;
     self->listener_owner.fsm = NULL;
     nn_sws_init (&self->sws, NN_AWS_SRC_SWS, ep, &self->fsm);
+    self->handshaking = 0;
     nn_fsm_event_init (&self->accepted);
+    nn_fsm_event_init (&self->established);
     nn_fsm_event_init (&self->done);
     nn_list_item_init (&self->item);
 }
@@ -71,6 +73,7 @@ void nn_aws_term (struct nn_aws *self)
 
     nn_list_item_term (&self->item);
     nn_fsm_event_term (&self->done);
+    nn_fsm_event_term (&self->established);
     nn_fsm_event_term (&self->accepted);
     nn_sws_term (&self->sws);
     nn_usock_term (&self->usock);
@@ -146,6 +149,7 @@ static void nn_aws_handler (struct nn_fsm *self, int src, int type,
     int val;
     size_t sz;
     uint8_t msg_type;
+    struct nn_ws_deflate_opts deflate;
 
     aws = nn_cont (self, struct nn_aws, fsm);
 
@@ -198,6 +202,7 @@ static void nn_aws_handler (struct nn_fsm *self, int src, int type,
                 sz = sizeof (val);
                 nn_ep_getopt (aws->ep, NN_WS, NN_WS_MSG_TYPE, &val, &sz);
                 msg_type = (uint8_t)val;
+                nn_ws_deflate_getopts (&deflate, aws->ep);
 
                 /*   Since the WebSocket handshake must poll, the receive
                      timeout is set to zero. Later, it will be set again
@@ -212,12 +217,13 @@ static void nn_aws_handler (struct nn_fsm *self, int src, int type,
                 aws->listener = NULL;
                 aws->listener_owner.src = -1;
                 aws->listener_owner.fsm = NULL;
+                aws->handshaking = 1;
                 nn_fsm_raise (&aws->fsm, &aws->accepted, NN_AWS_ACCEPTED);
 
                 /*  Start the sws state machine. */
                 nn_usock_activate (&aws->usock);
                 nn_sws_start (&aws->sws, &aws->usock, NN_WS_SERVER,
-                    NULL, NULL, msg_type);
+                    NULL, NULL, msg_type, &deflate);
                 aws->state = NN_AWS_STATE_ACTIVE;
 
                 nn_ep_stat_increment (aws->ep, NN_STAT_ACCEPTED_CONNECTIONS, 1);
@@ -264,6 +270,11 @@ static void nn_aws_handler (struct nn_fsm *self, int src, int type,
                 aws->state = NN_AWS_STATE_STOPPING_SWS;
                 nn_ep_stat_increment (aws->ep, NN_STAT_BROKEN_CONNECTIONS, 1);
                 return;
+            case NN_SWS_RETURN_ESTABLISHED:
+                aws->handshaking = 0;
+                nn_fsm_raise (&aws->fsm, &aws->established,
+                    NN_AWS_ESTABLISHED);
+                return;
             default:
                 nn_fsm_bad_action (aws->state, src, type);
             }
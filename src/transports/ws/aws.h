@@ -42,6 +42,7 @@
 #define NN_AWS_ACCEPTED 34231
 #define NN_AWS_ERROR 34232
 #define NN_AWS_STOPPED 34233
+#define NN_AWS_ESTABLISHED 34234
 
 struct nn_aws {
 
@@ -62,8 +63,13 @@ struct nn_aws {
     /*  State machine that takes care of the connection in the active state. */
     struct nn_sws sws;
 
+    /*  1 from accepting the connection till the opening handshake is
+        complete. */
+    int handshaking;
+
     /*  Events generated by aws state machine. */
     struct nn_fsm_event accepted;
+    struct nn_fsm_event established;
     struct nn_fsm_event done;
 
     /*  This member can be used by owner to keep individual awss in a list. */
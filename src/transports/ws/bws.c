@@ -37,6 +37,7 @@
 #include "../../utils/list.h"
 #include "../../utils/fast.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #if defined NN_HAVE_WINDOWS
@@ -50,6 +51,10 @@
     connection attemps during re-connection storms. */
 #define NN_BWS_BACKLOG 100
 
+/*  Default number of accepted connections that may be doing the opening
+    handshake at the same time. */
+#define NN_BWS_DEFAULT_HANDSHAKE_MAX 64
+
 #define NN_BWS_STATE_IDLE 1
 #define NN_BWS_STATE_ACTIVE 2
 #define NN_BWS_STATE_STOPPING_AWS 3
@@ -75,6 +80,17 @@ struct nn_bws {
 
     /*  List of accepted connections. */
     struct nn_list awss;
+
+    /*  Number of accepted connections doing the opening handshake and
+        the limit thereof. Once the limit is reached, no new connections are
+        accepted till one of the handshakes ends. Zero means no limit. */
+    int handshakes;
+    int handshake_max;
+
+    /*  Number of accepted connections and the limit thereof, as set by
+        NN_MAXCONN. Zero means no limit. */
+    int nconns;
+    int maxconn;
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -92,6 +108,8 @@ static void nn_bws_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_bws_listen (struct nn_bws *self);
 static void nn_bws_start_accepting (struct nn_bws *self);
+static void nn_bws_handshake_done (struct nn_bws *self);
+static void nn_bws_resume_accepting (struct nn_bws *self);
 
 int nn_bws_create (struct nn_ep *ep)
 {
@@ -104,6 +122,8 @@ int nn_bws_create (struct nn_ep *ep)
     size_t sslen;
     int ipv4only;
     size_t ipv4onlylen;
+    size_t maxconnsz;
+    const char *envvar;
 
     /*  Allocate the new endpoint object. */
     self = nn_alloc (sizeof (struct nn_bws), "bws");
@@ -142,6 +162,15 @@ int nn_bws_create (struct nn_ep *ep)
     self->state = NN_BWS_STATE_IDLE;
     self->aws = NULL;
     nn_list_init (&self->awss);
+    self->handshakes = 0;
+    self->handshake_max = NN_BWS_DEFAULT_HANDSHAKE_MAX;
+    envvar = getenv ("NN_WS_HANDSHAKE_MAX");
+    if (envvar)
+        self->handshake_max = atoi (envvar);
+    self->nconns = 0;
+    maxconnsz = sizeof (self->maxconn);
+    nn_ep_getopt (ep, NN_SOL_SOCKET, NN_MAXCONN, &self->maxconn, &maxconnsz);
+    nn_assert (maxconnsz == sizeof (self->maxconn));
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
@@ -190,20 +219,21 @@ static void nn_bws_shutdown (struct nn_fsm *self, int src, int type,
     bws = nn_cont (self, struct nn_bws, fsm);
 
     if (src == NN_FSM_ACTION && type == NN_FSM_STOP) {
-        if (bws->aws) {
+
+        /*  There's no connection being accepted if accepting is paused,
+            but the listening socket has to be stopped all the same. */
+        if (bws->aws)
             nn_aws_stop (bws->aws);
-            bws->state = NN_BWS_STATE_STOPPING_AWS;
-        }
-        else {
-            bws->state = NN_BWS_STATE_STOPPING_USOCK;
-        }
+        bws->state = NN_BWS_STATE_STOPPING_AWS;
     }
     if (bws->state == NN_BWS_STATE_STOPPING_AWS) {
-        if (!nn_aws_isidle (bws->aws))
-            return;
-        nn_aws_term (bws->aws);
-        nn_free (bws->aws);
-        bws->aws = NULL;
+        if (bws->aws) {
+            if (!nn_aws_isidle (bws->aws))
+                return;
+            nn_aws_term (bws->aws);
+            nn_free (bws->aws);
+            bws->aws = NULL;
+        }
         nn_usock_stop (&bws->usock);
         bws->state = NN_BWS_STATE_STOPPING_USOCK;
     }
@@ -284,17 +314,26 @@ static void nn_bws_handler (struct nn_fsm *self, int src, int type,
                 nn_list_end (&bws->awss));
             bws->aws = NULL;
 
-            /*  Start waiting for a new incoming connection. */
-            nn_bws_start_accepting (bws);
+            ++bws->handshakes;
+            ++bws->nconns;
+            nn_bws_resume_accepting (bws);
+            return;
+
+        case NN_AWS_ESTABLISHED:
+            nn_bws_handshake_done (bws);
             return;
 
         case NN_AWS_ERROR:
+            if (aws->handshaking)
+                nn_bws_handshake_done (bws);
             nn_aws_stop (aws);
             return;
         case NN_AWS_STOPPED:
             nn_list_erase (&bws->awss, &aws->item);
             nn_aws_term (aws);
             nn_free (aws);
+            --bws->nconns;
+            nn_bws_resume_accepting (bws);
             return;
         default:
             nn_fsm_bad_action (bws->state, src, type);
@@ -395,3 +434,27 @@ static void nn_bws_start_accepting (struct nn_bws *self)
     /*  Start waiting for a new incoming connection. */
     nn_aws_start (self->aws, &self->usock);
 }
+
+static void nn_bws_handshake_done (struct nn_bws *self)
+{
+    nn_assert (self->handshakes > 0);
+    --self->handshakes;
+
+    /*  If accepting was put on hold because of the limit, resume it. */
+    nn_bws_resume_accepting (self);
+}
+
+static void nn_bws_resume_accepting (struct nn_bws *self)
+{
+    /*  Start waiting for a new incoming connection, unless there are too
+        many handshakes in progress or too many connections already. In such
+        case new connections wait in the listen backlog so that they don't
+        starve the established connections. */
+    if (self->aws)
+        return;
+    if (self->handshake_max > 0 && self->handshakes >= self->handshake_max)
+        return;
+    if (self->maxconn > 0 && self->nconns >= self->maxconn)
+        return;
+    nn_bws_start_accepting (self);
+}
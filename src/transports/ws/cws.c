@@ -86,6 +86,9 @@ struct nn_cws {
     /*  Defines message validation and framing. */
     uint8_t msg_type;
 
+    /*  Compression requested for the connections. */
+    struct nn_ws_deflate_opts deflate;
+
     /*  State machine that handles the active part of the connection
         lifetime. */
     struct nn_sws sws;
@@ -238,6 +241,7 @@ int nn_cws_create (struct nn_ep *ep)
     nn_ep_getopt (ep, NN_WS, NN_WS_MSG_TYPE, &msg_type, &sz);
     nn_assert (sz == sizeof (msg_type));
     self->msg_type = (uint8_t) msg_type;
+    nn_ws_deflate_getopts (&self->deflate, ep);
 
     sz = sizeof (reconnect_ivl);
     nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RECONNECT_IVL, &reconnect_ivl, &sz);
@@ -305,6 +309,7 @@ static void nn_cws_shutdown (struct nn_fsm *self, int src, int type,
         if (!nn_sws_isidle (&cws->sws))
             return;
         nn_backoff_stop (&cws->retry);
+        nn_backoff_release (&cws->retry);
         nn_usock_stop (&cws->usock);
         nn_dns_stop (&cws->dns);
         cws->state = NN_CWS_STATE_STOPPING;
@@ -384,8 +389,8 @@ static void nn_cws_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_DNS_STOPPED:
                 if (cws->dns_result.error == 0) {
-                    nn_cws_start_connecting (cws, &cws->dns_result.addr,
-                        cws->dns_result.addrlen);
+                    nn_cws_start_connecting (cws, &cws->dns_result.addrs [0],
+                        cws->dns_result.addrlens [0]);
                     return;
                 }
                 nn_backoff_start (&cws->retry);
@@ -409,9 +414,12 @@ static void nn_cws_handler (struct nn_fsm *self, int src, int type,
         case NN_CWS_SRC_USOCK:
             switch (type) {
             case NN_USOCK_CONNECTED:
+                nn_backoff_release (&cws->retry);
+                nn_backoff_reset (&cws->retry);
                 nn_sws_start (&cws->sws, &cws->usock, NN_WS_CLIENT,
                     nn_chunkref_data (&cws->resource),
-                    nn_chunkref_data (&cws->remote_host), cws->msg_type);
+                    nn_chunkref_data (&cws->remote_host), cws->msg_type,
+                    &cws->deflate);
                 cws->state = NN_CWS_STATE_ACTIVE;
                 cws->peer_gone = 0;
                 nn_ep_stat_increment (cws->ep,
@@ -421,6 +429,7 @@ static void nn_cws_handler (struct nn_fsm *self, int src, int type,
                 nn_ep_clear_error (cws->ep);
                 return;
             case NN_USOCK_ERROR:
+                nn_backoff_release (&cws->retry);
                 nn_ep_set_error (cws->ep, nn_usock_geterrno (&cws->usock));
                 nn_usock_stop (&cws->usock);
                 cws->state = NN_CWS_STATE_STOPPING_USOCK;
@@ -457,6 +466,8 @@ static void nn_cws_handler (struct nn_fsm *self, int src, int type,
                 cws->state = NN_CWS_STATE_STOPPING_SWS;
                 nn_ep_stat_increment (cws->ep, NN_STAT_BROKEN_CONNECTIONS, 1);
                 return;
+            case NN_SWS_RETURN_ESTABLISHED:
+                return;
             default:
                 nn_fsm_bad_action (cws->state, src, type);
             }
@@ -620,6 +631,15 @@ static void nn_cws_start_connecting (struct nn_cws *self,
         return;
     }
 
+    /*  Wait for a while if there are too many connection attempts under way
+        in the process already. */
+    rc = nn_backoff_acquire (&self->retry);
+    if (nn_slow (rc < 0)) {
+        nn_backoff_throttle (&self->retry);
+        self->state = NN_CWS_STATE_WAITING;
+        return;
+    }
+
     /*  Combine the remote address and the port. */
     remote = *ss;
     remotelen = sslen;
@@ -633,6 +653,7 @@ static void nn_cws_start_connecting (struct nn_cws *self,
     /*  Try to start the underlying socket. */
     rc = nn_usock_start (&self->usock, remote.ss_family, SOCK_STREAM, 0);
     if (nn_slow (rc < 0)) {
+        nn_backoff_release (&self->retry);
         nn_backoff_start (&self->retry);
         self->state = NN_CWS_STATE_WAITING;
         return;
@@ -653,6 +674,7 @@ static void nn_cws_start_connecting (struct nn_cws *self,
     /*  Bind the socket to the local network interface. */
     rc = nn_usock_bind (&self->usock, (struct sockaddr*) &local, locallen);
     if (nn_slow (rc != 0)) {
+        nn_backoff_release (&self->retry);
         nn_backoff_start (&self->retry);
         self->state = NN_CWS_STATE_WAITING;
         return;
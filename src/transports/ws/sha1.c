@@ -22,18 +22,25 @@
 
 #include "sha1.h"
 
+#include "sha1.h"
+
+#include "../../utils/wire.h"
+
+#include <string.h>
+
+#if defined __SHA__ && defined __SSE4_1__
+#include <immintrin.h>
+#define NN_SHA1_SHANI
+#endif
+
 #define sha1_rol32(num,bits) ((num << bits) | (num >> (32 - bits)))
 
+/*  Hashes 'nblocks' consecutive 64-byte blocks of data. */
+static void nn_sha1_blocks (uint32_t *state, const uint8_t *data,
+    size_t nblocks);
+
 void nn_sha1_init (struct nn_sha1 *self)
 {
-    /*  Detect endianness. */
-    union {
-        uint32_t i;
-        char c[4];
-    } test = { 0x00000001 };
-
-    self->is_little_endian = test.c[0];
-
     /*  Initial state of the hash. */
     self->state [0] = 0x67452301;
     self->state [1] = 0xefcdab89;
@@ -44,31 +51,123 @@ void nn_sha1_init (struct nn_sha1 *self)
     self->buffer_offset = 0;
 }
 
-static void nn_sha1_add (struct nn_sha1 *self, uint8_t data)
+#if defined NN_SHA1_SHANI
+
+/*  Four rounds of the hash using the SHA extensions, interleaved with the
+    computation of the message schedule for the subsequent rounds. */
+#define NN_SHA1_ROUNDS4(f, enext, ecur, w0, w1, w2, w3)\
+    do {\
+        enext = _mm_sha1nexte_epu32 (enext, w0);\
+        ecur = abcd;\
+        w1 = _mm_sha1msg2_epu32 (w1, w0);\
+        abcd = _mm_sha1rnds4_epu32 (abcd, enext, f);\
+        w3 = _mm_sha1msg1_epu32 (w3, w0);\
+        w2 = _mm_xor_si128 (w2, w0);\
+    } while (0)
+
+static void nn_sha1_blocks (uint32_t *state, const uint8_t *data,
+    size_t nblocks)
+{
+    __m128i abcd;
+    __m128i abcd_save;
+    __m128i e0;
+    __m128i e1;
+    __m128i e_save;
+    __m128i w0;
+    __m128i w1;
+    __m128i w2;
+    __m128i w3;
+    __m128i bswap;
+
+    /*  The message words are big-endian. */
+    bswap = _mm_set_epi64x (0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    abcd = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i*) state), 0x1b);
+    e0 = _mm_set_epi32 ((int) state [4], 0, 0, 0);
+
+    for (; nblocks; --nblocks, data += SHA1_BLOCK_LEN) {
+        abcd_save = abcd;
+        e_save = e0;
+
+        /*  Rounds 0 to 15 consume the block itself. */
+        w0 = _mm_shuffle_epi8 (
+            _mm_loadu_si128 ((const __m128i*) data), bswap);
+        e0 = _mm_add_epi32 (e0, w0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32 (abcd, e0, 0);
+
+        w1 = _mm_shuffle_epi8 (
+            _mm_loadu_si128 ((const __m128i*) (data + 16)), bswap);
+        e1 = _mm_sha1nexte_epu32 (e1, w1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32 (abcd, e1, 0);
+        w0 = _mm_sha1msg1_epu32 (w0, w1);
+
+        w2 = _mm_shuffle_epi8 (
+            _mm_loadu_si128 ((const __m128i*) (data + 32)), bswap);
+        e0 = _mm_sha1nexte_epu32 (e0, w2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32 (abcd, e0, 0);
+        w1 = _mm_sha1msg1_epu32 (w1, w2);
+        w0 = _mm_xor_si128 (w0, w2);
+
+        w3 = _mm_shuffle_epi8 (
+            _mm_loadu_si128 ((const __m128i*) (data + 48)), bswap);
+        NN_SHA1_ROUNDS4 (0, e1, e0, w3, w0, w1, w2);
+
+        /*  Rounds 16 to 79. The schedule computed in the last few rounds
+            is not used. */
+        NN_SHA1_ROUNDS4 (0, e0, e1, w0, w1, w2, w3);
+        NN_SHA1_ROUNDS4 (1, e1, e0, w1, w2, w3, w0);
+        NN_SHA1_ROUNDS4 (1, e0, e1, w2, w3, w0, w1);
+        NN_SHA1_ROUNDS4 (1, e1, e0, w3, w0, w1, w2);
+        NN_SHA1_ROUNDS4 (1, e0, e1, w0, w1, w2, w3);
+        NN_SHA1_ROUNDS4 (1, e1, e0, w1, w2, w3, w0);
+        NN_SHA1_ROUNDS4 (2, e0, e1, w2, w3, w0, w1);
+        NN_SHA1_ROUNDS4 (2, e1, e0, w3, w0, w1, w2);
+        NN_SHA1_ROUNDS4 (2, e0, e1, w0, w1, w2, w3);
+        NN_SHA1_ROUNDS4 (2, e1, e0, w1, w2, w3, w0);
+        NN_SHA1_ROUNDS4 (2, e0, e1, w2, w3, w0, w1);
+        NN_SHA1_ROUNDS4 (3, e1, e0, w3, w0, w1, w2);
+        NN_SHA1_ROUNDS4 (3, e0, e1, w0, w1, w2, w3);
+        NN_SHA1_ROUNDS4 (3, e1, e0, w1, w2, w3, w0);
+        NN_SHA1_ROUNDS4 (3, e0, e1, w2, w3, w0, w1);
+        NN_SHA1_ROUNDS4 (3, e1, e0, w3, w0, w1, w2);
+
+        e0 = _mm_sha1nexte_epu32 (e0, e_save);
+        abcd = _mm_add_epi32 (abcd, abcd_save);
+    }
+
+    _mm_storeu_si128 ((__m128i*) state, _mm_shuffle_epi32 (abcd, 0x1b));
+    state [4] = (uint32_t) _mm_extract_epi32 (e0, 3);
+}
+
+#else
+
+static void nn_sha1_blocks (uint32_t *state, const uint8_t *data,
+    size_t nblocks)
 {
-    uint8_t i;
+    int i;
+    uint32_t w [16];
     uint32_t a, b, c, d, e, t;
-    uint8_t * const buf = (uint8_t*) self->buffer;
-
-    if (self->is_little_endian)
-        buf [self->buffer_offset ^ 3] = data;
-    else
-        buf [self->buffer_offset] = data;
-
-    self->buffer_offset++;
-    if (self->buffer_offset == SHA1_BLOCK_LEN) {
-        a = self->state [0];
-        b = self->state [1];
-        c = self->state [2];
-        d = self->state [3];
-        e = self->state [4];
+
+    for (; nblocks; --nblocks, data += SHA1_BLOCK_LEN) {
+        for (i = 0; i != 16; ++i)
+            w [i] = ((uint32_t) data [i * 4] << 24) |
+                ((uint32_t) data [i * 4 + 1] << 16) |
+                ((uint32_t) data [i * 4 + 2] << 8) |
+                ((uint32_t) data [i * 4 + 3]);
+
+        a = state [0];
+        b = state [1];
+        c = state [2];
+        d = state [3];
+        e = state [4];
         for (i = 0; i < 80; i++) {
             if (i >= 16) {
-                t = self->buffer [(i + 13) & 15] ^
-                    self->buffer [(i + 8) & 15] ^
-                    self->buffer [(i + 2) & 15] ^
-                    self->buffer [i & 15];
-                self->buffer [i & 15] = sha1_rol32 (t, 1);
+                t = w [(i + 13) & 15] ^ w [(i + 8) & 15] ^
+                    w [(i + 2) & 15] ^ w [i & 15];
+                w [i & 15] = sha1_rol32 (t, 1);
             }
 
             if (i < 20)
@@ -80,7 +179,7 @@ static void nn_sha1_add (struct nn_sha1 *self, uint8_t data)
             else
                 t = (b ^ c ^ d) + 0xCA62C1D6;
 
-            t += sha1_rol32 (a, 5) + e + self->buffer [i & 15];
+            t += sha1_rol32 (a, 5) + e + w [i & 15];
             e = d;
             d = c;
             c = sha1_rol32 (b, 30);
@@ -88,56 +187,78 @@ static void nn_sha1_add (struct nn_sha1 *self, uint8_t data)
             a = t;
         }
 
-        self->state [0] += a;
-        self->state [1] += b;
-        self->state [2] += c;
-        self->state [3] += d;
-        self->state [4] += e;
-
-        self->buffer_offset = 0;
+        state [0] += a;
+        state [1] += b;
+        state [2] += c;
+        state [3] += d;
+        state [4] += e;
     }
 }
 
-void nn_sha1_hashbyte (struct nn_sha1 *self, uint8_t data)
+#endif
+
+void nn_sha1_hash (struct nn_sha1 *self, const void *data, size_t len)
 {
-    ++self->bytes_hashed;
-    nn_sha1_add (self, data);
+    const uint8_t *pos;
+    size_t sz;
+
+    pos = (const uint8_t*) data;
+    self->bytes_hashed += (uint32_t) len;
+
+    /*  Complete the partially filled block first. */
+    if (self->buffer_offset) {
+        sz = SHA1_BLOCK_LEN - self->buffer_offset;
+        if (sz > len)
+            sz = len;
+        memcpy (self->buffer + self->buffer_offset, pos, sz);
+        self->buffer_offset += (uint8_t) sz;
+        pos += sz;
+        len -= sz;
+        if (self->buffer_offset < SHA1_BLOCK_LEN)
+            return;
+        nn_sha1_blocks (self->state, self->buffer, 1);
+        self->buffer_offset = 0;
+    }
+
+    /*  Whole blocks are hashed directly from the supplied data. */
+    if (len >= SHA1_BLOCK_LEN) {
+        nn_sha1_blocks (self->state, pos, len / SHA1_BLOCK_LEN);
+        pos += len - len % SHA1_BLOCK_LEN;
+        len %= SHA1_BLOCK_LEN;
+    }
+
+    memcpy (self->buffer, pos, len);
+    self->buffer_offset = (uint8_t) len;
 }
 
 uint8_t* nn_sha1_result (struct nn_sha1 *self)
 {
     int i;
 
-    /*  Pad to complete the last block. */
-    nn_sha1_add (self, 0x80);
-
-    while (self->buffer_offset != 56)
-        nn_sha1_add (self, 0x00);
+    /*  Pad to complete the last block. If there's no space left for the
+        length, the padding spills over to one more block. */
+    self->buffer [self->buffer_offset++] = 0x80;
+    if (self->buffer_offset > SHA1_BLOCK_LEN - 8) {
+        memset (self->buffer + self->buffer_offset, 0,
+            SHA1_BLOCK_LEN - self->buffer_offset);
+        nn_sha1_blocks (self->state, self->buffer, 1);
+        self->buffer_offset = 0;
+    }
+    memset (self->buffer + self->buffer_offset, 0,
+        SHA1_BLOCK_LEN - 8 - self->buffer_offset);
 
     /*  Append length in the last 8 bytes. SHA-1 supports 64-bit hashes, so
         zero-pad the top bits. Shifting to multiply by 8 as SHA-1 supports
         bit- as well as byte-streams. */
-    nn_sha1_add (self, 0);
-    nn_sha1_add (self, 0);
-    nn_sha1_add (self, 0);
-    nn_sha1_add (self, self->bytes_hashed >> 29);
-    nn_sha1_add (self, self->bytes_hashed >> 21);
-    nn_sha1_add (self, self->bytes_hashed >> 13);
-    nn_sha1_add (self, self->bytes_hashed >> 5);
-    nn_sha1_add (self, self->bytes_hashed << 3);
-
-    /*  Correct byte order for little-endian systems. */
-    if (self->is_little_endian) {
-        for (i = 0; i < 5; i++) {
-            self->state [i] =
-                (((self->state [i]) << 24) & 0xFF000000) |
-                (((self->state [i]) << 8) & 0x00FF0000) |
-                (((self->state [i]) >> 8) & 0x0000FF00) |
-                (((self->state [i]) >> 24) & 0x000000FF);
-        }
-    }
+    nn_putl (self->buffer + SHA1_BLOCK_LEN - 8, self->bytes_hashed >> 29);
+    nn_putl (self->buffer + SHA1_BLOCK_LEN - 4, self->bytes_hashed << 3);
+    nn_sha1_blocks (self->state, self->buffer, 1);
+    self->buffer_offset = 0;
+
+    /*  The hash is the state in big-endian byte order. */
+    for (i = 0; i < 5; i++)
+        nn_putl (self->result + i * 4, self->state [i]);
 
     /* 20-octet pointer to hash. */
-    return (uint8_t*) self->state;
+    return self->result;
 }
-
@@ -23,6 +23,7 @@
 #ifndef NN_SHA1_INCLUDED
 #define NN_SHA1_INCLUDED
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*****************************************************************************/
@@ -35,23 +36,24 @@
 /*  Caveat emptor for uses of this function elsewhere.                       */
 /*                                                                           */
 /*  Based on sha1.c (Public Domain) by Steve Reid, these functions calculate */
-/*  the SHA1 hash of arbitrary byte locations byte-by-byte.                  */
+/*  the SHA1 hash of arbitrary byte sequences a 64-byte block at a time.     */
+/*  If the compiler targets the x86 SHA extensions, they are used to hash    */
+/*  the blocks.                                                              */
 /*****************************************************************************/
 
 #define SHA1_HASH_LEN 20
 #define SHA1_BLOCK_LEN 64
 
 struct nn_sha1 {
-    uint32_t buffer [SHA1_BLOCK_LEN / sizeof (uint32_t)];
+    uint8_t buffer [SHA1_BLOCK_LEN];
     uint32_t state [SHA1_HASH_LEN / sizeof (uint32_t)];
     uint32_t bytes_hashed;
     uint8_t buffer_offset;
-    uint8_t is_little_endian;
+    uint8_t result [SHA1_HASH_LEN];
 };
 
 void nn_sha1_init (struct nn_sha1 *self);
-void nn_sha1_hashbyte (struct nn_sha1 *self, uint8_t data);
+void nn_sha1_hash (struct nn_sha1 *self, const void *data, size_t len);
 uint8_t* nn_sha1_result (struct nn_sha1 *self);
 
 #endif
-
@@ -23,10 +23,12 @@
 */
 
 #include "sws.h"
+#include "ws_mask.h"
 #include "../../ws.h"
 #include "../../nn.h"
 
 #include "../../utils/alloc.h"
+#include "../../utils/chunk.h"
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
@@ -34,6 +36,18 @@
 #include "../../utils/attr.h"
 #include "../../utils/random.h"
 
+#include <string.h>
+
+/*  Vector instructions used to process the payload, if available. */
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NN_SWS_SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#define NN_SWS_NEON
+#endif
+
 /*  States of the object as a whole. */
 #define NN_SWS_STATE_IDLE 1
 #define NN_SWS_STATE_HANDSHAKE 2
@@ -60,6 +74,7 @@
 /*  Subordinate srcptr objects. */
 #define NN_SWS_SRC_USOCK 1
 #define NN_SWS_SRC_HANDSHAKE 2
+#define NN_SWS_SRC_HEARTBEAT 3
 
 /*  WebSocket opcode constants as per RFC 6455 5.2. */
 #define NN_WS_OPCODE_FRAGMENT 0x00
@@ -102,9 +117,13 @@
 /*  Stream is a special type of pipe. Implementation of the virtual pipe API. */
 static int nn_sws_send (struct nn_pipebase *self, struct nn_msg *msg);
 static int nn_sws_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static size_t nn_sws_queued (struct nn_pipebase *self);
 const struct nn_pipebase_vfptr nn_sws_pipebase_vfptr = {
     nn_sws_send,
-    nn_sws_recv
+    nn_sws_recv,
+    nn_sws_queued,
+    NULL,
+    NULL
 };
 
 /*  Private functions. */
@@ -120,9 +139,25 @@ static void nn_sws_fail_conn (struct nn_sws *self, int code, char *reason);
 /*  Start receiving new message chunk. */
 static int nn_sws_recv_hdr (struct nn_sws *self);
 
-/*  Mask or unmask message payload. */
-static void nn_sws_mask_payload (uint8_t *payload, size_t payload_len,
-    const uint8_t *mask, size_t mask_len, int *mask_start_pos);
+/*  Start writing the frames queued so far. */
+static void nn_sws_flush (struct nn_sws *self);
+
+/*  Queues a heartbeat frame, or parses the one received. The latter returns
+    0 if the frame received is not a heartbeat. */
+static void nn_sws_heartbeat (struct nn_sws *self);
+static int nn_sws_recv_heartbeat (struct nn_sws *self);
+
+/*  Returns the length of the leading run of ASCII characters in the buffer,
+    rounded down to whole blocks. Used to validate text quickly. */
+static size_t nn_sws_ascii_len (const uint8_t *buf, size_t len);
+
+/*  Makes room for the fragment of the message that is about to be received
+    (inmsg_current_chunk_len bytes, already accounted for in inmsg_total_size)
+    and returns pointer to where it should be stored. */
+static uint8_t *nn_sws_inmsg_extend (struct nn_sws *self);
+
+/*  Deallocates the message being received, if any. */
+static void nn_sws_inmsg_term (struct nn_sws *self);
 
 /*  Validates incoming text chunks for UTF-8 compliance as per RFC 3629. */
 static void nn_sws_validate_utf8_chunk (struct nn_sws *self);
@@ -131,6 +166,10 @@ static void nn_sws_validate_utf8_chunk (struct nn_sws *self);
     RFC 6455 section 7. */
 static void nn_sws_acknowledge_close_handshake (struct nn_sws *self);
 
+/*  Hands the fully received message over to the user, decompressing it
+    first if needed. */
+static void nn_sws_received (struct nn_sws *self);
+
 void nn_sws_init (struct nn_sws *self, int src,
     struct nn_ep *ep, struct nn_fsm *owner)
 {
@@ -144,9 +183,15 @@ void nn_sws_init (struct nn_sws *self, int src,
     self->usock_owner.fsm = NULL;
     nn_pipebase_init (&self->pipebase, &nn_sws_pipebase_vfptr, ep);
     self->instate = -1;
-    nn_list_init (&self->inmsg_array);
+    self->inmsg_chunk = NULL;
+    self->inmsg_compressed = 0;
     self->outstate = -1;
-    nn_msg_init (&self->outmsg, 0);
+    nn_outq_init (&self->outq);
+    self->maskbuf = NULL;
+    self->maskbuf_size = 0;
+    nn_ws_deflate_init (&self->deflate);
+    nn_heartbeat_init (&self->heartbeat, NN_SWS_SRC_HEARTBEAT, &self->fsm);
+    self->peerheartbeat = 0;
 
     self->continuing = 0;
 
@@ -160,15 +205,20 @@ void nn_sws_init (struct nn_sws *self, int src,
     self->pongs_received = 0;
 
     nn_fsm_event_init (&self->done);
+    nn_fsm_event_init (&self->established);
 }
 
 void nn_sws_term (struct nn_sws *self)
 {
     nn_assert_state (self, NN_SWS_STATE_IDLE);
 
+    nn_fsm_event_term (&self->established);
     nn_fsm_event_term (&self->done);
-    nn_msg_term (&self->outmsg);
-    nn_msg_array_term (&self->inmsg_array);
+    nn_heartbeat_term (&self->heartbeat);
+    nn_ws_deflate_term (&self->deflate);
+    nn_free (self->maskbuf);
+    nn_outq_term (&self->outq);
+    nn_sws_inmsg_term (self);
     nn_pipebase_term (&self->pipebase);
     nn_ws_handshake_term (&self->handshaker);
     nn_fsm_term (&self->fsm);
@@ -180,7 +230,8 @@ int nn_sws_isidle (struct nn_sws *self)
 }
 
 void nn_sws_start (struct nn_sws *self, struct nn_usock *usock, int mode,
-    const char *resource, const char *host, uint8_t msg_type)
+    const char *resource, const char *host, uint8_t msg_type,
+    const struct nn_ws_deflate_opts *deflate)
 {
     /*  Take ownership of the underlying socket. */
     nn_assert (self->usock == NULL && self->usock_owner.fsm == NULL);
@@ -193,6 +244,7 @@ void nn_sws_start (struct nn_sws *self, struct nn_usock *usock, int mode,
     self->remote_host = host;
 
     self->msg_type = msg_type;
+    self->deflate_opts = *deflate;
 
     /*  Launch the state machine. */
     nn_fsm_start (&self->fsm);
@@ -203,41 +255,35 @@ void nn_sws_stop (struct nn_sws *self)
     nn_fsm_stop (&self->fsm);
 }
 
-void *nn_msg_chunk_new (size_t size, struct nn_list *msg_array)
+static uint8_t *nn_sws_inmsg_extend (struct nn_sws *self)
 {
-    struct msg_chunk *self;
-
-    self = nn_alloc (sizeof (struct msg_chunk), "msg_chunk");
-    alloc_assert (self);
-
-    nn_chunkref_init (&self->chunk, size);
-    nn_list_item_init (&self->item);
-
-    nn_list_insert (msg_array, &self->item, nn_list_end (msg_array));
+    int rc;
+    size_t capacity;
 
-    return nn_chunkref_data (&self->chunk);
-}
+    /*  Grow the buffer geometrically so that the message isn't copied
+        over and over again when it consists of many small fragments. */
+    if (!self->inmsg_chunk) {
+        rc = nn_chunk_alloc (self->inmsg_total_size, 0, &self->inmsg_chunk);
+        errnum_assert (rc == 0, -rc);
+    }
+    else if (nn_chunk_size (self->inmsg_chunk) < self->inmsg_total_size) {
+        capacity = nn_chunk_size (self->inmsg_chunk) * 2;
+        if (capacity < self->inmsg_total_size)
+            capacity = self->inmsg_total_size;
+        rc = nn_chunk_realloc (capacity, &self->inmsg_chunk);
+        errnum_assert (rc == 0, -rc);
+    }
 
-void nn_msg_chunk_term (struct msg_chunk *it, struct nn_list *msg_array)
-{
-    nn_chunkref_term (&it->chunk);
-    nn_list_erase (msg_array, &it->item);
-    nn_list_item_term (&it->item);
-    nn_free (it);
+    return ((uint8_t*) self->inmsg_chunk) + self->inmsg_total_size -
+        self->inmsg_current_chunk_len;
 }
 
-void nn_msg_array_term (struct nn_list *msg_array)
+static void nn_sws_inmsg_term (struct nn_sws *self)
 {
-    struct nn_list_item *it;
-    struct msg_chunk *ch;
-
-    while (!nn_list_empty (msg_array)) {
-        it = nn_list_begin (msg_array);
-        ch = nn_cont (it, struct msg_chunk, item);
-        nn_msg_chunk_term (ch, msg_array);
+    if (self->inmsg_chunk) {
+        nn_chunk_free (self->inmsg_chunk);
+        self->inmsg_chunk = NULL;
     }
-
-    nn_list_term (msg_array);
 }
 
 /*  Given a buffer location, this function determines whether the leading
@@ -323,35 +369,12 @@ static int nn_utf8_code_point (const uint8_t *buffer, size_t len)
     nn_assert (0);
 }
 
-static void nn_sws_mask_payload (uint8_t *payload, size_t payload_len,
-    const uint8_t *mask, size_t mask_len, int *mask_start_pos)
-{
-    unsigned i;
-
-    if (mask_start_pos) {
-        for (i = 0; i < payload_len; i++) {
-            payload [i] ^= mask [(i + *mask_start_pos) % mask_len];
-        }
-
-        *mask_start_pos = (i + *mask_start_pos) % mask_len;
-
-        return;
-    }
-    else {
-        for (i = 0; i < payload_len; i++) {
-            payload [i] ^= mask [i % mask_len];
-        }
-        return;
-    }
-}
-
 static int nn_sws_recv_hdr (struct nn_sws *self)
 {
     if (!self->continuing) {
-        nn_assert (nn_list_empty (&self->inmsg_array));
+        nn_assert (self->inmsg_chunk == NULL);
 
         self->inmsg_current_chunk_buf = NULL;
-        self->inmsg_chunks = 0;
         self->inmsg_current_chunk_len = 0;
         self->inmsg_total_size = 0;
     }
@@ -367,36 +390,37 @@ static int nn_sws_recv_hdr (struct nn_sws *self)
 static int nn_sws_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_sws *sws;
-    struct nn_iovec iov [3];
-    int mask_pos;
+    struct nn_iovec iov [NN_MSG_MAXPARTS + 2];
+    int i;
+    uint8_t opcode;
+    uint8_t *payload;
+    void *chunk;
+    int urgent;
     size_t nn_msg_size;
     size_t hdr_len;
+    uint8_t hdr [NN_SWS_FRAME_MAX_HDR_LEN];
     struct nn_cmsghdr *cmsg;
     struct nn_msghdr msghdr;
-    uint8_t rand_mask [NN_SWS_FRAME_SIZE_MASK];
 
     sws = nn_cont (self, struct nn_sws, pipebase);
 
     nn_assert_state (sws, NN_SWS_STATE_ACTIVE);
     nn_assert (sws->outstate == NN_SWS_OUTSTATE_IDLE);
+    nn_heartbeat_traffic (&sws->heartbeat);
 
-    /*  Move the message to the local storage. */
-    nn_msg_term (&sws->outmsg);
-    nn_msg_mv (&sws->outmsg, msg);
-
-    memset (sws->outhdr, 0, sizeof (sws->outhdr));
+    memset (hdr, 0, sizeof (hdr));
 
     hdr_len = NN_SWS_FRAME_SIZE_INITIAL;
 
     cmsg = NULL;
     msghdr.msg_iov = NULL;
     msghdr.msg_iovlen = 0;
-    msghdr.msg_controllen = nn_chunkref_size (&sws->outmsg.hdrs);
+    msghdr.msg_controllen = nn_chunkref_size (&msg->hdrs);
 
     /*  If the outgoing message has specified an opcode and control framing in
         its header, properly frame it as per RFC 6455 5.2. */
     if (msghdr.msg_controllen > 0) {
-        msghdr.msg_control = nn_chunkref_data (&sws->outmsg.hdrs);
+        msghdr.msg_control = nn_chunkref_data (&msg->hdrs);
         cmsg = NN_CMSG_FIRSTHDR (&msghdr);
         while (cmsg) {
             if (cmsg->cmsg_level == NN_WS && cmsg->cmsg_type == NN_WS_MSG_TYPE)
@@ -407,89 +431,227 @@ static int nn_sws_send (struct nn_pipebase *self, struct nn_msg *msg)
 
     /*  If the header does not specify an opcode, take default from option. */
     if (cmsg)
-        sws->outhdr [0] = *(uint8_t *) NN_CMSG_DATA (cmsg);
+        hdr [0] = *(uint8_t *) NN_CMSG_DATA (cmsg);
     else
-        sws->outhdr [0] = sws->msg_type;
+        hdr [0] = sws->msg_type;
 
     /*  For now, enforce that outgoing messages are the final frame. */
-    sws->outhdr [0] |= NN_SWS_FRAME_BITMASK_FIN;
+    hdr [0] |= NN_SWS_FRAME_BITMASK_FIN;
+
+    /*  If permessage-deflate is in use, the compressed payload of data
+        messages is sent instead of the original one as per RFC 7692. */
+    opcode = hdr [0] & NN_SWS_FRAME_BITMASK_OPCODE;
+    if (nn_ws_deflate_isactive (&sws->deflate) &&
+          (opcode == NN_WS_OPCODE_TEXT || opcode == NN_WS_OPCODE_BINARY)) {
+        iov [0].iov_base = nn_chunkref_data (&msg->sphdr);
+        iov [0].iov_len = nn_chunkref_size (&msg->sphdr);
+        iov [1].iov_base = nn_chunkref_data (&msg->body);
+        iov [1].iov_len = nn_chunkref_size (&msg->body);
+        for (i = 0; i != msg->nparts; ++i) {
+            iov [i + 2].iov_base = msg->parts [i];
+            iov [i + 2].iov_len = nn_chunk_size (msg->parts [i]);
+        }
+        nn_ws_deflate_compress (&sws->deflate, iov, msg->nparts + 2, &chunk);
+        urgent = msg->urgent;
+        nn_msg_term (msg);
+        nn_msg_init_chunk (msg, chunk);
+        msg->urgent = urgent;
+        hdr [0] |= NN_SWS_FRAME_BITMASK_RSV1;
+    }
 
-    nn_msg_size = nn_chunkref_size (&sws->outmsg.sphdr) +
-        nn_chunkref_size (&sws->outmsg.body);
+    nn_msg_size = nn_chunkref_size (&msg->sphdr) + nn_msg_bodysize (msg);
 
     /*  Framing WebSocket payload size in network byte order (big endian). */
     if (nn_msg_size <= NN_SWS_PAYLOAD_MAX_LENGTH) {
-        sws->outhdr [1] |= (uint8_t) nn_msg_size;
+        hdr [1] |= (uint8_t) nn_msg_size;
         hdr_len += NN_SWS_FRAME_SIZE_PAYLOAD_0;
     }
     else if (nn_msg_size <= NN_SWS_PAYLOAD_MAX_LENGTH_16) {
-        sws->outhdr [1] |= NN_SWS_PAYLOAD_FRAME_16;
-        nn_puts (&sws->outhdr [hdr_len], (uint16_t) nn_msg_size);
+        hdr [1] |= NN_SWS_PAYLOAD_FRAME_16;
+        nn_puts (&hdr [hdr_len], (uint16_t) nn_msg_size);
         hdr_len += NN_SWS_FRAME_SIZE_PAYLOAD_16;
     }
     else {
-        sws->outhdr [1] |= NN_SWS_PAYLOAD_FRAME_63;
-        nn_putll (&sws->outhdr [hdr_len], (uint64_t) nn_msg_size);
+        hdr [1] |= NN_SWS_PAYLOAD_FRAME_63;
+        nn_putll (&hdr [hdr_len], (uint64_t) nn_msg_size);
         hdr_len += NN_SWS_FRAME_SIZE_PAYLOAD_63;
     }
 
     if (sws->mode == NN_WS_CLIENT) {
-        sws->outhdr [1] |= NN_SWS_FRAME_BITMASK_MASKED;
+        hdr [1] |= NN_SWS_FRAME_BITMASK_MASKED;
 
         /*  Generate 32-bit mask as per RFC 6455 5.3. */
-        nn_random_generate (rand_mask, NN_SWS_FRAME_SIZE_MASK);
-
-        memcpy (&sws->outhdr [hdr_len], rand_mask, NN_SWS_FRAME_SIZE_MASK);
+        nn_random_generate (&hdr [hdr_len], NN_SWS_FRAME_SIZE_MASK);
         hdr_len += NN_SWS_FRAME_SIZE_MASK;
-
-        /*  Mask payload, beginning with header and moving to body. */
-        mask_pos = 0;
-
-        nn_sws_mask_payload (nn_chunkref_data (&sws->outmsg.sphdr),
-            nn_chunkref_size (&sws->outmsg.sphdr),
-            rand_mask, NN_SWS_FRAME_SIZE_MASK, &mask_pos);
-
-        nn_sws_mask_payload (nn_chunkref_data (&sws->outmsg.body),
-            nn_chunkref_size (&sws->outmsg.body),
-            rand_mask, NN_SWS_FRAME_SIZE_MASK, &mask_pos);
-
     }
     else if (sws->mode == NN_WS_SERVER) {
-        sws->outhdr [1] |= NN_SWS_FRAME_BITMASK_NOT_MASKED;
+        hdr [1] |= NN_SWS_FRAME_BITMASK_NOT_MASKED;
     }
     else {
         /*  Developer error; sws object was not constructed properly. */
         nn_assert (0);
     }
 
-    /*  Start async sending. */
-    iov [0].iov_base = sws->outhdr;
-    iov [0].iov_len = hdr_len;
-    iov [1].iov_base = nn_chunkref_data (&sws->outmsg.sphdr);
-    iov [1].iov_len = nn_chunkref_size (&sws->outmsg.sphdr);
-    iov [2].iov_base = nn_chunkref_data (&sws->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&sws->outmsg.body);
-    nn_usock_send (sws->usock, iov, 3);
-
-    sws->outstate = NN_SWS_OUTSTATE_SENDING;
+    /*  Queue the frame. If there's a write in progress, it will be sent
+        along with the other frames queued in the meantime once the write
+        is done, urgent ones first. */
+    if (nn_slow (msg->urgent))
+        payload = nn_outq_pushurgent (&sws->outq, hdr, hdr_len, msg);
+    else
+        payload = nn_outq_push (&sws->outq, hdr, hdr_len, msg);
+
+    /*  Payload copied into the batch buffer is owned by the connection and
+        can be masked in place. Payload sent by reference is masked when
+        its write starts. */
+    if (payload && sws->mode == NN_WS_CLIENT)
+        nn_ws_mask_payload (payload, payload, nn_msg_size,
+            &hdr [hdr_len - NN_SWS_FRAME_SIZE_MASK], NN_SWS_FRAME_SIZE_MASK,
+            NULL);
+
+    if (!nn_outq_busy (&sws->outq))
+        nn_sws_flush (sws);
+
+    /*  Unless the queue is full, the pipe remains writable. */
+    if (nn_slow (nn_outq_full (&sws->outq))) {
+        sws->outstate = NN_SWS_OUTSTATE_SENDING;
+        return 0;
+    }
+    nn_pipebase_sent (&sws->pipebase);
 
     return 0;
 }
 
+static void nn_sws_flush (struct nn_sws *self)
+{
+    struct nn_iovec iov [NN_OUTQ_MAXIOV];
+    int iovcnt;
+    int first;
+    int i;
+    int mask_pos;
+    size_t len;
+    const uint8_t *mask;
+    uint8_t *pos;
+    struct nn_msg *msg;
+
+    iovcnt = nn_outq_start (&self->outq, iov);
+    nn_heartbeat_sent (&self->heartbeat);
+
+    /*  The payload of a frame sent by reference may be shared with other
+        pipes, so it can't be masked in place. Instead, it's masked into
+        a buffer owned by the connection, which is reused by subsequent
+        writes. The mask is at the end of the frame header. */
+    msg = nn_outq_msg (&self->outq);
+    if (msg && self->mode == NN_WS_CLIENT) {
+        first = iovcnt - msg->nparts - 2;
+        mask = ((const uint8_t*) iov [first - 1].iov_base) +
+            iov [first - 1].iov_len - NN_SWS_FRAME_SIZE_MASK;
+        len = 0;
+        for (i = first; i != iovcnt; ++i)
+            len += iov [i].iov_len;
+        if (len > self->maskbuf_size) {
+            nn_free (self->maskbuf);
+            self->maskbuf = nn_alloc_class (len, NN_ALLOC_IOBUF,
+                "ws mask buffer");
+            alloc_assert (self->maskbuf);
+            self->maskbuf_size = len;
+        }
+        pos = self->maskbuf;
+        mask_pos = 0;
+        for (i = first; i != iovcnt; ++i) {
+            nn_ws_mask_payload (pos, iov [i].iov_base, iov [i].iov_len,
+                mask, NN_SWS_FRAME_SIZE_MASK, &mask_pos);
+            pos += iov [i].iov_len;
+        }
+        iov [first].iov_base = self->maskbuf;
+        iov [first].iov_len = len;
+        iovcnt = first + 1;
+    }
+
+    nn_usock_send (self->usock, iov, iovcnt);
+}
+
+static void nn_sws_heartbeat (struct nn_sws *self)
+{
+    struct nn_msg msg;
+    uint8_t *payload;
+    size_t hdr_len;
+    uint8_t hdr [NN_SWS_FRAME_MAX_HDR_LEN];
+    size_t size;
+
+    /*  There's no point in queueing a heartbeat if the peer isn't reading
+        what's queued already. */
+    if (nn_slow (nn_outq_full (&self->outq)))
+        return;
+
+    size = NN_SWS_HEARTBEAT_MAGIC_LEN + NN_HEARTBEAT_SIZE;
+    nn_msg_init (&msg, size);
+    payload = nn_chunkref_data (&msg.body);
+    memcpy (payload, NN_SWS_HEARTBEAT_MAGIC, NN_SWS_HEARTBEAT_MAGIC_LEN);
+    nn_heartbeat_put (&self->heartbeat,
+        payload + NN_SWS_HEARTBEAT_MAGIC_LEN);
+
+    /*  As any other frame sent by the client, this one is masked. */
+    hdr [0] = NN_SWS_FRAME_BITMASK_FIN | NN_WS_OPCODE_PONG;
+    hdr [1] = (uint8_t) size;
+    hdr_len = NN_SWS_FRAME_SIZE_INITIAL;
+    if (self->mode == NN_WS_CLIENT) {
+        hdr [1] |= NN_SWS_FRAME_BITMASK_MASKED;
+        nn_random_generate (&hdr [hdr_len], NN_SWS_FRAME_SIZE_MASK);
+        hdr_len += NN_SWS_FRAME_SIZE_MASK;
+    }
+
+    /*  The frame overtakes the ones not being written yet so that the peer
+        hears from us as soon as possible. */
+    payload = nn_outq_pushurgent (&self->outq, hdr, hdr_len, &msg);
+    if (payload && self->mode == NN_WS_CLIENT)
+        nn_ws_mask_payload (payload, payload, size,
+            &hdr [hdr_len - NN_SWS_FRAME_SIZE_MASK], NN_SWS_FRAME_SIZE_MASK,
+            NULL);
+    if (!nn_outq_busy (&self->outq))
+        nn_sws_flush (self);
+}
+
+static int nn_sws_recv_heartbeat (struct nn_sws *self)
+{
+    int rc;
+
+    if (!self->peerheartbeat || self->inmsg_current_chunk_len !=
+          NN_SWS_HEARTBEAT_MAGIC_LEN + NN_HEARTBEAT_SIZE ||
+          memcmp (self->inmsg_control, NN_SWS_HEARTBEAT_MAGIC,
+          NN_SWS_HEARTBEAT_MAGIC_LEN) != 0)
+        return 0;
+
+    /*  Heartbeat only tells how often the peer sends them. It's not passed
+        to the user and the next frame is received straight away. */
+    rc = nn_heartbeat_get (&self->heartbeat,
+        self->inmsg_control + NN_SWS_HEARTBEAT_MAGIC_LEN);
+    if (nn_slow (rc < 0)) {
+        nn_sws_fail_conn (self, NN_SWS_CLOSE_ERR_PROTO,
+            "Invalid heartbeat.");
+        return 1;
+    }
+    nn_sws_recv_hdr (self);
+    return 1;
+}
+
+static size_t nn_sws_queued (struct nn_pipebase *self)
+{
+    return nn_outq_count (&nn_cont (self, struct nn_sws, pipebase)->outq);
+}
+
 static int nn_sws_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
     struct nn_sws *sws;
-    struct nn_list_item *it;
-    struct msg_chunk *ch;
     struct nn_cmsghdr *cmsg;
     uint8_t opcode_hdr;
     uint8_t opcode;
     size_t cmsgsz;
-    size_t pos;
 
     sws = nn_cont (self, struct nn_sws, pipebase);
 
     nn_assert_state (sws, NN_SWS_STATE_ACTIVE);
+    nn_heartbeat_traffic (&sws->heartbeat);
 
     switch (sws->instate) {
     case NN_SWS_INSTATE_RECVD_CHUNKED:
@@ -509,23 +671,21 @@ static int nn_sws_recv (struct nn_pipebase *self, struct nn_msg *msg)
         nn_assert (opcode == NN_WS_OPCODE_BINARY ||
                    opcode == NN_WS_OPCODE_TEXT);
 
-        nn_msg_init (msg, sws->inmsg_total_size);
-
-        pos = 0;
-
-        /*  Reassemble incoming message scatter array. */
-        while (!nn_list_empty (&sws->inmsg_array)) {
-            it = nn_list_begin (&sws->inmsg_array);
-            ch = nn_cont (it, struct msg_chunk, item);
-            memcpy (((uint8_t*) nn_chunkref_data (&msg->body)) + pos,
-                nn_chunkref_data (&ch->chunk),
-                nn_chunkref_size (&ch->chunk));
-            pos += nn_chunkref_size (&ch->chunk);
-            nn_msg_chunk_term (ch, &sws->inmsg_array);
+        /*  The fragments are already in place; hand the buffer over to
+            the message, trimming any excess capacity first. */
+        if (sws->inmsg_chunk) {
+            if (nn_chunk_size (sws->inmsg_chunk) != sws->inmsg_total_size) {
+                rc = nn_chunk_realloc (sws->inmsg_total_size,
+                    &sws->inmsg_chunk);
+                errnum_assert (rc == 0, -rc);
+            }
+            nn_msg_init_chunk (msg, sws->inmsg_chunk);
+            sws->inmsg_chunk = NULL;
+        }
+        else {
+            nn_assert (sws->inmsg_total_size == 0);
+            nn_msg_init (msg, 0);
         }
-
-        nn_assert (pos == sws->inmsg_total_size);
-        nn_assert (nn_list_empty (&sws->inmsg_array));
 
         /*  No longer collecting scatter array of incoming msg chunks. */
         sws->continuing = 0;
@@ -578,11 +738,48 @@ static int nn_sws_recv (struct nn_pipebase *self, struct nn_msg *msg)
     return 0;
 }
 
+static size_t nn_sws_ascii_len (const uint8_t *buf, size_t len)
+{
+    size_t i;
+    uint64_t word;
+#if defined NN_SWS_SSE2
+    __m128i block;
+#elif defined NN_SWS_NEON
+    uint64x2_t block;
+#endif
+
+    i = 0;
+
+#if defined NN_SWS_SSE2
+    for (; len - i >= sizeof (block); i += sizeof (block)) {
+        block = _mm_loadu_si128 ((const __m128i*) (buf + i));
+        if (_mm_movemask_epi8 (block))
+            return i;
+    }
+#elif defined NN_SWS_NEON
+    for (; len - i >= sizeof (block); i += sizeof (block)) {
+        block = vreinterpretq_u64_u8 (vld1q_u8 (buf + i));
+        if ((vgetq_lane_u64 (block, 0) | vgetq_lane_u64 (block, 1)) &
+              0x8080808080808080ULL)
+            return i;
+    }
+#endif
+
+    for (; len - i >= sizeof (word); i += sizeof (word)) {
+        memcpy (&word, buf + i, sizeof (word));
+        if (word & 0x8080808080808080ULL)
+            return i;
+    }
+
+    return i;
+}
+
 static void nn_sws_validate_utf8_chunk (struct nn_sws *self)
 {
     uint8_t *pos;
     int code_point_len;
     size_t len;
+    size_t ascii_len;
 
     len = self->inmsg_current_chunk_len;
     pos = self->inmsg_current_chunk_buf;
@@ -598,6 +795,8 @@ static void nn_sws_validate_utf8_chunk (struct nn_sws *self)
         /*  Keep adding octets from fresh buffer to previous code point
             fragment to check for validity. */
         while (len > 0) {
+            nn_assert (self->utf8_code_pt_fragment_len <
+                NN_SWS_UTF8_MAX_CODEPOINT_LEN);
             self->utf8_code_pt_fragment [self->utf8_code_pt_fragment_len] = *pos;
             self->utf8_code_pt_fragment_len++;
             pos++;
@@ -634,6 +833,15 @@ static void nn_sws_validate_utf8_chunk (struct nn_sws *self)
         nn_assert (0);
 
     while (len > 0) {
+
+        /*  Skip runs of ASCII characters, which are valid UTF-8, a block
+            at a time. */
+        ascii_len = nn_sws_ascii_len (pos, len);
+        pos += ascii_len;
+        len -= ascii_len;
+        if (!len)
+            break;
+
         code_point_len = nn_utf8_code_point (pos, len);
 
         if (code_point_len > 0) {
@@ -674,15 +882,60 @@ static void nn_sws_validate_utf8_chunk (struct nn_sws *self)
     self->utf8_code_pt_fragment_len = 0;
     memset (self->utf8_code_pt_fragment, 0, NN_SWS_UTF8_MAX_CODEPOINT_LEN);
 
-    if (self->is_final_frame) {
+    if (self->is_final_frame)
+        nn_sws_received (self);
+    else
+        nn_sws_recv_hdr (self);
+
+    return;
+}
+
+static void nn_sws_received (struct nn_sws *self)
+{
+    int rc;
+    int opt;
+    size_t opt_sz;
+    void *chunk;
+
+    if (!self->inmsg_compressed) {
         self->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
         nn_pipebase_received (&self->pipebase);
+        return;
     }
-    else {
-        nn_sws_recv_hdr (self);
+    self->inmsg_compressed = 0;
+
+    /*  NN_RCVMAXSIZE applies to the decompressed message. */
+    opt_sz = sizeof (opt);
+    nn_pipebase_getopt (&self->pipebase, NN_SOL_SOCKET, NN_RCVMAXSIZE,
+        &opt, &opt_sz);
+    rc = nn_ws_deflate_decompress (&self->deflate, self->inmsg_chunk,
+        self->inmsg_total_size, opt, &chunk);
+    if (nn_slow (rc == -EMSGSIZE)) {
+        nn_sws_fail_conn (self, NN_SWS_CLOSE_ERR_TOOBIG,
+            "Message size exceeds limit.");
+        return;
+    }
+    if (nn_slow (rc < 0)) {
+        nn_sws_fail_conn (self, NN_SWS_CLOSE_ERR_PROTO,
+            "Invalid compressed payload.");
+        return;
     }
 
-    return;
+    nn_sws_inmsg_term (self);
+    self->inmsg_chunk = chunk;
+    self->inmsg_total_size = nn_chunk_size (chunk);
+
+    /*  Compressed text can only be validated as a whole. */
+    if ((self->inmsg_hdr & NN_SWS_FRAME_BITMASK_OPCODE) ==
+          NN_WS_OPCODE_TEXT) {
+        self->inmsg_current_chunk_buf = chunk;
+        self->inmsg_current_chunk_len = self->inmsg_total_size;
+        nn_sws_validate_utf8_chunk (self);
+        return;
+    }
+
+    self->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
+    nn_pipebase_received (&self->pipebase);
 }
 
 static void nn_sws_acknowledge_close_handshake (struct nn_sws *self)
@@ -769,7 +1022,7 @@ static void nn_sws_fail_conn (struct nn_sws *self, int code, char *reason)
     nn_pipebase_stop (&self->pipebase);
 
     /*  Destroy any remnant incoming message fragments. */
-    nn_msg_array_term (&self->inmsg_array);
+    nn_sws_inmsg_term (self);
 
     reason_len = strlen (reason);
 
@@ -818,21 +1071,19 @@ static void nn_sws_fail_conn (struct nn_sws *self, int code, char *reason)
 
     /*  If this is a client, apply mask. */
     if (self->mode == NN_WS_CLIENT) {
-        nn_sws_mask_payload (payload_pos, payload_len,
+        nn_ws_mask_payload (payload_pos, payload_pos, payload_len,
             rand_mask, NN_SWS_FRAME_SIZE_MASK, NULL);
     }
 
 
-    if (self->outstate == NN_SWS_OUTSTATE_IDLE) {
+    /*  If there's a write in progress, the close frame is sent once it's
+        done. Frames queued in the meantime are dropped. */
+    if (!nn_outq_busy (&self->outq)) {
         iov.iov_base = self->fail_msg;
         iov.iov_len = self->fail_msg_len;
         nn_usock_send (self->usock, &iov, 1);
-        self->outstate = NN_SWS_OUTSTATE_SENDING;
-        self->state = NN_SWS_STATE_CLOSING_CONNECTION;
-    } else {
-        self->state = NN_SWS_STATE_DONE;
-        nn_fsm_raise (&self->fsm, &self->done, NN_SWS_RETURN_CLOSE_HANDSHAKE);
     }
+    self->state = NN_SWS_STATE_CLOSING_CONNECTION;
 
     return;
 }
@@ -848,14 +1099,25 @@ static void nn_sws_shutdown (struct nn_fsm *self, int src, int type,
         /*  TODO: Consider sending a close code here? */
         nn_pipebase_stop (&sws->pipebase);
         nn_ws_handshake_stop (&sws->handshaker);
+        nn_heartbeat_stop (&sws->heartbeat);
         sws->state = NN_SWS_STATE_STOPPING;
     }
     if (nn_slow (sws->state == NN_SWS_STATE_STOPPING)) {
-        if (nn_ws_handshake_isidle (&sws->handshaker)) {
+        if (nn_ws_handshake_isidle (&sws->handshaker) &&
+              nn_heartbeat_isidle (&sws->heartbeat)) {
             nn_usock_swap_owner (sws->usock, &sws->usock_owner);
             sws->usock = NULL;
             sws->usock_owner.src = -1;
             sws->usock_owner.fsm = NULL;
+            nn_ws_deflate_stop (&sws->deflate);
+
+            /*  Drop the frames that were not sent, if any. */
+            nn_outq_term (&sws->outq);
+            nn_outq_init (&sws->outq);
+            nn_free (sws->maskbuf);
+            sws->maskbuf = NULL;
+            sws->maskbuf_size = 0;
+
             sws->state = NN_SWS_STATE_IDLE;
             nn_fsm_stopped (&sws->fsm, NN_SWS_RETURN_STOPPED);
             return;
@@ -872,10 +1134,32 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
     struct nn_sws *sws;
     int rc;
     int opt;
+    int idle;
     size_t opt_sz = sizeof (opt);
+    struct nn_iovec iov;
 
     sws = nn_cont (self, struct nn_sws, fsm);
 
+    /*  Send a heartbeat if the connection was quiet, or drop it if the peer
+        is gone or if no messages were passed for too long. Once the
+        connection is failing or broken, the timer is just left to wind
+        down. */
+    if (src == NN_SWS_SRC_HEARTBEAT) {
+        rc = nn_heartbeat_event (&sws->heartbeat, type,
+            sws->state == NN_SWS_STATE_ACTIVE &&
+            sws->instate == NN_SWS_INSTATE_RECV_HDR);
+        if (sws->state != NN_SWS_STATE_ACTIVE)
+            return;
+        if (rc == NN_HEARTBEAT_SEND)
+            nn_sws_heartbeat (sws);
+        else if (rc == NN_HEARTBEAT_DEAD || rc == NN_HEARTBEAT_IDLE) {
+            nn_pipebase_stop (&sws->pipebase);
+            sws->state = NN_SWS_STATE_DONE;
+            nn_fsm_raise (&sws->fsm, &sws->done, NN_SWS_RETURN_ERROR);
+        }
+        return;
+    }
+
     switch (sws->state) {
 
 /******************************************************************************/
@@ -888,7 +1172,8 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_FSM_START:
                 nn_ws_handshake_start (&sws->handshaker, sws->usock,
-                    &sws->pipebase, sws->mode, sws->resource, sws->remote_host);
+                    &sws->pipebase, sws->mode, sws->resource, sws->remote_host,
+                    &sws->deflate_opts);
                 sws->state = NN_SWS_STATE_HANDSHAKE;
                 return;
             default:
@@ -950,6 +1235,10 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                     return;
                  }
 
+                 /*  Use the compression negotiated by the handshake. */
+                 nn_ws_deflate_start (&sws->deflate,
+                     &sws->handshaker.deflate);
+
                  /*  Start receiving a message in asynchronous manner. */
                  nn_sws_recv_hdr (sws);
 
@@ -957,6 +1246,21 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                  sws->outstate = NN_SWS_OUTSTATE_IDLE;
 
                  sws->state = NN_SWS_STATE_ACTIVE;
+
+                 /*  Start sending heartbeats if asked to, letting the peer
+                     know how often to expect them, and watch for the
+                     connection going idle. */
+                 sws->peerheartbeat = sws->handshaker.peerheartbeat;
+                 nn_pipebase_getopt (&sws->pipebase, NN_SOL_SOCKET,
+                     NN_IDLE_TIMEOUT, &idle, &opt_sz);
+                 nn_pipebase_getopt (&sws->pipebase, NN_SOL_SOCKET,
+                     NN_HEARTBEAT_IVL, &opt, &opt_sz);
+                 if (nn_heartbeat_start (&sws->heartbeat, opt,
+                       sws->peerheartbeat, idle) == NN_HEARTBEAT_SEND)
+                     nn_sws_heartbeat (sws);
+
+                 nn_fsm_raise (&sws->fsm, &sws->established,
+                     NN_SWS_RETURN_ESTABLISHED);
                  return;
 
             default:
@@ -977,29 +1281,54 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
 
-                /*  The message is now fully sent. */
-                nn_assert (sws->outstate == NN_SWS_OUTSTATE_SENDING);
-                sws->outstate = NN_SWS_OUTSTATE_IDLE;
-                nn_msg_term (&sws->outmsg);
-                nn_msg_init (&sws->outmsg, 0);
-                nn_pipebase_sent (&sws->pipebase);
+                /*  The batch is now fully sent. Send the frames queued in
+                    the meantime, if any, in a single write. */
+                nn_outq_done (&sws->outq);
+                if (nn_outq_haspending (&sws->outq))
+                    nn_sws_flush (sws);
+                else
+                    nn_pipebase_drained (&sws->pipebase);
+
+                /*  If the pipe was waiting for space in the queue, it can
+                    accept messages again. */
+                if (sws->outstate == NN_SWS_OUTSTATE_SENDING &&
+                      !nn_outq_full (&sws->outq)) {
+                    sws->outstate = NN_SWS_OUTSTATE_IDLE;
+                    nn_pipebase_sent (&sws->pipebase);
+                }
                 return;
 
             case NN_USOCK_RECEIVED:
 
+                nn_heartbeat_received (&sws->heartbeat);
                 switch (sws->instate) {
                 case NN_SWS_INSTATE_RECV_HDR:
 
                     /*  Require RSV1, RSV2, and RSV3 bits to be unset for
                         x-nanomsg protocol as per RFC 6455 section 5.2. */
-                    if (sws->inhdr [0] & NN_SWS_FRAME_BITMASK_RSV1 ||
-                        sws->inhdr [0] & NN_SWS_FRAME_BITMASK_RSV2 ||
+                    if (sws->inhdr [0] & NN_SWS_FRAME_BITMASK_RSV2 ||
                         sws->inhdr [0] & NN_SWS_FRAME_BITMASK_RSV3) {
                         nn_sws_fail_conn (sws, NN_SWS_CLOSE_ERR_PROTO,
                             "RSV1, RSV2, and RSV3 must be unset.");
                         return;
                     }
 
+                    /*  The exception is RSV1 which marks compressed messages
+                        if permessage-deflate is in use. It may only be set
+                        on the first frame of a data message as per RFC 7692
+                        section 6.1. */
+                    if (sws->inhdr [0] & NN_SWS_FRAME_BITMASK_RSV1) {
+                        sws->opcode = sws->inhdr [0] &
+                            NN_SWS_FRAME_BITMASK_OPCODE;
+                        if (!nn_ws_deflate_isactive (&sws->deflate) ||
+                              (sws->opcode != NN_WS_OPCODE_TEXT &&
+                              sws->opcode != NN_WS_OPCODE_BINARY)) {
+                            nn_sws_fail_conn (sws, NN_SWS_CLOSE_ERR_PROTO,
+                                "RSV1, RSV2, and RSV3 must be unset.");
+                            return;
+                        }
+                    }
+
                     sws->is_final_frame = sws->inhdr [0] &
                         NN_SWS_FRAME_BITMASK_FIN;
                     sws->masked = sws->inhdr [1] &
@@ -1051,9 +1380,13 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
 
                     /*  Preserve initial message opcode and RSV bits in case
                         this is a fragmented message. */
-                    if (!sws->continuing)
-                        sws->inmsg_hdr = sws->inhdr [0] |
-                        NN_SWS_FRAME_BITMASK_FIN;
+                    if (!sws->continuing) {
+                        sws->inmsg_hdr = (sws->inhdr [0] |
+                            NN_SWS_FRAME_BITMASK_FIN) &
+                            ~NN_SWS_FRAME_BITMASK_RSV1;
+                        sws->inmsg_compressed = (sws->inhdr [0] &
+                            NN_SWS_FRAME_BITMASK_RSV1) ? 1 : 0;
+                    }
 
                     if (sws->payload_ctl <= NN_SWS_PAYLOAD_MAX_LENGTH) {
                         sws->ext_hdr_len += NN_SWS_FRAME_SIZE_PAYLOAD_0;
@@ -1103,8 +1436,7 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                             else {
                                 /*  Special case when there is no payload,
                                     mask, or additional frames. */
-                                sws->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
-                                nn_pipebase_received (&sws->pipebase);
+                                nn_sws_received (sws);
                                 return;
                             }
                             }
@@ -1132,8 +1464,7 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                             else {
                                 /*  Special case when there is no payload,
                                     mask, or additional frames. */
-                                sws->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
-                                nn_pipebase_received (&sws->pipebase);
+                                nn_sws_received (sws);
                                 return;
                             }
                         }
@@ -1283,10 +1614,8 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                                     "Message larger than application allows.");
                                 return;
                             }
-                            sws->inmsg_chunks++;
                             sws->inmsg_current_chunk_buf =
-                                nn_msg_chunk_new (sws->inmsg_current_chunk_len,
-                                &sws->inmsg_array);
+                                nn_sws_inmsg_extend (sws);
                         }
 
                         sws->instate = NN_SWS_INSTATE_RECV_PAYLOAD;
@@ -1355,12 +1684,13 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                             if (sws->opcode == NN_WS_OPCODE_CLOSE) {
                                 nn_sws_acknowledge_close_handshake (sws);
                             }
-                            else {
-                                sws->instate = (sws->is_control_frame ?
-                                    NN_SWS_INSTATE_RECVD_CONTROL :
-                                    NN_SWS_INSTATE_RECVD_CHUNKED);
+                            else if (sws->is_control_frame) {
+                                sws->instate = NN_SWS_INSTATE_RECVD_CONTROL;
                                 nn_pipebase_received (&sws->pipebase);
                             }
+                            else {
+                                nn_sws_received (sws);
+                            }
                         }
                         else {
                             nn_sws_recv_hdr (sws);
@@ -1390,10 +1720,8 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                                 "Message size exceeds limit.");
                             return;
                         }
-                        sws->inmsg_chunks++;
                         sws->inmsg_current_chunk_buf =
-                            nn_msg_chunk_new (sws->inmsg_current_chunk_len,
-                            &sws->inmsg_array);
+                            nn_sws_inmsg_extend (sws);
                     }
 
                     sws->instate = NN_SWS_INSTATE_RECV_PAYLOAD;
@@ -1405,7 +1733,8 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
 
                     /*  Unmask if necessary. */
                     if (sws->masked) {
-                        nn_sws_mask_payload (sws->inmsg_current_chunk_buf,
+                        nn_ws_mask_payload (sws->inmsg_current_chunk_buf,
+                            sws->inmsg_current_chunk_buf,
                             sws->inmsg_current_chunk_len, sws->mask,
                             NN_SWS_FRAME_SIZE_MASK, NULL);
                     }
@@ -1413,13 +1742,17 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                     switch (sws->opcode) {
 
                     case NN_WS_OPCODE_TEXT:
-                        nn_sws_validate_utf8_chunk (sws);
-                        return;
-
+                        /*  Compressed text is validated once the whole
+                            message is decompressed. */
+                        if (!sws->inmsg_compressed) {
+                            nn_sws_validate_utf8_chunk (sws);
+                            return;
+                        }
+                        /*  Compressed text is handled as binary. */
+                        /*  Fall through. */
                     case NN_WS_OPCODE_BINARY:
                         if (sws->is_final_frame) {
-                            sws->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
-                            nn_pipebase_received (&sws->pipebase);
+                            nn_sws_received (sws);
                         }
                         else {
                             nn_sws_recv_hdr (sws);
@@ -1430,12 +1763,11 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                         /*  Must check original opcode to see if this fragment
                             needs UTF-8 validation. */
                         if ((sws->inmsg_hdr & NN_SWS_FRAME_BITMASK_OPCODE) ==
-                            NN_WS_OPCODE_TEXT) {
+                            NN_WS_OPCODE_TEXT && !sws->inmsg_compressed) {
                             nn_sws_validate_utf8_chunk (sws);
                         }
                         else if (sws->is_final_frame) {
-                            sws->instate = NN_SWS_INSTATE_RECVD_CHUNKED;
-                            nn_pipebase_received (&sws->pipebase);
+                            nn_sws_received (sws);
                         }
                         else {
                             nn_sws_recv_hdr (sws);
@@ -1448,6 +1780,8 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
                         return;
 
                     case NN_WS_OPCODE_PONG:
+                        if (nn_sws_recv_heartbeat (sws))
+                            return;
                         sws->instate = NN_SWS_INSTATE_RECVD_CONTROL;
                         nn_pipebase_received (&sws->pipebase);
                         return;
@@ -1498,10 +1832,18 @@ static void nn_sws_handler (struct nn_fsm *self, int src, int type,
         case NN_SWS_SRC_USOCK:
             switch (type) {
             case NN_USOCK_SENT:
+                /*  If the write that was in progress when the connection
+                    failed is done, send the closing handshake now. */
+                if (nn_outq_busy (&sws->outq)) {
+                    nn_outq_done (&sws->outq);
+                    iov.iov_base = sws->fail_msg;
+                    iov.iov_len = sws->fail_msg_len;
+                    nn_usock_send (sws->usock, &iov, 1);
+                    return;
+                }
+
                 /*  Wait for acknowledgement closing handshake was sent
                     to peer. */
-                nn_assert (sws->outstate == NN_SWS_OUTSTATE_SENDING);
-                sws->outstate = NN_SWS_OUTSTATE_IDLE;
                 sws->state = NN_SWS_STATE_DONE;
                 nn_fsm_raise (&sws->fsm, &sws->done,
                     NN_SWS_RETURN_CLOSE_HANDSHAKE);
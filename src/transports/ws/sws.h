@@ -31,6 +31,9 @@
 #include "../../aio/usock.h"
 
 #include "ws_handshake.h"
+#include "ws_deflate.h"
+#include "../utils/outq.h"
+#include "../utils/heartbeat.h"
 
 #include "../../utils/msg.h"
 #include "../../utils/list.h"
@@ -42,6 +45,7 @@
 #define NN_SWS_RETURN_ERROR 1
 #define NN_SWS_RETURN_CLOSE_HANDSHAKE 2
 #define NN_SWS_RETURN_STOPPED 3
+#define NN_SWS_RETURN_ESTABLISHED 4
 
 /*  WebSocket protocol header frame sizes. */
 #define NN_SWS_FRAME_SIZE_INITIAL 2
@@ -77,6 +81,10 @@
 /*  WebSocket Close Status Code length. */
 #define NN_SWS_CLOSE_CODE_LEN 2
 
+/*  Payload of a heartbeat frame starts with this. */
+#define NN_SWS_HEARTBEAT_MAGIC "\0NHB"
+#define NN_SWS_HEARTBEAT_MAGIC_LEN 4
+
 struct nn_sws {
 
     /*  The state machine. */
@@ -108,6 +116,11 @@ struct nn_sws {
     /*  Remote Host in header request when acting as client. */
     const char* remote_host;
 
+    /*  Compression requested by the user and its state on the current
+        connection. */
+    struct nn_ws_deflate_opts deflate_opts;
+    struct nn_ws_deflate deflate;
+
     /*  State of inbound state machine. */
     int instate;
 
@@ -136,23 +149,34 @@ struct nn_sws {
     uint8_t utf8_code_pt_fragment [NN_SWS_UTF8_MAX_CODEPOINT_LEN];
     size_t utf8_code_pt_fragment_len;
 
+    /*  Heartbeats exchanged with the peer. They are passed as unsolicited
+        PONG frames carrying NN_SWS_HEARTBEAT_MAGIC followed by the body of
+        the heartbeat, if the handshake shows the peer recognises them.
+        Otherwise, the PONG frames are passed to the user as usual. */
+    struct nn_heartbeat heartbeat;
+    int peerheartbeat;
+
     /*  Statistics on control frames. */
     int pings_sent;
     int pongs_sent;
     int pings_received;
     int pongs_received;
 
-    /*  Fragments of message being received at the moment. */
-    struct nn_list inmsg_array;
+    /*  Message being received at the moment. Fragments of the message are
+        received directly into a single buffer which grows as needed. */
+    void *inmsg_chunk;
     uint8_t *inmsg_current_chunk_buf;
     size_t inmsg_current_chunk_len;
     size_t inmsg_total_size;
-    int inmsg_chunks;
     uint8_t inmsg_hdr;
 
+    /*  1 if RSV1 bit was set on the first frame of the message, meaning
+        that the payload has to be decompressed once fully received. */
+    int inmsg_compressed;
+
     /*  Control message being received at the moment. Because these can be
         interspersed between fragmented TEXT and BINARY messages, they are
-        stored in this buffer so as not to interrupt the message array. */
+        stored in this buffer so as not to interrupt the message buffer. */
     uint8_t inmsg_control [NN_SWS_PAYLOAD_MAX_LENGTH];
 
     /*  Reason this connection is closing to send as closing handshake. */
@@ -162,40 +186,30 @@ struct nn_sws {
     /*  State of the outbound state machine. */
     int outstate;
 
-    /*  Buffer used to store the header of outgoing message. */
-    uint8_t outhdr [NN_SWS_FRAME_MAX_HDR_LEN];
+    /*  Outgoing frames. Frames queued while a write is in progress are
+        sent together in a single write once it's done. */
+    struct nn_outq outq;
 
-    /*  Message being sent at the moment. */
-    struct nn_msg outmsg;
+    /*  Buffer the payload of the frame sent by reference is masked into
+        in client mode. It is reused by subsequent writes. */
+    uint8_t *maskbuf;
+    size_t maskbuf_size;
 
     /*  Event raised when the state machine ends. */
     struct nn_fsm_event done;
-};
 
-/*  Scatter/gather array element type forincoming message chunks. Fragmented
-    message frames are reassembled prior to notifying the user. */
-struct msg_chunk {
-    struct nn_list_item item;
-    struct nn_chunkref chunk;
+    /*  Event raised when the opening handshake succeeds. */
+    struct nn_fsm_event established;
 };
 
-/*  Allocate a new message chunk, append it to message array, and return
-    pointer to its buffer. */
-void *nn_msg_chunk_new (size_t size, struct nn_list *msg_array);
-
-/*  Deallocate a message chunk and remove it from array. */
-void nn_msg_chunk_term (struct msg_chunk *it, struct nn_list *msg_array);
-
-/*  Deallocate an entire message array. */
-void nn_msg_array_term (struct nn_list *msg_array);
-
 void nn_sws_init (struct nn_sws *self, int src,
     struct nn_ep *ep, struct nn_fsm *owner);
 void nn_sws_term (struct nn_sws *self);
 
 int nn_sws_isidle (struct nn_sws *self);
 void nn_sws_start (struct nn_sws *self, struct nn_usock *usock, int mode,
-    const char *resource, const char *host, uint8_t msg_type);
+    const char *resource, const char *host, uint8_t msg_type,
+    const struct nn_ws_deflate_opts *deflate);
 void nn_sws_stop (struct nn_sws *self);
 
 #endif
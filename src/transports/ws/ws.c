@@ -27,11 +27,13 @@
 #include "bws.h"
 #include "cws.h"
 #include "sws.h"
+#include "ws_deflate.h"
 
 #include "../../ws.h"
 
 #include "../utils/port.h"
 #include "../utils/iface.h"
+#include "../utils/dns.h"
 
 #include "../../utils/err.h"
 #include "../../utils/alloc.h"
@@ -51,6 +53,9 @@
 struct nn_ws_optset {
     struct nn_optset base;
     int msg_type;
+    int deflate;
+    int deflate_window_bits;
+    int deflate_no_context_takeover;
 };
 
 static void nn_ws_optset_destroy (struct nn_optset *self);
@@ -65,6 +70,7 @@ static const struct nn_optset_vfptr nn_ws_optset_vfptr = {
 };
 
 /*  nn_transport interface. */
+static void nn_ws_term (void);
 static int nn_ws_bind (struct nn_ep *);
 static int nn_ws_connect (struct nn_ep *);
 static struct nn_optset *nn_ws_optset (void);
@@ -73,7 +79,7 @@ static struct nn_transport nn_ws_vfptr = {
     "ws",
     NN_WS,
     NULL,
-    NULL,
+    nn_ws_term,
     nn_ws_bind,
     nn_ws_connect,
     nn_ws_optset,
@@ -82,6 +88,11 @@ static struct nn_transport nn_ws_vfptr = {
 
 struct nn_transport *nn_ws = &nn_ws_vfptr;
 
+static void nn_ws_term (void)
+{
+    nn_dns_shutdown ();
+}
+
 static int nn_ws_bind (struct nn_ep *ep)
 {
     return nn_bws_create (ep);
@@ -102,6 +113,9 @@ static struct nn_optset *nn_ws_optset ()
 
     /*  Default values for WebSocket options. */
     optset->msg_type = NN_WS_MSG_TYPE_BINARY;
+    optset->deflate = 0;
+    optset->deflate_window_bits = NN_WS_DEFLATE_MAX_WINDOW_BITS;
+    optset->deflate_no_context_takeover = 0;
 
     return &optset->base;   
 }
@@ -136,6 +150,24 @@ static int nn_ws_optset_setopt (struct nn_optset *self, int option,
         default:
             return -EINVAL;
         }
+    case NN_WS_DEFLATE:
+        if (val != 0 && val != 1)
+            return -EINVAL;
+        if (val && !nn_ws_deflate_supported ())
+            return -ENOTSUP;
+        optset->deflate = val;
+        return 0;
+    case NN_WS_DEFLATE_WINDOW_BITS:
+        if (val < NN_WS_DEFLATE_MIN_WINDOW_BITS ||
+              val > NN_WS_DEFLATE_MAX_WINDOW_BITS)
+            return -EINVAL;
+        optset->deflate_window_bits = val;
+        return 0;
+    case NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER:
+        if (val != 0 && val != 1)
+            return -EINVAL;
+        optset->deflate_no_context_takeover = val;
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -154,6 +186,21 @@ static int nn_ws_optset_getopt (struct nn_optset *self, int option,
             *optvallen < sizeof (int) ? *optvallen : sizeof (int));
         *optvallen = sizeof (int);
         return 0;
+    case NN_WS_DEFLATE:
+        memcpy (optval, &optset->deflate,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_WS_DEFLATE_WINDOW_BITS:
+        memcpy (optval, &optset->deflate_window_bits,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
+    case NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER:
+        memcpy (optval, &optset->deflate_no_context_takeover,
+            *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+        *optvallen = sizeof (int);
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
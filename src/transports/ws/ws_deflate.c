@@ -0,0 +1,312 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "ws_deflate.h"
+
+#include "../../ws.h"
+
+#include "../../utils/chunk.h"
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/attr.h"
+
+#include <stdint.h>
+#include <string.h>
+
+int nn_ws_deflate_supported (void)
+{
+#if defined NN_HAVE_ZLIB
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void nn_ws_deflate_getopts (struct nn_ws_deflate_opts *self,
+    struct nn_ep *ep)
+{
+    size_t sz;
+
+    sz = sizeof (self->enabled);
+    nn_ep_getopt (ep, NN_WS, NN_WS_DEFLATE, &self->enabled, &sz);
+    nn_assert (sz == sizeof (self->enabled));
+    sz = sizeof (self->window_bits);
+    nn_ep_getopt (ep, NN_WS, NN_WS_DEFLATE_WINDOW_BITS,
+        &self->window_bits, &sz);
+    nn_assert (sz == sizeof (self->window_bits));
+    sz = sizeof (self->no_context_takeover);
+    nn_ep_getopt (ep, NN_WS, NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER,
+        &self->no_context_takeover, &sz);
+    nn_assert (sz == sizeof (self->no_context_takeover));
+}
+
+void nn_ws_deflate_init (struct nn_ws_deflate *self)
+{
+    self->active = 0;
+    self->no_context_takeover = 0;
+}
+
+void nn_ws_deflate_term (struct nn_ws_deflate *self)
+{
+    nn_ws_deflate_stop (self);
+}
+
+int nn_ws_deflate_isactive (struct nn_ws_deflate *self)
+{
+    return self->active;
+}
+
+#if defined NN_HAVE_ZLIB
+
+/*  Each compressed message ends with an empty stored block, which is not
+    sent over the wire as per RFC 7692 section 7.2.1. */
+static const uint8_t nn_ws_deflate_trailer [4] = {0x00, 0x00, 0xff, 0xff};
+
+/*  Makes sure there's some free space after the first 'used' bytes of
+    the chunk, growing it geometrically, but not beyond 'limit' bytes.
+    Returns -EMSGSIZE if the chunk is already that big. */
+static int nn_ws_deflate_grow (void **chunk, size_t used, size_t limit,
+    z_stream *strm)
+{
+    int rc;
+    size_t size;
+
+    size = nn_chunk_size (*chunk);
+    if (used == size) {
+        if (size >= limit)
+            return -EMSGSIZE;
+        size = size > limit / 2 ? limit : size * 2;
+        rc = nn_chunk_realloc (size, chunk);
+        errnum_assert (rc == 0, -rc);
+    }
+    strm->next_out = ((Bytef*) *chunk) + used;
+    strm->avail_out = (uInt) (size - used);
+    return 0;
+}
+
+void nn_ws_deflate_start (struct nn_ws_deflate *self,
+    const struct nn_ws_deflate_opts *opts)
+{
+    int rc;
+
+    nn_ws_deflate_stop (self);
+    if (!opts->enabled)
+        return;
+
+    nn_assert (opts->window_bits >= NN_WS_DEFLATE_MIN_WINDOW_BITS &&
+        opts->window_bits <= NN_WS_DEFLATE_MAX_WINDOW_BITS);
+
+    /*  Negative window size means raw deflate stream with no zlib header. */
+    memset (&self->out, 0, sizeof (self->out));
+    rc = deflateInit2 (&self->out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+        -opts->window_bits, 8, Z_DEFAULT_STRATEGY);
+    alloc_assert (rc == Z_OK);
+
+    /*  The peer may use any window size up to the maximum. */
+    memset (&self->in, 0, sizeof (self->in));
+    rc = inflateInit2 (&self->in, -NN_WS_DEFLATE_MAX_WINDOW_BITS);
+    alloc_assert (rc == Z_OK);
+
+    self->no_context_takeover = opts->no_context_takeover;
+    self->active = 1;
+}
+
+void nn_ws_deflate_stop (struct nn_ws_deflate *self)
+{
+    if (!self->active)
+        return;
+
+    deflateEnd (&self->out);
+    inflateEnd (&self->in);
+    self->active = 0;
+}
+
+void nn_ws_deflate_compress (struct nn_ws_deflate *self,
+    const struct nn_iovec *iov, int iovcnt, void **chunk)
+{
+    int rc;
+    int i;
+    size_t len;
+    size_t used;
+
+    nn_assert (self->active);
+
+    /*  Start with a guess, assuming the payload compresses well. */
+    len = 0;
+    for (i = 0; i != iovcnt; ++i)
+        len += iov [i].iov_len;
+    *chunk = NULL;
+
+    /*  zlib won't flush an empty message following a flushed one. Send the
+        shortest valid representation of an empty message, an empty stored
+        block (RFC 7692 section 7.2.3.6), instead. */
+    if (!len) {
+        rc = nn_chunk_alloc (1, 0, chunk);
+        errnum_assert (rc == 0, -rc);
+        *(uint8_t*) *chunk = 0x00;
+        return;
+    }
+
+    rc = nn_chunk_alloc (len / 4 + 64, 0, chunk);
+    errnum_assert (rc == 0, -rc);
+    used = 0;
+    self->out.next_out = (Bytef*) *chunk;
+    self->out.avail_out = (uInt) nn_chunk_size (*chunk);
+
+    for (i = 0; i != iovcnt; ++i) {
+        self->out.next_in = (Bytef*) iov [i].iov_base;
+        self->out.avail_in = (uInt) iov [i].iov_len;
+        while (self->out.avail_in) {
+            used = nn_chunk_size (*chunk) - self->out.avail_out;
+            rc = nn_ws_deflate_grow (chunk, used, (size_t) -1, &self->out);
+            errnum_assert (rc == 0, -rc);
+            rc = deflate (&self->out, Z_NO_FLUSH);
+            nn_assert (rc == Z_OK || rc == Z_BUF_ERROR);
+        }
+    }
+
+    /*  Flush the message to the byte boundary. The flush is complete once
+        deflate leaves some of the output buffer unused. */
+    do {
+        used = nn_chunk_size (*chunk) - self->out.avail_out;
+        rc = nn_ws_deflate_grow (chunk, used, (size_t) -1, &self->out);
+        errnum_assert (rc == 0, -rc);
+        rc = deflate (&self->out, Z_SYNC_FLUSH);
+        nn_assert (rc == Z_OK || rc == Z_BUF_ERROR);
+    } while (self->out.avail_out == 0);
+    used = nn_chunk_size (*chunk) - self->out.avail_out;
+
+    /*  Strip the trailer and trim the chunk to the actual size. */
+    nn_assert (used >= sizeof (nn_ws_deflate_trailer));
+    used -= sizeof (nn_ws_deflate_trailer);
+    nn_assert (memcmp (((uint8_t*) *chunk) + used, nn_ws_deflate_trailer,
+        sizeof (nn_ws_deflate_trailer)) == 0);
+    rc = nn_chunk_realloc (used, chunk);
+    errnum_assert (rc == 0, -rc);
+
+    if (self->no_context_takeover) {
+        rc = deflateReset (&self->out);
+        nn_assert (rc == Z_OK);
+    }
+}
+
+int nn_ws_deflate_decompress (struct nn_ws_deflate *self,
+    const void *in, size_t len, int maxsize, void **chunk)
+{
+    int rc;
+    int i;
+    size_t used;
+    size_t limit;
+    const void *segs [2];
+    size_t seglens [2];
+
+    nn_assert (self->active);
+
+    /*  One byte more than allowed, so that oversized messages can be
+        told apart from the messages of exactly the maximum size. */
+    limit = maxsize < 0 ? (size_t) -1 : (size_t) maxsize + 1;
+
+    *chunk = NULL;
+    rc = nn_chunk_alloc (len * 2 + 64 < limit ? len * 2 + 64 : limit,
+        0, chunk);
+    errnum_assert (rc == 0, -rc);
+    self->in.next_out = (Bytef*) *chunk;
+    self->in.avail_out = (uInt) nn_chunk_size (*chunk);
+
+    /*  Put back the trailer the peer has stripped. */
+    segs [0] = in;
+    seglens [0] = len;
+    segs [1] = nn_ws_deflate_trailer;
+    seglens [1] = sizeof (nn_ws_deflate_trailer);
+
+    for (i = 0; i != 2; ++i) {
+        self->in.next_in = (Bytef*) segs [i];
+        self->in.avail_in = (uInt) seglens [i];
+        while (self->in.avail_in || self->in.avail_out == 0) {
+            used = nn_chunk_size (*chunk) - self->in.avail_out;
+            rc = nn_ws_deflate_grow (chunk, used, limit, &self->in);
+            if (nn_slow (rc < 0))
+                goto fail;
+            rc = inflate (&self->in, Z_SYNC_FLUSH);
+
+            /*  The peer may have ended the deflate stream. It's going to
+                start a new one with the next message. */
+            if (rc == Z_STREAM_END) {
+                rc = inflateReset (&self->in);
+                nn_assert (rc == Z_OK);
+                continue;
+            }
+            if (rc == Z_BUF_ERROR && !self->in.avail_in)
+                break;
+            if (nn_slow (rc != Z_OK)) {
+                rc = -EPROTO;
+                goto fail;
+            }
+        }
+    }
+
+    used = nn_chunk_size (*chunk) - self->in.avail_out;
+    if (nn_slow (used >= limit)) {
+        rc = -EMSGSIZE;
+        goto fail;
+    }
+    rc = nn_chunk_realloc (used, chunk);
+    errnum_assert (rc == 0, -rc);
+    return 0;
+
+fail:
+    nn_chunk_free (*chunk);
+    *chunk = NULL;
+    return rc;
+}
+
+#else
+
+void nn_ws_deflate_start (struct nn_ws_deflate *self,
+    const struct nn_ws_deflate_opts *opts)
+{
+    /*  Without zlib the extension is never negotiated. */
+    nn_assert (!opts->enabled);
+    self->active = 0;
+}
+
+void nn_ws_deflate_stop (struct nn_ws_deflate *self)
+{
+    self->active = 0;
+}
+
+void nn_ws_deflate_compress (NN_UNUSED struct nn_ws_deflate *self,
+    NN_UNUSED const struct nn_iovec *iov, NN_UNUSED int iovcnt,
+    NN_UNUSED void **chunk)
+{
+    nn_assert (0);
+}
+
+int nn_ws_deflate_decompress (NN_UNUSED struct nn_ws_deflate *self,
+    NN_UNUSED const void *in, NN_UNUSED size_t len, NN_UNUSED int maxsize,
+    NN_UNUSED void **chunk)
+{
+    nn_assert (0);
+    return -EPROTO;
+}
+
+#endif
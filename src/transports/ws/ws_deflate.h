@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_WS_DEFLATE_INCLUDED
+#define NN_WS_DEFLATE_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../nn.h"
+
+#include <stddef.h>
+
+#if defined NN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/*  Implementation of the permessage-deflate extension as per RFC 7692.
+    Without zlib the extension is never negotiated. */
+
+/*  Range of LZ77 window sizes (base-2 logarithm) the compressor can use.
+    RFC 7692 allows window of 256 bytes, but zlib doesn't support it for
+    raw deflate streams. */
+#define NN_WS_DEFLATE_MIN_WINDOW_BITS 9
+#define NN_WS_DEFLATE_MAX_WINDOW_BITS 15
+
+/*  Parameters of the extension. Before the opening handshake these are
+    the values requested by the user, afterwards the negotiated ones. Both
+    of them apply to messages sent by this endpoint, the peer may compress
+    its messages in any way the RFC permits. */
+struct nn_ws_deflate_opts {
+
+    /*  1 if the extension is requested or was negotiated, 0 otherwise. */
+    int enabled;
+
+    /*  Size of the LZ77 window used to compress outbound messages. */
+    int window_bits;
+
+    /*  If 1, every outbound message is compressed independently of the
+        previous ones. */
+    int no_context_takeover;
+};
+
+struct nn_ws_deflate {
+
+    /*  1 if the extension is in use on the connection. */
+    int active;
+    int no_context_takeover;
+
+#if defined NN_HAVE_ZLIB
+    /*  Compressor of the outbound messages and decompressor of the inbound
+        ones. Both keep their state between messages. */
+    z_stream out;
+    z_stream in;
+#endif
+};
+
+/*  Returns 1 if the library was built with the support for the extension. */
+int nn_ws_deflate_supported (void);
+
+/*  Fills in the parameters requested by the user via endpoint options. */
+void nn_ws_deflate_getopts (struct nn_ws_deflate_opts *self,
+    struct nn_ep *ep);
+
+void nn_ws_deflate_init (struct nn_ws_deflate *self);
+void nn_ws_deflate_term (struct nn_ws_deflate *self);
+
+/*  Starts using the extension on a new connection using negotiated
+    parameters. If the extension wasn't negotiated, does nothing. */
+void nn_ws_deflate_start (struct nn_ws_deflate *self,
+    const struct nn_ws_deflate_opts *opts);
+
+/*  Stops using the extension, if it was used, and drops the state kept
+    between messages. */
+void nn_ws_deflate_stop (struct nn_ws_deflate *self);
+
+/*  Returns 1 if messages on the connection are compressed. */
+int nn_ws_deflate_isactive (struct nn_ws_deflate *self);
+
+/*  Compresses the message payload consisting of 'iovcnt' buffers.
+    'chunk' is set to a newly allocated chunk containing the compressed
+    payload. */
+void nn_ws_deflate_compress (struct nn_ws_deflate *self,
+    const struct nn_iovec *iov, int iovcnt, void **chunk);
+
+/*  Decompresses the payload of a message. On success, 'chunk' is set to
+    a newly allocated chunk containing the message. Returns -EMSGSIZE if the
+    decompressed message would exceed 'maxsize' bytes (negative 'maxsize'
+    means no limit) and -EPROTO if the payload is not a valid deflate
+    stream. */
+int nn_ws_deflate_decompress (struct nn_ws_deflate *self,
+    const void *in, size_t len, int maxsize, void **chunk);
+
+#endif
@@ -38,7 +38,6 @@
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
 #include "../../utils/random.h"
-#include "../../utils/strcasestr.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -133,6 +132,31 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self);
 static int nn_ws_handshake_hash_key (const char *key, size_t key_len,
     char *hashed, size_t hashed_len);
 
+/*  Parameters of a permessage-deflate offer or response as per RFC 7692
+    section 7.1. Window sizes are -1 if the parameter is absent and 0 if
+    it is present without a value. */
+struct nn_ws_deflate_params {
+    int server_no_context_takeover;
+    int client_no_context_takeover;
+    int server_max_window_bits;
+    int client_max_window_bits;
+};
+
+/*  Parses one comma-separated element of Sec-WebSocket-Extensions header
+    and advances the subject pointer past it. Returns NN_WS_HANDSHAKE_MATCH
+    if the element is a well-formed permessage-deflate extension; else,
+    NN_WS_HANDSHAKE_NOMATCH. */
+static int nn_ws_handshake_parse_deflate (const char **subj, const char *end,
+    struct nn_ws_deflate_params *params);
+
+/*  Picks the first acceptable permessage-deflate offer from the client, if
+    any, and prepares the corresponding response header. */
+static void nn_ws_handshake_server_deflate (struct nn_ws_handshake *self);
+
+/*  Checks the extensions accepted by the server. Returns zero if they're
+    acceptable, -1 otherwise. */
+static int nn_ws_handshake_client_deflate (struct nn_ws_handshake *self);
+
 /*  String parsing support functions. */
 
 /*  Scans for reference token against subject string, optionally ignoring
@@ -157,6 +181,25 @@ static int nn_ws_match_value (const char* termseq, const char **subj,
 static int nn_ws_validate_value (const char* expected, const char *subj,
     size_t subj_len, int case_insensitive);
 
+/*  Splits the header line at the subject position into the field name and
+    the field value, stripped of surrounding whitespace, and advances the
+    subject pointer past the line. A line without a colon is returned as
+    a name with an empty value. The subject must contain the termination
+    sequence. Returns NN_WS_HANDSHAKE_NOMATCH once the empty line ending
+    the header section has been consumed; else, NN_WS_HANDSHAKE_MATCH. */
+static int nn_ws_match_field (const char **subj, const char **name,
+    size_t *name_len, const char **value, size_t *value_len);
+
+/*  Looks for the token in the comma-separated list, ignoring case. Returns
+    the location of the token within the list, or NULL if not found. */
+static const char *nn_ws_match_list (const char *token, const char *list,
+    size_t list_len);
+
+/*  Checks whether the received part of the handshake, 'len' bytes long,
+    is complete. The receive logic never reads past the first termination
+    sequence so it's enough to look at the tail of the buffer. */
+static int nn_ws_handshake_complete (const char *buf, size_t len);
+
 void nn_ws_handshake_init (struct nn_ws_handshake *self, int src,
     struct nn_fsm *owner)
 {
@@ -170,12 +213,16 @@ void nn_ws_handshake_init (struct nn_ws_handshake *self, int src,
     self->usock_owner.src = -1;
     self->usock_owner.fsm = NULL;
     self->pipebase = NULL;
+    self->bufs = NULL;
 }
 
 void nn_ws_handshake_term (struct nn_ws_handshake *self)
 {
     nn_assert_state (self, NN_WS_HANDSHAKE_STATE_IDLE);
 
+    /*  The buffers are still around if the handshake was interrupted. */
+    nn_free (self->bufs);
+
     nn_fsm_event_term (&self->done);
     nn_timer_term (&self->timer);
     nn_fsm_term (&self->fsm);
@@ -188,7 +235,8 @@ int nn_ws_handshake_isidle (struct nn_ws_handshake *self)
 
 void nn_ws_handshake_start (struct nn_ws_handshake *self,
     struct nn_usock *usock, struct nn_pipebase *pipebase,
-    int mode, const char *resource, const char *host)
+    int mode, const char *resource, const char *host,
+    const struct nn_ws_deflate_opts *deflate)
 {
     /*  It's expected this resource has been allocated during intial connect. */
     if (mode == NN_WS_CLIENT)
@@ -204,9 +252,17 @@ void nn_ws_handshake_start (struct nn_ws_handshake *self,
     self->mode = mode;
     self->resource = resource;
     self->remote_host = host;
+    self->deflate = *deflate;
 
-    memset (self->opening_hs, 0, sizeof (self->opening_hs));
-    memset (self->response, 0, sizeof (self->response));
+    if (!self->bufs) {
+        self->bufs = nn_alloc (sizeof (struct nn_ws_handshake_bufs),
+            "ws handshake buffers");
+        alloc_assert (self->bufs);
+    }
+    self->bufs->deflate_hdr [0] = '\0';
+
+    memset (self->bufs->opening_hs, 0, sizeof (self->bufs->opening_hs));
+    memset (self->bufs->response, 0, sizeof (self->bufs->response));
 
     self->recv_pos = 0;
     self->retries = 0;
@@ -389,6 +445,77 @@ static int nn_ws_validate_value (const char* expected, const char *subj,
     return NN_WS_HANDSHAKE_MATCH;
 }
 
+static int nn_ws_match_field (const char **subj, const char **name,
+    size_t *name_len, const char **value, size_t *value_len)
+{
+    const char *pos;
+    const char *eol;
+    const char *colon;
+
+    pos = *subj;
+    eol = strstr (pos, CRLF);
+    nn_assert (eol);
+    *subj = eol + strlen (CRLF);
+
+    /*  Empty line ends the header section. */
+    if (eol == pos)
+        return NN_WS_HANDSHAKE_NOMATCH;
+
+    *name = pos;
+    colon = memchr (pos, ':', eol - pos);
+    if (!colon) {
+        *name_len = eol - pos;
+        *value = eol;
+        *value_len = 0;
+        return NN_WS_HANDSHAKE_MATCH;
+    }
+    *name_len = colon - pos;
+
+    pos = colon + 1;
+    while (pos < eol && (*pos == '\x20' || *pos == '\t'))
+        pos++;
+    while (eol > pos && (*(eol - 1) == '\x20' || *(eol - 1) == '\t'))
+        eol--;
+    *value = pos;
+    *value_len = eol - pos;
+
+    return NN_WS_HANDSHAKE_MATCH;
+}
+
+static const char *nn_ws_match_list (const char *token, const char *list,
+    size_t list_len)
+{
+    const char *end;
+    const char *start;
+    const char *item_end;
+
+    end = list + list_len;
+    while (list < end) {
+        while (list < end && (*list == '\x20' || *list == '\t'))
+            list++;
+        start = list;
+        while (list < end && *list != ',')
+            list++;
+        item_end = list;
+        while (item_end > start &&
+              (*(item_end - 1) == '\x20' || *(item_end - 1) == '\t'))
+            item_end--;
+        if (nn_ws_validate_value (token, start, item_end - start, 1))
+            return start;
+        if (list < end)
+            list++;
+    }
+
+    return NULL;
+}
+
+static int nn_ws_handshake_complete (const char *buf, size_t len)
+{
+    return len >= NN_WS_HANDSHAKE_TERMSEQ_LEN &&
+        memcmp (buf + len - NN_WS_HANDSHAKE_TERMSEQ_LEN,
+        NN_WS_HANDSHAKE_TERMSEQ, NN_WS_HANDSHAKE_TERMSEQ_LEN) == 0;
+}
+
 static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
@@ -418,16 +545,16 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                 case NN_WS_CLIENT:
                     /*  Send opening handshake to server. */
                     nn_assert (handshaker->recv_len <=
-                        sizeof (handshaker->response));
+                        sizeof (handshaker->bufs->response));
                     handshaker->state = NN_WS_HANDSHAKE_STATE_CLIENT_SEND;
                     nn_ws_handshake_client_request (handshaker);
                     return;
                 case NN_WS_SERVER:
                     /*  Begin receiving opening handshake from client. */
                     nn_assert (handshaker->recv_len <=
-                        sizeof (handshaker->opening_hs));
+                        sizeof (handshaker->bufs->opening_hs));
                     handshaker->state = NN_WS_HANDSHAKE_STATE_SERVER_RECV;
-                    nn_usock_recv (handshaker->usock, handshaker->opening_hs,
+                    nn_usock_recv (handshaker->usock, handshaker->bufs->opening_hs,
                         handshaker->recv_len, NULL);
                     return;
                 default:
@@ -475,7 +602,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
 
                     /*  Validate the previous recv operation. */
                     nn_assert (handshaker->recv_pos <
-                        sizeof (handshaker->opening_hs));
+                        sizeof (handshaker->bufs->opening_hs));
 
                     /*  Ensure we can back-track at least the length of the
                         termination sequence to determine how many bytes to
@@ -491,7 +618,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                         automatically true. */
                     for (i = NN_WS_HANDSHAKE_TERMSEQ_LEN; i > 0; i--) {
                         if (memcmp (NN_WS_HANDSHAKE_TERMSEQ,
-                            handshaker->opening_hs + handshaker->recv_pos - i,
+                            handshaker->bufs->opening_hs + handshaker->recv_pos - i,
                             i) == 0) {
                             break;
                         }
@@ -505,7 +632,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                         assumed was a sufficiently-large buffer to receive the
                         handshake, we fail the client. */
                     if (handshaker->recv_len + handshaker->recv_pos >
-                        sizeof (handshaker->opening_hs)) {
+                        sizeof (handshaker->bufs->opening_hs)) {
                         handshaker->response_code =
                             NN_WS_HANDSHAKE_RESPONSE_TOO_BIG;
                         handshaker->state =
@@ -515,7 +642,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                     else {
                         handshaker->retries++;
                         nn_usock_recv (handshaker->usock,
-                            handshaker->opening_hs + handshaker->recv_pos,
+                            handshaker->bufs->opening_hs + handshaker->recv_pos,
                             handshaker->recv_len, NULL);
                     }
                     return;
@@ -597,7 +724,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
                 handshaker->state = NN_WS_HANDSHAKE_STATE_CLIENT_RECV;
-                nn_usock_recv (handshaker->usock, handshaker->response,
+                nn_usock_recv (handshaker->usock, handshaker->bufs->response,
                     handshaker->recv_len, NULL);
                 return;
             case NN_USOCK_SHUTDOWN:
@@ -657,7 +784,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
 
                     /*  Validate the previous recv operation. */
                     nn_assert (handshaker->recv_pos <
-                        sizeof (handshaker->response));
+                        sizeof (handshaker->bufs->response));
 
                     /*  Ensure we can back-track at least the length of the
                         termination sequence to determine how many bytes to
@@ -670,7 +797,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                     /*  If i goes to 0, it no need to compare. */
                     for (i = NN_WS_HANDSHAKE_TERMSEQ_LEN; i > 0; i--) {
                         if (memcmp (NN_WS_HANDSHAKE_TERMSEQ,
-                            handshaker->response + handshaker->recv_pos - i,
+                            handshaker->bufs->response + handshaker->recv_pos - i,
                             i) == 0) {
                             break;
                         }
@@ -684,7 +811,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                         assumed was a sufficiently-large buffer to receive the
                         handshake, we fail the connection. */
                     if (handshaker->recv_len + handshaker->recv_pos >
-                        sizeof (handshaker->response)) {
+                        sizeof (handshaker->bufs->response)) {
                         nn_timer_stop (&handshaker->timer);
                         handshaker->state =
                             NN_WS_HANDSHAKE_STATE_STOPPING_TIMER_ERROR;
@@ -692,7 +819,7 @@ static void nn_ws_handshake_handler (struct nn_fsm *self, int src, int type,
                     else {
                         handshaker->retries++;
                         nn_usock_recv (handshaker->usock,
-                            handshaker->response + handshaker->recv_pos,
+                            handshaker->bufs->response + handshaker->recv_pos,
                             handshaker->recv_len, NULL);
                     }
                     return;
@@ -841,6 +968,13 @@ static void nn_ws_handshake_leave (struct nn_ws_handshake *self, int rc)
     self->usock = NULL;
     self->usock_owner.src = -1;
     self->usock_owner.fsm = NULL;
+
+    /*  After a failure, a send may still be pending on the socket, so
+        the buffers are kept until the object is terminated. */
+    if (rc == NN_WS_HANDSHAKE_OK) {
+        nn_free (self->bufs);
+        self->bufs = NULL;
+    }
     self->state = NN_WS_HANDSHAKE_STATE_DONE;
     nn_fsm_raise (&self->fsm, &self->done, rc);
 }
@@ -853,24 +987,25 @@ static int nn_ws_handshake_parse_client_opening (struct nn_ws_handshake *self)
         reserved for accepted connections, not as fields within these
         headers. */
 
-    int rc;
     const char *pos;
+    const char *end;
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
     unsigned i;
 
     /*  Guarantee that a NULL terminator exists to enable treating this
         recv buffer like a string. */
-    nn_assert (memchr (self->opening_hs, '\0', sizeof (self->opening_hs)));
-
-    /*  Having found the NULL terminator, from this point forward string
-        functions may be used. */
-    nn_assert (strlen (self->opening_hs) < sizeof (self->opening_hs));
-
-    pos = self->opening_hs;
+    end = memchr (self->bufs->opening_hs, '\0', sizeof (self->bufs->opening_hs));
+    nn_assert (end);
 
     /*  Is the opening handshake from the client fully received? */
-    if (!strstr (pos, NN_WS_HANDSHAKE_TERMSEQ))
+    if (!nn_ws_handshake_complete (self->bufs->opening_hs, end - self->bufs->opening_hs))
         return NN_WS_HANDSHAKE_RECV_MORE;
 
+    pos = self->bufs->opening_hs;
+
     self->host = NULL;
     self->origin = NULL;
     self->key = NULL;
@@ -879,6 +1014,8 @@ static int nn_ws_handshake_parse_client_opening (struct nn_ws_handshake *self)
     self->version = NULL;
     self->protocol = NULL;
     self->uri = NULL;
+    self->extensions = NULL;
+    self->peerheartbeat = 0;
 
     self->host_len = 0;
     self->origin_len = 0;
@@ -888,6 +1025,7 @@ static int nn_ws_handshake_parse_client_opening (struct nn_ws_handshake *self)
     self->version_len = 0;
     self->protocol_len = 0;
     self->uri_len = 0;
+    self->extensions_len = 0;
 
     /*  This function, if generating a return value that triggers
         a response to the client, should replace this sentinel value
@@ -910,82 +1048,67 @@ static int nn_ws_handshake_parse_client_opening (struct nn_ws_handshake *self)
     if (!nn_ws_match_token (CRLF, &pos, 0, 0))
         return NN_WS_HANDSHAKE_RECV_MORE;
 
-    /*  It's expected the current position is now at the first
-        header field. Match them one by one. */
-    while (strlen (pos))
-    {
-        const char *conn = NULL;
-        size_t conn_len = 0;
-        if (nn_ws_match_token ("Host:", &pos, 1, 0)) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->host, &self->host_len);
+    /*  It's expected the current position is now at the first header field.
+        Split them one by one and pick the ones we are interested in.
+        Unknown header fields are skipped. */
+    while (nn_ws_match_field (&pos, &name, &name_len, &value, &value_len)) {
+        if (nn_ws_validate_value ("Host", name, name_len, 1)) {
+            self->host = value;
+            self->host_len = value_len;
         }
-        else if (nn_ws_match_token ("Origin:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->origin, &self->origin_len);
+        else if (nn_ws_validate_value ("Origin", name, name_len, 1)) {
+            self->origin = value;
+            self->origin_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Key:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->key, &self->key_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Key",
+              name, name_len, 1)) {
+            self->key = value;
+            self->key_len = value_len;
         }
-        else if (nn_ws_match_token ("Upgrade:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->upgrade, &self->upgrade_len);
+        else if (nn_ws_validate_value ("Upgrade", name, name_len, 1)) {
+            self->upgrade = value;
+            self->upgrade_len = value_len;
         }
-        else if (nn_ws_match_token ("Connection:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1, &conn, &conn_len);
+        else if (nn_ws_validate_value ("Connection", name, name_len, 1)) {
 
             /*  The values here can be comma delimited, or they can be
                 listed as separate Connection headers.  We only care about
-                the presence of the Upgrade header, and we're willing to
-                assume well-formedness.  This crummy parse may let clients
-                send us a malformed header that we ought to reject, but
-                we'll just cite Postel's law here if anyone asks. */
-            self->conn = nn_strcasestr (conn, "upgrade");
-            if (self->conn != NULL) {
-                self->conn_len = strlen ("upgrade");
+                the presence of the Upgrade token. */
+            if (!self->conn) {
+                self->conn = nn_ws_match_list ("upgrade", value, value_len);
+                if (self->conn != NULL)
+                    self->conn_len = strlen ("upgrade");
             }
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Version:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->version, &self->version_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Version",
+              name, name_len, 1)) {
+            self->version = value;
+            self->version_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Protocol:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->protocol, &self->protocol_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Protocol",
+              name, name_len, 1)) {
+            self->protocol = value;
+            self->protocol_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Extensions:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->extensions, &self->extensions_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Extensions",
+              name, name_len, 1)) {
+            self->extensions = value;
+            self->extensions_len = value_len;
         }
-        else if (nn_ws_match_token (CRLF,
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            /*  Exit loop since all headers are parsed. */
-            break;
+        else if (nn_ws_validate_value (NN_WS_HANDSHAKE_HEARTBEAT,
+              name, name_len, 1)) {
+            self->peerheartbeat = 1;
         }
-        else {
-            /*  Skip unknown headers. */
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                NULL, NULL);
-        }
-
-        if (rc != NN_WS_HANDSHAKE_MATCH)
-            return NN_WS_HANDSHAKE_RECV_MORE;
     }
 
-    /*  Validate the opening handshake is now fully parsed. Additionally,
-        as per RFC 6455 section 4.1, the client should not send additional data
-        after the opening handshake, so this assertion validates upstream recv
-        logic prevented this case. */
-    nn_assert (strlen (pos) == 0);
+    /*  As per RFC 6455 section 4.1, the client should not send additional
+        data after the opening handshake. Upstream recv logic doesn't read
+        past the termination sequence, so anything left here means that
+        the client has sent an empty line before the end of the request. */
+    if (pos != end) {
+        self->response_code = NN_WS_HANDSHAKE_RESPONSE_WSPROTO;
+        return NN_WS_HANDSHAKE_INVALID;
+    }
 
     /*  TODO: protocol expectations below this point are hard-coded here as
         an initial design decision. Perhaps in the future these values should
@@ -1019,6 +1142,9 @@ static int nn_ws_handshake_parse_client_opening (struct nn_ws_handshake *self)
         return NN_WS_HANDSHAKE_INVALID;
     }
 
+    /*  Extensions are optional; unsupported offers are simply declined. */
+    nn_ws_handshake_server_deflate (self);
+
     /*  At this point, client meets RFC 6455 compliance for opening handshake.
         Now it's time to check nanomsg-imposed required handshake values. */
     if (self->protocol) {
@@ -1070,24 +1196,25 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self)
         reserved for accepted connections, not as fields within these
         headers. */
 
-    int rc;
     const char *pos;
+    const char *end;
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
 
     /*  Guarantee that a NULL terminator exists to enable treating this
         recv buffer like a string. The lack of such would indicate a failure
         upstream to catch a buffer overflow. */
-    nn_assert (memchr (self->response, '\0', sizeof (self->response)));
-
-    /*  Having found the NULL terminator, from this point forward string
-        functions may be used. */
-    nn_assert (strlen (self->response) < sizeof (self->response));
-
-    pos = self->response;
+    end = memchr (self->bufs->response, '\0', sizeof (self->bufs->response));
+    nn_assert (end);
 
     /*  Is the response from the server fully received? */
-    if (!strstr (pos, NN_WS_HANDSHAKE_TERMSEQ))
+    if (!nn_ws_handshake_complete (self->bufs->response, end - self->bufs->response))
         return NN_WS_HANDSHAKE_RECV_MORE;
 
+    pos = self->bufs->response;
+
     self->status_code = NULL;
     self->reason_phrase = NULL;
     self->server = NULL;
@@ -1096,6 +1223,8 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self)
     self->conn = NULL;
     self->version = NULL;
     self->protocol = NULL;
+    self->extensions = NULL;
+    self->peerheartbeat = 0;
 
     self->status_code_len = 0;
     self->reason_phrase_len = 0;
@@ -1105,6 +1234,7 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self)
     self->conn_len = 0;
     self->version_len = 0;
     self->protocol_len = 0;
+    self->extensions_len = 0;
 
     /*  RFC 7230 3.1.2 Status Line: HTTP Version. */
     if (!nn_ws_match_token ("HTTP/1.1\x20", &pos, 0, 0))
@@ -1120,64 +1250,55 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self)
         &self->reason_phrase, &self->reason_phrase_len))
         return NN_WS_HANDSHAKE_RECV_MORE;
 
-    /*  It's expected the current position is now at the first
-        header field. Match them one by one. */
-    while (strlen (pos))
-    {
-        if (nn_ws_match_token ("Server:", &pos, 1, 0)) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->server, &self->server_len);
+    /*  It's expected the current position is now at the first header field.
+        Split them one by one and pick the ones we are interested in.
+        Unknown header fields are skipped. */
+    while (nn_ws_match_field (&pos, &name, &name_len, &value, &value_len)) {
+        if (nn_ws_validate_value ("Server", name, name_len, 1)) {
+            self->server = value;
+            self->server_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Accept:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->accept_key, &self->accept_key_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Accept",
+              name, name_len, 1)) {
+            self->accept_key = value;
+            self->accept_key_len = value_len;
         }
-        else if (nn_ws_match_token ("Upgrade:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->upgrade, &self->upgrade_len);
+        else if (nn_ws_validate_value ("Upgrade", name, name_len, 1)) {
+            self->upgrade = value;
+            self->upgrade_len = value_len;
         }
-        else if (nn_ws_match_token ("Connection:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->conn, &self->conn_len);
+        else if (nn_ws_validate_value ("Connection", name, name_len, 1)) {
+            if (!self->conn) {
+                self->conn = nn_ws_match_list ("upgrade", value, value_len);
+                if (self->conn != NULL)
+                    self->conn_len = strlen ("upgrade");
+            }
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Version-Server:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->version, &self->version_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Version-Server",
+              name, name_len, 1)) {
+            self->version = value;
+            self->version_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Protocol-Server:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->protocol, &self->protocol_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Protocol-Server",
+              name, name_len, 1)) {
+            self->protocol = value;
+            self->protocol_len = value_len;
         }
-        else if (nn_ws_match_token ("Sec-WebSocket-Extensions:",
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                &self->extensions, &self->extensions_len);
+        else if (nn_ws_validate_value ("Sec-WebSocket-Extensions",
+              name, name_len, 1)) {
+            self->extensions = value;
+            self->extensions_len = value_len;
         }
-        else if (nn_ws_match_token (CRLF,
-            &pos, 1, 0) == NN_WS_HANDSHAKE_MATCH) {
-            /*  Exit loop since all headers are parsed. */
-            break;
+        else if (nn_ws_validate_value (NN_WS_HANDSHAKE_HEARTBEAT,
+              name, name_len, 1)) {
+            self->peerheartbeat = 1;
         }
-        else {
-            /*  Skip unknown headers. */
-            rc = nn_ws_match_value (CRLF, &pos, 1, 1,
-                NULL, NULL);
-        }
-
-        if (rc != NN_WS_HANDSHAKE_MATCH)
-            return NN_WS_HANDSHAKE_RECV_MORE;
     }
 
-    /*  Validate the opening handshake is now fully parsed. Additionally,
-        as per RFC 6455 section 4.1, the client should not send additional data
-        after the opening handshake, so this assertion validates upstream recv
-        logic prevented this case. */
-    nn_assert (strlen (pos) == 0);
+    /*  As per RFC 6455 section 4.1, the server must not send additional data
+        before the handshake is complete. */
+    if (pos != end)
+        return NN_WS_HANDSHAKE_INVALID;
 
     /*  TODO: protocol expectations below this point are hard-coded here as
         an initial design decision. Perhaps in the future these values should
@@ -1210,6 +1331,11 @@ static int nn_ws_handshake_parse_server_response (struct nn_ws_handshake *self)
         self->accept_key_len, 1) != NN_WS_HANDSHAKE_MATCH)
         return NN_WS_HANDSHAKE_INVALID;
 
+    /*  RFC 6455 section 4.1: the server may only accept the extensions
+        offered by the client. */
+    if (nn_ws_handshake_client_deflate (self) != 0)
+        return NN_WS_HANDSHAKE_INVALID;
+
     /*  Server response meets RFC 6455 compliance for opening handshake. */
     return NN_WS_HANDSHAKE_VALID;
 }
@@ -1228,7 +1354,7 @@ static void nn_ws_handshake_client_request (struct nn_ws_handshake *self)
         string NULL terminator. */
     char encoded_key [24 + 1];
 
-    nn_random_generate (rand_key, sizeof (rand_key));
+    nn_random_secure (rand_key, sizeof (rand_key));
 
     rc = nn_base64_encode (rand_key, sizeof (rand_key),
         encoded_key, sizeof (encoded_key));
@@ -1256,19 +1382,30 @@ static void nn_ws_handshake_client_request (struct nn_ws_handshake *self)
     /*  Guarantee that the socket type was found in the map. */
     nn_assert (i < NN_WS_HANDSHAKE_SP_MAP_LEN);
 
-    sprintf (self->opening_hs,
+    /*  Offer compression as per RFC 7692 section 5. The client is able to
+        limit its window size to whatever the server asks for. */
+    if (self->deflate.enabled)
+        sprintf (self->bufs->deflate_hdr,
+            "Sec-WebSocket-Extensions: permessage-deflate; "
+            "client_max_window_bits%s\r\n",
+            self->deflate.no_context_takeover ?
+            "; client_no_context_takeover" : "");
+
+    sprintf (self->bufs->opening_hs,
         "GET %s HTTP/1.1\r\n"
         "Host: %s\r\n"
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
         "Sec-WebSocket-Key: %s\r\n"
         "Sec-WebSocket-Version: 13\r\n"
+        "%s"
+        NN_WS_HANDSHAKE_HEARTBEAT ": 1\r\n"
         "Sec-WebSocket-Protocol: %s\r\n\r\n",
         self->resource, self->remote_host, encoded_key,
-        NN_WS_HANDSHAKE_SP_MAP[i].ws_sp);
+        self->bufs->deflate_hdr, NN_WS_HANDSHAKE_SP_MAP[i].ws_sp);
 
-    open_request.iov_len = strlen (self->opening_hs);
-    open_request.iov_base = self->opening_hs;
+    open_request.iov_len = strlen (self->bufs->opening_hs);
+    open_request.iov_base = self->bufs->opening_hs;
 
     nn_usock_send (self->usock, &open_request, 1);
 }
@@ -1284,7 +1421,7 @@ static void nn_ws_handshake_server_reply (struct nn_ws_handshake *self)
     /*  Allow room for NULL terminator. */
     char accept_key [NN_WS_HANDSHAKE_ACCEPT_KEY_LEN + 1];
 
-    memset (self->response, 0, sizeof (self->response));
+    memset (self->bufs->response, 0, sizeof (self->bufs->response));
 
     if (self->response_code == NN_WS_HANDSHAKE_RESPONSE_OK) {
         /*  Upgrade connection as per RFC 6455 section 4.2.2. */
@@ -1300,13 +1437,16 @@ static void nn_ws_handshake_server_reply (struct nn_ws_handshake *self)
         strncpy (protocol, self->protocol, self->protocol_len);
         protocol [self->protocol_len] = '\0';
 
-        sprintf (self->response,
+        sprintf (self->bufs->response,
             "HTTP/1.1 101 Switching Protocols\r\n"
             "Upgrade: websocket\r\n"
             "Connection: Upgrade\r\n"
             "Sec-WebSocket-Accept: %s\r\n"
+            "%s%s"
             "Sec-WebSocket-Protocol: %s\r\n\r\n",
-            accept_key, protocol);
+            accept_key, self->bufs->deflate_hdr,
+            self->peerheartbeat ? NN_WS_HANDSHAKE_HEARTBEAT ": 1\r\n" : "",
+            protocol);
 
         nn_free (protocol);
     }
@@ -1343,7 +1483,7 @@ static void nn_ws_handshake_server_reply (struct nn_ws_handshake *self)
         version [self->version_len] = '\0';
 
         /*  Fail connection as per RFC 6455 4.4. */
-        sprintf (self->response,
+        sprintf (self->bufs->response,
             "HTTP/1.1 %s\r\n"
             "Sec-WebSocket-Version: %s\r\n",
             code, version);
@@ -1351,8 +1491,8 @@ static void nn_ws_handshake_server_reply (struct nn_ws_handshake *self)
         nn_free (version);
     }
 
-    response.iov_len = strlen (self->response);
-    response.iov_base = &self->response;
+    response.iov_len = strlen (self->bufs->response);
+    response.iov_base = &self->bufs->response;
 
     nn_usock_send (self->usock, &response, 1);
 
@@ -1363,20 +1503,228 @@ static int nn_ws_handshake_hash_key (const char *key, size_t key_len,
     char *hashed, size_t hashed_len)
 {
     int rc;
-    unsigned i;
     struct nn_sha1 hash;
 
     nn_sha1_init (&hash);
-
-    for (i = 0; i < key_len; i++)
-        nn_sha1_hashbyte (&hash, key [i]);
-
-    for (i = 0; i < strlen (NN_WS_HANDSHAKE_MAGIC_GUID); i++)
-        nn_sha1_hashbyte (&hash, NN_WS_HANDSHAKE_MAGIC_GUID [i]);
+    nn_sha1_hash (&hash, key, key_len);
+    nn_sha1_hash (&hash, NN_WS_HANDSHAKE_MAGIC_GUID,
+        strlen (NN_WS_HANDSHAKE_MAGIC_GUID));
 
     rc = nn_base64_encode (nn_sha1_result (&hash),
-        sizeof (hash.state), hashed, hashed_len);
+        SHA1_HASH_LEN, hashed, hashed_len);
 
     return rc;
 }
 
+
+/*  Scans a token of an extension header, skipping the surrounding
+    whitespace. Returns the start of the token and stores its length. */
+static const char *nn_ws_handshake_ext_token (const char **subj,
+    const char *end, size_t *len)
+{
+    const char *pos;
+    const char *start;
+
+    pos = *subj;
+    while (pos < end && (*pos == '\x20' || *pos == '\t'))
+        pos++;
+    start = pos;
+    while (pos < end && !strchr ("\x20\t;,=\"", *pos))
+        pos++;
+    *len = pos - start;
+    while (pos < end && (*pos == '\x20' || *pos == '\t'))
+        pos++;
+    *subj = pos;
+
+    return start;
+}
+
+static int nn_ws_handshake_parse_deflate (const char **subj, const char *end,
+    struct nn_ws_deflate_params *params)
+{
+    const char *pos;
+    const char *name;
+    size_t name_len;
+    int *flag;
+    int *bits;
+    int value;
+    int digits;
+    int quoted;
+    int valid;
+
+    params->server_no_context_takeover = 0;
+    params->client_no_context_takeover = 0;
+    params->server_max_window_bits = -1;
+    params->client_max_window_bits = -1;
+
+    pos = *subj;
+    valid = 1;
+
+    name = nn_ws_handshake_ext_token (&pos, end, &name_len);
+    if (!nn_ws_validate_value ("permessage-deflate", name, name_len, 1))
+        valid = 0;
+
+    while (pos < end && *pos == ';') {
+        pos++;
+        name = nn_ws_handshake_ext_token (&pos, end, &name_len);
+
+        /*  RFC 7692 section 7.1: values are decimal integers, which may
+            also be sent as quoted strings. */
+        value = -1;
+        if (pos < end && *pos == '=') {
+            pos++;
+            while (pos < end && (*pos == '\x20' || *pos == '\t'))
+                pos++;
+            quoted = pos < end && *pos == '"';
+            if (quoted)
+                pos++;
+            value = 0;
+            digits = 0;
+            while (pos < end && isdigit ((unsigned char) *pos) && digits < 3) {
+                value = value * 10 + (*pos - '0');
+                pos++;
+                digits++;
+            }
+            if (!digits)
+                valid = 0;
+            if (quoted) {
+                if (pos < end && *pos == '"')
+                    pos++;
+                else
+                    valid = 0;
+            }
+            while (pos < end && (*pos == '\x20' || *pos == '\t'))
+                pos++;
+        }
+
+        flag = NULL;
+        bits = NULL;
+        if (nn_ws_validate_value ("server_no_context_takeover",
+              name, name_len, 1))
+            flag = &params->server_no_context_takeover;
+        else if (nn_ws_validate_value ("client_no_context_takeover",
+              name, name_len, 1))
+            flag = &params->client_no_context_takeover;
+        else if (nn_ws_validate_value ("server_max_window_bits",
+              name, name_len, 1))
+            bits = &params->server_max_window_bits;
+        else if (nn_ws_validate_value ("client_max_window_bits",
+              name, name_len, 1))
+            bits = &params->client_max_window_bits;
+        else
+            valid = 0;
+
+        /*  Parameters must not be repeated. Only client_max_window_bits
+            may come without a value. */
+        if (flag) {
+            if (*flag || value != -1)
+                valid = 0;
+            *flag = 1;
+        }
+        if (bits) {
+            if (*bits != -1 || (value == -1 &&
+                  bits != &params->client_max_window_bits) ||
+                  (value != -1 && (value < 8 || value > 15)))
+                valid = 0;
+            *bits = value == -1 ? 0 : value;
+        }
+    }
+
+    /*  Anything else up to the end of the element makes it malformed. */
+    while (pos < end && *pos != ',') {
+        valid = 0;
+        pos++;
+    }
+    if (pos < end)
+        pos++;
+    *subj = pos;
+
+    return valid ? NN_WS_HANDSHAKE_MATCH : NN_WS_HANDSHAKE_NOMATCH;
+}
+
+static void nn_ws_handshake_server_deflate (struct nn_ws_handshake *self)
+{
+    const char *pos;
+    const char *end;
+    struct nn_ws_deflate_params params;
+    char window [40];
+
+    self->bufs->deflate_hdr [0] = '\0';
+
+    if (!self->deflate.enabled || !self->extensions) {
+        self->deflate.enabled = 0;
+        return;
+    }
+
+    pos = self->extensions;
+    end = pos + self->extensions_len;
+    while (pos < end) {
+        if (!nn_ws_handshake_parse_deflate (&pos, end, &params))
+            continue;
+
+        /*  The window can't be made as small as the client may ask for. */
+        if (params.server_max_window_bits > 0 &&
+              params.server_max_window_bits < NN_WS_DEFLATE_MIN_WINDOW_BITS)
+            continue;
+
+        if (params.server_max_window_bits > 0 &&
+              params.server_max_window_bits < self->deflate.window_bits)
+            self->deflate.window_bits = params.server_max_window_bits;
+        if (params.server_no_context_takeover)
+            self->deflate.no_context_takeover = 1;
+
+        /*  Client's window size doesn't matter to us, so there's no need
+            to limit it. */
+        window [0] = '\0';
+        if (params.server_max_window_bits > 0)
+            sprintf (window, "; server_max_window_bits=%d",
+                self->deflate.window_bits);
+        sprintf (self->bufs->deflate_hdr,
+            "Sec-WebSocket-Extensions: permessage-deflate%s%s%s\r\n",
+            self->deflate.no_context_takeover ?
+            "; server_no_context_takeover" : "",
+            window,
+            params.client_no_context_takeover ?
+            "; client_no_context_takeover" : "");
+        return;
+    }
+
+    /*  None of the offers is acceptable. */
+    self->deflate.enabled = 0;
+}
+
+static int nn_ws_handshake_client_deflate (struct nn_ws_handshake *self)
+{
+    const char *pos;
+    const char *end;
+    struct nn_ws_deflate_params params;
+
+    if (!self->extensions) {
+        self->deflate.enabled = 0;
+        return 0;
+    }
+
+    /*  permessage-deflate is the only extension ever offered. */
+    if (!self->deflate.enabled)
+        return -1;
+
+    pos = self->extensions;
+    end = pos + self->extensions_len;
+    if (!nn_ws_handshake_parse_deflate (&pos, end, &params) || pos != end)
+        return -1;
+
+    /*  RFC 7692 section 7.1.2.2: the response must specify the window size
+        the client is expected to use. */
+    if (params.client_max_window_bits == 0)
+        return -1;
+    if (params.client_max_window_bits > 0) {
+        if (params.client_max_window_bits < NN_WS_DEFLATE_MIN_WINDOW_BITS)
+            return -1;
+        if (params.client_max_window_bits < self->deflate.window_bits)
+            self->deflate.window_bits = params.client_max_window_bits;
+    }
+    if (params.client_no_context_takeover)
+        self->deflate.no_context_takeover = 1;
+
+    return 0;
+}
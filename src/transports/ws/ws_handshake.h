@@ -31,6 +31,8 @@
 #include "../../aio/usock.h"
 #include "../../aio/timer.h"
 
+#include "ws_deflate.h"
+
 /*  This state machine exchanges a handshake with a WebSocket client. */
 
 /*  Return codes of this state machine. */
@@ -56,6 +58,23 @@
 /*  Expected Accept Key length based on RFC 6455 4.2.2.5.4. */
 #define NN_WS_HANDSHAKE_ACCEPT_KEY_LEN 28
 
+/*  Header field the client sends to let the server know that it recognises
+    heartbeat frames (see heartbeat.h). The server sends it back if it does
+    as well. */
+#define NN_WS_HANDSHAKE_HEARTBEAT "X-Nanomsg-Heartbeat"
+
+struct nn_ws_handshake_bufs {
+
+    /*  Sec-WebSocket-Extensions header to send to the peer, if any. */
+    char deflate_hdr [192];
+
+    /*  Opening handshake verbatim from client as per RFC 6455 1.3. */
+    char opening_hs [NN_WS_HANDSHAKE_MAX_SIZE];
+
+    /*  Response to send back to client. */
+    char response [512];
+};
+
 struct nn_ws_handshake {
 
     /*  The state machine. */
@@ -85,8 +104,18 @@ struct nn_ws_handshake {
     /*  Remote Host in header request when acting as client. */
     const char* remote_host;
 
-    /*  Opening handshake verbatim from client as per RFC 6455 1.3. */
-    char opening_hs [NN_WS_HANDSHAKE_MAX_SIZE];
+    /*  Compression requested by the user before the handshake and
+        the negotiated one after it succeeds. */
+    struct nn_ws_deflate_opts deflate;
+
+    /*  1 if the peer recognises heartbeat frames, valid once the handshake
+        succeeds. */
+    int peerheartbeat;
+
+    /*  Buffers used while the handshake is in progress. They are released
+        once it is done, so that established connections don't carry
+        them around. */
+    struct nn_ws_handshake_bufs *bufs;
 
     /*  Monitor/control the opening recv poll. */
     int retries;
@@ -141,9 +170,6 @@ struct nn_ws_handshake {
     /*  Identifies the response to be sent to client's opening handshake. */
     int response_code;
 
-    /*  Response to send back to client. */
-    char response [512];
-
     /*  Event fired when the state machine ends. */
     struct nn_fsm_event done;
 };
@@ -169,7 +195,8 @@ void nn_ws_handshake_term (struct nn_ws_handshake *self);
 int nn_ws_handshake_isidle (struct nn_ws_handshake *self);
 void nn_ws_handshake_start (struct nn_ws_handshake *self,
     struct nn_usock *usock, struct nn_pipebase *pipebase,
-    int mode, const char *resource, const char *host);
+    int mode, const char *resource, const char *host,
+    const struct nn_ws_deflate_opts *deflate);
 void nn_ws_handshake_stop (struct nn_ws_handshake *self);
 
 #endif
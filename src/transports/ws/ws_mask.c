@@ -0,0 +1,97 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "ws_mask.h"
+
+#include "../../utils/err.h"
+
+#include <string.h>
+
+/*  Vector instructions used to process the payload, if available. */
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NN_WS_MASK_SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#define NN_WS_MASK_NEON
+#endif
+
+void nn_ws_mask_payload (uint8_t *dst, const uint8_t *src,
+    size_t len, const uint8_t *mask, size_t mask_len, int *mask_start_pos)
+{
+    size_t i;
+    size_t j;
+    int pos;
+    uint8_t rmask [16];
+    uint64_t wmask;
+    uint64_t word;
+#if defined NN_WS_MASK_SSE2
+    __m128i vmask;
+#elif defined NN_WS_MASK_NEON
+    uint8x16_t vmask;
+#endif
+
+    /*  With 4-byte mask, each 8- or 16-byte block of the payload is masked
+        by the same bit pattern. */
+    nn_assert (mask_len == NN_WS_MASK_SIZE);
+
+    pos = mask_start_pos ? *mask_start_pos : 0;
+    i = 0;
+
+    if (len >= sizeof (wmask)) {
+
+        /*  Rotate the mask once so that it starts at the current position. */
+        for (j = 0; j != sizeof (rmask); ++j)
+            rmask [j] = mask [(pos + j) % NN_WS_MASK_SIZE];
+
+#if defined NN_WS_MASK_SSE2
+        vmask = _mm_loadu_si128 ((const __m128i*) rmask);
+        for (; len - i >= sizeof (vmask); i += sizeof (vmask))
+            _mm_storeu_si128 ((__m128i*) (dst + i), _mm_xor_si128 (
+                _mm_loadu_si128 ((const __m128i*) (src + i)), vmask));
+#elif defined NN_WS_MASK_NEON
+        vmask = vld1q_u8 (rmask);
+        for (; len - i >= sizeof (vmask); i += sizeof (vmask))
+            vst1q_u8 (dst + i, veorq_u8 (vld1q_u8 (src + i), vmask));
+#endif
+
+        /*  Payload is not necessarily aligned, so the words are accessed
+            via memcpy, which compilers turn into plain loads and stores. */
+        memcpy (&wmask, rmask, sizeof (wmask));
+        for (; len - i >= sizeof (wmask); i += sizeof (wmask)) {
+            memcpy (&word, src + i, sizeof (word));
+            word ^= wmask;
+            memcpy (dst + i, &word, sizeof (word));
+        }
+    }
+
+    /*  Whole blocks leave the mask position unchanged. Mask the rest of
+        the payload byte by byte. */
+    for (; i < len; i++) {
+        dst [i] = src [i] ^ mask [pos];
+        pos = (pos + 1) % NN_WS_MASK_SIZE;
+    }
+
+    if (mask_start_pos)
+        *mask_start_pos = pos;
+}
@@ -0,0 +1,40 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_WS_MASK_INCLUDED
+#define NN_WS_MASK_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Size of the masking key of a WebSocket frame, as per RFC 6455. */
+#define NN_WS_MASK_SIZE 4
+
+/*  Mask or unmask message payload. The result is stored to 'dst', which may
+    be the same buffer as 'src'. If 'mask_start_pos' is not NULL, masking
+    starts at that position of the key and the position following the last
+    byte processed is stored back to it, so that a payload can be masked
+    piece by piece. */
+void nn_ws_mask_payload (uint8_t *dst, const uint8_t *src,
+    size_t len, const uint8_t *mask, size_t mask_len, int *mask_start_pos);
+
+#endif
@@ -21,71 +21,447 @@
 */
 
 #include "alloc.h"
-
-#if defined NN_ALLOC_MONITOR
-
+#include "hugearena.h"
+#include "attr.h"
+#include "err.h"
 #include "mutex.h"
+#include "once.h"
 
 #include <stdlib.h>
 #include <stddef.h>
-#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined NN_ALLOC_MONITOR
+#include <stdio.h>
+#endif
 
+struct nn_alloc_acct {
+    struct nn_mutex sync;
+
+    /*  Bytes currently charged to the account. */
+    size_t bytes;
+
+    /*  Number of blocks charged to the account, plus one while the owner
+        holds it. */
+    size_t refs;
+};
+
+/*  Every block is preceded by this header. The class of the block is kept
+    in the low bits of the account pointer so that the header stays two
+    words long and the blocks stay aligned the way malloc aligns them. */
 struct nn_alloc_hdr {
     size_t size;
+    uintptr_t tag;
+#if defined NN_ALLOC_MONITOR
     const char *name;
+#endif
+};
+
+/*  Blocks picked by the allocation monitor are additionally preceded by
+    the ID of their allocation site, padded so that the alignment of the
+    block doesn't change. The pickedness is kept in the tag as well. */
+struct nn_alloc_sampled {
+    size_t site;
+    size_t reserved;
+};
+
+#define NN_ALLOC_CLSMASK ((uintptr_t) 3)
+#define NN_ALLOC_SAMPLED ((uintptr_t) 4)
+#define NN_ALLOC_TAGMASK ((uintptr_t) 7)
+CT_ASSERT (NN_ALLOC_CLASSES <= NN_ALLOC_CLSMASK + 1);
+
+#define nn_alloc_hdr_acct(hdr) \
+    ((struct nn_alloc_acct*) ((hdr)->tag & ~NN_ALLOC_TAGMASK))
+#define nn_alloc_hdr_cls(hdr) ((int) ((hdr)->tag & NN_ALLOC_CLSMASK))
+#define nn_alloc_hdr_sampled(hdr) ((hdr)->tag & NN_ALLOC_SAMPLED)
+#define nn_alloc_hdr_prefix(hdr) \
+    (nn_alloc_hdr_sampled (hdr) ? sizeof (struct nn_alloc_sampled) : 0)
+#define nn_alloc_hdr_base(hdr) ((char*) (hdr) - nn_alloc_hdr_prefix (hdr))
+
+/*  The account selected in this thread. */
+static NN_THREAD_LOCAL struct nn_alloc_acct *nn_alloc_current;
+
+/*  Default allocator, backed by the C library. */
+static void *nn_alloc_malloc (size_t size, NN_UNUSED void *arg)
+{
+    return malloc (size);
+}
+
+static void *nn_alloc_realloc (void *ptr, size_t size, NN_UNUSED void *arg)
+{
+    return realloc (ptr, size);
+}
+
+static void nn_alloc_free (void *ptr, NN_UNUSED void *arg)
+{
+    free (ptr);
+}
+
+#define NN_ALLOC_DEFAULT \
+    {nn_alloc_malloc, nn_alloc_realloc, nn_alloc_free, NULL}
+
+/*  Allocators of the individual classes. A class can't change its allocator
+    once anything was allocated from it, so the table is read without
+    locking. */
+static struct nn_allocator nn_alloc_classes [NN_ALLOC_CLASSES] = {
+    NN_ALLOC_DEFAULT, NN_ALLOC_DEFAULT, NN_ALLOC_DEFAULT, NN_ALLOC_DEFAULT
+};
+static int nn_alloc_used [NN_ALLOC_CLASSES];
+
+/*  Most allocation sites the allocation monitor distinguishes. Allocations
+    from the sites beyond the limit are accounted for together under the
+    last one. */
+#define NN_ALLOC_MAXSITES 128
+
+/*  Size of the per-thread cache mapping the allocation site names to their
+    IDs. Must be a power of two. */
+#define NN_ALLOC_SITECACHE 64
+
+/*  Per-thread counters of the allocation monitor. Only the owning thread
+    writes into them. Frees are counted by the thread that frees the block,
+    so only the sums over all the threads are meaningful. The structures
+    are never deallocated, as their counters are needed for as long as the
+    blocks they account for exist. */
+struct nn_alloc_thread {
+    struct nn_alloc_thread *next;
+
+    /*  Number of allocations to skip before picking the next one. */
+    int countdown;
+
+    const char *cachenames [NN_ALLOC_SITECACHE];
+    int cachesites [NN_ALLOC_SITECACHE];
+
+    struct {
+        uint64_t allocs;
+        uint64_t allocated;
+        uint64_t freed;
+    } sites [NN_ALLOC_MAXSITES];
 };
 
+/*  One in how many allocations the monitor picks, 0 if it's switched off. */
+static int nn_alloc_sample;
+
+/*  The threads' counters and the names of the allocation sites are
+    registered under this lock. */
+static nn_once_t nn_alloc_once = NN_ONCE_INITIALIZER;
+static struct nn_mutex nn_alloc_sitesync;
+static const char *nn_alloc_sites [NN_ALLOC_MAXSITES];
+static int nn_alloc_nsites;
+static struct nn_alloc_thread *nn_alloc_threads;
+
+static NN_THREAD_LOCAL struct nn_alloc_thread *nn_alloc_thread;
+
+#if defined NN_ALLOC_MONITOR
 static struct nn_mutex nn_alloc_sync;
 static size_t nn_alloc_bytes;
 static size_t nn_alloc_blocks;
+#endif
+
+static void nn_alloc_charge (struct nn_alloc_hdr *hdr)
+{
+    struct nn_alloc_acct *acct;
+
+    acct = nn_alloc_current;
+    hdr->tag = (uintptr_t) acct | (hdr->tag & NN_ALLOC_TAGMASK);
+    if (!acct)
+        return;
+    nn_mutex_lock (&acct->sync);
+    acct->bytes += hdr->size;
+    ++acct->refs;
+    nn_mutex_unlock (&acct->sync);
+}
+
+/*  Drops a reference to the account, along with 'size' bytes charged to it,
+    and disposes of the account once no references are left. */
+static void nn_alloc_unref (struct nn_alloc_acct *acct, size_t size)
+{
+    size_t refs;
+
+    nn_mutex_lock (&acct->sync);
+    acct->bytes -= size;
+    refs = --acct->refs;
+    nn_mutex_unlock (&acct->sync);
+    if (!refs) {
+        nn_mutex_term (&acct->sync);
+        free (acct);
+    }
+}
+
+static void nn_alloc_setup (void)
+{
+    char *envvar;
+    int cls;
+
+    /*  The lock outlives the library, as do the blocks it tracks. */
+    nn_mutex_init (&nn_alloc_sitesync);
+    nn_alloc_sites [NN_ALLOC_MAXSITES - 1] = "other";
+    envvar = getenv ("NN_ALLOC_SAMPLE");
+    if (envvar && atoi (envvar) > 0)
+        nn_alloc_sample = atoi (envvar);
+
+    /*  Serve the classes the message paths churn through, i.e. all but
+        NN_ALLOC_OBJECT, from huge page arenas, if requested. The classes
+        the user has set an allocator for, or that are in use already, are
+        left alone. */
+    envvar = getenv ("NN_HUGEPAGES");
+    if (envvar && atoi (envvar) > 0 &&
+          nn_hugearena_init (atoi (envvar)) == 0) {
+        for (cls = NN_ALLOC_MSG; cls != NN_ALLOC_CLASSES; ++cls) {
+            if (nn_alloc_used [cls] ||
+                  nn_alloc_classes [cls].alloc != nn_alloc_malloc)
+                continue;
+            nn_alloc_classes [cls].alloc = nn_hugearena_alloc;
+            nn_alloc_classes [cls].realloc = nn_hugearena_realloc;
+            nn_alloc_classes [cls].free = nn_hugearena_free;
+            nn_alloc_classes [cls].arg = NULL;
+        }
+    }
+}
+
+/*  Returns the monitor's counters of the calling thread, NULL if there's
+    not enough memory to create them. */
+static struct nn_alloc_thread *nn_alloc_thread_get (void)
+{
+    struct nn_alloc_thread *self;
+
+    if (nn_fast (nn_alloc_thread != NULL))
+        return nn_alloc_thread;
+    self = malloc (sizeof (struct nn_alloc_thread));
+    if (!self)
+        return NULL;
+    memset (self, 0, sizeof (struct nn_alloc_thread));
+    self->countdown = nn_alloc_sample;
+    nn_mutex_lock (&nn_alloc_sitesync);
+    self->next = nn_alloc_threads;
+    nn_alloc_threads = self;
+    nn_mutex_unlock (&nn_alloc_sitesync);
+    nn_alloc_thread = self;
+    return self;
+}
+
+/*  Maps the site name to its ID. Names are compared by contents, as string
+    literals in different compilation units need not be merged. */
+static int nn_alloc_site (struct nn_alloc_thread *self, const char *name)
+{
+    int slot;
+    int site;
+
+    slot = (int) (((uintptr_t) name >> 3) & (NN_ALLOC_SITECACHE - 1));
+    if (nn_fast (self->cachenames [slot] == name))
+        return self->cachesites [slot];
+
+    nn_mutex_lock (&nn_alloc_sitesync);
+    for (site = 0; site != nn_alloc_nsites; ++site)
+        if (strcmp (nn_alloc_sites [site], name) == 0)
+            break;
+    if (site == nn_alloc_nsites) {
+        if (nn_alloc_nsites < NN_ALLOC_MAXSITES - 1)
+            nn_alloc_sites [nn_alloc_nsites++] = name;
+        else
+            site = NN_ALLOC_MAXSITES - 1;
+    }
+    nn_mutex_unlock (&nn_alloc_sitesync);
+
+    self->cachenames [slot] = name;
+    self->cachesites [slot] = site;
+    return site;
+}
+
+/*  Decides whether the allocation is to be tracked. Returns the ID of its
+    site if so, -1 otherwise. */
+static int nn_alloc_pick (const char *name)
+{
+    struct nn_alloc_thread *self;
+
+    self = nn_alloc_thread_get ();
+    if (nn_slow (!self))
+        return -1;
+    if (--self->countdown > 0)
+        return -1;
+    self->countdown = nn_alloc_sample;
+    return nn_alloc_site (self, name);
+}
+
+/*  Accounts for a tracked block changing its size from 'oldsize' to
+    'newsize', an allocation if 'oldsize' is -1 and a free if 'newsize'
+    is -1. */
+static void nn_alloc_count (struct nn_alloc_hdr *hdr, size_t oldsize,
+    size_t newsize)
+{
+    struct nn_alloc_thread *self;
+    size_t site;
+
+    self = nn_alloc_thread_get ();
+    if (nn_slow (!self))
+        return;
+    site = ((struct nn_alloc_sampled*) nn_alloc_hdr_base (hdr))->site;
+    if (oldsize == (size_t) -1)
+        ++self->sites [site].allocs;
+    else
+        self->sites [site].freed += oldsize;
+    if (newsize != (size_t) -1)
+        self->sites [site].allocated += newsize;
+}
+
+int nn_alloc_stats (struct nn_alloc_stat *stats, int max)
+{
+    int site;
+    int nstats;
+    uint64_t allocated;
+    uint64_t freed;
+    struct nn_alloc_thread *it;
+
+    if (!nn_alloc_sample)
+        return 0;
+
+    nn_mutex_lock (&nn_alloc_sitesync);
+    nstats = 0;
+    for (site = 0; site != NN_ALLOC_MAXSITES && nstats != max; ++site) {
+        if (!nn_alloc_sites [site])
+            continue;
+        allocated = 0;
+        freed = 0;
+        stats [nstats].allocations = 0;
+        for (it = nn_alloc_threads; it; it = it->next) {
+            stats [nstats].allocations += it->sites [site].allocs;
+            allocated += it->sites [site].allocated;
+            freed += it->sites [site].freed;
+        }
+        if (!stats [nstats].allocations)
+            continue;
+        stats [nstats].name = nn_alloc_sites [site];
+        stats [nstats].allocations *= nn_alloc_sample;
+        stats [nstats].live_bytes =
+            allocated > freed ? (allocated - freed) * nn_alloc_sample : 0;
+        ++nstats;
+    }
+    nn_mutex_unlock (&nn_alloc_sitesync);
+    return nstats;
+}
 
 void nn_alloc_init (void)
 {
+    nn_do_once (&nn_alloc_once, nn_alloc_setup);
+#if defined NN_ALLOC_MONITOR
     nn_mutex_init (&nn_alloc_sync);
     nn_alloc_bytes = 0;
     nn_alloc_blocks = 0;
+#endif
 }
 
 void nn_alloc_term (void)
 {
+#if defined NN_ALLOC_MONITOR
     nn_mutex_term (&nn_alloc_sync);
+#endif
+}
+
+int nn_alloc_setclass (int cls, const struct nn_allocator *allocator)
+{
+    static const struct nn_allocator dflt = NN_ALLOC_DEFAULT;
+
+    if (nn_slow (cls < 0 || cls >= NN_ALLOC_CLASSES))
+        return -EINVAL;
+    if (nn_slow (allocator && (!allocator->alloc || !allocator->free)))
+        return -EINVAL;
+    if (nn_slow (nn_alloc_used [cls]))
+        return -EBUSY;
+    nn_alloc_classes [cls] = allocator ? *allocator : dflt;
+    return 0;
 }
 
-void *nn_alloc_ (size_t size, const char *name)
+void *nn_alloc_ (size_t size, int cls, const char *name)
 {
-    uint8_t *chunk;
+    struct nn_alloc_hdr *chunk;
+    struct nn_allocator *allocator;
+    int site;
+    size_t prefix;
+    char *base;
 
-    chunk = malloc (sizeof (struct nn_alloc_hdr) + size);
-    if (!chunk)
+    nn_assert (cls >= 0 && cls < NN_ALLOC_CLASSES);
+    if (nn_slow (!nn_alloc_used [cls]))
+        nn_alloc_used [cls] = 1;
+    site = nn_slow (nn_alloc_sample) ? nn_alloc_pick (name) : -1;
+    prefix = site >= 0 ? sizeof (struct nn_alloc_sampled) : 0;
+    allocator = &nn_alloc_classes [cls];
+    base = allocator->alloc (prefix + sizeof (struct nn_alloc_hdr) + size,
+        allocator->arg);
+    if (!base)
         return NULL;
+    chunk = (struct nn_alloc_hdr*) (base + prefix);
+    chunk->size = size;
+    chunk->tag = (uintptr_t) cls;
+    if (site >= 0) {
+        ((struct nn_alloc_sampled*) base)->site = (size_t) site;
+        chunk->tag |= NN_ALLOC_SAMPLED;
+        nn_alloc_count (chunk, (size_t) -1, size);
+    }
+    nn_alloc_charge (chunk);
 
+#if defined NN_ALLOC_MONITOR
     nn_mutex_lock (&nn_alloc_sync);
-    ((struct nn_alloc_hdr*) chunk)->size = size;
-    ((struct nn_alloc_hdr*) chunk)->name = name;
+    chunk->name = name;
     nn_alloc_bytes += size;
     ++nn_alloc_blocks;
     printf ("Allocating %s (%zu bytes)\n", name, size);
     printf ("Current memory usage: %zu bytes in %zu blocks\n",
         nn_alloc_bytes, nn_alloc_blocks);
     nn_mutex_unlock (&nn_alloc_sync);
+#endif
 
-    return chunk + sizeof (struct nn_alloc_hdr);
+    return chunk + 1;
 }
 
 void *nn_realloc (void *ptr, size_t size)
 {
     struct nn_alloc_hdr *oldchunk;
     struct nn_alloc_hdr *newchunk;
+    struct nn_allocator *allocator;
+    struct nn_alloc_acct *acct;
     size_t oldsize;
+    size_t prefix;
+    char *base;
+
+    if (!ptr)
+        return nn_alloc (size, "reallocated block");
 
     oldchunk = ((struct nn_alloc_hdr*) ptr) - 1;
     oldsize = oldchunk->size;
-    newchunk = realloc (oldchunk, sizeof (struct nn_alloc_hdr) + size);
-    if (!newchunk)
-        return NULL;
+    prefix = nn_alloc_hdr_prefix (oldchunk);
+    allocator = &nn_alloc_classes [nn_alloc_hdr_cls (oldchunk)];
+    if (allocator->realloc) {
+        base = allocator->realloc (nn_alloc_hdr_base (oldchunk),
+            prefix + sizeof (struct nn_alloc_hdr) + size, allocator->arg);
+        if (!base)
+            return NULL;
+    }
+    else {
+
+        /*  The allocator can't resize blocks. Move the block instead. */
+        base = allocator->alloc (prefix + sizeof (struct nn_alloc_hdr) + size,
+            allocator->arg);
+        if (!base)
+            return NULL;
+        memcpy (base, nn_alloc_hdr_base (oldchunk), prefix +
+            sizeof (struct nn_alloc_hdr) + (oldsize < size ? oldsize : size));
+        allocator->free (nn_alloc_hdr_base (oldchunk), allocator->arg);
+    }
+    newchunk = (struct nn_alloc_hdr*) (base + prefix);
     newchunk->size = size;
+    if (nn_alloc_hdr_sampled (newchunk))
+        nn_alloc_count (newchunk, oldsize, size);
 
+    /*  The block stays charged to the account it was allocated from. */
+    acct = nn_alloc_hdr_acct (newchunk);
+    if (acct) {
+        nn_mutex_lock (&acct->sync);
+        acct->bytes -= oldsize;
+        acct->bytes += size;
+        nn_mutex_unlock (&acct->sync);
+    }
+
+#if defined NN_ALLOC_MONITOR
     nn_mutex_lock (&nn_alloc_sync);
     nn_alloc_bytes -= oldsize;
     nn_alloc_bytes += size;
@@ -94,18 +470,21 @@ void *nn_realloc (void *ptr, size_t size)
     printf ("Current memory usage: %zu bytes in %zu blocks\n",
         nn_alloc_bytes, nn_alloc_blocks);
     nn_mutex_unlock (&nn_alloc_sync);
+#endif
 
-    return newchunk + sizeof (struct nn_alloc_hdr);
+    return newchunk + 1;
 }
 
 void nn_free (void *ptr)
 {
     struct nn_alloc_hdr *chunk;
-    
+    struct nn_allocator *allocator;
+
     if (!ptr)
         return;
     chunk = ((struct nn_alloc_hdr*) ptr) - 1;
 
+#if defined NN_ALLOC_MONITOR
     nn_mutex_lock (&nn_alloc_sync);
     nn_alloc_bytes -= chunk->size;
     --nn_alloc_blocks;
@@ -113,36 +492,62 @@ void nn_free (void *ptr)
     printf ("Current memory usage: %zu bytes in %zu blocks\n",
         nn_alloc_bytes, nn_alloc_blocks);
     nn_mutex_unlock (&nn_alloc_sync);
+#endif
 
-    free (chunk);
+    allocator = &nn_alloc_classes [nn_alloc_hdr_cls (chunk)];
+    if (nn_alloc_hdr_acct (chunk))
+        nn_alloc_unref (nn_alloc_hdr_acct (chunk), chunk->size);
+    if (nn_alloc_hdr_sampled (chunk))
+        nn_alloc_count (chunk, chunk->size, (size_t) -1);
+    allocator->free (nn_alloc_hdr_base (chunk), allocator->arg);
 }
 
-#else
-
-#include <stdlib.h>
-
-void nn_alloc_init (void)
+struct nn_alloc_acct *nn_alloc_acct_create (void)
 {
-}
+    struct nn_alloc_acct *self;
 
-void nn_alloc_term (void)
-{
+    self = malloc (sizeof (struct nn_alloc_acct));
+    if (!self)
+        return NULL;
+    nn_assert (((uintptr_t) self & NN_ALLOC_TAGMASK) == 0);
+    nn_mutex_init (&self->sync);
+    self->bytes = 0;
+    self->refs = 1;
+    return self;
 }
 
-void *nn_alloc_ (size_t size)
+void nn_alloc_acct_release (struct nn_alloc_acct *acct)
 {
-    return malloc (size);
+    nn_alloc_unref (acct, 0);
 }
 
-void *nn_realloc (void *ptr, size_t size)
+size_t nn_alloc_acct_bytes (struct nn_alloc_acct *acct)
 {
-    return realloc (ptr, size);
+    size_t bytes;
+
+    nn_mutex_lock (&acct->sync);
+    bytes = acct->bytes;
+    nn_mutex_unlock (&acct->sync);
+    return bytes;
 }
 
-void nn_free (void *ptr)
+void nn_alloc_recharge (void *ptr)
 {
-    free (ptr);
+    struct nn_alloc_hdr *chunk;
+
+    chunk = ((struct nn_alloc_hdr*) ptr) - 1;
+    if (nn_alloc_hdr_acct (chunk) == nn_alloc_current)
+        return;
+    if (nn_alloc_hdr_acct (chunk))
+        nn_alloc_unref (nn_alloc_hdr_acct (chunk), chunk->size);
+    nn_alloc_charge (chunk);
 }
 
-#endif
+struct nn_alloc_acct *nn_alloc_acct_select (struct nn_alloc_acct *acct)
+{
+    struct nn_alloc_acct *prev;
 
+    prev = nn_alloc_current;
+    nn_alloc_current = acct;
+    return prev;
+}
@@ -23,23 +23,80 @@
 #ifndef NN_ALLOC_INCLUDED
 #define NN_ALLOC_INCLUDED
 
+#include "../nn.h"
+
 #include <stddef.h>
+#include <stdint.h>
 
 /*  These functions allow for interception of memory allocation-related
-    functionality. */
+    functionality. Memory is allocated from one of the NN_ALLOC_* classes
+    defined in nn.h, each of which can be served by an allocator supplied
+    by the user. nn_alloc allocates from NN_ALLOC_OBJECT class. A block
+    remembers its class, so nn_realloc and nn_free need not be told. */
 
 void nn_alloc_init (void);
 void nn_alloc_term (void);
 void *nn_realloc (void *ptr, size_t size);
 void nn_free (void *ptr);
 
-#if defined NN_ALLOC_MONITOR
-#define nn_alloc(size, name) nn_alloc_ (size, name)
-void *nn_alloc_ (size_t size, const char *name);
-#else
-#define nn_alloc(size, name) nn_alloc_(size)
-void *nn_alloc_ (size_t size);
-#endif
+/*  The name describes what the block is used for. It identifies the
+    allocation site to the allocation monitor below and is expected to be
+    a string literal. */
+#define nn_alloc(size, name) nn_alloc_ (size, NN_ALLOC_OBJECT, name)
+#define nn_alloc_class(size, cls, name) nn_alloc_ (size, cls, name)
+void *nn_alloc_ (size_t size, int cls, const char *name);
+
+/*  Number of allocation classes. */
+#define NN_ALLOC_CLASSES 4
+
+/*  Replaces the allocator of a class, NULL restoring the default one.
+    Returns -EBUSY if memory of the class was already allocated. */
+int nn_alloc_setclass (int cls, const struct nn_allocator *allocator);
+
+/*  Memory accounting. While an account is selected in a thread, the memory
+    allocated by the thread is charged to the account until it is freed,
+    whichever thread frees it. */
+struct nn_alloc_acct;
+
+/*  Creates an account. Returns NULL if out of memory. */
+struct nn_alloc_acct *nn_alloc_acct_create (void);
+
+/*  Gives up the account. It is disposed of once all the memory charged to
+    it is freed. */
+void nn_alloc_acct_release (struct nn_alloc_acct *acct);
+
+/*  Returns the number of bytes currently charged to the account. */
+size_t nn_alloc_acct_bytes (struct nn_alloc_acct *acct);
+
+/*  Selects the account to charge in the calling thread, NULL to stop
+    charging. Returns the previously selected account. */
+struct nn_alloc_acct *nn_alloc_acct_select (struct nn_alloc_acct *acct);
+
+/*  Moves a block to the account currently selected in the calling thread.
+    Used when a cached block is handed over to another owner. */
+void nn_alloc_recharge (void *ptr);
+
+/*  Allocation monitor. If NN_ALLOC_SAMPLE environment variable is set to N,
+    one in N allocations made by each thread is tracked, along with its
+    eventual deallocation, in per-thread counters kept for each allocation
+    site. The untracked allocations cost a single branch. */
+struct nn_alloc_stat {
+    const char *name;
+
+    /*  Estimated number of bytes allocated from the site and not yet
+        freed. */
+    uint64_t live_bytes;
+
+    /*  Estimated number of allocations made from the site so far. */
+    uint64_t allocations;
+};
+
+/*  Fills in up to 'max' statistics, one per allocation site seen so far,
+    with the sampled counters scaled by the sampling rate. Returns the
+    number of statistics filled in, 0 if the monitor is switched off. The
+    counters are read without synchronising with the threads updating
+    them, so the figures are approximate. */
+int nn_alloc_stats (struct nn_alloc_stat *stats, int max);
 
 #endif
 
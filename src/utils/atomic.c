@@ -23,9 +23,89 @@
 #include "atomic.h"
 #include "err.h"
 
+/*  The C11 and GCC backends are type-generic, so they are expressed as
+    macros shared by all the object types. */
+
+#if defined NN_ATOMIC_C11
+
+#define NN_ATOMIC_LOAD(v) atomic_load_explicit (&(v), memory_order_acquire)
+#define NN_ATOMIC_LOAD_RELAXED(v) \
+    atomic_load_explicit (&(v), memory_order_relaxed)
+#define NN_ATOMIC_STORE(v, n) \
+    atomic_store_explicit (&(v), (n), memory_order_release)
+#define NN_ATOMIC_INC(v, n) atomic_fetch_add (&(v), (n))
+#define NN_ATOMIC_DEC(v, n) atomic_fetch_sub (&(v), (n))
+#define NN_ATOMIC_SWAP(v, n) atomic_exchange (&(v), (n))
+#define NN_ATOMIC_CAS(v, oldval, newval) \
+    (atomic_compare_exchange_strong (&(v), &(oldval), (newval)), (oldval))
+
+#elif defined NN_ATOMIC_GCC_BUILTINS && defined __ATOMIC_ACQUIRE
+
+#define NN_ATOMIC_LOAD(v) __atomic_load_n (&(v), __ATOMIC_ACQUIRE)
+#define NN_ATOMIC_LOAD_RELAXED(v) __atomic_load_n (&(v), __ATOMIC_RELAXED)
+#define NN_ATOMIC_STORE(v, n) __atomic_store_n (&(v), (n), __ATOMIC_RELEASE)
+#define NN_ATOMIC_INC(v, n) __atomic_fetch_add (&(v), (n), __ATOMIC_SEQ_CST)
+#define NN_ATOMIC_DEC(v, n) __atomic_fetch_sub (&(v), (n), __ATOMIC_SEQ_CST)
+#define NN_ATOMIC_SWAP(v, n) __atomic_exchange_n (&(v), (n), __ATOMIC_SEQ_CST)
+#define NN_ATOMIC_CAS(v, oldval, newval) \
+    (__atomic_compare_exchange_n (&(v), &(oldval), (newval), 0, \
+    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST), (oldval))
+
+#elif defined NN_ATOMIC_GCC_BUILTINS
+
+/*  Legacy __sync builtins. They are full barriers, so loads and stores
+    are fenced manually. */
+#define NN_ATOMIC_LOAD(v) nn_atomic_sync_load (v)
+#define nn_atomic_sync_load(v) \
+    __extension__ ({__typeof__ (v) nn_res = (v); \
+    __sync_synchronize (); nn_res;})
+#define NN_ATOMIC_LOAD_RELAXED(v) (v)
+#define NN_ATOMIC_STORE(v, n) \
+    do {__sync_synchronize (); (v) = (n);} while (0)
+#define NN_ATOMIC_INC(v, n) __sync_fetch_and_add (&(v), (n))
+#define NN_ATOMIC_DEC(v, n) __sync_fetch_and_sub (&(v), (n))
+#define NN_ATOMIC_SWAP(v, n) \
+    __extension__ ({__typeof__ (v) nn_old; \
+    do {nn_old = (v);} while (!__sync_bool_compare_and_swap (&(v), \
+    nn_old, (n))); nn_old;})
+#define NN_ATOMIC_CAS(v, oldval, newval) \
+    __sync_val_compare_and_swap (&(v), (oldval), (newval))
+
+#endif
+
+/*  The fallback guards the value by the object's mutex. */
+
+#define NN_ATOMIC_MUTEX_LOAD(self, v, res) \
+    do {nn_mutex_lock (&(self)->sync); res = (v); \
+    nn_mutex_unlock (&(self)->sync);} while (0)
+#define NN_ATOMIC_MUTEX_STORE(self, v, n) \
+    do {nn_mutex_lock (&(self)->sync); (v) = (n); \
+    nn_mutex_unlock (&(self)->sync);} while (0)
+#define NN_ATOMIC_MUTEX_ADD(self, v, n, res) \
+    do {nn_mutex_lock (&(self)->sync); res = (v); (v) = res + (n); \
+    nn_mutex_unlock (&(self)->sync);} while (0)
+#define NN_ATOMIC_MUTEX_SWAP(self, v, n, res) \
+    do {nn_mutex_lock (&(self)->sync); res = (v); (v) = (n); \
+    nn_mutex_unlock (&(self)->sync);} while (0)
+#define NN_ATOMIC_MUTEX_CAS(self, v, oldval, newval, res) \
+    do {nn_mutex_lock (&(self)->sync); res = (v); \
+    if (res == (oldval)) (v) = (newval); \
+    nn_mutex_unlock (&(self)->sync);} while (0)
+
+#if defined NN_ATOMIC_C11 || defined NN_ATOMIC_GCC_BUILTINS
+#define NN_ATOMIC_GENERIC
+#endif
+#if defined NN_ATOMIC_GENERIC && !defined NN_ATOMIC64_MUTEX
+#define NN_ATOMIC64_GENERIC
+#endif
+
 void nn_atomic_init (struct nn_atomic *self, uint32_t n)
 {
+#if defined NN_ATOMIC_C11
+    atomic_init (&self->n, n);
+#else
     self->n = n;
+#endif
 #if defined NN_ATOMIC_MUTEX
     nn_mutex_init (&self->sync);
 #endif
@@ -38,20 +118,70 @@ void nn_atomic_term (struct nn_atomic *self)
 #endif
 }
 
+uint32_t nn_atomic_load (struct nn_atomic *self)
+{
+#if defined NN_ATOMIC_GENERIC
+    return NN_ATOMIC_LOAD (self->n);
+#elif defined NN_ATOMIC_WINAPI
+    uint32_t res;
+    res = self->n;
+    MemoryBarrier ();
+    return res;
+#elif defined NN_ATOMIC_SOLARIS
+    uint32_t res;
+    res = self->n;
+    membar_consumer ();
+    return res;
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    NN_ATOMIC_MUTEX_LOAD (self, self->n, res);
+    return res;
+#else
+#error
+#endif
+}
+
+uint32_t nn_atomic_load_relaxed (struct nn_atomic *self)
+{
+#if defined NN_ATOMIC_GENERIC
+    return NN_ATOMIC_LOAD_RELAXED (self->n);
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    NN_ATOMIC_MUTEX_LOAD (self, self->n, res);
+    return res;
+#else
+    return self->n;
+#endif
+}
+
+void nn_atomic_store (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_GENERIC
+    NN_ATOMIC_STORE (self->n, n);
+#elif defined NN_ATOMIC_WINAPI
+    MemoryBarrier ();
+    self->n = n;
+#elif defined NN_ATOMIC_SOLARIS
+    membar_exit ();
+    self->n = n;
+#elif defined NN_ATOMIC_MUTEX
+    NN_ATOMIC_MUTEX_STORE (self, self->n, n);
+#else
+#error
+#endif
+}
+
 uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n)
 {
-#if defined NN_ATOMIC_WINAPI
+#if defined NN_ATOMIC_GENERIC
+    return (uint32_t) NN_ATOMIC_INC (self->n, n);
+#elif defined NN_ATOMIC_WINAPI
     return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, n);
 #elif defined NN_ATOMIC_SOLARIS
     return atomic_add_32_nv (&self->n, n) - n;
-#elif defined NN_ATOMIC_GCC_BUILTINS
-    return (uint32_t) __sync_fetch_and_add (&self->n, n);
 #elif defined NN_ATOMIC_MUTEX
     uint32_t res;
-    nn_mutex_lock (&self->sync);
-    res = self->n;
-    self->n += n;
-    nn_mutex_unlock (&self->sync);
+    NN_ATOMIC_MUTEX_ADD (self, self->n, n, res);
     return res;
 #else
 #error
@@ -60,18 +190,254 @@ uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n)
 
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n)
 {
-#if defined NN_ATOMIC_WINAPI
+#if defined NN_ATOMIC_GENERIC
+    return (uint32_t) NN_ATOMIC_DEC (self->n, n);
+#elif defined NN_ATOMIC_WINAPI
     return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, -((LONG) n));
 #elif defined NN_ATOMIC_SOLARIS
     return atomic_add_32_nv (&self->n, -((int32_t) n)) + n;
-#elif defined NN_ATOMIC_GCC_BUILTINS
-    return (uint32_t) __sync_fetch_and_sub (&self->n, n);
 #elif defined NN_ATOMIC_MUTEX
     uint32_t res;
-    nn_mutex_lock (&self->sync);
-    res = self->n;
-    self->n -= n;
-    nn_mutex_unlock (&self->sync);
+    NN_ATOMIC_MUTEX_ADD (self, self->n, -n, res);
+    return res;
+#else
+#error
+#endif
+}
+
+uint32_t nn_atomic_swap (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_GENERIC
+    return (uint32_t) NN_ATOMIC_SWAP (self->n, n);
+#elif defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedExchange ((LONG*) &self->n, (LONG) n);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_swap_32 (&self->n, n);
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    NN_ATOMIC_MUTEX_SWAP (self, self->n, n, res);
+    return res;
+#else
+#error
+#endif
+}
+
+uint32_t nn_atomic_cas (struct nn_atomic *self, uint32_t oldval,
+    uint32_t newval)
+{
+#if defined NN_ATOMIC_GENERIC
+    return (uint32_t) NN_ATOMIC_CAS (self->n, oldval, newval);
+#elif defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedCompareExchange ((LONG*) &self->n,
+        (LONG) newval, (LONG) oldval);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_cas_32 (&self->n, oldval, newval);
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    NN_ATOMIC_MUTEX_CAS (self, self->n, oldval, newval, res);
+    return res;
+#else
+#error
+#endif
+}
+
+void nn_atomic64_init (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC_C11
+    atomic_init (&self->n, n);
+#else
+    self->n = n;
+#endif
+#if defined NN_ATOMIC64_MUTEX
+    nn_mutex_init (&self->sync);
+#endif
+}
+
+void nn_atomic64_term (struct nn_atomic64 *self)
+{
+#if defined NN_ATOMIC64_MUTEX
+    nn_mutex_term (&self->sync);
+#endif
+}
+
+uint64_t nn_atomic64_load (struct nn_atomic64 *self)
+{
+#if defined NN_ATOMIC64_GENERIC
+    return NN_ATOMIC_LOAD (self->n);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    NN_ATOMIC_MUTEX_LOAD (self, self->n, res);
+    return res;
+#elif defined NN_ATOMIC_WINAPI
+    /*  Plain 64-bit reads may tear on 32-bit systems. */
+    return (uint64_t) InterlockedCompareExchange64 ((LONGLONG*) &self->n,
+        0, 0);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_or_64_nv (&self->n, 0);
+#else
+#error
+#endif
+}
+
+void nn_atomic64_store (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC64_GENERIC
+    NN_ATOMIC_STORE (self->n, n);
+#elif defined NN_ATOMIC64_MUTEX
+    NN_ATOMIC_MUTEX_STORE (self, self->n, n);
+#elif defined NN_ATOMIC_WINAPI
+    InterlockedExchange64 ((LONGLONG*) &self->n, (LONGLONG) n);
+#elif defined NN_ATOMIC_SOLARIS
+    atomic_swap_64 (&self->n, n);
+#else
+#error
+#endif
+}
+
+uint64_t nn_atomic64_inc (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC64_GENERIC
+    return (uint64_t) NN_ATOMIC_INC (self->n, n);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    NN_ATOMIC_MUTEX_ADD (self, self->n, n, res);
+    return res;
+#elif defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedExchangeAdd64 ((LONGLONG*) &self->n,
+        (LONGLONG) n);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_add_64_nv (&self->n, n) - n;
+#else
+#error
+#endif
+}
+
+uint64_t nn_atomic64_dec (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC64_GENERIC
+    return (uint64_t) NN_ATOMIC_DEC (self->n, n);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    NN_ATOMIC_MUTEX_ADD (self, self->n, -n, res);
+    return res;
+#elif defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedExchangeAdd64 ((LONGLONG*) &self->n,
+        -((LONGLONG) n));
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_add_64_nv (&self->n, -((int64_t) n)) + n;
+#else
+#error
+#endif
+}
+
+uint64_t nn_atomic64_cas (struct nn_atomic64 *self, uint64_t oldval,
+    uint64_t newval)
+{
+#if defined NN_ATOMIC64_GENERIC
+    return (uint64_t) NN_ATOMIC_CAS (self->n, oldval, newval);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    NN_ATOMIC_MUTEX_CAS (self, self->n, oldval, newval, res);
+    return res;
+#elif defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedCompareExchange64 ((LONGLONG*) &self->n,
+        (LONGLONG) newval, (LONGLONG) oldval);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_cas_64 (&self->n, oldval, newval);
+#else
+#error
+#endif
+}
+
+void nn_atomic_ptr_init (struct nn_atomic_ptr *self, void *p)
+{
+#if defined NN_ATOMIC_C11
+    atomic_init (&self->p, p);
+#else
+    self->p = p;
+#endif
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_init (&self->sync);
+#endif
+}
+
+void nn_atomic_ptr_term (struct nn_atomic_ptr *self)
+{
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_term (&self->sync);
+#endif
+}
+
+void *nn_atomic_ptr_load (struct nn_atomic_ptr *self)
+{
+#if defined NN_ATOMIC_GENERIC
+    return NN_ATOMIC_LOAD (self->p);
+#elif defined NN_ATOMIC_WINAPI
+    void *res;
+    res = self->p;
+    MemoryBarrier ();
+    return res;
+#elif defined NN_ATOMIC_SOLARIS
+    void *res;
+    res = self->p;
+    membar_consumer ();
+    return res;
+#elif defined NN_ATOMIC_MUTEX
+    void *res;
+    NN_ATOMIC_MUTEX_LOAD (self, self->p, res);
+    return res;
+#else
+#error
+#endif
+}
+
+void nn_atomic_ptr_store (struct nn_atomic_ptr *self, void *p)
+{
+#if defined NN_ATOMIC_GENERIC
+    NN_ATOMIC_STORE (self->p, p);
+#elif defined NN_ATOMIC_WINAPI
+    MemoryBarrier ();
+    self->p = p;
+#elif defined NN_ATOMIC_SOLARIS
+    membar_exit ();
+    self->p = p;
+#elif defined NN_ATOMIC_MUTEX
+    NN_ATOMIC_MUTEX_STORE (self, self->p, p);
+#else
+#error
+#endif
+}
+
+void *nn_atomic_ptr_swap (struct nn_atomic_ptr *self, void *p)
+{
+#if defined NN_ATOMIC_GENERIC
+    return NN_ATOMIC_SWAP (self->p, p);
+#elif defined NN_ATOMIC_WINAPI
+    return InterlockedExchangePointer ((PVOID volatile*) &self->p, p);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_swap_ptr (&self->p, p);
+#elif defined NN_ATOMIC_MUTEX
+    void *res;
+    NN_ATOMIC_MUTEX_SWAP (self, self->p, p, res);
+    return res;
+#else
+#error
+#endif
+}
+
+void *nn_atomic_ptr_cas (struct nn_atomic_ptr *self, void *oldval,
+    void *newval)
+{
+#if defined NN_ATOMIC_GENERIC
+    return NN_ATOMIC_CAS (self->p, oldval, newval);
+#elif defined NN_ATOMIC_WINAPI
+    return InterlockedCompareExchangePointer ((PVOID volatile*) &self->p,
+        newval, oldval);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_cas_ptr (&self->p, oldval, newval);
+#elif defined NN_ATOMIC_MUTEX
+    void *res;
+    NN_ATOMIC_MUTEX_CAS (self, self->p, oldval, newval, res);
     return res;
 #else
 #error
@@ -23,7 +23,10 @@
 #ifndef NN_ATOMIC_INCLUDED
 #define NN_ATOMIC_INCLUDED
 
-#if defined NN_HAVE_WINDOWS
+#if defined NN_HAVE_STDATOMIC
+#include <stdatomic.h>
+#define NN_ATOMIC_C11
+#elif defined NN_HAVE_WINDOWS
 #include "win.h"
 #define NN_ATOMIC_WINAPI
 #elif NN_HAVE_ATOMIC_SOLARIS
@@ -32,17 +35,42 @@
 #elif defined NN_HAVE_GCC_ATOMIC_BUILTINS
 #define NN_ATOMIC_GCC_BUILTINS
 #else
-#include "mutex.h"
 #define NN_ATOMIC_MUTEX
 #endif
 
+/*  Some 32-bit platforms have word-sized atomics only. 64-bit objects fall
+    back to a mutex there. */
+#if defined NN_ATOMIC_MUTEX || (defined NN_ATOMIC_GCC_BUILTINS && \
+    !defined NN_HAVE_GCC_ATOMIC_BUILTINS_64)
+#define NN_ATOMIC64_MUTEX
+#endif
+
+#if defined NN_ATOMIC_MUTEX || defined NN_ATOMIC64_MUTEX
+#include "mutex.h"
+#endif
+
 #include <stdint.h>
 
+#if defined NN_ATOMIC_C11
+#define NN_ATOMIC_VAR(type) _Atomic type
+#else
+#define NN_ATOMIC_VAR(type) volatile type
+#endif
+
+/*  Unless stated otherwise, the read-modify-write operations below are full
+    memory barriers, loads have acquire semantics (memory accesses that
+    follow in program order are not performed before the value is read) and
+    stores have release semantics (memory accesses that precede the store in
+    program order are performed before the value is written). Values of the
+    objects must only be accessed via these functions. */
+
+/*  32-bit unsigned integer. */
+
 struct nn_atomic {
 #if defined NN_ATOMIC_MUTEX
     struct nn_mutex sync;
 #endif
-    volatile uint32_t n;
+    NN_ATOMIC_VAR(uint32_t) n;
 };
 
 /*  Initialise the object. Set it to value 'n'. */
@@ -51,11 +79,70 @@ void nn_atomic_init (struct nn_atomic *self, uint32_t n);
 /*  Destroy the object. */
 void nn_atomic_term (struct nn_atomic *self);
 
+/*  Return the value of the object. */
+uint32_t nn_atomic_load (struct nn_atomic *self);
+
+/*  Return the value of the object without ordering any other memory
+    accesses. Meant for the values only modified by the calling thread
+    and for statistics. */
+uint32_t nn_atomic_load_relaxed (struct nn_atomic *self);
+
+/*  Set the value of the object to 'n'. */
+void nn_atomic_store (struct nn_atomic *self, uint32_t n);
+
 /*  Atomically add n to the object, return old value of the object. */
 uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n);
 
 /*  Atomically subtract n from the object, return old value of the object. */
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n);
 
+/*  Atomically replace the value of the object by 'n', return old value of
+    the object. */
+uint32_t nn_atomic_swap (struct nn_atomic *self, uint32_t n);
+
+/*  Atomically replace the value of the object by 'newval' if its current
+    value is 'oldval'. Return old value of the object either way. */
+uint32_t nn_atomic_cas (struct nn_atomic *self, uint32_t oldval,
+    uint32_t newval);
+
+/*  64-bit unsigned integer. Same operations as above. */
+
+struct nn_atomic64 {
+#if defined NN_ATOMIC64_MUTEX
+    struct nn_mutex sync;
+#endif
+    NN_ATOMIC_VAR(uint64_t) n;
+};
+
+void nn_atomic64_init (struct nn_atomic64 *self, uint64_t n);
+void nn_atomic64_term (struct nn_atomic64 *self);
+uint64_t nn_atomic64_load (struct nn_atomic64 *self);
+void nn_atomic64_store (struct nn_atomic64 *self, uint64_t n);
+uint64_t nn_atomic64_inc (struct nn_atomic64 *self, uint64_t n);
+uint64_t nn_atomic64_dec (struct nn_atomic64 *self, uint64_t n);
+uint64_t nn_atomic64_cas (struct nn_atomic64 *self, uint64_t oldval,
+    uint64_t newval);
+
+/*  Pointer. Same operations as above. */
+
+struct nn_atomic_ptr {
+#if defined NN_ATOMIC_MUTEX
+    struct nn_mutex sync;
+#endif
+#if defined NN_ATOMIC_C11
+    void *_Atomic p;
+#else
+    void *volatile p;
+#endif
+};
+
+void nn_atomic_ptr_init (struct nn_atomic_ptr *self, void *p);
+void nn_atomic_ptr_term (struct nn_atomic_ptr *self);
+void *nn_atomic_ptr_load (struct nn_atomic_ptr *self);
+void nn_atomic_ptr_store (struct nn_atomic_ptr *self, void *p);
+void *nn_atomic_ptr_swap (struct nn_atomic_ptr *self, void *p);
+void *nn_atomic_ptr_cas (struct nn_atomic_ptr *self, void *oldval,
+    void *newval);
+
 #endif
 
@@ -29,4 +29,11 @@
 #define NN_UNUSED
 #endif
 
+/*  Storage class for thread-local variables. */
+#if defined _MSC_VER
+#define NN_THREAD_LOCAL __declspec(thread)
+#else
+#define NN_THREAD_LOCAL __thread
+#endif
+
 #endif
@@ -27,12 +27,35 @@
 #include "fast.h"
 #include "wire.h"
 #include "err.h"
+#include "attr.h"
+#include "mutex.h"
+#include "once.h"
+#if defined NN_HAVE_SHM
+#include "shmarena.h"
+#endif
+
+#include "../nn.h"
+#include "../shm.h"
 
 #include <string.h>
 
 #define NN_CHUNK_TAG 0xdeadcafe
 #define NN_CHUNK_TAG_DEALLOCATED 0xbeadfeed
 
+/*  Small chunks can be recycled via size-class pools rather than being
+    returned to the heap. The pool needs atomic operations and thread-local
+    storage. */
+#if defined NN_USE_CHUNK_POOL && !defined NN_ATOMIC_MUTEX
+#define NN_CHUNK_POOL
+#include "mpscq.h"
+#include "cont.h"
+#if defined NN_HAVE_WINDOWS
+#include "win.h"
+#else
+#include <pthread.h>
+#endif
+#endif
+
 typedef void (*nn_chunk_free_fn) (void *p);
 
 struct nn_chunk {
@@ -40,10 +63,18 @@ struct nn_chunk {
     /*  Number of places the chunk is referenced from. */
     struct nn_atomic refcount;
 
+    /*  Set if the chunk's capacity is charged to the budget. */
+    uint32_t charged;
+
     /*  Size of the message in bytes. */
     size_t size;
 
-    /*  Deallocation function. */
+    /*  Number of bytes available for the empty space and the message. The
+        message can grow in place as long as the two fit. */
+    size_t capacity;
+
+    /*  Deallocation function. NULL for chunks allocated in shared memory,
+        which may be freed by another process. */
     nn_chunk_free_fn ffn;
 
     /*  The structure if followed by optional empty space, a 32 bit unsigned
@@ -53,45 +84,202 @@ struct nn_chunk {
 
 /*  Private functions. */
 static struct nn_chunk *nn_chunk_getptr (void *p);
-static void *nn_chunk_getdata (struct nn_chunk *c);
 static void nn_chunk_default_free (void *p);
 static size_t nn_chunk_hdrsize ();
 
+/*  Process-wide budget. The counter of the charged bytes is used without
+    initialisation, which is fine unless it's guarded by a mutex. */
+#if !defined NN_ATOMIC64_MUTEX
+#define NN_CHUNK_BUDGET
+static struct nn_atomic64 nn_chunk_used;
+#endif
+static size_t nn_chunk_budget;
+static int nn_chunk_budgetflags;
+
+#if defined NN_CHUNK_POOL
+
+/*  Memory blocks of the smallest size class are NN_CHUNK_POOL_MIN bytes
+    long, each subsequent class doubles the size. */
+#define NN_CHUNK_POOL_MIN 128
+#define NN_CHUNK_POOL_CLASSES 6
+
+/*  Maximum number of free blocks per size class cached by a single thread.
+    Blocks beyond this limit are handed over to the global pool. */
+#define NN_CHUNK_POOL_CACHE 256
+
+/*  Header of a pooled memory block, precedes the chunk itself. */
+struct nn_chunk_block {
+    struct nn_queue_item item;
+    int cls;
+};
+
+/*  Free blocks of each size class. Blocks are returned to the global pool
+    without locking from whatever thread releases the message. */
+static struct nn_mpscq nn_chunk_pool [NN_CHUNK_POOL_CLASSES];
+
+/*  Free blocks cached by the current thread. */
+struct nn_chunk_cache {
+    struct nn_queue blocks;
+    int count;
+};
+static NN_THREAD_LOCAL struct nn_chunk_cache
+    nn_chunk_cache [NN_CHUNK_POOL_CLASSES];
+
+/*  The blocks cached by a thread are handed over to the global pool when
+    the thread exits. The key serves only to get notified of that, its
+    value is set once the thread caches something. */
+static nn_once_t nn_chunk_pool_once = NN_ONCE_INITIALIZER;
+#if defined NN_HAVE_WINDOWS
+static DWORD nn_chunk_pool_key;
+#else
+static pthread_key_t nn_chunk_pool_key;
+#endif
+static NN_THREAD_LOCAL int nn_chunk_cache_registered;
+
+static struct nn_chunk *nn_chunk_pool_alloc (size_t sz);
+static void nn_chunk_pool_free (void *p);
+static size_t nn_chunk_pool_capacity (int cls);
+static int nn_chunk_pool_class (size_t sz);
+static int nn_chunk_pool_warmup (int cls, int count);
+static void nn_chunk_pool_register (void);
+static void nn_chunk_pool_flush (void);
+
+#endif
+
+/*  Message pools created by the user. Pool N is passed to nn_chunk_alloc
+    as type N. Each pool holds up to 'maxbufs' buffers of the same size,
+    allocated on demand and recycled when the chunks are freed. The pools
+    are never destroyed, as the chunks can outlive the library itself. */
+#define NN_CHUNK_MSGPOOLS 16
+
+struct nn_chunk_msgpool {
+    struct nn_mutex sync;
+
+    /*  Chunk size the buffers can accommodate, including the header. */
+    size_t bufsz;
+
+    /*  Number of buffers allocated so far, and the limit. */
+    int nbufs;
+    int maxbufs;
+
+    /*  Buffers not in use, most recently used one first. */
+    struct nn_chunk_msgblock *free;
+};
+
+/*  Header of a buffer of a message pool, precedes the chunk itself. */
+struct nn_chunk_msgblock {
+    struct nn_chunk_msgpool *pool;
+    struct nn_chunk_msgblock *next;
+};
+
+static nn_once_t nn_chunk_msgpools_once = NN_ONCE_INITIALIZER;
+static struct nn_mutex nn_chunk_msgpools_sync;
+static struct nn_chunk_msgpool *nn_chunk_msgpools [NN_CHUNK_MSGPOOLS];
+
+static struct nn_chunk *nn_chunk_msgpool_alloc (int type, size_t sz);
+static void nn_chunk_msgpool_free (void *p);
+static int nn_chunk_msgpool_warmup (int type, int count);
+
+/*  Allocates a chunk on the heap, or from the size-class pools if these
+    are enabled. */
+static struct nn_chunk *nn_chunk_heap_alloc (size_t sz)
+{
+    struct nn_chunk *self;
+
+#if defined NN_CHUNK_POOL
+    self = nn_chunk_pool_alloc (sz);
+    if (self)
+        return self;
+#endif
+    self = nn_alloc_class (sz, NN_ALLOC_MSG, "message chunk");
+    if (self) {
+        self->ffn = nn_chunk_default_free;
+        self->capacity = sz - nn_chunk_hdrsize ();
+    }
+    return self;
+}
+
 int nn_chunk_alloc (size_t size, int type, void **result)
+{
+    return nn_chunk_alloc_room (size, 0, 0, type, result);
+}
+
+int nn_chunk_alloc_room (size_t size, size_t headroom, size_t tailroom,
+    int type, void **result)
 {
     size_t sz;
+    size_t room;
     struct nn_chunk *self;
+    struct nn_alloc_acct *prevacct;
+    uint8_t *p;
     const size_t hdrsz = nn_chunk_hdrsize ();
 
     /*  Compute total size to be allocated. Check for overflow. */
-    sz = hdrsz + size;
+    if (nn_slow (headroom >= UINT32_MAX))
+        return -ENOMEM;
+    room = headroom + size;
+    if (nn_slow (room < size))
+        return -ENOMEM;
+    room += tailroom;
+    if (nn_slow (room < tailroom))
+        return -ENOMEM;
+    sz = hdrsz + room;
     if (nn_slow (sz < hdrsz))
         return -ENOMEM;
 
-    /*  Allocate the actual memory depending on the type. */
+    /*  Allocate the actual memory depending on the type. Messages travel
+        between sockets and to the user, so they are not charged to the
+        socket that happens to allocate them. */
     switch (type) {
     case 0:
-        self = nn_alloc (sz, "message chunk");
+        prevacct = nn_alloc_acct_select (NULL);
+        self = nn_chunk_heap_alloc (sz);
+        nn_alloc_acct_select (prevacct);
+        break;
+#if defined NN_HAVE_SHM
+    case NN_SHM:
+        self = nn_shmarena_alloc (sz);
+        if (self) {
+            self->ffn = NULL;
+            self->capacity = room;
+        }
         break;
+#endif
     default:
-        return -EINVAL;
+        if (nn_slow (!nn_chunk_msgpool_valid (type)))
+            return -EINVAL;
+
+        /*  Chunks that don't fit into the pool's buffers, or that exceed
+            its limit, are allocated on the heap. */
+        prevacct = nn_alloc_acct_select (NULL);
+        self = nn_chunk_msgpool_alloc (type, sz);
+        if (!self)
+            self = nn_chunk_heap_alloc (sz);
+        nn_alloc_acct_select (prevacct);
+        break;
     }
     if (nn_slow (!self))
         return -ENOMEM;
 
-    /*  Fill in the chunk header. */
+    /*  Fill in the chunk header. Shared memory is not taken from
+        the process, so it's not charged to the budget. */
     nn_atomic_init (&self->refcount, 1);
     self->size = size;
-    self->ffn = nn_chunk_default_free;
-
-    /*  Fill in the size of the empty space between the chunk header
-        and the message. */
-    nn_putl ((uint8_t*) ((uint32_t*) (self + 1)), 0);
+    self->charged = 0;
+#if defined NN_CHUNK_BUDGET
+    if (nn_slow (nn_chunk_budget) && self->ffn) {
+        self->charged = 1;
+        nn_atomic64_inc (&nn_chunk_used, self->capacity);
+    }
+#endif
 
-    /*  Fill in the tag. */
-    nn_putl ((uint8_t*) ((((uint32_t*) (self + 1))) + 1), NN_CHUNK_TAG);
+    /*  The headroom is the empty space between the chunk header and the
+        message. Fill in its size and the tag. */
+    p = ((uint8_t*) (self + 1)) + headroom;
+    nn_putl (p, (uint32_t) headroom);
+    nn_putl (p + sizeof (uint32_t), NN_CHUNK_TAG);
 
-    *result = nn_chunk_getdata (self);
+    *result = p + 2 * sizeof (uint32_t);
     return 0;
 }
 
@@ -102,27 +290,57 @@ int nn_chunk_realloc (size_t size, void **chunk)
     void *new_ptr;
     size_t hdr_size;
     size_t new_size;
+    uint32_t empty_space;
     int rc;
 
     self = nn_chunk_getptr (*chunk);
+    empty_space = nn_getl ((uint8_t*) *chunk - 2 * sizeof (uint32_t));
 
     /*  Check if we only have one reference to this object, in that case we can
         reallocate the memory chunk. */
-    if (self->refcount.n == 1) {
+    if (nn_atomic_load (&self->refcount) == 1) {
+
+        /*  If the message fits into the memory the chunk already has, it is
+            resized in place. */
+        if (size <= self->capacity - empty_space) {
+            self->size = size;
+            return 0;
+        }
 
         /* Compute new size, check for overflow. */
-        hdr_size = nn_chunk_hdrsize ();
+        hdr_size = nn_chunk_hdrsize () + empty_space;
         new_size = hdr_size + size;
         if (nn_slow (new_size < hdr_size))
             return -ENOMEM;
 
-        /*  Reallocate memory chunk. */
+        /*  Chunks in shared memory and pooled chunks can't be reallocated,
+            the data are moved to a new chunk on the heap. */
+        if (self->ffn != nn_chunk_default_free) {
+            new_ptr = NULL;
+            rc = nn_chunk_alloc (size, 0, &new_ptr);
+            if (nn_slow (rc != 0))
+                return rc;
+            memcpy (new_ptr, *chunk, self->size);
+            nn_chunk_free (*chunk);
+            *chunk = new_ptr;
+            return 0;
+        }
+
+        /*  Reallocate memory chunk. The empty space is preserved. */
         new_chunk = nn_realloc (self, new_size);
         if (nn_slow (new_chunk == NULL))
             return -ENOMEM;
 
+#if defined NN_CHUNK_BUDGET
+        if (nn_slow (new_chunk->charged)) {
+            nn_atomic64_inc (&nn_chunk_used, empty_space + size);
+            nn_atomic64_dec (&nn_chunk_used, new_chunk->capacity);
+        }
+#endif
         new_chunk->size = size;
-        *chunk = nn_chunk_getdata (new_chunk);
+        new_chunk->capacity = empty_space + size;
+        *chunk = ((uint8_t*) (new_chunk + 1)) + empty_space +
+            2 * sizeof (uint32_t);
     }
 
     /*  There are many references to this memory chunk, we have to create a new
@@ -135,7 +353,7 @@ int nn_chunk_realloc (size_t size, void **chunk)
             return rc;
         }
 
-        memcpy (new_ptr, nn_chunk_getdata (self), self->size);
+        memcpy (new_ptr, *chunk, self->size < size ? self->size : size);
         *chunk = new_ptr;
         nn_atomic_dec (&self->refcount, 1);
     }
@@ -158,13 +376,47 @@ void nn_chunk_free (void *p)
 
         /*  Deallocate the resources held by the chunk. */
         nn_atomic_term (&self->refcount);
+#if defined NN_CHUNK_BUDGET
+        if (nn_slow (self->charged))
+            nn_atomic64_dec (&nn_chunk_used, self->capacity);
+#endif
 
         /*  Deallocate the memory block according to the allocation
             mechanism specified. */
+#if defined NN_HAVE_SHM
+        if (!self->ffn) {
+            nn_shmarena_free (self);
+            return;
+        }
+#endif
         self->ffn (self);
     }
 }
 
+int nn_chunk_setbudget (size_t bytes, int flags)
+{
+    if (nn_slow (flags & ~(NN_MEMBUDGET_SEND | NN_MEMBUDGET_RECV)))
+        return -EINVAL;
+#if defined NN_CHUNK_BUDGET
+    nn_chunk_budgetflags = flags;
+    nn_chunk_budget = bytes;
+    return 0;
+#else
+    return bytes ? -ENOTSUP : 0;
+#endif
+}
+
+int nn_chunk_overbudget (int flag)
+{
+#if defined NN_CHUNK_BUDGET
+    if (nn_fast (!nn_chunk_budget) || !(nn_chunk_budgetflags & flag))
+        return 0;
+    return nn_atomic64_load (&nn_chunk_used) > nn_chunk_budget ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
 void nn_chunk_addref (void *p, uint32_t n)
 {
     struct nn_chunk *self;
@@ -204,6 +456,92 @@ void *nn_chunk_trim (void *p, size_t n)
     return p;
 }
 
+void *nn_chunk_prepend (void *p, size_t n)
+{
+    struct nn_chunk *self;
+    uint32_t empty_space;
+
+    self = nn_chunk_getptr (p);
+    empty_space = nn_getl ((uint8_t*) p - 2 * sizeof (uint32_t));
+
+    /*  The headroom may be used only if no one else sees the chunk. */
+    if (nn_atomic_load (&self->refcount) != 1 || n > empty_space)
+        return NULL;
+
+    p = ((uint8_t*) p) - n;
+    nn_putl ((uint8_t*) (((uint32_t*) p) - 1), NN_CHUNK_TAG);
+    nn_putl ((uint8_t*) (((uint32_t*) p) - 2), (uint32_t) (empty_space - n));
+    self->size += n;
+
+    return p;
+}
+
+size_t nn_chunk_headroom (void *p)
+{
+    return nn_getl ((uint8_t*) p - 2 * sizeof (uint32_t));
+}
+
+#if defined NN_HAVE_SHM
+
+int nn_chunk_shmhandle (void *p, const char **name, uint64_t *offset)
+{
+    struct nn_chunk *self;
+
+    self = nn_chunk_getptr (p);
+    if (self->ffn || nn_atomic_load (&self->refcount) != 1)
+        return -EINVAL;
+    return nn_shmarena_locate (p, name, offset);
+}
+
+int nn_chunk_shmopen (const char *name, uint64_t offset, size_t size,
+    void **result)
+{
+    int rc;
+    void *p;
+    uint64_t off;
+    const size_t hdrsz = nn_chunk_hdrsize ();
+
+    /*  The handle comes from another process. Check that the chunk lies
+        within the arena before touching it. */
+    if (nn_slow (offset < hdrsz))
+        return -EINVAL;
+    rc = nn_shmarena_resolve (name, offset - 2 * sizeof (uint32_t),
+        2 * sizeof (uint32_t), &p);
+    if (nn_slow (rc < 0))
+        return rc;
+    if (nn_slow (nn_getl ((uint8_t*) p + sizeof (uint32_t)) != NN_CHUNK_TAG))
+        return -EPROTO;
+    off = nn_getl ((uint8_t*) p);
+    if (nn_slow (offset < hdrsz + off))
+        return -EINVAL;
+    rc = nn_shmarena_resolve (name, offset - hdrsz - off, hdrsz + off + size,
+        &p);
+    if (nn_slow (rc < 0))
+        return rc;
+    p = ((uint8_t*) p) + hdrsz + off;
+    if (nn_slow (nn_chunk_getptr (p)->ffn || nn_chunk_size (p) != size))
+        return -EPROTO;
+
+    *result = p;
+    return 0;
+}
+
+#else
+
+int nn_chunk_shmhandle (NN_UNUSED void *p, NN_UNUSED const char **name,
+    NN_UNUSED uint64_t *offset)
+{
+    return -EINVAL;
+}
+
+int nn_chunk_shmopen (NN_UNUSED const char *name, NN_UNUSED uint64_t offset,
+    NN_UNUSED size_t size, NN_UNUSED void **result)
+{
+    return -EINVAL;
+}
+
+#endif
+
 static struct nn_chunk *nn_chunk_getptr (void *p)
 {
     uint32_t off;
@@ -215,11 +553,6 @@ static struct nn_chunk *nn_chunk_getptr (void *p)
         sizeof (struct nn_chunk));
 }
 
-static void *nn_chunk_getdata (struct nn_chunk *self)
-{
-    return ((uint8_t*) (self + 1)) + 2 * sizeof (uint32_t);
-}
-
 static void nn_chunk_default_free (void *p)
 {
     nn_free (p);
@@ -230,3 +563,382 @@ static size_t nn_chunk_hdrsize ()
     return sizeof (struct nn_chunk) + 2 * sizeof (uint32_t);
 }
 
+#if defined NN_CHUNK_POOL
+
+static size_t nn_chunk_pool_capacity (int cls)
+{
+    return ((size_t) NN_CHUNK_POOL_MIN) << cls;
+}
+
+static int nn_chunk_pool_class (size_t sz)
+{
+    int cls;
+
+    sz += sizeof (struct nn_chunk_block);
+    for (cls = 0; cls != NN_CHUNK_POOL_CLASSES; ++cls)
+        if (sz <= nn_chunk_pool_capacity (cls))
+            return cls;
+    return -1;
+}
+
+static struct nn_chunk *nn_chunk_pool_alloc (size_t sz)
+{
+    int cls;
+    struct nn_chunk_cache *cache;
+    struct nn_queue_item *item;
+    struct nn_chunk_block *block;
+    struct nn_chunk *self;
+
+    /*  Find the size class. Large chunks are not pooled. */
+    cls = nn_chunk_pool_class (sz);
+    if (nn_slow (cls < 0))
+        return NULL;
+
+    /*  Try the thread-local cache first. If it's empty, refill it from
+        the global pool. If even that is empty, allocate a new block. */
+    cache = &nn_chunk_cache [cls];
+    item = nn_queue_pop (&cache->blocks);
+    if (nn_slow (!item)) {
+        if (nn_slow (!nn_chunk_cache_registered))
+            nn_chunk_pool_register ();
+        nn_mpscq_drain (&nn_chunk_pool [cls], &cache->blocks);
+        cache->count = 0;
+        for (item = cache->blocks.head; item != NULL; item = item->next)
+            ++cache->count;
+        item = nn_queue_pop (&cache->blocks);
+    }
+    if (item) {
+        --cache->count;
+        block = nn_cont (item, struct nn_chunk_block, item);
+    }
+    else {
+        block = nn_alloc_class (nn_chunk_pool_capacity (cls),
+            NN_ALLOC_MSG, "message chunk");
+        if (nn_slow (!block))
+            return NULL;
+        nn_queue_item_init (&block->item);
+        block->cls = cls;
+    }
+
+    self = (struct nn_chunk*) (block + 1);
+    self->ffn = nn_chunk_pool_free;
+    self->capacity = nn_chunk_pool_capacity (cls) -
+        sizeof (struct nn_chunk_block) - nn_chunk_hdrsize ();
+    return self;
+}
+
+static void nn_chunk_pool_free (void *p)
+{
+    struct nn_chunk_block *block;
+    struct nn_chunk_cache *cache;
+
+    block = ((struct nn_chunk_block*) p) - 1;
+    cache = &nn_chunk_cache [block->cls];
+    if (nn_fast (cache->count < NN_CHUNK_POOL_CACHE)) {
+        if (nn_slow (!nn_chunk_cache_registered))
+            nn_chunk_pool_register ();
+        nn_queue_push (&cache->blocks, &block->item);
+        ++cache->count;
+        return;
+    }
+    nn_mpscq_push (&nn_chunk_pool [block->cls], &block->item);
+}
+
+static int nn_chunk_pool_warmup (int cls, int count)
+{
+    int i;
+    struct nn_chunk_block *block;
+    const size_t capacity = nn_chunk_pool_capacity (cls);
+
+    /*  The blocks go to the global pool, so that whichever thread ends up
+        allocating the messages finds them there. */
+    for (i = 0; i != count; ++i) {
+        block = nn_alloc_class (capacity, NN_ALLOC_MSG, "message chunk");
+        if (nn_slow (!block))
+            return -ENOMEM;
+        memset (block, 0, capacity);
+        nn_queue_item_init (&block->item);
+        block->cls = cls;
+        nn_mpscq_push (&nn_chunk_pool [cls], &block->item);
+    }
+    return 0;
+}
+
+#if defined NN_HAVE_WINDOWS
+static void WINAPI nn_chunk_pool_exit (NN_UNUSED void *arg)
+#else
+static void nn_chunk_pool_exit (NN_UNUSED void *arg)
+#endif
+{
+    /*  The thread may still free some chunks afterwards, e.g. from other
+        destructors, and it has to register again then. */
+    nn_chunk_pool_flush ();
+    nn_chunk_cache_registered = 0;
+}
+
+static void nn_chunk_pool_setup (void)
+{
+#if defined NN_HAVE_WINDOWS
+    nn_chunk_pool_key = FlsAlloc (nn_chunk_pool_exit);
+    win_assert (nn_chunk_pool_key != FLS_OUT_OF_INDEXES);
+#else
+    int rc;
+
+    rc = pthread_key_create (&nn_chunk_pool_key, nn_chunk_pool_exit);
+    errnum_assert (rc == 0, rc);
+#endif
+}
+
+static void nn_chunk_pool_register (void)
+{
+#if defined NN_HAVE_WINDOWS
+    BOOL brc;
+
+    nn_do_once (&nn_chunk_pool_once, nn_chunk_pool_setup);
+    brc = FlsSetValue (nn_chunk_pool_key, &nn_chunk_pool_key);
+    win_assert (brc);
+#else
+    int rc;
+
+    nn_do_once (&nn_chunk_pool_once, nn_chunk_pool_setup);
+    rc = pthread_setspecific (nn_chunk_pool_key, &nn_chunk_pool_key);
+    errnum_assert (rc == 0, rc);
+#endif
+    nn_chunk_cache_registered = 1;
+}
+
+/*  Hands the blocks cached by the calling thread over to the global
+    pool. */
+static void nn_chunk_pool_flush (void)
+{
+    int cls;
+    struct nn_chunk_cache *cache;
+    struct nn_queue_item *item;
+
+    for (cls = 0; cls != NN_CHUNK_POOL_CLASSES; ++cls) {
+        cache = &nn_chunk_cache [cls];
+        while ((item = nn_queue_pop (&cache->blocks)) != NULL)
+            nn_mpscq_push (&nn_chunk_pool [cls], item);
+        cache->count = 0;
+    }
+}
+
+#endif
+
+void nn_chunk_term (void)
+{
+#if defined NN_CHUNK_POOL
+    int cls;
+    struct nn_queue blocks;
+    struct nn_queue_item *item;
+
+    /*  The worker threads have exited by now, leaving their blocks in the
+        global pool, and the calling thread's blocks are put there as well.
+        Application threads that are still running keep theirs until they
+        exit; these are freed by the next nn_term, if any. Chunks still in
+        use return to the pool once freed, the same way. */
+    nn_chunk_pool_flush ();
+    nn_queue_init (&blocks);
+    for (cls = 0; cls != NN_CHUNK_POOL_CLASSES; ++cls) {
+        nn_mpscq_drain (&nn_chunk_pool [cls], &blocks);
+        while ((item = nn_queue_pop (&blocks)) != NULL)
+            nn_free (nn_cont (item, struct nn_chunk_block, item));
+    }
+    nn_queue_term (&blocks);
+#endif
+}
+
+static void nn_chunk_msgpools_setup (void)
+{
+    nn_mutex_init (&nn_chunk_msgpools_sync);
+}
+
+int nn_chunk_msgpool_create (size_t size, int maxbufs)
+{
+    int i;
+    struct nn_chunk_msgpool *pool;
+    const size_t hdrsz = nn_chunk_hdrsize ();
+
+    if (nn_slow (maxbufs < 1 || size + hdrsz < size))
+        return -EINVAL;
+
+    pool = nn_alloc (sizeof (struct nn_chunk_msgpool), "message pool");
+    if (nn_slow (!pool))
+        return -ENOMEM;
+    nn_mutex_init (&pool->sync);
+    pool->bufsz = hdrsz + size;
+    pool->nbufs = 0;
+    pool->maxbufs = maxbufs;
+    pool->free = NULL;
+
+    nn_do_once (&nn_chunk_msgpools_once, nn_chunk_msgpools_setup);
+    nn_mutex_lock (&nn_chunk_msgpools_sync);
+    for (i = 0; i != NN_CHUNK_MSGPOOLS; ++i)
+        if (!nn_chunk_msgpools [i])
+            break;
+    if (i != NN_CHUNK_MSGPOOLS)
+        nn_chunk_msgpools [i] = pool;
+    nn_mutex_unlock (&nn_chunk_msgpools_sync);
+    if (nn_slow (i == NN_CHUNK_MSGPOOLS)) {
+        nn_mutex_term (&pool->sync);
+        nn_free (pool);
+        return -EMFILE;
+    }
+    return i + 1;
+}
+
+int nn_chunk_msgpool_valid (int type)
+{
+    /*  A pool is registered before its number is returned to the user, so
+        a number obtained from nn_chunk_msgpool_create is always seen. */
+    return type > 0 && type <= NN_CHUNK_MSGPOOLS &&
+        nn_chunk_msgpools [type - 1];
+}
+
+static struct nn_chunk *nn_chunk_msgpool_alloc (int type, size_t sz)
+{
+    struct nn_chunk_msgpool *pool;
+    struct nn_chunk_msgblock *block;
+    struct nn_chunk *self;
+
+    pool = nn_chunk_msgpools [type - 1];
+    if (sz > pool->bufsz)
+        return NULL;
+
+    nn_mutex_lock (&pool->sync);
+    block = pool->free;
+    if (block)
+        pool->free = block->next;
+    else if (pool->nbufs < pool->maxbufs)
+        ++pool->nbufs;
+    else {
+        nn_mutex_unlock (&pool->sync);
+        return NULL;
+    }
+    nn_mutex_unlock (&pool->sync);
+
+    if (!block) {
+        block = nn_alloc_class (sizeof (struct nn_chunk_msgblock) +
+            pool->bufsz, NN_ALLOC_MSG, "message pool buffer");
+        if (nn_slow (!block)) {
+            nn_mutex_lock (&pool->sync);
+            --pool->nbufs;
+            nn_mutex_unlock (&pool->sync);
+            return NULL;
+        }
+        block->pool = pool;
+    }
+
+    self = (struct nn_chunk*) (block + 1);
+    self->ffn = nn_chunk_msgpool_free;
+    self->capacity = pool->bufsz - nn_chunk_hdrsize ();
+    return self;
+}
+
+static int nn_chunk_msgpool_warmup (int type, int count)
+{
+    int n;
+    struct nn_chunk_msgpool *pool;
+    struct nn_chunk_msgblock *block;
+
+    pool = nn_chunk_msgpools [type - 1];
+
+    /*  Reserve the buffers that are still to be allocated to reach 'count'
+        buffers in total, never exceeding the limit of the pool. */
+    nn_mutex_lock (&pool->sync);
+    if (count > pool->maxbufs)
+        count = pool->maxbufs;
+    n = count > pool->nbufs ? count - pool->nbufs : 0;
+    pool->nbufs += n;
+    nn_mutex_unlock (&pool->sync);
+
+    for (; n != 0; --n) {
+        block = nn_alloc_class (sizeof (struct nn_chunk_msgblock) +
+            pool->bufsz, NN_ALLOC_MSG, "message pool buffer");
+        if (nn_slow (!block)) {
+            nn_mutex_lock (&pool->sync);
+            pool->nbufs -= n;
+            nn_mutex_unlock (&pool->sync);
+            return -ENOMEM;
+        }
+        memset (block, 0, sizeof (struct nn_chunk_msgblock) + pool->bufsz);
+        block->pool = pool;
+        nn_mutex_lock (&pool->sync);
+        block->next = pool->free;
+        pool->free = block;
+        nn_mutex_unlock (&pool->sync);
+    }
+    return 0;
+}
+
+static void nn_chunk_msgpool_free (void *p)
+{
+    struct nn_chunk_msgblock *block;
+    struct nn_chunk_msgpool *pool;
+
+    block = ((struct nn_chunk_msgblock*) p) - 1;
+    pool = block->pool;
+    nn_mutex_lock (&pool->sync);
+    block->next = pool->free;
+    pool->free = block;
+    nn_mutex_unlock (&pool->sync);
+}
+
+int nn_chunk_warmup (size_t size, int count, int type)
+{
+    int rc;
+    size_t sz;
+    void *blocks;
+    void *block;
+    struct nn_alloc_acct *prevacct;
+#if defined NN_CHUNK_POOL
+    int cls;
+#endif
+
+    sz = nn_chunk_hdrsize () + size;
+    if (nn_slow (count < 0 || sz < size))
+        return -EINVAL;
+    if (nn_slow (type != 0 && !nn_chunk_msgpool_valid (type)))
+        return -EINVAL;
+
+    /*  Same as the messages themselves, the memory is not charged to
+        the socket asking for it. */
+    prevacct = nn_alloc_acct_select (NULL);
+    if (type != 0) {
+        rc = nn_chunk_msgpool_warmup (type, count);
+        nn_alloc_acct_select (prevacct);
+        return rc;
+    }
+#if defined NN_CHUNK_POOL
+    cls = nn_chunk_pool_class (sz);
+    if (cls >= 0) {
+        rc = nn_chunk_pool_warmup (cls, count);
+        nn_alloc_acct_select (prevacct);
+        return rc;
+    }
+#endif
+
+    /*  Chunks that are not pooled come straight from the allocator. All of
+        them are allocated and touched before being released, which leaves
+        the memory faulted in and on the allocator's free lists. They are
+        chained through their first bytes meanwhile. */
+    rc = 0;
+    blocks = NULL;
+    for (; count != 0; --count) {
+        block = nn_alloc_class (sz, NN_ALLOC_MSG, "message chunk");
+        if (nn_slow (!block)) {
+            rc = -ENOMEM;
+            break;
+        }
+        memset (block, 0, sz);
+        *(void**) block = blocks;
+        blocks = block;
+    }
+    while (blocks) {
+        block = blocks;
+        blocks = *(void**) block;
+        nn_free (block);
+    }
+    nn_alloc_acct_select (prevacct);
+    return rc;
+}
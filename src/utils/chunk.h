@@ -26,10 +26,48 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/*  Allocates the chunk using the allocation mechanism specified by 'type'. */
+/*  Allocates the chunk using the allocation mechanism specified by 'type'.
+    Type 0 stands for the heap, positive types for message pools. */
 int nn_chunk_alloc (size_t size, int type, void **result);
 
-/*  Resizes a chunk previously allocated with nn_chunk_alloc. */
+/*  Same as above, except that 'headroom' bytes are reserved in front of the
+    message and 'tailroom' bytes behind it. The message can then be extended
+    in place, using nn_chunk_prepend and nn_chunk_realloc respectively. */
+int nn_chunk_alloc_room (size_t size, size_t headroom, size_t tailroom,
+    int type, void **result);
+
+/*  Creates a message pool of up to 'maxbufs' buffers, each holding a chunk
+    of up to 'size' bytes. Chunks allocated from the pool return to it once
+    freed. Returns the type to pass to nn_chunk_alloc, or a negative error
+    code. */
+int nn_chunk_msgpool_create (size_t size, int maxbufs);
+
+/*  Returns 1 if 'type' identifies an existing message pool, 0 otherwise. */
+int nn_chunk_msgpool_valid (int type);
+
+/*  Makes sure that 'count' chunks of 'size' bytes can be allocated using
+    the allocation mechanism specified by 'type' without taking page faults,
+    as far as the mechanism allows for it. Message pool buffers and pooled
+    chunks are allocated in advance and kept; other chunks are merely
+    allocated, touched and freed. */
+int nn_chunk_warmup (size_t size, int count, int type);
+
+/*  Frees the chunks kept for reuse by the size-class pools. Called when
+    the library is shut down. */
+void nn_chunk_term (void);
+
+/*  Sets the process-wide budget for the memory held by chunks allocated on
+    the heap or from message pools, zero meaning no budget. Chunks are
+    charged only while a budget is set. 'flags' is a combination of
+    NN_MEMBUDGET_SEND and NN_MEMBUDGET_RECV. */
+int nn_chunk_setbudget (size_t bytes, int flags);
+
+/*  Returns 1 if the charged chunks exceed the budget and 'flag' is one of
+    the flags it was set with, 0 otherwise. */
+int nn_chunk_overbudget (int flag);
+
+/*  Resizes a chunk previously allocated with nn_chunk_alloc. The chunk is
+    resized in place if it fits into the memory already allocated. */
 int nn_chunk_realloc (size_t size, void **chunk);
 
 /*  Releases a reference to the chunk and once the reference count had dropped
@@ -46,5 +84,25 @@ size_t nn_chunk_size (void *p);
     chunk. */
 void *nn_chunk_trim (void *p, size_t n);
 
+/*  Extends the chunk by n bytes at the beginning, using the empty space in
+    front of the data, which is either the reserved headroom or the bytes
+    trimmed before. Returns pointer to the new chunk, or NULL if there is not
+    enough empty space or the chunk is shared. */
+void *nn_chunk_prepend (void *p, size_t n);
+
+/*  Returns the number of bytes the chunk can be extended by at the
+    beginning. */
+size_t nn_chunk_headroom (void *p);
+
+/*  If the chunk was allocated in shared memory (NN_SHM allocation type) and
+    it's not referenced from anywhere else, fills in the name of the arena
+    and the offset of the chunk within it and returns 0. The reference can
+    then be handed over to another process. Returns -EINVAL otherwise. */
+int nn_chunk_shmhandle (void *p, const char **name, uint64_t *offset);
+
+/*  Takes over the reference to a chunk handed over by another process. */
+int nn_chunk_shmopen (const char *name, uint64_t offset, size_t size,
+    void **result);
+
 #endif
 
@@ -40,6 +40,11 @@ CT_ASSERT (NN_CHUNKREF_MAX < 255);
 CT_ASSERT (sizeof (struct nn_chunkref) >= sizeof (struct nn_chunkref_chunk));
 
 void nn_chunkref_init (struct nn_chunkref *self, size_t size)
+{
+    nn_chunkref_init_type (self, size, 0);
+}
+
+void nn_chunkref_init_type (struct nn_chunkref *self, size_t size, int type)
 {
     int rc;
     struct nn_chunkref_chunk *ch;
@@ -51,7 +56,24 @@ void nn_chunkref_init (struct nn_chunkref *self, size_t size)
 
     ch = (struct nn_chunkref_chunk*) self;
     ch->tag = 0xff;
-    rc = nn_chunk_alloc (size, 0, &ch->chunk);
+    rc = nn_chunk_alloc (size, type, &ch->chunk);
+    errno_assert (rc == 0);
+}
+
+void nn_chunkref_init_room (struct nn_chunkref *self, size_t size,
+    size_t headroom)
+{
+    int rc;
+    struct nn_chunkref_chunk *ch;
+
+    if (size < NN_CHUNKREF_MAX) {
+        self->u.ref [0] = (uint8_t) size;
+        return;
+    }
+
+    ch = (struct nn_chunkref_chunk*) self;
+    ch->tag = 0xff;
+    rc = nn_chunk_alloc_room (size, headroom, 0, 0, &ch->chunk);
     errno_assert (rc == 0);
 }
 
@@ -75,6 +97,11 @@ void nn_chunkref_term (struct nn_chunkref *self)
 }
 
 void *nn_chunkref_getchunk (struct nn_chunkref *self)
+{
+    return nn_chunkref_getchunk_type (self, 0);
+}
+
+void *nn_chunkref_getchunk_type (struct nn_chunkref *self, int type)
 {
     int rc;
     struct nn_chunkref_chunk *ch;
@@ -86,7 +113,7 @@ void *nn_chunkref_getchunk (struct nn_chunkref *self)
         return ch->chunk;
     }
 
-    rc = nn_chunk_alloc (self->u.ref [0], 0, &chunk);
+    rc = nn_chunk_alloc (self->u.ref [0], type, &chunk);
     errno_assert (rc == 0);
     memcpy (chunk, &self->u.ref [1], self->u.ref [0]);
     self->u.ref [0] = 0;
@@ -107,7 +134,7 @@ void nn_chunkref_cp (struct nn_chunkref *dst, struct nn_chunkref *src)
         ch = (struct nn_chunkref_chunk*) src;
         nn_chunk_addref (ch->chunk, 1);
     }
-    memcpy (dst, src, sizeof (struct nn_chunkref));
+    nn_chunkref_mv (dst, src);
 }
 
 void *nn_chunkref_data (struct nn_chunkref *self)
@@ -124,6 +151,11 @@ size_t nn_chunkref_size (struct nn_chunkref *self)
         self->u.ref [0];
 }
 
+int nn_chunkref_ischunk (struct nn_chunkref *self)
+{
+    return self->u.ref [0] == 0xff;
+}
+
 void nn_chunkref_trim (struct nn_chunkref *self, size_t n)
 {
     struct nn_chunkref_chunk *ch;
@@ -139,6 +171,48 @@ void nn_chunkref_trim (struct nn_chunkref *self, size_t n)
     self->u.ref [0] -= (uint8_t) n;
 }
 
+int nn_chunkref_prepend (struct nn_chunkref *self, const void *data,
+    size_t n)
+{
+    struct nn_chunkref_chunk *ch;
+    void *chunk;
+
+    if (self->u.ref [0] != 0xff)
+        return 0;
+    ch = (struct nn_chunkref_chunk*) self;
+    chunk = nn_chunk_prepend (ch->chunk, n);
+    if (!chunk)
+        return 0;
+    memcpy (chunk, data, n);
+    ch->chunk = chunk;
+    return 1;
+}
+
+void nn_chunkref_push (struct nn_chunkref *self, const void *data, size_t n)
+{
+    size_t sz;
+    struct nn_chunkref ref;
+
+    /*  Inline data are moved to make room for the new ones, provided that
+        all of them fit. */
+    if (self->u.ref [0] != 0xff && self->u.ref [0] + n < NN_CHUNKREF_MAX) {
+        memmove (&self->u.ref [1 + n], &self->u.ref [1], self->u.ref [0]);
+        memcpy (&self->u.ref [1], data, n);
+        self->u.ref [0] += (uint8_t) n;
+        return;
+    }
+    if (nn_chunkref_prepend (self, data, n))
+        return;
+
+    sz = nn_chunkref_size (self);
+    nn_chunkref_init_room (&ref, n + sz, NN_CHUNKREF_HEADROOM);
+    memcpy (nn_chunkref_data (&ref), data, n);
+    memcpy (((uint8_t*) nn_chunkref_data (&ref)) + n,
+        nn_chunkref_data (self), sz);
+    nn_chunkref_term (self);
+    nn_chunkref_mv (self, &ref);
+}
+
 void nn_chunkref_bulkcopy_start (struct nn_chunkref *self, uint32_t copies)
 {
     struct nn_chunkref_chunk *ch;
@@ -151,6 +225,6 @@ void nn_chunkref_bulkcopy_start (struct nn_chunkref *self, uint32_t copies)
 
 void nn_chunkref_bulkcopy_cp (struct nn_chunkref *dst, struct nn_chunkref *src)
 {
-    memcpy (dst, src, sizeof (struct nn_chunkref));
+    nn_chunkref_mv (dst, src);
 }
 
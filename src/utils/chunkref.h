@@ -23,7 +23,19 @@
 #ifndef NN_CHUNKREF_INCLUDED
 #define NN_CHUNKREF_INCLUDED
 
+/*  Size of the chunkref, in bytes. Chunks shorter than this are stored
+    inline. Can be overridden at build time, but it must be less than 255.
+    Each message embeds three chunkrefs, so raising it, e.g. to 128 for
+    sockets carrying mostly small messages, grows every message and every
+    queue slot. */
+#ifndef NN_CHUNKREF_MAX
 #define NN_CHUNKREF_MAX 32
+#endif
+
+/*  Number of bytes reserved in front of the data when nn_chunkref_push has
+    to move them into a new chunk, so that the subsequent pushes are done in
+    place. */
+#define NN_CHUNKREF_HEADROOM 64
 
 #include "chunk.h"
 
@@ -32,9 +44,9 @@
 
 /*  This class represents a reference to a data chunk. It's either an actual
     reference to data allocated on the heap, or if short enough, it may store
-    the data in itself. While user messages are not often short enough to store
-    them inside the chunkref itself, SP protocol headers mostly are and thus
-    we can avoid additional memory allocation per message. */
+    the data in itself. SP protocol headers and small user messages (such as
+    typical REQ/REP control traffic) are stored inside the chunkref itself and
+    thus we can avoid additional memory allocation per message. */
 
 struct nn_chunkref {
     union {
@@ -50,6 +62,16 @@ struct nn_chunkref {
     small messages, or will be allocated via nn_chunk object. */
 void nn_chunkref_init (struct nn_chunkref *self, size_t size);
 
+/*  Same as above, except that the chunk, if needed, is allocated using the
+    allocation mechanism specified by 'type' (see nn_chunk_alloc). */
+void nn_chunkref_init_type (struct nn_chunkref *self, size_t size, int type);
+
+/*  Same as nn_chunkref_init, except that if the data don't fit inline,
+    'headroom' bytes are reserved in front of them in the chunk, so that
+    they can be extended by nn_chunkref_push without copying. */
+void nn_chunkref_init_room (struct nn_chunkref *self, size_t size,
+    size_t headroom);
+
 /*  Create a chunkref from an existing chunk object. */
 void nn_chunkref_init_chunk (struct nn_chunkref *self, void *chunk);
 
@@ -60,6 +82,10 @@ void nn_chunkref_term (struct nn_chunkref *self);
     one. Chunkref points to empty chunk after the call. */
 void *nn_chunkref_getchunk (struct nn_chunkref *self);
 
+/*  Same as above, except that the chunk, if it has to be allocated, is
+    allocated using the allocation mechanism specified by 'type'. */
+void *nn_chunkref_getchunk_type (struct nn_chunkref *self, int type);
+
 /*  Moves chunk content from src to dst. dst should not be initialised before
     calling this function. After the call, dst becomes initialised and src
     becomes uninitialised. */
@@ -75,9 +101,28 @@ void *nn_chunkref_data (struct nn_chunkref *self);
 /*  Returns the size of the binary data stored in the chunk. */
 size_t nn_chunkref_size (struct nn_chunkref *self);
 
+/*  Returns 1 if the data are stored in a chunk object, 0 if they are stored
+    inline. */
+int nn_chunkref_ischunk (struct nn_chunkref *self);
+
 /*  Trims n bytes from the beginning of the chunk. */
 void nn_chunkref_trim (struct nn_chunkref *self, size_t n);
 
+/*  Prepends n bytes of data to the chunk without copying the chunk, using
+    the empty space in front of it. Returns 1 on success, 0 if the data are
+    stored inline or there is no room for the new data. */
+int nn_chunkref_prepend (struct nn_chunkref *self, const void *data,
+    size_t n);
+
+/*  Prepends n bytes of data to the chunk. Unlike nn_chunkref_prepend this
+    always succeeds: inline data are moved within the chunkref and chunks
+    use the empty space in front of them if possible. Otherwise the data
+    are copied into a new chunk, with NN_CHUNKREF_HEADROOM bytes reserved in
+    front. Along with nn_chunkref_trim this makes for a stack of fixed-size
+    entries, such as the backtrace of a request, that is pushed to and
+    popped from in place. */
+void nn_chunkref_push (struct nn_chunkref *self, const void *data, size_t n);
+
 /*  Bulk copying is done by first invoking nn_chunkref_bulkcopy_start on the
     source chunk and specifying how many copies of the chunk will be made.
     Then, nn_chunkref_bulkcopy_cp should be used 'copies' of times to make
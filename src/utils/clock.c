@@ -37,18 +37,39 @@
 #include "err.h"
 #include "attr.h"
 
-uint64_t nn_clock_ms (void)
-{
 #if defined NN_HAVE_WINDOWS
 
-    LARGE_INTEGER tps;
+/*  The frequency of the performance counter is fixed at boot, so it is
+    queried only once. Threads racing to initialise it store the same
+    value. */
+static LONGLONG nn_clock_tps;
+
+static uint64_t nn_clock_ticks (LONGLONG *tps)
+{
+    LARGE_INTEGER freq;
     LARGE_INTEGER time;
-    double tpms;
 
-    QueryPerformanceFrequency (&tps);
+    if (nn_slow (!nn_clock_tps)) {
+        QueryPerformanceFrequency (&freq);
+        nn_clock_tps = freq.QuadPart;
+    }
+    *tps = nn_clock_tps;
     QueryPerformanceCounter (&time);
-    tpms = (double) (tps.QuadPart / 1000);
-    return (uint64_t) (time.QuadPart / tpms);
+    return (uint64_t) time.QuadPart;
+}
+
+#endif
+
+uint64_t nn_clock_ms (void)
+{
+#if defined NN_HAVE_WINDOWS
+
+    LONGLONG tps;
+    uint64_t ticks;
+
+    ticks = nn_clock_ticks (&tps);
+    return ticks / (uint64_t) tps * 1000 +
+        ticks % (uint64_t) tps * 1000 / (uint64_t) tps;
 
 #elif defined NN_HAVE_OSX
 
@@ -89,3 +110,103 @@ uint64_t nn_clock_ms (void)
 
 #endif
 }
+
+uint64_t nn_clock_us (void)
+{
+#if defined NN_HAVE_WINDOWS
+
+    LONGLONG tps;
+    uint64_t ticks;
+
+    ticks = nn_clock_ticks (&tps);
+    return ticks / (uint64_t) tps * 1000000 +
+        ticks % (uint64_t) tps * 1000000 / (uint64_t) tps;
+
+#elif defined NN_HAVE_OSX
+
+    static mach_timebase_info_data_t nn_clock_timebase_info;
+    uint64_t ticks;
+
+    /*  If the global timebase info is not initialised yet, init it. */
+    if (nn_slow (!nn_clock_timebase_info.denom))
+        mach_timebase_info (&nn_clock_timebase_info);
+
+    ticks = mach_absolute_time ();
+    return ticks * nn_clock_timebase_info.numer /
+        nn_clock_timebase_info.denom / 1000;
+
+#elif defined NN_HAVE_GETHRTIME
+
+    return gethrtime () / 1000;
+
+#elif defined NN_HAVE_CLOCK_MONOTONIC
+
+    int rc;
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000 + tv.tv_nsec / 1000;
+
+#else
+
+    int rc;
+    struct timeval tv;
+
+    rc = gettimeofday (&tv, NULL);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000 + tv.tv_usec;
+
+#endif
+}
+
+uint64_t nn_clock_ns (void)
+{
+#if defined NN_HAVE_WINDOWS
+
+    LONGLONG tps;
+    uint64_t ticks;
+
+    ticks = nn_clock_ticks (&tps);
+    return ticks / (uint64_t) tps * 1000000000 +
+        ticks % (uint64_t) tps * 1000000000 / (uint64_t) tps;
+
+#elif defined NN_HAVE_OSX
+
+    static mach_timebase_info_data_t nn_clock_timebase_info;
+    uint64_t ticks;
+
+    if (nn_slow (!nn_clock_timebase_info.denom))
+        mach_timebase_info (&nn_clock_timebase_info);
+
+    ticks = mach_absolute_time ();
+    return ticks * nn_clock_timebase_info.numer /
+        nn_clock_timebase_info.denom;
+
+#elif defined NN_HAVE_GETHRTIME
+
+    return gethrtime ();
+
+#elif defined NN_HAVE_CLOCK_MONOTONIC
+
+    int rc;
+    struct timespec tv;
+
+    /*  Where the time stamp counter is reliable, the kernel serves this
+        from the vDSO by reading and scaling the counter, without entering
+        the kernel. */
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_nsec;
+
+#else
+
+    int rc;
+    struct timeval tv;
+
+    rc = gettimeofday (&tv, NULL);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_usec * 1000;
+
+#endif
+}
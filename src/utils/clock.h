@@ -28,5 +28,12 @@
 /*  Returns current time in milliseconds. */
 uint64_t nn_clock_ms (void);
 
+/*  Returns current time in microseconds. */
+uint64_t nn_clock_us (void);
+
+/*  Returns current time in nanoseconds, with the best resolution the system
+    provides. Meant for measuring short intervals. */
+uint64_t nn_clock_ns (void);
+
 #endif
 
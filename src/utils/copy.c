@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "copy.h"
+#include "fast.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NN_COPY_SSE2
+#endif
+
+/*  Bytes copied per iteration and the distance the source is prefetched
+    ahead of the copy. The non-temporal prefetch hint is not used as it
+    makes the copy several times slower once the source doesn't fit in
+    L2. */
+#define NN_COPY_BLOCK 64
+#define NN_COPY_PREFETCH 512
+
+static size_t nn_copy_threshold = NN_COPY_DEFAULT_THRESHOLD;
+
+void nn_copy_init (void)
+{
+    const char *envvar;
+    long val;
+
+    envvar = getenv ("NN_COPY_THRESHOLD");
+    if (!envvar)
+        return;
+    val = atol (envvar);
+    nn_copy_threshold = val > 0 ? (size_t) val : 0;
+}
+
+#if defined NN_COPY_SSE2
+
+static void nn_copy_nt (uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t head;
+    __m128i a;
+    __m128i b;
+    __m128i c;
+    __m128i d;
+
+    /*  Streaming stores need an aligned destination. The head of the copy
+        goes through the cache. */
+    head = (size_t) (-(uintptr_t) dst & 15);
+    if (head > len)
+        head = len;
+    memcpy (dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= NN_COPY_BLOCK; len -= NN_COPY_BLOCK,
+          src += NN_COPY_BLOCK, dst += NN_COPY_BLOCK) {
+        _mm_prefetch ((const char*) src + NN_COPY_PREFETCH, _MM_HINT_T0);
+        a = _mm_loadu_si128 ((const __m128i*) src);
+        b = _mm_loadu_si128 ((const __m128i*) (src + 16));
+        c = _mm_loadu_si128 ((const __m128i*) (src + 32));
+        d = _mm_loadu_si128 ((const __m128i*) (src + 48));
+        _mm_stream_si128 ((__m128i*) dst, a);
+        _mm_stream_si128 ((__m128i*) (dst + 16), b);
+        _mm_stream_si128 ((__m128i*) (dst + 32), c);
+        _mm_stream_si128 ((__m128i*) (dst + 48), d);
+    }
+
+    /*  Streaming stores are weakly ordered. The fence makes them visible
+        before the message is passed to another thread. */
+    _mm_sfence ();
+    memcpy (dst, src, len);
+}
+
+void nn_copy (void *dst, const void *src, size_t len)
+{
+    if (nn_fast (len < nn_copy_threshold || !nn_copy_threshold)) {
+        memcpy (dst, src, len);
+        return;
+    }
+    nn_copy_nt ((uint8_t*) dst, (const uint8_t*) src, len);
+}
+
+#else
+
+void nn_copy (void *dst, const void *src, size_t len)
+{
+    memcpy (dst, src, len);
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_COPY_INCLUDED
+#define NN_COPY_INCLUDED
+
+#include <stddef.h>
+
+/*  Copying of message payloads between the user's buffers and the chunks.
+    Payloads of at least the threshold size are copied with non-temporal
+    stores, which bypass the cache, while the source is prefetched ahead of
+    the copy. A large message copied once and handed over to the peer or to
+    the worker thread then doesn't evict the working set of the small ones.
+    Smaller payloads are copied with memcpy. Non-temporal stores are used
+    if the library is compiled for a CPU with SSE2; elsewhere all payloads
+    are copied with memcpy. */
+
+#define NN_COPY_DEFAULT_THRESHOLD 1048576
+
+/*  Reads the threshold from the NN_COPY_THRESHOLD environment variable.
+    Until it's called, the default is used. */
+void nn_copy_init (void);
+
+/*  Copies 'len' bytes from 'src' to 'dst'. The regions must not overlap. */
+void nn_copy (void *dst, const void *src, size_t len);
+
+#endif
@@ -20,145 +20,229 @@
     IN THE SOFTWARE.
 */
 
+
 #include "hash.h"
 #include "fast.h"
 #include "alloc.h"
-#include "cont.h"
 #include "err.h"
+#include "attr.h"
+
+#include <string.h>
 
 #define NN_HASH_INITIAL_SLOTS 32
 
+/*  Number of slots of the old array processed by each insert or erasure
+    while the table is growing. It has to be high enough for the items to be
+    moved before the new array fills up. */
+#define NN_HASH_MIGRATE_STEP 8
+
 static uint32_t nn_hash_key (uint32_t key);
+static struct nn_hash_slot *nn_hash_alloc (uint32_t slots);
+static struct nn_hash_slot *nn_hash_find (struct nn_hash_slot *array,
+    uint32_t slots, uint32_t key);
+static void nn_hash_place (struct nn_hash_slot *array, uint32_t slots,
+    uint32_t key, struct nn_hash_item *item);
+static void nn_hash_migrate (struct nn_hash *self, uint32_t count);
 
 void nn_hash_init (struct nn_hash *self)
 {
-    uint32_t i;
-
     self->slots = NN_HASH_INITIAL_SLOTS;
     self->items = 0;
-    self->array = nn_alloc (sizeof (struct nn_list) * NN_HASH_INITIAL_SLOTS,
-        "hash map");
-    alloc_assert (self->array);
-    for (i = 0; i != NN_HASH_INITIAL_SLOTS; ++i)
-        nn_list_init (&self->array [i]);
+    self->array = nn_hash_alloc (NN_HASH_INITIAL_SLOTS);
+    self->oldslots = 0;
+    self->olditems = 0;
+    self->migrated = 0;
+    self->oldarray = NULL;
 }
 
 void nn_hash_term (struct nn_hash *self)
 {
-    uint32_t i;
-
-    for (i = 0; i != self->slots; ++i)
-        nn_list_term (&self->array [i]);
+    nn_free (self->oldarray);
     nn_free (self->array);
 }
 
-static void nn_hash_rehash (struct nn_hash *self) {
-    uint32_t i;
-    uint32_t oldslots;
-    struct nn_list *oldarray;
-    struct nn_hash_item *hitm;
-    uint32_t newslot;
-
-    /*  Allocate new double-sized array of slots. */
-    oldslots = self->slots;
-    oldarray = self->array;
-    self->slots *= 2;
-    self->array = nn_alloc (sizeof (struct nn_list) * self->slots, "hash map");
-    alloc_assert (self->array);
-    for (i = 0; i != self->slots; ++i)
-    nn_list_init (&self->array [i]);
-
-    /*  Move the items from old slot array to new slot array. */
-    for (i = 0; i != oldslots; ++i) {
-    while (!nn_list_empty (&oldarray [i])) {
-        hitm = nn_cont (nn_list_begin (&oldarray [i]),
-                struct nn_hash_item, list);
-        nn_list_erase (&oldarray [i], &hitm->list);
-        newslot = nn_hash_key (hitm->key) % self->slots;
-        nn_list_insert (&self->array [newslot], &hitm->list,
-                nn_list_end (&self->array [newslot]));
-    }
-
-    nn_list_term (&oldarray [i]);
-    }
-
-    /*  Deallocate the old array of slots. */
-    nn_free (oldarray);
-}
-
-
 void nn_hash_insert (struct nn_hash *self, uint32_t key,
     struct nn_hash_item *item)
 {
-    struct nn_list_item *it;
-    uint32_t i;
-
-    i = nn_hash_key (key) % self->slots;
+    nn_assert (nn_hash_get (self, key) == NULL);
 
-    for (it = nn_list_begin (&self->array [i]);
-          it != nn_list_end (&self->array [i]);
-          it = nn_list_next (&self->array [i], it))
-        nn_assert (nn_cont (it, struct nn_hash_item, list)->key != key);
+    if (nn_slow (self->oldarray != NULL))
+        nn_hash_migrate (self, NN_HASH_MIGRATE_STEP);
 
     item->key = key;
-    nn_list_insert (&self->array [i], &item->list,
-        nn_list_end (&self->array [i]));
+    nn_hash_place (self->array, self->slots, key, item);
     ++self->items;
 
-    /*  If the hash is getting full, double the amount of slots and
-        re-hash all the items. */
-    if (nn_slow (self->items * 2 > self->slots && self->slots < 0x80000000))
-    nn_hash_rehash(self);
+    /*  If the hash is getting full, double the amount of slots. The items
+        are moved to the new slot array gradually by subsequent operations.
+        If the previous growth is still in progress, finish it first. */
+    if (nn_slow (self->items * 2 > self->slots && self->slots < 0x80000000)) {
+        if (self->oldarray)
+            nn_hash_migrate (self, self->oldslots);
+        self->oldslots = self->slots;
+        self->olditems = self->items;
+        self->migrated = 0;
+        self->oldarray = self->array;
+        self->slots *= 2;
+        self->items = 0;
+        self->array = nn_hash_alloc (self->slots);
+    }
 }
 
 void nn_hash_erase (struct nn_hash *self, struct nn_hash_item *item)
 {
-    uint32_t slot;
+    struct nn_hash_slot *slot;
+    uint32_t i;
+    uint32_t next;
+
+    slot = nn_hash_find (self->array, self->slots, item->key);
+    if (!slot) {
+
+        /*  The item wasn't moved to the new slot array yet. Vacate its
+            slot in the old one. */
+        nn_assert (self->oldarray);
+        slot = nn_hash_find (self->oldarray, self->oldslots, item->key);
+        nn_assert (slot && slot->item == item);
+        slot->item = NULL;
+        --self->olditems;
+        nn_hash_migrate (self, NN_HASH_MIGRATE_STEP);
+        return;
+    }
+    nn_assert (slot->item == item);
+
+    /*  Shift the following items of the cluster one slot back so that
+        there are no holes in it. */
+    i = slot - self->array;
+    for (;;) {
+        next = (i + 1) & (self->slots - 1);
+        if (self->array [next].dist <= 1)
+            break;
+        self->array [i] = self->array [next];
+        --self->array [i].dist;
+        i = next;
+    }
+    self->array [i].item = NULL;
+    self->array [i].dist = 0;
+    --self->items;
 
-    slot = nn_hash_key (item->key) % self->slots;
-    nn_list_erase (&self->array [slot], &item->list);
-	--self->items;
+    if (nn_slow (self->oldarray != NULL))
+        nn_hash_migrate (self, NN_HASH_MIGRATE_STEP);
 }
 
 struct nn_hash_item *nn_hash_get (struct nn_hash *self, uint32_t key)
 {
-    uint32_t slot;
-    struct nn_list_item *it;
-    struct nn_hash_item *item;
-
-    slot = nn_hash_key (key) % self->slots;
-
-    for (it = nn_list_begin (&self->array [slot]);
-          it != nn_list_end (&self->array [slot]);
-          it = nn_list_next (&self->array [slot], it)) {
-        item = nn_cont (it, struct nn_hash_item, list);
-        if (item->key == key)
-            return item;
+    struct nn_hash_slot *slot;
+
+    slot = nn_hash_find (self->array, self->slots, key);
+    if (nn_fast (slot != NULL))
+        return slot->item;
+    if (nn_slow (self->oldarray != NULL)) {
+        slot = nn_hash_find (self->oldarray, self->oldslots, key);
+        if (slot)
+            return slot->item;
     }
 
     return NULL;
 }
 
-uint32_t nn_hash_key (uint32_t key)
+static struct nn_hash_slot *nn_hash_alloc (uint32_t slots)
 {
-    /*  TODO: This is a randomly chosen hashing function. Give some thought
-        to picking a more fitting one. */
-    key = (key ^ 61) ^ (key >> 16);
-    key += key << 3;
-    key = key ^ (key >> 4);
-    key = key * 0x27d4eb2d;
-    key = key ^ (key >> 15);
+    struct nn_hash_slot *array;
+
+    array = nn_alloc (sizeof (struct nn_hash_slot) * slots, "hash map");
+    alloc_assert (array);
+    memset (array, 0, sizeof (struct nn_hash_slot) * slots);
+
+    return array;
+}
+
+static struct nn_hash_slot *nn_hash_find (struct nn_hash_slot *array,
+    uint32_t slots, uint32_t key)
+{
+    uint32_t i;
+    uint32_t dist;
+
+    /*  The keys in a cluster are ordered by their distance from the home
+        slot. Once a slot closer to its home slot than the key would be is
+        found, the key is not in the table. */
+    i = nn_hash_key (key) & (slots - 1);
+    for (dist = 1; array [i].dist >= dist; ++dist) {
+        if (array [i].key == key && array [i].item)
+            return &array [i];
+        i = (i + 1) & (slots - 1);
+    }
+
+    return NULL;
+}
+
+static void nn_hash_place (struct nn_hash_slot *array, uint32_t slots,
+    uint32_t key, struct nn_hash_item *item)
+{
+    uint32_t i;
+    struct nn_hash_slot cur;
+    struct nn_hash_slot tmp;
+
+    /*  Robin Hood insertion: the item takes the slot of any item that is
+        closer to its home slot, and that item moves on instead. */
+    cur.item = item;
+    cur.key = key;
+    cur.dist = 1;
+    i = nn_hash_key (key) & (slots - 1);
+    while (array [i].dist) {
+        if (array [i].dist < cur.dist) {
+            tmp = array [i];
+            array [i] = cur;
+            cur = tmp;
+        }
+        i = (i + 1) & (slots - 1);
+        ++cur.dist;
+    }
+    array [i] = cur;
+}
+
+static void nn_hash_migrate (struct nn_hash *self, uint32_t count)
+{
+    struct nn_hash_slot *slot;
+
+    while (count && self->olditems) {
+        slot = &self->oldarray [self->migrated];
+        if (slot->item) {
+            nn_hash_place (self->array, self->slots, slot->key, slot->item);
+            ++self->items;
+            slot->item = NULL;
+            --self->olditems;
+        }
+        ++self->migrated;
+        --count;
+    }
+
+    if (!self->olditems) {
+        nn_free (self->oldarray);
+        self->oldarray = NULL;
+        self->oldslots = 0;
+        self->migrated = 0;
+    }
+}
+
+static uint32_t nn_hash_key (uint32_t key)
+{
+    /*  Finalizer of MurmurHash3. Keys are typically sequential numbers;
+        it spreads them evenly over the table and every bit of the key
+        affects the low bits of the result that select the slot. */
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
 
     return key;
 }
 
 void nn_hash_item_init (struct nn_hash_item *self)
 {
-    nn_list_item_init (&self->list);
+    self->key = 0xffff;
 }
 
-void nn_hash_item_term (struct nn_hash_item *self)
+void nn_hash_item_term (NN_UNUSED struct nn_hash_item *self)
 {
-    nn_list_item_term (&self->list);
 }
-
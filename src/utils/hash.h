@@ -23,23 +23,46 @@
 #ifndef NN_HASH_INCLUDED
 #define NN_HASH_INCLUDED
 
-#include "list.h"
-
 #include <stddef.h>
 #include <stdint.h>
 
+/*  Open-addressing hash table using Robin Hood hashing. The keys are stored
+    in the slot array along with the pointers to the items, so looking up
+    an item touches a single cache line in the common case. When the table
+    grows, the items are moved to the new slot array a few at a time by
+    the subsequent inserts and erasures rather than all at once. */
+
 /*  Use for initialising a hash item statically. */
-#define NN_HASH_ITEM_INITIALIZER {0xffff, NN_LIST_ITEM_INITILIZER}
+#define NN_HASH_ITEM_INITIALIZER {0xffff}
 
 struct nn_hash_item {
     uint32_t key;
-    struct nn_list_item list;
+};
+
+struct nn_hash_slot {
+    struct nn_hash_item *item;
+    uint32_t key;
+
+    /*  Distance of the slot from the home slot of the key plus one. Zero
+        means the slot has never been used. */
+    uint32_t dist;
 };
 
 struct nn_hash {
+
+    /*  Slot array new items are inserted into. */
     uint32_t slots;
     uint32_t items;
-    struct nn_list *array;
+    struct nn_hash_slot *array;
+
+    /*  Slot array the items are being moved from after the table has grown,
+        NULL if there's none. The slots below 'migrated' were moved already.
+        Slots vacated in this array are not reused; they keep their
+        distance so that lookups don't stop at them. */
+    uint32_t oldslots;
+    uint32_t olditems;
+    uint32_t migrated;
+    struct nn_hash_slot *oldarray;
 };
 
 /*  Initialise the hash table. */
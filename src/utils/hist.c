@@ -0,0 +1,131 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "hist.h"
+#include "err.h"
+#include "attr.h"
+
+#include <string.h>
+
+static int nn_hist_msb (uint64_t val);
+static int nn_hist_bucket (uint64_t val);
+static uint64_t nn_hist_top (int bucket);
+
+void nn_hist_init (struct nn_hist *self)
+{
+    memset (self->counts, 0, sizeof (self->counts));
+    self->count = 0;
+    self->max = 0;
+}
+
+void nn_hist_term (NN_UNUSED struct nn_hist *self)
+{
+}
+
+void nn_hist_record (struct nn_hist *self, uint64_t value)
+{
+    ++self->counts [nn_hist_bucket (value)];
+    ++self->count;
+    if (value > self->max)
+        self->max = value;
+}
+
+uint64_t nn_hist_percentile (struct nn_hist *self, int permille)
+{
+    uint64_t rank;
+    uint64_t seen;
+    uint64_t top;
+    int i;
+
+    nn_assert (permille >= 0 && permille <= 1000);
+
+    if (!self->count)
+        return 0;
+
+    /*  Rank of the value we are looking for, counting from 1. */
+    rank = (self->count * permille + 999) / 1000;
+    if (rank == 0)
+        rank = 1;
+
+    seen = 0;
+    for (i = 0; i != NN_HIST_BUCKETS; ++i) {
+        seen += self->counts [i];
+        if (seen >= rank)
+            break;
+    }
+    nn_assert (i != NN_HIST_BUCKETS);
+
+    top = nn_hist_top (i);
+    return top < self->max ? top : self->max;
+}
+
+static int nn_hist_msb (uint64_t val)
+{
+#if defined __GNUC__ || defined __clang__
+    return 63 - __builtin_clzll (val);
+#else
+    int res;
+
+    res = 0;
+    if (val >> 32) { val >>= 32; res += 32; }
+    if (val >> 16) { val >>= 16; res += 16; }
+    if (val >> 8) { val >>= 8; res += 8; }
+    if (val >> 4) { val >>= 4; res += 4; }
+    if (val >> 2) { val >>= 2; res += 2; }
+    if (val >> 1) { res += 1; }
+    return res;
+#endif
+}
+
+static int nn_hist_bucket (uint64_t val)
+{
+    int msb;
+    int shift;
+
+    if (val < NN_HIST_SUBBUCKETS)
+        return (int) val;
+
+    /*  Values that are too large end up in the last bucket. */
+    msb = nn_hist_msb (val);
+    if (msb >= NN_HIST_MAXBITS)
+        return NN_HIST_BUCKETS - 1;
+
+    /*  The leading bit selects the power of two, the bits that follow it
+        select the bucket within it. */
+    shift = msb - NN_HIST_SUBBITS;
+    return NN_HIST_SUBBUCKETS * (shift + 1) +
+        (int) ((val >> shift) & (NN_HIST_SUBBUCKETS - 1));
+}
+
+static uint64_t nn_hist_top (int bucket)
+{
+    int shift;
+    uint64_t sub;
+
+    if (bucket < NN_HIST_SUBBUCKETS)
+        return bucket;
+
+    shift = bucket / NN_HIST_SUBBUCKETS - 1;
+    sub = bucket % NN_HIST_SUBBUCKETS;
+    return ((NN_HIST_SUBBUCKETS + sub + 1) << shift) - 1;
+}
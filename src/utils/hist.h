@@ -0,0 +1,62 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_HIST_INCLUDED
+#define NN_HIST_INCLUDED
+
+#include <stdint.h>
+
+/*  Log-linear latency histogram in the spirit of HdrHistogram. Values below
+    NN_HIST_SUBBUCKETS are counted exactly. Above that, each power of two is
+    split into NN_HIST_SUBBUCKETS equally sized buckets, so a reported value
+    is never off by more than 1/NN_HIST_SUBBUCKETS of the real one. Values
+    of 2^NN_HIST_MAXBITS and above are counted in the last bucket.
+
+    The histogram is not synchronised; the owner is expected to serialise
+    the updates. */
+
+#define NN_HIST_SUBBITS 2
+#define NN_HIST_SUBBUCKETS (1 << NN_HIST_SUBBITS)
+#define NN_HIST_MAXBITS 40
+#define NN_HIST_BUCKETS \
+    (NN_HIST_SUBBUCKETS * (NN_HIST_MAXBITS - NN_HIST_SUBBITS + 1))
+
+struct nn_hist {
+    uint32_t counts [NN_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+void nn_hist_init (struct nn_hist *self);
+void nn_hist_term (struct nn_hist *self);
+
+/*  Add a single value to the histogram. */
+void nn_hist_record (struct nn_hist *self, uint64_t value);
+
+/*  Returns the value below which the specified fraction of the recorded
+    values lie, in thousandths; e.g. 990 gives the 99th percentile. The
+    value is rounded up to the top of its bucket but never exceeds the
+    maximum value recorded. Returns 0 if the histogram is empty. */
+uint64_t nn_hist_percentile (struct nn_hist *self, int permille);
+
+#endif
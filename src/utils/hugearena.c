@@ -0,0 +1,326 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "hugearena.h"
+#include "err.h"
+#include "attr.h"
+
+#include <stdlib.h>
+
+#if defined NN_HAVE_WINDOWS
+
+int nn_hugearena_init (NN_UNUSED int count)
+{
+    return -ENOTSUP;
+}
+
+void *nn_hugearena_alloc (size_t size, NN_UNUSED void *arg)
+{
+    return malloc (size);
+}
+
+void *nn_hugearena_realloc (void *ptr, size_t size, NN_UNUSED void *arg)
+{
+    return realloc (ptr, size);
+}
+
+void nn_hugearena_free (void *ptr, NN_UNUSED void *arg)
+{
+    free (ptr);
+}
+
+int nn_hugearena_count (int *huge)
+{
+    if (huge)
+        *huge = 0;
+    return 0;
+}
+
+#else
+
+#include "mutex.h"
+#include "fast.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if !defined MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*  Blocks are 2^NN_HUGEARENA_MINSHIFT to 2^NN_HUGEARENA_MAXSHIFT bytes
+    long, header included. */
+#define NN_HUGEARENA_MINSHIFT 6
+#define NN_HUGEARENA_MAXSHIFT 19
+#define NN_HUGEARENA_CLASSES \
+    (NN_HUGEARENA_MAXSHIFT - NN_HUGEARENA_MINSHIFT + 1)
+
+/*  Class of the blocks allocated from the heap. */
+#define NN_HUGEARENA_HEAP NN_HUGEARENA_CLASSES
+
+/*  Every block is preceded by this header. It is two words long so that
+    the blocks are aligned the way malloc aligns them. */
+struct nn_hugearena_hdr {
+    size_t cls;
+    size_t reserved;
+};
+
+/*  Freed blocks are linked through their first word. */
+struct nn_hugearena_block {
+    struct nn_hugearena_block *next;
+};
+
+struct nn_hugearena_class {
+    struct nn_mutex sync;
+    struct nn_hugearena_block *free;
+};
+
+static struct {
+
+    /*  Guards the fields below. Taken before the locks of the classes. */
+    struct nn_mutex sync;
+
+    /*  Part of the current arena not carved into blocks yet. */
+    uint8_t *pos;
+    uint8_t *end;
+
+    /*  Arenas mapped upfront and not used yet, linked through their first
+        word. */
+    struct nn_hugearena_block *spare;
+
+    int count;
+    int huge;
+
+    struct nn_hugearena_class classes [NN_HUGEARENA_CLASSES];
+} nn_hugearena;
+
+/*  Maps a new arena. Returns NULL if the system is out of memory. */
+static uint8_t *nn_hugearena_map (void)
+{
+    uint8_t *base;
+    size_t lead;
+
+#if defined MAP_HUGETLB
+    base = mmap (NULL, NN_HUGEARENA_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) {
+        ++nn_hugearena.count;
+        ++nn_hugearena.huge;
+        return base;
+    }
+#endif
+
+    /*  No huge pages reserved in the system. Transparent huge pages back
+        aligned ranges only, so map twice the size and cut an aligned arena
+        out of it. */
+    base = mmap (NULL, 2 * NN_HUGEARENA_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nn_slow (base == MAP_FAILED))
+        return NULL;
+    lead = (NN_HUGEARENA_SIZE -
+        ((uintptr_t) base & (NN_HUGEARENA_SIZE - 1))) &
+        (NN_HUGEARENA_SIZE - 1);
+    if (lead)
+        munmap (base, lead);
+    munmap (base + lead + NN_HUGEARENA_SIZE, NN_HUGEARENA_SIZE - lead);
+    base += lead;
+#if defined MADV_HUGEPAGE
+    madvise (base, NN_HUGEARENA_SIZE, MADV_HUGEPAGE);
+#endif
+    ++nn_hugearena.count;
+    return base;
+}
+
+static void nn_hugearena_push (int cls, void *block)
+{
+    struct nn_hugearena_class *self;
+
+    self = &nn_hugearena.classes [cls];
+    nn_mutex_lock (&self->sync);
+    ((struct nn_hugearena_block*) block)->next = self->free;
+    self->free = block;
+    nn_mutex_unlock (&self->sync);
+}
+
+/*  Carves a block of the given class from the current arena, starting
+    a new one if needed. Returns NULL if no arena can be mapped. */
+static void *nn_hugearena_carve (int cls)
+{
+    size_t size;
+    size_t rest;
+    uint8_t *arena;
+    uint8_t *block;
+    int i;
+
+    size = (size_t) 1 << (cls + NN_HUGEARENA_MINSHIFT);
+    nn_mutex_lock (&nn_hugearena.sync);
+    if (nn_slow ((size_t) (nn_hugearena.end - nn_hugearena.pos) < size)) {
+        if (nn_hugearena.spare) {
+            arena = (uint8_t*) nn_hugearena.spare;
+            nn_hugearena.spare = nn_hugearena.spare->next;
+        }
+        else {
+            arena = nn_hugearena_map ();
+            if (nn_slow (!arena)) {
+                nn_mutex_unlock (&nn_hugearena.sync);
+                return NULL;
+            }
+        }
+
+        /*  Rather than wasting the rest of the old arena, make it into
+            free blocks of the smaller classes. */
+        rest = nn_hugearena.end - nn_hugearena.pos;
+        for (i = cls - 1; i >= 0; --i) {
+            size = (size_t) 1 << (i + NN_HUGEARENA_MINSHIFT);
+            if (rest >= size) {
+                nn_hugearena_push (i, nn_hugearena.pos);
+                nn_hugearena.pos += size;
+                rest -= size;
+            }
+        }
+
+        nn_hugearena.pos = arena;
+        nn_hugearena.end = arena + NN_HUGEARENA_SIZE;
+        size = (size_t) 1 << (cls + NN_HUGEARENA_MINSHIFT);
+    }
+    block = nn_hugearena.pos;
+    nn_hugearena.pos += size;
+    nn_mutex_unlock (&nn_hugearena.sync);
+    return block;
+}
+
+int nn_hugearena_init (int count)
+{
+    int i;
+    long pagesize;
+    size_t j;
+    uint8_t *arena;
+
+    nn_mutex_init (&nn_hugearena.sync);
+    for (i = 0; i != NN_HUGEARENA_CLASSES; ++i)
+        nn_mutex_init (&nn_hugearena.classes [i].sync);
+
+    /*  Touch every page of the arenas mapped upfront, so that they are
+        faulted in now rather than when they are first used. */
+    pagesize = sysconf (_SC_PAGESIZE);
+    if (pagesize <= 0)
+        pagesize = 4096;
+    for (i = 0; i != count; ++i) {
+        arena = nn_hugearena_map ();
+        if (!arena)
+            break;
+        for (j = 0; j < NN_HUGEARENA_SIZE; j += (size_t) pagesize)
+            ((volatile uint8_t*) arena) [j] = 0;
+        ((struct nn_hugearena_block*) arena)->next = nn_hugearena.spare;
+        nn_hugearena.spare = (struct nn_hugearena_block*) arena;
+    }
+    return 0;
+}
+
+void *nn_hugearena_alloc (size_t size, NN_UNUSED void *arg)
+{
+    struct nn_hugearena_hdr *hdr;
+    struct nn_hugearena_class *self;
+    int cls;
+
+    size += sizeof (struct nn_hugearena_hdr);
+    hdr = NULL;
+    if (nn_fast (size <= (size_t) 1 << NN_HUGEARENA_MAXSHIFT)) {
+        for (cls = 0; ((size_t) 1 << (cls + NN_HUGEARENA_MINSHIFT)) < size;
+              ++cls);
+        self = &nn_hugearena.classes [cls];
+        nn_mutex_lock (&self->sync);
+        if (self->free) {
+            hdr = (struct nn_hugearena_hdr*) self->free;
+            self->free = self->free->next;
+        }
+        nn_mutex_unlock (&self->sync);
+        if (!hdr)
+            hdr = nn_hugearena_carve (cls);
+    }
+    if (nn_slow (!hdr)) {
+        cls = NN_HUGEARENA_HEAP;
+        hdr = malloc (size);
+        if (nn_slow (!hdr))
+            return NULL;
+    }
+    hdr->cls = cls;
+    return hdr + 1;
+}
+
+void *nn_hugearena_realloc (void *ptr, size_t size, void *arg)
+{
+    struct nn_hugearena_hdr *hdr;
+    size_t capacity;
+    void *newptr;
+
+    if (!ptr)
+        return nn_hugearena_alloc (size, arg);
+
+    hdr = ((struct nn_hugearena_hdr*) ptr) - 1;
+    if (hdr->cls == NN_HUGEARENA_HEAP) {
+        hdr = realloc (hdr, sizeof (struct nn_hugearena_hdr) + size);
+        return hdr ? hdr + 1 : NULL;
+    }
+
+    /*  The block may be large enough already. */
+    capacity = ((size_t) 1 << (hdr->cls + NN_HUGEARENA_MINSHIFT)) -
+        sizeof (struct nn_hugearena_hdr);
+    if (size <= capacity)
+        return ptr;
+    newptr = nn_hugearena_alloc (size, arg);
+    if (nn_slow (!newptr))
+        return NULL;
+    memcpy (newptr, ptr, capacity);
+    nn_hugearena_free (ptr, arg);
+    return newptr;
+}
+
+void nn_hugearena_free (void *ptr, NN_UNUSED void *arg)
+{
+    struct nn_hugearena_hdr *hdr;
+
+    if (!ptr)
+        return;
+    hdr = ((struct nn_hugearena_hdr*) ptr) - 1;
+    if (hdr->cls == NN_HUGEARENA_HEAP) {
+        free (hdr);
+        return;
+    }
+    nn_hugearena_push ((int) hdr->cls, hdr);
+}
+
+int nn_hugearena_count (int *huge)
+{
+    int count;
+
+    nn_mutex_lock (&nn_hugearena.sync);
+    count = nn_hugearena.count;
+    if (huge)
+        *huge = nn_hugearena.huge;
+    nn_mutex_unlock (&nn_hugearena.sync);
+    return count;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_HUGEARENA_INCLUDED
+#define NN_HUGEARENA_INCLUDED
+
+#include <stddef.h>
+
+/*  Memory allocator carving blocks out of 2MB arenas, each backed by a huge
+    page if the system provides one, or by transparent huge pages otherwise.
+    Blocks are rounded up to a power of two and freed blocks are kept for
+    reuse by blocks of the same size, so the arenas are never returned to
+    the system. Blocks too large to be carved from an arena, as well as any
+    allocation made when the system runs out of arenas, come from the heap
+    instead. Serves the classes of memory the message paths churn through,
+    so that they touch fewer pages and the page faults are paid for upfront
+    rather than while the traffic flows. */
+
+/*  Size of an arena. */
+#define NN_HUGEARENA_SIZE ((size_t) 2 * 1024 * 1024)
+
+/*  Maps 'count' arenas upfront and faults their pages in. Arenas beyond
+    those are mapped on demand. Must be called before the allocator is used.
+    Returns -ENOTSUP if the platform has no support for the allocator. */
+int nn_hugearena_init (int count);
+
+/*  The allocator interface as in struct nn_allocator. */
+void *nn_hugearena_alloc (size_t size, void *arg);
+void *nn_hugearena_realloc (void *ptr, size_t size, void *arg);
+void nn_hugearena_free (void *ptr, void *arg);
+
+/*  Returns the number of arenas mapped so far and, in 'huge', the number of
+    those backed by explicitly allocated huge pages. */
+int nn_hugearena_count (int *huge);
+
+#endif
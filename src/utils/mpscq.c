@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+
+#include "mpscq.h"
+#include "err.h"
+#include "fast.h"
+
+void nn_mpscq_init (struct nn_mpscq *self)
+{
+    nn_atomic_ptr_init (&self->head, NULL);
+}
+
+void nn_mpscq_term (struct nn_mpscq *self)
+{
+    nn_atomic_ptr_term (&self->head);
+}
+
+int nn_mpscq_push (struct nn_mpscq *self, struct nn_queue_item *item)
+{
+    struct nn_queue_item *old;
+    struct nn_queue_item *cur;
+
+    nn_assert (item->next == NN_QUEUE_NOTINQUEUE);
+
+    old = nn_atomic_ptr_load (&self->head);
+    while (1) {
+        item->next = old;
+        cur = nn_atomic_ptr_cas (&self->head, old, item);
+        if (nn_fast (cur == old))
+            break;
+        old = cur;
+    }
+
+    return old ? 0 : 1;
+}
+
+int nn_mpscq_empty (struct nn_mpscq *self)
+{
+    return nn_atomic_ptr_load (&self->head) ? 0 : 1;
+}
+
+void nn_mpscq_drain (struct nn_mpscq *self, struct nn_queue *queue)
+{
+    struct nn_queue_item *items;
+    struct nn_queue_item *prev;
+    struct nn_queue_item *next;
+
+    /*  Grab all the items at once. */
+    items = nn_atomic_ptr_swap (&self->head, NULL);
+
+    /*  The items are in reverse order. Reverse the list and move the items
+        to the queue one by one. */
+    prev = NULL;
+    while (items) {
+        next = items->next;
+        items->next = prev;
+        prev = items;
+        items = next;
+    }
+    while (prev) {
+        next = prev->next;
+        prev->next = NN_QUEUE_NOTINQUEUE;
+        nn_queue_push (queue, prev);
+        prev = next;
+    }
+}
+
@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MPSCQ_INCLUDED
+#define NN_MPSCQ_INCLUDED
+
+#include "atomic.h"
+#include "queue.h"
+
+/*  Intrusive multi-producer, single-consumer queue. Producers push items
+    without locking. The consumer takes all the items at once and gets them
+    in the order they were pushed. Items are ordinary nn_queue_items so that
+    they can be moved to an nn_queue without copying. */
+
+struct nn_mpscq {
+
+    /*  Items pushed so far, last pushed item first. */
+    struct nn_atomic_ptr head;
+};
+
+/*  Initialise the queue. */
+void nn_mpscq_init (struct nn_mpscq *self);
+
+/*  Terminate the queue. Note that queue must be manually emptied before the
+    termination. */
+void nn_mpscq_term (struct nn_mpscq *self);
+
+/*  Inserts one element into the queue. Can be called from any thread.
+    Returns 1 if the queue was empty before the call, 0 otherwise. */
+int nn_mpscq_push (struct nn_mpscq *self, struct nn_queue_item *item);
+
+/*  Returns 1 if there are no items in the queue, 0 otherwise. By the time
+    it returns, an item may have been pushed already. */
+int nn_mpscq_empty (struct nn_mpscq *self);
+
+/*  Moves all the items from the queue to the end of 'queue', preserving
+    their order. If several threads drain the queue in parallel, each item
+    is moved by exactly one of them. */
+void nn_mpscq_drain (struct nn_mpscq *self, struct nn_queue *queue);
+
+#endif
+
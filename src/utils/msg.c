@@ -21,14 +21,46 @@
 */
 
 #include "msg.h"
+#include "fast.h"
+#include "err.h"
+#include "closefd.h"
+
+#include "../nn.h"
+#include "../ipc.h"
 
 #include <string.h>
 
+#if !defined NN_HAVE_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*  Returns the property of the given level and type at or after 'offset' in
+    the headers and updates 'offset' to point behind it. Returns NULL if
+    there's none. */
+static struct nn_cmsghdr *nn_msg_nextprop (struct nn_msg *self,
+    size_t *offset, int level, int type);
+
 void nn_msg_init (struct nn_msg *self, size_t size)
 {
     nn_chunkref_init (&self->sphdr, 0);
     nn_chunkref_init (&self->hdrs, 0);
     nn_chunkref_init (&self->body, size);
+    self->nparts = 0;
+    self->rcvtime = 0;
+    self->expiry = 0;
+    self->urgent = 0;
+}
+
+void nn_msg_init_type (struct nn_msg *self, size_t size, int type)
+{
+    nn_chunkref_init (&self->sphdr, 0);
+    nn_chunkref_init (&self->hdrs, 0);
+    nn_chunkref_init_type (&self->body, size, type);
+    self->nparts = 0;
+    self->rcvtime = 0;
+    self->expiry = 0;
+    self->urgent = 0;
 }
 
 void nn_msg_init_chunk (struct nn_msg *self, void *chunk)
@@ -36,13 +68,21 @@ void nn_msg_init_chunk (struct nn_msg *self, void *chunk)
     nn_chunkref_init (&self->sphdr, 0);
     nn_chunkref_init (&self->hdrs, 0);
     nn_chunkref_init_chunk (&self->body, chunk);
+    self->nparts = 0;
+    self->rcvtime = 0;
+    self->expiry = 0;
+    self->urgent = 0;
 }
 
 void nn_msg_term (struct nn_msg *self)
 {
+    int i;
+
     nn_chunkref_term (&self->sphdr);
     nn_chunkref_term (&self->hdrs);
     nn_chunkref_term (&self->body);
+    for (i = 0; i != self->nparts; ++i)
+        nn_chunk_free (self->parts [i]);
 }
 
 void nn_msg_mv (struct nn_msg *dst, struct nn_msg *src)
@@ -50,20 +90,38 @@ void nn_msg_mv (struct nn_msg *dst, struct nn_msg *src)
     nn_chunkref_mv (&dst->sphdr, &src->sphdr);
     nn_chunkref_mv (&dst->hdrs, &src->hdrs);
     nn_chunkref_mv (&dst->body, &src->body);
+    dst->nparts = src->nparts;
+    memcpy (dst->parts, src->parts, src->nparts * sizeof (void*));
+    dst->rcvtime = src->rcvtime;
+    dst->expiry = src->expiry;
+    dst->urgent = src->urgent;
 }
 
 void nn_msg_cp (struct nn_msg *dst, struct nn_msg *src)
 {
+    int i;
+
     nn_chunkref_cp (&dst->sphdr, &src->sphdr);
     nn_chunkref_cp (&dst->hdrs, &src->hdrs);
     nn_chunkref_cp (&dst->body, &src->body);
+    for (i = 0; i != src->nparts; ++i)
+        nn_chunk_addref (src->parts [i], 1);
+    dst->nparts = src->nparts;
+    memcpy (dst->parts, src->parts, src->nparts * sizeof (void*));
+    dst->rcvtime = src->rcvtime;
+    dst->expiry = src->expiry;
+    dst->urgent = src->urgent;
 }
 
 void nn_msg_bulkcopy_start (struct nn_msg *self, uint32_t copies)
 {
+    int i;
+
     nn_chunkref_bulkcopy_start (&self->sphdr, copies);
     nn_chunkref_bulkcopy_start (&self->hdrs, copies);
     nn_chunkref_bulkcopy_start (&self->body, copies);
+    for (i = 0; i != self->nparts; ++i)
+        nn_chunk_addref (self->parts [i], copies);
 }
 
 void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src)
@@ -71,11 +129,312 @@ void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src)
     nn_chunkref_bulkcopy_cp (&dst->sphdr, &src->sphdr);
     nn_chunkref_bulkcopy_cp (&dst->hdrs, &src->hdrs);
     nn_chunkref_bulkcopy_cp (&dst->body, &src->body);
+    dst->nparts = src->nparts;
+    memcpy (dst->parts, src->parts, src->nparts * sizeof (void*));
+    dst->rcvtime = src->rcvtime;
+    dst->expiry = src->expiry;
+    dst->urgent = src->urgent;
+}
+
+size_t nn_msg_bodysize (struct nn_msg *self)
+{
+    int i;
+    size_t sz;
+
+    sz = nn_chunkref_size (&self->body);
+    for (i = 0; i != self->nparts; ++i)
+        sz += nn_chunk_size (self->parts [i]);
+    return sz;
+}
+
+int nn_msg_addpart (struct nn_msg *self, void *chunk)
+{
+    if (nn_slow (self->nparts == NN_MSG_MAXPARTS))
+        return -EMSGSIZE;
+    self->parts [self->nparts++] = chunk;
+    return 0;
+}
+
+void nn_msg_flatten (struct nn_msg *self)
+{
+    int i;
+    size_t sz;
+    uint8_t *pos;
+    struct nn_chunkref body;
+
+    if (nn_fast (!self->nparts))
+        return;
+
+    nn_chunkref_init (&body, nn_msg_bodysize (self));
+    pos = nn_chunkref_data (&body);
+    sz = nn_chunkref_size (&self->body);
+    memcpy (pos, nn_chunkref_data (&self->body), sz);
+    pos += sz;
+    for (i = 0; i != self->nparts; ++i) {
+        sz = nn_chunk_size (self->parts [i]);
+        memcpy (pos, self->parts [i], sz);
+        pos += sz;
+        nn_chunk_free (self->parts [i]);
+    }
+    self->nparts = 0;
+    nn_chunkref_term (&self->body);
+    nn_chunkref_mv (&self->body, &body);
+}
+
+int nn_msg_fds (struct nn_msg *self, int **fds)
+{
+    size_t offset;
+    struct nn_cmsghdr *cmsg;
+
+    if (nn_fast (nn_chunkref_size (&self->hdrs) == 0))
+        return 0;
+    offset = 0;
+    cmsg = nn_msg_nextprop (self, &offset, NN_IPC, NN_IPC_FDS);
+    if (!cmsg)
+        return 0;
+    *fds = (int*) NN_CMSG_DATA (cmsg);
+    return (int) ((cmsg->cmsg_len - NN_CMSG_LEN (0)) / sizeof (int));
+}
+
+void nn_msg_closefds (struct nn_msg *self, size_t keep)
+{
+#if !defined NN_HAVE_WINDOWS
+    size_t offset;
+    struct nn_cmsghdr *cmsg;
+    int *fds;
+    size_t nfds;
+    size_t i;
+
+    if (nn_fast (nn_chunkref_size (&self->hdrs) == 0))
+        return;
+    offset = 0;
+    while ((cmsg = nn_msg_nextprop (self, &offset, NN_IPC, NN_IPC_FDS)) != NULL) {
+        if ((size_t) ((uint8_t*) cmsg -
+              (uint8_t*) nn_chunkref_data (&self->hdrs)) +
+              cmsg->cmsg_len <= keep)
+            continue;
+        fds = (int*) NN_CMSG_DATA (cmsg);
+        nfds = (cmsg->cmsg_len - NN_CMSG_LEN (0)) / sizeof (int);
+        for (i = 0; i != nfds; ++i)
+            nn_closefd (fds [i]);
+    }
+#endif
+}
+
+int nn_msg_file (struct nn_msg *self, struct nn_file_region *region)
+{
+    size_t offset;
+    struct nn_cmsghdr *cmsg;
+
+    if (nn_fast (nn_chunkref_size (&self->hdrs) == 0))
+        return 0;
+    offset = 0;
+    cmsg = nn_msg_nextprop (self, &offset, NN_SOL_SOCKET, NN_FILE_REGION);
+    if (!cmsg || cmsg->cmsg_len != NN_CMSG_LEN (sizeof (*region)))
+        return 0;
+    if (region)
+        memcpy (region, NN_CMSG_DATA (cmsg), sizeof (*region));
+    return 1;
+}
+
+int nn_msg_dupfile (struct nn_msg *self)
+{
+#if defined NN_HAVE_WINDOWS
+    return -ENOTSUP;
+#else
+    struct nn_file_region region;
+    struct nn_chunkref hdrs;
+    struct nn_cmsghdr *cmsg;
+
+    if (!nn_msg_file (self, &region))
+        return 0;
+    region.fd = fcntl (region.fd, F_DUPFD_CLOEXEC, 0);
+    if (nn_slow (region.fd < 0))
+        return -errno;
+
+    /*  Headers may be shared by several copies of the message, so they are
+        replaced rather than modified in place. Other properties aren't of
+        any use to the transport anyway. */
+    nn_chunkref_init (&hdrs, NN_CMSG_SPACE (sizeof (region)));
+    memset (nn_chunkref_data (&hdrs), 0, nn_chunkref_size (&hdrs));
+    cmsg = (struct nn_cmsghdr*) nn_chunkref_data (&hdrs);
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (region));
+    cmsg->cmsg_level = NN_SOL_SOCKET;
+    cmsg->cmsg_type = NN_FILE_REGION;
+    memcpy (NN_CMSG_DATA (cmsg), &region, sizeof (region));
+    nn_chunkref_term (&self->hdrs);
+    nn_chunkref_mv (&self->hdrs, &hdrs);
+    return 0;
+#endif
+}
+
+void nn_msg_closefile (struct nn_msg *self)
+{
+#if !defined NN_HAVE_WINDOWS
+    struct nn_file_region region;
+
+    if (nn_msg_file (self, &region))
+        nn_closefd (region.fd);
+#endif
+}
+
+int nn_msg_loadfile (struct nn_msg *self)
+{
+#if defined NN_HAVE_WINDOWS
+    return -ENOTSUP;
+#else
+    size_t offset;
+    struct nn_cmsghdr *cmsg;
+    struct nn_file_region region;
+    struct nn_chunkref hdrs;
+    void *chunk;
+    uint8_t *pos;
+    size_t len;
+    size_t done;
+    ssize_t nbytes;
+    int rc;
+
+    offset = 0;
+    cmsg = nn_msg_nextprop (self, &offset, NN_SOL_SOCKET, NN_FILE_REGION);
+    if (!cmsg || cmsg->cmsg_len != NN_CMSG_LEN (sizeof (region)))
+        return 0;
+    memcpy (&region, NN_CMSG_DATA (cmsg), sizeof (region));
+
+    /*  Read the region into a new part of the payload. */
+    rc = nn_chunk_alloc ((size_t) region.length, 0, &chunk);
+    if (nn_slow (rc < 0))
+        return rc;
+    done = 0;
+    while (done != region.length) {
+        nbytes = pread (region.fd, (uint8_t*) chunk + done,
+            (size_t) region.length - done, (off_t) (region.offset + done));
+        if (nbytes < 0 && errno == EINTR)
+            continue;
+        if (nn_slow (nbytes <= 0)) {
+            nn_chunk_free (chunk);
+            return -EIO;
+        }
+        done += (size_t) nbytes;
+    }
+    if (self->nparts == NN_MSG_MAXPARTS)
+        nn_msg_flatten (self);
+    rc = nn_msg_addpart (self, chunk);
+    errnum_assert (rc == 0, -rc);
+
+    /*  Drop the property from a private copy of the headers. */
+    pos = nn_chunkref_data (&self->hdrs);
+    len = offset - ((uint8_t*) cmsg - pos);
+    nn_chunkref_init (&hdrs, nn_chunkref_size (&self->hdrs) - len);
+    memcpy (nn_chunkref_data (&hdrs), pos, offset - len);
+    memcpy ((uint8_t*) nn_chunkref_data (&hdrs) + offset - len,
+        pos + offset, nn_chunkref_size (&self->hdrs) - offset);
+    nn_chunkref_term (&self->hdrs);
+    nn_chunkref_mv (&self->hdrs, &hdrs);
+    return 0;
+#endif
+}
+
+int nn_msg_piece (struct nn_msg *self, struct nn_msg_piece *piece)
+{
+    size_t offset;
+    struct nn_cmsghdr *cmsg;
+
+    if (nn_fast (nn_chunkref_size (&self->hdrs) == 0))
+        return 0;
+    offset = 0;
+    cmsg = nn_msg_nextprop (self, &offset, NN_SOL_SOCKET, NN_MSG_PIECE);
+    if (!cmsg || cmsg->cmsg_len != NN_CMSG_LEN (sizeof (*piece)))
+        return 0;
+    if (piece)
+        memcpy (piece, NN_CMSG_DATA (cmsg), sizeof (*piece));
+    return 1;
+}
+
+void nn_msg_setpiece (struct nn_msg *self, const struct nn_msg_piece *piece)
+{
+    struct nn_cmsghdr *cmsg;
+
+    nn_chunkref_term (&self->hdrs);
+    nn_chunkref_init (&self->hdrs, NN_CMSG_SPACE (sizeof (*piece)));
+    memset (nn_chunkref_data (&self->hdrs), 0,
+        nn_chunkref_size (&self->hdrs));
+    cmsg = (struct nn_cmsghdr*) nn_chunkref_data (&self->hdrs);
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (*piece));
+    cmsg->cmsg_level = NN_SOL_SOCKET;
+    cmsg->cmsg_type = NN_MSG_PIECE;
+    memcpy (NN_CMSG_DATA (cmsg), piece, sizeof (*piece));
+}
+
+void nn_msg_addtimestamp (struct nn_msg *self, uint64_t tstamp)
+{
+    struct nn_chunkref hdrs;
+    size_t size;
+    struct nn_cmsghdr *cmsg;
+
+    /*  Headers may be shared by several copies of the message, so the
+        property is added to a private copy of them. */
+    size = nn_chunkref_size (&self->hdrs);
+    nn_chunkref_init (&hdrs, size + NN_CMSG_SPACE (sizeof (tstamp)));
+    memcpy (nn_chunkref_data (&hdrs), nn_chunkref_data (&self->hdrs), size);
+    cmsg = (struct nn_cmsghdr*) ((uint8_t*) nn_chunkref_data (&hdrs) + size);
+    memset (cmsg, 0, NN_CMSG_SPACE (sizeof (tstamp)));
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (tstamp));
+    cmsg->cmsg_level = NN_SOL_SOCKET;
+    cmsg->cmsg_type = NN_MSG_TIMESTAMP;
+    memcpy (NN_CMSG_DATA (cmsg), &tstamp, sizeof (tstamp));
+    nn_chunkref_term (&self->hdrs);
+    nn_chunkref_mv (&self->hdrs, &hdrs);
+}
+
+static struct nn_cmsghdr *nn_msg_nextprop (struct nn_msg *self,
+    size_t *offset, int level, int type)
+{
+    uint8_t *pos;
+    size_t size;
+    size_t len;
+    struct nn_cmsghdr *cmsg;
+
+    pos = (uint8_t*) nn_chunkref_data (&self->hdrs) + *offset;
+    size = nn_chunkref_size (&self->hdrs) - *offset;
+    while (size >= NN_CMSG_SPACE (0)) {
+        cmsg = (struct nn_cmsghdr*) pos;
+        if (nn_slow (cmsg->cmsg_len < NN_CMSG_LEN (0) ||
+              cmsg->cmsg_len > size))
+            return NULL;
+        len = NN_CMSG_ALIGN_ (cmsg->cmsg_len);
+        if (len > size)
+            len = size;
+        *offset += len;
+        if (cmsg->cmsg_level == level && cmsg->cmsg_type == type)
+            return cmsg;
+        pos += len;
+        size -= len;
+    }
+    return NULL;
 }
 
 void nn_msg_replace_body (struct nn_msg *self, struct nn_chunkref new_body) 
 {
+    int i;
+
     nn_chunkref_term (&self->body);
     self->body = new_body;
+    for (i = 0; i != self->nparts; ++i)
+        nn_chunk_free (self->parts [i]);
+    self->nparts = 0;
+    self->rcvtime = 0;
 }
 
+void nn_msg_frame_init (struct nn_msg_frame *self)
+{
+    self->alg = 0;
+    self->compressed = NULL;
+    self->crcalg = -1;
+    self->crc = 0;
+}
+
+void nn_msg_frame_term (struct nn_msg_frame *self)
+{
+    if (self->compressed)
+        nn_chunk_free (self->compressed);
+}
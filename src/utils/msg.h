@@ -26,6 +26,13 @@
 #include "chunkref.h"
 
 #include <stddef.h>
+#include <stdint.h>
+
+struct nn_file_region;
+struct nn_msg_piece;
+
+/*  Maximum number of additional body parts of a message. */
+#define NN_MSG_MAXPARTS 7
 
 struct nn_msg {
 
@@ -40,11 +47,57 @@ struct nn_msg {
 
     /*  Contains application level message payload. */
     struct nn_chunkref body;
+
+    /*  Chunks of a multi-part payload that follow the body. They are passed
+        down the stack as they are so that the transports can send the whole
+        message without copying it into a single buffer. */
+    int nparts;
+    void *parts [NN_MSG_MAXPARTS];
+
+    /*  Time the message was received from the network, in microseconds
+        (see nn_clock_us), or 0 if the transport doesn't record it. */
+    uint64_t rcvtime;
+
+    /*  Time after which the message is not worth delivering any more, in
+        microseconds (see nn_clock_us), or 0 if it never expires. It is only
+        honoured within the process, it's not passed over the network. */
+    uint64_t expiry;
+
+    /*  1 if the message should overtake the ordinary messages queued on
+        the same connection (see NN_MSG_URGENT), 0 otherwise. */
+    int urgent;
 };
 
+/*  The parts of the wire framing of a message that don't depend on the
+    connection it's sent over. When the same message is sent to several
+    pipes at once (see nn_dist_send), the first pipe to work one of them out
+    stores it here and the others reuse it. It's only valid while the
+    message is being passed to the pipes and it's never used for messages
+    with transport headers. */
+struct nn_msg_frame {
+
+    /*  Algorithm the message was compressed with, 0 if no pipe tried yet,
+        and the compressed body, NULL if it wasn't worth compressing. The
+        frame holds a reference to the body. */
+    int alg;
+    void *compressed;
+
+    /*  CRC-32C of the payload of the frame and the algorithm the payload
+        was compressed with, 0 for none, or -1 if it wasn't computed yet. */
+    int crcalg;
+    uint32_t crc;
+};
+
+void nn_msg_frame_init (struct nn_msg_frame *self);
+void nn_msg_frame_term (struct nn_msg_frame *self);
+
 /*  Initialises a message with body 'size' bytes long and empty header. */
 void nn_msg_init (struct nn_msg *self, size_t size);
 
+/*  Same as above, except that the body is allocated using the allocation
+    mechanism specified by 'type' (see nn_chunk_alloc). */
+void nn_msg_init_type (struct nn_msg *self, size_t size, int type);
+
 /*  Initialise message with body provided in the form of chunk pointer. */
 void nn_msg_init_chunk (struct nn_msg *self, void *chunk);
 
@@ -68,6 +121,61 @@ void nn_msg_cp (struct nn_msg *dst, struct nn_msg *src);
 void nn_msg_bulkcopy_start (struct nn_msg *self, uint32_t copies);
 void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src);
 
+/*  Returns size of the message payload, i.e. size of the body and all
+    the parts that follow it. */
+size_t nn_msg_bodysize (struct nn_msg *self);
+
+/*  Appends a chunk to the message payload. The message takes ownership of
+    the chunk. Returns -EMSGSIZE if there are too many parts already. */
+int nn_msg_addpart (struct nn_msg *self, void *chunk);
+
+/*  Copies all the parts of the payload into the body, so that the payload
+    is contiguous. Layers that need to parse or modify the payload have to
+    call this function first. */
+void nn_msg_flatten (struct nn_msg *self);
+
+/*  Looks for the NN_IPC_FDS property among the message headers (see
+    nn_ipc(7)). If found, stores the location of the file descriptors it
+    carries in 'fds' and returns their number. Returns 0 otherwise. */
+int nn_msg_fds (struct nn_msg *self, int **fds);
+
+/*  Closes the file descriptors carried by the NN_IPC_FDS properties among
+    the message headers, except for those in the properties that fit in
+    the first 'keep' bytes of the headers. Used for the descriptors that
+    aren't handed over to the user. */
+void nn_msg_closefds (struct nn_msg *self, size_t keep);
+
+/*  Looks for the NN_FILE_REGION property among the message headers. If
+    found, copies it into 'region', unless it's NULL, and returns 1. Returns
+    0 otherwise. */
+int nn_msg_file (struct nn_msg *self, struct nn_file_region *region);
+
+/*  Replaces the message headers by the NN_FILE_REGION property alone,
+    referring to a duplicate of the file descriptor so that the region can
+    be sent after the user closed the original one. The duplicate has to be
+    closed by nn_msg_closefile. Returns -errno if the descriptor can't be
+    duplicated. */
+int nn_msg_dupfile (struct nn_msg *self);
+
+/*  Closes the file descriptor of the NN_FILE_REGION property, if any. */
+void nn_msg_closefile (struct nn_msg *self);
+
+/*  Reads the region of the file described by the NN_FILE_REGION property
+    into a new part of the payload and removes the property. For transports
+    that aren't able to send the region as it is. */
+int nn_msg_loadfile (struct nn_msg *self);
+
+/*  Looks for the NN_MSG_PIECE property among the message headers. If
+    found, copies it into 'piece', unless it's NULL, and returns 1. Returns
+    0 otherwise. */
+int nn_msg_piece (struct nn_msg *self, struct nn_msg_piece *piece);
+
+/*  Replaces the message headers by the NN_MSG_PIECE property alone. */
+void nn_msg_setpiece (struct nn_msg *self, const struct nn_msg_piece *piece);
+
+/*  Appends the NN_MSG_TIMESTAMP property to the message headers. */
+void nn_msg_addtimestamp (struct nn_msg *self, uint64_t tstamp);
+
 /** Replaces the message body with entirely new data.  This allows protocols
     that substantially rewrite or preprocess the userland message to be written. */
 void nn_msg_replace_body(struct nn_msg *self, struct nn_chunkref newBody);
@@ -26,12 +26,46 @@
 
 #include <stdlib.h>
 
+/*  Tells the CPU that the thread is busy-waiting. */
+#if defined NN_HAVE_WINDOWS
+#define nn_mutex_pause() YieldProcessor ()
+#elif (defined __GNUC__ || defined __llvm__) && \
+    (defined __i386__ || defined __x86_64__)
+#define nn_mutex_pause() __builtin_ia32_pause ()
+#elif (defined __GNUC__ || defined __llvm__) && defined __aarch64__
+#define nn_mutex_pause() __asm__ __volatile__ ("yield")
+#else
+#define nn_mutex_pause() ((void) 0)
+#endif
+
+static void nn_mutex_init_counters (nn_mutex_t *self, int spin)
+{
+    self->spin = spin;
+    self->contentions = 0;
+    self->parks = 0;
+}
+
+void nn_mutex_getstats (nn_mutex_t *self, struct nn_mutex_stats *stats)
+{
+    stats->contentions += self->contentions;
+    stats->parks += self->parks;
+}
+
 #ifdef NN_HAVE_WINDOWS
 
 void nn_mutex_init (nn_mutex_t *self)
 {
     InitializeCriticalSection (&self->cs);
     self->owner = 0;
+    nn_mutex_init_counters (self, 0);
+}
+
+void nn_mutex_init_adaptive (nn_mutex_t *self)
+{
+    /*  The spinning is done below so that contention can be counted. */
+    InitializeCriticalSection (&self->cs);
+    self->owner = 0;
+    nn_mutex_init_counters (self, NN_MUTEX_SPIN);
 }
 
 void nn_mutex_term (nn_mutex_t *self)
@@ -43,7 +77,24 @@ void nn_mutex_term (nn_mutex_t *self)
 
 void nn_mutex_lock (nn_mutex_t *self)
 {
-    EnterCriticalSection (&self->cs);
+    int i;
+
+    if (!self->spin)
+        EnterCriticalSection (&self->cs);
+    else if (!TryEnterCriticalSection (&self->cs)) {
+
+        /*  Retry for a while, then give up and sleep. */
+        for (i = 0; i != self->spin; ++i) {
+            nn_mutex_pause ();
+            if (TryEnterCriticalSection (&self->cs))
+                break;
+        }
+        if (i == self->spin) {
+            EnterCriticalSection (&self->cs);
+            ++self->parks;
+        }
+        ++self->contentions;
+    }
 
     /*  Make sure we don't recursively enter mutexes. */
     nn_assert(self->owner == 0);
@@ -71,6 +122,13 @@ void nn_mutex_init (nn_mutex_t *self)
     rc = pthread_mutex_init (&self->mutex, NULL);
     errnum_assert (rc == 0, rc);
     pthread_mutexattr_destroy(&attr);
+    nn_mutex_init_counters (self, 0);
+}
+
+void nn_mutex_init_adaptive (nn_mutex_t *self)
+{
+    nn_mutex_init (self);
+    self->spin = NN_MUTEX_SPIN;
 }
 
 void nn_mutex_term (nn_mutex_t *self)
@@ -84,9 +142,33 @@ void nn_mutex_term (nn_mutex_t *self)
 void nn_mutex_lock (nn_mutex_t *self)
 {
     int rc;
-
-    rc = pthread_mutex_lock (&self->mutex);
-    errnum_assert (rc == 0, rc);
+    int i;
+
+    if (!self->spin) {
+        rc = pthread_mutex_lock (&self->mutex);
+        errnum_assert (rc == 0, rc);
+        return;
+    }
+
+    rc = pthread_mutex_trylock (&self->mutex);
+    if (rc == 0)
+        return;
+    errnum_assert (rc == EBUSY, rc);
+
+    /*  Retry for a while, then give up and sleep. */
+    for (i = 0; i != self->spin; ++i) {
+        nn_mutex_pause ();
+        rc = pthread_mutex_trylock (&self->mutex);
+        if (rc == 0)
+            break;
+        errnum_assert (rc == EBUSY, rc);
+    }
+    if (i == self->spin) {
+        rc = pthread_mutex_lock (&self->mutex);
+        errnum_assert (rc == 0, rc);
+        ++self->parks;
+    }
+    ++self->contentions;
 }
 
 void nn_mutex_unlock (nn_mutex_t *self)
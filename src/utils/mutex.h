@@ -29,6 +29,14 @@
 #include <pthread.h>
 #endif
 
+#include <stdint.h>
+
+/*  Number of attempts to take a contended adaptive mutex before the thread
+    goes to sleep. */
+#ifndef NN_MUTEX_SPIN
+#define NN_MUTEX_SPIN 100
+#endif
+
 struct nn_mutex {
     /*  NB: The fields of this structure are private to the mutex
         implementation. */
@@ -39,6 +47,21 @@ struct nn_mutex {
 #else
     pthread_mutex_t mutex;
 #endif
+
+    /*  Number of spins before parking, zero for a plain mutex. */
+    int spin;
+
+    /*  Number of times the mutex was found locked and the number of times
+        the thread had to sleep waiting for it. They are only updated by
+        the owner of the mutex. */
+    uint64_t contentions;
+    uint64_t parks;
+};
+
+/*  Contention counters of a mutex. */
+struct nn_mutex_stats {
+    uint64_t contentions;
+    uint64_t parks;
 };
 
 typedef struct nn_mutex nn_mutex_t;
@@ -46,6 +69,12 @@ typedef struct nn_mutex nn_mutex_t;
 /*  Initialise the mutex. */
 void nn_mutex_init (nn_mutex_t *self);
 
+/*  Initialise an adaptive mutex. Before sleeping, a thread that finds it
+    locked retries for a while, which avoids the cost of parking and
+    waking it when the critical sections are very short. Contention on
+    the mutex is counted. */
+void nn_mutex_init_adaptive (nn_mutex_t *self);
+
 /*  Terminate the mutex. */
 void nn_mutex_term (nn_mutex_t *self);
 
@@ -56,4 +85,8 @@ void nn_mutex_lock (nn_mutex_t *self);
 /*  Unlock the mutex. Behaviour of unlocking an unlocked mutex is undefined */
 void nn_mutex_unlock (nn_mutex_t *self);
 
+/*  Add the contention counters of the mutex to 'stats'. The counters are
+    read without locking, so they may be slightly out of date. */
+void nn_mutex_getstats (nn_mutex_t *self, struct nn_mutex_stats *stats);
+
 #endif
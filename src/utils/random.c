@@ -23,21 +23,47 @@
 #include "random.h"
 #include "clock.h"
 #include "fast.h"
+#include "attr.h"
 
 #ifdef NN_HAVE_WINDOWS
 #include "win.h"
 #else
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#if defined NN_HAVE_ARC4RANDOM
+#include <stdlib.h>
+#elif defined NN_HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
 #endif
 
 #include <string.h>
 
+/*  Seed shared by all the threads. Each thread derives its own generator
+    state from it and from values unique to the thread. */
 static uint64_t nn_random_state;
 
+/*  State of the calling thread's generator. Zero means not seeded yet. */
+static NN_THREAD_LOCAL uint64_t nn_random_tls;
+
+static int nn_random_system (void *buf, size_t len);
+
+/*  Finaliser from SplitMix64. Spreads entropy of the input all over the
+    output, so that similar inputs give very different seeds. */
+static uint64_t nn_random_mix (uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
 void nn_random_seed ()
 {
     uint64_t pid;
+    uint64_t sys;
 
 #ifdef NN_HAVE_WINDOWS
     pid = (uint64_t) GetCurrentProcessId ();
@@ -46,24 +72,49 @@ void nn_random_seed ()
 #endif
 
     /*  The initial state for pseudo-random number generator is computed from
-        the exact timestamp and process ID. */
+        the exact timestamp and process ID. Where available, it's further
+        mixed with the output of the system's generator. */
     memcpy (&nn_random_state, "\xfa\x9b\x23\xe3\x07\xcc\x61\x1f", 8);
-    nn_random_state ^= pid + nn_clock_ms();
+    nn_random_state ^= pid + nn_clock_us ();
+    if (nn_random_system (&sys, sizeof (sys)) == 0)
+        nn_random_state ^= sys;
+}
+
+static uint64_t nn_random_next (void)
+{
+    uint64_t x;
+
+    x = nn_random_tls;
+    if (nn_slow (!x)) {
+        x = nn_random_mix (nn_random_state ^
+            (uint64_t) (size_t) &nn_random_tls ^ nn_clock_us ());
+        if (!x)
+            x = 1;
+    }
+
+    /*  xorshift64*. The low-order bits of the state are weak, the
+        multiplication moves the strong ones over the whole word. */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    nn_random_tls = x;
+    return x * 0x2545f4914f6cdd1dULL;
 }
 
 void nn_random_generate (void *buf, size_t len)
 {
     uint8_t *pos;
+    uint64_t rnd;
 
     pos = (uint8_t*) buf;
 
     while (1) {
 
         /*  Generate a pseudo-random integer. */
-        nn_random_state = nn_random_state * 1103515245 + 12345;
+        rnd = nn_random_next ();
 
         /*  Move the bytes to the output buffer. */
-        memcpy (pos, &nn_random_state, len > 8 ? 8 : len);
+        memcpy (pos, &rnd, len > 8 ? 8 : len);
         if (nn_fast (len <= 8))
             return;
         len -= 8;
@@ -71,3 +122,78 @@ void nn_random_generate (void *buf, size_t len)
     }
 }
 
+#if defined NN_HAVE_WINDOWS
+
+/*  RtlGenRandom, exported from advapi32 under its internal name. */
+#define RtlGenRandom SystemFunction036
+BOOLEAN NTAPI RtlGenRandom (PVOID buf, ULONG len);
+
+static int nn_random_system (void *buf, size_t len)
+{
+    return RtlGenRandom (buf, (ULONG) len) ? 0 : -1;
+}
+
+#elif defined NN_HAVE_ARC4RANDOM
+
+static int nn_random_system (void *buf, size_t len)
+{
+    arc4random_buf (buf, len);
+    return 0;
+}
+
+#else
+
+static int nn_random_system (void *buf, size_t len)
+{
+    uint8_t *pos;
+    ssize_t nbytes;
+    int fd;
+
+    pos = (uint8_t*) buf;
+
+#if defined NN_HAVE_GETRANDOM
+    while (len) {
+        nbytes = getrandom (pos, len, 0);
+        if (nn_slow (nbytes < 0)) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        pos += nbytes;
+        len -= nbytes;
+    }
+    if (!len)
+        return 0;
+#endif
+
+    /*  The system call may not be supported by the running kernel. */
+    fd = open ("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    while (len) {
+        nbytes = read (fd, pos, len);
+        if (nn_slow (nbytes <= 0)) {
+            if (nbytes < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        pos += nbytes;
+        len -= nbytes;
+    }
+    close (fd);
+    return len ? -1 : 0;
+}
+
+#endif
+
+void nn_random_secure (void *buf, size_t len)
+{
+    int rc;
+
+    rc = nn_random_system (buf, len);
+
+    /*  Without the system's generator there's nothing better to use than
+        the pseudo-random one. */
+    if (nn_slow (rc < 0))
+        nn_random_generate (buf, len);
+}
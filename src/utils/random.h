@@ -25,10 +25,17 @@
 
 #include <stddef.h>
 
-/*  Seeds the pseudorandom number generator. */
+/*  Seeds the pseudorandom number generator. Threads that haven't used
+    the generator yet derive their state from this seed. */
 void nn_random_seed ();
 
-/*  Generate a pseudorandom byte sequence. */
+/*  Generate a pseudorandom byte sequence. Each thread has its own generator,
+    so the function is cheap and safe to call from any thread. The output
+    is predictable and must not be used where security depends on it. */
 void nn_random_generate (void *buf, size_t len);
 
+/*  Generate a byte sequence using the cryptographically secure generator
+    of the operating system. Considerably slower than nn_random_generate. */
+void nn_random_secure (void *buf, size_t len);
+
 #endif
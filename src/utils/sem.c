@@ -91,6 +91,21 @@ int nn_sem_wait (struct nn_sem *self)
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    int rc;
+    int signaled;
+
+    rc = pthread_mutex_lock (&self->mutex);
+    errnum_assert (rc == 0, rc);
+    signaled = self->signaled;
+    self->signaled = 0;
+    rc = pthread_mutex_unlock (&self->mutex);
+    errnum_assert (rc == 0, rc);
+
+    return signaled ? 0 : -EAGAIN;
+}
+
 #elif defined NN_HAVE_WINDOWS
 
 void nn_sem_init (struct nn_sem *self)
@@ -126,6 +141,19 @@ int nn_sem_wait (struct nn_sem *self)
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    DWORD rc;
+
+    rc = WaitForSingleObject (self->h, 0);
+    win_assert (rc != WAIT_FAILED);
+    if (rc == WAIT_TIMEOUT)
+        return -EAGAIN;
+    nn_assert (rc == WAIT_OBJECT_0);
+
+    return 0;
+}
+
 #elif defined NN_HAVE_SEMAPHORE
 
 void nn_sem_init (struct nn_sem *self)
@@ -163,6 +191,22 @@ int nn_sem_wait (struct nn_sem *self)
     return 0;
 }
 
+int nn_sem_trywait (struct nn_sem *self)
+{
+    int rc;
+
+    while (1) {
+        rc = sem_trywait (&self->sem);
+        if (nn_slow (rc < 0 && errno == EINTR))
+            continue;
+        break;
+    }
+    if (rc < 0 && errno == EAGAIN)
+        return -EAGAIN;
+    errno_assert (rc == 0);
+    return 0;
+}
+
 #else
 #error
 #endif
@@ -39,6 +39,9 @@ void nn_sem_post (struct nn_sem *self);
 /*  Waits till sem object becomes unlocked and locks it. */
 int nn_sem_wait (struct nn_sem *self);
 
+/*  Locks the semaphore if it's unlocked. Returns -EAGAIN otherwise. */
+int nn_sem_trywait (struct nn_sem *self);
+
 #if defined NN_HAVE_OSX
 
 #include <pthread.h>
@@ -0,0 +1,454 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#if defined NN_HAVE_SHM
+
+#include "shmarena.h"
+#include "mutex.h"
+#include "once.h"
+#include "err.h"
+#include "fast.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  The arena is divided into blocks of this size. Each allocation spans one
+    or more consecutive blocks. */
+#define NN_SHMARENA_BLOCK 4096
+
+/*  Default size of the arena of this process. It can be overridden by
+    NN_SHM_ARENA_SIZE environment variable. The memory is not committed
+    until it's actually used. */
+#define NN_SHMARENA_DEFSIZE ((size_t) 1 << 30)
+#define NN_SHMARENA_MINSIZE ((size_t) 1 << 20)
+
+/*  Maximum number of arenas mapped into the process. */
+#define NN_SHMARENA_MAX 32
+
+#define NN_SHMARENA_TAG 0x6e6e6172
+
+/*  The beginning of the arena. A bitmap of used blocks follows. */
+struct nn_shmarena_hdr {
+    uint32_t tag;
+
+    /*  Spinlock guarding the bitmap. It's shared by all the processes that
+        have the arena mapped. */
+    volatile uint32_t lock;
+
+    /*  Size of the whole segment, number of blocks and the offset of the
+        first one. */
+    uint64_t size;
+    uint64_t nblocks;
+    uint64_t blocks;
+};
+
+/*  Precedes each allocation. */
+struct nn_shmarena_span {
+    uint64_t first;
+    uint64_t count;
+};
+
+struct nn_shmarena {
+    char name [NN_SHMARENA_NAMELEN];
+    uint8_t *base;
+    size_t size;
+};
+
+/*  Arenas mapped into the process. Entries are only ever added so they can
+    be looked up without locking. */
+static struct nn_shmarena nn_shmarena_maps [NN_SHMARENA_MAX];
+static volatile int nn_shmarena_count = 0;
+
+/*  Arena of this process, if already created, and the process that created
+    it. After fork, the child keeps allocating from the parent's arena. */
+static struct nn_shmarena *nn_shmarena_own = NULL;
+static pid_t nn_shmarena_pid;
+
+static nn_mutex_t nn_shmarena_sync;
+static nn_once_t nn_shmarena_once = NN_ONCE_INITIALIZER;
+
+/*  Private functions. */
+static void nn_shmarena_init (void);
+static void nn_shmarena_atexit (void);
+static struct nn_shmarena *nn_shmarena_create (void);
+static struct nn_shmarena *nn_shmarena_add (const char *name, void *base,
+    size_t size);
+static struct nn_shmarena *nn_shmarena_lookup (const void *p);
+static void nn_shmarena_lock (struct nn_shmarena_hdr *hdr);
+static void nn_shmarena_unlock (struct nn_shmarena_hdr *hdr);
+static int64_t nn_shmarena_find (struct nn_shmarena_hdr *hdr, uint64_t n);
+static void nn_shmarena_mark (struct nn_shmarena_hdr *hdr, uint64_t first,
+    uint64_t n, int used);
+
+void *nn_shmarena_alloc (size_t size)
+{
+    struct nn_shmarena *arena;
+    struct nn_shmarena_hdr *hdr;
+    struct nn_shmarena_span *span;
+    uint64_t count;
+    int64_t first;
+
+    nn_do_once (&nn_shmarena_once, nn_shmarena_init);
+
+    nn_mutex_lock (&nn_shmarena_sync);
+    if (nn_slow (!nn_shmarena_own))
+        nn_shmarena_own = nn_shmarena_create ();
+    arena = nn_shmarena_own;
+    nn_mutex_unlock (&nn_shmarena_sync);
+    if (nn_slow (!arena))
+        return NULL;
+    hdr = (struct nn_shmarena_hdr*) arena->base;
+
+    if (nn_slow (size > arena->size))
+        return NULL;
+    count = (size + sizeof (struct nn_shmarena_span) + NN_SHMARENA_BLOCK - 1) /
+        NN_SHMARENA_BLOCK;
+
+    nn_shmarena_lock (hdr);
+    first = nn_shmarena_find (hdr, count);
+    if (nn_fast (first >= 0))
+        nn_shmarena_mark (hdr, (uint64_t) first, count, 1);
+    nn_shmarena_unlock (hdr);
+    if (nn_slow (first < 0))
+        return NULL;
+
+    span = (struct nn_shmarena_span*) (arena->base + hdr->blocks +
+        (uint64_t) first * NN_SHMARENA_BLOCK);
+    span->first = (uint64_t) first;
+    span->count = count;
+
+    return span + 1;
+}
+
+void nn_shmarena_free (void *p)
+{
+    struct nn_shmarena *arena;
+    struct nn_shmarena_hdr *hdr;
+    struct nn_shmarena_span *span;
+
+    arena = nn_shmarena_lookup (p);
+    nn_assert (arena);
+    hdr = (struct nn_shmarena_hdr*) arena->base;
+    span = ((struct nn_shmarena_span*) p) - 1;
+    nn_assert (span->count && span->first + span->count <= hdr->nblocks);
+
+    nn_shmarena_lock (hdr);
+    nn_shmarena_mark (hdr, span->first, span->count, 0);
+    nn_shmarena_unlock (hdr);
+}
+
+int nn_shmarena_locate (const void *p, const char **name, uint64_t *offset)
+{
+    struct nn_shmarena *arena;
+
+    arena = nn_shmarena_lookup (p);
+    if (!arena)
+        return -EINVAL;
+    *name = arena->name;
+    *offset = (uint64_t) ((const uint8_t*) p - arena->base);
+
+    return 0;
+}
+
+int nn_shmarena_resolve (const char *name, uint64_t offset, size_t size,
+    void **result)
+{
+    int rc;
+    int i;
+    int fd;
+    struct stat st;
+    void *base;
+    struct nn_shmarena *arena;
+
+    nn_do_once (&nn_shmarena_once, nn_shmarena_init);
+
+    if (nn_slow (strlen (name) >= NN_SHMARENA_NAMELEN))
+        return -EINVAL;
+
+    nn_mutex_lock (&nn_shmarena_sync);
+
+    /*  Check whether the arena is already mapped. */
+    arena = NULL;
+    for (i = 0; i != nn_shmarena_count; ++i) {
+        if (strcmp (nn_shmarena_maps [i].name, name) == 0) {
+            arena = &nn_shmarena_maps [i];
+            break;
+        }
+    }
+
+    /*  If not so, map it now. It stays mapped until the process exits. */
+    if (!arena) {
+        fd = shm_open (name, O_RDWR, 0);
+        if (nn_slow (fd < 0)) {
+            rc = -errno;
+            nn_mutex_unlock (&nn_shmarena_sync);
+            return rc;
+        }
+        rc = fstat (fd, &st);
+        errno_assert (rc == 0);
+        if (nn_slow ((size_t) st.st_size < sizeof (struct nn_shmarena_hdr))) {
+            close (fd);
+            nn_mutex_unlock (&nn_shmarena_sync);
+            return -EPROTO;
+        }
+        base = mmap (NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+        rc = base == MAP_FAILED ? -errno : 0;
+        close (fd);
+        if (nn_slow (rc < 0)) {
+            nn_mutex_unlock (&nn_shmarena_sync);
+            return rc;
+        }
+        if (nn_slow (((struct nn_shmarena_hdr*) base)->tag !=
+              NN_SHMARENA_TAG)) {
+            munmap (base, (size_t) st.st_size);
+            nn_mutex_unlock (&nn_shmarena_sync);
+            return -EPROTO;
+        }
+        arena = nn_shmarena_add (name, base, (size_t) st.st_size);
+        if (nn_slow (!arena)) {
+            munmap (base, (size_t) st.st_size);
+            nn_mutex_unlock (&nn_shmarena_sync);
+            return -ENOMEM;
+        }
+    }
+
+    nn_mutex_unlock (&nn_shmarena_sync);
+
+    if (nn_slow (offset > arena->size || size > arena->size - offset))
+        return -EINVAL;
+    *result = arena->base + offset;
+
+    return 0;
+}
+
+static void nn_shmarena_init (void)
+{
+    nn_mutex_init (&nn_shmarena_sync);
+}
+
+static void nn_shmarena_atexit (void)
+{
+    /*  Remove the name of the arena so that it doesn't stay in the system.
+        Peers that have it mapped can still use it. */
+    if (nn_shmarena_own && getpid () == nn_shmarena_pid)
+        shm_unlink (nn_shmarena_own->name);
+}
+
+static struct nn_shmarena *nn_shmarena_create (void)
+{
+    int rc;
+    int fd;
+    char name [NN_SHMARENA_NAMELEN];
+    char *envvar;
+    size_t size;
+    uint64_t nblocks;
+    uint64_t blocks;
+    void *base;
+    struct nn_shmarena_hdr *hdr;
+    struct nn_shmarena *arena;
+
+    size = NN_SHMARENA_DEFSIZE;
+    envvar = getenv ("NN_SHM_ARENA_SIZE");
+    if (envvar && *envvar)
+        size = (size_t) strtoull (envvar, NULL, 10);
+    if (size < NN_SHMARENA_MINSIZE)
+        size = NN_SHMARENA_MINSIZE;
+
+    /*  The bitmap comes first, the blocks start at the next block
+        boundary. */
+    nblocks = size / NN_SHMARENA_BLOCK;
+    blocks = sizeof (struct nn_shmarena_hdr) + (nblocks + 63) / 64 * 8;
+    blocks = (blocks + NN_SHMARENA_BLOCK - 1) / NN_SHMARENA_BLOCK *
+        NN_SHMARENA_BLOCK;
+    size = (size_t) (blocks + nblocks * NN_SHMARENA_BLOCK);
+
+    /*  A segment with the same name can only be a leftover of a crashed
+        process that had the same pid. */
+    snprintf (name, sizeof (name), "/nn-arena-%d", (int) getpid ());
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        shm_unlink (name);
+        fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (nn_slow (fd < 0))
+        return NULL;
+    rc = ftruncate (fd, size);
+    if (nn_slow (rc != 0)) {
+        close (fd);
+        shm_unlink (name);
+        return NULL;
+    }
+    base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (nn_slow (base == MAP_FAILED)) {
+        shm_unlink (name);
+        return NULL;
+    }
+
+    /*  The segment is zero-filled, i.e. all the blocks are free. Mark the
+        bits past the last block as used so that they are never allocated. */
+    hdr = (struct nn_shmarena_hdr*) base;
+    hdr->size = size;
+    hdr->nblocks = nblocks;
+    hdr->blocks = blocks;
+    if (nblocks % 64)
+        ((uint64_t*) (hdr + 1)) [nblocks / 64] = ~(uint64_t) 0 << (nblocks % 64);
+    __sync_synchronize ();
+    hdr->tag = NN_SHMARENA_TAG;
+
+    arena = nn_shmarena_add (name, base, size);
+    if (nn_slow (!arena)) {
+        munmap (base, size);
+        shm_unlink (name);
+        return NULL;
+    }
+    nn_shmarena_pid = getpid ();
+    rc = atexit (nn_shmarena_atexit);
+    errnum_assert (rc == 0, rc);
+
+    return arena;
+}
+
+static struct nn_shmarena *nn_shmarena_add (const char *name, void *base,
+    size_t size)
+{
+    struct nn_shmarena *arena;
+
+    if (nn_slow (nn_shmarena_count == NN_SHMARENA_MAX))
+        return NULL;
+    arena = &nn_shmarena_maps [nn_shmarena_count];
+    strcpy (arena->name, name);
+    arena->base = base;
+    arena->size = size;
+
+    /*  Publish the entry only once it's filled in. */
+    __sync_synchronize ();
+    ++nn_shmarena_count;
+
+    return arena;
+}
+
+static struct nn_shmarena *nn_shmarena_lookup (const void *p)
+{
+    int i;
+    int count;
+    struct nn_shmarena *arena;
+
+    count = nn_shmarena_count;
+    __sync_synchronize ();
+    for (i = 0; i != count; ++i) {
+        arena = &nn_shmarena_maps [i];
+        if ((const uint8_t*) p >= arena->base &&
+              (const uint8_t*) p < arena->base + arena->size)
+            return arena;
+    }
+    return NULL;
+}
+
+static void nn_shmarena_lock (struct nn_shmarena_hdr *hdr)
+{
+    while (nn_slow (__sync_lock_test_and_set (&hdr->lock, 1)))
+        while (hdr->lock)
+            sched_yield ();
+}
+
+static void nn_shmarena_unlock (struct nn_shmarena_hdr *hdr)
+{
+    __sync_lock_release (&hdr->lock);
+}
+
+/*  Finds the first run of 'n' free blocks. Returns index of the first block
+    or -1 if there's no such run. */
+static int64_t nn_shmarena_find (struct nn_shmarena_hdr *hdr, uint64_t n)
+{
+    uint64_t *map;
+    uint64_t word;
+    uint64_t i;
+    uint64_t start;
+    uint64_t run;
+
+    map = (uint64_t*) (hdr + 1);
+    start = 0;
+    run = 0;
+    i = 0;
+    while (i < hdr->nblocks) {
+        word = map [i / 64];
+
+        /*  Skip whole words if possible. */
+        if (i % 64 == 0 && word == ~(uint64_t) 0) {
+            run = 0;
+            i += 64;
+            continue;
+        }
+        if (i % 64 == 0 && word == 0) {
+            if (!run)
+                start = i;
+            run += 64;
+            i += 64;
+            if (run >= n)
+                return (int64_t) start;
+            continue;
+        }
+
+        if (word & ((uint64_t) 1 << (i % 64)))
+            run = 0;
+        else {
+            if (!run)
+                start = i;
+            if (++run >= n)
+                return (int64_t) start;
+        }
+        ++i;
+    }
+
+    return -1;
+}
+
+static void nn_shmarena_mark (struct nn_shmarena_hdr *hdr, uint64_t first,
+    uint64_t n, int used)
+{
+    uint64_t *map;
+    uint64_t i;
+
+    map = (uint64_t*) (hdr + 1);
+    for (i = first; i != first + n; ++i) {
+        if (i % 64 == 0 && first + n - i >= 64) {
+            map [i / 64] = used ? ~(uint64_t) 0 : 0;
+            i += 63;
+            continue;
+        }
+        if (used)
+            map [i / 64] |= (uint64_t) 1 << (i % 64);
+        else
+            map [i / 64] &= ~((uint64_t) 1 << (i % 64));
+    }
+}
+
+#endif
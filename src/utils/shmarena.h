@@ -0,0 +1,56 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_SHMARENA_INCLUDED
+#define NN_SHMARENA_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Memory allocator working on top of POSIX shared memory segments. Each
+    process allocates from its own arena, created on the first allocation.
+    Arenas of other processes are mapped on demand when memory allocated
+    from them is received. Memory can be returned to the arena it was
+    allocated from by any process that has the arena mapped. */
+
+/*  Maximum length of the arena name, including the terminating zero. */
+#define NN_SHMARENA_NAMELEN 64
+
+/*  Allocates 'size' bytes in the arena of this process. Returns NULL if the
+    arena can't be created or if there's not enough free space in it. */
+void *nn_shmarena_alloc (size_t size);
+
+/*  Returns the memory to the arena it was allocated from. */
+void nn_shmarena_free (void *p);
+
+/*  If 'p' points into an arena mapped by this process, fills in the name of
+    the arena and the offset of 'p' within it and returns 0. Returns -EINVAL
+    otherwise. */
+int nn_shmarena_locate (const void *p, const char **name, uint64_t *offset);
+
+/*  Maps the arena with the specified name, unless it is mapped already, and
+    returns the address of 'size' bytes at 'offset' within it. */
+int nn_shmarena_resolve (const char *name, uint64_t offset, size_t size,
+    void **result);
+
+#endif
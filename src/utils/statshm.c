@@ -0,0 +1,190 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "statshm.h"
+#include "err.h"
+#include "attr.h"
+
+#include <string.h>
+
+#if defined NN_HAVE_STATSHM
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*  Slots are aligned to cache lines, so that updating one doesn't disturb
+    the readers of the others. */
+#define NN_STATSHM_ALIGN 64
+#define NN_STATSHM_ALIGNED(sz) \
+    (((sz) + NN_STATSHM_ALIGN - 1) / NN_STATSHM_ALIGN * NN_STATSHM_ALIGN)
+
+int nn_statshm_init (struct nn_statshm *self, const char *name, int nslots,
+    int nstats, int interval)
+{
+    int rc;
+    int fd;
+    size_t slots;
+    size_t slotsize;
+    void *base;
+
+    /*  Portable names of shared memory objects start with a slash. */
+    if (nn_slow (!*name || strlen (name) + 2 > sizeof (self->name)))
+        return -EINVAL;
+    snprintf (self->name, sizeof (self->name), "%s%s",
+        name [0] == '/' ? "" : "/", name);
+
+    slots = NN_STATSHM_ALIGNED (sizeof (struct nn_statshm_hdr) +
+        (size_t) nstats * NN_STATSHM_STATNAMELEN);
+    slotsize = NN_STATSHM_ALIGNED (offsetof (struct nn_statshm_slot, values) +
+        (size_t) nstats * sizeof (uint64_t));
+    self->size = slots + (size_t) nslots * slotsize;
+
+    /*  A segment with the same name is a leftover of a process that didn't
+        exit cleanly, or belongs to another process that was given the same
+        name. Either way, the readers are better served by the newer one. */
+    fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        shm_unlink (self->name);
+        fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (nn_slow (fd < 0))
+        return -errno;
+    rc = ftruncate (fd, self->size);
+    if (nn_slow (rc != 0)) {
+        rc = -errno;
+        close (fd);
+        shm_unlink (self->name);
+        return rc;
+    }
+    base = mmap (NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = base == MAP_FAILED ? -errno : 0;
+    close (fd);
+    if (nn_slow (rc < 0)) {
+        shm_unlink (self->name);
+        return rc;
+    }
+
+    /*  The segment is zero-filled, i.e. all the slots are empty. The magic
+        number is only set by nn_statshm_publish. */
+    self->base = (uint8_t*) base;
+    self->hdr = (struct nn_statshm_hdr*) base;
+    self->hdr->version = NN_STATSHM_VERSION;
+    self->hdr->nslots = (uint32_t) nslots;
+    self->hdr->nstats = (uint32_t) nstats;
+    self->hdr->slotsize = (uint32_t) slotsize;
+    self->hdr->slots = (uint32_t) slots;
+    self->hdr->interval = (uint32_t) interval;
+    self->hdr->pid = (uint32_t) getpid ();
+
+    return 0;
+}
+
+void nn_statshm_term (struct nn_statshm *self)
+{
+    /*  Readers that have the segment mapped keep the last values. */
+    munmap (self->base, self->size);
+    shm_unlink (self->name);
+}
+
+void nn_statshm_setname (struct nn_statshm *self, int i, const char *name)
+{
+    char *dst;
+
+    nn_assert (i >= 0 && (uint32_t) i < self->hdr->nstats);
+    dst = (char*) (self->hdr + 1) + (size_t) i * NN_STATSHM_STATNAMELEN;
+    strncpy (dst, name, NN_STATSHM_STATNAMELEN - 1);
+}
+
+void nn_statshm_publish (struct nn_statshm *self)
+{
+    __sync_synchronize ();
+    self->hdr->magic = NN_STATSHM_MAGIC;
+}
+
+struct nn_statshm_slot *nn_statshm_slot (struct nn_statshm *self, int i)
+{
+    if (nn_slow (i < 0 || (uint32_t) i >= self->hdr->nslots))
+        return NULL;
+    return (struct nn_statshm_slot*) (self->base + self->hdr->slots +
+        (size_t) i * self->hdr->slotsize);
+}
+
+void nn_statshm_lock (struct nn_statshm_slot *slot)
+{
+    /*  There's a single writer, so the sequence number needs no atomic
+        increment. The fence keeps the updates of the slot from being seen
+        before the number turns odd. */
+    slot->seq = slot->seq + 1;
+    __sync_synchronize ();
+}
+
+void nn_statshm_unlock (struct nn_statshm_slot *slot)
+{
+    __sync_synchronize ();
+    slot->seq = slot->seq + 1;
+}
+
+#else
+
+int nn_statshm_init (NN_UNUSED struct nn_statshm *self,
+    NN_UNUSED const char *name, NN_UNUSED int nslots, NN_UNUSED int nstats,
+    NN_UNUSED int interval)
+{
+    return -ENOTSUP;
+}
+
+void nn_statshm_term (NN_UNUSED struct nn_statshm *self)
+{
+    nn_assert (0);
+}
+
+void nn_statshm_setname (NN_UNUSED struct nn_statshm *self, NN_UNUSED int i,
+    NN_UNUSED const char *name)
+{
+    nn_assert (0);
+}
+
+void nn_statshm_publish (NN_UNUSED struct nn_statshm *self)
+{
+    nn_assert (0);
+}
+
+struct nn_statshm_slot *nn_statshm_slot (NN_UNUSED struct nn_statshm *self,
+    NN_UNUSED int i)
+{
+    nn_assert (0);
+    return NULL;
+}
+
+void nn_statshm_lock (NN_UNUSED struct nn_statshm_slot *slot)
+{
+    nn_assert (0);
+}
+
+void nn_statshm_unlock (NN_UNUSED struct nn_statshm_slot *slot)
+{
+    nn_assert (0);
+}
+
+#endif
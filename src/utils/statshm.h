@@ -0,0 +1,121 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_STATSHM_INCLUDED
+#define NN_STATSHM_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Shared memory segment the statistics of the sockets are exported into,
+    so that they can be read by external tools. The segment starts with
+    a header, followed by the names of the statistics and by one slot per
+    socket. Each slot is guarded by a sequence lock: the writer makes the
+    sequence number odd while it updates the slot, so a reader that sees
+    the same even number before and after copying the slot has got
+    a consistent snapshot. All the values are in the native byte order. */
+
+#if (defined NN_HAVE_SHM_OPEN || defined NN_HAVE_SHM_OPEN_RT) && \
+    defined NN_HAVE_GCC_ATOMIC_BUILTINS
+#define NN_HAVE_STATSHM
+#endif
+
+#define NN_STATSHM_MAGIC 0x6e6e7374
+#define NN_STATSHM_VERSION 1
+
+/*  Space reserved for the name of a statistic and for the name of
+    a socket, including the terminating zero. */
+#define NN_STATSHM_STATNAMELEN 32
+#define NN_STATSHM_SOCKNAMELEN 64
+
+struct nn_statshm_hdr {
+
+    /*  NN_STATSHM_MAGIC, set once the rest of the header is filled in. */
+    volatile uint32_t magic;
+    uint32_t version;
+
+    /*  Number of slots and of statistics in each of them. */
+    uint32_t nslots;
+    uint32_t nstats;
+
+    /*  Size of a slot in bytes and the offset of the first one. */
+    uint32_t slotsize;
+    uint32_t slots;
+
+    /*  Interval between the updates, in milliseconds. */
+    uint32_t interval;
+
+    /*  Process the statistics belong to. */
+    uint32_t pid;
+
+    /*  'nstats' names of NN_STATSHM_STATNAMELEN bytes follow. */
+};
+
+struct nn_statshm_slot {
+
+    /*  Sequence lock, odd while the slot is being updated. */
+    volatile uint32_t seq;
+
+    /*  1 if the socket with the descriptor equal to the index of the slot
+        is open, 0 otherwise. */
+    uint32_t live;
+
+    /*  Wall clock time of the last update, in seconds since the epoch. */
+    uint64_t time;
+
+    /*  The socket name (see NN_SOCKET_NAME). */
+    char name [NN_STATSHM_SOCKNAMELEN];
+
+    /*  'nstats' values follow, in the order of the names in the header. */
+    uint64_t values [1];
+};
+
+struct nn_statshm {
+    char name [NN_STATSHM_SOCKNAMELEN];
+    uint8_t *base;
+    size_t size;
+    struct nn_statshm_hdr *hdr;
+};
+
+/*  Creates the segment with the specified name, replacing any segment with
+    the same name left behind by another process. Returns -ENOTSUP if shared
+    memory isn't available on the platform. */
+int nn_statshm_init (struct nn_statshm *self, const char *name, int nslots,
+    int nstats, int interval);
+
+/*  Unmaps and removes the segment. */
+void nn_statshm_term (struct nn_statshm *self);
+
+/*  Sets the name of the i-th statistic. Done before nn_statshm_publish. */
+void nn_statshm_setname (struct nn_statshm *self, int i, const char *name);
+
+/*  Makes the segment visible to the readers once all the names are set. */
+void nn_statshm_publish (struct nn_statshm *self);
+
+/*  Returns the slot with the specified index, or NULL if there's none. */
+struct nn_statshm_slot *nn_statshm_slot (struct nn_statshm *self, int i);
+
+/*  The slot is updated between these two calls. */
+void nn_statshm_lock (struct nn_statshm_slot *slot);
+void nn_statshm_unlock (struct nn_statshm_slot *slot);
+
+#endif
@@ -36,10 +36,12 @@ void nn_stopwatch_init (struct nn_stopwatch *self)
 
 uint64_t nn_stopwatch_term (struct nn_stopwatch *self)
 {
-    LARGE_INTEGER tps;
+    static LARGE_INTEGER tps;
     LARGE_INTEGER time;
 
-    QueryPerformanceFrequency (&tps);
+    /*  The frequency is fixed at boot, so ask for it only once. */
+    if (tps.QuadPart == 0)
+        QueryPerformanceFrequency (&tps);
     QueryPerformanceCounter (&time);
     return (uint64_t) ((time.QuadPart - self->start) * 1000000 / tps.QuadPart);
 }
@@ -49,27 +51,36 @@ uint64_t nn_stopwatch_term (struct nn_stopwatch *self)
 #include <stdlib.h>
 #include <assert.h>
 #include <sys/time.h>
+#include <time.h>
 
-void nn_stopwatch_init (struct nn_stopwatch *self)
+/*  The monotonic clock is preferred so that the measurement isn't affected
+    by adjustments of the wall clock. */
+static uint64_t nn_stopwatch_now (void)
 {
     int rc;
+#if defined NN_HAVE_CLOCK_MONOTONIC
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    assert (rc == 0);
+    return (uint64_t) (((uint64_t) tv.tv_sec) * 1000000 + tv.tv_nsec / 1000);
+#else
     struct timeval tv;
 
     rc = gettimeofday (&tv, NULL);
     assert (rc == 0);
-    self->start = (uint64_t) (((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec);
+    return (uint64_t) (((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec);
+#endif
 }
 
-uint64_t nn_stopwatch_term (struct nn_stopwatch *self)
+void nn_stopwatch_init (struct nn_stopwatch *self)
 {
-    int rc;
-    struct timeval tv;
-    uint64_t end;
+    self->start = nn_stopwatch_now ();
+}
 
-    rc = gettimeofday (&tv, NULL);
-    assert (rc == 0);
-    end = (uint64_t) (((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec);
-    return end - self->start;
+uint64_t nn_stopwatch_term (struct nn_stopwatch *self)
+{
+    return nn_stopwatch_now () - self->start;
 }
 
 #endif
@@ -37,5 +37,9 @@ void nn_thread_init (struct nn_thread *self,
     nn_thread_routine *routine, void *arg);
 void nn_thread_term (struct nn_thread *self);
 
+/*  Pins the thread to the CPU with the specified index. Returns -ENOTSUP
+    if the platform doesn't support setting thread affinity. */
+int nn_thread_setaffinity (struct nn_thread *self, int cpu);
+
 #endif
 
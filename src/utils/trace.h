@@ -0,0 +1,55 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TRACE_INCLUDED
+#define NN_TRACE_INCLUDED
+
+#include "../nn.h"
+
+/*  Tracepoints along the path of a message. If the library is built without
+    NN_USE_TRACE they compile to nothing. Otherwise each of them costs a load
+    and a well-predicted branch while no hook is installed.
+
+    'obj' identifies the object the event happened on (socket, pipe or
+    underlying OS socket) and 'len' is the number of bytes involved. */
+
+#if defined NN_USE_TRACE
+
+#include "fast.h"
+
+extern nn_trace_fn volatile nn_trace_hook;
+
+#define NN_TRACE(point, obj, len) \
+    do {\
+        nn_trace_fn nn_trace_fn_ = nn_trace_hook;\
+        if (nn_slow (nn_trace_fn_ != NULL))\
+            nn_trace_fn_ ((point), (obj), (len));\
+    } while (0)
+
+#else
+
+#define NN_TRACE(point, obj, len) \
+    do {} while (0)
+
+#endif
+
+#endif
@@ -38,6 +38,11 @@ extern "C" {
     Attempting to set other message types is undefined.  */
 #define NN_WS_MSG_TYPE 1
 
+/*  Options of the permessage-deflate extension (RFC 7692). */
+#define NN_WS_DEFLATE 2
+#define NN_WS_DEFLATE_WINDOW_BITS 3
+#define NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER 4
+
 /*  WebSocket opcode constants as per RFC 6455 5.2  */
 #define NN_WS_MSG_TYPE_TEXT 0x01
 #define NN_WS_MSG_TYPE_BINARY 0x02
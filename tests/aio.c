@@ -0,0 +1,254 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+
+#include "testutil.h"
+#include "../src/utils/atomic.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests asynchronous send, receive and wait operations. */
+
+#define SOCKET_ADDRESS "inproc://aio"
+#define SOCKET_ADDRESS_WAIT "inproc://aio-wait"
+#define MESSAGES 100
+
+static struct nn_aio sends [MESSAGES];
+static struct nn_aio recvs [MESSAGES];
+static struct nn_atomic sent;
+static struct nn_atomic received;
+static struct nn_atomic woken;
+static int order [MESSAGES];
+static int echo;
+
+static void sent_cb (struct nn_aio *aio)
+{
+    nn_assert (aio->err == 0);
+    nn_assert (aio->msg == NULL);
+    nn_atomic_inc (&sent, 1);
+}
+
+static void received_cb (struct nn_aio *aio)
+{
+    uint32_t n;
+
+    /*  Callbacks of a socket are called one at a time, in the order the
+        operations were submitted. */
+    nn_assert (aio->err == 0);
+    n = nn_atomic_load (&received);
+    nn_assert (aio == &recvs [n]);
+    order [n] = atoi (aio->msg);
+    nn_assert (aio->len == strlen (aio->msg) + 1);
+    nn_freemsg (aio->msg);
+    nn_atomic_inc (&received, 1);
+}
+
+static void closed_cb (struct nn_aio *aio)
+{
+    nn_assert (aio->err == EBADF);
+    nn_assert (aio->msg == NULL);
+    nn_atomic_inc (&received, 1);
+}
+
+static void woken_cb (struct nn_aio *aio)
+{
+    nn_assert (aio->err == 0);
+    nn_atomic_inc (&woken, 1);
+}
+
+/*  Echo server: each received request is sent back and once it's sent,
+    the next one is received, all of that using the same operation. */
+static void echo_recv_cb (struct nn_aio *aio);
+
+static void echo_sent_cb (struct nn_aio *aio)
+{
+    int rc;
+
+    if (aio->err == EBADF)
+        return;
+    nn_assert (aio->err == 0);
+    aio->fn = echo_recv_cb;
+    rc = nn_recv_async (echo, aio);
+    errno_assert (rc == 0);
+}
+
+static void echo_recv_cb (struct nn_aio *aio)
+{
+    int rc;
+
+    if (aio->err == EBADF)
+        return;
+    nn_assert (aio->err == 0);
+    aio->fn = echo_sent_cb;
+    rc = nn_send_async (echo, aio);
+    errno_assert (rc == 0);
+}
+
+static void wait_for (struct nn_atomic *counter, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i != 500; ++i) {
+        if (nn_atomic_load (counter) == val)
+            return;
+        nn_sleep (10);
+    }
+    nn_assert (nn_atomic_load (counter) == val);
+}
+
+int main ()
+{
+    int rc;
+    int i;
+    int sb;
+    int sc;
+    struct nn_aio aio;
+    struct nn_aio wait;
+    char buf [32];
+
+    nn_atomic_init (&sent, 0);
+    nn_atomic_init (&received, 0);
+    nn_atomic_init (&woken, 0);
+
+    /*  Invalid operations. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    rc = nn_recv_async (sb, NULL);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    memset (&aio, 0, sizeof (aio));
+    rc = nn_recv_async (sb, &aio);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    aio.fn = sent_cb;
+    rc = nn_send_async (sb, &aio);
+    nn_assert (rc == -1 && nn_errno () == EFAULT);
+    rc = nn_recv_async (-1, &aio);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    test_close (sb);
+
+    /*  Receives submitted before the messages are sent complete in order. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    for (i = 0; i != MESSAGES; ++i) {
+        recvs [i].fn = received_cb;
+        rc = nn_recv_async (sb, &recvs [i]);
+        errno_assert (rc == 0);
+    }
+    for (i = 0; i != MESSAGES; ++i) {
+        sprintf (buf, "%d", i);
+        sends [i].fn = sent_cb;
+        sends [i].msg = nn_allocmsg (strlen (buf) + 1, 0);
+        alloc_assert (sends [i].msg);
+        memcpy (sends [i].msg, buf, strlen (buf) + 1);
+        rc = nn_send_async (sc, &sends [i]);
+        errno_assert (rc == 0);
+    }
+    wait_for (&sent, MESSAGES);
+    wait_for (&received, MESSAGES);
+    for (i = 0; i != MESSAGES; ++i)
+        nn_assert (order [i] == i);
+    nn_assert (nn_get_statistic (sb, NN_STAT_MESSAGES_RECEIVED) == MESSAGES);
+    nn_assert (nn_get_statistic (sc, NN_STAT_MESSAGES_SENT) == MESSAGES);
+    test_close (sc);
+    test_close (sb);
+
+    /*  Operations can be submitted from within the callbacks. */
+    echo = test_socket (AF_SP, NN_REP);
+    test_bind (echo, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_REQ);
+    test_connect (sc, SOCKET_ADDRESS);
+    memset (&aio, 0, sizeof (aio));
+    aio.fn = echo_recv_cb;
+    rc = nn_recv_async (echo, &aio);
+    errno_assert (rc == 0);
+    for (i = 0; i != MESSAGES; ++i) {
+        sprintf (buf, "%d", i);
+        test_send (sc, buf);
+        test_recv (sc, buf);
+    }
+    test_close (sc);
+
+    /*  Waiting for the socket to become readable or writable. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS_WAIT);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS_WAIT);
+    memset (&wait, 0, sizeof (wait));
+    wait.fn = woken_cb;
+    rc = nn_wait_async (sb, &wait);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    wait.events = 4;
+    rc = nn_wait_async (sb, &wait);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    wait.events = NN_POLLOUT;
+    rc = nn_wait_async (sc, &wait);
+    errno_assert (rc == 0);
+    wait_for (&woken, 1);
+    nn_assert (wait.events == NN_POLLOUT);
+    wait.events = NN_POLLIN;
+    rc = nn_wait_async (sb, &wait);
+    errno_assert (rc == 0);
+    nn_sleep (50);
+    nn_assert (nn_atomic_load (&woken) == 1);
+    test_send (sc, "ABC");
+    wait_for (&woken, 2);
+    nn_assert (wait.events == NN_POLLIN);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == 3);
+    wait.events = NN_POLLIN | NN_POLLOUT;
+    rc = nn_wait_async (sb, &wait);
+    errno_assert (rc == 0);
+    wait_for (&woken, 3);
+    nn_assert (wait.events == NN_POLLOUT);
+    test_close (sc);
+    test_close (sb);
+
+    /*  Operations pending when the socket is closed fail. */
+    test_close (echo);
+    nn_assert (aio.err == EBADF);
+    nn_atomic_store (&received, 0);
+    sb = test_socket (AF_SP, NN_PAIR);
+    for (i = 0; i != 3; ++i) {
+        recvs [i].fn = closed_cb;
+        rc = nn_recv_async (sb, &recvs [i]);
+        errno_assert (rc == 0);
+    }
+    memset (&aio, 0, sizeof (aio));
+    aio.fn = closed_cb;
+    aio.events = NN_POLLIN;
+    rc = nn_wait_async (sb, &aio);
+    errno_assert (rc == 0);
+    test_close (sb);
+    nn_assert (nn_atomic_load (&received) == 4);
+    nn_assert (aio.events == 0);
+
+    nn_atomic_term (&woken);
+    nn_atomic_term (&received);
+    nn_atomic_term (&sent);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/atomic.c"
+
+#include <stdlib.h>
+
+/*  Test of the pluggable allocators. */
+
+#define NN_TEST_CLASSES 4
+
+static struct nn_atomic allocs [NN_TEST_CLASSES];
+static struct nn_atomic frees [NN_TEST_CLASSES];
+static int classes [NN_TEST_CLASSES];
+
+static void *test_alloc (size_t size, void *arg)
+{
+    nn_atomic_inc (&allocs [*(int*) arg], 1);
+    return malloc (size);
+}
+
+static void test_free (void *ptr, void *arg)
+{
+    nn_atomic_inc (&frees [*(int*) arg], 1);
+    free (ptr);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int sb;
+    int sc;
+    int tb;
+    int tc;
+    void *msg;
+    struct nn_allocator allocator;
+    char socket_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    /*  Check the invalid arguments. */
+    allocator.alloc = test_alloc;
+    allocator.realloc = NULL;
+    allocator.free = NULL;
+    allocator.arg = NULL;
+    rc = nn_set_allocator (NN_ALLOC_MSG, &allocator);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    allocator.free = test_free;
+    rc = nn_set_allocator (NN_TEST_CLASSES, &allocator);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  Plug in an allocator of our own for each class, before the library
+        has allocated anything. Without realloc, the library emulates it. */
+    for (i = 0; i != NN_TEST_CLASSES; ++i) {
+        nn_atomic_init (&allocs [i], 0);
+        nn_atomic_init (&frees [i], 0);
+        classes [i] = i;
+        allocator.arg = &classes [i];
+        rc = nn_set_allocator (i, &allocator);
+        errno_assert (rc == 0);
+    }
+
+    /*  Exercise all the classes. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "inproc://a");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://a");
+    tb = test_socket (AF_SP, NN_PAIR);
+    test_bind (tb, socket_address);
+    tc = test_socket (AF_SP, NN_PAIR);
+    test_connect (tc, socket_address);
+    nn_sleep (100);
+
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_send (tc, "ABC");
+    test_recv (tb, "ABC");
+
+    msg = nn_allocmsg (10, 0);
+    alloc_assert (msg);
+    msg = nn_reallocmsg (msg, 100000);
+    alloc_assert (msg);
+    rc = nn_freemsg (msg);
+    errno_assert (rc == 0);
+
+    for (i = 0; i != NN_TEST_CLASSES; ++i)
+        nn_assert (nn_atomic_load (&allocs [i]) > 0);
+
+    /*  The allocator can't be replaced once it was used. */
+    rc = nn_set_allocator (NN_ALLOC_MSG, NULL);
+    nn_assert (rc == -1 && nn_errno () == EBUSY);
+
+    test_close (tc);
+    test_close (tb);
+    test_close (sc);
+    test_close (sb);
+
+    /*  Blocks are freed by the allocator they came from. Some of them may
+        be cached by the library. */
+    for (i = 0; i != NN_TEST_CLASSES; ++i) {
+        nn_assert (nn_atomic_load (&frees [i]) > 0);
+        nn_assert (nn_atomic_load (&frees [i]) <=
+            nn_atomic_load (&allocs [i]));
+    }
+
+    return 0;
+}
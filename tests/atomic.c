@@ -0,0 +1,113 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/err.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/thread.c"
+
+/*  Test of the atomic operations. */
+
+#define THREADS 4
+#define ITERATIONS 100000
+
+static struct nn_atomic counter32;
+static struct nn_atomic64 counter64;
+static struct nn_atomic_ptr owner;
+
+static void worker (void *arg)
+{
+    int i;
+    void *old;
+
+    for (i = 0; i != ITERATIONS; ++i) {
+        nn_atomic_inc (&counter32, 1);
+        nn_atomic64_inc (&counter64, 3);
+
+        /*  Spin lock built on top of the pointer CAS. */
+        while (1) {
+            old = nn_atomic_ptr_cas (&owner, NULL, arg);
+            if (old == NULL)
+                break;
+        }
+        nn_assert (nn_atomic_ptr_load (&owner) == arg);
+        nn_atomic_ptr_store (&owner, NULL);
+    }
+}
+
+int main ()
+{
+    int i;
+    int ids [THREADS];
+    struct nn_thread threads [THREADS];
+    uint64_t big;
+
+    /*  32-bit operations. */
+    nn_atomic_init (&counter32, 10);
+    nn_assert (nn_atomic_load (&counter32) == 10);
+    nn_assert (nn_atomic_inc (&counter32, 5) == 10);
+    nn_assert (nn_atomic_dec (&counter32, 3) == 15);
+    nn_assert (nn_atomic_load_relaxed (&counter32) == 12);
+    nn_assert (nn_atomic_cas (&counter32, 11, 20) == 12);
+    nn_assert (nn_atomic_load (&counter32) == 12);
+    nn_assert (nn_atomic_cas (&counter32, 12, 20) == 12);
+    nn_assert (nn_atomic_swap (&counter32, 7) == 20);
+    nn_atomic_store (&counter32, 0);
+    nn_assert (nn_atomic_dec (&counter32, 1) == 0);
+    nn_assert (nn_atomic_load (&counter32) == 0xffffffff);
+    nn_atomic_store (&counter32, 0);
+
+    /*  64-bit operations have to carry beyond 32 bits. */
+    big = ((uint64_t) 1) << 40;
+    nn_atomic64_init (&counter64, 0xffffffff);
+    nn_assert (nn_atomic64_inc (&counter64, 1) == 0xffffffff);
+    nn_assert (nn_atomic64_load (&counter64) == ((uint64_t) 1) << 32);
+    nn_assert (nn_atomic64_cas (&counter64, ((uint64_t) 1) << 32, big) ==
+        ((uint64_t) 1) << 32);
+    nn_assert (nn_atomic64_dec (&counter64, 1) == big);
+    nn_assert (nn_atomic64_cas (&counter64, big, 0) == big - 1);
+    nn_atomic64_store (&counter64, 0);
+
+    /*  Pointer operations. */
+    nn_atomic_ptr_init (&owner, NULL);
+    nn_assert (nn_atomic_ptr_swap (&owner, &big) == NULL);
+    nn_assert (nn_atomic_ptr_cas (&owner, NULL, &i) == &big);
+    nn_assert (nn_atomic_ptr_cas (&owner, &big, NULL) == &big);
+    nn_assert (nn_atomic_ptr_load (&owner) == NULL);
+
+    /*  Concurrent updates. */
+    for (i = 0; i != THREADS; ++i) {
+        ids [i] = i;
+        nn_thread_init (&threads [i], worker, &ids [i]);
+    }
+    for (i = 0; i != THREADS; ++i)
+        nn_thread_term (&threads [i]);
+    nn_assert (nn_atomic_load (&counter32) == THREADS * ITERATIONS);
+    nn_assert (nn_atomic64_load (&counter64) == 3 * THREADS * ITERATIONS);
+    nn_assert (nn_atomic_ptr_load (&owner) == NULL);
+
+    nn_atomic_ptr_term (&owner);
+    nn_atomic64_term (&counter64);
+    nn_atomic_term (&counter32);
+
+    return 0;
+}
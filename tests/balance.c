@@ -0,0 +1,112 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/clock.c"
+
+#include <stdlib.h>
+
+/*  Tests moving busy connections between the AIO worker threads. */
+
+#define NPAIRS 4
+
+static char socket_address [128];
+
+static void test_exchange (int *sb, int *sc)
+{
+    int i;
+
+    for (i = 0; i != NPAIRS; ++i)
+        test_send (sc [i], "ABC");
+    for (i = 0; i != NPAIRS; ++i) {
+        test_recv (sb [i], "ABC");
+        test_send (sb [i], "DEF");
+    }
+    for (i = 0; i != NPAIRS; ++i)
+        test_recv (sc [i], "DEF");
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int sb [NPAIRS];
+    int sc [NPAIRS];
+    uint64_t deadline;
+
+    /*  Both variables are read when the first socket is created. */
+#if defined _WIN32
+    rc = _putenv ("NN_WORKER_THREADS=2");
+    errno_assert (rc == 0);
+    rc = _putenv ("NN_WORKER_BALANCE=20");
+#else
+    rc = setenv ("NN_WORKER_THREADS", "2", 1);
+    errno_assert (rc == 0);
+    rc = setenv ("NN_WORKER_BALANCE", "20", 1);
+#endif
+    errno_assert (rc == 0);
+
+    /*  All the connections start in the first worker. Once established,
+        the sockets are no longer restricted to it. */
+    for (i = 0; i != NPAIRS; ++i) {
+        test_addr_from (socket_address, "tcp", "127.0.0.1",
+            get_test_port (argc, argv) + i);
+        sb [i] = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sb [i], NN_SOL_SOCKET, NN_WORKERS, "0", 1);
+        test_bind (sb [i], socket_address);
+        sc [i] = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sc [i], NN_SOL_SOCKET, NN_WORKERS, "0", 1);
+        test_connect (sc [i], socket_address);
+    }
+    test_exchange (sb, sc);
+    for (i = 0; i != NPAIRS; ++i) {
+        test_setsockopt (sb [i], NN_SOL_SOCKET, NN_WORKERS, "", 0);
+        test_setsockopt (sc [i], NN_SOL_SOCKET, NN_WORKERS, "", 0);
+    }
+    nn_assert (nn_get_statistic (sb [0], NN_STAT_WORKER_MIGRATIONS) == 0);
+
+    /*  Keep the first worker busy till it hands some of the connections
+        over to the idle one. */
+#if !defined NN_HAVE_WINDOWS
+    deadline = nn_clock_ms () + 5000;
+    while (nn_get_statistic (sb [0], NN_STAT_WORKER_MIGRATIONS) == 0) {
+        nn_assert (nn_clock_ms () < deadline);
+        test_exchange (sb, sc);
+    }
+#else
+    (void) deadline;
+#endif
+
+    /*  The moved connections keep working. */
+    for (i = 0; i != 100; ++i)
+        test_exchange (sb, sc);
+
+    for (i = 0; i != NPAIRS; ++i) {
+        test_close (sc [i]);
+        test_close (sb [i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/tcp.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <string.h>
+
+/*  Tests packing of small messages into batch frames on TCP and IPC
+    connections. */
+
+#define COUNT 20000
+
+static char buf [4096];
+static char rcvbuf [4096];
+
+static size_t msgsize (int i)
+{
+    /*  Mostly small messages, with empty, medium and large ones in
+        between, so that the frames are closed by those as well. */
+    if (i % 1000 == 999)
+        return sizeof (buf);
+    if (i % 100 == 50)
+        return 700;
+    return (size_t) (i % 300);
+}
+
+static void receiver (void *arg)
+{
+    int rc;
+    int i;
+    int s;
+    size_t size;
+    size_t j;
+
+    s = *(int*) arg;
+    for (i = 0; i != COUNT; ++i) {
+        rc = nn_recv (s, rcvbuf, sizeof (rcvbuf), 0);
+        errno_assert (rc >= 0);
+        size = msgsize (i);
+        nn_assert ((size_t) rc == size);
+        for (j = 0; j != size; ++j)
+            nn_assert (rcvbuf [j] == (char) (i + j));
+    }
+}
+
+static void test_stream (char *addr, int level, int option, int batch,
+    int cork)
+{
+    int rc;
+    int i;
+    int sb;
+    int sc;
+    int timeo;
+    size_t size;
+    size_t j;
+    struct nn_thread thread;
+
+    timeo = 3000;
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (sc, level, option, &batch, sizeof (batch));
+    if (cork)
+        test_setsockopt (sc, NN_TCP, NN_TCP_CORK, &cork, sizeof (cork));
+    test_connect (sc, addr);
+
+    /*  Messages arrive complete and in order whether they're packed or
+        not. */
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    nn_thread_init (&thread, receiver, &sb);
+    for (i = 0; i != COUNT; ++i) {
+        size = msgsize (i);
+        for (j = 0; j != size; ++j)
+            buf [j] = (char) (i + j);
+        rc = nn_send (sc, buf, size, 0);
+        errno_assert (rc >= 0);
+        nn_assert ((size_t) rc == size);
+    }
+    nn_thread_term (&thread);
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+
+    test_close (sc);
+    test_close (sb);
+}
+
+static void test_options (int level, int option)
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+
+    s = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, level, option, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (s, level, option, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1025;
+    rc = nn_setsockopt (s, level, option, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1024;
+    test_setsockopt (s, level, option, &opt, sizeof (opt));
+    test_close (s);
+}
+
+int main (int argc, const char *argv[])
+{
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+
+    test_options (NN_TCP, NN_TCP_BATCH);
+    test_options (NN_IPC, NN_IPC_BATCH);
+
+    test_stream (addr, NN_TCP, NN_TCP_BATCH, 0, 0);
+    test_stream (addr, NN_TCP, NN_TCP_BATCH, 256, 0);
+    test_stream (addr, NN_TCP, NN_TCP_BATCH, 1024, 1);
+    test_stream ("ipc://test_batch.ipc", NN_IPC, NN_IPC_BATCH, 256, 0);
+
+    return 0;
+}
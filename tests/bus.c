@@ -33,6 +33,10 @@ int main ()
     int bus1;
     int bus2;
     int bus3;
+    int bus4;
+    int dedup;
+    int timeo;
+    size_t sz;
     char buf [3];
 
     /*  Create a simple bus topology consisting of 3 nodes. */
@@ -77,6 +81,77 @@ int main ()
     test_close (bus2);
     test_close (bus1);
 
+    /*  Test the duplicate suppression option. */
+    bus1 = test_socket (AF_SP, NN_BUS);
+    sz = sizeof (dedup);
+    rc = nn_getsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &dedup, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (dedup) && dedup == 0);
+    dedup = -1;
+    rc = nn_setsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &dedup, sizeof (dedup));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    dedup = 100;
+    rc = nn_setsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &dedup, sizeof (dedup));
+    errno_assert (rc == 0);
+    rc = nn_getsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &dedup, &sz);
+    errno_assert (rc == 0);
+    nn_assert (dedup == 100);
+
+    /*  Create a loop: bus1 and bus2 are connected directly and also through
+        the raw socket bus4, which forwards what it gets to everybody. */
+    test_bind (bus1, SOCKET_ADDRESS_A);
+    bus2 = test_socket (AF_SP, NN_BUS);
+    rc = nn_setsockopt (bus2, NN_BUS, NN_BUS_DEDUP, &dedup, sizeof (dedup));
+    errno_assert (rc == 0);
+    test_bind (bus2, SOCKET_ADDRESS_B);
+    test_connect (bus2, SOCKET_ADDRESS_A);
+    bus4 = test_socket (AF_SP_RAW, NN_BUS);
+    test_connect (bus4, SOCKET_ADDRESS_A);
+    test_connect (bus4, SOCKET_ADDRESS_B);
+    timeo = 100;
+    rc = nn_setsockopt (bus1, NN_SOL_SOCKET, NN_RCVTIMEO,
+        &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (bus2, NN_SOL_SOCKET, NN_RCVTIMEO,
+        &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    nn_sleep (10);
+
+    test_send (bus1, "X");
+    test_recv (bus2, "X");
+    test_recv (bus4, "X");
+    test_send (bus4, "X");
+
+    /*  The copy coming around the loop is dropped by both nodes. */
+    test_send (bus1, "Y");
+    test_recv (bus2, "Y");
+    rc = nn_recv (bus2, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    rc = nn_recv (bus1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    nn_assert (nn_get_statistic (bus1, NN_STAT_DROPPED_MESSAGES) == 1);
+    nn_assert (nn_get_statistic (bus2, NN_STAT_DROPPED_MESSAGES) == 1);
+    test_recv (bus4, "Y");
+
+    /*  A multi-part message is recognised when it comes back flattened. */
+    test_send_parts (bus1, "MN", 1);
+    test_recv (bus2, "MN");
+    test_recv (bus4, "MN");
+    test_send (bus4, "MN");
+    test_drop (bus1, ETIMEDOUT);
+    test_drop (bus2, ETIMEDOUT);
+    nn_assert (nn_get_statistic (bus1, NN_STAT_DROPPED_MESSAGES) == 2);
+    nn_assert (nn_get_statistic (bus2, NN_STAT_DROPPED_MESSAGES) == 2);
+
+    /*  A message that happens to match its first part is a different one. */
+    test_send (bus2, "M");
+    test_recv (bus1, "M");
+    test_recv (bus4, "M");
+
+    test_close (bus4);
+    test_close (bus2);
+    test_close (bus1);
+
     return 0;
 }
 
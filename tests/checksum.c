@@ -0,0 +1,251 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/tcp.h"
+
+#include "testutil.h"
+#include "../src/transports/utils/crc32c.c"
+#include "../src/utils/wire.c"
+
+#include <string.h>
+
+#if defined __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+/*  Tests the frame checksums of the tcp transport. */
+
+#define LARGE_SIZE 200000
+#define RCVPIECE 65536
+#define NSMALL 100
+
+static char large [LARGE_SIZE];
+
+static void test_crc32c (void)
+{
+    size_t i;
+    uint32_t crc;
+    uint8_t buf [100];
+
+    nn_crc32c_init ();
+
+    /*  Known values. */
+    nn_assert (nn_crc32c (0, "", 0) == 0);
+    nn_assert (nn_crc32c (0, "123456789", 9) == 0xe3069283);
+    memset (buf, 0, 32);
+    nn_assert (nn_crc32c (0, buf, 32) == 0x8a9136aa);
+    memset (buf, 0xff, 32);
+    nn_assert (nn_crc32c (0, buf, 32) == 0x62a8ab43);
+
+    /*  The checksum can be computed piece by piece, whatever the alignment
+        of the pieces is. */
+    for (i = 0; i != sizeof (buf); ++i)
+        buf [i] = (uint8_t) (i * 31 + 7);
+    crc = nn_crc32c (0, buf, sizeof (buf));
+    for (i = 0; i != sizeof (buf); ++i)
+        nn_assert (nn_crc32c (nn_crc32c (0, buf, i), buf + i,
+            sizeof (buf) - i) == crc);
+}
+
+static void test_traffic (char *addr)
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    int i;
+    size_t total;
+    char *body;
+    char buf [16];
+
+    for (i = 0; i != LARGE_SIZE; ++i)
+        large [i] = (char) (i * 7 + i / 4096);
+
+    /*  It's enough for one side to ask for checksums. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    test_setsockopt (sb, NN_TCP, NN_TCP_CHECKSUM, &opt, sizeof (opt));
+    opt = -1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    opt = 20;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 64;
+    test_setsockopt (sc, NN_TCP, NN_TCP_BATCH, &opt, sizeof (opt));
+    opt = 1;
+    test_setsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    opt = 20;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    test_connect (sc, addr);
+
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+
+    /*  Large messages, batch frames and heartbeats are checked alike. */
+    rc = nn_send (sc, large, LARGE_SIZE, 0);
+    errno_assert (rc == LARGE_SIZE);
+    rc = nn_recv (sb, &body, NN_MSG, 0);
+    errno_assert (rc == LARGE_SIZE);
+    nn_assert (memcmp (body, large, LARGE_SIZE) == 0);
+    nn_freemsg (body);
+    for (i = 0; i != NSMALL; ++i) {
+        buf [0] = (char) i;
+        rc = nn_send (sc, buf, 1 + i % 10, 0);
+        errno_assert (rc == 1 + i % 10);
+    }
+    for (i = 0; i != NSMALL; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 1 + i % 10);
+        nn_assert (buf [0] == (char) i);
+    }
+    nn_sleep (100);
+    test_send (sc, "GHI");
+    test_recv (sb, "GHI");
+
+    /*  A message handed over in pieces is checked as a whole. */
+    opt = RCVPIECE;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVPIECE, &opt, sizeof (opt));
+    rc = nn_send (sc, large, LARGE_SIZE, 0);
+    errno_assert (rc == LARGE_SIZE);
+    for (total = 0; total != LARGE_SIZE; total += rc) {
+        rc = nn_recv (sb, &body, NN_MSG, 0);
+        errno_assert (rc > 0 && rc <= RCVPIECE);
+        nn_assert (memcmp (body, large + total, rc) == 0);
+        nn_freemsg (body);
+    }
+    test_send (sc, "JKL");
+    test_recv (sb, "JKL");
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 0);
+
+    test_close (sc);
+    test_close (sb);
+}
+
+#if defined __linux__
+
+static void test_corrupt (int port)
+{
+    int rc;
+    int sb;
+    int s;
+    int opt;
+    struct timeval tv;
+    struct sockaddr_in addr;
+    char saddr [128];
+    uint8_t hdr [8];
+    uint8_t frame [15];
+    char buf [8];
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    test_setsockopt (sb, NN_TCP, NN_TCP_CHECKSUM, &opt, sizeof (opt));
+    opt = 100;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_addr_from (saddr, "tcp", "127.0.0.1", port);
+    test_bind (sb, saddr);
+
+    /*  The peer is a raw TCP connection that announces it's able to check
+        the frames. */
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (port);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    tv.tv_sec = 3;
+    tv.tv_usec = 0;
+    rc = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    errno_assert (rc == 0);
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    memcpy (hdr, "\0SP\0\0\0\x10\0", 8);
+    hdr [5] = NN_PAIR & 0xff;
+    rc = (int) write (s, hdr, sizeof (hdr));
+    errno_assert (rc == sizeof (hdr));
+    rc = test_raw_read (s, hdr, sizeof (hdr));
+    nn_assert (rc == 0);
+    nn_assert (memcmp (hdr, "\0SP\0", 4) == 0);
+    nn_assert ((hdr [6] & 0x30) == 0x30);
+
+    /*  A frame that matches its checksum is delivered. */
+    memcpy (frame, "\0\0\0\0\0\0\0\x03\0\0\0\0ABC", 15);
+    nn_putl (frame + 8, nn_crc32c (0, "ABC", 3));
+    rc = (int) write (s, frame, sizeof (frame));
+    errno_assert (rc == sizeof (frame));
+    test_recv (sb, "ABC");
+
+    /*  A corrupted one is not, and the connection is dropped. */
+    frame [13] ^= 0x01;
+    rc = (int) write (s, frame, sizeof (frame));
+    errno_assert (rc == sizeof (frame));
+    while (test_raw_read (s, buf, 1) == 0)
+        ;
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 1);
+
+    close (s);
+    test_close (sb);
+}
+
+#endif
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    test_crc32c ();
+
+    s = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_TCP, NN_TCP_CHECKSUM, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = 2;
+    rc = nn_setsockopt (s, NN_TCP, NN_TCP_CHECKSUM, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_traffic (addr);
+
+#if defined __linux__
+    test_corrupt (port + 1);
+#endif
+
+    return 0;
+}
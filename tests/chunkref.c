@@ -0,0 +1,96 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/attr.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/wire.c"
+#include "../src/utils/mpscq.c"
+#include "../src/utils/chunk.c"
+#include "../src/utils/chunkref.c"
+
+/*  Test of the chunkref used as a stack of backtrace entries, the way
+    the REQ/REP protocols do. */
+
+#define ENTRIES 64
+
+int main ()
+{
+    struct nn_chunkref ref;
+    uint8_t key [sizeof (uint32_t)];
+    uint8_t *data;
+    void *chunk;
+    int i;
+    int j;
+
+    nn_chunkref_init_room (&ref, 0, NN_CHUNKREF_HEADROOM);
+    nn_assert (nn_chunkref_size (&ref) == 0);
+
+    /*  Push more entries than fit inline. Once moved into a chunk, the
+        entries are pushed in place until the headroom is used up. */
+    chunk = NULL;
+    for (i = 0; i != ENTRIES; ++i) {
+        nn_putl (key, (uint32_t) i);
+        nn_chunkref_push (&ref, key, sizeof (key));
+        nn_assert (nn_chunkref_size (&ref) == (i + 1) * sizeof (key));
+        if (!nn_chunkref_ischunk (&ref))
+            nn_assert (nn_chunkref_size (&ref) < NN_CHUNKREF_MAX);
+        else if (chunk && nn_chunkref_size (&ref) <=
+              NN_CHUNKREF_MAX + NN_CHUNKREF_HEADROOM)
+            nn_assert (nn_chunkref_data (&ref) ==
+                (uint8_t*) chunk - sizeof (key));
+        chunk = nn_chunkref_ischunk (&ref) ? nn_chunkref_data (&ref) : NULL;
+    }
+    nn_assert (nn_chunkref_ischunk (&ref));
+
+    /*  The most recent entry is on the top. */
+    data = nn_chunkref_data (&ref);
+    for (j = 0; j != ENTRIES; ++j)
+        nn_assert (nn_getl (data + j * sizeof (key)) ==
+            (uint32_t) (ENTRIES - 1 - j));
+
+    /*  Pop the entries one by one. */
+    for (i = ENTRIES - 1; i >= 0; --i) {
+        data = nn_chunkref_data (&ref);
+        nn_assert (nn_getl (data) == (uint32_t) i);
+        nn_chunkref_trim (&ref, sizeof (key));
+    }
+    nn_assert (nn_chunkref_size (&ref) == 0);
+    nn_chunkref_term (&ref);
+
+    /*  A header split off a larger message can be pushed to without
+        copying. */
+    nn_chunkref_init_room (&ref, NN_CHUNKREF_MAX, NN_CHUNKREF_HEADROOM);
+    memset (nn_chunkref_data (&ref), 0, NN_CHUNKREF_MAX);
+    chunk = nn_chunkref_data (&ref);
+    nn_putl (key, 42);
+    nn_chunkref_push (&ref, key, sizeof (key));
+    nn_assert (nn_chunkref_data (&ref) == (uint8_t*) chunk - sizeof (key));
+    nn_assert (nn_chunkref_size (&ref) == NN_CHUNKREF_MAX + sizeof (key));
+    nn_assert (nn_getl (nn_chunkref_data (&ref)) == 42);
+    nn_chunkref_term (&ref);
+
+    return 0;
+}
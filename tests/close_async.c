@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+
+#include "testutil.h"
+
+/*  Tests closing the sockets without waiting for them to wind down. */
+
+#define NSOCKS 1000
+
+static char socket_address [128];
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int s;
+    int sb;
+    int sc;
+    int rep;
+    int req;
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    /*  The descriptor is invalid straight away. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    rc = nn_close_async (sc);
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_close_async (sc);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_close (sc);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_close_async (-1);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+
+    /*  Once the socket is done closing, its descriptor is reused. */
+    nn_sleep (100);
+    s = test_socket (AF_SP, NN_PAIR);
+    nn_assert (s == sc);
+    test_close (s);
+
+    /*  Plenty of short-lived sockets. They don't pile up. */
+    rep = test_socket (AF_SP, NN_REP);
+    test_bind (rep, "inproc://a");
+    for (i = 0; i != NSOCKS; ++i) {
+        req = test_socket (AF_SP, NN_REQ);
+        nn_assert (req < NSOCKS);
+        test_connect (req, "inproc://a");
+        test_send (req, "ABC");
+        test_recv (rep, "ABC");
+        test_send (rep, "DEF");
+        test_recv (req, "DEF");
+        rc = nn_close_async (req);
+        errno_assert (rc == 0);
+    }
+    test_close (rep);
+
+    /*  nn_term waits for the sockets that are still closing. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    rc = nn_close_async (sc);
+    errno_assert (rc == 0);
+    rc = nn_close_async (sb);
+    errno_assert (rc == 0);
+    nn_term ();
+    rc = nn_socket (AF_SP, NN_PAIR);
+    nn_assert (rc == -1 && nn_errno () == ETERM);
+
+    return 0;
+}
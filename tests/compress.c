@@ -0,0 +1,238 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/reqrep.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/tcp.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Tests compression of the messages passed over TCP and IPC
+    connections. Algorithms the library was built without are skipped. */
+
+#define BIGSZ 65536
+
+static char big [BIGSZ];
+static char noise [BIGSZ];
+static char buf [BIGSZ];
+
+static void send_buf (int sock, const void *data, size_t size)
+{
+    int rc;
+
+    rc = nn_send (sock, data, size, 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == size);
+}
+
+static void recv_buf (int sock, const void *data, size_t size)
+{
+    int rc;
+
+    rc = nn_recv (sock, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == size);
+    nn_assert (memcmp (buf, data, size) == 0);
+}
+
+static void test_roundtrip (char *addr, int level, int option,
+    int alg)
+{
+    int rc;
+    int rep;
+    int req;
+    int timeo;
+
+    timeo = 3000;
+    rep = test_socket (AF_SP, NN_REP);
+    test_setsockopt (rep, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (rep, level, option, &alg, sizeof (alg));
+    test_bind (rep, addr);
+    req = test_socket (AF_SP, NN_REQ);
+    test_setsockopt (req, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (req, level, option, &alg, sizeof (alg));
+    test_connect (req, addr);
+
+    /*  Compressible requests and replies, which carry the SP header, along
+        with small and incompressible ones that are sent as they are. */
+    send_buf (req, big, sizeof (big));
+    recv_buf (rep, big, sizeof (big));
+    send_buf (rep, big, sizeof (big));
+    recv_buf (req, big, sizeof (big));
+    send_buf (req, "ABC", 3);
+    recv_buf (rep, "ABC", 3);
+    send_buf (rep, noise, sizeof (noise));
+    recv_buf (req, noise, sizeof (noise));
+    send_buf (req, big, 1024);
+    recv_buf (rep, big, 1024);
+    send_buf (rep, big, 1023);
+    recv_buf (req, big, 1023);
+
+    test_close (req);
+    test_close (rep);
+
+    /*  The size of the decompressed message is checked against
+        NN_RCVMAXSIZE too. */
+    rep = test_socket (AF_SP, NN_PAIR);
+    timeo = 200;
+    test_setsockopt (rep, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    rc = BIGSZ / 2;
+    test_setsockopt (rep, NN_SOL_SOCKET, NN_RCVMAXSIZE, &rc, sizeof (rc));
+    test_bind (rep, addr);
+    req = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (req, level, option, &alg, sizeof (alg));
+    test_connect (req, addr);
+    send_buf (req, big, sizeof (big));
+    rc = nn_recv (rep, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    test_close (req);
+    test_close (rep);
+}
+
+/*  A message published to several subscribers is compressed and checksummed
+    once for all the connections that use the same algorithm. Those that
+    use another algorithm compress it themselves. */
+static void test_fanout (char *addr1, char *addr2, int alg1, int alg2)
+{
+    int pub;
+    int sub [4];
+    int opt;
+    int i;
+
+    pub = test_socket (AF_SP, NN_PUB);
+    opt = 1;
+    test_setsockopt (pub, NN_TCP, NN_TCP_CHECKSUM, &opt, sizeof (opt));
+    test_setsockopt (pub, NN_TCP, NN_TCP_COMPRESS, &alg1, sizeof (alg1));
+    test_bind (pub, addr1);
+    test_setsockopt (pub, NN_TCP, NN_TCP_COMPRESS, &alg2, sizeof (alg2));
+    test_bind (pub, addr2);
+    for (i = 0; i != 4; ++i) {
+        sub [i] = test_socket (AF_SP, NN_SUB);
+        opt = 3000;
+        test_setsockopt (sub [i], NN_SOL_SOCKET, NN_RCVTIMEO, &opt,
+            sizeof (opt));
+        test_setsockopt (sub [i], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        test_connect (sub [i], i % 2 ? addr2 : addr1);
+    }
+    nn_sleep (200);
+
+    send_buf (pub, big, sizeof (big));
+    send_buf (pub, noise, sizeof (noise));
+    send_buf (pub, "ABC", 3);
+    send_buf (pub, big, 2048);
+    for (i = 0; i != 4; ++i) {
+        recv_buf (sub [i], big, sizeof (big));
+        recv_buf (sub [i], noise, sizeof (noise));
+        recv_buf (sub [i], "ABC", 3);
+        recv_buf (sub [i], big, 2048);
+        test_close (sub [i]);
+    }
+    test_close (pub);
+}
+
+static void test_options (int level, int option, int threshold)
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+
+    s = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, level, option, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    rc = nn_getsockopt (s, level, threshold, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 1024);
+    opt = 3;
+    rc = nn_setsockopt (s, level, option, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = -1;
+    rc = nn_setsockopt (s, level, threshold, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 0;
+    test_setsockopt (s, level, threshold, &opt, sizeof (opt));
+    test_close (s);
+}
+
+/*  Returns 1 if the library was built with the algorithm. */
+static int supported (int level, int option, int alg)
+{
+    int rc;
+    int s;
+
+    s = test_socket (AF_SP, NN_PAIR);
+    rc = nn_setsockopt (s, level, option, &alg, sizeof (alg));
+    nn_assert (rc == 0 || nn_errno () == ENOTSUP);
+    test_close (s);
+    return rc == 0;
+}
+
+int main (int argc, const char *argv[])
+{
+    int i;
+    uint32_t x;
+    char addr [128];
+    char addr2 [128];
+    int port = get_test_port (argc, argv);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+
+    for (i = 0; i != BIGSZ; ++i)
+        big [i] = "The quick brown fox jumps over the lazy dog. " [i % 45];
+    x = 1;
+    for (i = 0; i != BIGSZ; ++i) {
+        x = x * 1103515245 + 12345;
+        noise [i] = (char) (x >> 24);
+    }
+
+    test_options (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_THRESHOLD);
+    test_options (NN_IPC, NN_IPC_COMPRESS, NN_IPC_COMPRESS_THRESHOLD);
+
+    test_roundtrip (addr, NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_NONE);
+    if (supported (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_LZ4)) {
+        test_roundtrip (addr, NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_LZ4);
+        test_roundtrip ("ipc://test_compress.ipc", NN_IPC, NN_IPC_COMPRESS,
+            NN_IPC_COMPRESS_LZ4);
+    }
+    if (supported (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_ZSTD)) {
+        test_roundtrip (addr, NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_ZSTD);
+        test_roundtrip ("ipc://test_compress.ipc", NN_IPC, NN_IPC_COMPRESS,
+            NN_IPC_COMPRESS_ZSTD);
+    }
+
+    test_addr_from (addr2, "tcp", "127.0.0.1", port + 1);
+    test_fanout (addr, addr2, NN_TCP_COMPRESS_NONE, NN_TCP_COMPRESS_NONE);
+    if (supported (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_LZ4))
+        test_fanout (addr, addr2, NN_TCP_COMPRESS_LZ4, NN_TCP_COMPRESS_LZ4);
+    if (supported (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_LZ4) &&
+          supported (NN_TCP, NN_TCP_COMPRESS, NN_TCP_COMPRESS_ZSTD))
+        test_fanout (addr, addr2, NN_TCP_COMPRESS_LZ4, NN_TCP_COMPRESS_ZSTD);
+
+    return 0;
+}
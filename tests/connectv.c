@@ -0,0 +1,108 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+/*  Tests adding several remote endpoints at once with nn_connectv. */
+
+#define NADDRS 3
+
+static char socket_address [NADDRS][128];
+static char connect_address [NADDRS][128];
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int push;
+    int pull [NADDRS];
+    int eids [NADDRS];
+    const char *addrs [NADDRS];
+    int timeo;
+
+    for (i = 0; i != NADDRS; ++i) {
+        test_addr_from (socket_address [i], "tcp", "127.0.0.1",
+            get_test_port (argc, argv) + i);
+        test_addr_from (connect_address [i], "tcp", "localhost",
+            get_test_port (argc, argv) + i);
+        addrs [i] = connect_address [i];
+        pull [i] = test_socket (AF_SP, NN_PULL);
+        test_bind (pull [i], socket_address [i]);
+        timeo = 1000;
+        test_setsockopt (pull [i], NN_SOL_SOCKET, NN_RCVTIMEO,
+            &timeo, sizeof (timeo));
+    }
+    push = test_socket (AF_SP, NN_PUSH);
+
+    /*  Invalid arguments. */
+    rc = nn_connectv (push, addrs, -1, NULL);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_connectv (push, NULL, 1, NULL);
+    nn_assert (rc == -1 && nn_errno () == EFAULT);
+    rc = nn_connectv (push, addrs, 0, NULL);
+    errno_assert (rc == 0);
+    rc = nn_connectv (-1, addrs, 1, NULL);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+
+    /*  None of the endpoints is created if any of the addresses is not
+        valid, whether the transport or the address itself is wrong. */
+    addrs [1] = "foo://bar";
+    rc = nn_connectv (push, addrs, NADDRS, eids);
+    nn_assert (rc == -1 && nn_errno () == EPROTONOSUPPORT);
+    addrs [1] = "tcp://localhost";
+    rc = nn_connectv (push, addrs, NADDRS, eids);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    nn_sleep (100);
+    rc = nn_send (push, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    addrs [1] = connect_address [1];
+
+    /*  Connect to all the peers. The messages are load-balanced among
+        them. */
+    rc = nn_connectv (push, addrs, NADDRS, eids);
+    errno_assert (rc == 0);
+    for (i = 0; i != NADDRS; ++i) {
+        nn_assert (eids [i] >= 0);
+        if (i > 0)
+            nn_assert (eids [i] != eids [i - 1]);
+    }
+    nn_sleep (200);
+    for (i = 0; i != NADDRS; ++i)
+        test_send (push, "ABC");
+    for (i = 0; i != NADDRS; ++i)
+        test_recv (pull [i], "ABC");
+
+    /*  The endpoints can be removed one by one. */
+    for (i = 0; i != NADDRS; ++i) {
+        rc = nn_shutdown (push, eids [i]);
+        errno_assert (rc == 0);
+    }
+
+    test_close (push);
+    for (i = 0; i != NADDRS; ++i)
+        test_close (pull [i]);
+
+    return 0;
+}
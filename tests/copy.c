@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/copy.c"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests the copying of payloads between the user's buffers and
+    the messages. */
+
+#define SIZE (1024 * 1024 + 77)
+
+static unsigned char src [SIZE + 64];
+static unsigned char dst [SIZE + 64];
+
+static void test_copy (size_t srcoff, size_t dstoff, size_t len)
+{
+    memset (dst, 0xee, sizeof (dst));
+    nn_copy (dst + dstoff, src + srcoff, len);
+    nn_assert (memcmp (dst + dstoff, src + srcoff, len) == 0);
+
+    /*  Nothing outside the destination is touched. */
+    nn_assert (dstoff == 0 || dst [dstoff - 1] == 0xee);
+    nn_assert (dst [dstoff + len] == 0xee);
+}
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    size_t i;
+    size_t j;
+    unsigned char *buf;
+    struct nn_iovec iov [3];
+    struct nn_msghdr hdr;
+
+    for (i = 0; i != sizeof (src); ++i)
+        src [i] = (unsigned char) (i * 7 + i / 251);
+
+    /*  All the sizes and alignments, either way around the threshold. */
+    rc = setenv ("NN_COPY_THRESHOLD", "1", 1);
+    errno_assert (rc == 0);
+    nn_copy_init ();
+    for (i = 0; i != 16; ++i)
+        for (j = 0; j != 16; ++j) {
+            test_copy (i, j, 0);
+            test_copy (i, j, 1);
+            test_copy (i, j, 63 + i);
+            test_copy (i, j, 200 + j);
+            test_copy (i, j, SIZE - 32);
+        }
+    rc = setenv ("NN_COPY_THRESHOLD", "0", 1);
+    errno_assert (rc == 0);
+    nn_copy_init ();
+    test_copy (3, 5, SIZE);
+    rc = setenv ("NN_COPY_THRESHOLD", "1000", 1);
+    errno_assert (rc == 0);
+    nn_copy_init ();
+    test_copy (3, 5, 999);
+    test_copy (3, 5, 1000);
+    test_copy (3, 5, SIZE);
+
+    /*  Large messages passed through the user's buffers, with the library
+        using the threshold it was given. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "inproc://copy");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://copy");
+    rc = nn_send (sc, src + 1, SIZE, 0);
+    errno_assert (rc == SIZE);
+    buf = malloc (SIZE + 1);
+    alloc_assert (buf);
+    rc = nn_recv (sb, buf + 1, SIZE, 0);
+    errno_assert (rc == SIZE);
+    nn_assert (memcmp (buf + 1, src + 1, SIZE) == 0);
+
+    /*  Scatter and gather arrays. */
+    iov [0].iov_base = src;
+    iov [0].iov_len = 5;
+    iov [1].iov_base = src + 5;
+    iov [1].iov_len = SIZE - 10;
+    iov [2].iov_base = src + SIZE - 5;
+    iov [2].iov_len = 5;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 3;
+    rc = nn_sendmsg (sb, &hdr, 0);
+    errno_assert (rc == SIZE);
+    memset (buf, 0, SIZE + 1);
+    iov [0].iov_base = buf;
+    iov [0].iov_len = 3;
+    iov [1].iov_base = buf + 3;
+    iov [1].iov_len = SIZE - 3;
+    hdr.msg_iovlen = 2;
+    rc = nn_recvmsg (sc, &hdr, 0);
+    errno_assert (rc == SIZE);
+    nn_assert (memcmp (buf, src, SIZE) == 0);
+
+    free (buf);
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+#include "../src/devices/device.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+/*  Test that devices between SUB and PUB sockets subscribe upstream only to
+    the topics wanted downstream, both when the sockets are spliced within
+    the library and when the messages are moved by a custom recipe. */
+
+#define SOCKET_ADDRESS_A "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
+
+void device10 (NN_UNUSED void *arg)
+{
+    int rc;
+    int deva;
+    int devb;
+
+    deva = test_socket (AF_SP_RAW, NN_SUB);
+    test_connect (deva, SOCKET_ADDRESS_A);
+    devb = test_socket (AF_SP_RAW, NN_PUB);
+    test_bind (devb, SOCKET_ADDRESS_B);
+
+    rc = nn_device (deva, devb);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    test_close (devb);
+    test_close (deva);
+}
+
+static int rewrite_all (NN_UNUSED struct nn_device_recipe *device,
+    NN_UNUSED int from, NN_UNUSED int to, NN_UNUSED int flags,
+    NN_UNUSED struct nn_msghdr *msghdr, NN_UNUSED int bytes)
+{
+    return 1;
+}
+
+void device11 (NN_UNUSED void *arg)
+{
+    int rc;
+    int devc;
+    int devd;
+    struct nn_device_recipe recipe;
+
+    devc = test_socket (AF_SP_RAW, NN_SUB);
+    test_connect (devc, SOCKET_ADDRESS_C);
+    devd = test_socket (AF_SP_RAW, NN_PUB);
+    test_bind (devd, SOCKET_ADDRESS_D);
+
+    /*  A custom rewrite function makes the device use threads. */
+    recipe = nn_ordinary_device;
+    recipe.nn_device_rewritemsg = rewrite_all;
+    rc = nn_custom_device (&recipe, devc, devd, 0);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    test_close (devd);
+    test_close (devc);
+}
+
+/*  Waits till the publisher's subscribers are subscribed to 'subs'. */
+static void wait_subs (int pub, const char *subs, size_t len)
+{
+    int rc;
+    int i;
+    char buf [64];
+    size_t sz;
+
+    for (i = 0; i != 100; ++i) {
+        sz = sizeof (buf);
+        rc = nn_getsockopt (pub, NN_PUB, NN_PUB_SUBSCRIPTIONS, buf, &sz);
+        errno_assert (rc == 0);
+        if (sz == len && memcmp (buf, subs, len) == 0)
+            return;
+        nn_sleep (20);
+    }
+    nn_assert (0);
+}
+
+static void test_relay (char *addr1, char *addr2)
+{
+    int rc;
+    int up;
+    int down1;
+    int down2;
+    int val;
+    char buf [2];
+    size_t sz;
+
+    up = test_socket (AF_SP_RAW, NN_PUB);
+    test_bind (up, addr1);
+    down1 = test_socket (AF_SP, NN_SUB);
+    val = 1;
+    test_setsockopt (down1, NN_SUB, NN_SUB_FORWARD, &val, sizeof (val));
+    test_setsockopt (down1, NN_SUB, NN_SUB_SUBSCRIBE, "a", 1);
+    val = 100;
+    test_setsockopt (down1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    test_connect (down1, addr2);
+
+    /*  The device subscribes upstream to what is wanted downstream. */
+    wait_subs (up, "\0\0\0\1a", 5);
+    test_send (up, "b1");
+    test_send (up, "a1");
+    test_recv (down1, "a1");
+    test_drop (down1, ETIMEDOUT);
+
+    /*  The option reports its full length even if it doesn't fit. */
+    sz = sizeof (buf);
+    rc = nn_getsockopt (up, NN_PUB, NN_PUB_SUBSCRIPTIONS, buf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == 5);
+
+    /*  Changes are relayed as well. */
+    test_setsockopt (down1, NN_SUB, NN_SUB_SUBSCRIBE, "c", 1);
+    test_setsockopt (down1, NN_SUB, NN_SUB_UNSUBSCRIBE, "a", 1);
+    wait_subs (up, "\0\0\0\1c", 5);
+    test_send (up, "a2");
+    test_send (up, "c1");
+    test_recv (down1, "c1");
+
+    /*  A subscriber that doesn't forward its subscriptions gets everything
+        until it's gone. */
+    down2 = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (down2, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    test_connect (down2, addr2);
+    wait_subs (up, "\0\0\0\0", 4);
+    test_send (up, "b2");
+    test_recv (down2, "b2");
+    test_close (down2);
+    wait_subs (up, "\0\0\0\1c", 5);
+
+    test_close (down1);
+    wait_subs (up, "", 0);
+    test_close (up);
+}
+
+int main ()
+{
+    int rc;
+    int sub;
+    struct nn_thread thread1;
+    struct nn_thread thread2;
+
+    /*  The subscriptions can be replaced at once, but only by a valid list. */
+    sub = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub, NN_SUB, NN_SUB_SUBSCRIPTIONS, "\0\0\0\1a", 5);
+    rc = nn_setsockopt (sub, NN_SUB, NN_SUB_SUBSCRIPTIONS, "\0\0\0\2a", 5);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    test_close (sub);
+
+    nn_thread_init (&thread1, device10, NULL);
+    nn_thread_init (&thread2, device11, NULL);
+
+    test_relay (SOCKET_ADDRESS_A, SOCKET_ADDRESS_B);
+    test_relay (SOCKET_ADDRESS_C, SOCKET_ADDRESS_D);
+
+    nn_term ();
+    nn_thread_term (&thread2);
+    nn_thread_term (&thread1);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/devices/device.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*  Test that devices forward a large number of messages in order, both
+    when the sockets are spliced within the library and when the messages
+    are moved in batches through a custom recipe. */
+
+#define SOCKET_ADDRESS_A "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
+
+#define MESSAGES 100000
+
+void device8 (NN_UNUSED void *arg)
+{
+    int rc;
+    int deva;
+    int devb;
+
+    /*  Intialise the device sockets. */
+    deva = test_socket (AF_SP_RAW, NN_PULL);
+    test_bind (deva, SOCKET_ADDRESS_A);
+    devb = test_socket (AF_SP_RAW, NN_PUSH);
+    test_bind (devb, SOCKET_ADDRESS_B);
+
+    /*  Run the device. */
+    rc = nn_device (deva, devb);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    /*  Clean up. */
+    test_close (devb);
+    test_close (deva);
+}
+
+/*  Drops the messages with odd numbers. */
+static int rewrite_odd (NN_UNUSED struct nn_device_recipe *device,
+    NN_UNUSED int from, NN_UNUSED int to, NN_UNUSED int flags,
+    struct nn_msghdr *msghdr, NN_UNUSED int bytes)
+{
+    void *body;
+
+    body = *(void**) msghdr->msg_iov [0].iov_base;
+    if (atoi (body) % 2 == 0)
+        return 1;
+    nn_freemsg (body);
+    nn_freemsg (*(void**) msghdr->msg_control);
+    return 0;
+}
+
+void device9 (NN_UNUSED void *arg)
+{
+    int rc;
+    int devc;
+    int devd;
+    struct nn_device_recipe recipe;
+
+    devc = test_socket (AF_SP_RAW, NN_PULL);
+    test_bind (devc, SOCKET_ADDRESS_C);
+    devd = test_socket (AF_SP_RAW, NN_PUSH);
+    test_bind (devd, SOCKET_ADDRESS_D);
+
+    recipe = nn_ordinary_device;
+    recipe.nn_device_rewritemsg = rewrite_odd;
+    rc = nn_custom_device (&recipe, devc, devd, 0);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    test_close (devd);
+    test_close (devc);
+}
+
+void sender (void *arg)
+{
+    int rc;
+    int i;
+    void *buf;
+
+    for (i = 0; i != MESSAGES; ++i) {
+        buf = nn_allocmsg (16, 0);
+        alloc_assert (buf);
+        sprintf (buf, "%d", i);
+        rc = nn_send (*(int*) arg, &buf, NN_MSG, 0);
+        errno_assert (rc == 16);
+    }
+}
+
+static void test_forward (char *addr1, char *addr2, int step)
+{
+    int rc;
+    int end1;
+    int end2;
+    int i;
+    int timeo;
+    void *buf;
+    char body [16];
+    struct nn_thread thread;
+
+    end1 = test_socket (AF_SP, NN_PUSH);
+    test_connect (end1, addr1);
+    end2 = test_socket (AF_SP, NN_PULL);
+    test_connect (end2, addr2);
+    timeo = 5000;
+    test_setsockopt (end2, NN_SOL_SOCKET, NN_RCVTIMEO,
+        &timeo, sizeof (timeo));
+
+    /*  Zero-copy messages are passed through the device and arrive in order.
+        There are more of them than the socket buffers can hold, so the device
+        has to wait for both of the sockets. */
+    nn_thread_init (&thread, sender, &end1);
+    for (i = 0; i < MESSAGES; i += step) {
+        rc = nn_recv (end2, &buf, NN_MSG, 0);
+        errno_assert (rc == sizeof (body));
+        sprintf (body, "%d", i);
+        nn_assert (strcmp (buf, body) == 0);
+        rc = nn_freemsg (buf);
+        errno_assert (rc == 0);
+    }
+    nn_thread_term (&thread);
+
+    test_close (end2);
+    test_close (end1);
+}
+
+int main ()
+{
+    struct nn_thread thread1;
+    struct nn_thread thread2;
+
+    /*  Start the devices. */
+    nn_thread_init (&thread1, device8, NULL);
+    nn_thread_init (&thread2, device9, NULL);
+
+    test_forward (SOCKET_ADDRESS_A, SOCKET_ADDRESS_B, 1);
+    test_forward (SOCKET_ADDRESS_C, SOCKET_ADDRESS_D, 2);
+
+    /*  Shut down the devices. */
+    nn_term ();
+    nn_thread_term (&thread2);
+    nn_thread_term (&thread1);
+
+    return 0;
+}
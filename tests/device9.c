@@ -0,0 +1,211 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/reqrep.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*  Test devices forwarding messages by several workers in parallel. */
+
+#define SOCKET_ADDRESS_A "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
+
+#define SHARDS 4
+#define CLIENTS 4
+#define REQUESTS 2000
+#define MESSAGES 100000
+
+void device_reqrep (NN_UNUSED void *arg)
+{
+    int rc;
+    int deva;
+    int devb;
+
+    deva = test_socket (AF_SP_RAW, NN_REP);
+    test_bind (deva, SOCKET_ADDRESS_A);
+    devb = test_socket (AF_SP_RAW, NN_REQ);
+    test_bind (devb, SOCKET_ADDRESS_B);
+
+    rc = nn_device_sharded (deva, devb, SHARDS);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    test_close (devb);
+    test_close (deva);
+}
+
+void device_pipeline (NN_UNUSED void *arg)
+{
+    int rc;
+    int devc;
+    int devd;
+
+    devc = test_socket (AF_SP_RAW, NN_PULL);
+    test_bind (devc, SOCKET_ADDRESS_C);
+    devd = test_socket (AF_SP_RAW, NN_PUSH);
+    test_bind (devd, SOCKET_ADDRESS_D);
+
+    rc = nn_device_sharded (devc, devd, SHARDS);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    test_close (devd);
+    test_close (devc);
+}
+
+/*  Echoes the requests till the socket is closed. */
+void server (void *arg)
+{
+    int rc;
+    void *buf;
+
+    while (1) {
+        rc = nn_recv (*(int*) arg, &buf, NN_MSG, 0);
+        if (rc < 0 && nn_errno () == EBADF)
+            break;
+        errno_assert (rc >= 0);
+        rc = nn_send (*(int*) arg, &buf, NN_MSG, 0);
+        if (rc < 0 && nn_errno () == EBADF) {
+            nn_freemsg (buf);
+            break;
+        }
+        errno_assert (rc >= 0);
+    }
+}
+
+/*  Each reply has to get back to the client that sent the request. */
+void client (void *arg)
+{
+    int s;
+    int i;
+    int timeo;
+    char body [32];
+
+    s = test_socket (AF_SP, NN_REQ);
+    test_connect (s, SOCKET_ADDRESS_A);
+    timeo = 5000;
+    test_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    for (i = 0; i != REQUESTS; ++i) {
+        sprintf (body, "%d-%d", *(int*) arg, i);
+        test_send (s, body);
+        test_recv (s, body);
+    }
+    test_close (s);
+}
+
+void sender (void *arg)
+{
+    int rc;
+    int i;
+    void *buf;
+
+    for (i = 0; i != MESSAGES; ++i) {
+        buf = nn_allocmsg (sizeof (int), 0);
+        alloc_assert (buf);
+        memcpy (buf, &i, sizeof (int));
+        rc = nn_send (*(int*) arg, &buf, NN_MSG, 0);
+        errno_assert (rc == sizeof (int));
+    }
+}
+
+int main ()
+{
+    int rc;
+    int i;
+    int n;
+    int rep1;
+    int rep2;
+    int push;
+    int pull;
+    int timeo;
+    int ids [CLIENTS];
+    void *buf;
+    char *seen;
+    struct nn_thread devices [2];
+    struct nn_thread servers [2];
+    struct nn_thread clients [CLIENTS];
+    struct nn_thread thread;
+
+    nn_thread_init (&devices [0], device_reqrep, NULL);
+    nn_thread_init (&devices [1], device_pipeline, NULL);
+
+    /*  The backtraces of the requests are preserved, whichever worker
+        forwards them. */
+    rep1 = test_socket (AF_SP, NN_REP);
+    test_connect (rep1, SOCKET_ADDRESS_B);
+    rep2 = test_socket (AF_SP, NN_REP);
+    test_connect (rep2, SOCKET_ADDRESS_B);
+    nn_thread_init (&servers [0], server, &rep1);
+    nn_thread_init (&servers [1], server, &rep2);
+    for (i = 0; i != CLIENTS; ++i) {
+        ids [i] = i;
+        nn_thread_init (&clients [i], client, &ids [i]);
+    }
+    for (i = 0; i != CLIENTS; ++i)
+        nn_thread_term (&clients [i]);
+    test_close (rep2);
+    test_close (rep1);
+    nn_thread_term (&servers [1]);
+    nn_thread_term (&servers [0]);
+
+    /*  No message is lost or duplicated, though they may be reordered. */
+    push = test_socket (AF_SP, NN_PUSH);
+    test_connect (push, SOCKET_ADDRESS_C);
+    pull = test_socket (AF_SP, NN_PULL);
+    test_connect (pull, SOCKET_ADDRESS_D);
+    timeo = 5000;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO,
+        &timeo, sizeof (timeo));
+    seen = calloc (MESSAGES, 1);
+    alloc_assert (seen);
+    nn_thread_init (&thread, sender, &push);
+    for (i = 0; i != MESSAGES; ++i) {
+        rc = nn_recv (pull, &buf, NN_MSG, 0);
+        errno_assert (rc == sizeof (int));
+        memcpy (&n, buf, sizeof (int));
+        nn_assert (n >= 0 && n < MESSAGES && !seen [n]);
+        seen [n] = 1;
+        rc = nn_freemsg (buf);
+        errno_assert (rc == 0);
+    }
+    nn_thread_term (&thread);
+    free (seen);
+    test_close (pull);
+    test_close (push);
+
+    /*  The shard count is validated. */
+    rc = nn_device_sharded (-1, -1, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    nn_term ();
+    nn_thread_term (&devices [1]);
+    nn_thread_term (&devices [0]);
+
+    return 0;
+}
@@ -25,12 +25,16 @@
 #include "../src/utils/hash.c"
 #include "../src/utils/alloc.c"
 
+#define NN_HASH_TEST_ITEMS 3001
+
 int main ()
 {
     struct nn_hash hash;
     uint32_t k;
     struct nn_hash_item *item;
     struct nn_hash_item *item5000 = NULL;
+    static struct nn_hash_item *items [NN_HASH_TEST_ITEMS];
+    uint32_t i;
 
     nn_hash_init (&hash);
 
@@ -55,6 +59,41 @@ int main ()
     }
     nn_hash_term (&hash);
 
+    /*  Keep inserting and erasing items in the way REP sockets do with
+        connecting and disconnecting peers, including while the table is
+        growing. Check all the items are found all the time. */
+    nn_hash_init (&hash);
+    for (k = 0; k != NN_HASH_TEST_ITEMS; ++k)
+        items [k] = NULL;
+    for (i = 0; i != 200000; ++i) {
+        k = (i * 7919) % NN_HASH_TEST_ITEMS;
+        if (items [k]) {
+            nn_assert (nn_hash_get (&hash, k + 0x10000) == items [k]);
+            nn_hash_erase (&hash, items [k]);
+            nn_hash_item_term (items [k]);
+            nn_free (items [k]);
+            items [k] = NULL;
+            nn_assert (nn_hash_get (&hash, k + 0x10000) == NULL);
+        }
+        else {
+            items [k] = nn_alloc (sizeof (struct nn_hash_item), "item");
+            nn_assert (items [k]);
+            nn_hash_item_init (items [k]);
+            nn_hash_insert (&hash, k + 0x10000, items [k]);
+        }
+        if (i % 1000 == 0) {
+            for (k = 0; k != NN_HASH_TEST_ITEMS; ++k)
+                nn_assert (nn_hash_get (&hash, k + 0x10000) == items [k]);
+        }
+    }
+    for (k = 0; k != NN_HASH_TEST_ITEMS; ++k) {
+        if (items [k]) {
+            nn_hash_erase (&hash, items [k]);
+            nn_free (items [k]);
+        }
+    }
+    nn_hash_term (&hash);
+
     return 0;
 }
 
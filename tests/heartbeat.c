@@ -0,0 +1,188 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+#include <string.h>
+
+#if defined __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+/*  Tests SP-level heartbeats. */
+
+#define HEARTBEAT_IVL 50
+
+static void test_idle (char *addr)
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    char buf [8];
+
+    /*  Heartbeats keep an idle connection alive and they are not passed to
+        the user. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = HEARTBEAT_IVL;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    opt = 1000;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sb, addr);
+    test_connect (sc, addr);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    nn_sleep (HEARTBEAT_IVL * 10);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (sc, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_assert (nn_get_statistic (sc, NN_STAT_BROKEN_CONNECTIONS) == 0);
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 0);
+
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+
+    /*  Nor do they get in the way of the messages not picked up. */
+    test_send (sc, "GHI");
+    nn_sleep (HEARTBEAT_IVL * 10);
+    test_recv (sb, "GHI");
+
+    test_close (sc);
+    test_close (sb);
+}
+
+#if defined __linux__
+
+static void test_dead (int port)
+{
+    int rc;
+    int sb;
+    int s;
+    int opt;
+    struct timeval tv;
+    struct sockaddr_in addr;
+    char saddr [128];
+    uint8_t hdr [8];
+    uint8_t frame [12];
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = HEARTBEAT_IVL;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    test_addr_from (saddr, "tcp", "127.0.0.1", port);
+    test_bind (sb, saddr);
+
+    /*  The peer is a raw TCP connection that announces it's able to
+        recognise heartbeats. */
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (port);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    tv.tv_sec = 3;
+    tv.tv_usec = 0;
+    rc = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    errno_assert (rc == 0);
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    memcpy (hdr, "\0SP\0\0\0\x08\0", 8);
+    hdr [5] = NN_PAIR & 0xff;
+    rc = (int) write (s, hdr, sizeof (hdr));
+    errno_assert (rc == sizeof (hdr));
+    rc = test_raw_read (s, hdr, sizeof (hdr));
+    nn_assert (rc == 0);
+    nn_assert (memcmp (hdr, "\0SP\0", 4) == 0);
+    nn_assert (hdr [6] & 0x08);
+
+    /*  The interval is announced as soon as the connection is set up. */
+    rc = test_raw_read (s, frame, sizeof (frame));
+    nn_assert (rc == 0);
+    nn_assert (memcmp (frame, "\x81\0\0\0\0\0\0\x04\0\0\0", 11) == 0);
+    nn_assert (frame [11] == HEARTBEAT_IVL);
+
+    /*  Once the peer announces its own interval and then falls silent,
+        the connection is dropped after three of its intervals. */
+    memcpy (frame, "\x81\0\0\0\0\0\0\x04\0\0\0\0", 12);
+    frame [11] = HEARTBEAT_IVL;
+    nn_stopwatch_init (&stopwatch);
+    rc = (int) write (s, frame, sizeof (frame));
+    errno_assert (rc == sizeof (frame));
+    while (test_raw_read (s, frame, sizeof (frame)) == 0)
+        nn_assert (frame [0] == 0x81);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed >= 3 * HEARTBEAT_IVL * 1000 - 20000);
+    nn_assert (elapsed < 2000000);
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 1);
+
+    close (s);
+    test_close (sb);
+}
+
+#endif
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    s = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_idle (addr);
+    test_idle ("ipc://test-heartbeat.ipc");
+    test_addr_from (addr, "ws", "127.0.0.1", port + 1);
+    test_idle (addr);
+
+#if defined __linux__
+    test_dead (port + 2);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/err.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/hugearena.c"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Test of the huge page arena allocator. */
+
+#define COUNT 1000
+
+static void *blocks [COUNT];
+static size_t sizes [COUNT];
+
+static void fill (int i)
+{
+    memset (blocks [i], (unsigned char) i, sizes [i]);
+}
+
+static void check (int i)
+{
+    size_t j;
+
+    for (j = 0; j != sizes [i]; ++j)
+        nn_assert (((unsigned char*) blocks [i]) [j] == (unsigned char) i);
+}
+
+int main ()
+{
+    int rc;
+    int i;
+    int count;
+    int huge;
+    void *p;
+    void *q;
+
+    rc = nn_hugearena_init (2);
+    if (rc == -ENOTSUP)
+        return 0;
+    errnum_assert (rc == 0, -rc);
+    count = nn_hugearena_count (&huge);
+    nn_assert (count == 2 && huge <= count);
+
+    /*  Blocks of all sizes, including those too large for an arena, are
+        aligned and don't overlap. */
+    for (i = 0; i != COUNT; ++i) {
+        sizes [i] = (size_t) (i * 7919) % (i % 100 ? 4096 : 1024 * 1024);
+        blocks [i] = nn_hugearena_alloc (sizes [i], NULL);
+        alloc_assert (blocks [i]);
+        nn_assert ((uintptr_t) blocks [i] % (2 * sizeof (void*)) == 0);
+        fill (i);
+    }
+    for (i = 0; i != COUNT; ++i)
+        check (i);
+
+    /*  Growing a block keeps its contents. */
+    for (i = 0; i < COUNT; i += 3) {
+        blocks [i] = nn_hugearena_realloc (blocks [i], sizes [i] * 2 + 1,
+            NULL);
+        alloc_assert (blocks [i]);
+        check (i);
+        sizes [i] = sizes [i] * 2 + 1;
+        fill (i);
+    }
+    for (i = 0; i != COUNT; ++i)
+        check (i);
+
+    /*  Freed blocks are reused. */
+    for (i = 0; i < COUNT; i += 2)
+        nn_hugearena_free (blocks [i], NULL);
+    count = nn_hugearena_count (NULL);
+    for (i = 0; i < COUNT; i += 2) {
+        blocks [i] = nn_hugearena_alloc (sizes [i], NULL);
+        alloc_assert (blocks [i]);
+        fill (i);
+    }
+    nn_assert (nn_hugearena_count (NULL) == count);
+    for (i = 0; i != COUNT; ++i)
+        check (i);
+    for (i = 0; i != COUNT; ++i)
+        nn_hugearena_free (blocks [i], NULL);
+
+    p = nn_hugearena_alloc (100, NULL);
+    nn_hugearena_free (p, NULL);
+    q = nn_hugearena_alloc (100, NULL);
+    nn_assert (p == q);
+    nn_hugearena_free (q, NULL);
+
+    /*  Further arenas are mapped on demand. */
+    count = nn_hugearena_count (NULL);
+    for (i = 0; i != 64; ++i) {
+        blocks [i] = nn_hugearena_alloc (200000, NULL);
+        alloc_assert (blocks [i]);
+    }
+    nn_assert (nn_hugearena_count (NULL) > count);
+    for (i = 0; i != 64; ++i)
+        nn_hugearena_free (blocks [i], NULL);
+
+    return 0;
+}
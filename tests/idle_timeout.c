@@ -0,0 +1,119 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+/*  Tests closing of idle connections of bound endpoints. */
+
+#define IDLE_TIMEOUT 100
+
+static void test_reap (char *addr, int heartbeat)
+{
+    int sb;
+    int sc;
+    int opt;
+    int i;
+
+    /*  Only the bound side closes idle connections. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = IDLE_TIMEOUT;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_IDLE_TIMEOUT, &opt, sizeof (opt));
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &heartbeat,
+        sizeof (heartbeat));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_IDLE_TIMEOUT, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &heartbeat,
+        sizeof (heartbeat));
+    test_connect (sc, addr);
+
+    /*  Messages in either direction keep the connection open, heartbeats
+        don't count. */
+    for (i = 0; i != 10; ++i) {
+        if (i % 2) {
+            test_send (sc, "ABC");
+            test_recv (sb, "ABC");
+        }
+        else {
+            test_send (sb, "DEF");
+            test_recv (sc, "DEF");
+        }
+        nn_sleep (IDLE_TIMEOUT / 2);
+    }
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 0);
+
+    /*  Nor is a connection idle while a message waits to be picked up. */
+    test_send (sc, "GHI");
+    nn_sleep (IDLE_TIMEOUT * 3);
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 0);
+    test_recv (sb, "GHI");
+
+    /*  Once it's quiet for the timeout, it's closed. */
+    for (i = 0; i != 100; ++i) {
+        if (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) != 0)
+            break;
+        nn_sleep (IDLE_TIMEOUT / 4);
+    }
+    nn_assert (i != 100);
+    nn_assert (i * (IDLE_TIMEOUT / 4) >= IDLE_TIMEOUT / 2);
+
+    /*  The peer reconnects and the messages flow again. */
+    test_send (sc, "JKL");
+    test_recv (sb, "JKL");
+    nn_assert (nn_get_statistic (sc, NN_STAT_BROKEN_CONNECTIONS) >= 1);
+
+    test_close (sc);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    s = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_IDLE_TIMEOUT, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_IDLE_TIMEOUT, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_reap (addr, 0);
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 1);
+    test_reap (addr, IDLE_TIMEOUT / 4);
+    test_addr_from (addr, "ws", "127.0.0.1", port + 2);
+    test_reap (addr, 0);
+    test_reap ("ipc://test_idle_timeout.ipc", 0);
+
+    return 0;
+}
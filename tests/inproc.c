@@ -38,6 +38,7 @@ int main ()
     int sb;
     int sc;
     int s1, s2;
+    int socks [64];
     int i;
     char buf [256];
     int val;
@@ -217,6 +218,55 @@ int main ()
     test_close (sc);
     test_close (s2);
 
+    /*  Connect and disconnect over and over again. The pipes get recycled,
+        yet each new connection has to start afresh. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    for (i = 0; i != 100; ++i) {
+        sc = test_socket (AF_SP, NN_PAIR);
+        test_connect (sc, SOCKET_ADDRESS);
+        test_send (sc, "ABC");
+        test_recv (sb, "ABC");
+        test_send (sb, "DEF");
+        test_recv (sc, "DEF");
+        test_close (sc);
+    }
+    test_close (sb);
+
+    /*  Many endpoints, connected both before and after they are bound. */
+    sc = test_socket (AF_SP, NN_BUS);
+    for (i = 0; i != 64; ++i) {
+        sprintf (buf, "inproc://many%d", i);
+        test_connect (sc, buf);
+    }
+    for (i = 0; i != 64; ++i) {
+        sprintf (buf, "inproc://many%d", i);
+        socks [i] = test_socket (AF_SP, NN_BUS);
+        val = test_bind (socks [i], buf);
+        rc = nn_bind (sc, buf);
+        nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+        if (i % 2) {
+            rc = nn_shutdown (socks [i], val);
+            errno_assert (rc == 0);
+            test_bind (socks [i], buf);
+        }
+    }
+    sb = test_socket (AF_SP, NN_BUS);
+    for (i = 0; i != 64; ++i) {
+        sprintf (buf, "inproc://many%d", i);
+        test_connect (sb, buf);
+    }
+    nn_sleep (100);
+    test_send (sc, "ABC");
+    test_send (sb, "DEF");
+    for (i = 0; i != 64; ++i) {
+        test_recv (socks [i], "ABC");
+        test_recv (socks [i], "DEF");
+        test_close (socks [i]);
+    }
+    test_close (sb);
+    test_close (sc);
+
     return 0;
 }
 
@@ -58,6 +58,25 @@ int main ()
     nn_sleep (200);
 
     sb = test_socket (AF_SP, NN_PAIR);
+
+    /*  Check RCVBATCH socket option. The pipe picks it up when connected. */
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_IPC, NN_IPC_RCVBATCH, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt_sz == sizeof (opt));
+    nn_assert (opt == 65536);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_IPC, NN_IPC_RCVBATCH, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4096;
+    rc = nn_setsockopt (sb, NN_IPC, NN_IPC_RCVBATCH, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_IPC, NN_IPC_RCVBATCH, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 4096);
+    opt_sz = sizeof (opt);
+
     test_bind (sb, SOCKET_ADDRESS);
 
     /*  Ping-pong test. */
@@ -0,0 +1,218 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+
+#include <unistd.h>
+
+/*  Tests passing file descriptors over the IPC transport. */
+
+#define SOCKET_ADDRESS "ipc://test_fds.ipc"
+
+static void send_fds (int s, const char *data, size_t len, int *fds,
+    int nfds)
+{
+    int rc;
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    unsigned char ctrl [256];
+    struct nn_cmsghdr *cmsg;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = len;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (sizeof (int) * nfds);
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    cmsg->cmsg_level = NN_IPC;
+    cmsg->cmsg_type = NN_IPC_FDS;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int) * nfds);
+    memcpy (NN_CMSG_DATA (cmsg), fds, sizeof (int) * nfds);
+    rc = nn_sendmsg (s, &hdr, 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == len);
+}
+
+/*  Receives a message and returns the number of descriptors it carried. */
+static int recv_fds (int s, char *buf, size_t len, int *fds)
+{
+    int rc;
+    int nfds;
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    unsigned char ctrl [256];
+    struct nn_cmsghdr *cmsg;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof (ctrl);
+    rc = nn_recvmsg (s, &hdr, 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == len);
+
+    nfds = 0;
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    while (cmsg) {
+        if (cmsg->cmsg_level == NN_IPC && cmsg->cmsg_type == NN_IPC_FDS) {
+            nfds = (int) ((cmsg->cmsg_len - NN_CMSG_LEN (0)) / sizeof (int));
+            memcpy (fds, NN_CMSG_DATA (cmsg), sizeof (int) * nfds);
+        }
+        cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+    }
+    return nfds;
+}
+
+/*  Checks that the received descriptor refers to the pipe. */
+static void check_pipe (int wfd, int rfd, char c)
+{
+    ssize_t nbytes;
+    char buf;
+
+    nbytes = write (wfd, &c, 1);
+    nn_assert (nbytes == 1);
+    nbytes = read (rfd, &buf, 1);
+    nn_assert (nbytes == 1);
+    nn_assert (buf == c);
+}
+
+int main ()
+{
+    int sb;
+    int sc;
+    int rc;
+    int i;
+    int p [2];
+    int fds [NN_IPC_MAXFDS + 1];
+    int rfds [NN_IPC_MAXFDS];
+    int nfds;
+    char buf [4096];
+    char big [4096];
+
+    rc = pipe (p);
+    errno_assert (rc == 0);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+
+    /*  Wait for the connection to be established. */
+    test_send (sc, "0");
+    test_recv (sb, "0");
+
+    /*  Pass the write end of the pipe and write to it at the other side. */
+    send_fds (sc, "ABC", 3, &p [1], 1);
+    nfds = recv_fds (sb, buf, 3, rfds);
+    nn_assert (nfds == 1);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+    nn_assert (rfds [0] != p [1]);
+    check_pipe (rfds [0], p [0], 'x');
+    close (rfds [0]);
+
+    /*  Messages with and without descriptors, small and large, queued at
+        once so that they are batched. */
+    memset (big, 'b', sizeof (big));
+    for (i = 0; i != 10; ++i) {
+        test_send (sc, "plain");
+        send_fds (sc, i % 2 ? big : "small", i % 2 ? sizeof (big) : 5,
+            &p [1], 1);
+    }
+    for (i = 0; i != 10; ++i) {
+        test_recv (sb, "plain");
+        nfds = recv_fds (sb, buf, i % 2 ? sizeof (big) : 5, rfds);
+        nn_assert (nfds == 1);
+        nn_assert (memcmp (buf, i % 2 ? big : "small",
+            i % 2 ? sizeof (big) : 5) == 0);
+        check_pipe (rfds [0], p [0], (char) ('0' + i));
+        close (rfds [0]);
+    }
+
+    /*  Maximum number of descriptors in a message. */
+    for (i = 0; i != NN_IPC_MAXFDS; ++i)
+        fds [i] = p [1];
+    send_fds (sb, "MAX", 3, fds, NN_IPC_MAXFDS);
+    nfds = recv_fds (sc, buf, 3, rfds);
+    nn_assert (nfds == NN_IPC_MAXFDS);
+    for (i = 0; i != NN_IPC_MAXFDS; ++i) {
+        check_pipe (rfds [i], p [0], 'm');
+        close (rfds [i]);
+    }
+
+    /*  Descriptors of a message received without a control buffer are
+        closed by the library. */
+    send_fds (sc, "DROP", 4, &p [1], 1);
+    test_recv (sb, "DROP");
+
+    /*  Too many descriptors and invalid ones. */
+    {
+        struct nn_iovec iov;
+        struct nn_msghdr hdr;
+        unsigned char ctrl [256];
+        struct nn_cmsghdr *cmsg;
+
+        fds [NN_IPC_MAXFDS] = p [1];
+        iov.iov_base = "X";
+        iov.iov_len = 1;
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen =
+            NN_CMSG_SPACE (sizeof (int) * (NN_IPC_MAXFDS + 1));
+        cmsg = NN_CMSG_FIRSTHDR (&hdr);
+        cmsg->cmsg_level = NN_IPC;
+        cmsg->cmsg_type = NN_IPC_FDS;
+        cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int) * (NN_IPC_MAXFDS + 1));
+        memcpy (NN_CMSG_DATA (cmsg), fds,
+            sizeof (int) * (NN_IPC_MAXFDS + 1));
+        rc = nn_sendmsg (sc, &hdr, 0);
+        nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+        fds [0] = -1;
+        hdr.msg_controllen = NN_CMSG_SPACE (sizeof (int));
+        cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int));
+        memcpy (NN_CMSG_DATA (cmsg), fds, sizeof (int));
+        rc = nn_sendmsg (sc, &hdr, 0);
+        nn_assert (rc < 0 && nn_errno () == EBADF);
+    }
+
+    /*  The connection still works. */
+    test_send (sc, "END");
+    test_recv (sb, "END");
+
+    test_close (sc);
+    test_close (sb);
+    close (p [0]);
+    close (p [1]);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+
+#include <unistd.h>
+
+/*  Tests SOCK_SEQPACKET connections and abstract addresses of the IPC
+    transport. */
+
+#define SOCKET_ADDRESS "ipc://test_seqpacket.ipc"
+#define ABSTRACT_ADDRESS "ipc://@nanomsg-test-abstract"
+
+static void test_transfer (int sb, int sc)
+{
+    int i;
+    int rc;
+    size_t size;
+    char *buf;
+    void *msg;
+
+    /*  Ping-pong. */
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+
+    /*  Many small messages, coalesced by the sender. */
+    for (i = 0; i != 1000; ++i)
+        test_send (sc, "XYZ");
+    for (i = 0; i != 1000; ++i)
+        test_recv (sb, "XYZ");
+
+    /*  Messages larger than a record. */
+    for (size = 60000; size <= 1000000; size *= 4) {
+        buf = malloc (size);
+        alloc_assert (buf);
+        for (i = 0; i != (int) size; ++i)
+            buf [i] = (char) ('0' + i % 10);
+        rc = nn_send (sc, buf, size, 0);
+        errno_assert (rc >= 0);
+        nn_assert ((size_t) rc == size);
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert ((size_t) rc == size);
+        nn_assert (memcmp (msg, buf, size) == 0);
+        nn_freemsg (msg);
+        free (buf);
+    }
+}
+
+int main ()
+{
+    int sb;
+    int sc;
+    int rc;
+    int opt;
+    size_t opt_sz;
+
+    /*  Check the NN_IPC_SEQPACKET option. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt_sz == sizeof (opt));
+    nn_assert (opt == 0);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    test_setsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 1);
+    test_bind (sb, SOCKET_ADDRESS);
+
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+    test_connect (sc, SOCKET_ADDRESS);
+    test_transfer (sb, sc);
+
+    /*  Records stay small if the send buffer is. */
+    test_close (sc);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+    opt = 4096;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBUF, &opt, sizeof (opt));
+    test_connect (sc, SOCKET_ADDRESS);
+    test_transfer (sb, sc);
+    test_close (sc);
+    test_close (sb);
+
+#if defined __linux__
+    /*  Abstract addresses, both for streams and SOCK_SEQPACKET. No file
+        is created for them. */
+    for (opt = 0; opt != 2; ++opt) {
+        sb = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+        test_bind (sb, ABSTRACT_ADDRESS);
+        nn_assert (access ("@nanomsg-test-abstract", F_OK) != 0);
+        sc = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sc, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+        test_connect (sc, ABSTRACT_ADDRESS);
+        test_transfer (sb, sc);
+
+        /*  The address is taken while bound. */
+        rc = nn_bind (sc, ABSTRACT_ADDRESS);
+        nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+
+        test_close (sc);
+        test_close (sb);
+    }
+
+    /*  The address can be bound again right away. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, ABSTRACT_ADDRESS);
+    test_close (sb);
+#endif
+
+    return 0;
+}
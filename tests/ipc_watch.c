@@ -0,0 +1,70 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+/*  Tests that a connecting IPC endpoint connects as soon as the peer binds
+    the address instead of waiting for the reconnect interval to pass. */
+
+#define SOCKET_ADDRESS "ipc://test_ipc_watch.ipc"
+
+/*  Long enough for the test to time out if the endpoint waited for it. */
+#define RECONNECT_IVL 5000
+
+int main ()
+{
+    int sb;
+    int sc;
+    int opt;
+
+    /*  The first attempt fails and is retried right away. The one after
+        that waits for the reconnect interval. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = RECONNECT_IVL;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RECONNECT_IVL, &opt, sizeof (opt));
+    opt = 1000;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+    test_connect (sc, SOCKET_ADDRESS);
+    nn_sleep (100);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    /*  The same goes for a peer that restarts. */
+    test_close (sb);
+    nn_sleep (100);
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    test_send (sc, "DEF");
+    test_recv (sb, "DEF");
+
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
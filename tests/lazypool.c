@@ -0,0 +1,106 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+
+/*  The worker threads are started only once some AIO object needs them. */
+
+static char socket_address [128];
+
+/*  Returns the number of threads in the process, -1 if it can't tell. */
+static int nthreads (void)
+{
+#if defined __linux__
+    FILE *f;
+    char buf [512];
+    int n;
+
+    f = fopen ("/proc/self/status", "r");
+    if (!f)
+        return -1;
+    n = -1;
+    while (fgets (buf, sizeof (buf), f))
+        if (sscanf (buf, "Threads: %d", &n) == 1)
+            break;
+    fclose (f);
+    return n;
+#else
+    return -1;
+#endif
+}
+
+int main (int argc, const char *argv[])
+{
+    int sb;
+    int sc;
+    int req;
+    int rep;
+    int n;
+    int ivl;
+
+    /*  Inproc sockets do without any worker threads. */
+    n = nthreads ();
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "inproc://lazy");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://lazy");
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    nn_assert (nthreads () == n);
+
+    /*  So do the protocol timers that are never started. */
+    rep = test_socket (AF_SP, NN_REP);
+    test_bind (rep, "inproc://lazy-reqrep");
+    req = test_socket (AF_SP, NN_REQ);
+    test_connect (req, "inproc://lazy-reqrep");
+    nn_assert (nthreads () == n);
+
+    /*  A running timer needs a worker. */
+    ivl = 1000;
+    test_setsockopt (req, NN_REQ, NN_REQ_RESEND_IVL, &ivl, sizeof (ivl));
+    test_send (req, "DEF");
+    test_recv (rep, "DEF");
+    nn_assert (n < 0 || nthreads () > n);
+    test_close (req);
+    test_close (rep);
+
+    /*  As do the TCP connections, which keep working as before. */
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+    test_bind (sb, socket_address);
+    test_close (sc);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    test_send (sc, "GHI");
+    test_recv (sb, "GHI");
+
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
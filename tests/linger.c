@@ -0,0 +1,141 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+#include <string.h>
+
+/*  Tests that the outbound messages are sent before the socket is closed,
+    for up to NN_LINGER milliseconds. */
+
+#define MSGSIZE (1024 * 1024)
+#define MAXMSGS 64
+
+static char socket_address [128];
+static char socket_address_b [128];
+static char buf [MSGSIZE];
+
+/*  Fills up the connection the peer doesn't read from. Returns the number
+    of the messages sent. */
+static int fill (int push)
+{
+    int rc;
+    int i;
+
+    for (i = 0; i != MAXMSGS; ++i) {
+        rc = nn_send (push, buf, MSGSIZE, NN_DONTWAIT);
+        if (rc < 0 && nn_errno () == EAGAIN)
+            break;
+        errno_assert (rc == MSGSIZE);
+    }
+    return i;
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int n;
+    int pull;
+    int push;
+    int linger;
+    int timeo;
+    size_t sz;
+    void *msg;
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+    test_addr_from (socket_address_b, "tcp", "127.0.0.1",
+        get_test_port (argc, argv) + 1);
+    memset (buf, 'a', sizeof (buf));
+
+    /*  Linger is off by default. */
+    push = test_socket (AF_SP, NN_PUSH);
+    linger = -2;
+    sz = sizeof (linger);
+    rc = nn_getsockopt (push, NN_SOL_SOCKET, NN_LINGER, &linger, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (linger) && linger == 0);
+    linger = 10000;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_LINGER, &linger, sizeof (linger));
+    linger = 0;
+    rc = nn_getsockopt (push, NN_SOL_SOCKET, NN_LINGER, &linger, &sz);
+    errno_assert (rc == 0);
+    nn_assert (linger == 10000);
+
+    /*  Nothing is lost if the socket is closed while its messages are still
+        on the way. */
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, socket_address);
+    test_connect (push, socket_address);
+    test_send (push, "ABC");
+    test_recv (pull, "ABC");
+    n = fill (push);
+    nn_assert (n > 0 && n < MAXMSGS);
+    rc = nn_close_async (push);
+    errno_assert (rc == 0);
+    timeo = 5000;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    for (i = 0; i != n; ++i) {
+        rc = nn_recv (pull, &msg, NN_MSG, 0);
+        errno_assert (rc == MSGSIZE);
+        nn_freemsg (msg);
+    }
+
+    /*  Once everything is sent, the socket is closed straight away. */
+    push = test_socket (AF_SP, NN_PUSH);
+    test_setsockopt (push, NN_SOL_SOCKET, NN_LINGER, &linger, sizeof (linger));
+    test_connect (push, socket_address);
+    test_send (push, "ABC");
+    test_recv (pull, "ABC");
+    nn_stopwatch_init (&stopwatch);
+    test_close (push);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed < 1000000);
+    test_close (pull);
+
+    /*  If the peer doesn't read, the messages are dropped once the time
+        is up. */
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, socket_address_b);
+    push = test_socket (AF_SP, NN_PUSH);
+    linger = 200;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_LINGER, &linger, sizeof (linger));
+    test_connect (push, socket_address_b);
+    test_send (push, "ABC");
+    test_recv (pull, "ABC");
+    n = fill (push);
+    nn_assert (n > 0 && n < MAXMSGS);
+    nn_stopwatch_init (&stopwatch);
+    test_close (push);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed >= 190000 && elapsed < 2000000);
+    test_close (pull);
+
+    return 0;
+}
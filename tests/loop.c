@@ -0,0 +1,151 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#if !defined _WIN32
+#include <poll.h>
+#endif
+
+/*  Tests running the AIO in the application's event loop. */
+
+static char socket_address [128];
+
+#if !defined _WIN32
+
+/*  A single iteration of the application's event loop. */
+static void loop_once (int fd)
+{
+    int rc;
+    int timeout;
+    struct pollfd pfd;
+
+    timeout = nn_loop_timeout ();
+    nn_assert (timeout >= -1);
+    if (timeout < 0 || timeout > 100)
+        timeout = 100;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    rc = poll (&pfd, 1, timeout);
+    errno_assert (rc >= 0);
+    rc = nn_loop_run (0);
+    errno_assert (rc == 0);
+}
+
+#endif
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int fd;
+    int i;
+    int timeo;
+    char buf [3];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    /*  There's no worker before the first socket is created. */
+    rc = nn_loop_fd ();
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_loop_run (0);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    nn_assert (nn_loop_timeout () == -1);
+
+    /*  Worker threads are used unless asked otherwise. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    rc = nn_loop_fd ();
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+    rc = nn_loop_run (0);
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+    test_close (sb);
+
+#if defined _WIN32
+    rc = _putenv ("NN_WORKER_THREADS=0");
+#else
+    rc = setenv ("NN_WORKER_THREADS", "0", 1);
+#endif
+    errno_assert (rc == 0);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+
+    /*  Platforms that can't expose the worker fall back to a thread. */
+    fd = nn_loop_fd ();
+    if (fd < 0) {
+        nn_assert (nn_errno () == ENOTSUP);
+        test_send (sc, "ABC");
+        test_recv (sb, "ABC");
+        test_close (sc);
+        test_close (sb);
+        return 0;
+    }
+
+#if !defined _WIN32
+
+    /*  Nothing moves unless the application runs the loop, but then
+        everything is done in this thread. */
+    for (i = 0; i != 10; ++i) {
+        while (1) {
+            rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+            if (rc == 3)
+                break;
+            nn_assert (rc == -1 && nn_errno () == EAGAIN);
+            loop_once (fd);
+        }
+        while (1) {
+            rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+            if (rc == 3)
+                break;
+            nn_assert (rc == -1 && nn_errno () == EAGAIN);
+            loop_once (fd);
+        }
+        nn_assert (memcmp (buf, "ABC", 3) == 0);
+    }
+
+    /*  Blocking calls process the events themselves. */
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+    timeo = 50;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+
+    /*  So does closing the sockets. The worker goes away along with the
+        last one. */
+    test_close (sc);
+    test_close (sb);
+    rc = nn_loop_fd ();
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+
+#endif
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+/*  Tests the limit on the number of connections of a bound endpoint. */
+
+static void wait_accepted (int s, uint64_t n)
+{
+    int i;
+
+    for (i = 0; i != 100; ++i) {
+        if (nn_get_statistic (s, NN_STAT_ACCEPTED_CONNECTIONS) == n)
+            return;
+        nn_sleep (20);
+    }
+    nn_assert (0);
+}
+
+static void test_limit (char *addr)
+{
+    int sb;
+    int sc1;
+    int sc2;
+    int opt;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_MAXCONN, &opt, sizeof (opt));
+    test_bind (sb, addr);
+
+    sc1 = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc1, addr);
+    wait_accepted (sb, 1);
+    test_send (sc1, "ABC");
+    test_recv (sb, "ABC");
+
+    /*  The second connection waits in the backlog. */
+    sc2 = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc2, addr);
+    nn_sleep (200);
+    nn_assert (nn_get_statistic (sb, NN_STAT_ACCEPTED_CONNECTIONS) == 1);
+    nn_assert (nn_get_statistic (sb, NN_STAT_CURRENT_CONNECTIONS) == 1);
+
+    /*  Once the first one is closed, it's accepted. */
+    test_close (sc1);
+    wait_accepted (sb, 2);
+    test_send (sb, "DEF");
+    test_recv (sc2, "DEF");
+
+    test_close (sc2);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    s = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_MAXCONN, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_MAXCONN, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_limit (addr);
+    test_addr_from (addr, "ws", "127.0.0.1", port + 1);
+    test_limit (addr);
+#if !defined NN_HAVE_WINDOWS
+    test_limit ("ipc://test_maxconn.ipc");
+#endif
+
+    return 0;
+}
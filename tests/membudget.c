@@ -0,0 +1,105 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+static char socket_address [128];
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int push;
+    int pull;
+    int opt;
+    void *big;
+    char buf [8];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    rc = nn_membudget (1000000, 4);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, socket_address);
+    push = test_socket (AF_SP, NN_PUSH);
+    test_connect (push, socket_address);
+    nn_sleep (100);
+
+    /*  Sends fail while the messages exceed the budget. */
+    rc = nn_membudget (1000000, NN_MEMBUDGET_SEND);
+    errno_assert (rc == 0);
+    test_send (push, "A");
+    test_recv (pull, "A");
+    big = nn_allocmsg (2000000, 0);
+    alloc_assert (big);
+    rc = nn_send (push, "B", 1, 0);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_freemsg (big);
+    test_send (push, "B");
+    test_recv (pull, "B");
+
+    /*  Connections stop reading, and resume once the memory is freed. */
+    rc = nn_membudget (1000000, NN_MEMBUDGET_RECV);
+    errno_assert (rc == 0);
+    big = nn_allocmsg (2000000, 0);
+    alloc_assert (big);
+    test_send (push, "C");
+    opt = 100;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    rc = nn_recv (pull, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    nn_freemsg (big);
+    opt = 1000;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_recv (pull, "C");
+
+    /*  Growing a message counts against the budget as well. */
+    big = nn_allocmsg (1, 0);
+    alloc_assert (big);
+    big = nn_reallocmsg (big, 2000000);
+    alloc_assert (big);
+    test_send (push, "D");
+    opt = 100;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    rc = nn_recv (pull, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    nn_freemsg (big);
+    test_recv (pull, "D");
+
+    /*  Without a budget, nothing is held back. */
+    rc = nn_membudget (0, 0);
+    errno_assert (rc == 0);
+    big = nn_allocmsg (2000000, 0);
+    alloc_assert (big);
+    test_send (push, "E");
+    test_recv (pull, "E");
+    nn_freemsg (big);
+
+    test_close (push);
+    test_close (pull);
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Tests nn_sendmmsg and nn_recvmmsg. */
+
+#define SOCKET_ADDRESS_INPROC "inproc://a"
+
+#define NMSGS 40
+
+char socket_address_tcp [128];
+
+static void test_batch (int sb, int sc)
+{
+    int rc;
+    int i;
+    int received;
+    struct nn_mmsghdr msgs [NMSGS];
+    struct nn_iovec iovs [NMSGS];
+    char bufs [NMSGS][4];
+
+    /*  Send more messages than fit into a single batch. */
+    for (i = 0; i != NMSGS; ++i) {
+        bufs [i][0] = 'A' + (i % 26);
+        bufs [i][1] = (char) i;
+        iovs [i].iov_base = bufs [i];
+        iovs [i].iov_len = 1 + (i % 4);
+        memset (&msgs [i], 0, sizeof (msgs [i]));
+        msgs [i].msg_hdr.msg_iov = &iovs [i];
+        msgs [i].msg_hdr.msg_iovlen = 1;
+    }
+    rc = nn_sendmmsg (sc, msgs, NMSGS, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == NMSGS);
+    for (i = 0; i != NMSGS; ++i)
+        nn_assert (msgs [i].msg_len == (size_t) (1 + (i % 4)));
+
+    /*  Receive them back. A single call may return fewer messages than
+        requested if the rest are still in flight. */
+    received = 0;
+    while (received != NMSGS) {
+        for (i = received; i != NMSGS; ++i) {
+            memset (bufs [i], 0, sizeof (bufs [i]));
+            iovs [i].iov_base = bufs [i];
+            iovs [i].iov_len = sizeof (bufs [i]);
+            memset (&msgs [i], 0, sizeof (msgs [i]));
+            msgs [i].msg_hdr.msg_iov = &iovs [i];
+            msgs [i].msg_hdr.msg_iovlen = 1;
+        }
+        rc = nn_recvmmsg (sb, msgs + received, NMSGS - received, 0);
+        errno_assert (rc > 0);
+        nn_assert (rc <= NMSGS - received);
+        for (i = received; i != received + rc; ++i) {
+            nn_assert (msgs [i].msg_len == (size_t) (1 + (i % 4)));
+            nn_assert (bufs [i][0] == 'A' + (i % 26));
+            if (msgs [i].msg_len > 1)
+                nn_assert (bufs [i][1] == (char) i);
+        }
+        received += rc;
+    }
+
+    /*  Nothing is left. */
+    rc = nn_recvmmsg (sb, msgs, NMSGS, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+}
+
+static void test_zerocopy (int sb, int sc)
+{
+    int rc;
+    void *chunks [2];
+    void *chunk;
+    struct nn_mmsghdr msgs [3];
+    struct nn_iovec iovs [3];
+
+    /*  Zero-copy messages. The third header is invalid, so only the first
+        two messages are sent. */
+    chunks [0] = nn_allocmsg (3, 0);
+    alloc_assert (chunks [0]);
+    memcpy (chunks [0], "ABC", 3);
+    chunks [1] = nn_allocmsg (5, 0);
+    alloc_assert (chunks [1]);
+    memcpy (chunks [1], "DEFGH", 5);
+    memset (msgs, 0, sizeof (msgs));
+    iovs [0].iov_base = &chunks [0];
+    iovs [0].iov_len = NN_MSG;
+    msgs [0].msg_hdr.msg_iov = &iovs [0];
+    msgs [0].msg_hdr.msg_iovlen = 1;
+    iovs [1].iov_base = &chunks [1];
+    iovs [1].iov_len = NN_MSG;
+    msgs [1].msg_hdr.msg_iov = &iovs [1];
+    msgs [1].msg_hdr.msg_iovlen = 1;
+    msgs [2].msg_hdr.msg_iovlen = -1;
+    rc = nn_sendmmsg (sc, msgs, 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 2);
+    nn_assert (msgs [0].msg_len == 3);
+    nn_assert (msgs [1].msg_len == 5);
+
+    /*  An invalid header alone is reported as an error. */
+    rc = nn_sendmmsg (sc, msgs + 2, 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EMSGSIZE);
+
+    /*  Receive the first message as a chunk. */
+    memset (msgs, 0, sizeof (msgs));
+    iovs [0].iov_base = &chunk;
+    iovs [0].iov_len = NN_MSG;
+    msgs [0].msg_hdr.msg_iov = &iovs [0];
+    msgs [0].msg_hdr.msg_iovlen = 1;
+    rc = nn_recvmmsg (sb, msgs, 1, 0);
+    errno_assert (rc == 1);
+    nn_assert (msgs [0].msg_len == 3);
+    nn_assert (memcmp (chunk, "ABC", 3) == 0);
+    rc = nn_freemsg (chunk);
+    errno_assert (rc == 0);
+
+    /*  Headers are validated before anything is received. */
+    msgs [1].msg_hdr.msg_iov = iovs;
+    msgs [1].msg_hdr.msg_iovlen = 2;
+    iovs [1].iov_base = &chunk;
+    iovs [1].iov_len = NN_MSG;
+    rc = nn_recvmmsg (sb, msgs, 2, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    rc = nn_recvmmsg (sb, msgs, 1, 0);
+    errno_assert (rc == 1);
+    nn_assert (msgs [0].msg_len == 5);
+    nn_assert (memcmp (chunk, "DEFGH", 5) == 0);
+    rc = nn_freemsg (chunk);
+    errno_assert (rc == 0);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int sb;
+    int sc;
+    struct nn_mmsghdr msg;
+
+    test_addr_from (socket_address_tcp, "tcp", "127.0.0.1",
+            get_test_port (argc, argv));
+
+    /*  Test the batched API over inproc transport. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS_INPROC);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS_INPROC);
+
+    /*  Degenerate arguments. */
+    rc = nn_sendmmsg (sc, NULL, 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_sendmmsg (sc, &msg, -1, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_recvmmsg (sb, NULL, 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_sendmmsg (sc, &msg, 0, 0);
+    nn_assert (rc == 0);
+    rc = nn_recvmmsg (sb, &msg, 0, 0);
+    nn_assert (rc == 0);
+    rc = nn_sendmmsg (-1, &msg, 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+
+    /*  Nothing can be sent without a peer. */
+    s = test_socket (AF_SP, NN_PAIR);
+    memset (&msg, 0, sizeof (msg));
+    rc = nn_sendmmsg (s, &msg, 1, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    test_close (s);
+
+    test_batch (sb, sc);
+    test_zerocopy (sb, sc);
+
+    test_close (sc);
+    test_close (sb);
+
+    /*  Test the batched API over TCP transport. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address_tcp);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address_tcp);
+
+    test_batch (sb, sc);
+    test_zerocopy (sb, sc);
+
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
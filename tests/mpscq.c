@@ -0,0 +1,115 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/utils/cont.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/queue.c"
+#include "../src/utils/mpscq.c"
+
+/*  Test of the lock-free multi-producer, single-consumer queue. */
+
+#define PRODUCERS 4
+#define ITEMS 10000
+
+struct item {
+    int producer;
+    int seq;
+    struct nn_queue_item item;
+};
+
+static struct nn_mpscq mpscq;
+static struct item items [PRODUCERS][ITEMS];
+
+static void producer (void *arg)
+{
+    int id;
+    int i;
+
+    id = *(int*) arg;
+    for (i = 0; i != ITEMS; ++i) {
+        items [id][i].producer = id;
+        items [id][i].seq = i;
+        nn_queue_item_init (&items [id][i].item);
+        nn_mpscq_push (&mpscq, &items [id][i].item);
+    }
+}
+
+int main ()
+{
+    int i;
+    int ids [PRODUCERS];
+    int next [PRODUCERS];
+    int received;
+    struct nn_thread threads [PRODUCERS];
+    struct nn_queue queue;
+    struct nn_queue_item *it;
+    struct item *item;
+
+    nn_mpscq_init (&mpscq);
+    nn_queue_init (&queue);
+
+    /*  Single-threaded usage. */
+    nn_queue_item_init (&items [0][0].item);
+    nn_queue_item_init (&items [0][1].item);
+    nn_assert (nn_mpscq_push (&mpscq, &items [0][0].item) == 1);
+    nn_assert (nn_mpscq_push (&mpscq, &items [0][1].item) == 0);
+    nn_mpscq_drain (&mpscq, &queue);
+    nn_assert (nn_queue_pop (&queue) == &items [0][0].item);
+    nn_assert (nn_queue_pop (&queue) == &items [0][1].item);
+    nn_assert (nn_queue_pop (&queue) == NULL);
+    nn_mpscq_drain (&mpscq, &queue);
+    nn_assert (nn_queue_empty (&queue));
+
+    /*  Concurrent producers. Items from each producer have to be received
+        in the order they were pushed. */
+    for (i = 0; i != PRODUCERS; ++i) {
+        ids [i] = i;
+        next [i] = 0;
+        nn_thread_init (&threads [i], producer, &ids [i]);
+    }
+    received = 0;
+    while (received != PRODUCERS * ITEMS) {
+        nn_mpscq_drain (&mpscq, &queue);
+        while (1) {
+            it = nn_queue_pop (&queue);
+            if (!it)
+                break;
+            item = nn_cont (it, struct item, item);
+            nn_assert (item->seq == next [item->producer]);
+            ++next [item->producer];
+            ++received;
+        }
+    }
+    for (i = 0; i != PRODUCERS; ++i)
+        nn_thread_term (&threads [i]);
+
+    nn_queue_term (&queue);
+    nn_mpscq_term (&mpscq);
+
+    return 0;
+}
+
@@ -32,6 +32,59 @@
 
 char longdata[1 << 20];
 
+/*  Sends a message consisting of multiple chunks and checks that
+    it's received as a single contiguous message. */
+static void test_multipart (int sb, int sc)
+{
+    int rc;
+    int i;
+    unsigned char *parts [3];
+    unsigned char *buf;
+    size_t sizes [3] = {4096, 1 << 19, 100};
+    size_t pos;
+    struct nn_iovec iov [3];
+    struct nn_msghdr hdr;
+
+    for (i = 0; i != 3; ++i) {
+        parts [i] = nn_allocmsg (sizes [i], 0);
+        alloc_assert (parts [i]);
+        memset (parts [i], 'a' + i, sizes [i]);
+        iov [i].iov_base = &parts [i];
+        iov [i].iov_len = NN_MSG;
+    }
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 3;
+    rc = nn_sendmsg (sc, &hdr, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == (int) (sizes [0] + sizes [1] + sizes [2]));
+
+    rc = nn_recv (sb, &buf, NN_MSG, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == (int) (sizes [0] + sizes [1] + sizes [2]));
+    pos = 0;
+    for (i = 0; i != 3; ++i) {
+        nn_assert (buf [pos] == 'a' + i);
+        nn_assert (buf [pos + sizes [i] - 1] == 'a' + i);
+        pos += sizes [i];
+    }
+    rc = nn_freemsg (buf);
+    errno_assert (rc == 0);
+
+    /*  Zero-copy and ordinary buffers cannot be mixed. */
+    parts [0] = nn_allocmsg (16, 0);
+    alloc_assert (parts [0]);
+    iov [0].iov_base = &parts [0];
+    iov [0].iov_len = NN_MSG;
+    iov [1].iov_base = longdata;
+    iov [1].iov_len = 16;
+    hdr.msg_iovlen = 2;
+    rc = nn_sendmsg (sc, &hdr, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_freemsg (parts [0]);
+    errno_assert (rc == 0);
+}
+
 int main (int argc, const char *argv[])
 {
     int rc;
@@ -97,6 +150,8 @@ int main (int argc, const char *argv[])
     rc = nn_freemsg (buf2);
     errno_assert (rc == 0);
 
+    test_multipart (sb, sc);
+
     test_close (sc);
     test_close (sb);
 
@@ -121,6 +176,8 @@ int main (int argc, const char *argv[])
     rc = nn_freemsg (buf2);
     errno_assert (rc == 0);
 
+    test_multipart (sb, sc);
+
     test_close (sc);
     test_close (sb);
 
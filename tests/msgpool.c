@@ -0,0 +1,143 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Test of the message pools. */
+
+#define NN_TEST_BUFSZ 1024
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int pool;
+    int opt;
+    size_t optsz;
+    int sb;
+    int sc;
+    int sr;
+    int ss;
+    void *buf1;
+    void *buf2;
+    void *msg;
+    char body [500];
+    char socket_address [128];
+    char relay_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+    test_addr_from (relay_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv) + 1);
+
+    /*  Check the invalid arguments. */
+    rc = nn_msgpool (NN_TEST_BUFSZ, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    msg = nn_allocmsg (10, 1000);
+    nn_assert (!msg && nn_errno () == EINVAL);
+
+    /*  A pool of a single buffer. The buffer is recycled once freed. */
+    pool = nn_msgpool (NN_TEST_BUFSZ, 1);
+    errno_assert (pool > 0);
+    buf1 = nn_allocmsg (100, pool);
+    alloc_assert (buf1);
+    rc = nn_freemsg (buf1);
+    errno_assert (rc == 0);
+    buf2 = nn_allocmsg (100, pool);
+    nn_assert (buf2 == buf1);
+
+    /*  With the buffer taken, as well as for messages too large for the
+        pool, the heap is used instead. */
+    msg = nn_allocmsg (100, pool);
+    alloc_assert (msg);
+    nn_assert (msg != buf1);
+    nn_freemsg (msg);
+    msg = nn_allocmsg (2 * NN_TEST_BUFSZ, pool);
+    alloc_assert (msg);
+    nn_freemsg (msg);
+
+    /*  A pooled buffer can be resized within its capacity. */
+    buf2 = nn_reallocmsg (buf2, NN_TEST_BUFSZ);
+    nn_assert (buf2 == buf1);
+    nn_freemsg (buf2);
+
+    /*  Receive into the pool. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = pool + 1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVPOOL, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVPOOL, &pool, sizeof (pool));
+    optsz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_RCVPOOL, &opt, &optsz);
+    errno_assert (rc == 0);
+    nn_assert (opt == pool);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    sr = test_socket (AF_SP, NN_PAIR);
+    test_bind (sr, relay_address);
+    ss = test_socket (AF_SP, NN_PAIR);
+    test_connect (ss, relay_address);
+    nn_sleep (100);
+
+    memset (body, 'A', sizeof (body));
+    rc = nn_send (sc, body, sizeof (body), 0);
+    errno_assert (rc == sizeof (body));
+    rc = nn_recv (sb, &msg, NN_MSG, 0);
+    errno_assert (rc == sizeof (body));
+    nn_assert (msg == buf1);
+
+    /*  Relay the message. Once sent, the buffer returns to the pool and
+        the next message is received into it again. */
+    rc = nn_send (ss, &msg, NN_MSG, 0);
+    errno_assert (rc == sizeof (body));
+    rc = nn_recv (sr, &msg, NN_MSG, 0);
+    errno_assert (rc == sizeof (body));
+    nn_freemsg (msg);
+    nn_sleep (50);
+
+    rc = nn_send (sc, body, sizeof (body), 0);
+    errno_assert (rc == sizeof (body));
+    rc = nn_recv (sb, &msg, NN_MSG, 0);
+    errno_assert (rc == sizeof (body));
+    nn_assert (msg == buf1);
+    nn_freemsg (msg);
+
+    /*  Messages too small to need a buffer of their own on the way are
+        handed over to the user in a pooled buffer as well. */
+    test_send (sc, "ABC");
+    rc = nn_recv (sb, &msg, NN_MSG, 0);
+    errno_assert (rc == 3);
+    nn_assert (msg == buf1);
+    nn_freemsg (msg);
+
+    test_close (ss);
+    test_close (sr);
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
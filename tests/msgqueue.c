@@ -0,0 +1,187 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/utils/attr.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/wire.c"
+#include "../src/utils/queue.c"
+#include "../src/utils/mpscq.c"
+#include "../src/utils/chunk.c"
+#include "../src/utils/chunkref.c"
+#include "../src/utils/msg.c"
+#include "../src/transports/inproc/msgqueue.c"
+
+/*  Test of the single-producer, single-consumer message queue used by
+    the inproc transport. */
+
+#define MESSAGES 20000
+
+static struct nn_msgqueue msgqueue;
+
+static void test_msg_init (struct nn_msg *msg, uint32_t seq, size_t size)
+{
+    nn_msg_init (msg, size);
+    nn_assert (size >= sizeof (seq));
+    memcpy (nn_chunkref_data (&msg->body), &seq, sizeof (seq));
+}
+
+static uint32_t test_msg_seq (struct nn_msg *msg)
+{
+    uint32_t seq;
+
+    memcpy (&seq, nn_chunkref_data (&msg->body), sizeof (seq));
+    return seq;
+}
+
+static void producer (NN_UNUSED void *arg)
+{
+    int rc;
+    uint32_t i;
+    struct nn_msg msg;
+
+    for (i = 0; i != MESSAGES; ++i) {
+        test_msg_init (&msg, i, 4 + i % 200);
+        while (1) {
+            rc = nn_msgqueue_send (&msgqueue, &msg);
+            if (rc == 0)
+                break;
+            nn_assert (rc == -EAGAIN);
+            nn_sleep (1);
+        }
+    }
+}
+
+int main ()
+{
+    int rc;
+    int i;
+    struct nn_msg msg;
+    struct nn_thread thread;
+
+    /*  The queue is bounded by the number of slots... */
+    nn_msgqueue_init (&msgqueue, 1000000);
+    nn_assert (nn_msgqueue_empty (&msgqueue));
+    for (i = 0; i != NN_MSGQUEUE_SLOTS; ++i) {
+        test_msg_init (&msg, i, 4);
+        rc = nn_msgqueue_send (&msgqueue, &msg);
+        errnum_assert (rc == 0, -rc);
+    }
+    test_msg_init (&msg, i, 4);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    nn_assert (rc == -EAGAIN);
+    nn_msg_term (&msg);
+    nn_assert (!nn_msgqueue_empty (&msgqueue));
+
+    /*  A producer waiting for a slot is woken up once half of them are
+        free. */
+    nn_msgqueue_sndwait (&msgqueue);
+    for (i = 0; i != NN_MSGQUEUE_SLOTS; ++i) {
+        rc = nn_msgqueue_recv (&msgqueue, &msg);
+        errnum_assert (rc == 0, -rc);
+        nn_assert (test_msg_seq (&msg) == (uint32_t) i);
+        nn_msg_term (&msg);
+        nn_assert (nn_msgqueue_sndnotify (&msgqueue) ==
+            (i == NN_MSGQUEUE_SLOTS / 2 - 1));
+    }
+    nn_msgqueue_sndwoken (&msgqueue);
+    rc = nn_msgqueue_recv (&msgqueue, &msg);
+    nn_assert (rc == -EAGAIN);
+    nn_assert (nn_msgqueue_empty (&msgqueue));
+    nn_msgqueue_term (&msgqueue);
+
+    /*  ...and by the amount of data, except that the first message may be
+        of any size. */
+    nn_msgqueue_init (&msgqueue, 100);
+    test_msg_init (&msg, 0, 1000);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    errnum_assert (rc == 0, -rc);
+    test_msg_init (&msg, 1, 4);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    nn_assert (rc == -EAGAIN);
+    rc = nn_msgqueue_recv (&msgqueue, &msg);
+    errnum_assert (rc == 0, -rc);
+    nn_msg_term (&msg);
+    test_msg_init (&msg, 1, 60);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    errnum_assert (rc == 0, -rc);
+    test_msg_init (&msg, 2, 60);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    nn_assert (rc == -EAGAIN);
+
+    /*  A producer waiting because of the byte limit is woken up as soon as
+        there's any room. */
+    nn_msgqueue_sndwait (&msgqueue);
+    rc = nn_msgqueue_send (&msgqueue, &msg);
+    nn_assert (rc == -EAGAIN);
+    nn_msg_term (&msg);
+    rc = nn_msgqueue_recv (&msgqueue, &msg);
+    errnum_assert (rc == 0, -rc);
+    nn_msg_term (&msg);
+    nn_assert (nn_msgqueue_sndnotify (&msgqueue));
+    nn_msgqueue_sndwoken (&msgqueue);
+
+    /*  Notification requests. The consumer waits for the first message from
+        the start. */
+    nn_assert (nn_msgqueue_rcvnotify (&msgqueue));
+    nn_assert (!nn_msgqueue_rcvnotify (&msgqueue));
+    nn_msgqueue_rcvwoken (&msgqueue);
+    nn_assert (!nn_msgqueue_sndnotify (&msgqueue));
+    nn_msgqueue_sndwait (&msgqueue);
+    nn_assert (nn_msgqueue_sndcancel (&msgqueue));
+    nn_assert (!nn_msgqueue_sndnotify (&msgqueue));
+    nn_msgqueue_sndwait (&msgqueue);
+    nn_assert (nn_msgqueue_sndnotify (&msgqueue));
+    nn_assert (!nn_msgqueue_sndcancel (&msgqueue));
+    nn_msgqueue_sndwait (&msgqueue);
+    nn_msgqueue_sndwoken (&msgqueue);
+    nn_msgqueue_rcvwait (&msgqueue);
+    nn_assert (nn_msgqueue_rcvcancel (&msgqueue));
+    nn_msgqueue_term (&msgqueue);
+
+    /*  Pass a stream of messages from one thread to another. */
+    nn_msgqueue_init (&msgqueue, 10000);
+    nn_thread_init (&thread, producer, NULL);
+    for (i = 0; i != MESSAGES; ++i) {
+        while (1) {
+            rc = nn_msgqueue_recv (&msgqueue, &msg);
+            if (rc == 0)
+                break;
+            nn_assert (rc == -EAGAIN);
+            nn_sleep (1);
+        }
+        nn_assert (test_msg_seq (&msg) == (uint32_t) i);
+        nn_assert (nn_chunkref_size (&msg.body) == (size_t) (4 + i % 200));
+        nn_msg_term (&msg);
+    }
+    nn_thread_term (&thread);
+    nn_assert (nn_msgqueue_empty (&msgqueue));
+    nn_msgqueue_term (&msgqueue);
+
+    return 0;
+}
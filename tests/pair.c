@@ -29,8 +29,10 @@
 
 int main ()
 {
+    int rc;
     int sb;
     int sc;
+    char buf [3];
 
     sb = test_socket (AF_SP, NN_PAIR);
     test_bind (sb, SOCKET_ADDRESS);
@@ -45,6 +47,28 @@ int main ()
     test_close (sc);
     test_close (sb);
 
+    /*  Non-blocking operations on a socket that is not ready fail straight
+        away, yet they succeed as soon as the socket becomes ready. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    rc = nn_send (sb, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    nn_sleep (10);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_send (sb, "DEF", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    test_recv (sc, "DEF");
+    test_close (sc);
+    test_close (sb);
+
     return 0;
 }
 
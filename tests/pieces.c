@@ -0,0 +1,275 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <string.h>
+
+/*  Tests sending and receiving messages in pieces. */
+
+#define MSG_SIZE (20 * 1024 * 1024 + 333)
+#define SNDPIECE (1024 * 1024)
+#define RCVPIECE (256 * 1024)
+
+static char buf [SNDPIECE];
+
+static char byte_at (uint64_t pos)
+{
+    return (char) (pos * 7 + pos / 4096);
+}
+
+static int send_piece (int s, uint64_t size, uint64_t offset, size_t len,
+    int attach)
+{
+    size_t i;
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    unsigned char ctrl [NN_CMSG_SPACE (sizeof (struct nn_msg_piece))];
+    struct nn_cmsghdr *cmsg;
+    struct nn_msg_piece piece;
+
+    for (i = 0; i != len; ++i)
+        buf [i] = byte_at (offset + i);
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (attach) {
+        memset (ctrl, 0, sizeof (ctrl));
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen = sizeof (ctrl);
+        cmsg = NN_CMSG_FIRSTHDR (&hdr);
+        cmsg->cmsg_level = NN_SOL_SOCKET;
+        cmsg->cmsg_type = NN_MSG_PIECE;
+        cmsg->cmsg_len = NN_CMSG_LEN (sizeof (piece));
+        piece.size = size;
+        piece.offset = offset;
+        memcpy (NN_CMSG_DATA (cmsg), &piece, sizeof (piece));
+    }
+    return nn_sendmsg (s, &hdr, 0);
+}
+
+/*  Sends the message in pieces, attaching the property to the first one
+    only. */
+static void send_msg (int s, uint64_t size)
+{
+    int rc;
+    uint64_t offset;
+    size_t len;
+
+    for (offset = 0; offset != size; offset += len) {
+        len = size - offset < SNDPIECE ? (size_t) (size - offset) : SNDPIECE;
+        rc = send_piece (s, size, offset, len, offset == 0);
+        errno_assert (rc == (int) len);
+    }
+}
+
+/*  Receives the message of 'size' bytes, checking that it arrives in pieces
+    of 'maxpiece' bytes, or as a whole if it's 0. */
+static void recv_msg (int s, uint64_t size, size_t maxpiece)
+{
+    int rc;
+    int i;
+    char *body;
+    uint64_t offset;
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    void *ctrl;
+    struct nn_cmsghdr *cmsg;
+    struct nn_msg_piece piece;
+
+    for (offset = 0; offset != size; offset += rc) {
+        iov.iov_base = &body;
+        iov.iov_len = NN_MSG;
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &ctrl;
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_recvmsg (s, &hdr, 0);
+        errno_assert (rc >= 0);
+        cmsg = NN_CMSG_FIRSTHDR (&hdr);
+        while (cmsg && (cmsg->cmsg_level != NN_SOL_SOCKET ||
+              cmsg->cmsg_type != NN_MSG_PIECE))
+            cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+        if (!maxpiece) {
+            nn_assert (!cmsg);
+            nn_assert ((uint64_t) rc == size);
+        }
+        else {
+            nn_assert (cmsg);
+            nn_assert (cmsg->cmsg_len == NN_CMSG_LEN (sizeof (piece)));
+            memcpy (&piece, NN_CMSG_DATA (cmsg), sizeof (piece));
+            nn_assert (piece.size == size);
+            nn_assert (piece.offset == offset);
+            nn_assert ((uint64_t) rc == (size - offset < maxpiece ?
+                size - offset : maxpiece));
+        }
+        for (i = 0; i != rc; ++i)
+            nn_assert (body [i] == byte_at (offset + i));
+        nn_freemsg (body);
+        nn_freemsg (ctrl);
+    }
+}
+
+static void sender (void *arg)
+{
+    int s;
+
+    s = *(int*) arg;
+    send_msg (s, MSG_SIZE);
+    test_send (s, "AFTER");
+    send_msg (s, 3 * SNDPIECE + 1);
+}
+
+static void test_transport (const char *addr, size_t piece)
+{
+    int sb;
+    int sc;
+    int opt;
+    struct nn_thread thread;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = RCVPIECE;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVPIECE, &opt, sizeof (opt));
+    test_bind (sb, (char*) addr);
+    test_connect (sc, (char*) addr);
+
+    /*  Wait for the connection to be established. */
+    test_send (sc, "0");
+    test_recv (sb, "0");
+
+    /*  The message is much larger than NN_RCVMAXSIZE and the buffers of
+        the sockets. Both sides hold a few pieces of it at most. */
+    nn_thread_init (&thread, sender, &sc);
+    recv_msg (sb, MSG_SIZE, piece);
+    test_recv (sb, "AFTER");
+    recv_msg (sb, 3 * SNDPIECE + 1, piece);
+    nn_thread_term (&thread);
+
+    /*  Ordinary messages larger than NN_RCVPIECE are received in pieces
+        as well, smaller ones as they are. */
+    opt = -1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    if (piece != SNDPIECE) {
+        errno_assert (send_piece (sc, 0, 0, RCVPIECE * 2 + 1, 0) >= 0);
+        recv_msg (sb, RCVPIECE * 2 + 1, piece);
+    }
+    errno_assert (send_piece (sc, 0, 0, RCVPIECE, 0) >= 0);
+    recv_msg (sb, RCVPIECE, 0);
+
+    /*  Without NN_RCVPIECE, the pieces are received as a single
+        message. */
+    opt = 0;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVPIECE, &opt, sizeof (opt));
+    if (piece != SNDPIECE) {
+        send_msg (sc, 2 * SNDPIECE + 5);
+        recv_msg (sb, 2 * SNDPIECE + 5, 0);
+    }
+
+    test_close (sc);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int sb;
+    int opt;
+    char addr [128];
+
+    test_addr_from (addr, "tcp", "127.0.0.1", get_test_port (argc, argv));
+
+    test_transport (addr, RCVPIECE);
+    test_transport ("ipc://test_pieces.ipc", RCVPIECE);
+
+    /*  In-process transport passes the pieces on as they are. */
+    test_transport ("inproc://test_pieces", SNDPIECE);
+
+    /*  Only pair sockets are able to keep the pieces together. */
+    s = test_socket (AF_SP, NN_PUSH);
+    test_bind (s, "inproc://push");
+    rc = send_piece (s, 100, 0, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == ENOTSUP);
+    opt = RCVPIECE;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVPIECE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == ENOTSUP);
+    test_close (s);
+
+    /*  Pieces out of order. */
+    s = test_socket (AF_SP, NN_PAIR);
+    test_bind (s, "inproc://invalid");
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVPIECE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_piece (s, 100, 10, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_piece (s, 5, 0, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 100;
+    test_setsockopt (s, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+    rc = send_piece (s, 100, 0, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+
+    /*  The first piece is still pending, so the next message has to be
+        the first piece again rather than its continuation. */
+    rc = send_piece (s, 100, 10, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (s);
+
+    /*  Once the first piece is sent, the others have to follow it. */
+    s = test_socket (AF_SP, NN_PAIR);
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "inproc://invalid2");
+    test_connect (s, "inproc://invalid2");
+    rc = send_piece (s, 100, 0, 10, 1);
+    errno_assert (rc == 10);
+    rc = send_piece (s, 100, 20, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_piece (s, 200, 10, 10, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_piece (s, 0, 0, 91, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_piece (s, 100, 10, 40, 1);
+    errno_assert (rc == 40);
+    rc = send_piece (s, 0, 0, 50, 0);
+    errno_assert (rc == 50);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 10);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 40);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 50);
+    test_close (sb);
+    test_close (s);
+
+    return 0;
+}
@@ -25,7 +25,118 @@
 #include "../src/pipeline.h"
 #include "testutil.h"
 
+#include <string.h>
+
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+
+/*  Sends a single byte message with the specified routing key. */
+static void send_keyed (int s, char key)
+{
+    int rc;
+    char body;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    union {
+        struct nn_cmsghdr hdr;
+        char buf [NN_CMSG_SPACE (1)];
+    } control;
+
+    body = key;
+    iov.iov_base = &body;
+    iov.iov_len = 1;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof (control.buf);
+    cmsg = &control.hdr;
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = NN_ROUTING_KEY;
+    cmsg->cmsg_len = NN_CMSG_LEN (1);
+    *NN_CMSG_DATA (cmsg) = (unsigned char) key;
+    rc = nn_sendmsg (s, &hdr, 0);
+    errno_assert (rc == 1);
+}
+
+/*  Sends a message with the specified time to live. */
+static void send_ttl (int s, const char *data, int ttl)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    union {
+        struct nn_cmsghdr hdr;
+        char buf [NN_CMSG_SPACE (sizeof (int))];
+    } control;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof (control.buf);
+    cmsg = &control.hdr;
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = NN_MSG_TTL;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int));
+    memcpy (NN_CMSG_DATA (cmsg), &ttl, sizeof (ttl));
+    rc = nn_sendmsg (s, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Sends 'count' messages of 'size' bytes, filled with 'tag'. */
+static void send_sized (int s, char tag, size_t size, int count)
+{
+    int rc;
+    char buf [1024];
+
+    nn_assert (size <= sizeof (buf));
+    memset (buf, tag, size);
+    while (count--) {
+        rc = nn_send (s, buf, size, 0);
+        errno_assert (rc == (int) size);
+    }
+}
+
+/*  Receives 'count' messages and returns how many of them were tagged
+    with 'tag'. */
+static int recv_tagged (int s, char tag, int count)
+{
+    int rc;
+    int tagged;
+    char buf [1024];
+
+    tagged = 0;
+    while (count--) {
+        rc = nn_recv (s, buf, sizeof (buf), 0);
+        errno_assert (rc > 0);
+        if (buf [0] == tag)
+            ++tagged;
+    }
+    return tagged;
+}
+
+/*  Receives all the messages waiting at the socket and records the socket
+    as the owner of their keys. */
+static void recv_keyed (int s, int *owners)
+{
+    int rc;
+    char buf;
+
+    while (1) {
+        rc = nn_recv (s, &buf, 1, NN_DONTWAIT);
+        if (rc < 0) {
+            nn_assert (nn_errno () == EAGAIN);
+            return;
+        }
+        nn_assert (rc == 1 && buf >= 'a' && buf <= 'z');
+        owners [buf - 'a'] = s;
+    }
+}
 
 int main ()
 {
@@ -33,6 +144,16 @@ int main ()
     int push2;
     int pull1;
     int pull2;
+    int rc;
+    int lb;
+    int val;
+    size_t sz;
+    char buf [8];
+    int pull3;
+    int owners [26];
+    int moved [26];
+    int i;
+    int j;
 
     /*  Test fan-out. */
 
@@ -76,6 +197,251 @@ int main ()
     test_close (push1);
     test_close (push2);
 
+    /*  Test least-loaded distribution. */
+
+    push1 = test_socket (AF_SP, NN_PUSH);
+    lb = NN_LB_LEASTLOADED;
+    rc = nn_setsockopt (push1, NN_PUSH, NN_PUSH_LB, &lb, sizeof (lb) - 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    lb = 0;
+    rc = nn_setsockopt (push1, NN_PUSH, NN_PUSH_LB, &lb, sizeof (lb));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    lb = NN_LB_LEASTLOADED;
+    rc = nn_setsockopt (push1, NN_PUSH, NN_PUSH_LB, &lb, sizeof (lb));
+    errno_assert (rc == 0);
+    lb = 0;
+    sz = sizeof (lb);
+    rc = nn_getsockopt (push1, NN_PUSH, NN_PUSH_LB, &lb, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (lb) && lb == NN_LB_LEASTLOADED);
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, SOCKET_ADDRESS);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    /*  Equally loaded peers are served in round-robin fashion. */
+    test_send (push1, "A");
+    test_send (push1, "B");
+    test_send (push1, "C");
+    test_send (push1, "D");
+
+    /*  Once the first peer drains its queue, it gets all the new messages
+        until it is as loaded as the second one. */
+    test_recv (pull1, "A");
+    test_recv (pull1, "C");
+    test_send (push1, "E");
+    test_send (push1, "F");
+    test_recv (pull1, "E");
+    test_recv (pull1, "F");
+    test_recv (pull2, "B");
+    test_recv (pull2, "D");
+    rc = nn_recv (pull2, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Test keyed distribution. The messages with the same key go to the
+        same peer and closing a peer only moves the keys it owned. */
+    push1 = test_socket (AF_SP, NN_PUSH);
+    lb = NN_LB_KEYED;
+    rc = nn_setsockopt (push1, NN_PUSH, NN_PUSH_LB, &lb, sizeof (lb));
+    errno_assert (rc == 0);
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, SOCKET_ADDRESS);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, SOCKET_ADDRESS);
+    pull3 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull3, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    for (i = 0; i != 26; ++i)
+        send_keyed (push1, (char) ('a' + i));
+    nn_sleep (10);
+    memset (owners, 0xff, sizeof (owners));
+    recv_keyed (pull1, owners);
+    recv_keyed (pull2, owners);
+    recv_keyed (pull3, owners);
+    for (i = 0; i != 26; ++i)
+        nn_assert (owners [i] >= 0);
+
+    for (j = 0; j != 3; ++j) {
+        for (i = 25; i >= 0; --i)
+            send_keyed (push1, (char) ('a' + i));
+        nn_sleep (10);
+        memcpy (moved, owners, sizeof (moved));
+        recv_keyed (pull1, moved);
+        recv_keyed (pull2, moved);
+        recv_keyed (pull3, moved);
+        nn_assert (memcmp (moved, owners, sizeof (owners)) == 0);
+    }
+
+    test_close (pull2);
+    nn_sleep (10);
+    for (i = 0; i != 26; ++i)
+        send_keyed (push1, (char) ('a' + i));
+    nn_sleep (10);
+    memcpy (moved, owners, sizeof (moved));
+    recv_keyed (pull1, moved);
+    recv_keyed (pull3, moved);
+    for (i = 0; i != 26; ++i) {
+        nn_assert (moved [i] != pull2);
+        if (owners [i] != pull2)
+            nn_assert (moved [i] == owners [i]);
+    }
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull3);
+
+    /*  Test credit-based flow control. Each puller allows two messages in
+        flight, so a busy puller doesn't get more work than that. */
+    push1 = test_socket (AF_SP, NN_PUSH);
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    val = -1;
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_CREDITS, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 2;
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_CREDITS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (pull1, NN_PULL, NN_PULL_CREDITS, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 2);
+    test_connect (pull1, SOCKET_ADDRESS);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    rc = nn_setsockopt (pull2, NN_PULL, NN_PULL_CREDITS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    test_connect (pull2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (push1, "A");
+    test_send (push1, "B");
+    test_send (push1, "C");
+    test_send (push1, "D");
+    rc = nn_send (push1, "E", 1, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Only the puller that consumes its messages gets new ones. */
+    test_recv (pull2, "B");
+    test_recv (pull2, "D");
+    nn_sleep (10);
+    test_send (push1, "E");
+    test_send (push1, "F");
+    rc = nn_send (push1, "G", 1, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    test_recv (pull2, "E");
+    test_recv (pull2, "F");
+    test_recv (pull1, "A");
+    test_recv (pull1, "C");
+    rc = nn_recv (pull1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Test deficit round-robin. The peers get the same number of bytes
+        per turn, no matter what the size of their messages is. */
+    pull1 = test_socket (AF_SP, NN_PULL);
+    val = 0;
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_FQ, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = NN_FQ_DEFICIT;
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_FQ, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (pull1, NN_PULL, NN_PULL_FQ, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == NN_FQ_DEFICIT);
+    test_bind (pull1, SOCKET_ADDRESS);
+    push1 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push1, SOCKET_ADDRESS);
+    push2 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    send_sized (push1, 'L', 1024, 16);
+    send_sized (push2, 'S', 256, 64);
+    nn_sleep (10);
+    nn_assert (recv_tagged (pull1, 'L', 20) == 4);
+    nn_assert (recv_tagged (pull1, 'L', 60) == 12);
+
+    test_close (push2);
+    test_close (push1);
+    test_close (pull1);
+
+    /*  Test the weights of the peers. */
+    pull1 = test_socket (AF_SP, NN_PULL);
+    val = NN_FQ_DEFICIT;
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_FQ, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    rc = nn_setsockopt (pull1, NN_SOL_SOCKET, NN_RCVWEIGHT, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_bind (pull1, SOCKET_ADDRESS);
+    val = 3;
+    rc = nn_setsockopt (pull1, NN_SOL_SOCKET, NN_RCVWEIGHT, &val, sizeof (val));
+    errno_assert (rc == 0);
+    test_bind (pull1, SOCKET_ADDRESS_B);
+    push1 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push1, SOCKET_ADDRESS);
+    push2 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push2, SOCKET_ADDRESS_B);
+    nn_sleep (10);
+
+    send_sized (push1, 'A', 256, 64);
+    send_sized (push2, 'B', 256, 64);
+    nn_sleep (10);
+    nn_assert (recv_tagged (pull1, 'A', 32) == 8);
+
+    test_close (push2);
+    test_close (push1);
+    test_close (pull1);
+
+    /*  Test message expiry. Messages that outlive their time to live are
+        dropped rather than delivered. */
+    push1 = test_socket (AF_SP, NN_PUSH);
+    val = 0;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_MSGTTL, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 50;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_MSGTTL, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (push1, NN_SOL_SOCKET, NN_MSGTTL, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 50);
+
+    /*  A blocking send gives up once the message expires. */
+    rc = nn_send (push1, "ABC", 3, 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    nn_assert (nn_get_statistic (push1, NN_STAT_EXPIRED_MESSAGES) == 1);
+
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, SOCKET_ADDRESS);
+    nn_sleep (10);
+    test_send (push1, "A");
+    test_send (push1, "B");
+    send_ttl (push1, "C", 10000);
+    nn_sleep (100);
+    test_send (push1, "D");
+    test_recv (pull1, "C");
+    test_recv (pull1, "D");
+    nn_assert (nn_get_statistic (pull1, NN_STAT_EXPIRED_MESSAGES) == 2);
+
+    test_close (push1);
+    test_close (pull1);
+
     return 0;
 }
 
@@ -0,0 +1,170 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+#define TASKS_ADDRESS "inproc://tasks"
+
+#define CONTROL_SIZE NN_CMSG_SPACE (sizeof (size_t) + sizeof (uint32_t))
+
+static char results_address [128];
+
+/*  Receives a task on the worker's socket, keeping the header it came with
+    in 'control'. */
+static void recv_task (int s, char *buf, size_t len, void *control)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = CONTROL_SIZE;
+    rc = nn_recvmsg (s, &hdr, 0);
+    errno_assert (rc == 1);
+}
+
+/*  Sends the result of a task along with the header of the task. */
+static void send_result (int s, const char *buf, void *control)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = (void*) buf;
+    iov.iov_len = 1;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = CONTROL_SIZE;
+    rc = nn_sendmsg (s, &hdr, 0);
+    errno_assert (rc == 1);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int push;
+    int workers [2];
+    int results [2];
+    int pull;
+    int opt;
+    size_t sz;
+    int i;
+    char buf [8];
+    char tasks [8] [1];
+    char controls [8] [CONTROL_SIZE];
+
+    test_addr_from (results_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    push = test_socket (AF_SP, NN_PUSH);
+    opt = 1;
+    test_setsockopt (push, NN_PUSH, NN_PUSH_SEQUENCE, &opt, sizeof (opt));
+    test_bind (push, TASKS_ADDRESS);
+
+    pull = test_socket (AF_SP, NN_PULL);
+    opt = -1;
+    rc = nn_setsockopt (pull, NN_PULL, NN_PULL_REORDER, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4;
+    test_setsockopt (pull, NN_PULL, NN_PULL_REORDER, &opt, sizeof (opt));
+    sz = sizeof (opt);
+    rc = nn_getsockopt (pull, NN_PULL, NN_PULL_REORDER, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 4);
+    opt = 100;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (pull, results_address);
+
+    /*  Two workers pass the sequence numbers of the tasks on with
+        the results. */
+    for (i = 0; i != 2; ++i) {
+        workers [i] = test_socket (AF_SP, NN_PULL);
+        opt = 1;
+        test_setsockopt (workers [i], NN_PULL, NN_PULL_SEQUENCE, &opt,
+            sizeof (opt));
+        test_connect (workers [i], TASKS_ADDRESS);
+        results [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (results [i], results_address);
+    }
+    nn_sleep (100);
+
+    /*  The tasks are dealt out in turn. The second worker finishes first,
+        yet the results are delivered in order. */
+    test_send (push, "A");
+    test_send (push, "B");
+    test_send (push, "C");
+    test_send (push, "D");
+    recv_task (workers [0], tasks [0], 1, controls [0]);
+    recv_task (workers [1], tasks [1], 1, controls [1]);
+    recv_task (workers [0], tasks [2], 1, controls [2]);
+    recv_task (workers [1], tasks [3], 1, controls [3]);
+    send_result (results [1], tasks [3], controls [3]);
+    send_result (results [1], tasks [1], controls [1]);
+    nn_sleep (50);
+    rc = nn_recv (pull, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    send_result (results [0], tasks [2], controls [2]);
+    send_result (results [0], tasks [0], controls [0]);
+    test_recv (pull, "A");
+    test_recv (pull, "B");
+    test_recv (pull, "C");
+    test_recv (pull, "D");
+
+    /*  If a result goes missing, the gap is skipped once the window is
+        exceeded. */
+    for (i = 0; i != 5; ++i) {
+        buf [0] = (char) ('a' + i);
+        rc = nn_send (push, buf, 1, 0);
+        errno_assert (rc == 1);
+        recv_task (workers [i % 2], tasks [i], 1, controls [i]);
+    }
+    for (i = 4; i != 0; --i)
+        send_result (results [i % 2], tasks [i], controls [i]);
+    test_recv (pull, "b");
+    test_recv (pull, "c");
+    test_recv (pull, "d");
+    test_recv (pull, "e");
+
+    /*  A result that arrives after its turn was skipped is still
+        delivered. */
+    send_result (results [0], tasks [0], controls [0]);
+    test_recv (pull, "a");
+
+    for (i = 0; i != 2; ++i) {
+        test_close (results [i]);
+        test_close (workers [i]);
+    }
+    test_close (pull);
+    test_close (push);
+
+    return 0;
+}
@@ -32,6 +32,8 @@
 #include "../src/utils/win.h"
 #else
 #include <sys/select.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 /*  Test of polling via NN_SNDFD/NN_RCVFD mechanism. */
@@ -124,6 +126,12 @@ int main ()
     int rc;
     int sb;
     char buf [3];
+#if !defined NN_HAVE_WINDOWS
+    int fd;
+    int fd2;
+    int sndfd;
+    size_t fdsz;
+#endif
     struct nn_thread thread;
     struct nn_pollfd pfd [2];
 
@@ -146,6 +154,54 @@ int main ()
     test_close (sc);
     test_close (sb);
 
+#if !defined NN_HAVE_WINDOWS
+    /*  The file descriptors are only created once they are asked for. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    fd = open ("/dev/null", O_RDONLY);
+    errno_assert (fd >= 0);
+    rc = close (fd);
+    errno_assert (rc == 0);
+    sc = test_socket (AF_SP, NN_PAIR);
+    fd2 = open ("/dev/null", O_RDONLY);
+    nn_assert (fd2 == fd);
+    rc = close (fd2);
+    errno_assert (rc == 0);
+    rc = getevents (sc, NN_OUT, 0);
+    nn_assert (rc == 0);
+    fd2 = open ("/dev/null", O_RDONLY);
+    nn_assert (fd2 != fd);
+    rc = close (fd2);
+    errno_assert (rc == 0);
+
+    /*  Later on, the same one is returned every time. */
+    fdsz = sizeof (sndfd);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDFD, &sndfd, &fdsz);
+    errno_assert (rc == 0);
+    nn_assert (fdsz == sizeof (sndfd));
+    fdsz = sizeof (fd2);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDFD, &fd2, &fdsz);
+    errno_assert (rc == 0);
+    nn_assert (fdsz == sizeof (fd2) && fd2 == sndfd);
+    test_close (sc);
+    test_close (sb);
+#endif
+
+    /*  Check that the file descriptor is signalled even if the message
+        arrived before it was asked for. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    nn_sleep (10);
+    rc = getevents (sb, NN_IN, 1000);
+    nn_assert (rc == NN_IN);
+    test_recv (sb, "ABC");
+    rc = getevents (sb, NN_IN, 10);
+    nn_assert (rc == 0);
+    test_close (sc);
+    test_close (sb);
+
     /*  Create a simple topology. */
     sb = test_socket (AF_SP, NN_PAIR);
     test_bind (sb, SOCKET_ADDRESS);
@@ -0,0 +1,128 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+/*  Test of polling a persistent set of sockets. */
+
+#define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS2 "inproc://b"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int sb2;
+    int sc2;
+    struct nn_pollset *ps;
+    struct nn_pollfd pfd [4];
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    sb2 = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb2, SOCKET_ADDRESS2);
+    sc2 = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc2, SOCKET_ADDRESS2);
+
+    ps = nn_pollset_create ();
+    errno_assert (ps);
+
+    /*  Check invalid arguments. */
+    rc = nn_pollset_add (ps, sb, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_pollset_add (ps, sb, 4);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_pollset_add (ps, -1, NN_POLLIN);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_pollset_add (ps, 1000, NN_POLLIN);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_pollset_remove (ps, sb);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_pollset_wait (ps, pfd, 0, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  Nothing to receive yet. */
+    rc = nn_pollset_add (ps, sb, NN_POLLIN);
+    errno_assert (rc == 0);
+    rc = nn_pollset_add (ps, sb2, NN_POLLIN);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, pfd, 4, 10);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 0);
+
+    /*  Only the socket with a message to receive is reported. */
+    test_send (sc2, "ABC");
+    rc = nn_pollset_wait (ps, pfd, 4, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].fd == sb2 && pfd [0].revents == NN_POLLIN);
+
+    /*  The socket stays ready till the message is received. */
+    rc = nn_pollset_wait (ps, pfd, 4, 0);
+    nn_assert (rc == 1 && pfd [0].fd == sb2);
+    test_recv (sb2, "ABC");
+    rc = nn_pollset_wait (ps, pfd, 4, 10);
+    nn_assert (rc == 0);
+
+    /*  Both events of a socket are merged into a single entry. */
+    rc = nn_pollset_add (ps, sb, NN_POLLIN | NN_POLLOUT);
+    errno_assert (rc == 0);
+    test_send (sc, "DEF");
+    nn_sleep (10);
+    rc = nn_pollset_wait (ps, pfd, 4, 1000);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].fd == sb &&
+        pfd [0].revents == (NN_POLLIN | NN_POLLOUT));
+
+    /*  No more sockets than requested are reported. */
+    rc = nn_pollset_add (ps, sb2, NN_POLLOUT);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, pfd, 1, 1000);
+    nn_assert (rc == 1);
+    rc = nn_pollset_wait (ps, pfd, 4, 1000);
+    nn_assert (rc == 2);
+    nn_assert (pfd [0].fd != pfd [1].fd);
+
+    /*  Removed sockets are not reported any more. */
+    rc = nn_pollset_remove (ps, sb);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, pfd, 4, 1000);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].fd == sb2 && pfd [0].revents == NN_POLLOUT);
+    test_recv (sb, "DEF");
+
+    rc = nn_pollset_destroy (ps);
+    errno_assert (rc == 0);
+
+    test_close (sc2);
+    test_close (sb2);
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
@@ -28,6 +28,7 @@
 
 #define SOCKET_ADDRESS_A "inproc://a"
 #define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
 
 int main ()
 {
@@ -36,6 +37,7 @@ int main ()
     int push2;
     int pull1;
     int pull2;
+    int pull3;
     int sndprio;
     int rcvprio;
 
@@ -116,6 +118,47 @@ int main ()
     test_close (pull1);
     test_close (push1);
 
+    /*  Test failing over across a wide range of priorities. */
+
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_bind (pull1, SOCKET_ADDRESS_A);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_bind (pull2, SOCKET_ADDRESS_B);
+    pull3 = test_socket (AF_SP, NN_PULL);
+    test_bind (pull3, SOCKET_ADDRESS_C);
+    push1 = test_socket (AF_SP, NN_PUSH);
+    sndprio = 65;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    sndprio = 64;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    errno_assert (rc == 0);
+    test_connect (push1, SOCKET_ADDRESS_A);
+    sndprio = 33;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    errno_assert (rc == 0);
+    test_connect (push1, SOCKET_ADDRESS_B);
+    sndprio = 40;
+    rc = nn_setsockopt (push1, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    errno_assert (rc == 0);
+    test_connect (push1, SOCKET_ADDRESS_C);
+
+    test_send (push1, "ABC");
+    test_recv (pull2, "ABC");
+    test_close (pull2);
+    test_send (push1, "DEF");
+    test_recv (pull3, "DEF");
+    test_close (pull3);
+    test_send (push1, "GHI");
+    test_recv (pull1, "GHI");
+
+    test_close (push1);
+    test_close (pull1);
+
     return 0;
 }
 
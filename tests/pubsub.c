@@ -25,7 +25,58 @@
 
 #include "testutil.h"
 
+#include <string.h>
+
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5560"
+
+#define LARGE_SIZE 1000
+
+static void send_large (int s)
+{
+    int rc;
+    void *msg;
+
+    msg = nn_allocmsg (LARGE_SIZE, 0);
+    alloc_assert (msg);
+    memset (msg, 'L', LARGE_SIZE);
+    rc = nn_send (s, &msg, NN_MSG, 0);
+    errno_assert (rc == LARGE_SIZE);
+}
+
+/*  Sends messages "M0" to "M6" using the specified drop policy and returns
+    the number of messages the publisher has dropped so far. */
+static int send_backlog (int pub, int policy)
+{
+    int rc;
+    int i;
+    int val;
+    char buf [2];
+
+    val = policy;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_DROP_POLICY, &val, sizeof (val));
+    errno_assert (rc == 0);
+    for (i = 0; i != 7; ++i) {
+        buf [0] = 'M';
+        buf [1] = (char) ('0' + i);
+        rc = nn_send (pub, buf, 2, 0);
+        errno_assert (rc == 2);
+    }
+    return (int) nn_get_statistic (pub, NN_STAT_DROPPED_MESSAGES);
+}
+
+static void recv_large (int s)
+{
+    int rc;
+    void *msg;
+
+    rc = nn_recv (s, &msg, NN_MSG, 0);
+    errno_assert (rc == LARGE_SIZE);
+    nn_assert (((char*) msg) [0] == 'L');
+    nn_assert (((char*) msg) [LARGE_SIZE - 1] == 'L');
+    rc = nn_freemsg (msg);
+    errno_assert (rc == 0);
+}
 
 int main ()
 {
@@ -36,6 +87,7 @@ int main ()
     int sub2;
     char buf [8];
     size_t sz;
+    int val;
 
     pub1 = test_socket (AF_SP, NN_PUB);
     test_bind (pub1, SOCKET_ADDRESS);
@@ -58,9 +110,20 @@ int main ()
     test_recv (sub1, "0123456789012345678901234567890123456789");
     test_recv (sub2, "0123456789012345678901234567890123456789");
 
+    /*  Large message is shared by the subscribers rather than copied. */
+    send_large (pub1);
+    recv_large (sub1);
+    recv_large (sub2);
+
+    test_close (sub2);
+    nn_sleep (10);
+
+    /*  With a single subscriber the message is passed on as is. */
+    send_large (pub1);
+    recv_large (sub1);
+
     test_close (pub1);
     test_close (sub1);
-    test_close (sub2);
 
     /*  Check receiving messages from two publishers. */
 
@@ -83,6 +146,237 @@ int main ()
     test_close (pub1);
     test_close (sub1);
 
+    /*  Check that a conflating subscriber gets only the latest message
+        of each subscription, in the order the subscriptions were first
+        seen. */
+    pub1 = test_socket (AF_SP, NN_PUB);
+    test_bind (pub1, SOCKET_ADDRESS);
+    sub1 = test_socket (AF_SP, NN_SUB);
+    val = 1;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "B", 1);
+    errno_assert (rc == 0);
+    test_connect (sub1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (pub1, "A1");
+    test_send (pub1, "B1");
+    test_send (pub1, "C1");
+    test_send (pub1, "A2");
+    test_send (pub1, "A3");
+    test_send (pub1, "B2");
+    nn_sleep (10);
+    test_recv (sub1, "A3");
+    test_recv (sub1, "B2");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Without conflation, all the messages are delivered again. */
+    test_send (pub1, "A4");
+    test_send (pub1, "A5");
+    nn_sleep (10);
+    val = 0;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    errno_assert (rc == 0);
+    test_recv (sub1, "A4");
+    test_recv (sub1, "A5");
+
+    test_close (sub1);
+    test_close (pub1);
+
+    /*  Check the per-pipe queues of a publisher. Only the first two messages
+        fit into the inproc connection with the minimal buffer, the rest has
+        to wait on the publisher's side. */
+    pub1 = test_socket (AF_SP, NN_PUB);
+    val = -1;
+    rc = nn_setsockopt (pub1, NN_PUB, NN_PUB_HWM_MSGS, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 0;
+    rc = nn_setsockopt (pub1, NN_PUB, NN_PUB_DROP_POLICY, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (pub1, NN_PUB, NN_PUB_DROP_POLICY, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == NN_PUB_DROP_NEWEST);
+    val = 2;
+    rc = nn_setsockopt (pub1, NN_PUB, NN_PUB_HWM_MSGS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    test_bind (pub1, SOCKET_ADDRESS);
+    sub1 = test_socket (AF_SP, NN_SUB);
+    val = 1;
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    test_connect (sub1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    /*  The newest messages are dropped by default. */
+    nn_assert (send_backlog (pub1, NN_PUB_DROP_NEWEST) == 3);
+    test_recv (sub1, "M0");
+    test_recv (sub1, "M1");
+    test_recv (sub1, "M2");
+    test_recv (sub1, "M3");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  With drop-oldest, the subscriber catches up with the latest ones. */
+    nn_assert (send_backlog (pub1, NN_PUB_DROP_OLDEST) == 6);
+    test_recv (sub1, "M0");
+    test_recv (sub1, "M1");
+    test_recv (sub1, "M5");
+    test_recv (sub1, "M6");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Inproc connections can't be closed by the publisher, so the whole
+        backlog is dropped instead. */
+    nn_assert (send_backlog (pub1, NN_PUB_DISCONNECT) == 10);
+    test_recv (sub1, "M0");
+    test_recv (sub1, "M1");
+    test_recv (sub1, "M6");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (sub1);
+    test_close (pub1);
+
+    /*  A subscriber that doesn't keep up is disconnected. */
+    pub1 = test_socket (AF_SP, NN_PUB);
+    val = 4;
+    rc = nn_setsockopt (pub1, NN_PUB, NN_PUB_HWM_MSGS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = NN_PUB_DISCONNECT;
+    rc = nn_setsockopt (pub1, NN_PUB, NN_PUB_DROP_POLICY, &val, sizeof (val));
+    errno_assert (rc == 0);
+    test_bind (pub1, SOCKET_ADDRESS_TCP);
+    sub1 = test_socket (AF_SP, NN_SUB);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    test_connect (sub1, SOCKET_ADDRESS_TCP);
+    nn_sleep (100);
+
+    while (nn_get_statistic (pub1, NN_STAT_DROPPED_MESSAGES) == 0)
+        send_large (pub1);
+    nn_sleep (100);
+    nn_assert (nn_get_statistic (pub1, NN_STAT_BROKEN_CONNECTIONS) == 1);
+
+    test_close (sub1);
+    test_close (pub1);
+
+    /*  Check subscribing and unsubscribing in bulk. */
+    pub1 = test_socket (AF_SP, NN_PUB);
+    test_bind (pub1, SOCKET_ADDRESS);
+    sub1 = test_socket (AF_SP, NN_SUB);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_MANY,
+        "\0\0\0\2A", 5);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_MANY,
+        "\0\0\0\1A\0\0\0\2BC\0\0\0\1D", 16);
+    errno_assert (rc == 0);
+    test_connect (sub1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (pub1, "A1");
+    test_send (pub1, "B1");
+    test_send (pub1, "BC1");
+    test_send (pub1, "D1");
+    test_recv (sub1, "A1");
+    test_recv (sub1, "BC1");
+    test_recv (sub1, "D1");
+
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE_MANY,
+        "\0\0\0\1A\0\0\0\1D", 10);
+    errno_assert (rc == 0);
+    test_send (pub1, "A2");
+    test_send (pub1, "D2");
+    test_send (pub1, "BC2");
+    test_recv (sub1, "BC2");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (sub1);
+    test_close (pub1);
+
+    /*  Check exact topics, alone and along with prefixes. */
+    pub1 = test_socket (AF_SP, NN_PUB);
+    test_bind (pub1, SOCKET_ADDRESS);
+    sub1 = test_socket (AF_SP, NN_SUB);
+    val = 256;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &val,
+        sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = ' ';
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == ' ');
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_EXACT, "AB", 2);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_EXACT, "AB", 2);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_EXACT, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "X", 1);
+    errno_assert (rc == 0);
+    test_connect (sub1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (pub1, "AB 1");
+    test_send (pub1, "ABC 1");
+    test_send (pub1, "A 1");
+    test_send (pub1, "AB");
+    test_send (pub1, " 1");
+    test_send (pub1, "XY 1");
+    test_recv (sub1, "AB 1");
+    test_recv (sub1, "AB");
+    test_recv (sub1, " 1");
+    test_recv (sub1, "XY 1");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Exact topics are reference-counted, the same as prefixes. */
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE_EXACT, "AB", 2);
+    errno_assert (rc == 0);
+    test_send (pub1, "AB 2");
+    test_recv (sub1, "AB 2");
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE_EXACT, "AB", 2);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE_EXACT, "AB", 2);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_send (pub1, "AB 3");
+    test_send (pub1, " 3");
+    test_recv (sub1, " 3");
+
+    /*  Without a delimiter, the whole message is the topic. */
+    val = -1;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_EXACT, "AB 4", 4);
+    errno_assert (rc == 0);
+    test_send (pub1, "AB 5");
+    test_send (pub1, "AB 4");
+    test_recv (sub1, "AB 4");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (sub1);
+    test_close (pub1);
+
     return 0;
 }
 
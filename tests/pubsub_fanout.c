@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+
+/*  Tests PUB socket distributing messages by the worker threads. */
+
+#define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5561"
+
+#define SUBSCRIBERS 6
+#define MESSAGES 100
+
+int main ()
+{
+    int rc;
+    int pub;
+    int sub [SUBSCRIBERS];
+    int val;
+    int i;
+    int j;
+    size_t sz;
+    char buf [16];
+
+    pub = test_socket (AF_SP, NN_PUB);
+
+    /*  Out of range values are rejected. */
+    val = -1;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_FANOUT, &val, sizeof (val));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    val = 65;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_FANOUT, &val, sizeof (val));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    val = 3;
+    test_setsockopt (pub, NN_PUB, NN_PUB_FANOUT, &val, sizeof (val));
+    sz = sizeof (val);
+    rc = nn_getsockopt (pub, NN_PUB, NN_PUB_FANOUT, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 3);
+    test_bind (pub, SOCKET_ADDRESS);
+    test_bind (pub, SOCKET_ADDRESS_TCP);
+
+    for (i = 0; i != SUBSCRIBERS; ++i) {
+        sub [i] = test_socket (AF_SP, NN_SUB);
+        test_setsockopt (sub [i], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        test_connect (sub [i], i % 2 ? SOCKET_ADDRESS : SOCKET_ADDRESS_TCP);
+    }
+    nn_sleep (100);
+
+    /*  The partitioning can't change once there are subscribers. */
+    val = 2;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_FANOUT, &val, sizeof (val));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  All the subscribers get all the messages, in order. */
+    for (i = 0; i != MESSAGES; ++i) {
+        sprintf (buf, "%d", i);
+        test_send (pub, buf);
+    }
+    for (j = 0; j != SUBSCRIBERS; ++j) {
+        for (i = 0; i != MESSAGES; ++i) {
+            sprintf (buf, "%d", i);
+            test_recv (sub [j], buf);
+        }
+    }
+
+    /*  The socket can be closed with messages still waiting for
+        the workers. */
+    for (i = 0; i != MESSAGES; ++i)
+        test_send (pub, "x");
+    test_close (pub);
+
+    for (i = 0; i != SUBSCRIBERS; ++i)
+        test_close (sub [i]);
+
+    return 0;
+}
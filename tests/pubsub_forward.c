@@ -0,0 +1,120 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+/*  Tests filtering of messages on the publisher side. */
+
+#define SOCKET_ADDRESS "inproc://a"
+
+/*  Number of messages sent to overflow the pipe to a subscriber that is
+    not reading. */
+#define FLOOD 1000
+
+static void flood (int pub, const char *last)
+{
+    int i;
+
+    for (i = 0; i != FLOOD; ++i)
+        test_send (pub, "b");
+    test_send (pub, (char*) last);
+}
+
+int main ()
+{
+    int rc;
+    int pub;
+    int sub1;
+    int sub2;
+    int val;
+    size_t sz;
+
+    pub = test_socket (AF_SP, NN_PUB);
+    test_bind (pub, SOCKET_ADDRESS);
+
+    /*  The option is not available on publishers. */
+    val = 1;
+    rc = nn_setsockopt (pub, NN_SUB, NN_SUB_FORWARD, &val, sizeof (val));
+    nn_assert (rc == -1 && nn_errno () == ENOPROTOOPT);
+
+    /*  sub1 forwards its subscriptions, sub2 filters locally. */
+    sub1 = test_socket (AF_SP, NN_SUB);
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_FORWARD, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 0);
+    val = 1;
+    test_setsockopt (sub1, NN_SUB, NN_SUB_FORWARD, &val, sizeof (val));
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "a", 1);
+    test_connect (sub1, SOCKET_ADDRESS);
+    sub2 = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "a", 1);
+    test_connect (sub2, SOCKET_ADDRESS);
+    val = 100;
+    test_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    test_setsockopt (sub2, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+
+    /*  Wait till connections are established and subscriptions forwarded. */
+    nn_sleep (100);
+
+    /*  Non-matching messages fill up the pipe to sub2, so the matching one
+        is dropped by the publisher. sub1 never gets the non-matching ones. */
+    flood (pub, "a1");
+    test_recv (sub1, "a1");
+    test_drop (sub1, ETIMEDOUT);
+    test_drop (sub2, ETIMEDOUT);
+
+    /*  Subscription changes are forwarded as well. */
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "c", 1);
+    test_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE, "a", 1);
+    nn_sleep (100);
+    test_send (pub, "a2");
+    test_send (pub, "c1");
+    test_recv (sub1, "c1");
+    flood (pub, "c2");
+    test_recv (sub1, "c2");
+
+    /*  The topic of a multi-part message may span its parts. */
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "de", 2);
+    nn_sleep (100);
+    test_send_parts (pub, "de1", 1);
+    test_recv (sub1, "de1");
+    test_send_parts (pub, "df1", 1);
+    test_drop (sub1, ETIMEDOUT);
+
+    /*  Once forwarding is switched off the publisher sends everything. */
+    val = 0;
+    test_setsockopt (sub1, NN_SUB, NN_SUB_FORWARD, &val, sizeof (val));
+    nn_sleep (100);
+    flood (pub, "c3");
+    test_drop (sub1, ETIMEDOUT);
+
+    test_close (sub2);
+    test_close (sub1);
+    test_close (pub);
+
+    return 0;
+}
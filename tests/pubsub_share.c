@@ -0,0 +1,141 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+
+/*  Tests SUB sockets sharing their subscriptions. */
+
+#define SOCKET_ADDRESS "inproc://a"
+
+/*  Number of subscriptions added to the group in bulk. */
+#define TOPICS 1000
+
+static int sub_socket (int share)
+{
+    int s;
+    int val;
+
+    s = test_socket (AF_SP, NN_SUB);
+    val = share;
+    test_setsockopt (s, NN_SUB, NN_SUB_SHARE, &val, sizeof (val));
+    val = 100;
+    test_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    test_connect (s, SOCKET_ADDRESS);
+    return s;
+}
+
+int main ()
+{
+    int rc;
+    int pub;
+    int sub1;
+    int sub2;
+    int sub3;
+    int val;
+    int i;
+    size_t sz;
+    char topic [16];
+
+    pub = test_socket (AF_SP, NN_PUB);
+    test_bind (pub, SOCKET_ADDRESS);
+    sub1 = sub_socket (7);
+    sub2 = sub_socket (7);
+    nn_sleep (10);
+
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_SHARE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 7);
+
+    /*  Members of a group can't forward their subscriptions. */
+    val = 1;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_FORWARD, &val, sizeof (val));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  Nor use exact subscriptions. */
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_EXACT, "a", 1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_UNSUBSCRIBE_EXACT, "a", 1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  A subscription made through one member applies to all of them. */
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "a", 1);
+    test_send (pub, "b1");
+    test_send (pub, "a1");
+    test_recv (sub1, "a1");
+    test_recv (sub2, "a1");
+
+    /*  So does unsubscribing. */
+    test_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "c", 1);
+    test_setsockopt (sub2, NN_SUB, NN_SUB_UNSUBSCRIBE, "a", 1);
+    test_send (pub, "a2");
+    test_send (pub, "c1");
+    test_recv (sub1, "c1");
+    test_recv (sub2, "c1");
+
+    /*  A socket joining the group later gets its subscriptions. */
+    sub3 = sub_socket (7);
+    nn_sleep (10);
+    test_send (pub, "c2");
+    test_recv (sub1, "c2");
+    test_recv (sub2, "c2");
+    test_recv (sub3, "c2");
+
+    /*  Many subscriptions at once. */
+    for (i = 0; i != TOPICS; ++i) {
+        sprintf (topic, "t%d", i);
+        test_setsockopt (sub3, NN_SUB, NN_SUB_SUBSCRIBE, topic, strlen (topic));
+    }
+    test_send (pub, "t999");
+    test_recv (sub1, "t999");
+    test_recv (sub2, "t999");
+    test_recv (sub3, "t999");
+
+    /*  A socket that leaves the group has no subscriptions. The others keep
+        them. */
+    val = 0;
+    test_setsockopt (sub3, NN_SUB, NN_SUB_SHARE, &val, sizeof (val));
+    test_send (pub, "c3");
+    test_recv (sub1, "c3");
+    test_drop (sub3, ETIMEDOUT);
+    test_recv (sub2, "c3");
+
+    /*  Once all the members are gone, so are the subscriptions. */
+    test_close (sub1);
+    test_close (sub2);
+    sub1 = sub_socket (7);
+    nn_sleep (10);
+    test_send (pub, "c4");
+    test_drop (sub1, ETIMEDOUT);
+
+    test_close (sub3);
+    test_close (sub1);
+    test_close (pub);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*  Tests spooling of the messages pushed while there's no puller. */
+
+#define SPOOL_FILE "test_spool.tmp"
+#define SPOOL_SIZE (64 * 1024)
+#define COUNT 500
+
+static int push_socket (const char *addr)
+{
+    int s;
+    int opt;
+
+    s = test_socket (AF_SP, NN_PUSH);
+    opt = SPOOL_SIZE;
+    test_setsockopt (s, NN_PUSH, NN_PUSH_SPOOL_SIZE, &opt, sizeof (opt));
+    test_setsockopt (s, NN_PUSH, NN_PUSH_SPOOL, SPOOL_FILE,
+        strlen (SPOOL_FILE));
+    test_connect (s, (char*) addr);
+    return s;
+}
+
+static void send_seq (int s, int from, int to)
+{
+    int rc;
+    int i;
+    char buf [32];
+
+    for (i = from; i != to; ++i) {
+        sprintf (buf, "%d", i);
+        rc = nn_send (s, buf, strlen (buf), NN_DONTWAIT);
+        errno_assert (rc >= 0);
+    }
+}
+
+static void recv_seq (int s, int from, int to)
+{
+    int i;
+    char buf [32];
+
+    for (i = from; i != to; ++i) {
+        sprintf (buf, "%d", i);
+        test_recv (s, buf);
+    }
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int push;
+    int push2;
+    int pull;
+    int opt;
+    int i;
+    size_t sz;
+    char buf [1024];
+    char rbuf [1024];
+    char addr [128];
+
+    test_addr_from (addr, "tcp", "127.0.0.1", get_test_port (argc, argv));
+    remove (SPOOL_FILE);
+
+    /*  No puller to send the messages to, they are spooled. */
+    push = push_socket (addr);
+    send_seq (push, 0, COUNT);
+
+    /*  They are sent in order once the puller shows up, before the ones
+        sent afterwards. */
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, addr);
+    recv_seq (pull, 0, 10);
+    send_seq (push, COUNT, COUNT + 10);
+    recv_seq (pull, 10, COUNT + 10);
+    test_close (push);
+    test_close (pull);
+
+    /*  The spool is bounded. */
+    push = push_socket (addr);
+    memset (buf, 'x', sizeof (buf));
+    for (i = 0; ; ++i) {
+        rc = nn_send (push, buf, sizeof (buf), NN_DONTWAIT);
+        if (rc < 0)
+            break;
+    }
+    nn_assert (nn_errno () == EAGAIN);
+    nn_assert (i > 0 && i < SPOOL_SIZE / (int) sizeof (buf));
+    opt = 100;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+    rc = nn_send (push, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+
+    /*  Only a single socket can use the spool at a time. */
+    push2 = test_socket (AF_SP, NN_PUSH);
+    rc = nn_setsockopt (push2, NN_PUSH, NN_PUSH_SPOOL, SPOOL_FILE,
+        strlen (SPOOL_FILE));
+    nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+    test_close (push2);
+
+    /*  The messages outlive the socket. */
+    test_close (push);
+    push = push_socket (addr);
+    sz = sizeof (rbuf);
+    rc = nn_getsockopt (push, NN_PUSH, NN_PUSH_SPOOL, rbuf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == strlen (SPOOL_FILE) &&
+        memcmp (rbuf, SPOOL_FILE, sz) == 0);
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, addr);
+    while (i--) {
+        rc = nn_recv (pull, rbuf, sizeof (rbuf), 0);
+        errno_assert (rc == sizeof (rbuf));
+        nn_assert (memcmp (rbuf, buf, sizeof (buf)) == 0);
+    }
+    test_send (push, "LAST");
+    test_recv (pull, "LAST");
+    test_close (push);
+    test_close (pull);
+
+    /*  Messages that expire in the spool are dropped. */
+    push = push_socket (addr);
+    opt = 10;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_MSGTTL, &opt, sizeof (opt));
+    test_send (push, "STALE");
+    nn_sleep (50);
+    opt = -1;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_MSGTTL, &opt, sizeof (opt));
+    test_send (push, "FRESH");
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, addr);
+    test_recv (pull, "FRESH");
+    test_close (push);
+    test_close (pull);
+
+    /*  Without the spool, there's nowhere to send the message to. */
+    push = push_socket (addr);
+    test_setsockopt (push, NN_PUSH, NN_PUSH_SPOOL, "", 0);
+    rc = nn_send (push, "X", 1, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    opt = 100;
+    rc = nn_setsockopt (push, NN_PUSH, NN_PUSH_SPOOL_SIZE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (push);
+
+    remove (SPOOL_FILE);
+
+    return 0;
+}
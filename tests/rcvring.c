@@ -0,0 +1,160 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+#include "../src/reqrep.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+#include <string.h>
+#if !defined _WIN32
+#include <poll.h>
+#endif
+
+/*  Tests receiving from the receive ring of a socket. */
+
+#define MSGS 1000
+#define ROUND 50
+#define BATCH 16
+
+#if !defined _WIN32
+
+/*  Returns 1 if the doorbell rings within 'timeout' milliseconds. */
+static int doorbell (struct nn_rcvring *ring, int timeout)
+{
+    int rc;
+    struct pollfd pfd;
+
+    pfd.fd = nn_rcvring_fd (ring);
+    errno_assert (pfd.fd >= 0);
+    pfd.events = POLLIN;
+    rc = poll (&pfd, 1, timeout);
+    errno_assert (rc >= 0);
+    return rc;
+}
+
+static void test_ring (char *addr)
+{
+    int rc;
+    int pull;
+    int push;
+    int i;
+    int j;
+    int done;
+    struct nn_rcvring *ring;
+    void *bufs [BATCH];
+    size_t lens [BATCH];
+    char buf [16];
+
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, addr);
+    push = test_socket (AF_SP, NN_PUSH);
+    test_connect (push, addr);
+    ring = nn_rcvring_open (pull);
+    errno_assert (ring);
+    nn_assert (nn_rcvring_open (pull) == ring);
+
+    /*  Nothing to receive and nothing to ring about. */
+    rc = nn_rcvring_recv (ring, bufs, lens, BATCH);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_assert (doorbell (ring, 0) == 0);
+
+    /*  The doorbell rings once a message arrives and is cleared by the
+        next receive. */
+    test_send (push, "ABC");
+    nn_assert (doorbell (ring, 1000) == 1);
+    rc = nn_rcvring_recv (ring, bufs, lens, BATCH);
+    errno_assert (rc == 1);
+    nn_assert (lens [0] == 3 && memcmp (bufs [0], "ABC", 3) == 0);
+    nn_freemsg (bufs [0]);
+    nn_assert (doorbell (ring, 0) == 0);
+
+    /*  The messages arrive in order. */
+    done = 0;
+    for (i = 0; i != MSGS; i += ROUND) {
+        for (j = i; j != i + ROUND; ++j) {
+            sprintf (buf, "%d", j);
+            test_send (push, buf);
+        }
+        while (done != i + ROUND) {
+            rc = nn_rcvring_recv (ring, bufs, lens, BATCH);
+            if (rc < 0) {
+                errno_assert (nn_errno () == EAGAIN);
+                nn_assert (doorbell (ring, 1000) == 1);
+                continue;
+            }
+            for (j = 0; j != rc; ++j) {
+                sprintf (buf, "%d", done);
+                nn_assert (lens [j] == strlen (buf));
+                nn_assert (memcmp (bufs [j], buf, lens [j]) == 0);
+                nn_freemsg (bufs [j]);
+                ++done;
+            }
+        }
+    }
+    nn_assert (nn_get_statistic (pull, NN_STAT_MESSAGES_RECEIVED) == MSGS + 1);
+
+    /*  Messages can still be received the usual way. */
+    rc = nn_rcvring_recv (ring, bufs, lens, BATCH);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    test_send (push, "DEF");
+    nn_assert (doorbell (ring, 1000) == 1);
+    test_recv (pull, "DEF");
+
+    test_close (push);
+    test_close (pull);
+}
+
+#endif
+
+int main (int argc, const char *argv[])
+{
+    int s;
+    size_t len;
+    void *buf;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    /*  Only the sockets that can use NN_SINGLE_THREAD and receive messages
+        have a ring. */
+    nn_assert (nn_rcvring_open (-1) == NULL && nn_errno () == EBADF);
+    s = test_socket (AF_SP, NN_PUSH);
+    nn_assert (nn_rcvring_open (s) == NULL && nn_errno () == ENOTSUP);
+    test_close (s);
+    s = test_socket (AF_SP, NN_REP);
+    nn_assert (nn_rcvring_open (s) == NULL && nn_errno () == ENOTSUP);
+    test_close (s);
+    nn_assert (nn_rcvring_recv (NULL, &buf, &len, 1) < 0 &&
+        nn_errno () == EFAULT);
+
+#if !defined _WIN32
+    test_ring ("inproc://rcvring");
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_ring (addr);
+    test_ring ("ipc://test_rcvring.ipc");
+#endif
+
+    return 0;
+}
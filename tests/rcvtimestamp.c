@@ -0,0 +1,139 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+
+#include <time.h>
+
+/*  Receives a message and returns the time the kernel received it, in
+    nanoseconds since the Epoch, or 0 if it doesn't carry the time. */
+static uint64_t recv_timestamp (int s, const char *expected)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    char buf [16];
+    unsigned char ctrl [256];
+    struct nn_cmsghdr *cmsg;
+    uint64_t tstamp;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    memset (ctrl, 0, sizeof (ctrl));
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof (ctrl);
+    rc = nn_recvmsg (s, &hdr, 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == strlen (expected) &&
+        memcmp (buf, expected, rc) == 0);
+
+    for (cmsg = NN_CMSG_FIRSTHDR (&hdr); cmsg;
+          cmsg = NN_CMSG_NXTHDR (&hdr, cmsg)) {
+        if (cmsg->cmsg_level == NN_SOL_SOCKET &&
+              cmsg->cmsg_type == NN_MSG_TIMESTAMP) {
+            nn_assert (cmsg->cmsg_len == NN_CMSG_LEN (sizeof (tstamp)));
+            memcpy (&tstamp, NN_CMSG_DATA (cmsg), sizeof (tstamp));
+            nn_assert (tstamp != 0);
+            return tstamp;
+        }
+    }
+    return 0;
+}
+
+static void test_transport (char *addr, int seqpacket)
+{
+    int sb;
+    int sc;
+    int opt;
+    time_t before;
+    time_t after;
+    uint64_t tstamp;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &opt, sizeof (opt));
+    sc = test_socket (AF_SP, NN_PAIR);
+
+    /*  The kernel doesn't timestamp the data of UNIX domain stream
+        sockets. */
+    if (seqpacket) {
+        test_setsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+        test_setsockopt (sc, NN_IPC, NN_IPC_SEQPACKET, &opt, sizeof (opt));
+    }
+    test_bind (sb, addr);
+    test_connect (sc, addr);
+    nn_sleep (100);
+
+    /*  The time is that of the kernel's clock, the same as time's. */
+    before = time (NULL);
+    test_send (sc, "ABC");
+    tstamp = recv_timestamp (sb, "ABC");
+    after = time (NULL);
+#if defined __linux__
+    nn_assert (tstamp != 0);
+#endif
+    if (tstamp)
+        nn_assert (tstamp / 1000000000 >= (uint64_t) before &&
+            tstamp / 1000000000 <= (uint64_t) after);
+
+    /*  Only the connections of the socket that asked for it are
+        timestamped. */
+    test_send (sb, "DEF");
+    nn_assert (recv_timestamp (sc, "DEF") == 0);
+
+    test_close (sc);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+
+    s = test_socket (AF_SP, NN_PAIR);
+    opt = 2;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", get_test_port (argc, argv));
+    test_transport (addr, 0);
+#if !defined NN_HAVE_WINDOWS
+    test_transport ("ipc://test-rcvtimestamp.ipc", 1);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+#include "../src/rdma.h"
+
+#include "testutil.h"
+
+/*  Tests rdma transport. Without an RDMA device in the system, only the
+    options and the refusal to create endpoints can be checked. */
+
+/*  Larger than the slots so that the message has to be split. */
+#define LARGE_SIZE 100000
+
+int main (int argc, const char *argv[])
+{
+    int sb;
+    int sc;
+    int i;
+    int rc;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+    char *buf;
+    char socket_address[128];
+
+    test_addr_from(socket_address, "rdma", "127.0.0.1",
+            get_test_port(argc, argv));
+
+    /*  Check the socket options. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    rc = nn_getsockopt (sb, NN_RDMA, NN_RDMA_BUFSZ, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt_sz == sizeof (opt) && opt == 64 * 1024);
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_RDMA, NN_RDMA_BUFS, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 16);
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_RDMA, NN_RDMA_GID_INDEX, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 0);
+    opt = 100;
+    rc = nn_setsockopt (sb, NN_RDMA, NN_RDMA_BUFSZ, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_RDMA, NN_RDMA_BUFS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = -2;
+    rc = nn_setsockopt (sb, NN_RDMA, NN_RDMA_GID_INDEX, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4096;
+    rc = nn_setsockopt (sb, NN_RDMA, NN_RDMA_BUFSZ, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 4;
+    rc = nn_setsockopt (sb, NN_RDMA, NN_RDMA_BUFS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+
+    /*  Invalid addresses are refused the same way as by the tcp
+        transport. */
+    rc = nn_connect (sb, "rdma://127.0.0.1");
+    nn_assert (rc < 0);
+
+    rc = nn_bind (sb, socket_address);
+    if (rc < 0) {
+        errno_assert (nn_errno () == ENODEV);
+        sc = test_socket (AF_SP, NN_PAIR);
+        rc = nn_connect (sc, socket_address);
+        nn_assert (rc < 0 && nn_errno () == ENODEV);
+        test_close (sc);
+        test_close (sb);
+        return 0;
+    }
+
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+
+    /*  Ping-pong test. */
+    for (i = 0; i != 100; ++i) {
+        test_send (sc, "0123456789012345678901234567890123456789");
+        test_recv (sb, "0123456789012345678901234567890123456789");
+        test_send (sb, "0123456789012345678901234567890123456789");
+        test_recv (sc, "0123456789012345678901234567890123456789");
+    }
+
+    /*  More messages than there are slots. */
+    for (i = 0; i != 100; ++i) {
+        test_send (sc, "XYZ");
+    }
+    for (i = 0; i != 100; ++i) {
+        test_recv (sb, "XYZ");
+    }
+
+    /*  Messages split into several sends, in both directions. */
+    buf = malloc (LARGE_SIZE);
+    alloc_assert (buf);
+    for (i = 0; i < LARGE_SIZE; ++i) {
+        buf[i] = 48 + i % 10;
+    }
+    buf[LARGE_SIZE - 1] = '\0';
+    for (i = 0; i != 4; ++i) {
+        test_send (sc, buf);
+        test_recv (sb, buf);
+        test_send (sb, buf);
+        test_recv (sc, buf);
+    }
+    free (buf);
+
+    test_close (sc);
+    test_close (sb);
+
+    /*  Request/reply over the transport. */
+    sb = test_socket (AF_SP, NN_REP);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_REQ);
+    test_connect (sc, socket_address);
+    for (i = 0; i != 10; ++i) {
+        test_send (sc, "ABC");
+        test_recv (sb, "ABC");
+        test_send (sb, "DEF");
+        test_recv (sc, "DEF");
+    }
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+#define SOCKET_ADDRESS "inproc://a"
+
+#define NMSGS 100
+
+/*  Checks the message packed at 'pos' and returns the position of the next
+    one. */
+static const uint8_t *check_packed (const uint8_t *pos, int i)
+{
+    uint32_t sz;
+
+    sz = ((uint32_t) pos [0] << 24) | ((uint32_t) pos [1] << 16) |
+        ((uint32_t) pos [2] << 8) | pos [3];
+    nn_assert (sz == (uint32_t) (1 + i % 4));
+    nn_assert (pos [4] == (uint8_t) i);
+    return pos + 4 + sz;
+}
+
+int main ()
+{
+    int rc;
+    int push;
+    int pull;
+    int i;
+    int received;
+    int calls;
+    int opt;
+    uint8_t msg [4];
+    uint8_t buf [256];
+    const uint8_t *pos;
+
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, SOCKET_ADDRESS);
+    push = test_socket (AF_SP, NN_PUSH);
+    opt = NMSGS;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_SNDQUEUE_MSGS, &opt,
+        sizeof (opt));
+    test_connect (push, SOCKET_ADDRESS);
+
+    /*  Nothing to receive yet. */
+    rc = nn_recvpacked (pull, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    for (i = 0; i != NMSGS; ++i) {
+        memset (msg, i, sizeof (msg));
+        rc = nn_send (push, msg, 1 + i % 4, 0);
+        errno_assert (rc == 1 + i % 4);
+    }
+
+    /*  Many messages are packed into a single buffer. The one that doesn't
+        fit is left for the next call. */
+    received = 0;
+    calls = 0;
+    while (received != NMSGS) {
+        rc = nn_recvpacked (pull, buf, sizeof (buf), 0);
+        ++calls;
+        errno_assert (rc > 0 && rc <= (int) sizeof (buf));
+        pos = buf;
+        while (pos != buf + rc) {
+            nn_assert (pos < buf + rc);
+            pos = check_packed (pos, received++);
+        }
+    }
+    nn_assert (calls < NMSGS / 4);
+    nn_assert (nn_get_statistic (pull, NN_STAT_MESSAGES_RECEIVED) == NMSGS);
+
+    /*  A message that doesn't fit on its own isn't lost. */
+    test_send (push, "ABCDEFGH");
+    rc = nn_recvpacked (pull, buf, 8, 0);
+    nn_assert (rc == -1 && nn_errno () == EMSGSIZE);
+    test_recv (pull, "ABCDEFGH");
+
+    /*  The socket stays readable while a message is held back. */
+    test_send (push, "ABCDEFGH");
+    test_send (push, "I");
+    rc = nn_recvpacked (pull, buf, 8, 0);
+    nn_assert (rc == -1 && nn_errno () == EMSGSIZE);
+    rc = nn_recvpacked (pull, buf, 12, NN_DONTWAIT);
+    nn_assert (rc == 12 && memcmp (buf + 4, "ABCDEFGH", 8) == 0);
+    rc = nn_recvpacked (pull, buf, 12, NN_DONTWAIT);
+    nn_assert (rc == 5 && buf [4] == 'I');
+
+    rc = nn_recvpacked (pull, NULL, 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    test_close (push);
+    test_close (pull);
+
+    return 0;
+}
@@ -26,6 +26,54 @@
 #include "testutil.h"
 
 #define SOCKET_ADDRESS "inproc://test"
+#define SOCKET_ADDRESS_B "inproc://b"
+
+/*  Moves a message between two raw sockets along with its header. */
+static void forward (int from, int to)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    void *body;
+    void *control;
+
+    iov.iov_base = &body;
+    iov.iov_len = NN_MSG;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (from, &hdr, 0);
+    errno_assert (rc >= 0);
+    rc = nn_sendmsg (to, &hdr, 0);
+    errno_assert (rc >= 0);
+}
+
+/*  Returns the index of the socket the next message arrives at. */
+static int arrives_at (int *s, int count)
+{
+    int rc;
+    int i;
+    char buf [4];
+    struct nn_pollfd pfd [4];
+
+    for (i = 0; i != count; ++i) {
+        pfd [i].fd = s [i];
+        pfd [i].events = NN_POLLIN;
+    }
+    rc = nn_poll (pfd, count, 1000);
+    errno_assert (rc == 1);
+    for (i = 0; i != count; ++i) {
+        if (pfd [i].revents & NN_POLLIN) {
+            rc = nn_recv (s [i], buf, sizeof (buf), 0);
+            errno_assert (rc >= 0);
+            return i;
+        }
+    }
+    nn_assert (0);
+    return -1;
+}
 
 int main ()
 {
@@ -34,9 +82,30 @@ int main ()
     int rep2;
     int req1;
     int req2;
+    int rep3;
     int resend_ivl;
     char buf [7];
     int timeo;
+    int maxinflight;
+    int lb;
+    int ids [3];
+    int id;
+    int i;
+    size_t sz;
+    int reps [3];
+    char bodies [3][4];
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    void *control;
+    struct nn_cmsghdr *cmsg;
+    int xrep;
+    int xreq;
+    int sticky;
+    int first;
+    int hedge;
+    int cache;
+    int maxoutstanding;
+    void *body;
 
     /*  Test req/rep with full socket types. */
     rep1 = test_socket (AF_SP, NN_REP);
@@ -173,6 +242,320 @@ int main ()
     test_close (req1);
     test_close (rep1);
 
+    /*  Test multiple requests in flight. Replies are delivered in the order
+        they arrive, each tagged with the ID of its request. */
+    req1 = test_socket (AF_SP, NN_REQ);
+    test_bind (req1, SOCKET_ADDRESS);
+    maxinflight = 3;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_MAXINFLIGHT,
+        &maxinflight, sizeof (maxinflight));
+    errno_assert (rc == 0);
+    rep1 = test_socket (AF_SP, NN_REP);
+    test_connect (rep1, SOCKET_ADDRESS);
+    rep2 = test_socket (AF_SP, NN_REP);
+    test_connect (rep2, SOCKET_ADDRESS);
+    rep3 = test_socket (AF_SP, NN_REP);
+    test_connect (rep3, SOCKET_ADDRESS);
+
+    rc = nn_recv (req1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    for (i = 0; i != 3; ++i) {
+        buf [0] = (char) ('0' + i);
+        rc = nn_send (req1, buf, 1, 0);
+        errno_assert (rc == 1);
+        sz = sizeof (ids [i]);
+        rc = nn_getsockopt (req1, NN_REQ, NN_REQ_ID, &ids [i], &sz);
+        errno_assert (rc == 0 && sz == sizeof (ids [i]));
+    }
+    nn_assert (ids [0] != ids [1] && ids [1] != ids [2]);
+
+    /*  The limit is reached. */
+    rc = nn_send (req1, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    rc = nn_recv (req1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    reps [0] = rep1;
+    reps [1] = rep2;
+    reps [2] = rep3;
+    for (i = 0; i != 3; ++i) {
+        rc = nn_recv (reps [i], bodies [i], sizeof (bodies [i]), 0);
+        errno_assert (rc == 1);
+    }
+    for (i = 2; i >= 0; --i) {
+        rc = nn_send (reps [i], bodies [i], 1, 0);
+        errno_assert (rc == 1);
+    }
+
+    for (i = 2; i >= 0; --i) {
+        iov.iov_base = buf;
+        iov.iov_len = sizeof (buf);
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &control;
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_recvmsg (req1, &hdr, 0);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == bodies [i][0]);
+        cmsg = NN_CMSG_FIRSTHDR (&hdr);
+        while (1) {
+            nn_assert (cmsg);
+            if (cmsg->cmsg_level == NN_REQ && cmsg->cmsg_type == NN_REQ_ID)
+                break;
+            cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+        }
+        memcpy (&id, NN_CMSG_DATA (cmsg), sizeof (id));
+        nn_assert (id == ids [buf [0] - '0']);
+        nn_freemsg (control);
+    }
+
+    /*  The mode can't be changed while requests are in flight. */
+    test_send (req1, "ABC");
+    maxinflight = 1;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_MAXINFLIGHT,
+        &maxinflight, sizeof (maxinflight));
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    test_close (rep3);
+    test_close (rep2);
+    test_close (rep1);
+    test_close (req1);
+
+    /*  Test least-loaded distribution of requests. A new request goes to
+        the peer that has answered its request rather than to the next one
+        in round-robin order. */
+    req1 = test_socket (AF_SP, NN_REQ);
+    lb = NN_LB_LEASTLOADED;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_LB, &lb, sizeof (lb));
+    errno_assert (rc == 0);
+    maxinflight = 2;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_MAXINFLIGHT,
+        &maxinflight, sizeof (maxinflight));
+    errno_assert (rc == 0);
+    test_bind (req1, SOCKET_ADDRESS);
+    rep1 = test_socket (AF_SP, NN_REP);
+    test_connect (rep1, SOCKET_ADDRESS);
+    rep2 = test_socket (AF_SP, NN_REP);
+    test_connect (rep2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (req1, "A");
+    test_send (req1, "B");
+    reps [0] = rep1;
+    reps [1] = rep2;
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (reps [i], bodies [i], sizeof (bodies [i]), 0);
+        errno_assert (rc == 1);
+    }
+    i = bodies [0][0] == 'B' ? 0 : 1;
+    test_send (reps [i], "B");
+    test_recv (req1, "B");
+    test_send (req1, "C");
+    test_recv (reps [i], "C");
+
+    test_close (rep2);
+    test_close (rep1);
+    test_close (req1);
+
+    /*  Test sticky routing behind a device. All the requests of a client go
+        to the same backend. */
+    xreq = test_socket (AF_SP_RAW, NN_REQ);
+    sz = sizeof (sticky);
+    rc = nn_getsockopt (xreq, NN_REQ, NN_REQ_STICKY, &sticky, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (sticky) && sticky == 0);
+    sticky = -1;
+    rc = nn_setsockopt (xreq, NN_REQ, NN_REQ_STICKY, &sticky, sizeof (sticky));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    sticky = 16;
+    rc = nn_setsockopt (xreq, NN_REQ, NN_REQ_STICKY, &sticky, sizeof (sticky));
+    errno_assert (rc == 0);
+    test_bind (xreq, SOCKET_ADDRESS_B);
+    xrep = test_socket (AF_SP_RAW, NN_REP);
+    test_bind (xrep, SOCKET_ADDRESS);
+    rep1 = test_socket (AF_SP, NN_REP);
+    test_connect (rep1, SOCKET_ADDRESS_B);
+    rep2 = test_socket (AF_SP, NN_REP);
+    test_connect (rep2, SOCKET_ADDRESS_B);
+    req1 = test_socket (AF_SP, NN_REQ);
+    test_connect (req1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    reps [0] = rep1;
+    reps [1] = rep2;
+    test_send (req1, "A");
+    forward (xrep, xreq);
+    first = arrives_at (reps, 2);
+    for (i = 0; i != 4; ++i) {
+        test_send (req1, "A");
+        forward (xrep, xreq);
+        nn_assert (arrives_at (reps, 2) == first);
+    }
+
+    /*  When the backend goes away, the client moves to the other one. */
+    test_close (reps [first]);
+    test_send (req1, "A");
+    forward (xrep, xreq);
+    nn_assert (arrives_at (&reps [1 - first], 1) == 0);
+
+    test_close (req1);
+    test_close (reps [1 - first]);
+    test_close (xrep);
+    test_close (xreq);
+
+    /*  Test hedging. When the reply is late, a duplicate of the request is
+        sent to the other peer and the first reply is taken. */
+    for (maxinflight = 1; maxinflight <= 2; ++maxinflight) {
+        req1 = test_socket (AF_SP, NN_REQ);
+        rc = nn_setsockopt (req1, NN_REQ, NN_REQ_MAXINFLIGHT,
+            &maxinflight, sizeof (maxinflight));
+        errno_assert (rc == 0);
+        hedge = -2;
+        rc = nn_setsockopt (req1, NN_REQ, NN_REQ_HEDGE_IVL,
+            &hedge, sizeof (hedge));
+        nn_assert (rc == -1 && nn_errno () == EINVAL);
+        hedge = 50;
+        rc = nn_setsockopt (req1, NN_REQ, NN_REQ_HEDGE_IVL,
+            &hedge, sizeof (hedge));
+        errno_assert (rc == 0);
+        test_bind (req1, SOCKET_ADDRESS);
+        rep1 = test_socket (AF_SP, NN_REP);
+        test_connect (rep1, SOCKET_ADDRESS);
+        rep2 = test_socket (AF_SP, NN_REP);
+        test_connect (rep2, SOCKET_ADDRESS);
+        nn_sleep (10);
+
+        reps [0] = rep1;
+        reps [1] = rep2;
+        test_send (req1, "A");
+        first = arrives_at (reps, 2);
+        nn_assert (arrives_at (reps, 2) == 1 - first);
+        test_send (reps [1 - first], "B");
+        test_recv (req1, "B");
+
+        /*  The late reply is dropped. */
+        test_send (reps [first], "C");
+        nn_sleep (10);
+        rc = nn_recv (req1, buf, sizeof (buf), NN_DONTWAIT);
+        nn_assert (rc == -1 && nn_errno () == EFSM);
+
+        test_close (rep2);
+        test_close (rep1);
+        test_close (req1);
+    }
+
+    /*  Test the reply cache. A resent request is answered with the cached
+        reply and isn't received by the application again. */
+    rep1 = test_socket (AF_SP, NN_REP);
+    sz = sizeof (cache);
+    rc = nn_getsockopt (rep1, NN_REP, NN_REP_CACHE, &cache, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (cache) && cache == 0);
+    cache = -1;
+    rc = nn_setsockopt (rep1, NN_REP, NN_REP_CACHE, &cache, sizeof (cache));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    cache = 2;
+    rc = nn_setsockopt (rep1, NN_REP, NN_REP_CACHE, &cache, sizeof (cache));
+    errno_assert (rc == 0);
+    timeo = 100;
+    rc = nn_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO,
+       &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    test_bind (rep1, SOCKET_ADDRESS);
+    xreq = test_socket (AF_SP_RAW, NN_REQ);
+    test_connect (xreq, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    for (i = 0; i != 3; ++i) {
+        memcpy (buf, "\x80\0\0\0ABC", 7);
+        buf [3] = (char) i;
+        rc = nn_send (xreq, buf, 7, 0);
+        errno_assert (rc == 7);
+        test_recv (rep1, "ABC");
+        bodies [0][0] = (char) ('A' + i);
+        bodies [0][1] = 0;
+        test_send (rep1, bodies [0]);
+        rc = nn_recv (xreq, buf, sizeof (buf), 0);
+        errno_assert (rc == 1 && buf [0] == 'A' + i);
+    }
+
+    /*  The two most recent replies are remembered. The duplicates are
+        answered while the application is receiving. */
+    for (i = 2; i >= 1; --i) {
+        memcpy (buf, "\x80\0\0\0ABC", 7);
+        buf [3] = (char) i;
+        rc = nn_send (xreq, buf, 7, 0);
+        errno_assert (rc == 7);
+    }
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    for (i = 2; i >= 1; --i) {
+        rc = nn_recv (xreq, buf, sizeof (buf), 0);
+        errno_assert (rc == 1 && buf [0] == 'A' + i);
+    }
+    memcpy (buf, "\x80\0\0\0ABC", 7);
+    rc = nn_send (xreq, buf, 7, 0);
+    errno_assert (rc == 7);
+    test_recv (rep1, "ABC");
+
+    test_close (xreq);
+    test_close (rep1);
+
+    /*  Test the limit on outstanding requests. Once it's reached, no more
+        requests are received until one of them is answered. */
+    xrep = test_socket (AF_SP_RAW, NN_REP);
+    maxoutstanding = -1;
+    rc = nn_setsockopt (xrep, NN_REP, NN_REP_MAXOUTSTANDING,
+        &maxoutstanding, sizeof (maxoutstanding));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    maxoutstanding = 2;
+    rc = nn_setsockopt (xrep, NN_REP, NN_REP_MAXOUTSTANDING,
+        &maxoutstanding, sizeof (maxoutstanding));
+    errno_assert (rc == 0);
+    sz = sizeof (maxoutstanding);
+    rc = nn_getsockopt (xrep, NN_REP, NN_REP_MAXOUTSTANDING,
+        &maxoutstanding, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (maxoutstanding) && maxoutstanding == 2);
+    timeo = 100;
+    rc = nn_setsockopt (xrep, NN_SOL_SOCKET, NN_RCVTIMEO,
+       &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    test_bind (xrep, SOCKET_ADDRESS);
+    xreq = test_socket (AF_SP_RAW, NN_REQ);
+    test_connect (xreq, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    for (i = 0; i != 3; ++i) {
+        memcpy (buf, "\x80\0\0\0ABC", 7);
+        buf [3] = (char) i;
+        rc = nn_send (xreq, buf, 7, 0);
+        errno_assert (rc == 7);
+    }
+    iov.iov_base = &body;
+    iov.iov_len = NN_MSG;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (xrep, &hdr, 0);
+    errno_assert (rc == 3);
+    test_recv (xrep, "ABC");
+    rc = nn_recv (xrep, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+
+    /*  Answer the first request. */
+    rc = nn_sendmsg (xrep, &hdr, 0);
+    errno_assert (rc == 3);
+    test_recv (xreq, "ABC");
+    test_recv (xrep, "ABC");
+
+    test_close (xreq);
+    test_close (xrep);
+
     return 0;
 }
 
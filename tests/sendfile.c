@@ -0,0 +1,217 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/ipc.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*  Tests sending regions of a file along with the messages. */
+
+#define FILE_NAME "test_sendfile.tmp"
+#define FILE_SIZE (3 * 1024 * 1024 + 17)
+
+static char data [FILE_SIZE];
+
+static int send_file (int s, const char *body, int fd, uint64_t offset,
+    uint64_t length, const int *fds, int nfds)
+{
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    unsigned char ctrl [256];
+    struct nn_cmsghdr *cmsg;
+    struct nn_file_region region;
+
+    iov.iov_base = (void*) body;
+    iov.iov_len = strlen (body);
+    memset (&hdr, 0, sizeof (hdr));
+    memset (ctrl, 0, sizeof (ctrl));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (sizeof (region));
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    cmsg->cmsg_level = NN_SOL_SOCKET;
+    cmsg->cmsg_type = NN_FILE_REGION;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (region));
+    region.fd = fd;
+    region.offset = offset;
+    region.length = length;
+    memcpy (NN_CMSG_DATA (cmsg), &region, sizeof (region));
+    if (nfds) {
+        hdr.msg_controllen += NN_CMSG_SPACE (sizeof (int) * nfds);
+        cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+        cmsg->cmsg_level = NN_IPC;
+        cmsg->cmsg_type = NN_IPC_FDS;
+        cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int) * nfds);
+        memcpy (NN_CMSG_DATA (cmsg), fds, sizeof (int) * nfds);
+    }
+    return nn_sendmsg (s, &hdr, 0);
+}
+
+static void recv_file (int s, const char *body, uint64_t offset,
+    uint64_t length)
+{
+    int rc;
+    char *buf;
+    size_t len;
+
+    len = strlen (body);
+    rc = nn_recv (s, &buf, NN_MSG, 0);
+    errno_assert (rc >= 0);
+    nn_assert ((size_t) rc == len + length);
+    nn_assert (memcmp (buf, body, len) == 0);
+    nn_assert (memcmp (buf + len, data + offset, (size_t) length) == 0);
+    nn_freemsg (buf);
+}
+
+static int open_file (void)
+{
+    int fd;
+
+    fd = open (FILE_NAME, O_RDONLY);
+    errno_assert (fd >= 0);
+    return fd;
+}
+
+static void test_transport (char *addr, int level, int option)
+{
+    int rc;
+    int sb;
+    int sc;
+    int fd;
+    int i;
+    int opt;
+    int p [2];
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    if (option) {
+        opt = 1;
+        test_setsockopt (sb, level, option, &opt, sizeof (opt));
+        test_setsockopt (sc, level, option, &opt, sizeof (opt));
+    }
+    test_bind (sb, addr);
+    test_connect (sc, addr);
+
+    /*  Wait for the connection to be established. */
+    test_send (sc, "0");
+    test_recv (sb, "0");
+
+    /*  The descriptor may be closed as soon as the message is sent. */
+    fd = open_file ();
+    rc = send_file (sc, "HDR", fd, 0, FILE_SIZE, NULL, 0);
+    errno_assert (rc >= 0);
+    close (fd);
+    recv_file (sb, "HDR", 0, FILE_SIZE);
+
+    /*  Regions interleaved with ordinary messages, the order is kept. */
+    fd = open_file ();
+    for (i = 0; i != 10; ++i) {
+        test_send (sc, "plain");
+        rc = send_file (sc, i % 2 ? "" : "ODD", fd, (uint64_t) i * 1001,
+            (uint64_t) i * 777, NULL, 0);
+        errno_assert (rc >= 0);
+    }
+    for (i = 0; i != 10; ++i) {
+        test_recv (sb, "plain");
+        recv_file (sb, i % 2 ? "" : "ODD", (uint64_t) i * 1001,
+            (uint64_t) i * 777);
+    }
+
+    /*  The end of the file. */
+    rc = send_file (sc, "END", fd, FILE_SIZE - 5, 5, NULL, 0);
+    errno_assert (rc >= 0);
+    recv_file (sb, "END", FILE_SIZE - 5, 5);
+
+    /*  Along with the descriptors passed over IPC. */
+    rc = pipe (p);
+    errno_assert (rc == 0);
+    rc = send_file (sc, "FDS", fd, 100, 100000, &p [1], 1);
+    errno_assert (rc >= 0);
+    recv_file (sb, "FDS", 100, 100000);
+    close (p [0]);
+    close (p [1]);
+    close (fd);
+
+    test_close (sc);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int fd;
+    int p [2];
+    int i;
+    char addr [128];
+    FILE *f;
+
+    test_addr_from (addr, "tcp", "127.0.0.1", get_test_port (argc, argv));
+
+    for (i = 0; i != FILE_SIZE; ++i)
+        data [i] = (char) (i * 7 + i / 4096);
+    f = fopen (FILE_NAME, "wb");
+    nn_assert (f);
+    nn_assert (fwrite (data, 1, FILE_SIZE, f) == FILE_SIZE);
+    fclose (f);
+
+    test_transport (addr, 0, 0);
+    test_transport ("ipc://test_sendfile.ipc", 0, 0);
+
+    /*  Records of SOCK_SEQPACKET sockets, as well as in-process transport,
+        get the region read into the message instead. */
+    test_transport ("ipc://test_sendfile2.ipc", NN_IPC, NN_IPC_SEQPACKET);
+    test_transport ("inproc://test_sendfile", 0, 0);
+
+    /*  Invalid regions. */
+    s = test_socket (AF_SP, NN_PAIR);
+    test_bind (s, "inproc://invalid");
+    fd = open_file ();
+    rc = send_file (s, "X", -1, 0, 1, NULL, 0);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+    rc = send_file (s, "X", fd, FILE_SIZE, 1, NULL, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = send_file (s, "X", fd, 1, (uint64_t) -1, NULL, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = pipe (p);
+    errno_assert (rc == 0);
+    rc = send_file (s, "X", p [0], 0, 0, NULL, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    close (p [0]);
+    close (p [1]);
+    close (fd);
+    test_close (s);
+
+    rc = unlink (FILE_NAME);
+    errno_assert (rc == 0);
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/ipc.h"
+#include "../src/shm.h"
+
+#include "testutil.h"
+
+/*  Tests shm transport. */
+
+#define SOCKET_ADDRESS "shm://test.shm"
+#define IPC_ADDRESS "ipc://test.shm"
+
+/*  Larger than the ring so that the message has to wrap around. */
+#define LARGE_SIZE 100000
+
+int main ()
+{
+    int sb;
+    int sc;
+    int s1;
+    int i;
+    int rc;
+    int opt;
+    size_t opt_sz = sizeof (opt);
+    void *dummy_buf;
+    char *buf;
+    char *msg;
+    char *sent;
+
+    /*  Try closing a shm socket while it not connected. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    test_close (sc);
+
+    /*  Check BUFSZ socket option. The value is used by the pipes created
+        subsequently. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    rc = nn_getsockopt (sb, NN_SHM, NN_SHM_BUFSZ, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt_sz == sizeof (opt));
+    nn_assert (opt == 1024 * 1024);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_SHM, NN_SHM_BUFSZ, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4096;
+    rc = nn_setsockopt (sb, NN_SHM, NN_SHM_BUFSZ, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt_sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SHM, NN_SHM_BUFSZ, &opt, &opt_sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 4096);
+    test_bind (sb, SOCKET_ADDRESS);
+
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 4096;
+    rc = nn_setsockopt (sc, NN_SHM, NN_SHM_BUFSZ, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    test_connect (sc, SOCKET_ADDRESS);
+
+    /*  Ping-pong test. */
+    for (i = 0; i != 100; ++i) {
+        test_send (sc, "0123456789012345678901234567890123456789");
+        test_recv (sb, "0123456789012345678901234567890123456789");
+        test_send (sb, "0123456789012345678901234567890123456789");
+        test_recv (sc, "0123456789012345678901234567890123456789");
+    }
+
+    /*  Batch transfer test. */
+    for (i = 0; i != 100; ++i) {
+        test_send (sc, "XYZ");
+    }
+    for (i = 0; i != 100; ++i) {
+        test_recv (sb, "XYZ");
+    }
+
+    /*  Pass messages larger than the rings in both directions. */
+    buf = malloc (LARGE_SIZE);
+    alloc_assert (buf);
+    for (i = 0; i < LARGE_SIZE; ++i) {
+        buf[i] = 48 + i % 10;
+    }
+    buf[LARGE_SIZE - 1] = '\0';
+    for (i = 0; i != 4; ++i) {
+        test_send (sc, buf);
+        test_recv (sb, buf);
+        test_send (sb, buf);
+        test_recv (sc, buf);
+    }
+    test_send (sc, buf);
+    test_send (sb, "ABC");
+    test_recv (sc, "ABC");
+    test_recv (sb, buf);
+
+    /*  Messages allocated in shared memory are passed by reference. */
+    for (i = 0; i != 4; ++i) {
+        msg = nn_allocmsg (LARGE_SIZE, NN_SHM);
+        alloc_assert (msg);
+        memcpy (msg, buf, LARGE_SIZE);
+        sent = msg;
+        rc = nn_send (sc, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+        nn_assert (msg == sent);
+        nn_assert (memcmp (msg, buf, LARGE_SIZE) == 0);
+
+        /*  Send it back the same way. */
+        rc = nn_send (sb, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+        rc = nn_recv (sc, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+        nn_assert (memcmp (msg, buf, LARGE_SIZE) == 0);
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+    }
+
+    /*  Messages left unreceived are released when the pipe is closed. */
+    for (i = 0; i != 4; ++i) {
+        msg = nn_allocmsg (LARGE_SIZE, NN_SHM);
+        alloc_assert (msg);
+        rc = nn_send (sc, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+    }
+    free (buf);
+
+    test_close (sc);
+    test_close (sb);
+
+    /*  Test NN_RCVMAXSIZE limit */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    s1 = test_socket (AF_SP, NN_PAIR);
+    test_connect (s1, SOCKET_ADDRESS);
+    opt = 4;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    nn_sleep (100);
+    test_send (s1, "ABCD");
+    test_recv (sb, "ABCD");
+    test_send (s1, "ABCDE");
+    nn_sleep (100);
+    rc = nn_recv (sb, &dummy_buf, NN_MSG, NN_DONTWAIT);
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EAGAIN);
+    test_close (sb);
+    test_close (s1);
+
+    /*  An ipc peer is refused, but the endpoints keep working. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    s1 = test_socket (AF_SP, NN_PAIR);
+    test_connect (s1, IPC_ADDRESS);
+    nn_sleep (100);
+    test_close (s1);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_close (sc);
+    test_close (sb);
+
+    /*  Test closing a socket that is waiting to connect. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    nn_sleep (100);
+    test_close (sc);
+
+    return 0;
+}
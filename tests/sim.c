@@ -0,0 +1,184 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/sim.h"
+
+#include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+/*  Tests the network emulation of the sim transport. */
+
+/*  Sends 'count' messages numbered from zero and returns how many arrive,
+    checking that they do so in order. */
+static int test_count (int sc, int sb, int count)
+{
+    int rc;
+    int i;
+    int last;
+    int received;
+    int opt;
+
+    for (i = 0; i != count; ++i) {
+        rc = nn_send (sc, &i, sizeof (i), 0);
+        errno_assert (rc == sizeof (i));
+    }
+
+    opt = 200;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    last = -1;
+    received = 0;
+    while (1) {
+        rc = nn_recv (sb, &i, sizeof (i), 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == ETIMEDOUT);
+            break;
+        }
+        nn_assert (rc == sizeof (i));
+        nn_assert (i > last && i < count);
+        last = i;
+        ++received;
+    }
+    return received;
+}
+
+/*  Counts the messages that get through a lossy link seeded with 'seed'. */
+static int test_loss (int seed)
+{
+    int sb;
+    int sc;
+    int opt;
+    int received;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "sim://loss");
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 500000;
+    test_setsockopt (sc, NN_SIM, NN_SIM_LOSS, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_SIM, NN_SIM_SEED, &seed, sizeof (seed));
+    test_connect (sc, "sim://loss");
+    received = test_count (sc, sb, 100);
+    test_close (sc);
+    test_close (sb);
+
+    return received;
+}
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int si;
+    int opt;
+    int i;
+    size_t sz;
+    char buf [1000];
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+
+    /*  Options. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SIM, NN_SIM_DELAY, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_SIM, NN_SIM_DELAY, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1000001;
+    rc = nn_setsockopt (sb, NN_SIM, NN_SIM_LOSS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    /*  The addresses don't clash with the inproc ones. */
+    test_bind (sb, "sim://a");
+    si = test_socket (AF_SP, NN_PAIR);
+    test_bind (si, "inproc://a");
+    test_close (si);
+
+    /*  The delay applies to the messages sent by the socket it's set on. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 100;
+    test_setsockopt (sc, NN_SIM, NN_SIM_DELAY, &opt, sizeof (opt));
+    test_connect (sc, "sim://a");
+    test_send (sb, "ABC");
+    test_recv (sc, "ABC");
+    nn_stopwatch_init (&stopwatch);
+    test_send (sc, "DEF");
+    test_recv (sb, "DEF");
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed >= 100000);
+    time_assert (elapsed, 100000);
+
+    /*  Messages in flight don't hold up closing the socket. */
+    test_send (sc, "GHI");
+    test_close (sc);
+    test_close (sb);
+
+    /*  The bandwidth paces the sender. Ten messages of 1000 bytes take
+        100ms to transmit at 100000 bytes per second. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "sim://b");
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 100000;
+    test_setsockopt (sc, NN_SIM, NN_SIM_BANDWIDTH, &opt, sizeof (opt));
+    test_connect (sc, "sim://b");
+    test_send (sb, "ABC");
+    test_recv (sc, "ABC");
+    memset (buf, 0, sizeof (buf));
+    nn_stopwatch_init (&stopwatch);
+    for (i = 0; i != 10; ++i) {
+        rc = nn_send (sc, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+    }
+    for (i = 0; i != 10; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+    }
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed >= 90000);
+    time_assert (elapsed, 100000);
+    test_close (sc);
+    test_close (sb);
+
+    /*  The jitter doesn't reorder the messages. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "sim://c");
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 20;
+    test_setsockopt (sc, NN_SIM, NN_SIM_JITTER, &opt, sizeof (opt));
+    test_connect (sc, "sim://c");
+    test_send (sb, "ABC");
+    test_recv (sc, "ABC");
+    nn_assert (test_count (sc, sb, 50) == 50);
+    test_close (sc);
+    test_close (sb);
+
+    /*  About half of the messages are lost, the same ones every time. */
+    rc = test_loss (1);
+    nn_assert (rc > 20 && rc < 80);
+    nn_assert (test_loss (1) == rc);
+
+    return 0;
+}
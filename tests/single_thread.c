@@ -0,0 +1,164 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+#include "../src/reqrep.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*  Tests sockets used from a single thread, which receive without locking
+    whenever they can. */
+
+#define MSGS 1000
+#define ROUND 50
+
+static void wait_readable (int s)
+{
+    int rc;
+    struct nn_pollfd pfd;
+
+    pfd.fd = s;
+    pfd.events = NN_POLLIN;
+    rc = nn_poll (&pfd, 1, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1 && (pfd.revents & NN_POLLIN));
+}
+
+static void test_stream (char *addr)
+{
+    int rc;
+    int pull;
+    int push;
+    int opt;
+    int i;
+    int j;
+    char buf [16];
+    char expected [16];
+
+    pull = test_socket (AF_SP, NN_PULL);
+    opt = 1;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    test_bind (pull, addr);
+    push = test_socket (AF_SP, NN_PUSH);
+    test_setsockopt (push, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    test_connect (push, addr);
+
+    /*  Blocking receive. */
+    test_send (push, "ABC");
+    test_recv (pull, "ABC");
+
+    /*  The messages arrive in order, whether they are picked up from
+        the queue or from the protocol. They are sent in rounds so that
+        the connection doesn't fill up. */
+    for (i = 0; i != MSGS; ++i) {
+        if (i % ROUND == 0) {
+            for (j = i; j != i + ROUND; ++j) {
+                sprintf (buf, "%d", j);
+                test_send (push, buf);
+            }
+        }
+        sprintf (expected, "%d", i);
+        while (1) {
+            rc = nn_recv (pull, buf, sizeof (buf), NN_DONTWAIT);
+            if (rc >= 0)
+                break;
+            errno_assert (nn_errno () == EAGAIN);
+            wait_readable (pull);
+        }
+        nn_assert (rc == (int) strlen (expected));
+        nn_assert (memcmp (buf, expected, rc) == 0);
+    }
+    nn_assert (nn_get_statistic (pull, NN_STAT_MESSAGES_RECEIVED) == MSGS + 1);
+    rc = nn_recv (pull, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Switched off, the socket receives the messages queued already
+        first. */
+    test_send (push, "DEF");
+    test_send (push, "GHI");
+    wait_readable (pull);
+    opt = 0;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    test_recv (pull, "DEF");
+    test_recv (pull, "GHI");
+
+    /*  Messages still queued are freed when the socket is closed. */
+    opt = 1;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    test_send (push, "JKL");
+    test_send (push, "MNO");
+    wait_readable (pull);
+
+    test_close (push);
+    test_close (pull);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    s = test_socket (AF_SP, NN_PULL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = 2;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    test_setsockopt (s, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt, sizeof (opt));
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 1);
+    test_close (s);
+
+    /*  Protocols that track the messages they pass on don't support it. */
+    s = test_socket (AF_SP, NN_REP);
+    opt = 1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_SINGLE_THREAD, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == ENOTSUP);
+    test_close (s);
+
+    test_stream ("inproc://single_thread");
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_stream (addr);
+    test_stream ("ipc://test_single_thread.ipc");
+
+    return 0;
+}
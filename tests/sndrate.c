@@ -0,0 +1,124 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+#define SOCKET_ADDRESS "inproc://sndrate"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    size_t sz;
+    char buf [100];
+    struct nn_pollfd pfd;
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    memset (buf, 'A', sizeof (buf));
+
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_MSGS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 0;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_BURST, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_BURST, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 100);
+
+    /*  Ten messages a second with the default burst let a single message
+        through every 100ms. */
+    opt = 10;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_MSGS, &opt, sizeof (opt));
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_stopwatch_init (&stopwatch);
+    test_send (sc, "ABC");
+    elapsed = nn_stopwatch_term (&stopwatch);
+    time_assert (elapsed, 100000);
+
+    /*  The socket is not writable till the tokens are there. */
+    pfd.fd = sc;
+    pfd.events = NN_POLLOUT;
+    rc = nn_poll (&pfd, 1, 0);
+    errno_assert (rc == 0);
+    nn_stopwatch_init (&stopwatch);
+    rc = nn_poll (&pfd, 1, 1000);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    errno_assert (rc == 1 && (pfd.revents & NN_POLLOUT));
+    time_assert (elapsed, 100000);
+    test_send (sc, "ABC");
+
+    /*  The send timeout applies while waiting for the tokens. */
+    opt = 20;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+    rc = nn_send (sc, "ABC", 3, 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    opt = -1;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+
+    /*  1000 bytes a second make for a bucket of 100 bytes. */
+    opt = 0;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_MSGS, &opt, sizeof (opt));
+    opt = 1000;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_BYTES, &opt, sizeof (opt));
+    rc = nn_send (sc, buf, 100, NN_DONTWAIT);
+    errno_assert (rc == 100);
+    rc = nn_send (sc, buf, 50, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_stopwatch_init (&stopwatch);
+    rc = nn_send (sc, buf, 50, 0);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    errno_assert (rc == 50);
+    time_assert (elapsed, 50000);
+
+    /*  A larger burst lets more messages through at once. */
+    opt = 200;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDRATE_BURST, &opt, sizeof (opt));
+    rc = nn_send (sc, buf, 100, NN_DONTWAIT);
+    errno_assert (rc == 100);
+    rc = nn_send (sc, buf, 100, NN_DONTWAIT);
+    errno_assert (rc == 100);
+    rc = nn_send (sc, buf, 1, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  The socket can be closed while a message waits for the tokens. */
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
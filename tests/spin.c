@@ -0,0 +1,113 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+
+/*  Tests the AIO worker threads that busy-poll for events. */
+
+static void test_exchange (char *addr, int worker)
+{
+    int sb;
+    int sc;
+    int i;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_WORKER, &worker, sizeof (worker));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_WORKER, &worker, sizeof (worker));
+    test_connect (sc, addr);
+
+    for (i = 0; i != 100; ++i) {
+        test_send (sc, "ABC");
+        test_recv (sb, "ABC");
+        test_send (sb, "DEF");
+        test_recv (sc, "DEF");
+    }
+
+    test_close (sc);
+    test_close (sb);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s0;
+    int s1;
+    int worker;
+    uint64_t waits0;
+    uint64_t waits1;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    /*  Both variables are read when the first socket is created. */
+#if defined _WIN32
+    rc = _putenv ("NN_WORKER_THREADS=2");
+    errno_assert (rc == 0);
+    rc = _putenv ("NN_WORKER_SPIN=1");
+#else
+    rc = setenv ("NN_WORKER_THREADS", "2", 1);
+    errno_assert (rc == 0);
+    rc = setenv ("NN_WORKER_SPIN", "1", 1);
+#endif
+    errno_assert (rc == 0);
+
+    /*  The connections work the same in either worker. */
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_exchange (addr, 0);
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 1);
+    test_exchange (addr, 1);
+    test_exchange ("ipc://test_spin.ipc", 1);
+
+    /*  While idle, the spinning worker keeps polling, the other one
+        sleeps. The endpoints get the workers started. */
+    s0 = test_socket (AF_SP, NN_PAIR);
+    worker = 0;
+    test_setsockopt (s0, NN_SOL_SOCKET, NN_WORKER, &worker, sizeof (worker));
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 2);
+    test_bind (s0, addr);
+    s1 = test_socket (AF_SP, NN_PAIR);
+    worker = 1;
+    test_setsockopt (s1, NN_SOL_SOCKET, NN_WORKER, &worker, sizeof (worker));
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 3);
+    test_bind (s1, addr);
+    nn_sleep (10);
+    waits0 = nn_get_statistic (s0, NN_STAT_WORKER_WAITS);
+    waits1 = nn_get_statistic (s1, NN_STAT_WORKER_WAITS);
+    nn_sleep (100);
+    waits0 = nn_get_statistic (s0, NN_STAT_WORKER_WAITS) - waits0;
+    waits1 = nn_get_statistic (s1, NN_STAT_WORKER_WAITS) - waits1;
+#if !defined _WIN32
+    nn_assert (waits0 < 100);
+    nn_assert (waits1 > 1000);
+#endif
+    test_close (s1);
+    test_close (s0);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Tests the connections held in reserve by connecting endpoints. */
+
+#define BIGSZ 256
+
+static void wait_stat (int s, int stat, uint64_t value)
+{
+    int i;
+
+    for (i = 0; i != 100; ++i) {
+        if (nn_get_statistic (s, stat) == value)
+            return;
+        nn_sleep (20);
+    }
+    nn_assert (0);
+}
+
+/*  The pull socket drops the connection a message too large for it comes
+    from. A connection in reserve takes over and a new one is established
+    to replace it. */
+static void test_failover (char *addr, int standby)
+{
+    int rc;
+    int pull;
+    int push;
+    int opt;
+    int i;
+    char big [BIGSZ];
+
+    pull = test_socket (AF_SP, NN_PULL);
+    opt = BIGSZ / 2;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    test_bind (pull, addr);
+    push = test_socket (AF_SP, NN_PUSH);
+    test_setsockopt (push, NN_SOL_SOCKET, NN_STANDBY, &standby,
+        sizeof (standby));
+    test_connect (push, addr);
+
+    /*  Connections in reserve are established, but the protocol doesn't
+        know about them. */
+    wait_stat (pull, NN_STAT_CURRENT_CONNECTIONS, 1 + standby);
+    wait_stat (push, NN_STAT_CURRENT_CONNECTIONS, 1);
+    for (i = 0; i != 10; ++i)
+        test_send (push, "ABC");
+    for (i = 0; i != 10; ++i)
+        test_recv (pull, "ABC");
+
+    memset (big, 'x', sizeof (big));
+    rc = nn_send (push, big, sizeof (big), 0);
+    errno_assert (rc == BIGSZ);
+    wait_stat (push, NN_STAT_BROKEN_CONNECTIONS, 1);
+    nn_assert (nn_get_statistic (push, NN_STAT_CURRENT_CONNECTIONS) <= 1);
+    test_send (push, "DEF");
+    test_recv (pull, "DEF");
+
+    /*  The connection lost is re-established as a reserve one. */
+    wait_stat (push, NN_STAT_ESTABLISHED_CONNECTIONS, 2 + standby);
+    wait_stat (pull, NN_STAT_CURRENT_CONNECTIONS, 1 + standby);
+    nn_assert (nn_get_statistic (push, NN_STAT_CURRENT_CONNECTIONS) == 1);
+    test_send (push, "GHI");
+    test_recv (pull, "GHI");
+
+    test_close (push);
+    test_close (pull);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int s;
+    int opt;
+    size_t sz;
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    s = test_socket (AF_SP, NN_PUSH);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_STANDBY, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_STANDBY, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 17;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_STANDBY, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (s);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_failover (addr, 0);
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 1);
+    test_failover (addr, 1);
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 2);
+    test_failover (addr, 2);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests the periodic publishing of socket statistics. */
+
+#define SOCKET_ADDRESS "inproc://statistics"
+
+int main ()
+{
+    int rc;
+    int sub;
+    int sb;
+    int sc;
+    int i;
+    int timeo;
+    char buf [2048];
+    int reported;
+    int allocs;
+
+    /*  The reporter is configured when the first socket is created. */
+#if defined _WIN32
+    rc = _putenv ("NN_STATISTICS_SOCKET=" SOCKET_ADDRESS);
+    errno_assert (rc == 0);
+    rc = _putenv ("NN_STATISTICS_INTERVAL=50");
+    errno_assert (rc == 0);
+    rc = _putenv ("NN_ALLOC_SAMPLE=1");
+#else
+    rc = setenv ("NN_STATISTICS_SOCKET", SOCKET_ADDRESS, 1);
+    errno_assert (rc == 0);
+    rc = setenv ("NN_STATISTICS_INTERVAL", "50", 1);
+    errno_assert (rc == 0);
+    rc = setenv ("NN_ALLOC_SAMPLE", "1", 1);
+#endif
+    errno_assert (rc == 0);
+
+    sub = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub, NN_SUB, NN_SUB_SUBSCRIBE, "pair ", 5);
+    test_setsockopt (sub, NN_SUB, NN_SUB_SUBSCRIBE, "alloc ", 6);
+    timeo = 1000;
+    test_setsockopt (sub, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_bind (sub, SOCKET_ADDRESS);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_SOCKET_NAME, "pair", 4);
+    test_bind (sb, "inproc://a");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://a");
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    /*  Wait for a report listing the message received above. Earlier
+        reports may have been taken before it was. With every allocation
+        sampled, the allocation monitor reports the message chunks too. */
+    reported = 0;
+    allocs = 0;
+    for (i = 0; i != 40 && (!reported || !allocs); ++i) {
+        rc = nn_recv (sub, buf, sizeof (buf) - 1, 0);
+        errno_assert (rc >= 0);
+        buf [rc] = 0;
+        if (strncmp (buf, "alloc ", 6) == 0) {
+            if (strstr (buf, " message_chunk.allocations="))
+                allocs = 1;
+            continue;
+        }
+        nn_assert (strncmp (buf, "pair ", 5) == 0);
+        reported = strstr (buf, " MESSAGES_RECEIVED=1") &&
+            strstr (buf, " BYTES_RECEIVED=3");
+
+        /*  Statistics with zero value are omitted. */
+        nn_assert (!strstr (buf, " MESSAGES_SENT="));
+    }
+    nn_assert (reported);
+    nn_assert (allocs);
+
+    test_close (sc);
+    test_close (sb);
+    test_close (sub);
+
+    return 0;
+}
@@ -30,6 +30,11 @@ int main (int argc, const char *argv[])
 {
     int rep1;
     int req1;
+    int repeid;
+    int reqeid;
+    int rc;
+    uint64_t mem;
+    struct nn_pipe_stat ps;
     char socket_address[128];
 
     test_addr_from(socket_address, "tcp", "127.0.0.1",
@@ -37,11 +42,11 @@ int main (int argc, const char *argv[])
 
     /*  Test req/rep with full socket types. */
     rep1 = test_socket (AF_SP, NN_REP);
-    test_bind (rep1, socket_address);
+    repeid = test_bind (rep1, socket_address);
     nn_sleep (100);
 
     req1 = test_socket (AF_SP, NN_REQ);
-    test_connect (req1, socket_address);
+    reqeid = test_connect (req1, socket_address);
     nn_sleep (200);
 
     nn_assert (nn_get_statistic(rep1, NN_STAT_ACCEPTED_CONNECTIONS) == 1);
@@ -55,6 +60,10 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(req1, NN_STAT_CURRENT_CONNECTIONS) == 1);
     nn_assert (nn_get_statistic(req1, NN_STAT_MESSAGES_SENT) == 0);
     nn_assert (nn_get_statistic(req1, NN_STAT_MESSAGES_RECEIVED) == 0);
+    nn_assert (nn_get_statistic(req1, NN_STAT_RTT_MAX) == 0);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_DELAY_MAX) == 0);
+    mem = nn_get_statistic(rep1, NN_STAT_ALLOCATED_BYTES);
+    nn_assert (mem > 0);
 
     test_send (req1, "ABC");
     nn_sleep (100);
@@ -71,9 +80,20 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(rep1, NN_STAT_MESSAGES_RECEIVED) == 1);
     nn_assert (nn_get_statistic(rep1, NN_STAT_BYTES_RECEIVED) == 3);
 
+    /*  The request sat in the queue for the duration of the sleep. */
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_DELAY_MAX) >= 50000);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_DELAY_P50) >=
+        nn_get_statistic(rep1, NN_STAT_RECV_DELAY_MAX));
+
     test_send (rep1, "OK");
     test_recv (req1, "OK");
 
+    nn_assert (nn_get_statistic(req1, NN_STAT_RTT_MAX) >= 50000);
+    nn_assert (nn_get_statistic(req1, NN_STAT_RTT_P999) ==
+        nn_get_statistic(req1, NN_STAT_RTT_MAX));
+    nn_assert (nn_get_statistic(req1, NN_STAT_SEND_WAIT_MAX) <
+        nn_get_statistic(req1, NN_STAT_RTT_MAX));
+
     nn_assert (nn_get_statistic(req1, NN_STAT_MESSAGES_SENT) == 1);
     nn_assert (nn_get_statistic(req1, NN_STAT_BYTES_SENT) == 3);
     nn_assert (nn_get_statistic(req1, NN_STAT_MESSAGES_RECEIVED) == 1);
@@ -84,6 +104,61 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(rep1, NN_STAT_MESSAGES_RECEIVED) == 1);
     nn_assert (nn_get_statistic(rep1, NN_STAT_BYTES_RECEIVED) == 3);
 
+    /*  The same counters for the endpoints alone. */
+    nn_assert (nn_get_ep_statistic(req1, reqeid,
+        NN_STAT_ESTABLISHED_CONNECTIONS) == 1);
+    nn_assert (nn_get_ep_statistic(req1, reqeid,
+        NN_STAT_CURRENT_CONNECTIONS) == 1);
+    nn_assert (nn_get_ep_statistic(req1, reqeid, NN_STAT_MESSAGES_SENT) == 1);
+    nn_assert (nn_get_ep_statistic(req1, reqeid, NN_STAT_BYTES_SENT) == 3);
+    nn_assert (nn_get_ep_statistic(req1, reqeid,
+        NN_STAT_MESSAGES_RECEIVED) == 1);
+    nn_assert (nn_get_ep_statistic(rep1, repeid,
+        NN_STAT_ACCEPTED_CONNECTIONS) == 1);
+    nn_assert (nn_get_ep_statistic(rep1, repeid,
+        NN_STAT_CURRENT_CONNECTIONS) == 1);
+    nn_assert (nn_get_ep_statistic(rep1, repeid,
+        NN_STAT_MESSAGES_RECEIVED) == 1);
+    nn_assert (nn_get_ep_statistic(rep1, repeid, NN_STAT_MESSAGES_SENT) == 1);
+    nn_assert (nn_get_ep_statistic(rep1, repeid + 1,
+        NN_STAT_MESSAGES_SENT) == (uint64_t) -1);
+    nn_assert (nn_errno () == EINVAL);
+    nn_assert (nn_get_ep_statistic(rep1, repeid, NN_STAT_RTT_MAX) ==
+        (uint64_t) -1);
+    nn_assert (nn_errno () == EINVAL);
+
+    /*  And for the only connection of the socket. */
+    rc = nn_get_pipe_stat (req1, 0, &ps);
+    errno_assert (rc == 0);
+    nn_assert (ps.id > 0);
+    nn_assert (ps.eid == reqeid);
+    nn_assert (ps.messages_sent == 1);
+    nn_assert (ps.bytes_sent == 3);
+    nn_assert (ps.messages_received == 1);
+    nn_assert (ps.queued == 0);
+    rc = nn_get_pipe_stat (req1, ps.id, &ps);
+    nn_assert (rc == -1 && nn_errno () == ENOENT);
+    rc = nn_get_pipe_stat (rep1, 0, &ps);
+    errno_assert (rc == 0);
+    nn_assert (ps.eid == repeid);
+    nn_assert (ps.messages_received == 1);
+    nn_assert (ps.messages_sent == 1);
+
+    /*  The worker threads have been doing the I/O. */
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_WAITS) > 0);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_EVENTS) > 0);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_TASKS) > 0);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_MAX_EVENTS) > 0);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_MAX_EVENTS) <=
+        nn_get_statistic(rep1, NN_STAT_WORKER_EVENTS));
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_WAIT_TIME) >= 100000);
+
+    /*  Lock contention is counted, but it can't be predicted. */
+    nn_assert (nn_get_statistic(rep1, NN_STAT_LOCK_PARKS) <=
+        nn_get_statistic(rep1, NN_STAT_LOCK_CONTENTIONS));
+    nn_assert (nn_get_statistic(rep1, NN_STAT_WORKER_LOCK_CONTENTIONS) !=
+        (uint64_t) -1);
+
     test_close (req1);
 
     nn_sleep (100);
@@ -91,6 +166,15 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(rep1, NN_STAT_ACCEPTED_CONNECTIONS) == 1);
     nn_assert (nn_get_statistic(rep1, NN_STAT_ESTABLISHED_CONNECTIONS) == 0);
     nn_assert (nn_get_statistic(rep1, NN_STAT_CURRENT_CONNECTIONS) == 0);
+    nn_assert (nn_get_ep_statistic(rep1, repeid,
+        NN_STAT_CURRENT_CONNECTIONS) == 0);
+    nn_assert (nn_get_ep_statistic(rep1, repeid,
+        NN_STAT_BROKEN_CONNECTIONS) == 1);
+    rc = nn_get_pipe_stat (rep1, 0, &ps);
+    nn_assert (rc == -1 && nn_errno () == ENOENT);
+
+    /*  The memory held by the connection was given back. */
+    nn_assert (nn_get_statistic(rep1, NN_STAT_ALLOCATED_BYTES) < mem);
 
     test_close (rep1);
 
@@ -0,0 +1,168 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/statshm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests the export of socket statistics into shared memory, reading the
+    segment the way an external tool would. */
+
+#if defined NN_HAVE_STATSHM
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static struct nn_statshm_hdr *hdr;
+
+static int find_stat (const char *name)
+{
+    uint32_t i;
+    const char *names;
+
+    names = (const char*) (hdr + 1);
+    for (i = 0; i != hdr->nstats; ++i)
+        if (strcmp (names + i * NN_STATSHM_STATNAMELEN, name) == 0)
+            return (int) i;
+    nn_assert (0);
+    return -1;
+}
+
+/*  Takes a consistent snapshot of the slot of socket 's'. */
+static void read_slot (int s, struct nn_statshm_slot *copy)
+{
+    uint32_t seq;
+    volatile struct nn_statshm_slot *slot;
+
+    nn_assert ((uint32_t) s < hdr->nslots);
+    slot = (struct nn_statshm_slot*) ((char*) hdr + hdr->slots +
+        (size_t) s * hdr->slotsize);
+    while (1) {
+        seq = slot->seq;
+        if (seq & 1)
+            continue;
+        __sync_synchronize ();
+        memcpy (copy, (void*) slot, hdr->slotsize);
+        __sync_synchronize ();
+        if (slot->seq == seq)
+            return;
+    }
+}
+
+int main ()
+{
+    int rc;
+    int fd;
+    int sb;
+    int sc;
+    int i;
+    int received;
+    int bytes;
+    struct stat st;
+    struct nn_statshm_slot *slot;
+    char name [64];
+
+    sprintf (name, "/nn-test-statshm-%d", (int) getpid ());
+    rc = setenv ("NN_STATISTICS_SHM", name, 1);
+    errno_assert (rc == 0);
+    rc = setenv ("NN_STATISTICS_INTERVAL", "20", 1);
+    errno_assert (rc == 0);
+
+    /*  The segment is created when the library is initialised. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_SOCKET_NAME, "pair", 4);
+    test_bind (sb, "inproc://a");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://a");
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    fd = shm_open (name, O_RDONLY, 0);
+    errno_assert (fd >= 0);
+    rc = fstat (fd, &st);
+    errno_assert (rc == 0);
+    hdr = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    nn_assert (hdr != MAP_FAILED);
+    close (fd);
+    nn_assert (hdr->magic == NN_STATSHM_MAGIC);
+    nn_assert (hdr->version == NN_STATSHM_VERSION);
+    nn_assert (hdr->pid == (uint32_t) getpid ());
+    nn_assert (hdr->interval == 20);
+    nn_assert (hdr->slots + (size_t) hdr->nslots * hdr->slotsize <=
+        (size_t) st.st_size);
+    received = find_stat ("MESSAGES_RECEIVED");
+    bytes = find_stat ("BYTES_RECEIVED");
+
+    /*  Wait for the slot of the socket to show the message received above.
+        Earlier updates may have been done before it was. */
+    slot = malloc (hdr->slotsize);
+    alloc_assert (slot);
+    for (i = 0; i != 100; ++i) {
+        read_slot (sb, slot);
+        if (slot->live && slot->values [received] == 1)
+            break;
+        nn_sleep (20);
+    }
+    nn_assert (i != 100);
+    nn_assert (strcmp (slot->name, "pair") == 0);
+    nn_assert (slot->values [bytes] == 3);
+    nn_assert (slot->time != 0);
+
+    /*  A closed socket's slot is marked as empty. */
+    test_close (sc);
+    for (i = 0; i != 100; ++i) {
+        read_slot (sc, slot);
+        if (!slot->live)
+            break;
+        nn_sleep (20);
+    }
+    nn_assert (i != 100);
+    read_slot (sb, slot);
+    nn_assert (slot->live);
+
+    /*  The segment is removed once the library is terminated. */
+    test_close (sb);
+    fd = shm_open (name, O_RDONLY, 0);
+    nn_assert (fd < 0 && errno == ENOENT);
+
+    free (slot);
+    munmap (hdr, st.st_size);
+
+    return 0;
+}
+
+#else
+
+int main ()
+{
+    return 0;
+}
+
+#endif
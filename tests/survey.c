@@ -28,6 +28,42 @@
 
 #define SOCKET_ADDRESS "inproc://test"
 
+/*  Receives the response and returns the ID of the survey it answers. */
+static int test_recv_survey (int sock, const char *data)
+{
+    int rc;
+    int id;
+    char buf [16];
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    void *control;
+    struct nn_cmsghdr *cmsg;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+    nn_assert (memcmp (buf, data, rc) == 0);
+
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    while (1) {
+        nn_assert (cmsg);
+        if (cmsg->cmsg_level == NN_SURVEYOR &&
+              cmsg->cmsg_type == NN_SURVEYOR_ID)
+            break;
+        cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+    }
+    memcpy (&id, NN_CMSG_DATA (cmsg), sizeof (id));
+    nn_freemsg (control);
+
+    return id;
+}
+
 int main ()
 {
     int rc;
@@ -37,6 +73,18 @@ int main ()
     int respondent3;
     int deadline;
     char buf [7];
+    int maxsurveys;
+    int ids [2];
+    size_t sz;
+    int maxoutstanding;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    void *body;
+    void *control;
+    int i;
+    char bufs [2] [4];
+    struct nn_iovec iovs [2];
+    struct nn_mmsghdr msgs [2];
 
     /*  Test a simple survey with three respondents. */
     surveyor = test_socket (AF_SP, NN_SURVEYOR);
@@ -85,6 +133,7 @@ int main ()
     /*  Check that stale response from third respondent is not delivered. */
     rc = nn_recv (surveyor, buf, sizeof (buf), 0);
     errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    nn_assert (nn_get_statistic (surveyor, NN_STAT_DROPPED_MESSAGES) == 1);
 
     /* Check that subsequent attempt to recv with no survey pending is EFSM. */
     rc = nn_recv (surveyor, buf, sizeof (buf), 0);
@@ -95,6 +144,163 @@ int main ()
     test_close (respondent2);
     test_close (respondent3);
 
+    /*  Test collecting the responses in a batch. The stale ones are skipped
+        rather than returned. */
+    surveyor = test_socket (AF_SP, NN_SURVEYOR);
+    deadline = 500;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    test_bind (surveyor, SOCKET_ADDRESS);
+    respondent1 = test_socket (AF_SP, NN_RESPONDENT);
+    test_connect (respondent1, SOCKET_ADDRESS);
+    respondent2 = test_socket (AF_SP, NN_RESPONDENT);
+    test_connect (respondent2, SOCKET_ADDRESS);
+
+    test_send (surveyor, "ABC");
+    test_recv (respondent1, "ABC");
+    test_recv (respondent2, "ABC");
+    test_send (surveyor, "XYZ");
+    test_send (respondent1, "OLD");
+    test_recv (respondent1, "XYZ");
+    test_send (respondent1, "DEF");
+    test_recv (respondent2, "XYZ");
+    test_send (respondent2, "DEF");
+
+    for (i = 0; i != 2; ++i) {
+        iovs [i].iov_base = bufs [i];
+        iovs [i].iov_len = sizeof (bufs [i]);
+        memset (&msgs [i], 0, sizeof (msgs [i]));
+        msgs [i].msg_hdr.msg_iov = &iovs [i];
+        msgs [i].msg_hdr.msg_iovlen = 1;
+    }
+    rc = nn_recvmmsg (surveyor, msgs, 2, 0);
+    errno_assert (rc == 2);
+    for (i = 0; i != 2; ++i)
+        nn_assert (msgs [i].msg_len == 3 && memcmp (bufs [i], "DEF", 3) == 0);
+    nn_assert (nn_get_statistic (surveyor, NN_STAT_DROPPED_MESSAGES) == 1);
+
+    test_close (surveyor);
+    test_close (respondent1);
+    test_close (respondent2);
+
+    /*  Test overlapping surveys with different deadlines. */
+    surveyor = test_socket (AF_SP, NN_SURVEYOR);
+    maxsurveys = 2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_MAXSURVEYS,
+        &maxsurveys, sizeof (maxsurveys));
+    errno_assert (rc == 0);
+    test_bind (surveyor, SOCKET_ADDRESS);
+    respondent1 = test_socket (AF_SP, NN_RESPONDENT);
+    test_connect (respondent1, SOCKET_ADDRESS);
+    respondent2 = test_socket (AF_SP, NN_RESPONDENT);
+    test_connect (respondent2, SOCKET_ADDRESS);
+
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    deadline = 200;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    test_send (surveyor, "ABC");
+    sz = sizeof (ids [0]);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_ID, &ids [0], &sz);
+    errno_assert (rc == 0 && sz == sizeof (ids [0]));
+
+    deadline = 1000;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    test_send (surveyor, "DEF");
+    sz = sizeof (ids [1]);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_ID, &ids [1], &sz);
+    errno_assert (rc == 0 && sz == sizeof (ids [1]));
+    nn_assert (ids [0] != ids [1]);
+
+    /*  The limit is reached. */
+    rc = nn_send (surveyor, "GHI", 3, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  First respondent answers both surveys in time. */
+    test_recv (respondent1, "ABC");
+    test_send (respondent1, "R1");
+    test_recv (respondent1, "DEF");
+    test_send (respondent1, "R2");
+    nn_assert (test_recv_survey (surveyor, "R1") == ids [0]);
+    nn_assert (test_recv_survey (surveyor, "R2") == ids [1]);
+
+    /*  Second respondent misses the deadline of the first survey. */
+    nn_sleep (400);
+    test_recv (respondent2, "ABC");
+    test_send (respondent2, "R3");
+    test_recv (respondent2, "DEF");
+    test_send (respondent2, "R4");
+    nn_assert (test_recv_survey (surveyor, "R4") == ids [1]);
+
+    /*  Only one survey is in progress now. */
+    test_send (surveyor, "GHI");
+    rc = nn_send (surveyor, "JKL", 3, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Once all the surveys expire, the deadline is reported. */
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    test_close (surveyor);
+    test_close (respondent1);
+    test_close (respondent2);
+
+    /*  Test the limit on outstanding surveys at the respondent. */
+    surveyor = test_socket (AF_SP, NN_SURVEYOR);
+    maxsurveys = 2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_MAXSURVEYS,
+        &maxsurveys, sizeof (maxsurveys));
+    errno_assert (rc == 0);
+    test_bind (surveyor, SOCKET_ADDRESS);
+    respondent1 = test_socket (AF_SP_RAW, NN_RESPONDENT);
+    maxoutstanding = 1;
+    rc = nn_setsockopt (respondent1, NN_RESPONDENT,
+        NN_RESPONDENT_MAXOUTSTANDING, &maxoutstanding,
+        sizeof (maxoutstanding));
+    errno_assert (rc == 0);
+    sz = sizeof (maxoutstanding);
+    rc = nn_getsockopt (respondent1, NN_RESPONDENT,
+        NN_RESPONDENT_MAXOUTSTANDING, &maxoutstanding, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (maxoutstanding) && maxoutstanding == 1);
+    deadline = 100;
+    rc = nn_setsockopt (respondent1, NN_SOL_SOCKET, NN_RCVTIMEO,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    test_connect (respondent1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (surveyor, "ABC");
+    test_send (surveyor, "DEF");
+    iov.iov_base = &body;
+    iov.iov_len = NN_MSG;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (respondent1, &hdr, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+
+    /*  Once the first survey is answered, the second one is received. */
+    rc = nn_sendmsg (respondent1, &hdr, 0);
+    errno_assert (rc == 3);
+    test_recv_survey (surveyor, "ABC");
+    test_recv (respondent1, "DEF");
+
+    test_close (surveyor);
+    test_close (respondent1);
+
     return 0;
 }
 
@@ -25,14 +25,34 @@
 #include "../src/nn.h"
 #include "../src/pair.h"
 #include "../src/pubsub.h"
+#include "../src/pipeline.h"
 #include "../src/tcp.h"
 
 #include "testutil.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 /*  Tests TCP transport. */
 
+#define NMIXED 50
+#define LARGE_SIZE (4 * 1024 * 1024)
+#define NZEROCOPY 16
+#define ZEROCOPY_SIZE (1024 * 1024)
+#define NLISTENERS 4
+#define NCLIENTS 16
+
 int sc;
 
+/*  Sizes of the messages sent in a single burst by the mixed-size test.
+    Small ones get copied into a batch, the large ones close it. */
+static const size_t mixed_sizes [] = {0, 10, 1500, 100, 30000};
+
+static size_t mixed_size (int i)
+{
+    return mixed_sizes [i % (sizeof (mixed_sizes) / sizeof (size_t))];
+}
+
 int main (int argc, const char *argv[])
 {
     int rc;
@@ -41,13 +61,25 @@ int main (int argc, const char *argv[])
     int opt;
     size_t sz;
     int s1, s2;
+    int clients [NCLIENTS];
     void * dummy_buf;
     char addr[128];
     char socket_address[128];
+    char hostname_address[128];
 
     int port = get_test_port(argc, argv);
 
+    /*  Allow only a couple of connection attempts at a time so that
+        the tests with many clients exercise the throttling as well. */
+#if defined _WIN32
+    rc = _putenv ("NN_CONNECT_MAX=2");
+#else
+    rc = setenv ("NN_CONNECT_MAX", "2", 1);
+#endif
+    errno_assert (rc == 0);
+
     test_addr_from(socket_address, "tcp", "127.0.0.1", port);
+    test_addr_from(hostname_address, "tcp", "localhost", port);
 
     /*  Try closing bound but unconnected socket. */
     sb = test_socket (AF_SP, NN_PAIR);
@@ -82,6 +114,24 @@ int main (int argc, const char *argv[])
     nn_assert (sz == sizeof (opt));
     nn_assert (opt == 1);
 
+    /*  Check RCVBATCH socket option. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_RCVBATCH, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 65536);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_RCVBATCH, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 8192;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_RCVBATCH, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_RCVBATCH, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 8192);
+
     /*  Try using invalid address strings. */
     rc = nn_connect (sc, "tcp://*:");
     nn_assert (rc < 0);
@@ -155,9 +205,287 @@ int main (int argc, const char *argv[])
         test_recv (sb, "0123456789012345678901234567890123456789");
     }
 
+    /*  Burst of mixed-size messages, sent in a single call so that they
+        are coalesced. They must arrive intact and in order. */
+    {
+        struct nn_mmsghdr msgs [NMIXED];
+        struct nn_iovec iovs [NMIXED];
+        char *buf;
+        void *msg;
+
+        buf = malloc (NMIXED * 30000);
+        alloc_assert (buf);
+        for (i = 0; i != NMIXED; ++i) {
+            memset (buf + i * 30000, 'a' + (i % 26), mixed_size (i));
+            iovs [i].iov_base = buf + i * 30000;
+            iovs [i].iov_len = mixed_size (i);
+            memset (&msgs [i], 0, sizeof (msgs [i]));
+            msgs [i].msg_hdr.msg_iov = &iovs [i];
+            msgs [i].msg_hdr.msg_iovlen = 1;
+        }
+        rc = nn_sendmmsg (sc, msgs, NMIXED, 0);
+        errno_assert (rc == NMIXED);
+        for (i = 0; i != NMIXED; ++i) {
+            rc = nn_recv (sb, &msg, NN_MSG, 0);
+            errno_assert (rc >= 0);
+            nn_assert ((size_t) rc == mixed_size (i));
+            nn_assert (memcmp (msg, buf + i * 30000, rc) == 0);
+            nn_freemsg (msg);
+        }
+        free (buf);
+    }
+
+    /*  A multi-megabyte message is received straight into its chunk. The
+        message that follows it must not get lost on the way. */
+    {
+        char *buf;
+        void *msg;
+
+        opt = -1;
+        rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE,
+            &opt, sizeof (opt));
+        errno_assert (rc == 0);
+        buf = malloc (LARGE_SIZE);
+        alloc_assert (buf);
+        for (i = 0; i != LARGE_SIZE; ++i)
+            buf [i] = (char) (i % 251);
+        rc = nn_send (sc, buf, LARGE_SIZE, 0);
+        errno_assert (rc == LARGE_SIZE);
+        test_send (sc, "ABC");
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc == LARGE_SIZE);
+        nn_assert (memcmp (msg, buf, LARGE_SIZE) == 0);
+        nn_freemsg (msg);
+        test_recv (sb, "ABC");
+        free (buf);
+    }
+
+    test_close (sc);
+    test_close (sb);
+
+    /*  Large messages sent by reference must arrive intact, interleaved
+        with small ones that are copied as usual. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_ZEROCOPY, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_ZEROCOPY, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 65536;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_ZEROCOPY, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    test_connect (sc, socket_address);
+    {
+        char *msg;
+        int j;
+
+        for (i = 0; i != NZEROCOPY; ++i) {
+            msg = nn_allocmsg (ZEROCOPY_SIZE, 0);
+            alloc_assert (msg);
+            memset (msg, 'a' + i, ZEROCOPY_SIZE);
+            rc = nn_send (sc, &msg, NN_MSG, 0);
+            errno_assert (rc == ZEROCOPY_SIZE);
+            test_send (sc, "ABC");
+            rc = nn_recv (sb, &msg, NN_MSG, 0);
+            errno_assert (rc == ZEROCOPY_SIZE);
+            for (j = 0; j != ZEROCOPY_SIZE; ++j)
+                nn_assert (msg [j] == 'a' + i);
+            nn_freemsg (msg);
+            test_recv (sb, "ABC");
+        }
+    }
     test_close (sc);
     test_close (sb);
 
+    /*  With the send queue enabled, a burst of large messages is absorbed
+        by the pipe instead of making the sender wait. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDQUEUE_MSGS,
+        &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = NMIXED;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDQUEUE_MSGS,
+        &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt = NMIXED * 30000;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDQUEUE_BYTES,
+        &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDQUEUE_BYTES, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == NMIXED * 30000);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    {
+        char *buf;
+        void *msg;
+
+        buf = malloc (30000);
+        alloc_assert (buf);
+        for (i = 0; i != NMIXED; ++i) {
+            memset (buf, 'a' + (i % 26), 30000);
+            rc = nn_send (sc, buf, 30000, NN_DONTWAIT);
+            errno_assert (rc == 30000);
+        }
+        for (i = 0; i != NMIXED; ++i) {
+            rc = nn_recv (sb, &msg, NN_MSG, 0);
+            errno_assert (rc == 30000);
+            nn_assert (((char*) msg) [0] == 'a' + (i % 26));
+            nn_assert (((char*) msg) [29999] == 'a' + (i % 26));
+            nn_freemsg (msg);
+        }
+        free (buf);
+    }
+    test_close (sc);
+    test_close (sb);
+
+    /*  Clients connecting to an endpoint with several listening sockets are
+        spread among them and all get through. */
+    sb = test_socket (AF_SP, NN_PULL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 1);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = NLISTENERS;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    test_bind (sb, socket_address);
+    for (i = 0; i != NCLIENTS; ++i) {
+        clients [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (clients [i], socket_address);
+    }
+    for (i = 0; i != NCLIENTS; ++i)
+        test_send (clients [i], "ABC");
+    for (i = 0; i != NCLIENTS; ++i)
+        test_recv (sb, "ABC");
+    for (i = 0; i != NCLIENTS; ++i)
+        test_close (clients [i]);
+    test_close (sb);
+
+    /*  Low-latency options are validated and a connection using all of them
+        works, whether the platform supports them or not. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_TOS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == -1);
+    opt = 256;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_TOS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_QUICKACK, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_BUSY_POLL, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 50;
+    test_setsockopt (sc, NN_TCP, NN_TCP_BUSY_POLL, &opt, sizeof (opt));
+    opt = 1;
+    test_setsockopt (sc, NN_TCP, NN_TCP_QUICKACK, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+    opt = 0x10;
+    test_setsockopt (sc, NN_TCP, NN_TCP_TOS, &opt, sizeof (opt));
+    opt = 4;
+    test_setsockopt (sc, NN_TCP, NN_TCP_PRIORITY, &opt, sizeof (opt));
+    opt = 16384;
+    test_setsockopt (sc, NN_TCP, NN_TCP_NOTSENT_LOWAT, &opt, sizeof (opt));
+    opt = 0;
+    test_setsockopt (sb, NN_TCP, NN_TCP_INCOMING_CPU, &opt, sizeof (opt));
+    test_setsockopt (sb, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_PRIORITY, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 4);
+    test_bind (sb, socket_address);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+    test_close (sc);
+    test_close (sb);
+
+    /*  Corked messages all get through, in order. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    test_setsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    for (i = 0; i != 100; ++i)
+        test_send (sc, "0123456789");
+    for (i = 0; i != 100; ++i)
+        test_recv (sb, "0123456789");
+    test_close (sc);
+    test_close (sb);
+
+    /*  Fast Open connections work, whether the kernel lets them carry data
+        with the SYN or not. The second connection can use the cookie
+        obtained by the first one. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_FASTOPEN, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    test_setsockopt (sb, NN_TCP, NN_TCP_FASTOPEN, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    for (i = 0; i != 2; ++i) {
+        sc = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sc, NN_TCP, NN_TCP_FASTOPEN, &opt, sizeof (opt));
+        sz = sizeof (opt);
+        rc = nn_getsockopt (sc, NN_TCP, NN_TCP_FASTOPEN, &opt, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (opt) && opt == 1);
+        test_connect (sc, socket_address);
+        test_send (sc, "ABC");
+        test_recv (sb, "ABC");
+        test_send (sb, "DEF");
+        test_recv (sc, "DEF");
+        test_close (sc);
+    }
+    test_close (sb);
+
+    /*  Clients connecting by name all get through, whether the name is
+        being looked up at the moment or already cached. */
+    sb = test_socket (AF_SP, NN_PULL);
+    test_bind (sb, socket_address);
+    for (i = 0; i != NCLIENTS; ++i) {
+        clients [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (clients [i], hostname_address);
+        if (i == NCLIENTS / 2)
+            nn_sleep (100);
+    }
+    for (i = 0; i != NCLIENTS; ++i)
+        test_send (clients [i], "ABC");
+    for (i = 0; i != NCLIENTS; ++i)
+        test_recv (sb, "ABC");
+    for (i = 0; i != NCLIENTS; ++i)
+        test_close (clients [i]);
+    test_close (sb);
+
     /*  Test whether connection rejection is handled decently. */
     sb = test_socket (AF_SP, NN_PAIR);
     test_bind (sb, socket_address);
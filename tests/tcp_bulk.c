@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+#include "../src/tcp.h"
+
+#include "testutil.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*  Tests pipes split between a connection for small messages and one for
+    large messages. */
+
+#define SMALL 100
+#define LARGE (64 * 1024 * 1024)
+#define THRESHOLD 1024
+
+/*  Waits till the statistic of the socket reaches the value. */
+static void wait_stat (int sock, int stat, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i != 300; ++i) {
+        if (nn_get_statistic (sock, stat) == val)
+            return;
+        nn_sleep (10);
+    }
+    nn_assert (nn_get_statistic (sock, stat) == val);
+}
+
+static void send_large (int sock, char c, size_t sz)
+{
+    int rc;
+    void *buf;
+
+    buf = nn_allocmsg (sz, 0);
+    alloc_assert (buf);
+    memset (buf, c, sz);
+    rc = nn_send (sock, &buf, NN_MSG, 0);
+    errno_assert (rc == (int) sz);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    size_t sz;
+    int timeo;
+    int i;
+    int small;
+    int large;
+    char *buf;
+    char msg [32];
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    timeo = 10000;
+
+    /*  Option values. */
+    sc = test_socket (AF_SP, NN_PUSH);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_BULK_THRESHOLD, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_BULK_THRESHOLD, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (sc);
+
+    /*  The two connections are a single pipe to the protocol. */
+    sb = test_socket (AF_SP, NN_PULL);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    opt = -1;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PUSH);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    opt = THRESHOLD;
+    test_setsockopt (sc, NN_TCP, NN_TCP_BULK_THRESHOLD, &opt, sizeof (opt));
+    test_connect (sc, addr);
+    wait_stat (sb, NN_STAT_ACCEPTED_CONNECTIONS, 2);
+    wait_stat (sc, NN_STAT_ESTABLISHED_CONNECTIONS, 2);
+    nn_assert (nn_get_statistic (sb, NN_STAT_CURRENT_CONNECTIONS) == 1);
+    nn_assert (nn_get_statistic (sc, NN_STAT_CURRENT_CONNECTIONS) == 1);
+
+    /*  The small messages sent after a large one don't wait for it. */
+    send_large (sc, 'a', LARGE);
+    for (i = 0; i != SMALL; ++i) {
+        sprintf (msg, "%d", i);
+        test_send (sc, msg);
+    }
+    small = 0;
+    large = 0;
+    while (small != SMALL || !large) {
+        rc = nn_recv (sb, &buf, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        if (rc == LARGE) {
+            nn_assert (buf [0] == 'a' && buf [LARGE - 1] == 'a');
+            nn_assert (small > 0);
+            large = 1;
+        }
+        else {
+            sprintf (msg, "%d", small);
+            nn_assert (rc == (int) strlen (msg) && memcmp (buf, msg, rc) == 0);
+            ++small;
+        }
+        nn_freemsg (buf);
+    }
+
+    /*  Messages of each class keep their order. */
+    for (i = 0; i != 10; ++i) {
+        send_large (sc, 'a' + i, THRESHOLD + 1);
+        sprintf (msg, "%d", i);
+        test_send (sc, msg);
+    }
+    small = 0;
+    large = 0;
+    while (small != 10 || large != 10) {
+        rc = nn_recv (sb, &buf, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        if (rc == THRESHOLD + 1) {
+            nn_assert (buf [0] == 'a' + large);
+            ++large;
+        }
+        else {
+            sprintf (msg, "%d", small);
+            nn_assert (rc == (int) strlen (msg) && memcmp (buf, msg, rc) == 0);
+            ++small;
+        }
+        nn_freemsg (buf);
+    }
+
+    test_close (sc);
+    wait_stat (sb, NN_STAT_CURRENT_CONNECTIONS, 0);
+    test_close (sb);
+
+    return 0;
+}
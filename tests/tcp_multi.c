@@ -0,0 +1,178 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/tcp.h"
+
+#include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+#include <string.h>
+
+#if defined __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*  Tests connecting to TCP addresses listing several hosts. */
+
+static void test_invalid (int sock, const char *addr)
+{
+    int rc;
+
+    rc = nn_connect (sock, addr);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+}
+
+#if defined __linux__
+
+/*  Returns a socket listening on the port that doesn't answer connection
+    requests. The backlog is filled up so that the SYNs get dropped. */
+static int blackhole (int port, int *clients)
+{
+    int rc;
+    int i;
+    int s;
+    int opt;
+    struct sockaddr_in addr;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (port);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    opt = 1;
+    rc = setsockopt (s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = bind (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    rc = listen (s, 0);
+    errno_assert (rc == 0);
+
+    for (i = 0; i != 2; ++i) {
+        clients [i] = socket (AF_INET, SOCK_STREAM, 0);
+        errno_assert (clients [i] >= 0);
+        rc = fcntl (clients [i], F_SETFL, O_NONBLOCK);
+        errno_assert (rc == 0);
+        rc = connect (clients [i], (struct sockaddr*) &addr, sizeof (addr));
+        errno_assert (rc == 0 || errno == EINPROGRESS);
+    }
+    nn_sleep (100);
+
+    return s;
+}
+
+#endif
+
+int main (int argc, const char *argv[])
+{
+    int sb;
+    int sc;
+    int timeo;
+    char addr [256];
+    int port = get_test_port (argc, argv);
+#if defined __linux__
+    int i;
+    int bh;
+    int clients [2];
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+#endif
+
+    /*  Syntax of the host lists. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_invalid (sc, "tcp://127.0.0.1:5555,");
+    test_invalid (sc, "tcp://,127.0.0.1:5555");
+    test_invalid (sc, "tcp://127.0.0.1:5555,,127.0.0.1:5556");
+    test_invalid (sc, "tcp://127.0.0.1:5555,127.0.0.1");
+    test_invalid (sc, "tcp://127.0.0.1:5555,127.0.0.1:");
+    test_invalid (sc, "tcp://127.0.0.1:5555,-foo:5556");
+    test_invalid (sc, "tcp://127.0.0.1;127.0.0.1:5555,127.0.0.1;1.2.3.4:5556");
+    test_invalid (sc, "tcp://a:1,a:2,a:3,a:4,a:5,a:6,a:7,a:8,a:9");
+    test_connect (sc, "tcp://a:1,a:2,a:3,a:4,a:5,a:6,a:7,a:8");
+    test_connect (sc, "tcp://127.0.0.1;127.0.0.2:5555,localhost:5556");
+    test_close (sc);
+
+    timeo = 3000;
+
+    /*  The first host refuses the connection, the second one accepts it. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    sprintf (addr, "tcp://127.0.0.1:%d,localhost:%d", port + 1, port);
+    test_connect (sc, addr);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    test_send (sb, "DEF");
+    test_recv (sc, "DEF");
+
+    /*  Once the first server goes away, the connection fails over to the
+        one on the other port. */
+    test_close (sb);
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 1);
+    test_bind (sb, addr);
+    test_send (sb, "GHI");
+    test_recv (sc, "GHI");
+    test_close (sc);
+    test_close (sb);
+
+#if defined __linux__
+
+    /*  The first host doesn't respond at all. The second one is connected to
+        after the attempt delay rather than after the connection timeout. */
+    bh = blackhole (port + 2, clients);
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_addr_from (addr, "tcp", "127.0.0.1", port + 3);
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    sprintf (addr, "tcp://127.0.0.1:%d,127.0.0.1:%d", port + 2, port + 3);
+    nn_stopwatch_init (&stopwatch);
+    test_connect (sc, addr);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed >= 200000 && elapsed < 1000000);
+    test_close (sc);
+    test_close (sb);
+    for (i = 0; i != 2; ++i)
+        close (clients [i]);
+    close (bh);
+
+#endif
+
+    return 0;
+}
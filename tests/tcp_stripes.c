@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/tcp.h"
+
+#include "testutil.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*  Tests pipes striped over several TCP connections. */
+
+#define MESSAGES 2000
+
+static void send_seq (int sock, int count)
+{
+    int i;
+    char buf [32];
+
+    for (i = 0; i != count; ++i) {
+        sprintf (buf, "%d", i);
+        test_send (sock, buf);
+    }
+}
+
+static void recv_seq (int sock, int count)
+{
+    int i;
+    char buf [32];
+
+    for (i = 0; i != count; ++i) {
+        sprintf (buf, "%d", i);
+        test_recv (sock, buf);
+    }
+}
+
+/*  Waits till the statistic of the socket reaches the value. */
+static void wait_stat (int sock, int stat, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i != 300; ++i) {
+        if (nn_get_statistic (sock, stat) == val)
+            return;
+        nn_sleep (10);
+    }
+    nn_assert (nn_get_statistic (sock, stat) == val);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    size_t sz;
+    int timeo;
+    int i;
+    int n;
+    char buf [32];
+    char seen [MESSAGES];
+    char addr [128];
+    int port = get_test_port (argc, argv);
+
+    test_addr_from (addr, "tcp", "127.0.0.1", port);
+    timeo = 3000;
+
+    /*  Option values. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_STRIPES, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 1);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_STRIPE_ORDERED, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (opt == 1);
+    opt = 0;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_STRIPES, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 17;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_STRIPES, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_STRIPE_ORDERED, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (sc);
+
+    /*  The connections are a single pipe as far as the protocol is
+        concerned, which PAIR sockets accept only one of. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    opt = 4;
+    test_setsockopt (sc, NN_TCP, NN_TCP_STRIPES, &opt, sizeof (opt));
+    test_connect (sc, addr);
+    wait_stat (sb, NN_STAT_ACCEPTED_CONNECTIONS, 4);
+    wait_stat (sc, NN_STAT_ESTABLISHED_CONNECTIONS, 4);
+    nn_assert (nn_get_statistic (sb, NN_STAT_CURRENT_CONNECTIONS) == 1);
+    nn_assert (nn_get_statistic (sc, NN_STAT_CURRENT_CONNECTIONS) == 1);
+    nn_assert (nn_get_statistic (sb, NN_STAT_BROKEN_CONNECTIONS) == 0);
+
+    /*  Messages spread over the connections arrive in order, in both
+        directions. */
+    send_seq (sc, MESSAGES);
+    recv_seq (sb, MESSAGES);
+    send_seq (sb, MESSAGES);
+    recv_seq (sc, MESSAGES);
+    test_close (sc);
+    wait_stat (sb, NN_STAT_CURRENT_CONNECTIONS, 0);
+    test_close (sb);
+
+    /*  Without ordering, all the messages arrive still. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    opt = 0;
+    test_setsockopt (sb, NN_TCP, NN_TCP_STRIPE_ORDERED, &opt, sizeof (opt));
+    test_bind (sb, addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    opt = 3;
+    test_setsockopt (sc, NN_TCP, NN_TCP_STRIPES, &opt, sizeof (opt));
+    test_connect (sc, addr);
+    wait_stat (sb, NN_STAT_ACCEPTED_CONNECTIONS, 3);
+    send_seq (sc, MESSAGES);
+    memset (seen, 0, sizeof (seen));
+    for (i = 0; i != MESSAGES; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf) - 1, 0);
+        errno_assert (rc > 0);
+        buf [rc] = 0;
+        n = atoi (buf);
+        nn_assert (n >= 0 && n < MESSAGES && !seen [n]);
+        seen [n] = 1;
+    }
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pipeline.h"
+#include "../src/tcpmux.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Tests the tcpmux transport, i.e. sockets sharing TCP connections. */
+
+#define PAIRS 4
+#define MESSAGES 1000
+
+static char addr [128];
+
+static void make_addr (char *out, int port, const char *service)
+{
+    sprintf (out, "tcpmux://127.0.0.1:%d/%s", port, service);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int j;
+    int sb [PAIRS];
+    int sc [PAIRS];
+    int push;
+    int pull;
+    int opt;
+    int timeo;
+    char name [16];
+    char buf [8192];
+    char *msg;
+    int port = get_test_port (argc, argv);
+
+    /*  Invalid addresses. */
+    sb [0] = test_socket (AF_SP, NN_PAIR);
+    sprintf (addr, "tcpmux://127.0.0.1:%d", port);
+    rc = nn_bind (sb [0], addr);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sprintf (addr, "tcpmux://127.0.0.1:%d/", port);
+    rc = nn_connect (sb [0], addr);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sb [0], "tcpmux://127.0.0.1/a");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sb [0], "tcpmux://-hostname:5555/a");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_bind (sb [0], "tcpmux://eth10000:5555/a");
+    nn_assert (rc < 0 && nn_errno () == ENODEV);
+    test_close (sb [0]);
+
+    /*  Several pairs of sockets share the connection. */
+    for (i = 0; i != PAIRS; ++i) {
+        sprintf (name, "pair%d", i);
+        make_addr (addr, port, name);
+        sb [i] = test_socket (AF_SP, NN_PAIR);
+        test_bind (sb [i], addr);
+        sc [i] = test_socket (AF_SP, NN_PAIR);
+        test_connect (sc [i], addr);
+    }
+
+    /*  Each service can be bound to only once. */
+    make_addr (addr, port, "pair0");
+    rc = nn_bind (sc [0], addr);
+    nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+
+    for (j = 0; j != 10; ++j) {
+        for (i = 0; i != PAIRS; ++i) {
+            sprintf (name, "%d-%d", i, j);
+            test_send (sc [i], name);
+            test_send (sb [i], name);
+        }
+        for (i = 0; i != PAIRS; ++i) {
+            sprintf (name, "%d-%d", i, j);
+            test_recv (sb [i], name);
+            test_recv (sc [i], name);
+        }
+    }
+
+    /*  Messages of all sizes. */
+    msg = nn_allocmsg (100000, 0);
+    alloc_assert (msg);
+    for (i = 0; i != 100000; ++i)
+        msg [i] = (char) i;
+    rc = nn_send (sc [0], &msg, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    msg = NULL;
+    rc = nn_recv (sb [0], &msg, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    for (i = 0; i != 100000; ++i)
+        nn_assert (msg [i] == (char) i);
+    nn_freemsg (msg);
+    memset (buf, 'x', sizeof (buf));
+    for (i = 1; i < (int) sizeof (buf); i *= 2) {
+        rc = nn_send (sb [1], buf, i, 0);
+        errno_assert (rc == i);
+        rc = nn_recv (sc [1], buf, sizeof (buf), 0);
+        errno_assert (rc == i);
+    }
+
+    /*  A channel closed on one side is reopened. */
+    test_close (sc [2]);
+    sc [2] = test_socket (AF_SP, NN_PAIR);
+    make_addr (addr, port, "pair2");
+    test_connect (sc [2], addr);
+    test_send (sc [2], "ABC");
+    test_recv (sb [2], "ABC");
+
+    /*  Connecting to a service no one is bound to is retried. */
+    push = test_socket (AF_SP, NN_PUSH);
+    make_addr (addr, port, "pipeline");
+    test_connect (push, addr);
+    for (i = 0; i != 100; ++i) {
+        if (nn_get_statistic (push, NN_STAT_CONNECT_ERRORS) > 0)
+            break;
+        nn_sleep (10);
+    }
+    nn_assert (i != 100);
+
+    /*  A socket that doesn't read its messages stops its sender, but not
+        the other channels of the connection. */
+    pull = test_socket (AF_SP, NN_PULL);
+    opt = 4096;
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_RCVBUF, &opt, sizeof (opt));
+    test_bind (pull, addr);
+    timeo = 100;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    for (i = 0; i != MESSAGES; ++i) {
+        rc = nn_send (push, buf, 1000, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == ETIMEDOUT);
+            break;
+        }
+        nn_assert (rc == 1000);
+    }
+    nn_assert (i != MESSAGES);
+    test_send (sc [3], "DEF");
+    test_recv (sb [3], "DEF");
+    test_send (sb [3], "GHI");
+    test_recv (sc [3], "GHI");
+
+    /*  Once the messages are read, the sender can go on. */
+    timeo = -1;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
+    for (j = 0; j != i; ++j) {
+        rc = nn_recv (pull, buf, sizeof (buf), 0);
+        errno_assert (rc == 1000);
+    }
+    for (j = 0; j != MESSAGES; ++j) {
+        rc = nn_send (push, buf, 100, 0);
+        errno_assert (rc == 100);
+        rc = nn_recv (pull, buf, sizeof (buf), 0);
+        errno_assert (rc == 100);
+    }
+
+    test_close (pull);
+    test_close (push);
+    for (i = 0; i != PAIRS; ++i) {
+        test_close (sc [i]);
+        test_close (sb [i]);
+    }
+
+    /*  Once all the endpoints are closed, the address can be bound again. */
+    sb [0] = test_socket (AF_SP, NN_PAIR);
+    make_addr (addr, port, "again");
+    test_bind (sb [0], addr);
+    sc [0] = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc [0], addr);
+    test_send (sc [0], "JKL");
+    test_recv (sb [0], "JKL");
+    test_close (sc [0]);
+    test_close (sb [0]);
+
+    return 0;
+}
@@ -22,10 +22,17 @@
 
 #include "../src/nn.h"
 #include "../src/pair.h"
+#include "../src/pipeline.h"
 
 #include "../src/utils/thread.c"
 #include "testutil.h"
 
+#include <stdlib.h>
+
+#define NPUSH 100
+
+static char socket_address [128];
+
 static void worker (NN_UNUSED void *arg)
 {
     int rc;
@@ -46,20 +53,46 @@ static void worker (NN_UNUSED void *arg)
     test_close (s);
 }
 
-int main ()
+int main (int argc, const char *argv[])
 {
     int rc;
     int s;
+    int i;
+    int pull;
+    int push [NPUSH];
     struct nn_thread thread;
 
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
     /*  Close the socket with no associated endpoints. */
     s = test_socket (AF_SP, NN_PAIR);
     test_close (s);
 
+    /*  Plenty of TCP endpoints, all of them shut down at once. */
+    pull = test_socket (AF_SP, NN_PULL);
+    test_bind (pull, socket_address);
+    for (i = 0; i != NPUSH; ++i) {
+        push [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (push [i], socket_address);
+    }
+    test_send (push [0], "ABC");
+    test_recv (pull, "ABC");
+
+    /*  The time nn_term waits for can be limited. */
+#if defined _WIN32
+    rc = _putenv ("NN_TERM_TIMEOUT=0");
+#else
+    rc = setenv ("NN_TERM_TIMEOUT", "0", 1);
+#endif
+    errno_assert (rc == 0);
+
     /*  Test nn_term() before nn_close(). */
     nn_thread_init (&thread, worker, NULL);
     nn_sleep (100);
     nn_term ();
+    rc = nn_send (push [0], "ABC", 3, 0);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
 
     /*  Check that it's not possible to create new sockets after nn_term(). */
     rc = nn_socket (AF_SP, NN_PAIR);
@@ -69,6 +102,16 @@ int main ()
     /*  Wait till worker thread terminates. */
     nn_thread_term (&thread);
 
+    /*  The sockets that weren't done closing are deallocated later on,
+        e.g. once nn_term is called again. */
+#if defined _WIN32
+    rc = _putenv ("NN_TERM_TIMEOUT=");
+#else
+    rc = setenv ("NN_TERM_TIMEOUT", "", 1);
+#endif
+    errno_assert (rc == 0);
+    nn_term ();
+
     return 0;
 }
 
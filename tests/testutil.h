@@ -212,4 +212,56 @@ static void NN_UNUSED test_addr_from (char *out, const char *proto,
     sprintf(out, "%s://%s:%d", proto, ip, port);
 }
 
+/*  Sends the string as a zero-copy message of two chunks, the first one
+    'split' bytes long. */
+static void NN_UNUSED test_send_parts (int sock, const char *data,
+    size_t split)
+{
+    int rc;
+    int i;
+    size_t sizes [2];
+    void *parts [2];
+    struct nn_iovec iov [2];
+    struct nn_msghdr hdr;
+
+    sizes [0] = split;
+    sizes [1] = strlen (data) - split;
+    for (i = 0; i != 2; ++i) {
+        parts [i] = nn_allocmsg (sizes [i], 0);
+        alloc_assert (parts [i]);
+        memcpy (parts [i], data + (i ? split : 0), sizes [i]);
+        iov [i].iov_base = &parts [i];
+        iov [i].iov_len = NN_MSG;
+    }
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 2;
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+#if defined __linux__
+#include <unistd.h>
+
+/*  Reads exactly 'len' bytes from a plain socket, retrying the reads that
+    were interrupted. Returns 0 on success, -1 once the connection is
+    closed. */
+static int NN_UNUSED test_raw_read (int s, void *buf, size_t len)
+{
+    ssize_t nbytes;
+
+    while (len) {
+        nbytes = read (s, buf, len);
+        if (nbytes < 0 && errno == EINTR)
+            continue;
+        if (nbytes == 0 || (nbytes < 0 && errno == ECONNRESET))
+            return -1;
+        errno_assert (nbytes > 0);
+        buf = ((char*) buf) + nbytes;
+        len -= nbytes;
+    }
+    return 0;
+}
+#endif
+
 #endif
@@ -31,6 +31,8 @@ int main ()
     int rc;
     int s;
     int timeo;
+    int spin;
+    size_t sz;
     char buf [3];
     struct nn_stopwatch stopwatch;
     uint64_t elapsed;
@@ -46,6 +48,24 @@ int main ()
     errno_assert (rc < 0 && nn_errno () == ETIMEDOUT);
     time_assert (elapsed, 100000);
 
+    /*  Busy-waiting for a message is limited by the timeout as well. */
+    spin = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &spin, sizeof (spin));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    spin = 1000000;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &spin, sizeof (spin));
+    errno_assert (rc == 0);
+    spin = 0;
+    sz = sizeof (spin);
+    rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &spin, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (spin) && spin == 1000000);
+    nn_stopwatch_init (&stopwatch);
+    rc = nn_recv (s, buf, sizeof (buf), 0);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    errno_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+    time_assert (elapsed, 100000);
+
     timeo = 100;
     rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_SNDTIMEO, &timeo, sizeof (timeo));
     errno_assert (rc == 0);
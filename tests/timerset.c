@@ -0,0 +1,130 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/utils/cont.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/list.c"
+#include "../src/utils/clock.c"
+#include "../src/utils/sleep.c"
+#include "../src/aio/timerset.c"
+
+#include <stdlib.h>
+
+/*  Test of the timing wheel behind nn_timerset. */
+
+#define COUNT 1000
+
+static struct nn_timerset_hndl hndls [COUNT];
+
+/*  Returns due time of the first active timeout. */
+static uint64_t first (void)
+{
+    int i;
+    uint64_t res;
+
+    res = UINT64_MAX;
+    for (i = 0; i != COUNT; ++i)
+        if (nn_timerset_hndl_isactive (&hndls [i]) &&
+              hndls [i].timeout < res)
+            res = hndls [i].timeout;
+    return res;
+}
+
+int main ()
+{
+    int i;
+    int rc;
+    int timeout;
+    int active;
+    uint64_t due;
+    uint64_t now;
+    struct nn_timerset timerset;
+    struct nn_timerset_hndl longterm;
+    struct nn_timerset_hndl *hndl;
+
+    nn_timerset_init (&timerset);
+
+    /*  Empty timerset. */
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+    rc = nn_timerset_event (&timerset, &hndl);
+    nn_assert (rc == -EAGAIN);
+
+    /*  Timeout far in the future doesn't fire and can be removed. */
+    nn_timerset_hndl_init (&longterm);
+    rc = nn_timerset_add (&timerset, 3600000, &longterm);
+    nn_assert (rc == 1);
+    timeout = nn_timerset_timeout (&timerset);
+    nn_assert (timeout >= 0 && timeout <= 3600000);
+    rc = nn_timerset_event (&timerset, &hndl);
+    nn_assert (rc == -EAGAIN);
+
+    /*  Lots of random timeouts, some of them removed straight away. */
+    srand (1);
+    for (i = 0; i != COUNT; ++i) {
+        nn_timerset_hndl_init (&hndls [i]);
+        nn_timerset_add (&timerset, rand () % 300, &hndls [i]);
+    }
+    for (i = 0; i < COUNT; i += 3)
+        nn_timerset_rm (&timerset, &hndls [i]);
+    active = COUNT - (COUNT + 2) / 3;
+
+    /*  Wait for the timeouts to expire. Each has to be reported after it's
+        due and the reported waiting time must never exceed the time till
+        the first timeout is due. On a loaded machine that one may be
+        overdue already, leaving nothing to wait for. */
+    while (active) {
+        due = first ();
+        now = nn_clock_ms ();
+        nn_timerset_settime (&timerset, now);
+        timeout = nn_timerset_timeout (&timerset);
+        nn_assert (timeout >= 0);
+        nn_assert (timeout == 0 || now + timeout <= due);
+        nn_sleep (timeout);
+        nn_timerset_settime (&timerset, nn_clock_ms ());
+        while (1) {
+            rc = nn_timerset_event (&timerset, &hndl);
+            if (rc == -EAGAIN)
+                break;
+            errnum_assert (rc == 0, -rc);
+            nn_assert (hndl != &longterm);
+            nn_assert (hndl->timeout <= nn_clock_ms ());
+            nn_assert (!nn_timerset_hndl_isactive (hndl));
+            --active;
+        }
+    }
+    nn_assert (first () == UINT64_MAX);
+
+    nn_assert (nn_timerset_hndl_isactive (&longterm));
+    nn_timerset_rm (&timerset, &longterm);
+    nn_assert (!nn_timerset_hndl_isactive (&longterm));
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+
+    for (i = 0; i != COUNT; ++i)
+        nn_timerset_hndl_term (&hndls [i]);
+    nn_timerset_hndl_term (&longterm);
+    nn_timerset_term (&timerset);
+
+    return 0;
+}
+
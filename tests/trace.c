@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+#include "../src/utils/atomic.c"
+
+/*  Test of the message tracepoints. */
+
+#define NN_TEST_TRACE_POINTS 10
+
+static struct nn_atomic hits [NN_TEST_TRACE_POINTS];
+static struct nn_atomic last_send_len;
+
+static void trace_fn (int point, const void *obj, size_t len)
+{
+    nn_assert (point > 0 && point < NN_TEST_TRACE_POINTS);
+    nn_assert (obj);
+    nn_atomic_inc (&hits [point], 1);
+    if (point == NN_TRACE_SEND_ENTER)
+        nn_atomic_cas (&last_send_len, 0, (uint32_t) len);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int sb;
+    int sc;
+    uint32_t sum;
+    char socket_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    for (i = 0; i != NN_TEST_TRACE_POINTS; ++i)
+        nn_atomic_init (&hits [i], 0);
+    nn_atomic_init (&last_send_len, 0);
+
+    /*  Without the tracepoints compiled in, there's nothing to test. */
+    rc = nn_trace (trace_fn);
+    if (rc < 0) {
+        nn_assert (nn_errno () == ENOTSUP);
+        return 0;
+    }
+    errno_assert (rc == 0);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    nn_sleep (100);
+
+    /*  Each stage of the message's journey over TCP is reported. */
+    test_send (sc, "ABCDE");
+    test_recv (sb, "ABCDE");
+    for (i = 1; i != NN_TEST_TRACE_POINTS; ++i)
+        nn_assert (nn_atomic_load (&hits [i]) > 0);
+    nn_assert (nn_atomic_load (&last_send_len) == 5);
+
+    /*  Once the hook is removed, nothing is reported any more. */
+    rc = nn_trace (NULL);
+    errno_assert (rc == 0);
+    sum = 0;
+    for (i = 1; i != NN_TEST_TRACE_POINTS; ++i)
+        sum += nn_atomic_load (&hits [i]);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    for (i = 1; i != NN_TEST_TRACE_POINTS; ++i)
+        sum -= nn_atomic_load (&hits [i]);
+    nn_assert (sum == 0);
+
+    test_close (sc);
+    test_close (sb);
+
+    for (i = 0; i != NN_TEST_TRACE_POINTS; ++i)
+        nn_atomic_term (&hits [i]);
+    nn_atomic_term (&last_send_len);
+
+    return 0;
+}
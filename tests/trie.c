@@ -25,11 +25,67 @@
 #include "../src/utils/err.c"
 
 #include <stdio.h>
+#include <string.h>
+
+/*  Collects the strings visited by nn_trie_foreach, separated by '|'. */
+struct trie_collect {
+    char buf [256];
+    size_t len;
+    int count;
+};
+
+static void trie_collect_fn (void *arg, const uint8_t *data, size_t size)
+{
+    struct trie_collect *c = arg;
+
+    nn_assert (c->len + size + 1 < sizeof (c->buf));
+    memcpy (c->buf + c->len, data, size);
+    c->len += size;
+    c->buf [c->len++] = '|';
+    c->buf [c->len] = 0;
+    ++c->count;
+}
+
+static int trie_collected (struct trie_collect *c, const char *s)
+{
+    char tmp [64];
+
+    snprintf (tmp, sizeof (tmp), "|%s|", s);
+    return strstr (c->buf, tmp) != NULL ||
+        strncmp (c->buf, tmp + 1, strlen (tmp + 1)) == 0;
+}
+
+/*  Strings for the bulk subscription test. They share prefixes of various
+    lengths, include duplicates and enough distinct characters at some
+    positions to need dense nodes. */
+#define TRIE_BULK 1000
+
+static size_t trie_bulk_str (int i, uint8_t *buf)
+{
+    size_t size;
+    size_t j;
+    uint32_t x;
+
+    x = (uint32_t) (i % 700) * 2654435761u;
+    size = (x >> 8) % 24;
+    for (j = 0; j != size; ++j) {
+        buf [j] = (uint8_t) ('a' + (j < 12 ? (x >> (j % 4)) % 3 : x % 20));
+        x = x * 1103515245u + 12345u;
+    }
+    return size;
+}
 
 int main ()
 {
     int rc;
+    int i;
+    uint8_t c;
+    size_t sz;
+    size_t sz2;
     struct nn_trie trie;
+    struct nn_trie trie2;
+    uint8_t bulk [TRIE_BULK][24];
+    struct nn_trie_str strs [TRIE_BULK];
 
     /*  Try matching with an empty trie. */
     nn_trie_init (&trie);
@@ -63,6 +119,27 @@ int main ()
     nn_assert (rc == 1);
     nn_trie_term (&trie);
 
+    /*  The shortest matching subscription is reported, both by the trie
+        and by its flat copy. */
+    nn_trie_init (&trie);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABCD", 4);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "AB", 2);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "X", 1);
+    nn_assert (rc == 1);
+    for (i = 0; i != 2 * NN_TRIE_COMPILE_MIN; ++i) {
+        sz = 0;
+        rc = nn_trie_match_prefix (&trie, (const uint8_t*) "ABCDE", 5, &sz);
+        nn_assert (rc == 1 && sz == 2);
+        rc = nn_trie_match_prefix (&trie, (const uint8_t*) "XYZ", 3, &sz);
+        nn_assert (rc == 1 && sz == 1);
+        rc = nn_trie_match_prefix (&trie, (const uint8_t*) "AC", 2, &sz);
+        nn_assert (rc == 0);
+    }
+    nn_assert (trie.flat != NULL);
+    nn_trie_term (&trie);
+
     /*  Try a long subcsription. */
     nn_trie_init (&trie);
     rc = nn_trie_subscribe (&trie,
@@ -205,6 +282,110 @@ int main ()
     nn_assert (rc == 1);
     nn_trie_term (&trie);
 
+    /*  Enumerate the subscriptions, including long prefixes, a dense node
+        and the empty subscription. */
+    {
+        static const char *topics [] = {"", "A", "AB", "ABCDEFGHIJKLMNOP",
+            "ABCDEFGHIJKLMNOQ", "a", "b", "c", "d", "e", "f", "g", "h", "i",
+            "j"};
+        struct trie_collect c;
+        size_t j;
+
+        nn_trie_init (&trie);
+        for (j = 0; j != sizeof (topics) / sizeof (topics [0]); ++j) {
+            rc = nn_trie_subscribe (&trie, (const uint8_t*) topics [j],
+                strlen (topics [j]));
+            nn_assert (rc == 1);
+        }
+        rc = nn_trie_subscribe (&trie, (const uint8_t*) "A", 1);
+        nn_assert (rc == 0);
+
+        /*  The subscription in the node that turned dense is still there. */
+        rc = nn_trie_match (&trie, (const uint8_t*) "z", 1);
+        nn_assert (rc == 1);
+
+        memset (&c, 0, sizeof (c));
+        nn_trie_foreach (&trie, trie_collect_fn, &c);
+        nn_assert (c.count == sizeof (topics) / sizeof (topics [0]));
+        for (j = 0; j != sizeof (topics) / sizeof (topics [0]); ++j)
+            nn_assert (trie_collected (&c, topics [j]));
+        nn_trie_term (&trie);
+
+        nn_trie_init (&trie);
+        memset (&c, 0, sizeof (c));
+        nn_trie_foreach (&trie, trie_collect_fn, &c);
+        nn_assert (c.count == 0);
+        nn_trie_term (&trie);
+    }
+
+    /*  Matching repeatedly switches to the flat copy of the trie. Make sure
+        it gives the same answers and follows the changes. */
+    nn_trie_init (&trie);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABCDEFGHIJKLMNOP", 16);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "AB", 2);
+    nn_assert (rc == 1);
+    for (i = 0; i != 9; ++i) {
+        c = (uint8_t) ('a' + i);
+        rc = nn_trie_subscribe (&trie, &c, 1);
+        nn_assert (rc == 1);
+    }
+    for (i = 0; i != 3000; ++i) {
+        rc = nn_trie_match (&trie, (const uint8_t*) "ABX", 3);
+        nn_assert (rc == 1);
+        rc = nn_trie_match (&trie, (const uint8_t*) "A", 1);
+        nn_assert (rc == 0);
+        rc = nn_trie_match (&trie, (const uint8_t*) "i", 1);
+        nn_assert (rc == 1);
+        rc = nn_trie_match (&trie, (const uint8_t*) "j", 1);
+        nn_assert (rc == 0);
+    }
+    nn_assert (trie.flat != NULL);
+    rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "AB", 2);
+    nn_assert (rc == 1);
+    nn_assert (trie.flat == NULL);
+    for (i = 0; i != 3000; ++i) {
+        rc = nn_trie_match (&trie, (const uint8_t*) "ABX", 3);
+        nn_assert (rc == 0);
+        rc = nn_trie_match (&trie, (const uint8_t*) "ABCDEFGHIJKLMNOPQ", 17);
+        nn_assert (rc == 1);
+    }
+    nn_assert (trie.flat != NULL);
+    nn_trie_term (&trie);
+
+    /*  A trie built in bulk must behave the same as the one built by adding
+        the strings one by one. */
+    nn_trie_init (&trie);
+    nn_trie_init (&trie2);
+    sz2 = 0;
+    for (i = 0; i != TRIE_BULK; ++i) {
+        strs [i].data = bulk [i];
+        strs [i].size = trie_bulk_str (i, bulk [i]);
+        sz2 += nn_trie_subscribe (&trie2, strs [i].data, strs [i].size);
+    }
+    sz = nn_trie_subscribe_many (&trie, strs, TRIE_BULK / 2);
+    sz += nn_trie_subscribe_many (&trie, strs + TRIE_BULK / 2,
+        TRIE_BULK - TRIE_BULK / 2);
+    nn_assert (sz == sz2);
+    for (i = 0; i != TRIE_BULK; ++i) {
+        sz = trie_bulk_str (i * 7 + 3, bulk [0]);
+        nn_assert (nn_trie_match (&trie, bulk [0], sz) ==
+            nn_trie_match (&trie2, bulk [0], sz));
+        if (nn_trie_match_prefix (&trie, bulk [0], sz, &sz)) {
+            nn_assert (nn_trie_match_prefix (&trie2, bulk [0],
+                trie_bulk_str (i * 7 + 3, bulk [0]), &sz2));
+            nn_assert (sz == sz2);
+        }
+    }
+    for (i = 0; i != TRIE_BULK; ++i) {
+        sz = trie_bulk_str (i, bulk [0]);
+        nn_assert (nn_trie_unsubscribe (&trie, bulk [0], sz) ==
+            nn_trie_unsubscribe (&trie2, bulk [0], sz));
+    }
+    nn_assert (trie.root == NULL && trie2.root == NULL);
+    nn_trie_term (&trie2);
+    nn_trie_term (&trie);
+
     return 0;
 }
 
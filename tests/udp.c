@@ -0,0 +1,136 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/udp.h"
+
+#include "testutil.h"
+
+#include <string.h>
+
+/*  Tests UDP transport. */
+
+#define NMSGS 100
+#define LARGE_SIZE 100000
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int pub;
+    int sub1;
+    int sub2;
+    int pair;
+    int i;
+    int opt;
+    size_t sz;
+    char *buf;
+    char socket_address[128];
+    char group_address[128];
+
+    int port = get_test_port(argc, argv);
+
+    test_addr_from(socket_address, "udp", "127.0.0.1", port);
+    test_addr_from(group_address, "udp", "127.0.0.1;239.255.0.1", port + 1);
+
+    /*  Try invalid addresses. */
+    pub = test_socket (AF_SP, NN_PUB);
+    rc = nn_connect (pub, "udp://127.0.0.1");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (pub, "udp://localhost:5555");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_bind (pub, "udp://eth10000:5555");
+    nn_assert (rc < 0 && nn_errno () == ENODEV);
+
+    /*  Check the socket options. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (pub, NN_UDP, NN_UDP_TTL, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 1);
+    opt = 256;
+    rc = nn_setsockopt (pub, NN_UDP, NN_UDP_TTL, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 2;
+    rc = nn_setsockopt (pub, NN_UDP, NN_UDP_LOOPBACK, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (pub);
+
+    /*  Unicast datagrams. */
+    sub1 = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    opt = 1000;
+    test_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sub1, socket_address);
+    pub = test_socket (AF_SP, NN_PUB);
+    test_connect (pub, socket_address);
+    nn_sleep (100);
+    test_send (pub, "ABC");
+    test_recv (sub1, "ABC");
+    for (i = 0; i != NMSGS; ++i)
+        test_send (pub, "0123456789");
+    for (i = 0; i != NMSGS; ++i)
+        test_recv (sub1, "0123456789");
+
+    /*  Datagrams from sockets that aren't peers are ignored. */
+    pair = test_socket (AF_SP, NN_PAIR);
+    test_connect (pair, socket_address);
+    nn_sleep (100);
+    test_send (pair, "XYZ");
+    test_send (pub, "DEF");
+    test_recv (sub1, "DEF");
+    test_close (pair);
+
+    /*  A message that doesn't fit into a datagram is dropped. */
+    buf = nn_allocmsg (LARGE_SIZE, 0);
+    alloc_assert (buf);
+    memset (buf, 'x', LARGE_SIZE);
+    rc = nn_send (pub, &buf, NN_MSG, 0);
+    errno_assert (rc == LARGE_SIZE);
+    test_send (pub, "GHI");
+    test_recv (sub1, "GHI");
+    nn_assert (nn_get_statistic (pub, NN_STAT_DROPPED_MESSAGES) == 1);
+    test_close (pub);
+    test_close (sub1);
+
+    /*  A single multicast datagram reaches all the subscribers. */
+    sub1 = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    opt = 1000;
+    test_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sub1, group_address);
+    sub2 = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    test_setsockopt (sub2, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sub2, group_address);
+    pub = test_socket (AF_SP, NN_PUB);
+    test_connect (pub, group_address);
+    nn_sleep (100);
+    test_send (pub, "ABC");
+    test_recv (sub1, "ABC");
+    test_recv (sub2, "ABC");
+    test_close (pub);
+    test_close (sub2);
+    test_close (sub1);
+
+    return 0;
+}
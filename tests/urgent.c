@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#define BULK_SIZE (1024 * 1024)
+#define BULK_COUNT 16
+
+static char socket_address [128];
+
+/*  Sends a message marked as urgent. */
+static void send_urgent (int s, const char *data)
+{
+    int rc;
+    int urgent;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    union {
+        struct nn_cmsghdr hdr;
+        char buf [NN_CMSG_SPACE (sizeof (int))];
+    } control;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof (control.buf);
+    cmsg = &control.hdr;
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = NN_MSG_URGENT;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (int));
+    urgent = 1;
+    memcpy (NN_CMSG_DATA (cmsg), &urgent, sizeof (urgent));
+    rc = nn_sendmsg (s, &hdr, NN_DONTWAIT);
+    errno_assert (rc == (int) strlen (data));
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    int opt;
+    int bulk;
+    int urgentpos;
+    char *buf;
+    void *msg;
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = BULK_COUNT * 2;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDQUEUE_MSGS, &opt, sizeof (opt));
+    opt = 1000;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_connect (sc, socket_address);
+    nn_sleep (100);
+
+    /*  With nothing queued, an urgent message is sent as usual. */
+    send_urgent (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    /*  Queue up bulk messages the peer is not reading. An urgent message
+        overtakes the ones not being written yet. */
+    buf = malloc (BULK_SIZE);
+    alloc_assert (buf);
+    memset (buf, 'B', BULK_SIZE);
+    for (i = 0; i != BULK_COUNT; ++i) {
+        buf [0] = (char) i;
+        rc = nn_send (sc, buf, BULK_SIZE, NN_DONTWAIT);
+        errno_assert (rc == BULK_SIZE);
+    }
+    send_urgent (sc, "URGENT");
+
+    bulk = 0;
+    urgentpos = -1;
+    for (i = 0; i != BULK_COUNT + 1; ++i) {
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        if (rc == 6) {
+            nn_assert (memcmp (msg, "URGENT", 6) == 0);
+            nn_assert (urgentpos < 0);
+            urgentpos = i;
+        }
+        else {
+
+            /*  The bulk messages keep their order. */
+            nn_assert (rc == BULK_SIZE);
+            nn_assert (((char*) msg) [0] == (char) bulk);
+            ++bulk;
+        }
+        nn_freemsg (msg);
+    }
+    nn_assert (bulk == BULK_COUNT);
+    nn_assert (urgentpos >= 0 && urgentpos < BULK_COUNT);
+
+    /*  The connection is still in sync. */
+    test_send (sc, "DEF");
+    test_recv (sb, "DEF");
+
+    free (buf);
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "testutil.h"
+
+#define MSG_SIZE 1000
+#define MSG_COUNT 100
+
+static char socket_address [128];
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    int pool;
+    int i;
+    size_t sz;
+    uint64_t mem;
+    char *buf;
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+
+    sb = test_socket (AF_SP, NN_PAIR);
+
+    /*  Nothing is warmed up by default. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_MSGS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_SIZE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_MSGS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    /*  The memory set aside is not charged to the socket. */
+    mem = nn_get_statistic (sb, NN_STAT_ALLOCATED_BYTES);
+    opt = MSG_SIZE;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_SIZE, &opt, sizeof (opt));
+    opt = MSG_COUNT;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_MSGS, &opt, sizeof (opt));
+    nn_assert (nn_get_statistic (sb, NN_STAT_ALLOCATED_BYTES) == mem);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_SIZE, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == MSG_SIZE);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_WARMUP_MSGS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == MSG_COUNT);
+
+    /*  The receive pool is filled up to its limit. */
+    pool = nn_msgpool (MSG_SIZE, MSG_COUNT / 2);
+    errno_assert (pool > 0);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_RCVPOOL, &pool, sizeof (pool));
+    opt = MSG_SIZE;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_WARMUP_SIZE, &opt, sizeof (opt));
+    opt = MSG_COUNT;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_WARMUP_MSGS, &opt, sizeof (opt));
+
+    /*  The warmed up sockets work as usual. */
+    test_bind (sb, socket_address);
+    test_connect (sc, socket_address);
+    buf = malloc (MSG_SIZE);
+    alloc_assert (buf);
+    for (i = 0; i != MSG_COUNT; ++i) {
+        memset (buf, 'A' + i % 26, MSG_SIZE);
+        rc = nn_send (sb, buf, MSG_SIZE, 0);
+        errno_assert (rc == MSG_SIZE);
+        memset (buf, 0, MSG_SIZE);
+        rc = nn_recv (sc, buf, MSG_SIZE, 0);
+        errno_assert (rc == MSG_SIZE);
+        nn_assert (buf [0] == 'A' + i % 26 && buf [MSG_SIZE - 1] == buf [0]);
+    }
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+
+    free (buf);
+    test_close (sc);
+    test_close (sb);
+
+    return 0;
+}
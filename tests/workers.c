@@ -0,0 +1,143 @@
+/*
+    Copyright (c) 2016 nanomsg contributors  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests running the transports on top of several AIO worker threads. */
+
+#define NPAIRS 8
+
+static char socket_address [128];
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int i;
+    int j;
+    int sb [NPAIRS];
+    int sc [NPAIRS];
+    int push;
+    int pull;
+    int val;
+    size_t sz;
+    char buf [64];
+
+    /*  The pool size is read when the first socket is created. */
+#if defined _WIN32
+    rc = _putenv ("NN_WORKER_THREADS=4");
+#else
+    rc = setenv ("NN_WORKER_THREADS", "4", 1);
+#endif
+    errno_assert (rc == 0);
+
+    /*  Several TCP connections, each one likely to land in a different
+        worker thread. */
+    for (i = 0; i != NPAIRS; ++i) {
+        test_addr_from (socket_address, "tcp", "127.0.0.1",
+            get_test_port (argc, argv) + i);
+        sb [i] = test_socket (AF_SP, NN_PAIR);
+        test_bind (sb [i], socket_address);
+        sc [i] = test_socket (AF_SP, NN_PAIR);
+        test_connect (sc [i], socket_address);
+    }
+    for (j = 0; j != 10; ++j) {
+        for (i = 0; i != NPAIRS; ++i)
+            test_send (sc [i], "ABC");
+        for (i = 0; i != NPAIRS; ++i) {
+            test_recv (sb [i], "ABC");
+            test_send (sb [i], "DEF");
+        }
+        for (i = 0; i != NPAIRS; ++i)
+            test_recv (sc [i], "DEF");
+    }
+    for (i = 0; i != NPAIRS; ++i) {
+        test_close (sc [i]);
+        test_close (sb [i]);
+    }
+
+    /*  Fan-in of multiple connections to a single socket. By default all
+        of them are serviced by the socket's home worker; here the accepted
+        pipes are spread over a subset of the workers instead. */
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv) + NPAIRS);
+    pull = test_socket (AF_SP, NN_PULL);
+    sz = sizeof (buf);
+    rc = nn_getsockopt (pull, NN_SOL_SOCKET, NN_WORKERS, buf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == 0);
+    rc = nn_setsockopt (pull, NN_SOL_SOCKET, NN_WORKERS, "1,4", 3);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_setsockopt (pull, NN_SOL_SOCKET, NN_WORKERS, "x", 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_setsockopt (pull, NN_SOL_SOCKET, NN_WORKERS, "1-3", 3);
+    sz = sizeof (buf);
+    rc = nn_getsockopt (pull, NN_SOL_SOCKET, NN_WORKERS, buf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == 3 && memcmp (buf, "1-3", 3) == 0);
+    test_bind (pull, socket_address);
+    for (i = 0; i != NPAIRS; ++i) {
+        sc [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (sc [i], socket_address);
+    }
+    for (j = 0; j != 100; ++j)
+        for (i = 0; i != NPAIRS; ++i)
+            test_send (sc [i], "GHI");
+    for (j = 0; j != 100 * NPAIRS; ++j)
+        test_recv (pull, "GHI");
+    for (i = 0; i != NPAIRS; ++i)
+        test_close (sc [i]);
+
+    /*  Same over IPC, with all the connections of the socket bound to
+        a single worker. */
+    push = test_socket (AF_SP, NN_PUSH);
+    sz = sizeof (val);
+    rc = nn_getsockopt (push, NN_SOL_SOCKET, NN_WORKER, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == -1);
+    val = 4;
+    rc = nn_setsockopt (push, NN_SOL_SOCKET, NN_WORKER, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 2;
+    test_setsockopt (push, NN_SOL_SOCKET, NN_WORKER, &val, sizeof (val));
+    rc = nn_getsockopt (push, NN_SOL_SOCKET, NN_WORKER, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (val == 2);
+    test_bind (push, "ipc://test-workers.ipc");
+    test_close (pull);
+    pull = test_socket (AF_SP, NN_PULL);
+    test_connect (pull, "ipc://test-workers.ipc");
+    for (j = 0; j != 100; ++j)
+        test_send (push, "JKL");
+    for (j = 0; j != 100; ++j)
+        test_recv (pull, "JKL");
+    test_close (pull);
+    test_close (push);
+
+    return 0;
+}
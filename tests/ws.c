@@ -25,10 +25,23 @@
 
 #include "../src/nn.h"
 #include "../src/pair.h"
+#include "../src/pipeline.h"
 #include "../src/ws.h"
 
 #include "testutil.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#define NN_MASKING_MAXLEN 100000
+#define NN_DEFLATE_MAXLEN 300000
+#define NN_BURST_COUNT 50
+#define NN_HANDSHAKE_CLIENTS 8
+
+/*  Sizes of the messages sent in a single burst by test_burst(). Small ones
+    get copied into a batch, the large ones close it. */
+static const size_t burst_sizes [] = {0, 10, 1500, 100, 30000};
+
 static char socket_address[128];
 
 /*  Basic tests for WebSocket transport. */
@@ -41,6 +54,7 @@ void test_text ()
     int sc;
     int opt;
     uint8_t bad[20];
+    char longbad[48];
 
     /*  Negative testing... bad UTF-8 data for text. */
     sb = test_socket (AF_SP, NN_PAIR);
@@ -59,6 +73,13 @@ void test_text ()
     test_send (sc, "GOOD");
     test_recv (sb, "GOOD");
 
+    /*  Multi-octet code points mixed with runs of ASCII characters
+        longer than a block. */
+    test_send (sc, "0123456789012345678901234567890\xc3\xa9"
+        "012345678901234\xe2\x82\xac" "0123456789012345\xf0\x9f\x98\x80.");
+    test_recv (sb, "0123456789012345678901234567890\xc3\xa9"
+        "012345678901234\xe2\x82\xac" "0123456789012345\xf0\x9f\x98\x80.");
+
     /*  and the bad ... */
     strcpy ((char *)bad, "BAD.");
     bad[2] = (char)0xDD;
@@ -70,9 +91,307 @@ void test_text ()
     test_close (sb);
     test_close (sc);
 
+    /*  Invalid octet following a long run of ASCII characters. The peer
+        that sent invalid data is disconnected, so start anew. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = NN_WS_MSG_TYPE_TEXT;
+    test_setsockopt (sb, NN_WS, NN_WS_MSG_TYPE, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_WS, NN_WS_MSG_TYPE, &opt, sizeof (opt));
+    opt = 500;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    test_connect (sc, socket_address);
+
+    memset (longbad, 'A', sizeof (longbad) - 1);
+    longbad [sizeof (longbad) - 1] = 0;
+    longbad [40] = (char)0xDD;
+    test_send (sc, longbad);
+    test_drop (sb, ETIMEDOUT);
+
+    test_close (sb);
+    test_close (sc);
+
     return;
 }
 
+/*  test_masking() sends messages of various sizes in both directions,
+    to cover masking of both whole blocks and leftover bytes. */
+void test_masking ()
+{
+    int rc;
+    int sb;
+    int sc;
+    size_t i;
+    size_t j;
+    size_t len;
+    char *buf;
+    void *msg;
+
+    buf = malloc (NN_MASKING_MAXLEN);
+    alloc_assert (buf);
+    for (i = 0; i != NN_MASKING_MAXLEN; ++i)
+        buf [i] = (char) (i * 7 + 3);
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+
+    for (i = 0; i != 2; ++i) {
+        for (len = 0; len <= NN_MASKING_MAXLEN;
+              len = len < 40 ? len + 1 : len * 3) {
+            if (len > NN_MASKING_MAXLEN)
+                len = NN_MASKING_MAXLEN;
+            rc = nn_send (i ? sb : sc, buf, len, 0);
+            errno_assert (rc >= 0);
+            nn_assert ((size_t) rc == len);
+            rc = nn_recv (i ? sc : sb, &msg, NN_MSG, 0);
+            errno_assert (rc >= 0);
+            nn_assert ((size_t) rc == len);
+            for (j = 0; j != len; ++j)
+                nn_assert (((char*) msg) [j] == buf [j]);
+            nn_freemsg (msg);
+            if (len == NN_MASKING_MAXLEN)
+                break;
+        }
+    }
+
+    test_close (sc);
+    test_close (sb);
+    free (buf);
+}
+
+/*  test_burst() sends bursts of mixed-size messages in both directions in
+    a single call, so that their frames are coalesced. They must arrive
+    intact and in order. */
+void test_burst ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    int j;
+    size_t len;
+    char *buf;
+    void *msg;
+    struct nn_mmsghdr msgs [NN_BURST_COUNT];
+    struct nn_iovec iovs [NN_BURST_COUNT];
+
+    buf = malloc (NN_BURST_COUNT * 30000);
+    alloc_assert (buf);
+    for (i = 0; i != NN_BURST_COUNT; ++i) {
+        len = burst_sizes [i % (sizeof (burst_sizes) / sizeof (size_t))];
+        memset (buf + i * 30000, 'a' + (i % 26), len);
+        iovs [i].iov_base = buf + i * 30000;
+        iovs [i].iov_len = len;
+        memset (&msgs [i], 0, sizeof (msgs [i]));
+        msgs [i].msg_hdr.msg_iov = &iovs [i];
+        msgs [i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+
+    for (j = 0; j != 2; ++j) {
+        rc = nn_sendmmsg (j ? sb : sc, msgs, NN_BURST_COUNT, 0);
+        errno_assert (rc == NN_BURST_COUNT);
+        for (i = 0; i != NN_BURST_COUNT; ++i) {
+            rc = nn_recv (j ? sc : sb, &msg, NN_MSG, 0);
+            errno_assert (rc >= 0);
+            nn_assert ((size_t) rc == iovs [i].iov_len);
+            nn_assert (memcmp (msg, iovs [i].iov_base, rc) == 0);
+            nn_freemsg (msg);
+        }
+    }
+
+    test_close (sc);
+    test_close (sb);
+    free (buf);
+}
+
+/*  Sends messages of various sizes from one socket to the other and checks
+    they arrive intact. Messages are either repetitive or random. */
+static void test_deflate_exchange (int from, int to, const char *buf)
+{
+    int rc;
+    size_t len;
+    void *msg;
+
+    for (len = 0; len <= NN_DEFLATE_MAXLEN;
+          len = len < 8 ? len + 1 : len * 5) {
+        if (len > NN_DEFLATE_MAXLEN)
+            len = NN_DEFLATE_MAXLEN;
+        rc = nn_send (from, buf, len, 0);
+        errno_assert (rc >= 0);
+        nn_assert ((size_t) rc == len);
+        rc = nn_recv (to, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert ((size_t) rc == len);
+        nn_assert (memcmp (msg, buf, len) == 0);
+        nn_freemsg (msg);
+        if (len == NN_DEFLATE_MAXLEN)
+            break;
+    }
+}
+
+/*  test_deflate() exchanges messages with permessage-deflate negotiated
+    with various parameters, or requested by one of the peers only. */
+void test_deflate ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int opt;
+    size_t sz;
+    size_t i;
+    int cfg;
+    char *text;
+    char *random;
+    static const char pattern [] = "{\"id\": 42, \"name\": \"value\"}, ";
+
+    /*  Each line holds the options of the server (enabled, window bits,
+        no context takeover) and then the same for the client. */
+    static const int cfgs [][6] = {
+        {1, 15, 0, 1, 15, 0},
+        {1, 9, 0, 1, 15, 1},
+        {1, 15, 1, 1, 10, 0},
+        {1, 15, 0, 0, 15, 0},
+        {0, 15, 0, 1, 15, 0}
+    };
+
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    rc = nn_setsockopt (sc, NN_WS, NN_WS_DEFLATE, &opt, sizeof (opt));
+    if (rc < 0) {
+        /*  The library was built without zlib. */
+        errno_assert (nn_errno () == ENOTSUP);
+        test_close (sc);
+        return;
+    }
+
+    /*  Check the options. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_WS, NN_WS_DEFLATE_WINDOW_BITS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 15);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_WS, NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER,
+        &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = 8;
+    rc = nn_setsockopt (sc, NN_WS, NN_WS_DEFLATE_WINDOW_BITS,
+        &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 16;
+    rc = nn_setsockopt (sc, NN_WS, NN_WS_DEFLATE_WINDOW_BITS,
+        &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_WS, NN_WS_DEFLATE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_close (sc);
+
+    text = malloc (NN_DEFLATE_MAXLEN);
+    alloc_assert (text);
+    random = malloc (NN_DEFLATE_MAXLEN);
+    alloc_assert (random);
+    for (i = 0; i != NN_DEFLATE_MAXLEN; ++i) {
+        text [i] = pattern [i % (sizeof (pattern) - 1)];
+        random [i] = (char) ((i * 2654435761U) >> 13);
+    }
+
+    for (cfg = 0; cfg != sizeof (cfgs) / sizeof (cfgs [0]); ++cfg) {
+        sb = test_socket (AF_SP, NN_PAIR);
+        sc = test_socket (AF_SP, NN_PAIR);
+        test_setsockopt (sb, NN_WS, NN_WS_DEFLATE, &cfgs [cfg][0],
+            sizeof (int));
+        test_setsockopt (sb, NN_WS, NN_WS_DEFLATE_WINDOW_BITS, &cfgs [cfg][1],
+            sizeof (int));
+        test_setsockopt (sb, NN_WS, NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER,
+            &cfgs [cfg][2], sizeof (int));
+        test_setsockopt (sc, NN_WS, NN_WS_DEFLATE, &cfgs [cfg][3],
+            sizeof (int));
+        test_setsockopt (sc, NN_WS, NN_WS_DEFLATE_WINDOW_BITS, &cfgs [cfg][4],
+            sizeof (int));
+        test_setsockopt (sc, NN_WS, NN_WS_DEFLATE_NO_CONTEXT_TAKEOVER,
+            &cfgs [cfg][5], sizeof (int));
+        test_bind (sb, socket_address);
+        test_connect (sc, socket_address);
+
+        test_deflate_exchange (sc, sb, text);
+        test_deflate_exchange (sb, sc, text);
+        test_deflate_exchange (sc, sb, random);
+        test_deflate_exchange (sb, sc, random);
+
+        /*  Compressed text messages are validated as a whole. */
+        opt = NN_WS_MSG_TYPE_TEXT;
+        test_setsockopt (sb, NN_WS, NN_WS_MSG_TYPE, &opt, sizeof (opt));
+        test_setsockopt (sc, NN_WS, NN_WS_MSG_TYPE, &opt, sizeof (opt));
+        test_send (sc, "0123456789012345678901234567890\xc3\xa9"
+            "012345678901234\xe2\x82\xac" "0123456789012345\xf0\x9f\x98\x80.");
+        test_recv (sb, "0123456789012345678901234567890\xc3\xa9"
+            "012345678901234\xe2\x82\xac" "0123456789012345\xf0\x9f\x98\x80.");
+        test_send (sb, "GOOD");
+        test_recv (sc, "GOOD");
+
+        test_close (sc);
+        test_close (sb);
+    }
+
+    /*  NN_RCVMAXSIZE applies to the decompressed messages. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    sc = test_socket (AF_SP, NN_PAIR);
+    opt = 1;
+    test_setsockopt (sb, NN_WS, NN_WS_DEFLATE, &opt, sizeof (opt));
+    test_setsockopt (sc, NN_WS, NN_WS_DEFLATE, &opt, sizeof (opt));
+    opt = 1000;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    opt = 500;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    test_connect (sc, socket_address);
+    rc = nn_send (sc, text, 1000, 0);
+    errno_assert (rc == 1000);
+    rc = nn_recv (sb, random, 1000, 0);
+    errno_assert (rc == 1000);
+    nn_assert (memcmp (random, text, 1000) == 0);
+    rc = nn_send (sc, text, 1001, 0);
+    errno_assert (rc == 1001);
+    test_drop (sb, ETIMEDOUT);
+    test_close (sc);
+    test_close (sb);
+
+    free (random);
+    free (text);
+}
+
+/*  test_handshakes() connects several clients at once. The handshake
+    limit is set to one, so they have to take turns. */
+void test_handshakes ()
+{
+    int sb;
+    int sc [NN_HANDSHAKE_CLIENTS];
+    int i;
+
+    sb = test_socket (AF_SP, NN_PULL);
+    test_bind (sb, socket_address);
+    for (i = 0; i != NN_HANDSHAKE_CLIENTS; ++i) {
+        sc [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (sc [i], socket_address);
+    }
+    for (i = 0; i != NN_HANDSHAKE_CLIENTS; ++i)
+        test_send (sc [i], "ABC");
+    for (i = 0; i != NN_HANDSHAKE_CLIENTS; ++i)
+        test_recv (sb, "ABC");
+    for (i = 0; i != NN_HANDSHAKE_CLIENTS; ++i)
+        test_close (sc [i]);
+    test_close (sb);
+}
+
 int main (int argc, const char *argv[])
 {
     int rc;
@@ -84,6 +403,15 @@ int main (int argc, const char *argv[])
     int i;
     char any_address[128];
 
+    /*  Allow only one opening handshake at a time so that the tests with
+        many clients exercise the throttling as well. */
+#if defined _WIN32
+    rc = _putenv ("NN_WS_HANDSHAKE_MAX=1");
+#else
+    rc = setenv ("NN_WS_HANDSHAKE_MAX", "1", 1);
+#endif
+    errno_assert (rc == 0);
+
     test_addr_from (socket_address, "ws", "127.0.0.1",
             get_test_port (argc, argv));
 
@@ -243,6 +571,14 @@ int main (int argc, const char *argv[])
 
     test_text ();
 
+    test_masking ();
+
+    test_burst ();
+
+    test_handshakes ();
+
+    test_deflate ();
+
     /*  Test closing a socket that is waiting to connect. */
     sc = test_socket (AF_SP, NN_PAIR);
     test_connect (sc, socket_address);
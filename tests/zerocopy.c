@@ -22,22 +22,12 @@
 */
 
 #include "../src/nn.h"
+#include "../src/pair.h"
 #include "../src/pubsub.h"
 #include "../src/reqrep.h"
 
 #include "testutil.h"
 
-/*
- * Nanomsg never zero copies anymore - it used to be an attribute of
- * the inproc transport, but frankly its a mistake for anyone to depend
- * on that.  The implementation must be free to copy, move data, etc.
- * The only thing that should be guaranteed is that the "ownership" of the
- * message on send is passed to libnanomsg.  libnanomsg may give that message
- * to an inproc receiver, or it can do something else (like copy the data)
- * with it.
- */
-#if 0
-
 #include <string.h>
 
 void test_allocmsg_reqrep ()
@@ -202,15 +192,128 @@ void test_reallocmsg_pubsub ()
     nn_close (sub1);
     nn_close (pub);
 }
-#endif
+void test_inproc_pair ()
+{
+    int rc;
+    int sb;
+    int sc;
+    void *p;
+    void *p2;
+    const void *b;
+    char buf [3];
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, "inproc://test");
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, "inproc://test");
+
+    /*  Without a protocol header, the chunk travels from the sender to the
+        receiver as it is. */
+    p = nn_allocmsg (10000, 0);
+    nn_assert (p);
+    memset (p, 'A', 10000);
+    rc = nn_send (sc, &p, NN_MSG, 0);
+    errno_assert (rc == 10000);
+    rc = nn_recv (sb, &p2, NN_MSG, 0);
+    errno_assert (rc == 10000);
+    nn_assert (p2 == p);
+
+    /*  Borrowed receive lends the chunk to the user till the next call. */
+    rc = nn_send (sc, &p, NN_MSG, 0);
+    errno_assert (rc == 10000);
+    rc = nn_recvborrow (sb, &b, 0);
+    errno_assert (rc == 10000);
+    nn_assert (b == p);
+
+    test_send (sc, "ABC");
+    rc = nn_recvborrow (sb, &b, 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (b, "ABC", 3) == 0);
+
+    /*  The borrowed message is given up even if the call fails. */
+    rc = nn_recvborrow (sb, &b, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recvborrow (sb, NULL, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    /*  Socket closed with a message borrowed. */
+    test_send (sc, "ABC");
+    rc = nn_recvborrow (sb, &b, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_close (sc);
+    test_close (sb);
+}
+
+void test_reserve_reqrep ()
+{
+    int rc;
+    int req;
+    int rep;
+    void *p;
+    void *p2;
+
+    /*  The tailroom allows the message to grow in place. */
+    p = nn_allocmsg_reserve (100, 16, 100, 0);
+    nn_assert (p);
+    memset (p, 'A', 100);
+    p2 = nn_reallocmsg (p, 200);
+    nn_assert (p2 == p);
+    p2 = nn_reallocmsg (p, 1000);
+    nn_assert (p2);
+    nn_assert (memcmp (p2, "AAAA", 4) == 0);
+    rc = nn_freemsg (p2);
+    errno_assert (rc == 0);
+
+    req = test_socket (AF_SP, NN_REQ);
+    test_bind (req, "inproc://test");
+    rep = test_socket (AF_SP, NN_REP);
+    test_connect (rep, "inproc://test");
+
+    test_send (req, "ABC");
+    test_recv (rep, "ABC");
+
+    /*  The reply's backtrace is put into the headroom, so the reply crosses
+        inproc without being copied. */
+    p = nn_allocmsg_reserve (1000, 16, 0, 0);
+    nn_assert (p);
+    memset (p, 'B', 1000);
+    rc = nn_send (rep, &p, NN_MSG, 0);
+    errno_assert (rc == 1000);
+    rc = nn_recv (req, &p2, NN_MSG, 0);
+    errno_assert (rc == 1000);
+    nn_assert (p2 == p);
+    nn_assert (memcmp (p2, "BBBB", 4) == 0);
+    rc = nn_freemsg (p2);
+    errno_assert (rc == 0);
+
+    /*  Without the headroom the reply gets copied. */
+    test_send (req, "ABC");
+    test_recv (rep, "ABC");
+    p = nn_allocmsg (1000, 0);
+    nn_assert (p);
+    memset (p, 'C', 1000);
+    rc = nn_send (rep, &p, NN_MSG, 0);
+    errno_assert (rc == 1000);
+    rc = nn_recv (req, &p2, NN_MSG, 0);
+    errno_assert (rc == 1000);
+    nn_assert (memcmp (p2, "CCCC", 4) == 0);
+    rc = nn_freemsg (p2);
+    errno_assert (rc == 0);
+
+    test_close (rep);
+    test_close (req);
+}
 
 int main ()
 {
-#if 0
     test_allocmsg_reqrep ();
     test_reallocmsg_reqrep ();
     test_reallocmsg_pubsub ();
-#endif
+    test_inproc_pair ();
+    test_reserve_reqrep ();
     return 0;
 }
 
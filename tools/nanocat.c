@@ -32,6 +32,7 @@
 #include "options.h"
 #include "../src/utils/sleep.c"
 #include "../src/utils/clock.c"
+#include "../src/utils/thread.c"
 
 #include <stdio.h>
 #include <string.h>
@@ -39,8 +40,14 @@
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
-#if !defined NN_HAVE_WINDOWS
+#if defined NN_HAVE_WINDOWS
+#include "../src/utils/win.h"
+#else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #endif
 
 enum echo_format {
@@ -69,9 +76,17 @@ typedef struct nn_options {
     float send_delay;
     float send_interval;
     struct nn_blob data_to_send;
+    char *replay_path;
+    float replay_rate;
+    long replay_threads;
 
     /* Input options */
     enum echo_format echo_format;
+    char *capture_path;
+
+    /* Measurement options */
+    float stats_interval;
+    int timestamp;
 } nn_options_t;
 
 /*  Constants to get address of in option declaration  */
@@ -126,6 +141,7 @@ struct nn_enum_item echo_formats[] = {
 #define NN_MASK_SOCK_SUB 8
 #define NN_MASK_DATA 16
 #define NN_MASK_ENDPOINT 32
+#define NN_MASK_REPLAY 64
 #define NN_NO_PROVIDES 0
 #define NN_NO_CONFLICTS 0
 #define NN_NO_REQUIRES 0
@@ -272,6 +288,11 @@ struct nn_option nn_options[] = {
      NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_MASK_READABLE,
      "Input Options", NULL, "Print each message on separate line in double "
                            "quotes with hex values"},
+    {"capture", 0, NULL,
+     NN_OPT_STRING, offsetof (nn_options_t, capture_path), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_MASK_READABLE,
+     "Input Options", "PATH", "Record the messages received along with "
+     "the time of their arrival to the log PATH, for use with --replay"},
     /* Output Options */
     {"interval", 'i', NULL,
      NN_OPT_FLOAT, offsetof (nn_options_t, send_interval), NULL,
@@ -292,6 +313,36 @@ struct nn_option nn_options[] = {
      NN_OPT_READ_FILE, offsetof (nn_options_t, data_to_send), &echo_formats,
      NN_MASK_DATA, NN_MASK_DATA, NN_MASK_WRITEABLE,
      "Output Options", "PATH", "Same as --data but get data from file PATH"},
+    {"replay", 0, NULL,
+     NN_OPT_STRING, offsetof (nn_options_t, replay_path), NULL,
+     NN_MASK_DATA | NN_MASK_REPLAY, NN_MASK_DATA, NN_MASK_WRITEABLE,
+     "Output Options", "PATH", "Send the messages recorded in the log PATH "
+     "by --capture, keeping their original timing, and quit. Only for PUB, "
+     "PUSH, PAIR and BUS sockets"},
+    {"replay-rate", 0, NULL,
+     NN_OPT_FLOAT, offsetof (nn_options_t, replay_rate), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_MASK_REPLAY,
+     "Output Options", "FACTOR", "Replay FACTOR times faster than recorded. "
+     "Zero replays as fast as possible"},
+    {"replay-threads", 0, NULL,
+     NN_OPT_INT, offsetof (nn_options_t, replay_threads), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_MASK_REPLAY,
+     "Output Options", "NUM", "Replay using NUM threads, each sending "
+     "every NUM-th message of the log"},
+
+    /* Measurement Options */
+    {"stats", 0, NULL,
+     NN_OPT_FLOAT, offsetof (nn_options_t, stats_interval), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_NO_REQUIRES,
+     "Measurement Options", "SEC", "Print the rate, bandwidth and "
+     "inter-arrival jitter of the messages sent and received to stderr every "
+     "SEC seconds"},
+    {"timestamp", 0, NULL,
+     NN_OPT_INCREMENT, offsetof (nn_options_t, timestamp), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_NO_REQUIRES,
+     "Measurement Options", NULL, "Prefix the messages sent with the time "
+     "of sending and report the one-way latency of the messages received. "
+     "Both peers must use this option and have synchronized clocks."},
 
     /* Sentinel */
     {NULL, 0, NULL,
@@ -454,6 +505,512 @@ void nn_print_message (nn_options_t *options, char *buf, int buflen)
     fflush (stdout);
 }
 
+/*  Size of the timestamp prepended to messages by --timestamp.  */
+#define NN_TIMESTAMP_SIZE 8
+
+struct nn_meter {
+    const char *name;
+
+    /*  Beginning of the current reporting period.  */
+    uint64_t start;
+
+    /*  Messages and bytes seen during the period.  */
+    uint64_t msgs;
+    uint64_t bytes;
+
+    /*  Arrival of the last message and the gap preceding it.  */
+    uint64_t last;
+    uint64_t lastgap;
+
+    /*  Inter-arrival jitter, estimated as in RFC 3550.  */
+    double jitter;
+
+    /*  One-way latencies seen during the period.  */
+    uint64_t latencies;
+    uint64_t latency_sum;
+    uint64_t latency_min;
+    uint64_t latency_max;
+};
+
+static struct nn_meter nn_sent = {"sent"};
+static struct nn_meter nn_received = {"received"};
+
+/*  Wall-clock time in microseconds. Unlike nn_clock_us it's comparable
+    between machines, provided that their clocks are synchronized.  */
+uint64_t nn_wallclock_us (void)
+{
+#if defined NN_HAVE_WINDOWS
+    FILETIME ft;
+    uint64_t t;
+
+    GetSystemTimeAsFileTime (&ft);
+    t = ((uint64_t) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return t / 10;
+#else
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+void nn_meter_report (nn_options_t *options, struct nn_meter *meter,
+    uint64_t now)
+{
+    double elapsed;
+
+    elapsed = (double) (now - meter->start) / 1000000;
+    if (elapsed <= 0)
+        return;
+    fprintf (stderr, "%s: %.0f msg/s, %.3f MB/s, jitter %.1f us",
+        meter->name, meter->msgs / elapsed,
+        meter->bytes / elapsed / 1000000, meter->jitter);
+    if (meter->latencies) {
+        fprintf (stderr, ", latency min %llu avg %llu max %llu us",
+            (unsigned long long) meter->latency_min,
+            (unsigned long long) (meter->latency_sum / meter->latencies),
+            (unsigned long long) meter->latency_max);
+    }
+    fprintf (stderr, "\n");
+    fflush (stderr);
+
+    meter->start = now;
+    meter->msgs = 0;
+    meter->bytes = 0;
+    meter->latencies = 0;
+    meter->latency_sum = 0;
+    meter->latency_min = 0;
+    meter->latency_max = 0;
+}
+
+/*  Accounts for a message. 'latency' is negative if it's not known.  */
+void nn_meter_update (nn_options_t *options, struct nn_meter *meter,
+    size_t bytes, int64_t latency)
+{
+    uint64_t now;
+    uint64_t gap;
+    int64_t diff;
+
+    if (options->stats_interval <= 0)
+        return;
+
+    now = nn_clock_us ();
+    if (!meter->start)
+        meter->start = now;
+    ++meter->msgs;
+    meter->bytes += bytes;
+    if (meter->last) {
+        gap = now - meter->last;
+        if (meter->lastgap) {
+            diff = (int64_t) gap - (int64_t) meter->lastgap;
+            if (diff < 0)
+                diff = -diff;
+            meter->jitter += ((double) diff - meter->jitter) / 16;
+        }
+        meter->lastgap = gap;
+    }
+    meter->last = now;
+    if (latency >= 0) {
+        if (!meter->latencies || (uint64_t) latency < meter->latency_min)
+            meter->latency_min = latency;
+        if ((uint64_t) latency > meter->latency_max)
+            meter->latency_max = latency;
+        meter->latency_sum += latency;
+        ++meter->latencies;
+    }
+
+    if (now - meter->start >= (uint64_t) (options->stats_interval * 1000000))
+        nn_meter_report (options, meter, now);
+}
+
+int nn_send_data (nn_options_t *options, int sock)
+{
+    int rc;
+    uint64_t now;
+    int i;
+
+    /*  The space for the timestamp was reserved in front of the data.  */
+    if (options->timestamp) {
+        now = nn_wallclock_us ();
+        for (i = NN_TIMESTAMP_SIZE - 1; i >= 0; --i) {
+            options->data_to_send.data [i] = (char) (now & 0xff);
+            now >>= 8;
+        }
+    }
+    rc = nn_send (sock,
+        options->data_to_send.data, options->data_to_send.length,
+        0);
+    if (rc >= 0)
+        nn_meter_update (options, &nn_sent, rc, -1);
+    return rc;
+}
+
+/*  The capture log starts with NN_CAPTURE_MAGIC, followed by a record per
+    message: the time elapsed since the previous message in microseconds
+    and the size of the message plus one, both 32-bit big-endian, then
+    the message itself. The log is written through a memory mapping and
+    the file is grown ahead of the records, zero-filled. As zero size marks
+    the end of the log, it remains valid even if nanocat is interrupted
+    while capturing.  */
+#define NN_CAPTURE_MAGIC "NNCAP\0\0\1"
+#define NN_CAPTURE_MAGIC_SIZE 8
+#define NN_CAPTURE_HDR_SIZE 8
+#define NN_CAPTURE_GROWTH (1024 * 1024)
+
+struct nn_capture {
+#if defined NN_HAVE_WINDOWS
+    FILE *file;
+#else
+    int fd;
+    uint8_t *map;
+    size_t mapsize;
+#endif
+    size_t pos;
+    uint64_t last;
+};
+
+static struct nn_capture nn_capture = {0};
+
+static void nn_putbe32 (uint8_t *buf, uint32_t val)
+{
+    buf [0] = (uint8_t) (val >> 24);
+    buf [1] = (uint8_t) (val >> 16);
+    buf [2] = (uint8_t) (val >> 8);
+    buf [3] = (uint8_t) val;
+}
+
+static uint32_t nn_getbe32 (const uint8_t *buf)
+{
+    return ((uint32_t) buf [0] << 24) | ((uint32_t) buf [1] << 16) |
+        ((uint32_t) buf [2] << 8) | buf [3];
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  Makes sure that there are at least 'size' bytes mapped past the current
+    position in the log.  */
+static void nn_capture_reserve (size_t size)
+{
+    int rc;
+    size_t mapsize;
+
+    if (nn_capture.map && nn_capture.pos + size <= nn_capture.mapsize)
+        return;
+    mapsize = nn_capture.mapsize * 2;
+    if (mapsize < nn_capture.pos + size + NN_CAPTURE_GROWTH)
+        mapsize = nn_capture.pos + size + NN_CAPTURE_GROWTH;
+    if (nn_capture.map)
+        munmap (nn_capture.map, nn_capture.mapsize);
+    rc = ftruncate (nn_capture.fd, (off_t) mapsize);
+    nn_assert_errno (rc == 0, "Can't extend the capture log");
+    nn_capture.map = mmap (NULL, mapsize, PROT_READ | PROT_WRITE,
+        MAP_SHARED, nn_capture.fd, 0);
+    nn_assert_errno (nn_capture.map != MAP_FAILED, "Can't map the capture log");
+    nn_capture.mapsize = mapsize;
+}
+
+#endif
+
+static void nn_capture_write (const void *data, size_t size)
+{
+#if defined NN_HAVE_WINDOWS
+    size_t rc;
+
+    rc = fwrite (data, 1, size, nn_capture.file);
+    nn_assert_errno (rc == size, "Can't write the capture log");
+#else
+    nn_capture_reserve (size);
+    memcpy (nn_capture.map + nn_capture.pos, data, size);
+#endif
+    nn_capture.pos += size;
+}
+
+void nn_capture_open (nn_options_t *options)
+{
+    if (!options->capture_path)
+        return;
+#if defined NN_HAVE_WINDOWS
+    nn_capture.file = fopen (options->capture_path, "wb");
+    nn_assert_errno (nn_capture.file != NULL, "Can't open the capture log");
+#else
+    nn_capture.fd = open (options->capture_path,
+        O_RDWR | O_CREAT | O_TRUNC, 0644);
+    nn_assert_errno (nn_capture.fd >= 0, "Can't open the capture log");
+#endif
+    nn_capture_write (NN_CAPTURE_MAGIC, NN_CAPTURE_MAGIC_SIZE);
+}
+
+/*  Appends a message to the capture log.  */
+void nn_capture_record (nn_options_t *options, const char *buf, size_t buflen)
+{
+    uint64_t now;
+    uint64_t gap;
+    uint8_t hdr [NN_CAPTURE_HDR_SIZE];
+
+    if (!options->capture_path)
+        return;
+
+    /*  The gaps longer than the 32-bit field can hold (more than an hour)
+        are shortened.  */
+    now = nn_clock_us ();
+    gap = nn_capture.last ? now - nn_capture.last : 0;
+    nn_capture.last = now;
+    if (gap > 0xffffffff)
+        gap = 0xffffffff;
+    nn_assert_errno (buflen < 0xffffffff, "Message too large to capture");
+    nn_putbe32 (hdr, (uint32_t) gap);
+    nn_putbe32 (hdr + 4, (uint32_t) buflen + 1);
+#if !defined NN_HAVE_WINDOWS
+    nn_capture_reserve (NN_CAPTURE_HDR_SIZE + buflen);
+#endif
+    nn_capture_write (hdr, NN_CAPTURE_HDR_SIZE);
+    nn_capture_write (buf, buflen);
+#if defined NN_HAVE_WINDOWS
+    fflush (nn_capture.file);
+#endif
+}
+
+void nn_capture_close (nn_options_t *options)
+{
+    int rc;
+
+    if (!options->capture_path)
+        return;
+#if defined NN_HAVE_WINDOWS
+    rc = fclose (nn_capture.file);
+    nn_assert_errno (rc == 0, "Can't close the capture log");
+#else
+    munmap (nn_capture.map, nn_capture.mapsize);
+    rc = ftruncate (nn_capture.fd, (off_t) nn_capture.pos);
+    nn_assert_errno (rc == 0, "Can't truncate the capture log");
+    close (nn_capture.fd);
+#endif
+}
+
+/*  State shared by the replay threads.  */
+struct nn_replay {
+    nn_options_t *options;
+    int sock;
+    const uint8_t *log;
+    size_t logsize;
+    uint64_t start;
+};
+
+struct nn_replay_thread {
+    struct nn_replay *replay;
+    struct nn_thread thread;
+    int index;
+    uint64_t msgs;
+    uint64_t bytes;
+};
+
+/*  Sends every n-th message of the log, starting with the index-th one.
+    Each of them is sent when it's due with respect to the start of the
+    replay, so that the threads jointly follow the recorded timing.  */
+static void nn_replay_routine (void *arg)
+{
+    struct nn_replay_thread *self;
+    struct nn_replay *replay;
+    nn_options_t *options;
+    size_t pos;
+    size_t size;
+    uint64_t elapsed;
+    uint64_t due;
+    uint64_t now;
+    uint64_t stamp;
+    long n;
+    char *msg;
+    int rc;
+    int i;
+
+    self = (struct nn_replay_thread*) arg;
+    replay = self->replay;
+    options = replay->options;
+    pos = NN_CAPTURE_MAGIC_SIZE;
+    elapsed = 0;
+    for (n = 0; pos + NN_CAPTURE_HDR_SIZE <= replay->logsize; ++n) {
+        size = nn_getbe32 (replay->log + pos + 4);
+        if (size == 0)
+            break;
+        --size;
+        elapsed += nn_getbe32 (replay->log + pos);
+        pos += NN_CAPTURE_HDR_SIZE;
+        if (pos + size > replay->logsize) {
+            fprintf (stderr, "Capture log is truncated\n");
+            break;
+        }
+        if (n % options->replay_threads != self->index) {
+            pos += size;
+            continue;
+        }
+
+        if (options->replay_rate > 0) {
+            due = replay->start +
+                (uint64_t) ((double) elapsed / options->replay_rate);
+            now = nn_clock_us ();
+            if (due > now + 1000)
+                nn_sleep ((int) ((due - now) / 1000));
+        }
+
+        /*  The message is copied to a buffer of its own, leaving space for
+            the timestamp, if required.  */
+        msg = nn_allocmsg (size +
+            (options->timestamp ? NN_TIMESTAMP_SIZE : 0), 0);
+        nn_assert_errno (msg != NULL, "Can't allocate message");
+        if (options->timestamp) {
+            stamp = nn_wallclock_us ();
+            for (i = NN_TIMESTAMP_SIZE - 1; i >= 0; --i) {
+                msg [i] = (char) (stamp & 0xff);
+                stamp >>= 8;
+            }
+            memcpy (msg + NN_TIMESTAMP_SIZE, replay->log + pos, size);
+        }
+        else
+            memcpy (msg, replay->log + pos, size);
+        pos += size;
+
+        rc = nn_send (replay->sock, &msg, NN_MSG, 0);
+        if (rc < 0 && errno == EAGAIN) {
+            nn_freemsg (msg);
+            fprintf (stderr, "Message not sent (EAGAIN)\n");
+            continue;
+        }
+        nn_assert_errno (rc >= 0, "Can't send");
+        ++self->msgs;
+        self->bytes += rc;
+        if (options->replay_threads == 1)
+            nn_meter_update (options, &nn_sent, rc, -1);
+    }
+}
+
+void nn_replay_check (nn_options_t *options)
+{
+    switch (options->socket_type) {
+    case NN_PUB:
+    case NN_PUSH:
+    case NN_PAIR:
+    case NN_BUS:
+        break;
+    default:
+        fprintf (stderr, "Replay is supported only by PUB, PUSH, PAIR "
+            "and BUS sockets\n");
+        exit (1);
+    }
+    if (options->replay_rate < 0 || options->replay_threads < 1) {
+        fprintf (stderr, "Invalid replay rate or number of threads\n");
+        exit (1);
+    }
+}
+
+void nn_replay_loop (nn_options_t *options, int sock)
+{
+    struct nn_replay replay;
+    struct nn_replay_thread *threads;
+    uint64_t msgs;
+    uint64_t bytes;
+    double elapsed;
+    long i;
+#if defined NN_HAVE_WINDOWS
+    FILE *file;
+    long size;
+#else
+    int fd;
+    struct stat st;
+    int rc;
+#endif
+
+    /*  Get the whole log into memory.  */
+#if defined NN_HAVE_WINDOWS
+    file = fopen (options->replay_path, "rb");
+    nn_assert_errno (file != NULL, "Can't open the capture log");
+    fseek (file, 0, SEEK_END);
+    size = ftell (file);
+    fseek (file, 0, SEEK_SET);
+    nn_assert_errno (size >= 0, "Can't read the capture log");
+    replay.logsize = (size_t) size;
+    replay.log = malloc (replay.logsize ? replay.logsize : 1);
+    nn_assert_errno (replay.log != NULL, "Can't allocate memory");
+    nn_assert_errno (fread ((void*) replay.log, 1, replay.logsize, file) ==
+        replay.logsize, "Can't read the capture log");
+    fclose (file);
+#else
+    fd = open (options->replay_path, O_RDONLY);
+    nn_assert_errno (fd >= 0, "Can't open the capture log");
+    rc = fstat (fd, &st);
+    nn_assert_errno (rc == 0, "Can't read the capture log");
+    replay.logsize = (size_t) st.st_size;
+    replay.log = NULL;
+    if (replay.logsize) {
+        replay.log = mmap (NULL, replay.logsize, PROT_READ, MAP_PRIVATE,
+            fd, 0);
+        nn_assert_errno (replay.log != MAP_FAILED,
+            "Can't map the capture log");
+    }
+    close (fd);
+#endif
+    if (replay.logsize < NN_CAPTURE_MAGIC_SIZE ||
+          memcmp (replay.log, NN_CAPTURE_MAGIC, NN_CAPTURE_MAGIC_SIZE) != 0) {
+        fprintf (stderr, "%s is not a capture log\n", options->replay_path);
+        exit (1);
+    }
+
+    replay.options = options;
+    replay.sock = sock;
+    threads = calloc (options->replay_threads,
+        sizeof (struct nn_replay_thread));
+    nn_assert_errno (threads != NULL, "Can't allocate memory");
+    replay.start = nn_clock_us ();
+    for (i = 0; i != options->replay_threads; ++i) {
+        threads [i].replay = &replay;
+        threads [i].index = (int) i;
+        nn_thread_init (&threads [i].thread, nn_replay_routine, &threads [i]);
+    }
+    msgs = 0;
+    bytes = 0;
+    for (i = 0; i != options->replay_threads; ++i) {
+        nn_thread_term (&threads [i].thread);
+        msgs += threads [i].msgs;
+        bytes += threads [i].bytes;
+    }
+    elapsed = (double) (nn_clock_us () - replay.start) / 1000000;
+
+    if (options->verbose > 0) {
+        fprintf (stderr, "replayed %llu messages, %llu bytes in %.3f s\n",
+            (unsigned long long) msgs, (unsigned long long) bytes, elapsed);
+    }
+
+    free (threads);
+#if defined NN_HAVE_WINDOWS
+    free ((void*) replay.log);
+#else
+    if (replay.logsize)
+        munmap ((void*) replay.log, replay.logsize);
+#endif
+}
+
+void nn_handle_message (nn_options_t *options, char *buf, int buflen)
+{
+    uint64_t sent;
+    uint64_t now;
+    int i;
+
+    sent = 0;
+    if (options->timestamp && buflen >= NN_TIMESTAMP_SIZE) {
+        for (i = 0; i != NN_TIMESTAMP_SIZE; ++i)
+            sent = (sent << 8) | (unsigned char) buf [i];
+        now = nn_wallclock_us ();
+        nn_meter_update (options, &nn_received, buflen,
+            now > sent ? (int64_t) (now - sent) : 0);
+        buf += NN_TIMESTAMP_SIZE;
+        buflen -= NN_TIMESTAMP_SIZE;
+    }
+    else {
+        nn_meter_update (options, &nn_received, buflen, -1);
+    }
+    nn_capture_record (options, buf, buflen);
+    nn_print_message (options, buf, buflen);
+}
+
 void nn_connect_socket (nn_options_t *options, int sock)
 {
     int i;
@@ -479,9 +1036,7 @@ void nn_send_loop (nn_options_t *options, int sock)
 
     for (;;) {
         start_time = nn_clock_ms();
-        rc = nn_send (sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
+        rc = nn_send_data (options, sock);
         if (rc < 0 && errno == EAGAIN) {
             fprintf (stderr, "Message not sent (EAGAIN)\n");
         } else {
@@ -512,7 +1067,7 @@ void nn_recv_loop (nn_options_t *options, int sock)
         } else {
             nn_assert_errno (rc >= 0, "Can't recv");
         }
-        nn_print_message (options, buf, rc);
+        nn_handle_message (options, buf, rc);
         nn_freemsg (buf);
     }
 }
@@ -529,9 +1084,7 @@ void nn_rw_loop (nn_options_t *options, int sock)
 
     for (;;) {
         start_time = nn_clock_ms();
-        rc = nn_send (sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
+        rc = nn_send_data (options, sock);
         if (rc < 0 && errno == EAGAIN) {
             fprintf (stderr, "Message not sent (EAGAIN)\n");
         } else {
@@ -564,7 +1117,7 @@ void nn_rw_loop (nn_options_t *options, int sock)
                 }
             }
             nn_assert_errno (rc >= 0, "Can't recv");
-            nn_print_message (options, buf, rc);
+            nn_handle_message (options, buf, rc);
             nn_freemsg (buf);
         }
     }
@@ -582,11 +1135,9 @@ void nn_resp_loop (nn_options_t *options, int sock)
         } else {
             nn_assert_errno (rc >= 0, "Can't recv");
         }
-        nn_print_message (options, buf, rc);
+        nn_handle_message (options, buf, rc);
         nn_freemsg (buf);
-        rc = nn_send (sock,
-            options->data_to_send.data, options->data_to_send.length,
-            0);
+        rc = nn_send_data (options, sock);
         if (rc < 0 && errno == EAGAIN) {
             fprintf (stderr, "Message not sent (EAGAIN)\n");
         } else {
@@ -610,17 +1161,44 @@ int main (int argc, char **argv)
         /* send_delay        */ 0.f,
         /* send_interval     */ -1.f,
         /* data_to_send      */ {NULL, 0, 0},
-        /* echo_format       */ NN_NO_ECHO
+        /* replay_path       */ NULL,
+        /* replay_rate       */ 1.f,
+        /* replay_threads    */ 1,
+        /* echo_format       */ NN_NO_ECHO,
+        /* capture_path      */ NULL,
+        /* stats_interval    */ -1.f,
+        /* timestamp         */ 0
     };
+    char *data;
 
     nn_parse_options (&nn_cli, &options, argc, argv);
+    if (options.replay_path)
+        nn_replay_check (&options);
+
+    /*  Reserve space for the timestamp in front of the data to send.  */
+    if (options.timestamp && options.data_to_send.data) {
+        data = malloc (NN_TIMESTAMP_SIZE + options.data_to_send.length);
+        nn_assert_errno (data != NULL, "Can't allocate memory");
+        memcpy (data + NN_TIMESTAMP_SIZE, options.data_to_send.data,
+            options.data_to_send.length);
+        if (options.data_to_send.need_free)
+            free (options.data_to_send.data);
+        options.data_to_send.data = data;
+        options.data_to_send.length += NN_TIMESTAMP_SIZE;
+        options.data_to_send.need_free = 1;
+    }
     sock = nn_create_socket (&options);
     nn_connect_socket (&options, sock);
+    nn_capture_open (&options);
     nn_sleep((int)(options.send_delay*1000));
     switch (options.socket_type) {
     case NN_PUB:
     case NN_PUSH:
-        nn_send_loop (&options, sock);
+        if (options.replay_path) {
+            nn_replay_loop (&options, sock);
+        } else {
+            nn_send_loop (&options, sock);
+        }
         break;
     case NN_SUB:
     case NN_PULL:
@@ -628,7 +1206,9 @@ int main (int argc, char **argv)
         break;
     case NN_BUS:
     case NN_PAIR:
-        if (options.data_to_send.data) {
+        if (options.replay_path) {
+            nn_replay_loop (&options, sock);
+        } else if (options.data_to_send.data) {
             nn_rw_loop (&options, sock);
         } else {
             nn_recv_loop (&options, sock);
@@ -648,6 +1228,7 @@ int main (int argc, char **argv)
         break;
     }
 
+    nn_capture_close (&options);
     nn_close (sock);
     nn_free_options(&nn_cli, &options);
     return 0;